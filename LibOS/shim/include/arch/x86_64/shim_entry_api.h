@@ -17,6 +17,8 @@
 /* Offsets for GS register at which entry vectors can be found */
 #define SHIM_SYSCALLDB_OFFSET         32
 #define SHIM_REGISTER_LIBRARY_OFFSET  40
+/* Offset for GS register of the pointer to the CPU time of the current thread (for the vDSO) */
+#define SHIM_CPUTIME_OFFSET           48
 
 #ifdef __ASSEMBLER__
 
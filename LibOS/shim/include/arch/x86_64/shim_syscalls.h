@@ -49,7 +49,13 @@
 #ifndef __NR_io_uring_register
 #define __NR_io_uring_register 427
 #endif
+#ifndef __NR_close_range
+#define __NR_close_range 436
+#endif
+#ifndef __NR_futex_waitv
+#define __NR_futex_waitv 449
+#endif
 #ifndef __NR_syscalls
-#define __NR_syscalls 428
+#define __NR_syscalls 450
 #endif
 #endif  /* SHIM_SYSCALLS_H_ */
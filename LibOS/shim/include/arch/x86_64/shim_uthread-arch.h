@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * Context switching of user-level threads (see shim_uthread.c). A switched-out context is its stack
+ * pointer, with the callee-saved registers, the FPU control word and MXCSR saved on the stack below
+ * the return address (see uthread.S).
+ */
+
+#ifndef _SHIM_UTHREAD_ARCH_H_
+#define _SHIM_UTHREAD_ARCH_H_
+
+#include <stdint.h>
+
+#include "api.h"
+
+/* Saves the current context in `*old_sp` and resumes the one saved in `new_sp`. */
+void uthread_switch(void** old_sp, void* new_sp);
+/* Entry of new contexts, calls `fn(arg)` (in r13 and r12), which must not return. */
+void uthread_start(void);
+
+/* Prepares a new context below `stack_top`, which calls `fn(arg)` when switched to. */
+static inline void* uthread_init_context(void* stack_top, void (*fn)(void*), void* arg) {
+    uint64_t* sp = (uint64_t*)ALIGN_DOWN_PTR(stack_top, 16) - 8;
+    sp[0] = 0x37f | 0x1f80UL << 32; /* default FPU control word and MXCSR */
+    sp[1] = 0;                      /* r15 */
+    sp[2] = 0;                      /* r14 */
+    sp[3] = (uint64_t)fn;           /* r13 */
+    sp[4] = (uint64_t)arg;          /* r12 */
+    sp[5] = 0;                      /* rbx */
+    sp[6] = 0;                      /* rbp */
+    sp[7] = (uint64_t)&uthread_start;
+    return sp;
+}
+
+#endif /* _SHIM_UTHREAD_ARCH_H_ */
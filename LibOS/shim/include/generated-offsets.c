@@ -2,12 +2,34 @@
 
 #include "generated-offsets-build.h"
 #include "shim_internal.h"
+#include "shim_process.h"
 #include "shim_tcb.h"
+#include "shim_thread.h"
 
 __attribute__((__used__)) static void dummy(void) {
     OFFSET_T(SHIM_TCB_OFF, PAL_TCB, libos_tcb);
     OFFSET_T(SHIM_TCB_LIBOS_STACK_OFF, shim_tcb_t, libos_stack_bottom);
     OFFSET_T(SHIM_TCB_SCRATCH_PC_OFF, shim_tcb_t, syscall_scratch_pc);
+    OFFSET_T(SHIM_TCB_TP_OFF, shim_tcb_t, tp);
+
+    /* fast path of ID syscalls in syscalldb() */
+    OFFSET(SHIM_THREAD_TID_OFF, shim_thread, tid);
+    OFFSET(SHIM_THREAD_UID_OFF, shim_thread, uid);
+    OFFSET(SHIM_THREAD_GID_OFF, shim_thread, gid);
+    OFFSET(SHIM_THREAD_EUID_OFF, shim_thread, euid);
+    OFFSET(SHIM_THREAD_EGID_OFF, shim_thread, egid);
+    OFFSET(SHIM_THREAD_VFORK_OFF, shim_thread, vfork);
+    OFFSET(SHIM_THREAD_FAST_SYSCALLS_OFF, shim_thread, fast_syscalls);
+    DEFINE(SHIM_FAST_SYSCALL_GETPID, FAST_SYSCALL_GETPID);
+    DEFINE(SHIM_FAST_SYSCALL_GETPPID, FAST_SYSCALL_GETPPID);
+    DEFINE(SHIM_FAST_SYSCALL_GETTID, FAST_SYSCALL_GETTID);
+    DEFINE(SHIM_FAST_SYSCALL_GETUID, FAST_SYSCALL_GETUID);
+    DEFINE(SHIM_FAST_SYSCALL_GETEUID, FAST_SYSCALL_GETEUID);
+    DEFINE(SHIM_FAST_SYSCALL_GETGID, FAST_SYSCALL_GETGID);
+    DEFINE(SHIM_FAST_SYSCALL_GETEGID, FAST_SYSCALL_GETEGID);
+    OFFSET(SHIM_PROCESS_PID_OFF, shim_process, pid);
+    OFFSET(SHIM_PROCESS_PPID_OFF, shim_process, ppid);
+    DEFINE(SHIM_LOG_LEVEL_TRACE, LOG_LEVEL_TRACE);
 
     OFFSET_T(PAL_CONTEXT_FPREGS_OFF, struct PAL_CONTEXT, fpregs);
     OFFSET_T(PAL_CONTEXT_MXCSR_OFF, struct PAL_CONTEXT, mxcsr);
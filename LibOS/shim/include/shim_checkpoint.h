@@ -60,6 +60,13 @@ struct shim_mem_entry {
     int prot; /* combination of PAL_PROT_* flags */
 };
 
+/* Contents of each memory entry are sent as a sequence of runs, each preceded by this header. Runs
+ * of all-zero pages carry no data: memory allocated by the receiver is already zeroed. */
+struct shim_mem_run {
+    size_t size;
+    bool zero;
+};
+
 struct shim_palhdl_entry {
     struct shim_palhdl_entry* prev;
     PAL_HANDLE handle;
@@ -327,6 +334,9 @@ struct checkpoint_hdr {
 
     size_t mem_offset;
     size_t mem_entries_cnt;
+    size_t mem_streams_cnt;
+    /* memory is sent in the background, while the child already runs (see `sys.fork_lazy_memory`) */
+    bool lazy_memory;
 
     size_t palhdl_offset;
     size_t palhdl_entries_cnt;
@@ -365,4 +375,57 @@ int create_process_and_send_checkpoint(migrate_func_t migrate_func,
  */
 int receive_checkpoint_and_restore(struct checkpoint_hdr* hdr);
 
+/*!
+ * \brief Create a checkpoint of this process and write it into a file.
+ *
+ * The checkpoint data is written at `offset` of `file`, followed by the contents of memory. Open
+ * PAL handles cannot be written into a file; only host files are allowed and are opened again on
+ * restore.
+ *
+ * \param migrate_func          Migration function defined by the caller.
+ * \param file                  PAL handle of the file.
+ * \param offset                Offset in the file to write the checkpoint at.
+ * \param[out] hdr              Header of the written checkpoint, to be stored by the caller.
+ * \param process_description   Struct describing the process to restore.
+ * \param thread_description    Struct describing main thread of the process to restore.
+ * \param process_ipc_ids       IPC IDs of the process to restore.
+ *
+ * The remaining arguments are passed into the migration function.
+ *
+ * \return  0 on success, negative POSIX error code on failure.
+ */
+int write_checkpoint_to_file(migrate_func_t migrate_func, PAL_HANDLE file, size_t offset,
+                             struct checkpoint_hdr* hdr, struct shim_process* process_description,
+                             struct shim_thread* thread_description,
+                             struct shim_ipc_ids* process_ipc_ids, ...);
+
+/*!
+ * \brief Restore state from a checkpoint written by `write_checkpoint_to_file`.
+ *
+ * Called during initialization, in place of `receive_checkpoint_and_restore`.
+ *
+ * \param file    PAL handle of the file.
+ * \param offset  Offset in the file the checkpoint was written at.
+ * \param hdr     Header of the checkpoint.
+ *
+ * \return  0 on success, negative POSIX error code on failure.
+ */
+int restore_checkpoint_from_file(PAL_HANDLE file, size_t offset, struct checkpoint_hdr* hdr);
+
+int init_fork_streams(void);
+
+/* Lazily restored memory of a forked child (see `sys.fork_lazy_memory`) */
+extern bool g_lazy_memory_pending;
+
+/* Installs the received memory at `addr` if it is not installed yet, returns whether it was. */
+bool handle_lazy_memory_fault(void* addr);
+/* Installs the received memory at `[addr; addr+size)`, for LibOS writes to application memory. */
+void prefault_lazy_memory(void* addr, size_t size);
+/* Installs all received memory, waiting for the rest of it. */
+void finish_lazy_memory(void);
+
+/* Snapshots of an initialized process, see `shim_snapshot.c` */
+int create_snapshot(void);
+int init_snapshot(void);
+
 #endif /* _SHIM_CHECKPOINT_H_ */
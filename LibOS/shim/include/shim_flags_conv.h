@@ -13,6 +13,7 @@
 #define SHIM_FLAGS_CONV_H
 
 #include <asm/fcntl.h>
+#include <linux/fadvise.h>
 #include <linux/fcntl.h>
 #include <linux/mman.h>
 
@@ -48,4 +49,16 @@ static inline int LINUX_OPEN_FLAGS_TO_PAL_OPTIONS(int flags) {
            (flags & O_NONBLOCK ? PAL_OPTION_NONBLOCK : 0);
 }
 
+/* `advice` must be one of the POSIX_FADV_* values except POSIX_FADV_NOREUSE, which has no PAL
+ * counterpart */
+static inline enum PAL_ADVICE LINUX_FADV_TO_PAL_ADVICE(int advice) {
+    switch (advice) {
+        case POSIX_FADV_SEQUENTIAL: return PAL_ADVICE_SEQUENTIAL;
+        case POSIX_FADV_RANDOM:     return PAL_ADVICE_RANDOM;
+        case POSIX_FADV_WILLNEED:   return PAL_ADVICE_WILLNEED;
+        case POSIX_FADV_DONTNEED:   return PAL_ADVICE_DONTNEED;
+        default:                    return PAL_ADVICE_NORMAL;
+    }
+}
+
 #endif /* SHIM_FLAGS_CONV_H */
@@ -19,6 +19,7 @@
 #include "shim_types.h"
 #include "shim_utils.h"
 
+struct fs_lock_file;
 struct shim_handle;
 
 #define FS_POLL_RD 0x01
@@ -40,10 +41,26 @@ struct shim_fs_ops {
     /* write: the content from the file opened as handle */
     ssize_t (*write)(struct shim_handle* hdl, const void* buf, size_t count);
 
+    /* readv, writev: same as read and write, but with several buffers at once (`count` is their
+     * total size); if not provided, readv() and writev() call read and write for each buffer */
+    ssize_t (*readv)(struct shim_handle* hdl, const struct iovec* iov, size_t iov_len,
+                     size_t count);
+    ssize_t (*writev)(struct shim_handle* hdl, const struct iovec* iov, size_t iov_len,
+                      size_t count);
+
     /* mmap: mmap handle to address */
     int (*mmap)(struct shim_handle* hdl, void** addr, size_t size, int prot, int flags,
                 uint64_t offset);
 
+    /* munmap: called before [`addr`, `addr` + `size`), a part of a shared mapping of the handle
+     * with protection `prot` at file offset `offset`, is unmapped or replaced, so that its contents
+     * can be saved */
+    int (*munmap)(struct shim_handle* hdl, void* addr, size_t size, int prot, uint64_t offset);
+
+    /* msync: writes [`addr`, `addr` + `size`), a part of a shared mapping of the handle with
+     * protection `prot` at file offset `offset`, back to the file (if the host doesn't do that) */
+    int (*msync)(struct shim_handle* hdl, void* addr, size_t size, int prot, uint64_t offset);
+
     /* flush: flush out user buffer */
     int (*flush)(struct shim_handle* hdl);
 
@@ -57,6 +74,14 @@ struct shim_fs_ops {
     /* Returns 0 on success, -errno on error */
     int (*truncate)(struct shim_handle* hdl, off_t len);
 
+    /* fallocate: allocate storage for [`offset`, `offset` + `len`) and, unless `keep_size`, extend
+     * the file to its end (`fallocate` with mode 0 or FALLOC_FL_KEEP_SIZE) */
+    int (*fallocate)(struct shim_handle* hdl, off_t offset, off_t len, bool keep_size);
+
+    /* advise: apply a POSIX_FADV_* `advice` (other than POSIX_FADV_NOREUSE) to [`offset`,
+     * `offset` + `len`) of the file, `len` of 0 means up to the end of file (`fadvise64`) */
+    int (*advise)(struct shim_handle* hdl, off_t offset, off_t len, int advice);
+
     /* hstat: get status of the file; `st_ino` will be taken from dentry, if there's one */
     int (*hstat)(struct shim_handle* hdl, struct stat* buf);
 
@@ -89,6 +114,12 @@ struct shim_fs_ops {
     int (*migrate)(void* checkpoint, void** mount_data);
 };
 
+/* readv and writev pass the iovecs to DkStreamReadv() and DkStreamWritev() as they are */
+static_assert(sizeof(struct iovec) == sizeof(PAL_IOVEC)
+                  && offsetof(struct iovec, iov_base) == offsetof(PAL_IOVEC, buffer)
+                  && offsetof(struct iovec, iov_len) == offsetof(PAL_IOVEC, size),
+              "struct iovec must have the layout of PAL_IOVEC");
+
 #define DENTRY_VALID       0x0001 /* this dentry is verified to be valid */
 #define DENTRY_NEGATIVE    0x0002 /* recently deleted or inaccessible */
 #define DENTRY_RECENTLY    0x0004 /* recently used */
@@ -101,6 +132,7 @@ struct shim_fs_ops {
 //#define DENTRY_REACHABLE    0x0400  /* permission checked to be reachable */
 //#define DENTRY_UNREACHABLE  0x0800  /* permission checked to be unreachable */
 #define DENTRY_LISTED      0x1000 /* children in directory listed */
+#define DENTRY_LISTING     0x2000 /* children in directory being listed (`populate_directory`) */
 #define DENTRY_SYNTHETIC   0x4000 /* Auto-generated dentry to connect a mount point in the        \
                                    * manifest to the root, when one or more intermediate          \
                                    * directories do not exist on the underlying FS. The semantics \
@@ -137,6 +169,16 @@ struct shim_dentry {
     LISTP_TYPE(shim_dentry) children; /* These children and siblings link */
     LIST_TYPE(shim_dentry) siblings;
 
+    /* Index of `children` by name hash (chained by `hash_next`), allocated only for directories
+     * with many children; smaller directories are scanned (see `shim_dcache.c`). */
+    struct shim_dentry** children_table;
+    size_t children_table_size;
+    struct shim_dentry* hash_next;
+    HASHTYPE name_hash; /* `hash_strn` of `name` */
+
+    /* time of the failed lookup which made this a negative dentry (see `dentry_negative_cached`) */
+    uint64_t negative_time_us;
+
     struct shim_mount* mounted;
 
     /* file type: S_IFREG, S_IFDIR, S_IFLNK etc. */
@@ -147,6 +189,9 @@ struct shim_dentry {
 
     void* data;
 
+    /* POSIX locks on the file, see fs/shim_fs_lock.c (protected by the lock there) */
+    struct fs_lock_file* fs_lock;
+
     struct shim_lock lock;
     REFTYPE ref_count;
 };
@@ -252,6 +297,22 @@ struct shim_mount {
     void* cpdata;
     size_t cpsize;
 
+    /* How long negative dentries (failed lookups) are kept and trusted: 0 means until they are
+     * unused (default), `NEGATIVE_TTL_INFINITE` means forever (immutable mounts). */
+    uint64_t negative_ttl_us;
+    /* files under the mount never change (`fs.mount.<id>.immutable`), so cached file attributes
+     * never expire and are inherited by child processes */
+    bool immutable;
+    /* size of per-handle write-behind buffers (`fs.mount.<id>.write_behind`), 0 if disabled */
+    size_t write_behind_size;
+    /* tmpfs: limit on memory taken by file data (`fs.mount.<id>.size`), 0 if unlimited, and memory
+     * currently taken */
+    uint64_t size_limit;
+    uint64_t used_size;
+    /* lookups answered by the dcache / passed to the filesystem, see `print_mount_stats` */
+    uint64_t lookup_hits;
+    uint64_t lookup_misses;
+
     REFTYPE ref_count;
     LIST_TYPE(shim_mount) hlist;
     LIST_TYPE(shim_mount) list;
@@ -296,6 +357,11 @@ struct shim_mount* find_mount_from_uri(const char* uri);
 
 int walk_mounts(int (*walk)(struct shim_mount* mount, void* arg), void* arg);
 
+#define NEGATIVE_TTL_INFINITE UINT64_MAX
+
+/* Print per-mount dcache hit/miss counters (at the debug log level). */
+void print_mount_stats(void);
+
 /* functions for dcache supports */
 int init_dcache(void);
 
@@ -311,6 +377,32 @@ extern struct shim_lock g_dcache_lock;
  */
 void dump_dcache(struct shim_dentry* dent);
 
+/*!
+ * \brief Check if a negative dentry is still cached
+ *
+ * \param dent a valid negative dentry
+ *
+ * Returns true if the failed lookup of `dent` can be still trusted without asking the filesystem
+ * again, and `dent` should be kept in the dcache even if unused. This is the case for mounts with
+ * `negative_ttl_us` set, until the TTL expires.
+ *
+ * The caller should hold `g_dcache_lock`.
+ */
+bool dentry_negative_cached(struct shim_dentry* dent);
+
+/*!
+ * \brief Set up a new dentry from the lookups inherited from the parent process
+ *
+ * \param dent a new (invalid) dentry
+ *
+ * The parent passes to its children a snapshot of the lookups which its mounts guarantee to be
+ * still valid (see `fs.lookup_snapshot_size`). Returns true if `dent` was found in the snapshot,
+ * and was made a valid (possibly negative) dentry without asking the filesystem.
+ *
+ * The caller should hold `g_dcache_lock`.
+ */
+bool dentry_lookup_snapshot(struct shim_dentry* dent);
+
 /*!
  * \brief Check file permissions, similar to Unix access
  *
@@ -631,6 +723,8 @@ bool dentry_is_ancestor(struct shim_dentry* anc, struct shim_dentry* dent);
  */
 
 HASHTYPE hash_str(const char* str);
+/* Same as `hash_str`, for a string of length `len` (not necessarily null-terminated). */
+HASHTYPE hash_strn(const char* str, size_t len);
 HASHTYPE hash_name(HASHTYPE parent_hbuf, const char* name);
 HASHTYPE hash_abs_path(struct shim_dentry* dent);
 
@@ -655,6 +749,121 @@ extern struct shim_fs fifo_builtin_fs;
 extern struct shim_fs socket_builtin_fs;
 extern struct shim_fs epoll_builtin_fs;
 extern struct shim_fs eventfd_builtin_fs;
+extern struct shim_fs timerfd_builtin_fs;
+extern struct shim_fs io_uring_builtin_fs;
+extern struct shim_fs anon_shm_builtin_fs;
+
+/* in-LibOS pipes and socketpairs, see `struct shim_pipe_ring` (fs/pipe/ring.c) */
+int create_pipe_ring(struct shim_handle* reader, struct shim_handle* writer, bool dgram,
+                     struct shim_pipe_ring** out_ring);
+void put_pipe_ring(struct shim_pipe_ring* ring);
+bool pipe_ring_active(struct shim_pipe_ring* ring);
+/* Returns a new reference to `*ringp` (read under the lock of `hdl`), or NULL if there is no ring
+ * or it was already moved to the host. */
+struct shim_pipe_ring* get_pipe_ring(struct shim_handle* hdl, struct shim_pipe_ring** ringp);
+/* Read/write/poll operations set `*migrated` (and do nothing) if the ring was moved to the host
+ * in the meantime; the caller should then retry on the host handle. */
+ssize_t pipe_ring_readv(struct shim_pipe_ring* ring, const struct iovec* iov, size_t iov_len,
+                        size_t count, bool nonblocking, bool peek, bool* migrated);
+ssize_t pipe_ring_writev(struct shim_pipe_ring* ring, const struct iovec* iov, size_t iov_len,
+                         size_t count, bool nonblocking, bool* migrated);
+off_t pipe_ring_poll(struct shim_pipe_ring* ring, int poll_type, bool* migrated);
+void pipe_ring_shutdown(struct shim_pipe_ring* ring, bool rd);
+void pipe_ring_close_end(struct shim_pipe_ring* ring, struct shim_handle* hdl);
+int pipe_ring_migrate_locked(struct shim_pipe_ring* ring, PAL_HANDLE host_wr);
+void move_handle_to_host(struct shim_handle* hdl, struct shim_handle* host_hdl);
+/* Creates the poll events of in-LibOS objects of `hdl` (rings, eventfd counter, timerfd); called
+ * before `hdl` is polled. */
+int prepare_handle_poll(struct shim_handle* hdl);
+/* poll() on LibOS memory, e.g. for FDs waited for on behalf of the application */
+long do_poll(struct pollfd* fds, nfds_t nfds, int timeout_ms);
+int migrate_pipe_ring(struct shim_handle* hdl);
+int migrate_sock_rings(struct shim_handle* hdl);
+
+/* read-ahead of sequential reads from chroot files, see `struct shim_file_handle` */
+int init_chroot_read_ahead(void);
+
+/* Fast path of copy_file_range() between regular chroot files: copies up to `count` bytes from
+ * `hdli` at `pos_in` to `hdlo` at `pos_out` on the host (see DkStreamCopyFile), without touching the
+ * file positions. Returns false if the PAL can't do that for this pair of handles, otherwise stores
+ * the number of bytes copied or a negative error code in `*out_ret`. */
+bool chroot_copy_file_range(struct shim_handle* hdli, off_t pos_in, struct shim_handle* hdlo,
+                            off_t pos_out, size_t count, ssize_t* out_ret);
+
+/* Write-behind buffering of small writes to chroot files, see fs/chroot/write_behind.c. Must be
+ * called with `hdl->lock` held (except for `chroot_free_write_buffer`). chroot_write_behind()
+ * returns false if the write has to be done directly (write-behind is disabled for the mount, the
+ * write is too big, etc.), otherwise it stores the result of the write in `*out_ret`. */
+#define WRITE_BEHIND_MAX_SIZE (1024 * 1024)
+int init_chroot_write_behind(void);
+bool chroot_write_behind(struct shim_handle* hdl, const struct iovec* iov, size_t iov_len,
+                         size_t count, int* out_ret);
+int chroot_flush_writes(struct shim_handle* hdl);
+void chroot_defer_flush_error(struct shim_handle* hdl, int error);
+int chroot_free_write_buffer(struct shim_handle* hdl);
+void chroot_checkout_write_buffer(struct shim_handle* new_hdl);
+void chroot_flush_all_writes(void);
+
+/* Page cache of chroot files on immutable mounts, see fs/chroot/page_cache.c.
+ * chroot_page_cache_cached() and chroot_page_cache_read() must be called only if
+ * chroot_page_cache_enabled(); the latter returns a PAL error code, like DkStreamRead. An `end` of
+ * -1 invalidates up to the end of the file. */
+int init_chroot_page_cache(void);
+bool chroot_page_cache_enabled(struct shim_handle* hdl);
+bool chroot_page_cache_cached(struct shim_handle* hdl, off_t pos, size_t count);
+int chroot_page_cache_read(struct shim_handle* hdl, char* buf, off_t pos, size_t* count);
+void chroot_page_cache_invalidate(struct shim_file_data* data, off_t start, off_t end);
+void chroot_page_cache_written(struct shim_file_data* data, off_t pos, size_t count);
+void chroot_page_cache_disable(struct shim_file_data* data);
+void print_page_cache_stats(void);
+
+/* Emulated writable shared mappings of chroot files, see fs/chroot/shared_map.c.
+ * chroot_shared_map() maps the file like the `mmap` fs op. chroot_shared_map_sync() writes back
+ * the dirty pages of [`addr`, `addr` + `size`), a part of a shared file VMA of the handle at file
+ * offset `offset` (`writable` if the VMA is), and with `forget` stops tracking them;
+ * chroot_shared_map_sync_all() does that for all mappings of the handle. Both must be called with
+ * `hdl->lock` held. */
+int chroot_shared_map(struct shim_handle* hdl, void** addr, size_t size, int prot,
+                      uint64_t offset);
+int chroot_shared_map_sync(struct shim_handle* hdl, void* addr, size_t size, uint64_t offset,
+                           bool writable, bool forget);
+int chroot_shared_map_sync_all(struct shim_handle* hdl);
+void chroot_sync_all_shared_maps(void);
+void chroot_free_shared_maps(struct shim_handle* hdl);
+
+/* Shared anonymous memory, see fs/anon_shm/fs.c. create_anon_shm() returns a new handle of a
+ * region of `size` bytes, to be mapped at offset 0. migrate_anon_shm() publishes the pages of the
+ * mappings of the handle before the checkpoint; exchange_all_anon_shm() publishes (and with
+ * `take_over`, takes over) the pages of all mappings. */
+int init_anon_shm(void);
+bool anon_shm_enabled(void);
+int create_anon_shm(size_t size, struct shim_handle** out_hdl);
+int migrate_anon_shm(struct shim_handle* hdl);
+void exchange_all_anon_shm(bool take_over);
+
+/* eventfd counters in LibOS memory, see `struct shim_eventfd_handle` */
+int eventfd_enable_poll(struct shim_handle* hdl);
+int migrate_eventfd(struct shim_handle* hdl);
+
+/* quote cache of `/dev/attestation/quote`, see fs/dev/attestation.c */
+int init_attestation_quote_cache(void);
+
+/* timerfds, see `struct shim_timerfd_handle`; times are in usecs */
+int init_timerfd(void);
+int timerfd_enable_poll(struct shim_handle* hdl);
+int set_timerfd(struct shim_handle* hdl, uint64_t value, uint64_t interval, bool abstime,
+                uint64_t* old_value, uint64_t* old_interval);
+int get_timerfd(struct shim_handle* hdl, uint64_t* value, uint64_t* interval);
+
+/* io_uring instances, see `struct shim_io_uring_handle` */
+struct io_uring_params;
+void init_io_uring(struct shim_handle* hdl, uint32_t sq_entries, uint32_t cq_entries,
+                   struct io_uring_params* params);
+long io_uring_submit_and_wait(struct shim_handle* hdl, uint32_t to_submit, uint32_t min_complete,
+                              bool getevents);
+bool io_uring_op_supported(unsigned int opcode);
+int create_pipes(struct shim_handle* srv, struct shim_handle* cli, int flags, char* name,
+                 struct shim_qstr* qstr);
 
 struct shim_fs* find_fs(const char* name);
 
@@ -662,6 +871,7 @@ struct shim_fs* find_fs(const char* name);
 #define DIR_RX_MODE  0555
 #define FILE_RW_MODE 0666
 #define FILE_R_MODE  0444
+#define FILE_W_MODE  0222
 
 extern struct shim_fs_ops dev_fs_ops;
 extern struct shim_d_ops dev_d_ops;
@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * POSIX byte-range locks (`fcntl(F_SETLK/F_SETLKW/F_GETLK)`), see fs/shim_fs_lock.c.
+ */
+
+#ifndef SHIM_FS_LOCK_H_
+#define SHIM_FS_LOCK_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "shim_types.h"
+
+struct shim_dentry;
+
+/* `end` of a lock up to the end of the file, however far it grows */
+#define FS_LOCK_EOF ((uint64_t)-1)
+
+/* result of an IPC lock request: the state of the file was handed over to the requesting process,
+ * which applies the lock itself (and handles all further requests for the file) */
+#define POSIX_LOCK_LEASED 1
+
+struct posix_lock {
+    int type;       /* F_RDLCK, F_WRLCK or F_UNLCK */
+    uint64_t start;
+    uint64_t end;   /* inclusive */
+    IDTYPE pid;     /* owning (or requesting) process */
+};
+
+int init_fs_lock(void);
+
+/*!
+ * \brief Set or remove a lock of this process on a file (F_SETLK, and F_SETLKW if \p wait)
+ *
+ * Returns -EAGAIN if \p wait is false and a conflicting lock is held by another process, and
+ * -ERESTARTSYS if waiting was interrupted by a signal.
+ */
+int posix_lock_set(struct shim_dentry* dent, const struct posix_lock* pl, bool wait);
+
+/*!
+ * \brief Find a lock of another process conflicting with \p pl (F_GETLK)
+ *
+ * Sets \p out_pl to the conflicting lock, or its `type` to F_UNLCK if there is none.
+ */
+int posix_lock_get(struct shim_dentry* dent, const struct posix_lock* pl,
+                   struct posix_lock* out_pl);
+
+/*!
+ * \brief Remove all locks of this process on a file; called on every close() of it
+ */
+void posix_lock_clear_pid(struct shim_dentry* dent);
+
+/* Callbacks of the IPC messages, see ipc/shim_ipc_fs_lock.c. The ones of requests answer
+ * themselves (now or when the request is granted). */
+int posix_lock_set_from_ipc(const char* path, const struct posix_lock* pl, bool wait,
+                            IDTYPE vmid, unsigned long seq);
+int posix_lock_get_from_ipc(const char* path, const struct posix_lock* pl, IDTYPE vmid,
+                            unsigned long seq);
+int posix_lock_lease_from_ipc(const char* path, const struct posix_lock* pl);
+void posix_lock_recall_from_ipc(const char* path);
+void posix_lock_state_from_ipc(const char* path, const struct posix_lock* pls, size_t count,
+                               IDTYPE vmid);
+/* forgets the locks and requests of a disconnected process */
+void posix_lock_clear_vmid(IDTYPE vmid);
+
+#endif /* SHIM_FS_LOCK_H_ */
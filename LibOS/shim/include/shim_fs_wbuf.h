@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * Write buffers which collect small writes to a handle and write them out together, when a buffer
+ * fills up or a delay after the first buffered write (by the async worker), see fs/shim_fs_wbuf.c.
+ */
+
+#ifndef SHIM_FS_WBUF_H_
+#define SHIM_FS_WBUF_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "list.h"
+#include "shim_lock.h"
+#include "shim_types.h"
+
+struct shim_handle;
+
+DEFINE_LIST(shim_wbuf);
+DEFINE_LISTP(shim_wbuf);
+
+/* Write buffers of one kind, flushed by a common timer */
+struct shim_wbuf_queue {
+    const char* name;              /* for log messages */
+    uint64_t delay_us;
+    /* Called by the timer for each queued buffer; must take the lock protecting the buffer, clear
+     * its `queued` and flush it */
+    void (*flush_queued)(struct shim_wbuf* wbuf);
+    struct shim_lock lock;         /* protects `pending` and `timer_armed` */
+    LISTP_TYPE(shim_wbuf) pending;
+    bool timer_armed;
+    uint64_t writes;               /* stats of all buffers: buffered writes, flushes, bytes */
+    uint64_t flushes;
+    uint64_t bytes;
+};
+
+struct shim_wbuf {
+    struct shim_wbuf_queue* queue;
+    struct shim_handle* hdl;
+    LIST_TYPE(shim_wbuf) list;     /* in `queue->pending` if `queued` */
+    bool queued;                   /* waits for the flush timer, holds a reference to `hdl` */
+    uint64_t writes;               /* stats: buffered writes, flushes and flushed bytes */
+    uint64_t flushes;
+    uint64_t bytes;
+    size_t len;                    /* written atomically, may be peeked at without the lock */
+    size_t size;
+    char* data;
+};
+
+int wbuf_queue_init(struct shim_wbuf_queue* queue, const char* name, uint64_t delay_us,
+                    void (*flush_queued)(struct shim_wbuf* wbuf));
+void wbuf_init(struct shim_wbuf* wbuf, struct shim_wbuf_queue* queue, struct shim_handle* hdl,
+               char* data, size_t size);
+
+/* The following three must be called with the lock protecting `wbuf` held. */
+
+/*!
+ * \brief Make the timer flush \p wbuf
+ *
+ * Returns false if the timer cannot be armed, the caller must flush then.
+ */
+bool wbuf_queue(struct shim_wbuf* wbuf);
+
+/*!
+ * \brief Copy a write (which must fit) into \p wbuf and queue the buffer
+ *
+ * Returns true if the caller must flush the buffer now: it is full, or the timer cannot be armed.
+ */
+bool wbuf_append(struct shim_wbuf* wbuf, const struct iovec* iov, size_t iov_len, size_t count);
+
+/*!
+ * \brief Account for \p done bytes written out from the start of \p wbuf and drop them
+ */
+void wbuf_flushed(struct shim_wbuf* wbuf, size_t done);
+
+/*!
+ * \brief Do the work of the timer now (at process exit, when the async worker is stopped)
+ */
+void wbuf_flush_all(struct shim_wbuf_queue* queue);
+
+#endif /* SHIM_FS_WBUF_H_ */
@@ -22,6 +22,7 @@
 #include "list.h"
 #include "pal.h"
 #include "shim_defs.h"
+#include "shim_rcu.h"
 #include "shim_sysv.h"
 #include "shim_types.h"
 
@@ -34,6 +35,7 @@ enum shim_handle_type {
                       * filesystems */
     TYPE_PSEUDO,     /* pseudo nodes (currently directories), handled by `pseudo_*` functions, used
                       * by several filesystems */
+    TYPE_TMPFS,      /* in-memory files, used by `tmpfs` filesystem */
 
     /* Pipes and sockets: */
     TYPE_PIPE,       /* pipes, used by `pipe` filesystem */
@@ -44,6 +46,9 @@ enum shim_handle_type {
     TYPE_MSG,        /* System V messages, see `shim_msgget.c` */
     TYPE_EPOLL,      /* epoll handles, see `shim_epoll.c` */
     TYPE_EVENTFD,    /* eventfd handles, used by `eventfd` filesystem */
+    TYPE_TIMERFD,    /* timerfd handles, used by `timerfd` filesystem */
+    TYPE_IO_URING,   /* io_uring instances, used by `io_uring` filesystem */
+    TYPE_ANON_SHM,   /* shared anonymous memory, used by `anon_shm` filesystem */
 };
 
 struct shim_handle;
@@ -69,8 +74,16 @@ struct shim_file_data {
     unsigned long mtime;
     unsigned long ctime;
     unsigned long nlink;
+
+    /* see fs/chroot/page_cache.c; protected by the page cache lock */
+    uint64_t cache_gen;
+    size_t cache_pages;
+    bool cache_disabled;
 };
 
+struct shim_file_wbuf;
+struct shim_file_smaps;
+
 struct shim_file_handle {
     unsigned int version;
     struct shim_file_data* data;
@@ -78,6 +91,26 @@ struct shim_file_handle {
     enum shim_file_type type;
     off_t size;
     off_t marker;
+
+    /* Read-ahead window of regular files (`fs.read_ahead_max_size`): `ra_len` bytes of the file
+     * starting at `ra_off`, in `ra_buf` of size `ra_size`. `ra_window` is the size of the next
+     * refill; it grows while reads are sequential, i.e. start at `ra_next`. */
+    char* ra_buf;
+    size_t ra_size;
+    size_t ra_len;
+    off_t ra_off;
+    size_t ra_window;
+    off_t ra_next;
+    /* access pattern of the file set by fadvise(): POSIX_FADV_NORMAL, POSIX_FADV_SEQUENTIAL (the
+     * read-ahead window and page cache fetches are always as large as possible) or
+     * POSIX_FADV_RANDOM (no read-ahead, page cache fetches only the needed pages) */
+    int advice;
+
+    /* write-behind buffer, see fs/chroot/write_behind.c */
+    struct shim_file_wbuf* wbuf;
+
+    /* emulated writable shared mappings, see fs/chroot/shared_map.c */
+    struct shim_file_smaps* smaps;
 };
 
 #define FILE_HANDLE_DATA(hdl)  ((hdl)->info.file.data)
@@ -118,9 +151,44 @@ struct shim_dev_handle {
     struct shim_dev_ops dev_ops;
 };
 
+DEFINE_LIST(pipe_ring_waiter);
+DEFINE_LISTP(pipe_ring_waiter);
+/* Buffer of a pipe created by `pipe2` (or of one direction of a UNIX socketpair) while both of its
+ * ends are in this process: the data never leaves LibOS memory. Poll/epoll see two LibOS events
+ * (created only once either end is polled) that mirror whether the ring is readable and writable:
+ * the first one is the `pal_handle` of the reader, the second one the `pal_wr_handle` of the
+ * writer. On checkpoint, the ring is moved to the host (see `migrate_pipe_ring` and
+ * `migrate_sock_rings`), after which both ends use that. */
+struct shim_pipe_ring {
+    REFTYPE ref_count;  /* one per open end, plus one per operation in progress */
+    struct shim_lock lock;
+
+    /* all fields below are protected by `lock` */
+    bool dgram;   /* messages keep their boundaries (SOCK_DGRAM socketpairs) */
+    char* buf;
+    size_t start; /* offset of the first unread byte */
+    size_t used;  /* number of unread bytes */
+
+    /* not ref-counted; reset when the end is closed */
+    struct shim_handle* reader;
+    struct shim_handle* writer;
+    bool shut_rd; /* shutdown(SHUT_RD) */
+    bool shut_wr; /* shutdown(SHUT_WR) */
+
+    bool migrated; /* data was moved to a host pipe, operations must use that one */
+    LISTP_TYPE(pipe_ring_waiter) waiters;
+
+    bool polled;
+    AEVENTTYPE readable;
+    AEVENTTYPE writable;
+    bool readable_set;
+    bool writable_set;
+};
+
 struct shim_pipe_handle {
     bool ready_for_ops; /* true for pipes, false for FIFOs that were mknod'ed but not open'ed */
     char name[PIPE_URI_SIZE];
+    struct shim_pipe_ring* ring; /* NULL for host pipes */
 };
 
 #define SOCK_STREAM   1
@@ -194,6 +262,19 @@ struct shim_sock_handle {
         char uri[SOCK_URI_SIZE]; /* cached URI for recvfrom(udp_socket) case */
         char buf[];              /* peek buffer of size `size` */
     }* peek_buffer;
+
+    /* socket options of the PAL handle, so that getsockopt() doesn't query the PAL every time;
+     * only the `socket` fields are valid, and only if `options_cached` */
+    bool options_cached;
+    PAL_STREAM_ATTR options;
+
+    bool tcp_nodelay; /* TCP_NODELAY is set, which disables write coalescing */
+    bool reuseport;   /* SO_REUSEPORT is set, applied when the host socket is bound */
+    struct shim_sock_wbuf* write_buffer; /* coalesced small writes, see fs/socket/coalesce.c */
+
+    /* in-LibOS socketpairs (NULL for host sockets): data to read and data written by this end */
+    struct shim_pipe_ring* ring_in;
+    struct shim_pipe_ring* ring_out;
 };
 
 struct shim_dir_handle {
@@ -222,7 +303,7 @@ struct shim_msg_handle {
     int queuesize;
     int queueused;
     struct msg_qobj* freed;
-    PAL_HANDLE event; /* event for waiting */
+    LISTP_TYPE(sysv_waiter) waiters; /* local threads blocked in msgrcv */
     int ntypes;
     int maxtypes;
     struct msg_type* types;
@@ -239,7 +320,6 @@ struct shim_sem_handle {
     bool owned;
     int perm;
     bool deleted;
-    PAL_HANDLE event;
     int nsems;
     struct sem_obj* sems;
     int nreqs;
@@ -265,30 +345,132 @@ struct shim_str_handle {
     char* ptr;
 };
 
+struct shim_tmpfs_data;
+
+struct shim_tmpfs_handle {
+    struct shim_tmpfs_data* data; /* also stored in dentry, see `tmpfs/fs.c` */
+    off_t pos;
+};
+
 DEFINE_LIST(shim_epoll_item);
 DEFINE_LISTP(shim_epoll_item);
 struct shim_epoll_item {
     FDTYPE fd;
     uint64_t data;
     unsigned int events;
-    unsigned int revents;
+    unsigned int revents;            /* reported by the PAL poller but not yet by `epoll_wait` */
     /* The two references below are not ref-counted (to prevent cycles). When a handle is dropped
      * (ref-count goes to 0) it is also removed from all epoll instances. When an epoll instance is
      * destroyed, all handles that it traced are removed from it. */
     struct shim_handle* handle;      /* reference to monitored object (socket, pipe, file, etc) */
     struct shim_handle* epoll;       /* reference to epoll object that monitors handle object */
-    LIST_TYPE(shim_epoll_item) list; /* list of shim_epoll_items, used by epoll object (via `fds`) */
+    LIST_TYPE(shim_epoll_item) list; /* list of shim_epoll_items, used by epoll object (via `fds`,
+                                        or `removed` after the item was deleted) */
     LIST_TYPE(shim_epoll_item) back; /* list of epolls, used by handle object (via `epolls`) */
+    LIST_TYPE(shim_epoll_item) ready; /* list of items with pending `revents` (via `ready`) */
 };
 
 struct shim_epoll_handle {
+    /* Number of threads in `epoll_wait`, protected by the epoll handle lock. */
     size_t waiter_cnt;
 
     /* Number of items on fds list. */
     size_t fds_count;
 
-    AEVENTTYPE event;
+    /* PAL poller in which the PAL handles of all items are registered, with the item pointer as
+     * data. Set on creation (or restore from checkpoint) and never changed afterwards. */
+    PAL_HANDLE poller;
+    /* Items are not registered in `poller` yet (after restore from checkpoint). */
+    bool needs_arm;
+
     LISTP_TYPE(shim_epoll_item) fds;
+    LISTP_TYPE(shim_epoll_item) ready;
+    /* Items deleted while some thread was in `epoll_wait` (the PAL poller may still return them),
+     * freed by the last waiter. */
+    LISTP_TYPE(shim_epoll_item) removed;
+};
+
+DEFINE_LIST(eventfd_waiter);
+DEFINE_LISTP(eventfd_waiter);
+/* The counter of an eventfd lives in LibOS memory (protected by the handle lock) until the eventfd
+ * is inherited by a child process; then it is moved to a host eventfd in `pal_handle` (see
+ * `migrate_eventfd`). Until then, poll/epoll see two LibOS events (created only once the eventfd
+ * is polled) as `pal_handle` and `pal_wr_handle`, like for `struct shim_pipe_ring`. */
+struct shim_eventfd_handle {
+    bool is_semaphore; /* EFD_SEMAPHORE */
+    bool host;         /* moved to the host, operations must use `pal_handle` */
+    uint64_t val;
+    LISTP_TYPE(eventfd_waiter) waiters;
+
+    bool polled;
+    AEVENTTYPE readable;
+    AEVENTTYPE writable;
+    bool readable_set;
+    bool writable_set;
+};
+
+DEFINE_LIST(timerfd_waiter);
+DEFINE_LISTP(timerfd_waiter);
+/* The state of a timerfd lives in LibOS memory (protected by the handle lock); expirations are
+ * counted by a timer of the async worker (see fs/timerfd/fs.c), no host thread or object is used.
+ * Like for eventfds, poll/epoll see a LibOS event (created only once the timerfd is polled) as
+ * `pal_handle`. */
+struct shim_timerfd_handle {
+    uint64_t next_expire; /* time of the next expiration (in usecs), 0 if disarmed */
+    uint64_t interval;    /* in usecs, 0 for one-shot timers */
+    uint64_t expirations; /* not read yet */
+    /* pending async timer, changed under both the handle lock and `g_timerfd_lock` */
+    struct timerfd_timer* timer;
+    LISTP_TYPE(timerfd_waiter) waiters;
+
+    bool polled;
+    AEVENTTYPE readable;
+    bool readable_set;
+};
+
+DEFINE_LIST(io_uring_op);
+DEFINE_LISTP(io_uring_op);
+/* An io_uring is emulated in LibOS (see fs/io_uring/fs.c): its rings live in the application's
+ * mappings of the handle, and `io_uring_enter` executes the submitted requests with the LibOS
+ * implementations of the corresponding syscalls. Requests which would block wait in `pending` until
+ * their FD becomes ready. Protected by the handle lock. */
+struct shim_io_uring_handle {
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    /* set in a child process, which doesn't share the rings of its parent */
+    bool inherited;
+
+    /* the application's mappings of the rings and of the SQE array, NULL until mapped */
+    void* sq_ring;
+    void* cq_ring;
+    void* sqes;
+
+    LISTP_TYPE(io_uring_op) pending;
+    uint32_t pending_cnt;
+    uint32_t pending_drain_cnt; /* pending requests with IOSQE_IO_DRAIN */
+
+    /* registered with io_uring_register(); fixed files are kept as FD numbers */
+    int* files;
+    uint32_t files_cnt;
+    struct iovec* buffers;
+    uint32_t buffers_cnt;
+    struct shim_handle* eventfd;
+};
+
+#define ANON_SHM_KEY_SIZE 16
+/* A MAP_SHARED | MAP_ANONYMOUS region with `sys.shared_anonymous_memory`, backed by an unlinked
+ * host file (`pal_handle`), see fs/anon_shm/fs.c. If the PAL can't map the file shared into the
+ * process (`emulated`), the process keeps its own copy of the region, whose pages are exchanged
+ * with the other processes encrypted through `umem`, the file mapped in untrusted memory; the
+ * versions and hashes of the pages as last exchanged are NULL until the region is first mapped in
+ * this process. Protected by the handle lock. */
+struct shim_anon_shm_handle {
+    size_t size;
+    bool emulated;
+    uint8_t key[ANON_SHM_KEY_SIZE];
+    void* umem;
+    uint64_t* versions;
+    uint64_t* hashes;
 };
 
 struct shim_fs;
@@ -320,6 +502,10 @@ struct shim_handle {
                            * necessary to be set. */
 
     PAL_HANDLE pal_handle;
+    /* Handle which becomes readable when this one is writable, for pollable objects which have
+     * no host handle (see `struct shim_pipe_ring`). Not owned by this handle and not checkpointed;
+     * if set, `pal_handle` reports only read readiness. */
+    PAL_HANDLE pal_wr_handle;
 
     /* Type-specific fields: when accessing, ensure that `type` field is appropriate first (at least
      * by using assert()) */
@@ -327,6 +513,7 @@ struct shim_handle {
         struct shim_file_handle file;    /* TYPE_FILE */
         struct shim_dev_handle dev;      /* TYPE_DEV */
         struct shim_str_handle str;      /* TYPE_STR */
+        struct shim_tmpfs_handle tmpfs;  /* TYPE_TMPFS */
         /* (no data) */                  /* TYPE_PSEUDO */
 
         struct shim_pipe_handle pipe;    /* TYPE_PIPE */
@@ -335,7 +522,10 @@ struct shim_handle {
         struct shim_sem_handle sem;      /* TYPE_SEM */
         struct shim_msg_handle msg;      /* TYPE_MSG */
         struct shim_epoll_handle epoll;  /* TYPE_EPOLL */
-        /* (no data) */                  /* TYPE_EVENTFD */
+        struct shim_eventfd_handle eventfd; /* TYPE_EVENTFD */
+        struct shim_timerfd_handle timerfd; /* TYPE_TIMERFD */
+        struct shim_io_uring_handle io_uring; /* TYPE_IO_URING */
+        struct shim_anon_shm_handle anon_shm; /* TYPE_ANON_SHM */
     } info;
 
     struct shim_dir_handle dir_info;
@@ -349,6 +539,8 @@ struct shim_handle {
 struct shim_handle* get_new_handle(void);
 void get_handle(struct shim_handle* hdl);
 void put_handle(struct shim_handle* hdl);
+/* same as put_handle() on each handle, but PAL handles are closed in batches */
+void put_handles(struct shim_handle** hdls, size_t count);
 
 /* Set handle to non-blocking or blocking mode. */
 int set_handle_nonblocking(struct shim_handle* hdl, bool on);
@@ -359,6 +551,10 @@ struct shim_fd_handle {
     int flags;  /* file descriptor flags, only FD_CLOEXEC */
 
     struct shim_handle* handle;
+
+    /* number of handle maps sharing this entry (see `dup_handle_map`); a shared entry is never
+     * modified, it holds one reference on `handle` for all its maps */
+    REFTYPE ref_count;
 };
 
 struct shim_handle_map {
@@ -372,6 +568,9 @@ struct shim_handle_map {
 
     /* An array of file descriptor belong to this mapping */
     struct shim_fd_handle** map;
+
+    /* lock-free readers of `map`, see `get_fd_handle` */
+    struct shim_rcu rcu;
 };
 
 /* allocating file descriptors */
@@ -400,7 +599,33 @@ struct shim_handle* __detach_fd_handle(struct shim_fd_handle* fd, int* flags,
                                        struct shim_handle_map* map);
 struct shim_handle* detach_fd_handle(FDTYPE fd, int* flags, struct shim_handle_map* map);
 
-/* manage handle mapping */
+/* Sets the flags (only FD_CLOEXEC) of `fd`, if it is allocated. `map` must be locked. */
+int __set_fd_handle_flags(FDTYPE fd, int fd_flags, struct shim_handle_map* map);
+
+/*!
+ * \brief Detach handles of several fds at once.
+ *
+ * \param[in,out] fd    First fd to look at; on return, the fd to continue from.
+ * \param last_fd       Last fd of the range (inclusive).
+ * \param cloexec_only  Detach only fds with FD_CLOEXEC.
+ * \param[out] handles  Array for the detached handles (the references of the fds are moved to it).
+ * \param max_count     Size of `handles`.
+ * \param map           Handle map to be used.
+ *
+ * Detaches the fds in [`*fd`, `last_fd`], up to `max_count` of them, under a single lock of the map
+ * and a single RCU grace period. Returns the number of detached handles, 0 if none are left in the
+ * range.
+ */
+size_t detach_fd_handles(FDTYPE* fd, FDTYPE last_fd, bool cloexec_only,
+                         struct shim_handle** handles, size_t max_count,
+                         struct shim_handle_map* map);
+
+/*!
+ * \brief Duplicate a handle map.
+ *
+ * The new map shares the fd entries of `old_map` copy-on-write: only the array of entries is
+ * copied, and each map copies (or drops) a shared entry the first time it modifies its slot.
+ */
 int dup_handle_map(struct shim_handle_map** new_map, struct shim_handle_map* old_map);
 void get_handle_map(struct shim_handle_map* map);
 void put_handle_map(struct shim_handle_map* map);
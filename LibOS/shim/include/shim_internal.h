@@ -36,6 +36,9 @@ extern const PAL_CONTROL* g_pal_control;
 // TODO(mkow): We should make it cross-object-inlinable, ideally by enabling LTO, less ideally by
 // pasting it here and making `inline`, but our current linker scripts prevent both.
 void shim_log(int level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+int init_async_log(void);
+/* Writes out the messages buffered by the asynchronous logging mode. */
+void log_flush(bool crashing);
 
 #if 0
 #define DEBUG_BREAK_ON_FAILURE() DEBUG_BREAK()
@@ -134,6 +137,13 @@ void restore_sigreturn_context(PAL_CONTEXT* context, __sigset_t* new_mask);
  * Used e.g. in Linux-SGX Pal to handle `syscall` instruction.
  */
 bool maybe_emulate_syscall(PAL_CONTEXT* context);
+/*!
+ * \brief Initialize patching of syscall sites emulated by maybe_emulate_syscall()
+ *
+ * If enabled in the manifest, maybe_emulate_syscall() also patches the site so that its next
+ * executions enter LibOS directly.
+ */
+int init_syscall_patching(void);
 /*!
  * \brief Handle a signal
  *
@@ -164,9 +174,36 @@ bool handle_signal(PAL_CONTEXT* context, __sigset_t* old_mask_ptr);
 long pal_to_unix_errno(long err);
 
 void warn_unsupported_syscall(unsigned long sysno);
+const char* get_syscall_name(unsigned long sysno);
 void debug_print_syscall_before(unsigned long sysno, ...);
 void debug_print_syscall_after(unsigned long sysno, ...);
 
+/* Latency histogram buckets of a syscall: bucket 0 counts calls which took less than 1us, bucket `i`
+ * the ones which took [2^(i-1), 2^i) us, the last bucket also all longer ones. */
+#define SYSCALL_STATS_BUCKETS 24
+
+struct shim_syscall_stat {
+    uint64_t count;     /* also includes calls which never returned (e.g. `exit`) */
+    uint64_t time_us;
+    uint64_t buckets[SYSCALL_STATS_BUCKETS];
+};
+
+struct shim_thread;
+int init_syscall_stats(void);
+void fold_syscall_stats(struct shim_thread* thread);
+void free_syscall_stats(struct shim_thread* thread);
+/* Sums up the statistics of all threads of this process (including the exited ones) into `stats`,
+ * an array of `LIBOS_SYSCALL_BOUND` entries. */
+void collect_syscall_stats(struct shim_syscall_stat* stats);
+
+/* binary syscall tracing, see shim_syscall_trace.c */
+extern bool g_syscall_trace_enabled;
+int init_syscall_trace(void);
+void trace_syscall(unsigned long sysnr, const int64_t args[6], int64_t ret, uint64_t start_us,
+                   uint64_t duration_us);
+void release_syscall_trace(struct shim_thread* thread);
+void flush_syscall_trace(void);
+
 /*
  * These events have counting semaphore semantics:
  * - `set_event(e, n)` increases value of the semaphore by `n`,
@@ -347,6 +384,7 @@ extern void* __load_address;
 extern void* __load_address_end;
 
 extern const char** migrated_envp;
+extern const char** migrated_argv;
 
 struct shim_handle;
 int init_brk_from_executable(struct shim_handle* exec);
@@ -365,6 +403,7 @@ void set_rlimit_cur(int resource, uint64_t rlim);
 int object_wait_with_retry(PAL_HANDLE handle);
 
 void _update_epolls(struct shim_handle* handle);
+void _disarm_epolls(struct shim_handle* handle);
 void delete_from_epoll_handles(struct shim_handle* handle);
 /*!
  * \brief Check if next `epoll_wait` with `EPOLLET` should trigger for this handle
@@ -392,7 +431,40 @@ void delete_from_epoll_handles(struct shim_handle* handle);
  */
 void maybe_epoll_et_trigger(struct shim_handle* handle, int ret, bool in, bool was_partial);
 
+/* Busy-waiting of short sleeps, see sys/shim_sleep.c */
+int init_sleep(void);
+
+/* Coalescing of small TCP writes, see fs/socket/coalesce.c. sock_coalesce_write() returns false if
+ * the write has to be done directly (coalescing is disabled, the buffer is empty and the write is
+ * too big, etc.), otherwise it stores the result of the write in `*out_ret`. */
+int init_sock_coalescing(void);
+bool sock_coalesce_write(struct shim_handle* hdl, const struct iovec* iov, size_t iov_len,
+                         size_t count, ssize_t* out_ret);
+int sock_flush_writes(struct shim_handle* hdl);
+/* like sock_flush_writes(), but doesn't wait for a flush already done by another thread */
+void sock_flush_writes_for_read(struct shim_handle* hdl);
+void sock_set_nodelay(struct shim_handle* hdl, bool nodelay);
+void sock_free_write_buffer(struct shim_handle* hdl);
+void sock_flush_all_writes(void);
+
+/* In-LibOS socketpairs, see fs/socket/fs.c. The read/write functions return false if `hdl` is a
+ * host socket, otherwise they store the result of the operation in `*out_ret`. Must be called
+ * without the handle lock held. */
+bool sock_ring_readv(struct shim_handle* hdl, const struct iovec* iov, size_t iov_len,
+                     size_t count, bool nonblocking, bool peek, ssize_t* out_ret);
+bool sock_ring_writev(struct shim_handle* hdl, const struct iovec* iov, size_t iov_len,
+                      size_t count, bool nonblocking, ssize_t* out_ret);
+void sock_ring_shutdown(struct shim_handle* hdl, bool rd, bool wr);
+
+/* whether pages of thread stacks are committed on first access (`sys.stack.lazy_commit`) */
+extern bool g_lazy_stacks;
+
 void* allocate_stack(size_t size, size_t protect_size, bool user);
 int init_stack(const char** argv, const char** envp, const char*** out_argp, elf_auxv_t** out_auxv);
 
+/* record the end of a LibOS start-up phase, and report all phases (of PAL too) before entering the
+ * application (`libos.startup_stats`) */
+void add_startup_phase(const char* name);
+void report_startup_phases(void);
+
 #endif /* _SHIM_INTERNAL_H_ */
@@ -7,9 +7,9 @@
 #ifndef SHIM_IPC_H_
 #define SHIM_IPC_H_
 
-#include "avl_tree.h"
 #include "pal.h"
 #include "shim_defs.h"
+#include "shim_fs_lock.h"
 #include "shim_handle.h"
 #include "shim_internal.h"
 #include "shim_sysv.h"
@@ -22,6 +22,9 @@
 #define RANGE_SIZE 32
 
 #define IPC_MSG_MINIMAL_SIZE 48
+/* Messages are padded to this alignment on the wire, so that the receiver can handle messages in
+ * its (aligned) receive buffer in place. */
+#define IPC_MSG_WIRE_ALIGNMENT 16
 #define IPC_SEM_NOTIMEOUT    ((unsigned long)-1)
 
 enum {
@@ -48,6 +51,11 @@ enum {
     IPC_MSG_SYSV_SEMOP,
     IPC_MSG_SYSV_SEMCTL,
     IPC_MSG_SYSV_SEMRET,
+    IPC_MSG_POSIX_LOCK_SET,
+    IPC_MSG_POSIX_LOCK_GET,
+    IPC_MSG_POSIX_LOCK_RESP,
+    IPC_MSG_POSIX_LOCK_RECALL,
+    IPC_MSG_POSIX_LOCK_STATE,
     IPC_MSG_CODE_BOUND,
 };
 
@@ -72,12 +80,25 @@ int init_ns_sysv(void);
 
 /*!
  * \brief Initialize the IPC worker thread
+ *
+ * The worker is started right away only in child processes, the first process starts it with
+ * `start_ipc_worker()` before creating its first child.
  */
 int init_ipc_worker(void);
+/*!
+ * \brief Start the IPC worker thread, if not running yet
+ *
+ * Must be called before creating a child process, which connects to this one.
+ */
+int start_ipc_worker(void);
 /*!
  * \brief Terminate the IPC worker thread
  */
 void terminate_ipc_worker(void);
+/*!
+ * \brief Print per-message-type statistics of handled IPC messages (at the debug log level)
+ */
+void print_ipc_stats(void);
 
 /*!
  * \brief Establish a one-way IPC connection to another process
@@ -112,7 +133,6 @@ struct shim_ipc_msg {
 } __attribute__((packed));
 
 struct shim_ipc_msg_with_ack {
-    struct avl_tree_node node;
     struct shim_thread* thread;
     int retval;
     void* private;
@@ -133,6 +153,9 @@ static inline size_t get_ipc_msg_size(size_t payload) {
 static inline size_t get_ipc_msg_with_ack_size(size_t payload) {
     return _get_ipc_msg_size(sizeof(struct shim_ipc_msg_with_ack), payload);
 }
+static inline size_t get_ipc_msg_wire_size(size_t msg_size) {
+    return ALIGN_UP(msg_size, IPC_MSG_WIRE_ALIGNMENT);
+}
 
 void init_ipc_msg(struct shim_ipc_msg* msg, int code, size_t size, IDTYPE dest);
 void init_ipc_msg_with_ack(struct shim_ipc_msg_with_ack* msg, int code, size_t size, IDTYPE dest);
@@ -208,6 +231,14 @@ void release_ipc_id(IDTYPE idx);
  */
 int find_owner(IDTYPE idx, IDTYPE* owner);
 
+/*!
+ * \brief Forget cached owners of ids which are \p vmid
+ *
+ * Called when the process \p vmid disconnects, so that later lookups of its ids ask the leader
+ * again instead of using stale owners.
+ */
+void invalidate_ipc_owner(IDTYPE vmid);
+
 struct ipc_ns_offered {
     IDTYPE base;
     IDTYPE size;
@@ -226,6 +257,11 @@ int ipc_cld_exit_send(unsigned int exitcode, unsigned int term_signal);
 int ipc_cld_exit_callback(struct shim_ipc_msg* msg, IDTYPE src);
 void ipc_child_disconnect_callback(IDTYPE vmid);
 
+/* LEASE: lease ranges of IDs; processes that run out of IDs often get more ranges at once */
+struct shim_ipc_lease {
+    IDTYPE ranges_cnt;
+} __attribute__((packed));
+
 int ipc_lease_send(void);
 int ipc_lease_callback(struct shim_ipc_msg* msg, IDTYPE src);
 
@@ -418,4 +454,41 @@ struct shim_ipc_sysv_semret {
 int ipc_sysv_semret_send(IDTYPE dest, void* vals, size_t valsize, unsigned long seq);
 int ipc_sysv_semret_callback(struct shim_ipc_msg* msg, IDTYPE src);
 
+/* POSIX_LOCK_SET, POSIX_LOCK_GET: requests to the leader, answered with POSIX_LOCK_RESP */
+struct shim_ipc_posix_lock {
+    struct posix_lock pl;
+    bool wait;
+    char path[];
+} __attribute__((packed));
+
+int ipc_posix_lock_set_send(const char* path, const struct posix_lock* pl, bool wait);
+int ipc_posix_lock_set_callback(struct shim_ipc_msg* msg, IDTYPE src);
+int ipc_posix_lock_get_send(const char* path, const struct posix_lock* pl,
+                            struct posix_lock* out_pl);
+int ipc_posix_lock_get_callback(struct shim_ipc_msg* msg, IDTYPE src);
+
+/* POSIX_LOCK_RESP: result (or POSIX_LOCK_LEASED) and the conflicting lock for POSIX_LOCK_GET */
+struct shim_ipc_posix_lock_resp {
+    int result;
+    struct posix_lock pl;
+} __attribute__((packed));
+
+int ipc_posix_lock_resp_send(IDTYPE dest, unsigned long seq, int result,
+                             const struct posix_lock* pl);
+int ipc_posix_lock_resp_callback(struct shim_ipc_msg* msg, IDTYPE src);
+
+/* POSIX_LOCK_RECALL: the leader takes back the state of a file (the message is its path), answered
+ * with POSIX_LOCK_STATE */
+int ipc_posix_lock_recall_send(IDTYPE dest, const char* path);
+int ipc_posix_lock_recall_callback(struct shim_ipc_msg* msg, IDTYPE src);
+
+/* POSIX_LOCK_STATE: locks of the sender on a file, followed by the path */
+struct shim_ipc_posix_lock_state {
+    size_t count;
+    struct posix_lock locks[];
+} __attribute__((packed));
+
+int ipc_posix_lock_state_send(const char* path, const struct posix_lock* pls, size_t count);
+int ipc_posix_lock_state_callback(struct shim_ipc_msg* msg, IDTYPE src);
+
 #endif /* SHIM_IPC_H_ */
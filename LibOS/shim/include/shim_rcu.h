@@ -0,0 +1,68 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * Minimal RCU-style synchronization of lock-free readers with writers (in the spirit of Linux
+ * SRCU). Readers don't take any lock, they only announce themselves in one of two counters:
+ *
+ *     uint32_t idx = rcu_read_begin(&foo->rcu);
+ *     ... load pointers published by writers, take references on found objects ...
+ *     rcu_read_end(&foo->rcu, idx);
+ *
+ * Writers (serialized by a lock of their own) publish new state with release stores, and before
+ * releasing anything readers may still be looking at (a detached object, a replaced array), call
+ * `rcu_synchronize`.
+ */
+
+#ifndef SHIM_RCU_H_
+#define SHIM_RCU_H_
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+struct shim_rcu {
+    /* selects which of `readers` new readers increment */
+    uint32_t epoch;
+    uint32_t readers[2];
+};
+
+#define INIT_SHIM_RCU { .epoch = 0, .readers = { 0, 0 } }
+
+static inline void rcu_init(struct shim_rcu* rcu) {
+    rcu->epoch      = 0;
+    rcu->readers[0] = 0;
+    rcu->readers[1] = 0;
+}
+
+/*!
+ * \brief Start a lock-free read-side critical section.
+ *
+ * Returns the value to be passed to `rcu_read_end`.
+ */
+static inline uint32_t rcu_read_begin(struct shim_rcu* rcu) {
+    uint32_t idx = __atomic_load_n(&rcu->epoch, __ATOMIC_SEQ_CST) & 1;
+    __atomic_add_fetch(&rcu->readers[idx], 1, __ATOMIC_SEQ_CST);
+    return idx;
+}
+
+static inline void rcu_read_end(struct shim_rcu* rcu, uint32_t idx) {
+    __atomic_sub_fetch(&rcu->readers[idx], 1, __ATOMIC_RELEASE);
+}
+
+/*!
+ * \brief Wait until all readers that may still see the state before the last update are done.
+ *
+ * Flipping the epoch twice and draining the counter of the previous epoch each time covers also
+ * readers that loaded the epoch long before incrementing their counter, while newly arriving
+ * readers (which already see the new state) can't starve the writer. Writers must be serialized.
+ */
+static inline void rcu_synchronize(struct shim_rcu* rcu) {
+    for (int i = 0; i < 2; i++) {
+        uint32_t epoch = __atomic_add_fetch(&rcu->epoch, 1, __ATOMIC_SEQ_CST) - 1;
+        while (__atomic_load_n(&rcu->readers[epoch & 1], __ATOMIC_SEQ_CST))
+            CPU_RELAX();
+    }
+}
+
+#endif /* SHIM_RCU_H_ */
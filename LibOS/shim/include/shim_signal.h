@@ -11,6 +11,8 @@
 
 void sigaction_make_defaults(struct __kernel_sigaction* sig_action);
 void thread_sigaction_reset_on_execve(void);
+struct shim_signal_dispositions;
+void sigaction_reset_on_execve(struct shim_signal_dispositions* dispositions);
 
 #define BITS_PER_WORD (8 * sizeof(unsigned long))
 /* The standard def of this macro is dumb */
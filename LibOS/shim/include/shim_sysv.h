@@ -22,6 +22,7 @@ struct sysv_client {
 };
 
 struct shim_handle;
+struct shim_thread;
 
 #define MSG_NOERROR 010000
 
@@ -91,6 +92,15 @@ int add_sysv_msg(struct shim_msg_handle* msgq, long type, size_t size, const voi
 int get_sysv_msg(struct shim_msg_handle* msgq, long type, size_t size, void* data, int flags,
                  struct sysv_client* src);
 
+/* Local thread blocked on a System V object; woken up with `thread_wakeup` (no PAL event is
+ * involved, so objects not shared with other processes never leave the local process). */
+DEFINE_LIST(sysv_waiter);
+struct sysv_waiter {
+    struct shim_thread* thread;
+    LIST_TYPE(sysv_waiter) list;
+};
+DEFINE_LISTP(sysv_waiter);
+
 DEFINE_LIST(sem_ops);
 struct sem_ops {
     LIST_TYPE(sem_ops) progress;
@@ -102,6 +112,8 @@ struct sem_ops {
         unsigned long timeout;
     } stat;
     struct sysv_client client;
+    /* local waiter, woken up directly once its operations complete (NULL for remote clients) */
+    struct shim_thread* thread;
     struct sembuf ops[];
 };
 
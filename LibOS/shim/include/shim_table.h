@@ -48,6 +48,8 @@ long shim_do_pipe(int* fildes);
 long shim_do_select(int nfds, fd_set* readfds, fd_set* writefds, fd_set* errorfds,
                     struct __kernel_timeval* timeout);
 long shim_do_sched_yield(void);
+void* shim_do_mremap(void* old_addr, size_t old_size, size_t new_size, int flags,
+                     void* new_addr);
 long shim_do_msync(unsigned long start, size_t len, int flags);
 long shim_do_mincore(void* start, size_t len, unsigned char* vec);
 long shim_do_madvise(unsigned long start, size_t len_in, int behavior);
@@ -100,6 +102,9 @@ long shim_do_fsync(int fd);
 long shim_do_fdatasync(int fd);
 long shim_do_truncate(const char* path, loff_t length);
 long shim_do_ftruncate(int fd, loff_t length);
+long shim_do_fallocate(int fd, int mode, loff_t offset, loff_t len);
+long shim_do_fadvise64(int fd, loff_t offset, loff_t len, int advice);
+long shim_do_readahead(int fd, loff_t offset, size_t count);
 long shim_do_getdents(int fd, struct linux_dirent* buf, unsigned int count);
 long shim_do_getcwd(char* buf, size_t size);
 long shim_do_chdir(const char* filename);
@@ -164,6 +169,8 @@ long shim_do_epoll_wait(int epfd, struct __kernel_epoll_event* events, int maxev
 long shim_do_epoll_ctl(int epfd, int op, int fd, struct __kernel_epoll_event* event);
 long shim_do_clock_gettime(clockid_t which_clock, struct timespec* tp);
 long shim_do_clock_getres(clockid_t which_clock, struct timespec* tp);
+long shim_do_getrusage(int who, struct __kernel_rusage* ru);
+long shim_do_times(struct tms* buf);
 long shim_do_clock_nanosleep(clockid_t clock_id, int flags, struct __kernel_timespec* req,
                              struct __kernel_timespec* rem);
 long shim_do_exit_group(int error_code);
@@ -185,6 +192,9 @@ long shim_do_ppoll(struct pollfd* fds, int nfds, struct timespec* tsp, const __s
                    size_t sigsetsize);
 long shim_do_set_robust_list(struct robust_list_head* head, size_t len);
 long shim_do_get_robust_list(pid_t pid, struct robust_list_head** head, size_t* len);
+long shim_do_splice(int fd_in, loff_t* off_in, int fd_out, loff_t* off_out, size_t len,
+                    unsigned int flags);
+long shim_do_vmsplice(int fd, const struct iovec* iov, unsigned long nr_segs, unsigned int flags);
 long shim_do_epoll_pwait(int epfd, struct __kernel_epoll_event* events, int maxevents,
                          int timeout_ms, const __sigset_t* sigmask, size_t sigsetsize);
 long shim_do_accept4(int sockfd, struct sockaddr* addr, int* addrlen, int flags);
@@ -198,15 +208,54 @@ long shim_do_recvmmsg(int sockfd, struct mmsghdr* msg, unsigned int vlen, int fl
 long shim_do_prlimit64(pid_t pid, int resource, const struct __kernel_rlimit64* new_rlim,
                        struct __kernel_rlimit64* old_rlim);
 long shim_do_sendmmsg(int sockfd, struct mmsghdr* msg, unsigned int vlen, int flags);
+long shim_do_timerfd_create(int clockid, int flags);
+long shim_do_timerfd_settime(int fd, int flags, const struct __kernel_itimerspec* new_value,
+                             struct __kernel_itimerspec* old_value);
+long shim_do_timerfd_gettime(int fd, struct __kernel_itimerspec* curr_value);
 long shim_do_eventfd2(unsigned int count, int flags);
 long shim_do_eventfd(unsigned int count);
 long shim_do_getcpu(unsigned* cpu, unsigned* node, struct getcpu_cache* unused);
+long shim_do_io_uring_setup(unsigned int entries, struct io_uring_params* params);
+long shim_do_io_uring_enter(unsigned int fd, unsigned int to_submit, unsigned int min_complete,
+                            unsigned int flags, const void* sig, size_t sigsz);
+long shim_do_io_uring_register(unsigned int fd, unsigned int opcode, void* arg,
+                               unsigned int nr_args);
 long shim_do_getrandom(char* buf, size_t count, unsigned int flags);
+long shim_do_close_range(unsigned int first, unsigned int last, unsigned int flags);
+long shim_do_copy_file_range(int fd_in, loff_t* off_in, int fd_out, loff_t* off_out, size_t len,
+                             unsigned int flags);
+long shim_do_membarrier(int cmd, unsigned int flags, int cpu_id);
+long shim_do_rseq(struct rseq* rseq, uint32_t rseq_len, int flags, uint32_t sig);
+long shim_do_futex_waitv(struct futex_waitv* waiters, unsigned int nr_futexes, unsigned int flags,
+                         struct __kernel_timespec* timeout, clockid_t clockid);
+long shim_do_preadv(int fd, const struct iovec* vec, int vlen, unsigned long pos_l,
+                    unsigned long pos_h);
+long shim_do_pwritev(int fd, const struct iovec* vec, int vlen, unsigned long pos_l,
+                     unsigned long pos_h);
+long shim_do_preadv2(int fd, const struct iovec* vec, int vlen, unsigned long pos_l,
+                     unsigned long pos_h, int flags);
+long shim_do_pwritev2(int fd, const struct iovec* vec, int vlen, unsigned long pos_l,
+                      unsigned long pos_h, int flags);
+
+#ifndef CLOSE_RANGE_UNSHARE
+#define CLOSE_RANGE_UNSHARE (1U << 1)
+#endif
+#ifndef CLOSE_RANGE_CLOEXEC
+#define CLOSE_RANGE_CLOEXEC (1U << 2)
+#endif
 
 #define GRND_NONBLOCK 0x0001
 #define GRND_RANDOM   0x0002
 #define GRND_INSECURE 0x0004
 
+#ifndef RWF_HIPRI
+#define RWF_HIPRI  0x00000001
+#define RWF_DSYNC  0x00000002
+#define RWF_SYNC   0x00000004
+#define RWF_NOWAIT 0x00000008
+#define RWF_APPEND 0x00000010
+#endif
+
 #ifndef MADV_FREE
 #define MADV_FREE 8
 #endif
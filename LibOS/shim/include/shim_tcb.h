@@ -25,6 +25,8 @@ struct shim_tcb {
     /* Function pointers for patched code calling into Graphene. */
     void*               syscalldb;
     void*               register_library;
+    /* `&tp->cputime` (NULL if there is no current thread), read by the vDSO */
+    uint64_t*           cputime;
 
     struct shim_thread* tp;
     void*               libos_stack_bottom;
@@ -33,6 +35,20 @@ struct shim_tcb {
      * an SGX enclave) we lack a way to restore all (or at least some) registers atomically. */
     void*               syscall_scratch_pc;
     void*               vma_cache;
+    void*               slab_cache;
+    /* carrier of user-level threads running on this host thread, see shim_uthread.c */
+    void*               uthread_carrier;
+    /* CPU and NUMA node of this thread as far as LibOS knows: the first CPU allowed by the last
+     * sched_setaffinity() on this thread (or inherited from its parent) and the node of that CPU;
+     * 0 if the affinity was never set. Written by other threads only under `tp->lock`. */
+    int                 cpu;
+    int                 numa_node;
+    /* Odd while the thread is inside LibOS: bumped, with a full memory barrier, on every syscall
+     * entry and return to the application (see `shim_tcb_set_in_libos`). Read by membarrier() of
+     * other threads, together with the last generation of membarrier() this thread acknowledged
+     * in an interrupt. */
+    uint64_t            libos_transitions;
+    uint64_t            membarrier_ack;
     char                log_prefix[32];
 };
 
@@ -45,6 +61,10 @@ static_assert(
         SHIM_REGISTER_LIBRARY_OFFSET,
     "SHIM_REGISTER_LIBRARY_OFFSET must match");
 
+static_assert(
+    offsetof(PAL_TCB, libos_tcb) + offsetof(shim_tcb_t, cputime) == SHIM_CPUTIME_OFFSET,
+    "SHIM_CPUTIME_OFFSET must match");
+
 static inline void __shim_tcb_init(shim_tcb_t* shim_tcb) {
     shim_tcb->canary = SHIM_TCB_CANARY;
     shim_tcb->self = shim_tcb;
@@ -52,6 +72,8 @@ static inline void __shim_tcb_init(shim_tcb_t* shim_tcb) {
     shim_tcb->register_library = &register_library;
     shim_tcb->context.syscall_nr = -1;
     shim_tcb->vma_cache = NULL;
+    shim_tcb->slab_cache = NULL;
+    shim_tcb->uthread_carrier = NULL;
 }
 
 /* Call this function at the beginning of thread execution. */
@@ -68,6 +90,19 @@ static inline shim_tcb_t* shim_get_tcb(void) {
     return SHIM_TCB_GET(self);
 }
 
+/* Cheap query of the NUMA node of the current thread, used to keep per-thread caches node-local */
+static inline int shim_get_numa_node(void) {
+    return SHIM_TCB_GET(numa_node);
+}
+
+/* Called on every syscall entry (`in_libos` is true) and return to the application (false), see
+ * `libos_transitions` */
+static inline void shim_tcb_set_in_libos(bool in_libos) {
+    shim_tcb_t* tcb = shim_get_tcb();
+    if ((tcb->libos_transitions & 1) != in_libos)
+        (void)__atomic_add_fetch(&tcb->libos_transitions, 1, __ATOMIC_SEQ_CST);
+}
+
 static inline bool shim_tcb_check_canary(void) {
     return SHIM_TCB_GET(canary) == SHIM_TCB_CANARY;
 }
@@ -57,11 +57,71 @@ struct shim_signal_queue {
     struct shim_rt_signal_queue rt_signal_queues[NUM_SIGS - SIGRTMIN + 1];
 };
 
+/*
+ * State of a thread which called vfork() and now, until the child calls execve() or exits, runs the
+ * child on a thread description of its own (see `shim_clone.c`).
+ */
+struct shim_vfork_state {
+    /* the thread that called vfork(), which is resumed with `parent_regs` */
+    struct shim_thread* parent;
+    PAL_CONTEXT parent_regs;
+    int* parent_tidptr;
+    /* allocated upfront, so that the child's exit can always be reported to the parent */
+    struct shim_child_process* child_process;
+    IDTYPE child_pgid;
+    /* process-wide state the child may change, restored when the parent is resumed */
+    struct shim_dentry* parent_cwd;
+    mode_t parent_umask;
+};
+
+enum uthread_state {
+    UTHREAD_RUNNING = 0,
+    UTHREAD_PARKING,  /* switching to the scheduling loop of its carrier to be parked */
+    UTHREAD_YIELDING, /* switching to the scheduling loop of its carrier to be requeued */
+    UTHREAD_PARKED,
+    UTHREAD_RUNNABLE,
+};
+
+/*
+ * State of a user-level thread multiplexed on carrier host threads (see `shim_uthread.c`). Except
+ * for `enabled` (which never changes once the thread is visible to other threads) and `cpu` and
+ * `numa_node` (protected by `thread->lock`), protected by the lock of the scheduler.
+ */
+struct shim_uthread {
+    bool enabled;
+    enum uthread_state state;
+    /* equivalent of a signaled `scheduler_event` */
+    bool woken;
+    /* absolute deadline (in microseconds) of the current wait, 0 if none */
+    uint64_t deadline;
+    /* per-thread part of the LibOS TCB and FS base, saved while the thread does not run */
+    void* sp;
+    struct shim_context context;
+    void* syscall_scratch_pc;
+    unsigned long tls;
+    int cpu;
+    int numa_node;
+};
+
+/* syscalls answered by the fast path of `syscalldb`, see `shim_thread::fast_syscalls` */
+enum {
+    FAST_SYSCALL_GETPID = 0,
+    FAST_SYSCALL_GETPPID,
+    FAST_SYSCALL_GETTID,
+    FAST_SYSCALL_GETUID,
+    FAST_SYSCALL_GETEUID,
+    FAST_SYSCALL_GETGID,
+    FAST_SYSCALL_GETEGID,
+    FAST_SYSCALLS_CNT,
+};
+
 DEFINE_LIST(shim_thread);
 DEFINE_LISTP(shim_thread);
 struct shim_thread {
     /* Field for inserting threads on global `g_thread_list`. */
     LIST_TYPE(shim_thread) list;
+    /* Next thread in the same bucket of the TID hash table (see `lookup_thread`). */
+    struct shim_thread* hash_next;
 
     /* Pointer to the bottom of the internal LibOS stack. */
     void* libos_stack_bottom;
@@ -95,6 +155,10 @@ struct shim_thread {
     /* For the field below, see the explanation in "LibOS/shim/src/bookkeep/shim_signal.c" near
      * `g_process_pending_signals_cnt`. */
     uint64_t pending_signals;
+    /* Set whenever this thread may have something to handle in `handle_signal` (a new signal for
+     * it or the process, a change of `signal_mask`, a forced signal, `time_to_die`); cleared there
+     * when a check finds nothing deliverable. Makes the common no-signal case a single load. */
+    bool signal_check_needed;
 
     /*
      * Space to store a forced, synchronous signal. Needed to handle e.g. `SIGSEGV` caused by
@@ -109,10 +173,30 @@ struct shim_thread {
     /* futex robust list */
     struct robust_list_head* robust_list;
 
+    /* Area registered by rseq() and the `cpu_id` last written to it, see shim_rseq.c. Accessed
+     * only by this thread, except for `area` being read by sched_setaffinity(). */
+    struct {
+        struct rseq* area;
+        uint32_t sig;
+        int cpu;
+    } rseq;
+
+    /* Scratch buffer of poll/select, reused across calls; only accessed by this thread. */
+    struct {
+        void* buf;
+        size_t size;
+    } poll_scratch;
+
     PAL_HANDLE scheduler_event;
 
     struct wake_queue_node wake_queue;
 
+    /* If `uthread.enabled`, `pal_handle` is the handle of the carrier the thread runs (or ran)
+     * on and is not owned by the thread. */
+    struct shim_uthread uthread;
+    /* Field for inserting user-level threads on the run queue or the list of timed waiters. */
+    LIST_TYPE(shim_thread) uthread_list;
+
     bool time_to_die;
 
     void* stack;
@@ -121,6 +205,27 @@ struct shim_thread {
     shim_tcb_t* shim_tcb;
     void* frameptr;
 
+    /* non-NULL if this is the child of vfork() running on the parent's thread */
+    struct shim_vfork_state* vfork;
+
+    /* CPU time of the thread, in ticks of the clock of `cputime_now()`: `(start << 1) | 1` while
+     * the thread runs (its CPU time is then `now - start`), `ticks << 1` while it is blocked in
+     * `thread_wait()`, `thread_yield()` or poll. A single word, so that other threads (and the
+     * vDSO, through `shim_tcb->cputime`) read it consistently without a lock; written only by
+     * this thread (see shim_thread.c). */
+    uint64_t cputime;
+
+    /* Syscall statistics, allocated on the first syscall; updated only by this thread (see
+     * `shim_emulate_syscall`). */
+    struct shim_syscall_stats* syscall_stats;
+    /* Numbers of syscalls answered by the fast path of `syscalldb` (syscallas.S), which doesn't
+     * enter `shim_emulate_syscall`; indexed by `FAST_SYSCALL_*`, updated only by this thread. */
+    uint64_t fast_syscalls[FAST_SYSCALLS_CNT];
+    /* Ring buffer of the binary syscall trace, see shim_syscall_trace.c. */
+    struct syscall_trace_ring* syscall_trace;
+    /* Ring buffer of asynchronous logging, see utils/log.c. */
+    struct log_ring* log_ring;
+
     REFTYPE ref_count;
     struct shim_lock lock;
 };
@@ -143,11 +248,14 @@ void free_signal_queue(struct shim_signal_queue* queue);
 
 void get_signal_dispositions(struct shim_signal_dispositions* dispositions);
 void put_signal_dispositions(struct shim_signal_dispositions* dispositions);
+struct shim_signal_dispositions* dup_signal_dispositions(
+    struct shim_signal_dispositions* dispositions);
 
 void get_thread(struct shim_thread* thread);
 void put_thread(struct shim_thread* thread);
 
 void log_setprefix(shim_tcb_t* tcb);
+void release_log_ring(struct shim_thread* thread);
 
 static inline struct shim_thread* get_cur_thread(void) {
     return SHIM_TCB_GET(tp);
@@ -176,15 +284,59 @@ static inline void set_cur_thread(struct shim_thread* thread) {
     }
 
     tcb->tp = thread;
+    tcb->cputime = &thread->cputime;
     tcb->libos_stack_bottom = thread->libos_stack_bottom;
     thread->shim_tcb = tcb;
 
     log_setprefix(tcb);
 }
 
+int init_uthreads(void);
+int uthread_create(struct shim_thread* thread, PAL_CONTEXT* regs, unsigned long tls, int cpu,
+                   int numa_node);
+void uthread_prepare_wait(struct shim_thread* thread);
+int uthread_wait(uint64_t* timeout_us);
+void uthread_wakeup(struct shim_thread* thread);
+void uthread_yield(void);
+noreturn void uthread_exit(int* clear_on_exit);
+
+/* true if new threads are created as user-level threads (`libos.user_threads`) */
+bool uthreads_enabled(void);
+
+/* Number of threads on the thread list and how many of them are blocked in thread_wait(); read
+ * without any lock, so both are only a hint (see `shim_do_sched_yield`) */
+extern uint32_t g_app_threads_cnt;
+extern uint32_t g_waiting_threads_cnt;
+
+/* Called by the current thread in its interrupt upcall, see shim_membarrier.c */
+void membarrier_ack(void);
+void membarrier_reset_on_execve(void);
+
+/* Called before the return of the current thread from a syscall, see shim_rseq.c */
+void rseq_update_cpu(void);
+/* Called when the current thread is interrupted in the application (`context`) or gets a signal
+ * delivered; restarts an rseq critical section the thread is in */
+void rseq_handle_interrupt(PAL_CONTEXT* context);
+
+/* Stop and restart accounting CPU time of the current thread around a blocking wait; no-ops if
+ * it is already (not) accounted. */
+void thread_cputime_pause(void);
+void thread_cputime_resume(void);
+
+/* Clock ticks per second of times() and /proc/<pid>/stat, as on Linux (see sysconf(_SC_CLK_TCK)) */
+#define USER_HZ 100
+
+/* CPU time (in nanoseconds) of `thread`, of all threads of this process (also the exited ones) */
+uint64_t get_thread_cputime_ns(struct shim_thread* thread);
+uint64_t get_process_cputime_ns(void);
+
 static inline void thread_prepare_wait(void) {
     struct shim_thread* cur_thread = get_cur_thread();
     assert(!is_internal(cur_thread));
+    if (cur_thread->uthread.enabled) {
+        uthread_prepare_wait(cur_thread);
+        return;
+    }
     DkEventClear(cur_thread->scheduler_event);
 }
 
@@ -196,14 +348,44 @@ static inline int thread_wait(uint64_t* timeout_us, bool ignore_pending_signals)
         return -EINTR;
     }
 
+    thread_cputime_pause();
+    if (cur_thread->uthread.enabled) {
+        int ret = uthread_wait(timeout_us);
+        thread_cputime_resume();
+        return ret;
+    }
+
+    __atomic_add_fetch(&g_waiting_threads_cnt, 1, __ATOMIC_RELAXED);
     int ret = DkEventWait(cur_thread->scheduler_event, timeout_us);
+    __atomic_sub_fetch(&g_waiting_threads_cnt, 1, __ATOMIC_RELAXED);
+    thread_cputime_resume();
     return ret == -PAL_ERROR_TRYAGAIN ? -ETIMEDOUT : pal_to_unix_errno(ret);
 }
 
 static inline void thread_wakeup(struct shim_thread* thread) {
+    if (thread->uthread.enabled) {
+        uthread_wakeup(thread);
+        return;
+    }
     DkEventSet(thread->scheduler_event);
 }
 
+/* lets other threads run, which for a user-level thread means other threads on its carrier */
+static inline void thread_yield(void) {
+    struct shim_thread* cur_thread = get_cur_thread();
+    if (!cur_thread) {
+        DkThreadYieldExecution();
+        return;
+    }
+
+    thread_cputime_pause();
+    if (cur_thread->uthread.enabled)
+        uthread_yield();
+    else
+        DkThreadYieldExecution();
+    thread_cputime_resume();
+}
+
 /* Adds the thread to the wake-up queue.
  * If this thread is already on some queue, then it *will* be woken up soon and there is no need
  * to add it to another queue.
@@ -247,8 +429,8 @@ static inline void wake_queue(struct wake_queue_head* queue) {
  *
  * \param tid Thread id to look for.
  *
- * Searches global threads list for a thread with id equal to \p tid.
- * If no thread was found returns NULL.
+ * Searches global threads hash table (without taking any lock) for a thread with id equal to
+ * \p tid. If no thread was found returns NULL.
  * Increases refcount of the returned thread.
  */
 struct shim_thread* lookup_thread(IDTYPE tid);
@@ -299,6 +481,9 @@ bool kill_other_threads(void);
 noreturn void thread_exit(int error_code, int term_signal);
 noreturn void process_exit(int error_code, int term_signal);
 
+long vfork_execve(struct shim_handle* exec, const char** argv, const char** envp);
+noreturn void vfork_resume_parent(void);
+
 void release_robust_list(struct robust_list_head* head);
 void release_clear_child_tid(int* clear_child_tid);
 
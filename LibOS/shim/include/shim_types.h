@@ -293,6 +293,201 @@ struct getcpu_cache {
     unsigned long blob[128 / sizeof(long)];
 };
 
+/* futex_waitv() (Linux 5.16), not present in older kernel headers */
+#ifndef FUTEX_WAITV_MAX
+#define FUTEX_32        2
+#define FUTEX_WAITV_MAX 128
+
+struct futex_waitv {
+    uint64_t val;
+    uint64_t uaddr;
+    uint32_t flags;
+    uint32_t __reserved;
+};
+#endif
+
+/* linux/rseq.h (Linux 4.18), not present in older kernel headers */
+#define RSEQ_FLAG_UNREGISTER      (1 << 0)
+#define RSEQ_CPU_ID_UNINITIALIZED (-1)
+
+struct rseq_cs {
+    uint32_t version;
+    uint32_t flags;
+    uint64_t start_ip;
+    uint64_t post_commit_offset;
+    uint64_t abort_ip;
+} __attribute__((aligned(4 * sizeof(uint64_t))));
+
+struct rseq {
+    uint32_t cpu_id_start;
+    uint32_t cpu_id;
+    uint64_t rseq_cs;
+    uint32_t flags;
+} __attribute__((aligned(4 * sizeof(uint64_t))));
+
+/* linux/io_uring.h (Linux 5.6), not present in older kernel headers; only the subset implemented
+ * by LibOS (see fs/io_uring/fs.c) */
+#ifndef IORING_SETUP_IOPOLL
+#define IORING_SETUP_IOPOLL (1U << 0)
+#define IORING_SETUP_SQPOLL (1U << 1)
+#define IORING_SETUP_CQSIZE (1U << 3)
+#define IORING_SETUP_CLAMP  (1U << 4)
+
+#define IORING_OFF_SQ_RING 0ULL
+#define IORING_OFF_CQ_RING 0x8000000ULL
+#define IORING_OFF_SQES    0x10000000ULL
+
+#define IORING_ENTER_GETEVENTS (1U << 0)
+#define IORING_ENTER_SQ_WAKEUP (1U << 1)
+#define IORING_ENTER_SQ_WAIT   (1U << 2)
+#define IORING_ENTER_EXT_ARG   (1U << 3)
+
+#define IORING_FEAT_SINGLE_MMAP   (1U << 0)
+#define IORING_FEAT_NODROP        (1U << 1)
+#define IORING_FEAT_SUBMIT_STABLE (1U << 2)
+#define IORING_FEAT_RW_CUR_POS    (1U << 3)
+
+#define IOSQE_FIXED_FILE  (1U << 0)
+#define IOSQE_IO_DRAIN    (1U << 1)
+#define IOSQE_IO_LINK     (1U << 2)
+#define IOSQE_IO_HARDLINK (1U << 3)
+#define IOSQE_ASYNC       (1U << 4)
+
+#define IORING_FSYNC_DATASYNC (1U << 0)
+
+#define IO_URING_OP_SUPPORTED (1U << 0)
+
+enum {
+    IORING_OP_NOP,
+    IORING_OP_READV,
+    IORING_OP_WRITEV,
+    IORING_OP_FSYNC,
+    IORING_OP_READ_FIXED,
+    IORING_OP_WRITE_FIXED,
+    IORING_OP_POLL_ADD,
+    IORING_OP_POLL_REMOVE,
+    IORING_OP_SYNC_FILE_RANGE,
+    IORING_OP_SENDMSG,
+    IORING_OP_RECVMSG,
+    IORING_OP_TIMEOUT,
+    IORING_OP_TIMEOUT_REMOVE,
+    IORING_OP_ACCEPT,
+    IORING_OP_ASYNC_CANCEL,
+    IORING_OP_LINK_TIMEOUT,
+    IORING_OP_CONNECT,
+    IORING_OP_FALLOCATE,
+    IORING_OP_OPENAT,
+    IORING_OP_CLOSE,
+    IORING_OP_FILES_UPDATE,
+    IORING_OP_STATX,
+    IORING_OP_READ,
+    IORING_OP_WRITE,
+    IORING_OP_FADVISE,
+    IORING_OP_MADVISE,
+    IORING_OP_SEND,
+    IORING_OP_RECV,
+};
+
+enum {
+    IORING_REGISTER_BUFFERS    = 0,
+    IORING_UNREGISTER_BUFFERS  = 1,
+    IORING_REGISTER_FILES      = 2,
+    IORING_UNREGISTER_FILES    = 3,
+    IORING_REGISTER_EVENTFD    = 4,
+    IORING_UNREGISTER_EVENTFD  = 5,
+    IORING_REGISTER_PROBE      = 8,
+};
+
+struct io_uring_sqe {
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t ioprio;
+    int32_t fd;
+    union {
+        uint64_t off;
+        uint64_t addr2;
+    };
+    uint64_t addr;
+    uint32_t len;
+    union {
+        int rw_flags;
+        uint32_t fsync_flags;
+        uint16_t poll_events;
+        uint32_t msg_flags;
+        uint32_t accept_flags;
+        uint32_t open_flags;
+    };
+    uint64_t user_data;
+    union {
+        uint16_t buf_index;
+        uint64_t __pad2[3];
+    };
+};
+
+struct io_sqring_offsets {
+    uint32_t head;
+    uint32_t tail;
+    uint32_t ring_mask;
+    uint32_t ring_entries;
+    uint32_t flags;
+    uint32_t dropped;
+    uint32_t array;
+    uint32_t resv1;
+    uint64_t resv2;
+};
+
+struct io_cqring_offsets {
+    uint32_t head;
+    uint32_t tail;
+    uint32_t ring_mask;
+    uint32_t ring_entries;
+    uint32_t overflow;
+    uint32_t cqes;
+    uint32_t flags;
+    uint32_t resv1;
+    uint64_t resv2;
+};
+
+struct io_uring_params {
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint32_t flags;
+    uint32_t sq_thread_cpu;
+    uint32_t sq_thread_idle;
+    uint32_t features;
+    uint32_t wq_fd;
+    uint32_t resv[3];
+    struct io_sqring_offsets sq_off;
+    struct io_cqring_offsets cq_off;
+};
+
+struct io_uring_probe_op {
+    uint8_t op;
+    uint8_t resv;
+    uint16_t flags;
+    uint32_t resv2;
+};
+
+struct io_uring_probe {
+    uint8_t last_op;
+    uint8_t ops_len;
+    uint16_t resv;
+    uint32_t resv2[3];
+    struct io_uring_probe_op ops[];
+};
+#endif
+
+/* FUTEX_WAIT_MULTIPLE (out-of-tree patches used by Wine/Proton, predates futex_waitv()) */
+#ifndef FUTEX_WAIT_MULTIPLE
+#define FUTEX_WAIT_MULTIPLE 13
+
+struct futex_wait_block {
+    uint32_t* uaddr;
+    uint32_t val;
+    uint32_t bitset;
+};
+#endif
+
 #undef __CPU_SETSIZE
 #undef __NCPUBITS
 
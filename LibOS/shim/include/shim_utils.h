@@ -26,6 +26,16 @@ static inline uint64_t hash64(uint64_t key) {
     return key;
 }
 
+/* hash of a memory page (`size` is a multiple of 8), chains `hash64` over its words, so pages
+ * differing in a single word never collide */
+static inline uint64_t hash_page64(const void* page, size_t size) {
+    const uint64_t* words = page;
+    uint64_t hash = 0;
+    for (size_t i = 0; i < size / sizeof(*words); i++)
+        hash = hash64(hash ^ words[i]);
+    return hash;
+}
+
 /* string object */
 struct shim_str* get_str_obj(void);
 int free_str_obj(struct shim_str* str);
@@ -135,6 +145,8 @@ static inline int qstrcmpstr(const struct shim_qstr* qstr, const char* str, size
 
 /* heap allocation functions */
 int init_slab(void);
+void destroy_thread_slab_cache(void);
+void print_slab_stats(void);
 
 void* malloc(size_t size);
 void free(void* mem);
@@ -163,12 +175,20 @@ int create_pipe(char* name, char* uri, size_t size, PAL_HANDLE* hdl, struct shim
 int init_async_worker(void);
 int64_t install_async_event(PAL_HANDLE object, unsigned long time,
                             void (*callback)(IDTYPE caller, void* arg), void* arg);
+struct async_event;
+int install_async_timer(uint64_t time, void (*callback)(IDTYPE caller, void* arg), void* arg,
+                        struct async_event** out_timer);
+bool cancel_async_timer(struct async_event* timer);
 struct shim_thread* terminate_async_worker(void);
+void print_async_stats(void);
 
 extern const toml_table_t* g_manifest_root;
 
 int read_exact(PAL_HANDLE handle, void* buf, size_t size);
 int write_exact(PAL_HANDLE handle, void* buf, size_t size);
+/* Same as above, but for files: transfer `size` bytes at `offset` of the file. */
+int read_exact_at(PAL_HANDLE handle, size_t offset, void* buf, size_t size);
+int write_exact_at(PAL_HANDLE handle, size_t offset, void* buf, size_t size);
 
 static inline uint64_t timespec_to_us(const struct __kernel_timespec* ts) {
     return ts->tv_sec * TIME_US_IN_S + ts->tv_nsec / TIME_NS_IN_US;
@@ -8,7 +8,36 @@
 #ifndef _SHIM_VDSO_H_
 #define _SHIM_VDSO_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 extern const uint8_t vdso_so[];
 extern const size_t vdso_so_size;
 
+/*
+ * Time data which the vDSO reads to serve clock_gettime(), gettimeofday() and time() without
+ * entering the LibOS. It lives on the page directly below the vDSO image (see vdso.lds) and is
+ * written by the LibOS (see shim_time.c) each time a time syscall reaches it while the data is
+ * stale. Readers follow the seqlock protocol: `seq` is odd while an update is in progress.
+ *
+ * The time at TSC value `tsc` is `base_ns + ((tsc - base_tsc) * ns_mult >> 32)`, valid only for
+ * `tsc - base_tsc < max_delta`; after that (or if `ns_mult` is 0, e.g. when the TSC can't be used
+ * for timekeeping) the vDSO falls back to the syscall.
+ */
+struct vdso_time_data {
+    uint32_t seq;
+    uint32_t reserved;
+    uint64_t base_tsc;
+    uint64_t base_ns;
+    uint64_t ns_mult;
+    uint64_t max_delta;
+    /* like `ns_mult`, for the CPU time of the current thread (see `struct shim_thread`), in TSC
+     * ticks; written once, 0 if the CPU time is not in TSC ticks */
+    uint64_t cputime_ns_mult;
+};
+
+#define VDSO_TIME_PAGE_SIZE 4096
+
+void vdso_time_init(struct vdso_time_data* data);
+
 #endif /* _SHIM_VDSO_H_ */
@@ -75,6 +75,40 @@ void bkeep_remove_tmp_vma(void* vma);
 /* Bookkeeping a change to memory protections. */
 int bkeep_mprotect(void* addr, size_t length, int prot, bool is_internal);
 
+enum bkeep_op_type {
+    BKEEP_OP_MMAP_FIXED, /* see `bkeep_mmap_fixed` */
+    BKEEP_OP_MPROTECT,   /* see `bkeep_mprotect`, `flags` may only contain VMA_INTERNAL */
+};
+
+struct bkeep_op {
+    enum bkeep_op_type type;
+    void* addr;
+    size_t length;
+    int prot;
+    int flags;
+    /* only for BKEEP_OP_MMAP_FIXED */
+    struct shim_handle* file;
+    uint64_t offset;
+    const char* comment;
+};
+
+/*
+ * Bookkeeping a sequence of operations at once, with a single acquisition of the VMA lock. This is
+ * the same as calling the respective `bkeep_*` functions one by one, in particular the operations
+ * before a failed one stay applied. Returns 0 on success, the error of the first failed operation
+ * otherwise.
+ */
+int bkeep_batch(const struct bkeep_op* ops, size_t count);
+
+/*
+ * Bookkeeping a growth of the user mapping [`addr`, `addr` + `old_length`) to `new_length` bytes
+ * in place, by extending the vma containing that range. Fails with -EFAULT if the range is not
+ * inside a single user vma, and with -ENOMEM if the range does not end that vma or if anything is
+ * mapped right after it. The caller has to allocate the added memory afterwards (and to remove it
+ * with `bkeep_munmap` if that fails).
+ */
+int bkeep_mremap_grow(void* addr, size_t old_length, size_t new_length);
+
 /*
  * Bookkeeping an allocation of memory at a fixed address. `flags` must contain either MAP_FIXED or
  * MAP_FIXED_NOREPLACE - the former forces bookkeeping and removes any overlapping VMAs, the latter
@@ -119,10 +153,24 @@ bool is_in_adjacent_user_vmas(const void* addr, size_t length, int prot);
  * The returned array can be subsequently freed by `free_vma_info_array`.
  */
 int dump_all_vmas(struct shim_vma_info** vma_infos, size_t* count, bool include_unmapped);
+
+/* Same as `dump_all_vmas`, but dumps only shared file mappings overlapping [`addr`, `addr` +
+ * `length`). `*vma_infos` may be NULL if there are none. */
+int dump_shared_file_vmas(void* addr, size_t length, struct shim_vma_info** vma_infos,
+                          size_t* count);
 void free_vma_info_array(struct shim_vma_info* vma_infos, size_t count);
 
-/* Implementation of madvise(MADV_DONTNEED) syscall */
+/* Implementation of madvise(MADV_DONTNEED) and madvise(MADV_FREE) syscalls */
 int madvise_dontneed_range(uintptr_t begin, uintptr_t end);
+int madvise_free_range(uintptr_t begin, uintptr_t end);
+
+/* Returns the total size of user (i.e. not internal) mappings. */
+size_t get_user_vm_size(void);
+
+/* Returns a counter increased by every change of the user (i.e. not internal) mappings: anything
+ * derived from them, e.g. a `dump_all_vmas` done after reading the counter, stays valid as long as
+ * it does not change. */
+uint64_t get_vma_generation(void);
 
 void debug_print_all_vmas(void);
 
@@ -14,8 +14,14 @@
 #include "pal.h"
 #include "shim_context.h"
 #include "shim_entry.h"
+#include "shim_entry_api.h"
+#include "shim_flags_conv.h"
 #include "shim_internal.h"
+#include "shim_lock.h"
 #include "shim_thread.h"
+#include "shim_utils.h"
+#include "shim_vma.h"
+#include "toml.h"
 #include "ucontext.h"
 
 #define XSTATE_RESET_SIZE (sizeof(struct shim_fpstate))
@@ -198,6 +204,7 @@ noreturn void restore_child_context_after_clone(struct shim_context* context) {
     PAL_CONTEXT* regs = context->regs;
     context->regs = NULL;
 
+    shim_tcb_set_in_libos(false);
     return_from_syscall(regs);
 }
 
@@ -227,8 +234,9 @@ void prepare_sigframe(PAL_CONTEXT* context, siginfo_t* siginfo, void* handler, v
                   "Incorrect sigframe alignment");
 
     sigframe = (struct sigframe*)stack;
-    /* This could probably be omited as we set all fields explicitly below. */
-    memset(sigframe, 0, sizeof(*sigframe));
+    /* All fields are set explicitly below, only the reserved ones need zeroing; this avoids
+     * clearing the whole frame on every delivery (e.g. of frequent profiling signals). */
+    memset(&sigframe->uc.uc_mcontext.reserved1, 0, sizeof(sigframe->uc.uc_mcontext.reserved1));
 
     sigframe->siginfo = *siginfo;
 
@@ -297,10 +305,272 @@ void restore_sigreturn_context(PAL_CONTEXT* context, __sigset_t* new_mask) {
     context->is_fpregs_used = 1;
 }
 
+/*
+ * Patching of trapping syscall sites, enabled with `libos.patch_syscalls`. Each `syscall`
+ * instruction which doesn't go through patched libc traps (in Linux-SGX PAL, it raises #UD and
+ * exits the enclave), which is very slow for e.g. statically linked Go and musl applications. On
+ * the first trap of a site, the instruction that loads the syscall number into RAX right before
+ * `syscall` is replaced by a jump to a trampoline, which executes that instruction and then enters
+ * LibOS like SYSCALLDB does, so the site doesn't trap anymore.
+ *
+ * The `syscall` instruction itself and anything after it are never modified: other code may jump
+ * there, and other threads may be just about to execute it (they still trap as before). Only the
+ * previous instruction is replaced; since instructions can't be reliably decoded backwards, such an
+ * instruction is only recognized if its effect explains the RAX value of the trapping thread (that
+ * just executed it), and if it isn't preceded by a prefix byte. The new bytes are written with one
+ * 16-byte atomic compare-and-swap, so that other threads execute either the old or the new
+ * instruction. Sites that don't fit these rules are simply not patched.
+ *
+ * Trampolines are kept in normal (not LibOS-internal) anonymous memory, so that they are migrated
+ * together with patched code on fork.
+ */
+#define TRAMPOLINE_SIZE     32
+#define MAX_TRAMPOLINE_PAGES 64
+/* reach of rel32 jumps, with some margin for the offsets inside site and trampoline */
+#define TRAMPOLINE_MAX_DISTANCE ((1UL << 31) - (1UL << 20))
+
+struct trampoline_page {
+    uint8_t* addr;
+    size_t used;
+};
+
+static bool g_patch_syscalls = false;
+static struct shim_lock g_trampolines_lock;
+static struct trampoline_page g_trampoline_pages[MAX_TRAMPOLINE_PAGES];
+static size_t g_trampoline_pages_cnt = 0;
+
+int init_syscall_patching(void) {
+    int ret = toml_bool_in(g_manifest_root, "libos.patch_syscalls", /*defaultval=*/false,
+                           &g_patch_syscalls);
+    if (ret < 0) {
+        log_error("Cannot parse 'libos.patch_syscalls' (the value must be `true` or `false`)\n");
+        return -EINVAL;
+    }
+
+    if (g_patch_syscalls && !create_lock(&g_trampolines_lock))
+        return -ENOMEM;
+    return 0;
+}
+
+static bool is_prefix_byte(uint8_t byte) {
+    switch (byte) {
+        case 0x26: case 0x2e: case 0x36: case 0x3e: case 0x64: case 0x65: /* segment overrides */
+        case 0x66: case 0x67: case 0xf0: case 0xf2: case 0xf3:
+            return true;
+        default:
+            return (byte & 0xf0) == 0x40; /* REX */
+    }
+}
+
+/* Returns the size of the instruction ending at `syscall_insn`, if it is a supported instruction
+ * loading RAX which explains `context->rax`, or 0 otherwise. [syscall_insn - 8, syscall_insn) must
+ * be readable. */
+static size_t decode_syscall_nr_insn(const uint8_t* syscall_insn, PAL_CONTEXT* context) {
+    const uint8_t* insn;
+    int32_t imm;
+
+    /* mov $imm32, %eax (e.g. musl, Go runtime) */
+    insn = syscall_insn - 5;
+    if (insn[0] == 0xb8) {
+        memcpy(&imm, insn + 1, sizeof(imm));
+        if (context->rax == (uint32_t)imm && !is_prefix_byte(insn[-1]))
+            return 5;
+    }
+
+    /* mov $imm32, %rax (sign-extended) */
+    insn = syscall_insn - 7;
+    if (insn[0] == 0x48 && insn[1] == 0xc7 && insn[2] == 0xc0) {
+        memcpy(&imm, insn + 3, sizeof(imm));
+        if (context->rax == (uint64_t)(int64_t)imm && !is_prefix_byte(insn[-1]))
+            return 7;
+    }
+
+    /* mov disp8(%rsp), %rax (e.g. Go syscall.Syscall) */
+    insn = syscall_insn - 5;
+    if (insn[0] == 0x48 && insn[1] == 0x8b && insn[2] == 0x44 && insn[3] == 0x24) {
+        void* addr = (void*)(context->rsp + (int8_t)insn[4]);
+        uint64_t val;
+        if (is_in_adjacent_user_vmas(addr, sizeof(val), PROT_READ)) {
+            memcpy(&val, addr, sizeof(val));
+            if (context->rax == val && !is_prefix_byte(insn[-1]))
+                return 5;
+        }
+    }
+
+    return 0;
+}
+
+static bool cmpxchg16(void* addr, const uint8_t expected[16], const uint8_t desired[16]) {
+    uint64_t exp_lo, exp_hi, des_lo, des_hi;
+    memcpy(&exp_lo, expected, 8);
+    memcpy(&exp_hi, expected + 8, 8);
+    memcpy(&des_lo, desired, 8);
+    memcpy(&des_hi, desired + 8, 8);
+
+    bool swapped;
+    __asm__ volatile("lock cmpxchg16b %1"
+                     : "=@ccz"(swapped), "+m"(*(volatile __int128*)addr), "+a"(exp_lo),
+                       "+d"(exp_hi)
+                     : "b"(des_lo), "c"(des_hi)
+                     : "memory");
+    return swapped;
+}
+
+static bool is_within_rel32(uintptr_t a, uintptr_t b) {
+    return (a > b ? a - b : b - a) <= TRAMPOLINE_MAX_DISTANCE;
+}
+
+/* Returns a free trampoline reachable from `site`, or NULL. Must be called with
+ * `g_trampolines_lock` held. */
+static uint8_t* get_trampoline(uintptr_t site) {
+    for (size_t i = 0; i < g_trampoline_pages_cnt; i++) {
+        struct trampoline_page* page = &g_trampoline_pages[i];
+        if (page->used + TRAMPOLINE_SIZE <= ALLOC_ALIGNMENT
+                && is_within_rel32((uintptr_t)page->addr, site)) {
+            uint8_t* trampoline = page->addr + page->used;
+            page->used += TRAMPOLINE_SIZE;
+            return trampoline;
+        }
+    }
+
+    if (g_trampoline_pages_cnt == MAX_TRAMPOLINE_PAGES)
+        return NULL;
+
+    uintptr_t bottom = MAX((uintptr_t)g_pal_control->user_address.start,
+                           site > TRAMPOLINE_MAX_DISTANCE ? site - TRAMPOLINE_MAX_DISTANCE : 0);
+    uintptr_t top = MIN((uintptr_t)g_pal_control->user_address.end,
+                        site + TRAMPOLINE_MAX_DISTANCE);
+    bottom = ALLOC_ALIGN_UP(bottom);
+    top = ALLOC_ALIGN_DOWN(top);
+    if (bottom >= top)
+        return NULL;
+
+    void* addr;
+    if (bkeep_mmap_any_in_range((void*)bottom, (void*)top, ALLOC_ALIGNMENT, PROT_READ | PROT_EXEC,
+                                MAP_PRIVATE | MAP_ANONYMOUS, /*file=*/NULL, /*offset=*/0,
+                                "syscall_trampolines", &addr) < 0)
+        return NULL;
+
+    if (DkVirtualMemoryAlloc(&addr, ALLOC_ALIGNMENT, 0, PAL_PROT_READ | PAL_PROT_EXEC) < 0) {
+        void* tmp_vma = NULL;
+        if (bkeep_munmap(addr, ALLOC_ALIGNMENT, /*is_internal=*/false, &tmp_vma) < 0)
+            BUG();
+        bkeep_remove_tmp_vma(tmp_vma);
+        return NULL;
+    }
+
+    struct trampoline_page* page = &g_trampoline_pages[g_trampoline_pages_cnt++];
+    page->addr = addr;
+    page->used = TRAMPOLINE_SIZE;
+    return page->addr;
+}
+
+/* Writes `size` bytes of code at `addr`, which is in a single page mapped with `prot` (PAL_PROT_*);
+ * with `expected`, atomically replaces these 16 bytes at `addr` if they are unchanged */
+static int write_code(uint8_t* addr, const uint8_t* code, size_t size, int prot,
+                      const uint8_t* expected) {
+    void* page = (void*)ALLOC_ALIGN_DOWN_PTR(addr);
+    int ret = DkVirtualMemoryProtect(page, ALLOC_ALIGNMENT, prot | PAL_PROT_WRITE);
+    if (ret < 0)
+        return pal_to_unix_errno(ret);
+
+    if (expected) {
+        assert(size == 16 && IS_ALIGNED_PTR(addr, 16));
+        ret = cmpxchg16(addr, expected, code) ? 0 : -EAGAIN;
+    } else {
+        memcpy(addr, code, size);
+    }
+
+    int prot_ret = DkVirtualMemoryProtect(page, ALLOC_ALIGNMENT, prot);
+    if (prot_ret < 0)
+        BUG(); /* code would stay writable */
+    return ret;
+}
+
+static void maybe_patch_syscall(uint8_t* syscall_insn, PAL_CONTEXT* context) {
+    if (!is_in_adjacent_user_vmas(syscall_insn - 8, 8, PROT_READ | PROT_EXEC))
+        return;
+
+    size_t insn_size = decode_syscall_nr_insn(syscall_insn, context);
+    if (!insn_size)
+        return;
+
+    uint8_t* insn = syscall_insn - insn_size;
+    uint8_t* window = ALIGN_DOWN_PTR(insn, 16);
+    if (insn + insn_size > window + 16)
+        return;
+
+    struct shim_vma_info vma_info = {.file = NULL};
+    if (lookup_vma(insn, &vma_info) < 0)
+        return;
+    if (vma_info.file)
+        put_handle(vma_info.file);
+    if (vma_info.flags & MAP_SHARED) {
+        /* would modify the underlying file */
+        return;
+    }
+
+    lock(&g_trampolines_lock);
+
+    uint8_t old[16];
+    memcpy(old, window, sizeof(old));
+    if (memcmp(old + (insn - window), insn, insn_size)) {
+        /* patched by another thread in the meantime */
+        goto out;
+    }
+
+    uint8_t* trampoline = get_trampoline((uintptr_t)insn);
+    if (!trampoline)
+        goto out;
+
+    /* <insn>; lea <syscall_insn + 2>(%rip), %rcx; jmp *%gs:SHIM_SYSCALLDB_OFFSET */
+    uint8_t code[TRAMPOLINE_SIZE];
+    size_t off = 0;
+    memcpy(code, insn, insn_size);
+    off += insn_size;
+    int32_t rel32 = (int32_t)((intptr_t)(syscall_insn + 2) - (intptr_t)(trampoline + off + 7));
+    code[off++] = 0x48;
+    code[off++] = 0x8d;
+    code[off++] = 0x0d;
+    memcpy(code + off, &rel32, sizeof(rel32));
+    off += sizeof(rel32);
+    uint32_t gs_offset = SHIM_SYSCALLDB_OFFSET;
+    code[off++] = 0x65;
+    code[off++] = 0xff;
+    code[off++] = 0x24;
+    code[off++] = 0x25;
+    memcpy(code + off, &gs_offset, sizeof(gs_offset));
+    off += sizeof(gs_offset);
+    assert(off <= sizeof(code));
+    memset(code + off, 0xcc, sizeof(code) - off); /* int3 */
+
+    if (write_code(trampoline, code, sizeof(code), PAL_PROT_READ | PAL_PROT_EXEC,
+                   /*expected=*/NULL) < 0)
+        goto out;
+
+    /* jmp <trampoline>, padded with nops (never executed) to the size of the replaced insn */
+    uint8_t new[16];
+    memcpy(new, old, sizeof(new));
+    uint8_t* jmp = new + (insn - window);
+    rel32 = (int32_t)((intptr_t)trampoline - (intptr_t)(insn + 5));
+    jmp[0] = 0xe9;
+    memcpy(jmp + 1, &rel32, sizeof(rel32));
+    memset(jmp + 5, 0x90, insn_size - 5);
+
+    if (write_code(window, new, sizeof(new), LINUX_PROT_TO_PAL(vma_info.prot, /*map_flags=*/0),
+                   old) == 0)
+        log_debug("Patched syscall at %p\n", syscall_insn);
+    /* on failure the trampoline stays unused, which is harmless */
+out:
+    unlock(&g_trampolines_lock);
+}
+
 bool maybe_emulate_syscall(PAL_CONTEXT* context) {
     uint8_t* rip = (uint8_t*)context->rip;
     if (rip[0] == 0x0f && rip[1] == 0x05) {
         /* This is syscall instruction, let's emulate it. */
+        if (g_patch_syscalls)
+            maybe_patch_syscall(rip, context);
         context->rcx = (uint64_t)rip + 2;
         context->rip = (uint64_t)&syscalldb;
         return true;
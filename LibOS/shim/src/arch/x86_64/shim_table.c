@@ -40,7 +40,7 @@ shim_fp shim_table[LIBOS_SYSCALL_BOUND] = {
     [__NR_pipe]                   = (shim_fp)shim_do_pipe,
     [__NR_select]                 = (shim_fp)shim_do_select,
     [__NR_sched_yield]            = (shim_fp)shim_do_sched_yield,
-    [__NR_mremap]                 = (shim_fp)0, // shim_do_mremap
+    [__NR_mremap]                 = (shim_fp)shim_do_mremap,
     [__NR_msync]                  = (shim_fp)shim_do_msync,
     [__NR_mincore]                = (shim_fp)shim_do_mincore,
     [__NR_madvise]                = (shim_fp)shim_do_madvise,
@@ -113,9 +113,9 @@ shim_fp shim_table[LIBOS_SYSCALL_BOUND] = {
     [__NR_umask]                  = (shim_fp)shim_do_umask,
     [__NR_gettimeofday]           = (shim_fp)shim_do_gettimeofday,
     [__NR_getrlimit]              = (shim_fp)shim_do_getrlimit,
-    [__NR_getrusage]              = (shim_fp)0, // shim_do_getrusage
+    [__NR_getrusage]              = (shim_fp)shim_do_getrusage,
     [__NR_sysinfo]                = (shim_fp)0, // shim_do_sysinfo
-    [__NR_times]                  = (shim_fp)0, // shim_do_times
+    [__NR_times]                  = (shim_fp)shim_do_times,
     [__NR_ptrace]                 = (shim_fp)0, // shim_do_ptrace
     [__NR_getuid]                 = (shim_fp)shim_do_getuid,
     [__NR_syslog]                 = (shim_fp)0, // shim_do_syslog
@@ -202,7 +202,7 @@ shim_fp shim_table[LIBOS_SYSCALL_BOUND] = {
     [__NR_tuxcall]                = (shim_fp)0, // shim_do_tuxcall,
     [__NR_security]               = (shim_fp)0, // shim_do_security,
     [__NR_gettid]                 = (shim_fp)shim_do_gettid,
-    [__NR_readahead]              = (shim_fp)0, // shim_do_readahead
+    [__NR_readahead]              = (shim_fp)shim_do_readahead,
     [__NR_setxattr]               = (shim_fp)0, // shim_do_setxattr
     [__NR_lsetxattr]              = (shim_fp)0, // shim_do_lsetxattr
     [__NR_fsetxattr]              = (shim_fp)0, // shim_do_fsetxattr
@@ -236,7 +236,7 @@ shim_fp shim_table[LIBOS_SYSCALL_BOUND] = {
     [__NR_set_tid_address]        = (shim_fp)shim_do_set_tid_address,
     [__NR_restart_syscall]        = (shim_fp)0, // shim_do_restart_syscall
     [__NR_semtimedop]             = (shim_fp)shim_do_semtimedop,
-    [__NR_fadvise64]              = (shim_fp)0, // shim_do_fadvise64
+    [__NR_fadvise64]              = (shim_fp)shim_do_fadvise64,
     [__NR_timer_create]           = (shim_fp)0, // shim_do_timer_create
     [__NR_timer_settime]          = (shim_fp)0, // shim_do_timer_settime
     [__NR_timer_gettime]          = (shim_fp)0, // shim_do_timer_gettime
@@ -290,19 +290,19 @@ shim_fp shim_table[LIBOS_SYSCALL_BOUND] = {
     [__NR_unshare]                = (shim_fp)0, // shim_do_unshare
     [__NR_set_robust_list]        = (shim_fp)shim_do_set_robust_list,
     [__NR_get_robust_list]        = (shim_fp)shim_do_get_robust_list,
-    [__NR_splice]                 = (shim_fp)0, // shim_do_splice
+    [__NR_splice]                 = (shim_fp)shim_do_splice,
     [__NR_tee]                    = (shim_fp)0, // shim_do_tee
     [__NR_sync_file_range]        = (shim_fp)0, // shim_do_sync_file_range
-    [__NR_vmsplice]               = (shim_fp)0, // shim_do_vmsplice
+    [__NR_vmsplice]               = (shim_fp)shim_do_vmsplice,
     [__NR_move_pages]             = (shim_fp)0, // shim_do_move_pages
     [__NR_utimensat]              = (shim_fp)0, // shim_do_utimensat
     [__NR_epoll_pwait]            = (shim_fp)shim_do_epoll_pwait,
     [__NR_signalfd]               = (shim_fp)0, // shim_do_signalfd
-    [__NR_timerfd_create]         = (shim_fp)0, // shim_do_timerfd_create
+    [__NR_timerfd_create]         = (shim_fp)shim_do_timerfd_create,
     [__NR_eventfd]                = (shim_fp)shim_do_eventfd,
-    [__NR_fallocate]              = (shim_fp)0, // shim_do_fallocate
-    [__NR_timerfd_settime]        = (shim_fp)0, // shim_do_timerfd_settime
-    [__NR_timerfd_gettime]        = (shim_fp)0, // shim_do_timerfd_gettime
+    [__NR_fallocate]              = (shim_fp)shim_do_fallocate,
+    [__NR_timerfd_settime]        = (shim_fp)shim_do_timerfd_settime,
+    [__NR_timerfd_gettime]        = (shim_fp)shim_do_timerfd_gettime,
     [__NR_accept4]                = (shim_fp)shim_do_accept4,
     [__NR_signalfd4]              = (shim_fp)0, // shim_do_signalfd4
     [__NR_eventfd2]               = (shim_fp)shim_do_eventfd2,
@@ -310,8 +310,8 @@ shim_fp shim_table[LIBOS_SYSCALL_BOUND] = {
     [__NR_dup3]                   = (shim_fp)shim_do_dup3,
     [__NR_pipe2]                  = (shim_fp)shim_do_pipe2,
     [__NR_inotify_init1]          = (shim_fp)0, // shim_do_inotify_init1
-    [__NR_preadv]                 = (shim_fp)0, // shim_do_preadv
-    [__NR_pwritev]                = (shim_fp)0, // shim_do_pwritev
+    [__NR_preadv]                 = (shim_fp)shim_do_preadv,
+    [__NR_pwritev]                = (shim_fp)shim_do_pwritev,
     [__NR_rt_tgsigqueueinfo]      = (shim_fp)0, // shim_do_rt_tgsigqueueinfo
     [__NR_perf_event_open]        = (shim_fp)0, // shim_do_perf_event_open
     [__NR_recvmmsg]               = (shim_fp)shim_do_recvmmsg,
@@ -339,19 +339,21 @@ shim_fp shim_table[LIBOS_SYSCALL_BOUND] = {
     [__NR_bpf]                    = (shim_fp)0, // shim_do_bpf
     [__NR_execveat]               = (shim_fp)0, // shim_do_execveat
     [__NR_userfaultfd]            = (shim_fp)0, // shim_do_userfaultfd
-    [__NR_membarrier]             = (shim_fp)0, // shim_do_membarrier
+    [__NR_membarrier]             = (shim_fp)shim_do_membarrier,
     [__NR_mlock2]                 = (shim_fp)0, // shim_do_mlock2
-    [__NR_copy_file_range]        = (shim_fp)0, // shim_do_copy_file_range
-    [__NR_preadv2]                = (shim_fp)0, // shim_do_preadv2
-    [__NR_pwritev2]               = (shim_fp)0, // shim_do_pwritev2
+    [__NR_copy_file_range]        = (shim_fp)shim_do_copy_file_range,
+    [__NR_preadv2]                = (shim_fp)shim_do_preadv2,
+    [__NR_pwritev2]               = (shim_fp)shim_do_pwritev2,
     [__NR_pkey_mprotect]          = (shim_fp)0, // shim_do_pkey_mprotect
     [__NR_pkey_alloc]             = (shim_fp)0, // shim_do_pkey_alloc
     [__NR_pkey_free]              = (shim_fp)0, // shim_do_pkey_free
     [__NR_statx]                  = (shim_fp)0, // shim_do_statx
     [__NR_io_pgetevents]          = (shim_fp)0, // shim_do_io_pgetevents
-    [__NR_rseq]                   = (shim_fp)0, // shim_do_rseq
+    [__NR_rseq]                   = (shim_fp)shim_do_rseq,
     [__NR_pidfd_send_signal]      = (shim_fp)0, // shim_do_pidfd_send_signal
-    [__NR_io_uring_setup]         = (shim_fp)0, // shim_do_io_uring_setup
-    [__NR_io_uring_enter]         = (shim_fp)0, // shim_do_io_uring_enter
-    [__NR_io_uring_register]      = (shim_fp)0, // shim_do_io_uring_register
+    [__NR_io_uring_setup]         = (shim_fp)shim_do_io_uring_setup,
+    [__NR_io_uring_enter]         = (shim_fp)shim_do_io_uring_enter,
+    [__NR_io_uring_register]      = (shim_fp)shim_do_io_uring_register,
+    [__NR_close_range]            = (shim_fp)shim_do_close_range,
+    [__NR_futex_waitv]            = (shim_fp)shim_do_futex_waitv,
 };
@@ -29,6 +29,9 @@ static MEM_MGR handle_mgr = NULL;
 
 #define INIT_HANDLE_MAP_SIZE 32
 
+/* number of PAL handles closed with one DkObjectsClose() by put_handles() */
+#define PUT_HANDLES_BATCH 64
+
 //#define DEBUG_REF
 
 static int init_tty_handle(struct shim_handle* hdl, bool write) {
@@ -160,7 +163,7 @@ out:
 
 static struct shim_handle_map* get_new_handle_map(FDTYPE size);
 
-static int __init_handle(struct shim_fd_handle** fdhdl, FDTYPE fd, struct shim_handle* hdl,
+static int __init_handle(struct shim_handle_map* map, FDTYPE fd, struct shim_handle* hdl,
                          int fd_flags);
 
 static int __enlarge_handle_map(struct shim_handle_map* map, size_t size);
@@ -220,7 +223,7 @@ int init_important_handles(void) {
             return ret;
         }
 
-        __init_handle(&handle_map->map[0], /*fd=*/0, stdin_hdl, /*flags=*/0);
+        __init_handle(handle_map, /*fd=*/0, stdin_hdl, /*flags=*/0);
         put_handle(stdin_hdl);
     }
 
@@ -238,14 +241,14 @@ int init_important_handles(void) {
             return ret;
         }
 
-        __init_handle(&handle_map->map[1], /*fd=*/1, stdout_hdl, /*flags=*/0);
+        __init_handle(handle_map, /*fd=*/1, stdout_hdl, /*flags=*/0);
         put_handle(stdout_hdl);
     }
 
     /* initialize stderr as duplicate of stdout */
     if (!HANDLE_ALLOCATED(handle_map->map[2])) {
         struct shim_handle* stdout_hdl = handle_map->map[1]->handle;
-        __init_handle(&handle_map->map[2], /*fd=*/2, stdout_hdl, /*flags=*/0);
+        __init_handle(handle_map, /*fd=*/2, stdout_hdl, /*flags=*/0);
     }
 
     if (handle_map->fd_top == FD_NULL || handle_map->fd_top < 2)
@@ -275,22 +278,105 @@ struct shim_handle* __get_fd_handle(FDTYPE fd, int* fd_flags, struct shim_handle
     return NULL;
 }
 
+/*
+ * Lock-free version of `__get_fd_handle`, with a reference taken on the returned handle. Writers
+ * publish new entries and arrays atomically (see `__init_handle` and `__enlarge_handle_map`), and
+ * don't release what they replaced before `rcu_synchronize`.
+ */
 struct shim_handle* get_fd_handle(FDTYPE fd, int* fd_flags, struct shim_handle_map* map) {
     if (!map)
         map = get_thread_handle_map(NULL);
 
+    uint32_t idx = rcu_read_begin(&map->rcu);
+
     struct shim_handle* hdl = NULL;
-    lock(&map->lock);
-    if ((hdl = __get_fd_handle(fd, fd_flags, map)))
-        get_handle(hdl);
-    unlock(&map->lock);
+
+    /* `fd_size` is updated after `map`, so the array we load is at least that big */
+    if (fd < __atomic_load_n(&map->fd_size, __ATOMIC_ACQUIRE)) {
+        struct shim_fd_handle** array = __atomic_load_n(&map->map, __ATOMIC_ACQUIRE);
+        struct shim_fd_handle* fd_handle = __atomic_load_n(&array[fd], __ATOMIC_ACQUIRE);
+
+        if (fd_handle && __atomic_load_n(&fd_handle->vfd, __ATOMIC_ACQUIRE) != FD_NULL) {
+            hdl = __atomic_load_n(&fd_handle->handle, __ATOMIC_RELAXED);
+            if (hdl) {
+                if (fd_flags)
+                    *fd_flags = __atomic_load_n(&fd_handle->flags, __ATOMIC_RELAXED);
+                get_handle(hdl);
+            }
+        }
+    }
+
+    rcu_read_end(&map->rcu, idx);
     return hdl;
 }
 
-struct shim_handle* __detach_fd_handle(struct shim_fd_handle* fd, int* flags,
+/* Drops a reference to an fd entry. If it was the last one, frees the entry and returns its
+ * handle, whose reference is to be dropped by the caller. */
+static struct shim_handle* __put_fd_handle(struct shim_fd_handle* fd_hdl) {
+    if (REF_DEC(fd_hdl->ref_count))
+        return NULL;
+
+    struct shim_handle* handle = HANDLE_ALLOCATED(fd_hdl) ? fd_hdl->handle : NULL;
+    free(fd_hdl);
+    return handle;
+}
+
+/* Replaces the entry of `fd` in `map` with `new_fd_hdl` (may be NULL), if the entry is shared with
+ * other maps. Returns true if it was replaced. */
+static bool __replace_shared_fd_handle(FDTYPE fd, struct shim_fd_handle* new_fd_hdl,
                                        struct shim_handle_map* map) {
     assert(locked(&map->lock));
 
+    struct shim_fd_handle* old_fd_hdl = map->map[fd];
+    /* only this map can share the entry again (in `dup_handle_map`, under our lock) */
+    if (!old_fd_hdl || REF_GET(old_fd_hdl->ref_count) == 1)
+        return false;
+
+    __atomic_store_n(&map->map[fd], new_fd_hdl, __ATOMIC_RELEASE);
+
+    /* lock-free readers of this map may still be looking at the old entry, which the other maps
+     * free as soon as we drop our reference */
+    rcu_synchronize(&map->rcu);
+    struct shim_handle* handle = __put_fd_handle(old_fd_hdl);
+    if (handle)
+        put_handle(handle);
+    return true;
+}
+
+/* Makes the entry of `fd` (if any) private to `map`, so that it can be modified in place. */
+static int __unshare_fd_handle(FDTYPE fd, struct shim_handle_map* map) {
+    assert(locked(&map->lock));
+
+    struct shim_fd_handle* old_fd_hdl = map->map[fd];
+    if (!old_fd_hdl || REF_GET(old_fd_hdl->ref_count) == 1)
+        return 0;
+
+    struct shim_fd_handle* new_fd_hdl = malloc(sizeof(*new_fd_hdl));
+    if (!new_fd_hdl)
+        return -ENOMEM;
+
+    new_fd_hdl->vfd    = old_fd_hdl->vfd;
+    new_fd_hdl->flags  = old_fd_hdl->flags;
+    new_fd_hdl->handle = HANDLE_ALLOCATED(old_fd_hdl) ? old_fd_hdl->handle : NULL;
+    REF_SET(new_fd_hdl->ref_count, 1);
+    if (new_fd_hdl->handle)
+        get_handle(new_fd_hdl->handle);
+
+    if (!__replace_shared_fd_handle(fd, new_fd_hdl, map)) {
+        /* the other maps dropped the entry meanwhile, it is ours now */
+        if (new_fd_hdl->handle)
+            put_handle(new_fd_hdl->handle);
+        free(new_fd_hdl);
+    }
+    return 0;
+}
+
+/* same as __detach_fd_handle(), but the caller must rcu_synchronize() before releasing the
+ * handle */
+static struct shim_handle* __detach_fd_handle_nosync(struct shim_fd_handle* fd, int* flags,
+                                                     struct shim_handle_map* map) {
+    assert(locked(&map->lock));
+
     struct shim_handle* handle = NULL;
 
     if (HANDLE_ALLOCATED(fd)) {
@@ -299,9 +385,18 @@ struct shim_handle* __detach_fd_handle(struct shim_fd_handle* fd, int* flags,
         if (flags)
             *flags = fd->flags;
 
-        fd->vfd    = FD_NULL;
-        fd->handle = NULL;
-        fd->flags  = 0;
+        /* a shared entry is not copied, only removed from this map, with a new reference for the
+         * caller */
+        bool shared = REF_GET(fd->ref_count) > 1;
+        if (shared)
+            get_handle(handle);
+        if (!shared || !__replace_shared_fd_handle(vfd, /*new_fd_hdl=*/NULL, map)) {
+            if (shared)
+                put_handle(handle);
+            __atomic_store_n(&fd->vfd, FD_NULL, __ATOMIC_RELAXED);
+            __atomic_store_n(&fd->handle, NULL, __ATOMIC_RELAXED);
+            __atomic_store_n(&fd->flags, 0, __ATOMIC_RELAXED);
+        }
 
         if (vfd == map->fd_top)
             do {
@@ -313,6 +408,16 @@ struct shim_handle* __detach_fd_handle(struct shim_fd_handle* fd, int* flags,
     return handle;
 }
 
+struct shim_handle* __detach_fd_handle(struct shim_fd_handle* fd, int* flags,
+                                       struct shim_handle_map* map) {
+    struct shim_handle* handle = __detach_fd_handle_nosync(fd, flags, map);
+    if (handle) {
+        /* lock-free readers may still be taking a reference on `handle` */
+        rcu_synchronize(&map->rcu);
+    }
+    return handle;
+}
+
 struct shim_handle* detach_fd_handle(FDTYPE fd, int* flags, struct shim_handle_map* handle_map) {
     struct shim_handle* handle = NULL;
 
@@ -328,6 +433,45 @@ struct shim_handle* detach_fd_handle(FDTYPE fd, int* flags, struct shim_handle_m
     return handle;
 }
 
+size_t detach_fd_handles(FDTYPE* fd, FDTYPE last_fd, bool cloexec_only,
+                         struct shim_handle** handles, size_t max_count,
+                         struct shim_handle_map* map) {
+    size_t count = 0;
+
+    lock(&map->lock);
+
+    if (map->fd_top != FD_NULL) {
+        FDTYPE end = MIN(last_fd, map->fd_top);
+        for (; *fd <= end && count < max_count; (*fd)++) {
+            struct shim_fd_handle* fd_hdl = map->map[*fd];
+            if (!HANDLE_ALLOCATED(fd_hdl) || (cloexec_only && !(fd_hdl->flags & FD_CLOEXEC)))
+                continue;
+            handles[count++] = __detach_fd_handle_nosync(fd_hdl, NULL, map);
+        }
+    }
+
+    /* one grace period for all detached handles */
+    if (count)
+        rcu_synchronize(&map->rcu);
+
+    unlock(&map->lock);
+    return count;
+}
+
+int __set_fd_handle_flags(FDTYPE fd, int fd_flags, struct shim_handle_map* map) {
+    assert(locked(&map->lock));
+
+    if (fd >= map->fd_size || !HANDLE_ALLOCATED(map->map[fd]))
+        return 0;
+
+    int ret = __unshare_fd_handle(fd, map);
+    if (ret < 0)
+        return ret;
+
+    __atomic_store_n(&map->map[fd]->flags, fd_flags & FD_CLOEXEC, __ATOMIC_RELAXED);
+    return 0;
+}
+
 struct shim_handle* get_new_handle(void) {
     struct shim_handle* new_handle =
         get_mem_obj_from_mgr_enlarge(handle_mgr, size_align_up(HANDLE_MGR_ALLOC));
@@ -344,22 +488,29 @@ struct shim_handle* get_new_handle(void) {
     return new_handle;
 }
 
-static int __init_handle(struct shim_fd_handle** fdhdl, FDTYPE fd, struct shim_handle* hdl,
+static int __init_handle(struct shim_handle_map* map, FDTYPE fd, struct shim_handle* hdl,
                          int fd_flags) {
-    struct shim_fd_handle* new_handle = *fdhdl;
     assert((fd_flags & ~FD_CLOEXEC) == 0);  // The only supported flag right now
 
+    /* the slot is free, a shared (empty) entry is dropped instead of copied */
+    __replace_shared_fd_handle(fd, /*new_fd_hdl=*/NULL, map);
+
+    struct shim_fd_handle** fdhdl = &map->map[fd];
+    struct shim_fd_handle* new_handle = *fdhdl;
     if (!new_handle) {
         new_handle = malloc(sizeof(struct shim_fd_handle));
         if (!new_handle)
             return -ENOMEM;
-        *fdhdl = new_handle;
+        new_handle->vfd = FD_NULL;
+        REF_SET(new_handle->ref_count, 1);
+        __atomic_store_n(fdhdl, new_handle, __ATOMIC_RELEASE);
     }
 
-    new_handle->vfd   = fd;
-    new_handle->flags = fd_flags;
+    /* `vfd` is set last: lock-free readers (see `get_fd_handle`) check it first */
     get_handle(hdl);
-    new_handle->handle = hdl;
+    __atomic_store_n(&new_handle->handle, hdl, __ATOMIC_RELAXED);
+    __atomic_store_n(&new_handle->flags, fd_flags, __ATOMIC_RELAXED);
+    __atomic_store_n(&new_handle->vfd, fd, __ATOMIC_RELEASE);
     return 0;
 }
 
@@ -412,7 +563,7 @@ static int __set_new_fd_handle(FDTYPE fd, struct shim_handle* hdl, int fd_flags,
 
     assert(handle_map->map);
     assert(fd < handle_map->fd_size);
-    ret = __init_handle(&handle_map->map[fd], fd, hdl, fd_flags);
+    ret = __init_handle(handle_map, fd, hdl, fd_flags);
     if (ret < 0)
         goto out;
 
@@ -466,13 +617,16 @@ static void destroy_handle(struct shim_handle* hdl) {
     free_mem_obj_to_mgr(handle_mgr, hdl);
 }
 
-void put_handle(struct shim_handle* hdl) {
+/* Drops a reference to `hdl`. If it was the last one, releases the handle, except for its PAL
+ * handle, which is returned to be closed by the caller. */
+static PAL_HANDLE __put_handle(struct shim_handle* hdl) {
     int ref_count = REF_DEC(hdl->ref_count);
 
 #ifdef DEBUG_REF
     log_debug("put handle %p(%s) (ref_count = %d)\n", hdl, __handle_name(hdl), ref_count);
 #endif
 
+    PAL_HANDLE pal_handle = NULL;
     if (!ref_count) {
         delete_from_epoll_handles(hdl);
 
@@ -497,7 +651,7 @@ void put_handle(struct shim_handle* hdl) {
 #ifdef DEBUG_REF
             log_debug("handle %p closes PAL handle %p\n", hdl, hdl->pal_handle);
 #endif
-            DkObjectClose(hdl->pal_handle); // TODO: handle errors
+            pal_handle = hdl->pal_handle;
             hdl->pal_handle = NULL;
         }
 
@@ -506,6 +660,33 @@ void put_handle(struct shim_handle* hdl) {
 
         destroy_handle(hdl);
     }
+    return pal_handle;
+}
+
+void put_handle(struct shim_handle* hdl) {
+    PAL_HANDLE pal_handle = __put_handle(hdl);
+    if (pal_handle)
+        DkObjectClose(pal_handle); // TODO: handle errors
+}
+
+void put_handles(struct shim_handle** hdls, size_t count) {
+    PAL_HANDLE pal_handles[PUT_HANDLES_BATCH];
+    size_t pal_handles_cnt = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        PAL_HANDLE pal_handle = __put_handle(hdls[i]);
+        if (!pal_handle)
+            continue;
+
+        pal_handles[pal_handles_cnt++] = pal_handle;
+        if (pal_handles_cnt == ARRAY_SIZE(pal_handles)) {
+            DkObjectsClose(pal_handles, pal_handles_cnt);
+            pal_handles_cnt = 0;
+        }
+    }
+
+    if (pal_handles_cnt)
+        DkObjectsClose(pal_handles, pal_handles_cnt);
 }
 
 int get_file_size(struct shim_handle* hdl, uint64_t* size) {
@@ -575,9 +756,13 @@ static int __enlarge_handle_map(struct shim_handle_map* map, size_t size) {
         return -ENOMEM;
 
     memcpy(new_map, map->map, map->fd_size * sizeof(new_map[0]));
-    free(map->map);
-    map->map     = new_map;
-    map->fd_size = size;
+    struct shim_fd_handle** old_map = map->map;
+    __atomic_store_n(&map->map, new_map, __ATOMIC_RELEASE);
+    __atomic_store_n(&map->fd_size, size, __ATOMIC_RELEASE);
+
+    /* lock-free readers may still be using the old array */
+    rcu_synchronize(&map->rcu);
+    free(old_map);
     return 0;
 }
 
@@ -588,42 +773,24 @@ int dup_handle_map(struct shim_handle_map** new, struct shim_handle_map* old_map
        the old one */
     struct shim_handle_map* new_map = get_new_handle_map(old_map->fd_size);
 
-    if (!new_map)
+    if (!new_map) {
+        unlock(&old_map->lock);
         return -ENOMEM;
+    }
 
     new_map->fd_top = old_map->fd_top;
 
     if (old_map->fd_top == FD_NULL)
         goto done;
 
+    /* the entries are shared with the old map until either of the maps modifies them (see
+     * `__unshare_fd_handle`), so a map which is released soon (e.g. a child which calls execve())
+     * costs neither copies of the entries nor references on the handles */
     for (int i = 0; i <= old_map->fd_top; i++) {
         struct shim_fd_handle* fd_old = old_map->map[i];
-        struct shim_fd_handle* fd_new;
-
-        /* now we go through the handle map and reassign each
-           of them being allocated */
         if (HANDLE_ALLOCATED(fd_old)) {
-            /* first, get the handle to prevent it from being deleted */
-            struct shim_handle* hdl = fd_old->handle;
-            get_handle(hdl);
-
-            fd_new = malloc(sizeof(struct shim_fd_handle));
-            if (!fd_new) {
-                for (int j = 0; j < i; j++) {
-                    put_handle(new_map->map[j]->handle);
-                    free(new_map->map[j]);
-                }
-                unlock(&old_map->lock);
-                *new = NULL;
-                free(new_map);
-                return -ENOMEM;
-            }
-
-            /* DP: I assume we really need a deep copy of the handle map? */
-            new_map->map[i] = fd_new;
-            fd_new->vfd     = fd_old->vfd;
-            fd_new->handle  = hdl;
-            fd_new->flags   = fd_old->flags;
+            REF_INC(fd_old->ref_count);
+            new_map->map[i] = fd_old;
         }
     }
 
@@ -644,19 +811,24 @@ void put_handle_map(struct shim_handle_map* map) {
         if (map->fd_top == FD_NULL)
             goto done;
 
+        /* the last user of the map is gone (e.g. exited), close the PAL handles in batches */
+        struct shim_handle* handles[PUT_HANDLES_BATCH];
+        size_t handles_cnt = 0;
         for (int i = 0; i <= map->fd_top; i++) {
             if (!map->map[i])
                 continue;
 
-            if (map->map[i]->vfd != FD_NULL) {
-                struct shim_handle* handle = map->map[i]->handle;
-
-                if (handle)
-                    put_handle(handle);
+            /* entries still shared with other maps stay with them */
+            struct shim_handle* handle = __put_fd_handle(map->map[i]);
+            if (handle) {
+                handles[handles_cnt++] = handle;
+                if (handles_cnt == ARRAY_SIZE(handles)) {
+                    put_handles(handles, handles_cnt);
+                    handles_cnt = 0;
+                }
             }
-
-            free(map->map[i]);
         }
+        put_handles(handles, handles_cnt);
 
     done:
         destroy_lock(&map->lock);
@@ -696,6 +868,21 @@ BEGIN_CP_FUNC(handle) {
     size_t off = GET_FROM_CP_MAP(obj);
 
     if (!off) {
+        /* the child can't access in-LibOS pipes, socketpairs and eventfds of this process, move
+         * them to the host; the child takes over the shared anonymous memory we publish */
+        int ret = 0;
+        if (hdl->type == TYPE_PIPE) {
+            ret = migrate_pipe_ring(hdl);
+        } else if (hdl->type == TYPE_SOCK) {
+            ret = migrate_sock_rings(hdl);
+        } else if (hdl->type == TYPE_EVENTFD) {
+            ret = migrate_eventfd(hdl);
+        } else if (hdl->type == TYPE_ANON_SHM) {
+            ret = migrate_anon_shm(hdl);
+        }
+        if (ret < 0)
+            return ret;
+
         off = ADD_CP_OFFSET(sizeof(struct shim_handle));
         ADD_TO_CP_MAP(obj, off);
         new_hdl = (struct shim_handle*)(base + off);
@@ -727,6 +914,13 @@ BEGIN_CP_FUNC(handle) {
             DO_CP_MEMBER(dentry, hdl, new_hdl, dentry);
         }
 
+        /* only set for in-LibOS objects, which are not inherited */
+        new_hdl->pal_wr_handle = NULL;
+        if ((hdl->type == TYPE_EVENTFD && !hdl->info.eventfd.host) || hdl->type == TYPE_TIMERFD) {
+            /* not moved to the host (see `migrate_eventfd`), `pal_handle` is a LibOS event */
+            new_hdl->pal_handle = NULL;
+        }
+
         if (new_hdl->pal_handle) {
             struct shim_palhdl_entry* entry;
             DO_CP(palhdl, hdl->pal_handle, &entry);
@@ -740,13 +934,64 @@ BEGIN_CP_FUNC(handle) {
             case TYPE_EPOLL:
                 /* `new_hdl->info.epoll.fds_count` stays the same - copied above. */
                 DO_CP(epoll_item, &hdl->info.epoll.fds, &new_hdl->info.epoll.fds);
-                __atomic_store_n(&new_hdl->info.epoll.waiter_cnt, 0, __ATOMIC_RELAXED);
-                memset(&new_hdl->info.epoll.event, '\0', sizeof(new_hdl->info.epoll.event));
+                new_hdl->info.epoll.waiter_cnt = 0;
+                /* PAL poller is created on restore, items are registered in it on first use
+                 * (their PAL handles may not be restored yet) */
+                new_hdl->info.epoll.poller    = NULL;
+                new_hdl->info.epoll.needs_arm = true;
+                INIT_LISTP(&new_hdl->info.epoll.ready);
+                INIT_LISTP(&new_hdl->info.epoll.removed);
                 break;
             case TYPE_SOCK:
                 /* no support for multiple processes sharing options/peek buffer of the socket */
                 new_hdl->info.sock.pending_options = NULL;
                 new_hdl->info.sock.peek_buffer     = NULL;
+                /* buffered writes are flushed by this process */
+                new_hdl->info.sock.write_buffer    = NULL;
+                /* migrated above, the rings are kept only until this process closes the socket */
+                new_hdl->info.sock.ring_in  = NULL;
+                new_hdl->info.sock.ring_out = NULL;
+                break;
+            case TYPE_TMPFS:
+                /* tmpfs files are not inherited, the child can't access the file through it */
+                new_hdl->info.tmpfs.data = NULL;
+                break;
+            case TYPE_PIPE:
+                /* migrated above, the ring is kept only until this process closes the pipe */
+                new_hdl->info.pipe.ring = NULL;
+                break;
+            case TYPE_EVENTFD:
+                /* the child creates its own poll events */
+                INIT_LISTP(&new_hdl->info.eventfd.waiters);
+                new_hdl->info.eventfd.polled       = false;
+                new_hdl->info.eventfd.readable_set = false;
+                new_hdl->info.eventfd.writable_set = false;
+                memset(&new_hdl->info.eventfd.readable, 0, sizeof(new_hdl->info.eventfd.readable));
+                memset(&new_hdl->info.eventfd.writable, 0, sizeof(new_hdl->info.eventfd.writable));
+                break;
+            case TYPE_TIMERFD:
+                /* the child gets a copy of the timer, armed on first use (see
+                 * `ensure_timerfd_armed`), and creates its own poll event */
+                new_hdl->info.timerfd.timer = NULL;
+                INIT_LISTP(&new_hdl->info.timerfd.waiters);
+                new_hdl->info.timerfd.polled       = false;
+                new_hdl->info.timerfd.readable_set = false;
+                memset(&new_hdl->info.timerfd.readable, 0, sizeof(new_hdl->info.timerfd.readable));
+                break;
+            case TYPE_IO_URING:
+                /* the rings stay with this process, the child gets an unusable io_uring */
+                new_hdl->info.io_uring.inherited = true;
+                new_hdl->info.io_uring.sq_ring   = NULL;
+                new_hdl->info.io_uring.cq_ring   = NULL;
+                new_hdl->info.io_uring.sqes      = NULL;
+                INIT_LISTP(&new_hdl->info.io_uring.pending);
+                new_hdl->info.io_uring.pending_cnt       = 0;
+                new_hdl->info.io_uring.pending_drain_cnt = 0;
+                new_hdl->info.io_uring.files       = NULL;
+                new_hdl->info.io_uring.files_cnt   = 0;
+                new_hdl->info.io_uring.buffers     = NULL;
+                new_hdl->info.io_uring.buffers_cnt = 0;
+                new_hdl->info.io_uring.eventfd     = NULL;
                 break;
             default:
                 break;
@@ -789,9 +1034,9 @@ BEGIN_RS_FUNC(handle) {
             }
             break;
         case TYPE_EPOLL: ;
-            int ret = create_event(&hdl->info.epoll.event);
+            int ret = DkPollerCreate(&hdl->info.epoll.poller);
             if (ret < 0) {
-                return ret;
+                return pal_to_unix_errno(ret);
             }
 
             struct shim_epoll_item* epoll_item;
@@ -818,11 +1063,21 @@ BEGIN_CP_FUNC(fd_handle) {
     struct shim_fd_handle* fdhdl     = (struct shim_fd_handle*)obj;
     struct shim_fd_handle* new_fdhdl = NULL;
 
-    size_t off = ADD_CP_OFFSET(sizeof(struct shim_fd_handle));
-    new_fdhdl = (struct shim_fd_handle*)(base + off);
-    *new_fdhdl = *fdhdl;
-    DO_CP(handle, fdhdl->handle, &new_fdhdl->handle);
-    ADD_CP_FUNC_ENTRY(off);
+    /* an entry shared by several maps of the checkpoint is copied once, and stays shared in the
+     * child (where `RS_FUNC(handle_map)` counts its maps) */
+    size_t off = GET_FROM_CP_MAP(obj);
+
+    if (!off) {
+        off = ADD_CP_OFFSET(sizeof(struct shim_fd_handle));
+        ADD_TO_CP_MAP(obj, off);
+        new_fdhdl = (struct shim_fd_handle*)(base + off);
+        *new_fdhdl = *fdhdl;
+        REF_SET(new_fdhdl->ref_count, 0);
+        DO_CP(handle, fdhdl->handle, &new_fdhdl->handle);
+        ADD_CP_FUNC_ENTRY(off);
+    } else {
+        new_fdhdl = (struct shim_fd_handle*)(base + off);
+    }
 
     if (objp)
         *objp = (void*)new_fdhdl;
@@ -858,6 +1113,7 @@ BEGIN_CP_FUNC(handle_map) {
 
         REF_SET(new_handle_map->ref_count, 0);
         clear_lock(&new_handle_map->lock);
+        rcu_init(&new_handle_map->rcu);
 
         for (int i = 0; i < fd_size; i++) {
             if (HANDLE_ALLOCATED(handle_map->map[i]))
@@ -896,6 +1152,9 @@ BEGIN_RS_FUNC(handle_map) {
         for (int i = 0; i <= handle_map->fd_top; i++) {
             CP_REBASE(handle_map->map[i]);
             if (HANDLE_ALLOCATED(handle_map->map[i])) {
+                /* the first map of a shared entry rebases it and takes its handle reference */
+                if (REF_INC(handle_map->map[i]->ref_count) > 1)
+                    continue;
                 CP_REBASE(handle_map->map[i]->handle);
                 struct shim_handle* hdl = handle_map->map[i]->handle;
                 assert(hdl);
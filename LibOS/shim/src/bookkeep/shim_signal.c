@@ -39,11 +39,13 @@ void sigaction_make_defaults(struct __kernel_sigaction* sig_action) {
 }
 
 void thread_sigaction_reset_on_execve(void) {
-    struct shim_thread* current = get_cur_thread();
+    sigaction_reset_on_execve(get_cur_thread()->signal_dispositions);
+}
 
-    lock(&current->signal_dispositions->lock);
-    for (size_t i = 0; i < ARRAY_SIZE(current->signal_dispositions->actions); i++) {
-        struct __kernel_sigaction* sig_action = &current->signal_dispositions->actions[i];
+void sigaction_reset_on_execve(struct shim_signal_dispositions* dispositions) {
+    lock(&dispositions->lock);
+    for (size_t i = 0; i < ARRAY_SIZE(dispositions->actions); i++) {
+        struct __kernel_sigaction* sig_action = &dispositions->actions[i];
 
         __sighandler_t handler = sig_action->k_sa_handler;
         if (handler == (void*)SIG_DFL || handler == (void*)SIG_IGN) {
@@ -55,7 +57,7 @@ void thread_sigaction_reset_on_execve(void) {
         /* app installed its own signal handler, reset it to default */
         sigaction_make_defaults(sig_action);
     }
-    unlock(&current->signal_dispositions->lock);
+    unlock(&dispositions->lock);
 }
 
 static noreturn void sighandler_kill(int sig) {
@@ -129,6 +131,15 @@ static uint64_t g_process_pending_signals_cnt = 0;
 static int g_host_injected_signal = 0;
 static bool g_inject_host_signal_enabled = false;
 
+static bool have_host_injected_signal(void) {
+    if (!g_inject_host_signal_enabled) {
+        return false;
+    }
+    int sig = __atomic_load_n(&g_host_injected_signal, __ATOMIC_RELAXED);
+    /* 0xff marks an already delivered signal, see `handle_signal` */
+    return sig != 0 && sig != 0xff;
+}
+
 static bool is_rt_sq_empty(struct shim_rt_signal_queue* queue) {
     return queue->get_idx == queue->put_idx;
 }
@@ -154,15 +165,23 @@ void get_all_pending_signals(__sigset_t* set) {
 
     __sigemptyset(set);
 
+    /* signals sent to the process wait for the parent of a vfork() child to resume */
+    bool process_signals = !current->vfork;
+
     if (__atomic_load_n(&current->pending_signals, __ATOMIC_ACQUIRE) == 0
-            && __atomic_load_n(&g_process_pending_signals_cnt, __ATOMIC_ACQUIRE) == 0) {
+            && (!process_signals
+                || __atomic_load_n(&g_process_pending_signals_cnt, __ATOMIC_ACQUIRE) == 0)) {
         return;
     }
 
     lock(&current->lock);
     lock(&g_process_signal_queue_lock);
 
-    __sigorset(set, &current->signal_queue.pending_mask, &g_process_signal_queue.pending_mask);
+    if (process_signals) {
+        __sigorset(set, &current->signal_queue.pending_mask, &g_process_signal_queue.pending_mask);
+    } else {
+        *set = current->signal_queue.pending_mask;
+    }
 
     unlock(&g_process_signal_queue_lock);
     unlock(&current->lock);
@@ -170,6 +189,10 @@ void get_all_pending_signals(__sigset_t* set) {
 
 bool have_pending_signals(void) {
     struct shim_thread* current = get_cur_thread();
+    if (!__atomic_load_n(&current->signal_check_needed, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
     __sigset_t set;
     get_all_pending_signals(&set);
 
@@ -230,11 +253,18 @@ static bool append_thread_signal(struct shim_thread* thread, struct shim_signal*
     bool ret = queue_append_signal(&thread->signal_queue, signal);
     if (ret) {
         (void)__atomic_add_fetch(&thread->pending_signals, 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&thread->signal_check_needed, true, __ATOMIC_RELEASE);
     }
     unlock(&thread->lock);
     return ret;
 }
 
+static int mark_signal_check_needed(struct shim_thread* thread, void* arg) {
+    __UNUSED(arg);
+    __atomic_store_n(&thread->signal_check_needed, true, __ATOMIC_RELEASE);
+    return 1;
+}
+
 static bool append_process_signal(struct shim_signal** signal) {
     lock(&g_process_signal_queue_lock);
     bool ret = queue_append_signal(&g_process_signal_queue, signal);
@@ -242,6 +272,11 @@ static bool append_process_signal(struct shim_signal** signal) {
         (void)__atomic_add_fetch(&g_process_pending_signals_cnt, 1, __ATOMIC_RELEASE);
     }
     unlock(&g_process_signal_queue_lock);
+
+    if (ret) {
+        /* any thread that doesn't block the signal may pick it up */
+        (void)walk_thread_list(mark_signal_check_needed, /*arg=*/NULL, /*one_shot=*/false);
+    }
     return ret;
 }
 
@@ -285,6 +320,7 @@ static void force_signal(siginfo_t* info) {
     struct shim_thread* current = get_cur_thread();
 
     current->forced_signal.siginfo = *info;
+    __atomic_store_n(&current->signal_check_needed, true, __ATOMIC_RELEASE);
 }
 
 static bool have_forced_signal(void) {
@@ -315,6 +351,7 @@ static noreturn void internal_fault(const char* errstr, PAL_NUM addr, PAL_CONTEX
         log_error("%s at 0x%08lx (IP = 0x%08lx, VMID = %u, TID = %u)\n", errstr, addr,
                   context ? ip : 0, g_self_vmid, is_internal_tid(tid) ? 0 : tid);
 
+    log_flush(/*crashing=*/true);
     DEBUG_BREAK_ON_FAILURE();
     DkProcessExit(1);
 }
@@ -343,6 +380,10 @@ static void memfault_upcall(bool is_in_pal, PAL_NUM addr, PAL_CONTEXT* context)
     assert(!is_in_pal);
     assert(context);
 
+    /* memory of a forked child which is not received yet; LibOS may access it as well */
+    if (handle_lazy_memory_fault((void*)addr))
+        return;
+
     if (is_internal_tid(get_cur_tid()) || context_is_libos(context)) {
         internal_fault("Internal memory fault", addr, context);
     }
@@ -505,9 +546,12 @@ static void quit_upcall(bool is_in_pal, PAL_NUM addr, PAL_CONTEXT* context) {
 static void interrupted_upcall(bool is_in_pal, PAL_NUM addr, PAL_CONTEXT* context) {
     __UNUSED(addr);
 
+    membarrier_ack();
+
     if (is_internal(get_cur_thread()) || context_is_libos(context) || is_in_pal) {
         return;
     }
+    rseq_handle_interrupt(context);
     handle_signal(context, /*old_mask_ptr=*/NULL);
 }
 
@@ -557,6 +601,8 @@ void set_sig_mask(struct shim_thread* thread, const __sigset_t* set) {
     assert(locked(&thread->lock));
 
     thread->signal_mask = *set;
+    /* pending signals might have just been unblocked */
+    __atomic_store_n(&thread->signal_check_needed, true, __ATOMIC_RELEASE);
 }
 
 /* XXX: This function assumes that the stack is growing towards lower addresses. */
@@ -609,15 +655,27 @@ bool handle_signal(PAL_CONTEXT* context, __sigset_t* old_mask_ptr) {
     assert(!is_internal(current));
     assert(!context_is_libos(context) || pal_context_get_ip(context) == (uint64_t)&syscalldb);
 
+    /* Fast path: nothing happened since the last check found no deliverable signal. Otherwise
+     * clear the flag before looking, so that anything arriving meanwhile sets it again. */
+    if (!__atomic_load_n(&current->signal_check_needed, __ATOMIC_ACQUIRE)
+            && !have_host_injected_signal()) {
+        return false;
+    }
+    (void)__atomic_exchange_n(&current->signal_check_needed, false, __ATOMIC_ACQ_REL);
+
     if (__atomic_load_n(&current->time_to_die, __ATOMIC_ACQUIRE)) {
         thread_exit(/*error_code=*/0, /*term_signal=*/0);
     }
 
+    /* a vfork() child leaves signals sent to the process to its parent */
+    bool process_signals = !current->vfork;
+
     struct shim_signal signal = { 0 };
     if (have_forced_signal()) {
         get_forced_signal(&signal);
     } else if (__atomic_load_n(&current->pending_signals, __ATOMIC_ACQUIRE)
-               || __atomic_load_n(&g_process_pending_signals_cnt, __ATOMIC_ACQUIRE)) {
+               || (process_signals
+                   && __atomic_load_n(&g_process_pending_signals_cnt, __ATOMIC_ACQUIRE))) {
         lock(&current->lock);
         lock(&g_process_signal_queue_lock);
         for (int sig = 1; sig <= NUM_SIGS; sig++) {
@@ -628,7 +686,7 @@ bool handle_signal(PAL_CONTEXT* context, __sigset_t* old_mask_ptr) {
                 if (sig < SIGRTMIN) {
                     got = pop_standard_signal(&current->signal_queue.standard_signals[sig - 1],
                                               &signal);
-                    if (!got) {
+                    if (!got && process_signals) {
                         got = pop_standard_signal(&g_process_signal_queue.standard_signals[sig - 1],
                                                   &signal);
                         was_process = true;
@@ -637,7 +695,7 @@ bool handle_signal(PAL_CONTEXT* context, __sigset_t* old_mask_ptr) {
                     struct shim_signal* signal_ptr = NULL;
                     got = pop_rt_signal(&current->signal_queue.rt_signal_queues[sig - SIGRTMIN],
                                         &signal_ptr);
-                    if (!got) {
+                    if (!got && process_signals) {
                         assert(signal_ptr == NULL);
                         got =
                             pop_rt_signal(&g_process_signal_queue.rt_signal_queues[sig - SIGRTMIN],
@@ -666,7 +724,8 @@ bool handle_signal(PAL_CONTEXT* context, __sigset_t* old_mask_ptr) {
         }
         unlock(&g_process_signal_queue_lock);
         unlock(&current->lock);
-    } else if (__atomic_load_n(&g_host_injected_signal, __ATOMIC_RELAXED) != 0) {
+    } else if (process_signals
+               && __atomic_load_n(&g_host_injected_signal, __ATOMIC_RELAXED) != 0) {
         static_assert(NUM_SIGS < 0xff, "This code requires 0xff to be an invalid signal number");
         int sig = __atomic_exchange_n(&g_host_injected_signal, 0xff, __ATOMIC_RELAXED);
         if (sig != 0xff) {
@@ -679,6 +738,8 @@ bool handle_signal(PAL_CONTEXT* context, __sigset_t* old_mask_ptr) {
     if (!sig) {
         return false;
     }
+    /* more signals may be pending, look again on the next check */
+    __atomic_store_n(&current->signal_check_needed, true, __ATOMIC_RELEASE);
 
     bool ret = false;
     lock(&current->signal_dispositions->lock);
@@ -734,6 +795,7 @@ bool handle_signal(PAL_CONTEXT* context, __sigset_t* old_mask_ptr) {
         set_sig_mask(current, &new_mask);
         unlock(&current->lock);
 
+        rseq_handle_interrupt(context);
         prepare_sigframe(context, &signal.siginfo, handler, sa->sa_restorer,
                          !!(sa->sa_flags & SA_ONSTACK), old_mask_ptr ?: &old_mask);
 
@@ -21,16 +21,60 @@
 #include "shim_ipc.h"
 #include "shim_lock.h"
 #include "shim_process.h"
+#include "shim_rcu.h"
 #include "shim_signal.h"
 #include "shim_thread.h"
 #include "shim_vma.h"
+#include "toml.h"
 
 static IDTYPE g_tid_alloc_idx = 0;
 
-/* TODO: consider changing this list to a tree. */
 static LISTP_TYPE(shim_thread) g_thread_list = LISTP_INIT;
 struct shim_lock g_thread_list_lock;
 
+bool g_lazy_stacks = true;
+
+uint32_t g_app_threads_cnt = 0;
+uint32_t g_waiting_threads_cnt = 0;
+
+/* CPU time of the threads taken off `g_thread_list` (under `g_thread_list_lock`), in ticks of
+ * `cputime_now()`; not inherited by child processes, like on Linux */
+static uint64_t g_exited_threads_cputime = 0;
+
+/* Threads on `g_thread_list`, hashed by TID. Updated together with the list (under
+ * `g_thread_list_lock`), read without any lock (see `lookup_thread`). */
+#define THREAD_HASH_SIZE 1024
+static struct shim_thread* g_thread_hash[THREAD_HASH_SIZE];
+static struct shim_rcu g_thread_hash_rcu = INIT_SHIM_RCU;
+
+static struct shim_thread** thread_hash_bucket(IDTYPE tid) {
+    /* TIDs are mostly allocated sequentially, so low bits are good enough */
+    return &g_thread_hash[tid % THREAD_HASH_SIZE];
+}
+
+static void thread_hash_add(struct shim_thread* thread) {
+    assert(locked(&g_thread_list_lock));
+
+    struct shim_thread** bucket = thread_hash_bucket(thread->tid);
+    thread->hash_next = *bucket;
+    __atomic_store_n(bucket, thread, __ATOMIC_RELEASE);
+}
+
+/* After this returns, no lock-free reader can see `thread` anymore. */
+static void thread_hash_del(struct shim_thread* thread) {
+    assert(locked(&g_thread_list_lock));
+
+    struct shim_thread** link = thread_hash_bucket(thread->tid);
+    while (*link != thread) {
+        assert(*link);
+        link = &(*link)->hash_next;
+    }
+    /* `thread->hash_next` is left intact, for readers which are currently at `thread` */
+    __atomic_store_n(link, thread->hash_next, __ATOMIC_RELEASE);
+
+    rcu_synchronize(&g_thread_hash_rcu);
+}
+
 static IDTYPE g_internal_tid_alloc_idx = INTERNAL_TID_BASE;
 
 //#define DEBUG_REF
@@ -88,6 +132,74 @@ static IDTYPE get_new_tid(void) {
     return idx;
 }
 
+/* The TSC if it can be used for timekeeping (the PAL reports its frequency only with invariant
+ * TSC, which is the same on all CPUs), the system time in microseconds otherwise. */
+static uint64_t cputime_now(void) {
+    if (g_pal_control->cpu_info.tsc_hz)
+        return get_tsc();
+    uint64_t usec = 0;
+    (void)DkSystemTimeQuery(&usec);
+    return usec;
+}
+
+static uint64_t cputime_ticks(uint64_t cputime, uint64_t now) {
+    if (!(cputime & 1))
+        return cputime >> 1;
+    uint64_t start = cputime >> 1;
+    return now > start ? now - start : 0;
+}
+
+/* accounting starts when the thread is created, the thread then starts running almost at once */
+static void thread_cputime_init(struct shim_thread* thread) {
+    __atomic_store_n(&thread->cputime, (cputime_now() << 1) | 1, __ATOMIC_RELAXED);
+}
+
+void thread_cputime_pause(void) {
+    struct shim_thread* cur_thread = get_cur_thread();
+    uint64_t cputime = __atomic_load_n(&cur_thread->cputime, __ATOMIC_RELAXED);
+    if (!(cputime & 1))
+        return;
+    __atomic_store_n(&cur_thread->cputime, cputime_ticks(cputime, cputime_now()) << 1,
+                     __ATOMIC_RELAXED);
+}
+
+void thread_cputime_resume(void) {
+    struct shim_thread* cur_thread = get_cur_thread();
+    uint64_t cputime = __atomic_load_n(&cur_thread->cputime, __ATOMIC_RELAXED);
+    if (cputime & 1)
+        return;
+    uint64_t start = cputime_now() - (cputime >> 1);
+    __atomic_store_n(&cur_thread->cputime, (start << 1) | 1, __ATOMIC_RELAXED);
+}
+
+/* the same conversion as in the vDSO (see `struct vdso_time_data`), so that both agree */
+static uint64_t cputime_ticks_to_ns(uint64_t ticks) {
+    uint64_t tsc_hz = g_pal_control->cpu_info.tsc_hz;
+    if (!tsc_hz)
+        return ticks * 1000;
+    uint64_t ns_mult = (1000000000UL << 32) / tsc_hz;
+    return (uint64_t)(((unsigned __int128)ticks * ns_mult) >> 32);
+}
+
+uint64_t get_thread_cputime_ns(struct shim_thread* thread) {
+    uint64_t cputime = __atomic_load_n(&thread->cputime, __ATOMIC_RELAXED);
+    return cputime_ticks_to_ns(cputime_ticks(cputime, cputime_now()));
+}
+
+uint64_t get_process_cputime_ns(void) {
+    uint64_t now = cputime_now();
+
+    lock(&g_thread_list_lock);
+    uint64_t ticks = g_exited_threads_cputime;
+    struct shim_thread* thread;
+    LISTP_FOR_EACH_ENTRY(thread, &g_thread_list, list) {
+        ticks += cputime_ticks(__atomic_load_n(&thread->cputime, __ATOMIC_RELAXED), now);
+    }
+    unlock(&g_thread_list_lock);
+
+    return cputime_ticks_to_ns(ticks);
+}
+
 static struct shim_thread* alloc_new_thread(void) {
     struct shim_thread* thread = calloc(1, sizeof(struct shim_thread));
     if (!thread) {
@@ -101,8 +213,10 @@ static struct shim_thread* alloc_new_thread(void) {
 
     REF_SET(thread->ref_count, 1);
     INIT_LIST_HEAD(thread, list);
+    INIT_LIST_HEAD(thread, uthread_list);
     /* default value as sigalt stack isn't specified yet */
     thread->signal_altstack.ss_flags = SS_DISABLE;
+    thread_cputime_init(thread);
     return thread;
 }
 
@@ -119,8 +233,8 @@ int alloc_thread_libos_stack(struct shim_thread* thread) {
     }
 
     bool need_mem_free = false;
-    ret = DkVirtualMemoryAlloc(&addr, SHIM_THREAD_LIBOS_STACK_SIZE, 0,
-                               LINUX_PROT_TO_PAL(prot, flags));
+    ret = DkVirtualMemoryAlloc(&addr, SHIM_THREAD_LIBOS_STACK_SIZE,
+                               g_lazy_stacks ? PAL_ALLOC_LAZY : 0, LINUX_PROT_TO_PAL(prot, flags));
     if (ret < 0) {
         ret = pal_to_unix_errno(ret);
         goto unmap;
@@ -155,10 +269,34 @@ unmap:;
     return ret;
 }
 
+static int claim_tid(IDTYPE tid) {
+    lock(&g_thread_list_lock);
+    while (allocate_ipc_id(tid, tid + 1) != tid) {
+        unlock(&g_thread_list_lock);
+        /* ranges are leased in order, the one containing `tid` comes eventually */
+        int ret = ipc_lease_send();
+        if (ret < 0)
+            return ret;
+        lock(&g_thread_list_lock);
+    }
+    g_tid_alloc_idx = tid;
+    unlock(&g_thread_list_lock);
+    return 0;
+}
+
 static int init_main_thread(void) {
     struct shim_thread* cur_thread = get_cur_thread();
     if (cur_thread) {
         /* Thread already initialized (e.g. received via checkpoint). */
+        if (!g_pal_control->parent_process) {
+            /* restored from a snapshot: this process leads a new Graphene instance and has to get
+             * hold of its own ID first */
+            int ret = claim_tid(cur_thread->tid);
+            if (ret < 0) {
+                log_error("Cannot reclaim pid %u of the restored thread!\n", cur_thread->tid);
+                return ret;
+            }
+        }
         add_thread(cur_thread);
         return init_ns_pid();
     }
@@ -219,28 +357,27 @@ int init_threading(void) {
         return -ENOMEM;
     }
 
-    return init_main_thread();
-}
-
-static struct shim_thread* __lookup_thread(IDTYPE tid) {
-    assert(locked(&g_thread_list_lock));
-
-    struct shim_thread* tmp;
-
-    LISTP_FOR_EACH_ENTRY(tmp, &g_thread_list, list) {
-        if (tmp->tid == tid) {
-            get_thread(tmp);
-            return tmp;
-        }
+    int ret = toml_bool_in(g_manifest_root, "sys.stack.lazy_commit", /*defaultval=*/true,
+                           &g_lazy_stacks);
+    if (ret < 0) {
+        log_error("Cannot parse 'sys.stack.lazy_commit' (the value must be `true` or `false`)\n");
+        return -EINVAL;
     }
 
-    return NULL;
+    return init_main_thread();
 }
 
 struct shim_thread* lookup_thread(IDTYPE tid) {
-    lock(&g_thread_list_lock);
-    struct shim_thread* thread = __lookup_thread(tid);
-    unlock(&g_thread_list_lock);
+    uint32_t idx = rcu_read_begin(&g_thread_hash_rcu);
+
+    /* threads on the hash table hold a reference, which is dropped only after `thread_hash_del` */
+    struct shim_thread* thread = __atomic_load_n(thread_hash_bucket(tid), __ATOMIC_ACQUIRE);
+    while (thread && thread->tid != tid)
+        thread = __atomic_load_n(&thread->hash_next, __ATOMIC_ACQUIRE);
+    if (thread)
+        get_thread(thread);
+
+    rcu_read_end(&g_thread_hash_rcu, idx);
     return thread;
 }
 
@@ -333,6 +470,26 @@ void get_signal_dispositions(struct shim_signal_dispositions* dispositions) {
     DEBUG_PRINT_REF_COUNT(ref_count);
 }
 
+struct shim_signal_dispositions* dup_signal_dispositions(
+        struct shim_signal_dispositions* dispositions) {
+    struct shim_signal_dispositions* new_dispositions = malloc(sizeof(*new_dispositions));
+    if (!new_dispositions) {
+        return NULL;
+    }
+
+    if (!create_lock(&new_dispositions->lock)) {
+        free(new_dispositions);
+        return NULL;
+    }
+    REF_SET(new_dispositions->ref_count, 1);
+
+    lock(&dispositions->lock);
+    memcpy(new_dispositions->actions, dispositions->actions, sizeof(new_dispositions->actions));
+    unlock(&dispositions->lock);
+
+    return new_dispositions;
+}
+
 void put_signal_dispositions(struct shim_signal_dispositions* dispositions) {
     int ref_count = REF_DEC(dispositions->ref_count);
 
@@ -372,8 +529,13 @@ void put_thread(struct shim_thread* thread) {
         }
 
         free(thread->groups_info.groups);
+        free(thread->poll_scratch.buf);
+        free_syscall_stats(thread);
+        release_syscall_trace(thread);
+        release_log_ring(thread);
 
-        if (thread->pal_handle && thread->pal_handle != g_pal_control->first_thread)
+        if (thread->pal_handle && thread->pal_handle != g_pal_control->first_thread
+                && !thread->uthread.enabled)
             DkObjectClose(thread->pal_handle);
 
         if (thread->handle_map) {
@@ -427,6 +589,8 @@ void add_thread(struct shim_thread* thread) {
 
     get_thread(thread);
     LISTP_ADD_AFTER(thread, prev, &g_thread_list, list);
+    thread_hash_add(thread);
+    __atomic_add_fetch(&g_app_threads_cnt, 1, __ATOMIC_RELAXED);
     unlock(&g_thread_list_lock);
 }
 
@@ -450,6 +614,11 @@ bool check_last_thread(bool mark_self_dead) {
 
     if (mark_self_dead) {
         LISTP_DEL_INIT(self, &g_thread_list, list);
+        thread_hash_del(self);
+        __atomic_sub_fetch(&g_app_threads_cnt, 1, __ATOMIC_RELAXED);
+        fold_syscall_stats(self);
+        uint64_t cputime = __atomic_load_n(&self->cputime, __ATOMIC_RELAXED);
+        g_exited_threads_cputime += cputime_ticks(cputime, cputime_now());
     }
 
     unlock(&g_thread_list_lock);
@@ -589,7 +758,17 @@ BEGIN_CP_FUNC(thread) {
 
         new_thread->handle_map = NULL;
         memset(&new_thread->signal_queue, 0, sizeof(new_thread->signal_queue));
+        new_thread->signal_check_needed = true;
         new_thread->robust_list = NULL;
+        new_thread->poll_scratch.buf  = NULL;
+        new_thread->poll_scratch.size = 0;
+        new_thread->vfork = NULL;
+        new_thread->syscall_stats = NULL;
+        memset(new_thread->fast_syscalls, 0, sizeof(new_thread->fast_syscalls));
+        new_thread->syscall_trace = NULL;
+        new_thread->log_ring = NULL;
+        memset(&new_thread->uthread, 0, sizeof(new_thread->uthread));
+        INIT_LIST_HEAD(new_thread, uthread_list);
         REF_SET(new_thread->ref_count, 0);
 
         DO_CP_MEMBER(signal_dispositions, thread, new_thread, signal_dispositions);
@@ -604,9 +783,14 @@ BEGIN_CP_FUNC(thread) {
             struct shim_tcb* new_tcb = new_thread->shim_tcb;
             *new_tcb = *thread->shim_tcb;
             /* don't export stale pointers */
-            new_tcb->self      = NULL;
-            new_tcb->tp        = NULL;
-            new_tcb->vma_cache = NULL;
+            new_tcb->self       = NULL;
+            new_tcb->tp         = NULL;
+            new_tcb->vma_cache  = NULL;
+            new_tcb->slab_cache = NULL;
+            new_tcb->uthread_carrier = NULL;
+            /* the child starts outside of LibOS */
+            new_tcb->libos_transitions = 0;
+            new_tcb->membarrier_ack    = 0;
 
             new_tcb->log_prefix[0] = '\0';
 
@@ -636,6 +820,8 @@ BEGIN_RS_FUNC(thread) {
     CP_REBASE(thread->handle_map);
     CP_REBASE(thread->signal_dispositions);
 
+    thread_cputime_init(thread);
+
     if (!create_lock(&thread->lock)) {
         return -ENOMEM;
     }
@@ -655,6 +841,7 @@ BEGIN_RS_FUNC(thread) {
     }
 
     if (thread->set_child_tid) {
+        prefault_lazy_memory(thread->set_child_tid, sizeof(*thread->set_child_tid));
         *thread->set_child_tid = thread->tid;
         thread->set_child_tid = NULL;
     }
@@ -666,15 +853,22 @@ BEGIN_RS_FUNC(thread) {
         return ret;
     }
 
-    CP_REBASE(thread->shim_tcb);
-    CP_REBASE(thread->shim_tcb->context.regs);
+    /* a thread without TCB comes from vfork() + execve() and starts the new executable instead of
+     * resuming a context of the parent */
+    if (thread->shim_tcb) {
+        CP_REBASE(thread->shim_tcb);
+        CP_REBASE(thread->shim_tcb->context.regs);
 
-    shim_tcb_t* tcb = shim_get_tcb();
-    *tcb = *thread->shim_tcb;
-    __shim_tcb_init(tcb);
+        shim_tcb_t* tcb = shim_get_tcb();
+        /* this thread already allocated memory during LibOS init, keep its slab cache */
+        void* slab_cache = tcb->slab_cache;
+        *tcb = *thread->shim_tcb;
+        __shim_tcb_init(tcb);
+        tcb->slab_cache = slab_cache;
 
-    assert(tcb->context.regs);
-    set_tls(tcb->context.tls);
+        assert(tcb->context.regs);
+        set_tls(tcb->context.tls);
+    }
 
     thread->pal_handle = g_pal_control->first_thread;
 
@@ -0,0 +1,478 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * M:N user-level threads, enabled by `libos.user_threads = N`.
+ *
+ * Application threads are multiplexed on at most N host threads ("carriers"), which allows more
+ * application threads than the host (e.g. the number of TCSs of an SGX enclave) permits. A thread
+ * that waits in `thread_wait()` (on futexes, in sleeps, for signals, children, pipes, IPC, ...)
+ * does not block its host thread: it saves its context and switches to the scheduling loop of its
+ * carrier, which runs the next runnable thread or, if there is none, idles in the host until one
+ * is woken up. Scheduling is cooperative: a thread keeps its carrier until it waits in
+ * `thread_wait()`, yields or exits, and waits in the host (e.g. blocking I/O on files or sockets)
+ * block the whole carrier.
+ *
+ * Switches only happen in LibOS outside of any PAL call, so besides the callee-saved registers and
+ * the stack (each thread has its own LibOS stack) only the per-thread part of the LibOS TCB and the
+ * FS base have to be switched. Carriers are created on demand when new threads are created and
+ * none is idle; they then live until the process exits. While running its scheduling loop, a
+ * carrier has an internal thread of its own as the current thread.
+ *
+ * A thread switches away in two steps, so that no other carrier resumes it before its context is
+ * saved: it becomes UTHREAD_PARKING (or UTHREAD_YIELDING) and switches to the scheduling loop of
+ * its carrier, which then parks it (or makes it runnable if it yielded or was woken up meanwhile).
+ */
+
+#include "api.h"
+#include "assert.h"
+#include "cpu.h"
+#include "list.h"
+#include "pal.h"
+#include "shim_internal.h"
+#include "shim_lock.h"
+#include "shim_thread.h"
+#include "shim_uthread-arch.h"
+#include "shim_utils.h"
+#include "spinlock.h"
+#include "toml.h"
+
+#define UTHREAD_SCHED_STACK_SIZE SHIM_THREAD_LIBOS_STACK_SIZE
+
+struct uthread_carrier {
+    /* internal thread, current while the carrier runs its scheduling loop; its PAL handle is the
+     * one of the carrier */
+    struct shim_thread* thread;
+    /* stack pointer of the scheduling loop while a thread runs on the carrier */
+    void* sched_sp;
+    /* stack of the scheduling loop if not the initial stack of the host thread */
+    void* sched_stack;
+    /* thread that last switched to the scheduling loop, NULL if it exited */
+    struct shim_thread* prev;
+    /* zeroed once the exited thread does not use its stack anymore (like in `DkThreadExit`) */
+    int* prev_clear_on_exit;
+    /* set to wake up the carrier from idling */
+    PAL_HANDLE idle_event;
+    struct uthread_carrier* next_idle;
+    bool idle;
+};
+
+/* protects the run queue, the timed waiters, the carriers and the `uthread` state of threads (see
+ * `struct shim_uthread`); taken after `thread->lock` */
+static spinlock_t g_uthread_lock = INIT_SPINLOCK_UNLOCKED;
+static LISTP_TYPE(shim_thread) g_run_queue = LISTP_INIT;
+/* parked threads with a timeout, sorted by deadline */
+static LISTP_TYPE(shim_thread) g_timed_waiters = LISTP_INIT;
+static struct uthread_carrier* g_idle_carriers = NULL;
+/* carriers running or being created */
+static size_t g_carriers_cnt = 0;
+/* 0 if user-level threads are disabled; lowered if a carrier cannot be created */
+static size_t g_max_carriers = 0;
+
+bool uthreads_enabled(void) {
+    return __atomic_load_n(&g_max_carriers, __ATOMIC_RELAXED) > 0;
+}
+
+static struct uthread_carrier* cur_carrier(void) {
+    return shim_get_tcb()->uthread_carrier;
+}
+
+static void make_runnable(struct shim_thread* thread) {
+    assert(spinlock_is_locked(&g_uthread_lock));
+    thread->uthread.state = UTHREAD_RUNNABLE;
+    LISTP_ADD_TAIL(thread, &g_run_queue, uthread_list);
+}
+
+static void add_timed_waiter(struct shim_thread* thread) {
+    assert(spinlock_is_locked(&g_uthread_lock));
+    struct shim_thread* pos;
+    LISTP_FOR_EACH_ENTRY(pos, &g_timed_waiters, uthread_list) {
+        if (pos->uthread.deadline > thread->uthread.deadline) {
+            /* insert before `pos` */
+            LIST_ADD_TAIL(thread, pos, uthread_list);
+            if (pos == g_timed_waiters.first)
+                g_timed_waiters.first = thread;
+            return;
+        }
+    }
+    LISTP_ADD_TAIL(thread, &g_timed_waiters, uthread_list);
+}
+
+static void expire_timed_waiters(uint64_t now) {
+    assert(spinlock_is_locked(&g_uthread_lock));
+    while (!LISTP_EMPTY(&g_timed_waiters)) {
+        struct shim_thread* thread = LISTP_FIRST_ENTRY(&g_timed_waiters, shim_thread, uthread_list);
+        if (thread->uthread.deadline > now)
+            break;
+        LISTP_DEL_INIT(thread, &g_timed_waiters, uthread_list);
+        make_runnable(thread);
+    }
+}
+
+static struct uthread_carrier* pop_idle_carrier(void) {
+    assert(spinlock_is_locked(&g_uthread_lock));
+    struct uthread_carrier* carrier = g_idle_carriers;
+    if (carrier) {
+        g_idle_carriers = carrier->next_idle;
+        carrier->idle = false;
+    }
+    return carrier;
+}
+
+static void remove_idle_carrier(struct uthread_carrier* carrier) {
+    assert(spinlock_is_locked(&g_uthread_lock));
+    struct uthread_carrier** pos = &g_idle_carriers;
+    while (*pos != carrier)
+        pos = &(*pos)->next_idle;
+    *pos = carrier->next_idle;
+    carrier->idle = false;
+}
+
+/* called by the scheduling loop after `carrier->prev` switched to it */
+static void finish_prev(struct uthread_carrier* carrier) {
+    shim_tcb_t* tcb = shim_get_tcb();
+    struct shim_thread* prev = carrier->prev;
+    carrier->prev = NULL;
+
+    if (!prev) {
+        /* first run of the loop, or the previous thread exited (and dropped its reference from the
+         * TCB) */
+        if (!tcb->tp)
+            set_cur_thread(carrier->thread);
+        if (carrier->prev_clear_on_exit) {
+            __atomic_store_n(carrier->prev_clear_on_exit, 0, __ATOMIC_RELEASE);
+            carrier->prev_clear_on_exit = NULL;
+        }
+        return;
+    }
+
+    /* the thread list keeps `prev` alive */
+    lock(&prev->lock);
+    prev->uthread.cpu       = tcb->cpu;
+    prev->uthread.numa_node = tcb->numa_node;
+    set_cur_thread(carrier->thread);
+    unlock(&prev->lock);
+
+    spinlock_lock(&g_uthread_lock);
+    assert(prev->uthread.state == UTHREAD_PARKING || prev->uthread.state == UTHREAD_YIELDING);
+    if (prev->uthread.state == UTHREAD_YIELDING || prev->uthread.woken) {
+        make_runnable(prev);
+    } else {
+        prev->uthread.state = UTHREAD_PARKED;
+        if (prev->uthread.deadline)
+            add_timed_waiter(prev);
+    }
+    spinlock_unlock(&g_uthread_lock);
+}
+
+static void switch_to_thread(struct uthread_carrier* carrier, struct shim_thread* next) {
+    shim_tcb_t* tcb = shim_get_tcb();
+
+    lock(&next->lock);
+    set_cur_thread(next);
+    tcb->cpu         = next->uthread.cpu;
+    tcb->numa_node   = next->uthread.numa_node;
+    next->pal_handle = carrier->thread->pal_handle;
+    unlock(&next->lock);
+
+    tcb->context            = next->uthread.context;
+    tcb->syscall_scratch_pc = next->uthread.syscall_scratch_pc;
+    set_tls(next->uthread.tls);
+
+    uthread_switch(&carrier->sched_sp, next->uthread.sp);
+}
+
+/* switches from the current thread to the scheduling loop of the carrier; returns when the thread
+ * is resumed (possibly on another carrier) */
+static void switch_to_sched(struct shim_thread* thread) {
+    shim_tcb_t* tcb = shim_get_tcb();
+    struct uthread_carrier* carrier = tcb->uthread_carrier;
+    assert(carrier && tcb->tp == thread);
+
+    thread->uthread.context            = tcb->context;
+    thread->uthread.syscall_scratch_pc = tcb->syscall_scratch_pc;
+    thread->uthread.tls                = get_tls();
+
+    carrier->prev = thread;
+    uthread_switch(&thread->uthread.sp, carrier->sched_sp);
+}
+
+static noreturn void uthread_sched_loop(void* arg) {
+    struct uthread_carrier* carrier = arg;
+
+    while (true) {
+        finish_prev(carrier);
+
+        PAL_NUM now = 0;
+        (void)DkSystemTimeQuery(&now);
+
+        spinlock_lock(&g_uthread_lock);
+        expire_timed_waiters(now);
+        struct shim_thread* next = LISTP_FIRST_ENTRY(&g_run_queue, shim_thread, uthread_list);
+        if (next) {
+            LISTP_DEL_INIT(next, &g_run_queue, uthread_list);
+            next->uthread.state = UTHREAD_RUNNING;
+            spinlock_unlock(&g_uthread_lock);
+
+            switch_to_thread(carrier, next);
+            continue;
+        }
+
+        struct shim_thread* first = LISTP_FIRST_ENTRY(&g_timed_waiters, shim_thread,
+                                                      uthread_list);
+        uint64_t timeout_us = first ? first->uthread.deadline - now : 0;
+        carrier->idle      = true;
+        carrier->next_idle = g_idle_carriers;
+        g_idle_carriers    = carrier;
+        spinlock_unlock(&g_uthread_lock);
+
+        /* a wake-up after the carrier stopped idling only causes a spurious iteration */
+        (void)DkEventWait(carrier->idle_event, first ? &timeout_us : NULL);
+
+        spinlock_lock(&g_uthread_lock);
+        if (carrier->idle)
+            remove_idle_carrier(carrier);
+        spinlock_unlock(&g_uthread_lock);
+    }
+}
+
+static void destroy_carrier(struct uthread_carrier* carrier) {
+    if (carrier->idle_event)
+        DkObjectClose(carrier->idle_event);
+    if (carrier->thread)
+        put_thread(carrier->thread);
+    free(carrier->sched_stack);
+    free(carrier);
+}
+
+static struct uthread_carrier* create_carrier(void) {
+    struct uthread_carrier* carrier = calloc(1, sizeof(*carrier));
+    if (!carrier)
+        return NULL;
+
+    carrier->thread = get_new_internal_thread();
+    if (!carrier->thread)
+        goto fail;
+
+    if (DkEventCreate(&carrier->idle_event, /*init_signaled=*/false, /*auto_clear=*/true) < 0) {
+        carrier->idle_event = NULL;
+        goto fail;
+    }
+    return carrier;
+
+fail:
+    destroy_carrier(carrier);
+    return NULL;
+}
+
+static void uthread_carrier_main(void* arg) {
+    struct uthread_carrier* carrier = arg;
+
+    shim_tcb_init();
+    set_cur_thread(carrier->thread);
+    shim_get_tcb()->uthread_carrier = carrier;
+    /* user-level threads run on the carrier only between their syscalls */
+    shim_tcb_set_in_libos(true);
+
+    /* the handle is set right after the creating thread returns from `DkThreadCreate` */
+    while (!__atomic_load_n(&carrier->thread->pal_handle, __ATOMIC_ACQUIRE))
+        CPU_RELAX();
+
+    uthread_sched_loop(carrier);
+}
+
+static int spawn_carrier(void) {
+    struct uthread_carrier* carrier = create_carrier();
+    if (!carrier)
+        return -ENOMEM;
+
+    PAL_HANDLE handle = NULL;
+    int ret = DkThreadCreate(uthread_carrier_main, carrier, &handle);
+    if (ret < 0) {
+        destroy_carrier(carrier);
+        return pal_to_unix_errno(ret);
+    }
+    __atomic_store_n(&carrier->thread->pal_handle, handle, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static noreturn void uthread_start_thread(void* arg) {
+    __UNUSED(arg);
+    restore_child_context_after_clone(&shim_get_tcb()->context);
+}
+
+int uthread_create(struct shim_thread* thread, PAL_CONTEXT* regs, unsigned long tls, int cpu,
+                   int numa_node) {
+    assert(uthreads_enabled() && thread->libos_stack_bottom);
+
+    /* like in `clone_implementation_wrapper`, the initial context is kept on the LibOS stack of the
+     * new thread until it returns to the application */
+    PAL_CONTEXT* child_regs = (PAL_CONTEXT*)ALIGN_DOWN_PTR(
+        (char*)thread->libos_stack_bottom - sizeof(*child_regs), 64);
+    pal_context_copy(child_regs, regs);
+
+    thread->uthread.enabled            = true;
+    thread->uthread.context.regs       = child_regs;
+    thread->uthread.context.syscall_nr = -1;
+    thread->uthread.context.tls        = tls;
+    thread->uthread.tls                = tls;
+    thread->uthread.cpu                = cpu;
+    thread->uthread.numa_node          = numa_node;
+    thread->uthread.sp = uthread_init_context(child_regs, uthread_start_thread, /*arg=*/NULL);
+
+    spinlock_lock(&g_uthread_lock);
+    make_runnable(thread);
+    struct uthread_carrier* carrier = pop_idle_carrier();
+    bool spawn = !carrier && g_carriers_cnt < g_max_carriers;
+    if (spawn)
+        g_carriers_cnt++;
+    spinlock_unlock(&g_uthread_lock);
+
+    if (carrier)
+        DkEventSet(carrier->idle_event);
+
+    if (spawn) {
+        int ret = spawn_carrier();
+        if (ret < 0) {
+            /* not fatal, the thread runs once one of the existing carriers is free */
+            spinlock_lock(&g_uthread_lock);
+            g_carriers_cnt--;
+            __atomic_store_n(&g_max_carriers, MAX(g_carriers_cnt, 1UL), __ATOMIC_RELAXED);
+            spinlock_unlock(&g_uthread_lock);
+            log_warning("Cannot create a carrier of user-level threads (%d), continuing with %lu "
+                        "carriers\n", ret, g_max_carriers);
+        }
+    }
+    return 0;
+}
+
+void uthread_prepare_wait(struct shim_thread* thread) {
+    spinlock_lock(&g_uthread_lock);
+    thread->uthread.woken = false;
+    spinlock_unlock(&g_uthread_lock);
+}
+
+int uthread_wait(uint64_t* timeout_us) {
+    struct shim_thread* cur_thread = get_cur_thread();
+    assert(cur_thread->uthread.enabled);
+
+    uint64_t deadline = 0;
+    if (timeout_us) {
+        PAL_NUM now;
+        int ret = DkSystemTimeQuery(&now);
+        if (ret < 0)
+            return pal_to_unix_errno(ret);
+        deadline = now + *timeout_us;
+    }
+
+    spinlock_lock(&g_uthread_lock);
+    if (cur_thread->uthread.woken) {
+        cur_thread->uthread.woken = false;
+        spinlock_unlock(&g_uthread_lock);
+        return 0;
+    }
+    cur_thread->uthread.state    = UTHREAD_PARKING;
+    cur_thread->uthread.deadline = deadline;
+    spinlock_unlock(&g_uthread_lock);
+
+    switch_to_sched(cur_thread);
+
+    spinlock_lock(&g_uthread_lock);
+    bool woken = cur_thread->uthread.woken;
+    cur_thread->uthread.woken    = false;
+    cur_thread->uthread.deadline = 0;
+    spinlock_unlock(&g_uthread_lock);
+
+    if (timeout_us) {
+        PAL_NUM now;
+        if (DkSystemTimeQuery(&now) < 0)
+            now = deadline;
+        *timeout_us = now < deadline ? deadline - now : 0;
+    }
+    return woken ? 0 : -ETIMEDOUT;
+}
+
+void uthread_wakeup(struct shim_thread* thread) {
+    struct uthread_carrier* carrier = NULL;
+
+    spinlock_lock(&g_uthread_lock);
+    thread->uthread.woken = true;
+    if (thread->uthread.state == UTHREAD_PARKED) {
+        if (thread->uthread.deadline)
+            LISTP_DEL_INIT(thread, &g_timed_waiters, uthread_list);
+        make_runnable(thread);
+        carrier = pop_idle_carrier();
+    }
+    spinlock_unlock(&g_uthread_lock);
+
+    if (carrier)
+        DkEventSet(carrier->idle_event);
+}
+
+void uthread_yield(void) {
+    struct shim_thread* cur_thread = get_cur_thread();
+
+    spinlock_lock(&g_uthread_lock);
+    bool others_runnable = !LISTP_EMPTY(&g_run_queue);
+    if (others_runnable)
+        cur_thread->uthread.state = UTHREAD_YIELDING;
+    spinlock_unlock(&g_uthread_lock);
+
+    if (!others_runnable) {
+        DkThreadYieldExecution();
+        return;
+    }
+    switch_to_sched(cur_thread);
+}
+
+noreturn void uthread_exit(int* clear_on_exit) {
+    struct uthread_carrier* carrier = cur_carrier();
+    /* the exiting thread already dropped its reference from the TCB */
+    assert(carrier && !shim_get_tcb()->tp);
+
+    carrier->prev               = NULL;
+    carrier->prev_clear_on_exit = clear_on_exit;
+
+    void* unused_sp;
+    uthread_switch(&unused_sp, carrier->sched_sp);
+    __builtin_unreachable();
+}
+
+int init_uthreads(void) {
+    int64_t max_carriers = 0;
+    int ret = toml_int_in(g_manifest_root, "libos.user_threads", /*defaultval=*/0, &max_carriers);
+    if (ret < 0 || max_carriers < 0) {
+        log_error("Cannot parse 'libos.user_threads' (the value must be a non-negative number)\n");
+        return -EINVAL;
+    }
+    if (!max_carriers)
+        return 0;
+
+    /* the current host thread becomes the first carrier; its scheduling loop runs on a separate
+     * stack, since the initial stack of the host thread is used by the current thread */
+    struct uthread_carrier* carrier = create_carrier();
+    if (!carrier)
+        return -ENOMEM;
+    carrier->sched_stack = malloc(UTHREAD_SCHED_STACK_SIZE);
+    if (!carrier->sched_stack) {
+        destroy_carrier(carrier);
+        return -ENOMEM;
+    }
+    carrier->sched_sp = uthread_init_context((char*)carrier->sched_stack
+                                                 + UTHREAD_SCHED_STACK_SIZE,
+                                             uthread_sched_loop, carrier);
+
+    struct shim_thread* cur_thread = get_cur_thread();
+    assert(cur_thread && !is_internal(cur_thread));
+    carrier->thread->pal_handle = cur_thread->pal_handle;
+
+    g_carriers_cnt = 1;
+    g_max_carriers = max_carriers;
+    shim_get_tcb()->uthread_carrier = carrier;
+
+    /* other threads do not exist yet */
+    cur_thread->uthread.enabled   = true;
+    cur_thread->uthread.cpu       = shim_get_tcb()->cpu;
+    cur_thread->uthread.numa_node = shim_get_tcb()->numa_node;
+    return 0;
+}
@@ -14,6 +14,7 @@
 #include "api.h"
 #include "assert.h"
 #include "avl_tree.h"
+#include "seqlock.h"
 #include "shim_checkpoint.h"
 #include "shim_defs.h"
 #include "shim_flags_conv.h"
@@ -45,15 +46,23 @@ struct shim_vma {
     int flags;
     struct shim_handle* file;
     uint64_t offset; // offset inside `file`, where `begin` starts
-    union {
-        /* If this `vma` is used, it is included in `vma_tree` using this node. */
-        struct avl_tree_node tree_node;
-        /* Otherwise it might be cached in per thread vma cache, or might be on a temporary list
-         * of to-be-freed vmas (used by _vma_bkeep_remove). Such lists use the field below. */
-        struct shim_vma* next_free;
-    };
+    /* If this `vma` is used, it is included in `vma_tree` using this node. Lock-free readers may
+     * still follow stale pointers to a vma which was removed from the tree (see
+     * `_lookup_vma_speculative`), so these are never reused for anything else. */
+    struct avl_tree_node tree_node;
+    /* If this `vma` is not used, it might be cached in per thread vma cache, or might be on
+     * a temporary list of to-be-freed vmas (used by _vma_bkeep_remove). Such lists use this field. */
+    struct shim_vma* next_free;
+    /* Augmented data of `vma_tree` (see `vma_tree_update`): bounds of the subtree rooted at this
+     * vma and the largest free gap between vmas inside the subtree. */
+    uintptr_t subtree_begin;
+    uintptr_t subtree_end;
+    size_t subtree_max_gap;
     char comment[VMA_COMMENT_LEN];
 };
+static_assert(offsetof(struct shim_vma, next_free)
+                  == offsetof(struct shim_vma, tree_node) + sizeof(struct avl_tree_node),
+              "`clear_vma` relies on `next_free` following `tree_node`");
 
 static void copy_comment(struct shim_vma* vma, const char* comment) {
     size_t len = MIN(sizeof(vma->comment), strlen(comment) + 1);
@@ -92,45 +101,92 @@ static bool cmp_addr_to_vma(void* addr, struct avl_tree_node* node) {
     return (uintptr_t)addr < vma->end;
 }
 
+static struct shim_vma* node2vma(struct avl_tree_node* node) {
+    if (!node) {
+        return NULL;
+    }
+    return container_of(node, struct shim_vma, tree_node);
+}
+
+static void vma_tree_update(struct avl_tree_node* node) {
+    struct shim_vma* vma   = node2vma(node);
+    struct shim_vma* left  = node2vma(node->left);
+    struct shim_vma* right = node2vma(node->right);
+
+    vma->subtree_begin   = left ? left->subtree_begin : vma->begin;
+    vma->subtree_end     = right ? right->subtree_end : vma->end;
+    vma->subtree_max_gap = 0;
+    if (left) {
+        vma->subtree_max_gap = MAX(left->subtree_max_gap, vma->begin - left->subtree_end);
+    }
+    if (right) {
+        size_t right_gap = MAX(right->subtree_max_gap, right->subtree_begin - vma->end);
+        vma->subtree_max_gap = MAX(vma->subtree_max_gap, right_gap);
+    }
+}
+
 /*
  * "vma_tree" holds all vmas with the assumption that no 2 overlap (though they could be adjacent).
  * Currently we do not merge similar adjacent vmas - if we ever start doing it, this code needs
  * to be revisited as there might be some optimizations that would break due to it.
+ * Each node is augmented with the largest free gap in its subtree (see `vma_tree_update`), so
+ * finding free space is O(log n). Whenever `begin` or `end` of a vma in the tree changes in place,
+ * `avl_tree_update_path` must be called on it.
  */
-static struct avl_tree vma_tree = {.cmp = vma_tree_cmp};
-static spinlock_t vma_tree_lock = INIT_SPINLOCK_UNLOCKED;
+static struct avl_tree vma_tree = {.cmp = vma_tree_cmp, .update = vma_tree_update};
 
-static struct shim_vma* node2vma(struct avl_tree_node* node) {
-    if (!node) {
-        return NULL;
-    }
-    return container_of(node, struct shim_vma, tree_node);
+/*
+ * Writers (and readers which need references to vma files) take `vma_tree_lock` exclusively.
+ * Lookups and access checks first run lock-free and retry if a writer changed the tree meanwhile
+ * (see `_lookup_vma_speculative`). This relies on vmas never being freed to the system (`vma_mgr`
+ * only grows), so that any pointer in a tree node, stale or not, points to a vma.
+ */
+static seqlock_t vma_tree_lock = INIT_SEQLOCK_UNLOCKED;
+
+/* Increased on every change of the vmas visible to the user (with `vma_tree_lock` held), see
+ * `get_vma_generation`. */
+static uint64_t g_vma_generation = 0;
+/* `get_user_vm_size` of `g_vm_size_generation` (protected by `vma_tree_lock`) */
+static size_t g_vm_size = 0;
+static uint64_t g_vm_size_generation = (uint64_t)-1;
+
+static void bump_vma_generation(void) {
+    assert(spinlock_is_locked(&vma_tree_lock.lock));
+    __atomic_store_n(&g_vma_generation, g_vma_generation + 1, __ATOMIC_RELAXED);
 }
 
+/* A lock-free walk is abandoned (and retried) after this many steps: a concurrent writer may
+ * have created a cycle for it. Much more than the height of any AVL tree that fits in memory. */
+#define VMA_SPECULATIVE_MAX_STEPS 128
+/* Number of lock-free attempts before falling back to taking `vma_tree_lock`. */
+#define VMA_SPECULATIVE_RETRIES 4
+/* Access checks spanning more vmas than this take `vma_tree_lock`. */
+#define VMA_SPECULATIVE_MAX_VMAS 8
+
 static struct shim_vma* _get_next_vma(struct shim_vma* vma) {
-    assert(spinlock_is_locked(&vma_tree_lock));
+    assert(spinlock_is_locked(&vma_tree_lock.lock));
     return node2vma(avl_tree_next(&vma->tree_node));
 }
 
 static struct shim_vma* _get_prev_vma(struct shim_vma* vma) {
-    assert(spinlock_is_locked(&vma_tree_lock));
+    assert(spinlock_is_locked(&vma_tree_lock.lock));
     return node2vma(avl_tree_prev(&vma->tree_node));
 }
 
 static struct shim_vma* _get_last_vma(void) {
-    assert(spinlock_is_locked(&vma_tree_lock));
+    assert(spinlock_is_locked(&vma_tree_lock.lock));
     return node2vma(avl_tree_last(&vma_tree));
 }
 
 static struct shim_vma* _get_first_vma(void) {
-    assert(spinlock_is_locked(&vma_tree_lock));
+    assert(spinlock_is_locked(&vma_tree_lock.lock));
     return node2vma(avl_tree_first(&vma_tree));
 }
 
 /* Returns the vma that contains `addr`. If there is no such vma, returns the closest vma with
  * higher address. */
 static struct shim_vma* _lookup_vma(uintptr_t addr) {
-    assert(spinlock_is_locked(&vma_tree_lock));
+    assert(spinlock_is_locked(&vma_tree_lock.lock));
 
     struct avl_tree_node* node = avl_tree_lower_bound_fn(&vma_tree, (void*)addr, cmp_addr_to_vma);
     if (!node) {
@@ -139,6 +195,34 @@ static struct shim_vma* _lookup_vma(uintptr_t addr) {
     return container_of(node, struct shim_vma, tree_node);
 }
 
+/*
+ * Lock-free version of `_lookup_vma`, to be used between `read_seqbegin` and `read_seqretry` on
+ * `vma_tree_lock`. The result (and everything read from it) is only valid if `read_seqretry`
+ * succeeds afterwards. Pointers are each loaded once, so that a racing writer can only make us
+ * see another (possibly unused) vma, never a torn or re-read pointer. Returns false if the walk
+ * took too long.
+ */
+static bool _lookup_vma_speculative(uintptr_t addr, struct shim_vma** ret_vma) {
+    struct avl_tree_node* node = __atomic_load_n(&vma_tree.root, __ATOMIC_RELAXED);
+    struct shim_vma* found = NULL;
+
+    for (size_t steps = 0; node; steps++) {
+        if (steps == VMA_SPECULATIVE_MAX_STEPS) {
+            return false;
+        }
+        struct shim_vma* vma = node2vma(node);
+        if (addr < __atomic_load_n(&vma->end, __ATOMIC_RELAXED)) {
+            found = vma;
+            node = __atomic_load_n(&node->left, __ATOMIC_RELAXED);
+        } else {
+            node = __atomic_load_n(&node->right, __ATOMIC_RELAXED);
+        }
+    }
+
+    *ret_vma = found;
+    return true;
+}
+
 typedef bool (*traverse_visitor)(struct shim_vma* vma, void* visitor_arg);
 
 /*
@@ -153,7 +237,7 @@ typedef bool (*traverse_visitor)(struct shim_vma* vma, void* visitor_arg);
 // TODO: Probably other VMA functions could make use of this helper.
 static bool _traverse_vmas_in_range(uintptr_t begin, uintptr_t end, traverse_visitor visitor,
                                     void* visitor_arg) {
-    assert(spinlock_is_locked(&vma_tree_lock));
+    assert(spinlock_is_locked(&vma_tree_lock.lock));
     assert(begin <= end);
 
     if (begin == end)
@@ -183,6 +267,7 @@ static bool _traverse_vmas_in_range(uintptr_t begin, uintptr_t end, traverse_vis
     return is_continuous;
 }
 
+/* `old_vma` must be in `vma_tree`, `new_vma` is not inserted there by this function. */
 static void split_vma(struct shim_vma* old_vma, struct shim_vma* new_vma, uintptr_t addr) {
     assert(old_vma->begin < addr && addr < old_vma->end);
 
@@ -193,6 +278,7 @@ static void split_vma(struct shim_vma* old_vma, struct shim_vma* new_vma, uintpt
     }
 
     old_vma->end = addr;
+    avl_tree_update_path(&vma_tree, &old_vma->tree_node);
 }
 
 /*
@@ -205,7 +291,7 @@ static void split_vma(struct shim_vma* old_vma, struct shim_vma* new_vma, uintpt
  */
 static int _vma_bkeep_remove(uintptr_t begin, uintptr_t end, bool is_internal,
                              struct shim_vma** new_vma_ptr, struct shim_vma** vmas_to_free) {
-    assert(spinlock_is_locked(&vma_tree_lock));
+    assert(spinlock_is_locked(&vma_tree_lock.lock));
     assert(!new_vma_ptr || *new_vma_ptr);
     assert(IS_ALLOC_ALIGNED_PTR(begin) && IS_ALLOC_ALIGNED_PTR(end));
 
@@ -242,12 +328,14 @@ static int _vma_bkeep_remove(uintptr_t begin, uintptr_t end, bool is_internal,
 
             split_vma(vma, new_vma, end);
             vma->end = begin;
+            avl_tree_update_path(&vma_tree, &vma->tree_node);
 
             avl_tree_insert(&vma_tree, &new_vma->tree_node);
             return 0;
         }
 
         vma->end = begin;
+        avl_tree_update_path(&vma_tree, &vma->tree_node);
 
         vma = _get_next_vma(vma);
         if (!vma) {
@@ -276,6 +364,7 @@ static int _vma_bkeep_remove(uintptr_t begin, uintptr_t end, bool is_internal,
             vma->offset += end - vma->begin;
         }
         vma->begin = end;
+        avl_tree_update_path(&vma_tree, &vma->tree_node);
     }
 
     return 0;
@@ -297,11 +386,11 @@ static void* _vma_malloc(size_t size) {
     if (ret < 0) {
         struct shim_vma* vmas_to_free = NULL;
 
-        spinlock_lock(&vma_tree_lock);
+        write_seqbegin(&vma_tree_lock);
         /* Since we are freeing a range we just created, additional vma is not needed. */
         ret = _vma_bkeep_remove((uintptr_t)addr, (uintptr_t)addr + size, /*is_internal=*/true, NULL,
                                 &vmas_to_free);
-        spinlock_unlock(&vma_tree_lock);
+        write_seqend(&vma_tree_lock);
         if (ret < 0) {
             log_error("Removing a vma we just created failed with %d!\n", ret);
             BUG();
@@ -427,6 +516,17 @@ static void remove_from_thread_vma_cache(struct shim_vma* to_remove) {
     }
 }
 
+/* Zeroes `vma`. Its tree node may still be read by lock-free readers following stale pointers,
+ * so its pointers are cleared one by one instead of by memset (which might tear them). */
+static void clear_vma(struct shim_vma* vma) {
+    memset(vma, 0, offsetof(struct shim_vma, tree_node));
+    memset(&vma->next_free, 0, sizeof(*vma) - offsetof(struct shim_vma, next_free));
+    __atomic_store_n(&vma->tree_node.left, NULL, __ATOMIC_RELAXED);
+    __atomic_store_n(&vma->tree_node.right, NULL, __ATOMIC_RELAXED);
+    __atomic_store_n(&vma->tree_node.parent, NULL, __ATOMIC_RELAXED);
+    vma->tree_node.balance = 0;
+}
+
 static struct shim_vma* alloc_vma(void) {
     struct shim_vma* vma = get_from_thread_vma_cache();
     if (vma) {
@@ -437,8 +537,10 @@ static struct shim_vma* alloc_vma(void) {
     vma = get_mem_obj_from_mgr(vma_mgr);
     if (!vma) {
         /* `enlarge_mem_mgr` below will call _vma_malloc, which uses at most 1 vma - so we
-         * temporarily provide it. */
-        struct shim_vma tmp_vma = {0};
+         * temporarily provide it. It is not on the stack, because lock-free readers may reach it
+         * even after it is migrated; `vma_mgr_lock` protects it. */
+        static struct shim_vma tmp_vma;
+        clear_vma(&tmp_vma);
         /* vma cache is empty, as we checked it before. */
         if (!add_to_thread_vma_cache(&tmp_vma)) {
             log_error("Failed to add tmp vma to cache!\n");
@@ -455,7 +557,7 @@ static struct shim_vma* alloc_vma(void) {
             BUG();
         }
 
-        spinlock_lock(&vma_tree_lock);
+        write_seqbegin(&vma_tree_lock);
         /* Currently `tmp_vma` is always used (added to `vma_tree`), but this assumption could
          * easily be changed (e.g. if we implement VMAs merging).*/
         struct avl_tree_node* node = &tmp_vma.tree_node;
@@ -465,7 +567,7 @@ static struct shim_vma* alloc_vma(void) {
             avl_tree_swap_node(&vma_tree, node, &vma_migrate->tree_node);
             vma_migrate = NULL;
         }
-        spinlock_unlock(&vma_tree_lock);
+        write_seqend(&vma_tree_lock);
 
         if (vma_migrate) {
             free_mem_obj_to_mgr(vma_mgr, vma_migrate);
@@ -479,7 +581,7 @@ out_unlock:
     unlock(&vma_mgr_lock);
 out:
     if (vma) {
-        memset(vma, 0, sizeof(*vma));
+        clear_vma(vma);
     }
     return vma;
 }
@@ -507,7 +609,7 @@ static void free_vmas_freelist(struct shim_vma* vma) {
 }
 
 static int _bkeep_initial_vma(struct shim_vma* new_vma) {
-    assert(spinlock_is_locked(&vma_tree_lock));
+    assert(spinlock_is_locked(&vma_tree_lock.lock));
 
     struct shim_vma* tmp_vma = _lookup_vma(new_vma->begin);
     if (tmp_vma && tmp_vma->begin < new_vma->end) {
@@ -546,7 +648,7 @@ int init_vma(void) {
         copy_comment(&init_vmas[2 + i], g_pal_control->preloaded_ranges[i].comment);
     }
 
-    spinlock_lock(&vma_tree_lock);
+    write_seqbegin(&vma_tree_lock);
     int ret = 0;
     /* First of init_vmas is reserved for later usage. */
     for (size_t i = 1; i < ARRAY_SIZE(init_vmas); i++) {
@@ -572,7 +674,8 @@ int init_vma(void) {
         log_debug("Initial VMA region 0x%lx-0x%lx (%s) bookkeeped\n", init_vmas[i].begin,
                   init_vmas[i].end, init_vmas[i].comment);
     }
-    spinlock_unlock(&vma_tree_lock);
+    bump_vma_generation();
+    write_seqend(&vma_tree_lock);
     /* From now on if we return with an error we might leave a structure local to this function in
      * vma_tree. We do not bother with removing them - this is initialization of VMA subsystem, if
      * it fails the whole application startup fails and we should never call any of functions in
@@ -630,7 +733,7 @@ int init_vma(void) {
         }
     }
 
-    spinlock_lock(&vma_tree_lock);
+    write_seqbegin(&vma_tree_lock);
     for (size_t i = 0; i < ARRAY_SIZE(init_vmas); i++) {
         /* Skip empty areas. */
         if (init_vmas[i].begin == init_vmas[i].end) {
@@ -640,7 +743,7 @@ int init_vma(void) {
         avl_tree_swap_node(&vma_tree, &init_vmas[i].tree_node, &vmas_to_migrate_to[i]->tree_node);
         vmas_to_migrate_to[i] = NULL;
     }
-    spinlock_unlock(&vma_tree_lock);
+    write_seqend(&vma_tree_lock);
 
     for (size_t i = 0; i < ARRAY_SIZE(vmas_to_migrate_to); i++) {
         if (vmas_to_migrate_to[i]) {
@@ -652,7 +755,7 @@ int init_vma(void) {
 }
 
 static void _add_unmapped_vma(uintptr_t begin, uintptr_t end, struct shim_vma* vma) {
-    assert(spinlock_is_locked(&vma_tree_lock));
+    assert(spinlock_is_locked(&vma_tree_lock.lock));
 
     vma->begin  = begin;
     vma->end    = end;
@@ -682,7 +785,7 @@ int bkeep_munmap(void* addr, size_t length, bool is_internal, void** tmp_vma_ptr
 
     struct shim_vma* vmas_to_free = NULL;
 
-    spinlock_lock(&vma_tree_lock);
+    write_seqbegin(&vma_tree_lock);
     int ret = _vma_bkeep_remove((uintptr_t)addr, (uintptr_t)addr + length, is_internal,
                                 vma2 ? &vma2 : NULL, &vmas_to_free);
     if (ret >= 0) {
@@ -690,7 +793,8 @@ int bkeep_munmap(void* addr, size_t length, bool is_internal, void** tmp_vma_ptr
         *tmp_vma_ptr = (void*)vma1;
         vma1 = NULL;
     }
-    spinlock_unlock(&vma_tree_lock);
+    bump_vma_generation();
+    write_seqend(&vma_tree_lock);
 
     free_vmas_freelist(vmas_to_free);
     if (vma1) {
@@ -709,9 +813,9 @@ void bkeep_remove_tmp_vma(void* _vma) {
 
     assert(vma->flags == (VMA_INTERNAL | VMA_UNMAPPED));
 
-    spinlock_lock(&vma_tree_lock);
+    write_seqbegin(&vma_tree_lock);
     avl_tree_delete(&vma_tree, &vma->tree_node);
-    spinlock_unlock(&vma_tree_lock);
+    write_seqend(&vma_tree_lock);
 
     free_vma(vma);
 }
@@ -720,6 +824,42 @@ static bool is_file_prot_matching(struct shim_handle* file_hdl, int prot) {
     return !(prot & PROT_WRITE) || (file_hdl->flags & O_RDWR);
 }
 
+static void init_mmap_vma(struct shim_vma* vma, void* addr, size_t length, int prot, int flags,
+                          struct shim_handle* file, uint64_t offset, const char* comment) {
+    vma->begin = (uintptr_t)addr;
+    vma->end   = vma->begin + length;
+    vma->prot  = prot;
+    vma->flags = filter_saved_flags(flags) | ((file && (prot & PROT_WRITE)) ? VMA_TAINTED : 0);
+    vma->file  = file;
+    if (vma->file) {
+        get_handle(vma->file);
+    }
+    vma->offset = file ? offset : 0;
+    copy_comment(vma, comment ?: "");
+}
+
+/* Inserts `new_vma` (see `init_mmap_vma`) into the tree, see `bkeep_mmap_fixed`. `*vma1_ptr` is an
+ * optional spare vma and is set to NULL if it was used. */
+static int _bkeep_mmap_fixed(struct shim_vma* new_vma, int flags, struct shim_vma** vma1_ptr,
+                             struct shim_vma** vmas_to_free) {
+    assert(spinlock_is_locked(&vma_tree_lock.lock));
+
+    if (flags & MAP_FIXED_NOREPLACE) {
+        struct shim_vma* tmp_vma = _lookup_vma(new_vma->begin);
+        if (tmp_vma && tmp_vma->begin < new_vma->end) {
+            return -EEXIST;
+        }
+    } else {
+        int ret = _vma_bkeep_remove(new_vma->begin, new_vma->end, !!(flags & VMA_INTERNAL),
+                                    *vma1_ptr ? vma1_ptr : NULL, vmas_to_free);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    avl_tree_insert(&vma_tree, &new_vma->tree_node);
+    return 0;
+}
+
 int bkeep_mmap_fixed(void* addr, size_t length, int prot, int flags, struct shim_handle* file,
                      uint64_t offset, const char* comment) {
     assert(flags & (MAP_FIXED | MAP_FIXED_NOREPLACE));
@@ -735,34 +875,14 @@ int bkeep_mmap_fixed(void* addr, size_t length, int prot, int flags, struct shim
     /* Unmapping may succeed even without this vma, so if this allocation fails we move on. */
     struct shim_vma* vma1 = alloc_vma();
 
-    new_vma->begin = (uintptr_t)addr;
-    new_vma->end   = new_vma->begin + length;
-    new_vma->prot  = prot;
-    new_vma->flags = filter_saved_flags(flags) | ((file && (prot & PROT_WRITE)) ? VMA_TAINTED : 0);
-    new_vma->file  = file;
-    if (new_vma->file) {
-        get_handle(new_vma->file);
-    }
-    new_vma->offset = file ? offset : 0;
-    copy_comment(new_vma, comment ?: "");
+    init_mmap_vma(new_vma, addr, length, prot, flags, file, offset, comment);
 
     struct shim_vma* vmas_to_free = NULL;
 
-    spinlock_lock(&vma_tree_lock);
-    int ret = 0;
-    if (flags & MAP_FIXED_NOREPLACE) {
-        struct shim_vma* tmp_vma = _lookup_vma(new_vma->begin);
-        if (tmp_vma && tmp_vma->begin < new_vma->end) {
-            ret = -EEXIST;
-        }
-    } else {
-        ret = _vma_bkeep_remove(new_vma->begin, new_vma->end, !!(flags & VMA_INTERNAL),
-                                vma1 ? &vma1 : NULL, &vmas_to_free);
-    }
-    if (ret >= 0) {
-        avl_tree_insert(&vma_tree, &new_vma->tree_node);
-    }
-    spinlock_unlock(&vma_tree_lock);
+    write_seqbegin(&vma_tree_lock);
+    int ret = _bkeep_mmap_fixed(new_vma, flags, &vma1, &vmas_to_free);
+    bump_vma_generation();
+    write_seqend(&vma_tree_lock);
 
     free_vmas_freelist(vmas_to_free);
     if (vma1) {
@@ -784,7 +904,7 @@ static void vma_update_prot(struct shim_vma* vma, int prot) {
 
 static int _vma_bkeep_change(uintptr_t begin, uintptr_t end, int prot, bool is_internal,
                              struct shim_vma** new_vma_ptr1, struct shim_vma** new_vma_ptr2) {
-    assert(spinlock_is_locked(&vma_tree_lock));
+    assert(spinlock_is_locked(&vma_tree_lock.lock));
     assert(IS_ALLOC_ALIGNED_PTR(begin) && IS_ALLOC_ALIGNED_PTR(end));
     assert(begin < end);
 
@@ -912,10 +1032,11 @@ int bkeep_mprotect(void* addr, size_t length, int prot, bool is_internal) {
         return -ENOMEM;
     }
 
-    spinlock_lock(&vma_tree_lock);
+    write_seqbegin(&vma_tree_lock);
     int ret = _vma_bkeep_change((uintptr_t)addr, (uintptr_t)addr + length, prot, is_internal, &vma1,
                                 &vma2);
-    spinlock_unlock(&vma_tree_lock);
+    bump_vma_generation();
+    write_seqend(&vma_tree_lock);
 
     if (vma1) {
         free_vma(vma1);
@@ -927,11 +1048,179 @@ int bkeep_mprotect(void* addr, size_t length, int prot, bool is_internal) {
     return ret;
 }
 
-/* TODO consider:
- * maybe it's worth to keep another tree, complementary to `vma_tree`, that would hold free areas.
- * It would give O(logn) unmapped lookup, which now is O(n) in the worst case, but it would also
- * double the memory usage of this subsystem and add some complexity.
- * Another idea is to merge adjacent vmas, that are not backed by any file and have the same prot
+int bkeep_batch(const struct bkeep_op* ops, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const struct bkeep_op* op = &ops[i];
+        if (!op->length || !IS_ALLOC_ALIGNED(op->length) || !IS_ALLOC_ALIGNED_PTR(op->addr)) {
+            return -EINVAL;
+        }
+        assert(op->type == BKEEP_OP_MPROTECT || (op->flags & (MAP_FIXED | MAP_FIXED_NOREPLACE)));
+    }
+
+    /* Each operation gets two vmas: the new one and a spare one for mmap, two spare ones (for
+     * splitting) for mprotect. Spare vmas of mmap are optional, as in `bkeep_mmap_fixed`. */
+    struct shim_vma** vmas = calloc(2 * count, sizeof(*vmas));
+    if (!vmas) {
+        return -ENOMEM;
+    }
+
+    int ret = 0;
+    for (size_t i = 0; i < count; i++) {
+        const struct bkeep_op* op = &ops[i];
+        vmas[2 * i] = alloc_vma();
+        vmas[2 * i + 1] = alloc_vma();
+        if (!vmas[2 * i] || (op->type == BKEEP_OP_MPROTECT && !vmas[2 * i + 1])) {
+            ret = -ENOMEM;
+            goto out;
+        }
+        if (op->type == BKEEP_OP_MMAP_FIXED) {
+            init_mmap_vma(vmas[2 * i], op->addr, op->length, op->prot, op->flags, op->file,
+                          op->offset, op->comment);
+        }
+    }
+
+    struct shim_vma* vmas_to_free = NULL;
+
+    write_seqbegin(&vma_tree_lock);
+    for (size_t i = 0; i < count && ret >= 0; i++) {
+        const struct bkeep_op* op = &ops[i];
+        uintptr_t begin = (uintptr_t)op->addr;
+        switch (op->type) {
+            case BKEEP_OP_MMAP_FIXED:
+                ret = _bkeep_mmap_fixed(vmas[2 * i], op->flags, &vmas[2 * i + 1], &vmas_to_free);
+                if (ret >= 0) {
+                    /* now owned by the tree */
+                    vmas[2 * i] = NULL;
+                }
+                break;
+            case BKEEP_OP_MPROTECT:
+                ret = _vma_bkeep_change(begin, begin + op->length, op->prot,
+                                        !!(op->flags & VMA_INTERNAL), &vmas[2 * i],
+                                        &vmas[2 * i + 1]);
+                break;
+            default:
+                BUG();
+        }
+    }
+    bump_vma_generation();
+    write_seqend(&vma_tree_lock);
+
+    free_vmas_freelist(vmas_to_free);
+
+out:
+    for (size_t i = 0; i < 2 * count; i++) {
+        if (vmas[i]) {
+            free_vma(vmas[i]);
+        }
+    }
+    free(vmas);
+    return ret;
+}
+
+int bkeep_mremap_grow(void* addr, size_t old_length, size_t new_length) {
+    if (!old_length || !IS_ALLOC_ALIGNED(old_length) || !IS_ALLOC_ALIGNED_PTR(addr)
+            || !IS_ALLOC_ALIGNED(new_length) || new_length <= old_length) {
+        return -EINVAL;
+    }
+
+    uintptr_t old_end = (uintptr_t)addr + old_length;
+    uintptr_t new_end = (uintptr_t)addr + new_length;
+    if (new_end < old_end || (uintptr_t)g_pal_control->user_address.end < new_end) {
+        return -ENOMEM;
+    }
+
+    write_seqbegin(&vma_tree_lock);
+    int ret = 0;
+    struct shim_vma* vma = _lookup_vma((uintptr_t)addr);
+    if (!vma || !is_addr_in_vma((uintptr_t)addr, vma) || vma->end < old_end
+            || (vma->flags & (VMA_INTERNAL | VMA_UNMAPPED))) {
+        ret = -EFAULT;
+        goto out;
+    }
+    if (vma->end != old_end) {
+        /* the rest of this vma follows the range */
+        ret = -ENOMEM;
+        goto out;
+    }
+    struct shim_vma* next = _get_next_vma(vma);
+    if (next && next->begin < new_end) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    /* Neighbours are not affected, so this does not change the position of `vma` in the tree. */
+    vma->end = new_end;
+    avl_tree_update_path(&vma_tree, &vma->tree_node);
+    bump_vma_generation();
+
+out:
+    write_seqend(&vma_tree_lock);
+    return ret;
+}
+
+/* Checks whether the free area [begin, end) clipped to [bottom_addr, top_addr) has at least `length`
+ * bytes; if so, stores the end of the clipped area in `*ret_end`. */
+static bool fits_in_range(uintptr_t begin, uintptr_t end, uintptr_t bottom_addr,
+                          uintptr_t top_addr, size_t length, uintptr_t* ret_end) {
+    begin = MAX(begin, bottom_addr);
+    end   = MIN(end, top_addr);
+    if (begin < end && end - begin >= length) {
+        *ret_end = end;
+        return true;
+    }
+    return false;
+}
+
+/* Finds the highest free gap of at least `length` bytes between vmas of the subtree rooted at `vma`,
+ * clipped to [bottom_addr, top_addr), and stores its end in `*ret_end`. Subtrees without a big
+ * enough gap or outside of the range are skipped, so only subtrees crossing the range boundaries
+ * are visited without finding a gap, which makes this O(log n). */
+static bool _find_gap_in_subtree(struct shim_vma* vma, uintptr_t bottom_addr, uintptr_t top_addr,
+                                 size_t length, uintptr_t* ret_end) {
+    assert(spinlock_is_locked(&vma_tree_lock.lock));
+
+    if (!vma || vma->subtree_max_gap < length) {
+        return false;
+    }
+    if (vma->subtree_end <= bottom_addr || top_addr <= vma->subtree_begin) {
+        return false;
+    }
+
+    struct shim_vma* left  = node2vma(vma->tree_node.left);
+    struct shim_vma* right = node2vma(vma->tree_node.right);
+
+    if (_find_gap_in_subtree(right, bottom_addr, top_addr, length, ret_end)) {
+        return true;
+    }
+    if (right && fits_in_range(vma->end, right->subtree_begin, bottom_addr, top_addr, length,
+                               ret_end)) {
+        return true;
+    }
+    if (left && fits_in_range(left->subtree_end, vma->begin, bottom_addr, top_addr, length,
+                              ret_end)) {
+        return true;
+    }
+    return _find_gap_in_subtree(left, bottom_addr, top_addr, length, ret_end);
+}
+
+/* Finds the highest free area of at least `length` bytes in [bottom_addr, top_addr) and stores its
+ * end in `*ret_end`. */
+static bool _find_free_area(uintptr_t bottom_addr, uintptr_t top_addr, size_t length,
+                            uintptr_t* ret_end) {
+    assert(spinlock_is_locked(&vma_tree_lock.lock));
+
+    struct shim_vma* root = node2vma(vma_tree.root);
+    if (!root) {
+        return fits_in_range(bottom_addr, top_addr, bottom_addr, top_addr, length, ret_end);
+    }
+
+    return fits_in_range(root->subtree_end, top_addr, bottom_addr, top_addr, length, ret_end)
+           || _find_gap_in_subtree(root, bottom_addr, top_addr, length, ret_end)
+           || fits_in_range(bottom_addr, root->subtree_begin, bottom_addr, top_addr, length,
+                            ret_end);
+}
+
+/* TODO consider merging adjacent vmas, that are not backed by any file and have the same prot
  * and flags (the question is whether that happens often). */
 /* This function allocates at most 1 vma. If in the future it uses more, `_vma_malloc` should be
  * updated as well. */
@@ -975,35 +1264,14 @@ int bkeep_mmap_any_in_range(void* _bottom_addr, void* _top_addr, size_t length,
     new_vma->offset = file ? offset : 0;
     copy_comment(new_vma, comment ?: "");
 
-    spinlock_lock(&vma_tree_lock);
+    write_seqbegin(&vma_tree_lock);
 
-    struct shim_vma* vma = _lookup_vma(top_addr);
     uintptr_t max_addr;
-    if (!vma) {
-        vma = _get_last_vma();
-        max_addr = top_addr;
-    } else {
-        max_addr = MIN(top_addr, vma->begin);
-        vma = _get_prev_vma(vma);
-    }
-    assert(!vma || vma->end <= max_addr);
-
-    while (vma && bottom_addr <= vma->end) {
-        assert(vma->end <= max_addr);
-        if (max_addr - vma->end >= length) {
-            goto out_found;
-        }
-
-        max_addr = vma->begin;
-        vma = _get_prev_vma(vma);
-    }
-
-    if (!(bottom_addr <= max_addr && max_addr - bottom_addr >= length)) {
+    if (!_find_free_area(bottom_addr, top_addr, length, &max_addr)) {
         ret = -ENOMEM;
         goto out;
     }
 
-out_found:
     new_vma->end   = max_addr;
     new_vma->begin = new_vma->end - length;
 
@@ -1011,9 +1279,10 @@ out_found:
 
     ret_val = new_vma->begin;
     new_vma = NULL;
+    bump_vma_generation();
 
 out:
-    spinlock_unlock(&vma_tree_lock);
+    write_seqend(&vma_tree_lock);
     if (new_vma) {
         free_vma(new_vma);
     }
@@ -1056,11 +1325,44 @@ static void dump_vma(struct shim_vma_info* vma_info, struct shim_vma* vma) {
     memcpy(vma_info->comment, vma->comment, sizeof(vma_info->comment));
 }
 
+/* Lock-free part of `lookup_vma`. Returns false if the lookup must be retried (or done with
+ * `vma_tree_lock` held), in particular for file-backed vmas: their file needs a reference. */
+static bool lookup_vma_speculative(uintptr_t addr, struct shim_vma_info* vma_info, int* ret) {
+    uint32_t seq = read_seqbegin(&vma_tree_lock);
+
+    struct shim_vma* vma;
+    if (!_lookup_vma_speculative(addr, &vma)) {
+        return false;
+    }
+    if (!vma || !is_addr_in_vma(addr, vma)) {
+        *ret = -ENOENT;
+    } else if (__atomic_load_n(&vma->file, __ATOMIC_RELAXED)) {
+        return false;
+    } else {
+        vma_info->addr        = (void*)vma->begin;
+        vma_info->length      = vma->end - vma->begin;
+        vma_info->prot        = vma->prot;
+        vma_info->flags       = vma->flags;
+        vma_info->file_offset = vma->offset;
+        vma_info->file        = NULL;
+        memcpy(vma_info->comment, vma->comment, sizeof(vma_info->comment));
+        *ret = 0;
+    }
+
+    return !read_seqretry(&vma_tree_lock, seq);
+}
+
 int lookup_vma(void* addr, struct shim_vma_info* vma_info) {
     assert(vma_info);
     int ret = 0;
 
-    spinlock_lock(&vma_tree_lock);
+    for (size_t i = 0; i < VMA_SPECULATIVE_RETRIES; i++) {
+        if (lookup_vma_speculative((uintptr_t)addr, vma_info, &ret)) {
+            return ret;
+        }
+    }
+
+    read_seqlock_excl(&vma_tree_lock);
     struct shim_vma* vma = _lookup_vma((uintptr_t)addr);
     if (!vma || !is_addr_in_vma((uintptr_t)addr, vma)) {
         ret = -ENOENT;
@@ -1070,7 +1372,7 @@ int lookup_vma(void* addr, struct shim_vma_info* vma_info) {
     dump_vma(vma_info, vma);
 
 out:
-    spinlock_unlock(&vma_tree_lock);
+    read_sequnlock_excl(&vma_tree_lock);
     return ret;
 }
 
@@ -1087,19 +1389,69 @@ static bool adj_visitor(struct shim_vma* vma, void* visitor_arg) {
     return is_ok;
 }
 
+/* Lock-free version of `_traverse_vmas_in_range` with `adj_visitor`. Returns false if the check
+ * must be retried (or done with `vma_tree_lock` held). */
+static bool is_in_adjacent_user_vmas_speculative(uintptr_t begin, uintptr_t end, int prot,
+                                                 bool* ret) {
+    uint32_t seq = read_seqbegin(&vma_tree_lock);
+
+    uintptr_t addr = begin;
+    bool done = false;
+    *ret = false;
+    for (size_t i = 0; i < VMA_SPECULATIVE_MAX_VMAS && !done; i++) {
+        struct shim_vma* vma;
+        if (!_lookup_vma_speculative(addr, &vma)) {
+            return false;
+        }
+        done = true;
+        if (!vma || addr < vma->begin) {
+            /* hole in the range */
+            break;
+        }
+        if ((vma->flags & (VMA_INTERNAL | VMA_UNMAPPED)) || (vma->prot & prot) != prot) {
+            break;
+        }
+        uintptr_t vma_end = vma->end;
+        if (end <= vma_end) {
+            *ret = true;
+            break;
+        }
+        if (vma_end <= addr) {
+            /* inconsistent view of the tree, `read_seqretry` would catch it */
+            return false;
+        }
+        addr = vma_end;
+        done = false;
+    }
+
+    /* a range spanning too many vmas is checked under the lock */
+    return done && !read_seqretry(&vma_tree_lock, seq);
+}
+
 bool is_in_adjacent_user_vmas(const void* addr, size_t length, int prot) {
     uintptr_t begin = (uintptr_t)addr;
     uintptr_t end = begin + length;
     assert(begin <= end);
 
+    if (begin == end) {
+        return true;
+    }
+
+    for (size_t i = 0; i < VMA_SPECULATIVE_RETRIES; i++) {
+        bool ret;
+        if (is_in_adjacent_user_vmas_speculative(begin, end, prot, &ret)) {
+            return ret;
+        }
+    }
+
     struct adj_visitor_ctx ctx = {
         .prot = prot,
         .is_ok = true,
     };
 
-    spinlock_lock(&vma_tree_lock);
+    read_seqlock_excl(&vma_tree_lock);
     bool is_continuous = _traverse_vmas_in_range(begin, end, adj_visitor, &ctx);
-    spinlock_unlock(&vma_tree_lock);
+    read_sequnlock_excl(&vma_tree_lock);
 
     return is_continuous && ctx.is_ok;
 }
@@ -1109,7 +1461,7 @@ static size_t dump_all_vmas_with_buf(struct shim_vma_info* infos, size_t max_cou
     size_t size = 0;
     struct shim_vma_info* vma_info = infos;
 
-    spinlock_lock(&vma_tree_lock);
+    read_seqlock_excl(&vma_tree_lock);
     struct shim_vma* vma;
 
     for (vma = _get_first_vma(); vma; vma = _get_next_vma(vma)) {
@@ -1123,7 +1475,7 @@ static size_t dump_all_vmas_with_buf(struct shim_vma_info* infos, size_t max_cou
         size++;
     }
 
-    spinlock_unlock(&vma_tree_lock);
+    read_sequnlock_excl(&vma_tree_lock);
 
     return size;
 }
@@ -1149,6 +1501,56 @@ int dump_all_vmas(struct shim_vma_info** ret_infos, size_t* ret_count, bool incl
     }
 }
 
+static size_t dump_shared_file_vmas_with_buf(uintptr_t begin, uintptr_t end,
+                                             struct shim_vma_info* infos, size_t max_count) {
+    size_t size = 0;
+
+    read_seqlock_excl(&vma_tree_lock);
+    for (struct shim_vma* vma = _lookup_vma(begin); vma && vma->begin < end;
+            vma = _get_next_vma(vma)) {
+        if ((vma->flags & (VMA_UNMAPPED | VMA_INTERNAL)) || !vma->file
+                || !(vma->flags & MAP_SHARED)) {
+            continue;
+        }
+        if (size < max_count) {
+            dump_vma(&infos[size], vma);
+        }
+        size++;
+    }
+    read_sequnlock_excl(&vma_tree_lock);
+
+    return size;
+}
+
+int dump_shared_file_vmas(void* addr, size_t length, struct shim_vma_info** ret_infos,
+                          size_t* ret_count) {
+    uintptr_t begin = (uintptr_t)addr;
+    uintptr_t end = begin + length;
+
+    /* most ranges have no shared file mappings, don't allocate anything for them */
+    size_t count = dump_shared_file_vmas_with_buf(begin, end, /*infos=*/NULL, /*max_count=*/0);
+    while (count) {
+        struct shim_vma_info* vmas = calloc(count, sizeof(*vmas));
+        if (!vmas) {
+            return -ENOMEM;
+        }
+
+        size_t needed_count = dump_shared_file_vmas_with_buf(begin, end, vmas, count);
+        if (needed_count <= count) {
+            *ret_infos = vmas;
+            *ret_count = needed_count;
+            return 0;
+        }
+
+        free_vma_info_array(vmas, count);
+        count = needed_count;
+    }
+
+    *ret_infos = NULL;
+    *ret_count = 0;
+    return 0;
+}
+
 void free_vma_info_array(struct shim_vma_info* vma_infos, size_t count) {
     for (size_t i = 0; i < count; i++) {
         if (vma_infos[i].file) {
@@ -1159,14 +1561,15 @@ void free_vma_info_array(struct shim_vma_info* vma_infos, size_t count) {
     free(vma_infos);
 }
 
-struct madvise_dontneed_ctx {
+struct madvise_discard_ctx {
     uintptr_t begin;
     uintptr_t end;
+    bool lazy;
     int error;
 };
 
-static bool madvise_dontneed_visitor(struct shim_vma* vma, void* visitor_arg) {
-    struct madvise_dontneed_ctx* ctx = (struct madvise_dontneed_ctx*)visitor_arg;
+static bool madvise_discard_visitor(struct shim_vma* vma, void* visitor_arg) {
+    struct madvise_discard_ctx* ctx = (struct madvise_discard_ctx*)visitor_arg;
 
     if (vma->flags & (VMA_UNMAPPED | VMA_INTERNAL)) {
         ctx->error = -EINVAL;
@@ -1174,6 +1577,10 @@ static bool madvise_dontneed_visitor(struct shim_vma* vma, void* visitor_arg) {
     }
 
     if (vma->file) {
+        if (ctx->lazy) {
+            /* MADV_FREE is only a hint for file-backed mappings. */
+            return true;
+        }
         if (vma->flags & VMA_TAINTED) {
             /* Resetting writable file-backed mappings is not yet implemented. */
             ctx->error = -ENOSYS;
@@ -1184,33 +1591,65 @@ static bool madvise_dontneed_visitor(struct shim_vma* vma, void* visitor_arg) {
         return true;
     }
 
-    if (!(vma->prot & PROT_WRITE)) {
-        ctx->error = -ENOSYS; // Zeroing non-writable mappings is not yet implemented.
+    /* The PAL releases the memory (if it can) and makes it read as zeroes. */
+    uintptr_t discard_start = MAX(ctx->begin, vma->begin);
+    uintptr_t discard_end = MIN(ctx->end, vma->end);
+    int ret = DkVirtualMemoryDiscard((void*)discard_start, discard_end - discard_start, ctx->lazy);
+    if (ret < 0) {
+        ctx->error = pal_to_unix_errno(ret);
         return false;
     }
-
-    uintptr_t zero_start = MAX(ctx->begin, vma->begin);
-    uintptr_t zero_end = MIN(ctx->end, vma->end);
-    memset((void*)zero_start, 0, zero_end - zero_start);
     return true;
 }
 
-int madvise_dontneed_range(uintptr_t begin, uintptr_t end) {
-    struct madvise_dontneed_ctx ctx = {
+static int madvise_discard_range(uintptr_t begin, uintptr_t end, bool lazy) {
+    struct madvise_discard_ctx ctx = {
         .begin = begin,
         .end = end,
+        .lazy = lazy,
         .error = 0,
     };
 
-    spinlock_lock(&vma_tree_lock);
-    bool is_continuous = _traverse_vmas_in_range(begin, end, madvise_dontneed_visitor, &ctx);
-    spinlock_unlock(&vma_tree_lock);
+    read_seqlock_excl(&vma_tree_lock);
+    bool is_continuous = _traverse_vmas_in_range(begin, end, madvise_discard_visitor, &ctx);
+    read_sequnlock_excl(&vma_tree_lock);
 
     if (!is_continuous)
         return -ENOMEM;
     return ctx.error;
 }
 
+int madvise_dontneed_range(uintptr_t begin, uintptr_t end) {
+    return madvise_discard_range(begin, end, /*lazy=*/false);
+}
+
+int madvise_free_range(uintptr_t begin, uintptr_t end) {
+    return madvise_discard_range(begin, end, /*lazy=*/true);
+}
+
+size_t get_user_vm_size(void) {
+    size_t size = 0;
+
+    read_seqlock_excl(&vma_tree_lock);
+    if (g_vm_size_generation == g_vma_generation) {
+        size = g_vm_size;
+    } else {
+        for (struct shim_vma* vma = _get_first_vma(); vma; vma = _get_next_vma(vma)) {
+            if (!(vma->flags & (VMA_UNMAPPED | VMA_INTERNAL))) {
+                size += vma->end - vma->begin;
+            }
+        }
+        g_vm_size = size;
+        g_vm_size_generation = g_vma_generation;
+    }
+    read_sequnlock_excl(&vma_tree_lock);
+
+    return size;
+}
+
+uint64_t get_vma_generation(void) {
+    return __atomic_load_n(&g_vma_generation, __ATOMIC_RELAXED);
+}
 
 BEGIN_CP_FUNC(vma) {
     __UNUSED(size);
@@ -1234,7 +1673,9 @@ BEGIN_CP_FUNC(vma) {
         void* need_mapped = vma->addr;
 
         /* Check whether we need to checkpoint memory this vma bookkeeps. */
-        if ((vma->flags & VMA_TAINTED || !vma->file) && !(vma->flags & VMA_UNMAPPED)) {
+        /* tmpfs files are not inherited, so the child gets a copy of their mappings */
+        bool copy_memory = vma->flags & VMA_TAINTED || !vma->file || vma->file->type == TYPE_TMPFS;
+        if (copy_memory && !(vma->flags & VMA_UNMAPPED)) {
             void* send_addr  = vma->addr;
             size_t send_size = vma->length;
             if (vma->file) {
@@ -1372,7 +1813,7 @@ static void debug_print_vma(struct shim_vma* vma) {
 }
 
 void debug_print_all_vmas(void) {
-    spinlock_lock(&vma_tree_lock);
+    read_seqlock_excl(&vma_tree_lock);
 
     struct shim_vma* vma = _get_first_vma();
     while (vma) {
@@ -1380,5 +1821,5 @@ void debug_print_all_vmas(void) {
         vma = _get_next_vma(vma);
     }
 
-    spinlock_unlock(&vma_tree_lock);
+    read_sequnlock_excl(&vma_tree_lock);
 }
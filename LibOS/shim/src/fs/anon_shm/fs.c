@@ -0,0 +1,512 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * Shared anonymous memory (enabled with `sys.shared_anonymous_memory`). Without it, a
+ * MAP_SHARED | MAP_ANONYMOUS region is private to each Graphene process, and the child of fork()
+ * gets a copy of it. With it, each such region is backed by an unlinked host file in the given
+ * directory, and mapped through a TYPE_ANON_SHM handle, which children of fork() inherit together
+ * with the mapping.
+ *
+ * If the PAL can map the file shared at the address of the region (all PALs but Linux-SGX), the
+ * region simply is that host mapping, shared by the processes like on Linux.
+ *
+ * Enclave memory can't be shared, and the host must not see the contents, so on Linux-SGX each
+ * process keeps its own copy of the region and exchanges the pages with the other processes
+ * through the file, mapped in untrusted memory. Page `i` is stored at offset `i` pages of the file
+ * encrypted with AES-GCM, with a random key of the region which only the processes sharing it know
+ * (it's sent to children in the checkpoint); its `struct anon_shm_slot` after the last page holds
+ * the IV, tag and version of the page. The version is incremented by every write of the page and
+ * authenticated together with the page index, and a process never accepts an older version of a
+ * page than it has already seen: the host can't modify the pages, move them around or roll back
+ * what a process has seen (a child can be given older pages than its parent saw, though). Slots are
+ * locked by writers with `seq` (odd while a process writes the page) and read seqlock-style, and
+ * the IVs are random, so concurrent writers never reuse one.
+ *
+ * A process publishes the pages it changed (found by comparing `hash_page64` of the page with the
+ * hash at the last exchange, as SGX PAL can't write-protect enclave pages) and takes over the newer
+ * pages published by the others:
+ *   - on msync() of (a part of) the region: publishes, then takes over,
+ *   - on munmap() (also mremap() and mmap(MAP_FIXED) over it), execve() and exit: publishes,
+ *   - on fork(): the parent publishes, the child's mapping is created from the published pages,
+ *   - when wait() reaps a child: takes over (e.g. the results written by worker processes).
+ * In between, the copy of the region behaves like private memory: changes of the other processes
+ * are not seen, a page changed concurrently by several processes ends up as written by the last
+ * one to publish it, and atomic variables and futexes in the region don't work across processes.
+ */
+
+#include <asm/mman.h>
+
+#include "crypto.h"
+#include "pal.h"
+#include "pal_error.h"
+#include "shim_flags_conv.h"
+#include "shim_fs.h"
+#include "shim_handle.h"
+#include "shim_internal.h"
+#include "shim_lock.h"
+#include "shim_utils.h"
+#include "shim_vma.h"
+#include "toml.h"
+
+#define ANON_SHM_IV_SIZE  12
+#define ANON_SHM_TAG_SIZE 16
+#define ANON_SHM_FILE_PREFIX "graphene-shm-"
+
+/* a slot still locked after that many yields is left by a process which died while writing it */
+#define SLOT_WAIT_YIELDS 1000
+
+/* in untrusted memory, after the last page of the file */
+struct anon_shm_slot {
+    uint64_t seq;
+    uint64_t version; /* 0 if the page was never written */
+    uint8_t iv[ANON_SHM_IV_SIZE];
+    uint8_t tag[ANON_SHM_TAG_SIZE];
+    uint8_t pad[20];
+};
+
+static_assert(sizeof(struct anon_shm_slot) == 64, "slots must not share cache lines");
+
+/* authenticated together with each page */
+struct anon_shm_aad {
+    uint64_t index;
+    uint64_t version;
+};
+
+/* URI of the directory of the backing files, NULL if shared anonymous memory is disabled */
+static char* g_anon_shm_dir = NULL;
+
+int init_anon_shm(void) {
+    assert(g_manifest_root);
+
+    char* dir = NULL;
+    int ret = toml_string_in(g_manifest_root, "sys.shared_anonymous_memory", &dir);
+    if (ret < 0 || (dir && !strstartswith(dir, URI_PREFIX_FILE))) {
+        log_error("Cannot parse 'sys.shared_anonymous_memory' (the value must be a \"file:\" URI "
+                  "of a host directory)\n");
+        free(dir);
+        return -EINVAL;
+    }
+    g_anon_shm_dir = dir;
+    return 0;
+}
+
+bool anon_shm_enabled(void) {
+    return g_anon_shm_dir != NULL;
+}
+
+static size_t file_size(struct shim_anon_shm_handle* shm) {
+    size_t slots_size = shm->size / ALLOC_ALIGNMENT * sizeof(struct anon_shm_slot);
+    return shm->size + ALLOC_ALIGN_UP(slots_size);
+}
+
+static struct anon_shm_slot* get_slot(struct shim_anon_shm_handle* shm, size_t index) {
+    return (struct anon_shm_slot*)((char*)shm->umem + shm->size) + index;
+}
+
+int create_anon_shm(size_t size, struct shim_handle** out_hdl) {
+    assert(g_anon_shm_dir);
+    assert(IS_ALLOC_ALIGNED(size));
+
+    uint64_t id;
+    int ret = DkRandomBitsRead(&id, sizeof(id));
+    if (ret < 0)
+        return pal_to_unix_errno(ret);
+
+    size_t uri_size = strlen(g_anon_shm_dir) + 1 + static_strlen(ANON_SHM_FILE_PREFIX) + 16 + 1;
+    char* uri = malloc(uri_size);
+    if (!uri)
+        return -ENOMEM;
+    snprintf(uri, uri_size, "%s/" ANON_SHM_FILE_PREFIX "%016lx", g_anon_shm_dir, id);
+
+    struct shim_handle* hdl = get_new_handle();
+    if (!hdl) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    hdl->type = TYPE_ANON_SHM;
+    hdl->fs = &anon_shm_builtin_fs;
+    hdl->flags = O_RDWR;
+    hdl->acc_mode = MAY_READ | MAY_WRITE;
+    qstrsetstr(&hdl->uri, uri, strlen(uri));
+
+    struct shim_anon_shm_handle* shm = &hdl->info.anon_shm;
+    shm->size = size;
+    ret = DkRandomBitsRead(shm->key, sizeof(shm->key));
+    if (ret < 0) {
+        ret = pal_to_unix_errno(ret);
+        goto out;
+    }
+
+    ret = DkStreamOpen(uri, PAL_ACCESS_RDWR, PAL_SHARE_OWNER_R | PAL_SHARE_OWNER_W,
+                       PAL_CREATE_ALWAYS, /*options=*/0, &hdl->pal_handle);
+    if (ret < 0) {
+        log_warning("Cannot create %s for shared anonymous memory (on SGX, the directory must be "
+                    "in `sgx.allowed_files`)\n", uri);
+        ret = pal_to_unix_errno(ret);
+        goto out;
+    }
+    /* the processes sharing the region reach the file only through inherited handles */
+    ret = DkStreamDelete(hdl->pal_handle, /*access=*/0);
+    if (ret == 0)
+        ret = DkStreamSetLength(hdl->pal_handle, file_size(shm));
+    if (ret < 0) {
+        ret = pal_to_unix_errno(ret);
+        goto out;
+    }
+
+    *out_hdl = hdl;
+    hdl = NULL;
+    ret = 0;
+out:
+    if (hdl)
+        put_handle(hdl);
+    free(uri);
+    return ret;
+}
+
+/* Maps the file in untrusted memory and allocates the state of the pages, if not done yet. */
+static int init_emulation(struct shim_handle* hdl) {
+    assert(locked(&hdl->lock));
+    struct shim_anon_shm_handle* shm = &hdl->info.anon_shm;
+
+    if (!shm->umem) {
+        /* without an address, Linux-SGX maps the file shared outside of the enclave */
+        void* umem = NULL;
+        int ret = DkStreamMap(hdl->pal_handle, &umem, PAL_PROT_READ | PAL_PROT_WRITE,
+                              /*offset=*/0, file_size(shm));
+        if (ret < 0)
+            return pal_to_unix_errno(ret);
+        shm->umem = umem;
+    }
+
+    if (!shm->versions) {
+        size_t pages = shm->size / ALLOC_ALIGNMENT;
+        shm->versions = calloc(pages, sizeof(*shm->versions));
+        shm->hashes = calloc(pages, sizeof(*shm->hashes));
+        if (!shm->versions || !shm->hashes) {
+            free(shm->versions);
+            free(shm->hashes);
+            shm->versions = NULL;
+            shm->hashes = NULL;
+            return -ENOMEM;
+        }
+    }
+    return 0;
+}
+
+/* Publishes page `index` (at `page`) if it changed, using `buf` (of one page). */
+static int publish_page(struct shim_anon_shm_handle* shm, size_t index, char* page, char* buf) {
+    if (hash_page64(page, ALLOC_ALIGNMENT) == shm->hashes[index])
+        return 0;
+
+    /* encrypt a copy, which the application can't change under our hands */
+    memcpy(buf, page, ALLOC_ALIGNMENT);
+    uint64_t hash = hash_page64(buf, ALLOC_ALIGNMENT);
+
+    uint8_t iv[ANON_SHM_IV_SIZE];
+    int ret = DkRandomBitsRead(iv, sizeof(iv));
+    if (ret < 0)
+        return pal_to_unix_errno(ret);
+
+    struct anon_shm_slot* slot = get_slot(shm, index);
+    uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+    for (size_t tries = 0;; tries++) {
+        if ((seq & 1) && tries < SLOT_WAIT_YIELDS) {
+            DkThreadYieldExecution();
+            seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&slot->seq, &seq, seq | 1, /*weak=*/false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+
+    uint64_t version = MAX(__atomic_load_n(&slot->version, __ATOMIC_RELAXED), shm->versions[index])
+                       + 1;
+    struct anon_shm_aad aad = { .index = index, .version = version };
+    uint8_t iv_copy[ANON_SHM_IV_SIZE];
+    memcpy(iv_copy, iv, sizeof(iv));
+    uint8_t tag[ANON_SHM_TAG_SIZE];
+    ret = lib_AESGCMEncrypt(shm->key, sizeof(shm->key), iv_copy, (uint8_t*)buf, ALLOC_ALIGNMENT,
+                            (uint8_t*)&aad, sizeof(aad),
+                            (uint8_t*)shm->umem + index * ALLOC_ALIGNMENT, tag, sizeof(tag));
+    if (ret == 0) {
+        memcpy(slot->iv, iv, sizeof(iv));
+        memcpy(slot->tag, tag, sizeof(tag));
+        __atomic_store_n(&slot->version, version, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&slot->seq, (seq | 1) + 1, __ATOMIC_RELEASE);
+    if (ret < 0) {
+        log_error("anon_shm: encryption of a page failed: %d\n", ret);
+        return -EIO;
+    }
+
+    shm->versions[index] = version;
+    shm->hashes[index]   = hash;
+    return 0;
+}
+
+/* Takes over page `index` (to `page`) if a newer version was published, using `buf` (of two
+ * pages). */
+static int take_over_page(struct shim_anon_shm_handle* shm, size_t index, char* page, char* buf) {
+    struct anon_shm_slot* slot = get_slot(shm, index);
+    struct anon_shm_slot copy;
+    for (size_t tries = 0;; tries++) {
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (!(seq & 1)) {
+            /* nothing new (a lower version, e.g. rolled back by the host, is ignored too) */
+            if (__atomic_load_n(&slot->version, __ATOMIC_RELAXED) <= shm->versions[index])
+                return 0;
+            memcpy(&copy, slot, sizeof(copy));
+            memcpy(buf, (char*)shm->umem + index * ALLOC_ALIGNMENT, ALLOC_ALIGNMENT);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq)
+                break;
+        }
+        if (tries >= SLOT_WAIT_YIELDS) {
+            log_warning("anon_shm: page %lu is locked for too long, not taken over\n", index);
+            return 0;
+        }
+        DkThreadYieldExecution();
+    }
+    if (copy.version <= shm->versions[index])
+        return 0;
+
+    struct anon_shm_aad aad = { .index = index, .version = copy.version };
+    int ret = lib_AESGCMDecrypt(shm->key, sizeof(shm->key), copy.iv, (uint8_t*)buf,
+                                ALLOC_ALIGNMENT, (uint8_t*)&aad, sizeof(aad),
+                                (uint8_t*)buf + ALLOC_ALIGNMENT, copy.tag, sizeof(copy.tag));
+    if (ret < 0) {
+        log_error("anon_shm: page %lu of shared memory was modified by the host\n", index);
+        return -EIO;
+    }
+
+    memcpy(page, buf + ALLOC_ALIGNMENT, ALLOC_ALIGNMENT);
+    shm->versions[index] = copy.version;
+    shm->hashes[index]   = hash_page64(page, ALLOC_ALIGNMENT);
+    return 0;
+}
+
+/* Exchanges [`addr`, `addr` + `size`), mapping the region at `offset`: publishes the changed pages
+ * and, with `take_over`, takes over the newer ones. */
+static int exchange_pages(struct shim_handle* hdl, char* addr, size_t size, uint64_t offset,
+                          bool take_over) {
+    assert(locked(&hdl->lock));
+    struct shim_anon_shm_handle* shm = &hdl->info.anon_shm;
+    if (!shm->emulated || !shm->versions)
+        return 0;
+
+    size = ALLOC_ALIGN_UP(size);
+    assert(offset <= shm->size && size <= shm->size - offset);
+
+    /* the region stays accessible (SGX PAL doesn't restrict permissions of enclave pages) */
+    char* buf = malloc(2 * ALLOC_ALIGNMENT);
+    if (!buf)
+        return -ENOMEM;
+
+    int ret = 0;
+    size_t first = offset / ALLOC_ALIGNMENT;
+    for (size_t i = 0; i < size / ALLOC_ALIGNMENT; i++) {
+        int page_ret = publish_page(shm, first + i, addr + i * ALLOC_ALIGNMENT, buf);
+        if (page_ret < 0 && ret == 0)
+            ret = page_ret;
+    }
+    for (size_t i = 0; take_over && i < size / ALLOC_ALIGNMENT; i++) {
+        int page_ret = take_over_page(shm, first + i, addr + i * ALLOC_ALIGNMENT, buf);
+        if (page_ret < 0 && ret == 0)
+            ret = page_ret;
+    }
+    free(buf);
+    return ret;
+}
+
+static int anon_shm_mmap(struct shim_handle* hdl, void** addr, size_t size, int prot, int flags,
+                         uint64_t offset) {
+    assert(hdl->type == TYPE_ANON_SHM);
+    struct shim_anon_shm_handle* shm = &hdl->info.anon_shm;
+
+    if (!*addr) {
+        /* a LibOS-internal buffer without a VMA (see `handle_copy`) */
+        return -ENOSYS;
+    }
+    /* the region can't grow (e.g. with mremap()) */
+    if (!(flags & MAP_SHARED) || offset > shm->size || size > shm->size - offset)
+        return -EINVAL;
+
+    int ret;
+    lock(&hdl->lock);
+    if (!shm->emulated) {
+        ret = DkStreamMap(hdl->pal_handle, addr, PAL_PROT_READ | PAL_PROT_WRITE, offset, size);
+        if (ret == 0) {
+            ret = DkVirtualMemoryProtect(*addr, size, LINUX_PROT_TO_PAL(prot, /*map_flags=*/0));
+            if (ret < 0 && DkStreamUnmap(*addr, size) < 0)
+                BUG();
+        }
+        if (ret != -PAL_ERROR_DENIED) {
+            ret = pal_to_unix_errno(ret);
+            goto out;
+        }
+        /* the PAL can't map the file shared (Linux-SGX) */
+        shm->emulated = true;
+    }
+
+    ret = init_emulation(hdl);
+    if (ret < 0)
+        goto out;
+
+    ret = DkVirtualMemoryAlloc(addr, size, /*alloc_type=*/0, PAL_PROT_READ | PAL_PROT_WRITE);
+    if (ret < 0) {
+        ret = pal_to_unix_errno(ret);
+        goto out;
+    }
+
+    /* the new memory is zeroed, take over everything published */
+    char* buf = malloc(2 * ALLOC_ALIGNMENT);
+    if (!buf) {
+        ret = -ENOMEM;
+        goto out_free;
+    }
+    size_t first = offset / ALLOC_ALIGNMENT;
+    for (size_t i = 0; i < size / ALLOC_ALIGNMENT; i++) {
+        char* page = (char*)*addr + i * ALLOC_ALIGNMENT;
+        shm->versions[first + i] = 0;
+        ret = take_over_page(shm, first + i, page, buf);
+        if (ret < 0)
+            break;
+        shm->hashes[first + i] = hash_page64(page, ALLOC_ALIGNMENT);
+    }
+    free(buf);
+    if (ret < 0)
+        goto out_free;
+
+    ret = DkVirtualMemoryProtect(*addr, size, LINUX_PROT_TO_PAL(prot, /*map_flags=*/0));
+    if (ret < 0) {
+        ret = pal_to_unix_errno(ret);
+        goto out_free;
+    }
+    goto out;
+
+out_free:
+    if (DkVirtualMemoryFree(*addr, size) < 0)
+        BUG();
+out:
+    unlock(&hdl->lock);
+    return ret;
+}
+
+static int anon_shm_munmap(struct shim_handle* hdl, void* addr, size_t size, int prot,
+                           uint64_t offset) {
+    __UNUSED(prot);
+    assert(hdl->type == TYPE_ANON_SHM);
+
+    lock(&hdl->lock);
+    int ret = exchange_pages(hdl, addr, size, offset, /*take_over=*/false);
+    unlock(&hdl->lock);
+    if (ret < 0)
+        log_warning("anon_shm: cannot publish unmapped shared memory: %d\n", ret);
+    return ret;
+}
+
+static int anon_shm_msync(struct shim_handle* hdl, void* addr, size_t size, int prot,
+                          uint64_t offset) {
+    __UNUSED(prot);
+    assert(hdl->type == TYPE_ANON_SHM);
+
+    lock(&hdl->lock);
+    int ret = exchange_pages(hdl, addr, size, offset, /*take_over=*/true);
+    unlock(&hdl->lock);
+    return ret;
+}
+
+/* Exchanges all mapped shared anonymous memory (see the comment at the top). */
+void exchange_all_anon_shm(bool take_over) {
+    if (!g_anon_shm_dir)
+        return;
+
+    struct shim_vma_info* vmas;
+    size_t count;
+    void* start = g_pal_control->user_address.start;
+    size_t size = (char*)g_pal_control->user_address.end - (char*)start;
+    if (dump_shared_file_vmas(start, size, &vmas, &count) < 0) {
+        log_warning("anon_shm: cannot exchange shared memory\n");
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        struct shim_handle* hdl = vmas[i].file;
+        if (hdl->type != TYPE_ANON_SHM)
+            continue;
+
+        lock(&hdl->lock);
+        int ret = exchange_pages(hdl, vmas[i].addr, vmas[i].length, vmas[i].file_offset,
+                                 take_over);
+        unlock(&hdl->lock);
+        if (ret < 0)
+            log_warning("anon_shm: cannot exchange shared memory: %d\n", ret);
+    }
+    free_vma_info_array(vmas, count);
+}
+
+int migrate_anon_shm(struct shim_handle* hdl) {
+    assert(hdl->type == TYPE_ANON_SHM);
+
+    struct shim_vma_info* vmas;
+    size_t count;
+    void* start = g_pal_control->user_address.start;
+    size_t size = (char*)g_pal_control->user_address.end - (char*)start;
+    int ret = dump_shared_file_vmas(start, size, &vmas, &count);
+    if (ret < 0)
+        return ret;
+
+    for (size_t i = 0; i < count && ret == 0; i++) {
+        if (vmas[i].file != hdl)
+            continue;
+
+        lock(&hdl->lock);
+        ret = exchange_pages(hdl, vmas[i].addr, vmas[i].length, vmas[i].file_offset,
+                             /*take_over=*/false);
+        unlock(&hdl->lock);
+    }
+    free_vma_info_array(vmas, count);
+    return ret;
+}
+
+static int anon_shm_checkout(struct shim_handle* hdl) {
+    assert(hdl->type == TYPE_ANON_SHM);
+
+    /* the child maps the file and starts with the pages published by this process */
+    hdl->info.anon_shm.umem     = NULL;
+    hdl->info.anon_shm.versions = NULL;
+    hdl->info.anon_shm.hashes   = NULL;
+    return 0;
+}
+
+static int anon_shm_close(struct shim_handle* hdl) {
+    assert(hdl->type == TYPE_ANON_SHM);
+    struct shim_anon_shm_handle* shm = &hdl->info.anon_shm;
+
+    if (shm->umem && DkStreamUnmap(shm->umem, file_size(shm)) < 0)
+        log_warning("anon_shm: cannot unmap shared memory\n");
+    shm->umem = NULL;
+    free(shm->versions);
+    free(shm->hashes);
+    shm->versions = NULL;
+    shm->hashes   = NULL;
+    /* don't leave the key behind in freed memory */
+    memset(shm->key, 0, sizeof(shm->key));
+    return 0;
+}
+
+struct shim_fs_ops anon_shm_fs_ops = {
+    .close    = &anon_shm_close,
+    .mmap     = &anon_shm_mmap,
+    .munmap   = &anon_shm_munmap,
+    .msync    = &anon_shm_msync,
+    .checkout = &anon_shm_checkout,
+};
+
+struct shim_fs anon_shm_builtin_fs = {
+    .name   = "anon_shm",
+    .fs_ops = &anon_shm_fs_ops,
+};
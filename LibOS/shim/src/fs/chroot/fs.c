@@ -9,10 +9,12 @@
 #include <asm/mman.h>
 #include <asm/unistd.h>
 #include <errno.h>
+#include <linux/fadvise.h>
 #include <linux/fcntl.h>
 
 #include "pal.h"
 #include "pal_error.h"
+#include "shim_checkpoint.h"
 #include "shim_flags_conv.h"
 #include "shim_fs.h"
 #include "shim_handle.h"
@@ -33,6 +35,28 @@ struct mount_data {
 
 #define DENTRY_MOUNT_DATA(d) ((struct mount_data*)(d)->mount->data)
 
+/* first refill of the read-ahead window, doubled with every further sequential refill */
+#define READ_AHEAD_MIN_SIZE (16 * 1024UL)
+#define READ_AHEAD_MAX_SIZE (16 * 1024 * 1024)
+
+static size_t g_read_ahead_max_size = 0;
+
+int init_chroot_read_ahead(void) {
+    assert(g_manifest_root);
+
+    uint64_t size;
+    int ret = toml_sizestring_in(g_manifest_root, "fs.read_ahead_max_size", /*defaultval=*/0,
+                                 &size);
+    if (ret < 0 || size > READ_AHEAD_MAX_SIZE) {
+        log_error("Cannot parse 'fs.read_ahead_max_size' (the value must be put in double quotes "
+                  "and be at most 16M)\n");
+        return -EINVAL;
+    }
+
+    g_read_ahead_max_size = size;
+    return 0;
+}
+
 static int chroot_mount(const char* uri, void** mount_data) {
     enum shim_file_type type;
 
@@ -133,6 +157,7 @@ static struct shim_file_data* __create_data(void) {
 }
 
 static void __destroy_data(struct shim_file_data* data) {
+    chroot_page_cache_invalidate(data, 0, -1);
     qstrfree(&data->host_uri);
     destroy_lock(&data->lock);
     free(data);
@@ -550,15 +575,106 @@ static int chroot_hstat(struct shim_handle* hdl, struct stat* stat) {
 }
 
 static int chroot_flush(struct shim_handle* hdl) {
+    lock(&hdl->lock);
+    int ret = chroot_flush_writes(hdl);
+    if (ret == 0 && hdl->type == TYPE_FILE)
+        ret = chroot_shared_map_sync_all(hdl);
+    unlock(&hdl->lock);
+    if (ret < 0)
+        return ret;
+
     return pal_to_unix_errno(DkStreamFlush(hdl->pal_handle));
 }
 
 static int chroot_close(struct shim_handle* hdl) {
-    __UNUSED(hdl);
+    if (hdl->type == TYPE_FILE) {
+        chroot_free_write_buffer(hdl);
+        chroot_free_shared_maps(hdl);
+        free(hdl->info.file.ra_buf);
+        hdl->info.file.ra_buf = NULL;
+    }
     return 0;
 }
 
-static ssize_t chroot_read(struct shim_handle* hdl, void* buf, size_t count) {
+/*
+ * Read `*count` bytes at the marker of a regular file through its read-ahead window. Bytes in the
+ * window are served without asking the host. A missing rest that is smaller than the window is
+ * fetched together with the following part of the file with one host read, larger reads go to the
+ * host directly. The window grows from READ_AHEAD_MIN_SIZE up to `fs.read_ahead_max_size` while
+ * reads are sequential and shrinks to nothing on the first non-sequential one; after
+ * fadvise(POSIX_FADV_SEQUENTIAL) it is always at its maximum, after fadvise(POSIX_FADV_RANDOM)
+ * always empty. Writes, truncation and seeks outside of the window drop its contents. `hdl->lock`
+ * must be held.
+ *
+ * Returns a PAL error code, like DkStreamRead; `*count` is set to the number of bytes read.
+ */
+static int read_with_read_ahead(struct shim_handle* hdl, char* buf, size_t* count) {
+    struct shim_file_handle* file = &hdl->info.file;
+    assert(locked(&hdl->lock));
+
+    if (file->advice == POSIX_FADV_SEQUENTIAL) {
+        file->ra_window = g_read_ahead_max_size;
+    } else if (file->advice != POSIX_FADV_RANDOM && file->marker == file->ra_next) {
+        file->ra_window = file->ra_window ? MIN(file->ra_window * 2, g_read_ahead_max_size)
+                                          : MIN(READ_AHEAD_MIN_SIZE, g_read_ahead_max_size);
+    } else {
+        file->ra_window = 0;
+    }
+
+    size_t copied = 0;
+    if (file->ra_len && file->marker >= file->ra_off
+            && file->marker < file->ra_off + (off_t)file->ra_len) {
+        size_t off = file->marker - file->ra_off;
+        copied = MIN(*count, file->ra_len - off);
+        memcpy(buf, file->ra_buf + off, copied);
+    }
+
+    int ret = 0;
+    size_t left = *count - copied;
+    off_t pos = file->marker + copied;
+    if (left && left < file->ra_window) {
+        if (file->ra_size < file->ra_window) {
+            /* on allocation failure, just go on with the old (maybe no) buffer */
+            char* new_buf = malloc(file->ra_window);
+            if (new_buf) {
+                free(file->ra_buf);
+                file->ra_buf  = new_buf;
+                file->ra_size = file->ra_window;
+            }
+        }
+
+        file->ra_len = 0;
+        size_t len = MIN(file->ra_window, file->ra_size);
+        if (len > left) {
+            ret = DkStreamRead(hdl->pal_handle, pos, &len, file->ra_buf, NULL, 0);
+            if (ret == 0) {
+                file->ra_off = pos;
+                file->ra_len = len;
+                size_t n = MIN(left, len);
+                memcpy(buf + copied, file->ra_buf, n);
+                copied += n;
+                left = 0;
+            }
+        }
+    }
+
+    if (left && ret == 0) {
+        size_t len = left;
+        ret = DkStreamRead(hdl->pal_handle, pos, &len, buf + copied, NULL, 0);
+        if (ret == 0)
+            copied += len;
+    }
+
+    if (ret < 0 && !copied)
+        return ret;
+
+    *count = copied;
+    file->ra_next = file->marker + copied;
+    return 0;
+}
+
+static ssize_t chroot_readv(struct shim_handle* hdl, const struct iovec* iov, size_t iov_len,
+                            size_t count) {
     ssize_t ret = 0;
 
     if (count == 0)
@@ -584,7 +700,18 @@ static ssize_t chroot_read(struct shim_handle* hdl, void* buf, size_t count) {
 
     lock(&hdl->lock);
 
-    ret = DkStreamRead(hdl->pal_handle, file->marker, &count, buf, NULL, 0);
+    /* reads have to see the data buffered by write-behind */
+    int flush_ret = chroot_flush_writes(hdl);
+    if (flush_ret < 0)
+        chroot_defer_flush_error(hdl, flush_ret);
+
+    if (iov_len == 1 && chroot_page_cache_enabled(hdl)) {
+        ret = chroot_page_cache_read(hdl, iov[0].iov_base, file->marker, &count);
+    } else if (iov_len == 1 && file->type == FILE_REGULAR && g_read_ahead_max_size) {
+        ret = read_with_read_ahead(hdl, iov[0].iov_base, &count);
+    } else {
+        ret = DkStreamReadv(hdl->pal_handle, file->marker, (const PAL_IOVEC*)iov, iov_len, &count);
+    }
     if (ret < 0) {
         ret = pal_to_unix_errno(ret);
     } else {
@@ -602,7 +729,13 @@ out:
     return ret;
 }
 
-static ssize_t chroot_write(struct shim_handle* hdl, const void* buf, size_t count) {
+static ssize_t chroot_read(struct shim_handle* hdl, void* buf, size_t count) {
+    struct iovec iov = { .iov_base = buf, .iov_len = count };
+    return chroot_readv(hdl, &iov, 1, count);
+}
+
+static ssize_t chroot_writev(struct shim_handle* hdl, const struct iovec* iov, size_t iov_len,
+                             size_t count) {
     ssize_t ret;
 
     if (count == 0)
@@ -629,9 +762,18 @@ static ssize_t chroot_write(struct shim_handle* hdl, const void* buf, size_t cou
 
     lock(&hdl->lock);
 
-    ret = DkStreamWrite(hdl->pal_handle, file->marker, &count, (void*)buf, NULL);
-    if (ret < 0) {
-        ret = pal_to_unix_errno(ret);
+    file->ra_len = 0;
+    int write_ret;
+    if (!chroot_write_behind(hdl, iov, iov_len, count, &write_ret)) {
+        write_ret = DkStreamWritev(hdl->pal_handle, file->marker, (const PAL_IOVEC*)iov, iov_len,
+                                   &count);
+        if (write_ret < 0)
+            write_ret = pal_to_unix_errno(write_ret);
+        else if (FILE_HANDLE_DATA(hdl))
+            chroot_page_cache_written(FILE_HANDLE_DATA(hdl), file->marker, count);
+    }
+    if (write_ret < 0) {
+        ret = write_ret;
     } else {
         if (__builtin_add_overflow(count, 0, &ret)) {
             BUG();
@@ -651,6 +793,72 @@ out:
     return ret;
 }
 
+static ssize_t chroot_write(struct shim_handle* hdl, const void* buf, size_t count) {
+    struct iovec iov = { .iov_base = (void*)buf, .iov_len = count };
+    return chroot_writev(hdl, &iov, 1, count);
+}
+
+bool chroot_copy_file_range(struct shim_handle* hdli, off_t pos_in, struct shim_handle* hdlo,
+                            off_t pos_out, size_t count, ssize_t* out_ret) {
+    assert(hdli->type == TYPE_FILE && hdlo->type == TYPE_FILE);
+
+    int ret;
+    if ((NEED_RECREATE(hdli) && (ret = chroot_recreate(hdli)) < 0) ||
+            (NEED_RECREATE(hdlo) && (ret = chroot_recreate(hdlo)) < 0)) {
+        *out_ret = ret;
+        return true;
+    }
+
+    if (!hdli->pal_handle || !hdlo->pal_handle)
+        return false;
+
+    struct shim_file_handle* file = &hdlo->info.file;
+    off_t dummy_off_t;
+    if (__builtin_add_overflow(pos_out, count, &dummy_off_t)) {
+        *out_ret = -EFBIG;
+        return true;
+    }
+
+    /* lock both handles in address order, so that concurrent copies in opposite directions don't
+     * deadlock */
+    struct shim_handle* first  = hdli < hdlo ? hdli : hdlo;
+    struct shim_handle* second = hdli < hdlo ? hdlo : hdli;
+    lock(&first->lock);
+    if (second != first)
+        lock(&second->lock);
+
+    /* the copy has to see the data buffered by write-behind, and must not be overwritten by it */
+    int flush_ret = chroot_flush_writes(hdli);
+    if (flush_ret < 0)
+        chroot_defer_flush_error(hdli, flush_ret);
+    if (hdlo != hdli) {
+        flush_ret = chroot_flush_writes(hdlo);
+        if (flush_ret < 0)
+            chroot_defer_flush_error(hdlo, flush_ret);
+    }
+
+    PAL_NUM bytes = 0;
+    ret = DkStreamCopyFile(hdlo->pal_handle, pos_out, hdli->pal_handle, pos_in, count, &bytes);
+    bool handled = ret != -PAL_ERROR_NOTSUPPORT;
+    if (ret < 0) {
+        *out_ret = pal_to_unix_errno(ret);
+    } else {
+        /* like chroot_writev() */
+        file->ra_len = 0;
+        chroot_page_cache_written(FILE_HANDLE_DATA(hdlo), pos_out, bytes);
+        if (pos_out + (off_t)bytes > file->size) {
+            file->size = pos_out + bytes;
+            chroot_update_size(hdlo, file, FILE_HANDLE_DATA(hdlo));
+        }
+        *out_ret = bytes;
+    }
+
+    if (second != first)
+        unlock(&second->lock);
+    unlock(&first->lock);
+    return handled;
+}
+
 static int chroot_mmap(struct shim_handle* hdl, void** addr, size_t size, int prot, int flags,
                        uint64_t offset) {
     int ret;
@@ -659,6 +867,12 @@ static int chroot_mmap(struct shim_handle* hdl, void** addr, size_t size, int pr
 
     int pal_prot = LINUX_PROT_TO_PAL(prot, flags);
 
+    lock(&hdl->lock);
+    ret = chroot_flush_writes(hdl);
+    if (ret < 0)
+        chroot_defer_flush_error(hdl, ret);
+    unlock(&hdl->lock);
+
 #if MAP_FILE == 0
     if (flags & MAP_ANONYMOUS)
 #else
@@ -666,7 +880,63 @@ static int chroot_mmap(struct shim_handle* hdl, void** addr, size_t size, int pr
 #endif
         return -EINVAL;
 
-    return pal_to_unix_errno(DkStreamMap(hdl->pal_handle, addr, pal_prot, offset, size));
+    if (flags & MAP_SHARED) {
+        /* the pages of the file may change through the mapping at any time */
+        if ((prot & PROT_WRITE) && FILE_HANDLE_DATA(hdl))
+            chroot_page_cache_disable(FILE_HANDLE_DATA(hdl));
+    } else if (chroot_page_cache_enabled(hdl) && chroot_page_cache_cached(hdl, offset, size)) {
+        /* a private mapping is a copy of the file, which the page cache already has; otherwise
+         * the mapping is left to the PAL, which may populate it on demand (e.g. ELF segments of
+         * trusted files with `sgx.trusted_files_lazy_mmap`), instead of reading all of it now */
+        ret = DkVirtualMemoryAlloc(addr, size, /*alloc_type=*/0, PAL_PROT_READ | PAL_PROT_WRITE);
+        if (ret < 0)
+            return pal_to_unix_errno(ret);
+
+        size_t count = size;
+        lock(&hdl->lock);
+        ret = chroot_page_cache_read(hdl, *addr, offset, &count);
+        unlock(&hdl->lock);
+        if (ret == 0)
+            ret = DkVirtualMemoryProtect(*addr, size, LINUX_PROT_TO_PAL(prot, /*map_flags=*/0));
+        if (ret < 0) {
+            if (DkVirtualMemoryFree(*addr, size) < 0)
+                BUG();
+            return pal_to_unix_errno(ret);
+        }
+        return 0;
+    }
+
+    ret = DkStreamMap(hdl->pal_handle, addr, pal_prot, offset, size);
+    if (ret == -PAL_ERROR_DENIED && hdl->type == TYPE_FILE && (flags & MAP_SHARED)
+            && (prot & PROT_WRITE)) {
+        /* the PAL cannot map the file shared (an allowed file on SGX), emulate it */
+        return chroot_shared_map(hdl, addr, size, prot, offset);
+    }
+    return pal_to_unix_errno(ret);
+}
+
+static int chroot_munmap(struct shim_handle* hdl, void* addr, size_t size, int prot,
+                         uint64_t offset) {
+    if (hdl->type != TYPE_FILE)
+        return 0;
+
+    lock(&hdl->lock);
+    int ret = chroot_shared_map_sync(hdl, addr, size, offset, prot & PROT_WRITE, /*forget=*/true);
+    unlock(&hdl->lock);
+    if (ret < 0)
+        log_warning("chroot: cannot write back a shared mapping: %d\n", ret);
+    return ret;
+}
+
+static int chroot_msync(struct shim_handle* hdl, void* addr, size_t size, int prot,
+                        uint64_t offset) {
+    if (hdl->type != TYPE_FILE)
+        return 0;
+
+    lock(&hdl->lock);
+    int ret = chroot_shared_map_sync(hdl, addr, size, offset, prot & PROT_WRITE, /*forget=*/false);
+    unlock(&hdl->lock);
+    return ret;
 }
 
 static off_t chroot_seek(struct shim_handle* hdl, off_t offset, int whence) {
@@ -711,6 +981,9 @@ static off_t chroot_seek(struct shim_handle* hdl, off_t offset, int whence) {
 
     ret = file->marker = marker;
 
+    if (file->ra_len && (marker < file->ra_off || marker > file->ra_off + (off_t)file->ra_len))
+        file->ra_len = 0;
+
 out:
     unlock(&hdl->lock);
     return ret;
@@ -728,7 +1001,13 @@ static int chroot_truncate(struct shim_handle* hdl, off_t len) {
     struct shim_file_handle* file = &hdl->info.file;
     lock(&hdl->lock);
 
+    /* buffered data must not be written after the truncation */
+    ret = chroot_flush_writes(hdl);
+    if (ret < 0)
+        goto out;
+
     file->size = len;
+    file->ra_len = 0;
 
     if (check_version(hdl)) {
         struct shim_file_data* data = FILE_HANDLE_DATA(hdl);
@@ -741,6 +1020,9 @@ static int chroot_truncate(struct shim_handle* hdl, off_t len) {
         goto out;
     }
 
+    if (FILE_HANDLE_DATA(hdl))
+        chroot_page_cache_invalidate(FILE_HANDLE_DATA(hdl), len, -1);
+
     if (file->marker > len)
         file->marker = len;
 
@@ -749,6 +1031,89 @@ out:
     return ret;
 }
 
+static int chroot_fallocate(struct shim_handle* hdl, off_t offset, off_t len, bool keep_size) {
+    int ret = 0;
+
+    if (NEED_RECREATE(hdl) && (ret = chroot_recreate(hdl)) < 0)
+        return ret;
+
+    struct shim_file_handle* file = &hdl->info.file;
+    lock(&hdl->lock);
+
+    /* the host file must have its final size before we extend it */
+    ret = chroot_flush_writes(hdl);
+    if (ret < 0)
+        goto out;
+
+    ret = DkStreamAllocate(hdl->pal_handle, offset, len, keep_size);
+    if (ret == -PAL_ERROR_NOTSUPPORT && !keep_size) {
+        /* the host can't preallocate: a sparse extension still saves the caller from writing
+         * zeros (which is what e.g. glibc's `posix_fallocate` would do) */
+        ret = offset + len > file->size ? DkStreamSetLength(hdl->pal_handle, offset + len) : 0;
+    }
+    if (ret < 0) {
+        /* the PAL reports a full host filesystem as running out of memory */
+        ret = ret == -PAL_ERROR_NOMEM ? -ENOSPC : pal_to_unix_errno(ret);
+        goto out;
+    }
+
+    if (!keep_size && offset + len > file->size) {
+        file->size = offset + len;
+        if (check_version(hdl)) {
+            struct shim_file_data* data = FILE_HANDLE_DATA(hdl);
+            __atomic_store_n(&data->size.counter, file->size, __ATOMIC_SEQ_CST);
+        }
+    }
+
+out:
+    unlock(&hdl->lock);
+    return ret;
+}
+
+static int chroot_advise(struct shim_handle* hdl, off_t offset, off_t len, int advice) {
+    int ret = 0;
+
+    if (NEED_RECREATE(hdl) && (ret = chroot_recreate(hdl)) < 0)
+        return ret;
+
+    struct shim_file_handle* file = &hdl->info.file;
+    if (file->type != FILE_REGULAR)
+        return 0;
+
+    lock(&hdl->lock);
+    switch (advice) {
+        case POSIX_FADV_NORMAL:
+        case POSIX_FADV_SEQUENTIAL:
+        case POSIX_FADV_RANDOM:
+            file->advice = advice;
+            break;
+        case POSIX_FADV_DONTNEED: {
+            /* like Linux, write out the dirty data first, then drop what is cached */
+            ret = chroot_flush_writes(hdl);
+            if (ret < 0) {
+                chroot_defer_flush_error(hdl, ret);
+                ret = 0;
+            }
+            if (file->ra_len && (!len || offset < file->ra_off + (off_t)file->ra_len)
+                    && file->ra_off < offset + len)
+                file->ra_len = 0;
+            struct shim_file_data* data = FILE_HANDLE_DATA(hdl);
+            if (data)
+                chroot_page_cache_invalidate(data, offset, len ? offset + len : -1);
+            break;
+        }
+        case POSIX_FADV_WILLNEED:
+            /* the host (or the PAL) fetches the range in the background */
+            break;
+    }
+    unlock(&hdl->lock);
+
+    ret = DkStreamAdvise(hdl->pal_handle, offset, len, LINUX_FADV_TO_PAL_ADVICE(advice));
+    if (ret < 0 && ret != -PAL_ERROR_NOTSUPPORT)
+        return pal_to_unix_errno(ret);
+    return 0;
+}
+
 static int chroot_dput(struct shim_dentry* dent) {
     struct shim_file_data* data = FILE_DENTRY_DATA(dent);
 
@@ -833,15 +1198,25 @@ static int chroot_checkout(struct shim_handle* hdl) {
         struct shim_file_data* data = FILE_HANDLE_DATA(hdl);
         if (data)
             hdl->info.file.data = NULL;
+
+        chroot_checkout_write_buffer(hdl);
+
+        /* the read-ahead buffer and the emulated shared mappings stay with the parent */
+        hdl->info.file.smaps   = NULL;
+        hdl->info.file.ra_buf  = NULL;
+        hdl->info.file.ra_size = 0;
+        hdl->info.file.ra_len  = 0;
     }
 
     if (hdl->pal_handle) {
         /*
          * if the file still exists in the host, no need to send
-         * the handle over RPC; otherwise, send it.
+         * the handle over RPC; otherwise, send it. Files on immutable
+         * mounts can't be removed by anyone.
          */
         PAL_STREAM_ATTR attr;
-        if (DkStreamAttributesQuery(qstrgetstr(&hdl->uri), &attr) == 0)
+        if ((hdl->dentry && hdl->dentry->mount && hdl->dentry->mount->immutable)
+                || DkStreamAttributesQuery(qstrgetstr(&hdl->uri), &attr) == 0)
             hdl->pal_handle = NULL;
     }
 
@@ -869,6 +1244,48 @@ static int chroot_migrate(void* checkpoint, void** mount_data) {
     return 0;
 }
 
+/* Attributes of files on immutable mounts can't go stale, so the dentry checkpoint (see
+ * `BEGIN_CP_FUNC(dentry)`) hands them over to the child instead of letting it query them again. */
+BEGIN_CP_FUNC(chroot_file_data) {
+    __UNUSED(size);
+    assert(size == sizeof(struct shim_file_data));
+
+    struct shim_file_data* data     = (struct shim_file_data*)obj;
+    struct shim_file_data* new_data = NULL;
+
+    size_t off = GET_FROM_CP_MAP(obj);
+
+    if (!off) {
+        off = ADD_CP_OFFSET(sizeof(struct shim_file_data));
+        ADD_TO_CP_MAP(obj, off);
+        new_data = (struct shim_file_data*)(base + off);
+
+        lock(&data->lock);
+        *new_data = *data;
+        clear_lock(&new_data->lock);
+        DO_CP_IN_MEMBER(qstr, new_data, host_uri);
+        unlock(&data->lock);
+
+        ADD_CP_FUNC_ENTRY(off);
+    } else {
+        new_data = (struct shim_file_data*)(base + off);
+    }
+
+    if (objp)
+        *objp = (void*)new_data;
+}
+END_CP_FUNC(chroot_file_data)
+
+BEGIN_RS_FUNC(chroot_file_data) {
+    __UNUSED(offset);
+    __UNUSED(rebase);
+    struct shim_file_data* data = (void*)(base + GET_CP_FUNC_ENTRY());
+
+    if (!create_lock(&data->lock))
+        return -ENOMEM;
+}
+END_RS_FUNC(chroot_file_data)
+
 static int chroot_unlink(struct shim_dentry* dir, struct shim_dentry* dent) {
     __UNUSED(dir);
 
@@ -890,6 +1307,7 @@ static int chroot_unlink(struct shim_dentry* dir, struct shim_dentry* dent) {
     }
 
     data->queried = false;
+    chroot_page_cache_invalidate(data, 0, -1);
 
     __atomic_add_fetch(&data->version.counter, 1, __ATOMIC_SEQ_CST);
     __atomic_store_n(&data->size.counter, 0, __ATOMIC_SEQ_CST);
@@ -958,6 +1376,8 @@ static int chroot_rename(struct shim_dentry* old, struct shim_dentry* new) {
     new->perm = old->perm;
     new->type = old->type;
     old_data->queried = false;
+    chroot_page_cache_invalidate(old_data, 0, -1);
+    chroot_page_cache_invalidate(new_data, 0, -1);
 
     DkObjectClose(pal_hdl);
 
@@ -999,10 +1419,16 @@ struct shim_fs_ops chroot_fs_ops = {
     .close      = &chroot_close,
     .read       = &chroot_read,
     .write      = &chroot_write,
+    .readv      = &chroot_readv,
+    .writev     = &chroot_writev,
     .mmap       = &chroot_mmap,
+    .munmap     = &chroot_munmap,
+    .msync      = &chroot_msync,
     .seek       = &chroot_seek,
     .hstat      = &chroot_hstat,
     .truncate   = &chroot_truncate,
+    .fallocate  = &chroot_fallocate,
+    .advise     = &chroot_advise,
     .checkout   = &chroot_checkout,
     .checkpoint = &chroot_checkpoint,
     .migrate    = &chroot_migrate,
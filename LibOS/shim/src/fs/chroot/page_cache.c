@@ -0,0 +1,328 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * Process-wide page cache of chroot files on immutable mounts (enabled with `fs.page_cache_size`).
+ * Applications (and their interpreters) read the same configuration files, templates and library
+ * sources over and over, through many handles; on SGX, every such read is an OCALL followed by
+ * decryption or hash verification of the data. With the cache, file contents read once are kept in
+ * LibOS memory, in pages of CACHE_PAGE_SIZE bytes keyed by (`struct shim_file_data`, page index),
+ * and whole-page misses are fetched with one host read. The least recently used pages are evicted
+ * when the cache is full.
+ *
+ * Only files on immutable mounts are cached, so the host never changes them behind our back. What
+ * the process itself does to a file is kept coherent:
+ *   - writes (also flushes of write-behind buffers) and truncation drop the affected pages (and the
+ *     old last page, which a write past the end of file changes too),
+ *   - unlink and rename drop all pages of the file,
+ *   - a shared writable mapping disables caching of the file, as its pages may change at any time.
+ * A read that raced with one of these doesn't insert the pages it fetched (see `cache_gen`).
+ *
+ * The cache is per process, child processes start with an empty one.
+ */
+
+#include <linux/fadvise.h>
+
+#include "list.h"
+#include "pal.h"
+#include "pal_error.h"
+#include "shim_fs.h"
+#include "shim_handle.h"
+#include "shim_internal.h"
+#include "shim_lock.h"
+#include "shim_utils.h"
+
+#define CACHE_PAGE_SIZE 4096
+#define CACHE_BUCKETS   1024
+/* minimum and maximum number of missing pages fetched with one host read */
+#define CACHE_FETCH_MIN_PAGES 4
+#define CACHE_FETCH_MAX_PAGES 16
+
+DEFINE_LIST(cache_page);
+struct cache_page {
+    LIST_TYPE(cache_page) lru;      /* in `g_lru`, most recently used first */
+    struct cache_page* hash_next;   /* in `g_buckets` */
+    struct shim_file_data* data;
+    uint64_t index;
+    size_t len;                     /* less than CACHE_PAGE_SIZE only for the last page of a file */
+    char buf[CACHE_PAGE_SIZE];
+};
+DEFINE_LISTP(cache_page);
+
+/* protects all of the below and the `cache_*` fields of `struct shim_file_data` */
+static struct shim_lock g_page_cache_lock;
+static struct cache_page* g_buckets[CACHE_BUCKETS];
+static LISTP_TYPE(cache_page) g_lru = LISTP_INIT;
+static size_t g_pages_count = 0;
+static size_t g_max_pages = 0;
+
+static uint64_t g_hits = 0;
+static uint64_t g_misses = 0;
+static uint64_t g_evictions = 0;
+
+int init_chroot_page_cache(void) {
+    assert(g_manifest_root);
+
+    uint64_t size;
+    int ret = toml_sizestring_in(g_manifest_root, "fs.page_cache_size", /*defaultval=*/0, &size);
+    if (ret < 0) {
+        log_error("Cannot parse 'fs.page_cache_size' (the value must be put in double quotes)\n");
+        return -EINVAL;
+    }
+
+    g_max_pages = size / CACHE_PAGE_SIZE;
+    if (g_max_pages && !create_lock(&g_page_cache_lock))
+        return -ENOMEM;
+
+    return 0;
+}
+
+bool chroot_page_cache_enabled(struct shim_handle* hdl) {
+    assert(hdl->type == TYPE_FILE);
+    struct shim_file_data* data = FILE_HANDLE_DATA(hdl);
+
+    return g_max_pages && data && hdl->info.file.type == FILE_REGULAR && hdl->dentry
+           && hdl->dentry->mount && hdl->dentry->mount->immutable
+           && !__atomic_load_n(&data->cache_disabled, __ATOMIC_RELAXED)
+           && __atomic_load_n(&data->version.counter, __ATOMIC_SEQ_CST) == hdl->info.file.version;
+}
+
+static struct cache_page** bucket(struct shim_file_data* data, uint64_t index) {
+    uint64_t h = (uintptr_t)data / sizeof(*data) * 31 + index;
+    h ^= h >> 17;
+    return &g_buckets[h % CACHE_BUCKETS];
+}
+
+static struct cache_page* lookup_page(struct shim_file_data* data, uint64_t index) {
+    assert(locked(&g_page_cache_lock));
+    for (struct cache_page* page = *bucket(data, index); page; page = page->hash_next)
+        if (page->data == data && page->index == index)
+            return page;
+    return NULL;
+}
+
+static void unhash_page(struct cache_page* page) {
+    assert(locked(&g_page_cache_lock));
+    struct cache_page** p = bucket(page->data, page->index);
+    while (*p != page)
+        p = &(*p)->hash_next;
+    *p = page->hash_next;
+}
+
+static void remove_page(struct cache_page* page) {
+    assert(locked(&g_page_cache_lock));
+    unhash_page(page);
+    LISTP_DEL(page, &g_lru, lru);
+    page->data->cache_pages--;
+    g_pages_count--;
+    free(page);
+}
+
+static void insert_page(struct shim_file_data* data, uint64_t index, const char* buf, size_t len) {
+    assert(locked(&g_page_cache_lock));
+    if (lookup_page(data, index))
+        return;
+
+    struct cache_page* page;
+    if (g_pages_count >= g_max_pages) {
+        /* reuse the least recently used page */
+        page = LISTP_LAST_ENTRY(&g_lru, struct cache_page, lru);
+        unhash_page(page);
+        LISTP_DEL(page, &g_lru, lru);
+        page->data->cache_pages--;
+        g_evictions++;
+    } else {
+        page = malloc(sizeof(*page));
+        if (!page)
+            return;
+        g_pages_count++;
+    }
+
+    page->data  = data;
+    page->index = index;
+    page->len   = len;
+    memcpy(page->buf, buf, len);
+    struct cache_page** b = bucket(data, index);
+    page->hash_next = *b;
+    *b = page;
+    LISTP_ADD(page, &g_lru, lru);
+    data->cache_pages++;
+}
+
+/* Drops the pages of `data` covering [`start`, `end`); `end` of -1 means up to the end of file. */
+static void invalidate_locked(struct shim_file_data* data, off_t start, off_t end) {
+    assert(locked(&g_page_cache_lock));
+    data->cache_gen++;
+    if (!data->cache_pages)
+        return;
+
+    uint64_t first = start / CACHE_PAGE_SIZE;
+    uint64_t last  = end < 0 ? UINT64_MAX
+                             : ((uint64_t)end + CACHE_PAGE_SIZE - 1) / CACHE_PAGE_SIZE;
+    if (last - first > data->cache_pages) {
+        /* cheaper to go through all cached pages */
+        struct cache_page* page;
+        struct cache_page* tmp;
+        LISTP_FOR_EACH_ENTRY_SAFE(page, tmp, &g_lru, lru) {
+            if (page->data == data && page->index >= first && page->index < last)
+                remove_page(page);
+        }
+        return;
+    }
+
+    for (uint64_t index = first; index < last && data->cache_pages; index++) {
+        struct cache_page* page = lookup_page(data, index);
+        if (page)
+            remove_page(page);
+    }
+}
+
+void chroot_page_cache_invalidate(struct shim_file_data* data, off_t start, off_t end) {
+    if (!g_max_pages)
+        return;
+
+    lock(&g_page_cache_lock);
+    invalidate_locked(data, start, end);
+    unlock(&g_page_cache_lock);
+}
+
+void chroot_page_cache_written(struct shim_file_data* data, off_t pos, size_t count) {
+    /* a write past the end of file (as last seen by the cache) also changes the last page */
+    off_t size = __atomic_load_n(&data->size.counter, __ATOMIC_SEQ_CST);
+    chroot_page_cache_invalidate(data, MIN(pos, size), pos + count);
+}
+
+void chroot_page_cache_disable(struct shim_file_data* data) {
+    if (!g_max_pages)
+        return;
+
+    lock(&g_page_cache_lock);
+    __atomic_store_n(&data->cache_disabled, true, __ATOMIC_RELAXED);
+    invalidate_locked(data, 0, -1);
+    unlock(&g_page_cache_lock);
+}
+
+bool chroot_page_cache_cached(struct shim_handle* hdl, off_t pos, size_t count) {
+    assert(chroot_page_cache_enabled(hdl));
+    struct shim_file_data* data = FILE_HANDLE_DATA(hdl);
+
+    /* the range past the end of file is not backed by pages */
+    off_t size = __atomic_load_n(&data->size.counter, __ATOMIC_SEQ_CST);
+    if (pos >= size)
+        return false;
+    uint64_t first = pos / CACHE_PAGE_SIZE;
+    uint64_t last  = ((uint64_t)MIN(pos + (off_t)count, size) + CACHE_PAGE_SIZE - 1)
+                     / CACHE_PAGE_SIZE;
+
+    bool cached = true;
+    lock(&g_page_cache_lock);
+    if (last - first > data->cache_pages) {
+        cached = false;
+    } else {
+        for (uint64_t index = first; index < last; index++) {
+            if (!lookup_page(data, index)) {
+                cached = false;
+                break;
+            }
+        }
+    }
+    unlock(&g_page_cache_lock);
+    return cached;
+}
+
+int chroot_page_cache_read(struct shim_handle* hdl, char* buf, off_t pos, size_t* count) {
+    assert(chroot_page_cache_enabled(hdl));
+    struct shim_file_data* data = FILE_HANDLE_DATA(hdl);
+
+    size_t copied = 0;
+    int ret = 0;
+    char* fetch_buf = NULL;
+
+    while (copied < *count) {
+        uint64_t index = (pos + copied) / CACHE_PAGE_SIZE;
+        size_t page_off = (pos + copied) % CACHE_PAGE_SIZE;
+
+        lock(&g_page_cache_lock);
+        struct cache_page* page = lookup_page(data, index);
+        if (page) {
+            LISTP_DEL(page, &g_lru, lru);
+            LISTP_ADD(page, &g_lru, lru);
+            g_hits++;
+
+            size_t len = page->len > page_off ? MIN(page->len - page_off, *count - copied) : 0;
+            memcpy(buf + copied, page->buf + page_off, len);
+            copied += len;
+            bool eof = page->len < CACHE_PAGE_SIZE && page_off + len == page->len;
+            unlock(&g_page_cache_lock);
+            if (eof || !len)
+                break;
+            continue;
+        }
+
+        /* fetch the run of missing pages needed for this read (but at least a few, as reads are
+         * usually sequential, or as many as possible if the application said so with fadvise()),
+         * up to the next cached page */
+        size_t needed = (page_off + *count - copied + CACHE_PAGE_SIZE - 1) / CACHE_PAGE_SIZE;
+        size_t min_pages = CACHE_FETCH_MIN_PAGES;
+        if (hdl->info.file.advice == POSIX_FADV_SEQUENTIAL)
+            min_pages = CACHE_FETCH_MAX_PAGES;
+        else if (hdl->info.file.advice == POSIX_FADV_RANDOM)
+            min_pages = 1;
+        size_t npages = MIN(MAX(needed, min_pages), (size_t)CACHE_FETCH_MAX_PAGES);
+        for (size_t i = 1; i < npages; i++) {
+            if (lookup_page(data, index + i)) {
+                npages = i;
+                break;
+            }
+        }
+        uint64_t gen = data->cache_gen;
+        g_misses++;
+        unlock(&g_page_cache_lock);
+
+        if (!fetch_buf) {
+            fetch_buf = malloc(CACHE_FETCH_MAX_PAGES * CACHE_PAGE_SIZE);
+            if (!fetch_buf) {
+                ret = -PAL_ERROR_NOMEM;
+                break;
+            }
+        }
+
+        size_t fetched = npages * CACHE_PAGE_SIZE;
+        ret = DkStreamRead(hdl->pal_handle, index * CACHE_PAGE_SIZE, &fetched, fetch_buf, NULL, 0);
+        if (ret < 0)
+            break;
+
+        lock(&g_page_cache_lock);
+        if (gen == data->cache_gen) {
+            for (size_t i = 0; i * CACHE_PAGE_SIZE < fetched || (i == 0 && !fetched); i++) {
+                size_t len = MIN(fetched - i * CACHE_PAGE_SIZE, (size_t)CACHE_PAGE_SIZE);
+                insert_page(data, index + i, fetch_buf + i * CACHE_PAGE_SIZE, len);
+            }
+        }
+        unlock(&g_page_cache_lock);
+
+        size_t len = fetched > page_off ? MIN(fetched - page_off, *count - copied) : 0;
+        memcpy(buf + copied, fetch_buf + page_off, len);
+        copied += len;
+        if (fetched < npages * CACHE_PAGE_SIZE || !len)
+            break; /* end of file */
+    }
+
+    free(fetch_buf);
+    if (ret < 0 && !copied)
+        return ret;
+
+    *count = copied;
+    return 0;
+}
+
+void print_page_cache_stats(void) {
+    if (!g_max_pages)
+        return;
+
+    log_debug("page cache: %lu hits, %lu misses, %lu evictions, %lu pages cached\n",
+              __atomic_load_n(&g_hits, __ATOMIC_RELAXED),
+              __atomic_load_n(&g_misses, __ATOMIC_RELAXED),
+              __atomic_load_n(&g_evictions, __ATOMIC_RELAXED),
+              __atomic_load_n(&g_pages_count, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,394 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * Emulation of writable shared mappings of chroot files for PALs which cannot map a file shared
+ * (on Linux-SGX, a file mapping is a copy of the file in enclave memory, see `file_map`). Such a
+ * mapping is allocated and filled with the file contents by LibOS, and the pages the application
+ * changed are written back to the file on msync(), munmap() (also mremap() and mmap(MAP_FIXED)
+ * over it), fsync() of the handle, execve() and process exit.
+ *
+ * SGX PAL cannot write-protect enclave pages, so dirty pages are found by comparing a 64-bit hash
+ * of each page (`hash_page64`) with the hash of its contents last read from or written to the file.
+ * Contiguous dirty pages are written with one host write each; clean pages are never written, so
+ * a write() to the file through a handle is not overwritten by an msync() of an unchanged mapping.
+ * Writes through the mapping never extend the file, the last page is written up to its end.
+ *
+ * The mappings are tracked per handle (every VMA of the mapping holds a reference to it) in
+ * `struct shim_file_smaps`, protected by `hdl->lock`. Parts of a writable shared file VMA that are
+ * not tracked (e.g. moved there by mremap()) are written back completely and tracked from then on.
+ *
+ * Unlike host shared mappings, the emulated ones are not coherent with reads and writes of the
+ * file, or with other mappings of it, until they are written back; a child process gets a private
+ * copy of them.
+ */
+
+#include <asm/mman.h>
+
+#include "list.h"
+#include "pal.h"
+#include "pal_error.h"
+#include "shim_flags_conv.h"
+#include "shim_fs.h"
+#include "shim_handle.h"
+#include "shim_internal.h"
+#include "shim_lock.h"
+#include "shim_utils.h"
+#include "shim_vma.h"
+
+/* a page with this hash is always dirty (`page_hash` never returns it) */
+#define HASH_DIRTY 0
+
+DEFINE_LIST(shim_file_smap);
+struct shim_file_smap {
+    LIST_TYPE(shim_file_smap) list;
+    char* addr;
+    size_t size;
+    uint64_t offset;
+    uint64_t* hashes; /* of each page, as last synced with the file */
+};
+DEFINE_LISTP(shim_file_smap);
+
+struct shim_file_smaps {
+    LISTP_TYPE(shim_file_smap) list;
+};
+
+static uint64_t page_hash(const char* page) {
+    uint64_t hash = hash_page64(page, ALLOC_ALIGNMENT);
+    return hash == HASH_DIRTY ? 1 : hash;
+}
+
+/* Returns the mapping of page `addr`, if it's at file offset `(uintptr_t)addr + delta`. */
+static struct shim_file_smap* find_smap(struct shim_file_smaps* smaps, char* addr,
+                                        uint64_t delta) {
+    struct shim_file_smap* map;
+    LISTP_FOR_EACH_ENTRY(map, &smaps->list, list) {
+        if (map->addr <= addr && addr < map->addr + map->size
+                && map->offset - (uintptr_t)map->addr == delta)
+            return map;
+    }
+    return NULL;
+}
+
+/* Forgets [`addr`, `addr` + `size`) of the mappings (same as `forget_mappings` of tmpfs). */
+static void forget_range(struct shim_file_smaps* smaps, char* addr, size_t size) {
+    char* end = addr + size;
+
+    struct shim_file_smap* map;
+    struct shim_file_smap* tmp;
+    LISTP_FOR_EACH_ENTRY_SAFE(map, tmp, &smaps->list, list) {
+        char* map_end = map->addr + map->size;
+        if (map_end <= addr || end <= map->addr)
+            continue;
+
+        if (map->addr < addr && end < map_end) {
+            /* the range is in the middle, keep the part after it as another mapping */
+            struct shim_file_smap* tail = malloc(sizeof(*tail));
+            size_t tail_pages = (map_end - end) / ALLOC_ALIGNMENT;
+            uint64_t* tail_hashes = malloc(tail_pages * sizeof(*tail_hashes));
+            if (tail && tail_hashes) {
+                memcpy(tail_hashes, map->hashes + (end - map->addr) / ALLOC_ALIGNMENT,
+                       tail_pages * sizeof(*tail_hashes));
+                tail->addr   = end;
+                tail->size   = map_end - end;
+                tail->offset = map->offset + (end - map->addr);
+                tail->hashes = tail_hashes;
+                LISTP_ADD_AFTER(tail, map, &smaps->list, list);
+            } else {
+                /* the tail is untracked now, it will be written back completely */
+                free(tail);
+                free(tail_hashes);
+            }
+            map->size = addr - map->addr;
+        } else if (map->addr < addr) {
+            map->size = addr - map->addr;
+        } else if (end < map_end) {
+            size_t skipped = (end - map->addr) / ALLOC_ALIGNMENT;
+            memmove(map->hashes, map->hashes + skipped,
+                    (map->size / ALLOC_ALIGNMENT - skipped) * sizeof(*map->hashes));
+            map->offset += end - map->addr;
+            map->size    = map_end - end;
+            map->addr    = end;
+        } else {
+            LISTP_DEL(map, &smaps->list, list);
+            free(map->hashes);
+            free(map);
+        }
+    }
+}
+
+/* Starts tracking [`addr`, `addr` + `size`) at file offset `offset` (replacing whatever was tracked
+ * there), with all pages dirty. */
+static struct shim_file_smap* track_range(struct shim_file_smaps* smaps, char* addr, size_t size,
+                                          uint64_t offset) {
+    struct shim_file_smap* map = malloc(sizeof(*map));
+    uint64_t* hashes = malloc(size / ALLOC_ALIGNMENT * sizeof(*hashes));
+    if (!map || !hashes) {
+        free(map);
+        free(hashes);
+        return NULL;
+    }
+    for (size_t i = 0; i < size / ALLOC_ALIGNMENT; i++)
+        hashes[i] = HASH_DIRTY;
+
+    forget_range(smaps, addr, size);
+    map->addr   = addr;
+    map->size   = size;
+    map->offset = offset;
+    map->hashes = hashes;
+    LISTP_ADD_TAIL(map, &smaps->list, list);
+    return map;
+}
+
+/* Writes [`mem`, `mem` + `size`) to the file at `pos`, without extending the file. */
+static int write_run(struct shim_handle* hdl, const char* mem, size_t size, uint64_t pos,
+                     uint64_t* file_size) {
+    assert(locked(&hdl->lock));
+
+    if (*file_size == UINT64_MAX) {
+        PAL_STREAM_ATTR attr;
+        int ret = DkStreamAttributesQueryByHandle(hdl->pal_handle, &attr);
+        if (ret < 0)
+            return pal_to_unix_errno(ret);
+        *file_size = attr.pending_size;
+    }
+    if (pos >= *file_size)
+        return 0;
+    size = MIN(size, *file_size - pos);
+
+    hdl->info.file.ra_len = 0;
+    if (FILE_HANDLE_DATA(hdl))
+        chroot_page_cache_written(FILE_HANDLE_DATA(hdl), pos, size);
+
+    while (size > 0) {
+        size_t count = size;
+        int ret = DkStreamWrite(hdl->pal_handle, pos, &count, (void*)mem, NULL);
+        if (ret < 0)
+            return pal_to_unix_errno(ret);
+        if (count == 0)
+            return -EIO;
+        mem  += count;
+        pos  += count;
+        size -= count;
+    }
+    return 0;
+}
+
+/* Marks the tracked pages of [`addr`, `addr` + `size`) dirty again after a failed write. */
+static void mark_dirty(struct shim_file_smaps* smaps, char* addr, size_t size, uint64_t delta) {
+    for (char* page = addr; page < addr + size; page += ALLOC_ALIGNMENT) {
+        struct shim_file_smap* map = find_smap(smaps, page, delta);
+        if (map)
+            map->hashes[(page - map->addr) / ALLOC_ALIGNMENT] = HASH_DIRTY;
+    }
+}
+
+int chroot_shared_map(struct shim_handle* hdl, void** addr, size_t size, int prot,
+                      uint64_t offset) {
+    assert(hdl->type == TYPE_FILE);
+    assert(IS_ALLOC_ALIGNED(size));
+
+    int ret = DkVirtualMemoryAlloc(addr, size, /*alloc_type=*/0, PAL_PROT_READ | PAL_PROT_WRITE);
+    if (ret < 0)
+        return pal_to_unix_errno(ret);
+    char* mem = *addr;
+
+    lock(&hdl->lock);
+    struct shim_file_smaps* smaps = hdl->info.file.smaps;
+    if (!smaps) {
+        smaps = malloc(sizeof(*smaps));
+        if (!smaps) {
+            ret = -ENOMEM;
+            goto out;
+        }
+        INIT_LISTP(&smaps->list);
+        hdl->info.file.smaps = smaps;
+    }
+
+    struct shim_file_smap* map = track_range(smaps, mem, size, offset);
+    if (!map) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    /* the rest of the mapping past the end of file stays zeroed */
+    for (size_t done = 0; done < size;) {
+        size_t count = size - done;
+        ret = DkStreamRead(hdl->pal_handle, offset + done, &count, mem + done, NULL, 0);
+        if (ret < 0) {
+            forget_range(smaps, mem, size);
+            ret = pal_to_unix_errno(ret);
+            goto out;
+        }
+        if (count == 0)
+            break;
+        done += count;
+    }
+
+    for (size_t i = 0; i < size / ALLOC_ALIGNMENT; i++)
+        map->hashes[i] = page_hash(mem + i * ALLOC_ALIGNMENT);
+
+    ret = DkVirtualMemoryProtect(mem, size, LINUX_PROT_TO_PAL(prot, /*map_flags=*/0));
+    if (ret < 0) {
+        forget_range(smaps, mem, size);
+        ret = pal_to_unix_errno(ret);
+        goto out;
+    }
+    ret = 0;
+out:
+    unlock(&hdl->lock);
+    if (ret < 0 && DkVirtualMemoryFree(mem, size) < 0)
+        BUG();
+    return ret;
+}
+
+int chroot_shared_map_sync(struct shim_handle* hdl, void* addr, size_t size, uint64_t offset,
+                           bool writable, bool forget) {
+    assert(hdl->type == TYPE_FILE);
+    assert(locked(&hdl->lock));
+
+    struct shim_file_smaps* smaps = hdl->info.file.smaps;
+    if (!smaps)
+        return 0;
+
+    char* start = addr;
+    char* end = start + ALLOC_ALIGN_UP(size);
+    uint64_t delta = offset - (uintptr_t)start;
+
+    if (writable && !forget) {
+        /* track the parts that aren't tracked yet, dirty */
+        char* gap = NULL;
+        for (char* page = start; page <= end; page += ALLOC_ALIGNMENT) {
+            bool tracked = page < end && find_smap(smaps, page, delta);
+            if (!tracked && page < end) {
+                if (!gap)
+                    gap = page;
+            } else if (gap) {
+                if (!track_range(smaps, gap, page - gap, (uintptr_t)gap + delta))
+                    log_warning("chroot: cannot keep track of a shared mapping\n");
+                gap = NULL;
+            }
+        }
+    }
+
+    int ret = 0;
+    uint64_t file_size = UINT64_MAX;
+    struct shim_file_smap* map = NULL;
+    char* run = NULL;
+    for (char* page = start; page <= end; page += ALLOC_ALIGNMENT) {
+        bool dirty = false;
+        if (page < end) {
+            if (!map || page < map->addr || map->addr + map->size <= page)
+                map = find_smap(smaps, page, delta);
+            uint64_t hash = page_hash(page);
+            if (map) {
+                uint64_t* old_hash = &map->hashes[(page - map->addr) / ALLOC_ALIGNMENT];
+                dirty = *old_hash != hash;
+                /* a store after the hash keeps the page dirty */
+                *old_hash = hash;
+            } else {
+                dirty = writable;
+            }
+        }
+
+        if (dirty) {
+            if (!run)
+                run = page;
+            continue;
+        }
+        if (run) {
+            int write_ret = write_run(hdl, run, page - run, (uintptr_t)run + delta, &file_size);
+            if (write_ret < 0) {
+                mark_dirty(smaps, run, page - run, delta);
+                if (ret == 0)
+                    ret = write_ret;
+            }
+            run = NULL;
+        }
+    }
+
+    if (forget)
+        forget_range(smaps, start, end - start);
+    return ret;
+}
+
+int chroot_shared_map_sync_all(struct shim_handle* hdl) {
+    assert(hdl->type == TYPE_FILE);
+    assert(locked(&hdl->lock));
+
+    struct shim_file_smaps* smaps = hdl->info.file.smaps;
+    if (!smaps)
+        return 0;
+
+    int ret = 0;
+    struct shim_file_smap* map;
+    struct shim_file_smap* tmp;
+    LISTP_FOR_EACH_ENTRY_SAFE(map, tmp, &smaps->list, list) {
+        /* sync only what is still mapped from this handle (tracking the parts that are not is
+         * harmless, they are forgotten when unmapped) */
+        struct shim_vma_info* vmas;
+        size_t count;
+        if (dump_shared_file_vmas(map->addr, map->size, &vmas, &count) < 0)
+            continue;
+
+        for (size_t i = 0; i < count; i++) {
+            struct shim_vma_info* vma = &vmas[i];
+            if (vma->file != hdl || vma->file_offset - (uintptr_t)vma->addr
+                                    != map->offset - (uintptr_t)map->addr)
+                continue;
+
+            char* begin = MAX(map->addr, (char*)vma->addr);
+            char* end = MIN(map->addr + map->size, (char*)vma->addr + vma->length);
+            int sync_ret = chroot_shared_map_sync(hdl, begin, end - begin,
+                                                  map->offset + (begin - map->addr),
+                                                  vma->prot & PROT_WRITE, /*forget=*/false);
+            if (sync_ret < 0 && ret == 0)
+                ret = sync_ret;
+        }
+        free_vma_info_array(vmas, count);
+    }
+    return ret;
+}
+
+void chroot_sync_all_shared_maps(void) {
+    struct shim_vma_info* vmas;
+    size_t count;
+    void* start = g_pal_control->user_address.start;
+    size_t size = (char*)g_pal_control->user_address.end - (char*)start;
+    if (dump_shared_file_vmas(start, size, &vmas, &count) < 0) {
+        log_warning("chroot: cannot write back shared mappings\n");
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        struct shim_handle* hdl = vmas[i].file;
+        if (hdl->type != TYPE_FILE)
+            continue;
+
+        lock(&hdl->lock);
+        int ret = chroot_shared_map_sync(hdl, vmas[i].addr, vmas[i].length, vmas[i].file_offset,
+                                         vmas[i].prot & PROT_WRITE, /*forget=*/false);
+        unlock(&hdl->lock);
+        if (ret < 0)
+            log_warning("chroot: cannot write back a shared mapping: %d\n", ret);
+    }
+    free_vma_info_array(vmas, count);
+}
+
+void chroot_free_shared_maps(struct shim_handle* hdl) {
+    assert(hdl->type == TYPE_FILE);
+
+    struct shim_file_smaps* smaps = hdl->info.file.smaps;
+    if (!smaps)
+        return;
+
+    struct shim_file_smap* map;
+    struct shim_file_smap* tmp;
+    LISTP_FOR_EACH_ENTRY_SAFE(map, tmp, &smaps->list, list) {
+        LISTP_DEL(map, &smaps->list, list);
+        free(map->hashes);
+        free(map);
+    }
+    free(smaps);
+    hdl->info.file.smaps = NULL;
+}
@@ -0,0 +1,232 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * Write-behind buffering of small writes to regular chroot files (enabled per mount with
+ * `fs.mount.<id>.write_behind`). Logging-heavy applications append many short lines, and every
+ * write is a separate host syscall (an OCALL on SGX). With write-behind, writes smaller than the
+ * buffer size which continue the buffered range are copied into a per-handle LibOS buffer and
+ * reported as written. The buffer is written out with one write to the PAL when:
+ *   - the next write doesn't fit into it or doesn't continue it,
+ *   - `fs.write_behind_delay_ms` passed since the first buffered write (by the async worker),
+ *   - the application reads from, maps, truncates, fsyncs or closes the file through the handle,
+ *   - the handle is checkpointed (fork, execve) or the process exits.
+ * O_APPEND writes are buffered at the marker, i.e. at the end of the file as this handle sees it,
+ * exactly where the unbuffered write would go.
+ *
+ * All of this happens under `hdl->lock`, which serializes the file operations of the handle anyway.
+ * An error from a flush done by the timer (or a read) is returned by the next write, fsync or close
+ * of the handle.
+ *
+ * Per-handle counters are printed (at the debug log level) when the handle is freed, process-wide
+ * ones when the process exits.
+ *
+ * The buffer and its flush timer are the ones of TCP write coalescing, see fs/shim_fs_wbuf.c.
+ */
+
+#include "pal.h"
+#include "pal_error.h"
+#include "shim_fs.h"
+#include "shim_fs_wbuf.h"
+#include "shim_handle.h"
+#include "shim_internal.h"
+#include "shim_lock.h"
+#include "shim_utils.h"
+
+#define WRITE_BEHIND_DEFAULT_DELAY_MS 100
+
+struct shim_file_wbuf {
+    int error;                  /* error of the last flush not done on behalf of a write */
+    off_t off;                  /* file offset of `buf.data[0]` */
+    struct shim_wbuf buf;
+    char data[];
+};
+
+static struct shim_wbuf_queue g_queue;
+
+static void flush_queued(struct shim_wbuf* buf);
+
+int init_chroot_write_behind(void) {
+    assert(g_manifest_root);
+
+    int64_t delay_ms;
+    int ret = toml_int_in(g_manifest_root, "fs.write_behind_delay_ms",
+                          WRITE_BEHIND_DEFAULT_DELAY_MS, &delay_ms);
+    if (ret < 0 || delay_ms <= 0 || (uint64_t)delay_ms >= UINT64_MAX / 1000) {
+        log_error("Cannot parse 'fs.write_behind_delay_ms' (the value must be a positive "
+                  "number)\n");
+        return -EINVAL;
+    }
+    return wbuf_queue_init(&g_queue, "file write-behind", delay_ms * 1000, &flush_queued);
+}
+
+static struct shim_file_wbuf* get_write_buffer(struct shim_handle* hdl) {
+    assert(locked(&hdl->lock));
+    struct shim_file_handle* file = &hdl->info.file;
+
+    if (file->wbuf)
+        return file->wbuf;
+
+    struct shim_mount* mount = hdl->dentry ? hdl->dentry->mount : NULL;
+    if (!mount || !mount->write_behind_size || file->type != FILE_REGULAR)
+        return NULL;
+
+    struct shim_file_wbuf* wbuf = calloc(1, sizeof(*wbuf) + mount->write_behind_size);
+    if (!wbuf)
+        return NULL;
+
+    wbuf_init(&wbuf->buf, &g_queue, hdl, wbuf->data, mount->write_behind_size);
+    file->wbuf = wbuf;
+    return wbuf;
+}
+
+static int flush_locked(struct shim_file_wbuf* wbuf) {
+    struct shim_handle* hdl = wbuf->buf.hdl;
+    assert(locked(&hdl->lock));
+
+    size_t done = 0;
+    int ret = 0;
+    while (done < wbuf->buf.len) {
+        size_t size = wbuf->buf.len - done;
+        ret = DkStreamWrite(hdl->pal_handle, wbuf->off + done, &size, wbuf->buf.data + done, NULL);
+        if (ret < 0) {
+            ret = pal_to_unix_errno(ret);
+            if (ret == -EINTR)
+                continue;
+            break;
+        }
+        if (!size) {
+            ret = -EIO;
+            break;
+        }
+        done += size;
+    }
+
+    if (done && FILE_HANDLE_DATA(hdl))
+        chroot_page_cache_written(FILE_HANDLE_DATA(hdl), wbuf->off, done);
+    wbuf_flushed(&wbuf->buf, done);
+    /* on errors, the rest of the data is lost, like in a failed write-back of dirty pages */
+    wbuf->buf.len = 0;
+    return ret;
+}
+
+static void flush_queued(struct shim_wbuf* buf) {
+    struct shim_file_wbuf* wbuf = container_of(buf, struct shim_file_wbuf, buf);
+    struct shim_handle* hdl = buf->hdl;
+
+    lock(&hdl->lock);
+    buf->queued = false;
+    int ret = flush_locked(wbuf);
+    if (ret < 0)
+        wbuf->error = -ret;
+    unlock(&hdl->lock);
+}
+
+bool chroot_write_behind(struct shim_handle* hdl, const struct iovec* iov, size_t iov_len,
+                         size_t count, int* out_ret) {
+    assert(locked(&hdl->lock));
+    struct shim_file_handle* file = &hdl->info.file;
+
+    struct shim_file_wbuf* wbuf = get_write_buffer(hdl);
+    if (!wbuf)
+        return false;
+
+    int ret = 0;
+    if (wbuf->error) {
+        ret = -wbuf->error;
+        wbuf->error = 0;
+        goto out;
+    }
+
+    if (wbuf->buf.len && (file->marker != wbuf->off + (off_t)wbuf->buf.len
+                          || wbuf->buf.len + count > wbuf->buf.size)) {
+        ret = flush_locked(wbuf);
+        if (ret < 0)
+            goto out;
+    }
+
+    if (count >= wbuf->buf.size) {
+        /* too big to buffer, the (flushed) buffer doesn't have to be involved */
+        return false;
+    }
+
+    if (!wbuf->buf.len)
+        wbuf->off = file->marker;
+    if (wbuf_append(&wbuf->buf, iov, iov_len, count))
+        ret = flush_locked(wbuf);
+
+out:
+    *out_ret = ret;
+    return true;
+}
+
+int chroot_flush_writes(struct shim_handle* hdl) {
+    assert(locked(&hdl->lock));
+    if (hdl->type != TYPE_FILE)
+        return 0;
+
+    struct shim_file_wbuf* wbuf = hdl->info.file.wbuf;
+    if (!wbuf)
+        return 0;
+
+    int ret = wbuf->buf.len ? flush_locked(wbuf) : 0;
+    if (!ret && wbuf->error) {
+        ret = -wbuf->error;
+        wbuf->error = 0;
+    }
+    return ret;
+}
+
+void chroot_defer_flush_error(struct shim_handle* hdl, int error) {
+    assert(locked(&hdl->lock));
+    assert(error < 0);
+    if (hdl->info.file.wbuf)
+        hdl->info.file.wbuf->error = -error;
+}
+
+int chroot_free_write_buffer(struct shim_handle* hdl) {
+    assert(hdl->type == TYPE_FILE);
+    struct shim_file_wbuf* wbuf = hdl->info.file.wbuf;
+    if (!wbuf)
+        return 0;
+
+    /* the timer holds a reference to the handle, so the buffer can't be queued here */
+    assert(!wbuf->buf.queued);
+    lock(&hdl->lock);
+    int ret = chroot_flush_writes(hdl);
+    unlock(&hdl->lock);
+
+    log_debug("file %s: buffered %lu writes into %lu flushes (%lu bytes)\n",
+              qstrgetstr(&hdl->uri), wbuf->buf.writes, wbuf->buf.flushes, wbuf->buf.bytes);
+
+    hdl->info.file.wbuf = NULL;
+    free(wbuf);
+    return ret;
+}
+
+void chroot_flush_all_writes(void) {
+    /* the async worker is stopped at this point, so do the work of a (last) timer here */
+    wbuf_flush_all(&g_queue);
+
+    uint64_t writes = __atomic_load_n(&g_queue.writes, __ATOMIC_RELAXED);
+    if (!writes)
+        return;
+
+    uint64_t flushes = __atomic_load_n(&g_queue.flushes, __ATOMIC_RELAXED);
+    log_debug("file write-behind: %lu writes buffered into %lu flushes (%lu bytes), %lu host "
+              "writes saved\n", writes, flushes, __atomic_load_n(&g_queue.bytes, __ATOMIC_RELAXED),
+              writes > flushes ? writes - flushes : 0);
+}
+
+void chroot_checkout_write_buffer(struct shim_handle* new_hdl) {
+    struct shim_file_wbuf* wbuf = new_hdl->info.file.wbuf;
+    if (!wbuf)
+        return;
+
+    /* `new_hdl` is the checkpoint copy of `wbuf->buf.hdl`, whose lock is held; the child must see
+     * the buffered data, while the buffer stays with the parent */
+    int ret = flush_locked(wbuf);
+    if (ret < 0)
+        wbuf->error = -ret;
+    new_hdl->info.file.wbuf = NULL;
+}
@@ -6,16 +6,26 @@
  *
  * This file contains the implementation of local- and remote-attestation logic implemented via
  * `/dev/attestation/{user_report_data, target_info, my_target_info, report, quote}` pseudo-files.
+ * On request (`sgx.quote_cache_lifetime_ms`), quotes are cached and can be prefetched through
+ * `/dev/attestation/quote_prefetch`. A secret obtained through remote attestation can be kept in
+ * `/dev/attestation/provisioned_secret`, which child processes inherit.
  *
  * The attestation logic uses DkAttestationReport() and DkAttestationQuote() and is generic enough
  * to support attestation flows similar to Intel SGX. Currently only SGX attestation is used.
  *
  * This pseudo-FS interface is not thread-safe. It is the responsibility of the application to
  * correctly synchronize concurrent accesses to the pseudo-files. We expect attestation flows to
- * be generally single-threaded and therefore do not introduce synchronization here.
+ * be generally single-threaded and therefore do not introduce synchronization here. The quote
+ * cache is the exception: it is shared with the prefetch thread and protected by
+ * `g_quote_cache_lock`.
  */
 
+#include "pal.h"
+#include "shim_checkpoint.h"
 #include "shim_fs.h"
+#include "shim_internal.h"
+#include "shim_lock.h"
+#include "shim_tcb.h"
 #include "stat.h"
 
 /* user_report_data, target_info and quote are opaque blobs of predefined maximum sizes. Currently
@@ -36,6 +46,197 @@ static size_t g_report_size = 0;
 #define PF_KEY_HEX_SIZE (32 + 1)
 static char g_pf_key_hex[PF_KEY_HEX_SIZE] = {0};
 
+/* Secret provisioned to this process (e.g. by the Secret Provisioning library), kept inside the
+ * enclave and sent to child processes as part of their checkpoint (which is only ever transferred
+ * over the encrypted and attested connection between enclaves), so that children don't have to
+ * attest and provision again. It is not saved in snapshots. */
+#define PROVISIONED_SECRET_MAX_SIZE 4096
+static char g_provisioned_secret[PROVISIONED_SECRET_MAX_SIZE];
+static size_t g_provisioned_secret_size = 0;
+
+/*
+ * Generating a quote goes to the Quoting Enclave on the host and takes tens to hundreds of
+ * milliseconds, which stalls e.g. servers that create an RA-TLS certificate per connection. With
+ * `sgx.quote_cache_lifetime_ms` set, quotes are kept for that long and reused for reads of
+ * `/dev/attestation/quote` with the same user report data. The quote depends only on the report
+ * data (the target info of a quote is always the Quoting Enclave), so this is the cache key.
+ * Reusing a quote doesn't weaken anything by itself: a quote can be replayed by whoever got it
+ * anyway, freshness has to be established through the report data (e.g. a nonce or a hash of a
+ * fresh public key), which is exactly what makes the next quote a cache miss.
+ *
+ * Writing the report data of the next quote to `/dev/attestation/quote_prefetch` generates that
+ * quote in the background, so that the next read of `/dev/attestation/quote` is a cache hit.
+ */
+#define QUOTE_CACHE_SIZE 8
+
+struct quote_cache_entry {
+    char user_report_data[USER_REPORT_DATA_MAX_SIZE];
+    char* quote; /* NULL if the entry is unused */
+    size_t quote_size;
+    uint64_t expire_time; /* in usecs */
+};
+
+static uint64_t g_quote_cache_lifetime_us = 0; /* 0 if quote caching is disabled */
+static struct shim_lock g_quote_cache_lock;
+static struct quote_cache_entry g_quote_cache[QUOTE_CACHE_SIZE];
+
+/* the prefetch thread runs while there are pending requests, protected by `g_quote_cache_lock` */
+static char g_prefetch_report_data[USER_REPORT_DATA_MAX_SIZE];
+static bool g_prefetch_pending = false;
+static bool g_prefetch_running = false;
+static PAL_HANDLE g_prefetch_thread = NULL;
+static int g_prefetch_thread_clear_on_exit = 0;
+
+int init_attestation_quote_cache(void) {
+    assert(g_manifest_root);
+
+    int64_t lifetime_ms;
+    int ret = toml_int_in(g_manifest_root, "sgx.quote_cache_lifetime_ms", /*defaultval=*/0,
+                          &lifetime_ms);
+    if (ret < 0 || lifetime_ms < 0 || (uint64_t)lifetime_ms >= UINT64_MAX / 1000) {
+        log_error("Cannot parse 'sgx.quote_cache_lifetime_ms' (the value must be a non-negative "
+                  "number)\n");
+        return -EINVAL;
+    }
+    g_quote_cache_lifetime_us = lifetime_ms * 1000;
+
+    if (!create_lock(&g_quote_cache_lock))
+        return -ENOMEM;
+    return 0;
+}
+
+/* Copies the cached quote for `user_report_data` to `quote`, returns false on a miss */
+static bool quote_cache_lookup(const char* user_report_data, uint8_t* quote, size_t* quote_size) {
+    uint64_t now;
+    if (DkSystemTimeQuery(&now) < 0)
+        return false;
+
+    bool found = false;
+    lock(&g_quote_cache_lock);
+    for (size_t i = 0; i < QUOTE_CACHE_SIZE; i++) {
+        struct quote_cache_entry* entry = &g_quote_cache[i];
+        if (entry->quote && now < entry->expire_time && entry->quote_size <= *quote_size
+                && !memcmp(entry->user_report_data, user_report_data, g_user_report_data_size)) {
+            memcpy(quote, entry->quote, entry->quote_size);
+            *quote_size = entry->quote_size;
+            found = true;
+            break;
+        }
+    }
+    unlock(&g_quote_cache_lock);
+    return found;
+}
+
+/* Caches a copy of `quote`, replacing the entry with the same report data, an expired one or the
+ * one which expires first. Failures to allocate the copy are ignored, it's just a cache. */
+static void quote_cache_insert(const char* user_report_data, const uint8_t* quote,
+                               size_t quote_size) {
+    uint64_t now;
+    if (DkSystemTimeQuery(&now) < 0)
+        return;
+
+    char* copy = malloc(quote_size);
+    if (!copy)
+        return;
+    memcpy(copy, quote, quote_size);
+
+    lock(&g_quote_cache_lock);
+    struct quote_cache_entry* victim = &g_quote_cache[0];
+    for (size_t i = 0; i < QUOTE_CACHE_SIZE; i++) {
+        struct quote_cache_entry* entry = &g_quote_cache[i];
+        if (entry->quote
+                && !memcmp(entry->user_report_data, user_report_data, g_user_report_data_size)) {
+            victim = entry;
+            break;
+        }
+        if (!entry->quote || entry->expire_time < victim->expire_time)
+            victim = entry;
+    }
+    char* old_quote = victim->quote;
+    memcpy(victim->user_report_data, user_report_data, g_user_report_data_size);
+    victim->quote       = copy;
+    victim->quote_size  = quote_size;
+    victim->expire_time = now + g_quote_cache_lifetime_us;
+    unlock(&g_quote_cache_lock);
+
+    free(old_quote);
+}
+
+/* Obtains the quote for `user_report_data` from the cache or the Quoting Enclave. `*quote_size` is
+ * the size of `quote` on input and the size of the quote on output. Returns a PAL error code. */
+static int get_quote(char* user_report_data, uint8_t* quote, size_t* quote_size) {
+    if (g_quote_cache_lifetime_us && quote_cache_lookup(user_report_data, quote, quote_size))
+        return 0;
+
+    int ret = DkAttestationQuote(user_report_data, g_user_report_data_size, quote, quote_size);
+    if (ret < 0)
+        return ret;
+
+    if (g_quote_cache_lifetime_us)
+        quote_cache_insert(user_report_data, quote, *quote_size);
+    return 0;
+}
+
+static void quote_prefetch_thread(void* arg) {
+    __UNUSED(arg);
+    /* no shim thread, this thread does nothing but generate quotes */
+    shim_tcb_init();
+
+    uint8_t* quote = malloc(QUOTE_MAX_SIZE);
+    char user_report_data[USER_REPORT_DATA_MAX_SIZE];
+
+    lock(&g_quote_cache_lock);
+    while (g_prefetch_pending) {
+        memcpy(user_report_data, g_prefetch_report_data, g_user_report_data_size);
+        g_prefetch_pending = false;
+        unlock(&g_quote_cache_lock);
+
+        size_t quote_size = QUOTE_MAX_SIZE;
+        if (quote && get_quote(user_report_data, quote, &quote_size) < 0)
+            log_warning("Prefetching a quote failed\n");
+
+        lock(&g_quote_cache_lock);
+    }
+    g_prefetch_running = false;
+    unlock(&g_quote_cache_lock);
+
+    free(quote);
+    DkThreadExit(&g_prefetch_thread_clear_on_exit);
+    /* UNREACHABLE */
+}
+
+/* callback for str FS; requests the background generation of a quote for the contents of
+ * `/dev/attestation/quote_prefetch` on file close */
+static int quote_prefetch_modify(struct shim_handle* hdl) {
+    assert(g_user_report_data_size);
+    assert(hdl->type == TYPE_STR);
+
+    int ret = 0;
+    lock(&g_quote_cache_lock);
+    memcpy(&g_prefetch_report_data, hdl->info.str.data->str, g_user_report_data_size);
+    g_prefetch_pending = true;
+    if (!g_prefetch_running) {
+        if (g_prefetch_thread) {
+            /* the previous prefetch thread is exiting (or has exited) */
+            while (__atomic_load_n(&g_prefetch_thread_clear_on_exit, __ATOMIC_ACQUIRE))
+                CPU_RELAX();
+            DkObjectClose(g_prefetch_thread);
+            g_prefetch_thread = NULL;
+        }
+        g_prefetch_thread_clear_on_exit = 1;
+        g_prefetch_running = true;
+        ret = DkThreadCreate(quote_prefetch_thread, NULL, &g_prefetch_thread);
+        if (ret < 0) {
+            g_prefetch_thread = NULL;
+            g_prefetch_running = false;
+            g_prefetch_pending = false;
+            ret = pal_to_unix_errno(ret);
+        }
+    }
+    unlock(&g_quote_cache_lock);
+    return ret;
+}
+
 static int init_attestation_struct_sizes(void) {
     if (g_user_report_data_size && g_target_info_size && g_report_size) {
         /* already initialized, nothing to do here */
@@ -82,6 +283,20 @@ static int dev_attestation_readwrite_stat(const char* name, struct stat* buf) {
     return 0;
 }
 
+static int dev_attestation_writeonly_mode(const char* name, mode_t* mode) {
+    __UNUSED(name);
+    *mode = FILE_W_MODE | S_IFREG;
+    return 0;
+}
+
+static int dev_attestation_writeonly_stat(const char* name, struct stat* buf) {
+    __UNUSED(name);
+    memset(buf, 0, sizeof(*buf));
+    buf->st_dev  = 1; /* dummy ID of device containing file */
+    buf->st_mode = FILE_W_MODE | S_IFREG;
+    return 0;
+}
+
 /* callback for str FS; copies contents of `/dev/attestation/user_report_data` file in the
  * global `g_user_report_data` struct on file close */
 static int user_report_data_modify(struct shim_handle* hdl) {
@@ -389,7 +604,7 @@ static int dev_attestation_quote_open(struct shim_handle* hdl, const char* name,
         goto out;
     }
 
-    ret = DkAttestationQuote(&g_user_report_data, g_user_report_data_size, quote, &quote_size);
+    ret = get_quote(g_user_report_data, quote, &quote_size);
     if (ret < 0) {
         ret = -EACCES;
         goto out;
@@ -428,6 +643,54 @@ out:
     return ret;
 }
 
+/*!
+ * \brief Request the generation of a quote in the background.
+ *
+ * The user report data written into `/dev/attestation/quote_prefetch` is used to generate a quote
+ * in the background once the file is closed, which is then put into the quote cache. A later read
+ * of `/dev/attestation/quote` with the same user report data is served from the cache, without
+ * waiting for the Quoting Enclave.
+ *
+ * This file can only be written to and only exists if quote caching is enabled with
+ * `sgx.quote_cache_lifetime_ms`. Writing it again before the previous quote is generated replaces
+ * the previous request (so only the most recent request is guaranteed to be served).
+ */
+static int dev_attestation_quote_prefetch_open(struct shim_handle* hdl, const char* name,
+                                                int flags) {
+    __UNUSED(name);
+
+    if (strcmp(g_pal_control->host_type, "Linux-SGX") || !g_quote_cache_lifetime_us) {
+        /* this pseudo-file is only available with Linux-SGX and quote caching */
+        return -EACCES;
+    }
+
+    if ((flags & O_ACCMODE) != O_WRONLY)
+        return -EACCES;
+
+    if (init_attestation_struct_sizes() < 0)
+        return -EACCES;
+
+    struct shim_str_data* data = calloc(1, sizeof(*data));
+    if (!data)
+        return -ENOMEM;
+
+    char* data_str_prefetch = calloc(1, g_user_report_data_size);
+    if (!data_str_prefetch) {
+        free(data);
+        return -ENOMEM;
+    }
+
+    data->str      = data_str_prefetch;
+    data->buf_size = g_user_report_data_size;
+    data->modify   = &quote_prefetch_modify; /* invoked when file is closed */
+
+    hdl->type          = TYPE_STR;
+    hdl->acc_mode      = MAY_WRITE;
+    hdl->info.str.data = data;
+    hdl->info.str.ptr  = data_str_prefetch;
+    return 0;
+}
+
 /* callback for str FS; copies contents of `/dev/attestation/protected_files_key` file in the
  * global `g_pf_key_hex` string on file close and applies new PF key */
 static int pfkey_modify(struct shim_handle* hdl) {
@@ -483,6 +746,91 @@ static int dev_attestation_pfkey_open(struct shim_handle* hdl, const char* name,
     return 0;
 }
 
+/* callback for str FS; copies contents of `/dev/attestation/provisioned_secret` file in the global
+ * `g_provisioned_secret` buffer on file close */
+static int provisioned_secret_modify(struct shim_handle* hdl) {
+    assert(hdl->type == TYPE_STR);
+    struct shim_str_data* data = hdl->info.str.data;
+    if ((size_t)data->len > sizeof(g_provisioned_secret))
+        return -EFBIG;
+
+    memset(g_provisioned_secret, 0, sizeof(g_provisioned_secret));
+    memcpy(g_provisioned_secret, data->str, data->len);
+    g_provisioned_secret_size = data->len;
+    return 0;
+}
+
+/*!
+ * \brief Keep a provisioned secret for this process and its children.
+ *
+ * Reading this file returns the secret last written to it in this process or in one of its
+ * ancestors (and nothing if there is none). Writing it replaces the secret when the file is closed;
+ * the secret can be at most 4KB. The secret is passed to children on fork and execve in their
+ * checkpoint, so e.g. the Secret Provisioning library doesn't repeat remote attestation in them.
+ */
+static int dev_attestation_provisioned_secret_open(struct shim_handle* hdl, const char* name,
+                                                    int flags) {
+    __UNUSED(name);
+
+    if (strcmp(g_pal_control->host_type, "Linux-SGX")) {
+        /* this pseudo-file is only available with Linux-SGX */
+        return -EACCES;
+    }
+
+    struct shim_str_data* data = calloc(1, sizeof(*data));
+    if (!data)
+        return -ENOMEM;
+
+    char* data_str_secret = calloc(1, sizeof(g_provisioned_secret));
+    if (!data_str_secret) {
+        free(data);
+        return -ENOMEM;
+    }
+
+    data->str      = data_str_secret;
+    data->buf_size = sizeof(g_provisioned_secret);
+    if (flags & (O_WRONLY | O_RDWR)) {
+        /* writes replace the whole secret */
+        data->modify = &provisioned_secret_modify; /* invoked when file is closed */
+        hdl->acc_mode = MAY_WRITE | MAY_READ;
+    } else {
+        memcpy(data_str_secret, g_provisioned_secret, g_provisioned_secret_size);
+        data->len     = g_provisioned_secret_size;
+        hdl->acc_mode = MAY_READ;
+    }
+
+    hdl->type          = TYPE_STR;
+    hdl->info.str.data = data;
+    hdl->info.str.ptr  = data_str_secret;
+    return 0;
+}
+
+BEGIN_CP_FUNC(provisioned_secret) {
+    __UNUSED(obj);
+    __UNUSED(size);
+    __UNUSED(objp);
+
+    size_t off = ADD_CP_OFFSET(sizeof(size_t) + g_provisioned_secret_size);
+    *(size_t*)((char*)base + off) = g_provisioned_secret_size;
+    memcpy((char*)base + off + sizeof(size_t), g_provisioned_secret, g_provisioned_secret_size);
+    ADD_CP_FUNC_ENTRY(off);
+}
+END_CP_FUNC(provisioned_secret)
+
+BEGIN_RS_FUNC(provisioned_secret) {
+    __UNUSED(offset);
+    __UNUSED(rebase);
+
+    const char* data = (char*)base + GET_CP_FUNC_ENTRY();
+    size_t secret_size = *(const size_t*)data;
+    if (secret_size > sizeof(g_provisioned_secret))
+        return -EINVAL;
+
+    memcpy(g_provisioned_secret, data + sizeof(size_t), secret_size);
+    g_provisioned_secret_size = secret_size;
+}
+END_RS_FUNC(provisioned_secret)
+
 static struct pseudo_fs_ops dev_attestation_user_report_data_fs_ops = {
     .open = &dev_attestation_user_report_data_open,
     .mode = &dev_attestation_readwrite_mode,
@@ -513,6 +861,18 @@ static struct pseudo_fs_ops dev_attestation_quote_fs_ops = {
     .stat = &dev_attestation_readonly_stat,
 };
 
+static struct pseudo_fs_ops dev_attestation_quote_prefetch_fs_ops = {
+    .open = &dev_attestation_quote_prefetch_open,
+    .mode = &dev_attestation_writeonly_mode,
+    .stat = &dev_attestation_writeonly_stat,
+};
+
+static struct pseudo_fs_ops dev_attestation_provisioned_secret_fs_ops = {
+    .open = &dev_attestation_provisioned_secret_open,
+    .mode = &dev_attestation_readwrite_mode,
+    .stat = &dev_attestation_readwrite_stat,
+};
+
 static struct pseudo_fs_ops dev_attestation_pfkey_fs_ops = {
     .open = &dev_attestation_pfkey_open,
     .mode = &dev_attestation_readwrite_mode,
@@ -526,7 +886,7 @@ struct pseudo_fs_ops dev_attestation_fs_ops = {
 };
 
 struct pseudo_dir dev_attestation_dir = {
-    .size = 6,
+    .size = 8,
     .ent  = {
         {.name   = "user_report_data",
          .fs_ops = &dev_attestation_user_report_data_fs_ops,
@@ -543,6 +903,12 @@ struct pseudo_dir dev_attestation_dir = {
         {.name = "quote",
          .fs_ops = &dev_attestation_quote_fs_ops,
          .type = LINUX_DT_REG},
+        {.name   = "quote_prefetch",
+         .fs_ops = &dev_attestation_quote_prefetch_fs_ops,
+         .type   = LINUX_DT_REG},
+        {.name   = "provisioned_secret",
+         .fs_ops = &dev_attestation_provisioned_secret_fs_ops,
+         .type   = LINUX_DT_REG},
         {.name   = "protected_files_key",
          .fs_ops = &dev_attestation_pfkey_fs_ops,
          .type   = LINUX_DT_REG},
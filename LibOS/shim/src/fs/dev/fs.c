@@ -17,12 +17,13 @@ extern const struct pseudo_fs_ops dev_urandom_fs_ops;
 extern const struct pseudo_fs_ops dev_stdin_fs_ops;
 extern const struct pseudo_fs_ops dev_stdout_fs_ops;
 extern const struct pseudo_fs_ops dev_stderr_fs_ops;
+extern const struct pseudo_fs_ops dev_snapshot_fs_ops;
 
 extern const struct pseudo_fs_ops dev_attestation_fs_ops;
 extern const struct pseudo_dir dev_attestation_dir;
 
 static const struct pseudo_dir dev_root_dir = {
-    .size = 9,
+    .size = 10,
     .ent = {
         {.name   = "null",
          .fs_ops = &dev_null_fs_ops,
@@ -48,6 +49,9 @@ static const struct pseudo_dir dev_root_dir = {
         {.name   = "stderr",
          .fs_ops = &dev_stderr_fs_ops,
          .type   = LINUX_DT_LNK},
+        {.name   = "snapshot",
+         .fs_ops = &dev_snapshot_fs_ops,
+         .type   = LINUX_DT_CHR},
         {.name   = "attestation",
          .fs_ops = &dev_attestation_fs_ops,
          .type   = LINUX_DT_DIR,
@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*!
+ * \file
+ *
+ * This file contains the implementation of `/dev/snapshot` pseudo-file. Any write to it creates a
+ * snapshot of the process (see `shim_snapshot.c`); the write returns the number of bytes written
+ * in the process which created the snapshot, and 0 in processes restored from it. Reading is not
+ * supported.
+ */
+
+#include "shim_checkpoint.h"
+#include "shim_fs.h"
+#include "stat.h"
+
+static ssize_t dev_snapshot_write(struct shim_handle* hdl, const void* buf, size_t count) {
+    __UNUSED(hdl);
+    __UNUSED(buf);
+
+    int ret = create_snapshot();
+    if (ret < 0)
+        return ret;
+    return count;
+}
+
+static int dev_snapshot_mode(const char* name, mode_t* mode) {
+    __UNUSED(name);
+    *mode = FILE_RW_MODE | S_IFCHR;
+    return 0;
+}
+
+static int dev_snapshot_stat(const char* name, struct stat* buf) {
+    __UNUSED(name);
+    memset(buf, 0, sizeof(*buf));
+
+    buf->st_mode = FILE_RW_MODE | S_IFCHR;
+    return 0;
+}
+
+static int dev_snapshot_hstat(struct shim_handle* hdl, struct stat* buf) {
+    __UNUSED(hdl);
+    return dev_snapshot_stat(/*name=*/NULL, buf);
+}
+
+static int dev_snapshot_open(struct shim_handle* hdl, const char* name, int flags) {
+    __UNUSED(name);
+    __UNUSED(flags);
+
+    struct shim_dev_ops ops = {.write = &dev_snapshot_write,
+                               .mode  = &dev_snapshot_mode,
+                               .stat  = &dev_snapshot_stat,
+                               .hstat = &dev_snapshot_hstat};
+
+    hdl->type = TYPE_DEV;
+    hdl->info.dev.dev_ops = ops;
+    return 0;
+}
+
+struct pseudo_fs_ops dev_snapshot_fs_ops = {
+    .open = &dev_snapshot_open,
+    .mode = &dev_snapshot_mode,
+    .stat = &dev_snapshot_stat,
+};
@@ -3,6 +3,11 @@
 
 /*
  * This file contains code for implementation of 'eventfd' filesystem.
+ *
+ * The counter is kept in LibOS memory (see `struct shim_eventfd_handle`): readers and writers block
+ * on the handle like on a futex, and the host is involved only for waking up sleeping threads and,
+ * after the eventfd was polled, for keeping its `readable`/`writable` events in sync. Only an
+ * eventfd inherited by a child process is moved to a host eventfd.
  */
 
 #include <asm/fcntl.h>
@@ -11,15 +16,81 @@
 #include <linux/fcntl.h>
 
 #include "pal.h"
+#include "pal_error.h"
 #include "shim_fs.h"
 #include "shim_handle.h"
 #include "shim_internal.h"
 #include "shim_lock.h"
+#include "shim_thread.h"
+#include "toml.h"
 
-static ssize_t eventfd_read(struct shim_handle* hdl, void* buf, size_t count) {
-    if (count < sizeof(uint64_t))
-        return -EINVAL;
+#define EVENTFD_MAX_VAL 0xfffffffffffffffeULL
+
+struct eventfd_waiter {
+    struct shim_thread* thread;
+    LIST_TYPE(eventfd_waiter) list;
+};
+
+/* Must be called with the handle lock held. */
+static void wake_eventfd_waiters(struct shim_eventfd_handle* efd) {
+    struct eventfd_waiter* waiter;
+    struct eventfd_waiter* tmp;
+    LISTP_FOR_EACH_ENTRY_SAFE(waiter, tmp, &efd->waiters, list) {
+        LISTP_DEL_INIT(waiter, &efd->waiters, list);
+        thread_wakeup(waiter->thread);
+    }
+}
+
+/* Sleep until the counter changes. Must be called with the handle lock held; the lock is released
+ * while sleeping. */
+static int wait_eventfd(struct shim_handle* hdl) {
+    struct shim_eventfd_handle* efd = &hdl->info.eventfd;
+    struct eventfd_waiter waiter = { .thread = get_cur_thread() };
+
+    thread_prepare_wait();
+    LISTP_ADD_TAIL(&waiter, &efd->waiters, list);
+    unlock(&hdl->lock);
+
+    int ret = thread_wait(/*timeout_us=*/NULL, /*ignore_pending_signals=*/false);
+
+    lock(&hdl->lock);
+    if (!LIST_EMPTY(&waiter, list)) {
+        /* woken up by a signal, not by a change of the counter */
+        LISTP_DEL_INIT(&waiter, &efd->waiters, list);
+    }
+    return ret;
+}
+
+/* Bring the poll events in line with the counter and wake up blocked readers and writers. Must be
+ * called with the handle lock held, after every change of the counter. */
+static void eventfd_changed(struct shim_eventfd_handle* efd) {
+    wake_eventfd_waiters(efd);
+
+    if (!efd->polled)
+        return;
+
+    bool readable = efd->val > 0;
+    bool writable = efd->val < EVENTFD_MAX_VAL;
+
+    if (readable != efd->readable_set) {
+        int ret = readable ? set_event(&efd->readable, 1) : clear_event(&efd->readable);
+        if (ret < 0) {
+            log_warning("cannot update readable event of an eventfd: %d\n", ret);
+        } else {
+            efd->readable_set = readable;
+        }
+    }
+    if (writable != efd->writable_set) {
+        int ret = writable ? set_event(&efd->writable, 1) : clear_event(&efd->writable);
+        if (ret < 0) {
+            log_warning("cannot update writable event of an eventfd: %d\n", ret);
+        } else {
+            efd->writable_set = writable;
+        }
+    }
+}
 
+static ssize_t host_eventfd_read(struct shim_handle* hdl, void* buf, size_t count) {
     size_t orig_count = count;
     int ret = DkStreamRead(hdl->pal_handle, 0, &count, buf, NULL, 0);
     ret = pal_to_unix_errno(ret);
@@ -31,10 +102,7 @@ static ssize_t eventfd_read(struct shim_handle* hdl, void* buf, size_t count) {
     return (ssize_t)count;
 }
 
-static ssize_t eventfd_write(struct shim_handle* hdl, const void* buf, size_t count) {
-    if (count < sizeof(uint64_t))
-        return -EINVAL;
-
+static ssize_t host_eventfd_write(struct shim_handle* hdl, const void* buf, size_t count) {
     size_t orig_count = count;
     int ret = DkStreamWrite(hdl->pal_handle, 0, &count, (void*)buf, NULL);
     ret = pal_to_unix_errno(ret);
@@ -46,11 +114,97 @@ static ssize_t eventfd_write(struct shim_handle* hdl, const void* buf, size_t co
     return (ssize_t)count;
 }
 
+static ssize_t eventfd_read(struct shim_handle* hdl, void* buf, size_t count) {
+    if (count < sizeof(uint64_t))
+        return -EINVAL;
+
+    struct shim_eventfd_handle* efd = &hdl->info.eventfd;
+    int ret = 0;
+
+    lock(&hdl->lock);
+    while (!efd->host && !efd->val) {
+        if (hdl->flags & O_NONBLOCK) {
+            ret = -EAGAIN;
+            break;
+        }
+        ret = wait_eventfd(hdl);
+        if (ret < 0)
+            break;
+    }
+
+    if (efd->host) {
+        unlock(&hdl->lock);
+        return host_eventfd_read(hdl, buf, count);
+    }
+
+    if (!ret) {
+        uint64_t val = efd->is_semaphore ? 1 : efd->val;
+        efd->val -= val;
+        memcpy(buf, &val, sizeof(val));
+        eventfd_changed(efd);
+    }
+    unlock(&hdl->lock);
+
+    maybe_epoll_et_trigger(hdl, ret, /*in=*/true, /*was_partial=*/false);
+    return ret < 0 ? ret : (ssize_t)sizeof(uint64_t);
+}
+
+static ssize_t eventfd_write(struct shim_handle* hdl, const void* buf, size_t count) {
+    if (count < sizeof(uint64_t))
+        return -EINVAL;
+
+    uint64_t val;
+    memcpy(&val, buf, sizeof(val));
+    if (val > EVENTFD_MAX_VAL)
+        return -EINVAL;
+
+    struct shim_eventfd_handle* efd = &hdl->info.eventfd;
+    int ret = 0;
+
+    lock(&hdl->lock);
+    while (!efd->host && EVENTFD_MAX_VAL - efd->val < val) {
+        if (hdl->flags & O_NONBLOCK) {
+            ret = -EAGAIN;
+            break;
+        }
+        ret = wait_eventfd(hdl);
+        if (ret < 0)
+            break;
+    }
+
+    if (efd->host) {
+        unlock(&hdl->lock);
+        return host_eventfd_write(hdl, buf, count);
+    }
+
+    if (!ret && val) {
+        efd->val += val;
+        eventfd_changed(efd);
+    }
+    unlock(&hdl->lock);
+
+    maybe_epoll_et_trigger(hdl, ret, /*in=*/false, /*was_partial=*/false);
+    return ret < 0 ? ret : (ssize_t)sizeof(uint64_t);
+}
+
 static off_t eventfd_poll(struct shim_handle* hdl, int poll_type) {
+    struct shim_eventfd_handle* efd = &hdl->info.eventfd;
     off_t ret = 0;
 
     lock(&hdl->lock);
 
+    if (!efd->host) {
+        if (poll_type == FS_POLL_SZ) {
+            ret = efd->val ? sizeof(uint64_t) : 0;
+            goto out;
+        }
+        if ((poll_type & FS_POLL_RD) && efd->val > 0)
+            ret |= FS_POLL_RD;
+        if ((poll_type & FS_POLL_WR) && efd->val < EVENTFD_MAX_VAL)
+            ret |= FS_POLL_WR;
+        goto out;
+    }
+
     if (!hdl->pal_handle) {
         ret = -EBADF;
         goto out;
@@ -81,7 +235,123 @@ out:
     return ret;
 }
 
+int eventfd_enable_poll(struct shim_handle* hdl) {
+    assert(hdl->type == TYPE_EVENTFD);
+    struct shim_eventfd_handle* efd = &hdl->info.eventfd;
+    int ret = 0;
+
+    lock(&hdl->lock);
+    if (efd->polled || efd->host)
+        goto out;
+
+    ret = create_event(&efd->readable);
+    if (ret < 0)
+        goto out;
+    ret = create_event(&efd->writable);
+    if (ret < 0) {
+        destroy_event(&efd->readable);
+        goto out;
+    }
+
+    efd->polled = true;
+    eventfd_changed(efd);
+
+    /* the events stay owned by the eventfd, see `eventfd_close` */
+    hdl->pal_handle    = event_handle(&efd->readable);
+    hdl->pal_wr_handle = event_handle(&efd->writable);
+
+out:
+    unlock(&hdl->lock);
+    return ret;
+}
+
+/*
+ * Move the counter of `hdl` to a host eventfd, because the eventfd is about to be inherited by a
+ * child process. Like the host eventfds used before, this requires `sys.insecure__allow_eventfd`;
+ * without it, the child gets a copy of the counter, which is enough for the common case of an
+ * eventfd that is only closed in the child.
+ */
+int migrate_eventfd(struct shim_handle* hdl) {
+    assert(hdl->type == TYPE_EVENTFD);
+    struct shim_eventfd_handle* efd = &hdl->info.eventfd;
+
+    assert(g_manifest_root);
+    bool allow_host_eventfd;
+    int ret = toml_bool_in(g_manifest_root, "sys.insecure__allow_eventfd", /*defaultval=*/false,
+                           &allow_host_eventfd);
+    if (ret < 0) {
+        log_error("Cannot parse \'sys.insecure__allow_eventfd\' (the value must be `true` or "
+                  "`false`)\n");
+        return -EINVAL;
+    }
+
+    lock(&hdl->lock);
+    if (efd->host)
+        goto out;
+
+    if (!allow_host_eventfd) {
+        log_warning("eventfd is not shared with the child process (sharing requires "
+                    "'sys.insecure__allow_eventfd'), the child gets a copy\n");
+        goto out;
+    }
+
+    int pal_flags = hdl->flags & O_NONBLOCK ? PAL_OPTION_NONBLOCK : 0;
+    pal_flags |= efd->is_semaphore ? PAL_OPTION_EFD_SEMAPHORE : 0;
+
+    PAL_HANDLE pal_hdl = NULL;
+    ret = DkStreamOpen(URI_PREFIX_EVENTFD, 0, 0, /*initval=*/0, pal_flags, &pal_hdl);
+    if (ret < 0) {
+        log_error("eventfd open failure\n");
+        ret = pal_to_unix_errno(ret);
+        goto out;
+    }
+
+    if (efd->val) {
+        /* `initval` of the PAL is only 32-bit wide */
+        size_t size = sizeof(efd->val);
+        ret = DkStreamWrite(pal_hdl, 0, &size, &efd->val, NULL);
+        if (ret < 0) {
+            DkObjectClose(pal_hdl);
+            ret = pal_to_unix_errno(ret);
+            goto out;
+        }
+    }
+
+    _disarm_epolls(hdl);
+    hdl->pal_handle    = pal_hdl;
+    hdl->pal_wr_handle = NULL;
+    efd->host = true;
+    efd->val  = 0;
+    /* blocked readers and writers retry on the host eventfd */
+    wake_eventfd_waiters(efd);
+    _update_epolls(hdl);
+    ret = 0;
+
+out:
+    unlock(&hdl->lock);
+    return ret;
+}
+
+static int eventfd_close(struct shim_handle* hdl) {
+    struct shim_eventfd_handle* efd = &hdl->info.eventfd;
+    assert(LISTP_EMPTY(&efd->waiters));
+
+    if (!efd->host) {
+        /* the PAL handle (if any) is the `readable` event */
+        hdl->pal_handle = NULL;
+    }
+    hdl->pal_wr_handle = NULL;
+
+    if (efd->polled) {
+        destroy_event(&efd->readable);
+        destroy_event(&efd->writable);
+        efd->polled = false;
+    }
+    return 0;
+}
+
 struct shim_fs_ops eventfd_fs_ops = {
+    .close = &eventfd_close,
     .read  = &eventfd_read,
     .write = &eventfd_write,
     .poll  = &eventfd_poll,
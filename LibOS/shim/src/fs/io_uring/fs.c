@@ -0,0 +1,770 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * This file contains code for implementation of 'io_uring' filesystem.
+ *
+ * The submission and completion rings of an io_uring live in the application's mappings of the
+ * io_uring FD (mmap with the IORING_OFF_* offsets), so filling them requires no syscall at all.
+ * `io_uring_enter` consumes the submitted SQEs and executes each one with the LibOS implementation
+ * of the corresponding syscall, so host I/O happens exactly as for the plain syscalls (including
+ * encryption of protected files etc.). A whole batch of requests costs a single syscall entry.
+ *
+ * Requests on objects which may block (sockets, pipes, eventfds, ...) are executed only once their
+ * FD is ready; until then they are kept in `pending` and completed by later calls of
+ * `io_uring_enter` (which wait for them with IORING_ENTER_GETEVENTS). Chains of requests
+ * (IOSQE_IO_LINK) and IOSQE_IO_DRAIN are ordered accordingly. Completions never overflow: requests
+ * are only executed if there is room for their CQE.
+ */
+
+#include <asm/fcntl.h>
+#include <asm/mman.h>
+#include <errno.h>
+
+#include "pal.h"
+#include "pal_error.h"
+#include "shim_flags_conv.h"
+#include "shim_fs.h"
+#include "shim_handle.h"
+#include "shim_internal.h"
+#include "shim_lock.h"
+#include "shim_table.h"
+#include "shim_utils.h"
+
+/* Layout of the rings in the application's mappings, reported in `struct io_uring_params` */
+struct io_uring_sq_ring {
+    uint32_t head;
+    uint32_t tail;
+    uint32_t ring_mask;
+    uint32_t ring_entries;
+    uint32_t flags;
+    uint32_t dropped;
+    uint32_t array[];
+};
+
+struct io_uring_cq_entry {
+    uint64_t user_data;
+    int32_t res;
+    uint32_t flags;
+};
+
+struct io_uring_cq_ring {
+    uint32_t head;
+    uint32_t tail;
+    uint32_t ring_mask;
+    uint32_t ring_entries;
+    uint32_t overflow;
+    uint32_t flags;
+    struct io_uring_cq_entry cqes[];
+};
+
+static_assert(sizeof(struct io_uring_cq_entry) == 16, "CQE must match the kernel ABI");
+static_assert(sizeof(struct io_uring_sqe) == 64, "SQE must match the kernel ABI");
+
+/* A request waiting for its FD or for the requests it is ordered after */
+struct io_uring_op {
+    struct io_uring_sqe sqe; /* copied on submission (IORING_FEAT_SUBMIT_STABLE) */
+    int fd;                  /* resolved from the fixed files, if needed */
+    short poll_events;
+    /* the previous request of the chain (IOSQE_IO_LINK), until it completes */
+    struct io_uring_op* link_prev;
+    LIST_TYPE(io_uring_op) list;
+};
+
+#define IO_URING_MAX_PASSES 8
+
+static const bool g_supported_ops[] = {
+    [IORING_OP_NOP]         = true,
+    [IORING_OP_READV]       = true,
+    [IORING_OP_WRITEV]      = true,
+    [IORING_OP_FSYNC]       = true,
+    [IORING_OP_READ_FIXED]  = true,
+    [IORING_OP_WRITE_FIXED] = true,
+    [IORING_OP_POLL_ADD]    = true,
+    [IORING_OP_SENDMSG]     = true,
+    [IORING_OP_RECVMSG]     = true,
+    [IORING_OP_ACCEPT]      = true,
+    [IORING_OP_CONNECT]     = true,
+    [IORING_OP_OPENAT]      = true,
+    [IORING_OP_CLOSE]       = true,
+    [IORING_OP_READ]        = true,
+    [IORING_OP_WRITE]       = true,
+    [IORING_OP_SEND]        = true,
+    [IORING_OP_RECV]        = true,
+};
+
+bool io_uring_op_supported(unsigned int opcode) {
+    return opcode < ARRAY_SIZE(g_supported_ops) && g_supported_ops[opcode];
+}
+
+static size_t sq_ring_size(struct shim_io_uring_handle* ring) {
+    return sizeof(struct io_uring_sq_ring) + ring->sq_entries * sizeof(uint32_t);
+}
+
+static size_t cq_ring_size(struct shim_io_uring_handle* ring) {
+    return sizeof(struct io_uring_cq_ring) + ring->cq_entries * sizeof(struct io_uring_cq_entry);
+}
+
+static size_t sqes_size(struct shim_io_uring_handle* ring) {
+    return ring->sq_entries * sizeof(struct io_uring_sqe);
+}
+
+void init_io_uring(struct shim_handle* hdl, uint32_t sq_entries, uint32_t cq_entries,
+                   struct io_uring_params* params) {
+    assert(hdl->type == TYPE_IO_URING);
+    struct shim_io_uring_handle* ring = &hdl->info.io_uring;
+
+    memset(ring, 0, sizeof(*ring));
+    ring->sq_entries = sq_entries;
+    ring->cq_entries = cq_entries;
+    INIT_LISTP(&ring->pending);
+
+    params->sq_entries = sq_entries;
+    params->cq_entries = cq_entries;
+    params->features   = IORING_FEAT_SUBMIT_STABLE | IORING_FEAT_RW_CUR_POS;
+
+    memset(&params->sq_off, 0, sizeof(params->sq_off));
+    params->sq_off.head         = offsetof(struct io_uring_sq_ring, head);
+    params->sq_off.tail         = offsetof(struct io_uring_sq_ring, tail);
+    params->sq_off.ring_mask    = offsetof(struct io_uring_sq_ring, ring_mask);
+    params->sq_off.ring_entries = offsetof(struct io_uring_sq_ring, ring_entries);
+    params->sq_off.flags        = offsetof(struct io_uring_sq_ring, flags);
+    params->sq_off.dropped      = offsetof(struct io_uring_sq_ring, dropped);
+    params->sq_off.array        = offsetof(struct io_uring_sq_ring, array);
+
+    memset(&params->cq_off, 0, sizeof(params->cq_off));
+    params->cq_off.head         = offsetof(struct io_uring_cq_ring, head);
+    params->cq_off.tail         = offsetof(struct io_uring_cq_ring, tail);
+    params->cq_off.ring_mask    = offsetof(struct io_uring_cq_ring, ring_mask);
+    params->cq_off.ring_entries = offsetof(struct io_uring_cq_ring, ring_entries);
+    params->cq_off.overflow     = offsetof(struct io_uring_cq_ring, overflow);
+    params->cq_off.flags        = offsetof(struct io_uring_cq_ring, flags);
+    params->cq_off.cqes         = offsetof(struct io_uring_cq_ring, cqes);
+}
+
+static int io_uring_mmap(struct shim_handle* hdl, void** addr, size_t size, int prot, int flags,
+                         uint64_t offset) {
+    assert(hdl->type == TYPE_IO_URING);
+    struct shim_io_uring_handle* ring = &hdl->info.io_uring;
+
+    if (!*addr) {
+        /* a LibOS-internal buffer without a VMA (see `handle_copy`) */
+        return -ENOSYS;
+    }
+    /* LibOS updates the rings on behalf of the kernel, so they must stay writable */
+    if (!(flags & MAP_SHARED) || (prot & (PROT_READ | PROT_WRITE)) != (PROT_READ | PROT_WRITE))
+        return -EINVAL;
+
+    int ret = DkVirtualMemoryAlloc(addr, size, /*alloc_type=*/0, PAL_PROT_READ | PAL_PROT_WRITE);
+    if (ret < 0)
+        return pal_to_unix_errno(ret);
+
+    lock(&hdl->lock);
+    void** slot = NULL;
+    size_t needed = 0;
+    switch (offset) {
+        case IORING_OFF_SQ_RING:
+            slot   = &ring->sq_ring;
+            needed = sq_ring_size(ring);
+            break;
+        case IORING_OFF_CQ_RING:
+            slot   = &ring->cq_ring;
+            needed = cq_ring_size(ring);
+            break;
+        case IORING_OFF_SQES:
+            slot   = &ring->sqes;
+            needed = sqes_size(ring);
+            break;
+        default:
+            ret = -EINVAL;
+            goto out;
+    }
+    if (size < needed || size > ALLOC_ALIGN_UP(needed)) {
+        ret = -EINVAL;
+        goto out;
+    }
+
+    ret = DkVirtualMemoryProtect(*addr, size, LINUX_PROT_TO_PAL(prot, /*map_flags=*/0));
+    if (ret < 0) {
+        ret = pal_to_unix_errno(ret);
+        goto out;
+    }
+
+    if (ring->inherited) {
+        /* only the memory is restored, the child can't use the rings of its parent */
+        goto out;
+    }
+
+    if (*slot) {
+        /* mapped again: the new mapping takes over the current state */
+        memcpy(*addr, *slot, needed);
+    } else if (offset == IORING_OFF_SQ_RING) {
+        struct io_uring_sq_ring* sq = *addr;
+        sq->ring_mask    = ring->sq_entries - 1;
+        sq->ring_entries = ring->sq_entries;
+    } else if (offset == IORING_OFF_CQ_RING) {
+        struct io_uring_cq_ring* cq = *addr;
+        cq->ring_mask    = ring->cq_entries - 1;
+        cq->ring_entries = ring->cq_entries;
+    }
+    *slot = *addr;
+out:
+    unlock(&hdl->lock);
+    if (ret < 0 && DkVirtualMemoryFree(*addr, size) < 0)
+        BUG();
+    return ret;
+}
+
+static int io_uring_munmap(struct shim_handle* hdl, void* addr, size_t size, int prot,
+                           uint64_t offset) {
+    __UNUSED(prot);
+    __UNUSED(offset);
+    assert(hdl->type == TYPE_IO_URING);
+    struct shim_io_uring_handle* ring = &hdl->info.io_uring;
+
+    lock(&hdl->lock);
+    if ((char*)addr <= (char*)ring->sq_ring && (char*)ring->sq_ring < (char*)addr + size)
+        ring->sq_ring = NULL;
+    if ((char*)addr <= (char*)ring->cq_ring && (char*)ring->cq_ring < (char*)addr + size)
+        ring->cq_ring = NULL;
+    if ((char*)addr <= (char*)ring->sqes && (char*)ring->sqes < (char*)addr + size)
+        ring->sqes = NULL;
+    unlock(&hdl->lock);
+    return 0;
+}
+
+static int io_uring_close(struct shim_handle* hdl) {
+    struct shim_io_uring_handle* ring = &hdl->info.io_uring;
+
+    struct io_uring_op* op;
+    struct io_uring_op* tmp;
+    LISTP_FOR_EACH_ENTRY_SAFE(op, tmp, &ring->pending, list) {
+        LISTP_DEL(op, &ring->pending, list);
+        free(op);
+    }
+    ring->pending_cnt = 0;
+    ring->pending_drain_cnt = 0;
+
+    free(ring->files);
+    ring->files = NULL;
+    free(ring->buffers);
+    ring->buffers = NULL;
+    if (ring->eventfd) {
+        put_handle(ring->eventfd);
+        ring->eventfd = NULL;
+    }
+    return 0;
+}
+
+static uint32_t cq_ready(struct io_uring_cq_ring* cq) {
+    return cq->tail - __atomic_load_n(&cq->head, __ATOMIC_ACQUIRE);
+}
+
+static bool cq_has_room(struct shim_io_uring_handle* ring) {
+    return cq_ready(ring->cq_ring) < ring->cq_entries;
+}
+
+/* Must be called with the handle lock held and room in the CQ ring. */
+static void post_cqe(struct shim_io_uring_handle* ring, uint64_t user_data, long res) {
+    struct io_uring_cq_ring* cq = ring->cq_ring;
+    assert(cq_has_room(ring));
+
+    /* errors of interrupted syscalls are not restarted, like by the kernel */
+    if (res == -ERESTARTSYS || res == -ERESTARTNOINTR || res == -ERESTARTNOHAND)
+        res = -EINTR;
+
+    struct io_uring_cq_entry* cqe = &cq->cqes[cq->tail & (ring->cq_entries - 1)];
+    cqe->user_data = user_data;
+    cqe->res       = (int32_t)res;
+    cqe->flags     = 0;
+    __atomic_store_n(&cq->tail, cq->tail + 1, __ATOMIC_RELEASE);
+}
+
+/* read/write (`write`) with a single buffer or an iovec array (`vectored`), at offset `off` or at
+ * the current position if `off` is -1 */
+static long io_uring_rw(int fd, void* addr, uint32_t len, uint64_t off, bool write,
+                        bool vectored) {
+    if (off == (uint64_t)-1) {
+        if (vectored)
+            return write ? shim_do_writev(fd, addr, len) : shim_do_readv(fd, addr, len);
+        return write ? shim_do_write(fd, addr, len) : shim_do_read(fd, addr, len);
+    }
+    if ((int64_t)off < 0)
+        return -EINVAL;
+
+    if (!vectored) {
+        return write ? shim_do_pwrite64(fd, addr, len, off) : shim_do_pread64(fd, addr, len, off);
+    }
+
+    /* there is no preadv/pwritev in LibOS, a request reads or writes until the first short
+     * transfer */
+    struct iovec* iov = addr;
+    if (!is_user_memory_readable(iov, len * sizeof(*iov)))
+        return -EFAULT;
+
+    long total = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        long ret = write ? shim_do_pwrite64(fd, iov[i].iov_base, iov[i].iov_len, off + total)
+                         : shim_do_pread64(fd, iov[i].iov_base, iov[i].iov_len, off + total);
+        if (ret < 0)
+            return total ?: ret;
+        total += ret;
+        if ((size_t)ret < iov[i].iov_len)
+            break;
+    }
+    return total;
+}
+
+/* Checks that a fixed-buffer request stays within its registered buffer. */
+static bool fixed_buffer_ok(struct shim_io_uring_handle* ring, const struct io_uring_sqe* sqe) {
+    if (sqe->buf_index >= ring->buffers_cnt)
+        return false;
+    struct iovec* buf = &ring->buffers[sqe->buf_index];
+    uintptr_t start = (uintptr_t)buf->iov_base;
+    return start <= sqe->addr && sqe->len <= buf->iov_len
+           && sqe->addr - start <= buf->iov_len - sqe->len;
+}
+
+/* Executes a request (whose FD is ready, if it may block) and returns its result. */
+static long execute_op(const struct io_uring_sqe* sqe, int fd, short revents) {
+    void* addr = (void*)(uintptr_t)sqe->addr;
+
+    switch (sqe->opcode) {
+        case IORING_OP_NOP:
+            return 0;
+        case IORING_OP_READV:
+        case IORING_OP_WRITEV:
+            return io_uring_rw(fd, addr, sqe->len, sqe->off, sqe->opcode == IORING_OP_WRITEV,
+                               /*vectored=*/true);
+        case IORING_OP_READ_FIXED:
+        case IORING_OP_WRITE_FIXED:
+        case IORING_OP_READ:
+        case IORING_OP_WRITE:
+            return io_uring_rw(fd, addr, sqe->len, sqe->off,
+                               sqe->opcode == IORING_OP_WRITE
+                                   || sqe->opcode == IORING_OP_WRITE_FIXED,
+                               /*vectored=*/false);
+        case IORING_OP_FSYNC:
+            if (sqe->fsync_flags & ~IORING_FSYNC_DATASYNC)
+                return -EINVAL;
+            return sqe->fsync_flags & IORING_FSYNC_DATASYNC ? shim_do_fdatasync(fd)
+                                                            : shim_do_fsync(fd);
+        case IORING_OP_POLL_ADD:
+            return revents;
+        case IORING_OP_SENDMSG:
+            return shim_do_sendmsg(fd, addr, sqe->msg_flags);
+        case IORING_OP_RECVMSG:
+            return shim_do_recvmsg(fd, addr, sqe->msg_flags);
+        case IORING_OP_SEND:
+            return shim_do_sendto(fd, addr, sqe->len, sqe->msg_flags, NULL, 0);
+        case IORING_OP_RECV:
+            return shim_do_recvfrom(fd, addr, sqe->len, sqe->msg_flags, NULL, NULL);
+        case IORING_OP_ACCEPT:
+            return shim_do_accept4(fd, addr, (int*)(uintptr_t)sqe->addr2, sqe->accept_flags);
+        case IORING_OP_CONNECT:
+            return shim_do_connect(fd, addr, (int)sqe->off);
+        case IORING_OP_OPENAT:
+            return shim_do_openat(fd, addr, sqe->open_flags, sqe->len);
+        case IORING_OP_CLOSE:
+            return shim_do_close(fd);
+        default:
+            return -EINVAL;
+    }
+}
+
+/* Poll events a request waits for before it is executed, 0 if it never blocks */
+static short op_poll_events(const struct io_uring_sqe* sqe) {
+    switch (sqe->opcode) {
+        case IORING_OP_READV:
+        case IORING_OP_READ_FIXED:
+        case IORING_OP_READ:
+        case IORING_OP_RECVMSG:
+        case IORING_OP_RECV:
+        case IORING_OP_ACCEPT:
+            return POLLIN;
+        case IORING_OP_WRITEV:
+        case IORING_OP_WRITE_FIXED:
+        case IORING_OP_WRITE:
+        case IORING_OP_SENDMSG:
+        case IORING_OP_SEND:
+            return POLLOUT;
+        case IORING_OP_POLL_ADD:
+            return sqe->poll_events;
+        default:
+            return 0;
+    }
+}
+
+/* Checks the FD of a request; returns whether the request must wait for `events` on it (and not
+ * just be executed), or a negative error. */
+static int op_may_block(struct shim_handle* ring_hdl, int fd, const struct io_uring_sqe* sqe,
+                        short events) {
+    if (sqe->opcode == IORING_OP_NOP || sqe->opcode == IORING_OP_OPENAT)
+        return 0;
+
+    struct shim_handle* hdl = get_fd_handle(fd, NULL, NULL);
+    if (!hdl)
+        return -EBADF;
+
+    int ret = 0;
+    if (hdl == ring_hdl) {
+        ret = -EINVAL;
+    } else if (events && (sqe->opcode == IORING_OP_POLL_ADD || !(hdl->flags & O_NONBLOCK))) {
+        /* files never block (their poll reports them ready anyway), requests on non-blocking
+         * FDs complete with -EAGAIN like in Linux */
+        switch (hdl->type) {
+            case TYPE_FILE:
+            case TYPE_DEV:
+            case TYPE_STR:
+            case TYPE_PSEUDO:
+            case TYPE_TMPFS:
+                ret = sqe->opcode == IORING_OP_POLL_ADD;
+                break;
+            default:
+                ret = 1;
+                break;
+        }
+    }
+    put_handle(hdl);
+    return ret;
+}
+
+/* Completes `op` (which must be pending) with `res`, and releases or cancels the next request of
+ * its chain. Must be called with the handle lock held and room in the CQ ring. */
+static void complete_pending_op(struct shim_io_uring_handle* ring, struct io_uring_op* op,
+                                long res) {
+    post_cqe(ring, op->sqe.user_data, res);
+
+    LISTP_DEL(op, &ring->pending, list);
+    ring->pending_cnt--;
+    if (op->sqe.flags & IOSQE_IO_DRAIN)
+        ring->pending_drain_cnt--;
+
+    if (op->sqe.flags & (IOSQE_IO_LINK | IOSQE_IO_HARDLINK)) {
+        bool failed = res < 0 && !(op->sqe.flags & IOSQE_IO_HARDLINK);
+        struct io_uring_op* next;
+        struct io_uring_op* tmp;
+        LISTP_FOR_EACH_ENTRY_SAFE(next, tmp, &ring->pending, list) {
+            if (next->link_prev != op)
+                continue;
+            next->link_prev = NULL;
+            if (failed) {
+                if (cq_has_room(ring)) {
+                    complete_pending_op(ring, next, -ECANCELED);
+                } else {
+                    /* cancelled once there is room, see `run_pending` */
+                    next->fd = -ECANCELED;
+                }
+            }
+            break;
+        }
+    }
+    free(op);
+}
+
+/* Runs the pending requests whose FDs are ready. Returns the number of completions, or a negative
+ * error. Must be called with the handle lock held. */
+static long run_pending(struct shim_io_uring_handle* ring) {
+    long completed = 0;
+
+    for (int pass = 0; pass < IO_URING_MAX_PASSES && ring->pending_cnt; pass++) {
+        struct pollfd* fds = malloc(ring->pending_cnt * sizeof(*fds));
+        struct io_uring_op** ops = malloc(ring->pending_cnt * sizeof(*ops));
+        if (!fds || !ops) {
+            free(fds);
+            free(ops);
+            return completed ?: -ENOMEM;
+        }
+
+        /* collect the requests which may run: not waiting for the previous request of their chain,
+         * nor for a request with IOSQE_IO_DRAIN (which itself waits for all earlier ones) */
+        nfds_t cnt = 0;
+        bool is_first = true;
+        struct io_uring_op* op;
+        LISTP_FOR_EACH_ENTRY(op, &ring->pending, list) {
+            bool drain = op->sqe.flags & IOSQE_IO_DRAIN;
+            if (drain && !is_first)
+                break;
+            is_first = false;
+            if (!op->link_prev) {
+                fds[cnt].fd      = op->fd;
+                fds[cnt].events  = op->poll_events;
+                fds[cnt].revents = 0;
+                ops[cnt++] = op;
+            }
+            if (drain)
+                break;
+        }
+
+        long ret = 0;
+        if (cnt)
+            ret = do_poll(fds, cnt, /*timeout_ms=*/0);
+
+        long done = 0;
+        for (nfds_t i = 0; i < cnt && ret >= 0; i++) {
+            if (!cq_has_room(ring))
+                break;
+            op = ops[i];
+            if (op->fd == -ECANCELED) {
+                complete_pending_op(ring, op, -ECANCELED);
+                done++;
+                continue;
+            }
+            if (!fds[i].revents)
+                continue;
+            long res = fds[i].revents & POLLNVAL ? -EBADF
+                                                 : execute_op(&op->sqe, op->fd, fds[i].revents);
+            complete_pending_op(ring, op, res);
+            done++;
+        }
+        free(fds);
+        free(ops);
+
+        if (ret < 0)
+            return completed ?: ret;
+        completed += done;
+        if (!done)
+            break;
+    }
+    return completed;
+}
+
+/* Blocks until one of the runnable pending requests may be executed. Must be called with the handle
+ * lock held, which is released while waiting. */
+static long wait_pending(struct shim_handle* hdl) {
+    struct shim_io_uring_handle* ring = &hdl->info.io_uring;
+
+    struct pollfd* fds = malloc(ring->pending_cnt * sizeof(*fds));
+    if (!fds)
+        return -ENOMEM;
+
+    nfds_t cnt = 0;
+    bool is_first = true;
+    struct io_uring_op* op;
+    LISTP_FOR_EACH_ENTRY(op, &ring->pending, list) {
+        bool drain = op->sqe.flags & IOSQE_IO_DRAIN;
+        if (drain && !is_first)
+            break;
+        is_first = false;
+        if (!op->link_prev) {
+            fds[cnt].fd      = op->fd;
+            fds[cnt].events  = op->poll_events;
+            fds[cnt].revents = 0;
+            cnt++;
+        }
+        if (drain)
+            break;
+    }
+
+    unlock(&hdl->lock);
+    long ret = do_poll(fds, cnt, /*timeout_ms=*/-1);
+    lock(&hdl->lock);
+    free(fds);
+
+    if (ret == -ERESTARTNOHAND)
+        ret = -EINTR;
+    return ret < 0 ? ret : 0;
+}
+
+static int add_pending_op(struct shim_io_uring_handle* ring, const struct io_uring_sqe* sqe,
+                          int fd, short events, struct io_uring_op* link_prev,
+                          struct io_uring_op** out_op) {
+    struct io_uring_op* op = malloc(sizeof(*op));
+    if (!op)
+        return -ENOMEM;
+
+    op->sqe         = *sqe;
+    op->fd          = fd;
+    op->poll_events = events;
+    op->link_prev   = link_prev;
+    INIT_LIST_HEAD(op, list);
+    LISTP_ADD_TAIL(op, &ring->pending, list);
+    ring->pending_cnt++;
+    if (sqe->flags & IOSQE_IO_DRAIN)
+        ring->pending_drain_cnt++;
+    *out_op = op;
+    return 0;
+}
+
+#define IO_URING_SUPPORTED_SQE_FLAGS \
+    (IOSQE_FIXED_FILE | IOSQE_IO_DRAIN | IOSQE_IO_LINK | IOSQE_IO_HARDLINK | IOSQE_ASYNC)
+
+/* Consumes up to `to_submit` SQEs. Must be called with the handle lock held. */
+static long submit_sqes(struct shim_handle* hdl, uint32_t to_submit) {
+    struct shim_io_uring_handle* ring = &hdl->info.io_uring;
+    struct io_uring_sq_ring* sq = ring->sq_ring;
+    struct io_uring_sqe* sqes = ring->sqes;
+
+    /* state of the current chain of linked requests */
+    bool in_chain = false;
+    bool chain_failed = false;
+    struct io_uring_op* chain_pending = NULL;
+
+    uint32_t head = sq->head;
+    uint32_t tail = __atomic_load_n(&sq->tail, __ATOMIC_ACQUIRE);
+    uint32_t submitted = 0;
+    long ret = 0;
+
+    while (submitted < to_submit && head != tail) {
+        if (!cq_has_room(ring)) {
+            ret = -EBUSY;
+            break;
+        }
+
+        uint32_t idx = __atomic_load_n(&sq->array[head & (ring->sq_entries - 1)],
+                                       __ATOMIC_RELAXED);
+        head++;
+        if (idx >= ring->sq_entries) {
+            sq->dropped++;
+            continue;
+        }
+        struct io_uring_sqe sqe;
+        memcpy(&sqe, &sqes[idx], sizeof(sqe));
+        submitted++;
+
+        bool linked = sqe.flags & (IOSQE_IO_LINK | IOSQE_IO_HARDLINK);
+        long res = 0;
+        struct io_uring_op* op = NULL;
+
+        int fd = sqe.fd;
+        if (in_chain && chain_failed) {
+            res = -ECANCELED;
+        } else if ((sqe.flags & ~IO_URING_SUPPORTED_SQE_FLAGS) || !io_uring_op_supported(sqe.opcode)
+                       || sqe.ioprio) {
+            res = -EINVAL;
+        } else if ((sqe.flags & IOSQE_FIXED_FILE)
+                       && ((uint32_t)sqe.fd >= ring->files_cnt || sqe.opcode == IORING_OP_CLOSE)) {
+            res = -EBADF;
+        } else if ((sqe.opcode == IORING_OP_READ_FIXED || sqe.opcode == IORING_OP_WRITE_FIXED)
+                       && !fixed_buffer_ok(ring, &sqe)) {
+            res = -EFAULT;
+        } else {
+            if (sqe.flags & IOSQE_FIXED_FILE)
+                fd = ring->files[sqe.fd];
+
+            short events = op_poll_events(&sqe);
+            int may_block = op_may_block(hdl, fd, &sqe, events);
+            if (may_block < 0) {
+                res = may_block;
+            } else {
+                bool wait_order = (in_chain && chain_pending) || ring->pending_drain_cnt
+                                  || ((sqe.flags & IOSQE_IO_DRAIN) && ring->pending_cnt);
+                short revents = 0;
+                if (!wait_order && may_block) {
+                    struct pollfd pfd = { .fd = fd, .events = events, .revents = 0 };
+                    long poll_ret = do_poll(&pfd, 1, /*timeout_ms=*/0);
+                    if (poll_ret < 0) {
+                        ret = poll_ret;
+                        head--;
+                        submitted--;
+                        break;
+                    }
+                    revents = pfd.revents;
+                }
+
+                if (wait_order || (may_block && !revents)) {
+                    res = add_pending_op(ring, &sqe, fd, may_block ? events : POLLIN | POLLOUT,
+                                         in_chain ? chain_pending : NULL, &op);
+                    if (res < 0)
+                        op = NULL;
+                } else {
+                    res = execute_op(&sqe, fd, revents);
+                }
+            }
+        }
+
+        if (op) {
+            if (linked)
+                chain_pending = op;
+        } else {
+            post_cqe(ring, sqe.user_data, res);
+            if (linked && res < 0 && !(sqe.flags & IOSQE_IO_HARDLINK))
+                chain_failed = true;
+        }
+
+        in_chain = linked;
+        if (!linked) {
+            chain_failed  = false;
+            chain_pending = NULL;
+        }
+    }
+
+    __atomic_store_n(&sq->head, head, __ATOMIC_RELEASE);
+    return submitted ?: ret;
+}
+
+static void notify_eventfd(struct shim_io_uring_handle* ring) {
+    uint64_t one = 1;
+    int ret = do_handle_write(ring->eventfd, &one, sizeof(one));
+    if (ret < 0)
+        log_warning("io_uring: cannot signal the registered eventfd: %d\n", ret);
+}
+
+long io_uring_submit_and_wait(struct shim_handle* hdl, uint32_t to_submit, uint32_t min_complete,
+                              bool getevents) {
+    assert(hdl->type == TYPE_IO_URING);
+    struct shim_io_uring_handle* ring = &hdl->info.io_uring;
+    long ret = 0;
+
+    lock(&hdl->lock);
+    if (ring->inherited) {
+        /* the parent's rings are not shared with this process */
+        ret = -EBADF;
+        goto out;
+    }
+    if (!ring->sq_ring || !ring->cq_ring || !ring->sqes) {
+        ret = -EFAULT;
+        goto out;
+    }
+
+    struct io_uring_cq_ring* cq = ring->cq_ring;
+    uint32_t cq_tail = cq->tail;
+
+    long submitted = 0;
+    if (to_submit) {
+        submitted = submit_sqes(hdl, to_submit);
+        if (submitted < 0) {
+            ret = submitted;
+            goto out_notify;
+        }
+    }
+
+    ret = run_pending(ring);
+    if (ret < 0)
+        goto out_notify;
+
+    if (getevents) {
+        /* nothing in flight can complete: return instead of blocking forever */
+        while (cq_ready(cq) < min_complete && ring->pending_cnt && cq_has_room(ring)) {
+            ret = wait_pending(hdl);
+            if (ret < 0)
+                break;
+            ret = run_pending(ring);
+            if (ret < 0)
+                break;
+        }
+        /* an interrupted wait is reported only if nothing was submitted */
+        if (ret < 0 && submitted)
+            ret = 0;
+    }
+    if (ret >= 0)
+        ret = submitted;
+
+out_notify:
+    if (ring->eventfd && cq->tail != cq_tail)
+        notify_eventfd(ring);
+out:
+    unlock(&hdl->lock);
+    return ret;
+}
+
+struct shim_fs_ops io_uring_fs_ops = {
+    .close  = &io_uring_close,
+    .mmap   = &io_uring_mmap,
+    .munmap = &io_uring_munmap,
+};
+
+struct shim_fs io_uring_builtin_fs = {
+    .name   = "io_uring",
+    .fs_ops = &io_uring_fs_ops,
+};
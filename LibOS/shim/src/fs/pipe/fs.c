@@ -23,14 +23,94 @@
 #include "shim_thread.h"
 #include "stat.h"
 
-static ssize_t pipe_read(struct shim_handle* hdl, void* buf, size_t count) {
+/*
+ * Move the pipe of `hdl` (both ends) from its in-LibOS ring to a freshly created host pipe, e.g.
+ * because it's about to be inherited by a child process. Unread data is written into the host pipe
+ * before anyone can use it. Threads blocked on the ring are woken up and retry on the host pipe.
+ */
+int migrate_pipe_ring(struct shim_handle* hdl) {
+    struct shim_pipe_ring* ring = get_pipe_ring(hdl, &hdl->info.pipe.ring);
+    if (!ring)
+        return 0;
+
+    int ret = 0;
+    struct shim_handle* host_rd = get_new_handle();
+    struct shim_handle* host_wr = get_new_handle();
+    if (!host_rd || !host_wr) {
+        ret = -ENOMEM;
+        goto out_put;
+    }
+
+    lock(&ring->lock);
+    if (ring->migrated)
+        goto out;
+
+    ret = create_pipes(host_rd, host_wr, /*flags=*/0, host_rd->info.pipe.name, &host_rd->uri);
+    if (ret < 0)
+        goto out;
+    qstrcopy(&host_wr->uri, &host_rd->uri);
+
+    ret = pipe_ring_migrate_locked(ring, host_wr->pal_handle);
+    if (ret < 0)
+        goto out;
+
+    /* a closed end is represented by the temporary handle, which closes its host end below */
+    const char* name = host_rd->info.pipe.name;
+    if (ring->reader) {
+        memcpy(ring->reader->info.pipe.name, name, sizeof(ring->reader->info.pipe.name));
+        move_handle_to_host(ring->reader, host_rd);
+    }
+    if (ring->writer) {
+        memcpy(ring->writer->info.pipe.name, name, sizeof(ring->writer->info.pipe.name));
+        move_handle_to_host(ring->writer, host_wr);
+    }
+
+    log_debug("in-LibOS pipe %p moved to host pipe %s\n", ring, host_rd->info.pipe.name);
+
+out:
+    unlock(&ring->lock);
+out_put:
+    if (host_rd)
+        put_handle(host_rd);
+    if (host_wr)
+        put_handle(host_wr);
+    put_pipe_ring(ring);
+    return ret;
+}
+
+static int pipe_close(struct shim_handle* hdl) {
+    struct shim_pipe_ring* ring = hdl->info.pipe.ring;
+    if (!ring)
+        return 0;
+
+    pipe_ring_close_end(ring, hdl);
+    hdl->info.pipe.ring = NULL;
+    put_pipe_ring(ring);
+    return 0;
+}
+
+static ssize_t pipe_readv(struct shim_handle* hdl, const struct iovec* iov, size_t iov_len,
+                          size_t count) {
     assert(hdl->type == TYPE_PIPE);
     if (!hdl->info.pipe.ready_for_ops)
         return -EACCES;
 
     size_t orig_count = count;
-    int ret = DkStreamRead(hdl->pal_handle, 0, &count, buf, NULL, 0);
-    ret = pal_to_unix_errno(ret);
+    int ret = 0;
+    bool migrated = false;
+    struct shim_pipe_ring* ring = get_pipe_ring(hdl, &hdl->info.pipe.ring);
+    if (ring) {
+        ssize_t done = pipe_ring_readv(ring, iov, iov_len, count, hdl->flags & O_NONBLOCK,
+                                       /*peek=*/false, &migrated);
+        put_pipe_ring(ring);
+        ret   = done < 0 ? (int)done : 0;
+        count = done < 0 ? 0 : (size_t)done;
+    }
+    if (!ring || migrated) {
+        count = orig_count;
+        ret = DkStreamReadv(hdl->pal_handle, 0, (const PAL_IOVEC*)iov, iov_len, &count);
+        ret = pal_to_unix_errno(ret);
+    }
     maybe_epoll_et_trigger(hdl, ret, /*in=*/true, ret == 0 ? count < orig_count : false);
     if (ret < 0) {
         return ret;
@@ -39,14 +119,33 @@ static ssize_t pipe_read(struct shim_handle* hdl, void* buf, size_t count) {
     return (ssize_t)count;
 }
 
-static ssize_t pipe_write(struct shim_handle* hdl, const void* buf, size_t count) {
+static ssize_t pipe_read(struct shim_handle* hdl, void* buf, size_t count) {
+    struct iovec iov = { .iov_base = buf, .iov_len = count };
+    return pipe_readv(hdl, &iov, 1, count);
+}
+
+static ssize_t pipe_writev(struct shim_handle* hdl, const struct iovec* iov, size_t iov_len,
+                           size_t count) {
     assert(hdl->type == TYPE_PIPE);
     if (!hdl->info.pipe.ready_for_ops)
         return -EACCES;
 
     size_t orig_count = count;
-    int ret = DkStreamWrite(hdl->pal_handle, 0, &count, (void*)buf, NULL);
-    ret = pal_to_unix_errno(ret);
+    int ret = 0;
+    bool migrated = false;
+    struct shim_pipe_ring* ring = get_pipe_ring(hdl, &hdl->info.pipe.ring);
+    if (ring) {
+        ssize_t done = pipe_ring_writev(ring, iov, iov_len, count, hdl->flags & O_NONBLOCK,
+                                        &migrated);
+        put_pipe_ring(ring);
+        ret   = done < 0 ? (int)done : 0;
+        count = done < 0 ? 0 : (size_t)done;
+    }
+    if (!ring || migrated) {
+        count = orig_count;
+        ret = DkStreamWritev(hdl->pal_handle, 0, (const PAL_IOVEC*)iov, iov_len, &count);
+        ret = pal_to_unix_errno(ret);
+    }
     maybe_epoll_et_trigger(hdl, ret, /*in=*/false, ret == 0 ? count < orig_count : false);
     if (ret < 0) {
         if (ret == -EPIPE) {
@@ -65,6 +164,11 @@ static ssize_t pipe_write(struct shim_handle* hdl, const void* buf, size_t count
     return (ssize_t)count;
 }
 
+static ssize_t pipe_write(struct shim_handle* hdl, const void* buf, size_t count) {
+    struct iovec iov = { .iov_base = (void*)buf, .iov_len = count };
+    return pipe_writev(hdl, &iov, 1, count);
+}
+
 static int pipe_hstat(struct shim_handle* hdl, struct stat* stat) {
     /* XXX: Is any of this right?
      * Shouldn't we be using hdl to figure something out?
@@ -100,6 +204,15 @@ static off_t pipe_poll(struct shim_handle* hdl, int poll_type) {
     if (!hdl->info.pipe.ready_for_ops)
         return -EACCES;
 
+    struct shim_pipe_ring* ring = get_pipe_ring(hdl, &hdl->info.pipe.ring);
+    if (ring) {
+        bool migrated = false;
+        ret = pipe_ring_poll(ring, poll_type, &migrated);
+        put_pipe_ring(ring);
+        if (!migrated)
+            return ret;
+    }
+
     lock(&hdl->lock);
 
     if (!hdl->pal_handle) {
@@ -133,6 +246,10 @@ out:
 }
 
 static int pipe_setflags(struct shim_handle* hdl, int flags) {
+    /* in-LibOS pipes look at `hdl->flags` directly */
+    if (pipe_ring_active(hdl->info.pipe.ring))
+        return 0;
+
     if (!hdl->pal_handle)
         return 0;
 
@@ -237,8 +354,11 @@ static int fifo_open(struct shim_handle* hdl, struct shim_dentry* dent, int flag
 }
 
 static struct shim_fs_ops pipe_fs_ops = {
+    .close    = &pipe_close,
     .read     = &pipe_read,
     .write    = &pipe_write,
+    .readv    = &pipe_readv,
+    .writev   = &pipe_writev,
     .hstat    = &pipe_hstat,
     .poll     = &pipe_poll,
     .setflags = &pipe_setflags,
@@ -247,6 +367,8 @@ static struct shim_fs_ops pipe_fs_ops = {
 static struct shim_fs_ops fifo_fs_ops = {
     .read     = &pipe_read,
     .write    = &pipe_write,
+    .readv    = &pipe_readv,
+    .writev   = &pipe_writev,
     .poll     = &pipe_poll,
     .setflags = &pipe_setflags,
 };
@@ -0,0 +1,516 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * In-LibOS buffers of pipes and UNIX socketpairs whose ends are all in this process (see
+ * `struct shim_pipe_ring`). Readers and writers block on a ring like on a futex: they put
+ * themselves on its `waiters` list and sleep on their thread event, and whoever changes the state
+ * of the ring wakes them all. The host is involved only for waking up sleeping threads and, after
+ * the ring was polled, for keeping its `readable`/`writable` events in sync.
+ *
+ * A pipe is one ring, a socketpair is two rings (one per direction). Every end keeps a reference
+ * to its ring(s); once a ring is migrated to the host, it is only kept until the ends are closed.
+ */
+
+#include <asm/fcntl.h>
+#include <errno.h>
+
+#include "pal.h"
+#include "pal_error.h"
+#include "shim_fs.h"
+#include "shim_handle.h"
+#include "shim_internal.h"
+#include "shim_lock.h"
+#include "shim_thread.h"
+
+#define PIPE_RING_SIZE        (64 * 1024) /* default capacity of a Linux pipe */
+#define PIPE_RING_ATOMIC_SIZE 4096        /* PIPE_BUF, writes up to this size are never split */
+
+/* datagram rings store every message as its length followed by the data */
+typedef uint32_t pipe_ring_msg_hdr_t;
+
+struct pipe_ring_waiter {
+    struct shim_thread* thread;
+    LIST_TYPE(pipe_ring_waiter) list;
+};
+
+int create_pipe_ring(struct shim_handle* reader, struct shim_handle* writer, bool dgram,
+                     struct shim_pipe_ring** out_ring) {
+    struct shim_pipe_ring* ring = calloc(1, sizeof(*ring));
+    if (!ring)
+        return -ENOMEM;
+
+    ring->buf = malloc(PIPE_RING_SIZE);
+    if (!ring->buf || !create_lock(&ring->lock)) {
+        free(ring->buf);
+        free(ring);
+        return -ENOMEM;
+    }
+
+    REF_SET(ring->ref_count, 2);
+    ring->dgram  = dgram;
+    ring->reader = reader;
+    ring->writer = writer;
+    INIT_LISTP(&ring->waiters);
+
+    *out_ring = ring;
+    return 0;
+}
+
+void put_pipe_ring(struct shim_pipe_ring* ring) {
+    if (REF_DEC(ring->ref_count))
+        return;
+
+    assert(LISTP_EMPTY(&ring->waiters));
+    destroy_event(&ring->readable);
+    destroy_event(&ring->writable);
+    destroy_lock(&ring->lock);
+    free(ring->buf);
+    free(ring);
+}
+
+bool pipe_ring_active(struct shim_pipe_ring* ring) {
+    return ring && !__atomic_load_n(&ring->migrated, __ATOMIC_ACQUIRE);
+}
+
+struct shim_pipe_ring* get_pipe_ring(struct shim_handle* hdl, struct shim_pipe_ring** ringp) {
+    lock(&hdl->lock);
+    struct shim_pipe_ring* ring = *ringp;
+    if (pipe_ring_active(ring)) {
+        REF_INC(ring->ref_count);
+    } else {
+        ring = NULL;
+    }
+    unlock(&hdl->lock);
+    return ring;
+}
+
+static size_t pipe_ring_free_space(struct shim_pipe_ring* ring) {
+    return PIPE_RING_SIZE - ring->used;
+}
+
+static bool pipe_ring_no_reader(struct shim_pipe_ring* ring) {
+    return !ring->reader || ring->shut_rd;
+}
+
+static bool pipe_ring_no_writer(struct shim_pipe_ring* ring) {
+    return !ring->writer || ring->shut_wr;
+}
+
+/* Must be called with the ring lock held. */
+static void wake_pipe_ring_waiters(struct shim_pipe_ring* ring) {
+    struct pipe_ring_waiter* waiter;
+    struct pipe_ring_waiter* tmp;
+    LISTP_FOR_EACH_ENTRY_SAFE(waiter, tmp, &ring->waiters, list) {
+        LISTP_DEL_INIT(waiter, &ring->waiters, list);
+        thread_wakeup(waiter->thread);
+    }
+}
+
+/* Sleep until the state of the ring changes. Must be called with the ring lock held; the lock is
+ * released while sleeping. */
+static int wait_pipe_ring(struct shim_pipe_ring* ring) {
+    struct pipe_ring_waiter waiter = { .thread = get_cur_thread() };
+
+    thread_prepare_wait();
+    LISTP_ADD_TAIL(&waiter, &ring->waiters, list);
+    unlock(&ring->lock);
+
+    int ret = thread_wait(/*timeout_us=*/NULL, /*ignore_pending_signals=*/false);
+
+    lock(&ring->lock);
+    if (!LIST_EMPTY(&waiter, list)) {
+        /* woken up by a signal, not by a change of the ring */
+        LISTP_DEL_INIT(&waiter, &ring->waiters, list);
+    }
+    return ret;
+}
+
+/* Bring the poll events in line with the ring and wake up blocked readers and writers. Must be
+ * called with the ring lock held, after every change of the ring. */
+static void pipe_ring_changed(struct shim_pipe_ring* ring) {
+    wake_pipe_ring_waiters(ring);
+
+    if (!ring->polled)
+        return;
+
+    bool readable = ring->used || pipe_ring_no_writer(ring) || ring->shut_rd;
+    bool writable = pipe_ring_free_space(ring) >= PIPE_RING_ATOMIC_SIZE
+                    || pipe_ring_no_reader(ring);
+
+    if (readable != ring->readable_set) {
+        int ret = readable ? set_event(&ring->readable, 1) : clear_event(&ring->readable);
+        if (ret < 0) {
+            log_warning("cannot update readable event of an in-LibOS pipe: %d\n", ret);
+        } else {
+            ring->readable_set = readable;
+        }
+    }
+    if (writable != ring->writable_set) {
+        int ret = writable ? set_event(&ring->writable, 1) : clear_event(&ring->writable);
+        if (ret < 0) {
+            log_warning("cannot update writable event of an in-LibOS pipe: %d\n", ret);
+        } else {
+            ring->writable_set = writable;
+        }
+    }
+}
+
+static void pipe_ring_copy_out(struct shim_pipe_ring* ring, size_t off, void* buf, size_t len) {
+    size_t pos = (ring->start + off) % PIPE_RING_SIZE;
+    size_t first = MIN(len, PIPE_RING_SIZE - pos);
+    memcpy(buf, ring->buf + pos, first);
+    memcpy((char*)buf + first, ring->buf, len - first);
+}
+
+static void pipe_ring_consume(struct shim_pipe_ring* ring, size_t len) {
+    ring->start = (ring->start + len) % PIPE_RING_SIZE;
+    ring->used -= len;
+}
+
+static void pipe_ring_copy_in(struct shim_pipe_ring* ring, const void* buf, size_t len) {
+    size_t end = (ring->start + ring->used) % PIPE_RING_SIZE;
+    size_t first = MIN(len, PIPE_RING_SIZE - end);
+    memcpy(ring->buf + end, buf, first);
+    memcpy(ring->buf, (const char*)buf + first, len - first);
+    ring->used += len;
+}
+
+/* Copy up to `count` bytes from offset `off` of the ring into `iov`. */
+static size_t pipe_ring_copy_out_iov(struct shim_pipe_ring* ring, size_t off,
+                                     const struct iovec* iov, size_t iov_len, size_t count) {
+    size_t done = 0;
+    for (size_t i = 0; i < iov_len && done < count; i++) {
+        size_t len = MIN(iov[i].iov_len, count - done);
+        pipe_ring_copy_out(ring, off + done, iov[i].iov_base, len);
+        done += len;
+    }
+    return done;
+}
+
+ssize_t pipe_ring_readv(struct shim_pipe_ring* ring, const struct iovec* iov, size_t iov_len,
+                        size_t count, bool nonblocking, bool peek, bool* migrated) {
+    /* a stream read of nothing returns right away, a datagram one still consumes a message */
+    if (!count && !ring->dgram)
+        return 0;
+
+    ssize_t ret = 0;
+    lock(&ring->lock);
+
+    while (!ring->used && !ring->migrated) {
+        if (pipe_ring_no_writer(ring) || ring->shut_rd) {
+            /* EOF */
+            goto out;
+        }
+        if (nonblocking) {
+            ret = -EAGAIN;
+            goto out;
+        }
+        ret = wait_pipe_ring(ring);
+        if (ret < 0)
+            goto out;
+    }
+
+    if (ring->migrated) {
+        *migrated = true;
+        ret = 0;
+        goto out;
+    }
+
+    if (ring->dgram) {
+        pipe_ring_msg_hdr_t msg_size;
+        pipe_ring_copy_out(ring, 0, &msg_size, sizeof(msg_size));
+        /* the rest of a message that doesn't fit into the buffer is discarded */
+        ret = pipe_ring_copy_out_iov(ring, sizeof(msg_size), iov, iov_len, MIN(count, msg_size));
+        if (!peek)
+            pipe_ring_consume(ring, sizeof(msg_size) + msg_size);
+    } else {
+        ret = pipe_ring_copy_out_iov(ring, 0, iov, iov_len, MIN(count, ring->used));
+        if (!peek)
+            pipe_ring_consume(ring, ret);
+    }
+    if (!peek)
+        pipe_ring_changed(ring);
+
+out:
+    unlock(&ring->lock);
+    return ret;
+}
+
+/* A datagram is written all at once or not at all. */
+static ssize_t pipe_ring_write_msg(struct shim_pipe_ring* ring, const struct iovec* iov,
+                                   size_t iov_len, size_t count, bool nonblocking,
+                                   bool* migrated) {
+    pipe_ring_msg_hdr_t msg_size = count;
+    if (sizeof(msg_size) + count > PIPE_RING_SIZE)
+        return -EMSGSIZE;
+
+    while (1) {
+        if (ring->migrated) {
+            *migrated = true;
+            return 0;
+        }
+        if (ring->shut_wr)
+            return -EPIPE;
+        if (pipe_ring_no_reader(ring))
+            return -ECONNREFUSED;
+        if (pipe_ring_free_space(ring) >= sizeof(msg_size) + count)
+            break;
+        if (nonblocking)
+            return -EAGAIN;
+        int ret = wait_pipe_ring(ring);
+        if (ret < 0)
+            return ret;
+    }
+
+    pipe_ring_copy_in(ring, &msg_size, sizeof(msg_size));
+    for (size_t i = 0; i < iov_len; i++)
+        pipe_ring_copy_in(ring, iov[i].iov_base, iov[i].iov_len);
+    pipe_ring_changed(ring);
+    return count;
+}
+
+ssize_t pipe_ring_writev(struct shim_pipe_ring* ring, const struct iovec* iov, size_t iov_len,
+                         size_t count, bool nonblocking, bool* migrated) {
+    ssize_t ret = 0;
+    size_t done = 0;
+
+    lock(&ring->lock);
+
+    if (ring->dgram) {
+        ret = pipe_ring_write_msg(ring, iov, iov_len, count, nonblocking, migrated);
+        goto out;
+    }
+
+    size_t i = 0;
+    size_t iov_done = 0;
+    while (done < count) {
+        if (ring->migrated) {
+            *migrated = !done;
+            break;
+        }
+        if (pipe_ring_no_reader(ring) || ring->shut_wr) {
+            ret = -EPIPE;
+            break;
+        }
+
+        size_t space = pipe_ring_free_space(ring);
+        if (space < (count <= PIPE_RING_ATOMIC_SIZE ? count : 1)) {
+            if (nonblocking) {
+                ret = -EAGAIN;
+                break;
+            }
+            ret = wait_pipe_ring(ring);
+            if (ret < 0)
+                break;
+            continue;
+        }
+
+        while (space && done < count) {
+            assert(i < iov_len);
+            size_t len = MIN(iov[i].iov_len - iov_done, space);
+            pipe_ring_copy_in(ring, (const char*)iov[i].iov_base + iov_done, len);
+            done += len;
+            space -= len;
+            iov_done += len;
+            if (iov_done == iov[i].iov_len) {
+                i++;
+                iov_done = 0;
+            }
+        }
+        pipe_ring_changed(ring);
+    }
+    if (done)
+        ret = done;
+
+out:
+    unlock(&ring->lock);
+    return ret;
+}
+
+off_t pipe_ring_poll(struct shim_pipe_ring* ring, int poll_type, bool* migrated) {
+    off_t ret = 0;
+    lock(&ring->lock);
+
+    if (ring->migrated) {
+        *migrated = true;
+        goto out;
+    }
+
+    if (poll_type == FS_POLL_SZ) {
+        if (ring->dgram && ring->used) {
+            /* size of the next datagram, like FIONREAD on Linux */
+            pipe_ring_msg_hdr_t msg_size;
+            pipe_ring_copy_out(ring, 0, &msg_size, sizeof(msg_size));
+            ret = msg_size;
+        } else {
+            ret = ring->used;
+        }
+        goto out;
+    }
+
+    if (pipe_ring_no_reader(ring) || pipe_ring_no_writer(ring))
+        ret |= FS_POLL_ER;
+    if ((poll_type & FS_POLL_RD) && (ring->used || pipe_ring_no_writer(ring) || ring->shut_rd))
+        ret |= FS_POLL_RD;
+    if ((poll_type & FS_POLL_WR) && pipe_ring_free_space(ring))
+        ret |= FS_POLL_WR;
+
+out:
+    unlock(&ring->lock);
+    return ret;
+}
+
+static int pipe_ring_enable_poll(struct shim_pipe_ring* ring) {
+    int ret = 0;
+    lock(&ring->lock);
+    if (ring->polled || ring->migrated)
+        goto out;
+
+    ret = create_event(&ring->readable);
+    if (ret < 0)
+        goto out;
+    ret = create_event(&ring->writable);
+    if (ret < 0) {
+        destroy_event(&ring->readable);
+        goto out;
+    }
+
+    ring->polled = true;
+    pipe_ring_changed(ring);
+
+    /* the events stay owned by the ring, see `pipe_ring_close_end` */
+    if (ring->reader) {
+        lock(&ring->reader->lock);
+        ring->reader->pal_handle = event_handle(&ring->readable);
+        unlock(&ring->reader->lock);
+    }
+    if (ring->writer) {
+        lock(&ring->writer->lock);
+        ring->writer->pal_wr_handle = event_handle(&ring->writable);
+        unlock(&ring->writer->lock);
+    }
+
+out:
+    unlock(&ring->lock);
+    return ret;
+}
+
+int prepare_handle_poll(struct shim_handle* hdl) {
+    if (hdl->type == TYPE_EVENTFD)
+        return eventfd_enable_poll(hdl);
+    if (hdl->type == TYPE_TIMERFD)
+        return timerfd_enable_poll(hdl);
+
+    struct shim_pipe_ring* rings[2] = { NULL, NULL };
+    if (hdl->type == TYPE_PIPE) {
+        rings[0] = get_pipe_ring(hdl, &hdl->info.pipe.ring);
+    } else if (hdl->type == TYPE_SOCK) {
+        rings[0] = get_pipe_ring(hdl, &hdl->info.sock.ring_in);
+        rings[1] = get_pipe_ring(hdl, &hdl->info.sock.ring_out);
+    }
+
+    int ret = 0;
+    for (size_t i = 0; i < ARRAY_SIZE(rings); i++) {
+        if (!rings[i])
+            continue;
+        if (!ret)
+            ret = pipe_ring_enable_poll(rings[i]);
+        put_pipe_ring(rings[i]);
+    }
+    return ret;
+}
+
+void pipe_ring_shutdown(struct shim_pipe_ring* ring, bool rd) {
+    lock(&ring->lock);
+    if (rd) {
+        ring->shut_rd = true;
+    } else {
+        ring->shut_wr = true;
+    }
+    if (!ring->migrated)
+        pipe_ring_changed(ring);
+    unlock(&ring->lock);
+}
+
+void pipe_ring_close_end(struct shim_pipe_ring* ring, struct shim_handle* hdl) {
+    lock(&ring->lock);
+    if (ring->reader == hdl) {
+        ring->reader = NULL;
+        /* the PAL handle (if any) is the `readable` event */
+        if (!ring->migrated)
+            hdl->pal_handle = NULL;
+    }
+    if (ring->writer == hdl) {
+        ring->writer = NULL;
+        hdl->pal_wr_handle = NULL;
+    }
+    if (!ring->migrated)
+        pipe_ring_changed(ring);
+    unlock(&ring->lock);
+}
+
+int pipe_ring_migrate_locked(struct shim_pipe_ring* ring, PAL_HANDLE host_wr) {
+    assert(locked(&ring->lock));
+    assert(!ring->migrated);
+
+    if (ring->dgram && ring->used)
+        log_warning("datagrams of a socketpair moved to the host lose their boundaries\n");
+
+    /* nobody can read the data anymore if the read end is closed; datagrams lose their
+     * boundaries, because host socketpairs are streams */
+    while (ring->used && !pipe_ring_no_reader(ring)) {
+        size_t skip = 0;
+        size_t size = ring->used;
+        if (ring->dgram) {
+            pipe_ring_msg_hdr_t msg_size;
+            pipe_ring_copy_out(ring, 0, &msg_size, sizeof(msg_size));
+            skip = sizeof(msg_size);
+            size = msg_size;
+        }
+        pipe_ring_consume(ring, skip);
+
+        while (size) {
+            size_t chunk = MIN(size, PIPE_RING_SIZE - ring->start);
+            int ret = DkStreamWrite(host_wr, 0, &chunk, ring->buf + ring->start, NULL);
+            if (ret < 0) {
+                if (ret == -PAL_ERROR_INTERRUPTED || ret == -PAL_ERROR_TRYAGAIN)
+                    continue;
+                return pal_to_unix_errno(ret);
+            }
+            pipe_ring_consume(ring, chunk);
+            size -= chunk;
+        }
+    }
+
+    __atomic_store_n(&ring->migrated, true, __ATOMIC_RELEASE);
+    free(ring->buf);
+    ring->buf  = NULL;
+    ring->used = 0;
+    wake_pipe_ring_waiters(ring);
+    return 0;
+}
+
+void move_handle_to_host(struct shim_handle* hdl, struct shim_handle* host_hdl) {
+    if (hdl->flags & O_NONBLOCK) {
+        /* host pipes are created in blocking mode */
+        PAL_STREAM_ATTR attr;
+        int ret = DkStreamAttributesQueryByHandle(host_hdl->pal_handle, &attr);
+        if (ret >= 0) {
+            attr.nonblocking = PAL_TRUE;
+            ret = DkStreamAttributesSetByHandle(host_hdl->pal_handle, &attr);
+        }
+        if (ret < 0)
+            log_warning("cannot make migrated pipe non-blocking: %d\n", ret);
+    }
+
+    lock(&hdl->lock);
+
+    _disarm_epolls(hdl);
+    hdl->pal_handle = host_hdl->pal_handle;
+    hdl->pal_wr_handle = NULL;
+    host_hdl->pal_handle = NULL;
+    qstrcopy(&hdl->uri, &host_hdl->uri);
+    _update_epolls(hdl);
+
+    unlock(&hdl->lock);
+}
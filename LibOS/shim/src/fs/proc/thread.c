@@ -16,8 +16,9 @@
 #include "shim_table.h"
 #include "shim_thread.h"
 #include "shim_utils.h"
-#include "stat.h"
 #include "shim_vma.h"
+#include "spinlock.h"
+#include "stat.h"
 
 static int parse_thread_name(const char* name, IDTYPE* pidptr, const char** next, size_t* next_len,
                              const char** nextnext) {
@@ -394,6 +395,182 @@ static const struct pseudo_dir dir_fd = {
         },
 };
 
+/*
+ * Formatted contents of "maps", reused by later opens as long as the vmas don't change (see
+ * `get_vma_generation`): runtimes like JVMs or Go read it repeatedly, and formatting thousands of
+ * vmas (with the paths of their files) takes milliseconds. When the vmas did change, the lines of
+ * the ones which stayed the same are copied from the old contents instead of formatted again.
+ */
+struct maps_line {
+    uintptr_t start;
+    uintptr_t end;
+    int prot;
+    bool shared;
+    bool is_file;
+    uint64_t file_offset;
+    struct shim_dentry* dent; /* referenced, so that the pointer is not reused for another file */
+    char comment[VMA_COMMENT_LEN];
+    /* the formatted line in `maps_cache.text` */
+    size_t text_offset;
+    size_t text_len;
+};
+
+struct maps_cache {
+    uint64_t generation;
+    char* text;
+    size_t text_len;
+    size_t text_size;
+    struct maps_line* lines;
+    size_t count;
+};
+
+/* Protects only the pointer: a user takes the cache out while working with it. */
+static spinlock_t g_maps_cache_lock = INIT_SPINLOCK_UNLOCKED;
+static struct maps_cache* g_maps_cache = NULL;
+
+static void free_maps_cache(struct maps_cache* cache) {
+    for (size_t i = 0; i < cache->count; i++) {
+        if (cache->lines[i].dent)
+            put_dentry(cache->lines[i].dent);
+    }
+    free(cache->lines);
+    free(cache->text);
+    free(cache);
+}
+
+static bool maps_line_equal(const struct maps_line* a, const struct maps_line* b) {
+    if (a->start != b->start || a->end != b->end || a->prot != b->prot || a->shared != b->shared
+            || a->is_file != b->is_file)
+        return false;
+    if (a->is_file)
+        return a->file_offset == b->file_offset && a->dent == b->dent;
+    return !strcmp(a->comment, b->comment);
+}
+
+static int maps_append(struct maps_cache* cache, const char* str, size_t len) {
+    if (cache->text_size - cache->text_len < len) {
+        size_t new_size = MAX(cache->text_size * 2, cache->text_len + len);
+        char* new_text = malloc(new_size);
+        if (!new_text)
+            return -ENOMEM;
+        memcpy(new_text, cache->text, cache->text_len);
+        free(cache->text);
+        cache->text      = new_text;
+        cache->text_size = new_size;
+    }
+    memcpy(cache->text + cache->text_len, str, len);
+    cache->text_len += len;
+    return 0;
+}
+
+static int maps_format_line(struct maps_cache* cache, const struct maps_line* line) {
+    char pt[4] = {
+        (line->prot & PROT_READ) ? 'r' : '-',
+        (line->prot & PROT_WRITE) ? 'w' : '-',
+        (line->prot & PROT_EXEC) ? 'x' : '-',
+        line->shared ? 's' : 'p',
+    };
+
+    /* longest: 2 * 16 digits of addresses, 16 of offset, 20 of inode, separators */
+    char head[128];
+    int len;
+    if (line->is_file) {
+        int dev_major = 0, dev_minor = 0;
+        unsigned long ino = line->dent ? dentry_ino(line->dent) : 0;
+        len = snprintf(head, sizeof(head), "%08lx-%08lx %.4s %08lx %02d:%02d %lu ", line->start,
+                       line->end, pt, line->file_offset, dev_major, dev_minor, ino);
+    } else {
+        len = snprintf(head, sizeof(head), "%08lx-%08lx %.4s 00000000 00:00 0%s", line->start,
+                       line->end, pt, line->comment[0] ? " " : "");
+    }
+    assert(len > 0 && (size_t)len < sizeof(head));
+
+    int ret = maps_append(cache, head, len);
+    if (ret < 0)
+        return ret;
+
+    if (line->is_file) {
+        char* path = NULL;
+        if (line->dent)
+            dentry_abs_path(line->dent, &path, /*size=*/NULL);
+        const char* name = path ?: "[unknown]";
+        ret = maps_append(cache, name, strlen(name));
+        free(path);
+    } else {
+        ret = maps_append(cache, line->comment, strlen(line->comment));
+    }
+    if (ret < 0)
+        return ret;
+
+    return maps_append(cache, "\n", 1);
+}
+
+/* Formats the current vmas, reusing the lines of `old` (can be NULL) which are still valid. */
+static int maps_build(uint64_t generation, struct maps_cache* old, struct maps_cache** out_cache) {
+    size_t count;
+    struct shim_vma_info* vmas = NULL;
+    int ret = dump_all_vmas(&vmas, &count, /*include_unmapped=*/false);
+    if (ret < 0)
+        return ret;
+
+    struct maps_cache* cache = calloc(1, sizeof(*cache));
+    if (!cache) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    cache->generation = generation;
+    if (count) {
+        cache->lines = malloc(count * sizeof(*cache->lines));
+        if (!cache->lines) {
+            ret = -ENOMEM;
+            goto out;
+        }
+    }
+
+    /* both `vmas` and the lines of `old` are sorted by address */
+    size_t old_idx = 0;
+    for (size_t i = 0; i < count; i++) {
+        struct shim_vma_info* vma = &vmas[i];
+        struct maps_line* line = &cache->lines[i];
+
+        line->start   = (uintptr_t)vma->addr;
+        line->end     = (uintptr_t)vma->addr + vma->length;
+        line->prot    = vma->prot;
+        line->shared  = !(vma->flags & MAP_PRIVATE);
+        line->is_file = !!vma->file;
+        line->file_offset = vma->file ? vma->file_offset : 0;
+        line->dent    = vma->file ? vma->file->dentry : NULL;
+        if (line->dent)
+            get_dentry(line->dent);
+        memcpy(line->comment, vma->comment, sizeof(line->comment));
+        line->comment[sizeof(line->comment) - 1] = '\0';
+        cache->count++;
+
+        line->text_offset = cache->text_len;
+        while (old && old_idx < old->count && old->lines[old_idx].start < line->start)
+            old_idx++;
+        if (old && old_idx < old->count && maps_line_equal(&old->lines[old_idx], line)) {
+            struct maps_line* old_line = &old->lines[old_idx];
+            ret = maps_append(cache, old->text + old_line->text_offset, old_line->text_len);
+        } else {
+            ret = maps_format_line(cache, line);
+        }
+        if (ret < 0)
+            goto out;
+        line->text_len = cache->text_len - line->text_offset;
+    }
+
+    *out_cache = cache;
+    cache = NULL;
+    ret = 0;
+
+out:
+    if (cache)
+        free_maps_cache(cache);
+    free_vma_info_array(vmas, count);
+    return ret;
+}
+
 static int proc_thread_maps_open(struct shim_handle* hdl, const char* name, int flags) {
     if (flags & (O_WRONLY | O_RDWR))
         return -EACCES;
@@ -402,6 +579,7 @@ static int proc_thread_maps_open(struct shim_handle* hdl, const char* name, int
     size_t next_len;
     IDTYPE pid;
     char* buffer = NULL;
+    struct shim_str_data* data = NULL;
     int ret = parse_thread_name(name, &pid, &next, &next_len, NULL);
     if (ret < 0)
         return ret;
@@ -411,101 +589,57 @@ static int proc_thread_maps_open(struct shim_handle* hdl, const char* name, int
     if (!thread)
         return -ENOENT;
 
-    size_t count;
-    struct shim_vma_info* vmas = NULL;
-    ret = dump_all_vmas(&vmas, &count, /*include_unmapped=*/false);
-    if (ret < 0) {
-        goto err;
-    }
-
-#define DEFAULT_VMA_BUFFER_SIZE 256
+    /* read before dumping the vmas: if they change meanwhile, the cache is rebuilt next time */
+    uint64_t generation = get_vma_generation();
 
-    size_t buffer_size = DEFAULT_VMA_BUFFER_SIZE, offset = 0;
-    buffer = malloc(buffer_size);
-    if (!buffer) {
-        ret = -ENOMEM;
-        goto err;
-    }
-
-    for (struct shim_vma_info* vma = vmas; vma < vmas + count; vma++) {
-        size_t old_offset = offset;
-        uintptr_t start   = (uintptr_t)vma->addr;
-        uintptr_t end     = (uintptr_t)vma->addr + vma->length;
-        char pt[3]        = {
-            (vma->prot & PROT_READ) ? 'r' : '-',
-            (vma->prot & PROT_WRITE) ? 'w' : '-',
-            (vma->prot & PROT_EXEC) ? 'x' : '-',
-        };
-        char pr = (vma->flags & MAP_PRIVATE) ? 'p' : 's';
-
-#define ADDR_FMT(addr) ((addr) > 0xffffffff ? "%lx" : "%08lx")
-#define EMIT(fmt...)                                                    \
-    do {                                                                \
-        offset += snprintf(buffer + offset, buffer_size - offset, fmt); \
-    } while (0)
-
-    retry_emit_vma:
-        if (vma->file) {
-            int dev_major = 0, dev_minor = 0;
-            unsigned long ino = vma->file->dentry ? dentry_ino(vma->file->dentry) : 0;
-            char* path = NULL;
-
-            if (vma->file->dentry)
-                dentry_abs_path(vma->file->dentry, &path, /*size=*/NULL);
-
-            EMIT(ADDR_FMT(start), start);
-            EMIT("-");
-            EMIT(ADDR_FMT(end), end);
-            EMIT(" %c%c%c%c %08lx %02d:%02d %lu %s\n", pt[0], pt[1], pt[2], pr, vma->file_offset,
-                 dev_major, dev_minor, ino, path ? path : "[unknown]");
-
-            free(path);
-        } else {
-            EMIT(ADDR_FMT(start), start);
-            EMIT("-");
-            EMIT(ADDR_FMT(end), end);
-            if (vma->comment[0])
-                EMIT(" %c%c%c%c 00000000 00:00 0 %s\n", pt[0], pt[1], pt[2], pr, vma->comment);
-            else
-                EMIT(" %c%c%c%c 00000000 00:00 0\n", pt[0], pt[1], pt[2], pr);
-        }
+    spinlock_lock(&g_maps_cache_lock);
+    struct maps_cache* cache = g_maps_cache;
+    g_maps_cache = NULL;
+    spinlock_unlock(&g_maps_cache_lock);
 
-        if (offset >= buffer_size) {
-            char* new_buffer = malloc(buffer_size * 2);
-            if (!new_buffer) {
-                ret = -ENOMEM;
-                goto err;
-            }
-
-            offset = old_offset;
-            memcpy(new_buffer, buffer, old_offset);
-            free(buffer);
-            buffer = new_buffer;
-            buffer_size *= 2;
-            goto retry_emit_vma;
-        }
+    if (!cache || cache->generation != generation) {
+        struct maps_cache* new_cache;
+        ret = maps_build(generation, cache, &new_cache);
+        if (cache)
+            free_maps_cache(cache);
+        cache = NULL;
+        if (ret < 0)
+            goto out;
+        cache = new_cache;
     }
 
-    struct shim_str_data* data = calloc(1, sizeof(struct shim_str_data));
-    if (!data) {
+    buffer = malloc(cache->text_len ?: 1);
+    data = calloc(1, sizeof(struct shim_str_data));
+    if (!buffer || !data) {
         ret = -ENOMEM;
-        goto err;
+        goto out;
     }
+    memcpy(buffer, cache->text, cache->text_len);
 
     data->str = buffer;
-    data->len = offset;
+    data->len = cache->text_len;
     hdl->type          = TYPE_STR;
     hdl->flags         = flags & ~O_RDONLY;
     hdl->acc_mode      = MAY_READ;
     hdl->info.str.data = data;
     ret = 0;
 
-err:
+out:
     if (ret < 0) {
         free(buffer);
+        free(data);
     }
-    if (vmas) {
-        free_vma_info_array(vmas, count);
+    if (cache) {
+        /* keep the newest one */
+        spinlock_lock(&g_maps_cache_lock);
+        if (!g_maps_cache || g_maps_cache->generation < cache->generation) {
+            struct maps_cache* tmp = g_maps_cache;
+            g_maps_cache = cache;
+            cache = tmp;
+        }
+        spinlock_unlock(&g_maps_cache_lock);
+        if (cache)
+            free_maps_cache(cache);
     }
     put_thread(thread);
     return ret;
@@ -576,14 +710,14 @@ static int proc_thread_cmdline_open(struct shim_handle* hdl, const char* name, i
 }
 
 static int proc_thread_cmdline_mode(const char* name, mode_t* mode) {
-    // Only used by one file
+    // Only used by "cmdline" and "status"
     __UNUSED(name);
     *mode = PERM_r________ | S_IFREG;
     return 0;
 }
 
 static int proc_thread_cmdline_stat(const char* name, struct stat* buf) {
-    // Only used by one file
+    // Only used by "cmdline" and "status"
     __UNUSED(name);
     memset(buf, 0, sizeof(*buf));
 
@@ -602,6 +736,320 @@ static const struct pseudo_fs_ops fs_thread_cmdline = {
     .stat = &proc_thread_cmdline_stat,
 };
 
+static int count_thread_cb(struct shim_thread* thread, void* arg) {
+    __UNUSED(thread);
+    (*(size_t*)arg)++;
+    return 1;
+}
+
+/* like on Linux, the name is truncated to 15 characters */
+static void get_process_comm(char comm[16]) {
+    memset(comm, 0, 16);
+    lock(&g_process.fs_lock);
+    if (g_process.exec && g_process.exec->dentry) {
+        const char* exec_name = dentry_get_name(g_process.exec->dentry);
+        memcpy(comm, exec_name, MIN(strlen(exec_name), (size_t)15));
+    }
+    unlock(&g_process.fs_lock);
+}
+
+static int proc_thread_status_open(struct shim_handle* hdl, const char* name, int flags) {
+    if (flags & (O_WRONLY | O_RDWR))
+        return -EACCES;
+
+    const char* next;
+    size_t next_len;
+    IDTYPE pid;
+    int ret = parse_thread_name(name, &pid, &next, &next_len, NULL);
+    if (ret < 0)
+        return ret;
+
+    struct shim_thread* thread = lookup_thread(pid);
+    if (!thread)
+        return -ENOENT;
+
+    lock(&thread->lock);
+    IDTYPE uid  = thread->uid;
+    IDTYPE euid = thread->euid;
+    IDTYPE gid  = thread->gid;
+    IDTYPE egid = thread->egid;
+    unlock(&thread->lock);
+    put_thread(thread);
+
+    char comm[16];
+    get_process_comm(comm);
+
+    size_t threads = 0;
+    (void)walk_thread_list(&count_thread_cb, &threads, /*one_shot=*/false);
+
+    /* resident memory is reported by the PAL, it also includes memory used by Graphene itself */
+    size_t vm_size = get_user_vm_size();
+    size_t vm_rss  = DkMemoryResidentSize();
+
+    size_t buffer_size = 512;
+    char* buffer = malloc(buffer_size);
+    if (!buffer)
+        return -ENOMEM;
+
+    size_t len = snprintf(buffer, buffer_size,
+                          "Name:\t%s\n"
+                          "State:\tR (running)\n"
+                          "Tgid:\t%u\n"
+                          "Pid:\t%u\n"
+                          "PPid:\t%u\n"
+                          "Uid:\t%u\t%u\t%u\t%u\n"
+                          "Gid:\t%u\t%u\t%u\t%u\n"
+                          "VmSize:\t%8lu kB\n"
+                          "VmRSS:\t%8lu kB\n"
+                          "Threads:\t%lu\n",
+                          comm, g_process.pid, pid, g_process.ppid, uid, euid, euid, euid, gid,
+                          egid, egid, egid, vm_size / 1024, vm_rss / 1024, threads);
+    assert(len < buffer_size);
+
+    struct shim_str_data* data = malloc(sizeof(*data));
+    if (!data) {
+        free(buffer);
+        return -ENOMEM;
+    }
+
+    data->str          = buffer;
+    data->len          = len;
+    hdl->type          = TYPE_STR;
+    hdl->flags         = flags & ~O_RDONLY;
+    hdl->acc_mode      = MAY_READ;
+    hdl->info.str.data = data;
+
+    return 0;
+}
+
+static const struct pseudo_fs_ops fs_thread_status = {
+    .open = &proc_thread_status_open,
+    .mode = &proc_thread_cmdline_mode,
+    .stat = &proc_thread_cmdline_stat,
+};
+
+/* The 52 fields of Linux `/proc/<pid>/stat`, those not known to Graphene are 0. The CPU time (as
+ * user time) is of the whole process for the main thread, else of the thread. */
+static int proc_thread_stat_open(struct shim_handle* hdl, const char* name, int flags) {
+    if (flags & (O_WRONLY | O_RDWR))
+        return -EACCES;
+
+    IDTYPE pid;
+    int ret = parse_thread_name(name, &pid, NULL, NULL, NULL);
+    if (ret < 0)
+        return ret;
+
+    struct shim_thread* thread = lookup_thread(pid);
+    if (!thread)
+        return -ENOENT;
+    uint64_t cputime_ns = pid == g_process.pid ? get_process_cputime_ns()
+                                               : get_thread_cputime_ns(thread);
+    put_thread(thread);
+
+    char comm[16];
+    get_process_comm(comm);
+
+    size_t threads = 0;
+    (void)walk_thread_list(&count_thread_cb, &threads, /*one_shot=*/false);
+
+    size_t vm_size = get_user_vm_size();
+    size_t vm_rss  = DkMemoryResidentSize();
+
+    size_t buffer_size = 512;
+    char* buffer = malloc(buffer_size);
+    if (!buffer)
+        return -ENOMEM;
+
+    /* pid (comm) state ppid pgrp session tty_nr tpgid flags minflt cminflt majflt cmajflt utime
+     * stime cutime cstime priority nice num_threads itrealvalue starttime vsize rss, then 28 more
+     * fields (rsslim ... exit_code) */
+    size_t len = snprintf(buffer, buffer_size,
+                          "%u (%s) R %u %u 0 0 0 0 0 0 0 0 %lu 0 0 0 20 0 %lu 0 0 %lu %lu",
+                          pid, comm, g_process.ppid, g_process.pgid,
+                          cputime_ns / (1000000000 / USER_HZ), threads, vm_size,
+                          vm_rss / PAGE_SIZE);
+    for (size_t i = 0; i < 28; i++)
+        len += snprintf(buffer + len, buffer_size - len, " 0");
+    len += snprintf(buffer + len, buffer_size - len, "\n");
+    assert(len < buffer_size);
+
+    struct shim_str_data* data = malloc(sizeof(*data));
+    if (!data) {
+        free(buffer);
+        return -ENOMEM;
+    }
+
+    data->str          = buffer;
+    data->len          = len;
+    hdl->type          = TYPE_STR;
+    hdl->flags         = flags & ~O_RDONLY;
+    hdl->acc_mode      = MAY_READ;
+    hdl->info.str.data = data;
+
+    return 0;
+}
+
+static const struct pseudo_fs_ops fs_thread_stat = {
+    .open = &proc_thread_stat_open,
+    .mode = &proc_thread_cmdline_mode,
+    .stat = &proc_thread_cmdline_stat,
+};
+
+/* One line per syscall used by this process: name, number of calls, total time (in microseconds)
+ * and SYSCALL_STATS_BUCKETS latency histogram buckets. The statistics are always of the whole
+ * process, like on Linux `/proc/<pid>/io` of a thread group leader. */
+#define SYSCALL_STATS_LINE_MAX (32 + (2 + SYSCALL_STATS_BUCKETS) * 21)
+
+static int proc_thread_syscalls_open(struct shim_handle* hdl, const char* name, int flags) {
+    if (flags & (O_WRONLY | O_RDWR))
+        return -EACCES;
+
+    IDTYPE pid;
+    int ret = parse_thread_name(name, &pid, NULL, NULL, NULL);
+    if (ret < 0)
+        return ret;
+
+    struct shim_thread* thread = lookup_thread(pid);
+    if (!thread)
+        return -ENOENT;
+    put_thread(thread);
+
+    struct shim_syscall_stat* stats = malloc(LIBOS_SYSCALL_BOUND * sizeof(*stats));
+    if (!stats)
+        return -ENOMEM;
+    collect_syscall_stats(stats);
+
+    size_t lines = 0;
+    for (size_t i = 0; i < LIBOS_SYSCALL_BOUND; i++)
+        if (stats[i].count)
+            lines++;
+
+    size_t buffer_size = lines * SYSCALL_STATS_LINE_MAX + 1;
+    char* buffer = malloc(buffer_size);
+    if (!buffer) {
+        free(stats);
+        return -ENOMEM;
+    }
+
+    size_t len = 0;
+    buffer[0] = '\0';
+    for (size_t i = 0; i < LIBOS_SYSCALL_BOUND; i++) {
+        if (!stats[i].count)
+            continue;
+
+        const char* syscall_name = get_syscall_name(i);
+        if (syscall_name)
+            len += snprintf(buffer + len, buffer_size - len, "%s", syscall_name);
+        else
+            len += snprintf(buffer + len, buffer_size - len, "syscall%lu", i);
+        len += snprintf(buffer + len, buffer_size - len, " %lu %lu", stats[i].count,
+                        stats[i].time_us);
+        for (size_t j = 0; j < SYSCALL_STATS_BUCKETS; j++)
+            len += snprintf(buffer + len, buffer_size - len, " %lu", stats[i].buckets[j]);
+        len += snprintf(buffer + len, buffer_size - len, "\n");
+        assert(len < buffer_size);
+    }
+    free(stats);
+
+    struct shim_str_data* data = malloc(sizeof(*data));
+    if (!data) {
+        free(buffer);
+        return -ENOMEM;
+    }
+
+    data->str          = buffer;
+    data->len          = len;
+    hdl->type          = TYPE_STR;
+    hdl->flags         = flags & ~O_RDONLY;
+    hdl->acc_mode      = MAY_READ;
+    hdl->info.str.data = data;
+
+    return 0;
+}
+
+static const struct pseudo_fs_ops fs_thread_syscalls = {
+    .open = &proc_thread_syscalls_open,
+    .mode = &proc_thread_cmdline_mode,
+    .stat = &proc_thread_cmdline_stat,
+};
+
+/* One line per class of PAL streams with any I/O: name, then the number of reads, bytes read and
+ * time spent reading (in microseconds), the same of writes, and the number of waits and time spent
+ * waiting (see `PAL_IO_STATS`). Times are 0 unless `loader.io_time_stats` is set. Like the syscall
+ * statistics, of the whole process. */
+static const char* const g_io_class_names[PAL_IO_CLASS_BOUND] = {
+    [PAL_IO_CLASS_FILE]           = "file",
+    [PAL_IO_CLASS_PROTECTED_FILE] = "protected_file",
+    [PAL_IO_CLASS_DIR]            = "dir",
+    [PAL_IO_CLASS_PIPE]           = "pipe",
+    [PAL_IO_CLASS_DEV]            = "dev",
+    [PAL_IO_CLASS_TCP]            = "tcp",
+    [PAL_IO_CLASS_UDP]            = "udp",
+    [PAL_IO_CLASS_PROCESS]        = "process",
+    [PAL_IO_CLASS_EVENTFD]        = "eventfd",
+    [PAL_IO_CLASS_POLLER]         = "poller",
+    [PAL_IO_CLASS_OTHER]          = "other",
+};
+
+#define IO_STATS_LINE_MAX (16 + 8 * 21)
+
+static int proc_thread_io_open(struct shim_handle* hdl, const char* name, int flags) {
+    if (flags & (O_WRONLY | O_RDWR))
+        return -EACCES;
+
+    IDTYPE pid;
+    int ret = parse_thread_name(name, &pid, NULL, NULL, NULL);
+    if (ret < 0)
+        return ret;
+
+    struct shim_thread* thread = lookup_thread(pid);
+    if (!thread)
+        return -ENOENT;
+    put_thread(thread);
+
+    PAL_IO_STATS stats[PAL_IO_CLASS_BOUND];
+    DkStreamsGetIoStats(stats);
+
+    size_t buffer_size = PAL_IO_CLASS_BOUND * IO_STATS_LINE_MAX + 1;
+    char* buffer = malloc(buffer_size);
+    if (!buffer)
+        return -ENOMEM;
+
+    size_t len = 0;
+    buffer[0] = '\0';
+    for (size_t i = 0; i < PAL_IO_CLASS_BOUND; i++) {
+        if (!stats[i].reads && !stats[i].writes && !stats[i].waits)
+            continue;
+        len += snprintf(buffer + len, buffer_size - len,
+                        "%s %lu %lu %lu %lu %lu %lu %lu %lu\n", g_io_class_names[i],
+                        stats[i].reads, stats[i].read_bytes, stats[i].read_us, stats[i].writes,
+                        stats[i].write_bytes, stats[i].write_us, stats[i].waits,
+                        stats[i].wait_us);
+        assert(len < buffer_size);
+    }
+
+    struct shim_str_data* data = malloc(sizeof(*data));
+    if (!data) {
+        free(buffer);
+        return -ENOMEM;
+    }
+
+    data->str          = buffer;
+    data->len          = len;
+    hdl->type          = TYPE_STR;
+    hdl->flags         = flags & ~O_RDONLY;
+    hdl->acc_mode      = MAY_READ;
+    hdl->info.str.data = data;
+
+    return 0;
+}
+
+static const struct pseudo_fs_ops fs_thread_io = {
+    .open = &proc_thread_io_open,
+    .mode = &proc_thread_cmdline_mode,
+    .stat = &proc_thread_cmdline_stat,
+};
+
 static int proc_thread_dir_open(struct shim_handle* hdl, const char* name, int flags) {
     __UNUSED(hdl);
     __UNUSED(name);
@@ -726,8 +1174,17 @@ static const struct pseudo_dir dir_task = {
     }
 };
 
+/* Graphene-specific files */
+static const struct pseudo_dir dir_graphene = {
+    .size = 2,
+    .ent  = {
+        {.name = "syscalls", .fs_ops = &fs_thread_syscalls, .type = LINUX_DT_REG},
+        {.name = "io",       .fs_ops = &fs_thread_io,       .type = LINUX_DT_REG},
+    }
+};
+
 const struct pseudo_dir dir_thread = {
-    .size = 7,
+    .size = 10,
     .ent  = {
         {.name = "cwd",  .fs_ops = &fs_thread_link, .type = LINUX_DT_LNK},
         {.name = "exe",  .fs_ops = &fs_thread_link, .type = LINUX_DT_LNK},
@@ -736,5 +1193,8 @@ const struct pseudo_dir dir_thread = {
         {.name = "maps", .fs_ops = &fs_thread_maps, .type = LINUX_DT_REG},
         {.name = "task", .fs_ops = &fs_thread,      .dir  = &dir_task, .type = LINUX_DT_DIR},
         {.name = "cmdline",  .fs_ops = &fs_thread_cmdline, .type = LINUX_DT_REG},
+        {.name = "status",   .fs_ops = &fs_thread_status,  .type = LINUX_DT_REG},
+        {.name = "stat",     .fs_ops = &fs_thread_stat,    .type = LINUX_DT_REG},
+        {.name = "graphene", .fs_ops = &fs_thread_fd, .dir = &dir_graphene, .type = LINUX_DT_DIR},
     }
 };
@@ -16,6 +16,7 @@
 #include "shim_lock.h"
 #include "shim_types.h"
 #include "stat.h"
+#include "toml.h"
 
 static struct shim_lock dcache_mgr_lock;
 
@@ -34,6 +35,42 @@ static MEM_MGR dentry_mgr = NULL;
 
 struct shim_dentry* g_dentry_root = NULL;
 
+/* Directories with more children than this get `children_table`, which starts with that many
+ * buckets and is doubled whenever there are more than two children per bucket. */
+#define CHILDREN_TABLE_MIN_SIZE 16
+
+/*
+ * Snapshot of lookups passed to children (at most `fs.lookup_snapshot_size` of them). The child
+ * starts only with the dentries referenced by its handles, cwd and mounts (and their ancestors),
+ * and would otherwise ask the host again for every path the parent already looked up. The snapshot
+ * holds only lookups which can't have gone stale: failed lookups on mounts with `negative_ttl_us`
+ * (until it expires), and files on immutable mounts.
+ *
+ * It is one position-independent block of the checkpoint: the header with the buckets of a hash
+ * table of absolute paths, followed by the entries and their paths.
+ */
+struct dcache_snapshot_entry {
+    HASHTYPE hash;
+    uint32_t next;     /* index of the next entry in the bucket plus 1, 0 for the last one */
+    uint32_t path_off; /* offset of the path (not NUL-terminated) in the paths */
+    uint32_t path_len;
+    mode_t mode;       /* type and permissions, 0 for a failed lookup */
+    bool used;         /* a dentry was created from the entry, the dcache takes over */
+    uint64_t negative_time_us;
+};
+
+struct dcache_snapshot {
+    uint32_t count;
+    uint32_t buckets_cnt; /* power of 2 */
+    size_t entries_off;   /* offsets from the header */
+    size_t paths_off;
+    uint32_t buckets[];   /* index of the first entry of the bucket plus 1, 0 if empty */
+};
+
+static size_t g_lookup_snapshot_size = 0;
+/* inherited from the parent, stays in the checkpoint memory */
+static struct dcache_snapshot* g_dcache_snapshot = NULL;
+
 static struct shim_dentry* alloc_dentry(void) {
     struct shim_dentry* dent =
         get_mem_obj_from_mgr_enlarge(dentry_mgr, size_align_up(DCACHE_MGR_ALLOC));
@@ -60,6 +97,17 @@ int init_dcache(void) {
         return -ENOMEM;
     }
 
+    assert(g_manifest_root);
+    int64_t lookup_snapshot_size;
+    int ret = toml_int_in(g_manifest_root, "fs.lookup_snapshot_size", /*defaultval=*/0,
+                          &lookup_snapshot_size);
+    if (ret < 0 || lookup_snapshot_size < 0 || lookup_snapshot_size > UINT32_MAX) {
+        log_error("Cannot parse 'fs.lookup_snapshot_size' (the value must be a non-negative "
+                  "integer)\n");
+        return -EINVAL;
+    }
+    g_lookup_snapshot_size = lookup_snapshot_size;
+
     dentry_mgr = create_mem_mgr(init_align_up(DCACHE_MGR_ALLOC));
 
     g_dentry_root = alloc_dentry();
@@ -113,6 +161,7 @@ static void free_dentry(struct shim_dentry* dent) {
     assert(dent->nchildren == 0);
     assert(LISTP_EMPTY(&dent->children));
     assert(LIST_EMPTY(dent, siblings));
+    free(dent->children_table);
 
     if (dent->mounted) {
         put_mount(dent->mounted);
@@ -143,6 +192,97 @@ void put_dentry(struct shim_dentry* dent) {
     }
 }
 
+/* for tables of a power-of-2 size: `hash_strn` mixes the high bits poorly into the low ones */
+static HASHTYPE mix_hash(HASHTYPE hash) {
+    hash ^= hash >> 29;
+    hash *= 0x9e3779b97f4a7c15ULL;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+static struct shim_dentry** children_table_bucket(struct shim_dentry* dir, HASHTYPE hash) {
+    return &dir->children_table[mix_hash(hash) & (dir->children_table_size - 1)];
+}
+
+static void children_table_insert(struct shim_dentry* dir, struct shim_dentry* dent) {
+    struct shim_dentry** bucket = children_table_bucket(dir, dent->name_hash);
+    dent->hash_next = *bucket;
+    *bucket = dent;
+}
+
+static void children_table_remove(struct shim_dentry* dir, struct shim_dentry* dent) {
+    struct shim_dentry** link = children_table_bucket(dir, dent->name_hash);
+    while (*link != dent) {
+        assert(*link);
+        link = &(*link)->hash_next;
+    }
+    *link = dent->hash_next;
+    dent->hash_next = NULL;
+}
+
+static bool resize_children_table(struct shim_dentry* dir, size_t size) {
+    struct shim_dentry** table = calloc(size, sizeof(*table));
+    if (!table)
+        return false;
+
+    free(dir->children_table);
+    dir->children_table = table;
+    dir->children_table_size = size;
+
+    struct shim_dentry* child;
+    LISTP_FOR_EACH_ENTRY(child, &dir->children, siblings) {
+        children_table_insert(dir, child);
+    }
+    return true;
+}
+
+static void add_child(struct shim_dentry* dir, struct shim_dentry* dent) {
+    LISTP_ADD_TAIL(dent, &dir->children, siblings);
+    dir->nchildren++;
+
+    if (dir->children_table && dir->nchildren <= dir->children_table_size * 2) {
+        children_table_insert(dir, dent);
+        return;
+    }
+    if (!dir->children_table && dir->nchildren <= CHILDREN_TABLE_MIN_SIZE)
+        return;
+
+    size_t size = dir->children_table ? dir->children_table_size * 2 : CHILDREN_TABLE_MIN_SIZE;
+    if (!resize_children_table(dir, size) && dir->children_table) {
+        /* failing to grow the table is not fatal, keep using the old one */
+        children_table_insert(dir, dent);
+    }
+}
+
+static void del_child(struct shim_dentry* dir, struct shim_dentry* dent) {
+    if (dir->children_table)
+        children_table_remove(dir, dent);
+
+    LISTP_DEL_INIT(dent, &dir->children, siblings);
+    dir->nchildren--;
+
+    if (!dir->nchildren) {
+        free(dir->children_table);
+        dir->children_table = NULL;
+        dir->children_table_size = 0;
+    }
+}
+
+bool dentry_negative_cached(struct shim_dentry* dent) {
+    assert(locked(&g_dcache_lock));
+    assert((dent->state & DENTRY_VALID) && (dent->state & DENTRY_NEGATIVE));
+
+    if (!dent->mount || !dent->mount->negative_ttl_us)
+        return false;
+    if (dent->mount->negative_ttl_us == NEGATIVE_TTL_INFINITE)
+        return true;
+
+    uint64_t now_us;
+    if (DkSystemTimeQuery(&now_us) < 0)
+        return false;
+    return now_us - dent->negative_time_us < dent->mount->negative_ttl_us;
+}
+
 void dentry_gc(struct shim_dentry* dent) {
     assert(locked(&g_dcache_lock));
     assert(dent->parent);
@@ -153,8 +293,10 @@ void dentry_gc(struct shim_dentry* dent) {
     if ((dent->state & DENTRY_VALID) && !(dent->state & DENTRY_NEGATIVE))
         return;
 
-    LISTP_DEL_INIT(dent, &dent->parent->children, siblings);
-    dent->parent->nchildren--;
+    if ((dent->state & DENTRY_VALID) && dentry_negative_cached(dent))
+        return;
+
+    del_child(dent->parent, dent);
     /* This should delete `dent` */
     put_dentry(dent);
 }
@@ -173,6 +315,7 @@ struct shim_dentry* get_new_dentry(struct shim_mount* mount, struct shim_dentry*
         free_dentry(dent);
         return NULL;
     }
+    dent->name_hash = hash_strn(name, name_len);
 
     if (parent && parent->nchildren >= DENTRY_MAX_CHILDREN) {
         log_warning("get_new_dentry: nchildren limit reached\n");
@@ -191,8 +334,7 @@ struct shim_dentry* get_new_dentry(struct shim_mount* mount, struct shim_dentry*
         dent->parent = parent;
 
         get_dentry(dent);
-        LISTP_ADD_TAIL(dent, &parent->children, siblings);
-        parent->nchildren++;
+        add_child(parent, dent);
     }
 
     return dent;
@@ -204,10 +346,24 @@ struct shim_dentry* lookup_dcache(struct shim_dentry* parent, const char* name,
     assert(parent);
     assert(name_len > 0);
 
+    HASHTYPE hash = hash_strn(name, name_len);
     struct shim_dentry* tmp;
     struct shim_dentry* dent;
+
+    if (parent->children_table) {
+        for (dent = *children_table_bucket(parent, hash); dent; dent = tmp) {
+            tmp = dent->hash_next;
+            if (dent->name_hash == hash && qstrcmpstr(&dent->name, name, name_len) == 0) {
+                get_dentry(dent);
+                return dent;
+            }
+            dentry_gc(dent);
+        }
+        return NULL;
+    }
+
     LISTP_FOR_EACH_ENTRY_SAFE(dent, tmp, &parent->children, siblings) {
-        if (qstrcmpstr(&dent->name, name, name_len) == 0) {
+        if (dent->name_hash == hash && qstrcmpstr(&dent->name, name, name_len) == 0) {
             get_dentry(dent);
             return dent;
         }
@@ -236,9 +392,8 @@ int __del_dentry_tree(struct shim_dentry* root) {
         if (!LISTP_EMPTY(&cursor->children))
             __del_dentry_tree(cursor);
 
-        LISTP_DEL_INIT(cursor, &root->children, siblings);
+        del_child(root, cursor);
         cursor->parent = NULL;
-        root->nchildren--;
         put_dentry(cursor);
     }
 
@@ -372,6 +527,58 @@ int dentry_abs_path_into_qstr(struct shim_dentry* dent, struct shim_qstr* str) {
     return 0;
 }
 
+bool dentry_lookup_snapshot(struct shim_dentry* dent) {
+    assert(locked(&g_dcache_lock));
+    assert(!(dent->state & DENTRY_VALID));
+
+    struct dcache_snapshot* snap = g_dcache_snapshot;
+    if (!snap || dent->fs != &chroot_builtin_fs || !dent->mount)
+        return false;
+
+    char* path;
+    size_t path_size;
+    if (dentry_abs_path(dent, &path, &path_size) < 0)
+        return false;
+    size_t path_len = path_size - 1;
+    HASHTYPE hash = hash_strn(path, path_len);
+
+    struct dcache_snapshot_entry* entries = (void*)snap + snap->entries_off;
+    const char* paths = (void*)snap + snap->paths_off;
+    struct dcache_snapshot_entry* found = NULL;
+    uint32_t idx = snap->buckets[mix_hash(hash) & (snap->buckets_cnt - 1)];
+    for (; idx; idx = entries[idx - 1].next) {
+        struct dcache_snapshot_entry* entry = &entries[idx - 1];
+        if (entry->hash == hash && entry->path_len == path_len
+                && !memcmp(paths + entry->path_off, path, path_len)) {
+            found = entry;
+            break;
+        }
+    }
+    free(path);
+
+    /* once the dentry is gone from the dcache, the process may have changed the file itself */
+    if (!found || found->used)
+        return false;
+    found->used = true;
+
+    if (!found->mode) {
+        dent->state |= DENTRY_VALID | DENTRY_NEGATIVE;
+        dent->negative_time_us = found->negative_time_us;
+        if (!dentry_negative_cached(dent)) {
+            dent->state &= ~(DENTRY_VALID | DENTRY_NEGATIVE);
+            return false;
+        }
+        return true;
+    }
+
+    dent->type = found->mode & S_IFMT;
+    dent->perm = found->mode & ~S_IFMT;
+    dent->state |= DENTRY_VALID;
+    if (dent->type == S_IFDIR)
+        dent->state |= DENTRY_ISDIRECTORY;
+    return true;
+}
+
 static int dump_dentry_write_all(const char* str, size_t size, void* arg) {
     __UNUSED(arg);
     log_always("%.*s\n", (int)size, str);
@@ -464,15 +671,27 @@ BEGIN_CP_FUNC(dentry) {
         *new_dent = *dent;
         INIT_LISTP(&new_dent->children);
         INIT_LIST_HEAD(new_dent, siblings);
+        new_dent->children_table = NULL;
+        new_dent->children_table_size = 0;
+        new_dent->hash_next = NULL;
+        /* locks are not inherited */
+        new_dent->fs_lock = NULL;
         clear_lock(&new_dent->lock);
         REF_SET(new_dent->ref_count, 0);
 
         /* we don't checkpoint children dentries, so need to list directory again */
-        new_dent->state &= ~DENTRY_LISTED;
+        new_dent->state &= ~(DENTRY_LISTED | DENTRY_LISTING);
 
         if (new_dent->type != S_IFIFO) {
             /* not FIFO, no need to keep data (FIFOs stash internal FDs into data field) */
             new_dent->data = NULL;
+
+            /* ...except for cached attributes of files that can't change, which saves the child
+             * from querying them again */
+            struct shim_file_data* data = FILE_DENTRY_DATA(dent);
+            if (data && data->queried && dent->fs == &chroot_builtin_fs && dent->mount
+                    && dent->mount->immutable)
+                DO_CP(chroot_file_data, data, &new_dent->data);
         }
 
         DO_CP_IN_MEMBER(qstr, new_dent, name);
@@ -510,6 +729,8 @@ BEGIN_RS_FUNC(dentry) {
     CP_REBASE(dent->fs);
     CP_REBASE(dent->parent);
     CP_REBASE(dent->mounted);
+    if (dent->type != S_IFIFO)
+        CP_REBASE(dent->data);
 
     if (!create_lock(&dent->lock)) {
         return -ENOMEM;
@@ -526,6 +747,8 @@ BEGIN_RS_FUNC(dentry) {
         get_dentry(dent->parent);
         get_dentry(dent);
         LISTP_ADD_TAIL(dent, &dent->parent->children, siblings);
+        if (dent->parent->children_table)
+            children_table_insert(dent->parent, dent);
     }
 
     if (dent->mounted) {
@@ -533,3 +756,106 @@ BEGIN_RS_FUNC(dentry) {
     }
 }
 END_RS_FUNC(dentry)
+
+static bool dentry_in_lookup_snapshot(struct shim_dentry* dent) {
+    if (!(dent->state & DENTRY_VALID) || dent->fs != &chroot_builtin_fs || !dent->mount
+            || (dent->state & (DENTRY_MOUNTPOINT | DENTRY_SYNTHETIC | DENTRY_ISLINK)))
+        return false;
+    if (dent->state & DENTRY_NEGATIVE)
+        return dentry_negative_cached(dent);
+    return dent->mount->immutable && dent->type;
+}
+
+/* Collects up to `max_cnt` dentries under `dir` for the lookup snapshot. Recursion is bounded by
+ * the depth of paths, like in `__del_dentry_tree`. */
+static void collect_lookup_snapshot(struct shim_dentry* dir, struct shim_dentry** dents,
+                                    size_t* cnt, size_t max_cnt) {
+    struct shim_dentry* dent;
+    LISTP_FOR_EACH_ENTRY(dent, &dir->children, siblings) {
+        if (*cnt == max_cnt)
+            return;
+        if (dentry_in_lookup_snapshot(dent))
+            dents[(*cnt)++] = dent;
+        collect_lookup_snapshot(dent, dents, cnt, max_cnt);
+    }
+}
+
+BEGIN_CP_FUNC(dcache_snapshot) {
+    __UNUSED(obj);
+    __UNUSED(size);
+    __UNUSED(objp);
+
+    if (!g_lookup_snapshot_size)
+        return 0;
+
+    /* the snapshot only saves lookups in the child, don't fail the checkpoint without it */
+    struct shim_dentry** dents = malloc(g_lookup_snapshot_size * sizeof(*dents));
+    if (!dents)
+        return 0;
+
+    lock(&g_dcache_lock);
+
+    size_t cnt = 0;
+    collect_lookup_snapshot(g_dentry_root, dents, &cnt, g_lookup_snapshot_size);
+    if (!cnt)
+        goto out;
+
+    size_t paths_size = 0;
+    for (size_t i = 0; i < cnt; i++)
+        paths_size += dentry_path_size(dents[i], /*relative=*/false) - 1;
+
+    uint32_t buckets_cnt = 1;
+    while (buckets_cnt < cnt)
+        buckets_cnt *= 2;
+
+    size_t entries_off = ALIGN_UP(sizeof(struct dcache_snapshot) + buckets_cnt * sizeof(uint32_t),
+                                  __alignof__(struct dcache_snapshot_entry));
+    size_t paths_off = entries_off + cnt * sizeof(struct dcache_snapshot_entry);
+    /* the NUL of the last path */
+    size_t off = ADD_CP_OFFSET(paths_off + paths_size + 1);
+
+    struct dcache_snapshot* snap = (struct dcache_snapshot*)(base + off);
+    snap->count       = cnt;
+    snap->buckets_cnt = buckets_cnt;
+    snap->entries_off = entries_off;
+    snap->paths_off   = paths_off;
+    memset(snap->buckets, 0, buckets_cnt * sizeof(uint32_t));
+
+    struct dcache_snapshot_entry* entries = (void*)snap + entries_off;
+    char* paths = (void*)snap + paths_off;
+    size_t path_off = 0;
+    for (size_t i = 0; i < cnt; i++) {
+        struct shim_dentry* dent = dents[i];
+        size_t path_size = dentry_path_size(dent, /*relative=*/false);
+        /* the NUL is overwritten by the next path */
+        dentry_path_into_buf(dent, /*relative=*/false, paths + path_off, path_size);
+
+        struct dcache_snapshot_entry* entry = &entries[i];
+        entry->hash     = hash_strn(paths + path_off, path_size - 1);
+        entry->path_off = path_off;
+        entry->path_len = path_size - 1;
+        entry->mode     = (dent->state & DENTRY_NEGATIVE) ? 0 : dent->type | dent->perm;
+        entry->used     = false;
+        entry->negative_time_us = dent->negative_time_us;
+
+        uint32_t* bucket = &snap->buckets[mix_hash(entry->hash) & (buckets_cnt - 1)];
+        entry->next = *bucket;
+        *bucket = i + 1;
+
+        path_off += path_size - 1;
+    }
+
+    ADD_CP_FUNC_ENTRY(off);
+
+out:
+    unlock(&g_dcache_lock);
+    free(dents);
+}
+END_CP_FUNC(dcache_snapshot)
+
+BEGIN_RS_FUNC(dcache_snapshot) {
+    __UNUSED(offset);
+    __UNUSED(rebase);
+    g_dcache_snapshot = (void*)(base + GET_CP_FUNC_ENTRY());
+}
+END_RS_FUNC(dcache_snapshot)
@@ -13,6 +13,7 @@
 #include "pal_error.h"
 #include "shim_checkpoint.h"
 #include "shim_fs.h"
+#include "shim_fs_lock.h"
 #include "shim_internal.h"
 #include "shim_lock.h"
 #include "shim_process.h"
@@ -30,6 +31,9 @@ struct shim_fs* builtin_fs[] = {
     &socket_builtin_fs,
     &epoll_builtin_fs,
     &eventfd_builtin_fs,
+    &timerfd_builtin_fs,
+    &io_uring_builtin_fs,
+    &anon_shm_builtin_fs,
 };
 
 static struct shim_lock mount_mgr_lock;
@@ -49,6 +53,53 @@ DEFINE_LISTP(shim_mount);
 static LISTP_TYPE(shim_mount) mount_list;
 static struct shim_lock mount_list_lock;
 
+/*
+ * Mounts with a URI, indexed by it in a trie (one node per character, children in a list), for
+ * `find_mount_from_uri`. Path lookups don't need it: they reach the mount of each dentry through
+ * `dentry->mount`, and cross mount points through `dentry->mounted`. Protected by
+ * `mount_list_lock`, nodes are never freed (neither are mounts).
+ */
+struct mount_uri_node {
+    char c;
+    struct mount_uri_node* children;
+    struct mount_uri_node* next;
+    /* the mount with the longest path among the ones whose URI ends here, or NULL */
+    struct shim_mount* mount;
+};
+static struct mount_uri_node g_mount_uri_root;
+
+static struct mount_uri_node* mount_uri_child(struct mount_uri_node* node, char c) {
+    for (struct mount_uri_node* child = node->children; child; child = child->next)
+        if (child->c == c)
+            return child;
+    return NULL;
+}
+
+/* The caller should hold `mount_list_lock` (unless restoring the checkpoint). */
+static int mount_uri_index_add(struct shim_mount* mount) {
+    if (qstrempty(&mount->uri))
+        return 0;
+
+    struct mount_uri_node* node = &g_mount_uri_root;
+    const char* uri = qstrgetstr(&mount->uri);
+    for (size_t i = 0; i < mount->uri.len; i++) {
+        struct mount_uri_node* child = mount_uri_child(node, uri[i]);
+        if (!child) {
+            child = calloc(1, sizeof(*child));
+            if (!child)
+                return -ENOMEM;
+            child->c = uri[i];
+            child->next = node->children;
+            node->children = child;
+        }
+        node = child;
+    }
+
+    if (!node->mount || mount->path.len > node->mount->path.len)
+        node->mount = mount;
+    return 0;
+}
+
 int init_fs(void) {
     mount_mgr = create_mem_mgr(init_align_up(MOUNT_MGR_ALLOC));
     if (!mount_mgr)
@@ -58,7 +109,22 @@ int init_fs(void) {
         destroy_mem_mgr(mount_mgr);
         return -ENOMEM;
     }
-    return 0;
+    int ret = init_chroot_read_ahead();
+    if (ret < 0)
+        return ret;
+    ret = init_chroot_write_behind();
+    if (ret < 0)
+        return ret;
+    ret = init_chroot_page_cache();
+    if (ret < 0)
+        return ret;
+    ret = init_anon_shm();
+    if (ret < 0)
+        return ret;
+    ret = init_fs_lock();
+    if (ret < 0)
+        return ret;
+    return init_attestation_quote_cache();
 }
 
 static struct shim_mount* alloc_mount(void) {
@@ -210,12 +276,61 @@ static int __mount_one_other(toml_table_t* mount) {
         goto out;
     }
 
-    if ((ret = mount_fs(mount_type, mount_uri, mount_path, NULL, NULL, 1)) < 0) {
+    bool immutable;
+    ret = toml_bool_in(mount, "immutable", /*defaultval=*/false, &immutable);
+    if (ret < 0) {
+        log_error("Cannot parse 'fs.mount.%s.immutable' (the value must be `true` or `false`)\n",
+                  key);
+        ret = -EINVAL;
+        goto out;
+    }
+
+    int64_t negative_ttl_ms;
+    ret = toml_int_in(mount, "negative_ttl_ms", /*defaultval=*/0, &negative_ttl_ms);
+    if (ret < 0 || negative_ttl_ms < 0 || (uint64_t)negative_ttl_ms >= UINT64_MAX / 1000) {
+        log_error("Cannot parse 'fs.mount.%s.negative_ttl_ms' (the value must be a non-negative "
+                  "number)\n", key);
+        ret = -EINVAL;
+        goto out;
+    }
+
+    uint64_t write_behind_size;
+    ret = toml_sizestring_in(mount, "write_behind", /*defaultval=*/0, &write_behind_size);
+    if (ret < 0 || write_behind_size > WRITE_BEHIND_MAX_SIZE) {
+        log_error("Cannot parse 'fs.mount.%s.write_behind' (the value must be put in double "
+                  "quotes and be at most 1M)\n", key);
+        ret = -EINVAL;
+        goto out;
+    }
+
+    uint64_t size_limit;
+    ret = toml_sizestring_in(mount, "size", /*defaultval=*/0, &size_limit);
+    if (ret < 0) {
+        log_error("Cannot parse 'fs.mount.%s.size' (the value must be put in double quotes!)\n",
+                  key);
+        ret = -EINVAL;
+        goto out;
+    }
+    if (size_limit && strcmp(mount_type, "tmpfs")) {
+        log_error("'fs.mount.%s.size' is supported only by tmpfs mounts\n", key);
+        ret = -EINVAL;
+        goto out;
+    }
+
+    struct shim_dentry* dent;
+    if ((ret = mount_fs(mount_type, mount_uri, mount_path, NULL, &dent, 1)) < 0) {
         log_error("Mounting %s on %s (type=%s) failed (%d)\n", mount_uri, mount_path, mount_type,
                   -ret);
         goto out;
     }
 
+    dent->mount->negative_ttl_us = immutable ? NEGATIVE_TTL_INFINITE
+                                             : (uint64_t)negative_ttl_ms * 1000;
+    dent->mount->immutable = immutable;
+    dent->mount->write_behind_size = write_behind_size;
+    dent->mount->size_limit = size_limit;
+    put_dentry(dent);
+
     ret = 0;
 out:
     free(mount_type);
@@ -374,6 +489,11 @@ static int __mount_fs(struct shim_mount* mount, struct shim_dentry* dent) {
         return ret;
 
     lock(&mount_list_lock);
+    ret = mount_uri_index_add(mount);
+    if (ret < 0) {
+        unlock(&mount_list_lock);
+        return ret;
+    }
     get_mount(mount);
     LISTP_ADD_TAIL(mount, &mount_list, list);
     unlock(&mount_list_lock);
@@ -584,22 +704,33 @@ int walk_mounts(int (*walk)(struct shim_mount* mount, void* arg), void* arg) {
     return ret < 0 ? ret : (nsrched ? 0 : -ESRCH);
 }
 
-struct shim_mount* find_mount_from_uri(const char* uri) {
+void print_mount_stats(void) {
     struct shim_mount* mount;
-    struct shim_mount* found = NULL;
-    size_t longest_path = 0;
 
     lock(&mount_list_lock);
     LISTP_FOR_EACH_ENTRY(mount, &mount_list, list) {
-        if (qstrempty(&mount->uri))
+        uint64_t hits   = __atomic_load_n(&mount->lookup_hits, __ATOMIC_RELAXED);
+        uint64_t misses = __atomic_load_n(&mount->lookup_misses, __ATOMIC_RELAXED);
+        if (!hits && !misses)
             continue;
+        log_debug("mount %s: %lu lookups answered by the dcache, %lu passed to the filesystem\n",
+                  qstrgetstr(&mount->path), hits, misses);
+    }
+    unlock(&mount_list_lock);
+}
 
-        if (!memcmp(qstrgetstr(&mount->uri), uri, mount->uri.len)) {
-            if (mount->path.len > longest_path) {
-                longest_path = mount->path.len;
-                found = mount;
-            }
-        }
+struct shim_mount* find_mount_from_uri(const char* uri) {
+    struct shim_mount* found = NULL;
+
+    lock(&mount_list_lock);
+    /* every node on the way is a prefix of `uri`, pick the longest path of their mounts */
+    struct mount_uri_node* node = &g_mount_uri_root;
+    for (const char* p = uri; *p; p++) {
+        node = mount_uri_child(node, *p);
+        if (!node)
+            break;
+        if (node->mount && (!found || node->mount->path.len > found->path.len))
+            found = node->mount;
     }
 
     if (found)
@@ -692,9 +823,13 @@ BEGIN_CP_FUNC(mount) {
             new_mount->cpdata = (char*)base + cp_off;
         }
 
-        new_mount->data        = NULL;
-        new_mount->mount_point = NULL;
-        new_mount->root        = NULL;
+        new_mount->data          = NULL;
+        new_mount->mount_point   = NULL;
+        new_mount->root          = NULL;
+        new_mount->lookup_hits   = 0;
+        new_mount->lookup_misses = 0;
+        /* tmpfs files are not inherited by the child */
+        new_mount->used_size     = 0;
         INIT_LIST_HEAD(new_mount, list);
         REF_SET(new_mount->ref_count, 0);
 
@@ -742,6 +877,9 @@ BEGIN_RS_FUNC(mount) {
         mount->cpdata = NULL;
     }
 
+    int ret = mount_uri_index_add(mount);
+    if (ret < 0)
+        return ret;
     LISTP_ADD_TAIL(mount, &mount_list, list);
 
     if (!qstrempty(&mount->path)) {
@@ -9,11 +9,13 @@
 #include "shim_internal.h"
 
 HASHTYPE hash_str(const char* p) {
+    return hash_strn(p, strlen(p));
+}
+
+HASHTYPE hash_strn(const char* p, size_t len) {
     HASHTYPE hash = 0;
     HASHTYPE tmp;
 
-    size_t len = strlen(p);
-
     for (; len >= sizeof(hash); p += sizeof(hash), len -= sizeof(hash)) {
         memcpy(&tmp, p, sizeof(tmp)); /* avoid pointer alignment issues */
         hash += tmp;
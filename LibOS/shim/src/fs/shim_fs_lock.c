@@ -0,0 +1,775 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * POSIX byte-range locks (`fcntl(F_SETLK/F_SETLKW/F_GETLK)`).
+ *
+ * Locks are owned by processes, so they are resolved by a process holding the state of the file
+ * (all locks on it, keyed by the absolute path):
+ *   - The IPC leader holds the state of all files, unless it handed it over to another process.
+ *     Its own requests never need IPC, and other processes send theirs to it (POSIX_LOCK_SET,
+ *     POSIX_LOCK_GET); a request which has to wait is answered when it's granted.
+ *   - A process asking the leader to lock a file which nobody else has locked gets the state of it
+ *     instead (the request is answered with POSIX_LOCK_LEASED): all locks on the file are its own
+ *     and never conflict, so it takes and releases them without any IPC, e.g. around each
+ *     transaction of SQLite or Berkeley DB. Once another process (including the leader) uses locks
+ *     on the file, the leader recalls the state (POSIX_LOCK_RECALL, answered with POSIX_LOCK_STATE)
+ *     and resolves the requests from then on, queueing them in the meantime.
+ *
+ * The locks of a file are kept in an AVL tree sorted by start, with each node augmented with the
+ * highest end in its subtree (an interval tree), so the locks overlapping a range are found in
+ * O(log n) per lock. Locks of one process never overlap: setting a lock merges it with adjacent
+ * and overlapping locks of the same type and splits the ones of the other type.
+ *
+ * Threads of the leader wait for requests with `thread_wait()` (on their event or user-level
+ * thread scheduler), threads of other processes for the answer to their IPC request. Locks and
+ * requests of a process are dropped when its IPC connection to the leader closes (the process
+ * exited). Deadlocks are not detected, and waiting in non-leader processes is not interrupted by
+ * signals.
+ */
+
+#include <errno.h>
+#include <linux/fcntl.h>
+
+#include "avl_tree.h"
+#include "list.h"
+#include "shim_fs.h"
+#include "shim_fs_lock.h"
+#include "shim_internal.h"
+#include "shim_ipc.h"
+#include "shim_lock.h"
+#include "shim_process.h"
+#include "shim_thread.h"
+
+#define FS_LOCK_QUEUED 2
+
+struct fs_lock_node {
+    struct avl_tree_node node;
+    struct posix_lock pl;
+    IDTYPE vmid;
+    uint64_t subtree_end; /* highest `end` in the subtree */
+    struct fs_lock_node* next; /* used while updating locks */
+};
+
+DEFINE_LIST(fs_lock_req);
+DEFINE_LISTP(fs_lock_req);
+struct fs_lock_req {
+    LIST_TYPE(fs_lock_req) list;
+    struct posix_lock pl;
+    bool get;
+    bool wait;
+    IDTYPE vmid;
+    /* of the IPC request from `vmid`, or 0 for requests of threads of this process */
+    unsigned long seq;
+    struct shim_thread* thread;
+    bool done;
+    int result;
+    struct posix_lock conflict; /* answer to `get` */
+};
+
+DEFINE_LIST(fs_lock_file);
+DEFINE_LISTP(fs_lock_file);
+struct fs_lock_file {
+    LIST_TYPE(fs_lock_file) list;
+    char* path;
+    /* referenced, NULL if the file was not used by this process (only requests from others) */
+    struct shim_dentry* dent;
+    struct avl_tree locks;
+
+    /* IPC leader: process holding the state instead of us (0 if none) and whether we wait for it
+     * to send the state; requests which can't be answered yet */
+    IDTYPE delegate;
+    bool recalling;
+    LISTP_TYPE(fs_lock_req) pending;
+
+    /* other processes: the leader handed the state over to us; we (may) have locks stored by the
+     * leader */
+    bool leased;
+    bool remote_locks;
+};
+
+static struct shim_lock g_fs_lock_lock;
+static LISTP_TYPE(fs_lock_file) g_fs_lock_files = LISTP_INIT;
+
+static bool is_leader(void) {
+    return !g_process_ipc_ids.leader_vmid;
+}
+
+static struct fs_lock_node* node2lock(struct avl_tree_node* node) {
+    return node ? container_of(node, struct fs_lock_node, node) : NULL;
+}
+
+static bool lock_cmp(struct avl_tree_node* a, struct avl_tree_node* b) {
+    return node2lock(a)->pl.start <= node2lock(b)->pl.start;
+}
+
+static void lock_update(struct avl_tree_node* node) {
+    struct fs_lock_node* l = node2lock(node);
+    l->subtree_end = l->pl.end;
+    if (node->left)
+        l->subtree_end = MAX(l->subtree_end, node2lock(node->left)->subtree_end);
+    if (node->right)
+        l->subtree_end = MAX(l->subtree_end, node2lock(node->right)->subtree_end);
+}
+
+static bool locks_conflict(const struct posix_lock* a, const struct posix_lock* b) {
+    return a->pid != b->pid && (a->type == F_WRLCK || b->type == F_WRLCK);
+}
+
+/* Returns the first lock (by start) in the subtree of `node` that overlaps [`start`, `end`] and
+ * for which `match` returns true. */
+static struct fs_lock_node* search(struct avl_tree_node* node, uint64_t start, uint64_t end,
+                                   bool (*match)(struct fs_lock_node*, void*), void* arg) {
+    if (!node || node2lock(node)->subtree_end < start)
+        return NULL;
+
+    struct fs_lock_node* found = search(node->left, start, end, match, arg);
+    if (found)
+        return found;
+
+    struct fs_lock_node* l = node2lock(node);
+    if (l->pl.start > end)
+        return NULL;
+    if (l->pl.end >= start && match(l, arg))
+        return l;
+
+    return search(node->right, start, end, match, arg);
+}
+
+static bool match_conflict(struct fs_lock_node* l, void* arg) {
+    return locks_conflict(&l->pl, arg);
+}
+
+struct collect_args {
+    IDTYPE pid;
+    struct fs_lock_node* list;
+    struct fs_lock_node** tail;
+};
+
+static bool match_collect(struct fs_lock_node* l, void* arg) {
+    struct collect_args* args = arg;
+    if (l->pl.pid == args->pid) {
+        l->next = NULL;
+        *args->tail = l;
+        args->tail = &l->next;
+    }
+    return false;
+}
+
+static struct fs_lock_node* find_conflict(struct fs_lock_file* file, const struct posix_lock* pl) {
+    return search(file->locks.root, pl->start, pl->end, match_conflict, (void*)pl);
+}
+
+static void insert_lock(struct fs_lock_file* file, struct fs_lock_node* l) {
+    avl_tree_insert(&file->locks, &l->node);
+}
+
+static void delete_lock(struct fs_lock_file* file, struct fs_lock_node* l) {
+    avl_tree_delete(&file->locks, &l->node);
+}
+
+/* Sets (or with F_UNLCK, removes) the lock `pl` of process `pl->pid` (`vmid`), replacing the
+ * process' locks in the range. Conflicts must be checked by the caller. */
+static int apply_lock(struct fs_lock_file* file, const struct posix_lock* pl, IDTYPE vmid) {
+    assert(locked(&g_fs_lock_lock));
+
+    /* allocate up front, so that we don't fail halfway: at most one existing lock is split */
+    struct fs_lock_node* new = NULL;
+    if (pl->type != F_UNLCK) {
+        new = malloc(sizeof(*new));
+        if (!new)
+            return -ENOMEM;
+    }
+    struct fs_lock_node* split = malloc(sizeof(*split));
+    if (!split) {
+        free(new);
+        return -ENOMEM;
+    }
+
+    uint64_t start = pl->start;
+    uint64_t end = pl->end;
+
+    /* the locks of the process overlapping or adjacent to the range */
+    struct collect_args args = { .pid = pl->pid, .list = NULL, .tail = &args.list };
+    search(file->locks.root, start ? start - 1 : 0, end == FS_LOCK_EOF ? end : end + 1,
+           match_collect, &args);
+
+    struct fs_lock_node* next;
+    for (struct fs_lock_node* l = args.list; l; l = next) {
+        next = l->next;
+        if (l->pl.type == pl->type) {
+            start = MIN(start, l->pl.start);
+            end = MAX(end, l->pl.end);
+            delete_lock(file, l);
+            free(l);
+            continue;
+        }
+        if (l->pl.start > end || l->pl.end < start) {
+            /* adjacent lock of the other type */
+            continue;
+        }
+
+        if (l->pl.start < start && l->pl.end > end) {
+            split->pl = l->pl;
+            split->pl.start = end + 1;
+            split->vmid = l->vmid;
+            insert_lock(file, split);
+            split = NULL;
+            l->pl.end = start - 1;
+            avl_tree_update_path(&file->locks, &l->node);
+        } else if (l->pl.start < start) {
+            l->pl.end = start - 1;
+            avl_tree_update_path(&file->locks, &l->node);
+        } else if (l->pl.end > end) {
+            delete_lock(file, l);
+            l->pl.start = end + 1;
+            insert_lock(file, l);
+        } else {
+            delete_lock(file, l);
+            free(l);
+        }
+    }
+
+    if (new) {
+        new->pl = *pl;
+        new->pl.start = start;
+        new->pl.end = end;
+        new->vmid = vmid;
+        insert_lock(file, new);
+    }
+    free(split);
+    return 0;
+}
+
+static void remove_locks_of_vmid(struct fs_lock_file* file, IDTYPE vmid) {
+    struct avl_tree_node* node = avl_tree_first(&file->locks);
+    while (node) {
+        struct avl_tree_node* next = avl_tree_next(node);
+        struct fs_lock_node* l = node2lock(node);
+        if (l->vmid == vmid) {
+            delete_lock(file, l);
+            free(l);
+        }
+        node = next;
+    }
+}
+
+static struct fs_lock_file* find_file(const char* path) {
+    assert(locked(&g_fs_lock_lock));
+
+    struct fs_lock_file* file;
+    LISTP_FOR_EACH_ENTRY(file, &g_fs_lock_files, list) {
+        if (!strcmp(file->path, path))
+            return file;
+    }
+    return NULL;
+}
+
+static struct fs_lock_file* create_file(const char* path) {
+    assert(locked(&g_fs_lock_lock));
+
+    struct fs_lock_file* file = calloc(1, sizeof(*file));
+    if (!file)
+        return NULL;
+    file->path = strdup(path);
+    if (!file->path) {
+        free(file);
+        return NULL;
+    }
+    file->locks.cmp = lock_cmp;
+    file->locks.update = lock_update;
+    INIT_LISTP(&file->pending);
+    LISTP_ADD(file, &g_fs_lock_files, list);
+    return file;
+}
+
+/* Returns the state of the file of `dent` (creating it if needed), caching it in the dentry. */
+static int get_dentry_file(struct shim_dentry* dent, struct fs_lock_file** out_file) {
+    assert(locked(&g_fs_lock_lock));
+
+    if (dent->fs_lock) {
+        *out_file = dent->fs_lock;
+        return 0;
+    }
+
+    char* path;
+    int ret = dentry_abs_path(dent, &path, /*size=*/NULL);
+    if (ret < 0)
+        return ret;
+
+    struct fs_lock_file* file = find_file(path);
+    if (!file)
+        file = create_file(path);
+    free(path);
+    if (!file)
+        return -ENOMEM;
+
+    if (file->dent) {
+        /* the file was replaced (e.g. renamed over), its old dentry is stale */
+        file->dent->fs_lock = NULL;
+        put_dentry(file->dent);
+    }
+    get_dentry(dent);
+    file->dent = dent;
+    dent->fs_lock = file;
+    *out_file = file;
+    return 0;
+}
+
+/* Frees the state of the file if it's no longer needed. */
+static void maybe_free_file(struct fs_lock_file* file) {
+    assert(locked(&g_fs_lock_lock));
+
+    if (file->locks.root || file->delegate || file->recalling || !LISTP_EMPTY(&file->pending)
+            || file->leased || file->remote_locks)
+        return;
+
+    LISTP_DEL(file, &g_fs_lock_files, list);
+    if (file->dent) {
+        file->dent->fs_lock = NULL;
+        put_dentry(file->dent);
+    }
+    free(file->path);
+    free(file);
+}
+
+/* Answers a request which was queued. */
+static void complete_req(struct fs_lock_file* file, struct fs_lock_req* req, int result) {
+    LISTP_DEL_INIT(req, &file->pending, list);
+
+    if (!req->seq) {
+        req->result = result;
+        req->done = true;
+        thread_wakeup(req->thread);
+        return;
+    }
+
+    int ret = ipc_posix_lock_resp_send(req->vmid, req->seq, result, &req->conflict);
+    if (ret < 0)
+        log_warning("Cannot answer a file lock request of process %u: %d\n", req->vmid, ret);
+    free(req);
+}
+
+/* Tries to answer a request with the state held by the leader; returns FS_LOCK_QUEUED if it has to
+ * wait. */
+static int try_req(struct fs_lock_file* file, struct fs_lock_req* req, bool* changed) {
+    assert(!file->delegate && !file->recalling);
+
+    if (req->get) {
+        struct fs_lock_node* l = find_conflict(file, &req->pl);
+        if (l) {
+            req->conflict = l->pl;
+        } else {
+            req->conflict = req->pl;
+            req->conflict.type = F_UNLCK;
+        }
+        return 0;
+    }
+
+    if (req->pl.type != F_UNLCK && find_conflict(file, &req->pl))
+        return req->wait ? FS_LOCK_QUEUED : -EAGAIN;
+
+    int ret = apply_lock(file, &req->pl, req->vmid);
+    if (ret == 0)
+        *changed = true;
+    return ret;
+}
+
+/* Answers the queued requests which can be answered now. */
+static void process_pending(struct fs_lock_file* file) {
+    assert(!file->delegate);
+    if (file->recalling)
+        return;
+
+    bool changed;
+    do {
+        changed = false;
+        struct fs_lock_req* req;
+        struct fs_lock_req* tmp;
+        LISTP_FOR_EACH_ENTRY_SAFE(req, tmp, &file->pending, list) {
+            int ret = try_req(file, req, &changed);
+            if (ret != FS_LOCK_QUEUED)
+                complete_req(file, req, ret);
+        }
+    } while (changed && !LISTP_EMPTY(&file->pending));
+}
+
+/* Handles a request in the IPC leader; returns its result or FS_LOCK_QUEUED if it was queued (and
+ * will be completed by `complete_req`). */
+static int leader_submit(struct fs_lock_file* file, struct fs_lock_req* req) {
+    assert(locked(&g_fs_lock_lock));
+    assert(is_leader());
+
+    if (file->delegate && file->delegate == req->vmid) {
+        /* the request was sent before the requester got the state */
+        if (req->get) {
+            req->conflict = req->pl;
+            req->conflict.type = F_UNLCK;
+            return 0;
+        }
+        return POSIX_LOCK_LEASED;
+    }
+
+    if (!file->delegate && !file->locks.root && LISTP_EMPTY(&file->pending)
+            && req->vmid != g_self_vmid && !req->get && req->pl.type != F_UNLCK) {
+        /* nobody else uses locks on the file, let the requester resolve its locks itself */
+        file->delegate = req->vmid;
+        return POSIX_LOCK_LEASED;
+    }
+
+    if (file->delegate) {
+        if (!file->recalling) {
+            int ret = ipc_posix_lock_recall_send(file->delegate, file->path);
+            if (ret < 0) {
+                /* the process is gone (and so are its locks) */
+                log_debug("Cannot recall locks on %s from process %u: %d\n", file->path,
+                          file->delegate, ret);
+                file->delegate = 0;
+            } else {
+                file->recalling = true;
+            }
+        }
+        if (file->delegate) {
+            LISTP_ADD_TAIL(req, &file->pending, list);
+            return FS_LOCK_QUEUED;
+        }
+    }
+
+    bool changed = false;
+    int ret = try_req(file, req, &changed);
+    if (ret == FS_LOCK_QUEUED) {
+        LISTP_ADD_TAIL(req, &file->pending, list);
+        return FS_LOCK_QUEUED;
+    }
+    if (changed)
+        process_pending(file);
+    return ret;
+}
+
+/* Handles a request of this process in the IPC leader, waiting for the answer if needed. */
+static int leader_request(struct fs_lock_file* file, struct fs_lock_req* req) {
+    assert(locked(&g_fs_lock_lock));
+
+    req->vmid = g_self_vmid;
+    req->seq = 0;
+    req->thread = get_cur_thread();
+    req->done = false;
+    INIT_LIST_HEAD(req, list);
+
+    thread_prepare_wait();
+    int ret = leader_submit(file, req);
+    if (ret != FS_LOCK_QUEUED)
+        return ret;
+
+    /* only waiting for a conflicting lock can be interrupted, waiting for a recall is short */
+    bool interruptible = req->wait && !file->recalling;
+    while (!req->done) {
+        unlock(&g_fs_lock_lock);
+        ret = thread_wait(/*timeout_us=*/NULL, /*ignore_pending_signals=*/!interruptible);
+        lock(&g_fs_lock_lock);
+        if (req->done)
+            break;
+        if (ret == -EINTR && interruptible) {
+            LISTP_DEL_INIT(req, &file->pending, list);
+            return -ERESTARTSYS;
+        }
+        if (ret < 0 && ret != -EINTR) {
+            LISTP_DEL_INIT(req, &file->pending, list);
+            return ret;
+        }
+        interruptible = req->wait && !file->recalling;
+        thread_prepare_wait();
+    }
+    return req->result;
+}
+
+int init_fs_lock(void) {
+    if (!create_lock(&g_fs_lock_lock))
+        return -ENOMEM;
+    return 0;
+}
+
+int posix_lock_set(struct shim_dentry* dent, const struct posix_lock* pl, bool wait) {
+    lock(&g_fs_lock_lock);
+    struct fs_lock_file* file = NULL;
+    int ret = get_dentry_file(dent, &file);
+    if (ret < 0)
+        goto out;
+
+    if (is_leader()) {
+        struct fs_lock_req req = { .pl = *pl, .wait = wait };
+        ret = leader_request(file, &req);
+        goto out;
+    }
+
+    if (file->leased) {
+        /* all locks on the file are ours, nothing conflicts */
+        ret = apply_lock(file, pl, g_self_vmid);
+        goto out;
+    }
+    if (pl->type == F_UNLCK && !file->remote_locks) {
+        ret = 0;
+        goto out;
+    }
+    if (pl->type != F_UNLCK)
+        file->remote_locks = true;
+
+    char* path = strdup(file->path);
+    if (!path) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    unlock(&g_fs_lock_lock);
+
+    /* a lease is installed by the callback of the answer (see `posix_lock_lease_from_ipc`) */
+    ret = ipc_posix_lock_set_send(path, pl, wait);
+    free(path);
+    if (ret == POSIX_LOCK_LEASED)
+        ret = 0;
+
+    lock(&g_fs_lock_lock);
+    file = dent->fs_lock;
+out:
+    if (file)
+        maybe_free_file(file);
+    unlock(&g_fs_lock_lock);
+    return ret;
+}
+
+int posix_lock_get(struct shim_dentry* dent, const struct posix_lock* pl,
+                   struct posix_lock* out_pl) {
+    lock(&g_fs_lock_lock);
+    struct fs_lock_file* file = NULL;
+    int ret = get_dentry_file(dent, &file);
+    if (ret < 0)
+        goto out;
+
+    if (is_leader()) {
+        struct fs_lock_req req = { .pl = *pl, .get = true };
+        ret = leader_request(file, &req);
+        if (ret == 0)
+            *out_pl = req.conflict;
+        goto out;
+    }
+
+    if (file->leased) {
+        *out_pl = *pl;
+        out_pl->type = F_UNLCK;
+        ret = 0;
+        goto out;
+    }
+
+    char* path = strdup(file->path);
+    if (!path) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    unlock(&g_fs_lock_lock);
+
+    ret = ipc_posix_lock_get_send(path, pl, out_pl);
+    free(path);
+
+    lock(&g_fs_lock_lock);
+    file = dent->fs_lock;
+out:
+    if (file)
+        maybe_free_file(file);
+    unlock(&g_fs_lock_lock);
+    return ret;
+}
+
+void posix_lock_clear_pid(struct shim_dentry* dent) {
+    /* racy check for the common case of files without locks, these are set under the lock of the
+     * handle being closed */
+    if (!__atomic_load_n(&dent->fs_lock, __ATOMIC_RELAXED))
+        return;
+
+    struct posix_lock pl = {
+        .type = F_UNLCK,
+        .start = 0,
+        .end = FS_LOCK_EOF,
+        .pid = g_process.pid,
+    };
+    int ret = posix_lock_set(dent, &pl, /*wait=*/false);
+    if (ret < 0)
+        log_warning("Cannot release file locks on close: %d\n", ret);
+
+    lock(&g_fs_lock_lock);
+    struct fs_lock_file* file = dent->fs_lock;
+    if (file && !is_leader() && !file->leased)
+        file->remote_locks = false;
+    if (file)
+        maybe_free_file(file);
+    unlock(&g_fs_lock_lock);
+}
+
+int posix_lock_set_from_ipc(const char* path, const struct posix_lock* pl, bool wait,
+                            IDTYPE vmid, unsigned long seq) {
+    if (!is_leader())
+        return -EINVAL;
+
+    struct fs_lock_req* req = malloc(sizeof(*req));
+    if (!req)
+        return -ENOMEM;
+    *req = (struct fs_lock_req){ .pl = *pl, .wait = wait, .vmid = vmid, .seq = seq };
+    INIT_LIST_HEAD(req, list);
+
+    lock(&g_fs_lock_lock);
+    struct fs_lock_file* file = find_file(path);
+    if (!file)
+        file = create_file(path);
+    int ret = file ? leader_submit(file, req) : -ENOMEM;
+    if (ret != FS_LOCK_QUEUED) {
+        if (ret >= 0 || ret == -EAGAIN)
+            ret = ipc_posix_lock_resp_send(vmid, seq, ret, &req->conflict);
+        free(req);
+    }
+    if (file)
+        maybe_free_file(file);
+    unlock(&g_fs_lock_lock);
+    return ret == FS_LOCK_QUEUED ? 0 : ret;
+}
+
+int posix_lock_get_from_ipc(const char* path, const struct posix_lock* pl, IDTYPE vmid,
+                            unsigned long seq) {
+    if (!is_leader())
+        return -EINVAL;
+
+    lock(&g_fs_lock_lock);
+    struct fs_lock_file* file = find_file(path);
+    if (!file) {
+        unlock(&g_fs_lock_lock);
+        struct posix_lock conflict = *pl;
+        conflict.type = F_UNLCK;
+        return ipc_posix_lock_resp_send(vmid, seq, 0, &conflict);
+    }
+
+    struct fs_lock_req* req = malloc(sizeof(*req));
+    if (!req) {
+        unlock(&g_fs_lock_lock);
+        return -ENOMEM;
+    }
+    *req = (struct fs_lock_req){ .pl = *pl, .get = true, .vmid = vmid, .seq = seq };
+    INIT_LIST_HEAD(req, list);
+
+    int ret = leader_submit(file, req);
+    if (ret != FS_LOCK_QUEUED) {
+        ret = ipc_posix_lock_resp_send(vmid, seq, ret, &req->conflict);
+        free(req);
+    }
+    maybe_free_file(file);
+    unlock(&g_fs_lock_lock);
+    return ret == FS_LOCK_QUEUED ? 0 : ret;
+}
+
+int posix_lock_lease_from_ipc(const char* path, const struct posix_lock* pl) {
+    lock(&g_fs_lock_lock);
+    struct fs_lock_file* file = find_file(path);
+    if (!file)
+        file = create_file(path);
+    int ret = -ENOMEM;
+    if (file) {
+        /* locks we have stored by the leader were sent back to us with the state (if any) */
+        file->leased = true;
+        file->remote_locks = false;
+        ret = apply_lock(file, pl, g_self_vmid);
+    }
+    unlock(&g_fs_lock_lock);
+    return ret;
+}
+
+void posix_lock_recall_from_ipc(const char* path) {
+    lock(&g_fs_lock_lock);
+    struct fs_lock_file* file = find_file(path);
+
+    size_t count = 0;
+    struct posix_lock* pls = NULL;
+    if (file && file->leased) {
+        for (struct avl_tree_node* node = avl_tree_first(&file->locks); node;
+                node = avl_tree_next(node))
+            count++;
+        if (count) {
+            pls = malloc(count * sizeof(*pls));
+            if (!pls) {
+                log_error("Cannot hand over file locks on %s, dropping them\n", path);
+                count = 0;
+            }
+        }
+
+        size_t i = 0;
+        struct avl_tree_node* node = avl_tree_first(&file->locks);
+        while (node) {
+            struct avl_tree_node* next = avl_tree_next(node);
+            struct fs_lock_node* l = node2lock(node);
+            if (i < count)
+                pls[i++] = l->pl;
+            delete_lock(file, l);
+            free(l);
+            node = next;
+        }
+        file->leased = false;
+        file->remote_locks = count > 0;
+    }
+
+    /* answer even if we don't know the file, the leader waits for it */
+    int ret = ipc_posix_lock_state_send(path, pls, count);
+    if (ret < 0)
+        log_error("Cannot hand over file locks on %s: %d\n", path, ret);
+    free(pls);
+    if (file)
+        maybe_free_file(file);
+    unlock(&g_fs_lock_lock);
+}
+
+void posix_lock_state_from_ipc(const char* path, const struct posix_lock* pls, size_t count,
+                               IDTYPE vmid) {
+    if (!is_leader())
+        return;
+
+    lock(&g_fs_lock_lock);
+    struct fs_lock_file* file = find_file(path);
+    if (!file || file->delegate != vmid) {
+        unlock(&g_fs_lock_lock);
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (apply_lock(file, &pls[i], vmid) < 0)
+            log_error("Cannot take over a file lock on %s, dropping it\n", path);
+    }
+    file->delegate = 0;
+    file->recalling = false;
+    process_pending(file);
+    maybe_free_file(file);
+    unlock(&g_fs_lock_lock);
+}
+
+void posix_lock_clear_vmid(IDTYPE vmid) {
+    if (!is_leader())
+        return;
+
+    lock(&g_fs_lock_lock);
+    struct fs_lock_file* file;
+    struct fs_lock_file* tmp;
+    LISTP_FOR_EACH_ENTRY_SAFE(file, tmp, &g_fs_lock_files, list) {
+        struct fs_lock_req* req;
+        struct fs_lock_req* tmp_req;
+        LISTP_FOR_EACH_ENTRY_SAFE(req, tmp_req, &file->pending, list) {
+            if (req->seq && req->vmid == vmid) {
+                LISTP_DEL_INIT(req, &file->pending, list);
+                free(req);
+            }
+        }
+
+        if (file->delegate == vmid) {
+            file->delegate = 0;
+            file->recalling = false;
+        }
+        if (!file->delegate) {
+            remove_locks_of_vmid(file, vmid);
+            process_pending(file);
+        }
+        maybe_free_file(file);
+    }
+    unlock(&g_fs_lock_lock);
+}
@@ -0,0 +1,119 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * Write buffers, the common part of TCP write coalescing (fs/socket/coalesce.c) and chroot
+ * write-behind (fs/chroot/write_behind.c).
+ *
+ * A write buffer collects small writes to a handle. The first buffered write queues the buffer
+ * (taking a reference to the handle) in the `pending` list of its kind, and arms the async timer of
+ * the kind unless it is armed already. When the timer fires, it takes the whole list and lets the
+ * user flush each buffer (which may queue it again). Writing out the data, and which lock protects
+ * a buffer, are up to the user: sockets may keep unwritten data on EAGAIN, files drop it on errors.
+ */
+
+#include "shim_fs_wbuf.h"
+#include "shim_handle.h"
+#include "shim_internal.h"
+#include "shim_utils.h"
+
+int wbuf_queue_init(struct shim_wbuf_queue* queue, const char* name, uint64_t delay_us,
+                    void (*flush_queued)(struct shim_wbuf* wbuf)) {
+    queue->name         = name;
+    queue->delay_us     = delay_us;
+    queue->flush_queued = flush_queued;
+    INIT_LISTP(&queue->pending);
+    queue->timer_armed = false;
+    queue->writes      = 0;
+    queue->flushes     = 0;
+    queue->bytes       = 0;
+    if (!create_lock(&queue->lock))
+        return -ENOMEM;
+    return 0;
+}
+
+void wbuf_init(struct shim_wbuf* wbuf, struct shim_wbuf_queue* queue, struct shim_handle* hdl,
+               char* data, size_t size) {
+    memset(wbuf, 0, sizeof(*wbuf));
+    wbuf->queue = queue;
+    wbuf->hdl   = hdl;
+    wbuf->data  = data;
+    wbuf->size  = size;
+    INIT_LIST_HEAD(wbuf, list);
+}
+
+static void wbuf_timer_callback(IDTYPE caller, void* arg) {
+    __UNUSED(caller);
+    struct shim_wbuf_queue* queue = arg;
+
+    lock(&queue->lock);
+    LISTP_TYPE(shim_wbuf) pending = queue->pending;
+    INIT_LISTP(&queue->pending);
+    queue->timer_armed = false;
+    unlock(&queue->lock);
+
+    struct shim_wbuf* wbuf;
+    struct shim_wbuf* tmp;
+    LISTP_FOR_EACH_ENTRY_SAFE(wbuf, tmp, &pending, list) {
+        LISTP_DEL_INIT(wbuf, &pending, list);
+        struct shim_handle* hdl = wbuf->hdl;
+        queue->flush_queued(wbuf);
+        put_handle(hdl);
+    }
+}
+
+bool wbuf_queue(struct shim_wbuf* wbuf) {
+    if (wbuf->queued)
+        return true;
+
+    struct shim_wbuf_queue* queue = wbuf->queue;
+    lock(&queue->lock);
+    if (!queue->timer_armed) {
+        int ret = install_async_timer(queue->delay_us, &wbuf_timer_callback, queue,
+                                      /*out_timer=*/NULL);
+        if (ret < 0) {
+            unlock(&queue->lock);
+            log_warning("Cannot arm the %s flush timer: %d\n", queue->name, ret);
+            return false;
+        }
+        queue->timer_armed = true;
+    }
+    get_handle(wbuf->hdl);
+    LISTP_ADD_TAIL(wbuf, &queue->pending, list);
+    wbuf->queued = true;
+    unlock(&queue->lock);
+    return true;
+}
+
+bool wbuf_append(struct shim_wbuf* wbuf, const struct iovec* iov, size_t iov_len, size_t count) {
+    assert(wbuf->len + count <= wbuf->size);
+
+    size_t len = wbuf->len;
+    for (size_t i = 0; i < iov_len; i++) {
+        memcpy(wbuf->data + len, iov[i].iov_base, iov[i].iov_len);
+        len += iov[i].iov_len;
+    }
+    __atomic_store_n(&wbuf->len, len, __ATOMIC_RELAXED);
+    wbuf->writes++;
+    __atomic_add_fetch(&wbuf->queue->writes, 1, __ATOMIC_RELAXED);
+
+    bool queued = wbuf_queue(wbuf);
+    return wbuf->len == wbuf->size || !queued;
+}
+
+void wbuf_flushed(struct shim_wbuf* wbuf, size_t done) {
+    assert(done <= wbuf->len);
+    if (!done)
+        return;
+
+    memmove(wbuf->data, wbuf->data + done, wbuf->len - done);
+    __atomic_store_n(&wbuf->len, wbuf->len - done, __ATOMIC_RELAXED);
+    wbuf->flushes++;
+    wbuf->bytes += done;
+    __atomic_add_fetch(&wbuf->queue->flushes, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&wbuf->queue->bytes, done, __ATOMIC_RELAXED);
+}
+
+void wbuf_flush_all(struct shim_wbuf_queue* queue) {
+    wbuf_timer_callback(/*caller=*/0, queue);
+}
@@ -65,6 +65,8 @@ int check_permissions(struct shim_dentry* dent, mode_t mask) {
  * On failure (including lookup failing with any other error than ENOENT) returns the negative error
  * code, and sets `*found` to NULL.
  */
+static int populate_directory(struct shim_dentry* dent);
+
 static int lookup_dentry(struct shim_dentry* parent, const char* name, size_t name_len,
                          struct shim_dentry** found) {
     assert(locked(&g_dcache_lock));
@@ -81,6 +83,37 @@ static int lookup_dentry(struct shim_dentry* parent, const char* name, size_t na
         }
 
         assert(!(dent->state & DENTRY_VALID));
+        if (parent->mount && parent->mount->immutable && (parent->state & DENTRY_VALID)
+                && parent->type == S_IFDIR
+                && !(parent->state & (DENTRY_LISTED | DENTRY_LISTING))) {
+            /* First miss in a directory of an immutable mount: list the directory now (which also
+             * looks up `dent` if the file exists). The dynamic loader probes its library paths with
+             * open() and stat() and never lists them, so all its later failed probes there are
+             * answered by the branch below. Errors only mean that the directory stays unlisted. */
+            (void)populate_directory(parent);
+        }
+
+        if (dent->state & DENTRY_VALID) {
+            /* found by the listing above */
+        } else if (parent->state & DENTRY_LISTED) {
+            /* The child dentries are the whole listing of the directory (see `populate_directory`),
+             * so the file doesn't exist, there's no need to ask the filesystem. */
+            dent->state |= DENTRY_VALID | DENTRY_NEGATIVE;
+        } else {
+            /* Maybe found (or not found) by the parent process before forking us. */
+            dentry_lookup_snapshot(dent);
+        }
+    } else if ((dent->state & DENTRY_VALID) && (dent->state & DENTRY_NEGATIVE)
+               && dent->mount && dent->mount->negative_ttl_us && !(parent->state & DENTRY_LISTED)
+               && !dentry_negative_cached(dent)) {
+        /* The cached failed lookup expired, ask the filesystem again. */
+        dent->state &= ~(DENTRY_VALID | DENTRY_NEGATIVE);
+    }
+
+    if (dent->mount) {
+        __atomic_add_fetch((dent->state & DENTRY_VALID) ? &dent->mount->lookup_hits
+                                                        : &dent->mount->lookup_misses,
+                           1, __ATOMIC_RELAXED);
     }
 
     if (!(dent->state & DENTRY_VALID)) {
@@ -112,6 +145,11 @@ static int lookup_dentry(struct shim_dentry* parent, const char* name, size_t na
         } else if (ret == -ENOENT) {
             /* File not found, we will return a negative dentry */
             dent->state |= DENTRY_VALID | DENTRY_NEGATIVE;
+            if (dent->mount && dent->mount->negative_ttl_us
+                    && dent->mount->negative_ttl_us != NEGATIVE_TTL_INFINITE
+                    && DkSystemTimeQuery(&dent->negative_time_us) < 0) {
+                dent->negative_time_us = 0;
+            }
         } else {
             /* Lookup failed, keep dentry as invalid (and don't return it to user) */
             goto err;
@@ -555,6 +593,11 @@ static int add_name(const char* name, void* arg) {
  * While `readdir` is callback-based, we don't look up the names inside of callback, but first
  * finish `readdir`. Otherwise, the two filesystem operations (`readdir` and `lookup`) might
  * deadlock.
+ *
+ * On immutable mounts, the directory can change only through this process, which keeps the dcache
+ * up to date (creat, unlink and rename update the child dentries). So once listed, the directory is
+ * marked with DENTRY_LISTED and its child dentries are the listing from then on: names not among
+ * them don't exist (see `lookup_dentry`, which also lists such directories on the first miss).
  */
 static int populate_directory(struct shim_dentry* dent) {
     assert(locked(&g_dcache_lock));
@@ -562,6 +605,9 @@ static int populate_directory(struct shim_dentry* dent) {
     if (dent->state & DENTRY_NEGATIVE)
         return -ENOENT;
 
+    if (dent->state & DENTRY_LISTED)
+        return 0;
+
     if (!dent->fs || !dent->fs->d_ops || !dent->fs->d_ops->readdir)
         return -EINVAL;
 
@@ -569,10 +615,15 @@ static int populate_directory(struct shim_dentry* dent) {
     int ret = dent->fs->d_ops->readdir(dent, &add_name, &ents);
     if (ret < 0)
         log_error("readdir error: %d\n", ret);
+    bool complete = ret == 0;
 
     struct temp_dirent* ent;
     struct temp_dirent* tmp;
 
+    /* the lookups of the names must not start another listing of `dent` */
+    int listing = dent->state & DENTRY_LISTING;
+    dent->state |= DENTRY_LISTING;
+
     LISTP_FOR_EACH_ENTRY(ent, &ents, list) {
         struct shim_dentry* child;
         ret = lookup_dentry(dent, ent->name, ent->name_len, &child);
@@ -587,8 +638,13 @@ static int populate_directory(struct shim_dentry* dent) {
         }
     }
 
+    if (complete && dent->mount && dent->mount->immutable)
+        dent->state |= DENTRY_LISTED;
+
     ret = 0;
 out:
+    if (!listing)
+        dent->state &= ~DENTRY_LISTING;
     LISTP_FOR_EACH_ENTRY_SAFE(ent, tmp, &ents, list) {
         LISTP_DEL(ent, &ents, list);
         free(ent);
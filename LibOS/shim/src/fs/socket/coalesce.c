@@ -0,0 +1,281 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * Coalescing of small writes to TCP sockets (enabled with `sys.net.coalesce_writes`). Chatty
+ * protocols send many tiny messages, and every send is a separate host syscall (an OCALL on SGX).
+ * With coalescing, writes smaller than the buffer size are copied into a per-socket LibOS buffer
+ * and reported as sent. The buffer is flushed with one write to the PAL when:
+ *   - the next write doesn't fit into it,
+ *   - `sys.net.coalesce_delay_us` passed since the first buffered write (by the async worker),
+ *   - the application reads from the same socket (a request-response peer waits for our data),
+ *     unless another thread is flushing it already (see `sock_flush_writes_for_read`),
+ *   - the application sets TCP_NODELAY, shuts down the socket, closes it or exits.
+ * Sockets with TCP_NODELAY set are never coalesced.
+ *
+ * An error from a flush done by the timer is returned by the next write to the socket (the data of
+ * earlier writes is lost then, similar to a connection reset after send() succeeded).
+ *
+ * Per-socket counters are printed (at the debug log level) when the socket is closed, process-wide
+ * ones when the process exits.
+ *
+ * The buffer and its flush timer are the ones of chroot write-behind, see fs/shim_fs_wbuf.c.
+ */
+
+#include "pal.h"
+#include "pal_error.h"
+#include "shim_fs_wbuf.h"
+#include "shim_handle.h"
+#include "shim_internal.h"
+#include "shim_lock.h"
+#include "shim_utils.h"
+
+#define COALESCE_MAX_SIZE (1024 * 1024)
+#define COALESCE_DEFAULT_DELAY_US 100
+
+struct shim_sock_wbuf {
+    struct shim_lock lock;      /* serializes writes and flushes; taken before `hdl->lock` */
+    bool flushing;              /* flush_locked() is writing to the host, read without the lock */
+    int error;                  /* error of a flush by the timer, reported by the next write */
+    struct shim_wbuf buf;
+    char data[];                /* of size `g_coalesce_size` */
+};
+
+static size_t g_coalesce_size = 0;
+static struct shim_wbuf_queue g_queue;
+
+static void flush_queued(struct shim_wbuf* buf);
+
+int init_sock_coalescing(void) {
+    assert(g_manifest_root);
+
+    uint64_t size;
+    int ret = toml_sizestring_in(g_manifest_root, "sys.net.coalesce_writes", /*defaultval=*/0,
+                                 &size);
+    if (ret < 0 || size > COALESCE_MAX_SIZE) {
+        log_error("Cannot parse 'sys.net.coalesce_writes' (the value must be put in double quotes "
+                  "and be at most 1M)\n");
+        return -EINVAL;
+    }
+
+    int64_t delay_us;
+    ret = toml_int_in(g_manifest_root, "sys.net.coalesce_delay_us", COALESCE_DEFAULT_DELAY_US,
+                      &delay_us);
+    if (ret < 0 || delay_us <= 0) {
+        log_error("Cannot parse 'sys.net.coalesce_delay_us' (the value must be a positive "
+                  "number)\n");
+        return -EINVAL;
+    }
+
+    g_coalesce_size = size;
+    if (!g_coalesce_size)
+        return 0;
+
+    return wbuf_queue_init(&g_queue, "socket write", delay_us, &flush_queued);
+}
+
+static bool can_coalesce(struct shim_handle* hdl) {
+    if (!g_coalesce_size || hdl->type != TYPE_SOCK)
+        return false;
+
+    struct shim_sock_handle* sock = &hdl->info.sock;
+    return sock->sock_type == SOCK_STREAM && (sock->domain == AF_INET || sock->domain == AF_INET6)
+           && !__atomic_load_n(&sock->tcp_nodelay, __ATOMIC_RELAXED);
+}
+
+static struct shim_sock_wbuf* get_write_buffer(struct shim_handle* hdl) {
+    struct shim_sock_handle* sock = &hdl->info.sock;
+
+    lock(&hdl->lock);
+    struct shim_sock_wbuf* wbuf = sock->write_buffer;
+    if (!wbuf) {
+        wbuf = calloc(1, sizeof(*wbuf) + g_coalesce_size);
+        if (wbuf && !create_lock(&wbuf->lock)) {
+            free(wbuf);
+            wbuf = NULL;
+        }
+        if (wbuf) {
+            wbuf_init(&wbuf->buf, &g_queue, hdl, wbuf->data, g_coalesce_size);
+            /* read without `hdl->lock` by sock_flush_writes() */
+            __atomic_store_n(&sock->write_buffer, wbuf, __ATOMIC_RELEASE);
+        }
+    }
+    unlock(&hdl->lock);
+    return wbuf;
+}
+
+/* Writes out the buffered data; on a non-blocking socket, may leave some of it in the buffer. */
+static int flush_locked(struct shim_sock_wbuf* wbuf) {
+    assert(locked(&wbuf->lock));
+
+    size_t done = 0;
+    int ret = 0;
+    __atomic_store_n(&wbuf->flushing, true, __ATOMIC_RELAXED);
+    while (done < wbuf->buf.len) {
+        size_t size = wbuf->buf.len - done;
+        ret = DkStreamWrite(wbuf->buf.hdl->pal_handle, 0, &size, wbuf->buf.data + done, NULL);
+        if (ret < 0) {
+            ret = pal_to_unix_errno(ret);
+            if (ret == -EINTR)
+                continue;
+            break;
+        }
+        done += size;
+    }
+    __atomic_store_n(&wbuf->flushing, false, __ATOMIC_RELAXED);
+
+    wbuf_flushed(&wbuf->buf, done);
+    return wbuf->buf.len ? ret : 0;
+}
+
+static void flush_queued(struct shim_wbuf* buf) {
+    struct shim_sock_wbuf* wbuf = container_of(buf, struct shim_sock_wbuf, buf);
+
+    lock(&wbuf->lock);
+    buf->queued = false;
+    int ret = flush_locked(wbuf);
+    if (ret == -EAGAIN) {
+        /* non-blocking socket with a full send buffer, retry later (if the timer can't be armed,
+         * the next write or read flushes) */
+        wbuf_queue(buf);
+    } else if (ret < 0) {
+        wbuf->error = -ret;
+        buf->len = 0;
+    }
+    unlock(&wbuf->lock);
+}
+
+bool sock_coalesce_write(struct shim_handle* hdl, const struct iovec* iov, size_t iov_len,
+                         size_t count, ssize_t* out_ret) {
+    if (!count || !can_coalesce(hdl))
+        return false;
+
+    struct shim_sock_wbuf* wbuf = get_write_buffer(hdl);
+    if (!wbuf)
+        return false;
+
+    ssize_t ret;
+    lock(&wbuf->lock);
+
+    if (wbuf->error) {
+        ret = -wbuf->error;
+        wbuf->error = 0;
+        goto out;
+    }
+
+    if (count >= wbuf->buf.size) {
+        /* too big to coalesce, but has to go out after the data already buffered */
+        if (!wbuf->buf.len) {
+            unlock(&wbuf->lock);
+            return false;
+        }
+        ret = flush_locked(wbuf);
+        if (ret < 0)
+            goto out;
+
+        size_t size = count;
+        ret = DkStreamWritev(hdl->pal_handle, 0, (const PAL_IOVEC*)iov, iov_len, &size);
+        ret = ret < 0 ? pal_to_unix_errno(ret) : (ssize_t)size;
+        goto out;
+    }
+
+    if (wbuf->buf.len + count > wbuf->buf.size) {
+        ret = flush_locked(wbuf);
+        if (wbuf->buf.len + count > wbuf->buf.size) {
+            /* non-blocking socket which can't take the buffered data yet (or an error) */
+            goto out;
+        }
+    }
+
+    ret = count;
+    if (wbuf_append(&wbuf->buf, iov, iov_len, count)) {
+        /* on -EAGAIN, the rest stays buffered until the timer (or the next write) */
+        int flush_ret = flush_locked(wbuf);
+        if (flush_ret < 0 && flush_ret != -EAGAIN) {
+            wbuf->buf.len = 0;
+            ret = flush_ret;
+        }
+    }
+
+out:
+    unlock(&wbuf->lock);
+    *out_ret = ret;
+    return true;
+}
+
+int sock_flush_writes(struct shim_handle* hdl) {
+    if (hdl->type != TYPE_SOCK)
+        return 0;
+
+    struct shim_sock_wbuf* wbuf = __atomic_load_n(&hdl->info.sock.write_buffer, __ATOMIC_ACQUIRE);
+    if (!wbuf)
+        return 0;
+
+    lock(&wbuf->lock);
+    int ret = wbuf->buf.len ? flush_locked(wbuf) : 0;
+    unlock(&wbuf->lock);
+    return ret;
+}
+
+void sock_flush_writes_for_read(struct shim_handle* hdl) {
+    if (hdl->type != TYPE_SOCK)
+        return;
+
+    struct shim_sock_wbuf* wbuf = __atomic_load_n(&hdl->info.sock.write_buffer, __ATOMIC_ACQUIRE);
+    if (!wbuf)
+        return;
+
+    /* A thread in flush_locked() may be blocked in the host on a full send buffer; the data is on
+     * its way to the peer then, and waiting for `wbuf->lock` would only stall the reader. A write
+     * racing with these checks arms the timer itself. */
+    if (!__atomic_load_n(&wbuf->buf.len, __ATOMIC_RELAXED)
+            || __atomic_load_n(&wbuf->flushing, __ATOMIC_RELAXED))
+        return;
+
+    lock(&wbuf->lock);
+    if (wbuf->buf.len)
+        flush_locked(wbuf);
+    unlock(&wbuf->lock);
+}
+
+void sock_set_nodelay(struct shim_handle* hdl, bool nodelay) {
+    assert(hdl->type == TYPE_SOCK);
+    if (nodelay)
+        sock_flush_writes(hdl);
+    __atomic_store_n(&hdl->info.sock.tcp_nodelay, nodelay, __ATOMIC_RELAXED);
+}
+
+void sock_free_write_buffer(struct shim_handle* hdl) {
+    assert(hdl->type == TYPE_SOCK);
+    struct shim_sock_wbuf* wbuf = hdl->info.sock.write_buffer;
+    if (!wbuf)
+        return;
+
+    /* the timer holds a reference to the handle, so the buffer can't be queued here */
+    assert(!wbuf->buf.queued);
+    if (wbuf->buf.len) {
+        lock(&wbuf->lock);
+        flush_locked(wbuf);
+        unlock(&wbuf->lock);
+    }
+
+    log_debug("socket: coalesced %lu writes into %lu flushes (%lu bytes)\n", wbuf->buf.writes,
+              wbuf->buf.flushes, wbuf->buf.bytes);
+
+    hdl->info.sock.write_buffer = NULL;
+    destroy_lock(&wbuf->lock);
+    free(wbuf);
+}
+
+void sock_flush_all_writes(void) {
+    if (!g_coalesce_size)
+        return;
+
+    /* the async worker is stopped at this point, so do the work of a (last) timer here */
+    wbuf_flush_all(&g_queue);
+
+    log_debug("socket write coalescing: %lu writes coalesced into %lu flushes (%lu bytes)\n",
+              __atomic_load_n(&g_queue.writes, __ATOMIC_RELAXED),
+              __atomic_load_n(&g_queue.flushes, __ATOMIC_RELAXED),
+              __atomic_load_n(&g_queue.bytes, __ATOMIC_RELAXED));
+}
@@ -20,13 +20,184 @@
 #include "shim_signal.h"
 #include "stat.h"
 
+/* In-LibOS socketpairs (see `struct shim_pipe_ring`): `ring_in` of one end is `ring_out` of the
+ * other one. */
+bool sock_ring_readv(struct shim_handle* hdl, const struct iovec* iov, size_t iov_len,
+                     size_t count, bool nonblocking, bool peek, ssize_t* out_ret) {
+    struct shim_pipe_ring* ring = get_pipe_ring(hdl, &hdl->info.sock.ring_in);
+    if (!ring)
+        return false;
+
+    bool migrated = false;
+    ssize_t ret = pipe_ring_readv(ring, iov, iov_len, count, nonblocking, peek, &migrated);
+    put_pipe_ring(ring);
+    if (migrated)
+        return false;
+
+    maybe_epoll_et_trigger(hdl, ret < 0 ? (int)ret : 0, /*in=*/true,
+                           ret >= 0 ? (size_t)ret < count : false);
+    *out_ret = ret;
+    return true;
+}
+
+bool sock_ring_writev(struct shim_handle* hdl, const struct iovec* iov, size_t iov_len,
+                      size_t count, bool nonblocking, ssize_t* out_ret) {
+    struct shim_pipe_ring* ring = get_pipe_ring(hdl, &hdl->info.sock.ring_out);
+    if (!ring)
+        return false;
+
+    bool migrated = false;
+    ssize_t ret = pipe_ring_writev(ring, iov, iov_len, count, nonblocking, &migrated);
+    put_pipe_ring(ring);
+    if (migrated)
+        return false;
+
+    maybe_epoll_et_trigger(hdl, ret < 0 ? (int)ret : 0, /*in=*/false,
+                           ret >= 0 ? (size_t)ret < count : false);
+    *out_ret = ret;
+    return true;
+}
+
+static bool sock_ring_poll(struct shim_handle* hdl, int poll_type, off_t* out_ret) {
+    struct shim_pipe_ring* ring_in  = get_pipe_ring(hdl, &hdl->info.sock.ring_in);
+    struct shim_pipe_ring* ring_out = get_pipe_ring(hdl, &hdl->info.sock.ring_out);
+
+    bool migrated = !ring_in || !ring_out;
+    off_t ret = 0;
+    if (!migrated) {
+        if (poll_type == FS_POLL_SZ) {
+            ret = pipe_ring_poll(ring_in, FS_POLL_SZ, &migrated);
+        } else {
+            /* errors (the peer is gone) are reported by the incoming direction */
+            ret = pipe_ring_poll(ring_in, poll_type & ~FS_POLL_WR, &migrated);
+            if (poll_type & FS_POLL_WR)
+                ret |= pipe_ring_poll(ring_out, FS_POLL_WR, &migrated) & FS_POLL_WR;
+        }
+    }
+
+    if (ring_in)
+        put_pipe_ring(ring_in);
+    if (ring_out)
+        put_pipe_ring(ring_out);
+    if (migrated)
+        return false;
+
+    *out_ret = ret;
+    return true;
+}
+
+void sock_ring_shutdown(struct shim_handle* hdl, bool rd, bool wr) {
+    struct shim_pipe_ring* ring_in  = get_pipe_ring(hdl, &hdl->info.sock.ring_in);
+    struct shim_pipe_ring* ring_out = get_pipe_ring(hdl, &hdl->info.sock.ring_out);
+
+    /* the peer sees EOF or EPIPE, like after shutdown() of a host socket */
+    if (ring_in) {
+        if (rd)
+            pipe_ring_shutdown(ring_in, /*rd=*/true);
+        put_pipe_ring(ring_in);
+    }
+    if (ring_out) {
+        if (wr)
+            pipe_ring_shutdown(ring_out, /*rd=*/false);
+        put_pipe_ring(ring_out);
+    }
+}
+
+/* Move both directions of the socketpair of `hdl` to a host socketpair, see `migrate_pipe_ring`. */
+int migrate_sock_rings(struct shim_handle* hdl) {
+    struct shim_pipe_ring* ring_in  = get_pipe_ring(hdl, &hdl->info.sock.ring_in);
+    struct shim_pipe_ring* ring_out = get_pipe_ring(hdl, &hdl->info.sock.ring_out);
+    if (!ring_in || !ring_out) {
+        /* both rings are always migrated together */
+        assert(!ring_in && !ring_out);
+        return 0;
+    }
+
+    int ret = 0;
+    struct shim_handle* host_in  = get_new_handle(); /* host end of `hdl` */
+    struct shim_handle* host_out = get_new_handle(); /* host end of the peer */
+    if (!host_in || !host_out) {
+        ret = -ENOMEM;
+        goto out_put;
+    }
+
+    /* both ends may be migrated at the same time (e.g. by two threads forking) */
+    struct shim_pipe_ring* first  = ring_in < ring_out ? ring_in : ring_out;
+    struct shim_pipe_ring* second = ring_in < ring_out ? ring_out : ring_in;
+    lock(&first->lock);
+    lock(&second->lock);
+    if (ring_in->migrated)
+        goto out;
+
+    char name[PIPE_URI_SIZE];
+    ret = create_pipes(host_in, host_out, /*flags=*/0, name, &host_in->uri);
+    if (ret < 0)
+        goto out;
+    qstrcopy(&host_out->uri, &host_in->uri);
+
+    /* data to be read by `hdl` is written by the peer, and vice versa */
+    ret = pipe_ring_migrate_locked(ring_in, host_out->pal_handle);
+    if (ret < 0)
+        goto out;
+    ret = pipe_ring_migrate_locked(ring_out, host_in->pal_handle);
+    if (ret < 0)
+        goto out;
+
+    /* replay shutdowns; the reader of `ring_in` is this end, the reader of `ring_out` the peer */
+    if (ring_in->shut_rd)
+        DkStreamDelete(host_in->pal_handle, PAL_DELETE_RD);
+    if (ring_out->shut_wr)
+        DkStreamDelete(host_in->pal_handle, PAL_DELETE_WR);
+    if (ring_out->shut_rd)
+        DkStreamDelete(host_out->pal_handle, PAL_DELETE_RD);
+    if (ring_in->shut_wr)
+        DkStreamDelete(host_out->pal_handle, PAL_DELETE_WR);
+
+    /* a closed end is represented by the temporary handle, which closes its host end below */
+    struct shim_handle* ends[2]      = { ring_in->reader, ring_out->reader };
+    struct shim_handle* host_ends[2] = { host_in, host_out };
+    for (size_t i = 0; i < ARRAY_SIZE(ends); i++) {
+        if (!ends[i])
+            continue;
+        memcpy(ends[i]->info.sock.addr.un.name, name, sizeof(ends[i]->info.sock.addr.un.name));
+        move_handle_to_host(ends[i], host_ends[i]);
+    }
+
+    log_debug("in-LibOS socketpair %p/%p moved to host pipe %s\n", ring_in, ring_out, name);
+
+out:
+    unlock(&second->lock);
+    unlock(&first->lock);
+out_put:
+    if (host_in)
+        put_handle(host_in);
+    if (host_out)
+        put_handle(host_out);
+    if (ring_in)
+        put_pipe_ring(ring_in);
+    if (ring_out)
+        put_pipe_ring(ring_out);
+    return ret;
+}
+
 static int socket_close(struct shim_handle* hdl) {
-    /* XXX: Shouldn't this do something? */
-    __UNUSED(hdl);
+    sock_free_write_buffer(hdl);
+
+    struct shim_sock_handle* sock = &hdl->info.sock;
+    struct shim_pipe_ring* rings[2] = { sock->ring_in, sock->ring_out };
+    for (size_t i = 0; i < ARRAY_SIZE(rings); i++) {
+        if (!rings[i])
+            continue;
+        pipe_ring_close_end(rings[i], hdl);
+        put_pipe_ring(rings[i]);
+    }
+    sock->ring_in  = NULL;
+    sock->ring_out = NULL;
     return 0;
 }
 
-static ssize_t socket_read(struct shim_handle* hdl, void* buf, size_t count) {
+static ssize_t socket_readv(struct shim_handle* hdl, const struct iovec* iov, size_t iov_len,
+                            size_t count) {
     assert(hdl->type == TYPE_SOCK);
     struct shim_sock_handle* sock = &hdl->info.sock;
 
@@ -48,10 +219,22 @@ static ssize_t socket_read(struct shim_handle* hdl, void* buf, size_t count) {
 
     unlock(&hdl->lock);
 
-    size_t orig_count = count;
-    int ret = DkStreamRead(hdl->pal_handle, 0, &count, buf, NULL, 0);
-    ret = pal_to_unix_errno(ret);
-    maybe_epoll_et_trigger(hdl, ret, /*in=*/true, ret == 0 ? count < orig_count : false);
+    int ret;
+    ssize_t ring_ret;
+    if (sock_ring_readv(hdl, iov, iov_len, count, hdl->flags & O_NONBLOCK, /*peek=*/false,
+                        &ring_ret)) {
+        ret = ring_ret < 0 ? ring_ret : 0;
+        if (ring_ret >= 0)
+            count = ring_ret;
+    } else {
+        /* the peer may wait for our coalesced writes before it sends anything */
+        sock_flush_writes_for_read(hdl);
+
+        size_t orig_count = count;
+        ret = DkStreamReadv(hdl->pal_handle, 0, (const PAL_IOVEC*)iov, iov_len, &count);
+        ret = pal_to_unix_errno(ret);
+        maybe_epoll_et_trigger(hdl, ret, /*in=*/true, ret == 0 ? count < orig_count : false);
+    }
     if (ret < 0) {
         lock(&hdl->lock);
         sock->error = -ret;
@@ -62,7 +245,13 @@ static ssize_t socket_read(struct shim_handle* hdl, void* buf, size_t count) {
     return (ssize_t)count;
 }
 
-static ssize_t socket_write(struct shim_handle* hdl, const void* buf, size_t count) {
+static ssize_t socket_read(struct shim_handle* hdl, void* buf, size_t count) {
+    struct iovec iov = { .iov_base = buf, .iov_len = count };
+    return socket_readv(hdl, &iov, 1, count);
+}
+
+static ssize_t socket_writev(struct shim_handle* hdl, const struct iovec* iov, size_t iov_len,
+                             size_t count) {
     assert(hdl->type == TYPE_SOCK);
     struct shim_sock_handle* sock = &hdl->info.sock;
 
@@ -85,9 +274,23 @@ static ssize_t socket_write(struct shim_handle* hdl, const void* buf, size_t cou
     unlock(&hdl->lock);
 
     size_t orig_count = count;
-    int ret = DkStreamWrite(hdl->pal_handle, 0, &count, (void*)buf, NULL);
-    ret = pal_to_unix_errno(ret);
-    maybe_epoll_et_trigger(hdl, ret, /*in=*/false, ret == 0 ? count < orig_count : false);
+    int ret;
+    ssize_t done;
+    if (sock_ring_writev(hdl, iov, iov_len, count, hdl->flags & O_NONBLOCK, &done)) {
+        ret = done < 0 ? done : 0;
+        if (done >= 0)
+            count = done;
+    } else {
+        if (sock_coalesce_write(hdl, iov, iov_len, count, &done)) {
+            ret = done < 0 ? done : 0;
+            if (done >= 0)
+                count = done;
+        } else {
+            ret = DkStreamWritev(hdl->pal_handle, 0, (const PAL_IOVEC*)iov, iov_len, &count);
+            ret = pal_to_unix_errno(ret);
+        }
+        maybe_epoll_et_trigger(hdl, ret, /*in=*/false, ret == 0 ? count < orig_count : false);
+    }
     if (ret < 0) {
         if (ret == -EPIPE) {
             siginfo_t info = {
@@ -109,21 +312,30 @@ static ssize_t socket_write(struct shim_handle* hdl, const void* buf, size_t cou
     return (ssize_t)count;
 }
 
+static ssize_t socket_write(struct shim_handle* hdl, const void* buf, size_t count) {
+    struct iovec iov = { .iov_base = (void*)buf, .iov_len = count };
+    return socket_writev(hdl, &iov, 1, count);
+}
+
 static int socket_hstat(struct shim_handle* hdl, struct stat* stat) {
     if (!stat)
         return 0;
 
-    PAL_STREAM_ATTR attr;
+    off_t pending_size;
+    if (!sock_ring_poll(hdl, FS_POLL_SZ, &pending_size)) {
+        PAL_STREAM_ATTR attr;
 
-    int ret = DkStreamAttributesQueryByHandle(hdl->pal_handle, &attr);
-    if (ret < 0) {
-        return pal_to_unix_errno(ret);
+        int ret = DkStreamAttributesQueryByHandle(hdl->pal_handle, &attr);
+        if (ret < 0) {
+            return pal_to_unix_errno(ret);
+        }
+        pending_size = attr.pending_size;
     }
 
     memset(stat, 0, sizeof(struct stat));
 
     stat->st_ino  = 0;
-    stat->st_size = (off_t)attr.pending_size;
+    stat->st_size = pending_size;
     stat->st_mode = S_IFSOCK;
 
     return 0;
@@ -134,6 +346,9 @@ static off_t socket_poll(struct shim_handle* hdl, int poll_type) {
     struct shim_sock_handle* sock = &hdl->info.sock;
     off_t ret = 0;
 
+    if (sock_ring_poll(hdl, poll_type, &ret))
+        return ret;
+
     lock(&hdl->lock);
 
     if (poll_type & FS_POLL_RD) {
@@ -166,13 +381,18 @@ static off_t socket_poll(struct shim_handle* hdl, int poll_type) {
         }
     }
 
-    if (!hdl->pal_handle) {
+    PAL_HANDLE pal_handle = hdl->pal_handle;
+    if (!pal_handle) {
         ret = -EBADF;
         goto out;
     }
 
+    /* the query is a host syscall, don't block send and receive on this socket meanwhile; the PAL
+     * handle stays valid as long as `hdl` */
+    unlock(&hdl->lock);
     PAL_STREAM_ATTR attr;
-    int query_ret = DkStreamAttributesQueryByHandle(hdl->pal_handle, &attr);
+    int query_ret = DkStreamAttributesQueryByHandle(pal_handle, &attr);
+    lock(&hdl->lock);
     if (query_ret < 0) {
         ret = pal_to_unix_errno(query_ret);
         goto out;
@@ -202,7 +422,8 @@ out:
 }
 
 static int socket_setflags(struct shim_handle* hdl, int flags) {
-    if (!hdl->pal_handle)
+    /* in-LibOS socketpairs look at `hdl->flags` directly */
+    if (!hdl->pal_handle || pipe_ring_active(hdl->info.sock.ring_in))
         return 0;
 
     PAL_STREAM_ATTR attr;
@@ -236,6 +457,8 @@ struct shim_fs_ops socket_fs_ops = {
     .close    = &socket_close,
     .read     = &socket_read,
     .write    = &socket_write,
+    .readv    = &socket_readv,
+    .writev   = &socket_writev,
     .hstat    = &socket_hstat,
     .poll     = &socket_poll,
     .setflags = &socket_setflags,
@@ -3,7 +3,7 @@
 
 /*
  * This file contains code for implementation of 'str' filesystem. It is used by pseudo filesystems
- * (/proc, /dev, /sys) and by tmpfs.
+ * (/proc, /dev, /sys).
  */
 
 #include <asm/fcntl.h>
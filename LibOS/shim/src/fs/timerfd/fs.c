@@ -0,0 +1,391 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * This file contains code for implementation of 'timerfd' filesystem.
+ *
+ * The state of a timerfd is kept in LibOS memory (see `struct shim_timerfd_handle`). An armed
+ * timerfd has one pending timer of the async worker (see `install_async_timer`), which accounts the
+ * expirations and wakes up readers and pollers; expirations are also accounted on every access,
+ * so that a late async worker is never visible to the application.
+ *
+ * Async timers hold no reference to the handle: they are cancelled in `timerfd_close`, and
+ * `g_timerfd_lock` (held by timer callbacks for the whole time they use the handle) makes sure a
+ * callback never runs concurrently with the close.
+ */
+
+#include <asm/fcntl.h>
+#include <errno.h>
+
+#include "pal.h"
+#include "pal_error.h"
+#include "shim_fs.h"
+#include "shim_handle.h"
+#include "shim_internal.h"
+#include "shim_lock.h"
+#include "shim_thread.h"
+#include "shim_utils.h"
+
+struct timerfd_timer {
+    struct shim_handle* hdl;
+    struct async_event* event;
+    /* set if `event` couldn't be cancelled anymore, the callback only frees this object */
+    bool cancelled;
+};
+
+struct timerfd_waiter {
+    struct shim_thread* thread;
+    LIST_TYPE(timerfd_waiter) list;
+};
+
+static struct shim_lock g_timerfd_lock;
+
+int init_timerfd(void) {
+    if (!create_lock(&g_timerfd_lock))
+        return -ENOMEM;
+    return 0;
+}
+
+/* Must be called with the handle lock held. */
+static void wake_timerfd_waiters(struct shim_timerfd_handle* tfd) {
+    struct timerfd_waiter* waiter;
+    struct timerfd_waiter* tmp;
+    LISTP_FOR_EACH_ENTRY_SAFE(waiter, tmp, &tfd->waiters, list) {
+        LISTP_DEL_INIT(waiter, &tfd->waiters, list);
+        thread_wakeup(waiter->thread);
+    }
+}
+
+/* Sleep until the timer expires. Must be called with the handle lock held; the lock is released
+ * while sleeping. */
+static int wait_timerfd(struct shim_handle* hdl) {
+    struct shim_timerfd_handle* tfd = &hdl->info.timerfd;
+    struct timerfd_waiter waiter = { .thread = get_cur_thread() };
+
+    thread_prepare_wait();
+    LISTP_ADD_TAIL(&waiter, &tfd->waiters, list);
+    unlock(&hdl->lock);
+
+    int ret = thread_wait(/*timeout_us=*/NULL, /*ignore_pending_signals=*/false);
+
+    lock(&hdl->lock);
+    if (!LIST_EMPTY(&waiter, list)) {
+        /* woken up by a signal, not by an expiration */
+        LISTP_DEL_INIT(&waiter, &tfd->waiters, list);
+    }
+    return ret;
+}
+
+/* Bring the poll event in line with the expirations counter. Must be called with the handle lock
+ * held, after every change of the counter. */
+static void timerfd_changed(struct shim_timerfd_handle* tfd) {
+    if (tfd->expirations)
+        wake_timerfd_waiters(tfd);
+
+    if (!tfd->polled)
+        return;
+
+    bool readable = tfd->expirations > 0;
+    if (readable != tfd->readable_set) {
+        int ret = readable ? set_event(&tfd->readable, 1) : clear_event(&tfd->readable);
+        if (ret < 0) {
+            log_warning("cannot update readable event of a timerfd: %d\n", ret);
+        } else {
+            tfd->readable_set = readable;
+        }
+    }
+}
+
+/* Account the expirations up to `now`. Must be called with the handle lock held. */
+static void timerfd_update(struct shim_timerfd_handle* tfd, uint64_t now) {
+    if (!tfd->next_expire || now < tfd->next_expire)
+        return;
+
+    uint64_t count = 1;
+    if (tfd->interval) {
+        count += (now - tfd->next_expire) / tfd->interval;
+        tfd->next_expire += count * tfd->interval;
+    } else {
+        tfd->next_expire = 0;
+    }
+
+    tfd->expirations += count;
+    timerfd_changed(tfd);
+}
+
+static void timerfd_callback(IDTYPE caller, void* arg);
+
+/* Arm an async timer for the next expiration, unless already armed. Must be called with both
+ * `g_timerfd_lock` and the handle lock held. */
+static int arm_timerfd(struct shim_handle* hdl, uint64_t now) {
+    assert(locked(&g_timerfd_lock) && locked(&hdl->lock));
+    struct shim_timerfd_handle* tfd = &hdl->info.timerfd;
+
+    if (!tfd->next_expire || tfd->timer)
+        return 0;
+
+    struct timerfd_timer* timer = malloc(sizeof(*timer));
+    if (!timer)
+        return -ENOMEM;
+    timer->hdl       = hdl;
+    timer->cancelled = false;
+
+    uint64_t time = tfd->next_expire > now ? tfd->next_expire - now : 1;
+    int ret = install_async_timer(time, &timerfd_callback, timer, &timer->event);
+    if (ret < 0) {
+        free(timer);
+        return ret;
+    }
+
+    tfd->timer = timer;
+    return 0;
+}
+
+/* Must be called with both `g_timerfd_lock` and the handle lock held. */
+static void disarm_timerfd(struct shim_handle* hdl) {
+    assert(locked(&g_timerfd_lock) && locked(&hdl->lock));
+    struct shim_timerfd_handle* tfd = &hdl->info.timerfd;
+
+    struct timerfd_timer* timer = tfd->timer;
+    if (!timer)
+        return;
+
+    if (cancel_async_timer(timer->event)) {
+        free(timer);
+    } else {
+        /* the callback is about to run, waiting for `g_timerfd_lock` */
+        timer->cancelled = true;
+    }
+    tfd->timer = NULL;
+}
+
+static void timerfd_callback(IDTYPE caller, void* arg) {
+    __UNUSED(caller);
+    struct timerfd_timer* timer = arg;
+
+    lock(&g_timerfd_lock);
+    if (timer->cancelled) {
+        unlock(&g_timerfd_lock);
+        free(timer);
+        return;
+    }
+
+    struct shim_handle* hdl = timer->hdl;
+    struct shim_timerfd_handle* tfd = &hdl->info.timerfd;
+
+    uint64_t now = 0;
+    int ret = DkSystemTimeQuery(&now);
+
+    lock(&hdl->lock);
+    assert(tfd->timer == timer);
+    tfd->timer = NULL;
+
+    if (ret < 0) {
+        ret = pal_to_unix_errno(ret);
+    } else {
+        timerfd_update(tfd, now);
+        ret = arm_timerfd(hdl, now);
+    }
+    unlock(&hdl->lock);
+    unlock(&g_timerfd_lock);
+
+    if (ret < 0)
+        log_warning("timerfd: cannot arm the next expiration: %d\n", ret);
+    free(timer);
+}
+
+/* Make sure a timerfd inherited from the parent process (which has no timer yet, see the handle
+ * checkpoint) is armed before somebody waits for it. Must be called with the handle lock held,
+ * which may be released temporarily. */
+static int ensure_timerfd_armed(struct shim_handle* hdl) {
+    struct shim_timerfd_handle* tfd = &hdl->info.timerfd;
+    if (!tfd->next_expire || tfd->timer)
+        return 0;
+
+    int ret;
+    uint64_t now = 0;
+    unlock(&hdl->lock);
+    lock(&g_timerfd_lock);
+    lock(&hdl->lock);
+    ret = DkSystemTimeQuery(&now);
+    if (ret < 0) {
+        ret = pal_to_unix_errno(ret);
+    } else {
+        timerfd_update(tfd, now);
+        ret = arm_timerfd(hdl, now);
+    }
+    unlock(&g_timerfd_lock);
+    return ret;
+}
+
+/* Accounts the expirations up to now. Must be called with the handle lock held. */
+static int timerfd_update_now(struct shim_timerfd_handle* tfd) {
+    uint64_t now = 0;
+    int ret = DkSystemTimeQuery(&now);
+    if (ret < 0)
+        return pal_to_unix_errno(ret);
+    timerfd_update(tfd, now);
+    return 0;
+}
+
+static ssize_t timerfd_read(struct shim_handle* hdl, void* buf, size_t count) {
+    if (count < sizeof(uint64_t))
+        return -EINVAL;
+
+    struct shim_timerfd_handle* tfd = &hdl->info.timerfd;
+    int ret;
+
+    lock(&hdl->lock);
+    while (true) {
+        ret = timerfd_update_now(tfd);
+        if (ret < 0 || tfd->expirations)
+            break;
+
+        if (hdl->flags & O_NONBLOCK) {
+            ret = -EAGAIN;
+            break;
+        }
+
+        if (tfd->next_expire && !tfd->timer) {
+            /* releases the lock, so check the counter again afterwards */
+            ret = ensure_timerfd_armed(hdl);
+            if (ret < 0)
+                break;
+            continue;
+        }
+
+        ret = wait_timerfd(hdl);
+        if (ret < 0)
+            break;
+    }
+
+    if (!ret) {
+        memcpy(buf, &tfd->expirations, sizeof(tfd->expirations));
+        tfd->expirations = 0;
+        timerfd_changed(tfd);
+    }
+    unlock(&hdl->lock);
+
+    maybe_epoll_et_trigger(hdl, ret, /*in=*/true, /*was_partial=*/false);
+    return ret < 0 ? ret : (ssize_t)sizeof(uint64_t);
+}
+
+static off_t timerfd_poll(struct shim_handle* hdl, int poll_type) {
+    struct shim_timerfd_handle* tfd = &hdl->info.timerfd;
+
+    lock(&hdl->lock);
+    off_t ret = timerfd_update_now(tfd);
+    if (!ret) {
+        if (poll_type == FS_POLL_SZ) {
+            ret = tfd->expirations ? sizeof(uint64_t) : 0;
+        } else if ((poll_type & FS_POLL_RD) && tfd->expirations) {
+            ret = FS_POLL_RD;
+        }
+    }
+    unlock(&hdl->lock);
+    return ret;
+}
+
+int timerfd_enable_poll(struct shim_handle* hdl) {
+    assert(hdl->type == TYPE_TIMERFD);
+    struct shim_timerfd_handle* tfd = &hdl->info.timerfd;
+    int ret = 0;
+
+    lock(&hdl->lock);
+    ret = ensure_timerfd_armed(hdl);
+    if (ret < 0 || tfd->polled)
+        goto out;
+
+    ret = create_event(&tfd->readable);
+    if (ret < 0)
+        goto out;
+
+    tfd->polled = true;
+    timerfd_changed(tfd);
+
+    /* the event stays owned by the timerfd, see `timerfd_close` */
+    hdl->pal_handle = event_handle(&tfd->readable);
+
+out:
+    unlock(&hdl->lock);
+    return ret;
+}
+
+int set_timerfd(struct shim_handle* hdl, uint64_t value, uint64_t interval, bool abstime,
+                uint64_t* old_value, uint64_t* old_interval) {
+    assert(hdl->type == TYPE_TIMERFD);
+    struct shim_timerfd_handle* tfd = &hdl->info.timerfd;
+
+    uint64_t now = 0;
+    int ret = DkSystemTimeQuery(&now);
+    if (ret < 0)
+        return pal_to_unix_errno(ret);
+
+    lock(&g_timerfd_lock);
+    lock(&hdl->lock);
+
+    timerfd_update(tfd, now);
+    *old_value    = tfd->next_expire ? tfd->next_expire - now : 0;
+    *old_interval = tfd->interval;
+
+    disarm_timerfd(hdl);
+    tfd->interval    = interval;
+    tfd->next_expire = 0;
+    if (value) {
+        /* an absolute time in the past expires immediately */
+        tfd->next_expire = abstime ? (value > now ? value : now) : now + value;
+        timerfd_update(tfd, now);
+        ret = arm_timerfd(hdl, now);
+    }
+
+    unlock(&hdl->lock);
+    unlock(&g_timerfd_lock);
+    return ret;
+}
+
+int get_timerfd(struct shim_handle* hdl, uint64_t* value, uint64_t* interval) {
+    assert(hdl->type == TYPE_TIMERFD);
+    struct shim_timerfd_handle* tfd = &hdl->info.timerfd;
+
+    uint64_t now = 0;
+    int ret = DkSystemTimeQuery(&now);
+    if (ret < 0)
+        return pal_to_unix_errno(ret);
+
+    lock(&hdl->lock);
+    timerfd_update(tfd, now);
+    *value    = tfd->next_expire ? tfd->next_expire - now : 0;
+    *interval = tfd->interval;
+    unlock(&hdl->lock);
+    return 0;
+}
+
+static int timerfd_close(struct shim_handle* hdl) {
+    struct shim_timerfd_handle* tfd = &hdl->info.timerfd;
+    assert(LISTP_EMPTY(&tfd->waiters));
+
+    lock(&g_timerfd_lock);
+    lock(&hdl->lock);
+    disarm_timerfd(hdl);
+    unlock(&hdl->lock);
+    unlock(&g_timerfd_lock);
+
+    /* the PAL handle (if any) is the `readable` event */
+    hdl->pal_handle = NULL;
+    if (tfd->polled) {
+        destroy_event(&tfd->readable);
+        tfd->polled = false;
+    }
+    return 0;
+}
+
+struct shim_fs_ops timerfd_fs_ops = {
+    .close = &timerfd_close,
+    .read  = &timerfd_read,
+    .poll  = &timerfd_poll,
+};
+
+struct shim_fs timerfd_builtin_fs = {
+    .name   = "timerfd",
+    .fs_ops = &timerfd_fs_ops,
+};
@@ -12,6 +12,8 @@
 #include <asm/unistd.h>
 #include <errno.h>
 
+#include "list.h"
+#include "pal.h"
 #include "perm.h"
 #include "shim_flags_conv.h"
 #include "shim_fs.h"
@@ -19,19 +21,68 @@
 #include "shim_internal.h"
 #include "shim_lock.h"
 #include "shim_utils.h"
+#include "shim_vma.h"
 #include "stat.h"
 
 /*
  * Implementation:
  *
- * The tmpfs file handles are TYPE_STR, and we delegate work to str_* functions. This works because
- * shim_tmpfs_data structure (which is stored with dentries) begins with shim_str_data.
+ * The tmpfs file handles are TYPE_TMPFS and point to shim_tmpfs_data (which is stored with
+ * dentries). The contents of a regular file are kept in pages of TMPFS_PAGE_SIZE bytes, in a radix
+ * tree indexed by page number. Pages are allocated only when written, so appending to a file never
+ * copies the data written so far, and holes of sparse files (and of files extended by truncate)
+ * take no memory; they read as zeros. Truncation frees the pages past the new end of file.
+ *
+ * The memory taken by file pages is accounted to the mount and may be limited with
+ * `fs.mount.<id>.size`; writes which would exceed the limit fail with ENOSPC.
+ *
+ * Mappings of tmpfs files get a copy of the pages (on SGX, enclave memory can't be mapped at two
+ * addresses, so the pages can't be mapped directly), but never involve the host. Shared mappings
+ * are remembered in `mappings` and kept coherent with the pages at file operations touching the
+ * mapped range:
+ *   - read() (and mmap() of the same range) first takes over what the application stored into the
+ *     shared mappings,
+ *   - write() and truncate() copy the new contents into the shared mappings,
+ *   - unmapping a shared mapping (or replacing it with MAP_FIXED) takes over its contents.
+ * Data taken over from one shared mapping is copied into the other ones, so two shared mappings of
+ * the same page see each other's stores after the next such operation (not immediately). A shared
+ * mapping moved by mremap() is not synchronized anymore.
+ *
+ * The tmpfs files are not inherited by child processes: their handles lose the file data, and the
+ * mapped memory is copied.
  */
 
+#define TMPFS_PAGE_SIZE   4096
+#define TMPFS_RADIX_SHIFT 6
+#define TMPFS_RADIX_SLOTS (1 << TMPFS_RADIX_SHIFT)
+
+/* an inner node of the radix tree; slots of the lowest nodes point to pages */
+struct tmpfs_node {
+    void* slots[TMPFS_RADIX_SLOTS];
+};
+
+/* a shared mapping of the file, valid as long as the VMAs at `addr` still map it */
+DEFINE_LIST(tmpfs_mapping);
+struct tmpfs_mapping {
+    LIST_TYPE(tmpfs_mapping) list;
+    char* addr;
+    size_t size;
+    uint64_t offset;
+};
+DEFINE_LISTP(tmpfs_mapping);
+
 struct shim_tmpfs_data {
-    struct shim_str_data str_data;
+    REFTYPE ref_count;
     struct shim_lock lock;
     enum shim_file_type type;
+    struct shim_mount* mount;   /* pages are accounted in `mount->used_size` */
+    /* file contents, protected by `lock`: the tree covers page indices below
+     * TMPFS_RADIX_SLOTS^`height` (nothing if `height` is 0), missing pages are holes */
+    void* root;
+    unsigned int height;
+    size_t pages;
+    off_t size;
+    LISTP_TYPE(tmpfs_mapping) mappings;
     unsigned long atime;
     unsigned long mtime;
     unsigned long ctime;
@@ -58,13 +109,348 @@ static struct shim_tmpfs_data* __create_data(void) {
         free(data);
         return NULL;
     }
+    INIT_LISTP(&data->mappings);
     return data;
 }
 
+static char* lookup_page(struct shim_tmpfs_data* data, uint64_t index) {
+    assert(locked(&data->lock));
+    if (!data->height || index >> (data->height * TMPFS_RADIX_SHIFT))
+        return NULL;
+
+    void* node = data->root;
+    for (unsigned int level = data->height; level > 0 && node; level--) {
+        size_t slot = (index >> ((level - 1) * TMPFS_RADIX_SHIFT)) & (TMPFS_RADIX_SLOTS - 1);
+        node = ((struct tmpfs_node*)node)->slots[slot];
+    }
+    return node;
+}
+
+static int get_or_alloc_page(struct shim_tmpfs_data* data, uint64_t index, char** out_page) {
+    assert(locked(&data->lock));
+    char* page = lookup_page(data, index);
+    if (page) {
+        *out_page = page;
+        return 0;
+    }
+
+    struct shim_mount* mount = data->mount;
+    uint64_t used = __atomic_add_fetch(&mount->used_size, TMPFS_PAGE_SIZE, __ATOMIC_RELAXED);
+    if (mount->size_limit && used > mount->size_limit) {
+        __atomic_sub_fetch(&mount->used_size, TMPFS_PAGE_SIZE, __ATOMIC_RELAXED);
+        return -ENOSPC;
+    }
+
+    /* grow the tree until it covers `index`, the old tree becomes the first subtree */
+    while (!data->height || index >> (data->height * TMPFS_RADIX_SHIFT)) {
+        if (data->root) {
+            struct tmpfs_node* node = calloc(1, sizeof(*node));
+            if (!node)
+                goto out_nomem;
+            node->slots[0] = data->root;
+            data->root = node;
+        }
+        data->height++;
+    }
+
+    void** slot = &data->root;
+    for (unsigned int level = data->height; level > 0; level--) {
+        if (!*slot) {
+            *slot = calloc(1, sizeof(struct tmpfs_node));
+            if (!*slot)
+                goto out_nomem;
+        }
+        size_t i = (index >> ((level - 1) * TMPFS_RADIX_SHIFT)) & (TMPFS_RADIX_SLOTS - 1);
+        slot = &((struct tmpfs_node*)*slot)->slots[i];
+    }
+
+    page = calloc(1, TMPFS_PAGE_SIZE);
+    if (!page)
+        goto out_nomem;
+    *slot = page;
+    data->pages++;
+    *out_page = page;
+    return 0;
+
+out_nomem:
+    __atomic_sub_fetch(&mount->used_size, TMPFS_PAGE_SIZE, __ATOMIC_RELAXED);
+    return -ENOMEM;
+}
+
+/* Frees the pages with indices of at least `first` in the subtree at `*slot`, which is at `level`
+ * (0 for a page) and starts at page index `base`, and the nodes left empty. Returns the number of
+ * freed pages. */
+static size_t free_subtree(void** slot, unsigned int level, uint64_t base, uint64_t first) {
+    if (!*slot)
+        return 0;
+
+    if (level == 0) {
+        if (base < first)
+            return 0;
+        free(*slot);
+        *slot = NULL;
+        return 1;
+    }
+
+    struct tmpfs_node* node = *slot;
+    uint64_t span = 1UL << ((level - 1) * TMPFS_RADIX_SHIFT);
+    size_t freed = 0;
+    bool empty = true;
+    for (size_t i = 0; i < TMPFS_RADIX_SLOTS; i++) {
+        if (base + (i + 1) * span > first)
+            freed += free_subtree(&node->slots[i], level - 1, base + i * span, first);
+        if (node->slots[i])
+            empty = false;
+    }
+
+    if (empty) {
+        free(node);
+        *slot = NULL;
+    }
+    return freed;
+}
+
+static void free_pages_from(struct shim_tmpfs_data* data, uint64_t first) {
+    size_t freed = free_subtree(&data->root, data->height, /*base=*/0, first);
+    data->pages -= freed;
+    __atomic_sub_fetch(&data->mount->used_size, freed * TMPFS_PAGE_SIZE, __ATOMIC_RELAXED);
+    if (!data->root)
+        data->height = 0;
+}
+
+static ssize_t read_pages(struct shim_tmpfs_data* data, char* buf, off_t pos, size_t count) {
+    assert(locked(&data->lock));
+    if (pos >= data->size)
+        return 0;
+
+    count = MIN(count, (size_t)(data->size - pos));
+    size_t done = 0;
+    while (done < count) {
+        uint64_t index = (pos + done) / TMPFS_PAGE_SIZE;
+        size_t page_off = (pos + done) % TMPFS_PAGE_SIZE;
+        size_t len = MIN(TMPFS_PAGE_SIZE - page_off, count - done);
+
+        char* page = lookup_page(data, index);
+        if (page) {
+            memcpy(buf + done, page + page_off, len);
+        } else {
+            memset(buf + done, 0, len);
+        }
+        done += len;
+    }
+    return count;
+}
+
+static ssize_t write_pages(struct shim_tmpfs_data* data, const char* buf, off_t pos,
+                           size_t count) {
+    assert(locked(&data->lock));
+    size_t done = 0;
+    int ret = 0;
+    while (done < count) {
+        uint64_t index = (pos + done) / TMPFS_PAGE_SIZE;
+        size_t page_off = (pos + done) % TMPFS_PAGE_SIZE;
+        size_t len = MIN(TMPFS_PAGE_SIZE - page_off, count - done);
+
+        char* page;
+        ret = get_or_alloc_page(data, index, &page);
+        if (ret < 0)
+            break;
+        memcpy(page + page_off, buf + done, len);
+        done += len;
+    }
+
+    if (!done && ret < 0)
+        return ret;
+    if (pos + (off_t)done > data->size)
+        data->size = pos + done;
+    return done;
+}
+
+static void truncate_pages(struct shim_tmpfs_data* data, off_t len) {
+    assert(locked(&data->lock));
+    if (len < data->size) {
+        free_pages_from(data, ((uint64_t)len + TMPFS_PAGE_SIZE - 1) / TMPFS_PAGE_SIZE);
+
+        /* the rest of the last page must read as zeros if the file is extended again */
+        size_t page_off = len % TMPFS_PAGE_SIZE;
+        char* page = page_off ? lookup_page(data, len / TMPFS_PAGE_SIZE) : NULL;
+        if (page)
+            memset(page + page_off, 0, TMPFS_PAGE_SIZE - page_off);
+    }
+    data->size = len;
+}
+
+static bool is_zero(const char* buf, size_t size) {
+    for (size_t i = 0; i < size; i++)
+        if (buf[i])
+            return false;
+    return true;
+}
+
+/* Takes over the file data in [`pos`, `pos` + `size`) from mapped memory at `mem`. Returns true if
+ * anything changed. */
+static bool pull_memory(struct shim_tmpfs_data* data, const char* mem, uint64_t pos,
+                        size_t size) {
+    assert(locked(&data->lock));
+    /* what the application stores past the end of file is not file data */
+    if (pos >= (uint64_t)data->size)
+        return false;
+    size = MIN(size, data->size - pos);
+
+    bool changed = false;
+    for (size_t done = 0; done < size;) {
+        uint64_t index = (pos + done) / TMPFS_PAGE_SIZE;
+        size_t page_off = (pos + done) % TMPFS_PAGE_SIZE;
+        size_t len = MIN(TMPFS_PAGE_SIZE - page_off, size - done);
+
+        char* page = lookup_page(data, index);
+        if (page ? memcmp(page + page_off, mem + done, len) : !is_zero(mem + done, len)) {
+            if (page || get_or_alloc_page(data, index, &page) == 0) {
+                memcpy(page + page_off, mem + done, len);
+                changed = true;
+            } else {
+                log_warning("tmpfs: cannot save the contents of a shared mapping\n");
+            }
+        }
+        done += len;
+    }
+    return changed;
+}
+
+/* Copies the file data in [`pos`, `pos` + `size`) to mapped memory at `mem`. */
+static void push_memory(struct shim_tmpfs_data* data, char* mem, uint64_t pos, size_t size) {
+    assert(locked(&data->lock));
+    ssize_t ret = read_pages(data, mem, pos, size);
+    assert(ret >= 0);
+    memset(mem + ret, 0, size - ret);
+}
+
+/* Calls `pull_memory` (with `pull`) or `push_memory` on the parts of the shared mappings of the
+ * file that are still mapped and cover the file range [`start`, `end`), and forgets the mappings
+ * which are not mapped anymore. Returns true if `pull_memory` changed anything. */
+static bool visit_mappings(struct shim_tmpfs_data* data, uint64_t start, uint64_t end, bool pull) {
+    assert(locked(&data->lock));
+    bool changed = false;
+
+    struct tmpfs_mapping* map;
+    struct tmpfs_mapping* tmp;
+    LISTP_FOR_EACH_ENTRY_SAFE(map, tmp, &data->mappings, list) {
+        struct shim_vma_info* vmas;
+        size_t count;
+        if (dump_shared_file_vmas(map->addr, map->size, &vmas, &count) < 0)
+            continue;
+
+        bool mapped = false;
+        for (size_t i = 0; i < count; i++) {
+            struct shim_vma_info* vma = &vmas[i];
+            if (vma->file->type != TYPE_TMPFS || vma->file->info.tmpfs.data != data
+                    || vma->file_offset - (uintptr_t)vma->addr
+                       != map->offset - (uintptr_t)map->addr) {
+                /* unmapped and replaced with something else */
+                continue;
+            }
+            mapped = true;
+
+            char* mem_start = MAX(map->addr, (char*)vma->addr);
+            char* mem_end = MIN(map->addr + map->size, (char*)vma->addr + vma->length);
+            uint64_t pos = map->offset + (mem_start - map->addr);
+            uint64_t pos_start = MAX(pos, start);
+            uint64_t pos_end = MIN(pos + (mem_end - mem_start), end);
+            if (pos_start >= pos_end)
+                continue;
+
+            char* mem = mem_start + (pos_start - pos);
+            size_t size = pos_end - pos_start;
+
+            /* the memory may have been stored to before an mprotect() */
+            char* prot_addr = ALLOC_ALIGN_DOWN_PTR(mem);
+            size_t prot_size = ALLOC_ALIGN_UP_PTR(mem + size) - prot_addr;
+            bool accessible = (vma->prot & (PROT_READ | PROT_WRITE)) == (PROT_READ | PROT_WRITE);
+            if (!accessible && DkVirtualMemoryProtect(prot_addr, prot_size,
+                                                      PAL_PROT_READ | PAL_PROT_WRITE) < 0) {
+                log_warning("tmpfs: cannot access a shared mapping\n");
+                continue;
+            }
+
+            if (pull) {
+                changed |= pull_memory(data, mem, pos_start, size);
+            } else {
+                push_memory(data, mem, pos_start, size);
+            }
+
+            if (!accessible && DkVirtualMemoryProtect(prot_addr, prot_size,
+                                                      LINUX_PROT_TO_PAL(vma->prot,
+                                                                        /*map_flags=*/0)) < 0) {
+                BUG();
+            }
+        }
+        free_vma_info_array(vmas, count);
+
+        if (!mapped) {
+            LISTP_DEL(map, &data->mappings, list);
+            free(map);
+        }
+    }
+    return changed;
+}
+
+/* Makes the shared mappings coherent with the pages in the file range [`start`, `end`): with
+ * `pull`, takes over what the application stored into them first. */
+static void sync_mappings(struct shim_tmpfs_data* data, uint64_t start, uint64_t end, bool pull) {
+    assert(locked(&data->lock));
+    if (LISTP_EMPTY(&data->mappings) || start >= end)
+        return;
+
+    if (!pull || visit_mappings(data, start, end, /*pull=*/true))
+        visit_mappings(data, start, end, /*pull=*/false);
+}
+
+/* Forgets [`addr`, `addr` + `size`) of the shared mappings (it's about to be unmapped). */
+static void forget_mappings(struct shim_tmpfs_data* data, char* addr, size_t size) {
+    assert(locked(&data->lock));
+    char* end = addr + size;
+
+    struct tmpfs_mapping* map;
+    struct tmpfs_mapping* tmp;
+    LISTP_FOR_EACH_ENTRY_SAFE(map, tmp, &data->mappings, list) {
+        char* map_end = map->addr + map->size;
+        if (map_end <= addr || end <= map->addr)
+            continue;
+
+        if (map->addr < addr && end < map_end) {
+            /* the range is in the middle, keep the part after it as another mapping */
+            struct tmpfs_mapping* tail = malloc(sizeof(*tail));
+            if (tail) {
+                tail->addr   = end;
+                tail->size   = map_end - end;
+                tail->offset = map->offset + (end - map->addr);
+                LISTP_ADD_AFTER(tail, map, &data->mappings, list);
+            } else {
+                log_warning("tmpfs: cannot keep track of a shared mapping\n");
+            }
+            map->size = addr - map->addr;
+        } else if (map->addr < addr) {
+            map->size = addr - map->addr;
+        } else if (end < map_end) {
+            map->offset += end - map->addr;
+            map->size    = map_end - end;
+            map->addr    = end;
+        } else {
+            LISTP_DEL(map, &data->mappings, list);
+            free(map);
+        }
+    }
+}
+
 static void __destroy_data(struct shim_tmpfs_data* data) {
+    struct tmpfs_mapping* map;
+    struct tmpfs_mapping* tmp;
+    LISTP_FOR_EACH_ENTRY_SAFE(map, tmp, &data->mappings, list) {
+        LISTP_DEL(map, &data->mappings, list);
+        free(map);
+    }
+    free_pages_from(data, /*first=*/0);
     destroy_lock(&data->lock);
-    if (data->str_data.str)
-        free(data->str_data.str);
     free(data);
 }
 
@@ -79,6 +465,7 @@ static int create_data(struct shim_dentry* dent) {
         return -ENOMEM;
 
     data->type = FILE_UNKNOWN;
+    data->mount = dent->mount;
 
     uint64_t time = 0;
     if (DkSystemTimeQuery(&time) < 0) {
@@ -135,23 +522,17 @@ static int tmpfs_open(struct shim_handle* hdl, struct shim_dentry* dent, int fla
         dent->perm = PERM_rwxrwxrwx;
         dent->type = S_IFREG;
         /* always keep data for tmpfs until unlink */
-        REF_INC(data->str_data.ref_count);
+        REF_INC(data->ref_count);
     }
 
     switch (data->type) {
         case FILE_REGULAR:
-            ret = str_open(hdl, dent, flags);
-            if (ret < 0)
-                goto out;
             break;
         case FILE_DIR:
             if (flags & (O_ACCMODE | O_CREAT | O_TRUNC | O_APPEND)) {
                 ret = -EISDIR;
                 goto out;
             }
-            ret = str_open(hdl, dent, flags);
-            if (ret < 0)
-                goto out;
             hdl->is_dir = true;
             break;
         default:
@@ -159,6 +540,12 @@ static int tmpfs_open(struct shim_handle* hdl, struct shim_dentry* dent, int fla
             goto out;
     }
 
+    REF_INC(data->ref_count);
+    hdl->type = TYPE_TMPFS;
+    hdl->info.tmpfs.data = data;
+    hdl->info.tmpfs.pos  = 0;
+    hdl->dentry = dent;
+    hdl->flags = flags;
     hdl->acc_mode = ACC_MODE(flags & O_ACCMODE);
     ret = 0;
 
@@ -172,7 +559,7 @@ static int tmpfs_dput(struct shim_dentry* dent) {
     lock(&dent->lock);
     struct shim_tmpfs_data* tmpfs_data = dent->data;
 
-    if (!tmpfs_data || REF_DEC(tmpfs_data->str_data.ref_count) > 1) {
+    if (!tmpfs_data || REF_DEC(tmpfs_data->ref_count) > 1) {
         unlock(&dent->lock);
         return 0;
     }
@@ -185,15 +572,12 @@ static int tmpfs_dput(struct shim_dentry* dent) {
 }
 
 static int tmpfs_flush(struct shim_handle* hdl) {
-    return str_flush(hdl);
+    /* the data never leaves memory */
+    __UNUSED(hdl);
+    return 0;
 }
 
 static int tmpfs_close(struct shim_handle* hdl) {
-    if (hdl->flags & (O_WRONLY | O_RDWR)) {
-        int ret = tmpfs_flush(hdl);
-        if (ret < 0)
-            return ret;
-    }
     return tmpfs_dput(hdl->dentry);
 }
 
@@ -203,14 +587,23 @@ static ssize_t tmpfs_read(struct shim_handle* hdl, void* buf, size_t count) {
         return -EBADF;
     }
 
-    struct shim_tmpfs_data* tmpfs_data = hdl->dentry->data;
-    assert(tmpfs_data);
+    assert(hdl->type == TYPE_TMPFS);
+    struct shim_tmpfs_data* tmpfs_data = hdl->info.tmpfs.data;
+    if (!tmpfs_data) {
+        /* inherited from the parent process, see `shim_handle.c` */
+        return -EBADF;
+    }
     if (tmpfs_data->type != FILE_REGULAR) {
         return -EISDIR;
     }
 
     lock(&hdl->lock);
-    ssize_t ret = str_read(hdl, buf, count);
+    lock(&tmpfs_data->lock);
+    sync_mappings(tmpfs_data, hdl->info.tmpfs.pos, hdl->info.tmpfs.pos + count, /*pull=*/true);
+    ssize_t ret = read_pages(tmpfs_data, buf, hdl->info.tmpfs.pos, count);
+    unlock(&tmpfs_data->lock);
+    if (ret > 0)
+        hdl->info.tmpfs.pos += ret;
     /* technically, we should update access time here, but we skip this because it could hurt
      * performance on Linux-SGX host */
     unlock(&hdl->lock);
@@ -218,8 +611,16 @@ static ssize_t tmpfs_read(struct shim_handle* hdl, void* buf, size_t count) {
 }
 
 static ssize_t tmpfs_write(struct shim_handle* hdl, const void* buf, size_t count) {
-    struct shim_tmpfs_data* tmpfs_data = hdl->dentry->data;
-    assert(tmpfs_data);
+    if (!(hdl->acc_mode & MAY_WRITE)) {
+        return -EBADF;
+    }
+
+    assert(hdl->type == TYPE_TMPFS);
+    struct shim_tmpfs_data* tmpfs_data = hdl->info.tmpfs.data;
+    if (!tmpfs_data) {
+        /* inherited from the parent process, see `shim_handle.c` */
+        return -EBADF;
+    }
     if (tmpfs_data->type != FILE_REGULAR) {
         return -EISDIR;
     }
@@ -230,38 +631,145 @@ static ssize_t tmpfs_write(struct shim_handle* hdl, const void* buf, size_t coun
     }
 
     lock(&hdl->lock);
-    ssize_t ret = str_write(hdl, buf, count);
+    lock(&tmpfs_data->lock);
+    if (hdl->flags & O_APPEND)
+        hdl->info.tmpfs.pos = tmpfs_data->size;
+
+    off_t pos = hdl->info.tmpfs.pos;
+    ssize_t ret;
+    if (count > (size_t)(INT64_MAX - pos)) {
+        ret = -EFBIG;
+        goto out;
+    }
+
+    ret = write_pages(tmpfs_data, buf, pos, count);
     if (ret < 0) {
         goto out;
     }
+    sync_mappings(tmpfs_data, pos, pos + ret, /*pull=*/false);
 
+    hdl->info.tmpfs.pos += ret;
     tmpfs_data->ctime = time / 1000000;
     tmpfs_data->mtime = tmpfs_data->ctime;
 
 out:
+    unlock(&tmpfs_data->lock);
     unlock(&hdl->lock);
     return ret;
 }
 
-/* TODO: tmpfs_mmap() function is not implemented because shim_do_mmap() and shim_do_munmap()
-   are currently not flexible enough for correct tmpfs implementation. In particular, shim_do_mmap()
-   pre-allocates memory region at a specific address (making it impossible to have two mmaps on the
-   same tmpfs file), and shim_do_munmap() doesn't have a callback into tmpfs at all. */
 static int tmpfs_mmap(struct shim_handle* hdl, void** addr, size_t size, int prot, int flags,
                       uint64_t offset) {
-    __UNUSED(hdl);
-    __UNUSED(addr);
-    __UNUSED(size);
+    assert(hdl->type == TYPE_TMPFS);
+    struct shim_tmpfs_data* tmpfs_data = hdl->info.tmpfs.data;
+    if (!tmpfs_data) {
+        /* inherited from the parent process, see `shim_handle.c` */
+        return -EBADF;
+    }
+    if (tmpfs_data->type != FILE_REGULAR) {
+        return -ENODEV;
+    }
+    if (!*addr) {
+        /* a LibOS-internal buffer without a VMA (see `handle_copy`), which couldn't be kept
+         * coherent; the caller falls back to read() and write() */
+        return -ENOSYS;
+    }
+
+    struct tmpfs_mapping* map = NULL;
+    if (flags & MAP_SHARED) {
+        map = malloc(sizeof(*map));
+        if (!map)
+            return -ENOMEM;
+        map->addr   = *addr;
+        map->size   = size;
+        map->offset = offset;
+    }
+
+    lock(&tmpfs_data->lock);
+    /* take over what was stored into other shared mappings, before the memory is replaced (with
+     * MAP_FIXED, this range may be one of them) */
+    sync_mappings(tmpfs_data, offset, offset + size, /*pull=*/true);
+
+    int ret = DkVirtualMemoryAlloc(addr, size, /*alloc_type=*/0, PAL_PROT_READ | PAL_PROT_WRITE);
+    if (ret < 0) {
+        ret = pal_to_unix_errno(ret);
+        goto out;
+    }
+
+    /* the rest of the fresh memory (past the end of file) reads as zeros */
+    read_pages(tmpfs_data, *addr, offset, size);
+
+    ret = DkVirtualMemoryProtect(*addr, size, LINUX_PROT_TO_PAL(prot, /*map_flags=*/0));
+    if (ret < 0) {
+        if (DkVirtualMemoryFree(*addr, size) < 0)
+            BUG();
+        ret = pal_to_unix_errno(ret);
+        goto out;
+    }
+
+    if (map) {
+        forget_mappings(tmpfs_data, map->addr, map->size);
+        LISTP_ADD(map, &tmpfs_data->mappings, list);
+        map = NULL;
+    }
+    ret = 0;
+out:
+    unlock(&tmpfs_data->lock);
+    free(map);
+    return ret;
+}
+
+static int tmpfs_munmap(struct shim_handle* hdl, void* addr, size_t size, int prot,
+                        uint64_t offset) {
     __UNUSED(prot);
-    __UNUSED(flags);
-    __UNUSED(offset);
+    assert(hdl->type == TYPE_TMPFS);
+    struct shim_tmpfs_data* tmpfs_data = hdl->info.tmpfs.data;
+    if (!tmpfs_data)
+        return 0;
 
-    log_error("tmpfs_mmap(): mmap() function for tmpfs mount type is not implemented.\n");
-    return -ENOSYS;
+    lock(&tmpfs_data->lock);
+    sync_mappings(tmpfs_data, offset, offset + size, /*pull=*/true);
+    forget_mappings(tmpfs_data, addr, size);
+    unlock(&tmpfs_data->lock);
+    return 0;
 }
 
 static off_t tmpfs_seek(struct shim_handle* hdl, off_t offset, int whence) {
-    return str_seek(hdl, offset, whence);
+    assert(hdl->type == TYPE_TMPFS);
+    struct shim_tmpfs_data* tmpfs_data = hdl->info.tmpfs.data;
+    if (!tmpfs_data) {
+        /* inherited from the parent process, see `shim_handle.c` */
+        return -EBADF;
+    }
+
+    off_t ret;
+    lock(&hdl->lock);
+    switch (whence) {
+        case SEEK_SET:
+            ret = offset;
+            break;
+        case SEEK_CUR:
+            ret = hdl->info.tmpfs.pos + offset;
+            break;
+        case SEEK_END:
+            lock(&tmpfs_data->lock);
+            ret = tmpfs_data->size + offset;
+            unlock(&tmpfs_data->lock);
+            break;
+        default:
+            ret = -EINVAL;
+            goto out;
+    }
+
+    if (ret < 0) {
+        ret = -EINVAL;
+        goto out;
+    }
+    hdl->info.tmpfs.pos = ret;
+
+out:
+    unlock(&hdl->lock);
+    return ret;
 }
 
 static int query_dentry(struct shim_dentry* dent, mode_t* mode, struct stat* stat) {
@@ -294,7 +802,10 @@ static int query_dentry(struct shim_dentry* dent, mode_t* mode, struct stat* sta
 
         stat->st_mode  = dent->perm | dent->type;
         stat->st_dev   = 0;
-        stat->st_size  = data->str_data.len;
+        stat->st_size  = data->size;
+        stat->st_blksize = TMPFS_PAGE_SIZE;
+        /* holes take no memory */
+        stat->st_blocks = data->pages * (TMPFS_PAGE_SIZE / 512);
         stat->st_atime = (time_t)data->atime;
         stat->st_mtime = (time_t)data->mtime;
         stat->st_ctime = (time_t)data->ctime;
@@ -412,11 +923,45 @@ static int tmpfs_hstat(struct shim_handle* hdl, struct stat* stat) {
 }
 
 static int tmpfs_truncate(struct shim_handle* hdl, off_t len) {
-    int ret = 0;
-    lock(&hdl->lock);
-    ret = str_truncate(hdl, len);
-    unlock(&hdl->lock);
-    return ret;
+    if (!(hdl->acc_mode & MAY_WRITE))
+        return -EACCES;
+
+    assert(hdl->type == TYPE_TMPFS);
+    struct shim_tmpfs_data* tmpfs_data = hdl->info.tmpfs.data;
+    if (!tmpfs_data) {
+        /* inherited from the parent process, see `shim_handle.c` */
+        return -EBADF;
+    }
+
+    lock(&tmpfs_data->lock);
+    off_t old_len = tmpfs_data->size;
+    truncate_pages(tmpfs_data, len);
+    sync_mappings(tmpfs_data, MIN(old_len, len), MAX(old_len, len), /*pull=*/false);
+    unlock(&tmpfs_data->lock);
+    return 0;
+}
+
+/* Files are sparse (missing pages are holes), so there's nothing to allocate: pages are taken on
+ * first write. */
+static int tmpfs_fallocate(struct shim_handle* hdl, off_t offset, off_t len, bool keep_size) {
+    assert(hdl->type == TYPE_TMPFS);
+    struct shim_tmpfs_data* tmpfs_data = hdl->info.tmpfs.data;
+    if (!tmpfs_data) {
+        /* inherited from the parent process, see `shim_handle.c` */
+        return -EBADF;
+    }
+
+    if (keep_size)
+        return 0;
+
+    lock(&tmpfs_data->lock);
+    off_t old_len = tmpfs_data->size;
+    if (offset + len > old_len) {
+        truncate_pages(tmpfs_data, offset + len);
+        sync_mappings(tmpfs_data, old_len, offset + len, /*pull=*/false);
+    }
+    unlock(&tmpfs_data->lock);
+    return 0;
 }
 
 static int tmpfs_readdir(struct shim_dentry* dent, readdir_callback_t callback, void* arg) {
@@ -476,9 +1021,14 @@ static int tmpfs_unlink(struct shim_dentry* dir, struct shim_dentry* dent) {
 }
 
 static off_t tmpfs_poll(struct shim_handle* hdl, int poll_type) {
-    assert(hdl->type == TYPE_STR);
-    struct shim_str_data* data = hdl->info.str.data;
-    off_t size = data ? data->len : 0;
+    assert(hdl->type == TYPE_TMPFS);
+    struct shim_tmpfs_data* data = hdl->info.tmpfs.data;
+    off_t size = 0;
+    if (data) {
+        lock(&data->lock);
+        size = data->size;
+        unlock(&data->lock);
+    }
 
     if (poll_type == FS_POLL_SZ)
         return size;
@@ -488,7 +1038,12 @@ static off_t tmpfs_poll(struct shim_handle* hdl, int poll_type) {
 
 static int tmpfs_rename(struct shim_dentry* old, struct shim_dentry* new) {
     struct shim_tmpfs_data* tmpfs_data = new->data;
-    assert(tmpfs_data && tmpfs_data->str_data.str == NULL);
+    assert(tmpfs_data && !tmpfs_data->root);
+
+    if (old->mount != new->mount) {
+        /* the pages are accounted to the mount */
+        return -EXDEV;
+    }
 
     uint64_t time = 0;
     if (DkSystemTimeQuery(&time) < 0) {
@@ -536,9 +1091,11 @@ struct shim_fs_ops tmp_fs_ops = {
     .read     = &tmpfs_read,
     .write    = &tmpfs_write,
     .mmap     = &tmpfs_mmap,
+    .munmap   = &tmpfs_munmap,
     .seek     = &tmpfs_seek,
     .hstat    = &tmpfs_hstat,
-    .truncate = &tmpfs_truncate,
+    .truncate  = &tmpfs_truncate,
+    .fallocate = &tmpfs_fallocate,
     .poll     = &tmpfs_poll,
 };
 
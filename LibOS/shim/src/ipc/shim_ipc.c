@@ -12,7 +12,7 @@
 #include <stdbool.h>
 
 #include "assert.h"
-#include "avl_tree.h"
+#include "btree.h"
 #include "pal.h"
 #include "shim_checkpoint.h"
 #include "shim_internal.h"
@@ -22,33 +22,45 @@
 #include "shim_types.h"
 #include "shim_utils.h"
 
+/* Maximal number of messages coalesced into one write. */
+#define IPC_SEND_BATCH_MAX 16
+
+DEFINE_LIST(ipc_send_req);
+DEFINE_LISTP(ipc_send_req);
+/* A message waiting in `shim_ipc_connection::pending` for the sender currently writing. */
+struct ipc_send_req {
+    LIST_TYPE(ipc_send_req) list;
+    struct shim_ipc_msg* msg;
+    bool queued;
+    int ret;
+    bool done;
+};
+
 struct shim_ipc_connection {
-    struct avl_tree_node node;
     IDTYPE vmid;
     REFTYPE ref_count;
     PAL_HANDLE handle;
-    /* This lock guards concurrent accesses to `handle`. If you need both this lock and
-     * `g_ipc_connections_lock`, take the latter first. */
+    /* This lock guards concurrent accesses to `handle`, `writing` and `pending`. If you need both
+     * this lock and `g_ipc_connections_lock`, take the latter first. */
     struct shim_lock lock;
+    /* Set while a sender writes to `handle`. Other senders queue their messages in `pending` and
+     * the writing sender sends them all in its next write. */
+    bool writing;
+    LISTP_TYPE(ipc_send_req) pending;
+    /* Set after each write of the writing sender. Not the thread events of the senders, which may
+     * be already waiting for a response (see `send_ipc_message_with_ack`). */
+    PAL_HANDLE written_event;
+    bool removed;
 };
 
-static bool ipc_connection_cmp(struct avl_tree_node* _a, struct avl_tree_node* _b) {
-    struct shim_ipc_connection* a = container_of(_a, struct shim_ipc_connection, node);
-    struct shim_ipc_connection* b = container_of(_b, struct shim_ipc_connection, node);
-    return a->vmid <= b->vmid;
-}
-
-/* Tree of outgoing IPC connections, to be accessed only with `g_ipc_connections_lock` taken. */
-static struct avl_tree g_ipc_connections = { .cmp = ipc_connection_cmp };
+/* Outgoing IPC connections keyed by `vmid`, to be accessed only with `g_ipc_connections_lock`
+ * taken. */
+static struct btree g_ipc_connections;
 static struct shim_lock g_ipc_connections_lock;
 
-static bool msg_with_ack_cmp(struct avl_tree_node* _a, struct avl_tree_node* _b) {
-    struct shim_ipc_msg_with_ack* a = container_of(_a, struct shim_ipc_msg_with_ack, node);
-    struct shim_ipc_msg_with_ack* b = container_of(_b, struct shim_ipc_msg_with_ack, node);
-    return a->msg.dst == b->msg.dst ? a->msg.seq <= b->msg.seq : a->msg.dst <= b->msg.dst;
-}
-
-static struct avl_tree g_msg_with_ack_tree = { .cmp = msg_with_ack_cmp };
+/* Messages waiting for a response, keyed by `msg.seq` (unique in this process), with
+ * `g_msg_with_ack_tree_lock` taken. */
+static struct btree g_msg_with_ack_tree;
 static struct shim_lock g_msg_with_ack_tree_lock;
 
 IDTYPE g_self_vmid;
@@ -80,24 +92,24 @@ static void put_ipc_connection(struct shim_ipc_connection* conn) {
 
     if (!ref_count) {
         DkObjectClose(conn->handle);
+        DkObjectClose(conn->written_event);
         destroy_lock(&conn->lock);
         free(conn);
     }
 }
 
-static struct shim_ipc_connection* node2conn(struct avl_tree_node* node) {
-    if (!node) {
-        return NULL;
-    }
-    return container_of(node, struct shim_ipc_connection, node);
+static struct shim_ipc_connection* find_ipc_connection(IDTYPE vmid) {
+    assert(locked(&g_ipc_connections_lock));
+    void* conn = NULL;
+    btree_find(&g_ipc_connections, vmid, &conn);
+    return conn;
 }
 
 static int ipc_connect(IDTYPE dest, struct shim_ipc_connection** conn_ptr) {
-    struct shim_ipc_connection dummy = { .vmid = dest };
     int ret = 0;
 
     lock(&g_ipc_connections_lock);
-    struct shim_ipc_connection* conn = node2conn(avl_tree_find(&g_ipc_connections, &dummy.node));
+    struct shim_ipc_connection* conn = find_ipc_connection(dest);
     if (!conn) {
         conn = calloc(1, sizeof(*conn));
         if (!conn) {
@@ -108,13 +120,18 @@ static int ipc_connect(IDTYPE dest, struct shim_ipc_connection** conn_ptr) {
             ret = -ENOMEM;
             goto out;
         }
+        ret = DkEventCreate(&conn->written_event, /*init_signaled=*/false, /*auto_clear=*/false);
+        if (ret < 0) {
+            ret = pal_to_unix_errno(ret);
+            goto out;
+        }
 
         char uri[PIPE_URI_SIZE];
         if (vmid_to_uri(dest, uri, sizeof(uri)) < 0) {
             log_error("buffer for IPC pipe URI too small\n");
             BUG();
         }
-        ret = DkStreamOpen(uri, 0, 0, 0, 0, &conn->handle);
+        ret = DkStreamOpen(uri, 0, 0, 0, PAL_OPTION_PIPE_SHM, &conn->handle);
         if (ret < 0) {
             ret = pal_to_unix_errno(ret);
             goto out;
@@ -124,9 +141,14 @@ static int ipc_connect(IDTYPE dest, struct shim_ipc_connection** conn_ptr) {
             goto out;
         }
 
+        INIT_LISTP(&conn->pending);
         conn->vmid = dest;
         REF_SET(conn->ref_count, 1);
-        avl_tree_insert(&g_ipc_connections, &conn->node);
+        ret = btree_insert(&g_ipc_connections, dest, conn);
+        if (ret < 0) {
+            ret = pal_to_unix_errno(ret);
+            goto out;
+        }
     }
 
     get_ipc_connection(conn);
@@ -142,6 +164,9 @@ out:
         if (conn->handle) {
             DkObjectClose(conn->handle);
         }
+        if (conn->written_event) {
+            DkObjectClose(conn->written_event);
+        }
         free(conn);
     }
     unlock(&g_ipc_connections_lock);
@@ -149,7 +174,12 @@ out:
 }
 
 static void _remove_ipc_connection(struct shim_ipc_connection* conn) {
-    avl_tree_delete(&g_ipc_connections, &conn->node);
+    /* all senders of a failed coalesced write try to remove the connection */
+    if (conn->removed) {
+        return;
+    }
+    conn->removed = true;
+    btree_delete(&g_ipc_connections, conn->vmid);
     put_ipc_connection(conn);
 }
 
@@ -170,9 +200,8 @@ int connect_to_process(IDTYPE dest) {
 }
 
 void remove_outgoing_ipc_connection(IDTYPE dest) {
-    struct shim_ipc_connection dummy = { .vmid = dest };
     lock(&g_ipc_connections_lock);
-    struct shim_ipc_connection* conn = node2conn(avl_tree_find(&g_ipc_connections, &dummy.node));
+    struct shim_ipc_connection* conn = find_ipc_connection(dest);
     if (conn) {
         _remove_ipc_connection(conn);
     }
@@ -194,23 +223,129 @@ void init_ipc_msg_with_ack(struct shim_ipc_msg_with_ack* msg, int code, size_t s
     msg->private = NULL;
 }
 
+static int writev_exact(PAL_HANDLE handle, PAL_IOVEC* iov, size_t iov_count) {
+    while (iov_count) {
+        PAL_NUM written = 0;
+        int ret = DkStreamWritev(handle, /*offset=*/0, iov, iov_count, &written);
+        if (ret < 0) {
+            if (ret == -PAL_ERROR_INTERRUPTED || ret == -PAL_ERROR_TRYAGAIN) {
+                continue;
+            }
+            return pal_to_unix_errno(ret);
+        } else if (written == 0) {
+            return -EPIPE;
+        }
+
+        while (iov_count && written >= iov->size) {
+            written -= iov->size;
+            iov++;
+            iov_count--;
+        }
+        if (written) {
+            iov->buffer = (char*)iov->buffer + written;
+            iov->size -= written;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Send `req` and the messages queued by other senders in the meantime, coalesced into as few
+ * writes as possible. Called with `conn->lock` held and `conn->writing` not set, returns with the
+ * lock held. Returns the result of the write of `req`.
+ */
+static int write_ipc_messages(struct shim_ipc_connection* conn, struct ipc_send_req* req) {
+    static const char padding[IPC_MSG_WIRE_ALIGNMENT] = { 0 };
+    struct ipc_send_req* batch[IPC_SEND_BATCH_MAX];
+    PAL_IOVEC iov[IPC_SEND_BATCH_MAX * 2];
+    int own_ret = 0;
+
+    assert(locked(&conn->lock));
+    conn->writing = true;
+
+    do {
+        size_t cnt = 0;
+        size_t iov_cnt = 0;
+        if (req) {
+            batch[cnt++] = req;
+            req = NULL;
+        }
+        while (cnt < IPC_SEND_BATCH_MAX && !LISTP_EMPTY(&conn->pending)) {
+            struct ipc_send_req* next = LISTP_FIRST_ENTRY(&conn->pending, struct ipc_send_req,
+                                                          list);
+            LISTP_DEL_INIT(next, &conn->pending, list);
+            batch[cnt++] = next;
+        }
+
+        for (size_t i = 0; i < cnt; i++) {
+            struct shim_ipc_msg* msg = batch[i]->msg;
+            iov[iov_cnt++] = (PAL_IOVEC){ .buffer = msg, .size = msg->size };
+            size_t pad = get_ipc_msg_wire_size(msg->size) - msg->size;
+            if (pad) {
+                iov[iov_cnt++] = (PAL_IOVEC){ .buffer = (void*)padding, .size = pad };
+            }
+        }
+
+        DkEventClear(conn->written_event);
+        unlock(&conn->lock);
+        int ret = writev_exact(conn->handle, iov, iov_cnt);
+        if (ret < 0) {
+            log_error("Failed to send IPC msg to %u: %d\n", conn->vmid, ret);
+        } else if (cnt > 1) {
+            log_debug("Sent %zu coalesced IPC messages to %u\n", cnt, conn->vmid);
+        }
+        lock(&conn->lock);
+
+        for (size_t i = 0; i < cnt; i++) {
+            if (!batch[i]->queued) {
+                own_ret = ret;
+                continue;
+            }
+            batch[i]->ret = ret;
+            batch[i]->done = true;
+        }
+        DkEventSet(conn->written_event);
+    } while (!LISTP_EMPTY(&conn->pending));
+
+    conn->writing = false;
+    return own_ret;
+}
+
+/* Does not remove `conn` on failure, this is left to the callers (see `broadcast_ipc`, which holds
+ * `g_ipc_connections_lock`). */
 static int send_ipc_message_to_conn(struct shim_ipc_msg* msg, struct shim_ipc_connection* conn) {
     assert(msg->size >= IPC_MSG_MINIMAL_SIZE);
     msg->src = g_self_vmid;
     log_debug("Sending ipc message to %u\n", conn->vmid);
 
+    struct ipc_send_req req = {
+        .msg = msg,
+        .queued = false,
+        .ret = 0,
+        .done = false,
+    };
+    int ret;
+
     lock(&conn->lock);
 
-    int ret = write_exact(conn->handle, msg,  msg->size);
-    if (ret < 0) {
-        log_error("Failed to send IPC msg to %u: %d\n", conn->vmid, ret);
-        unlock(&conn->lock);
-        remove_ipc_connection(conn);
-        return ret;
+    if (conn->writing) {
+        /* Let the writing sender send our message together with the other queued ones. The event
+         * is set after each write, we may need to wait for several. */
+        req.queued = true;
+        INIT_LIST_HEAD(&req, list);
+        LISTP_ADD_TAIL(&req, &conn->pending, list);
+        while (!req.done) {
+            unlock(&conn->lock);
+            (void)DkEventWait(conn->written_event, /*timeout_us=*/NULL);
+            lock(&conn->lock);
+        }
+        ret = req.ret;
+    } else {
+        ret = write_ipc_messages(conn, &req);
     }
 
     unlock(&conn->lock);
-    return 0;
+    return ret;
 }
 
 int send_ipc_message(struct shim_ipc_msg* msg, IDTYPE dst) {
@@ -221,20 +356,22 @@ int send_ipc_message(struct shim_ipc_msg* msg, IDTYPE dst) {
     }
 
     ret = send_ipc_message_to_conn(msg, conn);
+    if (ret < 0) {
+        remove_ipc_connection(conn);
+    }
     put_ipc_connection(conn);
     return ret;
 }
 
 void ipc_msg_response_handle(IDTYPE src, unsigned long seq,
                              void (*callback)(struct shim_ipc_msg_with_ack*, void*), void* data) {
-    struct shim_ipc_msg_with_ack dummy = {
-        .msg = { .dst = src, .seq = seq }
-    };
     lock(&g_msg_with_ack_tree_lock);
-    struct shim_ipc_msg_with_ack* msg = NULL;
-    struct avl_tree_node* node = avl_tree_find(&g_msg_with_ack_tree, &dummy.node);
-    if (node) {
-        msg = container_of(node, struct shim_ipc_msg_with_ack, node);
+    void* found = NULL;
+    btree_find(&g_msg_with_ack_tree, seq, &found);
+    struct shim_ipc_msg_with_ack* msg = found;
+    if (msg && msg->msg.dst != src) {
+        /* not a response to the message with this sequence number */
+        msg = NULL;
     }
     callback(msg, data);
     unlock(&g_msg_with_ack_tree_lock);
@@ -253,8 +390,13 @@ int send_ipc_message_with_ack(struct shim_ipc_msg_with_ack* msg, IDTYPE dst, uns
     msg->msg.seq = __atomic_add_fetch(&ipc_seq_counter, 1, __ATOMIC_RELAXED);
 
     lock(&g_msg_with_ack_tree_lock);
-    avl_tree_insert(&g_msg_with_ack_tree, &msg->node);
+    ret = btree_insert(&g_msg_with_ack_tree, msg->msg.seq, msg);
     unlock(&g_msg_with_ack_tree_lock);
+    if (ret < 0) {
+        put_thread(msg->thread);
+        msg->thread = NULL;
+        return pal_to_unix_errno(ret);
+    }
 
     ret = send_ipc_message(&msg->msg, dst);
     if (ret < 0)
@@ -277,7 +419,7 @@ int send_ipc_message_with_ack(struct shim_ipc_msg_with_ack* msg, IDTYPE dst, uns
 
 out:
     lock(&g_msg_with_ack_tree_lock);
-    avl_tree_delete(&g_msg_with_ack_tree, &msg->node);
+    btree_delete(&g_msg_with_ack_tree, msg->msg.seq);
     unlock(&g_msg_with_ack_tree_lock);
 
     if (ret == 0) {
@@ -320,17 +462,24 @@ int ipc_dummy_callback(struct shim_ipc_msg* msg, IDTYPE src) {
 
 int broadcast_ipc(struct shim_ipc_msg* msg, IDTYPE exclude_id) {
     lock(&g_ipc_connections_lock);
-    struct shim_ipc_connection* conn = node2conn(avl_tree_first(&g_ipc_connections));
+    struct btree_iter iter;
+    bool found = btree_first(&g_ipc_connections, &iter);
 
     int main_ret = 0;
-    while (conn) {
-        if (conn->vmid != exclude_id) {
+    while (found) {
+        struct shim_ipc_connection* conn = btree_iter_value(&iter);
+        IDTYPE vmid = conn->vmid;
+        if (vmid != exclude_id) {
             int ret = send_ipc_message_to_conn(msg, conn);
+            if (ret < 0) {
+                _remove_ipc_connection(conn);
+            }
             if (!main_ret) {
                 main_ret = ret;
             }
         }
-        conn = node2conn(avl_tree_next(&conn->node));
+        /* removing the connection invalidated `iter` */
+        found = btree_lower_bound(&g_ipc_connections, (uint64_t)vmid + 1, &iter);
     }
 
     unlock(&g_ipc_connections_lock);
@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * This file contains functions and callbacks to handle IPC of POSIX locks, see fs/shim_fs_lock.c.
+ */
+
+#include <errno.h>
+
+#include "shim_fs_lock.h"
+#include "shim_internal.h"
+#include "shim_ipc.h"
+#include "shim_thread.h"
+
+static int posix_lock_send(int code, const char* path, const struct posix_lock* pl, bool wait,
+                           struct posix_lock* out_pl) {
+    IDTYPE dest = g_process_ipc_ids.leader_vmid;
+    assert(dest);
+
+    size_t path_size = strlen(path) + 1;
+    size_t total_msg_size = get_ipc_msg_with_ack_size(sizeof(struct shim_ipc_posix_lock)
+                                                      + path_size);
+    struct shim_ipc_msg_with_ack* msg = __alloca(total_msg_size);
+    init_ipc_msg_with_ack(msg, code, total_msg_size, dest);
+    msg->private = out_pl;
+
+    struct shim_ipc_posix_lock* msgin = (void*)&msg->msg.msg;
+    msgin->pl   = *pl;
+    msgin->wait = wait;
+    memcpy(msgin->path, path, path_size);
+
+    log_debug("ipc send to %u: IPC_MSG_POSIX_LOCK_%s(%s, %d, %lu-%lu%s)\n", dest,
+              code == IPC_MSG_POSIX_LOCK_SET ? "SET" : "GET", path, pl->type, pl->start, pl->end,
+              wait ? ", wait" : "");
+
+    return send_ipc_message_with_ack(msg, dest, NULL);
+}
+
+int ipc_posix_lock_set_send(const char* path, const struct posix_lock* pl, bool wait) {
+    return posix_lock_send(IPC_MSG_POSIX_LOCK_SET, path, pl, wait, /*out_pl=*/NULL);
+}
+
+int ipc_posix_lock_set_callback(struct shim_ipc_msg* msg, IDTYPE src) {
+    struct shim_ipc_posix_lock* msgin = (void*)&msg->msg;
+
+    log_debug("ipc callback from %u: IPC_MSG_POSIX_LOCK_SET(%s, %d, %lu-%lu%s)\n", src,
+              msgin->path, msgin->pl.type, msgin->pl.start, msgin->pl.end,
+              msgin->wait ? ", wait" : "");
+
+    return posix_lock_set_from_ipc(msgin->path, &msgin->pl, msgin->wait, src, msg->seq);
+}
+
+int ipc_posix_lock_get_send(const char* path, const struct posix_lock* pl,
+                            struct posix_lock* out_pl) {
+    return posix_lock_send(IPC_MSG_POSIX_LOCK_GET, path, pl, /*wait=*/false, out_pl);
+}
+
+int ipc_posix_lock_get_callback(struct shim_ipc_msg* msg, IDTYPE src) {
+    struct shim_ipc_posix_lock* msgin = (void*)&msg->msg;
+
+    log_debug("ipc callback from %u: IPC_MSG_POSIX_LOCK_GET(%s, %d, %lu-%lu)\n", src, msgin->path,
+              msgin->pl.type, msgin->pl.start, msgin->pl.end);
+
+    return posix_lock_get_from_ipc(msgin->path, &msgin->pl, src, msg->seq);
+}
+
+int ipc_posix_lock_resp_send(IDTYPE dest, unsigned long seq, int result,
+                             const struct posix_lock* pl) {
+    size_t total_msg_size = get_ipc_msg_size(sizeof(struct shim_ipc_posix_lock_resp));
+    struct shim_ipc_msg* msg = __alloca(total_msg_size);
+    init_ipc_msg(msg, IPC_MSG_POSIX_LOCK_RESP, total_msg_size, dest);
+    msg->seq = seq;
+
+    struct shim_ipc_posix_lock_resp* msgin = (void*)&msg->msg;
+    msgin->result = result;
+    msgin->pl     = *pl;
+
+    log_debug("ipc send to %u: IPC_MSG_POSIX_LOCK_RESP(%d)\n", dest, result);
+
+    return send_ipc_message(msg, dest);
+}
+
+static void posix_lock_resp_callback(struct shim_ipc_msg_with_ack* req_msg, void* data) {
+    if (!req_msg)
+        return;
+
+    struct shim_ipc_posix_lock_resp* resp = data;
+    struct shim_ipc_posix_lock* req = (void*)&req_msg->msg.msg;
+
+    int result = resp->result;
+    if (result == POSIX_LOCK_LEASED) {
+        /* install the state now, before handling a recall which may follow */
+        assert(req_msg->msg.code == IPC_MSG_POSIX_LOCK_SET);
+        result = posix_lock_lease_from_ipc(req->path, &req->pl);
+    }
+
+    struct posix_lock* out_pl = req_msg->private;
+    if (out_pl)
+        *out_pl = resp->pl;
+    req_msg->retval = result;
+
+    assert(req_msg->thread);
+    thread_wakeup(req_msg->thread);
+}
+
+int ipc_posix_lock_resp_callback(struct shim_ipc_msg* msg, IDTYPE src) {
+    struct shim_ipc_posix_lock_resp* msgin = (void*)&msg->msg;
+
+    log_debug("ipc callback from %u: IPC_MSG_POSIX_LOCK_RESP(%d)\n", src, msgin->result);
+
+    ipc_msg_response_handle(src, msg->seq, posix_lock_resp_callback, msgin);
+    return 0;
+}
+
+int ipc_posix_lock_recall_send(IDTYPE dest, const char* path) {
+    size_t path_size = strlen(path) + 1;
+    size_t total_msg_size = get_ipc_msg_size(path_size);
+    struct shim_ipc_msg* msg = __alloca(total_msg_size);
+    init_ipc_msg(msg, IPC_MSG_POSIX_LOCK_RECALL, total_msg_size, dest);
+    memcpy(msg->msg, path, path_size);
+
+    log_debug("ipc send to %u: IPC_MSG_POSIX_LOCK_RECALL(%s)\n", dest, path);
+
+    return send_ipc_message(msg, dest);
+}
+
+int ipc_posix_lock_recall_callback(struct shim_ipc_msg* msg, IDTYPE src) {
+    log_debug("ipc callback from %u: IPC_MSG_POSIX_LOCK_RECALL(%s)\n", src, msg->msg);
+
+    posix_lock_recall_from_ipc(msg->msg);
+    return 0;
+}
+
+int ipc_posix_lock_state_send(const char* path, const struct posix_lock* pls, size_t count) {
+    IDTYPE dest = g_process_ipc_ids.leader_vmid;
+    assert(dest);
+
+    size_t path_size = strlen(path) + 1;
+    size_t total_msg_size = get_ipc_msg_size(sizeof(struct shim_ipc_posix_lock_state)
+                                             + count * sizeof(*pls) + path_size);
+    /* `init_ipc_msg` accounts for the header once more */
+    struct shim_ipc_msg* msg = malloc(get_ipc_msg_size(total_msg_size));
+    if (!msg)
+        return -ENOMEM;
+    init_ipc_msg(msg, IPC_MSG_POSIX_LOCK_STATE, total_msg_size, dest);
+
+    struct shim_ipc_posix_lock_state* msgin = (void*)&msg->msg;
+    msgin->count = count;
+    if (count)
+        memcpy(msgin->locks, pls, count * sizeof(*pls));
+    memcpy(&msgin->locks[count], path, path_size);
+
+    log_debug("ipc send to %u: IPC_MSG_POSIX_LOCK_STATE(%s, %zu)\n", dest, path, count);
+
+    int ret = send_ipc_message(msg, dest);
+    free(msg);
+    return ret;
+}
+
+int ipc_posix_lock_state_callback(struct shim_ipc_msg* msg, IDTYPE src) {
+    struct shim_ipc_posix_lock_state* msgin = (void*)&msg->msg;
+    const char* path = (const char*)&msgin->locks[msgin->count];
+
+    log_debug("ipc callback from %u: IPC_MSG_POSIX_LOCK_STATE(%s, %zu)\n", src, path,
+              msgin->count);
+
+    posix_lock_state_from_ipc(path, msgin->locks, msgin->count, src);
+    return 0;
+}
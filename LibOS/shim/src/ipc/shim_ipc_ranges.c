@@ -16,6 +16,7 @@
 #define BITS (sizeof(char) * 8)
 
 #define INIT_RANGE_MAP_SIZE 32
+#define MAX_LEASE_RANGES    8U
 
 struct idx_bitmap {
     unsigned char map[RANGE_SIZE / BITS];
@@ -306,41 +307,52 @@ failed:
     return err;
 }
 
-static int alloc_ipc_range(IDTYPE owner, IDTYPE* base) {
-    struct range* r = malloc(sizeof(struct range));
-    if (!r)
-        return -ENOMEM;
+/*
+ * Allocates up to `cnt` consecutive ranges for `owner`, at the first gap large enough (or past the
+ * end of the bitmap). Returns the number of ranges allocated, which is less than `cnt` only if
+ * memory ran out on the way.
+ */
+static int alloc_ipc_ranges(IDTYPE owner, IDTYPE cnt, IDTYPE* base) {
+    assert(cnt > 0);
 
-    int ret = 0;
     lock(&range_map_lock);
-    r->owner = 0;
-    IDTYPE i = 0, j = 0;
-
-    if (range_map)
-        for (i = 0; i < range_map->map_size; i++) {
-            unsigned char map = range_map->map[i];
 
-            if (map < 255U) {
-                for (j = 0; j < BITS; map >>= 1, j++)
-                    if (!(map & 1U))
-                        break;
-                assert(j < BITS);
-                break;
+    IDTYPE start = 0;
+    if (range_map) {
+        IDTYPE run = 0;
+        for (IDTYPE off = 0; off < range_map->map_size && run < cnt; off++) {
+            if (__check_range_bitmap(off)) {
+                start = off + 1;
+                run = 0;
+            } else {
+                run++;
             }
         }
-
-    ret = __add_range(r, i * BITS + j, owner);
-    if (ret < 0) {
-        free(r);
-        goto out;
     }
 
-    if (base)
-        *base = (i * BITS + j) * RANGE_SIZE + 1;
+    int ret = 0;
+    IDTYPE allocated = 0;
+    for (; allocated < cnt; allocated++) {
+        struct range* r = malloc(sizeof(struct range));
+        if (!r) {
+            ret = -ENOMEM;
+            break;
+        }
+        r->owner = 0;
+        ret = __add_range(r, start + allocated, owner);
+        if (ret < 0) {
+            free(r);
+            break;
+        }
+    }
 
-out:
     unlock(&range_map_lock);
-    return ret;
+
+    if (!allocated)
+        return ret;
+    if (base)
+        *base = start * RANGE_SIZE + 1;
+    return allocated;
 }
 
 static int get_ipc_range(IDTYPE idx, struct ipc_range* range) {
@@ -487,34 +499,89 @@ out:
     return ret;
 }
 
+/* Number of ranges to lease next time. Each lease doubles it (up to `MAX_LEASE_RANGES`), so that
+ * processes forking many children (e.g. `make -j`) rarely have to ask the leader. */
+static IDTYPE g_lease_ranges_cnt = 1;
+
+static bool __is_range_used(struct range* r) {
+    if (r->owner)
+        return true;
+    if (r->subranges)
+        for (IDTYPE i = 0; i < RANGE_SIZE; i++)
+            if (r->subranges->map[i])
+                return true;
+    return false;
+}
+
+void invalidate_ipc_owner(IDTYPE vmid) {
+    /* the leader is the authority on all ranges, other processes just cache its answers */
+    if (!g_process_ipc_ids.leader_vmid || vmid == g_self_vmid)
+        return;
+
+    lock(&range_map_lock);
+
+    struct range* r;
+    struct range* tmp;
+    LISTP_FOR_EACH_ENTRY_SAFE(r, tmp, &offered_ranges, list) {
+        if (r->subranges)
+            for (IDTYPE i = 0; i < RANGE_SIZE; i++)
+                if (r->subranges->map[i] && r->subranges->map[i]->owner == vmid)
+                    __del_ipc_subrange(&r->subranges->map[i]);
+
+        if (r->owner == vmid)
+            r->owner = 0;
+        if (__is_range_used(r))
+            continue;
+
+        LISTP_DEL(r, &range_table[RANGE_HASH(r->offset)], hlist);
+        LISTP_DEL(r, &offered_ranges, list);
+        noffered--;
+        __set_range_bitmap(r->offset, /*unset=*/true);
+        free(r->used);
+        free(r->subranges);
+        free(r);
+    }
+
+    unlock(&range_map_lock);
+}
+
 int ipc_lease_send(void) {
+    IDTYPE cnt = __atomic_load_n(&g_lease_ranges_cnt, __ATOMIC_RELAXED);
+    if (cnt < MAX_LEASE_RANGES)
+        __atomic_store_n(&g_lease_ranges_cnt, cnt * 2, __ATOMIC_RELAXED);
+
     if (!g_process_ipc_ids.leader_vmid) {
-        return alloc_ipc_range(g_self_vmid, NULL);
+        int ret = alloc_ipc_ranges(g_self_vmid, cnt, NULL);
+        return ret < 0 ? ret : 0;
     }
 
     IDTYPE leader = g_process_ipc_ids.leader_vmid;
 
-    size_t total_msg_size = get_ipc_msg_with_ack_size(0);
+    size_t total_msg_size = get_ipc_msg_with_ack_size(sizeof(struct shim_ipc_lease));
     struct shim_ipc_msg_with_ack* msg = __alloca(total_msg_size);
     init_ipc_msg_with_ack(msg, IPC_MSG_LEASE, total_msg_size, leader);
 
-    log_debug("ipc send to %u: IPC_MSG_LEASE\n", leader);
+    struct shim_ipc_lease* msgin = (void*)&msg->msg.msg;
+    msgin->ranges_cnt = cnt;
+
+    log_debug("ipc send to %u: IPC_MSG_LEASE(%u)\n", leader, cnt);
 
     return send_ipc_message_with_ack(msg, leader, NULL);
 }
 
 int ipc_lease_callback(struct shim_ipc_msg* msg, IDTYPE src) {
-    __UNUSED(src);
-    log_debug("ipc callback from %u: IPC_MSG_LEASE\n", msg->src);
+    struct shim_ipc_lease* msgin = (void*)&msg->msg;
+    log_debug("ipc callback from %u: IPC_MSG_LEASE(%u)\n", msg->src, msgin->ranges_cnt);
 
+    IDTYPE cnt = MIN(MAX(msgin->ranges_cnt, 1U), MAX_LEASE_RANGES);
     IDTYPE base = 0;
 
-    int ret = alloc_ipc_range(msg->src, &base);
+    int ret = alloc_ipc_ranges(msg->src, cnt, &base);
     if (ret < 0)
         goto out;
 
     assert(src == msg->src);
-    ret = ipc_offer_send(msg->src, base, RANGE_SIZE, msg->seq);
+    ret = ipc_offer_send(msg->src, base, ret * RANGE_SIZE, msg->seq);
 
 out:
     return ret;
@@ -539,18 +606,16 @@ int ipc_offer_send(IDTYPE dest, IDTYPE base, IDTYPE size, unsigned long seq) {
 static void msg_add_range(struct shim_ipc_msg_with_ack* req_msg, void* _args) {
     struct shim_ipc_offer* args = _args;
 
-    switch (args->size) {
-        case RANGE_SIZE:
-            add_ipc_range(args->base, g_self_vmid);
-            break;
-        case 1:
-            if (req_msg) {
-                struct shim_ipc_sublease* s = (void*)&req_msg->msg.msg;
-                add_ipc_subrange(s->idx, s->tenant);
-            }
-            break;
-        default:
-            BUG();
+    if (args->size == 1) {
+        if (req_msg) {
+            struct shim_ipc_sublease* s = (void*)&req_msg->msg.msg;
+            add_ipc_subrange(s->idx, s->tenant);
+        }
+    } else {
+        /* leased ranges; without `req_msg`, ranges the leader leased to us on its own */
+        assert(args->size % RANGE_SIZE == 0);
+        for (IDTYPE i = 0; i < args->size / RANGE_SIZE; i++)
+            add_ipc_range(args->base + i * RANGE_SIZE, g_self_vmid);
     }
 
     if (req_msg) {
@@ -564,15 +629,35 @@ int ipc_offer_callback(struct shim_ipc_msg* msg, IDTYPE src) {
 
     log_debug("ipc callback from %u: IPC_MSG_OFFER(%u, %u)\n", msg->src, msgin->base, msgin->size);
 
-    if (msgin->size == RANGE_SIZE || msgin->size == 1) {
+    if (msgin->size == 1 || (msgin->size && msgin->size % RANGE_SIZE == 0
+                             && msgin->size <= MAX_LEASE_RANGES * RANGE_SIZE)) {
         ipc_msg_response_handle(src, msg->seq, msg_add_range, msgin);
     }
     return 0;
 }
 
+/*
+ * Leases a range to the new process `tenant` without being asked, so that its first clone() or
+ * fork() needn't wait for the leader. Called by the leader when the parent of `tenant` subleases
+ * the pid of `tenant`, which happens in every fork(). Failures are harmless: the tenant will lease
+ * a range once it needs one.
+ */
+static void prelease_ipc_range(IDTYPE tenant) {
+    IDTYPE base = 0;
+    int ret = alloc_ipc_ranges(tenant, /*cnt=*/1, &base);
+    if (ret >= 0)
+        ret = ipc_offer_send(tenant, base, RANGE_SIZE, /*seq=*/0);
+    if (ret < 0)
+        log_debug("failed to pre-lease a range to %u: %d\n", tenant, ret);
+}
+
 int ipc_sublease_send(IDTYPE tenant, IDTYPE idx) {
     if (!g_process_ipc_ids.leader_vmid) {
-        return add_ipc_subrange(idx, tenant);
+        int ret = add_ipc_subrange(idx, tenant);
+        if (ret < 0)
+            return ret;
+        prelease_ipc_range(tenant);
+        return 0;
     }
 
     IDTYPE leader = g_process_ipc_ids.leader_vmid;
@@ -603,7 +688,13 @@ int ipc_sublease_callback(struct shim_ipc_msg* msg, IDTYPE src) {
     }
 
     assert(src == msg->src);
-    return ipc_offer_send(msg->src, msgin->idx, 1, msg->seq);
+    ret = ipc_offer_send(msg->src, msgin->idx, 1, msg->seq);
+    if (ret < 0) {
+        return ret;
+    }
+
+    prelease_ipc_range(msgin->tenant);
+    return 0;
 }
 
 int ipc_query_send(IDTYPE idx) {
@@ -22,18 +22,29 @@
 
 #define LOG_PREFIX "IPC worker: "
 
+/* `data` of the reserved handles in `g_ipc_poller`; connections are registered with their address */
+#define IPC_POLLER_EXIT   0
+#define IPC_POLLER_LISTEN 1
+
+#define IPC_POLLER_MAX_EVENTS 64
+#define IPC_RECV_BUF_SIZE 4096
+#define IPC_MAX_HANDLER_THREADS 16
+
 DEFINE_LIST(shim_ipc_connection);
 DEFINE_LISTP(shim_ipc_connection);
 struct shim_ipc_connection {
+    /* in `g_ready_connections` while waiting for a handler thread */
     LIST_TYPE(shim_ipc_connection) list;
     PAL_HANDLE handle;
     IDTYPE vmid;
+    /* events reported by the poller, passed to the handler thread */
+    PAL_FLG events;
 };
 
-/* List of incoming IPC connections, fully managed by this IPC worker thread (hence no locking
- * needed). */
-static LISTP_TYPE(shim_ipc_connection) g_ipc_connections;
-static size_t g_ipc_connections_cnt = 0;
+/* All incoming IPC connections are registered in this poller, so that waiting doesn't depend on
+ * their number. A connection handed to a handler thread is removed from it until its messages are
+ * handled, hence each connection is handled by one thread at a time and its messages in order. */
+static PAL_HANDLE g_ipc_poller = NULL;
 
 static struct shim_thread* g_worker_thread = NULL;
 static AEVENTTYPE exit_notification_event;
@@ -42,36 +53,101 @@ static AEVENTTYPE exit_notification_event;
 static int g_clear_on_worker_exit = 1;
 static PAL_HANDLE g_self_ipc_handle = NULL;
 
+/* The first process starts the IPC worker only when it creates its first child (see
+ * `start_ipc_worker()`): until then no other process can connect to it, and all IPC requests are
+ * handled locally by the process as the IPC leader. Children start it right away. */
+static struct shim_lock g_ipc_worker_lock;
+static bool g_ipc_worker_started = false;
+/* result of the first start, returned by all later ones */
+static int g_ipc_worker_start_ret = 0;
+static size_t g_ipc_handlers_wanted = 0;
+
+/* Optional pool of threads handling messages of ready connections (`sys.ipc_handler_threads`).
+ * Without it, the IPC worker handles all messages itself. */
+struct ipc_handler {
+    struct shim_thread* thread;
+    int clear_on_exit;
+};
+static struct ipc_handler g_ipc_handlers[IPC_MAX_HANDLER_THREADS];
+static size_t g_ipc_handlers_cnt = 0;
+static bool g_ipc_handlers_exiting = false;
+/* Counts connections in `g_ready_connections` (plus wakeups on exit). */
+static AEVENTTYPE g_ready_event;
+static struct shim_lock g_ready_lock;
+static LISTP_TYPE(shim_ipc_connection) g_ready_connections;
+
+/* Per-message-type statistics, printed by `print_ipc_stats()`. */
+struct ipc_msg_stats {
+    uint64_t count;
+    uint64_t total_us;
+    uint64_t max_us;
+};
+
 static int ipc_resp_callback(struct shim_ipc_msg* msg, IDTYPE src);
 static int ipc_connect_back_callback(struct shim_ipc_msg* msg, IDTYPE src);
 
 typedef int (*ipc_callback)(struct shim_ipc_msg* msg, IDTYPE src);
 static ipc_callback ipc_callbacks[] = {
-    [IPC_MSG_RESP]          = ipc_resp_callback,
-    [IPC_MSG_CONNBACK]      = ipc_connect_back_callback,
-    [IPC_MSG_DUMMY]         = ipc_dummy_callback,
-    [IPC_MSG_CHILDEXIT]     = ipc_cld_exit_callback,
-    [IPC_MSG_LEASE]         = ipc_lease_callback,
-    [IPC_MSG_OFFER]         = ipc_offer_callback,
-    [IPC_MSG_SUBLEASE]      = ipc_sublease_callback,
-    [IPC_MSG_QUERY]         = ipc_query_callback,
-    [IPC_MSG_QUERYALL]      = ipc_queryall_callback,
-    [IPC_MSG_ANSWER]        = ipc_answer_callback,
-    [IPC_MSG_PID_KILL]      = ipc_pid_kill_callback,
-    [IPC_MSG_PID_GETSTATUS] = ipc_pid_getstatus_callback,
-    [IPC_MSG_PID_RETSTATUS] = ipc_pid_retstatus_callback,
-    [IPC_MSG_PID_GETMETA]   = ipc_pid_getmeta_callback,
-    [IPC_MSG_PID_RETMETA]   = ipc_pid_retmeta_callback,
-    [IPC_MSG_SYSV_FINDKEY]  = ipc_sysv_findkey_callback,
-    [IPC_MSG_SYSV_TELLKEY]  = ipc_sysv_tellkey_callback,
-    [IPC_MSG_SYSV_DELRES]   = ipc_sysv_delres_callback,
-    [IPC_MSG_SYSV_MSGSND]   = ipc_sysv_msgsnd_callback,
-    [IPC_MSG_SYSV_MSGRCV]   = ipc_sysv_msgrcv_callback,
-    [IPC_MSG_SYSV_SEMOP]    = ipc_sysv_semop_callback,
-    [IPC_MSG_SYSV_SEMCTL]   = ipc_sysv_semctl_callback,
-    [IPC_MSG_SYSV_SEMRET]   = ipc_sysv_semret_callback,
+    [IPC_MSG_RESP]              = ipc_resp_callback,
+    [IPC_MSG_CONNBACK]          = ipc_connect_back_callback,
+    [IPC_MSG_DUMMY]             = ipc_dummy_callback,
+    [IPC_MSG_CHILDEXIT]         = ipc_cld_exit_callback,
+    [IPC_MSG_LEASE]             = ipc_lease_callback,
+    [IPC_MSG_OFFER]             = ipc_offer_callback,
+    [IPC_MSG_SUBLEASE]          = ipc_sublease_callback,
+    [IPC_MSG_QUERY]             = ipc_query_callback,
+    [IPC_MSG_QUERYALL]          = ipc_queryall_callback,
+    [IPC_MSG_ANSWER]            = ipc_answer_callback,
+    [IPC_MSG_PID_KILL]          = ipc_pid_kill_callback,
+    [IPC_MSG_PID_GETSTATUS]     = ipc_pid_getstatus_callback,
+    [IPC_MSG_PID_RETSTATUS]     = ipc_pid_retstatus_callback,
+    [IPC_MSG_PID_GETMETA]       = ipc_pid_getmeta_callback,
+    [IPC_MSG_PID_RETMETA]       = ipc_pid_retmeta_callback,
+    [IPC_MSG_SYSV_FINDKEY]      = ipc_sysv_findkey_callback,
+    [IPC_MSG_SYSV_TELLKEY]      = ipc_sysv_tellkey_callback,
+    [IPC_MSG_SYSV_DELRES]       = ipc_sysv_delres_callback,
+    [IPC_MSG_SYSV_MSGSND]       = ipc_sysv_msgsnd_callback,
+    [IPC_MSG_SYSV_MSGRCV]       = ipc_sysv_msgrcv_callback,
+    [IPC_MSG_SYSV_SEMOP]        = ipc_sysv_semop_callback,
+    [IPC_MSG_SYSV_SEMCTL]       = ipc_sysv_semctl_callback,
+    [IPC_MSG_SYSV_SEMRET]       = ipc_sysv_semret_callback,
+    [IPC_MSG_POSIX_LOCK_SET]    = ipc_posix_lock_set_callback,
+    [IPC_MSG_POSIX_LOCK_GET]    = ipc_posix_lock_get_callback,
+    [IPC_MSG_POSIX_LOCK_RESP]   = ipc_posix_lock_resp_callback,
+    [IPC_MSG_POSIX_LOCK_RECALL] = ipc_posix_lock_recall_callback,
+    [IPC_MSG_POSIX_LOCK_STATE]  = ipc_posix_lock_state_callback,
 };
 
+static struct ipc_msg_stats g_ipc_msg_stats[ARRAY_SIZE(ipc_callbacks)];
+
+static void account_ipc_msg(unsigned int code, uint64_t start_us) {
+    uint64_t end_us;
+    if (DkSystemTimeQuery(&end_us) < 0 || end_us < start_us)
+        return;
+
+    struct ipc_msg_stats* stats = &g_ipc_msg_stats[code];
+    uint64_t time_us = end_us - start_us;
+    __atomic_add_fetch(&stats->count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats->total_us, time_us, __ATOMIC_RELAXED);
+
+    uint64_t max_us = __atomic_load_n(&stats->max_us, __ATOMIC_RELAXED);
+    while (time_us > max_us && !__atomic_compare_exchange_n(&stats->max_us, &max_us, time_us,
+                                                            /*weak=*/true, __ATOMIC_RELAXED,
+                                                            __ATOMIC_RELAXED))
+        ;
+}
+
+void print_ipc_stats(void) {
+    for (size_t i = 0; i < ARRAY_SIZE(g_ipc_msg_stats); i++) {
+        uint64_t count = __atomic_load_n(&g_ipc_msg_stats[i].count, __ATOMIC_RELAXED);
+        if (!count)
+            continue;
+        log_debug("IPC msg code %zu: %lu handled, %lu us on average, %lu us max\n", i, count,
+                  __atomic_load_n(&g_ipc_msg_stats[i].total_us, __ATOMIC_RELAXED) / count,
+                  __atomic_load_n(&g_ipc_msg_stats[i].max_us, __ATOMIC_RELAXED));
+    }
+}
+
 static void ipc_leader_died_callback(void) {
     /* This might happen legitimately e.g. if IPC leader is also our parent and does `wait` + `exit`
      * If this is an erroneous disconnect it will be noticed when trying to communicate with
@@ -84,6 +160,8 @@ static void disconnect_callbacks(struct shim_ipc_connection* conn) {
         ipc_leader_died_callback();
     }
     ipc_child_disconnect_callback(conn->vmid);
+    invalidate_ipc_owner(conn->vmid);
+    posix_lock_clear_vmid(conn->vmid);
 
     /*
      * Currently outgoing IPC connections (handled in `shim_ipc.c`) are not cleaned up - there is
@@ -100,17 +178,22 @@ static int add_ipc_connection(PAL_HANDLE handle, IDTYPE id) {
         return -ENOMEM;
     }
 
+    INIT_LIST_HEAD(conn, list);
     conn->handle = handle;
     conn->vmid = id;
+    conn->events = 0;
 
-    LISTP_ADD(conn, &g_ipc_connections, list);
-    g_ipc_connections_cnt++;
+    int ret = DkPollerCtl(g_ipc_poller, PAL_POLLER_ADD, handle, PAL_WAIT_READ, (PAL_NUM)conn);
+    if (ret < 0) {
+        free(conn);
+        return pal_to_unix_errno(ret);
+    }
     return 0;
 }
 
 static void del_ipc_connection(struct shim_ipc_connection* conn) {
-    LISTP_DEL(conn, &g_ipc_connections, list);
-    g_ipc_connections_cnt--;
+    /* Fails harmlessly if the connection was handed to a handler thread (and thus removed). */
+    (void)DkPollerCtl(g_ipc_poller, PAL_POLLER_REMOVE, conn->handle, /*events=*/0, /*data=*/0);
 
     DkObjectClose(conn->handle);
 
@@ -161,28 +244,57 @@ static int ipc_connect_back_callback(struct shim_ipc_msg* orig_msg, IDTYPE src)
     return send_ipc_message(msg, src);
 }
 
+static int handle_ipc_message(struct shim_ipc_connection* conn, struct shim_ipc_msg* msg) {
+    log_debug(LOG_PREFIX "received IPC message from %u: code=%d size=%lu src=%u dst=%u seq=%lu\n",
+              conn->vmid, msg->code, msg->size, msg->src, msg->dst, msg->seq);
+
+    assert(conn->vmid == msg->src);
+
+    if (msg->code < ARRAY_SIZE(ipc_callbacks) && ipc_callbacks[msg->code]) {
+        uint64_t start_us = 0;
+        (void)DkSystemTimeQuery(&start_us);
+        int ret = ipc_callbacks[msg->code](msg, conn->vmid);
+        account_ipc_msg(msg->code, start_us);
+        if ((ret < 0 || ret == RESPONSE_CALLBACK) && msg->seq) {
+            ret = send_ipc_response(conn->vmid, ret, msg->seq);
+            if (ret < 0) {
+                log_error(LOG_PREFIX "sending IPC msg response to %u failed: %d\n", conn->vmid,
+                          ret);
+                return ret;
+            }
+        }
+    } else {
+        log_error(LOG_PREFIX "received unknown IPC msg type: %u\n", msg->code);
+    }
+    return 0;
+}
+
 /*
  * Receive and handle some (possibly many) messages from IPC connection `conn`.
  * Returns `0` on success, `1` on EOF (connection closed on a message boundary), negative error
  * code on failures.
+ *
+ * Messages are padded to `IPC_MSG_WIRE_ALIGNMENT` on the wire, so each message starts at an aligned
+ * offset of `buf` and is handled in place, unless it doesn't fit into `buf`.
  */
 static int receive_ipc_messages(struct shim_ipc_connection* conn) {
+    /* Big enough to get many messages with one read. */
+    alignas(IPC_MSG_WIRE_ALIGNMENT) char buf[IPC_RECV_BUF_SIZE];
+    /* Offset of the next message in `buf` and number of bytes of it (and of the messages after it)
+     * already received. */
+    size_t start = 0;
     size_t size = 0;
-    /* Try to get more bytes that strictly required in case there are more messages waiting.
-     * `0x20` as a random estimation of "couple of ints" + `IPC_MSG_MINIMAL_SIZE` to get the next
-     * message header if possible. */
-#define READAHEAD_SIZE (0x20 + IPC_MSG_MINIMAL_SIZE)
-    union {
-        struct shim_ipc_msg msg_header;
-        char buf[IPC_MSG_MINIMAL_SIZE + READAHEAD_SIZE];
-    } buf;
-#undef READAHEAD_SIZE
 
     do {
         /* Receive at least the message header. */
+        if (start + IPC_MSG_MINIMAL_SIZE > sizeof(buf)) {
+            memmove(buf, buf + start, size);
+            start = 0;
+        }
         while (size < IPC_MSG_MINIMAL_SIZE) {
-            size_t tmp_size = sizeof(buf) - size;
-            int ret = DkStreamRead(conn->handle, /*offset=*/0, &tmp_size, buf.buf + size, NULL, 0);
+            size_t tmp_size = sizeof(buf) - start - size;
+            int ret = DkStreamRead(conn->handle, /*offset=*/0, &tmp_size, buf + start + size, NULL,
+                                   0);
             if (ret < 0) {
                 if (ret == -PAL_ERROR_INTERRUPTED || ret == -PAL_ERROR_TRYAGAIN) {
                     continue;
@@ -204,107 +316,160 @@ static int receive_ipc_messages(struct shim_ipc_connection* conn) {
             size += tmp_size;
         }
 
-        size_t msg_size = buf.msg_header.size;
-        struct shim_ipc_msg* msg = malloc(msg_size);
-        if (!msg) {
-            return -ENOMEM;
+        struct shim_ipc_msg* msg = (struct shim_ipc_msg*)(buf + start);
+        size_t msg_size = msg->size;
+        if (msg_size < IPC_MSG_MINIMAL_SIZE) {
+            log_error(LOG_PREFIX "received IPC message of invalid size %lu from %u\n", msg_size,
+                      conn->vmid);
+            return -EINVAL;
         }
-
-        if (msg_size <= size) {
-            /* Already got the whole message (and possibly part of the next one). */
-            memcpy(msg, buf.buf, msg_size);
-            memmove(buf.buf, buf.buf + msg_size, size - msg_size);
-            size -= msg_size;
+        size_t wire_size = get_ipc_msg_wire_size(msg_size);
+
+        struct shim_ipc_msg* big_msg = NULL;
+        if (wire_size <= sizeof(buf)) {
+            if (size < wire_size) {
+                /* Need to get rest of the message. */
+                if (start + wire_size > sizeof(buf)) {
+                    memmove(buf, buf + start, size);
+                    start = 0;
+                    msg = (struct shim_ipc_msg*)buf;
+                }
+                int ret = read_exact(conn->handle, buf + start + size, wire_size - size);
+                if (ret < 0) {
+                    log_error(LOG_PREFIX "receiving message from %u failed: %d\n", conn->vmid,
+                              ret);
+                    return ret;
+                }
+                size = wire_size;
+            }
+            /* Otherwise already got the whole message (and possibly part of the next one). */
+            start += wire_size;
+            size -= wire_size;
         } else {
-            /* Need to get rest of the message. */
-            memcpy(msg, buf.buf, size);
-            int ret = read_exact(conn->handle, (char*)msg + size, msg_size - size);
+            big_msg = malloc(wire_size);
+            if (!big_msg) {
+                return -ENOMEM;
+            }
+            memcpy(big_msg, msg, size);
+            int ret = read_exact(conn->handle, (char*)big_msg + size, wire_size - size);
             if (ret < 0) {
-                free(msg);
+                free(big_msg);
                 log_error(LOG_PREFIX "receiving message from %u failed: %d\n", conn->vmid, ret);
                 return ret;
             }
+            msg = big_msg;
+            start = 0;
             size = 0;
         }
 
-        log_debug(LOG_PREFIX "received IPC message from %u: code=%d size=%lu src=%u dst=%u seq=%lu"
-                  "\n", conn->vmid, msg->code, msg->size, msg->src, msg->dst, msg->seq);
+        int ret = handle_ipc_message(conn, msg);
+        free(big_msg);
+        if (ret < 0) {
+            return ret;
+        }
+        if (!size) {
+            start = 0;
+        }
+    } while (size > 0);
 
-        assert(conn->vmid == msg->src);
+    return 0;
+}
 
-        if (msg->code < ARRAY_SIZE(ipc_callbacks) && ipc_callbacks[msg->code]) {
-            int ret = ipc_callbacks[msg->code](msg, conn->vmid);
-            if ((ret < 0 || ret == RESPONSE_CALLBACK) && msg->seq) {
-                ret = send_ipc_response(conn->vmid, ret, msg->seq);
-                if (ret < 0) {
-                    log_error(LOG_PREFIX "sending IPC msg response to %u failed: %d\n", conn->vmid,
-                              ret);
-                    free(msg);
-                    return ret;
-                }
-            }
-        } else {
-            log_error(LOG_PREFIX "received unknown IPC msg type: %u\n", msg->code);
+/*
+ * Handle `events` reported on connection `conn`. Returns `true` if the connection is still open,
+ * `false` if it was closed (and freed).
+ */
+static bool handle_ipc_connection(struct shim_ipc_connection* conn, PAL_FLG events) {
+    if (events & PAL_WAIT_READ) {
+        int ret = receive_ipc_messages(conn);
+        if (ret == 1) {
+            /* Connection closed. */
+            events = PAL_WAIT_ERROR;
+        } else if (ret < 0) {
+            log_error(LOG_PREFIX "failed to receive an IPC message from %u: %d\n", conn->vmid, ret);
+            events = PAL_WAIT_ERROR;
         }
+    }
+    /* If there was something else other than error reported, let the poller report the connection
+     * at least one more time - in case there are messages left to be read. */
+    if (events == PAL_WAIT_ERROR) {
+        disconnect_callbacks(conn);
+        del_ipc_connection(conn);
+        return false;
+    }
+    return true;
+}
 
-        free(msg);
-    } while (size > 0);
+static noreturn void exit_ipc_thread(int* clear_on_exit) {
+    struct shim_thread* cur_thread = get_cur_thread();
+    assert(cur_thread->shim_tcb->tp == cur_thread);
+    cur_thread->shim_tcb->tp = NULL;
+    cur_thread->shim_tcb->cputime = NULL;
+    put_thread(cur_thread);
 
-    return 0;
+    destroy_thread_slab_cache();
+    DkThreadExit(clear_on_exit);
+    /* Unreachable. */
 }
 
-static noreturn void ipc_worker_main(void) {
-    /* TODO: If we had a global array of connections (instead of a list) we wouldn't have to gather
-     * them all here in every loop iteration, but then deletion would be slower (but deletion should
-     * be rare). */
-    struct shim_ipc_connection** connections = NULL;
-    PAL_HANDLE* handles = NULL;
-    PAL_FLG* events = NULL;
-    PAL_FLG* ret_events = NULL;
-    size_t prev_items_cnt = 0;
+/* Hand `conn` to a handler thread. Called only by the IPC worker thread. */
+static int dispatch_ipc_connection(struct shim_ipc_connection* conn, PAL_FLG events) {
+    int ret = DkPollerCtl(g_ipc_poller, PAL_POLLER_REMOVE, conn->handle, /*events=*/0,
+                          /*data=*/0);
+    if (ret < 0) {
+        return pal_to_unix_errno(ret);
+    }
+
+    conn->events = events;
+    lock(&g_ready_lock);
+    LISTP_ADD_TAIL(conn, &g_ready_connections, list);
+    unlock(&g_ready_lock);
 
+    return set_event(&g_ready_event, 1);
+}
+
+static noreturn void ipc_handler_main(struct ipc_handler* handler) {
     while (1) {
-        /* Reserve 2 slots for `exit_notification_event` and `g_self_ipc_handle`. */
-        const size_t reserved_slots = 2;
-        size_t items_cnt = g_ipc_connections_cnt + reserved_slots;
-        if (items_cnt != prev_items_cnt) {
-            free(connections);
-            free(handles);
-            free(events);
-            free(ret_events);
-
-            connections = malloc(items_cnt * sizeof(*connections));
-            handles = malloc(items_cnt * sizeof(*handles));
-            events = malloc(items_cnt * sizeof(*events));
-            ret_events = malloc(items_cnt * sizeof(*ret_events));
-            if (!connections || !handles || !events || !ret_events) {
-                log_error(LOG_PREFIX "arrays allocation failed\n");
-                goto out_die;
-            }
+        int ret = wait_event(&g_ready_event);
+        if (ret < 0) {
+            log_error(LOG_PREFIX "waiting for ready connections failed: %d\n", ret);
+            goto out_die;
+        }
 
-            prev_items_cnt = items_cnt;
+        if (__atomic_load_n(&g_ipc_handlers_exiting, __ATOMIC_ACQUIRE)) {
+            exit_ipc_thread(&handler->clear_on_exit);
         }
 
-        memset(ret_events, 0, items_cnt * sizeof(*ret_events));
-
-        connections[0] = NULL;
-        handles[0] = event_handle(&exit_notification_event);
-        events[0] = PAL_WAIT_READ;
-        connections[1] = NULL;
-        handles[1] = g_self_ipc_handle;
-        events[1] = PAL_WAIT_READ;
-
-        struct shim_ipc_connection* conn;
-        size_t i = reserved_slots;
-        LISTP_FOR_EACH_ENTRY(conn, &g_ipc_connections, list) {
-            connections[i] = conn;
-            handles[i] = conn->handle;
-            events[i] = PAL_WAIT_READ;
-            /* `ret_events[i]` already cleared. */
-            i++;
+        lock(&g_ready_lock);
+        struct shim_ipc_connection* conn = LISTP_FIRST_ENTRY(&g_ready_connections,
+                                                             struct shim_ipc_connection, list);
+        assert(conn);
+        LISTP_DEL_INIT(conn, &g_ready_connections, list);
+        unlock(&g_ready_lock);
+
+        if (handle_ipc_connection(conn, conn->events)) {
+            /* Let the IPC worker wait for more messages on this connection. */
+            ret = DkPollerCtl(g_ipc_poller, PAL_POLLER_ADD, conn->handle, PAL_WAIT_READ,
+                              (PAL_NUM)conn);
+            if (ret < 0) {
+                ret = pal_to_unix_errno(ret);
+                log_error(LOG_PREFIX "re-adding connection to %u failed: %d\n", conn->vmid, ret);
+                goto out_die;
+            }
         }
+    }
 
-        int ret = DkStreamsWaitEvents(items_cnt, handles, events, ret_events, NO_TIMEOUT);
+out_die:
+    log_flush(/*crashing=*/true);
+    DkProcessExit(1);
+}
+
+static noreturn void ipc_worker_main(void) {
+    PAL_POLLER_EVENT events[IPC_POLLER_MAX_EVENTS];
+
+    while (1) {
+        size_t count = 0;
+        int ret = DkPollerWait(g_ipc_poller, events, ARRAY_SIZE(events), &count, NO_TIMEOUT);
         if (ret < 0) {
             if (ret == -PAL_ERROR_INTERRUPTED) {
                 /* Generally speaking IPC worker should not be interrupted, but this happens with
@@ -312,87 +477,84 @@ static noreturn void ipc_worker_main(void) {
                 continue;
             }
             ret = pal_to_unix_errno(ret);
-            log_error(LOG_PREFIX "DkStreamsWaitEvents failed: %d\n", ret);
+            log_error(LOG_PREFIX "DkPollerWait failed: %d\n", ret);
             goto out_die;
         }
 
-        if (ret_events[0]) {
-            /* `exit_notification_event`. */
-            if (ret_events[0] & ~PAL_WAIT_READ) {
-                log_error(LOG_PREFIX "unexpected event (%d) on exit handle\n", ret_events[0]);
-                goto out_die;
+        /* A connection may be reported more than once, but must be handled (and in particular
+         * handed to a handler thread) only once: merge duplicates into the first report. */
+        for (size_t i = 1; i < count; i++) {
+            for (size_t j = 0; j < i; j++) {
+                if (events[j].events && events[j].data == events[i].data) {
+                    events[j].events |= events[i].events;
+                    events[i].events = 0;
+                    break;
+                }
             }
-            log_debug(LOG_PREFIX "exiting worker thread\n");
-
-            free(connections);
-            free(handles);
-            free(events);
-            free(ret_events);
-
-            struct shim_thread* cur_thread = get_cur_thread();
-            assert(g_worker_thread == cur_thread);
-            assert(cur_thread->shim_tcb->tp == cur_thread);
-            cur_thread->shim_tcb->tp = NULL;
-            put_thread(cur_thread);
-
-            DkThreadExit(&g_clear_on_worker_exit);
-            /* Unreachable. */
         }
 
-        if (ret_events[1]) {
-            /* New connection incoming. */
-            if (ret_events[1] & ~PAL_WAIT_READ) {
-                log_error(LOG_PREFIX "unexpected event (%d) on listening handle\n", ret_events[1]);
-                goto out_die;
-            }
-            PAL_HANDLE new_handle = NULL;
-            ret = DkStreamWaitForClient(g_self_ipc_handle, &new_handle);
-            if (ret < 0) {
-                ret = pal_to_unix_errno(ret);
-                log_error(LOG_PREFIX "DkStreamWaitForClient failed: %d\n", ret);
-                goto out_die;
+        for (size_t i = 0; i < count; i++) {
+            if (!events[i].events) {
+                continue;
             }
-            IDTYPE new_id = 0;
-            ret = read_exact(new_handle, &new_id, sizeof(new_id));
-            if (ret < 0) {
-                log_error(LOG_PREFIX "receiving id failed: %d\n", ret);
-                DkObjectClose(new_handle);
-            } else {
-                ret = add_ipc_connection(new_handle, new_id);
-                if (ret < 0) {
-                    log_error(LOG_PREFIX "add_ipc_connection failed: %d\n", ret);
+
+            if (events[i].data == IPC_POLLER_EXIT) {
+                if (events[i].events & ~PAL_WAIT_READ) {
+                    log_error(LOG_PREFIX "unexpected event (%d) on exit handle\n",
+                              events[i].events);
                     goto out_die;
                 }
+                log_debug(LOG_PREFIX "exiting worker thread\n");
+
+                assert(g_worker_thread == get_cur_thread());
+                exit_ipc_thread(&g_clear_on_worker_exit);
             }
-        }
 
-        for (i = reserved_slots; i < items_cnt; i++) {
-            conn = connections[i];
-            if (ret_events[i] & PAL_WAIT_READ) {
-                ret = receive_ipc_messages(conn);
-                if (ret == 1) {
-                    /* Connection closed. */
-                    disconnect_callbacks(conn);
-                    del_ipc_connection(conn);
-                    continue;
+            if (events[i].data == IPC_POLLER_LISTEN) {
+                /* New connection incoming. */
+                if (events[i].events & ~PAL_WAIT_READ) {
+                    log_error(LOG_PREFIX "unexpected event (%d) on listening handle\n",
+                              events[i].events);
+                    goto out_die;
+                }
+                PAL_HANDLE new_handle = NULL;
+                ret = DkStreamWaitForClient(g_self_ipc_handle, &new_handle);
+                if (ret < 0) {
+                    ret = pal_to_unix_errno(ret);
+                    log_error(LOG_PREFIX "DkStreamWaitForClient failed: %d\n", ret);
+                    goto out_die;
                 }
+                IDTYPE new_id = 0;
+                ret = read_exact(new_handle, &new_id, sizeof(new_id));
                 if (ret < 0) {
-                    log_error(LOG_PREFIX "failed to receive an IPC message from %u: %d\n",
-                              conn->vmid, ret);
-                    /* Let the code below handle this error. */
-                    ret_events[i] = PAL_WAIT_ERROR;
+                    log_error(LOG_PREFIX "receiving id failed: %d\n", ret);
+                    DkObjectClose(new_handle);
+                } else {
+                    ret = add_ipc_connection(new_handle, new_id);
+                    if (ret < 0) {
+                        log_error(LOG_PREFIX "add_ipc_connection failed: %d\n", ret);
+                        goto out_die;
+                    }
                 }
+                continue;
             }
-            /* If there was something else other than error reported, let the loop spin at least one
-             * more time - in case there are messages left to be read. */
-            if (ret_events[i] == PAL_WAIT_ERROR) {
-                disconnect_callbacks(conn);
-                del_ipc_connection(conn);
+
+            struct shim_ipc_connection* conn = (struct shim_ipc_connection*)events[i].data;
+            if (g_ipc_handlers_cnt) {
+                ret = dispatch_ipc_connection(conn, events[i].events);
+                if (ret < 0) {
+                    log_error(LOG_PREFIX "dispatching connection to %u failed: %d\n", conn->vmid,
+                              ret);
+                    goto out_die;
+                }
+            } else {
+                handle_ipc_connection(conn, events[i].events);
             }
         }
     }
 
 out_die:
+    log_flush(/*crashing=*/true);
     DkProcessExit(1);
 }
 
@@ -410,18 +572,84 @@ static void ipc_worker_wrapper(void* arg) {
     /* Unreachable. */
 }
 
+static void ipc_handler_wrapper(void* arg) {
+    struct ipc_handler* handler = arg;
+    assert(handler->thread);
+
+    shim_tcb_init();
+    set_cur_thread(handler->thread);
+
+    log_setprefix(shim_get_tcb());
+
+    log_debug("IPC handler thread started\n");
+    ipc_handler_main(handler);
+    /* Unreachable. */
+}
+
 static int init_self_ipc_handle(void) {
     char uri[PIPE_URI_SIZE];
     return create_pipe(NULL, uri, sizeof(uri), &g_self_ipc_handle, NULL,
                        /*use_vmid_for_name=*/true);
 }
 
-static int create_ipc_worker(void) {
+static int init_ipc_poller(void) {
+    int ret = DkPollerCreate(&g_ipc_poller);
+    if (ret < 0) {
+        return pal_to_unix_errno(ret);
+    }
+
+    ret = DkPollerCtl(g_ipc_poller, PAL_POLLER_ADD, event_handle(&exit_notification_event),
+                      PAL_WAIT_READ, IPC_POLLER_EXIT);
+    if (ret < 0) {
+        return pal_to_unix_errno(ret);
+    }
+    ret = DkPollerCtl(g_ipc_poller, PAL_POLLER_ADD, g_self_ipc_handle, PAL_WAIT_READ,
+                      IPC_POLLER_LISTEN);
+    if (ret < 0) {
+        return pal_to_unix_errno(ret);
+    }
+    return 0;
+}
+
+/* Failing to start a handler thread (e.g. no free SGX thread slot) is not fatal: the messages are
+ * then handled by fewer threads, or by the IPC worker itself. */
+static void create_ipc_handlers(size_t cnt) {
+    for (size_t i = 0; i < cnt; i++) {
+        struct ipc_handler* handler = &g_ipc_handlers[g_ipc_handlers_cnt];
+        handler->thread = get_new_internal_thread();
+        if (!handler->thread) {
+            break;
+        }
+        handler->clear_on_exit = 1;
+
+        PAL_HANDLE handle = NULL;
+        int ret = DkThreadCreate(ipc_handler_wrapper, handler, &handle);
+        if (ret < 0) {
+            ret = pal_to_unix_errno(ret);
+            log_warning(LOG_PREFIX "starting IPC handler thread failed: %d\n", ret);
+            put_thread(handler->thread);
+            handler->thread = NULL;
+            break;
+        }
+        handler->thread->pal_handle = handle;
+        g_ipc_handlers_cnt++;
+    }
+}
+
+static int create_ipc_worker(size_t handlers_cnt) {
     int ret = init_self_ipc_handle();
     if (ret < 0) {
         return ret;
     }
 
+    ret = init_ipc_poller();
+    if (ret < 0) {
+        return ret;
+    }
+
+    /* Handler threads must be running before the IPC worker decides how to handle messages. */
+    create_ipc_handlers(handlers_cnt);
+
     g_worker_thread = get_new_internal_thread();
     if (!g_worker_thread) {
         return -ENOMEM;
@@ -441,16 +669,75 @@ static int create_ipc_worker(void) {
 }
 
 int init_ipc_worker(void) {
-    int ret = create_event(&exit_notification_event);
+    assert(g_manifest_root);
+
+    int64_t handlers_cnt;
+    int ret = toml_int_in(g_manifest_root, "sys.ipc_handler_threads", /*defaultval=*/0,
+                          &handlers_cnt);
+    if (ret < 0 || handlers_cnt < 0 || handlers_cnt > IPC_MAX_HANDLER_THREADS) {
+        log_error("Cannot parse 'sys.ipc_handler_threads' (the value must be a number between 0 "
+                  "and 16)\n");
+        return -EINVAL;
+    }
+
+    ret = create_event(&exit_notification_event);
     if (ret < 0) {
         return ret;
     }
 
+    if (handlers_cnt) {
+        ret = create_event(&g_ready_event);
+        if (ret < 0) {
+            return ret;
+        }
+        if (!create_lock(&g_ready_lock)) {
+            return -ENOMEM;
+        }
+        INIT_LISTP(&g_ready_connections);
+    }
+
+    if (!create_lock(&g_ipc_worker_lock)) {
+        return -ENOMEM;
+    }
+    g_ipc_handlers_wanted = handlers_cnt;
+
     enable_locking();
-    return create_ipc_worker();
+    if (!g_pal_control->parent_process) {
+        return 0;
+    }
+    return start_ipc_worker();
+}
+
+int start_ipc_worker(void) {
+    if (__atomic_load_n(&g_ipc_worker_started, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+
+    lock(&g_ipc_worker_lock);
+    if (!g_ipc_worker_started && !g_ipc_worker_start_ret) {
+        /* a half-created worker cannot be undone (e.g. the pipe of this process is taken), so
+         * a failure is final */
+        int ret = create_ipc_worker(g_ipc_handlers_wanted);
+        if (ret < 0) {
+            log_error(LOG_PREFIX "starting IPC worker failed: %d\n", ret);
+            g_ipc_worker_start_ret = ret;
+        } else {
+            __atomic_store_n(&g_ipc_worker_started, true, __ATOMIC_RELEASE);
+        }
+    }
+    int ret = g_ipc_worker_start_ret;
+    unlock(&g_ipc_worker_lock);
+    return ret;
 }
 
 void terminate_ipc_worker(void) {
+    lock(&g_ipc_worker_lock);
+    bool started = g_ipc_worker_started;
+    unlock(&g_ipc_worker_lock);
+    if (!started) {
+        return;
+    }
+
     set_event(&exit_notification_event, 1);
 
     while (__atomic_load_n(&g_clear_on_worker_exit, __ATOMIC_RELAXED)) {
@@ -459,6 +746,23 @@ void terminate_ipc_worker(void) {
 
     put_thread(g_worker_thread);
     g_worker_thread = NULL;
+
+    if (g_ipc_handlers_cnt) {
+        __atomic_store_n(&g_ipc_handlers_exiting, true, __ATOMIC_RELEASE);
+        set_event(&g_ready_event, g_ipc_handlers_cnt);
+
+        for (size_t i = 0; i < g_ipc_handlers_cnt; i++) {
+            while (__atomic_load_n(&g_ipc_handlers[i].clear_on_exit, __ATOMIC_RELAXED)) {
+                CPU_RELAX();
+            }
+            put_thread(g_ipc_handlers[i].thread);
+            g_ipc_handlers[i].thread = NULL;
+        }
+        g_ipc_handlers_cnt = 0;
+    }
+
+    DkObjectClose(g_ipc_poller);
+    g_ipc_poller = NULL;
     DkObjectClose(g_self_ipc_handle);
     g_self_ipc_handle = NULL;
 }
@@ -12,20 +12,39 @@
 #include "shim_thread.h"
 #include "shim_utils.h"
 
-#define IDLE_SLEEP_TIME 1000000
-#define MAX_IDLE_CYCLES 10000
+/* async worker thread dies after MAX_IDLE_TIME usecs without any events (it is re-spawned when
+ * some thread installs a new event) */
+#define MAX_IDLE_TIME (10000 * 1000000UL)
+
+enum async_event_type {
+    ASYNC_EVENT_ALARM,   /* alarm()/setitimer(), cancelled by the next one */
+    ASYNC_EVENT_TIMER,   /* LibOS-internal timer, see install_async_timer() */
+    ASYNC_EVENT_IO,      /* async IO on a PAL handle */
+    ASYNC_EVENT_CLEANUP, /* cleanup of an exited thread */
+    ASYNC_EVENT_TYPES
+};
+
+static const char* const async_event_type_names[ASYNC_EVENT_TYPES] = {
+    [ASYNC_EVENT_ALARM]   = "alarm",
+    [ASYNC_EVENT_TIMER]   = "timer",
+    [ASYNC_EVENT_IO]      = "IO",
+    [ASYNC_EVENT_CLEANUP] = "cleanup",
+};
 
 DEFINE_LIST(async_event);
+DEFINE_LISTP(async_event);
 struct async_event {
     IDTYPE caller; /* thread installing this event */
+    /* on `async_list` (IO and cleanup events) or on the timer wheel (alarms/timers) */
     LIST_TYPE(async_event) list;
     LIST_TYPE(async_event) triggered_list;
+    LISTP_TYPE(async_event)* timer_slot; /* timer wheel list the alarm/timer is on */
     void (*callback)(IDTYPE caller, void* arg);
     void* arg;
     PAL_HANDLE object;    /* handle (async IO) to wait on */
     uint64_t expire_time; /* alarm/timer to wait on */
+    enum async_event_type type;
 };
-DEFINE_LISTP(async_event);
 static LISTP_TYPE(async_event) async_list;
 
 /* Should be accessed with async_worker_lock held. */
@@ -38,8 +57,146 @@ static AEVENTTYPE install_new_event;
 
 static int create_async_worker(void);
 
+/*
+ * Hierarchical timer wheel holding alarms and timers (all accesses under `async_worker_lock`).
+ *
+ * Level `l` has 64 slots, each covering 64^l usecs. A timer goes to the level of the highest bit in
+ * which its expiration time differs from `now`, so each level covers the next 64 slots of its
+ * granularity. When `now` passes a slot, its timers are moved to lower levels (or to `expired`)
+ * lazily, in `timer_wheel_advance`. Insertion and cancellation are O(1); the next expiration time
+ * is found by looking at the first non-empty slot of each level.
+ */
+#define TIMER_WHEEL_BITS   6
+#define TIMER_WHEEL_SLOTS  (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS ((64 + TIMER_WHEEL_BITS - 1) / TIMER_WHEEL_BITS)
+
+static_assert(TIMER_WHEEL_SLOTS == 64, "slot bitmaps are 64-bit");
+
+static struct {
+    uint64_t now;                        /* timers expiring up to this time are in `expired` */
+    uint64_t pending[TIMER_WHEEL_LEVELS]; /* bitmaps of non-empty slots */
+    LISTP_TYPE(async_event) slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    LISTP_TYPE(async_event) expired;
+} g_timer_wheel;
+
+/* the only pending alarm (installing an alarm cancels the previous one) */
+static struct async_event* g_pending_alarm;
+
+/* statistics, printed by print_async_stats() */
+static uint64_t g_async_installed[ASYNC_EVENT_TYPES];
+static uint64_t g_async_triggered[ASYNC_EVENT_TYPES];
+static uint64_t g_async_cancelled[ASYNC_EVENT_TYPES];
+
+static uint64_t rotate_right(uint64_t x, unsigned int n) {
+    n %= 64;
+    return n ? (x >> n) | (x << (64 - n)) : x;
+}
+
+static void timer_wheel_add(struct async_event* event) {
+    assert(locked(&async_worker_lock));
+
+    if (event->expire_time <= g_timer_wheel.now) {
+        event->timer_slot = &g_timer_wheel.expired;
+    } else {
+        uint64_t diff = event->expire_time ^ g_timer_wheel.now;
+        unsigned int level = (63 - __builtin_clzl(diff)) / TIMER_WHEEL_BITS;
+        unsigned int slot = (event->expire_time >> (level * TIMER_WHEEL_BITS))
+                            & (TIMER_WHEEL_SLOTS - 1);
+        event->timer_slot = &g_timer_wheel.slots[level][slot];
+        g_timer_wheel.pending[level] |= 1UL << slot;
+    }
+    LISTP_ADD_TAIL(event, event->timer_slot, list);
+}
+
+static void timer_wheel_del(struct async_event* event) {
+    assert(locked(&async_worker_lock));
+
+    LISTP_TYPE(async_event)* slot = event->timer_slot;
+    LISTP_DEL(event, slot, list);
+    event->timer_slot = NULL;
+
+    if (slot != &g_timer_wheel.expired && LISTP_EMPTY(slot)) {
+        size_t idx = slot - &g_timer_wheel.slots[0][0];
+        g_timer_wheel.pending[idx / TIMER_WHEEL_SLOTS] &= ~(1UL << (idx % TIMER_WHEEL_SLOTS));
+    }
+}
+
+/* Move time forward to `now`: timers which expired are moved to `g_timer_wheel.expired`, timers in
+ * slots that `now` passed are moved to lower levels. */
+static void timer_wheel_advance(uint64_t now) {
+    assert(locked(&async_worker_lock));
+
+    if (now <= g_timer_wheel.now)
+        return;
+
+    LISTP_TYPE(async_event) todo = LISTP_INIT;
+    for (unsigned int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        unsigned int shift = level * TIMER_WHEEL_BITS;
+        uint64_t old_pos = g_timer_wheel.now >> shift;
+        uint64_t new_pos = now >> shift;
+        if (old_pos == new_pos) {
+            /* higher levels didn't move either */
+            break;
+        }
+
+        /* slots old_pos + 1 .. new_pos (modulo TIMER_WHEEL_SLOTS) were passed */
+        uint64_t passed = new_pos - old_pos;
+        uint64_t mask = ~0UL;
+        if (passed < TIMER_WHEEL_SLOTS) {
+            unsigned int first = (old_pos + 1) % TIMER_WHEEL_SLOTS;
+            mask = rotate_right((1UL << passed) - 1, TIMER_WHEEL_SLOTS - first);
+        }
+        mask &= g_timer_wheel.pending[level];
+        g_timer_wheel.pending[level] &= ~mask;
+
+        while (mask) {
+            unsigned int slot = __builtin_ctzl(mask);
+            mask &= mask - 1;
+            LISTP_SPLICE_TAIL_INIT(&g_timer_wheel.slots[level][slot], &todo, list, async_event);
+        }
+    }
+
+    g_timer_wheel.now = now;
+
+    struct async_event* tmp;
+    struct async_event* n;
+    LISTP_FOR_EACH_ENTRY_SAFE(tmp, n, &todo, list) {
+        LISTP_DEL(tmp, &todo, list);
+        timer_wheel_add(tmp);
+    }
+}
+
+/* Returns the earliest expiration time of pending alarms/timers, or 0 if there are none. */
+static uint64_t timer_wheel_next_expire_time(void) {
+    assert(locked(&async_worker_lock));
+
+    if (!LISTP_EMPTY(&g_timer_wheel.expired))
+        return g_timer_wheel.now;
+
+    uint64_t next_expire_time = 0;
+    for (unsigned int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        uint64_t pending = g_timer_wheel.pending[level];
+        if (!pending)
+            continue;
+
+        /* slots following the current position are in the order of expiration, and all timers of
+         * the first non-empty one expire before the timers of the others */
+        unsigned int shift = level * TIMER_WHEEL_BITS;
+        unsigned int first = ((g_timer_wheel.now >> shift) + 1) % TIMER_WHEEL_SLOTS;
+        unsigned int slot = (first + __builtin_ctzl(rotate_right(pending, first)))
+                            % TIMER_WHEEL_SLOTS;
+
+        struct async_event* tmp;
+        LISTP_FOR_EACH_ENTRY(tmp, &g_timer_wheel.slots[level][slot], list) {
+            if (!next_expire_time || next_expire_time > tmp->expire_time)
+                next_expire_time = tmp->expire_time;
+        }
+    }
+    return next_expire_time;
+}
+
 /* Threads register async events like alarm(), setitimer(), ioctl(FIOASYNC)
- * using this function. These events are enqueued in async_list and delivered
+ * using this function. These events are enqueued in async_list (or the timer wheel) and delivered
  * to async worker thread by triggering install_new_event. When event is
  * triggered in async worker thread, the corresponding event's callback with
  * arguments `arg` is called. This callback typically sends a signal to the
@@ -52,11 +209,12 @@ static int create_async_worker(void);
  *
  * Function returns remaining usecs for alarm/timer events (same as alarm())
  * or 0 for async IO events. On error, it returns a negated error code.
+ *
+ * LibOS-internal timers which must not interfere with alarms use install_async_timer() instead.
  */
-int64_t install_async_event(PAL_HANDLE object, uint64_t time,
-                            void (*callback)(IDTYPE caller, void* arg), void* arg) {
-    /* if event happens on object, time must be zero */
-    assert(!object || (object && !time));
+static int64_t __install_async_event(PAL_HANDLE object, uint64_t time,
+                                     void (*callback)(IDTYPE caller, void* arg), void* arg,
+                                     enum async_event_type type, struct async_event** out_event) {
 
     uint64_t now = 0;
     int ret = DkSystemTimeQuery(&now);
@@ -76,23 +234,23 @@ int64_t install_async_event(PAL_HANDLE object, uint64_t time,
     event->caller      = get_cur_tid();
     event->object      = object;
     event->expire_time = time ? now + time : 0;
+    event->type        = type;
+    event->timer_slot  = NULL;
 
     lock(&async_worker_lock);
 
-    if (callback != &cleanup_thread && !object) {
+    if (type == ASYNC_EVENT_ALARM) {
         /* This is alarm() or setitimer() emulation, treat both according to
          * alarm() syscall semantics: cancel any pending alarm/timer. */
-        struct async_event* tmp;
-        struct async_event* n;
-        LISTP_FOR_EACH_ENTRY_SAFE(tmp, n, &async_list, list) {
-            if (tmp->expire_time) {
-                /* this is a pending alarm/timer, cancel it and save its expiration time */
-                if (max_prev_expire_time < tmp->expire_time)
-                    max_prev_expire_time = tmp->expire_time;
-
-                LISTP_DEL(tmp, &async_list, list);
-                free(tmp);
-            }
+        if (g_pending_alarm) {
+            /* save expiration time of the cancelled alarm/timer */
+            if (max_prev_expire_time < g_pending_alarm->expire_time)
+                max_prev_expire_time = g_pending_alarm->expire_time;
+
+            timer_wheel_del(g_pending_alarm);
+            free(g_pending_alarm);
+            g_pending_alarm = NULL;
+            g_async_cancelled[type]++;
         }
 
         if (!time) {
@@ -102,10 +260,19 @@ int64_t install_async_event(PAL_HANDLE object, uint64_t time,
             unlock(&async_worker_lock);
             return max_prev_expire_time - now;
         }
+
+        g_pending_alarm = event;
     }
 
     INIT_LIST_HEAD(event, list);
-    LISTP_ADD_TAIL(event, &async_list, list);
+    if (event->expire_time) {
+        timer_wheel_add(event);
+    } else {
+        LISTP_ADD_TAIL(event, &async_list, list);
+    }
+    g_async_installed[type]++;
+    if (out_event)
+        *out_event = event;
 
     if (async_worker_state == WORKER_NOTALIVE) {
         int ret = create_async_worker();
@@ -122,6 +289,58 @@ int64_t install_async_event(PAL_HANDLE object, uint64_t time,
     return max_prev_expire_time - now;
 }
 
+int64_t install_async_event(PAL_HANDLE object, uint64_t time,
+                            void (*callback)(IDTYPE caller, void* arg), void* arg) {
+    /* if event happens on object, time must be zero */
+    assert(!object || (object && !time));
+
+    enum async_event_type type = object ? ASYNC_EVENT_IO
+                                 : callback == &cleanup_thread ? ASYNC_EVENT_CLEANUP
+                                 : ASYNC_EVENT_ALARM;
+    return __install_async_event(object, time, callback, arg, type, /*out_event=*/NULL);
+}
+
+/* Calls `callback` once in the async worker thread after `time` usecs. Unlike alarm/timer events
+ * installed with install_async_event(), such timers are independent of each other. If `out_timer`
+ * is not NULL, it receives the timer for cancel_async_timer(); the timer is freed after `callback`
+ * returns. */
+int install_async_timer(uint64_t time, void (*callback)(IDTYPE caller, void* arg), void* arg,
+                        struct async_event** out_timer) {
+    assert(time);
+
+    int64_t ret = __install_async_event(/*object=*/NULL, time, callback, arg, ASYNC_EVENT_TIMER,
+                                        out_timer);
+    return ret < 0 ? ret : 0;
+}
+
+/* Cancels `timer` installed with install_async_timer(). Returns false if it is too late: the
+ * callback is running or about to run (the caller must synchronize with it). */
+bool cancel_async_timer(struct async_event* timer) {
+    lock(&async_worker_lock);
+    bool cancelled = timer->timer_slot != NULL;
+    if (cancelled) {
+        timer_wheel_del(timer);
+        g_async_cancelled[timer->type]++;
+    }
+    unlock(&async_worker_lock);
+
+    if (cancelled)
+        free(timer);
+    return cancelled;
+}
+
+void print_async_stats(void) {
+    for (size_t i = 0; i < ASYNC_EVENT_TYPES; i++) {
+        uint64_t installed = __atomic_load_n(&g_async_installed[i], __ATOMIC_RELAXED);
+        if (!installed)
+            continue;
+        log_debug("async %s events: %lu installed, %lu triggered, %lu cancelled\n",
+                  async_event_type_names[i], installed,
+                  __atomic_load_n(&g_async_triggered[i], __ATOMIC_RELAXED),
+                  __atomic_load_n(&g_async_cancelled[i], __ATOMIC_RELAXED));
+    }
+}
+
 int init_async_worker(void) {
     /* early enough in init, can write global vars without the lock */
     async_worker_state = WORKER_NOTALIVE;
@@ -155,6 +374,7 @@ static void shim_async_worker(void* arg) {
 
     if (notme) {
         put_thread(self);
+        destroy_thread_slab_cache();
         DkThreadExit(/*clear_child_tid=*/NULL);
         /* UNREACHABLE */
     }
@@ -164,10 +384,9 @@ static void shim_async_worker(void* arg) {
     log_debug("Async worker thread started\n");
 
     /* Simple heuristic to not burn cycles when no async events are installed:
-     * async worker thread sleeps IDLE_SLEEP_TIME for MAX_IDLE_CYCLES and
-     * if nothing happens, dies. It will be re-spawned if some thread wants
-     * to install a new event. */
-    uint64_t idle_cycles = 0;
+     * if nothing happens for MAX_IDLE_TIME, async worker thread dies. It will
+     * be re-spawned if some thread wants to install a new event. */
+    uint64_t idle_start = 0;
 
     /* init `pals` so that it always contains at least install_new_event */
     size_t pals_max_cnt = 32;
@@ -206,14 +425,15 @@ static void shim_async_worker(void* arg) {
             break;
         }
 
-        uint64_t next_expire_time = 0;
+        timer_wheel_advance(now);
+        uint64_t next_expire_time = timer_wheel_next_expire_time();
         size_t pals_cnt = 0;
 
         struct async_event* tmp;
         struct async_event* n;
         bool other_event = false;
         LISTP_FOR_EACH_ENTRY_SAFE(tmp, n, &async_list, list) {
-            /* repopulate `pals` with IO events and find the next expiring alarm/timer */
+            /* repopulate `pals` with IO events */
             if (tmp->object) {
                 if (pals_cnt == pals_max_cnt) {
                     /* grow `pals` to accommodate more objects */
@@ -250,11 +470,6 @@ static void shim_async_worker(void* arg) {
                 pal_events[pals_cnt + 1] = PAL_WAIT_READ;
                 ret_events[pals_cnt + 1] = 0;
                 pals_cnt++;
-            } else if (tmp->expire_time && tmp->expire_time > now) {
-                if (!next_expire_time || next_expire_time > tmp->expire_time) {
-                    /* use time of the next expiring alarm/timer */
-                    next_expire_time = tmp->expire_time;
-                }
             } else {
                 /* cleanup events do not have an object nor a timeout */
                 other_event = true;
@@ -263,18 +478,20 @@ static void shim_async_worker(void* arg) {
 
         uint64_t sleep_time;
         if (next_expire_time) {
-            sleep_time  = next_expire_time - now;
-            idle_cycles = 0;
+            /* use time of the next expiring alarm/timer */
+            sleep_time = next_expire_time > now ? next_expire_time - now : 0;
+            idle_start = 0;
         } else if (pals_cnt || other_event) {
             sleep_time = NO_TIMEOUT;
-            idle_cycles = 0;
+            idle_start = 0;
         } else {
             /* no async IO events and no timers/alarms: thread is idling */
-            sleep_time = IDLE_SLEEP_TIME;
-            idle_cycles++;
+            if (!idle_start)
+                idle_start = now;
+            sleep_time = idle_start + MAX_IDLE_TIME > now ? idle_start + MAX_IDLE_TIME - now : 0;
         }
 
-        if (idle_cycles == MAX_IDLE_CYCLES) {
+        if (idle_start && !sleep_time) {
             async_worker_state  = WORKER_NOTALIVE;
             async_worker_thread = NULL;
             unlock(&async_worker_lock);
@@ -325,25 +542,32 @@ static void shim_async_worker(void* arg) {
             }
         }
 
-        /* check if exit-child or alarm/timer events were triggered */
+        /* check if exit-child events were triggered */
         LISTP_FOR_EACH_ENTRY_SAFE(tmp, n, &async_list, list) {
-            if (tmp->callback == &cleanup_thread) {
+            if (tmp->type == ASYNC_EVENT_CLEANUP) {
                 log_debug("Thread exited, cleaning up\n");
                 LISTP_DEL(tmp, &async_list, list);
                 LISTP_ADD_TAIL(tmp, &triggered, triggered_list);
-            } else if (tmp->expire_time && tmp->expire_time <= now) {
-                log_debug("Alarm/timer triggered at %lu (expired at %lu)\n", now, tmp->expire_time);
-                LISTP_DEL(tmp, &async_list, list);
-                LISTP_ADD_TAIL(tmp, &triggered, triggered_list);
             }
         }
 
+        /* check if alarm/timer events were triggered */
+        timer_wheel_advance(now);
+        LISTP_FOR_EACH_ENTRY_SAFE(tmp, n, &g_timer_wheel.expired, list) {
+            log_debug("Alarm/timer triggered at %lu (expired at %lu)\n", now, tmp->expire_time);
+            timer_wheel_del(tmp);
+            if (tmp == g_pending_alarm)
+                g_pending_alarm = NULL;
+            LISTP_ADD_TAIL(tmp, &triggered, triggered_list);
+        }
+
         unlock(&async_worker_lock);
 
         /* call callbacks for all triggered events */
         if (!LISTP_EMPTY(&triggered)) {
             LISTP_FOR_EACH_ENTRY_SAFE(tmp, n, &triggered, triggered_list) {
                 LISTP_DEL(tmp, &triggered, triggered_list);
+                __atomic_add_fetch(&g_async_triggered[tmp->type], 1, __ATOMIC_RELAXED);
                 tmp->callback(tmp->caller, tmp->arg);
                 if (!tmp->object) {
                     /* this is a one-off exit-child or alarm/timer event */
@@ -359,6 +583,7 @@ static void shim_async_worker(void* arg) {
     free(pals);
     free(pal_events);
 
+    destroy_thread_slab_cache();
     DkThreadExit(/*clear_child_tid=*/NULL);
     /* UNREACHABLE */
 
@@ -367,6 +592,7 @@ out_err_unlock:
 out_err:
     log_error("Terminating the process due to a fatal error in async worker\n");
     put_thread(self);
+    log_flush(/*crashing=*/true);
     DkProcessExit(1);
 }
 
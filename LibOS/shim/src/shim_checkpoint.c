@@ -12,9 +12,9 @@
 #include <stdarg.h>
 #include <stdint.h>
 
-#include "list.h"
 #include "pal.h"
 #include "pal_error.h"
+#include "shim_flags_conv.h"
 #include "shim_fs.h"
 #include "shim_handle.h"
 #include "shim_internal.h"
@@ -26,37 +26,51 @@
 #include "shim_vma.h"
 
 #define CP_MMAP_FLAGS    (MAP_PRIVATE | MAP_ANONYMOUS | VMA_INTERNAL)
-#define CP_MAP_ENTRY_NUM 64
-#define CP_HASH_SIZE     256
+#define CP_MAP_MIN_SIZE  256
+#define CP_MAX_STREAMS   16
 
-DEFINE_LIST(cp_map_entry);
-struct cp_map_entry {
-    LIST_TYPE(cp_map_entry) hlist;
-    struct shim_cp_map_entry entry;
-};
+/* Checkpointed memory is split into pieces of at most this size, which are spread over the memory
+ * streams (see `transfer_mem_stream`). */
+#define CP_MEM_PIECE_SIZE (16 * 1024 * 1024UL)
+
+static size_t g_fork_streams_cnt = 1;
+static bool g_fork_lazy_memory = false;
 
-DEFINE_LISTP(cp_map_entry);
+/* Map of objects already added to the checkpoint: an open-addressing hash table with linear
+ * probing, kept at most half full. A slot with `addr == NULL` is free. */
 struct cp_map {
-    struct cp_map_buffer {
-        struct cp_map_buffer* next;
-        size_t num;
-        size_t cnt;
-        struct cp_map_entry entries[0];
-    }* buffers;
-    LISTP_TYPE(cp_map_entry) head[CP_HASH_SIZE];
+    struct shim_cp_map_entry* entries;
+    size_t size; /* power of two */
+    size_t cnt;
 };
 
-static struct cp_map_buffer* extend_cp_map(struct cp_map* map) {
-    struct cp_map_buffer* buffer = malloc(sizeof(struct cp_map_buffer) +
-                                          sizeof(struct cp_map_entry) * CP_MAP_ENTRY_NUM);
-    if (!buffer)
-        return NULL;
+/* number of objects in the last checkpoint of this process; the next one is likely similar, so
+ * its map is preallocated accordingly and rarely needs to grow */
+static size_t g_cp_map_last_cnt = 0;
+
+static struct shim_cp_map_entry* find_cp_map_slot(struct shim_cp_map_entry* entries, size_t size,
+                                                  void* addr) {
+    size_t mask = size - 1;
+    size_t i = hash64((uint64_t)addr) & mask;
+    while (entries[i].addr && entries[i].addr != addr)
+        i = (i + 1) & mask;
+    return &entries[i];
+}
+
+static int resize_cp_map(struct cp_map* map, size_t new_size) {
+    struct shim_cp_map_entry* new_entries = calloc(new_size, sizeof(*new_entries));
+    if (!new_entries)
+        return -ENOMEM;
+
+    for (size_t i = 0; i < map->size; i++) {
+        if (map->entries[i].addr)
+            *find_cp_map_slot(new_entries, new_size, map->entries[i].addr) = map->entries[i];
+    }
 
-    buffer->next = map->buffers;
-    buffer->num  = CP_MAP_ENTRY_NUM;
-    buffer->cnt  = 0;
-    map->buffers = buffer;
-    return buffer;
+    free(map->entries);
+    map->entries = new_entries;
+    map->size    = new_size;
+    return 0;
 }
 
 void* create_cp_map(void) {
@@ -64,10 +78,15 @@ void* create_cp_map(void) {
     if (!map)
         return NULL;
 
-    memset(map, 0, sizeof(*map));
+    size_t size = CP_MAP_MIN_SIZE;
+    size_t estimate = __atomic_load_n(&g_cp_map_last_cnt, __ATOMIC_RELAXED);
+    while (size < estimate * 2)
+        size *= 2;
 
-    struct cp_map_buffer* buffer = extend_cp_map(map);
-    if (!buffer) {
+    map->entries = NULL;
+    map->size    = 0;
+    map->cnt     = 0;
+    if (resize_cp_map(map, size) < 0) {
         free(map);
         return NULL;
     }
@@ -78,52 +97,35 @@ void* create_cp_map(void) {
 void destroy_cp_map(void* _map) {
     struct cp_map* map = (struct cp_map*)_map;
 
-    struct cp_map_buffer* buffer = map->buffers;
-    while (buffer) {
-        struct cp_map_buffer* next = buffer->next;
-        free(buffer);
-        buffer = next;
-    }
+    __atomic_store_n(&g_cp_map_last_cnt, map->cnt, __ATOMIC_RELAXED);
 
+    free(map->entries);
     free(map);
 }
 
 struct shim_cp_map_entry* get_cp_map_entry(void* _map, void* addr, bool create) {
     struct cp_map* map = (struct cp_map*)_map;
-
-    struct shim_cp_map_entry* e = NULL;
+    assert(addr);
 
     /* check if object at this addr was already added to the checkpoint */
-    uint64_t hash = hash64((uint64_t)addr) % CP_HASH_SIZE;
-    LISTP_TYPE(cp_map_entry)* head = &map->head[hash];
-
-    struct cp_map_entry* tmp;
-    LISTP_FOR_EACH_ENTRY(tmp, head, hlist)
-        if (tmp->entry.addr == addr)
-            e = &tmp->entry;
-
-    if (e)
+    struct shim_cp_map_entry* e = find_cp_map_slot(map->entries, map->size, addr);
+    if (e->addr)
         return e;
 
     /* object at this addr wasn't yet added to the checkpoint */
     if (!create)
         return NULL;
 
-    struct cp_map_buffer* buffer = map->buffers;
-
-    if (buffer->cnt == buffer->num) {
-        buffer = extend_cp_map(map);
-        if (!buffer)
+    if ((map->cnt + 1) * 2 > map->size) {
+        if (resize_cp_map(map, map->size * 2) < 0)
             return NULL;
+        e = find_cp_map_slot(map->entries, map->size, addr);
     }
 
-    struct cp_map_entry* new = &buffer->entries[buffer->cnt++];
-    INIT_LIST_HEAD(new, hlist);
-    LISTP_ADD(new, head, hlist);
-
-    new->entry.addr = addr;
-    new->entry.off  = 0;
-    return &new->entry;
+    map->cnt++;
+    e->addr = addr;
+    e->off  = 0;
+    return e;
 }
 
 BEGIN_CP_FUNC(memory) {
@@ -213,51 +215,477 @@ BEGIN_RS_FUNC(qstr) {
 }
 END_RS_FUNC(qstr)
 
-static int send_memory_on_stream(PAL_HANDLE stream, struct shim_cp_store* store) {
-    int ret = 0;
+static bool is_zero_mem(const void* addr, size_t size) {
+    if (IS_ALIGNED_PTR_POW2(addr, sizeof(uint64_t)) && IS_ALIGNED_POW2(size, sizeof(uint64_t))) {
+        const uint64_t* words = addr;
+        for (size_t i = 0; i < size / sizeof(*words); i++)
+            if (words[i])
+                return false;
+        return true;
+    }
+
+    const char* bytes = addr;
+    for (size_t i = 0; i < size; i++)
+        if (bytes[i])
+            return false;
+    return true;
+}
+
+static int send_mem_run(PAL_HANDLE stream, char* addr, size_t size, bool zero) {
+    struct shim_mem_run run = {
+        .size = size,
+        .zero = zero,
+    };
+    int ret = write_exact(stream, &run, sizeof(run));
+    if (ret < 0 || zero)
+        return ret;
+    return write_exact(stream, addr, size);
+}
+
+/* Sends memory at [addr, addr + size) page by page, merging adjacent pages into zero and non-zero
+ * runs. Untouched parts of large heaps thus cost neither the copy nor the encryption. */
+static int send_mem_runs(PAL_HANDLE stream, char* addr, size_t size, size_t* zero_size) {
+    size_t run_start = 0;
+    bool run_zero = false;
+    size_t chunk;
+
+    for (size_t off = 0; off < size; off += chunk) {
+        chunk = MIN(size - off, ALLOC_ALIGNMENT);
+        bool zero = is_zero_mem(addr + off, chunk);
+        if (off > run_start && zero != run_zero) {
+            int ret = send_mem_run(stream, addr + run_start, off - run_start, run_zero);
+            if (ret < 0)
+                return ret;
+            if (run_zero)
+                *zero_size += off - run_start;
+            run_start = off;
+        }
+        run_zero = zero;
+    }
+
+    if (size > run_start) {
+        if (run_zero)
+            *zero_size += size - run_start;
+        return send_mem_run(stream, addr + run_start, size - run_start, run_zero);
+    }
+    return 0;
+}
+
+/* zero runs are skipped: the memory was just allocated and is already zeroed */
+static int receive_mem_runs(PAL_HANDLE stream, char* addr, size_t size) {
+    size_t received = 0;
+    while (received < size) {
+        struct shim_mem_run run;
+        int ret = read_exact(stream, &run, sizeof(run));
+        if (ret < 0)
+            return ret;
+        if (!run.size || run.size > size - received) {
+            log_error("malformed memory run in checkpoint\n");
+            return -EINVAL;
+        }
+        if (!run.zero) {
+            ret = read_exact(stream, addr + received, run.size);
+            if (ret < 0)
+                return ret;
+        }
+        received += run.size;
+    }
+    return 0;
+}
+
+/* Memory entry of a lazily restored checkpoint (see `start_lazy_memory`). */
+struct lazy_mem_entry {
+    struct shim_mem_entry* entry;
+    char* data;      /* received contents, copied into place on installation */
+    size_t received; /* bytes of `data` received so far, updated atomically */
+    bool installed;
+};
+
+/* One of the streams over which checkpointed memory is transferred (see `transfer_memory`). */
+struct mem_stream {
+    PAL_HANDLE handle;
+    size_t idx;
+    size_t cnt;
+    struct shim_mem_entry* entries;
+    bool send;
+    size_t zero_size; /* bytes elided as zero pages (only when sending) */
+    /* if receiving lazily: received memory goes to these entries, `progress` is set whenever one
+     * of them is complete */
+    struct lazy_mem_entry* lazy;
+    PAL_HANDLE progress;
+    int ret;
+    PAL_HANDLE thread;
+    AEVENTTYPE* done;
+    /* cleared by `DkThreadExit` once the thread of this stream doesn't use any resources */
+    int clear_on_exit;
+};
+
+/*
+ * Transfers the pieces of memory entries assigned to stream `ms`. Each piece goes to the stream
+ * with the fewest bytes assigned so far; the parent and the child walk the same list of entries,
+ * so they arrive at the same assignment without exchanging it.
+ */
+static int transfer_mem_stream(struct mem_stream* ms) {
+    size_t loads[CP_MAX_STREAMS] = { 0 };
+    size_t idx = 0;
+
+    for (struct shim_mem_entry* entry = ms->entries; entry; entry = entry->next, idx++) {
+        for (size_t off = 0; off < entry->size; off += CP_MEM_PIECE_SIZE) {
+            size_t size = MIN(entry->size - off, CP_MEM_PIECE_SIZE);
+
+            size_t target = 0;
+            for (size_t i = 1; i < ms->cnt; i++)
+                if (loads[i] < loads[target])
+                    target = i;
+            loads[target] += size;
+            if (target != ms->idx)
+                continue;
+
+            char* addr = (ms->lazy ? ms->lazy[idx].data : (char*)entry->addr) + off;
+            int ret = ms->send ? send_mem_runs(ms->handle, addr, size, &ms->zero_size)
+                               : receive_mem_runs(ms->handle, addr, size);
+            if (ret < 0)
+                return ret;
+
+            if (ms->lazy && __atomic_add_fetch(&ms->lazy[idx].received, size, __ATOMIC_RELEASE)
+                                == entry->size)
+                DkEventSet(ms->progress);
+        }
+    }
+    return 0;
+}
+
+static void mem_stream_worker(void* arg) {
+    struct mem_stream* ms = arg;
+
+    /* no shim thread and no log prefix: in the child, this runs before LibOS is initialized */
+    shim_tcb_init();
+
+    ms->ret = transfer_mem_stream(ms);
+    if (set_event(ms->done, 1) < 0)
+        BUG();
+    DkThreadExit(&ms->clear_on_exit);
+    /* Unreachable. */
+}
+
+/*
+ * Transfers memory over all `cnt` streams at once. The first stream is handled by the calling
+ * thread, each other one by a thread of its own; if creating a thread fails (e.g. there are no
+ * free SGX thread slots), its stream is handled by the calling thread afterwards. Both sides handle
+ * such streams in the same order, so they can't wait for each other.
+ */
+static int transfer_memory(struct mem_stream* streams, size_t cnt) {
+    AEVENTTYPE done = { 0 };
+    size_t threads_cnt = 0;
+    int ret;
+
+    if (cnt > 1) {
+        ret = create_event(&done);
+        if (ret < 0)
+            return ret;
+    }
+
+    for (size_t i = 1; i < cnt; i++) {
+        streams[i].done = &done;
+        streams[i].clear_on_exit = 1;
+        if (DkThreadCreate(mem_stream_worker, &streams[i], &streams[i].thread) < 0) {
+            streams[i].thread = NULL;
+            continue;
+        }
+        threads_cnt++;
+    }
+
+    ret = transfer_mem_stream(&streams[0]);
+    for (size_t i = 1; i < cnt && !ret; i++)
+        if (!streams[i].thread)
+            ret = transfer_mem_stream(&streams[i]);
+
+    for (size_t i = 0; i < threads_cnt; i++)
+        if (wait_event(&done) < 0)
+            BUG();
+
+    for (size_t i = 1; i < cnt; i++) {
+        if (!streams[i].thread)
+            continue;
+        while (__atomic_load_n(&streams[i].clear_on_exit, __ATOMIC_ACQUIRE))
+            CPU_RELAX();
+        DkObjectClose(streams[i].thread);
+        streams[i].thread = NULL;
+        ret = ret ?: streams[i].ret;
+    }
+
+    destroy_event(&done);
+    return ret;
+}
 
-    struct shim_mem_entry* entry = store->first_mem_entry;
-    while (entry) {
-        size_t mem_size = entry->size;
-        void* mem_addr  = entry->addr;
-        int mem_prot    = entry->prot;
+/* Streams before `first` are the process handle itself, owned by the caller. */
+static void close_mem_streams(struct mem_stream* streams, size_t first, size_t cnt) {
+    for (size_t i = first; i < cnt; i++) {
+        if (streams[i].handle) {
+            DkObjectClose(streams[i].handle);
+            streams[i].handle = NULL;
+        }
+    }
+}
 
-        if (!(mem_prot & PAL_PROT_READ) && mem_size > 0) {
+/*
+ * Additional memory streams (from index `first` on) are pipes from the parent to a pipe server of
+ * the child. The child sends the server URI over the process stream, then the parent connects
+ * `cnt - first` times and begins each connection with the index of its stream.
+ */
+static int connect_mem_streams(PAL_HANDLE child, struct mem_stream* streams, size_t first,
+                               size_t cnt) {
+    char uri[PIPE_URI_SIZE];
+    int ret = read_exact(child, uri, sizeof(uri));
+    if (ret < 0)
+        return ret;
+    uri[sizeof(uri) - 1] = '\0';
+
+    for (uint32_t i = first; i < cnt; i++) {
+        ret = DkStreamOpen(uri, 0, 0, 0, 0, &streams[i].handle);
+        if (ret < 0) {
+            streams[i].handle = NULL;
+            return pal_to_unix_errno(ret);
+        }
+        ret = write_exact(streams[i].handle, &i, sizeof(i));
+        if (ret < 0)
+            return ret;
+    }
+    return 0;
+}
+
+static int accept_mem_streams(PAL_HANDLE parent, struct mem_stream* streams, size_t first,
+                              size_t cnt) {
+    char uri[PIPE_URI_SIZE];
+    PAL_HANDLE srv = NULL;
+    int ret = create_pipe(/*name=*/NULL, uri, sizeof(uri), &srv, /*qstr=*/NULL,
+                          /*use_vmid_for_name=*/false);
+    if (ret < 0)
+        return ret;
+
+    ret = write_exact(parent, uri, sizeof(uri));
+    if (ret < 0)
+        goto out;
+
+    for (size_t i = first; i < cnt; i++) {
+        PAL_HANDLE client;
+        ret = DkStreamWaitForClient(srv, &client);
+        if (ret < 0) {
+            ret = pal_to_unix_errno(ret);
+            goto out;
+        }
+
+        uint32_t idx;
+        ret = read_exact(client, &idx, sizeof(idx));
+        if (ret == 0 && (idx < first || idx >= cnt || streams[idx].handle))
+            ret = -EINVAL;
+        if (ret < 0) {
+            DkObjectClose(client);
+            goto out;
+        }
+        streams[idx].handle = client;
+    }
+
+    ret = 0;
+out:
+    DkObjectClose(srv);
+    return ret;
+}
+
+static void init_mem_streams(struct mem_stream* streams, size_t cnt, PAL_HANDLE handle,
+                             struct shim_mem_entry* entries, bool send) {
+    memset(streams, 0, sizeof(*streams) * cnt);
+    for (size_t i = 0; i < cnt; i++) {
+        streams[i].idx     = i;
+        streams[i].cnt     = cnt;
+        streams[i].entries = entries;
+        streams[i].send    = send;
+    }
+    streams[0].handle = handle;
+}
+
+/* Sends memory of `first_entry` and the following entries over already connected `streams`. */
+static int send_memory(struct mem_stream* streams, size_t streams_cnt,
+                       struct shim_mem_entry* first_entry) {
+    int ret = 0;
+    size_t total_size = 0;
+    size_t zero_size = 0;
+
+    struct shim_mem_entry* entry;
+    for (entry = first_entry; entry; entry = entry->next) {
+        if (!(entry->prot & PAL_PROT_READ) && entry->size > 0) {
             /* make the area readable */
-            ret = DkVirtualMemoryProtect(mem_addr, mem_size, mem_prot | PAL_PROT_READ);
+            ret = DkVirtualMemoryProtect(entry->addr, entry->size, entry->prot | PAL_PROT_READ);
             if (ret < 0) {
-                return pal_to_unix_errno(ret);
+                ret = pal_to_unix_errno(ret);
+                break;
             }
         }
+        total_size += entry->size;
+    }
 
-        ret = write_exact(stream, mem_addr, mem_size);
+    if (!entry)
+        ret = transfer_memory(streams, streams_cnt);
 
-        if (!(mem_prot & PAL_PROT_READ) && mem_size > 0) {
+    for (struct shim_mem_entry* e = first_entry; e != entry; e = e->next) {
+        if (!(e->prot & PAL_PROT_READ) && e->size > 0) {
             /* the area was made readable above; revert to original permissions */
-            int ret2 = DkVirtualMemoryProtect(mem_addr, mem_size, mem_prot);
+            int ret2 = DkVirtualMemoryProtect(e->addr, e->size, e->prot);
             if (ret2 < 0 && !ret) {
                 ret = pal_to_unix_errno(ret2);
             }
         }
+    }
 
-        if (ret < 0) {
-            return ret;
-        }
+    if (ret < 0)
+        return ret;
+
+    for (size_t i = 0; i < streams_cnt; i++)
+        zero_size += streams[i].zero_size;
+    log_debug("sent %lu bytes of memory over %lu streams, %lu of them elided as zero pages\n",
+              total_size, streams_cnt, zero_size);
+    return 0;
+}
 
-        entry = entry->next;
+static int send_memory_on_stream(PAL_HANDLE stream, struct shim_cp_store* store,
+                                 size_t streams_cnt) {
+    int ret = 0;
+
+    struct mem_stream streams[CP_MAX_STREAMS];
+    init_mem_streams(streams, streams_cnt, stream, store->first_mem_entry, /*send=*/true);
+
+    if (streams_cnt > 1) {
+        ret = connect_mem_streams(stream, streams, /*first=*/1, streams_cnt);
+        if (ret < 0)
+            goto out;
     }
 
+    ret = send_memory(streams, streams_cnt, store->first_mem_entry);
+out:
+    close_mem_streams(streams, /*first=*/1, streams_cnt);
+    return ret;
+}
+
+/*
+ * Transfer of checkpointed memory in the background, used with `sys.fork_lazy_memory`: the parent
+ * sends memory while it finishes creating the child, and the child receives it while it already
+ * runs. Memory streams of such a transfer are all pipes, as the process stream is still in use.
+ */
+struct mem_worker {
+    struct mem_stream streams[CP_MAX_STREAMS];
+    size_t streams_cnt;
+    struct shim_mem_entry* first_entry;
+    /* in the child: received contents of memory entries, installed on first access */
+    struct lazy_mem_entry* lazy;
+    size_t lazy_cnt;
+    size_t installed_cnt;
+    struct shim_lock lock; /* serializes installation of entries */
+    /* set whenever an entry is complete (in the child) and when the transfer finishes */
+    PAL_HANDLE progress;
+    bool finished;
+    int ret;
+    PAL_HANDLE thread;
+    /* cleared by `DkThreadExit` once the worker thread doesn't use any resources */
+    int clear_on_exit;
+};
+
+/* the lazily restored memory of this child, until all of it is installed */
+static struct mem_worker* g_lazy_mem = NULL;
+bool g_lazy_memory_pending = false;
+
+static void run_mem_worker(struct mem_worker* w) {
+    w->ret = w->streams[0].send ? send_memory(w->streams, w->streams_cnt, w->first_entry)
+                                : transfer_memory(w->streams, w->streams_cnt);
+    __atomic_store_n(&w->finished, true, __ATOMIC_RELEASE);
+    DkEventSet(w->progress);
+}
+
+static void mem_worker_thread(void* arg) {
+    struct mem_worker* w = arg;
+
+    /* no shim thread, just like memory stream threads (see `mem_stream_worker`) */
+    shim_tcb_init();
+
+    run_mem_worker(w);
+    DkThreadExit(&w->clear_on_exit);
+    /* Unreachable. */
+}
+
+/* Starts the transfer of `w`, whose streams are connected. If there is no thread for it, the
+ * transfer is done synchronously. */
+static int start_mem_worker(struct mem_worker* w) {
+    int ret = DkEventCreate(&w->progress, /*init_signaled=*/false, /*auto_clear=*/true);
+    if (ret < 0) {
+        w->progress = NULL;
+        return pal_to_unix_errno(ret);
+    }
+    for (size_t i = 0; i < w->streams_cnt; i++)
+        w->streams[i].progress = w->progress;
+
+    w->clear_on_exit = 1;
+    if (DkThreadCreate(mem_worker_thread, w, &w->thread) < 0) {
+        w->thread = NULL;
+        run_mem_worker(w);
+    }
     return 0;
 }
 
-static int send_checkpoint_on_stream(PAL_HANDLE stream, struct shim_cp_store* store) {
+static void wait_mem_worker_progress(struct mem_worker* w) {
+    int ret = DkEventWait(w->progress, /*timeout=*/NULL);
+    if (ret < 0 && ret != -PAL_ERROR_INTERRUPTED)
+        BUG();
+}
+
+/* Waits until the transfer of `w` finishes and releases its resources (but not `w` itself).
+ * Returns the result of the transfer. */
+static int finish_mem_worker(struct mem_worker* w) {
+    if (w->progress) {
+        while (!__atomic_load_n(&w->finished, __ATOMIC_ACQUIRE))
+            wait_mem_worker_progress(w);
+        DkObjectClose(w->progress);
+        w->progress = NULL;
+    }
+
+    if (w->thread) {
+        while (__atomic_load_n(&w->clear_on_exit, __ATOMIC_ACQUIRE))
+            CPU_RELAX();
+        DkObjectClose(w->thread);
+        w->thread = NULL;
+    }
+
+    close_mem_streams(w->streams, /*first=*/0, w->streams_cnt);
+    return w->ret;
+}
+
+/*
+ * Connects memory streams of `w` to the child on `stream` and starts sending memory of `store` in
+ * the background (see `struct mem_worker`). `finish_mem_worker` must be called on success.
+ */
+static int start_sending_memory(PAL_HANDLE stream, struct shim_cp_store* store,
+                                size_t streams_cnt, struct mem_worker* w) {
+    memset(w, 0, sizeof(*w));
+    w->streams_cnt = streams_cnt;
+    w->first_entry = store->first_mem_entry;
+    init_mem_streams(w->streams, streams_cnt, /*handle=*/NULL, store->first_mem_entry,
+                     /*send=*/true);
+
+    int ret = connect_mem_streams(stream, w->streams, /*first=*/0, streams_cnt);
+    if (ret == 0)
+        ret = start_mem_worker(w);
+    if (ret < 0)
+        close_mem_streams(w->streams, /*first=*/0, streams_cnt);
+    return ret;
+}
+
+static int send_checkpoint_on_stream(PAL_HANDLE stream, struct shim_cp_store* store,
+                                     size_t mem_streams_cnt) {
     /* first send non-memory entries found at [store->base, store->base + store->offset) */
     int ret = write_exact(stream, (void*)store->base, store->offset);
     if (ret < 0) {
         return ret;
     }
 
-    return send_memory_on_stream(stream, store);
+    return send_memory_on_stream(stream, store, mem_streams_cnt);
 }
 
 static int send_handles_on_stream(PAL_HANDLE stream, struct shim_cp_store* store) {
@@ -268,8 +696,11 @@ static int send_handles_on_stream(PAL_HANDLE stream, struct shim_cp_store* store
         return 0;
 
     struct shim_palhdl_entry** entries = malloc(sizeof(*entries) * entries_cnt);
-    if (!entries)
-        return -ENOMEM;
+    PAL_HANDLE* handles = malloc(sizeof(*handles) * entries_cnt);
+    if (!entries || !handles) {
+        ret = -ENOMEM;
+        goto out;
+    }
 
     /* PAL-handle entries were added in reverse order, let's first populate them */
     struct shim_palhdl_entry* entry = store->last_palhdl_entry;
@@ -280,59 +711,276 @@ static int send_handles_on_stream(PAL_HANDLE stream, struct shim_cp_store* store
     }
     assert(!entry);
 
-    /* now we can traverse PAL-handle entries in correct order and send them one by one */
-    for (size_t i = 0; i < entries_cnt; i++) {
-        /* we need to abort migration if DkSendHandle() returned error, otherwise app may fail */
-        ret = DkSendHandle(stream, entries[i]->handle);
-        if (ret < 0) {
-            ret = pal_to_unix_errno(ret);
-            goto out;
-        }
+    /* now we can collect PAL handles in correct order (the receiver skips empty entries too) */
+    size_t handles_cnt = 0;
+    for (size_t i = 0; i < entries_cnt; i++)
+        if (entries[i]->handle)
+            handles[handles_cnt++] = entries[i]->handle;
+
+    /* send all handles at once, with their host FDs in as few messages as possible; we need to
+     * abort migration if DkSendHandles() returned error, otherwise app may fail */
+    ret = DkSendHandles(stream, handles, handles_cnt);
+    if (ret < 0) {
+        ret = pal_to_unix_errno(ret);
+        goto out;
     }
 
     ret = 0;
 out:
+    free(handles);
     free(entries);
     return ret;
 }
 
-static int receive_memory_on_stream(PAL_HANDLE handle, struct checkpoint_hdr* hdr, uintptr_t base) {
-    ssize_t rebase = base - (uintptr_t)hdr->addr;
+/* Allocates memory of all entries of a received checkpoint, writable so that their contents can be
+ * filled in (or inaccessible until installed, if `lazy`). Rebases the list of entries on the way. */
+static int alloc_mem_entries(struct shim_mem_entry* first_entry, ssize_t rebase, bool lazy) {
+    for (struct shim_mem_entry* entry = first_entry; entry; entry = entry->next) {
+        CP_REBASE(entry->next);
 
-    if (hdr->mem_entries_cnt) {
-        struct shim_mem_entry* entry = (struct shim_mem_entry*)(base + hdr->mem_offset);
+        log_debug("memory entry [%p]: %p-%p\n", entry, entry->addr, entry->addr + entry->size);
 
-        for (; entry; entry = entry->next) {
-            CP_REBASE(entry->next);
+        PAL_PTR addr = ALLOC_ALIGN_DOWN_PTR(entry->addr);
+        PAL_NUM size = (char*)ALLOC_ALIGN_UP_PTR(entry->addr + entry->size) - (char*)addr;
 
-            log_debug("memory entry [%p]: %p-%p\n", entry, entry->addr, entry->addr + entry->size);
+        int ret = DkVirtualMemoryAlloc(&addr, size, 0,
+                                       lazy ? PAL_PROT_NONE : entry->prot | PAL_PROT_WRITE);
+        if (ret < 0) {
+            log_error("failed allocating %p-%p\n", addr, addr + size);
+            return pal_to_unix_errno(ret);
+        }
+    }
+    return 0;
+}
 
+/* Reverts the memory allocated by `alloc_mem_entries` to the original permissions. */
+static int protect_mem_entries(struct shim_mem_entry* first_entry) {
+    for (struct shim_mem_entry* entry = first_entry; entry; entry = entry->next) {
+        if (!(entry->prot & PAL_PROT_WRITE)) {
             PAL_PTR addr = ALLOC_ALIGN_DOWN_PTR(entry->addr);
             PAL_NUM size = (char*)ALLOC_ALIGN_UP_PTR(entry->addr + entry->size) - (char*)addr;
-            PAL_FLG prot = entry->prot;
-
-            int ret = DkVirtualMemoryAlloc(&addr, size, 0, prot | PAL_PROT_WRITE);
+            int ret = DkVirtualMemoryProtect(addr, size, entry->prot);
             if (ret < 0) {
-                log_error("failed allocating %p-%p\n", addr, addr + size);
+                log_error("failed protecting %p-%p\n", addr, addr + size);
                 return pal_to_unix_errno(ret);
             }
+        }
+    }
+    return 0;
+}
 
-            ret = read_exact(handle, entry->addr, entry->size);
-            if (ret < 0) {
-                return ret;
-            }
+/* Makes memory of `le` accessible with its contents, waiting until they are received. Any failure
+ * is fatal: the application already runs and can't do without its memory. */
+static void install_lazy_mem_entry(struct lazy_mem_entry* le) {
+    assert(locked(&g_lazy_mem->lock));
 
-            if (!(prot & PAL_PROT_WRITE)) {
-                ret = DkVirtualMemoryProtect(addr, size, prot);
-                if (ret < 0) {
-                    log_error("failed protecting %p-%p\n", addr, addr + size);
-                    return pal_to_unix_errno(ret);
-                }
-            }
+    if (le->installed)
+        return;
+
+    struct shim_mem_entry* entry = le->entry;
+    while (true) {
+        bool finished = __atomic_load_n(&g_lazy_mem->finished, __ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&le->received, __ATOMIC_ACQUIRE) == entry->size)
+            break;
+        if (finished) {
+            log_error("failed receiving memory from the parent process (%d)\n", g_lazy_mem->ret);
+            DkProcessExit(1);
+        }
+        wait_mem_worker_progress(g_lazy_mem);
+    }
+
+    PAL_PTR addr = ALLOC_ALIGN_DOWN_PTR(entry->addr);
+    PAL_NUM size = (char*)ALLOC_ALIGN_UP_PTR(entry->addr + entry->size) - (char*)addr;
+    int ret = DkVirtualMemoryProtect(addr, size, entry->prot | PAL_PROT_WRITE);
+    if (ret < 0) {
+        log_error("failed installing received memory %p-%p (%d)\n", addr, addr + size, ret);
+        DkProcessExit(1);
+    }
+    memcpy(entry->addr, le->data, entry->size);
+    if (!(entry->prot & PAL_PROT_WRITE)) {
+        ret = DkVirtualMemoryProtect(addr, size, entry->prot);
+        if (ret < 0) {
+            log_error("failed protecting %p-%p (%d)\n", addr, addr + size, ret);
+            DkProcessExit(1);
+        }
+    }
+
+    free(le->data);
+    le->data = NULL;
+    le->installed = true;
+    g_lazy_mem->installed_cnt++;
+}
+
+static bool install_lazy_memory(void* addr, size_t size) {
+    bool found = false;
+
+    lock(&g_lazy_mem->lock);
+    for (size_t i = 0; i < g_lazy_mem->lazy_cnt; i++) {
+        struct lazy_mem_entry* le = &g_lazy_mem->lazy[i];
+        void* start = ALLOC_ALIGN_DOWN_PTR(le->entry->addr);
+        void* end   = ALLOC_ALIGN_UP_PTR(le->entry->addr + le->entry->size);
+        if (!le->installed && (char*)addr < (char*)end && (char*)addr + size > (char*)start) {
+            install_lazy_mem_entry(le);
+            found = true;
         }
     }
+    unlock(&g_lazy_mem->lock);
+    return found;
+}
+
+bool handle_lazy_memory_fault(void* addr) {
+    if (!__atomic_load_n(&g_lazy_memory_pending, __ATOMIC_ACQUIRE))
+        return false;
+    return install_lazy_memory(addr, 1);
+}
+
+void prefault_lazy_memory(void* addr, size_t size) {
+    if (__atomic_load_n(&g_lazy_memory_pending, __ATOMIC_ACQUIRE))
+        install_lazy_memory(addr, size);
+}
+
+void finish_lazy_memory(void) {
+    if (!__atomic_load_n(&g_lazy_memory_pending, __ATOMIC_ACQUIRE))
+        return;
+
+    lock(&g_lazy_mem->lock);
+    if (!g_lazy_memory_pending) {
+        /* another thread finished meanwhile */
+        unlock(&g_lazy_mem->lock);
+        return;
+    }
+    for (size_t i = 0; i < g_lazy_mem->lazy_cnt; i++)
+        install_lazy_mem_entry(&g_lazy_mem->lazy[i]);
+    assert(g_lazy_mem->installed_cnt == g_lazy_mem->lazy_cnt);
+
+    /* all entries are received, so the transfer succeeded */
+    int ret = finish_mem_worker(g_lazy_mem);
+    assert(ret == 0);
+    __UNUSED(ret);
+    log_debug("installed all memory received from the parent process\n");
+
+    __atomic_store_n(&g_lazy_memory_pending, false, __ATOMIC_RELEASE);
+    unlock(&g_lazy_mem->lock);
+
+    /* the lock is not freed, as late readers of `g_lazy_mem` may still take it (they find
+     * nothing to install) */
+}
+
+/*
+ * Starts receiving memory of entries from `first_entry` on in the background (see `struct
+ * mem_worker`). The memory is allocated inaccessible: the first access to an entry, or the first
+ * system call (which may hand memory over to the host), waits for its contents and installs them.
+ * Until then, the child process has no other thread of the application which could access memory.
+ */
+static int start_lazy_memory(PAL_HANDLE handle, struct shim_mem_entry* first_entry,
+                             size_t entries_cnt, size_t streams_cnt, ssize_t rebase) {
+    int ret = alloc_mem_entries(first_entry, rebase, /*lazy=*/true);
+    if (ret < 0)
+        return ret;
+
+    struct mem_worker* w = calloc(1, sizeof(*w));
+    if (!w)
+        return -ENOMEM;
+    if (!create_lock(&w->lock)) {
+        free(w);
+        return -ENOMEM;
+    }
+
+    w->lazy = calloc(entries_cnt, sizeof(*w->lazy));
+    if (!w->lazy) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    w->lazy_cnt = entries_cnt;
+
+    size_t i = 0;
+    for (struct shim_mem_entry* entry = first_entry; entry; entry = entry->next, i++) {
+        assert(i < entries_cnt);
+        w->lazy[i].entry = entry;
+        /* zero runs are not received, see `receive_mem_runs` */
+        w->lazy[i].data = calloc(1, entry->size ?: 1);
+        if (!w->lazy[i].data) {
+            ret = -ENOMEM;
+            goto out;
+        }
+    }
+    if (i != entries_cnt) {
+        ret = -EINVAL;
+        goto out;
+    }
 
+    w->streams_cnt = streams_cnt;
+    w->first_entry = first_entry;
+    init_mem_streams(w->streams, streams_cnt, /*handle=*/NULL, first_entry, /*send=*/false);
+    for (i = 0; i < streams_cnt; i++)
+        w->streams[i].lazy = w->lazy;
+
+    ret = accept_mem_streams(handle, w->streams, /*first=*/0, streams_cnt);
+    if (ret < 0)
+        goto out;
+
+    g_lazy_mem = w;
+    __atomic_store_n(&g_lazy_memory_pending, true, __ATOMIC_RELEASE);
+
+    ret = start_mem_worker(w);
+    if (ret < 0) {
+        __atomic_store_n(&g_lazy_memory_pending, false, __ATOMIC_RELEASE);
+        g_lazy_mem = NULL;
+        goto out;
+    }
+
+    log_debug("receiving memory of %lu entries in the background\n", entries_cnt);
     return 0;
+
+out:
+    close_mem_streams(w->streams, /*first=*/0, w->streams_cnt);
+    if (w->lazy) {
+        for (i = 0; i < entries_cnt; i++)
+            free(w->lazy[i].data);
+        free(w->lazy);
+    }
+    destroy_lock(&w->lock);
+    free(w);
+    return ret;
+}
+
+static int receive_memory_on_stream(PAL_HANDLE handle, struct checkpoint_hdr* hdr, uintptr_t base) {
+    ssize_t rebase = base - (uintptr_t)hdr->addr;
+    int ret;
+
+    if (!hdr->mem_entries_cnt)
+        return 0;
+
+    size_t streams_cnt = hdr->mem_streams_cnt;
+    if (!streams_cnt || streams_cnt > CP_MAX_STREAMS)
+        return -EINVAL;
+
+    struct shim_mem_entry* first_entry = (struct shim_mem_entry*)(base + hdr->mem_offset);
+
+    if (hdr->lazy_memory)
+        return start_lazy_memory(handle, first_entry, hdr->mem_entries_cnt, streams_cnt, rebase);
+
+    ret = alloc_mem_entries(first_entry, rebase, /*lazy=*/false);
+    if (ret < 0)
+        return ret;
+
+    struct mem_stream streams[CP_MAX_STREAMS];
+    init_mem_streams(streams, streams_cnt, handle, first_entry, /*send=*/false);
+
+    if (streams_cnt > 1) {
+        ret = accept_mem_streams(handle, streams, /*first=*/1, streams_cnt);
+        if (ret < 0)
+            goto out;
+    }
+
+    ret = transfer_memory(streams, streams_cnt);
+    if (ret < 0)
+        goto out;
+
+    ret = protect_mem_entries(first_entry);
+out:
+    close_mem_streams(streams, /*first=*/1, streams_cnt);
+    return ret;
 }
 
 static int restore_checkpoint(struct checkpoint_hdr* hdr, uintptr_t base) {
@@ -377,6 +1025,11 @@ static int receive_handles_on_stream(struct checkpoint_hdr* hdr, void* base, ssi
     log_debug("receiving %lu PAL handles\n", entries_cnt);
 
     struct shim_palhdl_entry** entries = malloc(sizeof(*entries) * entries_cnt);
+    PAL_HANDLE* handles = malloc(sizeof(*handles) * entries_cnt);
+    if (!entries || !handles) {
+        ret = -ENOMEM;
+        goto out;
+    }
 
     /* entries are extracted from checkpoint in reverse order, let's first populate them */
     struct shim_palhdl_entry* entry = palhdl_entries;
@@ -389,24 +1042,26 @@ static int receive_handles_on_stream(struct checkpoint_hdr* hdr, void* base, ssi
     }
     assert(!entry);
 
-    /* now we can traverse PAL-handle entries in correct order and receive them one by one */
-    for (size_t i = 0; i < entries_cnt; i++) {
-        entry = entries[i];
-        if (!entry->handle)
-            continue;
+    /* the sender sent handles of all non-empty entries in correct order */
+    size_t handles_cnt = 0;
+    for (size_t i = 0; i < entries_cnt; i++)
+        if (entries[i]->handle)
+            handles_cnt++;
 
-        PAL_HANDLE hdl = NULL;
-        ret = DkReceiveHandle(g_pal_control->parent_process, &hdl);
-        /* need to abort migration if DkReceiveHandle() returned error, otherwise app may fail */
-        if (ret < 0) {
-            ret = pal_to_unix_errno(ret);
-            goto out;
-        }
-        *entry->phandle = hdl;
+    ret = DkReceiveHandles(g_pal_control->parent_process, handles, handles_cnt);
+    /* need to abort migration if DkReceiveHandles() returned error, otherwise app may fail */
+    if (ret < 0) {
+        ret = pal_to_unix_errno(ret);
+        goto out;
     }
 
+    for (size_t i = 0, j = 0; i < entries_cnt; i++)
+        if (entries[i]->handle)
+            *entries[i]->phandle = handles[j++];
+
     ret = 0;
 out:
+    free(handles);
     free(entries);
     return ret;
 }
@@ -458,6 +1113,83 @@ static void* cp_alloc(void* addr, size_t size) {
     return addr;
 }
 
+/* Allocates a space for dumping the checkpoint data. */
+static int init_cp_store(struct shim_cp_store* store) {
+    memset(store, 0, sizeof(*store));
+    store->alloc = cp_alloc;
+    store->bound = CP_INIT_VMA_SIZE;
+
+    while (1) {
+        /* try allocating checkpoint; if allocation fails, try with smaller sizes */
+        store->base = (uintptr_t)cp_alloc(0, store->bound);
+        if (store->base)
+            break;
+
+        store->bound >>= 1;
+        if (store->bound < ALLOC_ALIGNMENT)
+            break;
+    }
+
+    if (!store->base) {
+        log_error("failed allocating enough memory for checkpoint\n");
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+static int free_cp_store(struct shim_cp_store* store) {
+    void* tmp_vma = NULL;
+    int ret = bkeep_munmap((void*)store->base, store->bound, /*is_internal=*/true, &tmp_vma);
+    if (ret < 0) {
+        log_error("failed unmaping checkpoint (ret = %d)\n", ret);
+        return ret;
+    }
+    if (DkVirtualMemoryFree((PAL_PTR)store->base, store->bound) < 0) {
+        BUG();
+    }
+    bkeep_remove_tmp_vma(tmp_vma);
+    return 0;
+}
+
+static void init_checkpoint_hdr(struct checkpoint_hdr* hdr, struct shim_cp_store* store) {
+    memset(hdr, 0, sizeof(*hdr));
+
+    hdr->addr = (void*)store->base;
+    hdr->size = store->offset;
+
+    if (store->mem_entries_cnt) {
+        hdr->mem_offset      = (uintptr_t)store->first_mem_entry - store->base;
+        hdr->mem_entries_cnt = store->mem_entries_cnt;
+    }
+
+    if (store->palhdl_entries_cnt) {
+        hdr->palhdl_offset      = (uintptr_t)store->last_palhdl_entry - store->base;
+        hdr->palhdl_entries_cnt = store->palhdl_entries_cnt;
+    }
+}
+
+int init_fork_streams(void) {
+    assert(g_manifest_root);
+
+    int64_t cnt;
+    int ret = toml_int_in(g_manifest_root, "sys.fork_streams", /*defaultval=*/1, &cnt);
+    if (ret < 0 || cnt < 1 || cnt > CP_MAX_STREAMS) {
+        log_error("Cannot parse 'sys.fork_streams' (the value must be a number between 1 and "
+                  "16)\n");
+        return -EINVAL;
+    }
+
+    g_fork_streams_cnt = cnt;
+
+    ret = toml_bool_in(g_manifest_root, "sys.fork_lazy_memory", /*defaultval=*/false,
+                       &g_fork_lazy_memory);
+    if (ret < 0) {
+        log_error("Cannot parse 'sys.fork_lazy_memory' (the value must be `true` or `false`)\n");
+        return -EINVAL;
+    }
+    return 0;
+}
+
 int create_process_and_send_checkpoint(migrate_func_t migrate_func,
                                        struct shim_child_process* child_process,
                                        struct shim_process* process_description,
@@ -465,6 +1197,13 @@ int create_process_and_send_checkpoint(migrate_func_t migrate_func,
     assert(child_process);
 
     int ret = 0;
+    struct mem_worker mem_worker;
+    bool mem_worker_started = false;
+
+    /* the child connects to this process (and to the IPC leader) during its initialization */
+    ret = start_ipc_worker();
+    if (ret < 0)
+        return ret;
 
     /* FIXME: Child process requires some time to initialize before starting to receive checkpoint
      * data. Parallelizing process creation and checkpointing could improve latency of forking. */
@@ -475,28 +1214,10 @@ int create_process_and_send_checkpoint(migrate_func_t migrate_func,
         goto out;
     }
 
-    /* allocate a space for dumping the checkpoint data */
     struct shim_cp_store cpstore;
-    memset(&cpstore, 0, sizeof(cpstore));
-    cpstore.alloc = cp_alloc;
-    cpstore.bound = CP_INIT_VMA_SIZE;
-
-    while (1) {
-        /* try allocating checkpoint; if allocation fails, try with smaller sizes */
-        cpstore.base = (uintptr_t)cp_alloc(0, cpstore.bound);
-        if (cpstore.base)
-            break;
-
-        cpstore.bound >>= 1;
-        if (cpstore.bound < ALLOC_ALIGNMENT)
-            break;
-    }
-
-    if (!cpstore.base) {
-        ret = -ENOMEM;
-        log_error("failed allocating enough memory for checkpoint\n");
+    ret = init_cp_store(&cpstore);
+    if (ret < 0)
         goto out;
-    }
 
     struct shim_ipc_ids process_ipc_ids = {
         .parent_vmid = g_self_vmid,
@@ -514,20 +1235,9 @@ int create_process_and_send_checkpoint(migrate_func_t migrate_func,
     log_debug("checkpoint of %lu bytes created\n", cpstore.offset);
 
     struct checkpoint_hdr hdr;
-    memset(&hdr, 0, sizeof(hdr));
-
-    hdr.addr = (void*)cpstore.base;
-    hdr.size = cpstore.offset;
-
-    if (cpstore.mem_entries_cnt) {
-        hdr.mem_offset      = (uintptr_t)cpstore.first_mem_entry - cpstore.base;
-        hdr.mem_entries_cnt = cpstore.mem_entries_cnt;
-    }
-
-    if (cpstore.palhdl_entries_cnt) {
-        hdr.palhdl_offset      = (uintptr_t)cpstore.last_palhdl_entry - cpstore.base;
-        hdr.palhdl_entries_cnt = cpstore.palhdl_entries_cnt;
-    }
+    init_checkpoint_hdr(&hdr, &cpstore);
+    hdr.mem_streams_cnt = cpstore.mem_entries_cnt ? g_fork_streams_cnt : 1;
+    hdr.lazy_memory = g_fork_lazy_memory && cpstore.mem_entries_cnt;
 
     /* send a checkpoint header to child process to notify it to start receiving checkpoint */
     ret = write_exact(pal_process, &hdr, sizeof(hdr));
@@ -536,7 +1246,16 @@ int create_process_and_send_checkpoint(migrate_func_t migrate_func,
         goto out;
     }
 
-    ret = send_checkpoint_on_stream(pal_process, &cpstore);
+    if (hdr.lazy_memory) {
+        /* the child starts running before it received all memory, which we send meanwhile */
+        ret = write_exact(pal_process, (void*)cpstore.base, cpstore.offset);
+        if (ret == 0) {
+            ret = start_sending_memory(pal_process, &cpstore, hdr.mem_streams_cnt, &mem_worker);
+            mem_worker_started = ret == 0;
+        }
+    } else {
+        ret = send_checkpoint_on_stream(pal_process, &cpstore, hdr.mem_streams_cnt);
+    }
     if (ret < 0) {
         log_error("failed sending checkpoint (ret = %d)\n", ret);
         goto out;
@@ -548,16 +1267,11 @@ int create_process_and_send_checkpoint(migrate_func_t migrate_func,
         goto out;
     }
 
-    void* tmp_vma = NULL;
-    ret = bkeep_munmap((void*)cpstore.base, cpstore.bound, /*is_internal=*/true, &tmp_vma);
-    if (ret < 0) {
-        log_error("failed unmaping checkpoint (ret = %d)\n", ret);
-        goto out;
-    }
-    if (DkVirtualMemoryFree((PAL_PTR)cpstore.base, cpstore.bound) < 0) {
-        BUG();
+    if (!mem_worker_started) {
+        ret = free_cp_store(&cpstore);
+        if (ret < 0)
+            goto out;
     }
-    bkeep_remove_tmp_vma(tmp_vma);
 
     /* wait for final ack from child process (contains VMID of child) */
     IDTYPE child_vmid = 0;
@@ -587,8 +1301,24 @@ int create_process_and_send_checkpoint(migrate_func_t migrate_func,
         ipc_sublease_send(child_vmid, thread_description->tid);
     }
 
+    if (mem_worker_started) {
+        /* fork() must not return before the memory is sent, as the parent could change it */
+        mem_worker_started = false;
+        ret = finish_mem_worker(&mem_worker);
+        if (ret < 0) {
+            /* the child terminates on its own once it needs the missing memory */
+            log_error("failed sending memory to child process (ret = %d)\n", ret);
+        }
+        ret = free_cp_store(&cpstore);
+        if (ret < 0)
+            goto out;
+    }
+
     ret = 0;
 out:
+    if (mem_worker_started)
+        (void)finish_mem_worker(&mem_worker);
+
     if (pal_process)
         DkObjectClose(pal_process);
 
@@ -599,8 +1329,10 @@ out:
     return ret;
 }
 
-int receive_checkpoint_and_restore(struct checkpoint_hdr* hdr) {
-    int ret = 0;
+/* Maps the checkpoint area described by `hdr`, preferably at the address it was created at. */
+static int map_checkpoint(struct checkpoint_hdr* hdr, void** out_base, PAL_PTR* out_mapaddr,
+                          PAL_NUM* out_mapsize) {
+    int ret;
 
     void* base = hdr->addr;
     PAL_PTR mapaddr = (PAL_PTR)ALLOC_ALIGN_DOWN_PTR(base);
@@ -643,6 +1375,32 @@ int receive_checkpoint_and_restore(struct checkpoint_hdr* hdr) {
 
     log_debug("checkpoint mapped at %p-%p\n", base, base + hdr->size);
 
+    *out_base    = base;
+    *out_mapaddr = mapaddr;
+    *out_mapsize = mapsize;
+    return 0;
+}
+
+static void unmap_checkpoint(PAL_PTR mapaddr, PAL_NUM mapsize) {
+    void* tmp_vma = NULL;
+    if (bkeep_munmap(mapaddr, mapsize, /*is_internal=*/true, &tmp_vma) < 0) {
+        BUG();
+    }
+    if (DkVirtualMemoryFree(mapaddr, mapsize) < 0) {
+        BUG();
+    }
+    bkeep_remove_tmp_vma(tmp_vma);
+}
+
+int receive_checkpoint_and_restore(struct checkpoint_hdr* hdr) {
+    void* base;
+    PAL_PTR mapaddr;
+    PAL_NUM mapsize;
+    int ret = map_checkpoint(hdr, &base, &mapaddr, &mapsize);
+    if (ret < 0) {
+        return ret;
+    }
+
     ret = read_exact(g_pal_control->parent_process, base, hdr->size);
     if (ret < 0) {
         goto out_fail;
@@ -674,14 +1432,181 @@ int receive_checkpoint_and_restore(struct checkpoint_hdr* hdr) {
 
     return 0;
 
-out_fail:;
-    void* tmp_vma = NULL;
-    if (bkeep_munmap(mapaddr, mapsize, /*is_internal=*/true, &tmp_vma) < 0) {
-        BUG();
+out_fail:
+    unmap_checkpoint(mapaddr, mapsize);
+    return ret;
+}
+
+/* Contents of memory entries follow the checkpoint data in the file, in the order of entries. */
+static int write_memory_to_file(PAL_HANDLE file, size_t offset, struct shim_cp_store* store) {
+    for (struct shim_mem_entry* entry = store->first_mem_entry; entry; entry = entry->next) {
+        bool unreadable = !(entry->prot & PAL_PROT_READ) && entry->size > 0;
+        if (unreadable) {
+            /* make the area readable */
+            int ret = DkVirtualMemoryProtect(entry->addr, entry->size,
+                                             entry->prot | PAL_PROT_READ);
+            if (ret < 0)
+                return pal_to_unix_errno(ret);
+        }
+
+        int ret = write_exact_at(file, offset, entry->addr, entry->size);
+
+        if (unreadable) {
+            /* the area was made readable above; revert to original permissions */
+            int ret2 = DkVirtualMemoryProtect(entry->addr, entry->size, entry->prot);
+            if (ret2 < 0 && !ret)
+                ret = pal_to_unix_errno(ret2);
+        }
+        if (ret < 0)
+            return ret;
+
+        offset += entry->size;
     }
-    if (DkVirtualMemoryFree(mapaddr, mapsize) < 0) {
-        BUG();
+    return 0;
+}
+
+static int read_memory_from_file(PAL_HANDLE file, size_t offset, struct checkpoint_hdr* hdr,
+                                 uintptr_t base) {
+    ssize_t rebase = base - (uintptr_t)hdr->addr;
+
+    if (!hdr->mem_entries_cnt)
+        return 0;
+
+    struct shim_mem_entry* first_entry = (struct shim_mem_entry*)(base + hdr->mem_offset);
+
+    int ret = alloc_mem_entries(first_entry, rebase, /*lazy=*/false);
+    if (ret < 0)
+        return ret;
+
+    for (struct shim_mem_entry* entry = first_entry; entry; entry = entry->next) {
+        ret = read_exact_at(file, offset, entry->addr, entry->size);
+        if (ret < 0)
+            return ret;
+        offset += entry->size;
     }
-    bkeep_remove_tmp_vma(tmp_vma);
+
+    return protect_mem_entries(first_entry);
+}
+
+/* PAL handles cannot be stored in a file. Only handles of host files are allowed in such a
+ * checkpoint: they are opened again from their URIs when the checkpoint is restored. */
+static int check_file_handles(struct shim_cp_store* store) {
+    for (struct shim_palhdl_entry* entry = store->last_palhdl_entry; entry; entry = entry->prev) {
+        struct shim_handle* hdl = container_of(entry->phandle, struct shim_handle, pal_handle);
+        if (hdl->type != TYPE_FILE) {
+            log_error("cannot store an open %s in a checkpoint file\n", qstrgetstr(entry->uri));
+            return -EBUSY;
+        }
+    }
+    return 0;
+}
+
+static void clear_file_handles(struct checkpoint_hdr* hdr, void* base, ssize_t rebase) {
+    struct shim_palhdl_entry* entry = NULL;
+    if (hdr->palhdl_entries_cnt)
+        entry = (struct shim_palhdl_entry*)(base + hdr->palhdl_offset);
+
+    /* the handles are invalid in this process, don't let the restore functions see them */
+    for (; entry; entry = entry->prev) {
+        CP_REBASE(entry->prev);
+        CP_REBASE(entry->uri);
+        CP_REBASE(entry->phandle);
+        *entry->phandle = NULL;
+    }
+}
+
+static int reopen_file_handles(struct checkpoint_hdr* hdr, void* base) {
+    struct shim_palhdl_entry* entry = NULL;
+    if (hdr->palhdl_entries_cnt)
+        entry = (struct shim_palhdl_entry*)(base + hdr->palhdl_offset);
+
+    for (; entry; entry = entry->prev) {
+        struct shim_handle* hdl = container_of(entry->phandle, struct shim_handle, pal_handle);
+        const char* uri = qstrgetstr(entry->uri);
+        int ret = DkStreamOpen(uri, LINUX_OPEN_FLAGS_TO_PAL_ACCESS(hdl->flags), /*share_flags=*/0,
+                               /*create=*/0, LINUX_OPEN_FLAGS_TO_PAL_OPTIONS(hdl->flags),
+                               entry->phandle);
+        if (ret < 0) {
+            log_error("failed reopening %s from checkpoint (%d)\n", uri, ret);
+            return pal_to_unix_errno(ret);
+        }
+    }
+    return 0;
+}
+
+int write_checkpoint_to_file(migrate_func_t migrate_func, PAL_HANDLE file, size_t offset,
+                             struct checkpoint_hdr* hdr, struct shim_process* process_description,
+                             struct shim_thread* thread_description,
+                             struct shim_ipc_ids* process_ipc_ids, ...) {
+    struct shim_cp_store cpstore;
+    int ret = init_cp_store(&cpstore);
+    if (ret < 0)
+        return ret;
+
+    va_list ap;
+    va_start(ap, process_ipc_ids);
+    ret = (*migrate_func)(&cpstore, process_description, thread_description, process_ipc_ids, ap);
+    va_end(ap);
+    if (ret < 0) {
+        log_error("failed creating checkpoint (ret = %d)\n", ret);
+        goto out;
+    }
+
+    log_debug("checkpoint of %lu bytes created\n", cpstore.offset);
+
+    ret = check_file_handles(&cpstore);
+    if (ret < 0)
+        goto out;
+
+    init_checkpoint_hdr(hdr, &cpstore);
+
+    ret = write_exact_at(file, offset, (void*)cpstore.base, cpstore.offset);
+    if (ret < 0)
+        goto out;
+
+    ret = write_memory_to_file(file, offset + cpstore.offset, &cpstore);
+    if (ret < 0)
+        goto out;
+
+    log_debug("wrote checkpoint and %lu memory entries to file\n", cpstore.mem_entries_cnt);
+out:;
+    int ret2 = free_cp_store(&cpstore);
+    return ret ?: ret2;
+}
+
+int restore_checkpoint_from_file(PAL_HANDLE file, size_t offset, struct checkpoint_hdr* hdr) {
+    void* base;
+    PAL_PTR mapaddr;
+    PAL_NUM mapsize;
+    int ret = map_checkpoint(hdr, &base, &mapaddr, &mapsize);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = read_exact_at(file, offset, base, hdr->size);
+    if (ret < 0) {
+        goto out_fail;
+    }
+
+    ret = read_memory_from_file(file, offset + hdr->size, hdr, (uintptr_t)base);
+    if (ret < 0) {
+        goto out_fail;
+    }
+    log_debug("restored memory from checkpoint file\n");
+
+    clear_file_handles(hdr, base, (ssize_t)(base - hdr->addr));
+
+    migrated_memory_start = (void*)mapaddr;
+    migrated_memory_end   = (void*)mapaddr + mapsize;
+
+    ret = restore_checkpoint(hdr, (uintptr_t)base);
+    if (ret < 0) {
+        goto out_fail;
+    }
+
+    return reopen_file_handles(hdr, base);
+
+out_fail:
+    unmap_checkpoint(mapaddr, mapsize);
     return ret;
 }
@@ -40,6 +40,7 @@ const PAL_CONTROL* g_pal_control = NULL;
  * functions and by assert.h's assert() defined in the common library. Thus it might be called by
  * any thread, even internal. */
 noreturn void shim_abort(void) {
+    log_flush(/*crashing=*/true);
     DEBUG_BREAK_ON_FAILURE();
     DkProcessExit(1);
 }
@@ -87,6 +88,8 @@ void* migrated_memory_start;
 void* migrated_memory_end;
 
 const char** migrated_envp __attribute_migratable;
+/* set when this process was created by vfork() + execve(): arguments of the new executable */
+const char** migrated_argv;
 
 /* library_paths is populated with LD_PRELOAD entries once during LibOS
  * initialization and is used in __load_interp_object() to search for ELF
@@ -124,7 +127,8 @@ void* allocate_stack(size_t size, size_t protect_size, bool user) {
     }
 
     bool need_mem_free = false;
-    ret = DkVirtualMemoryAlloc(&stack, size + protect_size, 0, PAL_PROT_NONE);
+    ret = DkVirtualMemoryAlloc(&stack, size + protect_size, g_lazy_stacks ? PAL_ALLOC_LAZY : 0,
+                               PAL_PROT_NONE);
     if (ret < 0) {
         goto out_fail;
     }
@@ -306,7 +310,8 @@ int init_stack(const char** argv, const char** envp, const char*** out_argp,
     if (!stack)
         return -ENOMEM;
 
-    /* if there is envp inherited from parent, use it */
+    /* if there is argv or envp inherited from parent, use it */
+    argv = migrated_argv ?: argv;
     envp = migrated_envp ?: envp;
 
     ret = populate_stack(stack, stack_size, argv, envp, out_argp, out_auxv);
@@ -359,6 +364,116 @@ static int read_environs(const char** envp) {
     return 0;
 }
 
+/* Start-up phases of LibOS, reported together with the ones of PAL after all of them (see
+ * `libos.startup_stats`). */
+static struct {
+    const char* name;
+    uint64_t time;
+} g_startup_phases[8];
+static size_t g_startup_phases_cnt = 0;
+static bool g_startup_stats_log = false;
+static char* g_startup_stats_uri = NULL;
+
+void add_startup_phase(const char* name) {
+    if (g_startup_phases_cnt == ARRAY_SIZE(g_startup_phases))
+        return;
+    uint64_t time;
+    if (DkSystemTimeQuery(&time) < 0)
+        return;
+    g_startup_phases[g_startup_phases_cnt].name = name;
+    g_startup_phases[g_startup_phases_cnt].time = time;
+    g_startup_phases_cnt++;
+}
+
+static int init_startup_stats(void) {
+    assert(g_manifest_root);
+
+    int ret = toml_bool_in(g_manifest_root, "libos.startup_stats", /*defaultval=*/false,
+                           &g_startup_stats_log);
+    if (ret < 0) {
+        log_error("Cannot parse 'libos.startup_stats' (the value must be `true` or `false`)\n");
+        return -EINVAL;
+    }
+
+    ret = toml_string_in(g_manifest_root, "libos.startup_stats_file", &g_startup_stats_uri);
+    if (ret < 0 || (g_startup_stats_uri && !strstartswith(g_startup_stats_uri, URI_PREFIX_FILE))) {
+        log_error("Cannot parse 'libos.startup_stats_file' (the value must be a URI starting with "
+                  "\"file:\")\n");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+void report_startup_phases(void) {
+    static bool reported = false;
+    /* only the start-up of the first process goes from the loader to the application */
+    if (reported || g_pal_control->parent_process || (!g_startup_stats_log && !g_startup_stats_uri))
+        return;
+    reported = true;
+
+    add_startup_phase("application entry");
+
+    size_t cnt = g_pal_control->startup_phases_cnt + g_startup_phases_cnt;
+    const char* names[PAL_MAX_STARTUP_PHASES + ARRAY_SIZE(g_startup_phases)];
+    uint64_t times[PAL_MAX_STARTUP_PHASES + ARRAY_SIZE(g_startup_phases)];
+    for (size_t i = 0; i < g_pal_control->startup_phases_cnt; i++) {
+        names[i] = g_pal_control->startup_phases[i].name;
+        times[i] = g_pal_control->startup_phases[i].time;
+    }
+    for (size_t i = 0; i < g_startup_phases_cnt; i++) {
+        names[g_pal_control->startup_phases_cnt + i] = g_startup_phases[i].name;
+        times[g_pal_control->startup_phases_cnt + i] = g_startup_phases[i].time;
+    }
+    if (cnt < 2)
+        return;
+
+    /* phases of the untrusted loader may be timed with a slightly different clock, so negative
+     * durations are reported as 0 */
+    size_t log_size = 2048;
+    size_t json_size = 2048;
+    char* log_buf = malloc(log_size);
+    char* json_buf = malloc(json_size);
+    if (!log_buf || !json_buf)
+        goto out;
+    size_t log_len = 0;
+    size_t json_len = snprintf(json_buf, json_size, "{\"total_us\": %lu, \"phases\": [",
+                               times[cnt - 1] > times[0] ? times[cnt - 1] - times[0] : 0);
+    for (size_t i = 1; i < cnt && log_len < log_size && json_len < json_size; i++) {
+        uint64_t us = times[i] > times[i - 1] ? times[i] - times[i - 1] : 0;
+        log_len += snprintf(log_buf + log_len, log_size - log_len, "%s%s %lu us",
+                            i > 1 ? ", " : "", names[i], us);
+        json_len += snprintf(json_buf + json_len, json_size - json_len,
+                             "%s{\"name\": \"%s\", \"us\": %lu}", i > 1 ? ", " : "", names[i],
+                             us);
+    }
+    if (json_len < json_size)
+        json_len += snprintf(json_buf + json_len, json_size - json_len, "]}\n");
+    if (log_len >= log_size || json_len >= json_size)
+        goto out;
+
+    if (g_startup_stats_log)
+        log_always("startup: %s (total %lu us)\n", log_buf,
+                   times[cnt - 1] > times[0] ? times[cnt - 1] - times[0] : 0);
+
+    if (g_startup_stats_uri) {
+        PAL_HANDLE file = NULL;
+        int ret = DkStreamOpen(g_startup_stats_uri, PAL_ACCESS_WRONLY,
+                               PAL_SHARE_OWNER_R | PAL_SHARE_OWNER_W, PAL_CREATE_TRY,
+                               /*options=*/0, &file);
+        if (ret == 0) {
+            ret = DkStreamSetLength(file, 0);
+            if (ret == 0)
+                ret = write_exact_at(file, /*offset=*/0, json_buf, json_len);
+            DkObjectClose(file);
+        }
+        if (ret < 0)
+            log_warning("Cannot write start-up stats to %s: %d\n", g_startup_stats_uri, ret);
+    }
+out:
+    free(log_buf);
+    free(json_buf);
+}
+
 #define CALL_INIT(func, args...) func(args)
 
 #define RUN_INIT(func, ...)                                                  \
@@ -392,6 +507,7 @@ noreturn void* shim_init(int argc, void* args) {
     g_manifest_root = g_pal_control->manifest_root;
 
     shim_xstate_init();
+    init_string_ops(DkCpuIdRetrieve, STRING_OPS_AVX512);
 
     if (!create_lock(&__master_lock)) {
         log_error("Error during shim_init(): failed to allocate __master_lock\n");
@@ -404,6 +520,8 @@ noreturn void* shim_init(int argc, void* args) {
     RUN_INIT(init_vma);
     RUN_INIT(init_slab);
     RUN_INIT(read_environs, envp);
+    RUN_INIT(init_startup_stats);
+    RUN_INIT(init_syscall_stats);
     RUN_INIT(init_str_mgr);
     RUN_INIT(init_rlimit);
     RUN_INIT(init_fs);
@@ -423,12 +541,16 @@ noreturn void* shim_init(int argc, void* args) {
 
         assert(hdr.size);
         RUN_INIT(receive_checkpoint_and_restore, &hdr);
+    } else {
+        RUN_INIT(init_snapshot);
     }
 
     RUN_INIT(init_mount_root);
     RUN_INIT(init_ipc);
     RUN_INIT(init_process, argc, argv);
     RUN_INIT(init_threading);
+    RUN_INIT(init_uthreads);
+    RUN_INIT(init_sleep);
     RUN_INIT(init_mount);
     RUN_INIT(init_important_handles);
 
@@ -436,13 +558,20 @@ noreturn void* shim_init(int argc, void* args) {
     log_setprefix(shim_get_tcb());
 
     RUN_INIT(init_async_worker);
+    RUN_INIT(init_async_log);
+    RUN_INIT(init_syscall_trace);
+    RUN_INIT(init_timerfd);
+    RUN_INIT(init_sock_coalescing);
+    RUN_INIT(init_fork_streams);
 
     const char** new_argp;
     elf_auxv_t* new_auxv;
     RUN_INIT(init_stack, argv, envp, &new_argp, &new_auxv);
+    add_startup_phase("LibOS initialization");
 
     RUN_INIT(init_loader);
     RUN_INIT(init_signal_handling);
+    RUN_INIT(init_syscall_patching);
     RUN_INIT(init_ipc_worker);
 
     if (g_pal_control->parent_process) {
@@ -6,7 +6,23 @@
  * allocator is in common/include/slabmgr.h.
  *
  * When existing slabs are not sufficient, or a large (4k or greater) allocation is requested, it
- * ends up here (__system_alloc and __system_free).
+ * ends up here (__system_alloc and __system_free). Recently freed large objects are cached by the
+ * slab allocator, so repeated allocations of big buffers don't create and remove VMAs each time.
+ *
+ * Small allocations are served from per-thread caches (magazines) of free slab objects, kept in
+ * front of the shared slab manager. Each thread keeps, per slab level, a LIFO list of free objects
+ * (chained through their first word) in a `struct slab_cache` pointed to by its TCB, so malloc()
+ * and free() usually don't take `slab_mgr_lock` at all. An empty magazine is refilled, and a full
+ * one is half-flushed, with a single acquisition of the lock (slab_alloc_batch() and
+ * slab_free_batch()). The magazines are given back to the slab manager when the thread exits.
+ *
+ * Like the per-thread VMA cache, a slab cache is only used by its own thread and LibOS code is not
+ * re-entered asynchronously on the same thread, so the caches need no locking. When the thread is
+ * moved to another NUMA node (see shim_get_numa_node()), its cached objects, which are hot in the
+ * caches of the old node, are given back to the slab manager and the magazines start afresh.
+ *
+ * The untrusted allocator of the Linux-SGX PAL (Pal/src/host/Linux-SGX/enclave_untrusted.c) keeps
+ * magazines in the same way.
  */
 
 #include <asm/mman.h>
@@ -20,17 +36,53 @@
 
 static struct shim_lock slab_mgr_lock;
 
-#define SYSTEM_LOCK()   lock(&slab_mgr_lock)
+/* allocator contention counters, printed by print_slab_stats() */
+static uint64_t g_slab_lock_acquisitions = 0;
+static uint64_t g_slab_lock_contentions = 0;
+static uint64_t g_slab_cache_refills = 0;
+static uint64_t g_slab_cache_flushes = 0;
+
+static void lock_slab_mgr(void) {
+    __atomic_add_fetch(&g_slab_lock_acquisitions, 1, __ATOMIC_RELAXED);
+    /* racy peek at the owner, good enough for statistics */
+    if (__atomic_load_n(&slab_mgr_lock.owner, __ATOMIC_RELAXED))
+        __atomic_add_fetch(&g_slab_lock_contentions, 1, __ATOMIC_RELAXED);
+    lock(&slab_mgr_lock);
+}
+
+#define SYSTEM_LOCK()   lock_slab_mgr()
 #define SYSTEM_UNLOCK() unlock(&slab_mgr_lock)
 #define SYSTEM_LOCKED() locked(&slab_mgr_lock)
 
 #define SLAB_CANARY
 #define STARTUP_SIZE 16
+/* keep some freed large objects (up to 256KB each) around, see slabmgr.h */
+#define LARGE_OBJ_CACHE_SIZE (4 * 1024 * 1024)
 
 #include "slabmgr.h"
 
 static SLAB_MGR slab_mgr = NULL;
 
+/* Each magazine holds at most SLAB_CACHE_MAX_OBJS objects and at most about
+ * SLAB_CACHE_LEVEL_SIZE bytes (but always at least 2 objects). */
+#define SLAB_CACHE_MAX_OBJS   32UL
+#define SLAB_CACHE_LEVEL_SIZE 8192UL
+
+/* set in the TCB of an exiting thread, after its cache was destroyed */
+#define SLAB_CACHE_DISABLED ((struct slab_cache*)1)
+
+struct slab_magazine {
+    void* head;
+    size_t cnt;
+};
+
+struct slab_cache {
+    struct slab_magazine mags[SLAB_LEVEL];
+    int numa_node; /* node of the thread when the magazines were filled */
+};
+
+static size_t g_slab_cache_cap[SLAB_LEVEL];
+
 /* Returns NULL on failure */
 void* __system_malloc(size_t size) {
     size_t alloc_size = ALLOC_ALIGN_UP(size);
@@ -75,11 +127,115 @@ int init_slab(void) {
     if (!slab_mgr) {
         return -ENOMEM;
     }
+    for (size_t i = 0; i < SLAB_LEVEL; i++) {
+        size_t cap = MIN(SLAB_CACHE_MAX_OBJS, SLAB_CACHE_LEVEL_SIZE / slab_levels[i]);
+        g_slab_cache_cap[i] = MAX(cap, 2UL);
+    }
     return 0;
 }
 
+static void slab_cache_flush(struct slab_cache* cache) {
+    for (size_t i = 0; i < SLAB_LEVEL; i++) {
+        if (cache->mags[i].head)
+            slab_free_batch(slab_mgr, i, cache->mags[i].head);
+        cache->mags[i].head = NULL;
+        cache->mags[i].cnt  = 0;
+    }
+}
+
+/* Returns the slab cache of the current thread, creating it on first use; NULL if there is none. */
+static struct slab_cache* get_thread_slab_cache(void) {
+    struct slab_cache* cache = SHIM_TCB_GET(slab_cache);
+    if (cache) {
+        if (cache == SLAB_CACHE_DISABLED)
+            return NULL;
+        int numa_node = shim_get_numa_node();
+        if (cache->numa_node != numa_node) {
+            slab_cache_flush(cache);
+            cache->numa_node = numa_node;
+        }
+        return cache;
+    }
+
+    cache = slab_alloc(slab_mgr, sizeof(*cache));
+    if (!cache)
+        return NULL;
+    memset(cache, 0, sizeof(*cache));
+    cache->numa_node = shim_get_numa_node();
+    SHIM_TCB_SET(slab_cache, cache);
+    return cache;
+}
+
+static void* slab_cache_alloc(struct slab_cache* cache, size_t level) {
+    struct slab_magazine* mag = &cache->mags[level];
+
+    if (!mag->cnt) {
+        /* fill only a half, so that the following frees don't immediately flush the magazine */
+        mag->cnt = slab_alloc_batch(slab_mgr, level, g_slab_cache_cap[level] / 2, &mag->head);
+        __atomic_add_fetch(&g_slab_cache_refills, 1, __ATOMIC_RELAXED);
+        if (!mag->cnt)
+            return NULL;
+    }
+
+    void* obj = mag->head;
+    mag->head = *(void**)obj;
+    mag->cnt--;
+    return obj;
+}
+
+static void slab_cache_free(struct slab_cache* cache, size_t level, void* obj) {
+    struct slab_magazine* mag = &cache->mags[level];
+
+    if (mag->cnt == g_slab_cache_cap[level]) {
+        /* keep the most recently freed (likely cache-hot) half, give the rest back */
+        size_t keep = mag->cnt / 2;
+        void* last = mag->head;
+        for (size_t i = 1; i < keep; i++)
+            last = *(void**)last;
+
+        void* rest = *(void**)last;
+        *(void**)last = NULL;
+        slab_free_batch(slab_mgr, level, rest);
+        mag->cnt = keep;
+        __atomic_add_fetch(&g_slab_cache_flushes, 1, __ATOMIC_RELAXED);
+    }
+
+    *(void**)obj = mag->head;
+    mag->head = obj;
+    mag->cnt++;
+}
+
+/* Gives the slab cache of the current (exiting) thread back to the slab manager. Later allocations
+ * of this thread go directly to the slab manager. */
+void destroy_thread_slab_cache(void) {
+    struct slab_cache* cache = SHIM_TCB_GET(slab_cache);
+    SHIM_TCB_SET(slab_cache, SLAB_CACHE_DISABLED);
+    if (!cache || cache == SLAB_CACHE_DISABLED)
+        return;
+
+    slab_cache_flush(cache);
+    slab_free(slab_mgr, cache);
+}
+
+void print_slab_stats(void) {
+    log_debug("slab allocator: %lu lock acquisitions (%lu contended), %lu cache refills, %lu cache "
+              "flushes\n",
+              __atomic_load_n(&g_slab_lock_acquisitions, __ATOMIC_RELAXED),
+              __atomic_load_n(&g_slab_lock_contentions, __ATOMIC_RELAXED),
+              __atomic_load_n(&g_slab_cache_refills, __ATOMIC_RELAXED),
+              __atomic_load_n(&g_slab_cache_flushes, __ATOMIC_RELAXED));
+}
+
 void* malloc(size_t size) {
-    void* mem = slab_alloc(slab_mgr, size);
+    void* mem;
+    size_t level = slab_size_to_level(size);
+    struct slab_cache* cache = level < SLAB_LEVEL ? get_thread_slab_cache() : NULL;
+
+    if (cache) {
+        mem = slab_cache_alloc(cache, level);
+    } else {
+        mem = slab_alloc(slab_mgr, size);
+    }
 
     if (!mem) {
         /*
@@ -88,6 +244,7 @@ void* malloc(size_t size) {
          * condition and must terminate the current process.
          */
         log_error("Out-of-memory in library OS\n");
+        log_flush(/*crashing=*/true);
         DkProcessExit(1);
     }
 
@@ -139,9 +296,16 @@ void* malloc_copy(const void* mem, size_t size) {
 }
 
 void free(void* mem) {
-    if (memory_migrated(mem)) {
+    if (memory_migrated(mem) || !mem) {
+        return;
+    }
+
+    unsigned char level = slab_obj_level(mem);
+    struct slab_cache* cache = level < SLAB_LEVEL ? get_thread_slab_cache() : NULL;
+    if (!cache) {
+        slab_free(slab_mgr, mem);
         return;
     }
 
-    slab_free(slab_mgr, mem);
+    slab_cache_free(cache, level, mem);
 }
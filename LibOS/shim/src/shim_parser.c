@@ -119,7 +119,9 @@ struct parser_table {
     [__NR_select] = {.slow = true, .name = "select", .parser = {parse_long_arg, parse_integer_arg,
                      parse_pointer_arg, parse_pointer_arg, parse_pointer_arg, parse_pointer_arg}},
     [__NR_sched_yield] = {.slow = false, .name = "sched_yield", .parser = {parse_long_arg}},
-    [__NR_mremap] = {.slow = false, .name = "mremap", .parser = {NULL}},
+    [__NR_mremap] = {.slow = true, .name = "mremap", .parser = {parse_pointer_ret,
+                     parse_pointer_arg, parse_pointer_arg, parse_pointer_arg, parse_integer_arg,
+                     parse_pointer_arg}},
     [__NR_msync] = {.slow = false, .name = "msync", .parser = {NULL}},
     [__NR_mincore] = {.slow = false, .name = "mincore", .parser = {parse_long_arg,
                       parse_pointer_arg, parse_pointer_arg, parse_pointer_arg}},
@@ -246,9 +248,11 @@ struct parser_table {
                            parse_pointer_arg, parse_pointer_arg}},
     [__NR_getrlimit] = {.slow = false, .name = "getrlimit", .parser = {parse_long_arg,
                         parse_integer_arg, parse_pointer_arg}},
-    [__NR_getrusage] = {.slow = false, .name = "getrusage", .parser = {NULL}},
+    [__NR_getrusage] = {.slow = false, .name = "getrusage", .parser = {parse_long_arg,
+                        parse_integer_arg, parse_pointer_arg}},
     [__NR_sysinfo] = {.slow = false, .name = "sysinfo", .parser = {NULL}},
-    [__NR_times] = {.slow = false, .name = "times", .parser = {NULL}},
+    [__NR_times] = {.slow = false, .name = "times", .parser = {parse_long_arg,
+                    parse_pointer_arg}},
     [__NR_ptrace] = {.slow = false, .name = "ptrace", .parser = {NULL}},
     [__NR_getuid] = {.slow = false, .name = "getuid", .parser = {parse_long_arg}},
     [__NR_syslog] = {.slow = false, .name = "syslog", .parser = {NULL}},
@@ -368,7 +372,8 @@ struct parser_table {
     [__NR_tuxcall] = {.slow = false, .name = "tuxcall", .parser = {NULL}},
     [__NR_security] = {.slow = false, .name = "security", .parser = {NULL}},
     [__NR_gettid] = {.slow = false, .name = "gettid", .parser = {parse_long_arg}},
-    [__NR_readahead] = {.slow = false, .name = "readahead", .parser = {NULL}},
+    [__NR_readahead] = {.slow = false, .name = "readahead", .parser = {parse_long_arg,
+                        parse_integer_arg, parse_long_arg, parse_long_arg}},
     [__NR_setxattr] = {.slow = false, .name = "setxattr", .parser = {NULL}},
     [__NR_lsetxattr] = {.slow = false, .name = "lsetxattr", .parser = {NULL}},
     [__NR_fsetxattr] = {.slow = false, .name = "fsetxattr", .parser = {NULL}},
@@ -418,7 +423,8 @@ struct parser_table {
     [__NR_semtimedop] = {.slow = false, .name = "semtimedop", .parser = {parse_long_arg,
                          parse_integer_arg, parse_pointer_arg, parse_integer_arg,
                          parse_pointer_arg}},
-    [__NR_fadvise64] = {.slow = false, .name = "fadvise64", .parser = {NULL}},
+    [__NR_fadvise64] = {.slow = false, .name = "fadvise64", .parser = {parse_long_arg,
+                        parse_integer_arg, parse_long_arg, parse_long_arg, parse_integer_arg}},
     [__NR_timer_create] = {.slow = false, .name = "timer_create", .parser = {NULL}},
     [__NR_timer_settime] = {.slow = false, .name = "timer_settime", .parser = {NULL}},
     [__NR_timer_gettime] = {.slow = false, .name = "timer_gettime", .parser = {NULL}},
@@ -502,22 +508,30 @@ struct parser_table {
                               parse_pointer_arg, parse_pointer_arg}},
     [__NR_get_robust_list] = {.slow = false, .name = "get_robust_list", .parser = {parse_long_arg,
                               parse_integer_arg, parse_pointer_arg, parse_pointer_arg}},
-    [__NR_splice] = {.slow = false, .name = "splice", .parser = {NULL}},
+    [__NR_splice] = {.slow = true, .name = "splice", .parser = {parse_long_arg, parse_integer_arg,
+                     parse_pointer_arg, parse_integer_arg, parse_pointer_arg, parse_long_arg,
+                     parse_integer_arg}},
     [__NR_tee] = {.slow = false, .name = "tee", .parser = {NULL}},
     [__NR_sync_file_range] = {.slow = false, .name = "sync_file_range", .parser = {NULL}},
-    [__NR_vmsplice] = {.slow = false, .name = "vmsplice", .parser = {NULL}},
+    [__NR_vmsplice] = {.slow = true, .name = "vmsplice", .parser = {parse_long_arg,
+                       parse_integer_arg, parse_pointer_arg, parse_long_arg, parse_integer_arg}},
     [__NR_move_pages] = {.slow = false, .name = "move_pages", .parser = {NULL}},
     [__NR_utimensat] = {.slow = false, .name = "utimensat", .parser = {NULL}},
     [__NR_epoll_pwait] = {.slow = true, .name = "epoll_pwait", .parser = {parse_long_arg,
                           parse_integer_arg, parse_pointer_arg, parse_integer_arg,
                           parse_integer_arg, parse_pointer_arg, parse_pointer_arg}},
     [__NR_signalfd] = {.slow = false, .name = "signalfd", .parser = {NULL}},
-    [__NR_timerfd_create] = {.slow = false, .name = "timerfd_create", .parser = {NULL}},
+    [__NR_timerfd_create] = {.slow = false, .name = "timerfd_create", .parser = {parse_long_arg,
+                             parse_integer_arg, parse_integer_arg}},
     [__NR_eventfd] = {.slow = false, .name = "eventfd", .parser = {parse_long_arg,
                       parse_integer_arg}},
-    [__NR_fallocate] = {.slow = false, .name = "fallocate", .parser = {NULL}},
-    [__NR_timerfd_settime] = {.slow = false, .name = "timerfd_settime", .parser = {NULL}},
-    [__NR_timerfd_gettime] = {.slow = false, .name = "timerfd_gettime", .parser = {NULL}},
+    [__NR_fallocate] = {.slow = false, .name = "fallocate", .parser = {parse_long_arg,
+                        parse_integer_arg, parse_integer_arg, parse_long_arg, parse_long_arg}},
+    [__NR_timerfd_settime] = {.slow = false, .name = "timerfd_settime", .parser = {parse_long_arg,
+                              parse_integer_arg, parse_integer_arg, parse_pointer_arg,
+                              parse_pointer_arg}},
+    [__NR_timerfd_gettime] = {.slow = false, .name = "timerfd_gettime", .parser = {parse_long_arg,
+                              parse_integer_arg, parse_pointer_arg}},
     [__NR_accept4] = {.slow = true, .name = "accept4", .parser = {parse_long_arg, parse_integer_arg,
                       parse_pointer_arg, parse_pointer_arg, parse_integer_arg}},
     [__NR_signalfd4] = {.slow = false, .name = "signalfd4", .parser = {NULL}},
@@ -530,8 +544,11 @@ struct parser_table {
     [__NR_pipe2] = {.slow = false, .name = "pipe2", .parser = {parse_long_arg, parse_pointer_arg,
                     parse_integer_arg}},
     [__NR_inotify_init1] = {.slow = false, .name = "inotify_init1", .parser = {NULL}},
-    [__NR_preadv] = {.slow = false, .name = "preadv", .parser = {NULL}},
-    [__NR_pwritev] = {.slow = false, .name = "pwritev", .parser = {NULL}},
+    [__NR_preadv] = {.slow = true, .name = "preadv", .parser = {parse_long_arg, parse_integer_arg,
+                     parse_pointer_arg, parse_integer_arg, parse_long_arg, parse_long_arg}},
+    [__NR_pwritev] = {.slow = false, .name = "pwritev", .parser = {parse_long_arg,
+                      parse_integer_arg, parse_pointer_arg, parse_integer_arg, parse_long_arg,
+                      parse_long_arg}},
     [__NR_rt_tgsigqueueinfo] = {.slow = false, .name = "rt_tgsigqueueinfo", .parser = {NULL}},
     [__NR_perf_event_open] = {.slow = false, .name = "perf_event_open", .parser = {NULL}},
     [__NR_recvmmsg] = {.slow = false, .name = "recvmmsg", .parser = {parse_long_arg,
@@ -560,21 +577,39 @@ struct parser_table {
     [__NR_bpf] = {.slow = false, .name = "bpf", .parser = {NULL}},
     [__NR_execveat] = {.slow = false, .name = "execveat", .parser = {NULL}},
     [__NR_userfaultfd] = {.slow = false, .name = "userfaultfd", .parser = {NULL}},
-    [__NR_membarrier] = {.slow = false, .name = "membarrier", .parser = {NULL}},
+    [__NR_membarrier] = {.slow = false, .name = "membarrier", .parser = {parse_long_arg,
+                         parse_integer_arg, parse_integer_arg, parse_integer_arg}},
     [__NR_mlock2] = {.slow = false, .name = "mlock2", .parser = {NULL}},
-    [__NR_copy_file_range] = {.slow = false, .name = "copy_file_range", .parser = {NULL}},
-    [__NR_preadv2] = {.slow = false, .name = "preadv2", .parser = {NULL}},
-    [__NR_pwritev2] = {.slow = false, .name = "pwritev2", .parser = {NULL}},
+    [__NR_copy_file_range] = {.slow = false, .name = "copy_file_range", .parser = {parse_long_arg,
+                              parse_integer_arg, parse_pointer_arg, parse_integer_arg,
+                              parse_pointer_arg, parse_long_arg, parse_integer_arg}},
+    [__NR_preadv2] = {.slow = true, .name = "preadv2", .parser = {parse_long_arg,
+                      parse_integer_arg, parse_pointer_arg, parse_integer_arg, parse_long_arg,
+                      parse_long_arg, parse_integer_arg}},
+    [__NR_pwritev2] = {.slow = false, .name = "pwritev2", .parser = {parse_long_arg,
+                       parse_integer_arg, parse_pointer_arg, parse_integer_arg, parse_long_arg,
+                       parse_long_arg, parse_integer_arg}},
     [__NR_pkey_mprotect] = {.slow = false, .name = "pkey_mprotect", .parser = {NULL}},
     [__NR_pkey_alloc] = {.slow = false, .name = "pkey_alloc", .parser = {NULL}},
     [__NR_pkey_free] = {.slow = false, .name = "pkey_free", .parser = {NULL}},
     [__NR_statx] = {.slow = false, .name = "statx", .parser = {NULL}},
     [__NR_io_pgetevents] = {.slow = false, .name = "io_pgetevents", .parser = {NULL}},
-    [__NR_rseq] = {.slow = false, .name = "rseq", .parser = {NULL}},
+    [__NR_rseq] = {.slow = false, .name = "rseq", .parser = {parse_long_arg, parse_pointer_arg,
+                   parse_integer_arg, parse_integer_arg, parse_integer_arg}},
     [__NR_pidfd_send_signal] = {.slow = false, .name = "pidfd_send_signal", .parser = {NULL}},
-    [__NR_io_uring_setup] = {.slow = false, .name = "io_uring_setup", .parser = {NULL}},
-    [__NR_io_uring_enter] = {.slow = false, .name = "io_uring_enter", .parser = {NULL}},
-    [__NR_io_uring_register] = {.slow = false, .name = "io_uring_register", .parser = {NULL}},
+    [__NR_io_uring_setup] = {.slow = false, .name = "io_uring_setup", .parser = {parse_long_arg,
+                             parse_integer_arg, parse_pointer_arg}},
+    [__NR_io_uring_enter] = {.slow = true, .name = "io_uring_enter", .parser = {parse_long_arg,
+                             parse_integer_arg, parse_integer_arg, parse_integer_arg,
+                             parse_integer_arg, parse_pointer_arg, parse_integer_arg}},
+    [__NR_io_uring_register] = {.slow = false, .name = "io_uring_register", .parser = {
+                                parse_long_arg, parse_integer_arg, parse_integer_arg,
+                                parse_pointer_arg, parse_integer_arg}},
+    [__NR_close_range] = {.slow = false, .name = "close_range", .parser = {parse_long_arg,
+                          parse_integer_arg, parse_integer_arg, parse_integer_arg}},
+    [__NR_futex_waitv] = {.slow = true, .name = "futex_waitv", .parser = {parse_long_arg,
+                          parse_pointer_arg, parse_integer_arg, parse_integer_arg,
+                          parse_pointer_arg, parse_integer_arg}},
 };
 
 const char* const siglist[SIGRTMIN] = {
@@ -1276,6 +1311,9 @@ static void parse_futexop(struct print_buf* buf, va_list* ap) {
         case FUTEX_WAKE_OP:
             buf_puts(buf, "FUTEX_WAKE_OP");
             break;
+        case FUTEX_WAIT_MULTIPLE:
+            buf_puts(buf, "FUTEX_WAIT_MULTIPLE");
+            break;
         default:
             buf_printf(buf, "OP %d", op);
             break;
@@ -1547,6 +1585,10 @@ void warn_unsupported_syscall(unsigned long sysno) {
         log_warning("Unsupported system call %lu\n", sysno);
 }
 
+const char* get_syscall_name(unsigned long sysno) {
+    return sysno < ARRAY_SIZE(syscall_parser_table) ? syscall_parser_table[sysno].name : NULL;
+}
+
 static int buf_write_all(const char* str, size_t size, void* arg) {
     __UNUSED(arg);
 
@@ -233,14 +233,81 @@ static int reserve_dyn(size_t total_size, void** addr) {
 }
 
 /*
- * Execute a single load command: bookkeep the memory, map the file content, and make sure the area
- * not mapped to a file (ph_filesz .. ph_memsz) is zero-filled.
+ * Bookkeep the memory of all load commands at once (see `bkeep_batch`): the part mapped from file
+ * and the zero-filled pages after it, for each of them.
+ *
+ * This function doesn't undo the bookkeeping in case of error: if it fails, it may leave some
+ * segments already bookkept.
+ */
+static int bkeep_loadcmds(const struct loadcmd* loadcmds, size_t n_loadcmds, ElfW(Addr) load_addr,
+                          struct shim_handle* file) {
+    struct bkeep_op* ops = malloc(2 * n_loadcmds * sizeof(*ops));
+    if (!ops)
+        return -ENOMEM;
+
+    size_t n_ops = 0;
+    for (const struct loadcmd* c = loadcmds; c < loadcmds + n_loadcmds; c++) {
+        if (c->start < c->map_end) {
+            ops[n_ops++] = (struct bkeep_op){
+                .type   = BKEEP_OP_MMAP_FIXED,
+                .addr   = (void*)(load_addr + c->start),
+                .length = c->map_end - c->start,
+                .prot   = c->prot,
+                .flags  = MAP_FIXED | MAP_PRIVATE,
+                .file   = file,
+                .offset = c->map_off,
+            };
+        }
+        if (c->map_end < c->alloc_end) {
+            ops[n_ops++] = (struct bkeep_op){
+                .type   = BKEEP_OP_MMAP_FIXED,
+                .addr   = (void*)(load_addr + c->map_end),
+                .length = c->alloc_end - c->map_end,
+                .prot   = c->prot,
+                .flags  = MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS,
+            };
+        }
+    }
+
+    int ret = bkeep_batch(ops, n_ops);
+    free(ops);
+    if (ret < 0)
+        log_debug("%s: failed to bookkeep addresses of segments\n", __func__);
+    return ret;
+}
+
+/* Zero-fill pages not allocated yet: adjacent ranges with the same protections are allocated with
+ * a single PAL call. */
+struct pending_alloc {
+    void* start;
+    size_t size;
+    int prot;
+};
+
+static int flush_pending_alloc(struct pending_alloc* pending) {
+    if (!pending->size)
+        return 0;
+
+    PAL_FLG pal_prot = LINUX_PROT_TO_PAL(pending->prot, MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS);
+    int ret = DkVirtualMemoryAlloc(&pending->start, pending->size, /*alloc_type=*/0, pal_prot);
+    pending->size = 0;
+    if (ret < 0) {
+        log_debug("%s: cannot map zero-fill pages\n", __func__);
+        return pal_to_unix_errno(ret);
+    }
+    return 0;
+}
+
+/*
+ * Execute a single load command, whose memory is already bookkept (see `bkeep_loadcmds`): map the
+ * file content, and make sure the area not mapped to a file (ph_filesz .. ph_memsz) is zero-filled.
+ * Allocation of the extra pages after the mapped area may be deferred to `pending`.
  *
  * This function doesn't undo allocations in case of error: if it fails, it may leave some segments
  * already allocated.
  */
 static int execute_loadcmd(const struct loadcmd* c, ElfW(Addr) load_addr,
-                           struct shim_handle* file) {
+                           struct shim_handle* file, struct pending_alloc* pending) {
     int ret;
     int map_flags = MAP_FIXED | MAP_PRIVATE;
     PAL_FLG pal_prot = LINUX_PROT_TO_PAL(c->prot, map_flags);
@@ -250,11 +317,9 @@ static int execute_loadcmd(const struct loadcmd* c, ElfW(Addr) load_addr,
         void* map_start = (void*)(load_addr + c->start);
         size_t map_size = c->map_end - c->start;
 
-        if ((ret = bkeep_mmap_fixed(map_start, map_size, c->prot, map_flags, file, c->map_off,
-                                    /*comment=*/NULL)) < 0) {
-            log_debug("%s: failed to bookkeep address of segment\n", __func__);
+        /* Mappings must be done in order, as they may overlap (on page boundaries). */
+        if ((ret = flush_pending_alloc(pending)) < 0)
             return ret;
-        }
 
         if ((ret = file->fs->fs_ops->mmap(file, &map_start, map_size, c->prot, map_flags,
                                           c->map_off) < 0)) {
@@ -292,20 +357,18 @@ static int execute_loadcmd(const struct loadcmd* c, ElfW(Addr) load_addr,
     if (c->map_end < c->alloc_end) {
         void* zero_page_start = (void*)(load_addr + c->map_end);
         size_t zero_page_size = c->alloc_end - c->map_end;
-        int zero_map_flags = MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS;
-        PAL_FLG zero_pal_prot = LINUX_PROT_TO_PAL(c->prot, zero_map_flags);
 
-        if ((ret = bkeep_mmap_fixed(zero_page_start, zero_page_size, c->prot, zero_map_flags,
-                                    /*file=*/NULL, /*offset=*/0, /*comment=*/NULL)) < 0) {
-            log_debug("%s: cannot bookkeep address of zero-fill pages\n", __func__);
-            return ret;
+        if (pending->size && ((char*)pending->start + pending->size != zero_page_start
+                              || pending->prot != c->prot)) {
+            if ((ret = flush_pending_alloc(pending)) < 0)
+                return ret;
         }
 
-        if ((ret = DkVirtualMemoryAlloc(&zero_page_start, zero_page_size, /*alloc_type=*/0,
-                                        zero_pal_prot)) < 0) {
-            log_debug("%s: cannot map zero-fill pages\n", __func__);
-            return pal_to_unix_errno(ret);
+        if (!pending->size) {
+            pending->start = zero_page_start;
+            pending->prot  = c->prot;
         }
+        pending->size += zero_page_size;
     }
 
     return 0;
@@ -399,13 +462,25 @@ static struct link_map* __map_elf_object(struct shim_handle* file, ElfW(Ehdr)* e
     l->l_map_end   = load_end + l->l_addr;
 
     /* Execute load commands. */
-    l->l_data_segment_size = 0;
+    if ((ret = bkeep_loadcmds(loadcmds, n_loadcmds, l->l_addr, file)) < 0) {
+        errstring = "failed to bookkeep load commands";
+        goto err;
+    }
+
+    struct pending_alloc pending = {0};
     for (struct loadcmd* c = &loadcmds[0]; c < &loadcmds[n_loadcmds]; c++) {
-        if ((ret = execute_loadcmd(c, l->l_addr, file)) < 0) {
+        if ((ret = execute_loadcmd(c, l->l_addr, file, &pending)) < 0) {
             errstring = "failed to execute load command";
             goto err;
         }
+    }
+    if ((ret = flush_pending_alloc(&pending)) < 0) {
+        errstring = "failed to execute load command";
+        goto err;
+    }
 
+    l->l_data_segment_size = 0;
+    for (struct loadcmd* c = &loadcmds[0]; c < &loadcmds[n_loadcmds]; c++) {
         if (!l->l_phdr && ehdr->e_phoff >= c->map_off
                 && ehdr->e_phoff + phdr_size <= c->map_off + (c->data_end - c->start)) {
             /* Found the program header in this segment. */
@@ -819,30 +894,44 @@ static int vdso_map_init(void) {
      * In host child process, LibOS may or may not be loaded at the same address.
      * When LibOS is loaded at different address, it may overlap with the old vDSO
      * area.
+     *
+     * The vDSO image is preceded by a writable page with time data (`struct vdso_time_data`),
+     * which the vDSO code finds at a fixed offset from itself.
      */
+    size_t data_size = ALLOC_ALIGN_UP(VDSO_TIME_PAGE_SIZE);
+    size_t image_size = ALLOC_ALIGN_UP(vdso_so_size);
     void* addr = NULL;
-    int ret = bkeep_mmap_any_aslr(ALLOC_ALIGN_UP(vdso_so_size), PROT_READ | PROT_EXEC,
+    int ret = bkeep_mmap_any_aslr(data_size + image_size, PROT_READ | PROT_EXEC,
                                   MAP_PRIVATE | MAP_ANONYMOUS, NULL, 0, LINUX_VDSO_FILENAME,
                                   &addr);
     if (ret < 0) {
         return ret;
     }
 
-    ret = DkVirtualMemoryAlloc(&addr, ALLOC_ALIGN_UP(vdso_so_size), /*alloc_type=*/0,
+    ret = bkeep_mprotect(addr, data_size, PROT_READ | PROT_WRITE, /*is_internal=*/false);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = DkVirtualMemoryAlloc(&addr, data_size + image_size, /*alloc_type=*/0,
                                PAL_PROT_READ | PAL_PROT_WRITE);
     if (ret < 0) {
         return pal_to_unix_errno(ret);
     }
 
-    memcpy(addr, &vdso_so, vdso_so_size);
-    memset(addr + vdso_so_size, 0, ALLOC_ALIGN_UP(vdso_so_size) - vdso_so_size);
+    void* image = (char*)addr + data_size;
+    memcpy(image, &vdso_so, vdso_so_size);
+    memset(image + vdso_so_size, 0, image_size - vdso_so_size);
 
-    ret = DkVirtualMemoryProtect(addr, ALLOC_ALIGN_UP(vdso_so_size), PAL_PROT_READ | PAL_PROT_EXEC);
+    ret = DkVirtualMemoryProtect(image, image_size, PAL_PROT_READ | PAL_PROT_EXEC);
     if (ret < 0) {
         return pal_to_unix_errno(ret);
     }
 
-    vdso_addr = addr;
+    memset(addr, 0, data_size);
+    vdso_time_init((struct vdso_time_data*)((char*)image - VDSO_TIME_PAGE_SIZE));
+
+    vdso_addr = image;
     return 0;
 }
 
@@ -877,13 +966,17 @@ int init_loader(void) {
 
         exec_map = __search_map_by_handle(exec);
     }
+    add_startup_phase("executable loading");
 
     ret = init_brk_from_executable(exec);
     if (ret < 0)
         goto out;
 
-    if (!interp_map && __need_interp(exec_map) && (ret = __load_interp_object(exec_map)) < 0)
-        goto out;
+    if (!interp_map && __need_interp(exec_map)) {
+        if ((ret = __load_interp_object(exec_map)) < 0)
+            goto out;
+        add_startup_phase("interpreter loading");
+    }
 
     ret = 0;
 out:
@@ -989,6 +1082,8 @@ noreturn void execute_elf_object(struct shim_handle* exec, void* argp, ElfW(auxv
     /* We are done with using this handle. */
     put_handle(exec);
 
+    report_startup_phases();
+
     CALL_ELF_ENTRY(entry, argp);
 
     die_or_inf_loop();
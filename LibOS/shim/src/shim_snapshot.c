@@ -0,0 +1,277 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * Snapshots of an initialized process, for applications with long start-up. Once done with its
+ * initialization, the application writes to `/dev/snapshot` and the state of the process is
+ * checkpointed (the same way as on fork) into the file given by `libos.snapshot.file` manifest
+ * option. Later runs find the snapshot during LibOS initialization and restore it instead of
+ * starting the executable: the application resumes right after the write to `/dev/snapshot`, which
+ * returns 0 in a restored process.
+ *
+ * A snapshot is bound to the identity of the Graphene instance which created it: on SGX, this is
+ * the target info of the enclave (containing MRENCLAVE, which also covers the manifest). Snapshots
+ * which don't match are ignored and the application starts from scratch. Confidentiality and
+ * integrity of the snapshot contents are not provided here; on SGX, the snapshot file must be
+ * listed in `sgx.protected_files`.
+ */
+
+#include "pal.h"
+#include "shim_checkpoint.h"
+#include "shim_internal.h"
+#include "shim_lock.h"
+#include "shim_process.h"
+#include "shim_thread.h"
+#include "shim_utils.h"
+
+#define SNAPSHOT_MAGIC            "GSNAPSHT"
+#define SNAPSHOT_VERSION          1
+#define SNAPSHOT_BINDING_MAX_SIZE 1024
+
+struct snapshot_hdr {
+    char magic[8];
+    uint32_t version;
+    uint32_t binding_size;
+    char binding[SNAPSHOT_BINDING_MAX_SIZE];
+    struct checkpoint_hdr cp_hdr;
+};
+
+/* set during initialization of the first process of this Graphene instance */
+static char* g_snapshot_uri = NULL;
+
+static BEGIN_MIGRATION_DEF(snapshot, struct shim_process* process_description,
+                           struct shim_thread* thread_description,
+                           struct shim_ipc_ids* process_ipc_ids) {
+    DEFINE_MIGRATE(process_ipc_ids, process_ipc_ids, sizeof(*process_ipc_ids));
+    DEFINE_MIGRATE(all_mounts, NULL, 0);
+    DEFINE_MIGRATE(all_vmas, NULL, 0);
+    DEFINE_MIGRATE(process_description, process_description, sizeof(*process_description));
+    DEFINE_MIGRATE(thread, thread_description, sizeof(*thread_description));
+    DEFINE_MIGRATE(migratable, NULL, 0);
+    DEFINE_MIGRATE(brk, NULL, 0);
+    DEFINE_MIGRATE(loaded_libraries, NULL, 0);
+#ifdef DEBUG
+    DEFINE_MIGRATE(gdb_map, NULL, 0);
+#endif
+}
+END_MIGRATION_DEF(snapshot)
+
+static int migrate_snapshot(struct shim_cp_store* store, struct shim_process* process_description,
+                            struct shim_thread* thread_description,
+                            struct shim_ipc_ids* process_ipc_ids, va_list ap) {
+    __UNUSED(ap);
+    return START_MIGRATE(store, snapshot, process_description, thread_description,
+                         process_ipc_ids);
+}
+
+/* Obtains the identity of this Graphene instance; empty if the PAL has no notion of it. */
+static int get_snapshot_binding(char* binding, uint32_t* out_size) {
+    if (strcmp(g_pal_control->host_type, "Linux-SGX")) {
+        *out_size = 0;
+        return 0;
+    }
+
+    PAL_NUM user_report_data_size = 0;
+    PAL_NUM target_info_size = 0;
+    PAL_NUM report_size = 0;
+    int ret = DkAttestationReport(/*user_report_data=*/NULL, &user_report_data_size,
+                                  /*target_info=*/NULL, &target_info_size, /*report=*/NULL,
+                                  &report_size);
+    if (ret < 0)
+        return pal_to_unix_errno(ret);
+    if (target_info_size > SNAPSHOT_BINDING_MAX_SIZE)
+        return -EOVERFLOW;
+
+    char* user_report_data = calloc(1, user_report_data_size);
+    if (!user_report_data)
+        return -ENOMEM;
+
+    /* zeroed target info makes DkAttestationReport() return the target info of this enclave */
+    memset(binding, 0, target_info_size);
+    ret = DkAttestationReport(user_report_data, &user_report_data_size, binding,
+                              &target_info_size, /*report=*/NULL, &report_size);
+    free(user_report_data);
+    if (ret < 0)
+        return pal_to_unix_errno(ret);
+
+    *out_size = target_info_size;
+    return 0;
+}
+
+int create_snapshot(void) {
+    struct shim_thread* self = get_cur_thread();
+    int ret;
+
+    if (!g_snapshot_uri) {
+        log_error("snapshot: 'libos.snapshot.file' must be specified in the manifest and only the "
+                  "first process can create a snapshot\n");
+        return -EPERM;
+    }
+
+    /* only the state of this very process can be restored, not other processes and threads */
+    lock(&g_process.children_lock);
+    bool has_children = !LISTP_EMPTY(&g_process.children) || !LISTP_EMPTY(&g_process.zombies);
+    unlock(&g_process.children_lock);
+    if (has_children) {
+        log_error("snapshot: cannot snapshot a process with children\n");
+        return -EBUSY;
+    }
+    if (!check_last_thread(/*mark_self_dead=*/false) || self->tid != g_process.pid) {
+        log_error("snapshot: only a single-threaded process can be snapshotted\n");
+        return -EBUSY;
+    }
+
+    struct snapshot_hdr* hdr = calloc(1, sizeof(*hdr));
+    if (!hdr)
+        return -ENOMEM;
+
+    PAL_HANDLE file = NULL;
+    ret = DkStreamOpen(g_snapshot_uri, PAL_ACCESS_RDWR, PAL_SHARE_OWNER_R | PAL_SHARE_OWNER_W,
+                       PAL_CREATE_TRY, /*options=*/0, &file);
+    if (ret < 0) {
+        ret = pal_to_unix_errno(ret);
+        goto out_free;
+    }
+    ret = DkStreamSetLength(file, 0);
+    if (ret < 0) {
+        ret = pal_to_unix_errno(ret);
+        goto out;
+    }
+
+    /* the header is filled in last, so that an incomplete snapshot is never restored */
+    ret = write_exact_at(file, /*offset=*/0, hdr, sizeof(*hdr));
+    if (ret < 0)
+        goto out;
+
+    memcpy(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic));
+    hdr->version = SNAPSHOT_VERSION;
+    ret = get_snapshot_binding(hdr->binding, &hdr->binding_size);
+    if (ret < 0) {
+        log_error("snapshot: cannot obtain the identity of this instance (%d)\n", ret);
+        goto out;
+    }
+
+    lock(&g_process.fs_lock);
+    struct shim_process process_description = {
+        .pid = g_process.pid,
+        .ppid = g_process.ppid,
+        .pgid = __atomic_load_n(&g_process.pgid, __ATOMIC_ACQUIRE),
+        .root = g_process.root,
+        .cwd = g_process.cwd,
+        .umask = g_process.umask,
+        .exec = g_process.exec,
+    };
+
+    get_dentry(process_description.root);
+    get_dentry(process_description.cwd);
+    get_handle(process_description.exec);
+
+    unlock(&g_process.fs_lock);
+
+    INIT_LISTP(&process_description.children);
+    INIT_LISTP(&process_description.zombies);
+
+    clear_lock(&process_description.fs_lock);
+    clear_lock(&process_description.children_lock);
+
+    /* the restored process is the first process of a new Graphene instance */
+    struct shim_ipc_ids process_ipc_ids = {
+        .parent_vmid = 0,
+        .leader_vmid = 0,
+    };
+
+    ret = write_checkpoint_to_file(&migrate_snapshot, file, sizeof(*hdr), &hdr->cp_hdr,
+                                   &process_description, self, &process_ipc_ids);
+
+    put_handle(process_description.exec);
+    put_dentry(process_description.cwd);
+    put_dentry(process_description.root);
+
+    if (ret < 0)
+        goto out;
+
+    ret = write_exact_at(file, /*offset=*/0, hdr, sizeof(*hdr));
+    if (ret < 0)
+        goto out;
+
+    ret = DkStreamFlush(file);
+    if (ret < 0) {
+        ret = pal_to_unix_errno(ret);
+        goto out;
+    }
+
+    log_debug("snapshot: created snapshot in %s\n", g_snapshot_uri);
+out:
+    DkObjectClose(file);
+out_free:
+    free(hdr);
+    if (ret < 0)
+        log_error("snapshot: failed creating snapshot in %s (%d)\n", g_snapshot_uri, ret);
+    return ret;
+}
+
+int init_snapshot(void) {
+    assert(g_manifest_root);
+    assert(!g_pal_control->parent_process);
+
+    char* uri = NULL;
+    int ret = toml_string_in(g_manifest_root, "libos.snapshot.file", &uri);
+    if (ret < 0) {
+        log_error("Cannot parse 'libos.snapshot.file' (the value must be put in double quotes!)\n");
+        return -EINVAL;
+    }
+    if (!uri)
+        return 0;
+    if (!strstartswith(uri, URI_PREFIX_FILE)) {
+        log_error("'libos.snapshot.file' must start with \"" URI_PREFIX_FILE "\"\n");
+        free(uri);
+        return -EINVAL;
+    }
+    g_snapshot_uri = uri;
+
+    PAL_HANDLE file = NULL;
+    ret = DkStreamOpen(uri, PAL_ACCESS_RDONLY, /*share_flags=*/0, /*create=*/0, /*options=*/0,
+                       &file);
+    if (ret < 0) {
+        log_debug("snapshot: no snapshot in %s, starting from scratch\n", uri);
+        return 0;
+    }
+
+    struct snapshot_hdr* hdr = malloc(sizeof(*hdr));
+    char* binding = malloc(SNAPSHOT_BINDING_MAX_SIZE);
+    if (!hdr || !binding) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    uint32_t binding_size;
+    ret = get_snapshot_binding(binding, &binding_size);
+    if (ret < 0)
+        goto out;
+
+    /* an invalid snapshot is not trusted in any way: it is simply overwritten by the next one */
+    ret = read_exact_at(file, /*offset=*/0, hdr, sizeof(*hdr));
+    if (ret < 0 || memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic))
+            || hdr->version != SNAPSHOT_VERSION) {
+        log_warning("snapshot: ignoring incomplete or outdated snapshot in %s\n", uri);
+        ret = 0;
+        goto out;
+    }
+    if (hdr->binding_size != binding_size || memcmp(hdr->binding, binding, binding_size)) {
+        log_warning("snapshot: ignoring snapshot in %s created by a different instance\n", uri);
+        ret = 0;
+        goto out;
+    }
+
+    ret = restore_checkpoint_from_file(file, sizeof(*hdr), &hdr->cp_hdr);
+    if (ret < 0) {
+        log_error("snapshot: failed restoring snapshot from %s (%d)\n", uri, ret);
+        goto out;
+    }
+    log_debug("snapshot: restored snapshot from %s\n", uri);
+out:
+    free(binding);
+    free(hdr);
+    DkObjectClose(file);
+    return ret;
+}
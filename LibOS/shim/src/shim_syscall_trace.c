@@ -0,0 +1,299 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * Binary syscall tracing (enabled with `libos.syscall_trace_file`). Trace-level logging formats
+ * every syscall into text and writes each line to the host, which slows the application down by
+ * orders of magnitude. Instead, `shim_emulate_syscall` records each returned syscall (start time,
+ * duration, TID, syscall number, raw arguments and return value) into a ring buffer of the calling
+ * thread. The rings are single-producer single-consumer: only the owning thread adds records and
+ * only the drainer (the async worker, every SYSCALL_TRACE_DRAIN_INTERVAL_US, and the exiting
+ * process) takes them out and writes them to the trace file. If a ring is full, the record is
+ * dropped and counted.
+ *
+ * Rings are created on the first traced syscall of a thread and outlive it until drained. Each
+ * process writes its own file, `<libos.syscall_trace_file>.<pid>`: a `struct syscall_trace_header`,
+ * the names of all syscalls known to Graphene (NUL-terminated, empty for unknown numbers) and then
+ * the records. `graphene-syscall-trace` decodes it.
+ */
+
+#include "list.h"
+#include "pal.h"
+#include "pal_error.h"
+#include "shim_internal.h"
+#include "shim_lock.h"
+#include "shim_process.h"
+#include "shim_thread.h"
+#include "shim_utils.h"
+#include "toml.h"
+
+#define SYSCALL_TRACE_DEFAULT_BUFFER_SIZE (256 * 1024)
+#define SYSCALL_TRACE_DRAIN_INTERVAL_US   10000
+
+#define SYSCALL_TRACE_MAGIC "GSCTRC01"
+
+struct syscall_trace_header {
+    char magic[8];
+    uint32_t record_size;
+    uint32_t names_count;   /* LIBOS_SYSCALL_BOUND */
+    uint32_t names_size;    /* size of the names following the header */
+    uint32_t pid;
+};
+
+struct syscall_trace_record {
+    uint64_t time_us;       /* host time at the start of the syscall */
+    uint64_t duration_us;
+    uint32_t tid;
+    uint32_t sysnr;
+    int64_t args[6];
+    int64_t ret;
+};
+
+DEFINE_LIST(syscall_trace_ring);
+struct syscall_trace_ring {
+    LIST_TYPE(syscall_trace_ring) list; /* in `g_rings`, protected by `g_trace_lock` */
+    bool dead;                  /* the thread is gone, free the ring once drained */
+    uint64_t head;              /* records added so far, written only by the thread */
+    uint64_t tail;              /* records drained so far, written only by the drainer */
+    uint64_t dropped;
+    size_t size;                /* number of records, a power of two */
+    struct syscall_trace_record records[];
+};
+DEFINE_LISTP(syscall_trace_ring);
+
+bool g_syscall_trace_enabled = false;
+
+static size_t g_ring_size = 0;
+
+/* protects all of the below, serializes drainers */
+static struct shim_lock g_trace_lock;
+static LISTP_TYPE(syscall_trace_ring) g_rings = LISTP_INIT;
+static PAL_HANDLE g_trace_file = NULL;
+static size_t g_trace_file_off = 0;
+static uint64_t g_records_dropped = 0;
+
+static void drain_timer_callback(IDTYPE caller, void* arg);
+
+static int write_trace_header(const char* uri) {
+    int ret = DkStreamOpen(uri, PAL_ACCESS_WRONLY, PAL_SHARE_OWNER_R | PAL_SHARE_OWNER_W,
+                           PAL_CREATE_TRY, /*options=*/0, &g_trace_file);
+    if (ret < 0)
+        return ret;
+
+    ret = DkStreamSetLength(g_trace_file, 0);
+    if (ret < 0)
+        return ret;
+
+    size_t names_size = 0;
+    for (size_t i = 0; i < LIBOS_SYSCALL_BOUND; i++) {
+        const char* name = get_syscall_name(i);
+        names_size += (name ? strlen(name) : 0) + 1;
+    }
+
+    size_t size = sizeof(struct syscall_trace_header) + names_size;
+    char* buf = malloc(size);
+    if (!buf)
+        return -PAL_ERROR_NOMEM;
+
+    struct syscall_trace_header* hdr = (struct syscall_trace_header*)buf;
+    memcpy(hdr->magic, SYSCALL_TRACE_MAGIC, sizeof(hdr->magic));
+    hdr->record_size = sizeof(struct syscall_trace_record);
+    hdr->names_count = LIBOS_SYSCALL_BOUND;
+    hdr->names_size  = names_size;
+    hdr->pid         = g_process.pid;
+
+    char* names = buf + sizeof(*hdr);
+    for (size_t i = 0; i < LIBOS_SYSCALL_BOUND; i++) {
+        const char* name = get_syscall_name(i) ?: "";
+        size_t len = strlen(name) + 1;
+        memcpy(names, name, len);
+        names += len;
+    }
+
+    ret = write_exact_at(g_trace_file, /*offset=*/0, buf, size);
+    free(buf);
+    if (ret < 0)
+        return ret;
+
+    g_trace_file_off = size;
+    return 0;
+}
+
+int init_syscall_trace(void) {
+    assert(g_manifest_root);
+
+    char* uri = NULL;
+    char* process_uri = NULL;
+    int ret = toml_string_in(g_manifest_root, "libos.syscall_trace_file", &uri);
+    if (ret < 0 || (uri && !strstartswith(uri, URI_PREFIX_FILE))) {
+        log_error("Cannot parse 'libos.syscall_trace_file' (the value must be a URI starting with "
+                  "\"file:\")\n");
+        ret = -EINVAL;
+        goto out;
+    }
+    if (!uri)
+        return 0;
+
+    uint64_t buffer_size;
+    ret = toml_sizestring_in(g_manifest_root, "libos.syscall_trace_buffer_size",
+                             SYSCALL_TRACE_DEFAULT_BUFFER_SIZE, &buffer_size);
+    if (ret < 0 || buffer_size < sizeof(struct syscall_trace_record)) {
+        log_error("Cannot parse 'libos.syscall_trace_buffer_size' (the value must be put in double "
+                  "quotes and hold at least one record)\n");
+        ret = -EINVAL;
+        goto out;
+    }
+    /* round down to a power of two, so that ring indices are simple masks */
+    g_ring_size = 1UL << (63 - __builtin_clzl(buffer_size / sizeof(struct syscall_trace_record)));
+
+    if (!create_lock(&g_trace_lock)) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    char pid_suffix[12];
+    snprintf(pid_suffix, sizeof(pid_suffix), ".%u", g_process.pid);
+    process_uri = alloc_concat(uri, -1, pid_suffix, -1);
+    if (!process_uri) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    ret = write_trace_header(process_uri);
+    if (ret < 0) {
+        log_error("Cannot create the syscall trace file %s: %d\n", process_uri, ret);
+        ret = pal_to_unix_errno(ret);
+        goto out;
+    }
+
+    ret = install_async_timer(SYSCALL_TRACE_DRAIN_INTERVAL_US, &drain_timer_callback, NULL,
+                              /*out_timer=*/NULL);
+    if (ret < 0)
+        goto out;
+
+    __atomic_store_n(&g_syscall_trace_enabled, true, __ATOMIC_RELEASE);
+    ret = 0;
+out:
+    free(process_uri);
+    free(uri);
+    return ret;
+}
+
+static struct syscall_trace_ring* get_trace_ring(struct shim_thread* thread) {
+    if (thread->syscall_trace)
+        return thread->syscall_trace;
+
+    struct syscall_trace_ring* ring = calloc(1, sizeof(*ring)
+                                                + g_ring_size * sizeof(ring->records[0]));
+    if (!ring)
+        return NULL;
+    ring->size = g_ring_size;
+    INIT_LIST_HEAD(ring, list);
+
+    lock(&g_trace_lock);
+    LISTP_ADD_TAIL(ring, &g_rings, list);
+    unlock(&g_trace_lock);
+
+    thread->syscall_trace = ring;
+    return ring;
+}
+
+void trace_syscall(unsigned long sysnr, const int64_t args[6], int64_t ret, uint64_t start_us,
+                   uint64_t duration_us) {
+    struct shim_thread* cur_thread = get_cur_thread();
+    if (!cur_thread)
+        return;
+
+    struct syscall_trace_ring* ring = get_trace_ring(cur_thread);
+    if (!ring)
+        return;
+
+    uint64_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == ring->size) {
+        __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    struct syscall_trace_record* record = &ring->records[head & (ring->size - 1)];
+    record->time_us     = start_us;
+    record->duration_us = duration_us;
+    record->tid         = cur_thread->tid;
+    record->sysnr       = sysnr;
+    memcpy(record->args, args, sizeof(record->args));
+    record->ret         = ret;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void release_syscall_trace(struct shim_thread* thread) {
+    struct syscall_trace_ring* ring = thread->syscall_trace;
+    if (!ring)
+        return;
+
+    /* the ring is freed by the drainer */
+    __atomic_store_n(&ring->dead, true, __ATOMIC_RELEASE);
+    thread->syscall_trace = NULL;
+}
+
+static void drain_ring(struct syscall_trace_ring* ring) {
+    assert(locked(&g_trace_lock));
+
+    uint64_t tail = ring->tail;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    while (tail != head) {
+        /* up to the end of the ring buffer, the rest in the next iteration */
+        size_t start = tail & (ring->size - 1);
+        size_t count = MIN(head - tail, ring->size - start);
+        size_t size  = count * sizeof(ring->records[0]);
+        /* on errors, the records are dropped, there is no one to report them to */
+        if (write_exact_at(g_trace_file, g_trace_file_off, &ring->records[start], size) == 0)
+            g_trace_file_off += size;
+        tail += count;
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+}
+
+static void drain_all_rings(void) {
+    lock(&g_trace_lock);
+    struct syscall_trace_ring* ring;
+    struct syscall_trace_ring* tmp;
+    LISTP_FOR_EACH_ENTRY_SAFE(ring, tmp, &g_rings, list) {
+        /* read before draining: a dead ring gets no more records */
+        bool dead = __atomic_load_n(&ring->dead, __ATOMIC_ACQUIRE);
+        drain_ring(ring);
+        if (dead) {
+            g_records_dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+            LISTP_DEL(ring, &g_rings, list);
+            free(ring);
+        }
+    }
+    unlock(&g_trace_lock);
+}
+
+static void drain_timer_callback(IDTYPE caller, void* arg) {
+    __UNUSED(caller);
+    __UNUSED(arg);
+
+    drain_all_rings();
+    /* fails only when the async worker is being terminated, the exiting process drains the rest */
+    (void)install_async_timer(SYSCALL_TRACE_DRAIN_INTERVAL_US, &drain_timer_callback, NULL,
+                              /*out_timer=*/NULL);
+}
+
+void flush_syscall_trace(void) {
+    if (!__atomic_load_n(&g_syscall_trace_enabled, __ATOMIC_ACQUIRE))
+        return;
+
+    drain_all_rings();
+
+    lock(&g_trace_lock);
+    uint64_t dropped = g_records_dropped;
+    struct syscall_trace_ring* ring;
+    LISTP_FOR_EACH_ENTRY(ring, &g_rings, list) {
+        dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+    }
+    unlock(&g_trace_lock);
+
+    if (dropped)
+        log_warning("syscall trace: %lu records dropped (increase "
+                    "'libos.syscall_trace_buffer_size')\n", dropped);
+}
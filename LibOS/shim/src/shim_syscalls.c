@@ -3,23 +3,172 @@
  *                    Borys Popławski <borysp@invisiblethingslab.com>
  */
 
+#include <asm/unistd.h>
+
+#include "shim_checkpoint.h"
 #include "shim_defs.h"
 #include "shim_internal.h"
 #include "shim_table.h"
 #include "shim_tcb.h"
+#include "shim_thread.h"
 #include "shim_types.h"
 
 typedef arch_syscall_arg_t (*six_args_syscall_t)(arch_syscall_arg_t, arch_syscall_arg_t,
                                                  arch_syscall_arg_t, arch_syscall_arg_t,
                                                  arch_syscall_arg_t, arch_syscall_arg_t);
 
+/*
+ * Per-thread syscall statistics, exposed in `/proc/<pid>/graphene/syscalls`. Each thread updates only
+ * its own counters, so there are no locked instructions on the syscall path; readers sum up the
+ * counters of all threads with relaxed loads (and may see a syscall counted, but not yet timed).
+ * Entries are allocated on the first use of a syscall by the thread. When a thread exits, its
+ * counters are added to `g_exited_stats`.
+ */
+struct shim_syscall_stats {
+    struct shim_syscall_stat* stat[LIBOS_SYSCALL_BOUND];
+};
+
+/* statistics of exited threads, protected by `g_thread_list_lock` (`walk_thread_list` callbacks run
+ * with it held) */
+static struct shim_syscall_stat g_exited_stats[LIBOS_SYSCALL_BOUND];
+
+static bool g_syscall_latency_stats = false;
+
+int init_syscall_stats(void) {
+    assert(g_manifest_root);
+
+    int ret = toml_bool_in(g_manifest_root, "libos.syscall_latency_stats", /*defaultval=*/false,
+                           &g_syscall_latency_stats);
+    if (ret < 0) {
+        log_error("Cannot parse 'libos.syscall_latency_stats' (the value must be `true` or "
+                  "`false`)\n");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static struct shim_syscall_stat* get_syscall_stat(unsigned long sysnr) {
+    struct shim_thread* cur_thread = get_cur_thread();
+    if (!cur_thread)
+        return NULL;
+
+    struct shim_syscall_stats* stats = cur_thread->syscall_stats;
+    if (!stats) {
+        stats = calloc(1, sizeof(*stats));
+        if (!stats)
+            return NULL;
+        __atomic_store_n(&cur_thread->syscall_stats, stats, __ATOMIC_RELEASE);
+    }
+
+    struct shim_syscall_stat* stat = stats->stat[sysnr];
+    if (!stat) {
+        stat = calloc(1, sizeof(*stat));
+        if (!stat)
+            return NULL;
+        __atomic_store_n(&stats->stat[sysnr], stat, __ATOMIC_RELEASE);
+    }
+    return stat;
+}
+
+static void record_syscall_time(struct shim_syscall_stat* stat, uint64_t time_us) {
+    size_t bucket = time_us ? MIN(64 - (size_t)__builtin_clzl(time_us),
+                                  (size_t)SYSCALL_STATS_BUCKETS - 1) : 0;
+    /* only this thread writes the counters, plain increments are enough */
+    __atomic_store_n(&stat->time_us, stat->time_us + time_us, __ATOMIC_RELAXED);
+    __atomic_store_n(&stat->buckets[bucket], stat->buckets[bucket] + 1, __ATOMIC_RELAXED);
+}
+
+static void add_syscall_stat(struct shim_syscall_stat* sum, struct shim_syscall_stat* stat) {
+    sum->count   += __atomic_load_n(&stat->count, __ATOMIC_RELAXED);
+    sum->time_us += __atomic_load_n(&stat->time_us, __ATOMIC_RELAXED);
+    for (size_t i = 0; i < SYSCALL_STATS_BUCKETS; i++)
+        sum->buckets[i] += __atomic_load_n(&stat->buckets[i], __ATOMIC_RELAXED);
+}
+
+/* syscalls counted in `shim_thread::fast_syscalls`, they are never timed */
+static const unsigned long g_fast_syscall_nrs[FAST_SYSCALLS_CNT] = {
+    [FAST_SYSCALL_GETPID]  = __NR_getpid,
+    [FAST_SYSCALL_GETPPID] = __NR_getppid,
+    [FAST_SYSCALL_GETTID]  = __NR_gettid,
+    [FAST_SYSCALL_GETUID]  = __NR_getuid,
+    [FAST_SYSCALL_GETEUID] = __NR_geteuid,
+    [FAST_SYSCALL_GETGID]  = __NR_getgid,
+    [FAST_SYSCALL_GETEGID] = __NR_getegid,
+};
+
+static void add_thread_syscall_stats(struct shim_syscall_stat* sum, struct shim_thread* thread) {
+    for (size_t i = 0; i < FAST_SYSCALLS_CNT; i++) {
+        sum[g_fast_syscall_nrs[i]].count += __atomic_load_n(&thread->fast_syscalls[i],
+                                                            __ATOMIC_RELAXED);
+    }
+
+    struct shim_syscall_stats* stats = __atomic_load_n(&thread->syscall_stats, __ATOMIC_ACQUIRE);
+    if (!stats)
+        return;
+
+    for (size_t i = 0; i < LIBOS_SYSCALL_BOUND; i++) {
+        struct shim_syscall_stat* stat = __atomic_load_n(&stats->stat[i], __ATOMIC_ACQUIRE);
+        if (stat)
+            add_syscall_stat(&sum[i], stat);
+    }
+}
+
+/* Called when `thread` is taken off the thread list, with `g_thread_list_lock` held. */
+void fold_syscall_stats(struct shim_thread* thread) {
+    add_thread_syscall_stats(g_exited_stats, thread);
+}
+
+void free_syscall_stats(struct shim_thread* thread) {
+    struct shim_syscall_stats* stats = thread->syscall_stats;
+    if (!stats)
+        return;
+
+    for (size_t i = 0; i < LIBOS_SYSCALL_BOUND; i++)
+        free(stats->stat[i]);
+    free(stats);
+    thread->syscall_stats = NULL;
+}
+
+struct collect_syscall_stats_arg {
+    struct shim_syscall_stat* stats;
+    bool exited_added;
+};
+
+static int collect_syscall_stats_cb(struct shim_thread* thread, void* arg) {
+    struct collect_syscall_stats_arg* args = arg;
+
+    if (!args->exited_added) {
+        for (size_t i = 0; i < LIBOS_SYSCALL_BOUND; i++)
+            add_syscall_stat(&args->stats[i], &g_exited_stats[i]);
+        args->exited_added = true;
+    }
+    add_thread_syscall_stats(args->stats, thread);
+    return 1;
+}
+
+void collect_syscall_stats(struct shim_syscall_stat* stats) {
+    memset(stats, 0, LIBOS_SYSCALL_BOUND * sizeof(*stats));
+
+    struct collect_syscall_stats_arg args = {
+        .stats = stats,
+        .exited_added = false,
+    };
+    /* the calling thread is on the list, so the callback runs at least once */
+    (void)walk_thread_list(&collect_syscall_stats_cb, &args, /*one_shot=*/false);
+}
+
 /*
  * `context` is expected to be placed at the bottom of Graphene-internal stack.
  * If you change this function please also look at `shim_do_rt_sigsuspend`!
  */
 noreturn void shim_emulate_syscall(PAL_CONTEXT* context) {
+    shim_tcb_set_in_libos(true);
     SHIM_TCB_SET(context.regs, context);
 
+    /* system calls may hand application memory over to the host, or create threads */
+    if (__atomic_load_n(&g_lazy_memory_pending, __ATOMIC_ACQUIRE))
+        finish_lazy_memory();
+
     unsigned long sysnr = pal_context_get_syscall(context);
     arch_syscall_arg_t ret = 0;
     if (sysnr >= LIBOS_SYSCALL_BOUND || !shim_table[sysnr]) {
@@ -32,10 +181,34 @@ noreturn void shim_emulate_syscall(PAL_CONTEXT* context) {
 
     six_args_syscall_t syscall_func = (six_args_syscall_t)shim_table[sysnr];
 
+    struct shim_syscall_stat* stat = get_syscall_stat(sysnr);
+    if (stat) {
+        __atomic_store_n(&stat->count, stat->count + 1, __ATOMIC_RELAXED);
+        if (!g_syscall_latency_stats)
+            stat = NULL;
+    }
+
+    /* the context may be changed by the syscall (e.g. `rt_sigreturn`), save the arguments */
+    bool trace = __atomic_load_n(&g_syscall_trace_enabled, __ATOMIC_RELAXED);
+    arch_syscall_arg_t args[6] = {0};
+    if (trace)
+        memcpy(args, (arch_syscall_arg_t[6]){ALL_SYSCALL_ARGS(context)}, sizeof(args));
+
+    uint64_t start_us = 0;
+    bool timed = (stat || trace) && DkSystemTimeQuery(&start_us) == 0;
+
     debug_print_syscall_before(sysnr, ALL_SYSCALL_ARGS(context));
     ret = syscall_func(ALL_SYSCALL_ARGS(context));
     debug_print_syscall_after(sysnr, ret, ALL_SYSCALL_ARGS(context));
 
+    uint64_t end_us;
+    if (timed && DkSystemTimeQuery(&end_us) == 0 && end_us >= start_us) {
+        if (stat)
+            record_syscall_time(stat, end_us - start_us);
+        if (trace)
+            trace_syscall(sysnr, args, ret, start_us, end_us - start_us);
+    }
+
 out:
     pal_context_set_retval(context, ret);
 
@@ -56,5 +229,7 @@ out:
     SHIM_TCB_SET(context.syscall_nr, -1);
     SHIM_TCB_SET(context.regs, NULL);
 
+    rseq_update_cpu();
+    shim_tcb_set_in_libos(false);
     return_from_syscall(context);
 }
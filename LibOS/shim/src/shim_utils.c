@@ -7,11 +7,15 @@
 #include "shim_internal.h"
 #include "shim_utils.h"
 
-int read_exact(PAL_HANDLE handle, void* buf, size_t size) {
+/* Streams (pipes, sockets) ignore the offset and must be passed 0; files are read and written at
+ * consecutive offsets. */
+static int read_exact_common(PAL_HANDLE handle, bool seekable, size_t offset, void* buf,
+                             size_t size) {
     size_t read = 0;
     while (read < size) {
         size_t tmp_read = size - read;
-        int ret = DkStreamRead(handle, /*offset=*/0, &tmp_read, (char*)buf + read, NULL, 0);
+        int ret = DkStreamRead(handle, seekable ? offset + read : 0, &tmp_read, (char*)buf + read,
+                               NULL, 0);
         if (ret < 0) {
             if (ret == -PAL_ERROR_INTERRUPTED || ret == -PAL_ERROR_TRYAGAIN) {
                 continue;
@@ -25,11 +29,13 @@ int read_exact(PAL_HANDLE handle, void* buf, size_t size) {
     return 0;
 }
 
-int write_exact(PAL_HANDLE handle, void* buf, size_t size) {
+static int write_exact_common(PAL_HANDLE handle, bool seekable, size_t offset, void* buf,
+                              size_t size) {
     size_t written = 0;
     while (written < size) {
         size_t tmp_written = size - written;
-        int ret = DkStreamWrite(handle, /*offset=*/0, &tmp_written, (char*)buf + written, NULL);
+        int ret = DkStreamWrite(handle, seekable ? offset + written : 0, &tmp_written,
+                                (char*)buf + written, NULL);
         if (ret < 0) {
             if (ret == -PAL_ERROR_INTERRUPTED || ret == -PAL_ERROR_TRYAGAIN) {
                 continue;
@@ -42,3 +48,19 @@ int write_exact(PAL_HANDLE handle, void* buf, size_t size) {
     }
     return 0;
 }
+
+int read_exact(PAL_HANDLE handle, void* buf, size_t size) {
+    return read_exact_common(handle, /*seekable=*/false, /*offset=*/0, buf, size);
+}
+
+int write_exact(PAL_HANDLE handle, void* buf, size_t size) {
+    return write_exact_common(handle, /*seekable=*/false, /*offset=*/0, buf, size);
+}
+
+int read_exact_at(PAL_HANDLE handle, size_t offset, void* buf, size_t size) {
+    return read_exact_common(handle, /*seekable=*/true, offset, buf, size);
+}
+
+int write_exact_at(PAL_HANDLE handle, size_t offset, void* buf, size_t size) {
+    return write_exact_common(handle, /*seekable=*/true, offset, buf, size);
+}
@@ -30,6 +30,8 @@ struct shim_clone_args {
     void* stack;
     unsigned long tls;
     PAL_CONTEXT* regs;
+    int cpu;
+    int numa_node;
 };
 
 /*
@@ -66,6 +68,9 @@ static int clone_implementation_wrapper(struct shim_clone_args* arg) {
     DkObjectClose(arg->create_event);
 
     shim_tcb_t* tcb = my_thread->shim_tcb;
+    /* like on Linux, the new thread inherits the CPU affinity (and thus placement) of its parent */
+    tcb->cpu       = arg->cpu;
+    tcb->numa_node = arg->numa_node;
 
     log_setprefix(tcb);
 
@@ -103,15 +108,57 @@ static int clone_implementation_wrapper(struct shim_clone_args* arg) {
     restore_child_context_after_clone(&tcb->context);
 }
 
+/* Counterpart of `clone_implementation_wrapper` for user-level threads, which are not started by
+ * the host but queued to run on a carrier (see `shim_uthread.c`). Consumes the reference to
+ * `thread`. */
+static long do_clone_uthread(struct shim_thread* thread, unsigned long user_stack_addr,
+                             unsigned long tls, int* set_parent_tid) {
+    struct shim_thread* self = get_cur_thread();
+
+    if (thread->set_child_tid) {
+        *(thread->set_child_tid) = thread->tid;
+        thread->set_child_tid = NULL;
+    }
+
+    void* stack = (void*)(user_stack_addr ?: pal_context_get_sp(self->shim_tcb->context.regs));
+
+    struct shim_vma_info vma_info;
+    if (lookup_vma(ALLOC_ALIGN_DOWN_PTR(stack), &vma_info) < 0) {
+        put_thread(thread);
+        return -EFAULT;
+    }
+    thread->stack_top = (char*)vma_info.addr + vma_info.length;
+    thread->stack_red = thread->stack = vma_info.addr;
+    if (vma_info.file) {
+        put_handle(vma_info.file);
+    }
+
+    PAL_CONTEXT regs;
+    pal_context_copy(&regs, self->shim_tcb->context.regs);
+    pal_context_set_sp(&regs, (unsigned long)stack);
+
+    add_thread(thread);
+
+    if (set_parent_tid)
+        *set_parent_tid = thread->tid;
+
+    IDTYPE tid = thread->tid;
+    long ret = uthread_create(thread, &regs, tls, self->shim_tcb->cpu, self->shim_tcb->numa_node);
+    put_thread(thread);
+    return ret < 0 ? ret : tid;
+}
+
 static BEGIN_MIGRATION_DEF(fork, struct shim_process* process_description,
                            struct shim_thread* thread_description,
                            struct shim_ipc_ids* process_ipc_ids) {
     DEFINE_MIGRATE(process_ipc_ids, process_ipc_ids, sizeof(*process_ipc_ids));
     DEFINE_MIGRATE(all_mounts, NULL, 0);
+    DEFINE_MIGRATE(dcache_snapshot, NULL, 0);
     DEFINE_MIGRATE(all_vmas, NULL, 0);
     DEFINE_MIGRATE(process_description, process_description, sizeof(*process_description));
     DEFINE_MIGRATE(thread, thread_description, sizeof(*thread_description));
     DEFINE_MIGRATE(migratable, NULL, 0);
+    DEFINE_MIGRATE(provisioned_secret, NULL, 0);
     DEFINE_MIGRATE(brk, NULL, 0);
     DEFINE_MIGRATE(loaded_libraries, NULL, 0);
 #ifdef DEBUG
@@ -146,6 +193,8 @@ static long do_clone_new_vm(unsigned long flags, struct shim_thread* thread, uns
      * a shallow copy, so `shim_tcb.context.regs` will be shared with the parent. */
     shim_tcb.context.regs = self->shim_tcb->context.regs;
     shim_tcb.context.tls = tls;
+    shim_tcb.cpu = self->shim_tcb->cpu;
+    shim_tcb.numa_node = self->shim_tcb->numa_node;
 
     thread->shim_tcb = &shim_tcb;
 
@@ -221,6 +270,140 @@ static long do_clone_new_vm(unsigned long flags, struct shim_thread* thread, uns
     return ret;
 }
 
+/*
+ * vfork() is emulated without creating a child process until the child calls execve() or exits:
+ * the child runs on the thread of its parent (which in Linux is suspended anyway) with a thread
+ * description of its own. Only then a new process is created, either with a tiny checkpoint
+ * describing the new executable (see `vfork_execve`) or as an already exited child. This avoids
+ * checkpointing the whole address space of the parent, which is wasted work when followed by
+ * execve(), and is how posix_spawn() and most shells start new programs.
+ */
+static long do_vfork(unsigned long flags, unsigned long user_stack_addr, int* set_parent_tid) {
+    struct shim_thread* self = get_cur_thread();
+    shim_tcb_t* tcb = shim_get_tcb();
+    long ret;
+
+    struct shim_vfork_state* state = calloc(1, sizeof(*state));
+    if (!state)
+        return -ENOMEM;
+
+    state->child_process = create_child_process();
+    if (!state->child_process) {
+        ret = -ENOMEM;
+        goto out_free;
+    }
+
+    struct shim_thread* child = get_new_thread();
+    if (!child) {
+        ret = -ENOMEM;
+        goto out_free;
+    }
+
+    /* The child gets its own copies of the descriptor table and signal dispositions, so that it
+     * cannot disturb the parent before execve(). */
+    struct shim_handle_map* new_map = NULL;
+    ret = dup_handle_map(&new_map, child->handle_map);
+    if (ret < 0)
+        goto out_put;
+    set_handle_map(child, new_map);
+    put_handle_map(new_map);
+
+    struct shim_signal_dispositions* dispositions =
+        dup_signal_dispositions(child->signal_dispositions);
+    if (!dispositions) {
+        ret = -ENOMEM;
+        goto out_put;
+    }
+    put_signal_dispositions(child->signal_dispositions);
+    child->signal_dispositions = dispositions;
+
+    /* the child borrows the host thread and the LibOS stack of the parent */
+    child->pal_handle         = self->pal_handle;
+    child->libos_stack_bottom = self->libos_stack_bottom;
+    child->signal_altstack    = self->signal_altstack;
+
+    get_thread(self);
+    state->parent = self;
+    pal_context_copy(&state->parent_regs, tcb->context.regs);
+    state->parent_tidptr = set_parent_tid;
+    state->child_process->pid = child->tid;
+    state->child_process->child_termination_signal = flags & CSIGNAL;
+    state->child_pgid = __atomic_load_n(&g_process.pgid, __ATOMIC_ACQUIRE);
+
+    lock(&g_process.fs_lock);
+    state->parent_cwd = g_process.cwd;
+    get_dentry(state->parent_cwd);
+    state->parent_umask = g_process.umask;
+    unlock(&g_process.fs_lock);
+
+    child->vfork = state;
+    set_cur_thread(child);
+
+    if (user_stack_addr)
+        pal_context_set_sp(tcb->context.regs, user_stack_addr);
+
+    /* we keep the reference from `get_new_thread` until the parent is resumed */
+    return 0;
+
+out_put:
+    put_thread(child);
+out_free:
+    /* no pid was assigned to `child_process` yet */
+    free(state->child_process);
+    free(state);
+    return ret;
+}
+
+noreturn void vfork_resume_parent(void) {
+    struct shim_thread* child = get_cur_thread();
+    struct shim_vfork_state* state = child->vfork;
+    assert(state);
+    /* the child was handed over to the children list (and the pid along with it) */
+    assert(!state->child_process);
+
+    IDTYPE child_pid = child->tid;
+
+    set_cur_thread(state->parent);
+
+    /* The pid is released once the child is reaped, see `destroy_child_process`. Also the host
+     * thread and the LibOS stack are still used by the parent. */
+    child->tid                = 0;
+    child->pal_handle         = NULL;
+    child->libos_stack_bottom = NULL;
+    child->vfork              = NULL;
+    put_thread(child);
+
+    lock(&g_process.fs_lock);
+    struct shim_dentry* child_cwd = g_process.cwd;
+    g_process.cwd   = state->parent_cwd;
+    g_process.umask = state->parent_umask;
+    unlock(&g_process.fs_lock);
+    put_dentry(child_cwd);
+
+    if (state->parent_tidptr)
+        *state->parent_tidptr = child_pid;
+
+    PAL_CONTEXT regs;
+    pal_context_copy(&regs, &state->parent_regs);
+    pal_context_set_retval(&regs, child_pid);
+
+    put_thread(state->parent);
+    free(state);
+
+    log_debug("vfork: resuming the parent of %u\n", child_pid);
+
+    shim_tcb_t* tcb = shim_get_tcb();
+    tcb->context.regs = &regs;
+    /* deliver signals which arrived while the child was running */
+    handle_signal(&regs, /*old_mask_ptr=*/NULL);
+    tcb->context.syscall_nr = -1;
+    tcb->context.regs = NULL;
+
+    rseq_update_cpu();
+    shim_tcb_set_in_libos(false);
+    return_from_syscall(&regs);
+}
+
 long shim_do_clone(unsigned long flags, unsigned long user_stack_addr, int* parent_tidptr,
                   int* child_tidptr, unsigned long tls) {
     /*
@@ -273,13 +456,25 @@ long shim_do_clone(unsigned long flags, unsigned long user_stack_addr, int* pare
         }
     }
 
+    if (get_cur_thread()->vfork) {
+        /* A vfork() child may only call execve() or exit, anything else is undefined behavior, but
+         * let's be nice at least to applications forking from the child. */
+        log_warning("clone called by a child of vfork before execve, this is unsupported\n");
+        return -EINVAL;
+    }
+
     if (flags & CLONE_VFORK) {
-        /* Instead of trying to support Linux semantics for vfork() -- which requires adding
-         * corner-cases in signal handling and syscalls -- we simply treat vfork() as fork(). We
-         * assume that performance hit is negligible (Graphene has to migrate internal state anyway
-         * which is slow) and apps do not rely on insane Linux-specific semantics of vfork().  */
-        log_warning("vfork was called by the application, implemented as an alias to fork in "
-                    "Graphene\n");
+        if ((flags & ~(CLONE_PARENT_SETTID | CSIGNAL)) == (CLONE_VFORK | CLONE_VM)) {
+            if ((flags & CLONE_PARENT_SETTID) && !parent_tidptr)
+                return -EINVAL;
+            return do_vfork(flags, user_stack_addr,
+                            flags & CLONE_PARENT_SETTID ? parent_tidptr : NULL);
+        }
+
+        /* Other combinations with CLONE_VFORK (e.g. sharing the descriptor table or setting TLS)
+         * are not worth the corner-cases in the emulation above, we simply treat them as fork(). */
+        log_warning("clone with CLONE_VFORK and flags 0x%lx is implemented as an alias to fork in "
+                    "Graphene\n", flags);
         flags &= ~(CLONE_VFORK | CLONE_VM);
     }
 
@@ -359,7 +554,9 @@ long shim_do_clone(unsigned long flags, unsigned long user_stack_addr, int* pare
          * descriptors table. */
         struct shim_handle_map* new_map = NULL;
 
-        dup_handle_map(&new_map, thread->handle_map);
+        ret = dup_handle_map(&new_map, thread->handle_map);
+        if (ret < 0)
+            goto failed;
         set_handle_map(thread, new_map);
         put_handle_map(new_map);
     }
@@ -370,6 +567,9 @@ long shim_do_clone(unsigned long flags, unsigned long user_stack_addr, int* pare
 
     enable_locking();
 
+    if (uthreads_enabled())
+        return do_clone_uthread(thread, user_stack_addr, tls, set_parent_tid);
+
     struct shim_clone_args new_args;
     memset(&new_args, 0, sizeof(new_args));
 
@@ -390,10 +590,13 @@ long shim_do_clone(unsigned long flags, unsigned long user_stack_addr, int* pare
     /* Increasing refcount due to copy below. Passing ownership of the new copy
      * of this pointer to the new thread (receiver of new_args). */
     get_thread(thread);
-    new_args.thread = thread;
-    new_args.stack  = (void*)(user_stack_addr ?: pal_context_get_sp(self->shim_tcb->context.regs));
-    new_args.tls    = tls;
-    new_args.regs   = self->shim_tcb->context.regs;
+    new_args.thread    = thread;
+    new_args.stack     = (void*)(user_stack_addr
+                                     ?: pal_context_get_sp(self->shim_tcb->context.regs));
+    new_args.tls       = tls;
+    new_args.regs      = self->shim_tcb->context.regs;
+    new_args.cpu       = self->shim_tcb->cpu;
+    new_args.numa_node = self->shim_tcb->numa_node;
 
     // Invoke DkThreadCreate to spawn off a child process using the actual
     // "clone" system call. DkThreadCreate allocates a stack for the child
@@ -29,8 +29,20 @@
 #define EPOLLRDHUP  0x2000
 #endif
 
-/* TODO: 1024 handles/FDs is a small number for high-load servers (e.g., Linux has ~3M) */
-#define MAX_EPOLL_HANDLES 1024
+#ifndef EPOLLEXCLUSIVE
+/* Linux 4.5, not present in older kernel headers */
+#define EPOLLEXCLUSIVE (1U << 28)
+#endif
+
+/* events which may be combined with EPOLLEXCLUSIVE (see `EPOLLEXCLUSIVE_OK_BITS` in Linux) */
+#define EPOLLEXCLUSIVE_OK_BITS (EPOLLIN | EPOLLOUT | EPOLLERR | EPOLLHUP | EPOLLWAKEUP | EPOLLET \
+                                | EPOLLEXCLUSIVE)
+
+/* max events fetched from the PAL poller by one wait */
+#define EPOLL_WAIT_MAX_EVENTS 64
+
+/* set in the poller data of `pal_wr_handle` registrations (items are at least 2-byte aligned) */
+#define EPOLL_ITEM_WR_HANDLE 1UL
 
 struct shim_fs epoll_builtin_fs;
 
@@ -46,14 +58,18 @@ long shim_do_epoll_create1(int flags) {
     hdl->fs = &epoll_builtin_fs;
 
     struct shim_epoll_handle* epoll = &hdl->info.epoll;
-    epoll->fds_count = 0;
-    __atomic_store_n(&epoll->waiter_cnt, 0, __ATOMIC_RELAXED);
+    epoll->waiter_cnt = 0;
+    epoll->fds_count  = 0;
+    epoll->poller     = NULL;
+    epoll->needs_arm  = false;
     INIT_LISTP(&epoll->fds);
+    INIT_LISTP(&epoll->ready);
+    INIT_LISTP(&epoll->removed);
 
-    int ret = create_event(&epoll->event);
+    int ret = DkPollerCreate(&epoll->poller);
     if (ret < 0) {
         put_handle(hdl);
-        return ret;
+        return pal_to_unix_errno(ret);
     }
 
     int vfd = set_new_fd_handle(hdl, (flags & EPOLL_CLOEXEC) ? FD_CLOEXEC : 0, NULL);
@@ -69,25 +85,164 @@ long shim_do_epoll_create(int size) {
     return shim_do_epoll_create1(0);
 }
 
-static void notify_epoll_waiters(struct shim_epoll_handle* epoll) {
-    /* if other threads are currently waiting on epoll_wait(), send a signal to update their
-     * epoll items (note that we send waiter_cnt number of signals -- to each waiting thread)
-     * XXX(borys): I don't think this is correct: set_event semantics seem to be producers-consumers
-     * and here we need to wake all waiting threads. Waiting for this event is done in a loop
-     * (`shim_do_epoll_wait`), what if one threads consumes multiple events? */
-    size_t waiters = __atomic_load_n(&epoll->waiter_cnt, __ATOMIC_RELAXED);
-    if (waiters) {
-        /* TODO: this needs error checking. */
-        set_event(&epoll->event, waiters);
+/*
+ * PAL events `epoll_item` currently waits for. An `EPOLLET` item doesn't wait for a direction in
+ * which it already reported an event, until the handle's `needs_et_poll_in/out` is set again.
+ *
+ * Must be called with the handle lock held.
+ */
+static PAL_FLG epoll_item_pal_events(struct shim_epoll_item* epoll_item) {
+    struct shim_handle* hdl = epoll_item->handle;
+    assert(locked(&hdl->lock));
+
+    bool et = epoll_item->events & EPOLLET;
+    /* with several epolls (usually of different processes) waiting on one listening socket, the
+     * host wakes up only one of them instead of all, which then fail to accept() */
+    PAL_FLG pal_events = epoll_item->events & EPOLLEXCLUSIVE ? PAL_WAIT_EXCLUSIVE : 0;
+    if ((epoll_item->events & (EPOLLIN | EPOLLRDNORM))
+            && (!et || __atomic_load_n(&hdl->needs_et_poll_in, __ATOMIC_ACQUIRE)))
+        pal_events |= PAL_WAIT_READ;
+    if ((epoll_item->events & (EPOLLOUT | EPOLLWRNORM))
+            && (!et || __atomic_load_n(&hdl->needs_et_poll_out, __ATOMIC_ACQUIRE)))
+        pal_events |= PAL_WAIT_WRITE;
+    return pal_events;
+}
+
+/*
+ * (Re-)register the PAL handle of `epoll_item` in the PAL poller of its epoll. The PAL poller keeps
+ * one registration per PAL handle, so all items of the handle in this epoll (e.g. of dup-ed FDs)
+ * share it: it waits for the events of all of them and `add_ready_epoll_items` reports each event
+ * to every item waiting for it. Registrations are persistent, so a thread blocked in `epoll_wait`
+ * picks up the change without being woken up.
+ *
+ * Must be called with the handle lock held.
+ */
+static void arm_epoll_item(struct shim_epoll_item* epoll_item) {
+    struct shim_handle* hdl = epoll_item->handle;
+    assert(locked(&hdl->lock));
+
+    /* pipe and socket may not have pal_handle yet (e.g. before bind()), the item is armed in
+     * `_update_epolls` once they get one */
+    if (!hdl->pal_handle && !hdl->pal_wr_handle)
+        return;
+
+    PAL_FLG pal_events = 0;
+    struct shim_epoll_item* other;
+    LISTP_FOR_EACH_ENTRY(other, &hdl->epolls, back) {
+        if (other->epoll == epoll_item->epoll)
+            pal_events |= epoll_item_pal_events(other);
+    }
+
+    PAL_HANDLE poller = epoll_item->epoll->info.epoll.poller;
+    int ret = 0;
+    if (hdl->pal_wr_handle) {
+        /* write readiness is signalled by `pal_wr_handle` becoming readable */
+        ret = DkPollerCtl(poller, PAL_POLLER_ADD, hdl->pal_wr_handle,
+                          (pal_events & PAL_WAIT_WRITE ? PAL_WAIT_READ : 0)
+                              | (pal_events & PAL_WAIT_EXCLUSIVE),
+                          (PAL_NUM)((uintptr_t)epoll_item | EPOLL_ITEM_WR_HANDLE));
+        pal_events &= ~PAL_WAIT_WRITE;
+    }
+    if (ret >= 0 && hdl->pal_handle) {
+        ret = DkPollerCtl(poller, PAL_POLLER_ADD, hdl->pal_handle, pal_events,
+                          (PAL_NUM)(uintptr_t)epoll_item);
+    }
+    if (ret < 0) {
+        log_debug("cannot register fd %d in epoll handle %p: %d\n", epoll_item->fd,
+                  epoll_item->epoll, ret);
+    }
+}
+
+/* Must be called with the handle lock held. */
+static void remove_from_poller(PAL_HANDLE poller, struct shim_handle* hdl) {
+    if (hdl->pal_handle)
+        DkPollerCtl(poller, PAL_POLLER_REMOVE, hdl->pal_handle, /*events=*/0, /*data=*/0);
+    if (hdl->pal_wr_handle)
+        DkPollerCtl(poller, PAL_POLLER_REMOVE, hdl->pal_wr_handle, /*events=*/0, /*data=*/0);
+}
+
+/* Unbind `epoll_item` from its handle (the `back` list) and unregister the PAL handle from the PAL
+ * poller, unless other items of the handle in the same epoll still share the registration. Must be
+ * called with the handle lock held. */
+static void disarm_epoll_item(struct shim_epoll_item* epoll_item) {
+    struct shim_handle* hdl = epoll_item->handle;
+    assert(locked(&hdl->lock));
+
+    LISTP_DEL(epoll_item, &hdl->epolls, back);
+
+    if (!hdl->pal_handle && !hdl->pal_wr_handle)
+        return;
+
+    /* the remaining items take the registration over (see `arm_epoll_item`), without the events
+     * only `epoll_item` waited for */
+    struct shim_epoll_item* other;
+    LISTP_FOR_EACH_ENTRY(other, &hdl->epolls, back) {
+        if (other != epoll_item && other->epoll == epoll_item->epoll) {
+            arm_epoll_item(other);
+            return;
+        }
+    }
+
+    remove_from_poller(epoll_item->epoll->info.epoll.poller, hdl);
+}
+
+/* Register all items of a restored epoll. Must be called with the epoll handle lock held. */
+static void arm_epoll_items(struct shim_epoll_handle* epoll) {
+    struct shim_epoll_item* epoll_item;
+    LISTP_FOR_EACH_ENTRY(epoll_item, &epoll->fds, list) {
+        lock(&epoll_item->handle->lock);
+        arm_epoll_item(epoll_item);
+        unlock(&epoll_item->handle->lock);
+    }
+    epoll->needs_arm = false;
+}
+
+/* Remove an already unlinked-from-handle item from its epoll. An item that may still be returned
+ * to a thread blocked in `epoll_wait` is only marked as removed, by moving it to `removed` list.
+ * Must be called with the epoll handle lock held. */
+static void release_epoll_item(struct shim_epoll_handle* epoll,
+                               struct shim_epoll_item* epoll_item) {
+    LISTP_DEL(epoll_item, &epoll->fds, list);
+    epoll->fds_count--;
+
+    if (!LIST_EMPTY(epoll_item, ready))
+        LISTP_DEL_INIT(epoll_item, &epoll->ready, ready);
+
+    if (epoll->waiter_cnt) {
+        epoll_item->handle = NULL;
+        LISTP_ADD(epoll_item, &epoll->removed, list);
+    } else {
+        free(epoll_item);
+    }
+}
+
+static void free_removed_epoll_items(struct shim_epoll_handle* epoll) {
+    struct shim_epoll_item* epoll_item;
+    struct shim_epoll_item* tmp;
+    LISTP_FOR_EACH_ENTRY_SAFE(epoll_item, tmp, &epoll->removed, list) {
+        LISTP_DEL(epoll_item, &epoll->removed, list);
+        free(epoll_item);
     }
 }
 
 void _update_epolls(struct shim_handle* handle) {
     assert(locked(&handle->lock));
 
+    /* the PAL handle may have been created, or edge-triggered items may have to be re-armed */
     struct shim_epoll_item* epoll_item;
     LISTP_FOR_EACH_ENTRY(epoll_item, &handle->epolls, back) {
-        notify_epoll_waiters(&epoll_item->epoll->info.epoll);
+        arm_epoll_item(epoll_item);
+    }
+}
+
+void _disarm_epolls(struct shim_handle* handle) {
+    assert(locked(&handle->lock));
+
+    /* the PAL handles are about to be replaced, `_update_epolls` registers the new ones */
+    struct shim_epoll_item* epoll_item;
+    LISTP_FOR_EACH_ENTRY(epoll_item, &handle->epolls, back) {
+        /* fails for all but the first of dup-ed items in the same epoll, which is fine */
+        remove_from_poller(epoll_item->epoll->info.epoll.poller, handle);
     }
 }
 
@@ -104,35 +259,30 @@ void delete_from_epoll_handles(struct shim_handle* handle) {
         struct shim_epoll_item* epoll_item =
             LISTP_FIRST_ENTRY(&handle->epolls, struct shim_epoll_item, back);
 
-        LISTP_DEL(epoll_item, &handle->epolls, back);
+        disarm_epoll_item(epoll_item);
         unlock(&handle->lock);
 
         /* second, get epoll to which this epoll-item belongs to, and remove epoll-item from
          * epoll's `fds` list */
         struct shim_handle* hdl = epoll_item->epoll;
         assert(hdl->type == TYPE_EPOLL);
-        struct shim_epoll_handle* epoll = &hdl->info.epoll;
+        assert(epoll_item->handle == handle);
 
         lock(&hdl->lock);
-        LISTP_DEL(epoll_item, &epoll->fds, list);
-        epoll->fds_count--;
-        notify_epoll_waiters(epoll);
+        release_epoll_item(&hdl->info.epoll, epoll_item);
         unlock(&hdl->lock);
-
-        assert(epoll_item->handle == handle);
-
-        free(epoll_item);
     }
 }
 
 void maybe_epoll_et_trigger(struct shim_handle* handle, int ret, bool in, bool was_partial) {
     if (ret == -EAGAIN || ret == -EWOULDBLOCK || was_partial) {
+        /* set under the lock, so that it doesn't race with `epoll_wait` clearing it */
+        lock(&handle->lock);
         if (in) {
             __atomic_store_n(&handle->needs_et_poll_in, true, __ATOMIC_RELEASE);
         } else {
             __atomic_store_n(&handle->needs_et_poll_out, true, __ATOMIC_RELEASE);
         }
-        lock(&handle->lock);
         _update_epolls(handle);
         unlock(&handle->lock);
     }
@@ -150,6 +300,13 @@ long shim_do_epoll_ctl(int epfd, int op, int fd, struct __kernel_epoll_event* ev
             return -EFAULT;
         }
 
+    /* EPOLLEXCLUSIVE can be set only when adding an FD, and only for plain reads and writes */
+    if (op == EPOLL_CTL_ADD && (event->events & EPOLLEXCLUSIVE)
+            && (event->events & ~EPOLLEXCLUSIVE_OK_BITS))
+        return -EINVAL;
+    if (op == EPOLL_CTL_MOD && (event->events & EPOLLEXCLUSIVE))
+        return -EINVAL;
+
     struct shim_handle* epoll_hdl = get_fd_handle(epfd, NULL, cur->handle_map);
     if (!epoll_hdl)
         return -EBADF;
@@ -164,6 +321,9 @@ long shim_do_epoll_ctl(int epfd, int op, int fd, struct __kernel_epoll_event* ev
 
     lock(&epoll_hdl->lock);
 
+    if (epoll->needs_arm)
+        arm_epoll_items(epoll);
+
     switch (op) {
         case EPOLL_CTL_ADD: {
             LISTP_FOR_EACH_ENTRY(epoll_item, &epoll->fds, list) {
@@ -184,8 +344,9 @@ long shim_do_epoll_ctl(int epfd, int op, int fd, struct __kernel_epoll_event* ev
                 put_handle(hdl);
                 goto out;
             }
-            if (epoll->fds_count == MAX_EPOLL_HANDLES) {
-                ret = -ENOSPC;
+
+            ret = prepare_handle_poll(hdl);
+            if (ret < 0) {
                 put_handle(hdl);
                 goto out;
             }
@@ -204,25 +365,26 @@ long shim_do_epoll_ctl(int epfd, int op, int fd, struct __kernel_epoll_event* ev
             epoll_item->revents   = 0;
             epoll_item->handle    = hdl;
             epoll_item->epoll     = epoll_hdl;
+            INIT_LIST_HEAD(epoll_item, ready);
 
+            /* register hdl (corresponding to FD) in epoll (corresponding to EPFD):
+             * - bind hdl to epoll-item via the `back` list
+             * - bind epoll-item to epoll via the `list` list
+             * - register PAL handle of hdl in the PAL poller of epoll */
+            lock(&hdl->lock);
             if (epoll_item->events & EPOLLET) {
                 __atomic_store_n(&hdl->needs_et_poll_in, true, __ATOMIC_RELEASE);
                 __atomic_store_n(&hdl->needs_et_poll_out, true, __ATOMIC_RELEASE);
             }
-
-            /* register hdl (corresponding to FD) in epoll (corresponding to EPFD):
-             * - bind hdl to epoll-item via the `back` list
-             * - bind epoll-item to epoll via the `list` list */
-            lock(&hdl->lock);
             INIT_LIST_HEAD(epoll_item, back);
             LISTP_ADD_TAIL(epoll_item, &hdl->epolls, back);
+            arm_epoll_item(epoll_item);
             unlock(&hdl->lock);
 
             /* note that we already grabbed epoll_hdl->lock so can safely update epoll */
             INIT_LIST_HEAD(epoll_item, list);
             LISTP_ADD_TAIL(epoll_item, &epoll->fds, list);
             epoll->fds_count++;
-            notify_epoll_waiters(epoll);
 
             put_handle(hdl);
             break;
@@ -231,17 +393,25 @@ long shim_do_epoll_ctl(int epfd, int op, int fd, struct __kernel_epoll_event* ev
         case EPOLL_CTL_MOD: {
             LISTP_FOR_EACH_ENTRY(epoll_item, &epoll->fds, list) {
                 if (epoll_item->fd == fd) {
+                    struct shim_handle* hdl = epoll_item->handle;
+
+                    if (epoll_item->events & EPOLLEXCLUSIVE) {
+                        ret = -EINVAL;
+                        goto out;
+                    }
+
+                    lock(&hdl->lock);
                     epoll_item->events = event->events;
                     epoll_item->data   = event->data;
 
                     if (epoll_item->events & EPOLLET) {
-                        struct shim_handle* handle = epoll_item->handle;
-                        __atomic_store_n(&handle->needs_et_poll_in, true, __ATOMIC_RELEASE);
-                        __atomic_store_n(&handle->needs_et_poll_out, true, __ATOMIC_RELEASE);
+                        __atomic_store_n(&hdl->needs_et_poll_in, true, __ATOMIC_RELEASE);
+                        __atomic_store_n(&hdl->needs_et_poll_out, true, __ATOMIC_RELEASE);
                     }
+                    arm_epoll_item(epoll_item);
+                    unlock(&hdl->lock);
 
                     log_debug("modified fd %d at epoll handle %p\n", fd, epoll);
-                    notify_epoll_waiters(epoll);
                     goto out;
                 }
             }
@@ -257,18 +427,15 @@ long shim_do_epoll_ctl(int epfd, int op, int fd, struct __kernel_epoll_event* ev
                     log_debug("delete fd %d (handle %p) from epoll handle %p\n", fd, hdl, epoll);
 
                     /* unregister hdl (corresponding to FD) in epoll (corresponding to EPFD):
-                     * - unbind hdl from epoll-item via the `back` list
+                     * - unbind hdl from epoll-item via the `back` list and unregister PAL handle
+                     *   of hdl from the PAL poller of epoll
                      * - unbind epoll-item from epoll via the `list` list */
                     lock(&hdl->lock);
-                    LISTP_DEL(epoll_item, &hdl->epolls, back);
+                    disarm_epoll_item(epoll_item);
                     unlock(&hdl->lock);
 
                     /* note that we already grabbed epoll_hdl->lock so we can safely update epoll */
-                    LISTP_DEL(epoll_item, &epoll->fds, list);
-                    epoll->fds_count--;
-                    notify_epoll_waiters(epoll);
-
-                    free(epoll_item);
+                    release_epoll_item(epoll, epoll_item);
                     goto out;
                 }
             }
@@ -288,8 +455,53 @@ out:
     return ret;
 }
 
+/* Move items reported by the PAL poller to the ready list. Must be called with the epoll handle
+ * lock held. */
+static void add_ready_epoll_items(struct shim_epoll_handle* epoll, PAL_POLLER_EVENT* pal_events,
+                                  size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uintptr_t data = (uintptr_t)pal_events[i].data;
+        struct shim_epoll_item* epoll_item =
+            (struct shim_epoll_item*)(data & ~EPOLL_ITEM_WR_HANDLE);
+        if (!epoll_item->handle) {
+            /* deleted while we were waiting */
+            continue;
+        }
+
+        PAL_FLG events = pal_events[i].events;
+        if (data & EPOLL_ITEM_WR_HANDLE)
+            events = events & PAL_WAIT_READ ? PAL_WAIT_WRITE : 0;
+
+        /* the registration is shared by all items of the handle in this epoll, see
+         * `arm_epoll_item` */
+        struct shim_handle* hdl = epoll_item->handle;
+        lock(&hdl->lock);
+        struct shim_epoll_item* item;
+        LISTP_FOR_EACH_ENTRY(item, &hdl->epolls, back) {
+            if (item->epoll != epoll_item->epoll)
+                continue;
+
+            PAL_FLG item_events = events & (epoll_item_pal_events(item) | PAL_WAIT_ERROR);
+            if (!item_events)
+                continue;
+            if (item_events & PAL_WAIT_ERROR)
+                item->revents |= EPOLLERR | EPOLLHUP | EPOLLRDHUP;
+            if (item_events & PAL_WAIT_READ)
+                item->revents |= EPOLLIN | EPOLLRDNORM;
+            if (item_events & PAL_WAIT_WRITE)
+                item->revents |= EPOLLOUT | EPOLLWRNORM;
+
+            if (LIST_EMPTY(item, ready))
+                LISTP_ADD_TAIL(item, &epoll->ready, ready);
+        }
+        unlock(&hdl->lock);
+    }
+}
+
 long shim_do_epoll_wait(int epfd, struct __kernel_epoll_event* events, int maxevents,
                         int timeout_ms) {
+    int ret;
+
     if (maxevents <= 0)
         return -EINVAL;
 
@@ -307,157 +519,111 @@ long shim_do_epoll_wait(int epfd, struct __kernel_epoll_event* events, int maxev
     assert(epoll_hdl->type == TYPE_EPOLL);
     struct shim_epoll_handle* epoll = &epoll_hdl->info.epoll;
 
-    lock(&epoll_hdl->lock);
-
-    /* loop to retry on interrupted epoll waits (due to epoll being concurrently updated) */
-    while (1) {
-        /* wait on epoll's PAL handles + one "event" handle that signals epoll updates */
-        PAL_HANDLE* pal_handles = malloc((epoll->fds_count + 1) * sizeof(PAL_HANDLE));
-        if (!pal_handles) {
-            unlock(&epoll_hdl->lock);
+    uint64_t deadline_us = 0;
+    if (timeout_ms > 0) {
+        ret = DkSystemTimeQuery(&deadline_us);
+        if (ret < 0) {
             put_handle(epoll_hdl);
-            return -ENOMEM;
+            return pal_to_unix_errno(ret);
         }
+        deadline_us += (uint64_t)timeout_ms * 1000;
+    }
 
-        /* allocate one memory region to hold two PAL_FLG arrays: events and revents */
-        PAL_FLG* pal_events = malloc((epoll->fds_count + 1) * sizeof(PAL_FLG) * 2);
-        if (!pal_events) {
-            free(pal_handles);
-            unlock(&epoll_hdl->lock);
-            put_handle(epoll_hdl);
-            return -ENOMEM;
-        }
-        PAL_FLG* ret_events = pal_events + (epoll->fds_count + 1);
-
-        /* populate pal_events with read/write events from user-supplied epoll items */
-        size_t pal_cnt = 0;
-        struct shim_epoll_item* epoll_item;
-        LISTP_FOR_EACH_ENTRY(epoll_item, &epoll->fds, list) {
-            assert(epoll_item->handle != NULL);
-            if (!epoll_item->handle->pal_handle)
-                continue;
+    lock(&epoll_hdl->lock);
 
-            pal_handles[pal_cnt] = epoll_item->handle->pal_handle;
-            pal_events[pal_cnt] = (epoll_item->events & (EPOLLIN | EPOLLRDNORM))
-                                  ? PAL_WAIT_READ
-                                  : 0;
-            pal_events[pal_cnt] |= (epoll_item->events & (EPOLLOUT | EPOLLWRNORM))
-                                   ? PAL_WAIT_WRITE
-                                   : 0;
-            ret_events[pal_cnt] = 0;
+    if (epoll->needs_arm)
+        arm_epoll_items(epoll);
 
-            if (epoll_item->events & EPOLLET) {
-                if (!__atomic_load_n(&epoll_item->handle->needs_et_poll_in, __ATOMIC_ACQUIRE)) {
-                    pal_events[pal_cnt] &= ~PAL_WAIT_READ;
-                }
-                if (!__atomic_load_n(&epoll_item->handle->needs_et_poll_out, __ATOMIC_ACQUIRE)) {
-                    pal_events[pal_cnt] &= ~PAL_WAIT_WRITE;
-                }
+    /* wait on the PAL poller until some item is ready; retried on spurious wakeups (e.g. events of
+     * items deleted concurrently), with the remaining time */
+    while (LISTP_EMPTY(&epoll->ready)) {
+        uint64_t timeout_us = timeout_ms < 0 ? NO_TIMEOUT : 0;
+        if (timeout_ms > 0) {
+            uint64_t now_us;
+            ret = DkSystemTimeQuery(&now_us);
+            if (ret < 0) {
+                ret = pal_to_unix_errno(ret);
+                goto out;
             }
-
-            pal_cnt++;
+            if (now_us >= deadline_us)
+                break;
+            timeout_us = deadline_us - now_us;
         }
 
-        assert(pal_cnt <= epoll->fds_count);
+        PAL_POLLER_EVENT pal_events[EPOLL_WAIT_MAX_EVENTS];
+        PAL_NUM count = 0;
 
-        /* populate "event" handle so it waits on read (meaning epoll-update signal arrived);
-         * note that we don't increment pal_cnt because this is a special not-user-supplied item */
-        pal_handles[pal_cnt] = epoll->event.event;
-        pal_events[pal_cnt]  = PAL_WAIT_READ;
-        ret_events[pal_cnt]  = 0;
-
-        /* mark epoll as being waited on (so epoll-update signal is sent) */
-        __atomic_add_fetch(&epoll->waiter_cnt, 1, __ATOMIC_RELAXED);
+        /* the lock is dropped while blocked; concurrent updates of the epoll go directly to the
+         * PAL poller and deleted items are kept alive until `waiter_cnt` drops to zero */
+        epoll->waiter_cnt++;
         unlock(&epoll_hdl->lock);
 
-        /* TODO: Timeout must be updated in case of retries; otherwise, we may wait for too long */
-        long error = DkStreamsWaitEvents(pal_cnt + 1, pal_handles, pal_events, ret_events,
-                                         timeout_ms * 1000);
-        bool polled = error == 0;
-        error = pal_to_unix_errno(error);
+        size_t max_pal_events = MIN((size_t)maxevents, ARRAY_SIZE(pal_events));
+        ret = DkPollerWait(epoll->poller, pal_events, max_pal_events, &count, timeout_us);
 
         lock(&epoll_hdl->lock);
-        __atomic_sub_fetch(&epoll->waiter_cnt, 1, __ATOMIC_RELAXED);
-
-        /* update user-supplied epoll items' revents with ret_events of polled PAL handles */
-        if (!ret_events[pal_cnt] && polled) {
-            /* only if epoll was not updated concurrently and something was actually polled */
-            /* TODO: This loop is wrong. If there are 2 epoll_items with the same pal_handle (e.g.
-             * due to dup-ed fd), only the first will be updated.
-             * GH issue: https://github.com/oscarlab/graphene/issues/1848 */
-            for (size_t i = 0; i < pal_cnt; i++) {
-                LISTP_FOR_EACH_ENTRY(epoll_item, &epoll->fds, list) {
-                    assert(epoll_item->handle != NULL);
-                    if (!epoll_item->handle->pal_handle)
-                        continue;
-                    if (epoll_item->handle->pal_handle != pal_handles[i])
-                        continue;
-
-                    if (ret_events[i] & PAL_WAIT_ERROR) {
-                        epoll_item->revents  |= EPOLLERR | EPOLLHUP | EPOLLRDHUP;
-                    }
-                    if (ret_events[i] & PAL_WAIT_READ)
-                        epoll_item->revents |= EPOLLIN | EPOLLRDNORM;
-                    if (ret_events[i] & PAL_WAIT_WRITE)
-                        epoll_item->revents |= EPOLLOUT | EPOLLWRNORM;
-                    break;
-                }
-            }
-        }
+        epoll->waiter_cnt--;
 
-        PAL_FLG event_handle_update = ret_events[pal_cnt];
-        free(pal_handles);
-        free(pal_events);
+        add_ready_epoll_items(epoll, pal_events, count);
+        if (!epoll->waiter_cnt)
+            free_removed_epoll_items(epoll);
 
-        if (error && error != -EAGAIN) {
-            unlock(&epoll_hdl->lock);
-            put_handle(epoll_hdl);
-            if (error == -EINTR) {
+        if (ret == -PAL_ERROR_TRYAGAIN) {
+            /* timed out */
+            break;
+        }
+        if (ret < 0) {
+            ret = pal_to_unix_errno(ret);
+            if (ret == -EINTR) {
                 /* `epoll_wait` and `epoll_pwait` are not restarted after being interrupted by
                  * a signal handler. */
-                error = -ERESTARTNOHAND;
+                ret = -ERESTARTNOHAND;
             }
-            return error;
-        } else if (event_handle_update) {
-            /* retry if epoll was updated concurrently (similar to Linux semantics) */
-            unlock(&epoll_hdl->lock);
-            int ret = wait_event(&epoll->event);
-            if (ret < 0) {
-                put_handle(epoll_hdl);
-                return ret;
-            }
-            lock(&epoll_hdl->lock);
-        } else {
-            /* no need to retry, exit the while loop */
-            break;
+            goto out;
         }
     }
 
-    /* update user-supplied events array with all events detected till now on epoll */
+    /* update user-supplied events array with ready items */
     int nevents = 0;
     struct shim_epoll_item* epoll_item;
-    LISTP_FOR_EACH_ENTRY(epoll_item, &epoll->fds, list) {
+    struct shim_epoll_item* tmp;
+    LISTP_FOR_EACH_ENTRY_SAFE(epoll_item, tmp, &epoll->ready, ready) {
         if (nevents == maxevents)
             break;
 
+        /* informed user about revents (or the events are not monitored anymore), may clear;
+         * level-triggered items will be reported by the PAL poller again */
+        LISTP_DEL_INIT(epoll_item, &epoll->ready, ready);
         unsigned int monitored_events = epoll_item->events | EPOLLERR | EPOLLHUP | EPOLLRDHUP;
-        if (epoll_item->revents & monitored_events) {
-            events[nevents].events = epoll_item->revents & monitored_events;
-            events[nevents].data   = epoll_item->data;
-            if (events[nevents].events & (EPOLLIN | EPOLLRDNORM)) {
-                __atomic_store_n(&epoll_item->handle->needs_et_poll_in, false, __ATOMIC_RELEASE);
+        unsigned int revents = epoll_item->revents & monitored_events;
+        epoll_item->revents = 0;
+        if (!revents)
+            continue;
+
+        events[nevents].events = revents;
+        events[nevents].data   = epoll_item->data;
+        nevents++;
+
+        if (epoll_item->events & EPOLLET) {
+            /* stop waiting for the reported directions until the next EAGAIN/partial read/write */
+            struct shim_handle* hdl = epoll_item->handle;
+            lock(&hdl->lock);
+            if (revents & (EPOLLIN | EPOLLRDNORM)) {
+                __atomic_store_n(&hdl->needs_et_poll_in, false, __ATOMIC_RELEASE);
             }
-            if (events[nevents].events & (EPOLLOUT | EPOLLWRNORM)) {
-                __atomic_store_n(&epoll_item->handle->needs_et_poll_out, false, __ATOMIC_RELEASE);
+            if (revents & (EPOLLOUT | EPOLLWRNORM)) {
+                __atomic_store_n(&hdl->needs_et_poll_out, false, __ATOMIC_RELEASE);
             }
-            epoll_item->revents &= ~epoll_item->events; /* informed user about revents, may clear */
-            nevents++;
+            arm_epoll_item(epoll_item);
+            unlock(&hdl->lock);
         }
     }
+    ret = nevents;
 
+out:
     unlock(&epoll_hdl->lock);
     put_handle(epoll_hdl);
-    return nevents;
+    return ret;
 }
 
 long shim_do_epoll_pwait(int epfd, struct __kernel_epoll_event* events, int maxevents,
@@ -476,6 +642,7 @@ static int epoll_close(struct shim_handle* epoll_hdl) {
 
     lock(&epoll_hdl->lock);
 
+    /* no need to unregister PAL handles, the whole PAL poller is closed below */
     LISTP_FOR_EACH_ENTRY_SAFE(epoll_item, tmp_epoll_item, &epoll->fds, list) {
         struct shim_handle* hdl = epoll_item->handle;
 
@@ -483,14 +650,16 @@ static int epoll_close(struct shim_handle* epoll_hdl) {
         LISTP_DEL(epoll_item, &hdl->epolls, back);
         unlock(&hdl->lock);
 
-        LISTP_DEL(epoll_item, &epoll->fds, list);
-        epoll->fds_count--;
-        free(epoll_item);
+        release_epoll_item(epoll, epoll_item);
     }
 
+    assert(!epoll->waiter_cnt);
+    free_removed_epoll_items(epoll);
+
     unlock(&epoll_hdl->lock);
 
-    destroy_event(&epoll->event);
+    if (epoll->poller)
+        DkObjectClose(epoll->poller);
 
     return 0;
 }
@@ -524,8 +693,9 @@ BEGIN_CP_FUNC(epoll_item) {
         new_epoll_item->fd        = epoll_item->fd;
         new_epoll_item->events    = epoll_item->events;
         new_epoll_item->data      = epoll_item->data;
-        new_epoll_item->revents   = epoll_item->revents;
+        new_epoll_item->revents   = 0; /* ready items are reported by the new PAL poller again */
         new_epoll_item->epoll     = NULL; // To be filled by epoll handle RS_FUNC
+        INIT_LIST_HEAD(new_epoll_item, ready);
 
         LISTP_ADD(new_epoll_item, new_list, list);
 
@@ -3,6 +3,17 @@
 
 /*
  * Implementation of system call "execve".
+ *
+ * execve() replaces the program in place: the process keeps its Graphene instance (on SGX, its
+ * enclave) and everything LibOS and PAL know independently of the program, e.g. the dentry cache,
+ * mounts, the page cache of immutable files, verified hashes of trusted files, handles without
+ * FD_CLOEXEC and the IPC state. Only the state of the old program is dropped: its memory (all VMAs
+ * except the current stack), loaded libraries, signal handlers, brk, robust list and rseq and
+ * membarrier registrations. The new program and its interpreter are then loaded as at startup.
+ *
+ * The only exception is a child of vfork(), which runs on the thread of its parent: its parent
+ * continues once the child calls execve(), so the child becomes a new process (see
+ * `vfork_execve`).
  */
 
 #include <errno.h>
@@ -23,16 +34,19 @@
 #include "shim_vma.h"
 #include "stat.h"
 
-static int close_on_exec(struct shim_fd_handle* fd_hdl, struct shim_handle_map* map) {
-    if (fd_hdl->flags & FD_CLOEXEC) {
-        struct shim_handle* hdl = __detach_fd_handle(fd_hdl, NULL, map);
-        put_handle(hdl);
-    }
-    return 0;
-}
+/* number of FD_CLOEXEC descriptors detached at once, see detach_fd_handles() */
+#define CLOSE_ON_EXEC_BATCH 64
 
 static int close_cloexec_handle(struct shim_handle_map* map) {
-    return walk_handle_map(&close_on_exec, map);
+    /* PAL handles released by each batch of descriptors are closed together, so that a process
+     * with many descriptors does not pay one host close (one OCALL on SGX) per descriptor */
+    struct shim_handle* handles[CLOSE_ON_EXEC_BATCH];
+    FDTYPE fd = 0;
+    size_t count;
+    while ((count = detach_fd_handles(&fd, FD_NULL - 1, /*cloexec_only=*/true, handles,
+                                      ARRAY_SIZE(handles), map)))
+        put_handles(handles, count);
+    return 0;
 }
 
 struct execve_rtld_arg {
@@ -54,6 +68,10 @@ noreturn static void __shim_do_execve_rtld(struct execve_rtld_arg* __arg) {
 
     reset_brk();
 
+    /* the memory of emulated shared file mappings is freed below, without `munmap` */
+    chroot_sync_all_shared_maps();
+    exchange_all_anon_shm(/*take_over=*/false);
+
     size_t count;
     struct shim_vma_info* vmas;
     ret = dump_all_vmas(&vmas, &count, /*include_unmapped=*/true);
@@ -93,6 +111,10 @@ noreturn static void __shim_do_execve_rtld(struct execve_rtld_arg* __arg) {
     load_elf_interp(exec);
 
     cur_thread->robust_list = NULL;
+    cur_thread->rseq.area = NULL;
+    membarrier_reset_on_execve();
+    /* the new program starts outside of LibOS */
+    shim_tcb_set_in_libos(false);
 
     log_debug("execve: start execution\n");
     /* Passing ownership of `exec` to `execute_elf_object`. */
@@ -125,6 +147,7 @@ static int shim_do_execve_rtld(struct shim_handle* hdl, const char** argv, const
     cur_thread->stack_red = NULL;
 
     migrated_envp = NULL;
+    migrated_argv = NULL;
 
     const char** new_argp;
     elf_auxv_t* new_auxv;
@@ -143,6 +166,190 @@ static int shim_do_execve_rtld(struct shim_handle* hdl, const char** argv, const
     /* UNREACHABLE */
 }
 
+/* arguments of the new executable started by a vfork() child, see `vfork_execve` */
+struct execve_args {
+    const char** argv;
+    const char** envp;
+};
+
+BEGIN_CP_FUNC(execve_args) {
+    __UNUSED(size);
+    __UNUSED(objp);
+    assert(size == sizeof(struct execve_args));
+
+    struct execve_args* args = (struct execve_args*)obj;
+
+    size_t argc = 0;
+    size_t envc = 0;
+    size_t strings_size = 0;
+    for (; args->argv[argc]; argc++)
+        strings_size += strlen(args->argv[argc]) + 1;
+    for (; args->envp[envc]; envc++)
+        strings_size += strlen(args->envp[envc]) + 1;
+
+    /* both NULL-terminated pointer arrays, followed by all the strings */
+    size_t vec_size = (argc + 1 + envc + 1) * sizeof(const char*);
+    size_t off = ADD_CP_OFFSET(vec_size + strings_size);
+    const char** new_vec = (const char**)(base + off);
+    char* new_str = (char*)new_vec + vec_size;
+
+    const char** vecs[] = { args->argv, args->envp };
+    for (size_t i = 0; i < ARRAY_SIZE(vecs); i++) {
+        for (const char** a = vecs[i]; *a; a++) {
+            size_t len = strlen(*a) + 1;
+            memcpy(new_str, *a, len);
+            *new_vec++ = new_str;
+            new_str += len;
+        }
+        *new_vec++ = NULL;
+    }
+
+    ADD_CP_FUNC_ENTRY(off);
+}
+END_CP_FUNC(execve_args)
+
+BEGIN_RS_FUNC(execve_args) {
+    __UNUSED(offset);
+    const char** vec = (const char**)(base + GET_CP_FUNC_ENTRY());
+
+    /* picked up by `init_stack` */
+    migrated_argv = vec;
+    for (; *vec; vec++)
+        CP_REBASE(*vec);
+    vec++;
+
+    migrated_envp = vec;
+    for (; *vec; vec++)
+        CP_REBASE(*vec);
+}
+END_RS_FUNC(execve_args)
+
+/* Only the process-wide state needed to start a new executable is sent, in particular no memory at
+ * all. */
+static BEGIN_MIGRATION_DEF(vfork_exec, struct shim_process* process_description,
+                           struct shim_thread* thread_description,
+                           struct shim_ipc_ids* process_ipc_ids, struct execve_args* args) {
+    DEFINE_MIGRATE(process_ipc_ids, process_ipc_ids, sizeof(*process_ipc_ids));
+    DEFINE_MIGRATE(all_mounts, NULL, 0);
+    DEFINE_MIGRATE(dcache_snapshot, NULL, 0);
+    DEFINE_MIGRATE(process_description, process_description, sizeof(*process_description));
+    DEFINE_MIGRATE(thread, thread_description, sizeof(*thread_description));
+    DEFINE_MIGRATE(execve_args, args, sizeof(*args));
+    DEFINE_MIGRATE(provisioned_secret, NULL, 0);
+}
+END_MIGRATION_DEF(vfork_exec)
+
+static int migrate_vfork_exec(struct shim_cp_store* store,
+                              struct shim_process* process_description,
+                              struct shim_thread* thread_description,
+                              struct shim_ipc_ids* process_ipc_ids, va_list ap) {
+    struct execve_args* args = va_arg(ap, struct execve_args*);
+    return START_MIGRATE(store, vfork_exec, process_description, thread_description,
+                         process_ipc_ids, args);
+}
+
+/*
+ * execve() called by a child of vfork(), which runs on the thread of its parent (see
+ * `shim_clone.c`): the child becomes a new process, started directly with `exec`, and the parent is
+ * resumed. Takes ownership of `exec`; returns only on failure, with the child still running.
+ */
+long vfork_execve(struct shim_handle* exec, const char** argv, const char** envp) {
+    struct shim_thread* child = get_cur_thread();
+    struct shim_vfork_state* state = child->vfork;
+    assert(state);
+
+    struct shim_handle_map* exec_map = NULL;
+    struct shim_signal_dispositions* exec_dispositions = NULL;
+
+    long ret = dup_handle_map(&exec_map, child->handle_map);
+    if (ret < 0)
+        goto out;
+    ret = close_cloexec_handle(exec_map);
+    if (ret < 0)
+        goto out;
+
+    exec_dispositions = dup_signal_dispositions(child->signal_dispositions);
+    if (!exec_dispositions) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    sigaction_reset_on_execve(exec_dispositions);
+
+    lock(&g_process.fs_lock);
+    struct shim_process process_description = {
+        .pid = child->tid,
+        .ppid = g_process.pid,
+        .pgid = state->child_pgid,
+        .root = g_process.root,
+        .cwd = g_process.cwd,
+        .umask = g_process.umask,
+        .exec = exec,
+    };
+
+    get_dentry(process_description.root);
+    get_dentry(process_description.cwd);
+
+    unlock(&g_process.fs_lock);
+
+    INIT_LISTP(&process_description.children);
+    INIT_LISTP(&process_description.zombies);
+
+    clear_lock(&process_description.fs_lock);
+    clear_lock(&process_description.children_lock);
+
+    struct shim_child_process* child_process = state->child_process;
+    child_process->uid = child->uid;
+
+    /* Checkpointing runs as the parent. The main thread of the new process has neither a context
+     * nor a stack, it starts the executable from scratch (see `shim_init`). */
+    set_cur_thread(state->parent);
+
+    shim_tcb_t* tcb = child->shim_tcb;
+    void* stack = child->stack;
+    void* stack_top = child->stack_top;
+    void* stack_red = child->stack_red;
+    struct shim_handle_map* handle_map = child->handle_map;
+    struct shim_signal_dispositions* dispositions = child->signal_dispositions;
+
+    child->shim_tcb = NULL;
+    child->stack = child->stack_top = child->stack_red = NULL;
+    child->handle_map = exec_map;
+    child->signal_dispositions = exec_dispositions;
+
+    struct execve_args args = {
+        .argv = argv,
+        .envp = envp,
+    };
+    ret = create_process_and_send_checkpoint(&migrate_vfork_exec, child_process,
+                                             &process_description, child, &args);
+
+    child->shim_tcb = tcb;
+    child->stack = stack;
+    child->stack_top = stack_top;
+    child->stack_red = stack_red;
+    child->handle_map = handle_map;
+    child->signal_dispositions = dispositions;
+
+    set_cur_thread(child);
+
+    put_dentry(process_description.cwd);
+    put_dentry(process_description.root);
+
+out:
+    if (exec_dispositions)
+        put_signal_dispositions(exec_dispositions);
+    if (exec_map)
+        put_handle_map(exec_map);
+    put_handle(exec);
+
+    if (ret < 0)
+        return ret;
+
+    /* `child_process` was added to the children list of the parent */
+    state->child_process = NULL;
+    vfork_resume_parent();
+}
+
 long shim_do_execve(const char* file, const char** argv, const char** envp) {
     struct shim_dentry* dent = NULL;
     int ret = 0, argc = 0;
@@ -314,6 +521,12 @@ reopen:
     }
 
     put_dentry(dent);
+
+    if (get_cur_thread()->vfork) {
+        /* Passing ownership of `exec`. */
+        return vfork_execve(exec, argv, envp);
+    }
+
     /* If `execve` is invoked concurrently by multiple threads, let only one succeed. From this
      * point errors are fatal. */
     static unsigned int first = 0;
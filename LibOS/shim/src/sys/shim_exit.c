@@ -8,6 +8,7 @@
 
 #include "pal.h"
 #include "pal_error.h"
+#include "shim_fs.h"
 #include "shim_handle.h"
 #include "shim_internal.h"
 #include "shim_ipc.h"
@@ -25,6 +26,13 @@ static noreturn void libos_clean_and_exit(int exit_code) {
      * 2) wait for them to exit here, before we terminate the IPC helper
      */
 
+    /* writes buffered for coalescing or write-behind would be lost with the async worker, which
+     * flushes them */
+    sock_flush_all_writes();
+    chroot_flush_all_writes();
+    chroot_sync_all_shared_maps();
+    exchange_all_anon_shm(/*take_over=*/false);
+
     struct shim_thread* async_thread = terminate_async_worker();
     if (async_thread) {
         /* TODO: wait for the thread to exit in host.
@@ -37,16 +45,45 @@ static noreturn void libos_clean_and_exit(int exit_code) {
     terminate_ipc_worker();
 
     log_debug("process %u exited with status %d\n", g_self_vmid, exit_code);
+    print_slab_stats();
+    print_async_stats();
+    print_ipc_stats();
+    print_mount_stats();
+    print_page_cache_stats();
+    flush_syscall_trace();
+    log_flush(/*crashing=*/false);
 
     /* TODO: We exit whole libos, but there are some objects that might need cleanup, e.g. we should
      * release this (last) thread pid. We should do a proper cleanup of everything. */
     DkProcessExit(exit_code);
 }
 
+/* The child of vfork() exits before calling execve(): report it as an exited child process and
+ * resume the parent, on whose thread the child has been running. */
+static noreturn void vfork_exit(int error_code, int term_signal) {
+    struct shim_thread* child = get_cur_thread();
+    struct shim_vfork_state* state = child->vfork;
+
+    struct shim_child_process* child_process = state->child_process;
+    state->child_process = NULL;
+
+    log_debug("vfork child %u exited with status %d\n", child_process->pid, error_code);
+
+    add_child_process(child_process);
+    (void)mark_child_exited_by_pid(child_process->pid, child->uid, error_code, term_signal);
+
+    vfork_resume_parent();
+}
+
 noreturn void thread_exit(int error_code, int term_signal) {
+    if (get_cur_thread()->vfork) {
+        vfork_exit(error_code, term_signal);
+    }
+
     /* Remove current thread from the threads list. */
     if (!check_last_thread(/*mark_self_dead=*/true)) {
         struct shim_thread* cur_thread = get_cur_thread();
+        bool uthread = cur_thread->uthread.enabled;
 
         /* ask async worker thread to cleanup this thread */
         cur_thread->clear_child_tid_pal = 1; /* any non-zero value suffices */
@@ -58,6 +95,7 @@ noreturn void thread_exit(int error_code, int term_signal) {
         lock(&cur_thread->lock);
         assert(cur_thread->shim_tcb->tp == cur_thread);
         cur_thread->shim_tcb->tp = NULL;
+        cur_thread->shim_tcb->cputime = NULL;
         unlock(&cur_thread->lock);
         put_thread(cur_thread);
 
@@ -67,10 +105,17 @@ noreturn void thread_exit(int error_code, int term_signal) {
             /* `cleanup_thread` did not get this reference, clean it. We have to be careful, as
              * this is most likely the last reference and will free this `cur_thread`. */
             put_thread(cur_thread);
+            if (uthread)
+                uthread_exit(NULL);
+            destroy_thread_slab_cache();
             DkThreadExit(NULL);
             /* UNREACHABLE */
         }
 
+        /* a user-level thread leaves its carrier (and its slab cache) to other threads */
+        if (uthread)
+            uthread_exit(&cur_thread->clear_child_tid_pal);
+        destroy_thread_slab_cache();
         DkThreadExit(&cur_thread->clear_child_tid_pal);
         /* UNREACHABLE */
     }
@@ -92,6 +137,7 @@ static int mark_thread_to_die(struct shim_thread* thread, void* arg) {
     }
 
     bool need_wakeup = !__atomic_exchange_n(&thread->time_to_die, true, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&thread->signal_check_needed, true, __ATOMIC_RELEASE);
 
     /* Now let's kick `thread`, so that it notices (in `handle_signal`) the flag `time_to_die`
      * set above (but only if we really set that flag). */
@@ -109,7 +155,7 @@ bool kill_other_threads(void) {
     if (walk_thread_list(mark_thread_to_die, get_cur_thread(), /*one_shot=*/false) != -ESRCH) {
         killed = true;
     }
-    DkThreadYieldExecution();
+    thread_yield();
 
     /* Wait for all other threads to exit. */
     while (!check_last_thread(/*mark_self_dead=*/false)) {
@@ -118,7 +164,7 @@ bool kill_other_threads(void) {
         if (walk_thread_list(mark_thread_to_die, get_cur_thread(), /*one_shot=*/false) != -ESRCH) {
             killed = true;
         }
-        DkThreadYieldExecution();
+        thread_yield();
     }
 
     return killed;
@@ -127,6 +173,11 @@ bool kill_other_threads(void) {
 noreturn void process_exit(int error_code, int term_signal) {
     assert(!is_internal(get_cur_thread()));
 
+    if (get_cur_thread()->vfork) {
+        /* the parent's other threads must survive the exit of its vfork() child */
+        vfork_exit(error_code, term_signal);
+    }
+
     /* If process_exit is invoked multiple times, only a single invocation proceeds past this
      * point. */
     static int first = 0;
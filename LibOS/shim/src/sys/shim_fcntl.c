@@ -11,15 +11,123 @@
 #include "pal.h"
 #include "pal_error.h"
 #include "shim_fs.h"
+#include "shim_fs_lock.h"
 #include "shim_handle.h"
 #include "shim_internal.h"
 #include "shim_lock.h"
+#include "shim_process.h"
 #include "shim_table.h"
 #include "shim_thread.h"
 #include "shim_utils.h"
 
 #define FCNTL_SETFL_MASK (O_APPEND | O_NONBLOCK)
 
+/* Converts the range of `fl` (relative to `l_whence`) to an absolute one. */
+static int flock_to_posix_lock(struct shim_handle* hdl, const struct flock* fl,
+                               struct posix_lock* pl) {
+    if (fl->l_type != F_RDLCK && fl->l_type != F_WRLCK && fl->l_type != F_UNLCK)
+        return -EINVAL;
+
+    off_t origin;
+    switch (fl->l_whence) {
+        case SEEK_SET:
+            origin = 0;
+            break;
+        case SEEK_CUR:
+            if (!hdl->fs || !hdl->fs->fs_ops || !hdl->fs->fs_ops->seek)
+                return -EINVAL;
+            origin = hdl->fs->fs_ops->seek(hdl, 0, SEEK_CUR);
+            if (origin < 0)
+                return origin;
+            break;
+        case SEEK_END: {
+            if (!hdl->fs || !hdl->fs->fs_ops || !hdl->fs->fs_ops->hstat)
+                return -EINVAL;
+            struct stat stat;
+            int ret = hdl->fs->fs_ops->hstat(hdl, &stat);
+            if (ret < 0)
+                return ret;
+            origin = stat.st_size;
+            break;
+        }
+        default:
+            return -EINVAL;
+    }
+
+    off_t start;
+    if (__builtin_add_overflow(origin, fl->l_start, &start) || start < 0)
+        return -EINVAL;
+
+    uint64_t end;
+    if (fl->l_len == 0) {
+        end = FS_LOCK_EOF;
+    } else if (fl->l_len > 0) {
+        off_t last;
+        if (__builtin_add_overflow(start, fl->l_len - 1, &last))
+            return -EOVERFLOW;
+        end = last;
+    } else {
+        /* the range ends right before `start` */
+        end = start - 1;
+        if (__builtin_add_overflow(start, fl->l_len, &start) || start < 0)
+            return -EINVAL;
+    }
+
+    pl->type  = fl->l_type;
+    pl->start = start;
+    pl->end   = end;
+    pl->pid   = g_process.pid;
+    return 0;
+}
+
+static int do_setlk(struct shim_handle* hdl, struct flock* fl, bool wait) {
+    if (!is_user_memory_readable(fl, sizeof(*fl)))
+        return -EFAULT;
+    if (!hdl->dentry)
+        return -EINVAL;
+
+    struct posix_lock pl;
+    int ret = flock_to_posix_lock(hdl, fl, &pl);
+    if (ret < 0)
+        return ret;
+
+    if ((pl.type == F_RDLCK && !(hdl->acc_mode & MAY_READ))
+            || (pl.type == F_WRLCK && !(hdl->acc_mode & MAY_WRITE)))
+        return -EBADF;
+
+    return posix_lock_set(hdl->dentry, &pl, wait);
+}
+
+static int do_getlk(struct shim_handle* hdl, struct flock* fl) {
+    if (!is_user_memory_writable(fl, sizeof(*fl)))
+        return -EFAULT;
+    if (!hdl->dentry)
+        return -EINVAL;
+
+    struct posix_lock pl;
+    int ret = flock_to_posix_lock(hdl, fl, &pl);
+    if (ret < 0)
+        return ret;
+    if (pl.type == F_UNLCK)
+        return -EINVAL;
+
+    struct posix_lock conflict;
+    ret = posix_lock_get(hdl->dentry, &pl, &conflict);
+    if (ret < 0)
+        return ret;
+
+    if (conflict.type == F_UNLCK) {
+        fl->l_type = F_UNLCK;
+        return 0;
+    }
+    fl->l_type   = conflict.type;
+    fl->l_whence = SEEK_SET;
+    fl->l_start  = conflict.start;
+    fl->l_len    = conflict.end == FS_LOCK_EOF ? 0 : conflict.end - conflict.start + 1;
+    fl->l_pid    = conflict.pid;
+    return 0;
+}
+
 static int _set_handle_flags(struct shim_handle* hdl, unsigned long arg) {
     if (hdl->fs && hdl->fs->fs_ops && hdl->fs->fs_ops->setflags) {
         int ret = hdl->fs->fs_ops->setflags(hdl, arg & FCNTL_SETFL_MASK);
@@ -91,10 +199,8 @@ long shim_do_fcntl(int fd, int cmd, unsigned long arg) {
          */
         case F_SETFD:
             lock(&handle_map->lock);
-            if (HANDLE_ALLOCATED(handle_map->map[fd]))
-                handle_map->map[fd]->flags = arg & FD_CLOEXEC;
+            ret = __set_fd_handle_flags(fd, arg & FD_CLOEXEC, handle_map);
             unlock(&handle_map->lock);
-            ret = 0;
             break;
 
         /* File status flags
@@ -143,7 +249,7 @@ long shim_do_fcntl(int fd, int cmd, unsigned long arg) {
          *   EACCES or EAGAIN.
          */
         case F_SETLK:
-            ret = -ENOSYS;
+            ret = do_setlk(hdl, (struct flock*)arg, /*wait=*/false);
             break;
 
         /* F_SETLKW (struct flock *)
@@ -154,7 +260,7 @@ long shim_do_fcntl(int fd, int cmd, unsigned long arg) {
          *   set to EINTR; see signal(7)).
          */
         case F_SETLKW:
-            ret = -ENOSYS;
+            ret = do_setlk(hdl, (struct flock*)arg, /*wait=*/true);
             break;
 
         /* F_GETLK (struct flock *)
@@ -168,7 +274,7 @@ long shim_do_fcntl(int fd, int cmd, unsigned long arg) {
          *   the PID of the process holding that lock.
          */
         case F_GETLK:
-            ret = -ENOSYS;
+            ret = do_getlk(hdl, (struct flock*)arg);
             break;
 
         /* F_SETOWN (int)
@@ -17,6 +17,7 @@
 #include "shim_internal.h"
 #include "shim_lock.h"
 #include "shim_process.h"
+#include "shim_signal.h"
 #include "shim_table.h"
 #include "shim_utils.h"
 #include "stat.h"
@@ -597,6 +598,90 @@ out:
     return ret;
 }
 
+/*
+ * Fast path of sendfile() from a regular file to a connected TCP socket: the PAL sends the data
+ * with host sendfile, so it is never copied through LibOS buffers (or, on SGX, into the enclave).
+ * Returns false if the PAL can't do that for this pair of handles (e.g. the file is trusted or
+ * protected); the caller then falls back to handle_copy().
+ */
+static bool sendfile_direct(struct shim_handle* hdli, off_t* offset, struct shim_handle* hdlo,
+                            size_t count, ssize_t* out_ret) {
+    if (!count || hdli->type != TYPE_FILE || hdlo->type != TYPE_SOCK)
+        return false;
+
+    if (!hdli->pal_handle || !FILE_HANDLE_DATA(hdli) || !hdlo->pal_handle)
+        return false;
+
+    struct shim_file_handle* file = &hdli->info.file;
+    struct shim_sock_handle* sock = &hdlo->info.sock;
+
+    if (file->type != FILE_REGULAR || !(hdli->acc_mode & MAY_READ) || (offset && *offset < 0))
+        return false;
+
+    lock(&hdlo->lock);
+    bool connected = sock->sock_type == SOCK_STREAM && (sock->sock_state == SOCK_CONNECTED ||
+                     sock->sock_state == SOCK_BOUNDCONNECTED || sock->sock_state == SOCK_ACCEPTED);
+    unlock(&hdlo->lock);
+    if (!connected)
+        return false;
+
+    /* the file data must go out after the coalesced writes */
+    int flush_ret = sock_flush_writes(hdlo);
+    if (flush_ret < 0) {
+        *out_ret = flush_ret;
+        return true;
+    }
+
+    /* like chroot_read(), hold the file lock so that the marker is read and advanced atomically */
+    lock(&hdli->lock);
+
+    /* like chroot_read(), send the data buffered by write-behind first */
+    int flush_ret_in = chroot_flush_writes(hdli);
+    if (flush_ret_in < 0)
+        chroot_defer_flush_error(hdli, flush_ret_in);
+
+    off_t pos = offset ? *offset : file->marker;
+    PAL_NUM bytes = 0;
+    int ret = DkStreamSendFile(hdlo->pal_handle, hdli->pal_handle, pos, count, &bytes);
+    if (ret == -PAL_ERROR_NOTSUPPORT) {
+        unlock(&hdli->lock);
+        return false;
+    }
+
+    ret = pal_to_unix_errno(ret);
+    if (ret == 0) {
+        if (offset) {
+            *offset = pos + bytes;
+        } else {
+            file->marker = pos + bytes;
+        }
+    }
+    unlock(&hdli->lock);
+
+    maybe_epoll_et_trigger(hdlo, ret, /*in=*/false, ret == 0 ? bytes < count : false);
+    if (ret < 0) {
+        if (ret == -EPIPE) {
+            siginfo_t info = {
+                .si_signo = SIGPIPE,
+                .si_pid = g_process.pid,
+                .si_code = SI_USER,
+            };
+            if (kill_current_proc(&info) < 0) {
+                log_error("sendfile: failed to deliver a signal\n");
+            }
+        }
+
+        lock(&hdlo->lock);
+        sock->error = -ret;
+        unlock(&hdlo->lock);
+        *out_ret = ret;
+        return true;
+    }
+
+    *out_ret = (ssize_t)bytes;
+    return true;
+}
+
 long shim_do_sendfile(int ofd, int ifd, off_t* offset, size_t count) {
     struct shim_handle* hdli = get_fd_handle(ifd, NULL, NULL);
     if (!hdli)
@@ -614,6 +699,12 @@ long shim_do_sendfile(int ofd, int ifd, off_t* offset, size_t count) {
         goto out;
     }
 
+    ssize_t direct_ret;
+    if (sendfile_direct(hdli, offset, hdlo, count, &direct_ret)) {
+        ret = direct_ret;
+        goto out;
+    }
+
     off_t old_offset = 0;
     ret = -EACCES;
 
@@ -630,8 +721,168 @@ long shim_do_sendfile(int ofd, int ifd, off_t* offset, size_t count) {
 
     ret = handle_copy(hdli, offset, hdlo, NULL, count);
 
-    if (ret >= 0 && offset)
+    if (ret >= 0 && offset) {
         hdli->fs->fs_ops->seek(hdli, old_offset, SEEK_SET);
+        /* like Linux, report the offset after the last byte read */
+        *offset += ret;
+    }
+
+out:
+    put_handle(hdli);
+    put_handle(hdlo);
+    return ret;
+}
+
+/* max number of bytes copied at a time by copy_file_range() through a LibOS buffer */
+#define COPY_BUF_SIZE (64 * 1024)
+
+static bool is_copyable_file(struct shim_handle* hdl) {
+    struct shim_fs_ops* fs_ops = hdl->fs ? hdl->fs->fs_ops : NULL;
+    if (!fs_ops || !fs_ops->seek || !fs_ops->read || !fs_ops->write)
+        return false;
+
+    return (hdl->type == TYPE_FILE && hdl->info.file.type == FILE_REGULAR)
+           || hdl->type == TYPE_TMPFS;
+}
+
+/* Copies through a LibOS buffer with the read/write ops of the files (e.g. for tmpfs files, or for
+ * protected files, which the PAL has to decrypt and encrypt); moves the file positions. */
+static ssize_t copy_file_range_fallback(struct shim_handle* hdli, off_t pos_in,
+                                        struct shim_handle* hdlo, off_t pos_out, size_t len) {
+    struct shim_fs_ops* fsi = hdli->fs->fs_ops;
+    struct shim_fs_ops* fso = hdlo->fs->fs_ops;
+
+    size_t buf_size = MIN(len, (size_t)COPY_BUF_SIZE);
+    char* buf = malloc(buf_size);
+    if (!buf)
+        return -ENOMEM;
+
+    size_t copied = 0;
+    ssize_t ret = 0;
+    while (copied < len) {
+        size_t count = MIN(len - copied, buf_size);
+        ret = fsi->seek(hdli, pos_in + copied, SEEK_SET);
+        if (ret < 0)
+            break;
+        ret = fsi->read(hdli, buf, count);
+        if (ret <= 0)
+            break;
+
+        size_t to_write = ret;
+        size_t written  = 0;
+        while (written < to_write) {
+            ret = fso->seek(hdlo, pos_out + copied + written, SEEK_SET);
+            if (ret < 0)
+                break;
+            ret = fso->write(hdlo, buf + written, to_write - written);
+            if (ret == 0)
+                ret = -EIO;
+            if (ret < 0)
+                break;
+            written += ret;
+        }
+        copied += written;
+        if (written < to_write || to_write < count)
+            break;
+    }
+
+    free(buf);
+    return copied ? (ssize_t)copied : ret;
+}
+
+/*
+ * Between regular chroot files, the PAL copies the data with host copy_file_range, so it is never
+ * copied through LibOS buffers (or, on SGX, into the enclave); see chroot_copy_file_range(). Other
+ * pairs of files, and those the PAL can't copy directly, are copied by
+ * copy_file_range_fallback().
+ */
+long shim_do_copy_file_range(int fd_in, loff_t* off_in, int fd_out, loff_t* off_out, size_t len,
+                             unsigned int flags) {
+    if (flags)
+        return -EINVAL;
+
+    if ((off_in && !is_user_memory_writable(off_in, sizeof(*off_in))) ||
+            (off_out && !is_user_memory_writable(off_out, sizeof(*off_out))))
+        return -EFAULT;
+
+    struct shim_handle* hdli = get_fd_handle(fd_in, NULL, NULL);
+    if (!hdli)
+        return -EBADF;
+
+    struct shim_handle* hdlo = get_fd_handle(fd_out, NULL, NULL);
+    if (!hdlo) {
+        put_handle(hdli);
+        return -EBADF;
+    }
+
+    ssize_t ret = -EBADF;
+    if (!(hdli->acc_mode & MAY_READ) || !(hdlo->acc_mode & MAY_WRITE) || (hdlo->flags & O_APPEND))
+        goto out;
+
+    ret = -EISDIR;
+    if (hdli->is_dir || hdlo->is_dir)
+        goto out;
+
+    ret = -EINVAL;
+    if (!is_copyable_file(hdli) || !is_copyable_file(hdlo))
+        goto out;
+
+    if ((off_in && *off_in < 0) || (off_out && *off_out < 0))
+        goto out;
+
+    struct shim_fs_ops* fsi = hdli->fs->fs_ops;
+    struct shim_fs_ops* fso = hdlo->fs->fs_ops;
+    off_t old_pos_in = fsi->seek(hdli, 0, SEEK_CUR);
+    if (old_pos_in < 0) {
+        ret = old_pos_in;
+        goto out;
+    }
+    off_t old_pos_out = fso->seek(hdlo, 0, SEEK_CUR);
+    if (old_pos_out < 0) {
+        ret = old_pos_out;
+        goto out;
+    }
+
+    off_t pos_in  = off_in ? *off_in : old_pos_in;
+    off_t pos_out = off_out ? *off_out : old_pos_out;
+    off_t end_in, end_out;
+    if (__builtin_add_overflow(pos_in, len, &end_in) ||
+            __builtin_add_overflow(pos_out, len, &end_out)) {
+        ret = -EOVERFLOW;
+        goto out;
+    }
+
+    /* like Linux, refuse overlapping ranges of the same file */
+    ret = -EINVAL;
+    if (hdli->dentry && hdli->dentry == hdlo->dentry && pos_in < end_out && pos_out < end_in)
+        goto out;
+
+    ret = 0;
+    if (!len)
+        goto out;
+
+    if (hdli->type != TYPE_FILE || hdlo->type != TYPE_FILE
+            || !chroot_copy_file_range(hdli, pos_in, hdlo, pos_out, len, &ret))
+        ret = copy_file_range_fallback(hdli, pos_in, hdlo, pos_out, len);
+
+    /* put back the positions the fallback moved, then advance those used instead of an offset (in
+     * this order, in case both FDs refer to the same handle) */
+    off_t copied = ret > 0 ? ret : 0;
+    if (off_in)
+        fsi->seek(hdli, old_pos_in, SEEK_SET);
+    if (off_out)
+        fso->seek(hdlo, old_pos_out, SEEK_SET);
+    if (!off_in)
+        fsi->seek(hdli, pos_in + copied, SEEK_SET);
+    if (!off_out)
+        fso->seek(hdlo, pos_out + copied, SEEK_SET);
+
+    if (ret > 0) {
+        if (off_in)
+            *off_in = pos_in + copied;
+        if (off_out)
+            *off_out = pos_out + copied;
+    }
 
 out:
     put_handle(hdli);
@@ -21,7 +21,7 @@
 
 #include "api.h"
 #include "assert.h"
-#include "avl_tree.h"
+#include "cpu.h"
 #include "list.h"
 #include "pal.h"
 #include "shim_internal.h"
@@ -33,6 +33,7 @@
 #include "spinlock.h"
 
 struct shim_futex;
+struct futex_bucket;
 struct futex_waiter;
 
 DEFINE_LIST(futex_waiter);
@@ -41,33 +42,46 @@ struct futex_waiter {
     struct shim_thread* thread;
     uint32_t bitset;
     LIST_TYPE(futex_waiter) list;
-    /* futex field is guarded by g_futex_tree_lock, do not use it without taking that lock first.
-     * This is needed to ensure that a waiter knows what futex they were sleeping on, after they
-     * wake-up (because they could have been requeued to another futex).*/
+    /* The futex (and its bucket) this waiter is sleeping on. Both fields are guarded by the lock of
+     * `bucket`, and they change only if the waiter is requeued to another futex. After waking up,
+     * the waiter finds out (and locks) its current bucket with lock_waiter_bucket(). */
     struct shim_futex* futex;
+    struct futex_bucket* bucket;
 };
 
+DEFINE_LIST(shim_futex);
+DEFINE_LISTP(shim_futex);
 struct shim_futex {
     uint32_t* uaddr;
     LISTP_TYPE(futex_waiter) waiters;
-    struct avl_tree_node tree_node;
-    bool in_tree;
-    /* This lock guards every access to *uaddr (futex word value) and waiters (above).
-     * Always take g_futex_tree_lock before taking this lock. */
-    spinlock_t lock;
+    LIST_TYPE(shim_futex) list;
+    bool in_table;
     REFTYPE _ref_count;
 };
 
-static bool futex_tree_cmp(struct avl_tree_node* node_a, struct avl_tree_node* node_b) {
-    struct shim_futex* a = container_of(node_a, struct shim_futex, tree_node);
-    struct shim_futex* b = container_of(node_b, struct shim_futex, tree_node);
+/*
+ * Futexes are kept in a hash table keyed by the futex address. The lock of a bucket guards every
+ * access to futexes hashed into it: the futex list of the bucket, waiters of these futexes and the
+ * futex word values (*uaddr). Buckets are never freed, so a waiter can always lock the bucket it
+ * was last queued on, even if its (old) futex is already gone.
+ *
+ * Buckets are cache-line aligned so that threads using different buckets don't share cache lines.
+ * The table is zero-initialized, which means unlocked locks and empty lists (see the comment to
+ * INIT_SPINLOCK_UNLOCKED).
+ */
+#define FUTEX_HASH_BITS 8
+#define FUTEX_HASH_SIZE (1 << FUTEX_HASH_BITS)
 
-    return (uintptr_t)a->uaddr <= (uintptr_t)b->uaddr;
-}
+struct futex_bucket {
+    spinlock_t lock;
+    LISTP_TYPE(shim_futex) futexes;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
 
-static struct avl_tree g_futex_tree = { .cmp = futex_tree_cmp };
+static struct futex_bucket g_futex_table[FUTEX_HASH_SIZE];
 
-static spinlock_t g_futex_tree_lock = INIT_SPINLOCK_UNLOCKED;
+static struct futex_bucket* get_futex_bucket(uint32_t* uaddr) {
+    return &g_futex_table[hash64((uintptr_t)uaddr) & (FUTEX_HASH_SIZE - 1)];
+}
 
 static void get_futex(struct shim_futex* futex) {
     REF_INC(futex->_ref_count);
@@ -79,150 +93,70 @@ static void put_futex(struct shim_futex* futex) {
     }
 }
 
-/* Since we distinguish futexes by their virtual address, we can as well create a total ordering
- * based on it. */
-static int cmp_futexes(struct shim_futex* futex1, struct shim_futex* futex2) {
-    uintptr_t f1 = (uintptr_t)futex1->uaddr;
-    uintptr_t f2 = (uintptr_t)futex2->uaddr;
-
-    if (f1 < f2) {
-        return -1;
-    } else if (f1 == f2) {
-        return 0;
-    } else {
-        return 1;
-    }
-}
-
 /*
- * Locks two futexes in ascending order (defined by cmp_futexes).
- * If a futex is NULL, it is just skipped.
+ * Locks two buckets in ascending order of their addresses (to avoid deadlocks).
+ * If both buckets are equal, just takes one lock.
  */
-static void lock_two_futexes(struct shim_futex* futex1, struct shim_futex* futex2) {
-    if (!futex1 && !futex2) {
-        return;
-    } else if (futex1 && !futex2) {
-        spinlock_lock(&futex1->lock);
-        return;
-    } else if (!futex1 && futex2) {
-        spinlock_lock(&futex2->lock);
-        return;
-    }
-    /* Both are not NULL. */
-
-    /* To avoid deadlocks we always take the locks in ascending order of futexes.
-     * If both futexes are equal, just take one lock. */
-    int cmp = cmp_futexes(futex1, futex2);
-    if (cmp < 0) {
-        spinlock_lock(&futex1->lock);
-        spinlock_lock(&futex2->lock);
-    } else if (cmp == 0) {
-        spinlock_lock(&futex1->lock);
+static void lock_two_buckets(struct futex_bucket* bucket1, struct futex_bucket* bucket2) {
+    if (bucket1 == bucket2) {
+        spinlock_lock(&bucket1->lock);
+    } else if (bucket1 < bucket2) {
+        spinlock_lock(&bucket1->lock);
+        spinlock_lock(&bucket2->lock);
     } else {
-        spinlock_lock(&futex2->lock);
-        spinlock_lock(&futex1->lock);
+        spinlock_lock(&bucket2->lock);
+        spinlock_lock(&bucket1->lock);
     }
 }
 
-static void unlock_two_futexes(struct shim_futex* futex1, struct shim_futex* futex2) {
-    if (!futex1 && !futex2) {
-        return;
-    } else if (futex1 && !futex2) {
-        spinlock_unlock(&futex1->lock);
-        return;
-    } else if (!futex1 && futex2) {
-        spinlock_unlock(&futex2->lock);
-        return;
-    }
-    /* Both are not NULL. */
-
+static void unlock_two_buckets(struct futex_bucket* bucket1, struct futex_bucket* bucket2) {
     /* For unlocking order does not matter. */
-    int cmp = cmp_futexes(futex1, futex2);
-    if (cmp) {
-        spinlock_unlock(&futex1->lock);
-        spinlock_unlock(&futex2->lock);
-    } else {
-        spinlock_unlock(&futex1->lock);
+    spinlock_unlock(&bucket1->lock);
+    if (bucket1 != bucket2) {
+        spinlock_unlock(&bucket2->lock);
     }
 }
 
 /*
- * Adds `futex` to `g_futex_tree`.
+ * Adds `futex` to its bucket `bucket`.
  *
- * `g_futex_tree_lock` should be held while calling this function and you must ensure that nobody
- * is using `futex` (e.g. you have just created it).
+ * `bucket->lock` should be held while calling this function and you must ensure that nobody is
+ * using `futex` (e.g. you have just created it).
  */
-static void enqueue_futex(struct shim_futex* futex) {
-    assert(spinlock_is_locked(&g_futex_tree_lock));
+static void enqueue_futex(struct futex_bucket* bucket, struct shim_futex* futex) {
+    assert(spinlock_is_locked(&bucket->lock));
 
     get_futex(futex);
-    avl_tree_insert(&g_futex_tree, &futex->tree_node);
-    futex->in_tree = true;
+    LISTP_ADD(futex, &bucket->futexes, list);
+    futex->in_table = true;
 }
 
 /*
- * Checks whether `futex` has no waiters and is on `g_futex_tree`.
+ * If `futex` has no waiters and is in the table, takes it off its bucket `bucket`.
  *
- * This requires only `futex->lock` to be held.
+ * `bucket->lock` needs to be held.
  */
-static bool check_dequeue_futex(struct shim_futex* futex) {
-    assert(spinlock_is_locked(&futex->lock));
-
-    return LISTP_EMPTY(&futex->waiters) && futex->in_tree;
-}
-
-static void _maybe_dequeue_futex(struct shim_futex* futex) {
-    assert(spinlock_is_locked(&futex->lock));
-    assert(spinlock_is_locked(&g_futex_tree_lock));
+static void maybe_dequeue_futex(struct futex_bucket* bucket, struct shim_futex* futex) {
+    assert(spinlock_is_locked(&bucket->lock));
 
-    if (check_dequeue_futex(futex)) {
-        avl_tree_delete(&g_futex_tree, &futex->tree_node);
-        futex->in_tree = false;
+    if (LISTP_EMPTY(&futex->waiters) && futex->in_table) {
+        LISTP_DEL_INIT(futex, &bucket->futexes, list);
+        futex->in_table = false;
         /* We still hold this futex reference (in the caller), so this won't call free. */
         put_futex(futex);
     }
 }
 
-/*
- * If `futex` has no waiters and is on `g_futex_tree`, takes it off that tree.
- *
- * Neither `g_futex_tree_lock` nor `futex->lock` should be held while calling this,
- * it acquires these locks itself.
- */
-static void maybe_dequeue_futex(struct shim_futex* futex) {
-    spinlock_lock(&g_futex_tree_lock);
-    spinlock_lock(&futex->lock);
-    _maybe_dequeue_futex(futex);
-    spinlock_unlock(&futex->lock);
-    spinlock_unlock(&g_futex_tree_lock);
-}
-
-/*
- * Same as `maybe_dequeue_futex`, but works for two futexes, any of which might be NULL.
- */
-static void maybe_dequeue_two_futexes(struct shim_futex* futex1, struct shim_futex* futex2) {
-    spinlock_lock(&g_futex_tree_lock);
-    lock_two_futexes(futex1, futex2);
-    if (futex1) {
-        _maybe_dequeue_futex(futex1);
-    }
-    if (futex2) {
-        _maybe_dequeue_futex(futex2);
-    }
-    unlock_two_futexes(futex1, futex2);
-    spinlock_unlock(&g_futex_tree_lock);
-}
-
 /*
  * Adds `waiter` to `futex` waiters list.
- * You need to make sure that this futex is still on `g_futex_tree`, but in most cases it follows
- * from the program control flow.
+ * You need to make sure that this futex is still in the table, but in most cases it follows from
+ * the program control flow.
  *
- * `futex->lock` needs to be held.
+ * `bucket->lock` (of the bucket of `futex`) needs to be held.
  */
-static void add_futex_waiter(struct futex_waiter* waiter, struct shim_futex* futex,
-                             uint32_t bitset) {
-    assert(spinlock_is_locked(&futex->lock));
+static void add_futex_waiter(struct futex_waiter* waiter, struct futex_bucket* bucket,
+                             struct shim_futex* futex, uint32_t bitset) {
+    assert(spinlock_is_locked(&bucket->lock));
 
     waiter->thread = get_cur_thread();
     get_thread(waiter->thread);
@@ -231,6 +165,7 @@ static void add_futex_waiter(struct futex_waiter* waiter, struct shim_futex* fut
     waiter->bitset = bitset;
     get_futex(futex);
     waiter->futex = futex;
+    waiter->bucket = bucket;
     LISTP_ADD_TAIL(waiter, &futex->waiters, list);
 }
 
@@ -238,34 +173,52 @@ static void add_futex_waiter(struct futex_waiter* waiter, struct shim_futex* fut
  * Ownership of the `waiter->thread` is passed to the caller; we do not change its refcount because
  * we take it of `futex->waiters` list (-1) and give it to caller (+1).
  *
- * `futex->lock` needs to be held.
+ * The lock of the bucket of `futex` needs to be held.
  */
 static struct shim_thread* remove_futex_waiter(struct futex_waiter* waiter,
                                                struct shim_futex* futex) {
-    assert(spinlock_is_locked(&futex->lock));
+    assert(spinlock_is_locked(&waiter->bucket->lock));
 
     LISTP_DEL_INIT(waiter, &futex->waiters, list);
     return waiter->thread;
 }
 
 /*
- * Moves waiter from `futex1` to `futex2`.
- * As in `add_futex_waiter`, `futex2` needs to be on `g_futex_tree`.
+ * Moves waiter from `futex1` to `futex2` (which is in bucket `bucket2`).
+ * As in `add_futex_waiter`, `futex2` needs to be in the table.
  *
- * `futex1->lock` and `futex2->lock` need to be held.
+ * Locks of the buckets of both futexes need to be held.
  */
 static void move_futex_waiter(struct futex_waiter* waiter, struct shim_futex* futex1,
-                              struct shim_futex* futex2) {
-    assert(spinlock_is_locked(&futex1->lock));
-    assert(spinlock_is_locked(&futex2->lock));
+                              struct futex_bucket* bucket2, struct shim_futex* futex2) {
+    assert(spinlock_is_locked(&waiter->bucket->lock));
+    assert(spinlock_is_locked(&bucket2->lock));
 
     LISTP_DEL_INIT(waiter, &futex1->waiters, list);
     get_futex(futex2);
     put_futex(waiter->futex);
     waiter->futex = futex2;
+    /* pairs with the load in lock_waiter_bucket(), which doesn't hold any lock yet */
+    __atomic_store_n(&waiter->bucket, bucket2, __ATOMIC_RELEASE);
     LISTP_ADD_TAIL(waiter, &futex2->waiters, list);
 }
 
+/*
+ * Locks the bucket `waiter` is currently queued on (it might have been requeued while sleeping)
+ * and returns it. After that, `waiter->futex` is stable until the lock is released.
+ */
+static struct futex_bucket* lock_waiter_bucket(struct futex_waiter* waiter) {
+    while (true) {
+        struct futex_bucket* bucket = __atomic_load_n(&waiter->bucket, __ATOMIC_ACQUIRE);
+        spinlock_lock(&bucket->lock);
+        if (__atomic_load_n(&waiter->bucket, __ATOMIC_RELAXED) == bucket) {
+            return bucket;
+        }
+        /* requeued to a futex in another bucket in the meantime */
+        spinlock_unlock(&bucket->lock);
+    }
+}
+
 /*
  * Creates a new futex.
  * Sets the new futex refcount to 1.
@@ -281,70 +234,66 @@ static struct shim_futex* create_new_futex(uint32_t* uaddr) {
     REF_SET(futex->_ref_count, 1);
 
     futex->uaddr = uaddr;
-    futex->in_tree = false;
+    futex->in_table = false;
     INIT_LISTP(&futex->waiters);
-    spinlock_init(&futex->lock);
+    INIT_LIST_HEAD(futex, list);
 
     return futex;
 }
 
 /*
- * Finds a futex in `g_futex_tree`.
- * Must be called with `g_futex_tree_lock` held.
+ * Finds a futex in its bucket `bucket`.
+ * Must be called with `bucket->lock` held.
  * Increases refcount of futex by 1.
  */
-static struct shim_futex* find_futex(uint32_t* uaddr) {
-    assert(spinlock_is_locked(&g_futex_tree_lock));
-    struct shim_futex* futex = NULL;
-    struct shim_futex cmp_arg = {
-        .uaddr = uaddr
-    };
-    struct avl_tree_node* node = avl_tree_find(&g_futex_tree, &cmp_arg.tree_node);
-    if (!node) {
-        return NULL;
-    }
+static struct shim_futex* find_futex(struct futex_bucket* bucket, uint32_t* uaddr) {
+    assert(spinlock_is_locked(&bucket->lock));
 
-    futex = container_of(node, struct shim_futex, tree_node);
-    get_futex(futex);
-    return futex;
+    struct shim_futex* futex;
+    LISTP_FOR_EACH_ENTRY(futex, &bucket->futexes, list) {
+        if (futex->uaddr == uaddr) {
+            get_futex(futex);
+            return futex;
+        }
+    }
+    return NULL;
 }
 
 static int futex_wait(uint32_t* uaddr, uint32_t val, uint64_t timeout, uint32_t bitset) {
     int ret = 0;
+    struct futex_bucket* bucket = get_futex_bucket(uaddr);
     struct shim_futex* futex = NULL;
     struct shim_thread* thread = NULL;
     struct shim_futex* tmp = NULL;
 
-    spinlock_lock(&g_futex_tree_lock);
-    futex = find_futex(uaddr);
+    spinlock_lock(&bucket->lock);
+    futex = find_futex(bucket, uaddr);
     if (!futex) {
-        spinlock_unlock(&g_futex_tree_lock);
+        spinlock_unlock(&bucket->lock);
         tmp = create_new_futex(uaddr);
         if (!tmp) {
             return -ENOMEM;
         }
-        spinlock_lock(&g_futex_tree_lock);
-        futex = find_futex(uaddr);
+        spinlock_lock(&bucket->lock);
+        futex = find_futex(bucket, uaddr);
         if (!futex) {
-            enqueue_futex(tmp);
+            enqueue_futex(bucket, tmp);
             futex = tmp;
             tmp = NULL;
         }
     }
-    spinlock_lock(&futex->lock);
-    spinlock_unlock(&g_futex_tree_lock);
 
     if (__atomic_load_n(uaddr, __ATOMIC_RELAXED) != val) {
         ret = -EAGAIN;
-        goto out_with_futex_lock;
+        goto out_with_bucket_lock;
     }
 
     thread_prepare_wait();
 
     struct futex_waiter waiter = {0};
-    add_futex_waiter(&waiter, futex, bitset);
+    add_futex_waiter(&waiter, bucket, futex, bitset);
 
-    spinlock_unlock(&futex->lock);
+    spinlock_unlock(&bucket->lock);
 
     /* Give up this futex reference - we have no idea what futex we will be on once we wake up
      * (due to possible requeues). */
@@ -353,13 +302,11 @@ static int futex_wait(uint32_t* uaddr, uint32_t val, uint64_t timeout, uint32_t
 
     ret = thread_wait(timeout != NO_TIMEOUT ? &timeout : NULL, /*ignore_pending_signals=*/false);
 
-    spinlock_lock(&g_futex_tree_lock);
     /* We might have been requeued. Grab the (possibly new) futex reference. */
+    bucket = lock_waiter_bucket(&waiter);
     futex = waiter.futex;
     assert(futex);
     get_futex(futex);
-    spinlock_lock(&futex->lock);
-    spinlock_unlock(&g_futex_tree_lock);
 
     if (!LIST_EMPTY(&waiter, list)) {
         /* If we woke up due to time out or a signal, we were not removed from the waiters list
@@ -379,16 +326,9 @@ static int futex_wait(uint32_t* uaddr, uint32_t val, uint64_t timeout, uint32_t
      * NB: actually `futex` and this point to the same futex, so this won't call free. */
     put_futex(waiter.futex);
 
-out_with_futex_lock:; // C is awesome!
-    /* Because dequeuing a futex requires `g_futex_tree_lock` which we do not hold at this moment,
-     * we check if we actually need to do it now (locks acquisition and dequeuing). */
-    bool needs_dequeue = check_dequeue_futex(futex);
-
-    spinlock_unlock(&futex->lock);
-
-    if (needs_dequeue) {
-        maybe_dequeue_futex(futex);
-    }
+out_with_bucket_lock:
+    maybe_dequeue_futex(bucket, futex);
+    spinlock_unlock(&bucket->lock);
 
     if (thread) {
         put_thread(thread);
@@ -401,19 +341,122 @@ out_with_futex_lock:; // C is awesome!
     return ret;
 }
 
+/*
+ * Waits on `count` futexes at once: the thread gets one waiter on each of them and sleeps until any
+ * of the waiters is woken up. Waiters are queued one by one, each under the lock of its own bucket,
+ * so a wakeup can already arrive while the rest are still being queued (the thread event was
+ * cleared before, so such wakeup is not lost).
+ *
+ * Returns the index of the woken futex (the lowest one, if more were woken), -EAGAIN if some futex
+ * word didn't match its expected value, or an error.
+ */
+static int futex_wait_multiple(struct futex_wait_block* blocks, size_t count, uint64_t timeout) {
+    int ret = 0;
+    size_t queued = 0;
+
+    struct futex_waiter* waiters = calloc(count, sizeof(*waiters));
+    if (!waiters) {
+        return -ENOMEM;
+    }
+
+    thread_prepare_wait();
+
+    for (; queued < count; queued++) {
+        uint32_t* uaddr = blocks[queued].uaddr;
+        struct futex_bucket* bucket = get_futex_bucket(uaddr);
+        struct shim_futex* tmp = NULL;
+
+        spinlock_lock(&bucket->lock);
+        struct shim_futex* futex = find_futex(bucket, uaddr);
+        if (!futex) {
+            spinlock_unlock(&bucket->lock);
+            tmp = create_new_futex(uaddr);
+            if (!tmp) {
+                ret = -ENOMEM;
+                break;
+            }
+            spinlock_lock(&bucket->lock);
+            futex = find_futex(bucket, uaddr);
+            if (!futex) {
+                enqueue_futex(bucket, tmp);
+                futex = tmp;
+                tmp = NULL;
+            }
+        }
+
+        bool match = __atomic_load_n(uaddr, __ATOMIC_RELAXED) == blocks[queued].val;
+        if (match) {
+            add_futex_waiter(&waiters[queued], bucket, futex, blocks[queued].bitset);
+        } else {
+            maybe_dequeue_futex(bucket, futex);
+        }
+        spinlock_unlock(&bucket->lock);
+
+        /* the waiter holds its own futex reference */
+        put_futex(futex);
+        if (tmp) {
+            put_futex(tmp);
+        }
+
+        if (!match) {
+            ret = -EAGAIN;
+            break;
+        }
+    }
+
+    if (queued == count) {
+        ret = thread_wait(timeout != NO_TIMEOUT ? &timeout : NULL,
+                          /*ignore_pending_signals=*/false);
+    }
+
+    /* Take all waiters off their (possibly requeued) futexes. Waiters which are not on a list
+     * anymore were removed by a waker. */
+    ssize_t woken = -1;
+    for (size_t i = 0; i < queued; i++) {
+        struct futex_waiter* waiter = &waiters[i];
+        struct futex_bucket* bucket = lock_waiter_bucket(waiter);
+        struct shim_futex* futex = waiter->futex;
+        struct shim_thread* thread = NULL;
+
+        if (!LIST_EMPTY(waiter, list)) {
+            thread = remove_futex_waiter(waiter, futex);
+        } else if (woken < 0) {
+            woken = i;
+        }
+
+        /* `waiter` still holds a reference, so this won't call free. */
+        maybe_dequeue_futex(bucket, futex);
+        spinlock_unlock(&bucket->lock);
+
+        put_futex(futex);
+        if (thread) {
+            put_thread(thread);
+        }
+    }
+
+    free(waiters);
+
+    if (woken >= 0) {
+        return woken;
+    }
+    if (queued == count && (ret == 0 || ret == -EINTR)) {
+        /* woken up by a signal (or spuriously) */
+        ret = -ERESTARTSYS;
+    }
+    return ret;
+}
+
 /*
  * Moves at most `to_wake` waiters from futex to wake queue;
  * In the Linux kernel the number of waiters to wake has type `int` and we follow that here.
  * Normally `bitset` has to be non-zero, here zero means: do not even check it.
  *
- * Must be called with `futex->lock` held.
+ * Must be called with the lock of the bucket of `futex` held.
  *
  * Returns number of threads woken.
  */
 static int move_to_wake_queue(struct shim_futex* futex, uint32_t bitset, int to_wake,
                               struct wake_queue_head* queue) {
-    assert(spinlock_is_locked(&futex->lock));
-
     struct futex_waiter* waiter;
     struct futex_waiter* wtmp;
     struct shim_thread* thread;
@@ -439,6 +482,7 @@ static int move_to_wake_queue(struct shim_futex* futex, uint32_t bitset, int to_
 }
 
 static int futex_wake(uint32_t* uaddr, int to_wake, uint32_t bitset) {
+    struct futex_bucket* bucket = get_futex_bucket(uaddr);
     struct shim_futex* futex;
     struct wake_queue_head queue = {.first = WAKE_QUEUE_TAIL};
     int woken = 0;
@@ -447,24 +491,17 @@ static int futex_wake(uint32_t* uaddr, int to_wake, uint32_t bitset) {
         return -EINVAL;
     }
 
-    spinlock_lock(&g_futex_tree_lock);
-    futex = find_futex(uaddr);
+    spinlock_lock(&bucket->lock);
+    futex = find_futex(bucket, uaddr);
     if (!futex) {
-        spinlock_unlock(&g_futex_tree_lock);
+        spinlock_unlock(&bucket->lock);
         return 0;
     }
-    spinlock_lock(&futex->lock);
-    spinlock_unlock(&g_futex_tree_lock);
 
     woken = move_to_wake_queue(futex, bitset, to_wake, &queue);
+    maybe_dequeue_futex(bucket, futex);
 
-    bool needs_dequeue = check_dequeue_futex(futex);
-
-    spinlock_unlock(&futex->lock);
-
-    if (needs_dequeue) {
-        maybe_dequeue_futex(futex);
-    }
+    spinlock_unlock(&bucket->lock);
 
     wake_queue(&queue);
 
@@ -485,19 +522,16 @@ static int wakeop_arg_extend(int x) {
 
 static int futex_wake_op(uint32_t* uaddr1, uint32_t* uaddr2, int to_wake1, int to_wake2,
                          uint32_t val3) {
+    struct futex_bucket* bucket1 = get_futex_bucket(uaddr1);
+    struct futex_bucket* bucket2 = get_futex_bucket(uaddr2);
     struct shim_futex* futex1 = NULL;
     struct shim_futex* futex2 = NULL;
     struct wake_queue_head queue = {.first = WAKE_QUEUE_TAIL};
     int ret = 0;
-    bool needs_dequeue1 = false;
-    bool needs_dequeue2 = false;
 
-    spinlock_lock(&g_futex_tree_lock);
-    futex1 = find_futex(uaddr1);
-    futex2 = find_futex(uaddr2);
-
-    lock_two_futexes(futex1, futex2);
-    spinlock_unlock(&g_futex_tree_lock);
+    lock_two_buckets(bucket1, bucket2);
+    futex1 = find_futex(bucket1, uaddr1);
+    futex2 = find_futex(bucket2, uaddr2);
 
     unsigned int op = (val3 >> 28) & 0x7; // highest bit is for FUTEX_OP_OPARG_SHIFT
     unsigned int cmp = (val3 >> 24) & 0xf;
@@ -567,19 +601,19 @@ static int futex_wake_op(uint32_t* uaddr1, uint32_t* uaddr2, int to_wake1, int t
 
     if (futex1) {
         ret += move_to_wake_queue(futex1, 0, to_wake1, &queue);
-        needs_dequeue1 = check_dequeue_futex(futex1);
     }
     if (futex2 && cmpval) {
         ret += move_to_wake_queue(futex2, 0, to_wake2, &queue);
-        needs_dequeue2 = check_dequeue_futex(futex2);
     }
 
 out_unlock:
-    unlock_two_futexes(futex1, futex2);
-
-    if (needs_dequeue1 || needs_dequeue2) {
-        maybe_dequeue_two_futexes(futex1, futex2);
+    if (futex1) {
+        maybe_dequeue_futex(bucket1, futex1);
+    }
+    if (futex2) {
+        maybe_dequeue_futex(bucket2, futex2);
     }
+    unlock_two_buckets(bucket1, bucket2);
 
     if (ret > 0) {
         wake_queue(&queue);
@@ -596,6 +630,8 @@ out_unlock:
 
 static int futex_requeue(uint32_t* uaddr1, uint32_t* uaddr2, int to_wake, int to_requeue,
                          uint32_t* val) {
+    struct futex_bucket* bucket1 = get_futex_bucket(uaddr1);
+    struct futex_bucket* bucket2 = get_futex_bucket(uaddr2);
     struct shim_futex* futex1 = NULL;
     struct shim_futex* futex2 = NULL;
     struct shim_futex* tmp = NULL;
@@ -606,35 +642,29 @@ static int futex_requeue(uint32_t* uaddr1, uint32_t* uaddr2, int to_wake, int to
     struct futex_waiter* waiter;
     struct futex_waiter* wtmp;
     struct shim_thread* thread;
-    bool needs_dequeue1 = false;
-    bool needs_dequeue2 = false;
 
     if (to_wake < 0 || to_requeue < 0) {
         return -EINVAL;
     }
 
-    spinlock_lock(&g_futex_tree_lock);
-    futex2 = find_futex(uaddr2);
+    lock_two_buckets(bucket1, bucket2);
+    futex2 = find_futex(bucket2, uaddr2);
     if (!futex2) {
-        spinlock_unlock(&g_futex_tree_lock);
+        unlock_two_buckets(bucket1, bucket2);
         tmp = create_new_futex(uaddr2);
         if (!tmp) {
             return -ENOMEM;
         }
-        needs_dequeue2 = true;
 
-        spinlock_lock(&g_futex_tree_lock);
-        futex2 = find_futex(uaddr2);
+        lock_two_buckets(bucket1, bucket2);
+        futex2 = find_futex(bucket2, uaddr2);
         if (!futex2) {
-            enqueue_futex(tmp);
+            enqueue_futex(bucket2, tmp);
             futex2 = tmp;
             tmp = NULL;
         }
     }
-    futex1 = find_futex(uaddr1);
-
-    lock_two_futexes(futex1, futex2);
-    spinlock_unlock(&g_futex_tree_lock);
+    futex1 = find_futex(bucket1, uaddr1);
 
     if (val != NULL) {
         if (__atomic_load_n(uaddr1, __ATOMIC_RELAXED) != *val) {
@@ -654,25 +684,22 @@ static int futex_requeue(uint32_t* uaddr1, uint32_t* uaddr2, int to_wake, int to
                 put_thread(thread);
                 ++woken;
             } else if (requeued < to_requeue) {
-                move_futex_waiter(waiter, futex1, futex2);
+                move_futex_waiter(waiter, futex1, bucket2, futex2);
                 ++requeued;
             } else {
                 break;
             }
         }
 
-        needs_dequeue1 = check_dequeue_futex(futex1);
-        needs_dequeue2 = check_dequeue_futex(futex2);
-
         ret = woken + requeued;
     }
 
 out_unlock:
-    unlock_two_futexes(futex1, futex2);
-
-    if (needs_dequeue1 || needs_dequeue2) {
-        maybe_dequeue_two_futexes(futex1, futex2);
+    if (futex1) {
+        maybe_dequeue_futex(bucket1, futex1);
     }
+    maybe_dequeue_futex(bucket2, futex2);
+    unlock_two_buckets(bucket1, bucket2);
 
     if (woken > 0) {
         wake_queue(&queue);
@@ -709,6 +736,43 @@ static int is_valid_futex_ptr(uint32_t* ptr, bool check_write) {
     return 0;
 }
 
+/*
+ * Implements FUTEX_WAIT_MULTIPLE: `user_blocks` is an array of `count` futex descriptions in user
+ * memory. They are copied first, so that the application can't change them under our hands.
+ */
+static int futex_wait_multiple_user(struct futex_wait_block* user_blocks, uint32_t count,
+                                    uint64_t timeout) {
+    if (count == 0 || count > FUTEX_WAITV_MAX) {
+        return -EINVAL;
+    }
+    if (!is_user_memory_readable(user_blocks, count * sizeof(*user_blocks))) {
+        return -EFAULT;
+    }
+
+    struct futex_wait_block* blocks = malloc(count * sizeof(*blocks));
+    if (!blocks) {
+        return -ENOMEM;
+    }
+    memcpy(blocks, user_blocks, count * sizeof(*blocks));
+
+    int ret;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!blocks[i].bitset) {
+            ret = -EINVAL;
+            goto out;
+        }
+        ret = is_valid_futex_ptr(blocks[i].uaddr, FUTEX_CHECK_READ);
+        if (ret) {
+            goto out;
+        }
+    }
+
+    ret = futex_wait_multiple(blocks, count, timeout);
+out:
+    free(blocks);
+    return ret;
+}
+
 static int _shim_do_futex(uint32_t* uaddr, int op, uint32_t val, void* utime, uint32_t* uaddr2,
                           uint32_t val3) {
     int cmd = op & FUTEX_CMD_MASK;
@@ -716,15 +780,16 @@ static int _shim_do_futex(uint32_t* uaddr, int op, uint32_t val, void* utime, ui
     uint32_t val2 = 0;
 
     if (utime && (cmd == FUTEX_WAIT || cmd == FUTEX_WAIT_BITSET || cmd == FUTEX_LOCK_PI ||
-                  cmd == FUTEX_WAIT_REQUEUE_PI)) {
+                  cmd == FUTEX_WAIT_REQUEUE_PI || cmd == FUTEX_WAIT_MULTIPLE)) {
         struct __kernel_timespec* user_timeout = utime;
         if (!is_user_memory_readable(user_timeout, sizeof(*user_timeout))) {
             return -EFAULT;
         }
         timeout = timespec_to_us(user_timeout);
-        if (cmd != FUTEX_WAIT) {
-            /* For FUTEX_WAIT, timeout is interpreted as a relative value, which differs from other
-             * futex operations, where timeout is interpreted as an absolute value. */
+        if (cmd != FUTEX_WAIT && cmd != FUTEX_WAIT_MULTIPLE) {
+            /* For FUTEX_WAIT (and FUTEX_WAIT_MULTIPLE), timeout is interpreted as a relative value,
+             * which differs from other futex operations, where timeout is interpreted as an
+             * absolute value. */
             uint64_t current_time = 0;
             int ret = DkSystemTimeQuery(&current_time);
             if (ret < 0) {
@@ -744,7 +809,8 @@ static int _shim_do_futex(uint32_t* uaddr, int op, uint32_t val, void* utime, ui
     }
 
     if (op & FUTEX_CLOCK_REALTIME) {
-        if (cmd != FUTEX_WAIT && cmd != FUTEX_WAIT_BITSET && cmd != FUTEX_WAIT_REQUEUE_PI) {
+        if (cmd != FUTEX_WAIT && cmd != FUTEX_WAIT_BITSET && cmd != FUTEX_WAIT_REQUEUE_PI &&
+                cmd != FUTEX_WAIT_MULTIPLE) {
             return -ENOSYS;
         }
         /* Graphene has only one clock for now. */
@@ -793,6 +859,8 @@ static int _shim_do_futex(uint32_t* uaddr, int op, uint32_t val, void* utime, ui
                 return ret;
             }
             return futex_requeue(uaddr, uaddr2, val, val2, &val3);
+        case FUTEX_WAIT_MULTIPLE:
+            return futex_wait_multiple_user((struct futex_wait_block*)uaddr, val, timeout);
         case FUTEX_LOCK_PI:
         case FUTEX_TRYLOCK_PI:
         case FUTEX_UNLOCK_PI:
@@ -812,6 +880,71 @@ long shim_do_futex(int* uaddr, int op, int val, void* utime, int* uaddr2, int va
                           (uint32_t)val3);
 }
 
+long shim_do_futex_waitv(struct futex_waitv* waiters, unsigned int nr_futexes, unsigned int flags,
+                         struct __kernel_timespec* timeout, clockid_t clockid) {
+    if (flags || nr_futexes == 0 || nr_futexes > FUTEX_WAITV_MAX) {
+        return -EINVAL;
+    }
+    if (!is_user_memory_readable(waiters, nr_futexes * sizeof(*waiters))) {
+        return -EFAULT;
+    }
+
+    uint64_t timeout_us = NO_TIMEOUT;
+    if (timeout) {
+        if (clockid != CLOCK_MONOTONIC && clockid != CLOCK_REALTIME) {
+            return -EINVAL;
+        }
+        if (!is_user_memory_readable(timeout, sizeof(*timeout))) {
+            return -EFAULT;
+        }
+        /* The timeout is absolute. Graphene has only one clock for now, so `clockid` is ignored. */
+        uint64_t current_time = 0;
+        int ret = DkSystemTimeQuery(&current_time);
+        if (ret < 0) {
+            return pal_to_unix_errno(ret);
+        }
+        timeout_us = timespec_to_us(timeout);
+        if (timeout_us < current_time) {
+            return -ETIMEDOUT;
+        }
+        timeout_us -= current_time;
+    }
+
+    struct futex_wait_block* blocks = malloc(nr_futexes * sizeof(*blocks));
+    if (!blocks) {
+        return -ENOMEM;
+    }
+
+    long ret;
+    bool warned = false;
+    for (unsigned int i = 0; i < nr_futexes; i++) {
+        struct futex_waitv waiter = waiters[i];
+        if ((waiter.flags & ~FUTEX_PRIVATE_FLAG) != FUTEX_32 || waiter.__reserved
+                || waiter.val > UINT32_MAX) {
+            ret = -EINVAL;
+            goto out;
+        }
+        if (!(waiter.flags & FUTEX_PRIVATE_FLAG) && !warned) {
+            log_warning("Non-private futexes are not supported, assuming implicit "
+                        "FUTEX_PRIVATE_FLAG\n");
+            warned = true;
+        }
+
+        blocks[i].uaddr = (uint32_t*)(uintptr_t)waiter.uaddr;
+        blocks[i].val = (uint32_t)waiter.val;
+        blocks[i].bitset = FUTEX_BITSET_MATCH_ANY;
+        ret = is_valid_futex_ptr(blocks[i].uaddr, FUTEX_CHECK_READ);
+        if (ret) {
+            goto out;
+        }
+    }
+
+    ret = futex_wait_multiple(blocks, nr_futexes, timeout_us);
+out:
+    free(blocks);
+    return ret;
+}
+
 long shim_do_set_robust_list(struct robust_list_head* head, size_t len) {
     if (len != sizeof(struct robust_list_head)) {
         return -EINVAL;
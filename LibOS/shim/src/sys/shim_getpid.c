@@ -11,6 +11,10 @@
 #include "shim_types.h"
 
 long shim_do_getpid(void) {
+    /* the child of vfork() is the only thread of its process, its pid equals its tid */
+    struct shim_thread* cur = get_cur_thread();
+    if (cur->vfork)
+        return cur->tid;
     return g_process.pid;
 }
 
@@ -20,6 +24,8 @@ long shim_do_gettid(void) {
 }
 
 long shim_do_getppid(void) {
+    if (get_cur_thread()->vfork)
+        return g_process.pid;
     return g_process.ppid;
 }
 
@@ -36,6 +42,15 @@ long shim_do_setpgid(pid_t pid, pid_t pgid) {
         return -EINVAL;
     }
 
+    struct shim_thread* cur = get_cur_thread();
+    if (cur->vfork) {
+        /* the child of vfork() takes its process group into the new process on execve() */
+        if (pid && cur->tid != (IDTYPE)pid)
+            return -EINVAL;
+        cur->vfork->child_pgid = (IDTYPE)pgid ?: cur->tid;
+        return 0;
+    }
+
     if (!pid || g_process.pid == (IDTYPE)pid) {
         __atomic_store_n(&g_process.pgid, (IDTYPE)pgid ?: g_process.pid, __ATOMIC_RELEASE);
         /* TODO: inform parent about pgid change. */
@@ -47,6 +62,10 @@ long shim_do_setpgid(pid_t pid, pid_t pgid) {
 }
 
 long shim_do_getpgid(pid_t pid) {
+    struct shim_thread* cur = get_cur_thread();
+    if (cur->vfork && (!pid || cur->tid == (IDTYPE)pid))
+        return cur->vfork->child_pgid;
+
     if (!pid || g_process.pid == (IDTYPE)pid) {
         return __atomic_load_n(&g_process.pgid, __ATOMIC_ACQUIRE);
     }
@@ -0,0 +1,292 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * Implementation of system calls "io_uring_setup", "io_uring_enter" and "io_uring_register". The
+ * rings are emulated in LibOS (see fs/io_uring/fs.c).
+ */
+
+#include <asm/fcntl.h>
+#include <errno.h>
+
+#include "shim_fs.h"
+#include "shim_handle.h"
+#include "shim_internal.h"
+#include "shim_lock.h"
+#include "shim_table.h"
+#include "shim_utils.h"
+
+#define IO_URING_MAX_ENTRIES    32768
+#define IO_URING_MAX_CQ_ENTRIES (2 * IO_URING_MAX_ENTRIES)
+#define IO_URING_MAX_FILES      32768
+#define IO_URING_MAX_BUFFERS    1024
+
+static uint32_t round_up_pow2(uint32_t x) {
+    uint32_t ret = 1;
+    while (ret < x)
+        ret <<= 1;
+    return ret;
+}
+
+static int get_io_uring_handle(unsigned int fd, struct shim_handle** out_hdl) {
+    struct shim_handle* hdl = get_fd_handle(fd, NULL, NULL);
+    if (!hdl)
+        return -EBADF;
+    if (hdl->type != TYPE_IO_URING) {
+        put_handle(hdl);
+        return -EOPNOTSUPP;
+    }
+    *out_hdl = hdl;
+    return 0;
+}
+
+long shim_do_io_uring_setup(unsigned int entries, struct io_uring_params* params) {
+    if (!is_user_memory_writable(params, sizeof(*params)))
+        return -EFAULT;
+
+    /* no kernel-side polling (IORING_SETUP_IOPOLL, IORING_SETUP_SQPOLL): requests are executed by
+     * io_uring_enter() */
+    if (params->flags & ~(IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP))
+        return -EINVAL;
+    for (size_t i = 0; i < ARRAY_SIZE(params->resv); i++)
+        if (params->resv[i])
+            return -EINVAL;
+
+    bool clamp = params->flags & IORING_SETUP_CLAMP;
+    if (!entries)
+        return -EINVAL;
+    if (entries > IO_URING_MAX_ENTRIES) {
+        if (!clamp)
+            return -EINVAL;
+        entries = IO_URING_MAX_ENTRIES;
+    }
+    uint32_t sq_entries = round_up_pow2(entries);
+
+    uint32_t cq_entries = 2 * sq_entries;
+    if (params->flags & IORING_SETUP_CQSIZE) {
+        if (!params->cq_entries)
+            return -EINVAL;
+        cq_entries = params->cq_entries;
+        if (cq_entries > IO_URING_MAX_CQ_ENTRIES) {
+            if (!clamp)
+                return -EINVAL;
+            cq_entries = IO_URING_MAX_CQ_ENTRIES;
+        }
+        cq_entries = round_up_pow2(cq_entries);
+        if (cq_entries < sq_entries)
+            return -EINVAL;
+    }
+
+    struct shim_handle* hdl = get_new_handle();
+    if (!hdl)
+        return -ENOMEM;
+
+    hdl->type = TYPE_IO_URING;
+    hdl->fs = &io_uring_builtin_fs;
+    hdl->flags = O_RDWR;
+    hdl->acc_mode = MAY_READ | MAY_WRITE;
+    init_io_uring(hdl, sq_entries, cq_entries, params);
+
+    /* get_new_handle() above increments hdl's refcount. Followed by another increment inside
+     * set_new_fd_handle. So we need to put_handle() afterwards. */
+    int vfd = set_new_fd_handle(hdl, FD_CLOEXEC, NULL);
+    put_handle(hdl);
+    return vfd;
+}
+
+long shim_do_io_uring_enter(unsigned int fd, unsigned int to_submit, unsigned int min_complete,
+                            unsigned int flags, const void* sig, size_t sigsz) {
+    /* the signal mask is ignored, like in ppoll() */
+    __UNUSED(sig);
+    __UNUSED(sigsz);
+
+    /* there is no SQ polling thread to wake up or wait for */
+    if (flags & ~(IORING_ENTER_GETEVENTS | IORING_ENTER_SQ_WAKEUP | IORING_ENTER_SQ_WAIT))
+        return -EINVAL;
+
+    struct shim_handle* hdl;
+    int ret = get_io_uring_handle(fd, &hdl);
+    if (ret < 0)
+        return ret;
+
+    long submitted = io_uring_submit_and_wait(hdl, to_submit, min_complete,
+                                              flags & IORING_ENTER_GETEVENTS);
+    put_handle(hdl);
+    return submitted;
+}
+
+static int register_buffers(struct shim_io_uring_handle* ring, struct iovec* iovs,
+                            unsigned int nr_args) {
+    if (ring->buffers)
+        return -EBUSY;
+    if (!nr_args || nr_args > IO_URING_MAX_BUFFERS)
+        return -EINVAL;
+    if (!is_user_memory_readable(iovs, nr_args * sizeof(*iovs)))
+        return -EFAULT;
+
+    for (unsigned int i = 0; i < nr_args; i++) {
+        if (!iovs[i].iov_base || !iovs[i].iov_len)
+            return -EFAULT;
+        if (!is_user_memory_writable(iovs[i].iov_base, iovs[i].iov_len))
+            return -EFAULT;
+    }
+
+    ring->buffers = malloc(nr_args * sizeof(*iovs));
+    if (!ring->buffers)
+        return -ENOMEM;
+    memcpy(ring->buffers, iovs, nr_args * sizeof(*iovs));
+    ring->buffers_cnt = nr_args;
+    return 0;
+}
+
+static int register_files(struct shim_io_uring_handle* ring, int* fds, unsigned int nr_args) {
+    if (ring->files)
+        return -EBUSY;
+    if (!nr_args || nr_args > IO_URING_MAX_FILES)
+        return -EINVAL;
+    if (!is_user_memory_readable(fds, nr_args * sizeof(*fds)))
+        return -EFAULT;
+
+    /* FDs are checked when used, a registered FD closed later fails with -EBADF (unlike in Linux,
+     * which keeps a reference to the file) */
+    for (unsigned int i = 0; i < nr_args; i++) {
+        if (fds[i] == -1)
+            continue;
+        struct shim_handle* file = get_fd_handle(fds[i], NULL, NULL);
+        if (!file)
+            return -EBADF;
+        bool is_ring = file->type == TYPE_IO_URING;
+        put_handle(file);
+        if (is_ring)
+            return -EBADF;
+    }
+
+    ring->files = malloc(nr_args * sizeof(*fds));
+    if (!ring->files)
+        return -ENOMEM;
+    memcpy(ring->files, fds, nr_args * sizeof(*fds));
+    ring->files_cnt = nr_args;
+    return 0;
+}
+
+static int register_eventfd(struct shim_io_uring_handle* ring, int* fd, unsigned int nr_args) {
+    if (ring->eventfd)
+        return -EBUSY;
+    if (nr_args != 1)
+        return -EINVAL;
+    if (!is_user_memory_readable(fd, sizeof(*fd)))
+        return -EFAULT;
+
+    struct shim_handle* eventfd = get_fd_handle(*fd, NULL, NULL);
+    if (!eventfd)
+        return -EBADF;
+    if (eventfd->type != TYPE_EVENTFD) {
+        put_handle(eventfd);
+        return -EINVAL;
+    }
+    ring->eventfd = eventfd;
+    return 0;
+}
+
+static int register_probe(struct io_uring_probe* probe, unsigned int nr_args) {
+    size_t size = sizeof(*probe) + nr_args * sizeof(probe->ops[0]);
+    if (!is_user_memory_writable(probe, size))
+        return -EFAULT;
+
+    for (size_t i = 0; i < size; i++)
+        if (((char*)probe)[i])
+            return -EINVAL;
+
+    unsigned int last_op = 0;
+    for (unsigned int op = 0; op <= UINT8_MAX; op++)
+        if (io_uring_op_supported(op))
+            last_op = op;
+
+    probe->last_op = last_op;
+    probe->ops_len = MIN(nr_args, last_op + 1);
+    for (unsigned int op = 0; op < probe->ops_len; op++) {
+        probe->ops[op].op = op;
+        if (io_uring_op_supported(op))
+            probe->ops[op].flags = IO_URING_OP_SUPPORTED;
+    }
+    return 0;
+}
+
+long shim_do_io_uring_register(unsigned int fd, unsigned int opcode, void* arg,
+                               unsigned int nr_args) {
+    struct shim_handle* hdl;
+    int ret = get_io_uring_handle(fd, &hdl);
+    if (ret < 0)
+        return ret;
+
+    struct shim_io_uring_handle* ring = &hdl->info.io_uring;
+    lock(&hdl->lock);
+    if (ring->inherited) {
+        ret = -EBADF;
+        goto out;
+    }
+
+    switch (opcode) {
+        case IORING_REGISTER_BUFFERS:
+            ret = register_buffers(ring, arg, nr_args);
+            break;
+        case IORING_UNREGISTER_BUFFERS:
+            if (arg || nr_args) {
+                ret = -EINVAL;
+                break;
+            }
+            if (!ring->buffers) {
+                ret = -ENXIO;
+                break;
+            }
+            free(ring->buffers);
+            ring->buffers = NULL;
+            ring->buffers_cnt = 0;
+            ret = 0;
+            break;
+        case IORING_REGISTER_FILES:
+            ret = register_files(ring, arg, nr_args);
+            break;
+        case IORING_UNREGISTER_FILES:
+            if (arg || nr_args) {
+                ret = -EINVAL;
+                break;
+            }
+            if (!ring->files) {
+                ret = -ENXIO;
+                break;
+            }
+            free(ring->files);
+            ring->files = NULL;
+            ring->files_cnt = 0;
+            ret = 0;
+            break;
+        case IORING_REGISTER_EVENTFD:
+            ret = register_eventfd(ring, arg, nr_args);
+            break;
+        case IORING_UNREGISTER_EVENTFD:
+            if (arg || nr_args) {
+                ret = -EINVAL;
+                break;
+            }
+            if (!ring->eventfd) {
+                ret = -ENXIO;
+                break;
+            }
+            put_handle(ring->eventfd);
+            ring->eventfd = NULL;
+            ret = 0;
+            break;
+        case IORING_REGISTER_PROBE:
+            ret = register_probe(arg, nr_args);
+            break;
+        default:
+            ret = -EINVAL;
+            break;
+    }
+
+out:
+    unlock(&hdl->lock);
+    put_handle(hdl);
+    return ret;
+}
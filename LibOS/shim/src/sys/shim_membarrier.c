@@ -0,0 +1,179 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * Implementation of system call "membarrier".
+ *
+ * The expedited commands need every other thread of the process that runs application code to
+ * execute a full memory barrier before the syscall returns. A thread inside LibOS needs nothing:
+ * it executes a barrier on its way in and out (see `libos_transitions` in `struct shim_tcb`). A
+ * thread running application code is interrupted with `DkThreadResume`, like for signal delivery,
+ * and acknowledges the barrier in its interrupt upcall (see `membarrier_ack`).
+ */
+
+#include <errno.h>
+
+#include "pal.h"
+#include "shim_checkpoint.h"
+#include "shim_internal.h"
+#include "shim_lock.h"
+#include "shim_table.h"
+#include "shim_tcb.h"
+#include "shim_thread.h"
+
+/* linux/membarrier.h, the RSEQ commands (Linux 5.10) are not present in older kernel headers */
+#define MEMBARRIER_CMD_QUERY                           0
+#define MEMBARRIER_CMD_PRIVATE_EXPEDITED               (1 << 3)
+#define MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED      (1 << 4)
+#define MEMBARRIER_CMD_PRIVATE_EXPEDITED_RSEQ          (1 << 7)
+#define MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_RSEQ (1 << 8)
+#define MEMBARRIER_CMD_FLAG_CPU                        (1 << 0)
+
+#define MEMBARRIER_SUPPORTED_CMDS (MEMBARRIER_CMD_PRIVATE_EXPEDITED                 \
+                                   | MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED      \
+                                   | MEMBARRIER_CMD_PRIVATE_EXPEDITED_RSEQ          \
+                                   | MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_RSEQ)
+
+/* registered commands (MEMBARRIER_CMD_PRIVATE_EXPEDITED*); inherited by fork(), like the memory
+ * of the process, and cleared on execve() */
+static int g_membarrier_registered __attribute_migratable = 0;
+
+/* generation of the last barrier requested by membarrier() */
+static uint64_t g_membarrier_generation = 0;
+
+void membarrier_ack(void) {
+    shim_tcb_t* tcb = shim_get_tcb();
+    /* orders everything the thread did before the interrupt with the barrier */
+    uint64_t generation = __atomic_load_n(&g_membarrier_generation, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&tcb->membarrier_ack, generation, __ATOMIC_RELEASE);
+}
+
+void membarrier_reset_on_execve(void) {
+    __atomic_store_n(&g_membarrier_registered, 0, __ATOMIC_RELAXED);
+}
+
+struct membarrier_wait {
+    struct shim_thread* thread;
+    uint64_t transitions;
+};
+
+struct membarrier_arg {
+    uint64_t generation;
+    /* -1 for all CPUs */
+    int cpu;
+    /* interrupted threads, with a reference */
+    struct membarrier_wait* waits;
+    size_t waits_cnt;
+    size_t waits_size;
+};
+
+static int membarrier_interrupt(struct shim_thread* thread, void* _arg) {
+    struct membarrier_arg* arg = _arg;
+
+    if (thread == get_cur_thread() || is_internal(thread))
+        return 0;
+
+    if (arg->waits_cnt == arg->waits_size) {
+        size_t new_size = arg->waits_size ? arg->waits_size * 2 : 16;
+        struct membarrier_wait* new_waits = malloc(new_size * sizeof(*new_waits));
+        if (!new_waits)
+            return -ENOMEM;
+        if (arg->waits_cnt)
+            memcpy(new_waits, arg->waits, arg->waits_cnt * sizeof(*new_waits));
+        free(arg->waits);
+        arg->waits = new_waits;
+        arg->waits_size = new_size;
+    }
+
+    /* The TCB of another thread is valid only until the thread drops its TCB reference in
+     * thread_exit(), which is done under `thread->lock`. A user-level thread not running on a
+     * carrier right now is inside LibOS. */
+    PAL_HANDLE pal_handle = NULL;
+    uint64_t transitions = 0;
+    lock(&thread->lock);
+    shim_tcb_t* tcb = thread->shim_tcb;
+    if (tcb && tcb->tp == thread && (arg->cpu < 0 || tcb->cpu == arg->cpu)) {
+        transitions = __atomic_load_n(&tcb->libos_transitions, __ATOMIC_SEQ_CST);
+        if (!(transitions & 1))
+            pal_handle = thread->pal_handle;
+    }
+    unlock(&thread->lock);
+
+    if (!pal_handle)
+        return 0;
+
+    int ret = DkThreadResume(pal_handle);
+    if (ret < 0)
+        return pal_to_unix_errno(ret);
+
+    get_thread(thread);
+    arg->waits[arg->waits_cnt++] = (struct membarrier_wait){
+        .thread = thread,
+        .transitions = transitions,
+    };
+    return 0;
+}
+
+/* Returns true while the thread of `wait` may still have to execute the barrier. */
+static bool membarrier_pending(struct membarrier_wait* wait, uint64_t generation) {
+    struct shim_thread* thread = wait->thread;
+    bool pending = false;
+    lock(&thread->lock);
+    shim_tcb_t* tcb = thread->shim_tcb;
+    if (tcb && tcb->tp == thread) {
+        /* any entry into or return from LibOS since the interrupt is a barrier as well */
+        pending = __atomic_load_n(&tcb->libos_transitions, __ATOMIC_SEQ_CST) == wait->transitions
+                  && __atomic_load_n(&tcb->membarrier_ack, __ATOMIC_ACQUIRE) < generation;
+    }
+    unlock(&thread->lock);
+    return pending;
+}
+
+long shim_do_membarrier(int cmd, unsigned int flags, int cpu_id) {
+    if (cmd != MEMBARRIER_CMD_PRIVATE_EXPEDITED_RSEQ && flags)
+        return -EINVAL;
+    if (flags & ~MEMBARRIER_CMD_FLAG_CPU)
+        return -EINVAL;
+
+    switch (cmd) {
+        case MEMBARRIER_CMD_QUERY:
+            return MEMBARRIER_SUPPORTED_CMDS;
+
+        case MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED:
+        case MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_RSEQ:
+            /* each command is the bit right below its registration command */
+            __atomic_or_fetch(&g_membarrier_registered, cmd >> 1, __ATOMIC_RELAXED);
+            return 0;
+
+        case MEMBARRIER_CMD_PRIVATE_EXPEDITED:
+        case MEMBARRIER_CMD_PRIVATE_EXPEDITED_RSEQ:
+            if (!(__atomic_load_n(&g_membarrier_registered, __ATOMIC_RELAXED) & cmd))
+                return -EPERM;
+            break;
+
+        default:
+            return -EINVAL;
+    }
+
+    struct membarrier_arg arg = {
+        /* orders everything the caller did before the syscall with the barrier */
+        .generation = __atomic_add_fetch(&g_membarrier_generation, 1, __ATOMIC_SEQ_CST),
+        .cpu = flags & MEMBARRIER_CMD_FLAG_CPU ? cpu_id : -1,
+    };
+    /* interrupted threads restart their rseq critical sections (see `rseq_handle_interrupt`), so
+     * the RSEQ variant needs nothing more */
+    int ret = walk_thread_list(&membarrier_interrupt, &arg, /*one_shot=*/false);
+    if (ret == -ESRCH)
+        ret = 0;
+
+    /* wait without the thread list locked, the interrupted threads may need it */
+    for (size_t i = 0; i < arg.waits_cnt; i++) {
+        while (ret == 0 && membarrier_pending(&arg.waits[i], arg.generation))
+            DkThreadYieldExecution();
+        put_thread(arg.waits[i].thread);
+    }
+    free(arg.waits);
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return ret;
+}
@@ -6,7 +6,7 @@
  */
 
 /*
- * Implementation of system calls "mmap", "munmap" and "mprotect".
+ * Implementation of system calls "mmap", "munmap", "mprotect" and "mremap".
  */
 
 #include <errno.h>
@@ -46,6 +46,54 @@
                        | MAP_HUGE_2MB           \
                        | MAP_HUGE_1GB)
 
+/* Lets filesystems save the contents of shared file mappings in [`addr`, `addr` + `length`) before
+ * the memory is freed (see `shim_fs_ops.munmap`). */
+static void munmap_shared_files(void* addr, size_t length) {
+    struct shim_vma_info* vmas;
+    size_t count;
+    if (dump_shared_file_vmas(addr, length, &vmas, &count) < 0) {
+        log_warning("Cannot save shared file mappings at %p-%p\n", addr, (char*)addr + length);
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        struct shim_handle* hdl = vmas[i].file;
+        if (!hdl->fs || !hdl->fs->fs_ops || !hdl->fs->fs_ops->munmap)
+            continue;
+
+        char* begin = MAX((char*)addr, (char*)vmas[i].addr);
+        char* end = MIN((char*)addr + length, (char*)vmas[i].addr + vmas[i].length);
+        hdl->fs->fs_ops->munmap(hdl, begin, end - begin, vmas[i].prot,
+                                vmas[i].file_offset + (begin - (char*)vmas[i].addr));
+    }
+    free_vma_info_array(vmas, count);
+}
+
+/* Lets filesystems write the contents of shared file mappings in [`addr`, `addr` + `length`) back
+ * to the files (see `shim_fs_ops.msync`). */
+static int msync_shared_files(void* addr, size_t length) {
+    struct shim_vma_info* vmas;
+    size_t count;
+    int ret = dump_shared_file_vmas(addr, length, &vmas, &count);
+    if (ret < 0)
+        return ret;
+
+    for (size_t i = 0; i < count; i++) {
+        struct shim_handle* hdl = vmas[i].file;
+        if (!hdl->fs || !hdl->fs->fs_ops || !hdl->fs->fs_ops->msync)
+            continue;
+
+        char* begin = MAX((char*)addr, (char*)vmas[i].addr);
+        char* end = MIN((char*)addr + length, (char*)vmas[i].addr + vmas[i].length);
+        int sync_ret = hdl->fs->fs_ops->msync(hdl, begin, end - begin, vmas[i].prot,
+                                              vmas[i].file_offset + (begin - (char*)vmas[i].addr));
+        if (sync_ret < 0 && ret == 0)
+            ret = sync_ret;
+    }
+    free_vma_info_array(vmas, count);
+    return ret;
+}
+
 void* shim_do_mmap(void* addr, size_t length, int prot, int flags, int fd, unsigned long offset) {
     struct shim_handle* hdl = NULL;
     long ret = 0;
@@ -77,6 +125,14 @@ void* shim_do_mmap(void* addr, size_t length, int prot, int flags, int fd, unsig
     if (flags & MAP_ANONYMOUS) {
         switch (flags & MAP_TYPE) {
             case MAP_SHARED:
+                if (anon_shm_enabled()) {
+                    /* backed by a file shared with the children, see fs/anon_shm/fs.c */
+                    ret = create_anon_shm(length, &hdl);
+                    if (ret < 0)
+                        return (void*)ret;
+                    offset = 0;
+                }
+                break;
             case MAP_PRIVATE:
                 break;
             default:
@@ -138,6 +194,8 @@ void* shim_do_mmap(void* addr, size_t length, int prot, int flags, int fd, unsig
             ret = -EINVAL;
             goto out_handle;
         }
+        if (flags & MAP_FIXED)
+            munmap_shared_files(addr, length);
         ret = bkeep_mmap_fixed(addr, length, prot, flags, hdl, offset, NULL);
         if (ret < 0) {
             goto out_handle;
@@ -165,7 +223,10 @@ void* shim_do_mmap(void* addr, size_t length, int prot, int flags, int fd, unsig
     /* From now on `addr` contains the actual address we want to map (and already bookkeeped). */
 
     if (!hdl) {
-        ret = DkVirtualMemoryAlloc(&addr, length, 0, LINUX_PROT_TO_PAL(prot, flags));
+        /* stacks (e.g. of pthreads) are usually much bigger than what is ever touched */
+        bool lazy = g_lazy_stacks && (flags & (MAP_STACK | MAP_GROWSDOWN));
+        ret = DkVirtualMemoryAlloc(&addr, length, lazy ? PAL_ALLOC_LAZY : 0,
+                                   LINUX_PROT_TO_PAL(prot, flags));
         if (ret < 0) {
             if (ret == -PAL_ERROR_DENIED) {
                 ret = -EPERM;
@@ -281,6 +342,8 @@ long shim_do_munmap(void* addr, size_t length) {
     if (!IS_ALLOC_ALIGNED(length))
         length = ALLOC_ALIGN_UP(length);
 
+    munmap_shared_files(addr, length);
+
     void* tmp_vma = NULL;
     int ret = bkeep_munmap(addr, length, /*is_internal=*/false, &tmp_vma);
     if (ret < 0) {
@@ -296,6 +359,231 @@ long shim_do_munmap(void* addr, size_t length) {
     return 0;
 }
 
+/* Allocates memory for a just bookkeeped part [`addr`, `addr` + `length`) of a mapping described by
+ * `vma_info`, at `offset` bytes from its start. */
+static int mremap_alloc(struct shim_vma_info* vma_info, void* addr, size_t length, uint64_t offset) {
+    if (!vma_info->file) {
+        int ret = DkVirtualMemoryAlloc(&addr, length, 0,
+                                       LINUX_PROT_TO_PAL(vma_info->prot, vma_info->flags));
+        if (ret < 0) {
+            return ret == -PAL_ERROR_DENIED ? -EPERM : pal_to_unix_errno(ret);
+        }
+        return 0;
+    }
+
+    struct shim_handle* hdl = vma_info->file;
+    void* ret_addr = addr;
+    int flags = (vma_info->flags & ~VMA_TAINTED) | MAP_FIXED;
+    int ret = hdl->fs->fs_ops->mmap(hdl, &ret_addr, length, vma_info->prot, flags,
+                                    vma_info->file_offset + offset);
+    if (ret >= 0 && ret_addr != addr) {
+        log_error("Requested address (%p) differs from allocated (%p)!\n", addr, ret_addr);
+        BUG();
+    }
+    return ret;
+}
+
+/* Removes bookkeeping of [`addr`, `addr` + `length`) and frees its memory. */
+static void mremap_free(void* addr, size_t length) {
+    munmap_shared_files(addr, length);
+
+    void* tmp_vma = NULL;
+    if (bkeep_munmap(addr, length, /*is_internal=*/false, &tmp_vma) < 0) {
+        log_error("[mremap] Failed to remove bookkeeped memory at %p-%p!\n", addr,
+                  (char*)addr + length);
+        BUG();
+    }
+    if (DkVirtualMemoryFree(addr, length) < 0) {
+        BUG();
+    }
+    bkeep_remove_tmp_vma(tmp_vma);
+}
+
+/* Grows [`addr`, `addr` + `old_size`) in place, if the memory after it is free. */
+static int mremap_grow(struct shim_vma_info* vma_info, void* addr, size_t old_size,
+                       size_t new_size) {
+    int ret = bkeep_mremap_grow(addr, old_size, new_size);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = mremap_alloc(vma_info, (char*)addr + old_size, new_size - old_size,
+                       (uintptr_t)addr + old_size - (uintptr_t)vma_info->addr);
+    if (ret < 0) {
+        void* tmp_vma = NULL;
+        if (bkeep_munmap((char*)addr + old_size, new_size - old_size, /*is_internal=*/false,
+                         &tmp_vma) < 0) {
+            BUG();
+        }
+        bkeep_remove_tmp_vma(tmp_vma);
+    }
+    return ret;
+}
+
+/* Moves [`old_addr`, `old_addr` + `old_size`) to a new mapping of `new_size` bytes at
+ * `*new_addr_ptr` (or anywhere if it is NULL). The pages themselves are moved by the PAL. */
+static int mremap_move(struct shim_vma_info* vma_info, void* old_addr, size_t old_size,
+                       size_t new_size, void** new_addr_ptr) {
+    uint64_t offset = (uintptr_t)old_addr - (uintptr_t)vma_info->addr;
+    void* new_addr = *new_addr_ptr;
+    int ret;
+
+    if (new_addr) {
+        ret = bkeep_mmap_fixed(new_addr, new_size, vma_info->prot, vma_info->flags | MAP_FIXED,
+                               vma_info->file, vma_info->file_offset + offset, vma_info->comment);
+    } else {
+        ret = bkeep_mmap_any_aslr(new_size, vma_info->prot, vma_info->flags, vma_info->file,
+                                  vma_info->file_offset + offset, vma_info->comment, &new_addr);
+    }
+    if (ret < 0) {
+        return ret;
+    }
+
+    /* Allocate the grown part before moving anything, so that a failure leaves the old mapping
+     * intact. */
+    size_t moved_size = MIN(old_size, new_size);
+    if (new_size > moved_size) {
+        ret = mremap_alloc(vma_info, (char*)new_addr + moved_size, new_size - moved_size,
+                           offset + moved_size);
+        if (ret < 0) {
+            goto out_free;
+        }
+    }
+
+    /* filesystems don't follow the move, let them save the contents as if it was unmapped */
+    munmap_shared_files(old_addr, moved_size);
+    ret = DkVirtualMemoryMove(old_addr, new_addr, moved_size);
+    if (ret < 0) {
+        ret = pal_to_unix_errno(ret);
+        goto out_free;
+    }
+
+    /* The memory at `old_addr` is already freed by the move. */
+    void* tmp_vma = NULL;
+    if (bkeep_munmap(old_addr, moved_size, /*is_internal=*/false, &tmp_vma) < 0) {
+        BUG();
+    }
+    bkeep_remove_tmp_vma(tmp_vma);
+
+    *new_addr_ptr = new_addr;
+    return 0;
+
+out_free:
+    mremap_free(new_addr, new_size);
+    return ret;
+}
+
+void* shim_do_mremap(void* old_addr, size_t old_size, size_t new_size, int flags,
+                     void* new_addr) {
+    if (flags & ~(MREMAP_MAYMOVE | MREMAP_FIXED)) {
+        return (void*)-EINVAL;
+    }
+
+    if ((flags & MREMAP_FIXED) && !(flags & MREMAP_MAYMOVE)) {
+        return (void*)-EINVAL;
+    }
+
+    if (!IS_ALLOC_ALIGNED_PTR(old_addr)) {
+        return (void*)-EINVAL;
+    }
+
+    /* Duplicating shared mappings (`old_size` == 0) is not supported. */
+    if (!old_size || !new_size) {
+        return (void*)-EINVAL;
+    }
+
+    old_size = ALLOC_ALIGN_UP(old_size);
+    new_size = ALLOC_ALIGN_UP(new_size);
+    if (!old_size || !new_size) {
+        /* overflow when rounding up */
+        return (void*)-EINVAL;
+    }
+
+    if (!access_ok(old_addr, old_size)) {
+        return (void*)-EFAULT;
+    }
+
+    if (flags & MREMAP_FIXED) {
+        if (!IS_ALLOC_ALIGNED_PTR(new_addr) || !access_ok(new_addr, new_size)) {
+            return (void*)-EINVAL;
+        }
+        /* We know that `new_addr + new_size` does not overflow (`access_ok` above). */
+        if (new_addr < g_pal_control->user_address.start
+                || (uintptr_t)g_pal_control->user_address.end < (uintptr_t)new_addr + new_size) {
+            return (void*)-EINVAL;
+        }
+        if ((uintptr_t)old_addr < (uintptr_t)new_addr + new_size
+                && (uintptr_t)new_addr < (uintptr_t)old_addr + old_size) {
+            return (void*)-EINVAL;
+        }
+    } else {
+        new_addr = NULL;
+    }
+
+    struct shim_vma_info vma_info;
+    if (lookup_vma(old_addr, &vma_info) < 0) {
+        return (void*)-EFAULT;
+    }
+
+    long ret = 0;
+    /* Like on Linux, the old range must lie inside a single mapping. */
+    if ((vma_info.flags & (VMA_INTERNAL | VMA_UNMAPPED))
+            || (uintptr_t)vma_info.addr + vma_info.length < (uintptr_t)old_addr + old_size) {
+        ret = -EFAULT;
+        goto out;
+    }
+
+    if (vma_info.file && (!vma_info.file->fs || !vma_info.file->fs->fs_ops
+                          || !vma_info.file->fs->fs_ops->mmap)) {
+        ret = -ENODEV;
+        goto out;
+    }
+
+    if (!(flags & MREMAP_FIXED)) {
+        if (new_size == old_size) {
+            ret = (long)old_addr;
+            goto out;
+        }
+
+        if (new_size < old_size) {
+            ret = shim_do_munmap((char*)old_addr + new_size, old_size - new_size);
+            if (ret >= 0) {
+                ret = (long)old_addr;
+            }
+            goto out;
+        }
+
+        ret = mremap_grow(&vma_info, old_addr, old_size, new_size);
+        if (ret >= 0) {
+            ret = (long)old_addr;
+            goto out;
+        }
+        if (ret != -ENOMEM || !(flags & MREMAP_MAYMOVE)) {
+            goto out;
+        }
+    }
+
+    if (new_size < old_size) {
+        /* Only the part that stays mapped is moved. */
+        ret = shim_do_munmap((char*)old_addr + new_size, old_size - new_size);
+        if (ret < 0) {
+            goto out;
+        }
+        old_size = new_size;
+    }
+
+    ret = mremap_move(&vma_info, old_addr, old_size, new_size, &new_addr);
+    if (ret >= 0) {
+        ret = (long)new_addr;
+    }
+
+out:
+    if (vma_info.file) {
+        put_handle(vma_info.file);
+    }
+    return (void*)ret;
+}
+
 /* This emulation of mincore() always tells that pages are _NOT_ in RAM
  * pessimistically due to lack of a good way to know it.
  * Possibly it may cause performance(or other) issue due to this lying.
@@ -392,7 +680,6 @@ long shim_do_madvise(unsigned long start, size_t len_in, int behavior) {
         case MADV_RANDOM:
         case MADV_SEQUENTIAL:
         case MADV_WILLNEED:
-        case MADV_FREE:
         case MADV_SOFT_OFFLINE:
         case MADV_MERGEABLE:
         case MADV_UNMERGEABLE:
@@ -413,6 +700,10 @@ long shim_do_madvise(unsigned long start, size_t len_in, int behavior) {
         case MADV_DONTNEED: {
             return madvise_dontneed_range(start, start + len);
         }
+
+        case MADV_FREE: {
+            return madvise_free_range(start, start + len);
+        }
     }
     return -EINVAL;
 }
@@ -440,15 +731,12 @@ long shim_do_msync(unsigned long start, size_t len_orig, int flags) {
         flags = MS_ASYNC;
     }
 
-    if (flags != MS_ASYNC) {
-        log_warning("Graphene does not support flags to msync other than MS_ASYNC\n");
-        return -ENOSYS;
-    }
-
     if (!is_user_memory_readable((void*)start, len)) {
         return -ENOMEM;
     }
 
-    /* `MS_ASYNC` is a no-op on Linux. */
-    return 0;
+    /* Host shared mappings are written back by the host (`MS_ASYNC` is a no-op on Linux), but
+     * emulated ones have to be written back here, with either flag. `MS_INVALIDATE` is a no-op, as
+     * on Linux: other mappings of the file are either coherent or private copies. */
+    return msync_shared_files((void*)start, len);
 }
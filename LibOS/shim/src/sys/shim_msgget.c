@@ -21,6 +21,7 @@
 #include "shim_lock.h"
 #include "shim_sysv.h"
 #include "shim_table.h"
+#include "shim_thread.h"
 #include "shim_types.h"
 #include "shim_utils.h"
 #include "stat.h"
@@ -84,11 +85,7 @@ static int __add_msg_handle(unsigned long key, IDTYPE msqid, bool owned,
     msgq->owned       = owned;
     msgq->deleted     = false;
     msgq->currentsize = 0;
-    int ret = DkEventCreate(&msgq->event, /*init_signaled=*/false, /*auto_clear=*/true);
-    if (ret < 0) {
-        // Needs some cleanup, but this function is broken anyway...
-        return pal_to_unix_errno(ret);
-    }
+    INIT_LISTP(&msgq->waiters);
 
     msgq->queue     = malloc(MSG_QOBJ_SIZE * DEFAULT_MSG_QUEUE_SIZE);
     msgq->queuesize = DEFAULT_MSG_QUEUE_SIZE;
@@ -550,7 +547,13 @@ int add_sysv_msg(struct shim_msg_handle* msgq, long type, size_t size, const voi
     if ((ret = __store_msg_qobjs(msgq, mtype, size, data)) < 0)
         goto out_locked;
 
-    DkEventSet(msgq->event);
+    /* wake up all local receivers, each of them rechecks whether a message of its type arrived */
+    struct sysv_waiter* waiter;
+    struct sysv_waiter* tmp;
+    LISTP_FOR_EACH_ENTRY_SAFE(waiter, tmp, &msgq->waiters, list) {
+        LISTP_DEL_INIT(waiter, &msgq->waiters, list);
+        thread_wakeup(waiter->thread);
+    }
     ret = 0;
 out_locked:
     unlock(&hdl->lock);
@@ -640,10 +643,19 @@ int get_sysv_msg(struct shim_msg_handle* msgq, long type, size_t size, void* dat
         if (flags & IPC_NOWAIT || src)
             break;
 
+        struct sysv_waiter waiter = { .thread = get_cur_thread() };
+        INIT_LIST_HEAD(&waiter, list);
+        LISTP_ADD_TAIL(&waiter, &msgq->waiters, list);
+
+        /* prepare before unlocking, so that a wakeup issued in between isn't lost */
+        thread_prepare_wait();
         unlock(&hdl->lock);
-        object_wait_with_retry(msgq->event);
+        thread_wait(/*timeout_us=*/NULL, /*ignore_pending_signals=*/true);
         lock(&hdl->lock);
 
+        if (!LIST_EMPTY(&waiter, list))
+            LISTP_DEL_INIT(&waiter, &msgq->waiters, list);
+
         if (!msgq->owned)
             goto unowned;
     }
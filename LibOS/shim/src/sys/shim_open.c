@@ -3,7 +3,8 @@
 
 /*
  * Implementation of system calls: "read", "write", "open", "creat", "openat", "close", "lseek",
- * "pread64", "pwrite64", "getdents", "getdents64", "fsync", "truncate" and "ftruncate".
+ * "pread64", "pwrite64", "getdents", "getdents64", "fsync", "truncate", "ftruncate", "fallocate",
+ * "fadvise64" and "readahead".
  */
 
 #define _POSIX_C_SOURCE 200809L  /* for SSIZE_MAX */
@@ -11,12 +12,15 @@
 #include <dirent.h>
 #include <errno.h>
 #include <limits.h>
+#include <linux/fadvise.h>
+#include <linux/falloc.h>
 #include <linux/fcntl.h>
 #include <stdalign.h>
 
 #include "pal.h"
 #include "pal_error.h"
 #include "shim_fs.h"
+#include "shim_fs_lock.h"
 #include "shim_handle.h"
 #include "shim_internal.h"
 #include "shim_lock.h"
@@ -146,15 +150,186 @@ out:
     return ret;
 }
 
+/* Does what closing a descriptor of `handle` implies, besides dropping the reference to it. */
+static int close_fd_of_handle(struct shim_handle* handle) {
+    /* data buffered by write-behind must reach the host by the time close() returns, even if the
+     * handle lives on (dup'ed descriptors, the flush timer) */
+    int ret = 0;
+    if (handle->type == TYPE_FILE) {
+        lock(&handle->lock);
+        ret = chroot_flush_writes(handle);
+        unlock(&handle->lock);
+    }
+
+    /* closing any descriptor of a file releases all POSIX locks of the process on it */
+    if (handle->dentry)
+        posix_lock_clear_pid(handle->dentry);
+
+    return ret;
+}
+
 long shim_do_close(int fd) {
     struct shim_handle* handle = detach_fd_handle(fd, NULL, NULL);
     if (!handle)
         return -EBADF;
 
+    int ret = close_fd_of_handle(handle);
     put_handle(handle);
+    return ret;
+}
+
+/* number of descriptors detached at once by close_range(), see detach_fd_handles() */
+#define CLOSE_RANGE_BATCH 64
+
+long shim_do_close_range(unsigned int first, unsigned int last, unsigned int flags) {
+    if (flags & ~(CLOSE_RANGE_UNSHARE | CLOSE_RANGE_CLOEXEC))
+        return -EINVAL;
+    if (first > last)
+        return -EINVAL;
+
+    struct shim_thread* cur_thread = get_cur_thread();
+    if (flags & CLOSE_RANGE_UNSHARE) {
+        struct shim_handle_map* new_map = NULL;
+        int ret = dup_handle_map(&new_map, cur_thread->handle_map);
+        if (ret < 0)
+            return ret;
+        set_handle_map(cur_thread, new_map);
+        put_handle_map(new_map);
+    }
+    struct shim_handle_map* handle_map = cur_thread->handle_map;
+
+    /* no descriptor can be above FD_NULL - 1 */
+    if (first >= FD_NULL)
+        return 0;
+    FDTYPE last_fd = MIN(last, (unsigned int)FD_NULL - 1);
+
+    if (flags & CLOSE_RANGE_CLOEXEC) {
+        int ret = 0;
+        lock(&handle_map->lock);
+        if (handle_map->fd_top != FD_NULL) {
+            for (FDTYPE fd = first; fd <= MIN(last_fd, handle_map->fd_top); fd++) {
+                ret = __set_fd_handle_flags(fd, FD_CLOEXEC, handle_map);
+                if (ret < 0)
+                    break;
+            }
+        }
+        unlock(&handle_map->lock);
+        return ret;
+    }
+
+    /* close the descriptors in batches: one RCU grace period per batch of detached handles and
+     * one batched PAL close of the handles released by them */
+    struct shim_handle* handles[CLOSE_RANGE_BATCH];
+    FDTYPE fd = first;
+    size_t count;
+    while ((count = detach_fd_handles(&fd, last_fd, /*cloexec_only=*/false, handles,
+                                      ARRAY_SIZE(handles), handle_map))) {
+        for (size_t i = 0; i < count; i++)
+            (void)close_fd_of_handle(handles[i]);
+        put_handles(handles, count);
+    }
     return 0;
 }
 
+long shim_do_fallocate(int fd, int mode, loff_t offset, loff_t len) {
+    if (offset < 0 || len <= 0)
+        return -EINVAL;
+    /* only allocation is supported, not punching holes, zeroing, collapsing or inserting ranges */
+    if (mode & ~FALLOC_FL_KEEP_SIZE)
+        return -EOPNOTSUPP;
+    loff_t end;
+    if (__builtin_add_overflow(offset, len, &end))
+        return -EFBIG;
+
+    struct shim_handle* hdl = get_fd_handle(fd, NULL, NULL);
+    if (!hdl)
+        return -EBADF;
+
+    int ret;
+    if (!(hdl->acc_mode & MAY_WRITE)) {
+        ret = -EBADF;
+        goto out;
+    }
+    if (hdl->is_dir) {
+        ret = -EISDIR;
+        goto out;
+    }
+    if (hdl->type == TYPE_PIPE || hdl->type == TYPE_SOCK) {
+        ret = -ESPIPE;
+        goto out;
+    }
+
+    struct shim_fs* fs = hdl->fs;
+    if (!fs || !fs->fs_ops || !fs->fs_ops->fallocate) {
+        ret = -ENODEV;
+        goto out;
+    }
+
+    ret = fs->fs_ops->fallocate(hdl, offset, len, mode & FALLOC_FL_KEEP_SIZE);
+out:
+    put_handle(hdl);
+    return ret;
+}
+
+/* The hints are only hints: filesystems without `advise` (and POSIX_FADV_NOREUSE, which is a no-op
+ * on Linux too) silently succeed. A length of 0 (or one past the maximum offset) means "up to the
+ * end of the file". */
+static int do_advise(struct shim_handle* hdl, loff_t offset, loff_t len, int advice) {
+    if (hdl->type == TYPE_PIPE || hdl->type == TYPE_SOCK)
+        return -ESPIPE;
+    if (hdl->is_dir || advice == POSIX_FADV_NOREUSE)
+        return 0;
+
+    struct shim_fs* fs = hdl->fs;
+    if (!fs || !fs->fs_ops || !fs->fs_ops->advise)
+        return 0;
+
+    loff_t end;
+    if (__builtin_add_overflow(offset, len, &end))
+        len = 0;
+
+    return fs->fs_ops->advise(hdl, offset, len, advice);
+}
+
+long shim_do_fadvise64(int fd, loff_t offset, loff_t len, int advice) {
+    if (advice < POSIX_FADV_NORMAL || advice > POSIX_FADV_NOREUSE)
+        return -EINVAL;
+    if (offset < 0 || len < 0)
+        return -EINVAL;
+
+    struct shim_handle* hdl = get_fd_handle(fd, NULL, NULL);
+    if (!hdl)
+        return -EBADF;
+
+    int ret = do_advise(hdl, offset, len, advice);
+    put_handle(hdl);
+    return ret;
+}
+
+long shim_do_readahead(int fd, loff_t offset, size_t count) {
+    if (offset < 0)
+        return -EINVAL;
+
+    struct shim_handle* hdl = get_fd_handle(fd, NULL, NULL);
+    if (!hdl)
+        return -EBADF;
+
+    int ret;
+    if (!(hdl->acc_mode & MAY_READ)) {
+        ret = -EBADF;
+        goto out;
+    }
+    if (hdl->is_dir || hdl->type == TYPE_PIPE || hdl->type == TYPE_SOCK) {
+        ret = -EINVAL;
+        goto out;
+    }
+
+    ret = do_advise(hdl, offset, (loff_t)MIN(count, (size_t)INT64_MAX), POSIX_FADV_WILLNEED);
+out:
+    put_handle(hdl);
+    return ret;
+}
+
 /* See also `do_getdents`. */
 static off_t do_lseek_dir(struct shim_handle* hdl, off_t offset, int origin) {
     assert(hdl->is_dir);
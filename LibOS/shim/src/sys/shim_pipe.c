@@ -2,7 +2,8 @@
 /* Copyright (C) 2014 Stony Brook University */
 
 /*
- * Implementation of system calls "pipe", "pipe2", "socketpair", "mknod", and "mknodat".
+ * Implementation of system calls "pipe", "pipe2", "socketpair", "mknod", "mknodat", "splice" and
+ * "vmsplice".
  */
 
 #include <asm/fcntl.h>
@@ -20,8 +21,8 @@
 #include "shim_utils.h"
 #include "stat.h"
 
-static int create_pipes(struct shim_handle* srv, struct shim_handle* cli, int flags, char* name,
-                        struct shim_qstr* qstr) {
+int create_pipes(struct shim_handle* srv, struct shim_handle* cli, int flags, char* name,
+                 struct shim_qstr* qstr) {
     int ret = 0;
     char uri[PIPE_URI_SIZE];
 
@@ -124,12 +125,20 @@ long shim_do_pipe2(int* filedes, int flags) {
     hdl1->info.pipe.ready_for_ops = true;
     hdl2->info.pipe.ready_for_ops = true;
 
-    ret = create_pipes(hdl1, hdl2, flags, hdl1->info.pipe.name, &hdl1->uri);
+    if (flags & O_NONBLOCK) {
+        hdl1->flags |= O_NONBLOCK;
+        hdl2->flags |= O_NONBLOCK;
+    }
+
+    /* both ends are in this process for now, so the pipe doesn't need the host until one of them is
+     * inherited by a child (see `migrate_pipe_ring`) */
+    ret = create_pipe_ring(hdl1, hdl2, /*dgram=*/false, &hdl1->info.pipe.ring);
     if (ret < 0)
         goto out;
-
+    hdl2->info.pipe.ring = hdl1->info.pipe.ring;
+    /* only has to tell pipes apart (e.g. in splice); replaced by the host pipe name on migration */
+    snprintf(hdl1->info.pipe.name, sizeof(hdl1->info.pipe.name), "ring:%p", hdl1->info.pipe.ring);
     memcpy(hdl2->info.pipe.name, hdl1->info.pipe.name, sizeof(hdl2->info.pipe.name));
-    qstrcopy(&hdl2->uri, &hdl1->uri);
 
     vfd1 = set_new_fd_handle(hdl1, flags & O_CLOEXEC ? FD_CLOEXEC : 0, NULL);
     if (vfd1 < 0) {
@@ -169,7 +178,8 @@ long shim_do_socketpair(int domain, int type, int protocol, int* sv) {
     if (domain != AF_UNIX)
         return -EAFNOSUPPORT;
 
-    if ((type & ~(SOCK_NONBLOCK | SOCK_CLOEXEC)) != SOCK_STREAM)
+    int sock_type = type & ~(SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (sock_type != SOCK_STREAM && sock_type != SOCK_DGRAM)
         return -EPROTONOSUPPORT;
 
     if (!is_user_memory_writable(sv, 2 * sizeof(int)))
@@ -186,7 +196,6 @@ long shim_do_socketpair(int domain, int type, int protocol, int* sv) {
         goto out;
     }
 
-
     hdl1->type = TYPE_SOCK;
     hdl1->fs = &socket_builtin_fs;
     hdl1->flags = O_RDONLY;
@@ -194,9 +203,9 @@ long shim_do_socketpair(int domain, int type, int protocol, int* sv) {
 
     struct shim_sock_handle* sock1 = &hdl1->info.sock;
     sock1->domain     = domain;
-    sock1->sock_type  = type & ~(SOCK_NONBLOCK | SOCK_CLOEXEC);
+    sock1->sock_type  = sock_type;
     sock1->protocol   = protocol;
-    sock1->sock_state = SOCK_ACCEPTED;
+    sock1->sock_state = sock_type == SOCK_STREAM ? SOCK_ACCEPTED : SOCK_CONNECTED;
 
     hdl2->type = TYPE_SOCK;
     hdl2->fs = &socket_builtin_fs;
@@ -205,17 +214,30 @@ long shim_do_socketpair(int domain, int type, int protocol, int* sv) {
 
     struct shim_sock_handle* sock2 = &hdl2->info.sock;
     sock2->domain     = domain;
-    sock2->sock_type  = type & ~(SOCK_NONBLOCK | SOCK_CLOEXEC);
+    sock2->sock_type  = sock_type;
     sock2->protocol   = protocol;
     sock2->sock_state = SOCK_CONNECTED;
 
-    ret = create_pipes(hdl1, hdl2, type & SOCK_NONBLOCK ? O_NONBLOCK : 0, sock1->addr.un.name,
-                       &hdl1->uri);
+    if (type & SOCK_NONBLOCK) {
+        hdl1->flags |= O_NONBLOCK;
+        hdl2->flags |= O_NONBLOCK;
+    }
+
+    /* one ring per direction; like pipes, they are moved to a host socketpair (a byte stream) only
+     * once either end is inherited by a child (see `migrate_sock_rings`) */
+    bool dgram = sock_type == SOCK_DGRAM;
+    ret = create_pipe_ring(/*reader=*/hdl1, /*writer=*/hdl2, dgram, &sock1->ring_in);
+    if (ret < 0)
+        goto out;
+    sock2->ring_out = sock1->ring_in;
+
+    ret = create_pipe_ring(/*reader=*/hdl2, /*writer=*/hdl1, dgram, &sock2->ring_in);
     if (ret < 0)
         goto out;
+    sock1->ring_out = sock2->ring_in;
 
+    snprintf(sock1->addr.un.name, sizeof(sock1->addr.un.name), "ring:%p", sock1->ring_in);
     memcpy(sock2->addr.un.name, sock1->addr.un.name, sizeof(sock2->addr.un.name));
-    qstrcopy(&hdl2->uri, &hdl1->uri);
 
     vfd1 = set_new_fd_handle(hdl1, type & SOCK_CLOEXEC ? FD_CLOEXEC : 0, NULL);
     if (vfd1 < 0) {
@@ -378,3 +400,171 @@ out:
 long shim_do_mknod(const char* pathname, mode_t mode, dev_t dev) {
     return shim_do_mknodat(AT_FDCWD, pathname, mode, dev);
 }
+
+#define SPLICE_F_MOVE     1 /* hint, ignored: pages are never moved */
+#define SPLICE_F_NONBLOCK 2
+#define SPLICE_F_MORE     4 /* hint, ignored */
+#define SPLICE_F_GIFT     8 /* hint, ignored */
+#define SPLICE_F_ALL      (SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE | SPLICE_F_GIFT)
+
+/* max number of bytes moved by one splice(); same as the default capacity of a Linux pipe */
+#define SPLICE_BUF_SIZE (64 * 1024)
+
+#define SPLICE_IOV_MAX 1024 /* UIO_MAXIOV */
+
+/* Reads or writes `hdl` at `*offset` (advancing it) if given, at the handle position otherwise */
+static ssize_t splice_rw(struct shim_handle* hdl, off_t* offset, void* buf, size_t count,
+                         bool is_write) {
+    struct shim_fs_ops* fs_ops = hdl->fs ? hdl->fs->fs_ops : NULL;
+    if (!fs_ops || (is_write ? !fs_ops->write : !fs_ops->read))
+        return -EINVAL;
+
+    off_t old_offset = 0;
+    if (offset) {
+        if (!fs_ops->seek)
+            return -ESPIPE;
+        old_offset = fs_ops->seek(hdl, 0, SEEK_CUR);
+        if (old_offset < 0)
+            return old_offset;
+        off_t ret = fs_ops->seek(hdl, *offset, SEEK_SET);
+        if (ret < 0)
+            return ret;
+    }
+
+    ssize_t ret = is_write ? fs_ops->write(hdl, buf, count) : fs_ops->read(hdl, buf, count);
+
+    if (offset) {
+        fs_ops->seek(hdl, old_offset, SEEK_SET);
+        if (ret > 0)
+            *offset += ret;
+    }
+    return ret;
+}
+
+/*
+ * Pipes are host streams (encrypted in the SGX PAL) rather than in-LibOS buffers, so there are no
+ * pages we could hand over: splice() is a read from `fd_in` followed by writing out everything that
+ * was read to `fd_out`, through a LibOS buffer. It saves the application the bounce through its own
+ * memory, but not the copies. If writing fails after the read, the data read is lost (Linux would
+ * leave it in the input pipe).
+ *
+ * SPLICE_F_NONBLOCK is only honored for the pipe ends which were already non-blocking.
+ */
+long shim_do_splice(int fd_in, loff_t* off_in, int fd_out, loff_t* off_out, size_t len,
+                    unsigned int flags) {
+    if (flags & ~SPLICE_F_ALL)
+        return -EINVAL;
+
+    if ((off_in && !is_user_memory_writable(off_in, sizeof(*off_in))) ||
+            (off_out && !is_user_memory_writable(off_out, sizeof(*off_out))))
+        return -EFAULT;
+
+    struct shim_handle* hdli = get_fd_handle(fd_in, NULL, NULL);
+    if (!hdli)
+        return -EBADF;
+
+    struct shim_handle* hdlo = get_fd_handle(fd_out, NULL, NULL);
+    if (!hdlo) {
+        put_handle(hdli);
+        return -EBADF;
+    }
+
+    void* buf = NULL;
+    ssize_t ret = -EBADF;
+    if (!(hdli->acc_mode & MAY_READ) || !(hdlo->acc_mode & MAY_WRITE))
+        goto out;
+
+    ret = -EINVAL;
+    if (hdli->type != TYPE_PIPE && hdlo->type != TYPE_PIPE)
+        goto out;
+
+    if ((hdlo->flags & O_APPEND) ||
+            (hdli->type == TYPE_PIPE && hdlo->type == TYPE_PIPE &&
+             !strcmp(hdli->info.pipe.name, hdlo->info.pipe.name)))
+        goto out;
+
+    ret = -ESPIPE;
+    if ((off_in && hdli->type == TYPE_PIPE) || (off_out && hdlo->type == TYPE_PIPE))
+        goto out;
+
+    ret = -EINVAL;
+    if ((off_in && *off_in < 0) || (off_out && *off_out < 0))
+        goto out;
+
+    ret = 0;
+    if (!len)
+        goto out;
+
+    size_t buf_size = MIN(len, (size_t)SPLICE_BUF_SIZE);
+    buf = malloc(buf_size);
+    if (!buf) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    off_t offi = off_in ? *off_in : 0;
+    off_t offo = off_out ? *off_out : 0;
+
+    ret = splice_rw(hdli, off_in ? &offi : NULL, buf, buf_size, /*is_write=*/false);
+    if (ret <= 0)
+        goto out;
+
+    size_t to_write = ret;
+    size_t written  = 0;
+    while (written < to_write) {
+        ret = splice_rw(hdlo, off_out ? &offo : NULL, buf + written, to_write - written,
+                        /*is_write=*/true);
+        if (ret == -EINTR || ret == -EAGAIN) {
+            /* the data is already consumed from the input, so we have to wait until it fits */
+            DkThreadYieldExecution();
+            continue;
+        }
+        if (ret <= 0)
+            break;
+        written += ret;
+    }
+
+    if (written) {
+        if (off_in)
+            *off_in = offi;
+        if (off_out)
+            *off_out = offo;
+        ret = written;
+    } else if (ret == 0) {
+        ret = -EIO;
+    }
+
+out:
+    free(buf);
+    put_handle(hdli);
+    put_handle(hdlo);
+    if (ret == -EINTR) {
+        ret = -ERESTARTSYS;
+    }
+    return ret;
+}
+
+/* Without in-LibOS pipe buffers, vmsplice() can't map user pages into the pipe: it copies them like
+ * writev() on the write end (and like readv() on the read end, as Linux also allows). */
+long shim_do_vmsplice(int fd, const struct iovec* iov, unsigned long nr_segs, unsigned int flags) {
+    if (flags & ~SPLICE_F_ALL)
+        return -EINVAL;
+
+    if (nr_segs > SPLICE_IOV_MAX)
+        return -EINVAL;
+
+    struct shim_handle* hdl = get_fd_handle(fd, NULL, NULL);
+    if (!hdl)
+        return -EBADF;
+
+    int type = hdl->type;
+    int acc_mode = hdl->acc_mode;
+    put_handle(hdl);
+
+    if (type != TYPE_PIPE)
+        return -EBADF;
+
+    if (acc_mode & MAY_WRITE)
+        return shim_do_writev(fd, iov, (int)nr_segs);
+    return shim_do_readv(fd, iov, (int)nr_segs);
+}
@@ -45,38 +45,58 @@ typedef unsigned long __fd_mask;
 
 #define POLL_NOTIMEOUT ((uint64_t)-1)
 
-static long _shim_do_poll(struct pollfd* fds, nfds_t nfds, int timeout_ms) {
-    if ((uint64_t)nfds > get_rlimit_cur(RLIMIT_NOFILE))
-        return -EINVAL;
+/* Scratch buffers larger than this are freed after the call instead of being kept by the thread. */
+#define POLL_SCRATCH_MAX_KEEP (64 * 1024)
+
+#define NO_PAL_IDX ((nfds_t)-1)
+
+/* for bookkeeping, need to have a mapping FD -> {shim handle, index-in-pals} */
+struct fds_mapping_t {
+    struct shim_handle* hdl; /* NULL if no mapping (handle is not used in polling) */
+    nfds_t idx;              /* index from fds array to pals array, or NO_PAL_IDX */
+    nfds_t wr_idx;           /* index of `hdl->pal_wr_handle` in pals array, or NO_PAL_IDX */
+};
+
+/* size of the scratch memory needed by `_shim_do_poll` */
+static size_t poll_scratch_size(nfds_t nfds) {
+    /* every FD may need two PAL handles (see `pal_wr_handle`), 2 * nfds is the upper limit for
+     * actual number of handles; PAL_FLG arrays are events and revents */
+    return nfds * (2 * sizeof(PAL_HANDLE) + sizeof(struct fds_mapping_t) + 4 * sizeof(PAL_FLG));
+}
 
-    struct shim_handle_map* map = get_cur_thread()->handle_map;
+/* Return the thread's scratch buffer, grown to at least `size` bytes. Event loops call poll/select
+ * with the same FD sets over and over, so after the first few calls this doesn't allocate. */
+static void* get_poll_scratch(struct shim_thread* thread, size_t size) {
+    if (thread->poll_scratch.size < size) {
+        void* buf = malloc(size);
+        if (!buf)
+            return NULL;
+        free(thread->poll_scratch.buf);
+        thread->poll_scratch.buf  = buf;
+        thread->poll_scratch.size = size;
+    }
+    return thread->poll_scratch.buf;
+}
 
-    uint64_t timeout_us = timeout_ms < 0 ? POLL_NOTIMEOUT : timeout_ms * 1000ULL;
+static void put_poll_scratch(struct shim_thread* thread) {
+    /* don't keep buffers of one-off huge polls for the whole lifetime of the thread */
+    if (thread->poll_scratch.size > POLL_SCRATCH_MAX_KEEP) {
+        free(thread->poll_scratch.buf);
+        thread->poll_scratch.buf  = NULL;
+        thread->poll_scratch.size = 0;
+    }
+}
 
-    /* nfds is the upper limit for actual number of handles */
-    PAL_HANDLE* pals = malloc(nfds * sizeof(PAL_HANDLE));
-    if (!pals)
-        return -ENOMEM;
+/* `scratch` must have at least `poll_scratch_size(nfds)` bytes, suitably aligned for pointers */
+static long _shim_do_poll(struct pollfd* fds, nfds_t nfds, int timeout_ms, void* scratch) {
+    struct shim_handle_map* map = get_cur_thread()->handle_map;
 
-    /* for bookkeeping, need to have a mapping FD -> {shim handle, index-in-pals} */
-    struct fds_mapping_t {
-        struct shim_handle* hdl; /* NULL if no mapping (handle is not used in polling) */
-        nfds_t idx;              /* index from fds array to pals array */
-    };
-    struct fds_mapping_t* fds_mapping = malloc(nfds * sizeof(struct fds_mapping_t));
-    if (!fds_mapping) {
-        free(pals);
-        return -ENOMEM;
-    }
+    uint64_t timeout_us = timeout_ms < 0 ? POLL_NOTIMEOUT : timeout_ms * 1000ULL;
 
-    /* allocate one memory region to hold two PAL_FLG arrays: events and revents */
-    PAL_FLG* pal_events = malloc(nfds * sizeof(PAL_FLG) * 2);
-    if (!pal_events) {
-        free(pals);
-        free(fds_mapping);
-        return -ENOMEM;
-    }
-    PAL_FLG* ret_events = pal_events + nfds;
+    PAL_HANDLE* pals = scratch;
+    struct fds_mapping_t* fds_mapping = (struct fds_mapping_t*)(pals + 2 * nfds);
+    PAL_FLG* pal_events = (PAL_FLG*)(fds_mapping + nfds);
+    PAL_FLG* ret_events = pal_events + 2 * nfds;
 
     nfds_t pal_cnt  = 0;
     nfds_t nrevents = 0;
@@ -123,6 +143,12 @@ static long _shim_do_poll(struct pollfd* fds, nfds_t nfds, int timeout_ms) {
             continue;
         }
 
+        if (prepare_handle_poll(hdl) < 0) {
+            fds[i].revents = POLLERR;
+            nrevents++;
+            continue;
+        }
+
         PAL_FLG allowed_events = 0;
         if ((fds[i].events & (POLLIN | POLLRDNORM)) && (hdl->acc_mode & MAY_READ))
             allowed_events |= PAL_WAIT_READ;
@@ -137,12 +163,28 @@ static long _shim_do_poll(struct pollfd* fds, nfds_t nfds, int timeout_ms) {
         }
 
         get_handle(hdl);
-        fds_mapping[i].hdl = hdl;
-        fds_mapping[i].idx = pal_cnt;
-        pals[pal_cnt] = hdl->pal_handle;
-        pal_events[pal_cnt] = allowed_events;
-        ret_events[pal_cnt] = 0;
-        pal_cnt++;
+        fds_mapping[i].hdl    = hdl;
+        fds_mapping[i].idx    = NO_PAL_IDX;
+        fds_mapping[i].wr_idx = NO_PAL_IDX;
+
+        PAL_HANDLE pal_wr_handle = hdl->pal_wr_handle;
+        if (pal_wr_handle && (allowed_events & PAL_WAIT_WRITE)) {
+            /* write readiness is signalled by `pal_wr_handle` becoming readable */
+            fds_mapping[i].wr_idx = pal_cnt;
+            pals[pal_cnt] = pal_wr_handle;
+            pal_events[pal_cnt] = PAL_WAIT_READ;
+            ret_events[pal_cnt] = 0;
+            pal_cnt++;
+            allowed_events &= ~PAL_WAIT_WRITE;
+        }
+
+        if (!pal_wr_handle || allowed_events) {
+            fds_mapping[i].idx = pal_cnt;
+            pals[pal_cnt] = hdl->pal_handle;
+            pal_events[pal_cnt] = allowed_events;
+            ret_events[pal_cnt] = 0;
+            pal_cnt++;
+        }
     }
 
     unlock(&map->lock);
@@ -150,7 +192,12 @@ static long _shim_do_poll(struct pollfd* fds, nfds_t nfds, int timeout_ms) {
     bool polled = false;
     long error = 0;
     if (pal_cnt) {
+        /* a thread blocked in the host does not use CPU time */
+        if (timeout_us)
+            thread_cputime_pause();
         error = DkStreamsWaitEvents(pal_cnt, pals, pal_events, ret_events, timeout_us);
+        if (timeout_us)
+            thread_cputime_resume();
         polled = error == 0;
         error = pal_to_unix_errno(error);
     }
@@ -161,12 +208,19 @@ static long _shim_do_poll(struct pollfd* fds, nfds_t nfds, int timeout_ms) {
 
         /* update fds.revents, but only if something was actually polled */
         if (polled) {
+            PAL_FLG events = 0;
+            if (fds_mapping[i].idx != NO_PAL_IDX)
+                events = ret_events[fds_mapping[i].idx];
+            if (fds_mapping[i].wr_idx != NO_PAL_IDX
+                    && (ret_events[fds_mapping[i].wr_idx] & PAL_WAIT_READ))
+                events |= PAL_WAIT_WRITE;
+
             fds[i].revents = 0;
-            if (ret_events[fds_mapping[i].idx] & PAL_WAIT_ERROR)
+            if (events & PAL_WAIT_ERROR)
                 fds[i].revents |= POLLERR | POLLHUP;
-            if (ret_events[fds_mapping[i].idx] & PAL_WAIT_READ)
+            if (events & PAL_WAIT_READ)
                 fds[i].revents |= fds[i].events & (POLLIN | POLLRDNORM);
-            if (ret_events[fds_mapping[i].idx] & PAL_WAIT_WRITE)
+            if (events & PAL_WAIT_WRITE)
                 fds[i].revents |= fds[i].events & (POLLOUT | POLLWRNORM);
 
             if (fds[i].revents)
@@ -176,10 +230,6 @@ static long _shim_do_poll(struct pollfd* fds, nfds_t nfds, int timeout_ms) {
         put_handle(fds_mapping[i].hdl);
     }
 
-    free(pals);
-    free(pal_events);
-    free(fds_mapping);
-
     if (error == -EAGAIN) {
         /* `poll` returns 0 on timeout. */
         error = 0;
@@ -191,11 +241,25 @@ static long _shim_do_poll(struct pollfd* fds, nfds_t nfds, int timeout_ms) {
     return nrevents ? (long)nrevents : error;
 }
 
+long do_poll(struct pollfd* fds, nfds_t nfds, int timeout_ms) {
+    struct shim_thread* cur = get_cur_thread();
+    void* scratch = get_poll_scratch(cur, poll_scratch_size(nfds));
+    if (!scratch)
+        return -ENOMEM;
+
+    long ret = _shim_do_poll(fds, nfds, timeout_ms, scratch);
+    put_poll_scratch(cur);
+    return ret;
+}
+
 long shim_do_poll(struct pollfd* fds, nfds_t nfds, int timeout_ms) {
     if (!is_user_memory_writable(fds, sizeof(*fds) * nfds))
         return -EFAULT;
 
-    return _shim_do_poll(fds, nfds, timeout_ms);
+    if ((uint64_t)nfds > get_rlimit_cur(RLIMIT_NOFILE))
+        return -EINVAL;
+
+    return do_poll(fds, nfds, timeout_ms);
 }
 
 long shim_do_ppoll(struct pollfd* fds, int nfds, struct timespec* tsp, const __sigset_t* sigmask,
@@ -228,10 +292,14 @@ long shim_do_select(int nfds, fd_set* readfds, fd_set* writefds, fd_set* errorfd
         nfds = __NFDBITS;
     }
 
-    /* nfds is the upper limit for actual number of fds for poll */
-    struct pollfd* fds_poll = malloc(nfds * sizeof(struct pollfd));
+    /* nfds is the upper limit for actual number of fds for poll; the scratch memory of poll itself
+     * follows the array of pollfd's */
+    struct shim_thread* cur = get_cur_thread();
+    size_t fds_poll_size = ALIGN_UP(nfds * sizeof(struct pollfd), sizeof(void*));
+    struct pollfd* fds_poll = get_poll_scratch(cur, fds_poll_size + poll_scratch_size(nfds));
     if (!fds_poll)
         return -ENOMEM;
+    void* poll_scratch = (char*)fds_poll + fds_poll_size;
 
     /* populate array of pollfd's based on user-supplied readfds & writefds */
     nfds_t nfds_poll = 0;
@@ -253,26 +321,24 @@ long shim_do_select(int nfds, fd_set* readfds, fd_set* writefds, fd_set* errorfd
 
     /* select()/pselect() return -EBADF if invalid FD was given by user in readfds/writefds;
      * note that poll()/ppoll() don't have this error code, so we return this code only here */
-    struct shim_handle_map* map = get_cur_thread()->handle_map;
+    struct shim_handle_map* map = cur->handle_map;
+    long ret;
     lock(&map->lock);
     for (nfds_t i = 0; i < nfds_poll; i++) {
         struct shim_handle* hdl = __get_fd_handle(fds_poll[i].fd, NULL, map);
         if (!hdl || !hdl->fs || !hdl->fs->fs_ops) {
             /* the corresponding handle doesn't exist or doesn't provide FS-like semantics */
-            free(fds_poll);
             unlock(&map->lock);
-            return -EBADF;
+            ret = -EBADF;
+            goto out;
         }
     }
     unlock(&map->lock);
 
     uint64_t timeout_ms = tsv ? tsv->tv_sec * 1000ULL + tsv->tv_usec / 1000 : POLL_NOTIMEOUT;
-    long ret = _shim_do_poll(fds_poll, nfds_poll, timeout_ms);
-
-    if (ret < 0) {
-        free(fds_poll);
-        return ret;
-    }
+    ret = _shim_do_poll(fds_poll, nfds_poll, timeout_ms, poll_scratch);
+    if (ret < 0)
+        goto out;
 
     /* modify readfds, writefds, and errorfds in-place with returned events */
     if (readfds)
@@ -298,7 +364,8 @@ long shim_do_select(int nfds, fd_set* readfds, fd_set* writefds, fd_set* errorfd
         }
     }
 
-    free(fds_poll);
+out:
+    put_poll_scratch(cur);
     return ret;
 }
 
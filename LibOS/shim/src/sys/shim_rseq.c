@@ -0,0 +1,120 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * Implementation of system call "rseq".
+ *
+ * The `cpu_id` of a registered area follows getcpu(), i.e. the CPU recorded by sched_setaffinity()
+ * (see `struct shim_tcb`), and is refreshed whenever the thread goes back from LibOS to the
+ * application. A critical section is restarted on the events LibOS sees: delivery of a signal and
+ * an interrupt of the thread (e.g. by membarrier() or by sched_setaffinity() of another thread).
+ * LibOS cannot see the host preempting or migrating a thread, so per-CPU data protected by rseq is
+ * consistent only among threads pinned to distinct CPUs.
+ */
+
+#include <errno.h>
+
+#include "shim_internal.h"
+#include "shim_table.h"
+#include "shim_tcb.h"
+#include "shim_thread.h"
+
+static void rseq_write_cpu(struct shim_thread* thread, struct rseq* area, int cpu) {
+    __atomic_store_n(&area->cpu_id_start, (uint32_t)cpu, __ATOMIC_RELAXED);
+    __atomic_store_n(&area->cpu_id, (uint32_t)cpu, __ATOMIC_RELAXED);
+    thread->rseq.cpu = cpu;
+}
+
+static noreturn void rseq_fault(struct rseq* area) {
+    log_error("rseq: invalid area %p or critical section descriptor, killing the process\n", area);
+    process_exit(0, SIGSEGV);
+}
+
+void rseq_update_cpu(void) {
+    struct shim_thread* cur_thread = get_cur_thread();
+    struct rseq* area = cur_thread->rseq.area;
+    if (!area)
+        return;
+
+    int cpu = SHIM_TCB_GET(cpu);
+    if (cur_thread->rseq.cpu == cpu)
+        return;
+    if (!is_user_memory_writable(area, sizeof(*area)))
+        rseq_fault(area);
+    rseq_write_cpu(cur_thread, area, cpu);
+}
+
+void rseq_handle_interrupt(PAL_CONTEXT* context) {
+    struct shim_thread* cur_thread = get_cur_thread();
+    struct rseq* area = cur_thread->rseq.area;
+    if (!area)
+        return;
+
+    if (!is_user_memory_writable(area, sizeof(*area)))
+        rseq_fault(area);
+    uint64_t* rseq_cs = &area->rseq_cs;
+    uint64_t cs_addr = __atomic_load_n(rseq_cs, __ATOMIC_RELAXED);
+    if (cs_addr) {
+        struct rseq_cs cs;
+        if (!is_user_memory_readable((void*)cs_addr, sizeof(cs)))
+            rseq_fault(area);
+        memcpy(&cs, (void*)cs_addr, sizeof(cs));
+
+        uint64_t ip = pal_context_get_ip(context);
+        if (ip - cs.start_ip < cs.post_commit_offset) {
+            /* the abort handler must be outside of the critical section and preceded by the
+             * signature given at registration */
+            uint32_t* sig = (uint32_t*)(cs.abort_ip - sizeof(*sig));
+            if (cs.version != 0 || cs.abort_ip - cs.start_ip < cs.post_commit_offset
+                    || !is_user_memory_readable(sig, sizeof(*sig))
+                    || *sig != cur_thread->rseq.sig)
+                rseq_fault(area);
+            pal_context_set_ip(context, cs.abort_ip);
+        }
+        __atomic_store_n(rseq_cs, 0, __ATOMIC_RELAXED);
+    }
+
+    int cpu = SHIM_TCB_GET(cpu);
+    if (cur_thread->rseq.cpu != cpu)
+        rseq_write_cpu(cur_thread, area, cpu);
+}
+
+long shim_do_rseq(struct rseq* rseq, uint32_t rseq_len, int flags, uint32_t sig) {
+    struct shim_thread* cur_thread = get_cur_thread();
+    struct rseq* area = cur_thread->rseq.area;
+
+    if (flags & ~RSEQ_FLAG_UNREGISTER)
+        return -EINVAL;
+
+    if (flags & RSEQ_FLAG_UNREGISTER) {
+        if (!area || area != rseq || rseq_len != sizeof(*rseq))
+            return -EINVAL;
+        if (sig != cur_thread->rseq.sig)
+            return -EPERM;
+        if (!is_user_memory_writable(rseq, sizeof(*rseq)))
+            return -EFAULT;
+        __atomic_store_n(&rseq->cpu_id_start, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&rseq->cpu_id, (uint32_t)RSEQ_CPU_ID_UNINITIALIZED, __ATOMIC_RELAXED);
+        __atomic_store_n(&cur_thread->rseq.area, NULL, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    if (area) {
+        if (area != rseq || rseq_len != sizeof(*rseq))
+            return -EINVAL;
+        if (sig != cur_thread->rseq.sig)
+            return -EPERM;
+        return -EBUSY;
+    }
+
+    if (!IS_ALIGNED_PTR(rseq, __alignof__(*rseq)) || rseq_len != sizeof(*rseq))
+        return -EINVAL;
+    if (!is_user_memory_writable(rseq, sizeof(*rseq)))
+        return -EFAULT;
+
+    cur_thread->rseq.sig = sig;
+    rseq_write_cpu(cur_thread, rseq, SHIM_TCB_GET(cpu));
+    /* read by sched_setaffinity() of other threads */
+    __atomic_store_n(&cur_thread->rseq.area, rseq, __ATOMIC_RELAXED);
+    return 0;
+}
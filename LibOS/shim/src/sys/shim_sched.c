@@ -13,13 +13,26 @@
 #include <linux/sched.h>
 
 #include "api.h"
+#include "hex.h"
 #include "pal.h"
 #include "shim_internal.h"
+#include "shim_lock.h"
 #include "shim_table.h"
 #include "shim_thread.h"
 
 long shim_do_sched_yield(void) {
-    DkThreadYieldExecution();
+    struct shim_thread* cur_thread = get_cur_thread();
+    if (!cur_thread->uthread.enabled) {
+        /* Yielding the host CPU costs an exit from the enclave on SGX and is useless if each thread
+         * that is not blocked (including this one) can have a CPU of its own, like sched_yield() on
+         * Linux returns immediately with an empty run queue. User-level threads always yield, it is
+         * cheap and their carrier may have other threads to run. */
+        uint32_t runnable = __atomic_load_n(&g_app_threads_cnt, __ATOMIC_RELAXED)
+                            - __atomic_load_n(&g_waiting_threads_cnt, __ATOMIC_RELAXED);
+        if ((int32_t)runnable <= (int32_t)g_pal_control->cpu_info.online_logical_cores)
+            return 0;
+    }
+    thread_yield();
     return 0;
 }
 
@@ -140,6 +153,57 @@ long shim_do_sched_rr_get_interval(pid_t pid, struct timespec* interval) {
     return 0;
 }
 
+/* checks if `cpu` is set in a "cpumap" sysfs string (comma-separated 32-bit hex words, most
+ * significant first, e.g. "00000000,00ff00ff") */
+static bool cpumap_has_cpu(const char* cpumap, size_t cpu) {
+    size_t digit_idx = cpu / 4;
+    for (size_t i = strlen(cpumap); i > 0; i--) {
+        int8_t digit = hex2dec(cpumap[i - 1]);
+        if (digit < 0)
+            continue; /* comma or newline */
+        if (digit_idx-- == 0)
+            return digit & (1 << (cpu % 4));
+    }
+    return false;
+}
+
+static int cpu_to_numa_node(size_t cpu) {
+    const PAL_TOPO_INFO* topo_info = &g_pal_control->topo_info;
+    for (size_t node = 0; node < topo_info->num_online_nodes; node++)
+        if (cpumap_has_cpu(topo_info->numa_topology[node].cpumap, cpu))
+            return (int)node;
+    return 0;
+}
+
+/* Records the first CPU allowed by `mask` (and its NUMA node) in the TCB of `thread`. The TCB of
+ * another thread is valid only until the thread drops its TCB reference in thread_exit(), which is
+ * done under `thread->lock`. */
+static void record_thread_placement(struct shim_thread* thread, const unsigned long* mask,
+                                    size_t mask_size) {
+    size_t cpu_cnt = MIN(mask_size * BITS_IN_BYTE, g_pal_control->cpu_info.online_logical_cores);
+    size_t cpu = 0;
+    while (cpu < cpu_cnt && !(mask[cpu / BITS_IN_TYPE(long)] & (1UL << (cpu % BITS_IN_TYPE(long)))))
+        cpu++;
+    if (cpu == cpu_cnt)
+        return;
+    int numa_node = cpu_to_numa_node(cpu);
+
+    lock(&thread->lock);
+    shim_tcb_t* tcb = thread->shim_tcb;
+    if (tcb && tcb->tp == thread) {
+        __atomic_store_n(&tcb->cpu, (int)cpu, __ATOMIC_RELAXED);
+        __atomic_store_n(&tcb->numa_node, numa_node, __ATOMIC_RELAXED);
+    }
+    /* a user-level thread not running right now gets them on its next switch to a carrier */
+    thread->uthread.cpu       = (int)cpu;
+    thread->uthread.numa_node = numa_node;
+    /* let a thread with an rseq area notice the migration, see shim_rseq.c */
+    if (thread != get_cur_thread() && __atomic_load_n(&thread->rseq.area, __ATOMIC_RELAXED)
+            && thread->pal_handle)
+        (void)DkThreadResume(thread->pal_handle);
+    unlock(&thread->lock);
+}
+
 long shim_do_sched_setaffinity(pid_t pid, unsigned int cpumask_size, unsigned long* user_mask_ptr) {
     int ret;
 
@@ -169,6 +233,7 @@ long shim_do_sched_setaffinity(pid_t pid, unsigned int cpumask_size, unsigned lo
         return pal_to_unix_errno(ret);
     }
 
+    record_thread_placement(thread, user_mask_ptr, cpumask_size);
     put_thread(thread);
     return 0;
 }
@@ -222,7 +287,8 @@ long shim_do_sched_getaffinity(pid_t pid, unsigned int cpumask_size, unsigned lo
     return bitmask_size_in_bytes;
 }
 
-/* dummy implementation: always return cpu0  */
+/* returns the CPU and node recorded by sched_setaffinity() (see `struct shim_tcb`), i.e. cpu0 for
+ * threads that were never pinned */
 long shim_do_getcpu(unsigned* cpu, unsigned* node, struct getcpu_cache* unused) {
     __UNUSED(unused);
 
@@ -230,14 +296,14 @@ long shim_do_getcpu(unsigned* cpu, unsigned* node, struct getcpu_cache* unused)
         if (!is_user_memory_writable(cpu, sizeof(*cpu))) {
             return -EFAULT;
         }
-        *cpu = 0;
+        *cpu = SHIM_TCB_GET(cpu);
     }
 
     if (node) {
         if (!is_user_memory_writable(node, sizeof(*node))) {
             return -EFAULT;
         }
-        *node = 0;
+        *node = shim_get_numa_node();
     }
 
     return 0;
@@ -16,6 +16,7 @@
 #include "shim_lock.h"
 #include "shim_sysv.h"
 #include "shim_table.h"
+#include "shim_thread.h"
 #include "shim_utils.h"
 
 #define SEM_HASH_LEN  8
@@ -74,12 +75,6 @@ static int __add_sem_handle(unsigned long key, IDTYPE semid, int nsems, bool own
     tmp->semid  = semid;
     tmp->owned  = owned;
 
-    ret = DkEventCreate(&tmp->event, /*init_signaled=*/false, /*auto_clear=*/false);
-    if (ret < 0) {
-        ret = pal_to_unix_errno(ret);
-        goto failed;
-    }
-
     if (owned && nsems) {
         tmp->nsems = nsems;
         tmp->sems  = malloc(sizeof(struct sem_obj) * nsems);
@@ -426,7 +421,6 @@ out:
 
 static bool __handle_sysv_sems(struct shim_sem_handle* sem) {
     bool progressed = false;
-    bool setevent   = false;
 
     struct sem_obj* sobj;
     for (sobj = sem->sems; sobj < &sem->sems[sem->nsems]; sobj++)
@@ -492,7 +486,8 @@ static bool __handle_sysv_sems(struct shim_sem_handle* sem) {
             LISTP_DEL_INIT(sops, &sobj->ops, progress);
             sem->nreqs--;
             if (!sops->client.vmid) {
-                setevent = true;
+                if (sops->thread)
+                    thread_wakeup(sops->thread);
                 continue;
             }
 
@@ -512,9 +507,6 @@ static bool __handle_sysv_sems(struct shim_sem_handle* sem) {
         }
     }
 
-    if (setevent)
-        DkEventSet(sem->event);
-
     return progressed;
 }
 
@@ -687,7 +679,8 @@ int submit_sysv_sem(struct shim_sem_handle* sem, struct sembuf* sops, int nsops,
         }
     }
 
-    sem_ops->stat = stat;
+    sem_ops->stat   = stat;
+    sem_ops->thread = client ? NULL : get_cur_thread();
     for (int i = 0; i < nsops; i++) {
         sem_ops->ops[i] = sops[i];
     }
@@ -714,8 +707,11 @@ int submit_sysv_sem(struct shim_sem_handle* sem, struct sembuf* sops, int nsops,
             goto unowned;
         }
 
+        /* woken up by `__handle_sysv_sems` once our operations complete; preparing before
+         * unlocking makes sure that the wakeup isn't lost */
+        thread_prepare_wait();
         unlock(&hdl->lock);
-        object_wait_with_retry(sem->event);
+        thread_wait(/*timeout_us=*/NULL, /*ignore_pending_signals=*/true);
         lock(&hdl->lock);
     }
 
@@ -223,6 +223,8 @@ long shim_do_rt_sigsuspend(const __sigset_t* mask_ptr, size_t setsize) {
 
     SHIM_TCB_SET(context.syscall_nr, -1);
     SHIM_TCB_SET(context.regs, NULL);
+    rseq_update_cpu();
+    shim_tcb_set_in_libos(false);
     return_from_syscall(context);
 }
 
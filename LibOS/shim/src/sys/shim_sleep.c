@@ -11,6 +11,7 @@
 #include "shim_table.h"
 #include "shim_thread.h"
 #include "shim_utils.h"
+#include "toml.h"
 
 long shim_do_pause(void) {
     thread_prepare_wait();
@@ -22,8 +23,61 @@ long shim_do_pause(void) {
     return -ERESTARTNOHAND;
 }
 
+/* sleeps shorter than this are busy-waited (`libos.spin_sleep_threshold_us`) */
+static uint64_t g_spin_sleep_threshold_us = 0;
+
+int init_sleep(void) {
+    int64_t threshold_us = 0;
+    int ret = toml_int_in(g_manifest_root, "libos.spin_sleep_threshold_us", /*defaultval=*/0,
+                          &threshold_us);
+    if (ret < 0 || threshold_us < 0) {
+        log_error("Cannot parse 'libos.spin_sleep_threshold_us' (the value must be a non-negative "
+                  "number)\n");
+        return -EINVAL;
+    }
+    g_spin_sleep_threshold_us = threshold_us;
+    return 0;
+}
+
+/*
+ * Waits for `*timeout_us` without blocking the host thread, by polling the time. This is cheaper
+ * than a host sleep for the very short sleeps of spinning code: on SGX, DkSystemTimeQuery() reads
+ * the TSC inside the enclave, while a host sleep costs an enclave exit and a wake-up by the host
+ * scheduler, which alone takes tens of microseconds. Returns 0 or -EINTR with the remaining time in
+ * `*timeout_us`.
+ */
+static int spin_sleep(uint64_t* timeout_us) {
+    uint64_t start_us = 0;
+    int ret = DkSystemTimeQuery(&start_us);
+    if (ret < 0)
+        return pal_to_unix_errno(ret);
+
+    uint64_t now_us = start_us;
+    while (now_us - start_us < *timeout_us) {
+        if (have_pending_signals()) {
+            *timeout_us -= now_us - start_us;
+            return -EINTR;
+        }
+        CPU_RELAX();
+        ret = DkSystemTimeQuery(&now_us);
+        if (ret < 0)
+            return pal_to_unix_errno(ret);
+    }
+    *timeout_us = 0;
+    return 0;
+}
+
 int do_nanosleep(uint64_t timeout_us, struct __kernel_timespec* rem) {
     int ret = -EINTR;
+    /* user-level threads do not block the host thread when sleeping, spinning would only keep
+     * other threads from running on the carrier */
+    if (timeout_us < g_spin_sleep_threshold_us && !get_cur_thread()->uthread.enabled) {
+        ret = spin_sleep(&timeout_us);
+        if (ret != -EINTR && ret != 0)
+            return ret;
+        goto out;
+    }
+
     thread_prepare_wait();
     while (!have_pending_signals()) {
         ret = thread_wait(&timeout_us, /*ignore_pending_signals=*/false);
@@ -40,6 +94,7 @@ int do_nanosleep(uint64_t timeout_us, struct __kernel_timespec* rem) {
      * to a function to be called instead of restarting the syscall.
      */
 
+out:
     if (rem) {
         rem->tv_sec = timeout_us / TIME_US_IN_S;
         rem->tv_nsec = (timeout_us % TIME_US_IN_S) * TIME_NS_IN_US;
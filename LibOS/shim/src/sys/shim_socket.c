@@ -503,6 +503,11 @@ long shim_do_bind(int sockfd, struct sockaddr* addr, int _addrlen) {
         /* application requests IPV6_V6ONLY, this socket is not dual-stack */
         create_flags &= ~PAL_CREATE_DUALSTACK;
     }
+    if (sock->reuseport && (sock->domain == AF_INET || sock->domain == AF_INET6)) {
+        /* each process binding the address gets its own host socket, and the host kernel
+         * balances the incoming connections (or datagrams) between them */
+        create_flags |= PAL_CREATE_REUSEPORT;
+    }
 
     PAL_HANDLE pal_hdl = NULL;
     ret = DkStreamOpen(qstrgetstr(&hdl->uri), 0, 0, create_flags,
@@ -1047,8 +1052,12 @@ static ssize_t do_sendmsg(int fd, struct iovec* bufs, int nbufs, int flags,
 
     lock(&hdl->lock);
 
+    bool nonblocking = hdl->flags & O_NONBLOCK;
     if (flags & MSG_DONTWAIT) {
-        if (!(hdl->flags & O_NONBLOCK)) {
+        if (pipe_ring_active(sock->ring_out)) {
+            /* in-LibOS socketpairs support it */
+            nonblocking = true;
+        } else if (!(hdl->flags & O_NONBLOCK)) {
             log_warning("MSG_DONTWAIT on blocking socket is ignored, may lead to a write that "
                         "unexpectedly blocks.\n");
         }
@@ -1122,26 +1131,44 @@ static ssize_t do_sendmsg(int fd, struct iovec* bufs, int nbufs, int flags,
     int bytes = 0;
     ret = 0;
 
-    for (int i = 0; i < nbufs; i++) {
-        size_t this_size = bufs[i].iov_len;
-        ret = DkStreamWrite(pal_hdl, 0, &this_size, bufs[i].iov_base, uri);
-        ret = ret == -PAL_ERROR_STREAMEXIST ? -ECONNABORTED : pal_to_unix_errno(ret);
-        maybe_epoll_et_trigger(hdl, ret, /*in=*/false, !ret ? this_size < bufs[i].iov_len : false);
-        if (ret < 0) {
-            if (ret == -EPIPE && !(flags & MSG_NOSIGNAL)) {
-                siginfo_t info = {
-                    .si_signo = SIGPIPE,
-                    .si_pid = g_process.pid,
-                    .si_code = SI_USER,
-                };
-                if (kill_current_proc(&info) < 0) {
-                    log_error("do_sendmsg: failed to deliver a signal\n");
-                }
-            }
-            break;
+    size_t total = 0;
+    for (int i = 0; i < nbufs; i++)
+        total += bufs[i].iov_len;
+
+    ssize_t coalesced;
+    if (!uri && sock_ring_writev(hdl, bufs, nbufs, total, nonblocking, &coalesced)) {
+        /* one message for all buffers, boundaries of datagrams are kept */
+        ret = coalesced < 0 ? coalesced : 0;
+        if (coalesced > 0)
+            bytes = coalesced;
+    } else if (!uri && sock_coalesce_write(hdl, bufs, nbufs, total, &coalesced)) {
+        ret = coalesced < 0 ? coalesced : 0;
+        maybe_epoll_et_trigger(hdl, ret, /*in=*/false, !ret ? (size_t)coalesced < total : false);
+        if (coalesced > 0)
+            bytes = coalesced;
+    } else {
+        for (int i = 0; i < nbufs; i++) {
+            size_t this_size = bufs[i].iov_len;
+            ret = DkStreamWrite(pal_hdl, 0, &this_size, bufs[i].iov_base, uri);
+            ret = ret == -PAL_ERROR_STREAMEXIST ? -ECONNABORTED : pal_to_unix_errno(ret);
+            maybe_epoll_et_trigger(hdl, ret, /*in=*/false,
+                                   !ret ? this_size < bufs[i].iov_len : false);
+            if (ret < 0)
+                break;
+
+            bytes += this_size;
         }
+    }
 
-        bytes += this_size;
+    if (ret == -EPIPE && !(flags & MSG_NOSIGNAL)) {
+        siginfo_t info = {
+            .si_signo = SIGPIPE,
+            .si_pid = g_process.pid,
+            .si_code = SI_USER,
+        };
+        if (kill_current_proc(&info) < 0) {
+            log_error("do_sendmsg: failed to deliver a signal\n");
+        }
     }
 
     if (bytes)
@@ -1229,6 +1256,125 @@ long shim_do_sendmsg(int sockfd, struct msghdr* msg, int flags) {
                       msg->msg_namelen);
 }
 
+/* max messages passed to one DkStreamReadMsgs()/DkStreamWriteMsgs() by sendmmsg()/recvmmsg() */
+#define SOCK_MMSG_BATCH 16
+
+/*
+ * Checks whether sendmmsg()/recvmmsg() on `hdl` can go through DkStreamWriteMsgs() and
+ * DkStreamReadMsgs() instead of one do_sendmsg()/do_recvmsg() per message: only for UDP sockets
+ * that already have a PAL handle, with one iovec per message and without the flags that do_*msg()
+ * needs to emulate. Everything else (including all error reporting) is left to the generic path.
+ * Sets `*connected` for sockets connected to a peer, whose PAL handle doesn't take addresses.
+ */
+static bool can_batch_dgram(struct shim_handle* hdl, struct mmsghdr* msg, unsigned int vlen,
+                            int flags, bool is_recv, bool* connected) {
+    if (hdl->type != TYPE_SOCK)
+        return false;
+
+    int allowed_flags = is_recv ? 0 : MSG_NOSIGNAL;
+    if (hdl->flags & O_NONBLOCK)
+        allowed_flags |= MSG_DONTWAIT;
+    if (flags & ~allowed_flags)
+        return false;
+
+    struct shim_sock_handle* sock = &hdl->info.sock;
+    bool ret = false;
+
+    lock(&hdl->lock);
+    if ((sock->domain != AF_INET && sock->domain != AF_INET6) || sock->sock_type != SOCK_DGRAM)
+        goto out;
+    if (!hdl->pal_handle || sock->sock_state == SOCK_CREATED || sock->sock_state == SOCK_SHUTDOWN)
+        goto out;
+    if (!(hdl->acc_mode & (is_recv ? MAY_READ : MAY_WRITE)))
+        goto out;
+    if (is_recv && sock->peek_buffer)
+        goto out;
+
+    *connected = sock->sock_state == SOCK_CONNECTED || sock->sock_state == SOCK_BOUNDCONNECTED;
+    for (size_t i = 0; i < vlen; i++) {
+        struct msghdr* m = &msg[i].msg_hdr;
+        if (m->msg_iovlen != 1)
+            goto out;
+        if (!is_recv && !m->msg_name != *connected)
+            goto out;
+        if (m->msg_name && (size_t)m->msg_namelen < minimal_addrlen(sock->domain))
+            goto out;
+        if (!is_recv && m->msg_name
+                && ((struct sockaddr*)m->msg_name)->sa_family != sock->domain)
+            goto out;
+    }
+    ret = true;
+out:
+    unlock(&hdl->lock);
+    return ret;
+}
+
+static ssize_t do_sendmmsg_dgram(struct shim_handle* hdl, struct mmsghdr* msg, unsigned int vlen,
+                                 bool connected) {
+    struct shim_sock_handle* sock = &hdl->info.sock;
+    PAL_STREAM_MSG msgs[SOCK_MMSG_BATCH];
+    char* uris = NULL;
+    ssize_t ret = 0;
+
+    /* one buffer for the URIs of a whole batch, instead of one allocation per message */
+    if (!connected) {
+        uris = malloc(SOCK_MMSG_BATCH * SOCK_URI_SIZE);
+        if (!uris)
+            return -ENOMEM;
+    }
+
+    size_t total = 0;
+    while (total < vlen) {
+        size_t count = MIN(vlen - total, (size_t)SOCK_MMSG_BATCH);
+        for (size_t i = 0; i < count; i++) {
+            struct msghdr* m = &msg[total + i].msg_hdr;
+            msgs[i].buffer    = m->msg_iov[0].iov_base;
+            msgs[i].size      = m->msg_iov[0].iov_len;
+            msgs[i].addr      = NULL;
+            msgs[i].addr_size = 0;
+            if (connected)
+                continue;
+
+            char* uri = uris + i * SOCK_URI_SIZE;
+            struct addr_inet addr_buf;
+            inet_save_addr(sock->domain, &addr_buf, m->msg_name);
+            inet_rebase_port(false, sock->domain, &addr_buf, false);
+            size_t prefix_len = static_strlen(URI_PREFIX_UDP);
+            memcpy(uri, URI_PREFIX_UDP, prefix_len + 1);
+            ret = inet_translate_addr(sock->domain, uri + prefix_len, SOCK_URI_SIZE - prefix_len,
+                                      &addr_buf, NULL);
+            if (ret < 0)
+                goto out;
+            msgs[i].addr = uri;
+        }
+
+        PAL_NUM sent = 0;
+        ret = DkStreamWriteMsgs(hdl->pal_handle, msgs, count, &sent);
+        ret = ret == -PAL_ERROR_STREAMEXIST ? -ECONNABORTED : pal_to_unix_errno(ret);
+        maybe_epoll_et_trigger(hdl, ret, /*in=*/false, !ret ? sent < count : false);
+        if (ret < 0)
+            break;
+
+        for (size_t i = 0; i < sent; i++)
+            msg[total + i].msg_len = msgs[i].size;
+        total += sent;
+        if (sent < count)
+            break;
+    }
+
+out:
+    free(uris);
+    if (total)
+        return total;
+
+    if (ret < 0) {
+        lock(&hdl->lock);
+        sock->error = -ret;
+        unlock(&hdl->lock);
+    }
+    return ret == -EINTR ? -ERESTARTSYS : ret;
+}
+
 long shim_do_sendmmsg(int sockfd, struct mmsghdr* msg, unsigned int vlen, int flags) {
     if (!is_user_memory_writable(msg, sizeof(*msg) * vlen)) {
         return -EFAULT;
@@ -1242,6 +1388,21 @@ long shim_do_sendmmsg(int sockfd, struct mmsghdr* msg, unsigned int vlen, int fl
         }
     }
 
+    if (vlen) {
+        struct shim_handle* hdl = get_fd_handle(sockfd, NULL, NULL);
+        if (!hdl)
+            return -EBADF;
+
+        bool connected;
+        ssize_t ret = -ENOSYS;
+        bool batched = can_batch_dgram(hdl, msg, vlen, flags, /*is_recv=*/false, &connected);
+        if (batched)
+            ret = do_sendmmsg_dgram(hdl, msg, vlen, connected);
+        put_handle(hdl);
+        if (batched)
+            return ret;
+    }
+
     ssize_t total = 0;
     for (size_t i = 0; i < vlen; i++) {
         struct msghdr* m = &msg[i].msg_hdr;
@@ -1292,6 +1453,9 @@ static ssize_t do_recvmsg(int fd, struct iovec* bufs, size_t nbufs, int flags,
         goto out;
     }
 
+    /* the peer may wait for our coalesced writes before it sends anything */
+    sock_flush_writes_for_read(hdl);
+
     lock(&hdl->lock);
 
     if (flags & MSG_WAITALL) {
@@ -1300,8 +1464,12 @@ static ssize_t do_recvmsg(int fd, struct iovec* bufs, size_t nbufs, int flags,
         flags &= ~MSG_WAITALL;
     }
 
+    bool nonblocking = hdl->flags & O_NONBLOCK;
     if (flags & MSG_DONTWAIT) {
-        if (!(hdl->flags & O_NONBLOCK)) {
+        if (pipe_ring_active(sock->ring_in)) {
+            /* in-LibOS socketpairs support it */
+            nonblocking = true;
+        } else if (!(hdl->flags & O_NONBLOCK)) {
             log_warning("MSG_DONTWAIT on blocking socket is ignored, may lead to a read that "
                         "unexpectedly blocks.\n");
         }
@@ -1336,6 +1504,21 @@ static ssize_t do_recvmsg(int fd, struct iovec* bufs, size_t nbufs, int flags,
 
     unlock(&hdl->lock);
 
+    ssize_t ring_ret;
+    if (!peek_buffer && sock_ring_readv(hdl, bufs, nbufs, expected_size, nonblocking,
+                                        flags & MSG_PEEK, &ring_ret)) {
+        if (ring_ret < 0) {
+            ret = ring_ret;
+            lock(&hdl->lock);
+            goto out_locked;
+        }
+        /* the peer of a socketpair is unnamed */
+        if (addr)
+            *addrlen = 0;
+        ret = ring_ret;
+        goto out;
+    }
+
     if (flags & MSG_PEEK) {
         if (!peek_buffer) {
             /* create new peek buffer with expected read size */
@@ -1545,6 +1728,73 @@ long shim_do_recvmsg(int sockfd, struct msghdr* msg, int flags) {
                       &msg->msg_namelen);
 }
 
+static ssize_t do_recvmmsg_dgram(struct shim_handle* hdl, struct mmsghdr* msg, unsigned int vlen,
+                                 bool connected) {
+    struct shim_sock_handle* sock = &hdl->info.sock;
+    PAL_STREAM_MSG msgs[SOCK_MMSG_BATCH];
+    char* uris = NULL;
+    ssize_t ret = 0;
+
+    if (!connected) {
+        uris = malloc(SOCK_MMSG_BATCH * SOCK_URI_SIZE);
+        if (!uris)
+            return -ENOMEM;
+    }
+
+    /* like the per-message loop of recvmmsg(), wait until all `vlen` messages are received */
+    size_t total = 0;
+    while (total < vlen) {
+        size_t count = MIN(vlen - total, (size_t)SOCK_MMSG_BATCH);
+        for (size_t i = 0; i < count; i++) {
+            struct msghdr* m = &msg[total + i].msg_hdr;
+            msgs[i].buffer    = m->msg_iov[0].iov_base;
+            msgs[i].size      = m->msg_iov[0].iov_len;
+            msgs[i].addr      = uris && m->msg_name ? uris + i * SOCK_URI_SIZE : NULL;
+            msgs[i].addr_size = msgs[i].addr ? SOCK_URI_SIZE : 0;
+        }
+
+        PAL_NUM received = 0;
+        ret = DkStreamReadMsgs(hdl->pal_handle, msgs, count, &received);
+        ret = ret == -PAL_ERROR_STREAMNOTEXIST ? -ECONNABORTED : pal_to_unix_errno(ret);
+        maybe_epoll_et_trigger(hdl, ret, /*in=*/true, !ret ? received < count : false);
+        if (ret < 0)
+            break;
+
+        for (size_t i = 0; i < received; i++) {
+            struct mmsghdr* mm = &msg[total + i];
+            mm->msg_len = msgs[i].size;
+            if (!mm->msg_hdr.msg_name)
+                continue;
+
+            struct addr_inet conn;
+            if (msgs[i].addr) {
+                ret = inet_parse_addr(sock->domain, SOCK_DGRAM, msgs[i].addr, &conn, NULL);
+                if (ret < 0)
+                    goto out;
+                inet_rebase_port(true, sock->domain, &conn, false);
+            } else {
+                lock(&hdl->lock);
+                conn = sock->addr.in.conn;
+                unlock(&hdl->lock);
+            }
+            mm->msg_hdr.msg_namelen = inet_copy_addr(sock->domain, mm->msg_hdr.msg_name,
+                                                     mm->msg_hdr.msg_namelen, &conn);
+        }
+        total += received;
+    }
+
+out:
+    free(uris);
+    if (ret < 0) {
+        lock(&hdl->lock);
+        sock->error = -ret;
+        unlock(&hdl->lock);
+    }
+    if (total)
+        return total;
+    return ret == -EINTR ? -ERESTARTSYS : ret;
+}
+
 long shim_do_recvmmsg(int sockfd, struct mmsghdr* msg, unsigned int vlen, int flags,
                       struct __kernel_timespec* timeout) {
     if (!is_user_memory_writable(msg, sizeof(*msg) * vlen))
@@ -1566,6 +1816,21 @@ long shim_do_recvmmsg(int sockfd, struct mmsghdr* msg, unsigned int vlen, int fl
         return -EOPNOTSUPP;
     }
 
+    if (vlen) {
+        struct shim_handle* hdl = get_fd_handle(sockfd, NULL, NULL);
+        if (!hdl)
+            return -EBADF;
+
+        bool connected;
+        ssize_t ret = -ENOSYS;
+        bool batched = can_batch_dgram(hdl, msg, vlen, flags, /*is_recv=*/true, &connected);
+        if (batched)
+            ret = do_recvmmsg_dgram(hdl, msg, vlen, connected);
+        put_handle(hdl);
+        if (batched)
+            return ret;
+    }
+
     ssize_t total = 0;
     for (size_t i = 0; i < vlen; i++) {
         struct msghdr* m = &msg[i].msg_hdr;
@@ -1598,6 +1863,9 @@ long shim_do_shutdown(int sockfd, int how) {
         goto out;
     }
 
+    if (how != SHUT_RD)
+        sock_flush_writes(hdl);
+
     lock(&hdl->lock);
 
     struct shim_sock_handle* sock = &hdl->info.sock;
@@ -1607,9 +1875,12 @@ long shim_do_shutdown(int sockfd, int how) {
         goto out_locked;
     }
 
+    /* in-LibOS socketpairs are shut down below, without the handle lock */
+    bool ring = pipe_ring_active(sock->ring_in);
+
     switch (how) {
         case SHUT_RD:
-            ret = DkStreamDelete(hdl->pal_handle, PAL_DELETE_RD);
+            ret = ring ? 0 : DkStreamDelete(hdl->pal_handle, PAL_DELETE_RD);
             if (ret < 0) {
                 ret = pal_to_unix_errno(ret);
                 goto out_locked;
@@ -1617,7 +1888,7 @@ long shim_do_shutdown(int sockfd, int how) {
             hdl->acc_mode &= ~MAY_READ;
             break;
         case SHUT_WR:
-            ret = DkStreamDelete(hdl->pal_handle, PAL_DELETE_WR);
+            ret = ring ? 0 : DkStreamDelete(hdl->pal_handle, PAL_DELETE_WR);
             if (ret < 0) {
                 ret = pal_to_unix_errno(ret);
                 goto out_locked;
@@ -1625,7 +1896,7 @@ long shim_do_shutdown(int sockfd, int how) {
             hdl->acc_mode &= ~MAY_WRITE;
             break;
         case SHUT_RDWR:
-            ret = DkStreamDelete(hdl->pal_handle, 0);
+            ret = ring ? 0 : DkStreamDelete(hdl->pal_handle, 0);
             if (ret < 0) {
                 ret = pal_to_unix_errno(ret);
                 goto out_locked;
@@ -1644,6 +1915,8 @@ out_locked:
         sock->error = -ret;
 
     unlock(&hdl->lock);
+    if (!ret && ring)
+        sock_ring_shutdown(hdl, /*rd=*/how != SHUT_WR, /*wr=*/how != SHUT_RD);
 out:
     put_handle(hdl);
     return ret;
@@ -1860,8 +2133,16 @@ static int __do_setsockopt(struct shim_handle* hdl, int level, int optname, char
     if (level == SOL_TCP && optname != TCP_CORK && optname != TCP_NODELAY)
         return -ENOPROTOOPT;
 
+    struct shim_sock_handle* sock = &hdl->info.sock;
     PAL_STREAM_ATTR local_attr;
     if (!attr) {
+        if (sock->options_cached) {
+            /* nothing to do if the option already has the requested value */
+            local_attr = sock->options;
+            if (!__update_attr(&local_attr, level, optname, optval))
+                return 0;
+        }
+
         attr = &local_attr;
         int ret = DkStreamAttributesQueryByHandle(hdl->pal_handle, attr);
         if (ret < 0) {
@@ -1873,10 +2154,14 @@ static int __do_setsockopt(struct shim_handle* hdl, int level, int optname, char
     if (need_set_attr) {
         int ret = DkStreamAttributesSetByHandle(hdl->pal_handle, attr);
         if (ret < 0) {
+            /* the PAL may have applied some of the options */
+            sock->options_cached = false;
             return pal_to_unix_errno(ret);
         }
     }
 
+    sock->options.socket = attr->socket;
+    sock->options_cached = true;
     return 0;
 }
 
@@ -1933,7 +2218,14 @@ long shim_do_setsockopt(int fd, int level, int optname, char* optval, int optlen
     struct shim_sock_handle* sock = &hdl->info.sock;
     lock(&hdl->lock);
 
-    if (!hdl->pal_handle) {
+    if (level == SOL_SOCKET && optname == SO_REUSEPORT) {
+        /* as on Linux, it only has an effect if set before bind() */
+        sock->reuseport = *(int*)optval != 0;
+        goto out_locked;
+    }
+
+    /* in-LibOS socketpairs have no host socket to apply the options to */
+    if (!hdl->pal_handle || pipe_ring_active(sock->ring_in)) {
         struct shim_sock_option* o = malloc(sizeof(struct shim_sock_option) + optlen);
         if (!o) {
             ret = -ENOMEM;
@@ -1958,6 +2250,8 @@ long shim_do_setsockopt(int fd, int level, int optname, char* optval, int optlen
 
 out_locked:
     unlock(&hdl->lock);
+    if (!ret && level == SOL_TCP && optname == TCP_NODELAY && optlen >= (int)sizeof(int))
+        sock_set_nodelay(hdl, *(int*)optval != 0);
 out:
     put_handle(hdl);
     return ret;
@@ -2014,6 +2308,9 @@ long shim_do_getsockopt(int fd, int level, int optname, char* optval, int* optle
             case SO_TYPE:
                 *intval = sock->sock_type;
                 goto out;
+            case SO_REUSEPORT:
+                *intval = sock->reuseport ? 1 : 0;
+                goto out;
             case SO_KEEPALIVE:
             case SO_LINGER:
             case SO_RCVBUF:
@@ -2053,9 +2350,10 @@ long shim_do_getsockopt(int fd, int level, int optname, char* optval, int* optle
     /* at this point, we need to query PAL to get current attributes of hdl */
     PAL_STREAM_ATTR attr;
 
-    if (!hdl->pal_handle) {
+    if (!hdl->pal_handle || pipe_ring_active(sock->ring_in)) {
         /* it is possible that there is no underlying PAL handle for hdl, e.g., socket() before
-         * bind(); in this case, augment default attrs with pending_options and skip quering PAL */
+         * bind() or an in-LibOS socketpair; in this case, augment default attrs with
+         * pending_options and skip quering PAL */
         __populate_addr_with_defaults(&attr);
 
         struct shim_sock_option* o = sock->pending_options;
@@ -2063,6 +2361,9 @@ long shim_do_getsockopt(int fd, int level, int optname, char* optval, int* optle
             __update_attr(&attr, o->level, o->optname, o->optval);
             o = o->next;
         }
+    } else if (sock->options_cached) {
+        /* options can be changed only by setsockopt(), which keeps the cache current */
+        attr.socket = sock->options.socket;
     } else {
         /* query PAL to get current attributes */
         ret = DkStreamAttributesQueryByHandle(hdl->pal_handle, &attr);
@@ -2070,6 +2371,8 @@ long shim_do_getsockopt(int fd, int level, int optname, char* optval, int* optle
             ret = pal_to_unix_errno(ret);
             goto out;
         }
+        sock->options.socket = attr.socket;
+        sock->options_cached = true;
     }
 
     if (level == SOL_SOCKET) {
@@ -2,17 +2,110 @@
 /* Copyright (C) 2014 Stony Brook University */
 
 /*
- * Implementation of system calls "gettimeofday", "time" and "clock_gettime".
+ * Implementation of system calls "gettimeofday", "time", "clock_gettime", "clock_getres",
+ * "getrusage" and "times".
+ *
+ * The first three are also served by the vDSO (see vdso/arch/x86_64/vdso.c) without entering the
+ * LibOS, from the time data page which is refreshed here, whenever its data was too old for the
+ * vDSO. CPU time is accounted by the LibOS itself per thread (see `thread_cputime_pause` in
+ * shim_thread.c); all of it is reported as user time.
  */
 
 #include <errno.h>
+#include <linux/resource.h>
 
+#include "cpu.h"
 #include "pal.h"
 #include "pal_error.h"
+#include "shim_checkpoint.h"
 #include "shim_fs.h"
 #include "shim_handle.h"
 #include "shim_internal.h"
+#include "shim_process.h"
 #include "shim_table.h"
+#include "shim_thread.h"
+#include "shim_vdso.h"
+#include "spinlock.h"
+
+/* the vDSO uses a TSC/time pair for at most that long, then falls back to the syscall */
+#define VDSO_TIME_MAX_AGE_US 1000000
+/* a TSC/time pair is published only if DkSystemTimeQuery() took less than that (from time to time
+ * the PAL refreshes its own time base with a host call, which makes the pair imprecise) */
+#define VDSO_TIME_MAX_QUERY_US 10
+
+static struct vdso_time_data* g_vdso_time __attribute_migratable = NULL;
+static uint64_t g_vdso_tsc_hz __attribute_migratable = 0;
+static spinlock_t g_vdso_time_lock = INIT_SPINLOCK_UNLOCKED;
+
+static uint64_t vdso_time_extrapolate(struct vdso_time_data* data, uint64_t tsc) {
+    return data->base_ns + (uint64_t)(((unsigned __int128)(tsc - data->base_tsc) * data->ns_mult)
+                                      >> 32);
+}
+
+static void vdso_time_update(struct vdso_time_data* data, uint64_t tsc, uint64_t usec) {
+    uint64_t ns = usec * 1000;
+
+    spinlock_lock(&g_vdso_time_lock);
+    if (data->ns_mult && tsc - data->base_tsc < data->max_delta) {
+        /* don't let time go backwards for the vDSO users because of imprecise pairs */
+        uint64_t old_ns = vdso_time_extrapolate(data, tsc);
+        if (ns < old_ns)
+            ns = old_ns;
+    }
+
+    /* not a plain increment, so that a (checkpointed) odd value can't get stuck */
+    uint32_t seq = __atomic_load_n(&data->seq, __ATOMIC_RELAXED) | 1;
+    __atomic_store_n(&data->seq, seq, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store_n(&data->base_tsc, tsc, __ATOMIC_RELAXED);
+    __atomic_store_n(&data->base_ns, ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&data->ns_mult, (1000000000UL << 32) / g_vdso_tsc_hz, __ATOMIC_RELAXED);
+    __atomic_store_n(&data->max_delta, g_vdso_tsc_hz / 1000000 * VDSO_TIME_MAX_AGE_US,
+                     __ATOMIC_RELAXED);
+
+    __atomic_store_n(&data->seq, seq + 1, __ATOMIC_RELEASE);
+    spinlock_unlock(&g_vdso_time_lock);
+}
+
+/* DkSystemTimeQuery() which also refreshes the vDSO time data if it's (getting) stale */
+static int query_time(uint64_t* out_usec) {
+    struct vdso_time_data* data = g_vdso_time;
+    if (!data || !g_vdso_tsc_hz) {
+        int ret = DkSystemTimeQuery(out_usec);
+        return ret < 0 ? pal_to_unix_errno(ret) : 0;
+    }
+
+    uint64_t tsc1 = get_tsc();
+    int ret = DkSystemTimeQuery(out_usec);
+    if (ret < 0) {
+        return pal_to_unix_errno(ret);
+    }
+    uint64_t tsc2 = get_tsc();
+
+    uint64_t age = tsc2 - __atomic_load_n(&data->base_tsc, __ATOMIC_RELAXED);
+    if (age < __atomic_load_n(&data->max_delta, __ATOMIC_RELAXED) / 2) {
+        return 0;
+    }
+    if (tsc2 - tsc1 >= g_vdso_tsc_hz / 1000000 * VDSO_TIME_MAX_QUERY_US) {
+        /* imprecise, try again on the next call */
+        return 0;
+    }
+    vdso_time_update(data, tsc1 + (tsc2 - tsc1) / 2, *out_usec);
+    return 0;
+}
+
+void vdso_time_init(struct vdso_time_data* data) {
+    /* zeroed data makes the vDSO always use the syscall, which is all we can do without TSC */
+    g_vdso_time = data;
+    g_vdso_tsc_hz = g_pal_control->cpu_info.tsc_hz;
+    if (g_vdso_tsc_hz) {
+        /* CPU time of threads is then in TSC ticks too */
+        data->cputime_ns_mult = (1000000000UL << 32) / g_vdso_tsc_hz;
+        uint64_t usec;
+        (void)query_time(&usec);
+    }
+}
 
 long shim_do_gettimeofday(struct __kernel_timeval* tv, struct __kernel_timezone* tz) {
     if (!tv)
@@ -25,9 +118,9 @@ long shim_do_gettimeofday(struct __kernel_timeval* tv, struct __kernel_timezone*
         return -EFAULT;
 
     uint64_t time = 0;
-    int ret = DkSystemTimeQuery(&time);
+    int ret = query_time(&time);
     if (ret < 0) {
-        return pal_to_unix_errno(ret);
+        return ret;
     }
 
     tv->tv_sec  = time / 1000000;
@@ -40,9 +133,9 @@ long shim_do_time(time_t* tloc) {
         return -EFAULT;
 
     uint64_t time = 0;
-    int ret = DkSystemTimeQuery(&time);
+    int ret = query_time(&time);
     if (ret < 0) {
-        return pal_to_unix_errno(ret);
+        return ret;
     }
 
     time_t t = time / 1000000;
@@ -53,21 +146,75 @@ long shim_do_time(time_t* tloc) {
     return t;
 }
 
-long shim_do_clock_gettime(clockid_t which_clock, struct timespec* tp) {
-    /* all clocks are the same */
-    if (!(0 <= which_clock && which_clock < MAX_CLOCKS))
+/* Dynamic CPU-time clocks of clock_getcpuclockid() and pthread_getcpuclockid(), encoded as
+ * `(~pid << 3) | type` with bit 2 set for a thread (see Linux include/linux/posix-timers.h); all
+ * types (profiling, virtual, scheduler) are the same here. */
+#define CPUCLOCK_PERTHREAD_MASK 4
+#define CPUCLOCK_TYPE_MASK      3
+#define CPUCLOCK_TYPE_MAX       2
+#define CPUCLOCK_PID(clock)     ((IDTYPE)~((clock) >> 3))
+
+static bool is_cpu_clock(clockid_t which_clock) {
+    return which_clock < 0 || which_clock == CLOCK_PROCESS_CPUTIME_ID
+           || which_clock == CLOCK_THREAD_CPUTIME_ID;
+}
+
+static int get_cpu_clock_ns(clockid_t which_clock, uint64_t* out_ns) {
+    if (which_clock == CLOCK_PROCESS_CPUTIME_ID) {
+        *out_ns = get_process_cputime_ns();
+        return 0;
+    }
+    if (which_clock == CLOCK_THREAD_CPUTIME_ID) {
+        *out_ns = get_thread_cputime_ns(get_cur_thread());
+        return 0;
+    }
+
+    if ((which_clock & CPUCLOCK_TYPE_MASK) > CPUCLOCK_TYPE_MAX)
         return -EINVAL;
+    IDTYPE id = CPUCLOCK_PID(which_clock);
+
+    if (!(which_clock & CPUCLOCK_PERTHREAD_MASK)) {
+        /* only this process can be looked up */
+        if (id && id != g_process.pid)
+            return -EINVAL;
+        *out_ns = get_process_cputime_ns();
+        return 0;
+    }
 
+    struct shim_thread* thread = id ? lookup_thread(id) : get_cur_thread();
+    if (!thread)
+        return -EINVAL;
+    *out_ns = get_thread_cputime_ns(thread);
+    if (id)
+        put_thread(thread);
+    return 0;
+}
+
+long shim_do_clock_gettime(clockid_t which_clock, struct timespec* tp) {
     if (!tp)
         return -EINVAL;
 
     if (!is_user_memory_writable(tp, sizeof(*tp)))
         return -EFAULT;
 
+    if (is_cpu_clock(which_clock)) {
+        uint64_t ns;
+        int ret = get_cpu_clock_ns(which_clock, &ns);
+        if (ret < 0)
+            return ret;
+        tp->tv_sec  = ns / 1000000000;
+        tp->tv_nsec = ns % 1000000000;
+        return 0;
+    }
+
+    /* all other clocks are the same */
+    if (which_clock >= MAX_CLOCKS)
+        return -EINVAL;
+
     uint64_t time = 0;
-    int ret = DkSystemTimeQuery(&time);
+    int ret = query_time(&time);
     if (ret < 0) {
-        return pal_to_unix_errno(ret);
+        return ret;
     }
 
     tp->tv_sec  = time / 1000000;
@@ -76,16 +223,71 @@ long shim_do_clock_gettime(clockid_t which_clock, struct timespec* tp) {
 }
 
 long shim_do_clock_getres(clockid_t which_clock, struct timespec* tp) {
-    /* all clocks are the same */
-    if (!(0 <= which_clock && which_clock < MAX_CLOCKS))
+    long res_ns = 1000;
+    if (is_cpu_clock(which_clock)) {
+        uint64_t ns;
+        int ret = get_cpu_clock_ns(which_clock, &ns);
+        if (ret < 0)
+            return ret;
+        if (g_pal_control->cpu_info.tsc_hz)
+            res_ns = 1;
+    } else if (which_clock >= MAX_CLOCKS) {
+        /* all other clocks are the same */
         return -EINVAL;
+    }
 
     if (tp) {
         if (!is_user_memory_writable(tp, sizeof(*tp)))
             return -EFAULT;
 
         tp->tv_sec  = 0;
-        tp->tv_nsec = 1000;
+        tp->tv_nsec = res_ns;
+    }
+    return 0;
+}
+
+long shim_do_getrusage(int who, struct __kernel_rusage* ru) {
+    if (!is_user_memory_writable(ru, sizeof(*ru)))
+        return -EFAULT;
+
+    uint64_t ns;
+    switch (who) {
+        case RUSAGE_SELF:
+            ns = get_process_cputime_ns();
+            break;
+        case RUSAGE_THREAD:
+            ns = get_thread_cputime_ns(get_cur_thread());
+            break;
+        case RUSAGE_CHILDREN:
+            /* not reported by child processes */
+            ns = 0;
+            break;
+        default:
+            return -EINVAL;
     }
+
+    memset(ru, 0, sizeof(*ru));
+    ru->ru_utime.tv_sec  = ns / 1000000000;
+    ru->ru_utime.tv_usec = ns % 1000000000 / 1000;
+    /* the current resident size (including Graphene itself) instead of the maximum */
+    if (who != RUSAGE_CHILDREN)
+        ru->ru_maxrss = DkMemoryResidentSize() / 1024;
     return 0;
 }
+
+long shim_do_times(struct tms* buf) {
+    if (buf && !is_user_memory_writable(buf, sizeof(*buf)))
+        return -EFAULT;
+
+    uint64_t time = 0;
+    int ret = query_time(&time);
+    if (ret < 0)
+        return ret;
+
+    if (buf) {
+        memset(buf, 0, sizeof(*buf));
+        buf->tms_utime = get_process_cputime_ns() / (1000000000 / USER_HZ);
+    }
+    /* like Linux, in clock ticks since an arbitrary point in the past (here the Epoch) */
+    return time / (1000000 / USER_HZ);
+}
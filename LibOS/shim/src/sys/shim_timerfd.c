@@ -0,0 +1,139 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * Implementation of system calls "timerfd_create", "timerfd_settime" and "timerfd_gettime". The
+ * timer is kept in LibOS memory and driven by the async worker (see fs/timerfd/fs.c).
+ */
+
+#include <asm/fcntl.h>
+#include <linux/time.h>
+
+#include "shim_fs.h"
+#include "shim_handle.h"
+#include "shim_internal.h"
+#include "shim_table.h"
+#include "shim_utils.h"
+
+/* from <sys/timerfd.h>, which conflicts with kernel headers */
+#define TFD_CLOEXEC             O_CLOEXEC
+#define TFD_NONBLOCK            O_NONBLOCK
+#define TFD_TIMER_ABSTIME       (1 << 0)
+#define TFD_TIMER_CANCEL_ON_SET (1 << 1)
+
+#ifndef CLOCK_BOOTTIME
+#define CLOCK_BOOTTIME 7
+#endif
+
+static int timerfd_timespec_to_us(const struct __kernel_timespec* ts, uint64_t* out_us) {
+    if (ts->tv_sec < 0 || ts->tv_nsec < 0 || (uint64_t)ts->tv_nsec >= TIME_NS_IN_S)
+        return -EINVAL;
+
+    /* round up, so that the timer never expires early */
+    *out_us = ts->tv_sec * TIME_US_IN_S + (ts->tv_nsec + TIME_NS_IN_US - 1) / TIME_NS_IN_US;
+    return 0;
+}
+
+static void us_to_timespec(uint64_t us, struct __kernel_timespec* ts) {
+    ts->tv_sec  = us / TIME_US_IN_S;
+    ts->tv_nsec = (us % TIME_US_IN_S) * TIME_NS_IN_US;
+}
+
+static int get_timerfd_handle(int fd, struct shim_handle** out_hdl) {
+    struct shim_handle* hdl = get_fd_handle(fd, NULL, NULL);
+    if (!hdl)
+        return -EBADF;
+    if (hdl->type != TYPE_TIMERFD) {
+        put_handle(hdl);
+        return -EINVAL;
+    }
+    *out_hdl = hdl;
+    return 0;
+}
+
+long shim_do_timerfd_create(int clockid, int flags) {
+    /* all clocks are the same (see `shim_do_clock_gettime`) */
+    if (clockid != CLOCK_REALTIME && clockid != CLOCK_MONOTONIC && clockid != CLOCK_BOOTTIME)
+        return -EINVAL;
+
+    if (flags & ~(TFD_CLOEXEC | TFD_NONBLOCK))
+        return -EINVAL;
+
+    struct shim_handle* hdl = get_new_handle();
+    if (!hdl)
+        return -ENOMEM;
+
+    hdl->type = TYPE_TIMERFD;
+    hdl->fs = &timerfd_builtin_fs;
+    hdl->flags = O_RDONLY | (flags & TFD_NONBLOCK ? O_NONBLOCK : 0);
+    hdl->acc_mode = MAY_READ;
+
+    struct shim_timerfd_handle* tfd = &hdl->info.timerfd;
+    INIT_LISTP(&tfd->waiters);
+
+    /* get_new_handle() above increments hdl's refcount. Followed by another increment inside
+     * set_new_fd_handle. So we need to put_handle() afterwards. */
+    int vfd = set_new_fd_handle(hdl, flags & TFD_CLOEXEC ? FD_CLOEXEC : 0, NULL);
+    put_handle(hdl);
+    return vfd;
+}
+
+long shim_do_timerfd_settime(int fd, int flags, const struct __kernel_itimerspec* new_value,
+                             struct __kernel_itimerspec* old_value) {
+    if (flags & ~(TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET))
+        return -EINVAL;
+    /* TFD_TIMER_CANCEL_ON_SET is accepted but has no effect: the clock is never set in Graphene */
+
+    if (!is_user_memory_readable(new_value, sizeof(*new_value)))
+        return -EFAULT;
+    if (old_value && !is_user_memory_writable(old_value, sizeof(*old_value)))
+        return -EFAULT;
+
+    uint64_t value;
+    uint64_t interval;
+    int ret = timerfd_timespec_to_us(&new_value->it_value, &value);
+    if (ret < 0)
+        return ret;
+    ret = timerfd_timespec_to_us(&new_value->it_interval, &interval);
+    if (ret < 0)
+        return ret;
+
+    struct shim_handle* hdl;
+    ret = get_timerfd_handle(fd, &hdl);
+    if (ret < 0)
+        return ret;
+
+    uint64_t old_val;
+    uint64_t old_interval;
+    ret = set_timerfd(hdl, value, interval, flags & TFD_TIMER_ABSTIME, &old_val, &old_interval);
+    put_handle(hdl);
+    if (ret < 0)
+        return ret;
+
+    if (old_value) {
+        us_to_timespec(old_val, &old_value->it_value);
+        us_to_timespec(old_interval, &old_value->it_interval);
+    }
+    return 0;
+}
+
+long shim_do_timerfd_gettime(int fd, struct __kernel_itimerspec* curr_value) {
+    if (!is_user_memory_writable(curr_value, sizeof(*curr_value)))
+        return -EFAULT;
+
+    struct shim_handle* hdl;
+    int ret = get_timerfd_handle(fd, &hdl);
+    if (ret < 0)
+        return ret;
+
+    uint64_t value;
+    uint64_t interval;
+    ret = get_timerfd(hdl, &value, &interval);
+    put_handle(hdl);
+    if (ret < 0)
+        return ret;
+
+    us_to_timespec(value, &curr_value->it_value);
+    us_to_timespec(interval, &curr_value->it_interval);
+    return 0;
+}
@@ -11,6 +11,7 @@
 
 #include "assert.h"
 #include "api.h"
+#include "shim_fs.h"
 #include "shim_internal.h"
 #include "shim_lock.h"
 #include "shim_process.h"
@@ -122,6 +123,7 @@ static long do_waitid(int which, pid_t id, siginfo_t* infop, int options) {
         return -EINVAL;
 
     long ret = 0;
+    bool exited = false;
 
     do {
         lock(&g_process.children_lock);
@@ -143,6 +145,7 @@ static long do_waitid(int which, pid_t id, siginfo_t* infop, int options) {
                     LISTP_DEL_INIT(child, &g_process.zombies, list);
                     destroy_child_process(child);
                 }
+                exited = true;
                 ret = 0;
                 goto out;
             }
@@ -208,6 +211,10 @@ static long do_waitid(int which, pid_t id, siginfo_t* infop, int options) {
 
 out:
     unlock(&g_process.children_lock);
+    if (exited) {
+        /* the child published its shared anonymous memory when exiting */
+        exchange_all_anon_shm(/*take_over=*/true);
+    }
     return ret;
 }
 
@@ -2,7 +2,12 @@
 /* Copyright (C) 2014 Stony Brook University */
 
 /*
- * Implementation of system calls "readv" and "writev".
+ * Implementation of system calls "readv", "writev", "preadv", "pwritev", "preadv2" and "pwritev2".
+ *
+ * If the filesystem provides `readv`/`writev` ops (chroot, pipes and sockets do), all buffers are
+ * passed down at once, so that the PAL can do a single host readv/writev (preadv/pwritev for files,
+ * as the PAL gets the offset explicitly). Otherwise the buffers are transferred one by one with
+ * `read`/`write`, e.g. by tmpfs, which keeps the file contents in memory anyway.
  */
 
 #include <errno.h>
@@ -15,7 +20,23 @@
 #include "shim_table.h"
 #include "shim_utils.h"
 
-long shim_do_readv(int fd, const struct iovec* vec, int vlen) {
+#define UIO_MAXIOV 1024
+
+/* Returns whether `vec` can be passed to the `readv`/`writev` ops as a whole and sets `*total` to
+ * its size */
+static bool can_use_vectored(const struct iovec* vec, int vlen, size_t* total) {
+    *total = 0;
+    for (int i = 0; i < vlen; i++) {
+        /* NULL buffers are skipped by the per-buffer loops below */
+        if (!vec[i].iov_base)
+            return false;
+        if (__builtin_add_overflow(*total, vec[i].iov_len, total))
+            return false;
+    }
+    return *total <= SIZE_MAX / 2; /* the result must fit in ssize_t */
+}
+
+static int check_iovecs(const struct iovec* vec, int vlen, bool is_write) {
     if (!is_user_memory_readable(vec, sizeof(*vec) * vlen))
         return -EINVAL;
 
@@ -23,21 +44,21 @@ long shim_do_readv(int fd, const struct iovec* vec, int vlen) {
         if (vec[i].iov_base) {
             if (!access_ok(vec[i].iov_base, vec[i].iov_len))
                 return -EINVAL;
-            if (!is_user_memory_writable(vec[i].iov_base, vec[i].iov_len))
+            if (is_write ? !is_user_memory_readable(vec[i].iov_base, vec[i].iov_len)
+                         : !is_user_memory_writable(vec[i].iov_base, vec[i].iov_len))
                 return -EFAULT;
         }
     }
+    return 0;
+}
 
-    struct shim_handle* hdl = get_fd_handle(fd, NULL, NULL);
-    if (!hdl)
-        return -EBADF;
-
-    int ret = 0;
+static long do_readv(struct shim_handle* hdl, const struct iovec* vec, int vlen) {
+    if (!(hdl->acc_mode & MAY_READ) || !hdl->fs || !hdl->fs->fs_ops || !hdl->fs->fs_ops->read)
+        return -EACCES;
 
-    if (!(hdl->acc_mode & MAY_READ) || !hdl->fs || !hdl->fs->fs_ops || !hdl->fs->fs_ops->read) {
-        ret = -EACCES;
-        goto out;
-    }
+    size_t total;
+    if (hdl->fs->fs_ops->readv && can_use_vectored(vec, vlen, &total))
+        return hdl->fs->fs_ops->readv(hdl, vec, vlen, total);
 
     ssize_t bytes = 0;
 
@@ -48,21 +69,13 @@ long shim_do_readv(int fd, const struct iovec* vec, int vlen) {
             continue;
 
         b_vec = hdl->fs->fs_ops->read(hdl, vec[i].iov_base, vec[i].iov_len);
-        if (b_vec < 0) {
-            ret = bytes ?: b_vec;
-            goto out;
-        }
+        if (b_vec < 0)
+            return bytes ?: b_vec;
 
         bytes += b_vec;
     }
 
-    ret = bytes;
-out:
-    put_handle(hdl);
-    if (ret == -EINTR) {
-        ret = -ERESTARTSYS;
-    }
-    return ret;
+    return bytes;
 }
 
 /*
@@ -80,45 +93,84 @@ out:
  * actually written. Otherwise, it shall return a value of -1, the file-pointer
  * shall remain unchanged, and errno shall be set to indicate an error
  */
-long shim_do_writev(int fd, const struct iovec* vec, int vlen) {
-    if (!is_user_memory_readable(vec, sizeof(*vec) * vlen))
-        return -EINVAL;
+static long do_writev(struct shim_handle* hdl, const struct iovec* vec, int vlen) {
+    if (!(hdl->acc_mode & MAY_WRITE) || !hdl->fs || !hdl->fs->fs_ops || !hdl->fs->fs_ops->write)
+        return -EACCES;
+
+    /* a single `writev` op also keeps the writev() atomicity for pipes (see above) */
+    size_t total;
+    if (hdl->fs->fs_ops->writev && can_use_vectored(vec, vlen, &total))
+        return hdl->fs->fs_ops->writev(hdl, vec, vlen, total);
+
+    ssize_t bytes = 0;
 
     for (int i = 0; i < vlen; i++) {
-        if (vec[i].iov_base) {
-            if (!access_ok(vec[i].iov_base, vec[i].iov_len))
-                return -EINVAL;
-            if (!is_user_memory_readable(vec[i].iov_base, vec[i].iov_len))
-                return -EFAULT;
-        }
+        int b_vec;
+
+        if (!vec[i].iov_base)
+            continue;
+
+        b_vec = hdl->fs->fs_ops->write(hdl, vec[i].iov_base, vec[i].iov_len);
+        if (b_vec < 0)
+            return bytes ?: b_vec;
+
+        bytes += b_vec;
     }
 
+    return bytes;
+}
+
+/*
+ * Common part of readv(), writev() and their positional variants. `pos` of -1 means the current
+ * file position (which is then advanced); otherwise the position is moved to `pos` for the transfer
+ * and restored afterwards, like in pread64() and pwrite64().
+ */
+static long do_rw_vectored(int fd, const struct iovec* vec, int vlen, loff_t pos, bool is_write) {
+    if (vlen < 0 || vlen > UIO_MAXIOV)
+        return -EINVAL;
+
+    long ret = check_iovecs(vec, vlen, is_write);
+    if (ret < 0)
+        return ret;
+
     struct shim_handle* hdl = get_fd_handle(fd, NULL, NULL);
     if (!hdl)
         return -EBADF;
 
-    int ret = 0;
+    struct shim_fs* fs = hdl->fs;
+    off_t old_pos = 0;
 
-    if (!(hdl->acc_mode & MAY_WRITE) || !hdl->fs || !hdl->fs->fs_ops || !hdl->fs->fs_ops->write) {
-        ret = -EACCES;
-        goto out;
-    }
+    if (pos != -1) {
+        if (fs && fs->fs_ops && !fs->fs_ops->seek) {
+            ret = -ESPIPE;
+            goto out;
+        }
+        if (!fs || !fs->fs_ops || hdl->is_dir) {
+            ret = -EACCES;
+            goto out;
+        }
 
-    ssize_t bytes = 0;
+        old_pos = fs->fs_ops->seek(hdl, 0, SEEK_CUR);
+        if (old_pos < 0) {
+            ret = old_pos;
+            goto out;
+        }
 
-    for (int i = 0; i < vlen; i++) {
-        int b_vec;
+        off_t seek_ret = fs->fs_ops->seek(hdl, pos, SEEK_SET);
+        if (seek_ret < 0) {
+            ret = seek_ret;
+            goto out;
+        }
+    }
 
-        if (!vec[i].iov_base)
-            continue;
+    long bytes = is_write ? do_writev(hdl, vec, vlen) : do_readv(hdl, vec, vlen);
 
-        b_vec = hdl->fs->fs_ops->write(hdl, vec[i].iov_base, vec[i].iov_len);
-        if (b_vec < 0) {
-            ret = bytes ?: b_vec;
+    if (pos != -1) {
+        off_t seek_ret = fs->fs_ops->seek(hdl, old_pos, SEEK_SET);
+        if (seek_ret < 0) {
+            ret = seek_ret;
             goto out;
         }
-
-        bytes += b_vec;
     }
 
     ret = bytes;
@@ -129,3 +181,63 @@ out:
     }
     return ret;
 }
+
+long shim_do_readv(int fd, const struct iovec* vec, int vlen) {
+    return do_rw_vectored(fd, vec, vlen, /*pos=*/-1, /*is_write=*/false);
+}
+
+long shim_do_writev(int fd, const struct iovec* vec, int vlen) {
+    return do_rw_vectored(fd, vec, vlen, /*pos=*/-1, /*is_write=*/true);
+}
+
+/* On x86-64, the whole offset is passed in `pos_l`; `pos_h` is only used by 32-bit ABIs. */
+long shim_do_preadv(int fd, const struct iovec* vec, int vlen, unsigned long pos_l,
+                    unsigned long pos_h) {
+    __UNUSED(pos_h);
+    loff_t pos = (loff_t)pos_l;
+    if (pos < 0)
+        return -EINVAL;
+    return do_rw_vectored(fd, vec, vlen, pos, /*is_write=*/false);
+}
+
+long shim_do_pwritev(int fd, const struct iovec* vec, int vlen, unsigned long pos_l,
+                     unsigned long pos_h) {
+    __UNUSED(pos_h);
+    loff_t pos = (loff_t)pos_l;
+    if (pos < 0)
+        return -EINVAL;
+    return do_rw_vectored(fd, vec, vlen, pos, /*is_write=*/true);
+}
+
+/* RWF_HIPRI is only a polling hint and is ignored; RWF_NOWAIT and RWF_APPEND are not supported. */
+long shim_do_preadv2(int fd, const struct iovec* vec, int vlen, unsigned long pos_l,
+                     unsigned long pos_h, int flags) {
+    __UNUSED(pos_h);
+    if (flags & ~(RWF_HIPRI | RWF_DSYNC | RWF_SYNC))
+        return -EOPNOTSUPP;
+
+    loff_t pos = (loff_t)pos_l;
+    if (pos < -1)
+        return -EINVAL;
+    return do_rw_vectored(fd, vec, vlen, pos, /*is_write=*/false);
+}
+
+long shim_do_pwritev2(int fd, const struct iovec* vec, int vlen, unsigned long pos_l,
+                      unsigned long pos_h, int flags) {
+    __UNUSED(pos_h);
+    if (flags & ~(RWF_HIPRI | RWF_DSYNC | RWF_SYNC))
+        return -EOPNOTSUPP;
+
+    loff_t pos = (loff_t)pos_l;
+    if (pos < -1)
+        return -EINVAL;
+    long ret = do_rw_vectored(fd, vec, vlen, pos, /*is_write=*/true);
+
+    /* like O_DSYNC/O_SYNC for this write only: there is no separate data-only flush */
+    if (ret > 0 && (flags & (RWF_DSYNC | RWF_SYNC))) {
+        long flush_ret = shim_do_fsync(fd);
+        if (flush_ret < 0 && flush_ret != -EROFS)
+            return flush_ret;
+    }
+    return ret;
+}
@@ -9,15 +9,64 @@
 
 #include "api.h"
 #include "assert.h"
+#include "list.h"
 #include "pal.h"
 #include "shim_defs.h"
 #include "shim_internal.h"
 #include "shim_ipc.h"
 #include "shim_lock.h"
 #include "shim_process.h"
+#include "shim_thread.h"
+#include "shim_utils.h"
+#include "spinlock.h"
+#include "toml.h"
+
+/*
+ * Asynchronous logging (enabled with `libos.async_log`). Normally, every message is written to the
+ * host right away by the logging thread (an OCALL on SGX). In the asynchronous mode, a thread
+ * copies its messages into its own ring buffer and goes on; the async worker writes the buffered
+ * messages out every ASYNC_LOG_FLUSH_INTERVAL_US, and the exiting or crashing process writes the
+ * rest (see `log_flush`). A message which doesn't fit into a full ring is dropped, the number of
+ * dropped messages is logged with the next flush.
+ *
+ * Rings are single-producer single-consumer: only the owning thread adds messages and only the
+ * flushing thread (serialized by `g_log_rings_lock`) takes them out. Messages logged before the
+ * asynchronous mode is set up, by threads without a ring and from upcalls interrupting a thread
+ * which is just adding a message, are written synchronously.
+ */
+
+#define ASYNC_LOG_DEFAULT_BUFFER_SIZE (64 * 1024)
+#define ASYNC_LOG_FLUSH_INTERVAL_US   50000
+/* how long the crashing process waits for a flush in progress before flushing anyway */
+#define ASYNC_LOG_CRASH_LOCK_ITERATIONS 100000000
+
+/* `shim_thread.log_ring` while the ring is being allocated, or forever if that failed */
+#define LOG_RING_NONE ((struct log_ring*)1)
+
+DEFINE_LIST(log_ring);
+struct log_ring {
+    LIST_TYPE(log_ring) list;   /* in `g_log_rings`, protected by `g_log_rings_lock` */
+    bool dead;                  /* the thread is gone, free the ring once flushed */
+    bool busy;                  /* the thread is adding a message */
+    uint64_t head;              /* bytes added so far, written only by the thread */
+    uint64_t tail;              /* bytes written out so far, written only by the flushing thread */
+    uint64_t dropped;           /* messages dropped so far, written only by the thread */
+    uint64_t dropped_reported;
+    size_t size;                /* a power of two */
+    char buf[];
+};
+DEFINE_LISTP(log_ring);
 
 int g_log_level = LOG_LEVEL_NONE;
 
+static bool g_async_log = false;
+static size_t g_log_ring_size = 0;
+
+static spinlock_t g_log_rings_lock = INIT_SPINLOCK_UNLOCKED;
+static LISTP_TYPE(log_ring) g_log_rings = LISTP_INIT;
+
+static void log_flush_timer_callback(IDTYPE caller, void* arg);
+
 /* NOTE: We could add "libos" prefix to the below strings for more fine-grained log info */
 static const char* log_level_to_prefix[] = {
     [LOG_LEVEL_NONE]    = "",
@@ -91,15 +140,120 @@ void log_setprefix(shim_tcb_t* tcb) {
     unlock(&g_process.fs_lock);
 }
 
+int init_async_log(void) {
+    assert(g_manifest_root);
+
+    bool async_log;
+    int ret = toml_bool_in(g_manifest_root, "libos.async_log", /*defaultval=*/false, &async_log);
+    if (ret < 0) {
+        log_error("Cannot parse 'libos.async_log' (the value must be `true` or `false`)\n");
+        return -EINVAL;
+    }
+
+    uint64_t buffer_size;
+    ret = toml_sizestring_in(g_manifest_root, "libos.async_log_buffer_size",
+                             ASYNC_LOG_DEFAULT_BUFFER_SIZE, &buffer_size);
+    if (ret < 0 || buffer_size < PRINT_BUF_SIZE) {
+        log_error("Cannot parse 'libos.async_log_buffer_size' (the value must be put in double "
+                  "quotes and be at least %d bytes)\n", PRINT_BUF_SIZE);
+        return -EINVAL;
+    }
+
+    if (!async_log || g_log_level <= LOG_LEVEL_NONE)
+        return 0;
+
+    /* round down to a power of two, so that ring positions are simple masks */
+    g_log_ring_size = 1UL << (63 - __builtin_clzl(buffer_size));
+
+    ret = install_async_timer(ASYNC_LOG_FLUSH_INTERVAL_US, &log_flush_timer_callback, NULL,
+                              /*out_timer=*/NULL);
+    if (ret < 0)
+        return ret;
+
+    __atomic_store_n(&g_async_log, true, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Returns the ring of the current thread and marks it busy, or NULL if the message must be written
+ * synchronously. */
+static struct log_ring* get_log_ring(void) {
+    if (!__atomic_load_n(&g_async_log, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    struct shim_thread* thread = shim_get_tcb()->tp;
+    if (!thread)
+        return NULL;
+
+    struct log_ring* ring = thread->log_ring;
+    if (ring == LOG_RING_NONE)
+        return NULL;
+
+    if (!ring) {
+        /* the allocation may log (e.g. on out-of-memory), these messages are written directly */
+        thread->log_ring = LOG_RING_NONE;
+        ring = calloc(1, sizeof(*ring) + g_log_ring_size);
+        if (!ring)
+            return NULL;
+        ring->size = g_log_ring_size;
+        INIT_LIST_HEAD(ring, list);
+
+        spinlock_lock(&g_log_rings_lock);
+        LISTP_ADD_TAIL(ring, &g_log_rings, list);
+        spinlock_unlock(&g_log_rings_lock);
+        thread->log_ring = ring;
+    }
+
+    if (__atomic_load_n(&ring->busy, __ATOMIC_RELAXED))
+        return NULL;
+    __atomic_store_n(&ring->busy, true, __ATOMIC_RELAXED);
+    COMPILER_BARRIER();
+    return ring;
+}
+
+void release_log_ring(struct shim_thread* thread) {
+    struct log_ring* ring = thread->log_ring;
+    thread->log_ring = NULL;
+    if (!ring || ring == LOG_RING_NONE)
+        return;
+
+    /* the ring is freed by the next flush */
+    __atomic_store_n(&ring->dead, true, __ATOMIC_RELEASE);
+}
+
+struct log_message {
+    struct log_ring* ring;  /* NULL if written synchronously */
+    uint64_t end;           /* end of the message in the ring, published when complete */
+    bool dropped;
+};
+
 static int buf_write_all(const char* str, size_t size, void* arg) {
-    __UNUSED(arg);
-    DkDebugLog((PAL_PTR)str, size);
+    struct log_message* msg = arg;
+    if (!msg->ring) {
+        DkDebugLog((PAL_PTR)str, size);
+        return 0;
+    }
+
+    struct log_ring* ring = msg->ring;
+    if (msg->dropped || msg->end + size - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)
+                            > ring->size) {
+        msg->dropped = true;
+        return 0;
+    }
+
+    size_t start = msg->end & (ring->size - 1);
+    size_t first = MIN(size, ring->size - start);
+    memcpy(ring->buf + start, str, first);
+    memcpy(ring->buf, str + first, size - first);
+    msg->end += size;
     return 0;
 }
 
 void shim_log(int level, const char* fmt, ...) {
     if (level <= g_log_level) {
-        struct print_buf buf = INIT_PRINT_BUF(buf_write_all);
+        struct log_message msg = {.ring = get_log_ring()};
+        if (msg.ring)
+            msg.end = msg.ring->head;
+        struct print_buf buf = INIT_PRINT_BUF_ARG(buf_write_all, &msg);
 
         buf_puts(&buf, shim_get_tcb()->log_prefix);
         buf_puts(&buf, log_level_to_prefix[level]);
@@ -110,5 +264,82 @@ void shim_log(int level, const char* fmt, ...) {
         va_end(ap);
 
         buf_flush(&buf);
+
+        struct log_ring* ring = msg.ring;
+        if (ring) {
+            if (msg.dropped) {
+                __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+            } else {
+                __atomic_store_n(&ring->head, msg.end, __ATOMIC_RELEASE);
+            }
+            COMPILER_BARRIER();
+            __atomic_store_n(&ring->busy, false, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* Writes out all rings; must not log, as the current thread may be the one adding to its ring. */
+static void flush_log_rings(void) {
+    struct log_ring* ring;
+    struct log_ring* tmp;
+    LISTP_FOR_EACH_ENTRY_SAFE(ring, tmp, &g_log_rings, list) {
+        /* read before flushing: a dead ring gets no more messages */
+        bool dead = __atomic_load_n(&ring->dead, __ATOMIC_ACQUIRE);
+
+        uint64_t tail = ring->tail;
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        while (tail != head) {
+            /* up to the end of the ring buffer, the rest in the next iteration */
+            size_t start = tail & (ring->size - 1);
+            size_t size  = MIN(head - tail, ring->size - start);
+            DkDebugLog(ring->buf + start, size);
+            tail += size;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+        uint64_t dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+        if (dropped != ring->dropped_reported) {
+            char line[96];
+            int len = snprintf(line, sizeof(line), "%s%lu log messages dropped (increase "
+                               "'libos.async_log_buffer_size')\n",
+                               log_level_to_prefix[LOG_LEVEL_WARNING],
+                               dropped - ring->dropped_reported);
+            DkDebugLog(line, MIN((size_t)len, sizeof(line) - 1));
+            ring->dropped_reported = dropped;
+        }
+
+        if (dead) {
+            LISTP_DEL(ring, &g_log_rings, list);
+            free(ring);
+        }
+    }
+}
+
+static void log_flush_timer_callback(IDTYPE caller, void* arg) {
+    __UNUSED(caller);
+    __UNUSED(arg);
+
+    spinlock_lock(&g_log_rings_lock);
+    flush_log_rings();
+    spinlock_unlock(&g_log_rings_lock);
+
+    /* fails only when the async worker is being terminated, the exiting process flushes the rest */
+    (void)install_async_timer(ASYNC_LOG_FLUSH_INTERVAL_US, &log_flush_timer_callback, NULL,
+                              /*out_timer=*/NULL);
+}
+
+void log_flush(bool crashing) {
+    if (!__atomic_load_n(&g_async_log, __ATOMIC_ACQUIRE))
+        return;
+
+    if (!crashing) {
+        spinlock_lock(&g_log_rings_lock);
+    } else if (spinlock_lock_timeout(&g_log_rings_lock, ASYNC_LOG_CRASH_LOCK_ITERATIONS)) {
+        /* the flushing thread is stuck (or it is us, crashing in the middle of a flush): the
+         * messages are worth more than a clean list now, the process is going down anyway */
+        flush_log_rings();
+        return;
     }
+    flush_log_rings();
+    spinlock_unlock(&g_log_rings_lock);
 }
@@ -7,7 +7,10 @@
  */
 
 #include <asm/unistd.h>
+#include <linux/time.h>
 
+#include "cpu.h"
+#include "shim_vdso.h"
 #include "vdso.h"
 #include "vdso_syscall.h"
 
@@ -20,17 +23,96 @@
 #define EXPORT_WEAK_SYMBOL(name) \
     __typeof__(__vdso_##name) name __attribute__((weak, alias("__vdso_" #name)))
 
+/* placed on the page preceding the vDSO image by vdso.lds, written by the LibOS */
+extern struct vdso_time_data vdso_time_data_page __attribute__((visibility("hidden")));
+
+/* Returns false if the time data can't be used (the caller must fall back to the syscall, which
+ * also refreshes the data). */
+static bool vdso_time_get_ns(uint64_t* out_ns) {
+    struct vdso_time_data* data = &vdso_time_data_page;
+
+    uint32_t seq = __atomic_load_n(&data->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1)
+        return false;
+    uint64_t base_tsc  = __atomic_load_n(&data->base_tsc, __ATOMIC_RELAXED);
+    uint64_t base_ns   = __atomic_load_n(&data->base_ns, __ATOMIC_RELAXED);
+    uint64_t ns_mult   = __atomic_load_n(&data->ns_mult, __ATOMIC_RELAXED);
+    uint64_t max_delta = __atomic_load_n(&data->max_delta, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&data->seq, __ATOMIC_RELAXED) != seq)
+        return false;
+
+    uint64_t delta = get_tsc() - base_tsc;
+    if (!ns_mult || delta >= max_delta)
+        return false;
+
+    *out_ns = base_ns + (uint64_t)(((unsigned __int128)delta * ns_mult) >> 32);
+    return true;
+}
+
+/* CPU time of the current thread, see `struct shim_thread` (the pointer to it is in the LibOS TCB
+ * and only changes when the LibOS switches threads) */
+static bool vdso_thread_cputime_get_ns(uint64_t* out_ns) {
+    uint64_t ns_mult = __atomic_load_n(&vdso_time_data_page.cputime_ns_mult, __ATOMIC_RELAXED);
+    if (!ns_mult)
+        return false;
+
+    uint64_t* cputime_ptr;
+    __asm__ volatile("movq %%gs:%c[off], %0" : "=r"(cputime_ptr) : [off] "i"(SHIM_CPUTIME_OFFSET));
+    if (!cputime_ptr)
+        return false;
+
+    uint64_t cputime = __atomic_load_n(cputime_ptr, __ATOMIC_RELAXED);
+    if (!(cputime & 1))
+        return false;
+    uint64_t start = cputime >> 1;
+    uint64_t now = get_tsc();
+    uint64_t ticks = now > start ? now - start : 0;
+
+    *out_ns = (uint64_t)(((unsigned __int128)ticks * ns_mult) >> 32);
+    return true;
+}
+
 int __vdso_clock_gettime(clockid_t clock, struct timespec* t) {
+    uint64_t ns;
+    if (t && clock == CLOCK_THREAD_CPUTIME_ID && vdso_thread_cputime_get_ns(&ns)) {
+        t->tv_sec  = ns / 1000000000;
+        t->tv_nsec = ns % 1000000000;
+        return 0;
+    }
+
+    /* all these clocks are the same in Graphene (see shim_do_clock_gettime()) */
+    if (t && (clock == CLOCK_REALTIME || clock == CLOCK_MONOTONIC || clock == CLOCK_MONOTONIC_RAW
+              || clock == CLOCK_REALTIME_COARSE || clock == CLOCK_MONOTONIC_COARSE
+              || clock == CLOCK_BOOTTIME) && vdso_time_get_ns(&ns)) {
+        t->tv_sec  = ns / 1000000000;
+        t->tv_nsec = ns % 1000000000;
+        return 0;
+    }
     return vdso_arch_syscall(__NR_clock_gettime, (long)clock, (long)t);
 }
 EXPORT_WEAK_SYMBOL(clock_gettime);
 
 int __vdso_gettimeofday(struct timeval* tv, struct timezone* tz) {
+    /* `tz` is ignored, as in shim_do_gettimeofday() */
+    uint64_t ns;
+    if (tv && vdso_time_get_ns(&ns)) {
+        tv->tv_sec  = ns / 1000000000;
+        tv->tv_usec = ns % 1000000000 / 1000;
+        return 0;
+    }
     return vdso_arch_syscall(__NR_gettimeofday, (long)tv, (long)tz);
 }
 EXPORT_WEAK_SYMBOL(gettimeofday);
 
 time_t __vdso_time(time_t* t) {
+    uint64_t ns;
+    if (vdso_time_get_ns(&ns)) {
+        time_t sec = ns / 1000000000;
+        if (t)
+            *t = sec;
+        return sec;
+    }
     return vdso_arch_syscall(__NR_time, (long)t, 0);
 }
 EXPORT_WEAK_SYMBOL(time);
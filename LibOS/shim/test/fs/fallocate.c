@@ -0,0 +1,74 @@
+#include "common.h"
+
+#define ALLOC_SIZE (64 * 1024)
+
+static void verify_size(const char* path, int fd, off_t size) {
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        fatal_error("Failed to fstat file %s: %s\n", path, strerror(errno));
+    if (st.st_size != size)
+        fatal_error("File %s has size %ld instead of %ld\n", path, (long)st.st_size, (long)size);
+}
+
+static void verify_zeros(const char* path, int fd, off_t offset, size_t size) {
+    static char buf[ALLOC_SIZE];
+    seek_fd(path, fd, offset, SEEK_SET);
+    read_fd(path, fd, buf, size);
+    for (size_t i = 0; i < size; i++)
+        if (buf[i] != 0)
+            fatal_error("File %s has non-zero byte at offset %zu\n", path, offset + i);
+}
+
+static void file_fallocate(const char* path) {
+    int fd = open_output_fd(path, /*rdwr=*/true);
+    if (ftruncate(fd, 0) != 0)
+        fatal_error("Failed to ftruncate file %s: %s\n", path, strerror(errno));
+
+    /* mode 0 extends the file with zeros */
+    if (fallocate(fd, 0, 0, ALLOC_SIZE) != 0)
+        fatal_error("Failed to fallocate file %s: %s\n", path, strerror(errno));
+    verify_size(path, fd, ALLOC_SIZE);
+    verify_zeros(path, fd, 0, ALLOC_SIZE);
+
+    /* a range inside the file, or FALLOC_FL_KEEP_SIZE past its end, doesn't change the size */
+    if (fallocate(fd, 0, 1, 1) != 0)
+        fatal_error("Failed to fallocate file %s: %s\n", path, strerror(errno));
+    if (fallocate(fd, FALLOC_FL_KEEP_SIZE, ALLOC_SIZE, ALLOC_SIZE) != 0)
+        fatal_error("Failed to fallocate file %s with KEEP_SIZE: %s\n", path, strerror(errno));
+    verify_size(path, fd, ALLOC_SIZE);
+
+    /* existing data is not touched */
+    if (pwrite(fd, "A", 1, 10) != 1)
+        fatal_error("Failed to pwrite file %s: %s\n", path, strerror(errno));
+    int ret = posix_fallocate(fd, ALLOC_SIZE, ALLOC_SIZE);
+    if (ret != 0)
+        fatal_error("Failed to posix_fallocate file %s: %s\n", path, strerror(ret));
+    verify_size(path, fd, 2 * ALLOC_SIZE);
+    char c;
+    if (pread(fd, &c, 1, 10) != 1 || c != 'A')
+        fatal_error("Data of file %s changed by fallocate\n", path);
+    verify_zeros(path, fd, ALLOC_SIZE, ALLOC_SIZE);
+
+    if (fallocate(fd, 0, -1, 1) != -1 || errno != EINVAL)
+        fatal_error("fallocate of file %s at a negative offset didn't fail with EINVAL\n", path);
+    if (fallocate(fd, 0, 0, 0) != -1 || errno != EINVAL)
+        fatal_error("fallocate of file %s with zero length didn't fail with EINVAL\n", path);
+
+    close_fd(path, fd);
+
+    fd = open_input_fd(path);
+    if (fallocate(fd, 0, 0, 1) != -1 || errno != EBADF)
+        fatal_error("fallocate of read-only file %s didn't fail with EBADF\n", path);
+    close_fd(path, fd);
+
+    printf("fallocate(%s) OK\n", path);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2)
+        fatal_error("Usage: %s <file_path>\n", argv[0]);
+
+    setup();
+    file_fallocate(argv[1]);
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include "common.h"
+
+#define HOLE_SIZE (1024 * 1024)
+#define PAGE_SIZE 4096
+
+static void verify_zeros(const char* path, int fd, off_t offset, size_t size) {
+    static char buf[HOLE_SIZE];
+    seek_fd(path, fd, offset, SEEK_SET);
+    read_fd(path, fd, buf, size);
+    for (size_t i = 0; i < size; i++)
+        if (buf[i] != 0)
+            fatal_error("File %s has non-zero byte at offset %zu\n", path, offset + i);
+}
+
+static void sparse_file(const char* path) {
+    int fd = open_output_fd(path, /*rdwr=*/true);
+
+    /* a write past the end of file leaves a hole */
+    if (pwrite(fd, "A", 1, HOLE_SIZE) != 1)
+        fatal_error("Failed to pwrite file %s: %s\n", path, strerror(errno));
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        fatal_error("Failed to fstat file %s: %s\n", path, strerror(errno));
+    if (st.st_size != HOLE_SIZE + 1)
+        fatal_error("File %s has size %ld instead of %d\n", path, (long)st.st_size,
+                    HOLE_SIZE + 1);
+    if (st.st_blocks * 512 >= HOLE_SIZE)
+        fatal_error("Hole of file %s takes %ld blocks\n", path, (long)st.st_blocks);
+    verify_zeros(path, fd, 0, HOLE_SIZE);
+    printf("hole(%s) OK\n", path);
+
+    /* truncation discards the data in the middle of a page, extending again reads zeros */
+    char buf[2 * PAGE_SIZE];
+    memset(buf, 'B', sizeof(buf));
+    seek_fd(path, fd, 0, SEEK_SET);
+    write_fd(path, fd, buf, sizeof(buf));
+    if (ftruncate(fd, PAGE_SIZE + 1) != 0 || ftruncate(fd, sizeof(buf)) != 0)
+        fatal_error("Failed to ftruncate file %s: %s\n", path, strerror(errno));
+    verify_zeros(path, fd, PAGE_SIZE + 1, PAGE_SIZE - 1);
+    printf("truncate(%s) OK\n", path);
+
+    close_fd(path, fd);
+}
+
+static void size_limit(const char* path, size_t limit) {
+    int fd = open_output_fd(path, /*rdwr=*/false);
+
+    char buf[PAGE_SIZE] = {0};
+    size_t written = 0;
+    while (true) {
+        ssize_t ret = write(fd, buf, sizeof(buf));
+        if (ret < 0) {
+            if (errno != ENOSPC)
+                fatal_error("Failed to write file %s: %s\n", path, strerror(errno));
+            break;
+        }
+        written += ret;
+        if (written > limit)
+            fatal_error("Wrote %zu bytes to file %s past the limit\n", written, path);
+    }
+    if (written != limit)
+        fatal_error("Wrote only %zu bytes to file %s\n", written, path);
+
+    /* truncation gives the memory back */
+    if (ftruncate(fd, 0) != 0)
+        fatal_error("Failed to ftruncate file %s: %s\n", path, strerror(errno));
+    seek_fd(path, fd, 0, SEEK_SET);
+    write_fd(path, fd, buf, sizeof(buf));
+    printf("limit(%s) OK\n", path);
+
+    close_fd(path, fd);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2 || argc == 3)
+        fatal_error("Usage: %s <file_path> [<limited_file_path> <limit>]\n", argv[0]);
+
+    setup();
+    sparse_file(argv[1]);
+    if (argc > 2)
+        size_limit(argv[2], strtoul(argv[3], NULL, 10));
+
+    return 0;
+}
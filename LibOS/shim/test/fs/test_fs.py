@@ -242,6 +242,12 @@ class TC_00_FileSystem(RegressionTestCase):
         self.do_truncate_test(65537, 65535)
         self.do_truncate_test(65537, 65536)
 
+    def test_145_file_fallocate(self):
+        file_path = os.path.join(self.OUTPUT_DIR, 'test_145')
+        stdout, stderr = self.run_binary(['fallocate', file_path])
+        self.assertNotIn('ERROR: ', stderr)
+        self.assertIn('fallocate(' + file_path + ') OK', stdout)
+
     def verify_copy_content(self, input_path, output_path):
         self.assertTrue(filecmp.cmp(input_path, output_path, shallow=False))
 
@@ -64,22 +64,19 @@ class TC_10_Tmpfs(test_fs.TC_00_FileSystem):
     def test_140_file_truncate(self):
         test_fs.TC_00_FileSystem.test_140_file_truncate(self)
 
+    def test_150_sparse_file(self):
+        file_path = os.path.join(self.OUTPUT_DIR, 'test_150')
+        limited_path = os.path.join('/mnt-tmpfs-small', 'test_150')
+        stdout, stderr = self.run_binary(['sparse', file_path, limited_path, str(64 * 1024)])
+        self.assertNotIn('ERROR: ', stderr)
+        self.assertIn('hole(' + file_path + ') OK', stdout)
+        self.assertIn('truncate(' + file_path + ') OK', stdout)
+        self.assertIn('limit(' + limited_path + ') OK', stdout)
+
     # overrides TC_00_FileSystem to skip verification by python
     def verify_copy_content(self, input_path, output_path):
         pass
 
-    @unittest.skip("mmap is not yet implemented in tmpfs")
-    def test_204_copy_dir_mmap_whole(self):
-        test_fs.TC_00_FileSystem.test_204_copy_dir_mmap_whole(self)
-
-    @unittest.skip("mmap is not yet implemented in tmpfs")
-    def test_205_copy_dir_mmap_seq(self):
-        test_fs.TC_00_FileSystem.test_205_copy_dir_mmap_seq(self)
-
-    @unittest.skip("mmap is not yet implemented in tmpfs")
-    def test_206_copy_dir_mmap_rev(self):
-        test_fs.TC_00_FileSystem.test_206_copy_dir_mmap_rev(self)
-
     @unittest.skip("not applicable for tmpfs")
     def test_210_copy_dir_mounted(self):
         test_fs.TC_00_FileSystem.test_210_copy_dir_mounted(self)
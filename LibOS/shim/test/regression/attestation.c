@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "mbedtls/base64.h"
@@ -18,6 +19,7 @@
 #include "sgx_attest.h"
 
 uint8_t g_quote[SGX_QUOTE_MAX_SIZE];
+uint8_t g_cached_quote[SGX_QUOTE_MAX_SIZE];
 
 char user_report_data_str[] = "This is user-provided report data";
 
@@ -326,6 +328,113 @@ static int test_quote_interface(void) {
     return SUCCESS;
 }
 
+/*!
+ * \brief Test quote cache (enabled with `sgx.quote_cache_lifetime_ms` in the manifest).
+ *
+ * Perform the following steps in order:
+ *   1. write some custom data to `quote_prefetch` file
+ *   2. write the same data to `user_report_data` file
+ *   3. read `quote` file twice
+ *   4. verify that both quotes are the same (quotes are randomized, so the second one must have
+ *      come from the cache) and contain the report data
+ *
+ * \return 0 if the test succeeds, -1 otherwise.
+ */
+static int test_quote_cache(void) {
+    ssize_t bytes;
+
+    /* 1. write some custom data to `quote_prefetch` file */
+    sgx_report_data_t user_report_data = {0};
+    memcpy((void*)&user_report_data, "prefetched report data", sizeof("prefetched report data"));
+
+    bytes = rw_file_f("/dev/attestation/quote_prefetch", (char*)&user_report_data,
+                      sizeof(user_report_data), /*do_write=*/true);
+    if (bytes != sizeof(user_report_data)) {
+        /* error is already printed by rw_file_f() */
+        return FAILURE;
+    }
+
+    /* 2. write the same data to `user_report_data` file */
+    bytes = rw_file_f("/dev/attestation/user_report_data", (char*)&user_report_data,
+                      sizeof(user_report_data), /*do_write=*/true);
+    if (bytes != sizeof(user_report_data)) {
+        /* error is already printed by rw_file_f() */
+        return FAILURE;
+    }
+
+    /* 3. read `quote` file twice */
+    bytes = rw_file_f("/dev/attestation/quote", (char*)&g_quote, sizeof(g_quote),
+                      /*do_write=*/false);
+    if (bytes < 0) {
+        /* error is already printed by rw_file_f() */
+        return FAILURE;
+    }
+
+    ssize_t cached_bytes = rw_file_f("/dev/attestation/quote", (char*)&g_cached_quote,
+                                     sizeof(g_cached_quote), /*do_write=*/false);
+    if (cached_bytes < 0) {
+        /* error is already printed by rw_file_f() */
+        return FAILURE;
+    }
+
+    /* 4. verify that both quotes are the same and contain the report data */
+    if (bytes < sizeof(sgx_quote_t) || cached_bytes != bytes
+            || memcmp(g_quote, g_cached_quote, bytes)) {
+        fprintf(stderr, "second SGX quote is not the cached one\n");
+        return FAILURE;
+    }
+
+    sgx_quote_t* typed_quote = (sgx_quote_t*)g_cached_quote;
+    if (memcmp(typed_quote->report_body.report_data.d, user_report_data.d,
+               sizeof(user_report_data))) {
+        fprintf(stderr, "comparison of report data in cached SGX quote failed\n");
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+/*!
+ * \brief Test that `provisioned_secret` file is inherited by child processes.
+ *
+ * Perform the following steps in order:
+ *   1. write some secret to `provisioned_secret` file
+ *   2. read it back in a forked child and compare
+ *
+ * \return 0 if the test succeeds, -1 otherwise.
+ */
+static int test_provisioned_secret(void) {
+    char secret[] = "This is a provisioned secret";
+    ssize_t bytes = rw_file_f("/dev/attestation/provisioned_secret", secret, sizeof(secret),
+                              /*do_write=*/true);
+    if (bytes != sizeof(secret)) {
+        /* error is already printed by rw_file_f() */
+        return FAILURE;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "fork failed\n");
+        return FAILURE;
+    }
+
+    if (pid == 0) {
+        char inherited[sizeof(secret) + 1] = {0};
+        bytes = rw_file_f("/dev/attestation/provisioned_secret", inherited, sizeof(inherited),
+                          /*do_write=*/false);
+        /* _exit() so that the inherited stdio buffers are not flushed twice */
+        _exit(bytes == sizeof(secret) && !memcmp(inherited, secret, sizeof(secret)) ? 0 : 1);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+        fprintf(stderr, "child process didn't inherit the provisioned secret\n");
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
 int main(int argc, char** argv) {
     rw_file_f = rw_file_posix;
     if (argc > 1) {
@@ -337,6 +446,9 @@ int main(int argc, char** argv) {
            test_local_attestation() == SUCCESS ? "SUCCESS" : "FAIL");
     printf("Test quote interface... %s\n",
            test_quote_interface() == SUCCESS ? "SUCCESS" : "FAIL");
+    printf("Test quote cache... %s\n", test_quote_cache() == SUCCESS ? "SUCCESS" : "FAIL");
+    printf("Test provisioned secret... %s\n",
+           test_provisioned_secret() == SUCCESS ? "SUCCESS" : "FAIL");
     printf("Test resource leaks in attestation filesystem... %s\n",
            test_resource_leak() == SUCCESS ? "SUCCESS" : "FAIL");
     return 0;
@@ -0,0 +1,94 @@
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef __NR_close_range
+#define __NR_close_range 436
+#endif
+#ifndef CLOSE_RANGE_UNSHARE
+#define CLOSE_RANGE_UNSHARE (1U << 1)
+#endif
+#ifndef CLOSE_RANGE_CLOEXEC
+#define CLOSE_RANGE_CLOEXEC (1U << 2)
+#endif
+
+/* more than one batch of descriptors closed at once by Graphene */
+#define FDS_CNT 300
+
+static int g_fds[FDS_CNT];
+
+static int do_close_range(unsigned int first, unsigned int last, unsigned int flags) {
+    return syscall(__NR_close_range, first, last, flags);
+}
+
+static int is_open(int fd) {
+    int ret = fcntl(fd, F_GETFD);
+    if (ret < 0 && errno != EBADF)
+        err(1, "fcntl(F_GETFD)");
+    return ret >= 0;
+}
+
+int main(void) {
+    int pipefds[2];
+    if (pipe(pipefds) < 0)
+        err(1, "pipe");
+
+    for (int i = 0; i < FDS_CNT; i++) {
+        g_fds[i] = dup(pipefds[0]);
+        if (g_fds[i] < 0)
+            err(1, "dup");
+        if (i > 0 && g_fds[i] != g_fds[i - 1] + 1)
+            errx(1, "descriptors are not consecutive");
+    }
+    int first = g_fds[0];
+    int last  = g_fds[FDS_CNT - 1];
+
+    if (do_close_range(first + 1, first, 0) != -1 || errno != EINVAL)
+        errx(1, "close_range() with first > last was accepted");
+    if (do_close_range(first, last, 1U << 0) != -1 || errno != EINVAL)
+        errx(1, "close_range() with an unknown flag was accepted");
+
+    if (do_close_range(first, first + 9, CLOSE_RANGE_CLOEXEC) < 0)
+        err(1, "close_range(CLOSE_RANGE_CLOEXEC)");
+    for (int i = 0; i < FDS_CNT; i++) {
+        int flags = fcntl(g_fds[i], F_GETFD);
+        if (flags < 0)
+            err(1, "fcntl(F_GETFD)");
+        if (!!(flags & FD_CLOEXEC) != (i < 10))
+            errx(1, "wrong FD_CLOEXEC of fd %d", g_fds[i]);
+    }
+
+    /* close all but the first and the last one */
+    if (do_close_range(first + 1, last - 1, 0) < 0)
+        err(1, "close_range()");
+    for (int i = 0; i < FDS_CNT; i++) {
+        if (is_open(g_fds[i]) != (i == 0 || i == FDS_CNT - 1))
+            errx(1, "fd %d is %s", g_fds[i], is_open(g_fds[i]) ? "open" : "closed");
+    }
+
+    /* the pipe must still work through the remaining descriptors */
+    if (write(pipefds[1], "x", 1) != 1)
+        err(1, "write");
+    char c;
+    if (read(last, &c, 1) != 1 || c != 'x')
+        errx(1, "read from the pipe failed");
+
+    /* a new descriptor gets the lowest free number */
+    int fd = dup(pipefds[0]);
+    if (fd != first + 1)
+        errx(1, "dup() returned %d instead of %d", fd, first + 1);
+
+    if (do_close_range(first, ~0U, CLOSE_RANGE_UNSHARE) < 0)
+        err(1, "close_range(CLOSE_RANGE_UNSHARE)");
+    if (is_open(first) || is_open(fd) || is_open(last))
+        errx(1, "descriptors above %d were not closed", first);
+    if (!is_open(pipefds[0]) || !is_open(pipefds[1]))
+        errx(1, "pipe descriptors were closed");
+
+    puts("TEST OK");
+    return 0;
+}
@@ -0,0 +1,212 @@
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef __NR_copy_file_range
+#define __NR_copy_file_range 326
+#endif
+
+#define SRC_PATH "tmp/copy_file_range_src"
+#define DST_PATH "tmp/copy_file_range_dst"
+#define EXE_PATH "tmp/copy_file_range_exe"
+
+/* more than one buffer of the in-LibOS fallback */
+#define DATA_SIZE 200000
+
+static char g_data[DATA_SIZE];
+
+static ssize_t do_copy_file_range(int fd_in, off_t* off_in, int fd_out, off_t* off_out,
+                                  size_t len, unsigned int flags) {
+    return syscall(__NR_copy_file_range, fd_in, off_in, fd_out, off_out, len, flags);
+}
+
+static char* read_file(const char* path, size_t* out_size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        err(1, "open %s", path);
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+        err(1, "fstat");
+
+    char* buf = malloc(st.st_size + 1);
+    if (!buf)
+        err(1, "malloc");
+
+    size_t done = 0;
+    while (done < (size_t)st.st_size) {
+        ssize_t ret = read(fd, buf + done, st.st_size - done);
+        if (ret < 0)
+            err(1, "read");
+        if (ret == 0)
+            errx(1, "unexpected EOF of %s", path);
+        done += ret;
+    }
+    close(fd);
+    *out_size = done;
+    return buf;
+}
+
+/* copies everything from the current position of `fd_in` to the current position of `fd_out`, in
+ * (possibly short) calls like cp does */
+static size_t copy_all(int fd_in, int fd_out) {
+    size_t copied = 0;
+    while (1) {
+        ssize_t ret = do_copy_file_range(fd_in, NULL, fd_out, NULL, 1 << 30, 0);
+        if (ret < 0)
+            err(1, "copy_file_range");
+        if (ret == 0)
+            break;
+        copied += ret;
+    }
+    return copied;
+}
+
+static void test_copy(void) {
+    for (size_t i = 0; i < DATA_SIZE; i++)
+        g_data[i] = 'a' + i % 23;
+
+    int src = open(SRC_PATH, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (src < 0)
+        err(1, "open " SRC_PATH);
+    if (write(src, g_data, DATA_SIZE) != DATA_SIZE)
+        err(1, "write");
+    if (lseek(src, 0, SEEK_SET) != 0)
+        err(1, "lseek");
+
+    int dst = open(DST_PATH, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (dst < 0)
+        err(1, "open " DST_PATH);
+
+    if (copy_all(src, dst) != DATA_SIZE)
+        errx(1, "wrong number of bytes copied");
+    if (lseek(src, 0, SEEK_CUR) != DATA_SIZE || lseek(dst, 0, SEEK_CUR) != DATA_SIZE)
+        errx(1, "file positions were not advanced");
+
+    /* explicit offsets: the file positions stay, the offsets advance; writing after the end of the
+     * destination leaves a hole */
+    off_t off_in = 1000;
+    off_t off_out = DATA_SIZE + 5000;
+    if (do_copy_file_range(src, &off_in, dst, &off_out, 4096, 0) != 4096)
+        err(1, "copy_file_range with offsets");
+    if (off_in != 1000 + 4096 || off_out != DATA_SIZE + 5000 + 4096)
+        errx(1, "offsets were not advanced");
+    if (lseek(src, 0, SEEK_CUR) != DATA_SIZE || lseek(dst, 0, SEEK_CUR) != DATA_SIZE)
+        errx(1, "file positions were changed");
+
+    /* at the end of the source */
+    off_in = DATA_SIZE;
+    if (do_copy_file_range(src, &off_in, dst, NULL, 100, 0) != 0)
+        errx(1, "copy_file_range at EOF did not return 0");
+
+    close(src);
+    close(dst);
+
+    size_t size;
+    char* buf = read_file(DST_PATH, &size);
+    if (size != DATA_SIZE + 5000 + 4096)
+        errx(1, "wrong size of the destination: %zu", size);
+    if (memcmp(buf, g_data, DATA_SIZE))
+        errx(1, "wrong contents of the destination");
+    for (size_t i = DATA_SIZE; i < DATA_SIZE + 5000; i++)
+        if (buf[i] != 0)
+            errx(1, "hole of the destination is not zeroed");
+    if (memcmp(buf + DATA_SIZE + 5000, g_data + 1000, 4096))
+        errx(1, "wrong contents copied with offsets");
+    free(buf);
+}
+
+static void test_errors(void) {
+    int src = open(SRC_PATH, O_RDWR);
+    if (src < 0)
+        err(1, "open " SRC_PATH);
+
+    int dst = open(DST_PATH, O_WRONLY | O_APPEND);
+    if (dst < 0)
+        err(1, "open " DST_PATH);
+    if (do_copy_file_range(src, NULL, dst, NULL, 10, 0) != -1 || errno != EBADF)
+        errx(1, "copy_file_range to an O_APPEND file was accepted");
+    close(dst);
+
+    dst = open(DST_PATH, O_RDONLY);
+    if (dst < 0)
+        err(1, "open " DST_PATH);
+    if (do_copy_file_range(src, NULL, dst, NULL, 10, 0) != -1 || errno != EBADF)
+        errx(1, "copy_file_range to a read-only file was accepted");
+    close(dst);
+
+    dst = open(DST_PATH, O_WRONLY);
+    if (dst < 0)
+        err(1, "open " DST_PATH);
+    if (do_copy_file_range(src, NULL, dst, NULL, 10, 1) != -1 || errno != EINVAL)
+        errx(1, "copy_file_range with flags was accepted");
+    close(dst);
+
+    off_t off_in = 0;
+    off_t off_out = 100;
+    if (do_copy_file_range(src, &off_in, src, &off_out, 200, 0) != -1 || errno != EINVAL)
+        errx(1, "copy_file_range of overlapping ranges was accepted");
+    off_out = 200;
+    if (do_copy_file_range(src, &off_in, src, &off_out, 200, 0) != 200)
+        err(1, "copy_file_range within a file");
+
+    int dir = open("tmp", O_RDONLY | O_DIRECTORY);
+    if (dir < 0)
+        err(1, "open tmp");
+    if (do_copy_file_range(dir, NULL, src, NULL, 10, 0) != -1 || errno != EISDIR)
+        errx(1, "copy_file_range from a directory was accepted");
+    close(dir);
+
+    int pipefds[2];
+    if (pipe(pipefds) < 0)
+        err(1, "pipe");
+    if (do_copy_file_range(src, NULL, pipefds[1], NULL, 10, 0) != -1 || errno != EINVAL)
+        errx(1, "copy_file_range to a pipe was accepted");
+    close(pipefds[0]);
+    close(pipefds[1]);
+
+    close(src);
+}
+
+/* the executable is a trusted file under SGX */
+static void test_copy_exe(const char* exe_path) {
+    int src = open(exe_path, O_RDONLY);
+    if (src < 0)
+        err(1, "open %s", exe_path);
+    int dst = open(EXE_PATH, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (dst < 0)
+        err(1, "open " EXE_PATH);
+    copy_all(src, dst);
+    close(src);
+    close(dst);
+
+    size_t exe_size, copy_size;
+    char* exe = read_file(exe_path, &exe_size);
+    char* copy = read_file(EXE_PATH, &copy_size);
+    if (exe_size != copy_size || memcmp(exe, copy, exe_size))
+        errx(1, "wrong copy of the executable");
+    free(exe);
+    free(copy);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 1)
+        errx(1, "no executable path");
+
+    test_copy();
+    test_errors();
+    test_copy_exe(argv[0]);
+
+    if (unlink(SRC_PATH) < 0 || unlink(DST_PATH) < 0 || unlink(EXE_PATH) < 0)
+        err(1, "unlink");
+
+    puts("TEST OK");
+    return 0;
+}
@@ -0,0 +1,140 @@
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/times.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BUSY_NS  (200 * 1000 * 1000L)
+#define SLEEP_NS (300 * 1000 * 1000L)
+
+static uint64_t clock_ns(clockid_t clock_id) {
+    struct timespec ts;
+    if (clock_gettime(clock_id, &ts) < 0)
+        err(1, "clock_gettime(%d)", clock_id);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void busy_loop(void) {
+    uint64_t start = clock_ns(CLOCK_MONOTONIC);
+    while (clock_ns(CLOCK_MONOTONIC) - start < BUSY_NS)
+        ;
+}
+
+static uint64_t g_thread_cputime;
+
+static void* thread_func(void* arg) {
+    (void)arg;
+    busy_loop();
+    g_thread_cputime = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    return NULL;
+}
+
+static uint64_t rusage_ns(int who) {
+    struct rusage usage;
+    if (getrusage(who, &usage) < 0)
+        err(1, "getrusage(%d)", who);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000UL
+           + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000UL;
+}
+
+/* utime + stime of /proc/self/stat, in ns */
+static uint64_t proc_stat_ns(void) {
+    FILE* f = fopen("/proc/self/stat", "r");
+    if (!f)
+        err(1, "fopen /proc/self/stat");
+    char buf[1024];
+    if (!fgets(buf, sizeof(buf), f))
+        errx(1, "empty /proc/self/stat");
+    fclose(f);
+
+    /* the fields after "(comm)" start with the state, utime and stime are the 12th and 13th */
+    char* p = strrchr(buf, ')');
+    if (!p)
+        errx(1, "malformed /proc/self/stat: %s", buf);
+    unsigned long utime, stime;
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+        errx(1, "malformed /proc/self/stat: %s", buf);
+    return (utime + stime) * (1000000000UL / sysconf(_SC_CLK_TCK));
+}
+
+int main(void) {
+    uint64_t thread_start  = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    uint64_t process_start = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+
+    busy_loop();
+    uint64_t thread_busy = clock_ns(CLOCK_THREAD_CPUTIME_ID) - thread_start;
+    if (thread_busy < BUSY_NS / 2 || thread_busy > BUSY_NS * 3)
+        errx(1, "CPU time of a busy loop of %ld ns is %lu ns", BUSY_NS, thread_busy);
+
+    /* sleeping adds (almost) no CPU time */
+    uint64_t before_sleep = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    struct timespec req = {.tv_sec = 0, .tv_nsec = SLEEP_NS};
+    if (nanosleep(&req, NULL) < 0)
+        err(1, "nanosleep");
+    uint64_t sleep_cputime = clock_ns(CLOCK_THREAD_CPUTIME_ID) - before_sleep;
+    if (sleep_cputime > SLEEP_NS / 3)
+        errx(1, "CPU time of a sleep of %ld ns is %lu ns", SLEEP_NS, sleep_cputime);
+
+    /* CPU time of another thread is of the process, but not of this thread */
+    uint64_t thread_before = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    pthread_t thread;
+    int ret = pthread_create(&thread, NULL, thread_func, NULL);
+    if (ret != 0) {
+        errno = ret;
+        err(1, "pthread_create");
+    }
+    clockid_t thread_clock;
+    ret = pthread_getcpuclockid(thread, &thread_clock);
+    if (ret != 0) {
+        errno = ret;
+        err(1, "pthread_getcpuclockid");
+    }
+    struct timespec ts;
+    if (clock_gettime(thread_clock, &ts) < 0)
+        err(1, "clock_gettime of the thread CPU clock");
+    ret = pthread_join(thread, NULL);
+    if (ret != 0) {
+        errno = ret;
+        err(1, "pthread_join");
+    }
+    if (g_thread_cputime < BUSY_NS / 2)
+        errx(1, "CPU time of the thread is %lu ns", g_thread_cputime);
+    if (clock_ns(CLOCK_THREAD_CPUTIME_ID) - thread_before > BUSY_NS / 2)
+        errx(1, "CPU time of the joining thread includes the other thread");
+
+    uint64_t process = clock_ns(CLOCK_PROCESS_CPUTIME_ID) - process_start;
+    if (process < BUSY_NS)
+        errx(1, "CPU time of the process is %lu ns", process);
+
+    if (rusage_ns(RUSAGE_SELF) < BUSY_NS)
+        errx(1, "getrusage(RUSAGE_SELF) reports too little CPU time");
+    uint64_t rusage_thread = rusage_ns(RUSAGE_THREAD);
+    if (rusage_thread < BUSY_NS / 2 || rusage_thread > clock_ns(CLOCK_THREAD_CPUTIME_ID))
+        errx(1, "getrusage(RUSAGE_THREAD) reports %lu ns", rusage_thread);
+
+    struct tms tms;
+    if (times(&tms) == (clock_t)-1)
+        err(1, "times");
+    uint64_t tms_ns = (tms.tms_utime + tms.tms_stime) * (1000000000UL / sysconf(_SC_CLK_TCK));
+    if (tms_ns < BUSY_NS / 2)
+        errx(1, "times() reports too little CPU time");
+
+    if (proc_stat_ns() < BUSY_NS / 2)
+        errx(1, "/proc/self/stat reports too little CPU time");
+
+    struct timespec res;
+    if (clock_getres(CLOCK_THREAD_CPUTIME_ID, &res) < 0)
+        err(1, "clock_getres");
+    if (res.tv_sec != 0 || res.tv_nsec == 0)
+        errx(1, "wrong resolution of CLOCK_THREAD_CPUTIME_ID");
+
+    puts("TEST OK");
+    return 0;
+}
@@ -0,0 +1,65 @@
+/* Events of a pipe added to one epoll under two FDs (original and dup-ed) are reported for both. */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+static void add_fd(int epfd, int fd, uint32_t events) {
+    struct epoll_event event = {.events = events, .data.fd = fd};
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event) < 0)
+        err(1, "epoll_ctl(EPOLL_CTL_ADD, %d)", fd);
+}
+
+/* returns the number of events, `*seen_fds` gets a bit for each reported FD */
+static int wait_events(int epfd, unsigned int* seen_fds) {
+    struct epoll_event events[4];
+    int ret = epoll_wait(epfd, events, 4, /*timeout=*/1000);
+    if (ret < 0)
+        err(1, "epoll_wait");
+
+    *seen_fds = 0;
+    for (int i = 0; i < ret; i++) {
+        if (!(events[i].events & EPOLLIN))
+            errx(1, "unexpected events 0x%x of fd %d", events[i].events, events[i].data.fd);
+        *seen_fds |= 1U << events[i].data.fd;
+    }
+    return ret;
+}
+
+int main(void) {
+    int pipefds[2];
+    if (pipe(pipefds) < 0)
+        err(1, "pipe");
+    int dup_fd = dup(pipefds[0]);
+    if (dup_fd < 0)
+        err(1, "dup");
+    if (dup_fd >= 32)
+        errx(1, "fd %d too big", dup_fd);
+
+    int epfd = epoll_create1(0);
+    if (epfd < 0)
+        err(1, "epoll_create1");
+    add_fd(epfd, pipefds[0], EPOLLIN);
+    add_fd(epfd, dup_fd, EPOLLIN);
+
+    if (write(pipefds[1], "x", 1) != 1)
+        err(1, "write");
+
+    unsigned int seen_fds;
+    int ret = wait_events(epfd, &seen_fds);
+    if (ret != 2 || seen_fds != ((1U << pipefds[0]) | (1U << dup_fd)))
+        errx(1, "epoll_wait reported %d events instead of 2, for both fds", ret);
+
+    /* the remaining FD keeps getting the events */
+    if (epoll_ctl(epfd, EPOLL_CTL_DEL, pipefds[0], NULL) < 0)
+        err(1, "epoll_ctl(EPOLL_CTL_DEL)");
+    ret = wait_events(epfd, &seen_fds);
+    if (ret != 1 || seen_fds != (1U << dup_fd))
+        errx(1, "epoll_wait reported %d events instead of 1, for the dup-ed fd", ret);
+
+    puts("TEST OK");
+    return 0;
+}
@@ -0,0 +1,100 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <err.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define WAITERS_CNT 4
+
+static int g_epfds[WAITERS_CNT];
+static int g_woken[WAITERS_CNT];
+
+static void* waiter(void* arg) {
+    int i = (int)(long)arg;
+    struct epoll_event event;
+    int ret = epoll_wait(g_epfds[i], &event, 1, /*timeout=*/2000);
+    if (ret < 0)
+        err(1, "epoll_wait");
+    g_woken[i] = ret;
+    return NULL;
+}
+
+int main(void) {
+    int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listen_fd < 0)
+        err(1, "socket");
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+        .sin_port = 0,
+    };
+    socklen_t addrlen = sizeof(addr);
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+        err(1, "bind");
+    if (listen(listen_fd, WAITERS_CNT) < 0)
+        err(1, "listen");
+    if (getsockname(listen_fd, (struct sockaddr*)&addr, &addrlen) < 0)
+        err(1, "getsockname");
+
+    for (int i = 0; i < WAITERS_CNT; i++) {
+        g_epfds[i] = epoll_create1(EPOLL_CLOEXEC);
+        if (g_epfds[i] < 0)
+            err(1, "epoll_create1");
+
+        struct epoll_event event = {
+            .events = EPOLLIN | EPOLLRDNORM | EPOLLEXCLUSIVE,
+            .data.fd = listen_fd,
+        };
+        if (epoll_ctl(g_epfds[i], EPOLL_CTL_ADD, listen_fd, &event) != -1 || errno != EINVAL)
+            errx(1, "EPOLLEXCLUSIVE with EPOLLRDNORM was accepted");
+
+        event.events = EPOLLIN | EPOLLEXCLUSIVE;
+        if (epoll_ctl(g_epfds[i], EPOLL_CTL_ADD, listen_fd, &event) < 0)
+            err(1, "EPOLL_CTL_ADD");
+
+        event.events = EPOLLIN;
+        if (epoll_ctl(g_epfds[i], EPOLL_CTL_MOD, listen_fd, &event) != -1 || errno != EINVAL)
+            errx(1, "EPOLL_CTL_MOD of an EPOLLEXCLUSIVE item was accepted");
+    }
+
+    pthread_t threads[WAITERS_CNT];
+    for (int i = 0; i < WAITERS_CNT; i++) {
+        int ret = pthread_create(&threads[i], NULL, waiter, (void*)(long)i);
+        if (ret != 0) {
+            errno = ret;
+            err(1, "pthread_create");
+        }
+    }
+
+    /* let all waiters block in epoll_wait() */
+    usleep(500 * 1000);
+
+    int client_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (client_fd < 0)
+        err(1, "socket");
+    if (connect(client_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+        err(1, "connect");
+
+    int woken = 0;
+    for (int i = 0; i < WAITERS_CNT; i++) {
+        int ret = pthread_join(threads[i], NULL);
+        if (ret != 0) {
+            errno = ret;
+            err(1, "pthread_join");
+        }
+        woken += g_woken[i];
+    }
+
+    /* Linux guarantees "one or more" woken-up waiters, but not all of them */
+    if (woken < 1 || woken == WAITERS_CNT)
+        errx(1, "%d of %d waiters were woken up", woken, WAITERS_CNT);
+
+    puts("TEST OK");
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include <errno.h>
+#include <fcntl.h>
 #include <poll.h>
 #include <pthread.h>
 #include <signal.h>
@@ -7,6 +8,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -215,6 +217,76 @@ static int eventfd_using_various_flags(void) {
     return 0;
 }
 
+static void* delayed_write_thread(void* arg) {
+    uint64_t count = 7;
+    usleep(100 * 1000);
+    if (write(*(int*)arg, &count, sizeof(count)) != sizeof(count))
+        perror("write error");
+    return NULL;
+}
+
+/* Blocking reads woken up by another thread, the counter limit and readiness seen by epoll.
+ * To support regression testing, positive value returned for error case. */
+static int eventfd_using_epoll(void) {
+    int ret = 1;
+    uint64_t count = 0;
+    pthread_t tid;
+
+    int efd = eventfd(0, 0);
+    int epfd = epoll_create1(0);
+    if (efd < 0 || epfd < 0) {
+        perror("eventfd/epoll_create1 failed");
+        return 1;
+    }
+
+    struct epoll_event event = { .events = EPOLLIN | EPOLLOUT };
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, efd, &event) < 0) {
+        perror("epoll_ctl failed");
+        goto out;
+    }
+    if (epoll_wait(epfd, &event, 1, 0) != 1 || event.events != EPOLLOUT) {
+        printf("epoll_wait on an empty eventfd: events %#x\n", event.events);
+        goto out;
+    }
+
+    if (pthread_create(&tid, NULL, delayed_write_thread, &efd) != 0) {
+        perror("error in thread creation");
+        goto out;
+    }
+    if (read(efd, &count, sizeof(count)) != sizeof(count) || count != 7) {
+        printf("blocking read returned count %lu\n", count);
+        goto out;
+    }
+    pthread_join(tid, NULL);
+
+    /* the counter can't go above 0xfffffffffffffffe */
+    if (fcntl(efd, F_SETFL, O_NONBLOCK) < 0) {
+        perror("fcntl failed");
+        goto out;
+    }
+    count = 0xfffffffffffffffeULL;
+    if (write(efd, &count, sizeof(count)) != sizeof(count)) {
+        perror("write error");
+        goto out;
+    }
+    count = 1;
+    if (write(efd, &count, sizeof(count)) != -1 || errno != EAGAIN) {
+        printf("write over the limit didn't fail with EAGAIN\n");
+        goto out;
+    }
+    if (epoll_wait(epfd, &event, 1, 0) != 1 || event.events != EPOLLIN) {
+        printf("epoll_wait on a full eventfd: events %#x\n", event.events);
+        goto out;
+    }
+
+    printf("%s completed successfully\n", __func__);
+    ret = 0;
+out:
+    close(epfd);
+    close(efd);
+    return ret;
+}
+
 static int eventfd_using_fork(void) {
     int status     = 0;
     int efd        = 0;
@@ -274,6 +346,7 @@ int main(int argc, char* argv[]) {
 
     ret = eventfd_using_poll();
     ret += eventfd_using_various_flags();
+    ret += eventfd_using_epoll();
     ret += eventfd_using_fork();
 
     return ret;
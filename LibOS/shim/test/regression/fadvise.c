@@ -0,0 +1,104 @@
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FILE_PATH "tmp/fadvise"
+
+/* more than the maximum read-ahead window and the page cache fetch size */
+#define DATA_SIZE (3 * 1024 * 1024)
+
+static char g_data[DATA_SIZE];
+static char g_buf[DATA_SIZE];
+
+static void advise(int fd, off_t offset, off_t len, int advice, const char* name) {
+    /* posix_fadvise() returns the error instead of setting errno */
+    int ret = posix_fadvise(fd, offset, len, advice);
+    if (ret != 0) {
+        errno = ret;
+        err(1, "posix_fadvise(%s)", name);
+    }
+}
+
+/* reads the file in chunks of `chunk` bytes, in order or (if `stride` is not 0) jumping around */
+static void read_and_check(int fd, size_t chunk, size_t stride) {
+    memset(g_buf, 0, sizeof(g_buf));
+    size_t off = 0;
+    for (size_t i = 0; i < DATA_SIZE / chunk; i++) {
+        if (pread(fd, g_buf + off, chunk, off) != (ssize_t)chunk)
+            err(1, "pread");
+        off = stride ? (off + stride) % DATA_SIZE : off + chunk;
+    }
+    for (size_t i = 0; i < DATA_SIZE / chunk; i++) {
+        size_t pos = stride ? i * stride % DATA_SIZE : i * chunk;
+        if (memcmp(g_buf + pos, g_data + pos, chunk))
+            errx(1, "wrong data read at offset %zu", pos);
+    }
+}
+
+int main(void) {
+    for (size_t i = 0; i < DATA_SIZE; i++)
+        g_data[i] = 'a' + i % 29;
+
+    int fd = open(FILE_PATH, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+        err(1, "open " FILE_PATH);
+    if (write(fd, g_data, DATA_SIZE) != DATA_SIZE)
+        err(1, "write");
+
+    advise(fd, 0, 0, POSIX_FADV_SEQUENTIAL, "SEQUENTIAL");
+    read_and_check(fd, 4096, 0);
+
+    /* 4096 * 37 and DATA_SIZE are coprime in pages, so all chunks are visited */
+    advise(fd, 0, 0, POSIX_FADV_RANDOM, "RANDOM");
+    read_and_check(fd, 4096, 4096 * 37);
+
+    advise(fd, 4096, 8192, POSIX_FADV_WILLNEED, "WILLNEED");
+    if (readahead(fd, 0, DATA_SIZE) < 0)
+        err(1, "readahead");
+    advise(fd, 0, 0, POSIX_FADV_NORMAL, "NORMAL");
+    read_and_check(fd, 1000, 0);
+
+    /* dropping the cached data must not lose a write done just before */
+    if (pwrite(fd, "XYZ", 3, 10000) != 3)
+        err(1, "pwrite");
+    memcpy(g_data + 10000, "XYZ", 3);
+    advise(fd, 0, 0, POSIX_FADV_DONTNEED, "DONTNEED");
+    read_and_check(fd, 4096, 0);
+
+    advise(fd, 0, 0, POSIX_FADV_NOREUSE, "NOREUSE");
+
+    if (posix_fadvise(fd, 0, 0, 1000) != EINVAL)
+        errx(1, "posix_fadvise() with an invalid advice was accepted");
+    if (posix_fadvise(fd, 0, -1, POSIX_FADV_NORMAL) != EINVAL)
+        errx(1, "posix_fadvise() with a negative length was accepted");
+    close(fd);
+    if (posix_fadvise(fd, 0, 0, POSIX_FADV_NORMAL) != EBADF)
+        errx(1, "posix_fadvise() on a closed descriptor was accepted");
+
+    fd = open(FILE_PATH, O_WRONLY);
+    if (fd < 0)
+        err(1, "open " FILE_PATH);
+    if (readahead(fd, 0, 4096) != -1 || errno != EBADF)
+        errx(1, "readahead() on a write-only file was accepted");
+    close(fd);
+
+    int pipefds[2];
+    if (pipe(pipefds) < 0)
+        err(1, "pipe");
+    if (posix_fadvise(pipefds[0], 0, 0, POSIX_FADV_SEQUENTIAL) != ESPIPE)
+        errx(1, "posix_fadvise() on a pipe was accepted");
+    if (readahead(pipefds[0], 0, 4096) != -1 || errno != EINVAL)
+        errx(1, "readahead() on a pipe was accepted");
+    close(pipefds[0]);
+    close(pipefds[1]);
+
+    if (unlink(FILE_PATH) < 0)
+        err(1, "unlink");
+
+    puts("TEST OK");
+    return 0;
+}
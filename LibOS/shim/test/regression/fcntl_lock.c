@@ -0,0 +1,149 @@
+/* POSIX byte-range locks (fcntl F_SETLK, F_SETLKW, F_GETLK) between a process and its child */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define TEST_FILE "tmp/fcntl_lock_test"
+
+static int g_fd;
+
+static int set_lock(int cmd, short type, off_t start, off_t len) {
+    struct flock fl = {
+        .l_type   = type,
+        .l_whence = SEEK_SET,
+        .l_start  = start,
+        .l_len    = len,
+    };
+    return fcntl(g_fd, cmd, &fl);
+}
+
+static void lock_ok(int cmd, short type, off_t start, off_t len) {
+    if (set_lock(cmd, type, start, len) < 0)
+        err(1, "lock %d of [%ld, +%ld)", type, start, len);
+}
+
+static void lock_busy(short type, off_t start, off_t len) {
+    if (set_lock(F_SETLK, type, start, len) == 0)
+        errx(1, "lock %d of [%ld, +%ld) unexpectedly succeeded", type, start, len);
+    if (errno != EAGAIN && errno != EACCES)
+        err(1, "lock %d of [%ld, +%ld)", type, start, len);
+}
+
+static void expect_getlk(short type, off_t start, off_t len, short exp_type, off_t exp_start,
+                         off_t exp_len, pid_t exp_pid) {
+    struct flock fl = {
+        .l_type   = type,
+        .l_whence = SEEK_SET,
+        .l_start  = start,
+        .l_len    = len,
+    };
+    if (fcntl(g_fd, F_GETLK, &fl) < 0)
+        err(1, "F_GETLK");
+    if (fl.l_type != exp_type)
+        errx(1, "F_GETLK of [%ld, +%ld): type %d instead of %d", start, len, fl.l_type, exp_type);
+    if (exp_type == F_UNLCK)
+        return;
+    if (fl.l_start != exp_start || fl.l_len != exp_len || fl.l_pid != exp_pid)
+        errx(1, "F_GETLK of [%ld, +%ld): got [%ld, +%ld) of %d instead of [%ld, +%ld) of %d",
+             start, len, fl.l_start, fl.l_len, fl.l_pid, exp_start, exp_len, exp_pid);
+}
+
+static void write_byte(int fd) {
+    char c = 0;
+    if (write(fd, &c, 1) != 1)
+        err(1, "write to pipe");
+}
+
+static void read_byte(int fd) {
+    char c;
+    if (read(fd, &c, 1) != 1)
+        err(1, "read from pipe");
+}
+
+int main(void) {
+    g_fd = open(TEST_FILE, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (g_fd < 0)
+        err(1, "open");
+
+    /* locks of this process never conflict with each other */
+    lock_ok(F_SETLK, F_WRLCK, 0, 100);
+    lock_ok(F_SETLK, F_RDLCK, 50, 10);
+    lock_ok(F_SETLK, F_WRLCK, 50, 10);
+    expect_getlk(F_WRLCK, 0, 0, F_UNLCK, 0, 0, 0);
+    lock_ok(F_SETLK, F_RDLCK, 200, 0);
+
+    int to_parent[2], to_child[2];
+    if (pipe(to_parent) < 0 || pipe(to_child) < 0)
+        err(1, "pipe");
+
+    pid_t parent = getpid();
+    pid_t pid = fork();
+    if (pid < 0)
+        err(1, "fork");
+
+    if (pid == 0) {
+        /* locks are not inherited */
+        lock_busy(F_WRLCK, 50, 10);
+        lock_busy(F_RDLCK, 99, 1);
+        expect_getlk(F_RDLCK, 10, 10, F_WRLCK, 0, 100, parent);
+        expect_getlk(F_WRLCK, 300, 1, F_RDLCK, 200, 0, parent);
+
+        /* a read lock shares with the parent's one, the gap between the parent's locks is free */
+        lock_ok(F_SETLK, F_RDLCK, 250, 10);
+        lock_ok(F_SETLK, F_WRLCK, 100, 100);
+
+        write_byte(to_parent[1]);
+        /* blocks until the parent unlocks */
+        lock_ok(F_SETLKW, F_WRLCK, 0, 10);
+        write_byte(to_parent[1]);
+
+        read_byte(to_child[0]);
+        /* closing any descriptor of the file drops the locks of the process */
+        int fd = open(TEST_FILE, O_RDONLY);
+        if (fd < 0)
+            err(1, "open in child");
+        if (close(fd) < 0)
+            err(1, "close in child");
+        write_byte(to_parent[1]);
+        read_byte(to_child[0]);
+        return 0;
+    }
+
+    read_byte(to_parent[0]);
+    lock_busy(F_WRLCK, 100, 1);
+    expect_getlk(F_WRLCK, 150, 50, F_WRLCK, 100, 100, pid);
+    expect_getlk(F_WRLCK, 255, 1, F_RDLCK, 250, 10, pid);
+
+    /* let the child wait for a while */
+    usleep(100 * 1000);
+    lock_ok(F_SETLK, F_UNLCK, 0, 50);
+    read_byte(to_parent[0]);
+    expect_getlk(F_RDLCK, 0, 10, F_WRLCK, 0, 10, pid);
+    lock_busy(F_RDLCK, 5, 1);
+    /* right after the range the child has locked */
+    lock_ok(F_SETLK, F_WRLCK, 10, 50);
+
+    write_byte(to_child[1]);
+    read_byte(to_parent[0]);
+    expect_getlk(F_WRLCK, 0, 0, F_UNLCK, 0, 0, 0);
+    lock_ok(F_SETLK, F_WRLCK, 0, 300);
+    write_byte(to_child[1]);
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        err(1, "waitpid");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        errx(1, "child failed");
+
+    if (close(g_fd) < 0)
+        err(1, "close");
+    if (unlink(TEST_FILE) < 0)
+        err(1, "unlink");
+    puts("TEST OK");
+    return 0;
+}
@@ -0,0 +1,113 @@
+/* Descriptor tables copied by close_range(CLOSE_RANGE_UNSHARE) and vfork() are independent of the
+ * tables they were copied from (Graphene shares their entries until they are modified). */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef __NR_close_range
+#define __NR_close_range 436
+#endif
+#ifndef CLOSE_RANGE_UNSHARE
+#define CLOSE_RANGE_UNSHARE (1U << 1)
+#endif
+
+static int g_pipefds[2];
+static int g_fd_closed;
+static int g_fd_cloexec;
+static int g_fd_new;
+
+static int get_fd_flags(int fd) {
+    int ret = fcntl(fd, F_GETFD);
+    if (ret < 0 && errno != EBADF)
+        err(1, "fcntl(F_GETFD)");
+    return ret;
+}
+
+static void check_parent_table(const char* who) {
+    if (get_fd_flags(g_fd_closed) != 0)
+        errx(1, "fd closed by the %s is not open in the parent", who);
+    if (get_fd_flags(g_fd_cloexec) != 0)
+        errx(1, "FD_CLOEXEC set by the %s is visible in the parent", who);
+    if (get_fd_flags(g_fd_new) >= 0)
+        errx(1, "fd created by the %s is open in the parent", who);
+}
+
+static void modify_table(void) {
+    if (close(g_fd_closed) < 0)
+        err(1, "close");
+    if (fcntl(g_fd_cloexec, F_SETFD, FD_CLOEXEC) < 0)
+        err(1, "fcntl(F_SETFD)");
+    if (dup2(g_pipefds[1], g_fd_new) != g_fd_new)
+        err(1, "dup2");
+
+    if (get_fd_flags(g_fd_closed) >= 0)
+        errx(1, "closed fd is still open");
+    if (get_fd_flags(g_fd_cloexec) != FD_CLOEXEC)
+        errx(1, "FD_CLOEXEC was not set");
+    if (get_fd_flags(g_fd_new) != 0)
+        errx(1, "new fd is not open");
+}
+
+static void* thread_func(void* arg) {
+    (void)arg;
+    /* closes nothing, only gives this thread its own copy of the table */
+    if (syscall(__NR_close_range, ~0U, ~0U, CLOSE_RANGE_UNSHARE) < 0)
+        err(1, "close_range(CLOSE_RANGE_UNSHARE)");
+    modify_table();
+    return NULL;
+}
+
+int main(void) {
+    if (pipe(g_pipefds) < 0)
+        err(1, "pipe");
+    g_fd_closed  = dup(g_pipefds[0]);
+    g_fd_cloexec = dup(g_pipefds[0]);
+    if (g_fd_closed < 0 || g_fd_cloexec < 0)
+        err(1, "dup");
+    g_fd_new = g_fd_cloexec + 10;
+
+    pthread_t thread;
+    int ret = pthread_create(&thread, NULL, thread_func, NULL);
+    if (ret != 0) {
+        errno = ret;
+        err(1, "pthread_create");
+    }
+    ret = pthread_join(thread, NULL);
+    if (ret != 0) {
+        errno = ret;
+        err(1, "pthread_join");
+    }
+    check_parent_table("thread");
+
+    pid_t pid = vfork();
+    if (pid < 0)
+        err(1, "vfork");
+    if (pid == 0) {
+        modify_table();
+        _exit(0);
+    }
+    int status;
+    if (waitpid(pid, &status, 0) != pid)
+        err(1, "waitpid");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        errx(1, "vfork child failed");
+    check_parent_table("vfork child");
+
+    /* the parent's table can still be modified, and the pipe works through it */
+    modify_table();
+    if (write(g_fd_new, "x", 1) != 1)
+        err(1, "write");
+    char c;
+    if (read(g_fd_cloexec, &c, 1) != 1 || c != 'x')
+        errx(1, "read from the pipe failed");
+
+    puts("TEST OK");
+    return 0;
+}
@@ -0,0 +1,79 @@
+/* Fork with `sys.fork_lazy_memory`: the child must see the memory of the parent at the time of
+ * fork(), both before and after its first system call, and none of the parent's later changes. */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define HEAP_SIZE (64 * 1024 * 1024)
+#define RO_SIZE   (4 * 4096)
+
+static uint64_t pattern(size_t i) {
+    return i * 0x9E3779B97F4A7C15ULL;
+}
+
+static size_t check(const uint64_t* words, size_t cnt) {
+    size_t bad = 0;
+    for (size_t i = 0; i < cnt; i++)
+        if (words[i] != pattern(i))
+            bad++;
+    return bad;
+}
+
+int main(void) {
+    setbuf(stdout, NULL);
+
+    uint64_t* heap = malloc(HEAP_SIZE);
+    if (!heap)
+        err(1, "malloc");
+    for (size_t i = 0; i < HEAP_SIZE / sizeof(*heap); i++)
+        heap[i] = pattern(i);
+
+    uint64_t* ro = mmap(NULL, RO_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ro == MAP_FAILED)
+        err(1, "mmap");
+    for (size_t i = 0; i < RO_SIZE / sizeof(*ro); i++)
+        ro[i] = pattern(i);
+    if (mprotect(ro, RO_SIZE, PROT_READ) < 0)
+        err(1, "mprotect");
+
+    pid_t pid = fork();
+    if (pid < 0)
+        err(1, "fork");
+
+    if (pid == 0) {
+        /* no system call before these checks, so that the memory is installed on access */
+        size_t bad = check(ro, RO_SIZE / sizeof(*ro));
+        bad += check(heap, HEAP_SIZE / sizeof(*heap));
+        heap[0] = 42;
+
+        /* the first system call installs the rest of memory, keeping the write above */
+        if (getpid() <= 0)
+            errx(1, "child: getpid failed");
+        if (bad)
+            errx(1, "child: %zu words differ from the parent's memory", bad);
+        if (heap[0] != 42)
+            errx(1, "child: write to the heap was lost");
+        heap[0] = pattern(0);
+        if (check(heap, HEAP_SIZE / sizeof(*heap)))
+            errx(1, "child: heap changed after the first system call");
+        exit(0);
+    }
+
+    memset(heap, 0, HEAP_SIZE);
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        err(1, "waitpid");
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+        errx(1, "child failed");
+
+    puts("TEST OK");
+    return 0;
+}
@@ -0,0 +1,56 @@
+/* MAP_SHARED | MAP_ANONYMOUS memory shared with a child (with `sys.shared_anonymous_memory`) */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define PAGES 4
+
+static void expect(const char* m, size_t size, char c, const char* what) {
+    for (size_t i = 0; i < size; i++) {
+        if (m[i] != c)
+            errx(1, "%s: byte %zu is 0x%x instead of 0x%x", what, i, m[i], c);
+    }
+}
+
+int main(void) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+
+    char* m = mmap(NULL, PAGES * page_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                   -1, 0);
+    if (m == MAP_FAILED)
+        err(1, "mmap");
+    expect(m, PAGES * page_size, 0, "new mapping");
+    memset(m, 'a', PAGES * page_size);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        err(1, "fork");
+    if (pid == 0) {
+        expect(m, PAGES * page_size, 'a', "child");
+        /* the results of workers, seen by the parent after wait() */
+        memset(m + page_size, 'b', page_size);
+        m[3 * page_size] = 'c';
+        return 0;
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        err(1, "waitpid");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        errx(1, "child failed");
+    expect(m, page_size, 'a', "page 0 (unchanged)");
+    expect(m + page_size, page_size, 'b', "page 1 (written by the child)");
+    expect(m + 2 * page_size, page_size, 'a', "page 2 (unchanged)");
+    expect(m + 3 * page_size, 1, 'c', "page 3 (written by the child)");
+    expect(m + 3 * page_size + 1, page_size - 1, 'a', "page 3 (unchanged)");
+
+    if (munmap(m, PAGES * page_size) < 0)
+        err(1, "munmap");
+    puts("TEST OK");
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* more than one child, so that all but the first are forked off the already running zygote */
+#define CHILDREN_CNT 10
+
+static int g_value = 42;
+
+static void wait_for(pid_t pid, int expected_status) {
+    int status;
+    if (waitpid(pid, &status, 0) != pid)
+        err(1, "waitpid");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != expected_status)
+        errx(1, "child %d exited with status %#x", pid, status);
+}
+
+static void child(int i, pid_t parent_pid, int pipe_fd) {
+    if (getppid() != parent_pid)
+        errx(1, "child %d: wrong parent PID %d", i, getppid());
+    if (g_value != 42 + i)
+        errx(1, "child %d: memory of the parent was not copied", i);
+
+    /* the children create processes too */
+    pid_t pid = fork();
+    if (pid < 0)
+        err(1, "fork");
+    if (pid == 0)
+        exit(i + 100);
+    wait_for(pid, i + 100);
+
+    pid_t self = getpid();
+    if (write(pipe_fd, &self, sizeof(self)) != sizeof(self))
+        err(1, "write");
+    exit(i);
+}
+
+int main(void) {
+    int pipefds[2];
+    if (pipe(pipefds) < 0)
+        err(1, "pipe");
+
+    pid_t parent_pid = getpid();
+    pid_t pids[CHILDREN_CNT];
+    for (int i = 0; i < CHILDREN_CNT; i++) {
+        g_value = 42 + i;
+        pids[i] = fork();
+        if (pids[i] < 0)
+            err(1, "fork");
+        if (pids[i] == 0) {
+            close(pipefds[0]);
+            child(i, parent_pid, pipefds[1]);
+        }
+    }
+    close(pipefds[1]);
+
+    for (int i = 0; i < CHILDREN_CNT; i++)
+        wait_for(pids[i], i);
+
+    for (int i = 0; i < CHILDREN_CNT; i++) {
+        pid_t pid;
+        if (read(pipefds[0], &pid, sizeof(pid)) != sizeof(pid))
+            errx(1, "missing PID of a child");
+        int found = 0;
+        for (int j = 0; j < CHILDREN_CNT; j++)
+            found |= pids[j] == pid;
+        if (!found)
+            errx(1, "unknown PID %d reported by a child", pid);
+    }
+
+    puts("TEST OK");
+    return 0;
+}
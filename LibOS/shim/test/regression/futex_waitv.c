@@ -0,0 +1,129 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef SYS_futex_waitv
+#define SYS_futex_waitv 449
+#endif
+
+#ifndef FUTEX_WAITV_MAX
+#define FUTEX_32 2
+
+struct futex_waitv {
+    uint64_t val;
+    uint64_t uaddr;
+    uint32_t flags;
+    uint32_t __reserved;
+};
+#endif
+
+#define FUTEXES 4
+
+static uint32_t g_futexes[FUTEXES];
+static struct futex_waitv g_waiters[FUTEXES];
+
+static long futex_waitv(struct futex_waitv* waiters, unsigned int nr_futexes,
+                        struct timespec* timeout) {
+    return syscall(SYS_futex_waitv, waiters, nr_futexes, 0, timeout, CLOCK_MONOTONIC);
+}
+
+static long futex_wake(uint32_t* uaddr, int to_wake) {
+    return syscall(SYS_futex, uaddr, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, to_wake, NULL, NULL, 0);
+}
+
+static void fail(const char* msg, int x) {
+    printf("%s failed with %d (%s)\n", msg, x, strerror(x));
+    exit(1);
+}
+
+static void* thread_func(void* arg) {
+    (void)arg;
+    long ret = futex_waitv(g_waiters, FUTEXES, NULL);
+    return (void*)ret;
+}
+
+int main(void) {
+    setbuf(stdout, NULL);
+
+    for (int i = 0; i < FUTEXES; i++) {
+        g_waiters[i].uaddr = (uintptr_t)&g_futexes[i];
+        g_waiters[i].val = 0;
+        g_waiters[i].flags = FUTEX_32 | FUTEX_PRIVATE_FLAG;
+    }
+
+    /* a mismatching value on any of the futexes makes the call fail right away */
+    g_futexes[2] = 1;
+    long ret = futex_waitv(g_waiters, FUTEXES, NULL);
+    if (ret != -1 || errno != EAGAIN) {
+        printf("futex_waitv with a mismatching value returned %ld (errno %d)\n", ret, errno);
+        return 1;
+    }
+    g_futexes[2] = 0;
+
+    /* the timeout is absolute */
+    struct timespec timeout;
+    if (clock_gettime(CLOCK_MONOTONIC, &timeout) < 0)
+        fail("clock_gettime", errno);
+    timeout.tv_nsec += 100 * 1000 * 1000;
+    if (timeout.tv_nsec >= 1000 * 1000 * 1000) {
+        timeout.tv_sec++;
+        timeout.tv_nsec -= 1000 * 1000 * 1000;
+    }
+    ret = futex_waitv(g_waiters, FUTEXES, &timeout);
+    if (ret != -1 || errno != ETIMEDOUT) {
+        printf("futex_waitv with a timeout returned %ld (errno %d)\n", ret, errno);
+        return 1;
+    }
+
+    /* a reserved flag (here: no size) is rejected */
+    g_waiters[1].flags = FUTEX_PRIVATE_FLAG;
+    ret = futex_waitv(g_waiters, FUTEXES, NULL);
+    if (ret != -1 || errno != EINVAL) {
+        printf("futex_waitv with invalid flags returned %ld (errno %d)\n", ret, errno);
+        return 1;
+    }
+    g_waiters[1].flags = FUTEX_32 | FUTEX_PRIVATE_FLAG;
+
+    /* a wakeup on one of the futexes wakes the thread, which gets the index of that futex */
+    pthread_t thread;
+    ret = pthread_create(&thread, NULL, thread_func, NULL);
+    if (ret)
+        fail("pthread_create", ret);
+
+    do {
+        /* the thread may not be sleeping yet */
+        usleep(10 * 1000);
+        ret = futex_wake(&g_futexes[3], 1);
+        if (ret < 0)
+            fail("futex_wake", errno);
+    } while (ret == 0);
+
+    void* retval;
+    ret = pthread_join(thread, &retval);
+    if (ret)
+        fail("pthread_join", ret);
+    if ((long)retval != 3) {
+        printf("futex_waitv in the thread returned %ld (expected: 3)\n", (long)retval);
+        return 1;
+    }
+
+    /* the thread is gone, so nobody waits on the other futexes anymore */
+    for (int i = 0; i < FUTEXES; i++) {
+        ret = futex_wake(&g_futexes[i], 1);
+        if (ret != 0) {
+            printf("futex_wake on futex %d woke %ld threads (expected: 0)\n", i, ret);
+            return 1;
+        }
+    }
+
+    puts("TEST OK");
+    return 0;
+}
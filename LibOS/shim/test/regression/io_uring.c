@@ -0,0 +1,257 @@
+/* io_uring: NOP, requests on a pipe completed immediately and after waiting for data, linked
+ * requests, fixed buffers, registered eventfd and the probe. */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+struct ring {
+    int fd;
+    unsigned int* sq_head;
+    unsigned int* sq_tail;
+    unsigned int* sq_mask;
+    unsigned int* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    unsigned int* cq_mask;
+    struct io_uring_cqe* cqes;
+};
+
+static void setup_ring(struct ring* ring, unsigned int entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd < 0)
+        err(1, "io_uring_setup");
+    if (p.sq_entries != entries || p.cq_entries != 2 * entries)
+        errx(1, "unexpected ring sizes: %u %u", p.sq_entries, p.cq_entries);
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    char* sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                    IORING_OFF_SQ_RING);
+    char* cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                    IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || ring->sqes == MAP_FAILED)
+        err(1, "mmap");
+
+    ring->sq_head  = (unsigned int*)(sq + p.sq_off.head);
+    ring->sq_tail  = (unsigned int*)(sq + p.sq_off.tail);
+    ring->sq_mask  = (unsigned int*)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned int*)(sq + p.sq_off.array);
+    ring->cq_head  = (unsigned int*)(cq + p.cq_off.head);
+    ring->cq_tail  = (unsigned int*)(cq + p.cq_off.tail);
+    ring->cq_mask  = (unsigned int*)(cq + p.cq_off.ring_mask);
+    ring->cqes     = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    if (*ring->sq_mask != entries - 1 || *ring->cq_mask != 2 * entries - 1)
+        errx(1, "unexpected ring masks");
+}
+
+static struct io_uring_sqe* get_sqe(struct ring* ring) {
+    unsigned int tail = *ring->sq_tail;
+    unsigned int idx = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+static int enter(struct ring* ring, unsigned int to_submit, unsigned int min_complete) {
+    int ret = syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete,
+                      min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (ret < 0)
+        err(1, "io_uring_enter");
+    return ret;
+}
+
+static unsigned int cq_ready(struct ring* ring) {
+    return __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) - *ring->cq_head;
+}
+
+static void get_cqe(struct ring* ring, uint64_t* user_data, int* res) {
+    if (!cq_ready(ring))
+        errx(1, "no completion");
+    struct io_uring_cqe* cqe = &ring->cqes[*ring->cq_head & *ring->cq_mask];
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+static void expect_cqe(struct ring* ring, uint64_t user_data, int res) {
+    uint64_t cqe_user_data;
+    int cqe_res;
+    get_cqe(ring, &cqe_user_data, &cqe_res);
+    if (cqe_user_data != user_data || cqe_res != res)
+        errx(1, "unexpected completion: user_data %lu res %d (expected %lu %d)",
+             (unsigned long)cqe_user_data, cqe_res, (unsigned long)user_data, res);
+}
+
+static void prep_rw(struct io_uring_sqe* sqe, int opcode, int fd, void* addr, unsigned int len,
+                    uint64_t user_data) {
+    sqe->opcode    = opcode;
+    sqe->fd        = fd;
+    sqe->addr      = (uintptr_t)addr;
+    sqe->len       = len;
+    sqe->off       = -1;
+    sqe->user_data = user_data;
+}
+
+static void test_nop(struct ring* ring) {
+    get_sqe(ring)->user_data = 1;
+    get_sqe(ring)->user_data = 2;
+    if (enter(ring, 2, 2) != 2)
+        errx(1, "NOP: not all submitted");
+    expect_cqe(ring, 1, 0);
+    expect_cqe(ring, 2, 0);
+
+    struct io_uring_sqe* sqe = get_sqe(ring);
+    sqe->opcode = 0xff;
+    sqe->user_data = 3;
+    enter(ring, 1, 1);
+    expect_cqe(ring, 3, -EINVAL);
+    puts("NOP OK");
+}
+
+static void test_pipe(struct ring* ring) {
+    int fds[2];
+    if (pipe(fds) < 0)
+        err(1, "pipe");
+
+    char buf[16] = { 0 };
+    /* completes only after the write below */
+    prep_rw(get_sqe(ring), IORING_OP_READ, fds[0], buf, sizeof(buf), 10);
+    enter(ring, 1, 0);
+    if (cq_ready(ring))
+        errx(1, "pipe read completed without data");
+
+    prep_rw(get_sqe(ring), IORING_OP_WRITE, fds[1], "hello", 5, 11);
+    enter(ring, 1, 2);
+    /* both complete in this call, in any order */
+    for (int i = 0; i < 2; i++) {
+        uint64_t user_data;
+        int res;
+        get_cqe(ring, &user_data, &res);
+        if ((user_data != 10 && user_data != 11) || res != 5)
+            errx(1, "unexpected pipe completion: user_data %lu res %d", (unsigned long)user_data,
+                 res);
+    }
+    if (memcmp(buf, "hello", 5))
+        errx(1, "wrong data read from pipe");
+
+    /* a chain: the read runs after the write, the NOP is cancelled after a failed read */
+    char out[] = "world";
+    struct iovec iov = { .iov_base = out, .iov_len = sizeof(out) };
+    struct io_uring_sqe* sqe = get_sqe(ring);
+    prep_rw(sqe, IORING_OP_WRITEV, fds[1], &iov, 1, 20);
+    sqe->flags = IOSQE_IO_LINK;
+    memset(buf, 0, sizeof(buf));
+    sqe = get_sqe(ring);
+    prep_rw(sqe, IORING_OP_READ, fds[0], buf, sizeof(buf), 21);
+    sqe->flags = IOSQE_IO_LINK;
+    sqe = get_sqe(ring);
+    prep_rw(sqe, IORING_OP_READ, /*fd=*/-1, buf, sizeof(buf), 22);
+    sqe->flags = IOSQE_IO_LINK;
+    get_sqe(ring)->user_data = 23;
+    enter(ring, 4, 4);
+    expect_cqe(ring, 20, sizeof(out));
+    expect_cqe(ring, 21, sizeof(out));
+    expect_cqe(ring, 22, -EBADF);
+    expect_cqe(ring, 23, -ECANCELED);
+    if (strcmp(buf, out))
+        errx(1, "wrong data read in chain");
+
+    close(fds[0]);
+    close(fds[1]);
+    puts("pipe OK");
+}
+
+static void test_registered(struct ring* ring) {
+    int fds[2];
+    if (pipe(fds) < 0)
+        err(1, "pipe");
+
+    static char buffer[4096];
+    struct iovec iov = { .iov_base = buffer, .iov_len = sizeof(buffer) };
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, &iov, 1) < 0)
+        err(1, "IORING_REGISTER_BUFFERS");
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES, fds, 2) < 0)
+        err(1, "IORING_REGISTER_FILES");
+    int efd = eventfd(0, 0);
+    if (efd < 0)
+        err(1, "eventfd");
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_EVENTFD, &efd, 1) < 0)
+        err(1, "IORING_REGISTER_EVENTFD");
+
+    memcpy(buffer, "fixed", 5);
+    struct io_uring_sqe* sqe = get_sqe(ring);
+    prep_rw(sqe, IORING_OP_WRITE_FIXED, /*fixed file index=*/1, buffer, 5, 30);
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe = get_sqe(ring);
+    prep_rw(sqe, IORING_OP_READ_FIXED, /*fixed file index=*/0, buffer + 100, 5, 31);
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_DRAIN;
+    sqe = get_sqe(ring);
+    prep_rw(sqe, IORING_OP_READ_FIXED, fds[0], buffer + sizeof(buffer) - 1, 5, 32);
+    enter(ring, 3, 3);
+    expect_cqe(ring, 30, 5);
+    expect_cqe(ring, 31, 5);
+    expect_cqe(ring, 32, -EFAULT);
+    if (memcmp(buffer + 100, "fixed", 5))
+        errx(1, "wrong data read into fixed buffer");
+
+    uint64_t count;
+    if (read(efd, &count, sizeof(count)) != sizeof(count) || !count)
+        errx(1, "registered eventfd not signaled");
+
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_UNREGISTER_EVENTFD, NULL, 0) < 0)
+        err(1, "IORING_UNREGISTER_EVENTFD");
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_UNREGISTER_FILES, NULL, 0) < 0)
+        err(1, "IORING_UNREGISTER_FILES");
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_UNREGISTER_BUFFERS, NULL, 0) < 0)
+        err(1, "IORING_UNREGISTER_BUFFERS");
+    close(efd);
+    close(fds[0]);
+    close(fds[1]);
+    puts("registered OK");
+}
+
+static void test_probe(struct ring* ring) {
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = calloc(1, size);
+    if (!probe)
+        err(1, "calloc");
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+        err(1, "IORING_REGISTER_PROBE");
+    if (probe->ops_len <= IORING_OP_READ || !(probe->ops[IORING_OP_READ].flags
+                                              & IO_URING_OP_SUPPORTED))
+        errx(1, "IORING_OP_READ not reported as supported");
+    free(probe);
+    puts("probe OK");
+}
+
+int main(void) {
+    struct ring ring;
+    setup_ring(&ring, 8);
+
+    test_nop(&ring);
+    test_pipe(&ring);
+    test_registered(&ring);
+    test_probe(&ring);
+
+    close(ring.fd);
+    puts("TEST OK");
+    return 0;
+}
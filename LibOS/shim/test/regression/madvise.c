@@ -7,6 +7,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
@@ -15,6 +16,27 @@
 
 #define PAGES_CNT 128
 
+static size_t read_vm_rss_kb(void) {
+    FILE* f = fopen("/proc/self/status", "r");
+    if (!f)
+        err(1, "fopen(/proc/self/status)");
+
+    char line[128];
+    size_t rss = 0;
+    bool found = false;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "VmRSS: %zu kB", &rss) == 1) {
+            found = true;
+            break;
+        }
+    }
+    fclose(f);
+
+    if (!found)
+        errx(1, "no VmRSS in /proc/self/status");
+    return rss;
+}
+
 int main() {
     size_t page_size = getpagesize();
 
@@ -53,6 +75,24 @@ int main() {
             }
         }
     }
+
+    /* After MADV_FREE, pages keep either their contents or get zeroed, until they are written to */
+    memset(m, 0x42, PAGES_CNT * page_size);
+    if (madvise(m, PAGES_CNT * page_size, MADV_FREE))
+        err(1, "madvise(MADV_FREE) failed");
+    for (size_t i = 0; i < PAGES_CNT * page_size; i++) {
+        if (m[i] != 0 && m[i] != 0x42)
+            errx(1, "byte %zu has wrong contents after MADV_FREE: 0x%x", i, m[i]);
+    }
+    memset(m, 0x24, PAGES_CNT * page_size);
+    for (size_t i = 0; i < PAGES_CNT * page_size; i++) {
+        if (m[i] != 0x24)
+            errx(1, "byte %zu has wrong contents after writing to freed memory", i);
+    }
+
+    if (read_vm_rss_kb() == 0)
+        errx(1, "resident memory is not reported");
+
     puts("TEST OK");
     return 0;
 }
@@ -0,0 +1,81 @@
+/* membarrier() with the private expedited commands, while other threads run application code or
+ * are blocked in a syscall */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <linux/membarrier.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define THREADS    4
+#define ITERATIONS 1000
+
+static volatile bool g_stop = false;
+static int g_pipe[2];
+
+static long membarrier(int cmd, unsigned int flags) {
+    return syscall(__NR_membarrier, cmd, flags, 0);
+}
+
+static void* spin(void* arg) {
+    (void)arg;
+    while (!g_stop)
+        ;
+    return NULL;
+}
+
+static void* block(void* arg) {
+    (void)arg;
+    char c;
+    if (read(g_pipe[0], &c, 1) != 1)
+        err(1, "read");
+    return NULL;
+}
+
+int main(void) {
+    long cmds = membarrier(MEMBARRIER_CMD_QUERY, 0);
+    if (cmds < 0)
+        err(1, "MEMBARRIER_CMD_QUERY");
+    if (!(cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED)
+            || !(cmds & MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED))
+        errx(1, "MEMBARRIER_CMD_PRIVATE_EXPEDITED not supported (0x%lx)", cmds);
+
+    if (membarrier(MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0) != -1 || errno != EPERM)
+        errx(1, "MEMBARRIER_CMD_PRIVATE_EXPEDITED without registration didn't fail with EPERM");
+    if (membarrier(MEMBARRIER_CMD_QUERY, 1) != -1 || errno != EINVAL)
+        errx(1, "membarrier with invalid flags didn't fail with EINVAL");
+
+    if (membarrier(MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) < 0)
+        err(1, "MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED");
+
+    if (pipe(g_pipe) < 0)
+        err(1, "pipe");
+
+    pthread_t threads[THREADS];
+    for (int i = 0; i < THREADS; i++) {
+        int ret = pthread_create(&threads[i], NULL, i % 2 ? block : spin, NULL);
+        if (ret)
+            errx(1, "pthread_create: %d", ret);
+    }
+
+    for (int i = 0; i < ITERATIONS; i++)
+        if (membarrier(MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0) < 0)
+            err(1, "MEMBARRIER_CMD_PRIVATE_EXPEDITED");
+
+    g_stop = true;
+    char buf[THREADS] = {0};
+    if (write(g_pipe[1], buf, sizeof(buf)) != sizeof(buf))
+        err(1, "write");
+    for (int i = 0; i < THREADS; i++) {
+        int ret = pthread_join(threads[i], NULL);
+        if (ret)
+            errx(1, "pthread_join: %d", ret);
+    }
+
+    puts("TEST OK");
+    return 0;
+}
@@ -0,0 +1,104 @@
+/* Growing, shrinking and moving anonymous mappings with mremap(). */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static size_t g_page_size;
+
+static void fill(char* m, size_t pages) {
+    for (size_t i = 0; i < pages; i++)
+        memset(m + i * g_page_size, (char)(i + 1), g_page_size);
+}
+
+static void check(const char* m, size_t pages, const char* what) {
+    for (size_t i = 0; i < pages; i++) {
+        for (size_t j = 0; j < g_page_size; j++) {
+            if (m[i * g_page_size + j] != (char)(i + 1))
+                errx(1, "%s: wrong contents of page %zu", what, i);
+        }
+    }
+}
+
+static void check_zero(const char* m, size_t size, const char* what) {
+    for (size_t i = 0; i < size; i++) {
+        if (m[i])
+            errx(1, "%s: grown memory is not zeroed", what);
+    }
+}
+
+int main(void) {
+    setbuf(stdout, NULL);
+    g_page_size = getpagesize();
+
+    /* reserve a range and free its upper half, so that the mapping can grow in place */
+    char* m = mmap(NULL, 8 * g_page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                   -1, 0);
+    if (m == MAP_FAILED)
+        err(1, "mmap");
+    if (munmap(m + 4 * g_page_size, 4 * g_page_size) < 0)
+        err(1, "munmap");
+    fill(m, 4);
+
+    char* p = mremap(m, 4 * g_page_size, 8 * g_page_size, 0);
+    if (p != m)
+        err(1, "growing in place");
+    check(p, 4, "growing in place");
+    check_zero(p + 4 * g_page_size, 4 * g_page_size, "growing in place");
+
+    /* the grown mapping is a single one, so it can be shrunk and grown again */
+    p = mremap(m, 8 * g_page_size, 2 * g_page_size, 0);
+    if (p != m)
+        err(1, "shrinking");
+    check(p, 2, "shrinking");
+    p = mremap(m, 2 * g_page_size, 6 * g_page_size, 0);
+    if (p != m)
+        err(1, "growing again");
+    fill(p, 6);
+
+    /* a mapping followed by another one cannot grow without MREMAP_MAYMOVE */
+    char* guard = mmap(m + 6 * g_page_size, g_page_size, PROT_NONE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    if (guard != m + 6 * g_page_size)
+        err(1, "mmap of a guard page");
+    if (mremap(m, 6 * g_page_size, 7 * g_page_size, 0) != MAP_FAILED || errno != ENOMEM)
+        errx(1, "growing into another mapping didn't fail with ENOMEM");
+
+    p = mremap(m, 6 * g_page_size, 16 * g_page_size, MREMAP_MAYMOVE);
+    if (p == MAP_FAILED)
+        err(1, "moving");
+    if (p == m)
+        errx(1, "mapping was grown over another mapping");
+    check(p, 6, "moving");
+    check_zero(p + 6 * g_page_size, 10 * g_page_size, "moving");
+    if (msync(m, g_page_size, MS_ASYNC) != -1 || errno != ENOMEM)
+        errx(1, "old mapping still exists after moving");
+
+    /* move to a fixed address, replacing anything that was there */
+    char* q = mremap(p, 6 * g_page_size, 3 * g_page_size, MREMAP_MAYMOVE | MREMAP_FIXED, m);
+    if (q != m)
+        err(1, "moving to a fixed address");
+    check(q, 3, "moving to a fixed address");
+
+    /* error cases */
+    if (mremap(m + 1, g_page_size, 2 * g_page_size, MREMAP_MAYMOVE) != MAP_FAILED
+            || errno != EINVAL)
+        errx(1, "mremap of an unaligned address didn't fail with EINVAL");
+    if (mremap(m, g_page_size, 2 * g_page_size, MREMAP_FIXED, p) != MAP_FAILED || errno != EINVAL)
+        errx(1, "MREMAP_FIXED without MREMAP_MAYMOVE didn't fail with EINVAL");
+    if (mremap(m, 2 * g_page_size, 3 * g_page_size, MREMAP_MAYMOVE | MREMAP_FIXED,
+               m + g_page_size) != MAP_FAILED || errno != EINVAL)
+        errx(1, "moving to an overlapping range didn't fail with EINVAL");
+    if (munmap(m, 3 * g_page_size) < 0)
+        err(1, "munmap");
+    if (mremap(m, g_page_size, 2 * g_page_size, MREMAP_MAYMOVE) != MAP_FAILED || errno != EFAULT)
+        errx(1, "mremap of unmapped memory didn't fail with EFAULT");
+
+    puts("TEST OK");
+    return 0;
+}
@@ -0,0 +1,92 @@
+/* Write-back of writable shared file mappings on msync(), fsync() and munmap() */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TEST_FILE "tmp/msync_shared.tmp"
+
+static size_t g_page_size;
+
+static void expect_file(int fd, size_t pos, size_t size, char c, const char* what) {
+    char* buf = malloc(size);
+    if (!buf)
+        err(1, "malloc");
+    if (pread(fd, buf, size, pos) != (ssize_t)size)
+        err(1, "%s: pread", what);
+    for (size_t i = 0; i < size; i++) {
+        if (buf[i] != c)
+            errx(1, "%s: byte %zu of the file is 0x%x instead of 0x%x", what, pos + i, buf[i], c);
+    }
+    free(buf);
+}
+
+int main(void) {
+    g_page_size = sysconf(_SC_PAGESIZE);
+    size_t file_size = 3 * g_page_size + g_page_size / 2;
+
+    int fd = open(TEST_FILE, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+        err(1, "open");
+    char* buf = malloc(file_size);
+    if (!buf)
+        err(1, "malloc");
+    memset(buf, 'a', file_size);
+    if (write(fd, buf, file_size) != (ssize_t)file_size)
+        err(1, "write");
+    free(buf);
+
+    char* m = mmap(NULL, 4 * g_page_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED)
+        err(1, "mmap");
+    if (m[0] != 'a' || m[file_size - 1] != 'a' || m[file_size] != 0)
+        errx(1, "wrong contents of the mapping");
+
+    memset(m + g_page_size, 'b', g_page_size);
+    if (msync(m, 4 * g_page_size, MS_SYNC) < 0)
+        err(1, "msync(MS_SYNC)");
+    expect_file(fd, 0, g_page_size, 'a', "MS_SYNC");
+    expect_file(fd, g_page_size, g_page_size, 'b', "MS_SYNC");
+
+    /* a clean page doesn't overwrite what was written to the file in the meantime */
+    char c = 'c';
+    if (pwrite(fd, &c, 1, 0) != 1)
+        err(1, "pwrite");
+    memset(m + 2 * g_page_size, 'd', g_page_size);
+    if (msync(m, 4 * g_page_size, MS_ASYNC) < 0)
+        err(1, "msync(MS_ASYNC)");
+    expect_file(fd, 0, 1, 'c', "MS_ASYNC");
+    expect_file(fd, 2 * g_page_size, g_page_size, 'd', "MS_ASYNC");
+    puts("msync OK");
+
+    memset(m + g_page_size, 'e', g_page_size);
+    if (fsync(fd) < 0)
+        err(1, "fsync");
+    expect_file(fd, g_page_size, g_page_size, 'e', "fsync");
+    puts("fsync OK");
+
+    /* stores past the end of file don't extend it */
+    memset(m + 3 * g_page_size, 'f', g_page_size);
+    if (munmap(m, 4 * g_page_size) < 0)
+        err(1, "munmap");
+    expect_file(fd, 3 * g_page_size, g_page_size / 2, 'f', "munmap");
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+        err(1, "fstat");
+    if ((size_t)st.st_size != file_size)
+        errx(1, "file size changed to %ld", (long)st.st_size);
+    puts("munmap OK");
+
+    if (close(fd) < 0)
+        err(1, "close");
+    if (unlink(TEST_FILE) < 0)
+        err(1, "unlink");
+    puts("TEST OK");
+    return 0;
+}
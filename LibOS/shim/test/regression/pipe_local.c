@@ -0,0 +1,141 @@
+/* Pipes whose both ends stay in one process, and what happens to them on fork(). */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define TOTAL_SIZE (1024 * 1024)
+#define CHUNK_SIZE 1000
+
+static int g_pipefd[2];
+
+static void* writer(void* arg) {
+    static char buf[CHUNK_SIZE];
+    size_t done = 0;
+    while (done < TOTAL_SIZE) {
+        size_t size = TOTAL_SIZE - done < sizeof(buf) ? TOTAL_SIZE - done : sizeof(buf);
+        for (size_t i = 0; i < size; i++)
+            buf[i] = (char)(done + i);
+        ssize_t ret = write(g_pipefd[1], buf, size);
+        if (ret < 0)
+            err(1, "write");
+        done += ret;
+    }
+    if (close(g_pipefd[1]) < 0)
+        err(1, "close");
+    return arg;
+}
+
+int main(void) {
+    setbuf(stdout, NULL);
+
+    /* data written by another thread comes out in order, more than fits into the pipe at once */
+    if (pipe(g_pipefd) < 0)
+        err(1, "pipe");
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, writer, NULL))
+        errx(1, "pthread_create failed");
+
+    static char buf[4096];
+    size_t done = 0;
+    while (1) {
+        ssize_t ret = read(g_pipefd[0], buf, sizeof(buf));
+        if (ret < 0)
+            err(1, "read");
+        if (ret == 0)
+            break;
+        for (ssize_t i = 0; i < ret; i++) {
+            if (buf[i] != (char)(done + i))
+                errx(1, "wrong data at offset %zu", done + i);
+        }
+        done += ret;
+    }
+    if (done != TOTAL_SIZE)
+        errx(1, "read %zu bytes instead of %d", done, TOTAL_SIZE);
+    if (pthread_join(thread, NULL))
+        errx(1, "pthread_join failed");
+    close(g_pipefd[0]);
+
+    /* non-blocking pipes report EAGAIN, poll() follows the fill level */
+    if (pipe2(g_pipefd, O_NONBLOCK) < 0)
+        err(1, "pipe2");
+    if (read(g_pipefd[0], buf, sizeof(buf)) != -1 || errno != EAGAIN)
+        errx(1, "read from an empty non-blocking pipe didn't fail with EAGAIN");
+
+    struct pollfd fds[2] = {
+        { .fd = g_pipefd[0], .events = POLLIN },
+        { .fd = g_pipefd[1], .events = POLLOUT },
+    };
+    if (poll(fds, 2, 0) != 1 || fds[0].revents || !(fds[1].revents & POLLOUT))
+        errx(1, "poll on an empty pipe: read end %#x, write end %#x", fds[0].revents,
+             fds[1].revents);
+
+    size_t filled = 0;
+    while (1) {
+        ssize_t ret = write(g_pipefd[1], buf, sizeof(buf));
+        if (ret < 0) {
+            if (errno == EAGAIN)
+                break;
+            err(1, "write");
+        }
+        filled += ret;
+    }
+    if (poll(fds, 2, 0) != 1 || !(fds[0].revents & POLLIN) || fds[1].revents)
+        errx(1, "poll on a full pipe: read end %#x, write end %#x", fds[0].revents,
+             fds[1].revents);
+
+    /* drain a bit, so that the child below gets the rest of the data */
+    if (read(g_pipefd[0], buf, sizeof(buf)) != sizeof(buf))
+        err(1, "read");
+    filled -= sizeof(buf);
+
+    /* the pipe keeps working and keeps its contents once it's shared with a child */
+    pid_t pid = fork();
+    if (pid < 0)
+        err(1, "fork");
+    if (pid == 0) {
+        close(g_pipefd[1]);
+        int flags = fcntl(g_pipefd[0], F_GETFL);
+        if (flags < 0 || fcntl(g_pipefd[0], F_SETFL, flags & ~O_NONBLOCK) < 0)
+            err(1, "fcntl");
+
+        size_t got = 0;
+        while (1) {
+            ssize_t ret = read(g_pipefd[0], buf, sizeof(buf));
+            if (ret < 0)
+                err(1, "child read");
+            if (ret == 0)
+                break;
+            got += ret;
+        }
+        if (got != filled + 1)
+            errx(1, "child read %zu bytes instead of %zu", got, filled + 1);
+        exit(0);
+    }
+
+    close(g_pipefd[0]);
+    int flags = fcntl(g_pipefd[1], F_GETFL);
+    if (flags < 0 || fcntl(g_pipefd[1], F_SETFL, flags & ~O_NONBLOCK) < 0)
+        err(1, "fcntl");
+    if (write(g_pipefd[1], "x", 1) != 1)
+        err(1, "write after fork");
+    close(g_pipefd[1]);
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        err(1, "waitpid");
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+        errx(1, "child failed");
+
+    puts("TEST OK");
+    return 0;
+}
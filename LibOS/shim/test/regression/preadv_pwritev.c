@@ -0,0 +1,97 @@
+/* preadv(), pwritev(), preadv2() and pwritev2() on a file and on a pipe */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define TEST_FILE "tmp/preadv_pwritev.tmp"
+
+static void expect_pos(int fd, off_t pos) {
+    off_t cur = lseek(fd, 0, SEEK_CUR);
+    if (cur != pos)
+        errx(1, "file position is %ld instead of %ld", (long)cur, (long)pos);
+}
+
+int main(void) {
+    int fd = open(TEST_FILE, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+        err(1, "open");
+    if (write(fd, "0123456789", 10) != 10)
+        err(1, "write");
+    if (lseek(fd, 2, SEEK_SET) != 2)
+        err(1, "lseek");
+
+    /* pwritev() and preadv() must not move the file position */
+    char hello[] = "hello";
+    char world[] = " world";
+    struct iovec wiov[2] = {
+        { .iov_base = hello, .iov_len = strlen(hello) },
+        { .iov_base = world, .iov_len = strlen(world) },
+    };
+    ssize_t ret = pwritev(fd, wiov, 2, 4);
+    if (ret != 11)
+        errx(1, "pwritev returned %zd (errno %d)", ret, errno);
+    expect_pos(fd, 2);
+
+    char buf1[3];
+    char buf2[32] = {0};
+    struct iovec riov[2] = {
+        { .iov_base = buf1, .iov_len = sizeof(buf1) },
+        { .iov_base = buf2, .iov_len = sizeof(buf2) },
+    };
+    ret = preadv(fd, riov, 2, 1);
+    if (ret != 14)
+        errx(1, "preadv returned %zd (errno %d)", ret, errno);
+    if (memcmp(buf1, "123", 3) || strcmp(buf2, "hello world"))
+        errx(1, "preadv returned wrong data");
+    expect_pos(fd, 2);
+    puts("preadv/pwritev OK");
+
+    /* with offset -1, preadv2() and pwritev2() use and advance the file position */
+    memset(buf2, 0, sizeof(buf2));
+    ret = preadv2(fd, riov, 2, -1, 0);
+    if (ret != 13)
+        errx(1, "preadv2 returned %zd (errno %d)", ret, errno);
+    if (memcmp(buf1, "23h", 3) || strcmp(buf2, "ello world"))
+        errx(1, "preadv2 returned wrong data");
+    expect_pos(fd, 15);
+
+    ret = pwritev2(fd, wiov, 1, 0, RWF_DSYNC);
+    if (ret != 5)
+        errx(1, "pwritev2 returned %zd (errno %d)", ret, errno);
+    expect_pos(fd, 15);
+    ret = pwritev2(fd, wiov, 1, -1, 0);
+    if (ret != 5)
+        errx(1, "pwritev2 returned %zd (errno %d)", ret, errno);
+    expect_pos(fd, 20);
+
+    if (preadv2(fd, riov, 2, 0, 0x80000000) != -1 || errno != EOPNOTSUPP)
+        errx(1, "preadv2 with unknown flags did not fail with EOPNOTSUPP");
+    if (preadv(fd, riov, 2, -1) != -1 || errno != EINVAL)
+        errx(1, "preadv with negative offset did not fail with EINVAL");
+    close(fd);
+    puts("preadv2/pwritev2 OK");
+
+    int fds[2];
+    if (pipe(fds) < 0)
+        err(1, "pipe");
+    if (pwritev(fds[1], wiov, 2, 0) != -1 || errno != ESPIPE)
+        errx(1, "pwritev on a pipe did not fail with ESPIPE");
+    if (pwritev2(fds[1], wiov, 2, -1, 0) != 11)
+        err(1, "pwritev2 on a pipe");
+    if (preadv2(fds[0], riov, 2, -1, 0) != 11)
+        err(1, "preadv2 on a pipe");
+    close(fds[0]);
+    close(fds[1]);
+    puts("pipe OK");
+
+    if (unlink(TEST_FILE) < 0)
+        err(1, "unlink");
+    puts("TEST OK");
+    return 0;
+}
@@ -0,0 +1,93 @@
+/* /proc/self/graphene/io: PAL stream I/O counters per class of streams. */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define STATS_PATH "/proc/self/graphene/io"
+#define FILE_PATH  "tmp/proc_io_file"
+#define FILE_SIZE  (64 * 1024)
+#define PIPE_SIZE  100
+
+struct io_stat {
+    uint64_t reads, read_bytes, read_us;
+    uint64_t writes, write_bytes, write_us;
+    uint64_t waits, wait_us;
+};
+
+static char g_buf[FILE_SIZE];
+
+/* all zeros if the class had no I/O yet */
+static void read_stat(const char* name, struct io_stat* stat) {
+    FILE* f = fopen(STATS_PATH, "r");
+    if (!f)
+        err(1, "fopen " STATS_PATH);
+
+    memset(stat, 0, sizeof(*stat));
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        char class[32];
+        struct io_stat values;
+        if (sscanf(line, "%31s %lu %lu %lu %lu %lu %lu %lu %lu", class, &values.reads,
+                   &values.read_bytes, &values.read_us, &values.writes, &values.write_bytes,
+                   &values.write_us, &values.waits, &values.wait_us) != 9)
+            errx(1, "malformed line in " STATS_PATH ": %s", line);
+        if (!values.reads && !values.writes && !values.waits)
+            errx(1, "line of a class without I/O in " STATS_PATH ": %s", line);
+        if (!strcmp(class, name))
+            *stat = values;
+    }
+
+    fclose(f);
+}
+
+int main(void) {
+    struct io_stat file_before, pipe_before;
+    read_stat("file", &file_before);
+    read_stat("pipe", &pipe_before);
+
+    int fd = open(FILE_PATH, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+        err(1, "open " FILE_PATH);
+    memset(g_buf, 'x', sizeof(g_buf));
+    if (write(fd, g_buf, sizeof(g_buf)) != sizeof(g_buf))
+        err(1, "write");
+    if (fsync(fd) < 0)
+        err(1, "fsync");
+    if (close(fd) < 0)
+        err(1, "close");
+
+    int pipefds[2];
+    if (pipe(pipefds) < 0)
+        err(1, "pipe");
+    if (write(pipefds[1], g_buf, PIPE_SIZE) != PIPE_SIZE)
+        err(1, "write to pipe");
+    if (read(pipefds[0], g_buf, PIPE_SIZE) != PIPE_SIZE)
+        err(1, "read from pipe");
+    close(pipefds[0]);
+    close(pipefds[1]);
+
+    struct io_stat file_after, pipe_after;
+    read_stat("file", &file_after);
+    read_stat("pipe", &pipe_after);
+
+    if (file_after.writes <= file_before.writes
+            || file_after.write_bytes - file_before.write_bytes < FILE_SIZE)
+        errx(1, "writes to the file not counted");
+    if (pipe_after.writes <= pipe_before.writes
+            || pipe_after.write_bytes - pipe_before.write_bytes < PIPE_SIZE)
+        errx(1, "writes to the pipe not counted");
+    if (pipe_after.reads <= pipe_before.reads
+            || pipe_after.read_bytes - pipe_before.read_bytes < PIPE_SIZE)
+        errx(1, "reads from the pipe not counted");
+
+    if (unlink(FILE_PATH) < 0)
+        err(1, "unlink");
+
+    puts("TEST OK");
+    return 0;
+}
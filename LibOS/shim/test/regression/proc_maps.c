@@ -0,0 +1,102 @@
+/* /proc/self/maps and VmSize of /proc/self/status follow changes of the mappings */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define PAGES 16
+
+static char g_buf[1024 * 1024];
+
+static const char* read_file(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        err(1, "open %s", path);
+    size_t len = 0;
+    while (true) {
+        ssize_t n = read(fd, g_buf + len, sizeof(g_buf) - 1 - len);
+        if (n < 0)
+            err(1, "read %s", path);
+        if (n == 0)
+            break;
+        len += n;
+        if (len == sizeof(g_buf) - 1)
+            errx(1, "%s is too big", path);
+    }
+    g_buf[len] = '\0';
+    if (close(fd) < 0)
+        err(1, "close %s", path);
+    return g_buf;
+}
+
+static bool has_mapping(void* start, void* end, const char* perms) {
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "%08lx-%08lx %s ", (unsigned long)start, (unsigned long)end,
+             perms);
+    const char* maps = read_file("/proc/self/maps");
+    for (const char* line = maps; *line; line = strchr(line, '\n') + 1) {
+        if (!strncmp(line, prefix, strlen(prefix)))
+            return true;
+        if (!strchr(line, '\n'))
+            break;
+    }
+    return false;
+}
+
+static unsigned long vm_size_kb(void) {
+    const char* status = read_file("/proc/self/status");
+    const char* vm_size = strstr(status, "VmSize:");
+    if (!vm_size)
+        errx(1, "no VmSize in /proc/self/status");
+    return strtoul(vm_size + strlen("VmSize:"), NULL, 10);
+}
+
+int main(void) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t size = PAGES * page_size;
+
+    /* the same contents on repeated reads */
+    static char first[sizeof(g_buf)];
+    strcpy(first, read_file("/proc/self/maps"));
+    if (strcmp(first, read_file("/proc/self/maps")))
+        errx(1, "/proc/self/maps changed without any mapping changes");
+
+    unsigned long vm_size_before = vm_size_kb();
+
+    /* guard pages around the mapping, so that the host does not merge it with neighbours */
+    char* reserved = mmap(NULL, size + 2 * page_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1,
+                          0);
+    if (reserved == MAP_FAILED)
+        err(1, "mmap of reserved range");
+    char* m = mmap(reserved + page_size, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    if (m == MAP_FAILED)
+        err(1, "mmap");
+    if (!has_mapping(m, m + size, "rw-p"))
+        errx(1, "new mapping not in /proc/self/maps");
+    if (vm_size_kb() < vm_size_before + size / 1024)
+        errx(1, "VmSize did not grow (%lu kB before)", vm_size_before);
+
+    if (mprotect(m + page_size, page_size, PROT_READ) < 0)
+        err(1, "mprotect");
+    char* ro = m + page_size;
+    if (!has_mapping(m, ro, "rw-p") || !has_mapping(ro, ro + page_size, "r--p")
+            || !has_mapping(ro + page_size, m + size, "rw-p"))
+        errx(1, "mprotect not reflected in /proc/self/maps");
+
+    if (munmap(reserved, size + 2 * page_size) < 0)
+        err(1, "munmap");
+    if (has_mapping(m, ro, "rw-p") || has_mapping(ro, ro + page_size, "r--p"))
+        errx(1, "unmapped mapping still in /proc/self/maps");
+    if (vm_size_kb() != vm_size_before)
+        errx(1, "VmSize is not back to %lu kB", vm_size_before);
+
+    puts("TEST OK");
+    return 0;
+}
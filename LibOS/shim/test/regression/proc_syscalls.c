@@ -0,0 +1,128 @@
+/* /proc/self/graphene/syscalls: per-syscall counters and latency histograms of all threads (the
+ * manifest enables `libos.syscall_latency_stats`). getppid() is answered by the fast path of
+ * syscalldb and only counted, sched_yield() goes through the full syscall emulation and is also
+ * timed. */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define STATS_PATH "/proc/self/graphene/syscalls"
+#define BUCKETS    24
+#define CALLS      100
+
+struct syscall_stat {
+    uint64_t count;
+    uint64_t time_us;
+    uint64_t buckets[BUCKETS];
+};
+
+static int read_stat(const char* name, struct syscall_stat* stat) {
+    FILE* f = fopen(STATS_PATH, "r");
+    if (!f)
+        err(1, "fopen " STATS_PATH);
+
+    int found = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), f)) {
+        char* saveptr;
+        char* token = strtok_r(line, " \n", &saveptr);
+        if (!token)
+            errx(1, "empty line in " STATS_PATH);
+
+        int match = !strcmp(token, name);
+        uint64_t values[2 + BUCKETS];
+        size_t n = 0;
+        while ((token = strtok_r(NULL, " \n", &saveptr))) {
+            if (n == 2 + BUCKETS)
+                errx(1, "too many columns in " STATS_PATH);
+            values[n++] = strtoull(token, NULL, 10);
+        }
+        if (n != 2 + BUCKETS)
+            errx(1, "too few columns in " STATS_PATH);
+
+        uint64_t timed = 0;
+        for (size_t i = 0; i < BUCKETS; i++)
+            timed += values[2 + i];
+        if (timed > values[0])
+            errx(1, "more timed than counted calls of %s", line);
+
+        if (match) {
+            stat->count   = values[0];
+            stat->time_us = values[1];
+            memcpy(stat->buckets, &values[2], sizeof(stat->buckets));
+            found = 1;
+        }
+    }
+
+    fclose(f);
+    return found;
+}
+
+static void do_calls(void) {
+    for (int i = 0; i < CALLS; i++) {
+        syscall(SYS_getppid);
+        syscall(SYS_sched_yield);
+    }
+}
+
+static void* thread_func(void* arg) {
+    (void)arg;
+    do_calls();
+    return NULL;
+}
+
+static uint64_t timed_calls(struct syscall_stat* before, struct syscall_stat* after) {
+    uint64_t timed = 0;
+    for (size_t i = 0; i < BUCKETS; i++)
+        timed += after->buckets[i] - before->buckets[i];
+    return timed;
+}
+
+int main(void) {
+    setbuf(stdout, NULL);
+
+    struct syscall_stat fast_before = {0};
+    struct syscall_stat slow_before = {0};
+    read_stat("getppid", &fast_before);
+    read_stat("sched_yield", &slow_before);
+
+    do_calls();
+
+    /* counters of exited threads are kept */
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, thread_func, NULL) != 0)
+        errx(1, "pthread_create");
+    if (pthread_join(thread, NULL) != 0)
+        errx(1, "pthread_join");
+
+    struct syscall_stat fast_after;
+    if (!read_stat("getppid", &fast_after))
+        errx(1, "no getppid line in " STATS_PATH);
+    if (fast_after.count - fast_before.count != 2 * CALLS)
+        errx(1, "getppid counted %lu times instead of %d", fast_after.count - fast_before.count,
+             2 * CALLS);
+
+    struct syscall_stat slow_after;
+    if (!read_stat("sched_yield", &slow_after))
+        errx(1, "no sched_yield line in " STATS_PATH);
+    if (slow_after.count - slow_before.count != 2 * CALLS)
+        errx(1, "sched_yield counted %lu times instead of %d",
+             slow_after.count - slow_before.count, 2 * CALLS);
+    uint64_t timed = timed_calls(&slow_before, &slow_after);
+    if (timed != 2 * CALLS)
+        errx(1, "sched_yield timed %lu times instead of %d", timed, 2 * CALLS);
+
+    struct syscall_stat open_stat;
+    if (!read_stat("openat", &open_stat) || !open_stat.count)
+        errx(1, "opens of " STATS_PATH " not counted");
+
+    puts("TEST OK");
+    return 0;
+}
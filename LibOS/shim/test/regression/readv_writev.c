@@ -0,0 +1,72 @@
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define TEST_FILE "tmp/readv_writev.tmp"
+
+static const char* g_parts[] = {"header: 1\r\n", "\r\n", "body of the message"};
+
+/* writes `g_parts` with one writev() and reads them back with one readv() into differently sized
+ * buffers */
+static void test_rw(int wfd, int rfd, off_t rewind_to) {
+    struct iovec wiov[3];
+    size_t total = 0;
+    for (size_t i = 0; i < 3; i++) {
+        wiov[i].iov_base = (void*)g_parts[i];
+        wiov[i].iov_len  = strlen(g_parts[i]);
+        total += wiov[i].iov_len;
+    }
+
+    ssize_t ret = writev(wfd, wiov, 3);
+    if (ret < 0)
+        err(1, "writev");
+    if ((size_t)ret != total)
+        errx(1, "writev returned %zd instead of %zu", ret, total);
+
+    if (rewind_to >= 0 && lseek(rfd, rewind_to, SEEK_SET) != rewind_to)
+        err(1, "lseek");
+
+    char buf1[5];
+    char buf2[64] = {0};
+    struct iovec riov[2] = {
+        { .iov_base = buf1, .iov_len = sizeof(buf1) },
+        { .iov_base = buf2, .iov_len = sizeof(buf2) },
+    };
+    ret = readv(rfd, riov, 2);
+    if (ret < 0)
+        err(1, "readv");
+    if ((size_t)ret != total)
+        errx(1, "readv returned %zd instead of %zu", ret, total);
+
+    char expected[64];
+    snprintf(expected, sizeof(expected), "%s%s%s", g_parts[0], g_parts[1], g_parts[2]);
+    if (memcmp(buf1, expected, sizeof(buf1)) || strcmp(buf2, expected + sizeof(buf1)))
+        errx(1, "readv returned wrong data");
+}
+
+int main(void) {
+    int fd = open(TEST_FILE, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+        err(1, "open");
+    /* the file position must advance by the whole writev() */
+    if (write(fd, "x", 1) != 1)
+        err(1, "write");
+    test_rw(fd, fd, /*rewind_to=*/1);
+    if (lseek(fd, 0, SEEK_CUR) != 1 + (off_t)strlen("header: 1\r\n\r\nbody of the message"))
+        errx(1, "wrong file position after readv");
+    close(fd);
+    unlink(TEST_FILE);
+
+    int pipefds[2];
+    if (pipe(pipefds) < 0)
+        err(1, "pipe");
+    test_rw(pipefds[1], pipefds[0], /*rewind_to=*/-1);
+    close(pipefds[0]);
+    close(pipefds[1]);
+
+    puts("TEST OK");
+    return 0;
+}
@@ -0,0 +1,125 @@
+/* rseq(): cpu_id of the registered area follows sched_setaffinity(), and a critical section is
+ * restarted when a signal arrives in it */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <linux/rseq.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define RSEQ_SIG 0x53053053
+
+/* area registered by glibc 2.35+ (see <sys/rseq.h>) */
+extern const ptrdiff_t __rseq_offset __attribute__((weak));
+extern const unsigned int __rseq_size __attribute__((weak));
+
+static __thread struct rseq g_rseq_area;
+static struct rseq* g_rseq;
+
+static volatile bool g_stop = false;
+
+static long sys_rseq(struct rseq* rseq, uint32_t len, int flags, uint32_t sig) {
+    return syscall(__NR_rseq, rseq, len, flags, sig);
+}
+
+static void register_rseq(void) {
+    if (&__rseq_size && __rseq_size) {
+        void* tp;
+        __asm__("mov %%fs:0, %0" : "=r"(tp));
+        g_rseq = (struct rseq*)((char*)tp + __rseq_offset);
+        /* glibc registered its area already */
+        if (sys_rseq(g_rseq, sizeof(*g_rseq), 0, RSEQ_SIG) != -1 || errno != EBUSY)
+            errx(1, "second rseq registration didn't fail with EBUSY");
+        return;
+    }
+
+    g_rseq = &g_rseq_area;
+    g_rseq->cpu_id = RSEQ_CPU_ID_UNINITIALIZED;
+    if (sys_rseq(g_rseq, sizeof(*g_rseq) - 1, 0, RSEQ_SIG) != -1 || errno != EINVAL)
+        errx(1, "rseq with invalid length didn't fail with EINVAL");
+    if (sys_rseq(g_rseq, sizeof(*g_rseq), 0, RSEQ_SIG) < 0)
+        err(1, "rseq");
+    if (sys_rseq(g_rseq, sizeof(*g_rseq), 0, RSEQ_SIG + 1) != -1 || errno != EPERM)
+        errx(1, "rseq with another signature didn't fail with EPERM");
+    if (sys_rseq(g_rseq, sizeof(*g_rseq), 0, RSEQ_SIG) != -1 || errno != EBUSY)
+        errx(1, "second rseq registration didn't fail with EBUSY");
+}
+
+static void check_cpu_id(void) {
+    int cpu = sched_getcpu();
+    if (cpu < 0)
+        err(1, "sched_getcpu");
+    uint32_t cpu_id = __atomic_load_n(&g_rseq->cpu_id, __ATOMIC_RELAXED);
+    if (cpu_id != (uint32_t)cpu)
+        errx(1, "rseq cpu_id is %d instead of %d", (int)cpu_id, cpu);
+}
+
+static void handler(int sig) {
+    (void)sig;
+    g_stop = true;
+}
+
+/* spins in a critical section until a signal handler sets `g_stop`; returns true if the critical
+ * section was restarted */
+static bool spin_in_critical_section(void) {
+    int aborted;
+    __asm__ volatile(
+        ".pushsection __rseq_cs, \"aw\"\n"
+        ".balign 32\n"
+        "1: .long 0, 0\n"
+        ".quad 2f, 3f - 2f, 4f\n"
+        ".popsection\n"
+        "leaq 1b(%%rip), %%rax\n"
+        "movq %%rax, %[rseq_cs]\n"
+        "2: cmpb $0, %[stop]\n"
+        "je 2b\n"
+        "3: movl $0, %[aborted]\n"
+        "jmp 5f\n"
+        /* RSEQ_SIG */
+        ".long 0x53053053\n"
+        "4: movl $1, %[aborted]\n"
+        "5:\n"
+        : [rseq_cs] "=m"(g_rseq->rseq_cs), [aborted] "=r"(aborted)
+        : [stop] "m"(g_stop)
+        : "rax", "memory", "cc");
+    return aborted;
+}
+
+int main(void) {
+    register_rseq();
+    check_cpu_id();
+
+    cpu_set_t cpus;
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) < 0)
+        err(1, "sched_getaffinity");
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &cpus))
+            continue;
+        cpu_set_t one;
+        CPU_ZERO(&one);
+        CPU_SET(cpu, &one);
+        if (sched_setaffinity(0, sizeof(one), &one) < 0)
+            err(1, "sched_setaffinity");
+        check_cpu_id();
+        if (g_rseq->cpu_id != (uint32_t)cpu)
+            errx(1, "rseq cpu_id is %u after pinning to CPU %d", g_rseq->cpu_id, cpu);
+    }
+
+    if (signal(SIGALRM, handler) == SIG_ERR)
+        err(1, "signal");
+    alarm(1);
+    if (!spin_in_critical_section())
+        errx(1, "critical section was not restarted on signal delivery");
+    if (g_rseq->rseq_cs)
+        errx(1, "rseq_cs was not cleared on restart");
+
+    puts("TEST OK");
+    return 0;
+}
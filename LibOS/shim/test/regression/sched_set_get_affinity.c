@@ -43,6 +43,10 @@ int main(int argc, const char** argv) {
         if (!CPU_EQUAL_S(sizeof(cpus), &cpus, &get_cpus)) {
             errx(EXIT_FAILURE, "The get cpu set is not equal to set on core id: %ld", i);
         }
+        ret = sched_getcpu();
+        if (ret != i) {
+            errx(EXIT_FAILURE, "Thread pinned to core id %ld runs on core id %d", i, ret);
+        }
     }
 
     if (numprocs >= 2) {
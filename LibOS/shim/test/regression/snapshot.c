@@ -0,0 +1,53 @@
+/* Snapshot of an initialized process: the first run creates it, the second one is restored. */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DATA_SIZE (1024 * 1024)
+
+int main(void) {
+    setbuf(stdout, NULL);
+
+    /* "initialization": state on the heap and an open file, which must survive the restore */
+    char* data = malloc(DATA_SIZE);
+    if (!data)
+        err(1, "malloc");
+    for (size_t i = 0; i < DATA_SIZE; i++)
+        data[i] = i % 251;
+
+    int fd = open("tmp/snapshot_input", O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+        err(1, "open");
+    if (write(fd, "hello", 5) != 5)
+        err(1, "write");
+
+    int snapshot_fd = open("/dev/snapshot", O_WRONLY);
+    if (snapshot_fd < 0)
+        err(1, "open /dev/snapshot");
+    ssize_t ret = write(snapshot_fd, "x", 1);
+    if (ret < 0)
+        err(1, "write /dev/snapshot");
+    close(snapshot_fd);
+
+    if (ret == 1) {
+        puts("snapshot created");
+        return 0;
+    }
+
+    for (size_t i = 0; i < DATA_SIZE; i++)
+        if (data[i] != (char)(i % 251))
+            errx(1, "wrong heap contents at offset %zu after restore", i);
+
+    char buf[5];
+    if (pread(fd, buf, sizeof(buf), 0) != sizeof(buf) || memcmp(buf, "hello", sizeof(buf)))
+        errx(1, "wrong file contents after restore");
+    close(fd);
+
+    puts("restored from snapshot");
+    return 0;
+}
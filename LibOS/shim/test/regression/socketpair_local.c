@@ -0,0 +1,160 @@
+/* UNIX socketpairs whose both ends stay in one process, and what happens to them on fork(). */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define TOTAL_SIZE (1024 * 1024)
+#define CHUNK_SIZE 1000
+
+static int g_sv[2];
+
+static void* writer(void* arg) {
+    static char buf[CHUNK_SIZE];
+    size_t done = 0;
+    while (done < TOTAL_SIZE) {
+        size_t size = TOTAL_SIZE - done < sizeof(buf) ? TOTAL_SIZE - done : sizeof(buf);
+        for (size_t i = 0; i < size; i++)
+            buf[i] = (char)(done + i);
+        ssize_t ret = write(g_sv[1], buf, size);
+        if (ret < 0)
+            err(1, "write");
+        done += ret;
+    }
+    if (shutdown(g_sv[1], SHUT_WR) < 0)
+        err(1, "shutdown");
+    return arg;
+}
+
+static void test_stream(void) {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, g_sv) < 0)
+        err(1, "socketpair");
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, writer, NULL))
+        errx(1, "pthread_create failed");
+
+    static char buf[4096];
+    size_t done = 0;
+    while (1) {
+        ssize_t ret = read(g_sv[0], buf, sizeof(buf));
+        if (ret < 0)
+            err(1, "read");
+        if (ret == 0)
+            break;
+        for (ssize_t i = 0; i < ret; i++) {
+            if (buf[i] != (char)(done + i))
+                errx(1, "wrong data at offset %zu", done + i);
+        }
+        done += ret;
+    }
+    if (done != TOTAL_SIZE)
+        errx(1, "read %zu bytes instead of %d", done, TOTAL_SIZE);
+    if (pthread_join(thread, NULL))
+        errx(1, "pthread_join failed");
+
+    /* the other direction still works after shutdown(SHUT_WR) */
+    if (write(g_sv[0], "ping", 4) != 4)
+        err(1, "write");
+    if (recv(g_sv[1], buf, sizeof(buf), MSG_PEEK) != 4 || recv(g_sv[1], buf, sizeof(buf), 0) != 4
+            || memcmp(buf, "ping", 4))
+        errx(1, "wrong reply");
+    if (recv(g_sv[1], buf, sizeof(buf), MSG_DONTWAIT) != -1 || errno != EAGAIN)
+        errx(1, "MSG_DONTWAIT recv from an empty socket didn't fail with EAGAIN");
+
+    close(g_sv[0]);
+    close(g_sv[1]);
+}
+
+static void test_dgram(void) {
+    if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, g_sv) < 0)
+        err(1, "socketpair");
+
+    char buf[100];
+    if (read(g_sv[0], buf, sizeof(buf)) != -1 || errno != EAGAIN)
+        errx(1, "read from an empty non-blocking socket didn't fail with EAGAIN");
+
+    struct pollfd fds[2] = {
+        { .fd = g_sv[0], .events = POLLIN | POLLOUT },
+        { .fd = g_sv[1], .events = POLLIN },
+    };
+    if (poll(fds, 2, 0) != 1 || fds[0].revents != POLLOUT || fds[1].revents)
+        errx(1, "poll on empty sockets: %#x, %#x", fds[0].revents, fds[1].revents);
+
+    /* messages keep their boundaries, truncated ones lose the rest */
+    if (send(g_sv[1], "first", 5, 0) != 5 || send(g_sv[1], "second message", 14, 0) != 14
+            || send(g_sv[1], "", 0, 0) != 0)
+        err(1, "send");
+
+    if (poll(fds, 2, 0) != 1 || fds[0].revents != (POLLIN | POLLOUT) || fds[1].revents)
+        errx(1, "poll on sockets with data: %#x, %#x", fds[0].revents, fds[1].revents);
+
+    if (recv(g_sv[0], buf, sizeof(buf), MSG_PEEK) != 5 || recv(g_sv[0], buf, sizeof(buf), 0) != 5
+            || memcmp(buf, "first", 5))
+        errx(1, "wrong first message");
+    if (recv(g_sv[0], buf, 6, 0) != 6 || memcmp(buf, "second", 6))
+        errx(1, "wrong second message");
+    if (recv(g_sv[0], buf, sizeof(buf), 0) != 0)
+        errx(1, "wrong empty message");
+    if (recv(g_sv[0], buf, sizeof(buf), 0) != -1 || errno != EAGAIN)
+        errx(1, "recv after all messages didn't fail with EAGAIN");
+
+    /* a closed peer can't receive anything */
+    close(g_sv[0]);
+    if (send(g_sv[1], "x", 1, 0) != -1 || errno != ECONNREFUSED)
+        errx(1, "send to a closed peer didn't fail with ECONNREFUSED");
+    close(g_sv[1]);
+}
+
+static void test_fork(void) {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, g_sv) < 0)
+        err(1, "socketpair");
+
+    /* data written before fork() is received by the child */
+    if (write(g_sv[1], "hello", 5) != 5)
+        err(1, "write");
+
+    pid_t pid = fork();
+    if (pid < 0)
+        err(1, "fork");
+    if (pid == 0) {
+        close(g_sv[1]);
+        char buf[5];
+        if (read(g_sv[0], buf, sizeof(buf)) != 5 || memcmp(buf, "hello", 5))
+            errx(1, "child got wrong data");
+        if (write(g_sv[0], "world", 5) != 5)
+            err(1, "child write");
+        exit(0);
+    }
+
+    close(g_sv[0]);
+    char buf[5];
+    if (read(g_sv[1], buf, sizeof(buf)) != 5 || memcmp(buf, "world", 5))
+        errx(1, "parent got wrong data");
+    close(g_sv[1]);
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        err(1, "waitpid");
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+        errx(1, "child failed");
+}
+
+int main(void) {
+    setbuf(stdout, NULL);
+
+    test_stream();
+    test_dgram();
+    test_fork();
+
+    puts("TEST OK");
+    return 0;
+}
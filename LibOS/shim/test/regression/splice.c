@@ -0,0 +1,86 @@
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define TEST_FILE "tmp/splice.tmp"
+
+static const char g_data[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+
+static void read_exact(int fd, char* buf, size_t size) {
+    while (size > 0) {
+        ssize_t ret = read(fd, buf, size);
+        if (ret <= 0)
+            err(1, "read");
+        buf += ret;
+        size -= ret;
+    }
+}
+
+int main(void) {
+    int fds[2];
+    if (pipe(fds) < 0)
+        err(1, "pipe");
+
+    int fd = open(TEST_FILE, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+        err(1, "open");
+    if (write(fd, g_data, sizeof(g_data) - 1) != sizeof(g_data) - 1)
+        err(1, "write");
+
+    /* file (at an explicit offset) -> pipe; the file position must not change */
+    loff_t off = 10;
+    ssize_t ret = splice(fd, &off, fds[1], NULL, 16, 0);
+    if (ret != 16)
+        err(1, "splice file -> pipe returned %zd", ret);
+    if (off != 26)
+        errx(1, "splice didn't advance the offset (%lld)", (long long)off);
+    if (lseek(fd, 0, SEEK_CUR) != sizeof(g_data) - 1)
+        errx(1, "splice changed the file position");
+
+    char buf[32] = {0};
+    read_exact(fds[0], buf, 16);
+    if (memcmp(buf, g_data + 10, 16))
+        errx(1, "wrong data from the pipe: %s", buf);
+
+    /* user memory -> pipe -> file (at the file position) */
+    struct iovec iov[2] = {
+        { .iov_base = (void*)"spliced ", .iov_len = 8 },
+        { .iov_base = (void*)"data", .iov_len = 4 },
+    };
+    ret = vmsplice(fds[1], iov, 2, 0);
+    if (ret != 12)
+        err(1, "vmsplice returned %zd", ret);
+
+    if (lseek(fd, 0, SEEK_SET) != 0)
+        err(1, "lseek");
+    ret = splice(fds[0], NULL, fd, NULL, 12, 0);
+    if (ret != 12)
+        err(1, "splice pipe -> file returned %zd", ret);
+    if (lseek(fd, 0, SEEK_CUR) != 12)
+        errx(1, "splice didn't advance the file position");
+
+    memset(buf, 0, sizeof(buf));
+    if (pread(fd, buf, 12, 0) != 12)
+        err(1, "pread");
+    if (memcmp(buf, "spliced data", 12))
+        errx(1, "wrong data in the file: %s", buf);
+
+    /* offsets are not allowed for pipes */
+    off = 0;
+    if (splice(fds[0], &off, fd, NULL, 1, 0) != -1 || errno != ESPIPE)
+        errx(1, "splice with a pipe offset didn't fail with ESPIPE");
+
+    close(fd);
+    close(fds[0]);
+    close(fds[1]);
+    if (unlink(TEST_FILE) < 0)
+        err(1, "unlink");
+
+    puts("TEST OK");
+    return 0;
+}
@@ -0,0 +1,133 @@
+/* Tests patching of raw `syscall` instructions (`libos.patch_syscalls`): a patchable site gives
+ * the right results from several threads racing to patch it, and sites which cannot be patched
+ * safely are left intact and keep working. */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define THREADS_CNT 4
+#define ITERATIONS  10000
+
+#define XSTR(x) STR(x)
+#define STR(x)  #x
+
+long raw_gettid(void);
+long raw_gettid_split(void);
+extern uint8_t raw_gettid_insn[];
+extern uint8_t raw_gettid_split_insn[];
+
+/*
+ * Both functions are `mov $__NR_gettid, %eax; syscall; ret`, padded with int3 (which is not a
+ * prefix byte). In `raw_gettid` the mov fits into a 16-byte aligned window and can be patched, in
+ * `raw_gettid_split` it crosses the end of such a window and cannot be replaced atomically.
+ */
+__asm__(
+    ".pushsection .text\n"
+    ".balign 16, 0xcc\n"
+    ".skip 16, 0xcc\n"
+    ".global raw_gettid\n"
+    ".global raw_gettid_insn\n"
+    ".type raw_gettid, @function\n"
+    "raw_gettid:\n"
+    "raw_gettid_insn:\n"
+    ".byte 0xb8\n"
+    ".long " XSTR(__NR_gettid) "\n"
+    "syscall\n"
+    "ret\n"
+    ".size raw_gettid, . - raw_gettid\n"
+
+    ".balign 16, 0xcc\n"
+    ".skip 13, 0xcc\n"
+    ".global raw_gettid_split\n"
+    ".global raw_gettid_split_insn\n"
+    ".type raw_gettid_split, @function\n"
+    "raw_gettid_split:\n"
+    "raw_gettid_split_insn:\n"
+    ".byte 0xb8\n"
+    ".long " XSTR(__NR_gettid) "\n"
+    "syscall\n"
+    "ret\n"
+    ".size raw_gettid_split, . - raw_gettid_split\n"
+    ".popsection\n"
+);
+
+static void* thread_func(void* arg) {
+    long tid = syscall(SYS_gettid);
+    for (int i = 0; i < ITERATIONS; i++) {
+        long ret = raw_gettid();
+        if (ret != tid)
+            errx(1, "raw_gettid returned %ld instead of %ld", ret, tid);
+        ret = raw_gettid_split();
+        if (ret != tid)
+            errx(1, "raw_gettid_split returned %ld instead of %ld", ret, tid);
+    }
+    return arg;
+}
+
+/* The mov starts the page and the syscall is in its first 8 bytes, after an unmapped page. */
+static void test_page_start(void) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    uint8_t* mem = mmap(NULL, 2 * page_size, PROT_READ | PROT_WRITE | PROT_EXEC,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        err(1, "mmap");
+    if (munmap(mem, page_size) < 0)
+        err(1, "munmap");
+
+    uint8_t* code = mem + page_size;
+    int32_t nr = __NR_gettid;
+    code[0] = 0xb8;
+    memcpy(code + 1, &nr, sizeof(nr));
+    code[5] = 0x0f;
+    code[6] = 0x05;
+    code[7] = 0xc3;
+
+    uint8_t orig[8];
+    memcpy(orig, code, sizeof(orig));
+
+    long (*func)(void) = (long (*)(void))code;
+    long tid = syscall(SYS_gettid);
+    for (int i = 0; i < 10; i++) {
+        long ret = func();
+        if (ret != tid)
+            errx(1, "syscall at page start returned %ld instead of %ld", ret, tid);
+    }
+    if (memcmp(code, orig, sizeof(orig)))
+        errx(1, "syscall site at page start was patched");
+
+    if (munmap(code, page_size) < 0)
+        err(1, "munmap");
+}
+
+int main(void) {
+    test_page_start();
+
+    pthread_t threads[THREADS_CNT];
+    for (int i = 0; i < THREADS_CNT; i++) {
+        int ret = pthread_create(&threads[i], NULL, thread_func, NULL);
+        if (ret != 0)
+            errx(1, "pthread_create: %d", ret);
+    }
+    thread_func(NULL);
+    for (int i = 0; i < THREADS_CNT; i++) {
+        int ret = pthread_join(threads[i], NULL);
+        if (ret != 0)
+            errx(1, "pthread_join: %d", ret);
+    }
+
+    if (raw_gettid_insn[0] != 0xe9)
+        errx(1, "patchable syscall site was not patched (first byte: 0x%x)", raw_gettid_insn[0]);
+    if (raw_gettid_split_insn[0] != 0xb8)
+        errx(1, "syscall site crossing a 16-byte window was patched");
+
+    puts("TEST OK");
+    return 0;
+}
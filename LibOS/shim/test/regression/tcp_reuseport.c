@@ -0,0 +1,126 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <err.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* enough connections that each of the two listeners gets some of them */
+#define CONNS_CNT 64
+
+static int create_listener(struct sockaddr_in* addr, int reuseport) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+        err(1, "socket");
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &reuseport, sizeof(reuseport)) < 0)
+        err(1, "setsockopt(SO_REUSEPORT)");
+    if (bind(fd, (struct sockaddr*)addr, sizeof(*addr)) < 0) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    if (listen(fd, CONNS_CNT) < 0)
+        err(1, "listen");
+
+    socklen_t addrlen = sizeof(*addr);
+    if (getsockname(fd, (struct sockaddr*)addr, &addrlen) < 0)
+        err(1, "getsockname");
+    return fd;
+}
+
+/* accepts (and closes) all pending connections */
+static int accept_all(int listen_fd) {
+    int cnt = 0;
+    while (1) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EAGAIN)
+                return cnt;
+            err(1, "accept");
+        }
+        close(fd);
+        cnt++;
+    }
+}
+
+int main(void) {
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+        .sin_port = 0,
+    };
+    int listen_fd = create_listener(&addr, 1);
+    if (listen_fd < 0)
+        err(1, "bind");
+
+    int val = 0;
+    socklen_t len = sizeof(val);
+    if (getsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &val, &len) < 0)
+        err(1, "getsockopt(SO_REUSEPORT)");
+    if (val != 1)
+        errx(1, "SO_REUSEPORT is not reported as set");
+
+    if (create_listener(&addr, 0) != -1 || errno != EADDRINUSE)
+        errx(1, "second bind without SO_REUSEPORT did not fail with EADDRINUSE");
+
+    int ready_pipe[2], done_pipe[2];
+    if (pipe(ready_pipe) < 0 || pipe(done_pipe) < 0)
+        err(1, "pipe");
+
+    pid_t pid = fork();
+    if (pid < 0)
+        err(1, "fork");
+    if (pid == 0) {
+        /* a worker with its own host socket on the same port */
+        close(listen_fd);
+        int fd = create_listener(&addr, 1);
+        if (fd < 0)
+            err(1, "bind in the child");
+        char c = 'r';
+        if (write(ready_pipe[1], &c, 1) != 1)
+            err(1, "write");
+        if (read(done_pipe[0], &c, 1) != 1)
+            err(1, "read");
+        return accept_all(fd);
+    }
+
+    char c;
+    if (read(ready_pipe[0], &c, 1) != 1)
+        err(1, "read");
+
+    int conn_fds[CONNS_CNT];
+    for (int i = 0; i < CONNS_CNT; i++) {
+        conn_fds[i] = socket(AF_INET, SOCK_STREAM, 0);
+        if (conn_fds[i] < 0)
+            err(1, "socket");
+        if (connect(conn_fds[i], (struct sockaddr*)&addr, sizeof(addr)) < 0)
+            err(1, "connect");
+    }
+
+    int parent_cnt = accept_all(listen_fd);
+    if (write(done_pipe[1], &c, 1) != 1)
+        err(1, "write");
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        err(1, "waitpid");
+    if (!WIFEXITED(status))
+        errx(1, "child died");
+    int child_cnt = WEXITSTATUS(status);
+
+    for (int i = 0; i < CONNS_CNT; i++)
+        close(conn_fds[i]);
+
+    printf("parent accepted %d, child accepted %d connections\n", parent_cnt, child_cnt);
+    if (parent_cnt + child_cnt != CONNS_CNT)
+        errx(1, "lost connections");
+    if (!parent_cnt || !child_cnt)
+        errx(1, "connections were not balanced between the listeners");
+
+    puts("TEST OK");
+    return 0;
+}
@@ -135,6 +135,8 @@ class TC_01_Bootstrap(RegressionTestCase):
 
         # vfork and exec 2 page child binary
         self.assertIn('child exited with status: 0', stdout)
+        self.assertIn('exiting child exited with status: 42', stdout)
+        self.assertIn('spawned child exited with status: 0', stdout)
         self.assertIn('test completed successfully', stdout)
 
     def test_204_exec_fork(self):
@@ -149,6 +151,31 @@ class TC_01_Bootstrap(RegressionTestCase):
         self.assertIn('TEST OK', stdout)
         self.assertNotIn('grandchild', stderr)
 
+    def test_206_snapshot(self):
+        snapshot_path = 'tmp/snapshot.bin'
+        if os.path.exists(snapshot_path):
+            os.remove(snapshot_path)
+        try:
+            stdout, _ = self.run_binary(['snapshot'])
+            self.assertIn('snapshot created', stdout)
+
+            stdout, _ = self.run_binary(['snapshot'])
+            self.assertIn('restored from snapshot', stdout)
+        finally:
+            os.remove(snapshot_path)
+
+    def test_207_fork_lazy_memory(self):
+        stdout, _ = self.run_binary(['fork_lazy_memory'])
+        self.assertIn('TEST OK', stdout)
+
+    def test_208_fork_shared_anon(self):
+        stdout, _ = self.run_binary(['fork_shared_anon'])
+        self.assertIn('TEST OK', stdout)
+
+    def test_209_fork_zygote(self):
+        stdout, _ = self.run_binary(['fork_zygote'])
+        self.assertIn('TEST OK', stdout)
+
     def test_210_exec_invalid_args(self):
         stdout, _ = self.run_binary(['exec_invalid_args'])
 
@@ -300,12 +327,16 @@ class TC_04_Attestation(RegressionTestCase):
         self.assertIn("Test resource leaks in attestation filesystem... SUCCESS", stdout)
         self.assertIn("Test local attestation... SUCCESS", stdout)
         self.assertIn("Test quote interface... SUCCESS", stdout)
+        self.assertIn("Test quote cache... SUCCESS", stdout)
+        self.assertIn("Test provisioned secret... SUCCESS", stdout)
 
     def test_001_attestation_stdio(self):
         stdout, _ = self.run_binary(['attestation', 'test_stdio'], timeout=60)
         self.assertIn("Test resource leaks in attestation filesystem... SUCCESS", stdout)
         self.assertIn("Test local attestation... SUCCESS", stdout)
         self.assertIn("Test quote interface... SUCCESS", stdout)
+        self.assertIn("Test quote cache... SUCCESS", stdout)
+        self.assertIn("Test provisioned secret... SUCCESS", stdout)
 
 class TC_30_Syscall(RegressionTestCase):
     def test_000_getcwd(self):
@@ -413,6 +444,37 @@ class TC_30_Syscall(RegressionTestCase):
         stdout, _ = self.run_binary(['file_size'])
         self.assertIn('test completed successfully', stdout)
 
+    def test_033_readv_writev(self):
+        stdout, _ = self.run_binary(['readv_writev'])
+        self.assertIn('TEST OK', stdout)
+
+    def test_034_splice(self):
+        stdout, _ = self.run_binary(['splice'])
+        self.assertIn('TEST OK', stdout)
+
+    def test_035_preadv_pwritev(self):
+        stdout, _ = self.run_binary(['preadv_pwritev'])
+        self.assertIn('preadv/pwritev OK', stdout)
+        self.assertIn('preadv2/pwritev2 OK', stdout)
+        self.assertIn('pipe OK', stdout)
+        self.assertIn('TEST OK', stdout)
+
+    def test_036_fcntl_lock(self):
+        stdout, _ = self.run_binary(['fcntl_lock'])
+        self.assertIn('TEST OK', stdout)
+
+    def test_037_close_range(self):
+        stdout, _ = self.run_binary(['close_range'])
+        self.assertIn('TEST OK', stdout)
+
+    def test_038_copy_file_range(self):
+        stdout, _ = self.run_binary(['copy_file_range'])
+        self.assertIn('TEST OK', stdout)
+
+    def test_039_fadvise(self):
+        stdout, _ = self.run_binary(['fadvise'])
+        self.assertIn('TEST OK', stdout)
+
     def test_040_futex_bitset(self):
         stdout, _ = self.run_binary(['futex_bitset'])
 
@@ -435,6 +497,14 @@ class TC_30_Syscall(RegressionTestCase):
 
         self.assertIn('Test successful!', stdout)
 
+    def test_044_futex_waitv(self):
+        stdout, _ = self.run_binary(['futex_waitv'])
+        self.assertIn('TEST OK', stdout)
+
+    def test_045_fd_table_unshare(self):
+        stdout, _ = self.run_binary(['fd_table_unshare'])
+        self.assertIn('TEST OK', stdout)
+
     def test_050_mmap(self):
         stdout, _ = self.run_binary(['mmap_file'], timeout=60)
 
@@ -488,6 +558,17 @@ class TC_30_Syscall(RegressionTestCase):
         stdout, _ = self.run_binary(['madvise'])
         self.assertIn('TEST OK', stdout)
 
+    def test_056_mremap(self):
+        stdout, _ = self.run_binary(['mremap'])
+        self.assertIn('TEST OK', stdout)
+
+    def test_057_msync_shared(self):
+        stdout, _ = self.run_binary(['msync_shared'])
+        self.assertIn('msync OK', stdout)
+        self.assertIn('fsync OK', stdout)
+        self.assertIn('munmap OK', stdout)
+        self.assertIn('TEST OK', stdout)
+
     @unittest.skip('sigaltstack isn\'t correctly implemented')
     def test_060_sigaltstack(self):
         stdout, _ = self.run_binary(['sigaltstack'])
@@ -513,8 +594,21 @@ class TC_30_Syscall(RegressionTestCase):
         # Eventfd Test
         self.assertIn('eventfd_using_poll completed successfully', stdout)
         self.assertIn('eventfd_using_various_flags completed successfully', stdout)
+        self.assertIn('eventfd_using_epoll completed successfully', stdout)
         self.assertIn('eventfd_using_fork completed successfully', stdout)
 
+    def test_071_timerfd(self):
+        stdout, _ = self.run_binary(['timerfd'])
+        self.assertIn('TEST OK', stdout)
+
+    def test_072_io_uring(self):
+        stdout, _ = self.run_binary(['io_uring'])
+        self.assertIn('NOP OK', stdout)
+        self.assertIn('pipe OK', stdout)
+        self.assertIn('registered OK', stdout)
+        self.assertIn('probe OK', stdout)
+        self.assertIn('TEST OK', stdout)
+
     def test_080_sched(self):
         stdout, _ = self.run_binary(['sched'])
 
@@ -575,6 +669,23 @@ class TC_30_Syscall(RegressionTestCase):
         stdout, _ = self.run_binary(['gettimeofday'])
         self.assertIn('TEST OK', stdout)
 
+    def test_104_vdso_time(self):
+        stdout, _ = self.run_binary(['vdso_time'])
+        self.assertIn('TEST OK', stdout)
+
+    def test_105_membarrier(self):
+        stdout, _ = self.run_binary(['membarrier'])
+        self.assertIn('TEST OK', stdout)
+
+    @unittest.skipUnless(ON_X86, "x86-specific")
+    def test_106_rseq(self):
+        stdout, _ = self.run_binary(['rseq'])
+        self.assertIn('TEST OK', stdout)
+
+    def test_107_cputime(self):
+        stdout, _ = self.run_binary(['cputime'])
+        self.assertIn('TEST OK', stdout)
+
 class TC_31_Syscall(RegressionTestCase):
     @unittest.skipUnless(HAS_SGX,
         'This test is only meaningful on SGX PAL because only SGX catches raw '
@@ -586,6 +697,13 @@ class TC_31_Syscall(RegressionTestCase):
         # Syscall Instruction Redirection
         self.assertIn('Hello world', stdout)
 
+    @unittest.skipUnless(HAS_SGX,
+        'This test is only meaningful on SGX PAL because only SGX catches raw syscalls (and '
+        'Graphene patches only trapping syscall sites).')
+    def test_001_syscall_patching(self):
+        stdout, _ = self.run_binary(['syscall_patching'])
+        self.assertIn('TEST OK', stdout)
+
     def test_010_syscall_restart(self):
         stdout, _ = self.run_binary(['syscall_restart'])
         self.assertIn('Got: R', stdout)
@@ -651,6 +769,18 @@ class TC_40_FileSystem(RegressionTestCase):
         # proc/cpuinfo Linux-based formatting
         self.assertIn('cpuinfo test passed', stdout)
 
+    def test_021_syscalls(self):
+        stdout, _ = self.run_binary(['proc_syscalls'])
+        self.assertIn('TEST OK', stdout)
+
+    def test_022_maps(self):
+        stdout, _ = self.run_binary(['proc_maps'])
+        self.assertIn('TEST OK', stdout)
+
+    def test_023_io(self):
+        stdout, _ = self.run_binary(['proc_io'])
+        self.assertIn('TEST OK', stdout)
+
     def test_030_fdleak(self):
         stdout, _ = self.run_binary(['fdleak'], timeout=10)
         self.assertIn("Test succeeded.", stdout)
@@ -741,6 +871,14 @@ class TC_80_Socket(RegressionTestCase):
         stdout, _ = self.run_binary(['epoll_epollet', 'EMULATE_GRAPHENE_BUG'])
         self.assertIn('TEST OK', stdout)
 
+    def test_012_epoll_exclusive(self):
+        stdout, _ = self.run_binary(['epoll_exclusive'])
+        self.assertIn('TEST OK', stdout)
+
+    def test_013_epoll_dup(self):
+        stdout, _ = self.run_binary(['epoll_dup'])
+        self.assertIn('TEST OK', stdout)
+
     def test_020_poll(self):
         stdout, _ = self.run_binary(['poll'])
         self.assertIn('poll(POLLOUT) returned 1 file descriptors', stdout)
@@ -788,6 +926,10 @@ class TC_80_Socket(RegressionTestCase):
         stdout, _ = self.run_binary(['pipe_ocloexec'])
         self.assertIn('TEST OK', stdout)
 
+    def test_093_pipe_local(self):
+        stdout, _ = self.run_binary(['pipe_local'], timeout=60)
+        self.assertIn('TEST OK', stdout)
+
     def test_095_mkfifo(self):
         stdout, _ = self.run_binary(['mkfifo'], timeout=60)
         self.assertIn('read on FIFO: Hello from write end of FIFO!', stdout)
@@ -805,6 +947,10 @@ class TC_80_Socket(RegressionTestCase):
         self.assertIn('Data: This is packet 8', stdout)
         self.assertIn('Data: This is packet 9', stdout)
 
+    def test_101_socketpair_local(self):
+        stdout, _ = self.run_binary(['socketpair_local'], timeout=60)
+        self.assertIn('TEST OK', stdout)
+
     def test_200_socket_udp(self):
         stdout, _ = self.run_binary(['udp'], timeout=50)
         self.assertIn('This is packet 0', stdout)
@@ -831,6 +977,10 @@ class TC_80_Socket(RegressionTestCase):
         stdout, _ = self.run_binary(['tcp_ipv6_v6only'], timeout=50)
         self.assertIn('test completed successfully', stdout)
 
+    def test_320_socket_tcp_reuseport(self):
+        stdout, _ = self.run_binary(['tcp_reuseport'], timeout=50)
+        self.assertIn('TEST OK', stdout)
+
 @unittest.skipUnless(HAS_SGX,
     'This test is only meaningful on SGX PAL because only SGX emulates CPUID.')
 class TC_90_CpuidSGX(RegressionTestCase):
@@ -0,0 +1,174 @@
+/* timerfd: one-shot and periodic timers, disarming, non-blocking reads, epoll and fork(). */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MANY_TIMERS 500
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        err(1, "clock_gettime");
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void set_timer(int fd, int flags, long value_us, long interval_us) {
+    struct itimerspec its = {
+        .it_value    = { .tv_sec = value_us / 1000000, .tv_nsec = value_us % 1000000 * 1000 },
+        .it_interval = { .tv_sec = interval_us / 1000000, .tv_nsec = interval_us % 1000000 * 1000 },
+    };
+    if (timerfd_settime(fd, flags, &its, NULL) < 0)
+        err(1, "timerfd_settime");
+}
+
+static uint64_t read_expirations(int fd) {
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        err(1, "read");
+    return expirations;
+}
+
+static void test_oneshot(void) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, 0);
+    if (fd < 0)
+        err(1, "timerfd_create");
+
+    uint64_t start = now_us();
+    set_timer(fd, 0, 100000, 0);
+
+    struct itimerspec its;
+    if (timerfd_gettime(fd, &its) < 0)
+        err(1, "timerfd_gettime");
+    if (its.it_value.tv_sec != 0 || its.it_value.tv_nsec == 0 || its.it_interval.tv_nsec != 0)
+        errx(1, "wrong timerfd_gettime result of an armed timer");
+
+    if (read_expirations(fd) != 1)
+        errx(1, "one-shot timer expired more than once");
+    if (now_us() - start < 100000)
+        errx(1, "one-shot timer expired too early");
+
+    if (timerfd_gettime(fd, &its) < 0)
+        err(1, "timerfd_gettime");
+    if (its.it_value.tv_sec != 0 || its.it_value.tv_nsec != 0)
+        errx(1, "expired one-shot timer is still armed");
+
+    /* an absolute time in the past expires immediately */
+    set_timer(fd, TFD_TIMER_ABSTIME, 1, 0);
+    if (read_expirations(fd) != 1)
+        errx(1, "absolute timer in the past didn't expire once");
+
+    close(fd);
+}
+
+static void test_periodic(void) {
+    int fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0)
+        err(1, "timerfd_create");
+
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) != -1 || errno != EAGAIN)
+        errx(1, "read from a disarmed non-blocking timerfd didn't fail with EAGAIN");
+
+    set_timer(fd, 0, 10000, 10000);
+    usleep(105000);
+    expirations = read_expirations(fd);
+    if (expirations < 10 || expirations > 11)
+        errx(1, "periodic timer expired %lu times instead of 10", expirations);
+
+    /* disarming keeps the timer silent */
+    set_timer(fd, 0, 0, 0);
+    usleep(30000);
+    if (read(fd, &expirations, sizeof(expirations)) != -1 || errno != EAGAIN)
+        errx(1, "disarmed timer expired");
+
+    close(fd);
+}
+
+static void test_epoll(void) {
+    int efd = epoll_create1(0);
+    if (efd < 0)
+        err(1, "epoll_create1");
+
+    /* many timers at once, woken up in the order of their expiration */
+    static int fds[MANY_TIMERS];
+    for (int i = 0; i < MANY_TIMERS; i++) {
+        fds[i] = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (fds[i] < 0)
+            err(1, "timerfd_create");
+        struct epoll_event event = { .events = EPOLLIN, .data.u32 = i };
+        if (epoll_ctl(efd, EPOLL_CTL_ADD, fds[i], &event) < 0)
+            err(1, "epoll_ctl");
+        set_timer(fds[i], 0, 20000 + (MANY_TIMERS - i) * 200, 0);
+    }
+
+    int expired = 0;
+    int last = MANY_TIMERS;
+    while (expired < MANY_TIMERS) {
+        struct epoll_event events[16];
+        int n = epoll_wait(efd, events, 16, 10000);
+        if (n < 0)
+            err(1, "epoll_wait");
+        if (n == 0)
+            errx(1, "epoll_wait timed out with %d timers expired", expired);
+        for (int j = 0; j < n; j++) {
+            int i = events[j].data.u32;
+            if (read_expirations(fds[i]) != 1)
+                errx(1, "timer %d expired more than once", i);
+            if (i > last + 16)
+                errx(1, "timer %d expired too late", i);
+            last = i < last ? i : last;
+            expired++;
+        }
+    }
+
+    for (int i = 0; i < MANY_TIMERS; i++)
+        close(fds[i]);
+    close(efd);
+}
+
+static void test_fork(void) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, 0);
+    if (fd < 0)
+        err(1, "timerfd_create");
+    set_timer(fd, 0, 100000, 0);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        err(1, "fork");
+    if (pid == 0) {
+        /* the child inherits the armed timer */
+        if (read_expirations(fd) != 1)
+            errx(1, "child: wrong expirations");
+        exit(0);
+    }
+
+    close(fd);
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        err(1, "waitpid");
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+        errx(1, "child failed");
+}
+
+int main(void) {
+    setbuf(stdout, NULL);
+
+    test_oneshot();
+    test_periodic();
+    test_epoll();
+    test_fork();
+
+    puts("TEST OK");
+    return 0;
+}
@@ -0,0 +1,56 @@
+/* Checks that time served by the vDSO (without a syscall) is consistent with the time syscalls. */
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ITERATIONS    100000
+#define MAX_SKEW_NS   (10 * 1000 * 1000)
+
+static int64_t ts_to_ns(const struct timespec* ts) {
+    return (int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+static void check_clock(clockid_t clock, const char* name) {
+    struct timespec prev;
+    if (clock_gettime(clock, &prev) < 0)
+        err(1, "clock_gettime(%s)", name);
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        struct timespec vdso_ts, syscall_ts;
+        if (clock_gettime(clock, &vdso_ts) < 0)
+            err(1, "clock_gettime(%s)", name);
+        if (syscall(SYS_clock_gettime, clock, &syscall_ts) < 0)
+            err(1, "syscall clock_gettime(%s)", name);
+
+        if (ts_to_ns(&vdso_ts) < ts_to_ns(&prev))
+            errx(1, "%s went backwards", name);
+        if (ts_to_ns(&syscall_ts) + MAX_SKEW_NS < ts_to_ns(&vdso_ts)
+                || ts_to_ns(&vdso_ts) + MAX_SKEW_NS < ts_to_ns(&syscall_ts))
+            errx(1, "%s: vDSO and syscall times differ too much", name);
+        prev = vdso_ts;
+    }
+}
+
+int main(void) {
+    /* sleep in between, so that the vDSO time data has to be refreshed */
+    for (int round = 0; round < 3; round++) {
+        check_clock(CLOCK_REALTIME, "CLOCK_REALTIME");
+        check_clock(CLOCK_MONOTONIC, "CLOCK_MONOTONIC");
+        usleep(700 * 1000);
+    }
+
+    struct timeval tv;
+    if (gettimeofday(&tv, NULL) < 0)
+        err(1, "gettimeofday");
+    time_t t = time(NULL);
+    if (t < tv.tv_sec || t > tv.tv_sec + 1)
+        errx(1, "time() and gettimeofday() differ");
+
+    puts("TEST OK");
+    return 0;
+}
@@ -1,11 +1,14 @@
 #define _GNU_SOURCE
 #include <errno.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+extern char** environ;
+
 int main(int argc, const char** argv, const char** envp) {
     pid_t child_pid;
 
@@ -51,6 +54,37 @@ int main(int argc, const char** argv, const char** envp) {
         return 1;
     }
 
+    /* a child exiting without execve() is reported to the parent like any other child */
+    child_pid = vfork();
+    if (child_pid == 0) {
+        _exit(42);
+    } else if (child_pid < 0) {
+        perror("vfork failed");
+        return 1;
+    }
+    int status;
+    if (waitpid(child_pid, &status, 0) < 0) {
+        perror("waitpid failed");
+        return 1;
+    }
+    if (WIFEXITED(status))
+        printf("exiting child exited with status: %d\n", WEXITSTATUS(status));
+
+    /* posix_spawn() in glibc is built on top of clone(CLONE_VM | CLONE_VFORK) */
+    ret = posix_spawn(&child_pid, new_argv[0], /*file_actions=*/NULL, /*attrp=*/NULL, new_argv,
+                      environ);
+    if (ret) {
+        errno = ret;
+        perror("posix_spawn failed");
+        return 1;
+    }
+    if (waitpid(child_pid, &status, 0) < 0) {
+        perror("waitpid failed");
+        return 1;
+    }
+    if (WIFEXITED(status))
+        printf("spawned child exited with status: %d\n", WEXITSTATUS(status));
+
     puts("test completed successfully");
     return 0;
 }
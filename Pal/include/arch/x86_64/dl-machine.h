@@ -141,4 +141,13 @@ static void elf_machine_rela_relative(struct link_map* l, const Elf64_Rela* relo
     *reloc_addr = l->l_addr + reloc->r_addend;
 }
 
+/* Applies the R_X86_64_RELATIVE relocations in [`start`, `end`), which make up most of the
+ * relocations of PAL and LibOS. The load address is passed by value: stores through the relocated
+ * addresses could alias `l->l_addr`, which would have to be reloaded for each relocation. */
+static void elf_machine_rela_relative_range(Elf64_Addr l_addr, const Elf64_Rela* start,
+                                            const Elf64_Rela* end) {
+    for (const Elf64_Rela* reloc = start; reloc < end; reloc++)
+        *(Elf64_Addr*)(l_addr + reloc->r_offset) = l_addr + reloc->r_addend;
+}
+
 #endif /* !DL_MACHINE_H */
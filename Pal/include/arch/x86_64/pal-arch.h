@@ -295,6 +295,8 @@ typedef struct PAL_CPU_INFO_ {
     PAL_NUM cpu_stepping;
     double  cpu_bogomips;
     PAL_STR cpu_flags;
+    /* TSC frequency if RDTSC can be used for timekeeping (invariant TSC), 0 otherwise */
+    PAL_NUM tsc_hz;
 } PAL_CPU_INFO;
 
 typedef struct PAL_CORE_CACHE_INFO_ {
@@ -14,11 +14,7 @@
 #define Rel                      Rela
 #define elf_machine_rel          elf_machine_rela
 #define elf_machine_rel_relative elf_machine_rela_relative
-
-#ifndef DO_ELF_MACHINE_REL_RELATIVE
-#define DO_ELF_MACHINE_REL_RELATIVE(l, relative) \
-    elf_machine_rel_relative(l, relative, (void*)(l->l_addr + relative->r_offset))
-#endif
+#define elf_machine_rel_relative_range elf_machine_rela_relative_range
 
 static void __attribute_unused elf_dynamic_do_rel(struct link_map* l, ElfW(Addr) reladdr,
                                                   int relsize) {
@@ -51,9 +47,7 @@ static void __attribute_unused elf_dynamic_do_rel(struct link_map* l, ElfW(Addr)
     if (l->l_addr != 0 || !l->l_info[VALIDX(DT_GNU_PRELINKED)])
 #endif
 #endif
-        for (; relative < r; ++relative) {
-            DO_ELF_MACHINE_REL_RELATIVE(l, relative);
-        }
+        elf_machine_rel_relative_range(l->l_addr, relative, r);
 
     for (; r < end; ++r) {
         elf_machine_rel(l, r, &symtab[ELFW(R_SYM)(r->r_info)], (void*)(l->l_addr + r->r_offset));
@@ -64,5 +58,5 @@ static void __attribute_unused elf_dynamic_do_rel(struct link_map* l, ElfW(Addr)
 #undef Rel
 #undef elf_machine_rel
 #undef elf_machine_rel_relative
-#undef DO_ELF_MACHINE_REL_RELATIVE
+#undef elf_machine_rel_relative_range
 #undef RELCOUNT_IDX
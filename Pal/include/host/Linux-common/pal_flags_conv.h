@@ -13,6 +13,7 @@
 #define PAL_FLAGS_CONV_H
 
 #include <asm/fcntl.h>
+#include <linux/fadvise.h>
 #include <linux/mman.h>
 #include <sys/types.h>
 
@@ -24,6 +25,7 @@ static inline int PAL_MEM_FLAGS_TO_LINUX(int alloc_type, int prot) {
     assert(WITHIN_MASK(prot,       PAL_PROT_MASK));
 
     return (alloc_type & PAL_ALLOC_RESERVE ? MAP_NORESERVE | MAP_UNINITIALIZED : 0) |
+           (alloc_type & PAL_ALLOC_LAZY    ? MAP_NORESERVE : 0) |
            (prot & PAL_PROT_WRITECOPY      ? MAP_PRIVATE : MAP_SHARED);
 }
 
@@ -54,4 +56,15 @@ static inline int PAL_OPTION_TO_LINUX_OPEN(int options) {
            (options & PAL_OPTION_NONBLOCK ? O_NONBLOCK : 0);
 }
 
+static inline int PAL_ADVICE_TO_LINUX(enum PAL_ADVICE advice) {
+    assert(advice <= PAL_ADVICE_DONTNEED);
+    switch (advice) {
+        case PAL_ADVICE_SEQUENTIAL: return POSIX_FADV_SEQUENTIAL;
+        case PAL_ADVICE_RANDOM:     return POSIX_FADV_RANDOM;
+        case PAL_ADVICE_WILLNEED:   return POSIX_FADV_WILLNEED;
+        case PAL_ADVICE_DONTNEED:   return POSIX_FADV_DONTNEED;
+        default:                    return POSIX_FADV_NORMAL;
+    }
+}
+
 #endif /* PAL_FLAGS_CONV_H */
@@ -108,6 +108,7 @@ enum {
     pal_type_thread,
     pal_type_event,
     pal_type_eventfd,
+    pal_type_poller,
     PAL_HANDLE_TYPE_BOUND,
 };
 
@@ -125,6 +126,8 @@ typedef struct PAL_MEM_INFO_ {
 } PAL_MEM_INFO;
 
 /********** PAL APIs **********/
+#define PAL_MAX_STARTUP_PHASES 16
+
 typedef struct PAL_CONTROL_ {
     PAL_STR host_type;
     PAL_NUM process_id; /*!< An identifier of current picoprocess */
@@ -167,6 +170,15 @@ typedef struct PAL_CONTROL_ {
     PAL_CPU_INFO cpu_info; /*!< CPU information (only required ones) */
     PAL_MEM_INFO mem_info; /*!< memory information (only required ones) */
     PAL_TOPO_INFO topo_info; /*!< Topology information (only required ones) */
+
+    /*
+     * Start-up timing
+     */
+    struct {
+        const char* name; /*!< the phase which ended, or "start" for the first entry */
+        PAL_NUM time;     /*!< host wall-clock time (in microseconds) at the end of the phase */
+    } startup_phases[PAL_MAX_STARTUP_PHASES]; /*!< start-up phases of PAL, in order */
+    size_t startup_phases_cnt;
 } PAL_CONTROL;
 
 const PAL_CONTROL* DkGetPalControl(void);
@@ -179,8 +191,9 @@ const PAL_CONTROL* DkGetPalControl(void);
 enum PAL_ALLOC {
     PAL_ALLOC_RESERVE  = 0x1, /*!< Only reserve the memory */
     PAL_ALLOC_INTERNAL = 0x2, /*!< Allocate for PAL (valid only if #IN_PAL) */
+    PAL_ALLOC_LAZY     = 0x4, /*!< Commit pages on first access, if supported by the host */
 
-    PAL_ALLOC_MASK     = 0x3,
+    PAL_ALLOC_MASK     = 0x7,
 };
 
 /*! Memory Protection Flags */
@@ -230,6 +243,33 @@ int DkVirtualMemoryFree(PAL_PTR addr, PAL_NUM size);
  */
 int DkVirtualMemoryProtect(PAL_PTR addr, PAL_NUM size, PAL_FLG prot);
 
+/*!
+ * \brief Move a previously allocated memory mapping to another address.
+ *
+ * \param old_addr the address of the mapping
+ * \param new_addr the address to move the mapping to
+ * \param size the size
+ *
+ * The contents and permissions of [`old_addr`, `old_addr` + `size`) are moved to `new_addr`, and
+ * the old range is deallocated afterwards. Any memory previously allocated in the new range is
+ * discarded. The two ranges must not overlap; all arguments must be non-zero and aligned at the
+ * allocation alignment.
+ */
+int DkVirtualMemoryMove(PAL_PTR old_addr, PAL_PTR new_addr, PAL_NUM size);
+
+/*!
+ * \brief Release the physical memory backing a previously allocated memory mapping.
+ *
+ * \param addr the address
+ * \param size the size
+ * \param lazy if true, the memory may keep its contents until the host actually needs it
+ *
+ * The mapping stays allocated with the same permissions, but its contents are discarded: the next
+ * access reads zeroes (with `lazy`, either zeroes or the old contents, until it is written to).
+ * Both `addr` and `size` must be non-zero and aligned at the allocation alignment.
+ */
+int DkVirtualMemoryDiscard(PAL_PTR addr, PAL_NUM size, PAL_BOL lazy);
+
 /*
  * PROCESS CREATION
  */
@@ -294,8 +334,10 @@ enum PAL_CREATE {
     PAL_CREATE_TRY       = 1, /*!< Create file if file does not exist */
     PAL_CREATE_ALWAYS    = 2, /*!< Create file and fail if file already exists */
     PAL_CREATE_DUALSTACK = 4, /*!< Create dual-stack socket (opposite of IPV6_V6ONLY) */
+    PAL_CREATE_REUSEPORT = 8, /*!< Bind socket with SO_REUSEPORT, so that several sockets (also of
+                                   different processes) can listen on the same address */
 
-    PAL_CREATE_MASK      = 7,
+    PAL_CREATE_MASK      = 15,
 };
 
 /*! Stream Option Flags */
@@ -303,8 +345,10 @@ enum PAL_OPTION {
     PAL_OPTION_CLOEXEC       = 1,
     PAL_OPTION_EFD_SEMAPHORE = 2, /*!< specific to `eventfd` syscall */
     PAL_OPTION_NONBLOCK      = 4,
+    PAL_OPTION_PIPE_SHM      = 8, /*!< specific to `pipe:` connections: the PAL may carry data over
+                                       shared memory instead of the host socket (a hint) */
 
-    PAL_OPTION_MASK          = 7,
+    PAL_OPTION_MASK          = 15,
 };
 
 #define WITHIN_MASK(val, mask) (((val) | (mask)) == (mask))
@@ -328,7 +372,9 @@ enum PAL_OPTION {
  * * `dev:...`: Open a device as a stream. For example, `dev:tty` represents the standard I/O.
  * * `pipe.srv:<name>`, `pipe:<name>`, `pipe:`: Open a byte stream that can be used for RPC between
  *   processes. The server side of a pipe can accept any number of connections. If `pipe:` is given
- *   as the URI (i.e., without a name), it will open an anonymous bidirectional pipe.
+ *   as the URI (i.e., without a name), it will open an anonymous bidirectional pipe. With
+ *   #PAL_OPTION_PIPE_SHM, a `pipe:<name>` connection may be backed by shared memory; such handles
+ *   cannot be sent to other processes with DkSendHandle().
  * * `tcp.srv:<ADDR>:<PORT>`, `tcp:<ADDR>:<PORT>`: Open a TCP socket to listen or connect to
  *   a remote TCP socket.
  * * `udp.srv:<ADDR>:<PORT>`, `udp:<ADDR>:<PORT>`: Open a UDP socket to listen or connect to
@@ -384,6 +430,127 @@ int DkStreamRead(PAL_HANDLE handle, PAL_NUM offset, PAL_NUM* count, PAL_PTR buff
  */
 int DkStreamWrite(PAL_HANDLE handle, PAL_NUM offset, PAL_NUM* count, PAL_PTR buffer, PAL_STR dest);
 
+/*! A buffer segment for #DkStreamReadv and #DkStreamWritev, laid out as `struct iovec` */
+typedef struct PAL_IOVEC_ {
+    PAL_PTR buffer;
+    PAL_NUM size;
+} PAL_IOVEC;
+
+/*!
+ * \brief Read data from an open stream into several buffers.
+ *
+ * \param handle handle to the stream.
+ * \param offset offset to read at, same as for #DkStreamRead.
+ * \param iov buffers to fill, in order.
+ * \param iov_count number of elements in \p iov.
+ * \param[out] ret_size number of bytes read.
+ *
+ * \return 0 on success, negative error code on failure.
+ *
+ * Behaves like one #DkStreamRead into the concatenation of the buffers (host `readv`/`preadv`);
+ * in particular, it may read less than their total size.
+ */
+int DkStreamReadv(PAL_HANDLE handle, PAL_NUM offset, const PAL_IOVEC* iov, PAL_NUM iov_count,
+                  PAL_NUM* ret_size);
+
+/*!
+ * \brief Write data from several buffers to an open stream.
+ *
+ * \param handle handle to the stream.
+ * \param offset offset to write to, same as for #DkStreamWrite.
+ * \param iov buffers to write, in order.
+ * \param iov_count number of elements in \p iov.
+ * \param[out] ret_size number of bytes written.
+ *
+ * \return 0 on success, negative error code on failure.
+ *
+ * Behaves like one #DkStreamWrite of the concatenation of the buffers (host `writev`/`pwritev`);
+ * in particular, it may write less than their total size.
+ */
+int DkStreamWritev(PAL_HANDLE handle, PAL_NUM offset, const PAL_IOVEC* iov, PAL_NUM iov_count,
+                   PAL_NUM* ret_size);
+
+/*! A message (datagram) for #DkStreamReadMsgs and #DkStreamWriteMsgs */
+typedef struct PAL_STREAM_MSG_ {
+    PAL_PTR buffer;    /*!< message data */
+    PAL_NUM size;      /*!< size of \p buffer on input, number of bytes transferred on output */
+    PAL_PTR addr;      /*!< remote socket address (URI): destination for writes, buffer for the
+                            source for reads; NULL if not used */
+    PAL_NUM addr_size; /*!< size of the \p addr buffer (reads only) */
+} PAL_STREAM_MSG;
+
+/*!
+ * \brief Read several messages from a stream in one call.
+ *
+ * \param handle handle to the stream (e.g. a UDP socket).
+ * \param[in,out] msgs messages to read; `size` and (for UDP server sockets) `addr` of each are
+ *                 updated, same as \p count and \p source of #DkStreamRead.
+ * \param count number of elements in \p msgs.
+ * \param[out] ret_count number of messages read.
+ *
+ * \return 0 on success, negative error code on failure.
+ *
+ * Blocks (unless \p handle is non-blocking) until at least one message is available, then returns
+ * the messages already queued, up to \p count; \p ret_count may be less than \p count even if more
+ * messages follow. Fails only if no message was read.
+ */
+int DkStreamReadMsgs(PAL_HANDLE handle, PAL_STREAM_MSG* msgs, PAL_NUM count, PAL_NUM* ret_count);
+
+/*!
+ * \brief Write several messages to a stream in one call.
+ *
+ * \param handle handle to the stream (e.g. a UDP socket).
+ * \param[in,out] msgs messages to write; `size` of each is updated with the number of bytes
+ *                 written, `addr` is the destination as \p dest of #DkStreamWrite.
+ * \param count number of elements in \p msgs.
+ * \param[out] ret_count number of messages written.
+ *
+ * \return 0 on success, negative error code on failure.
+ *
+ * Messages are written in order; on an error, the messages before it are reported as written and
+ * the error is returned only if no message was written.
+ */
+int DkStreamWriteMsgs(PAL_HANDLE handle, PAL_STREAM_MSG* msgs, PAL_NUM count, PAL_NUM* ret_count);
+
+/*!
+ * \brief Send data from a file directly to a stream, without copying it through the caller.
+ *
+ * \param handle handle to the destination stream.
+ * \param file handle to the source file.
+ * \param offset offset in \p file to start reading at; the file position is not used or changed.
+ * \param count maximum number of bytes to send.
+ * \param[out] ret_count number of bytes sent.
+ *
+ * \return 0 on success, negative error code on failure.
+ *
+ * Behaves like host `sendfile`; in particular, it may send less than \p count bytes. Fails with
+ * -PAL_ERROR_NOTSUPPORT if this pair of handles can't be served by the host (e.g. the file contents
+ * must be verified or decrypted inside the PAL), in which case the caller has to copy the data
+ * itself.
+ */
+int DkStreamSendFile(PAL_HANDLE handle, PAL_HANDLE file, PAL_NUM offset, PAL_NUM count,
+                     PAL_NUM* ret_count);
+
+/*!
+ * \brief Copy data between two files, without copying it through the caller.
+ *
+ * \param handle handle to the destination file.
+ * \param offset offset in \p handle to start writing at.
+ * \param file handle to the source file.
+ * \param file_offset offset in \p file to start reading at.
+ * \param count maximum number of bytes to copy.
+ * \param[out] ret_count number of bytes copied.
+ *
+ * \return 0 on success, negative error code on failure.
+ *
+ * Behaves like host `copy_file_range` with explicit offsets; the file positions are not used or
+ * changed and fewer than \p count bytes may be copied (0 at the end of \p file). Fails with
+ * -PAL_ERROR_NOTSUPPORT if this pair of handles can't be served by the host (e.g. the destination
+ * is encrypted inside the PAL), in which case the caller has to copy the data itself.
+ */
+int DkStreamCopyFile(PAL_HANDLE handle, PAL_NUM offset, PAL_HANDLE file, PAL_NUM file_offset,
+                     PAL_NUM count, PAL_NUM* ret_count);
+
 enum PAL_DELETE {
     PAL_DELETE_RD = 1, /*!< shut down the read side only */
     PAL_DELETE_WR = 2, /*!< shut down the write side only */
@@ -425,6 +592,41 @@ int DkStreamUnmap(PAL_PTR addr, PAL_NUM size);
  */
 int DkStreamSetLength(PAL_HANDLE handle, PAL_NUM length);
 
+/*!
+ * \brief Allocate storage for the range [`offset`, `offset + length`) of the file referenced by
+ *        handle, like host `fallocate` with mode 0 or `FALLOC_FL_KEEP_SIZE`.
+ *
+ * \param keep_size if false, the file is extended to `offset + length` if it is shorter.
+ *
+ * \return 0 on success, negative error code on failure. -PAL_ERROR_NOTSUPPORT means that the
+ *         stream (or the host filesystem) can't preallocate; extending it with DkStreamSetLength()
+ *         may still work.
+ */
+int DkStreamAllocate(PAL_HANDLE handle, PAL_NUM offset, PAL_NUM length, PAL_BOL keep_size);
+
+enum PAL_ADVICE {
+    PAL_ADVICE_NORMAL,     /*!< no special access pattern */
+    PAL_ADVICE_SEQUENTIAL, /*!< the range will be read sequentially */
+    PAL_ADVICE_RANDOM,     /*!< the range will be read in random order */
+    PAL_ADVICE_WILLNEED,   /*!< the range will be read soon */
+    PAL_ADVICE_DONTNEED,   /*!< the range won't be read soon */
+};
+
+/*!
+ * \brief Advise the PAL (and the host) about the future accesses to the range [`offset`,
+ *        `offset + length`) of the file referenced by handle, like host `posix_fadvise`.
+ *
+ * \param length length of the range, 0 means up to the end of the file.
+ * \param advice one of #PAL_ADVICE.
+ *
+ * The advice only affects caching and read-ahead of the file (in the PAL or on the host), never its
+ * contents. In particular, #PAL_ADVICE_WILLNEED starts fetching the range without waiting for it.
+ *
+ * \return 0 on success, negative error code on failure. -PAL_ERROR_NOTSUPPORT means that the
+ *         stream doesn't take advice.
+ */
+int DkStreamAdvise(PAL_HANDLE handle, PAL_NUM offset, PAL_NUM length, enum PAL_ADVICE advice);
+
 /*!
  * \brief Flush the buffer of a file stream.
  *
@@ -452,6 +654,70 @@ int DkSendHandle(PAL_HANDLE handle, PAL_HANDLE cargo);
  */
 int DkReceiveHandle(PAL_HANDLE handle, PAL_HANDLE* cargo);
 
+/*!
+ * \brief Send an array of PAL handles over another handle.
+ *
+ * Same as DkSendHandle(), but the handles are transferred in batches, each with a single host
+ * message carrying the host resources of all its handles. Must be received with
+ * DkReceiveHandles() with the same `count`.
+ *
+ * \param handle  Process handle over which to send `cargos`.
+ * \param cargos  Array of handles being sent.
+ * \param count   Number of handles in `cargos`.
+ *
+ * \return 0 on success, negative error code on failure.
+ */
+int DkSendHandles(PAL_HANDLE handle, PAL_HANDLE* cargos, PAL_NUM count);
+
+/*!
+ * \brief Receive an array of PAL handles sent with DkSendHandles().
+ *
+ * \param handle       Process handle over which to receive.
+ * \param[out] cargos  Array to be filled with `count` received handles.
+ * \param count        Number of handles to receive.
+ *
+ * \return 0 on success, negative error code on failure.
+ */
+int DkReceiveHandles(PAL_HANDLE handle, PAL_HANDLE* cargos, PAL_NUM count);
+
+/*! classes of streams of the I/O counters, see #DkStreamsGetIoStats() */
+enum PAL_IO_CLASS {
+    PAL_IO_CLASS_FILE,
+    PAL_IO_CLASS_PROTECTED_FILE, /*!< SGX protected files (not counted as files) */
+    PAL_IO_CLASS_DIR,
+    PAL_IO_CLASS_PIPE,
+    PAL_IO_CLASS_DEV,
+    PAL_IO_CLASS_TCP,
+    PAL_IO_CLASS_UDP,
+    PAL_IO_CLASS_PROCESS,
+    PAL_IO_CLASS_EVENTFD,
+    PAL_IO_CLASS_POLLER,         /*!< only waits, in #DkPollerWait() */
+    PAL_IO_CLASS_OTHER,
+    PAL_IO_CLASS_BOUND,
+};
+
+/*! I/O counters of one class of streams */
+typedef struct PAL_IO_STATS_ {
+    /*! calls of #DkStreamRead(), #DkStreamReadv() and #DkStreamReadMsgs() (also failed ones), bytes
+     * read and time spent in them (in microseconds) */
+    PAL_NUM reads, read_bytes, read_us;
+    /*! the same of the write functions */
+    PAL_NUM writes, write_bytes, write_us;
+    /*! calls of #DkStreamsWaitEvents() which waited on a stream of this class (or of
+     * #DkPollerWait()) and time spent in them */
+    PAL_NUM waits, wait_us;
+} PAL_IO_STATS;
+
+/*!
+ * \brief Get the I/O counters of this process.
+ *
+ * \param[out] stats  Array of #PAL_IO_CLASS_BOUND entries, filled with the counters of each class.
+ *
+ * The counters only grow (they start at zero in each process). Times are measured only with the
+ * manifest option `loader.io_time_stats`, otherwise they are zero.
+ */
+void DkStreamsGetIoStats(PAL_IO_STATS* stats);
+
 /* stream attribute structure */
 typedef struct _PAL_STREAM_ATTR {
     PAL_IDX handle_type;
@@ -658,10 +924,11 @@ void DkEventClear(PAL_HANDLE handle);
 int DkEventWait(PAL_HANDLE handle, uint64_t* timeout_us);
 
 enum PAL_WAIT {
-    PAL_WAIT_SIGNAL = 1, /*!< ignored in events */
-    PAL_WAIT_READ   = 2,
-    PAL_WAIT_WRITE  = 4,
-    PAL_WAIT_ERROR  = 8, /*!< ignored in events */
+    PAL_WAIT_SIGNAL    = 1,  /*!< ignored in events */
+    PAL_WAIT_READ      = 2,
+    PAL_WAIT_WRITE     = 4,
+    PAL_WAIT_ERROR     = 8,  /*!< ignored in events */
+    PAL_WAIT_EXCLUSIVE = 16, /*!< only for #DkPollerCtl, see there */
 };
 
 /*!
@@ -679,11 +946,87 @@ enum PAL_WAIT {
 int DkStreamsWaitEvents(PAL_NUM count, PAL_HANDLE* handle_array, PAL_FLG* events,
                         PAL_FLG* ret_events, PAL_NUM timeout_us);
 
+/*!
+ * \brief Create a poller.
+ *
+ * \param[out] handle on success contains the poller handle
+ *
+ * \return 0 on success, negative error code on failure
+ *
+ * A poller is a set of stream handles that are registered once with #DkPollerCtl and then waited
+ * on with #DkPollerWait, which returns only the handles that are ready. Unlike
+ * #DkStreamsWaitEvents, the cost of a wait doesn't grow with the number of registered handles.
+ * The poller is destroyed with #DkObjectClose.
+ */
+int DkPollerCreate(PAL_HANDLE* handle);
+
+enum PAL_POLLER_OP {
+    PAL_POLLER_ADD,    /*!< register a handle; registering it again replaces the registration */
+    PAL_POLLER_MODIFY, /*!< change events and data of a registered handle */
+    PAL_POLLER_REMOVE, /*!< unregister a handle, `events` and `data` are ignored */
+};
+
+/*!
+ * \brief Add, modify or remove a handle in a poller.
+ *
+ * \param poller poller handle
+ * \param op operation, see #PAL_POLLER_OP
+ * \param handle stream handle
+ * \param events #PAL_WAIT_READ and/or #PAL_WAIT_WRITE to wait for, optionally with
+ *               #PAL_WAIT_EXCLUSIVE
+ * \param data opaque value reported by #DkPollerWait for events of \p handle
+ *
+ * \return 0 on success, negative error code on failure
+ *
+ * A handle must be removed from all pollers before it is closed.
+ *
+ * If \p handle is registered with #PAL_WAIT_EXCLUSIVE in several pollers, an event on it wakes up
+ * only some (usually one) of the threads blocked in #DkPollerWait on these pollers, instead of all
+ * of them (like `EPOLLEXCLUSIVE` of Linux). Pollers which are not blocked in a wait may still
+ * report the event.
+ */
+int DkPollerCtl(PAL_HANDLE poller, enum PAL_POLLER_OP op, PAL_HANDLE handle, PAL_FLG events,
+                PAL_NUM data);
+
+typedef struct PAL_POLLER_EVENT_ {
+    PAL_NUM data;   /*!< `data` of the registered handle */
+    PAL_FLG events; /*!< ready events, including #PAL_WAIT_ERROR */
+} PAL_POLLER_EVENT;
+
+/*!
+ * \brief Wait for events on the handles registered in a poller.
+ *
+ * \param poller poller handle
+ * \param[out] events array of at least \p max_events elements, filled with ready events
+ * \param max_events the maximal number of events to return
+ * \param[out] ret_count number of events stored in \p events
+ * \param timeout_us maximal time to wait (in microseconds), or `NO_TIMEOUT` to block until at
+ *                   least one handle is ready
+ *
+ * \return 0 on success (\p ret_count may be 0 in case of a spurious wakeup), negative error code
+ *         otherwise (#PAL_ERROR_TRYAGAIN in case of timeout)
+ *
+ * A handle with several host objects (e.g. a private pipe) may be reported in more than one event.
+ */
+int DkPollerWait(PAL_HANDLE poller, PAL_POLLER_EVENT* events, PAL_NUM max_events,
+                 PAL_NUM* ret_count, PAL_NUM timeout_us);
+
 /*!
  * \brief Close (deallocate) a PAL handle.
  */
 void DkObjectClose(PAL_HANDLE objectHandle);
 
+/*!
+ * \brief Close (deallocate) several PAL handles.
+ *
+ * Same as calling DkObjectClose() on each handle, but the host resources may be released in
+ * batches (e.g. on SGX, host FDs are closed with one OCALL per batch instead of one each).
+ *
+ * \param handles  Array of handles to close.
+ * \param count    Number of handles in `handles`.
+ */
+void DkObjectsClose(PAL_HANDLE* handles, PAL_NUM count);
+
 /*
  * MISC
  */
@@ -745,6 +1088,12 @@ int DkSegmentRegisterSet(PAL_FLG reg, PAL_PTR addr);
  */
 PAL_NUM DkMemoryAvailableQuota(void);
 
+/*!
+ * \brief Return the amount of memory currently resident (backed by physical memory) in this
+ * process, or 0 if it is unknown.
+ */
+PAL_NUM DkMemoryResidentSize(void);
+
 /*!
  * \brief Obtain the attestation report (local) with `user_report_data` embedded into it.
  *
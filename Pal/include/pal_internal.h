@@ -49,6 +49,27 @@ struct handle_ops {
     int64_t (*writebyaddr)(PAL_HANDLE handle, uint64_t offset, uint64_t count, const void* buffer,
                            const char* addr, size_t addrlen);
 
+    /* 'readmsgs' and 'writemsgs' are used by DkStreamReadMsgs and DkStreamWriteMsgs and return the
+     * number of messages transferred (may be less than `count`). Without them, messages are
+     * transferred one by one with the ops above. */
+    int64_t (*readmsgs)(PAL_HANDLE handle, PAL_STREAM_MSG* msgs, size_t count);
+    int64_t (*writemsgs)(PAL_HANDLE handle, PAL_STREAM_MSG* msgs, size_t count);
+
+    /* 'readv' and 'writev' are used by DkStreamReadv and DkStreamWritev and return the number of
+     * bytes transferred. Without them, the segments are transferred one by one with 'read' and
+     * 'write', see _DkStreamReadvFallback() and _DkStreamWritevFallback(). */
+    int64_t (*readv)(PAL_HANDLE handle, uint64_t offset, const PAL_IOVEC* iov, size_t iov_count);
+    int64_t (*writev)(PAL_HANDLE handle, uint64_t offset, const PAL_IOVEC* iov, size_t iov_count);
+
+    /* 'sendfile' is used by DkStreamSendFile on the destination handle and returns the number of
+     * bytes sent, or -PAL_ERROR_NOTSUPPORT if the host can't transfer from `file` directly */
+    int64_t (*sendfile)(PAL_HANDLE handle, PAL_HANDLE file, uint64_t offset, uint64_t count);
+
+    /* 'copyfile' is used by DkStreamCopyFile on the destination handle and returns the number of
+     * bytes copied, or -PAL_ERROR_NOTSUPPORT if the host can't copy between the two files */
+    int64_t (*copyfile)(PAL_HANDLE handle, uint64_t offset, PAL_HANDLE file, uint64_t file_offset,
+                        uint64_t count);
+
     /* 'close' and 'delete' is used by DkObjectClose and DkStreamDelete, 'close' will close the
      * stream, while 'delete' actually destroy the stream, such as deleting a file or shutting
      * down a socket */
@@ -67,6 +88,14 @@ struct handle_ops {
     /* 'setlength' is used by DkStreamFlush. It truncate the stream to certain size. */
     int64_t (*setlength)(PAL_HANDLE handle, uint64_t length);
 
+    /* 'allocate' is used by DkStreamAllocate. It allocates storage for a range of the stream and
+     * extends the stream to its end, unless `keep_size` */
+    int (*allocate)(PAL_HANDLE handle, uint64_t offset, uint64_t length, bool keep_size);
+
+    /* 'advise' is used by DkStreamAdvise. It applies access advice to a range of the stream (up to
+     * its end if `length` is 0) */
+    int (*advise)(PAL_HANDLE handle, uint64_t offset, uint64_t length, enum PAL_ADVICE advice);
+
     /* 'flush' is used by DkStreamFlush. It syncs the stream to the device */
     int (*flush)(PAL_HANDLE handle);
 
@@ -125,6 +154,9 @@ struct pal_internal_state {
 
     /* May not be the same as page size, e.g. SYSTEM_INFO::dwAllocationGranularity on Windows */
     size_t          alloc_align;
+
+    /* `loader.io_time_stats`, measure the time of stream I/O (see DkStreamsGetIoStats()) */
+    bool            io_time_stats;
 };
 extern struct pal_internal_state g_pal_state;
 
@@ -132,6 +164,19 @@ extern PAL_CONTROL g_pal_control;
 
 int add_preloaded_range(uintptr_t start, uintptr_t end, const char* comment);
 
+/* Stream I/O counters (see DkStreamsGetIoStats()): `io_stats_start()` before the operation, then
+ * `io_stats_add_*()` with its result. */
+uint64_t io_stats_start(void);
+void io_stats_add_read(PAL_HANDLE handle, int64_t ret, uint64_t start);
+void io_stats_add_write(PAL_HANDLE handle, int64_t ret, uint64_t start);
+void io_stats_add_wait(size_t count, PAL_HANDLE* handles, uint64_t start);
+/* logs the counters of all classes with any I/O, for the stats printed at exit */
+void print_io_stats(void);
+
+/* Records the end of start-up phase `name` in `g_pal_control.startup_phases`, at `time` (host time
+ * in microseconds) or now if `time` is 0. */
+void add_startup_phase(const char* name, uint64_t time);
+
 #define IS_ALLOC_ALIGNED(addr)     IS_ALIGNED_POW2(addr, g_pal_state.alloc_align)
 #define IS_ALLOC_ALIGNED_PTR(addr) IS_ALIGNED_PTR_POW2(addr, g_pal_state.alloc_align)
 #define ALLOC_ALIGN_UP(addr)       ALIGN_UP_POW2(addr, g_pal_state.alloc_align)
@@ -164,6 +209,7 @@ bool _DkCheckMemoryMappable(const void* addr, size_t size);
 PAL_NUM _DkGetProcessId(void);
 unsigned long _DkMemoryQuota(void);
 unsigned long _DkMemoryAvailableQuota(void);
+unsigned long _DkMemoryResidentSize(void);
 // Returns 0 on success, negative PAL code on failure
 int _DkGetCPUInfo(PAL_CPU_INFO* info);
 int _DkGetTopologyInfo(PAL_TOPO_INFO* topo_info);
@@ -177,6 +223,10 @@ int64_t _DkStreamRead(PAL_HANDLE handle, uint64_t offset, uint64_t count, void*
                       int addrlen);
 int64_t _DkStreamWrite(PAL_HANDLE handle, uint64_t offset, uint64_t count, const void* buf,
                        const char* addr, int addrlen);
+int64_t _DkStreamReadvFallback(PAL_HANDLE handle, uint64_t offset, const PAL_IOVEC* iov,
+                               size_t iov_count);
+int64_t _DkStreamWritevFallback(PAL_HANDLE handle, uint64_t offset, const PAL_IOVEC* iov,
+                                size_t iov_count);
 int _DkStreamAttributesQuery(const char* uri, PAL_STREAM_ATTR* attr);
 int _DkStreamAttributesQueryByHandle(PAL_HANDLE hdl, PAL_STREAM_ATTR* attr);
 int _DkStreamMap(PAL_HANDLE handle, void** addr, int prot, uint64_t offset, uint64_t size);
@@ -185,8 +235,8 @@ int64_t _DkStreamSetLength(PAL_HANDLE handle, uint64_t length);
 int _DkStreamFlush(PAL_HANDLE handle);
 int _DkStreamGetName(PAL_HANDLE handle, char* buf, size_t size);
 const char* _DkStreamRealpath(PAL_HANDLE hdl);
-int _DkSendHandle(PAL_HANDLE hdl, PAL_HANDLE cargo);
-int _DkReceiveHandle(PAL_HANDLE hdl, PAL_HANDLE* cargo);
+int _DkSendHandles(PAL_HANDLE hdl, PAL_HANDLE* cargos, size_t count);
+int _DkReceiveHandles(PAL_HANDLE hdl, PAL_HANDLE* cargos, size_t count);
 
 /* DkProcess and DkThread calls */
 int _DkThreadCreate(PAL_HANDLE* handle, int (*callback)(void*), const void* param);
@@ -194,6 +244,10 @@ noreturn void _DkThreadExit(int* clear_child_tid);
 void _DkThreadYieldExecution(void);
 int _DkThreadResume(PAL_HANDLE threadHandle);
 int _DkProcessCreate(PAL_HANDLE* handle, const char** args);
+/* Called by pal_main() after loading the libraries. If the current process was started as a zygote
+ * (only in Linux PAL), it waits for requests of new children and returns only in each child forked
+ * off, with `instance_id` and `parent_process` of that child. Otherwise does nothing. */
+void _DkProcessZygote(PAL_NUM* instance_id, PAL_HANDLE* parent_process);
 noreturn void _DkProcessExit(int exitCode);
 int _DkThreadSetCpuAffinity(PAL_HANDLE thread, PAL_NUM cpumask_size, PAL_PTR cpu_mask);
 int _DkThreadGetCpuAffinity(PAL_HANDLE thread, PAL_NUM cpumask_size, PAL_PTR cpu_mask);
@@ -208,11 +262,19 @@ int _DkEventWait(PAL_HANDLE handle, uint64_t* timeout_us);
 int _DkVirtualMemoryAlloc(void** paddr, uint64_t size, int alloc_type, int prot);
 int _DkVirtualMemoryFree(void* addr, uint64_t size);
 int _DkVirtualMemoryProtect(void* addr, uint64_t size, int prot);
+int _DkVirtualMemoryMove(void* old_addr, void* new_addr, uint64_t size);
+int _DkVirtualMemoryDiscard(void* addr, uint64_t size, bool lazy);
 
 /* DkObject calls */
 int _DkObjectClose(PAL_HANDLE objectHandle);
+void _DkObjectsClose(PAL_HANDLE* handles, size_t count);
 int _DkStreamsWaitEvents(size_t count, PAL_HANDLE* handle_array, PAL_FLG* events,
                          PAL_FLG* ret_events, int64_t timeout_us);
+int _DkPollerCreate(PAL_HANDLE* handle);
+int _DkPollerCtl(PAL_HANDLE poller, enum PAL_POLLER_OP op, PAL_HANDLE handle, PAL_FLG events,
+                 PAL_NUM data);
+int _DkPollerWait(PAL_HANDLE poller, PAL_POLLER_EVENT* events, size_t max_events,
+                  size_t* ret_count, int64_t timeout_us);
 
 /* DkException calls & structures */
 PAL_EVENT_HANDLER _DkGetExceptionHandler(PAL_NUM event_num);
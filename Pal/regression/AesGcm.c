@@ -0,0 +1,146 @@
+/* Test vectors and a simple throughput benchmark of AES-GCM from the crypto adapter, which is used
+ * e.g. for protected files and encrypted pipes. */
+
+#include "api.h"
+#include "crypto.h"
+#include "hex.h"
+#include "pal.h"
+#include "pal_regression.h"
+
+#define BENCH_ROUNDS   64
+#define BENCH_BUF_SIZE (1024 * 1024)
+#define TAG_SIZE       16
+
+/* from "The Galois/Counter Mode of Operation (GCM)" by McGrew and Viega (test cases 2, 3, 4, 16) */
+static const struct {
+    const char* key;
+    const char* iv;
+    const char* plaintext;
+    const char* aad;
+    const char* ciphertext;
+    const char* tag;
+} g_vectors[] = {
+    { "00000000000000000000000000000000",
+      "000000000000000000000000",
+      "00000000000000000000000000000000",
+      "",
+      "0388dace60b6a392f328c2b971b2fe78",
+      "ab6e47d42cec13bdf53a67b21257bddf" },
+    { "feffe9928665731c6d6a8f9467308308",
+      "cafebabefacedbaddecaf888",
+      "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+      "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255",
+      "",
+      "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+      "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091473f5985",
+      "4d5c2af327cd64a62cf35abd2ba6fab4" },
+    { "feffe9928665731c6d6a8f9467308308",
+      "cafebabefacedbaddecaf888",
+      "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+      "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+      "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+      "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+      "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091",
+      "5bc94fbc3221a5db94fae95ae7121a47" },
+    { "feffe9928665731c6d6a8f9467308308feffe9928665731c6d6a8f9467308308",
+      "cafebabefacedbaddecaf888",
+      "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+      "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+      "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+      "522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa"
+      "8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662",
+      "76fc6ece0f4e1768cddf8853bb2d551b" },
+};
+
+static size_t hex2bytes(const char* hex, uint8_t* bytes) {
+    size_t size = strlen(hex) / 2;
+    for (size_t i = 0; i < size; i++)
+        bytes[i] = hex2dec(hex[2 * i]) << 4 | hex2dec(hex[2 * i + 1]);
+    return size;
+}
+
+static bool check_vector(size_t i) {
+    uint8_t key[32], iv[12], plaintext[64], aad[32], ciphertext[64], tag[TAG_SIZE];
+    uint8_t output[64], output_tag[TAG_SIZE];
+    size_t key_size = hex2bytes(g_vectors[i].key, key);
+    hex2bytes(g_vectors[i].iv, iv);
+    size_t size = hex2bytes(g_vectors[i].plaintext, plaintext);
+    size_t aad_size = hex2bytes(g_vectors[i].aad, aad);
+    hex2bytes(g_vectors[i].ciphertext, ciphertext);
+    hex2bytes(g_vectors[i].tag, tag);
+
+    if (lib_AESGCMEncrypt(key, key_size, iv, plaintext, size, aad, aad_size, output, output_tag,
+                          TAG_SIZE) < 0
+            || memcmp(output, ciphertext, size) || memcmp(output_tag, tag, TAG_SIZE))
+        return false;
+    if (lib_AESGCMDecrypt(key, key_size, iv, ciphertext, size, aad, aad_size, output, tag,
+                          TAG_SIZE) < 0
+            || memcmp(output, plaintext, size))
+        return false;
+
+    /* a wrong tag must be rejected */
+    tag[0] ^= 1;
+    return lib_AESGCMDecrypt(key, key_size, iv, ciphertext, size, aad, aad_size, output, tag,
+                             TAG_SIZE) < 0;
+}
+
+int main(int argc, char** argv, char** envp) {
+    for (size_t i = 0; i < ARRAY_SIZE(g_vectors); i++) {
+        if (!check_vector(i)) {
+            pal_printf("AES-GCM test vector %lu failed\n", i);
+            return 1;
+        }
+    }
+    pal_printf("AES-GCM test vectors OK\n");
+
+    uint8_t* buf = NULL;
+    if (DkVirtualMemoryAlloc((void**)&buf, BENCH_BUF_SIZE, 0, PAL_PROT_READ | PAL_PROT_WRITE) < 0) {
+        pal_printf("DkVirtualMemoryAlloc failed\n");
+        return 1;
+    }
+    for (size_t i = 0; i < BENCH_BUF_SIZE; i++)
+        buf[i] = i;
+
+    /* round trip of odd sizes, in place, which exercises both the eight-block and the tail code */
+    uint8_t key[16] = {1};
+    uint8_t iv[12] = {2};
+    uint8_t tag[TAG_SIZE];
+    for (size_t size = 0; size < 4096; size += 333) {
+        if (lib_AESGCMEncrypt(key, sizeof(key), iv, buf, size, buf + size, 7, buf, tag,
+                              TAG_SIZE) < 0
+                || lib_AESGCMDecrypt(key, sizeof(key), iv, buf, size, buf + size, 7, buf, tag,
+                                     TAG_SIZE) < 0) {
+            pal_printf("AES-GCM round trip of %lu bytes failed\n", size);
+            return 1;
+        }
+        for (size_t i = 0; i < size; i++) {
+            if (buf[i] != (uint8_t)i) {
+                pal_printf("AES-GCM round trip of %lu bytes is wrong\n", size);
+                return 1;
+            }
+        }
+    }
+    pal_printf("AES-GCM round trips OK\n");
+
+    const size_t sizes[] = {4096, BENCH_BUF_SIZE};
+    for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+        size_t rounds = BENCH_ROUNDS * BENCH_BUF_SIZE / sizes[i];
+        PAL_NUM start, end;
+        if (DkSystemTimeQuery(&start) < 0)
+            return 1;
+        for (size_t j = 0; j < rounds; j++) {
+            if (lib_AESGCMEncrypt(key, sizeof(key), iv, buf, sizes[i], NULL, 0, buf, tag,
+                                  TAG_SIZE) < 0) {
+                pal_printf("AES-GCM encryption of benchmark buffer failed\n");
+                return 1;
+            }
+        }
+        if (DkSystemTimeQuery(&end) < 0)
+            return 1;
+        pal_printf("AES-GCM throughput (%lu B): %lu MB/s\n", sizes[i],
+                   rounds * sizes[i] / MAX(end - start, 1UL));
+    }
+
+    DkVirtualMemoryFree(buf, BENCH_BUF_SIZE);
+    return 0;
+}
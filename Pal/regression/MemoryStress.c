@@ -0,0 +1,87 @@
+/* Stress test (and a simple benchmark) of virtual memory bookkeeping with a large number of
+ * mappings: punches holes into a large allocation to get NUM_MAPPINGS separate mappings, performs
+ * allocations that have to search through the fragmented range and finally fills all the holes. */
+
+#include "api.h"
+#include "pal.h"
+#include "pal_regression.h"
+
+#define UNIT (pal_control.alloc_align)
+
+#define NUM_MAPPINGS 100000
+#define NUM_SEARCHES 1000
+
+static PAL_NUM g_last_time;
+
+static int report_time(const char* phase) {
+    PAL_NUM time;
+    if (DkSystemTimeQuery(&time) < 0) {
+        pal_printf("DkSystemTimeQuery failed\n");
+        return -1;
+    }
+    if (phase)
+        pal_printf("%s: %lu us\n", phase, time - g_last_time);
+    g_last_time = time;
+    return 0;
+}
+
+int main(int argc, char** argv, char** envp) {
+    size_t size = 2 * NUM_MAPPINGS * UNIT;
+
+    void* base = NULL;
+    if (DkVirtualMemoryAlloc(&base, size, 0, PAL_PROT_READ | PAL_PROT_WRITE) < 0) {
+        pal_printf("DkVirtualMemoryAlloc of %lu bytes failed\n", size);
+        return 1;
+    }
+
+    if (report_time(NULL) < 0)
+        return 1;
+
+    /* free every other unit, so that the range becomes NUM_MAPPINGS separate mappings */
+    for (size_t i = 0; i < NUM_MAPPINGS; i++) {
+        if (DkVirtualMemoryFree(base + (2 * i + 1) * UNIT, UNIT) < 0) {
+            pal_printf("DkVirtualMemoryFree of hole %lu failed\n", i);
+            return 1;
+        }
+    }
+    if (report_time("Punching holes") < 0)
+        return 1;
+
+    /* the holes are too small for these allocations, so the allocator has to skip all of them */
+    for (size_t i = 0; i < NUM_SEARCHES; i++) {
+        void* mem = NULL;
+        if (DkVirtualMemoryAlloc(&mem, 2 * UNIT, 0, PAL_PROT_READ | PAL_PROT_WRITE) < 0) {
+            pal_printf("DkVirtualMemoryAlloc in fragmented memory failed\n");
+            return 1;
+        }
+        if (mem >= base && mem < base + size) {
+            pal_printf("DkVirtualMemoryAlloc returned %p which overlaps with holes\n", mem);
+            return 1;
+        }
+        if (DkVirtualMemoryFree(mem, 2 * UNIT) < 0) {
+            pal_printf("DkVirtualMemoryFree in fragmented memory failed\n");
+            return 1;
+        }
+    }
+    if (report_time("Allocating in fragmented memory") < 0)
+        return 1;
+
+    /* fill all the holes back, merging the mappings */
+    for (size_t i = 0; i < NUM_MAPPINGS; i++) {
+        void* mem = base + (2 * i + 1) * UNIT;
+        if (DkVirtualMemoryAlloc(&mem, UNIT, 0, PAL_PROT_READ | PAL_PROT_WRITE) < 0) {
+            pal_printf("DkVirtualMemoryAlloc of hole %lu failed\n", i);
+            return 1;
+        }
+    }
+    if (report_time("Filling holes") < 0)
+        return 1;
+
+    if (DkVirtualMemoryFree(base, size) < 0) {
+        pal_printf("DkVirtualMemoryFree of the whole range failed\n");
+        return 1;
+    }
+
+    pal_printf("Memory stress test OK\n");
+    return 0;
+}
@@ -60,5 +60,61 @@ int main(int argc, char** argv, char** envp) {
         }
     }
 
+    /* same over a connection which may use shared memory; move more data than fits into it */
+    PAL_HANDLE srv = NULL;
+    ret = DkStreamOpen("pipe.srv:2", PAL_ACCESS_RDWR, 0, 0, 0, &srv);
+    if (ret < 0) {
+        pal_printf("DkStreamOpen(pipe.srv:2) failed: %d\n", ret);
+        return 1;
+    }
+    PAL_HANDLE cli = NULL;
+    ret = DkStreamOpen("pipe:2", PAL_ACCESS_RDWR, 0, 0, PAL_OPTION_PIPE_SHM, &cli);
+    if (ret < 0) {
+        pal_printf("DkStreamOpen(pipe:2) failed: %d\n", ret);
+        return 1;
+    }
+    PAL_HANDLE acc = NULL;
+    ret = DkStreamWaitForClient(srv, &acc);
+    if (ret < 0) {
+        pal_printf("DkStreamWaitForClient(pipe.srv:2) failed: %d\n", ret);
+        return 1;
+    }
+
+    static char wbuf[10000];
+    static char rbuf[sizeof(wbuf)];
+    for (int iter = 0; iter < 40; iter++) {
+        PAL_HANDLE from = iter % 2 ? acc : cli;
+        PAL_HANDLE to   = iter % 2 ? cli : acc;
+        for (size_t i = 0; i < sizeof(wbuf); i++)
+            wbuf[i] = (char)(iter + i);
+
+        size_t size = sizeof(wbuf);
+        ret = DkStreamWrite(from, 0, &size, wbuf, NULL);
+        if (ret < 0 || size != sizeof(wbuf)) {
+            pal_printf("Pipe Write failed: %d\n", ret);
+            return 1;
+        }
+
+        /* read in chunks not matching whatever the PAL sends */
+        size_t done = 0;
+        while (done < sizeof(rbuf)) {
+            size = MIN(sizeof(rbuf) - done, (size_t)777);
+            ret = DkStreamRead(to, 0, &size, rbuf + done, NULL, 0);
+            if (ret < 0 || size == 0) {
+                pal_printf("Pipe Read failed: %d\n", ret);
+                return 1;
+            }
+            done += size;
+        }
+        if (memcmp(wbuf, rbuf, sizeof(wbuf))) {
+            pal_printf("Pipe Read returned wrong data\n");
+            return 1;
+        }
+    }
+    pal_printf("Pipe Transmission 2 OK\n");
+
+    DkObjectClose(acc);
+    DkObjectClose(cli);
+    DkObjectClose(srv);
     return 0;
 }
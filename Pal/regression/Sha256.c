@@ -0,0 +1,75 @@
+/* Test vectors and a simple throughput benchmark of SHA256 from the crypto adapter, which is used
+ * e.g. for hashing of trusted files. */
+
+#include "api.h"
+#include "crypto.h"
+#include "hex.h"
+#include "pal.h"
+#include "pal_regression.h"
+
+#define BENCH_BUF_SIZE (1024 * 1024)
+#define BENCH_ROUNDS   64
+
+static const struct {
+    const char* msg;
+    const char* hash;
+} g_vectors[] = {
+    { "", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+    { "abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+    { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+      "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+};
+
+static int sha256(const uint8_t* data, size_t size, uint8_t* hash) {
+    LIB_SHA256_CONTEXT ctx;
+    int ret = lib_SHA256Init(&ctx);
+    if (ret < 0)
+        return ret;
+    ret = lib_SHA256Update(&ctx, data, size);
+    if (ret < 0)
+        return ret;
+    return lib_SHA256Final(&ctx, hash);
+}
+
+int main(int argc, char** argv, char** envp) {
+    uint8_t hash[SHA256_DIGEST_LEN];
+    char hash_str[SHA256_DIGEST_LEN * 2 + 1];
+
+    for (size_t i = 0; i < ARRAY_SIZE(g_vectors); i++) {
+        if (sha256((const uint8_t*)g_vectors[i].msg, strlen(g_vectors[i].msg), hash) < 0) {
+            pal_printf("SHA256 of test vector %lu failed\n", i);
+            return 1;
+        }
+        BYTES2HEXSTR(hash, hash_str, sizeof(hash_str));
+        if (strcmp(hash_str, g_vectors[i].hash)) {
+            pal_printf("Wrong SHA256 of test vector %lu: %s\n", i, hash_str);
+            return 1;
+        }
+    }
+    pal_printf("SHA256 test vectors OK\n");
+
+    uint8_t* buf = NULL;
+    if (DkVirtualMemoryAlloc((void**)&buf, BENCH_BUF_SIZE, 0, PAL_PROT_READ | PAL_PROT_WRITE) < 0) {
+        pal_printf("DkVirtualMemoryAlloc failed\n");
+        return 1;
+    }
+    for (size_t i = 0; i < BENCH_BUF_SIZE; i++)
+        buf[i] = i;
+
+    PAL_NUM start, end;
+    if (DkSystemTimeQuery(&start) < 0)
+        return 1;
+    for (size_t i = 0; i < BENCH_ROUNDS; i++) {
+        if (sha256(buf, BENCH_BUF_SIZE, hash) < 0) {
+            pal_printf("SHA256 of benchmark buffer failed\n");
+            return 1;
+        }
+    }
+    if (DkSystemTimeQuery(&end) < 0)
+        return 1;
+
+    pal_printf("SHA256 throughput: %lu MB/s\n",
+               BENCH_ROUNDS * BENCH_BUF_SIZE / MAX(end - start, 1UL));
+    DkVirtualMemoryFree(buf, BENCH_BUF_SIZE);
+    return 0;
+}
@@ -0,0 +1,210 @@
+/* Correctness tests and a throughput benchmark of memcpy(), memset(), memcmp() and strnlen() at
+ * each level supported by the CPU (see init_string_ops()). */
+
+#include "api.h"
+#include "pal.h"
+#include "pal_regression.h"
+
+#define CHECK_MAX_SIZE 300
+#define CHECK_ALIGN    64
+#define CHECK_BUF_SIZE (CHECK_MAX_SIZE + 3 * CHECK_ALIGN)
+#define GUARD          0xa5
+
+#define BIG_SIZE       (8 * 1024 * 1024)
+#define BENCH_BYTES    (256 * 1024 * 1024)
+
+static const char* g_level_names[] = {
+    [STRING_OPS_BASELINE] = "baseline",
+    [STRING_OPS_AVX2]     = "AVX2",
+    [STRING_OPS_AVX512]   = "AVX-512",
+};
+
+static const size_t g_bench_sizes[] = {16, 64, 256, 4096, 65536, BIG_SIZE};
+
+static char* g_src;
+static char* g_dst;
+static volatile size_t g_sink;
+
+static void fill(char* buf, size_t size, unsigned int seed) {
+    for (size_t i = 0; i < size; i++)
+        buf[i] = (char)(i * 7 + seed);
+}
+
+static bool guards_intact(const char* buf, size_t begin, size_t end) {
+    for (size_t i = 0; i < CHECK_BUF_SIZE; i++)
+        if ((i < begin || i >= end) && (unsigned char)buf[i] != GUARD)
+            return false;
+    return true;
+}
+
+static int sign(int x) {
+    return x < 0 ? -1 : x > 0;
+}
+
+static bool check_memcpy_memset(void) {
+    for (size_t size = 0; size <= CHECK_MAX_SIZE; size++) {
+        for (size_t src_off = 0; src_off < CHECK_ALIGN; src_off += 7) {
+            for (size_t dst_off = CHECK_ALIGN; dst_off < 2 * CHECK_ALIGN; dst_off += 5) {
+                memset(g_dst, GUARD, CHECK_BUF_SIZE);
+                memcpy(g_dst + dst_off, g_src + src_off, size);
+                for (size_t i = 0; i < size; i++)
+                    if (g_dst[dst_off + i] != g_src[src_off + i])
+                        return false;
+                if (!guards_intact(g_dst, dst_off, dst_off + size))
+                    return false;
+
+                memset(g_dst + dst_off, (int)size, size);
+                for (size_t i = 0; i < size; i++)
+                    if (g_dst[dst_off + i] != (char)size)
+                        return false;
+                if (!guards_intact(g_dst, dst_off, dst_off + size))
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool check_memcmp(void) {
+    char lhs[CHECK_BUF_SIZE];
+    char rhs[CHECK_BUF_SIZE];
+    fill(lhs, sizeof(lhs), 0);
+    fill(rhs, sizeof(rhs), 0);
+
+    for (size_t size = 0; size <= CHECK_MAX_SIZE; size++) {
+        for (size_t off = 0; off < CHECK_ALIGN; off += 3) {
+            if (memcmp(lhs + off, rhs + off, size))
+                return false;
+            for (size_t pos = 0; pos < size; pos++) {
+                char orig = rhs[off + pos];
+                /* both smaller and greater bytes, and ones with the top bit set */
+                rhs[off + pos] = orig ^ (pos % 2 ? 0x80 : 0x01);
+                int expected = (unsigned char)lhs[off + pos] - (unsigned char)rhs[off + pos];
+                int ret = memcmp(lhs + off, rhs + off, size);
+                rhs[off + pos] = orig;
+                if (sign(ret) != sign(expected))
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+/* `page` is followed by an inaccessible page, so reads past the end of strings at its end fault */
+static bool check_strnlen(char* page, size_t page_size) {
+    for (size_t len = 0; len <= CHECK_MAX_SIZE; len++) {
+        for (size_t off = 0; off < CHECK_ALIGN; off++) {
+            char* str = page + page_size - CHECK_ALIGN - len + off - 1;
+            memset(str - CHECK_ALIGN, 'x', CHECK_ALIGN + len);
+            str[len] = '\0';
+            if (strlen(str) != len)
+                return false;
+            for (size_t maxlen = 0; maxlen <= len + 1; maxlen += (maxlen < 40 ? 1 : 17))
+                if (strnlen(str, maxlen) != MIN(len, maxlen))
+                    return false;
+        }
+    }
+
+    /* string ending at the very end of the accessible page */
+    char* str = page + page_size - CHECK_ALIGN;
+    memset(str, 'x', CHECK_ALIGN - 1);
+    str[CHECK_ALIGN - 1] = '\0';
+    return strlen(str) == CHECK_ALIGN - 1 && strnlen(str, SIZE_MAX) == CHECK_ALIGN - 1;
+}
+
+static bool check_big(char* big_src, char* big_dst) {
+    /* non-temporal stores of misaligned large copies */
+    memset(big_dst, GUARD, BIG_SIZE);
+    memcpy(big_dst + 3, big_src + 1, BIG_SIZE - 67);
+    if ((unsigned char)big_dst[2] != GUARD || (unsigned char)big_dst[BIG_SIZE - 64] != GUARD)
+        return false;
+    return memcmp(big_dst + 3, big_src + 1, BIG_SIZE - 67) == 0;
+}
+
+static void bench(const char* level_name, char* big_src, char* big_dst) {
+    for (size_t i = 0; i < ARRAY_SIZE(g_bench_sizes); i++) {
+        size_t size = g_bench_sizes[i];
+        size_t rounds = BENCH_BYTES / size;
+        PAL_NUM start, end;
+        PAL_NUM elapsed[4];
+
+        DkSystemTimeQuery(&start);
+        for (size_t j = 0; j < rounds; j++)
+            memcpy(big_dst, big_src, size);
+        DkSystemTimeQuery(&end);
+        elapsed[0] = end - start;
+
+        DkSystemTimeQuery(&start);
+        for (size_t j = 0; j < rounds; j++)
+            memset(big_dst, (int)j, size);
+        DkSystemTimeQuery(&end);
+        elapsed[1] = end - start;
+
+        memcpy(big_dst, big_src, size);
+        DkSystemTimeQuery(&start);
+        for (size_t j = 0; j < rounds; j++)
+            g_sink += memcmp(big_dst, big_src, size);
+        DkSystemTimeQuery(&end);
+        elapsed[2] = end - start;
+
+        memset(big_dst, 'x', size);
+        big_dst[size - 1] = '\0';
+        DkSystemTimeQuery(&start);
+        for (size_t j = 0; j < rounds; j++)
+            g_sink += strlen(big_dst);
+        DkSystemTimeQuery(&end);
+        elapsed[3] = end - start;
+
+        /* bytes per microsecond is MB/s */
+        pal_printf("%s %lu B: memcpy %lu MB/s, memset %lu MB/s, memcmp %lu MB/s, "
+                   "strlen %lu MB/s\n", level_name, size,
+                   rounds * size / MAX(elapsed[0], 1UL), rounds * size / MAX(elapsed[1], 1UL),
+                   rounds * size / MAX(elapsed[2], 1UL), rounds * size / MAX(elapsed[3], 1UL));
+    }
+}
+
+int main(int argc, char** argv, char** envp) {
+    size_t page_size = pal_control.alloc_align;
+    char* page = NULL;
+    char* big_src = NULL;
+    char* big_dst = NULL;
+    if (DkVirtualMemoryAlloc((void**)&page, 2 * page_size, 0, PAL_PROT_READ | PAL_PROT_WRITE) < 0
+            || DkVirtualMemoryProtect(page + page_size, page_size, /*prot=*/0) < 0
+            || DkVirtualMemoryAlloc((void**)&big_src, BIG_SIZE, 0,
+                                    PAL_PROT_READ | PAL_PROT_WRITE) < 0
+            || DkVirtualMemoryAlloc((void**)&big_dst, BIG_SIZE, 0,
+                                    PAL_PROT_READ | PAL_PROT_WRITE) < 0) {
+        pal_printf("DkVirtualMemoryAlloc failed\n");
+        return 1;
+    }
+    static char src[CHECK_BUF_SIZE];
+    static char dst[CHECK_BUF_SIZE];
+    g_src = src;
+    g_dst = dst;
+    fill(g_src, CHECK_BUF_SIZE, 1);
+    fill(big_src, BIG_SIZE, 2);
+
+    bool do_bench = argc > 1 && !strcmp(argv[1], "bench");
+    enum string_ops_level max_level = init_string_ops(DkCpuIdRetrieve, STRING_OPS_AVX512);
+    for (enum string_ops_level level = STRING_OPS_BASELINE; level <= max_level; level++) {
+        if (init_string_ops(DkCpuIdRetrieve, level) != level) {
+            pal_printf("init_string_ops(%s) failed\n", g_level_names[level]);
+            return 1;
+        }
+        if (!check_memcpy_memset() || !check_memcmp() || !check_strnlen(page, page_size)
+                || !check_big(big_src, big_dst)) {
+            pal_printf("%s string ops are wrong\n", g_level_names[level]);
+            return 1;
+        }
+        pal_printf("%s string ops OK\n", g_level_names[level]);
+        if (do_bench)
+            bench(g_level_names[level], big_src, big_dst);
+    }
+
+    init_string_ops(DkCpuIdRetrieve, STRING_OPS_AVX512);
+    DkVirtualMemoryFree(big_dst, BIG_SIZE);
+    DkVirtualMemoryFree(big_src, BIG_SIZE);
+    DkVirtualMemoryFree(page, 2 * page_size);
+    pal_printf("String ops test OK\n");
+    return 0;
+}
@@ -14,6 +14,8 @@ int main(int argc, char** argv, char** envp) {
     PRINT_SYMBOL(DkVirtualMemoryAlloc);
     PRINT_SYMBOL(DkVirtualMemoryFree);
     PRINT_SYMBOL(DkVirtualMemoryProtect);
+    PRINT_SYMBOL(DkVirtualMemoryMove);
+    PRINT_SYMBOL(DkVirtualMemoryDiscard);
 
     PRINT_SYMBOL(DkProcessCreate);
     PRINT_SYMBOL(DkProcessExit);
@@ -22,19 +24,32 @@ int main(int argc, char** argv, char** envp) {
     PRINT_SYMBOL(DkStreamWaitForClient);
     PRINT_SYMBOL(DkStreamRead);
     PRINT_SYMBOL(DkStreamWrite);
+    PRINT_SYMBOL(DkStreamReadMsgs);
+    PRINT_SYMBOL(DkStreamWriteMsgs);
+    PRINT_SYMBOL(DkStreamReadv);
+    PRINT_SYMBOL(DkStreamWritev);
+    PRINT_SYMBOL(DkStreamSendFile);
+    PRINT_SYMBOL(DkStreamCopyFile);
     PRINT_SYMBOL(DkStreamDelete);
     PRINT_SYMBOL(DkStreamMap);
     PRINT_SYMBOL(DkStreamUnmap);
     PRINT_SYMBOL(DkStreamSetLength);
+    PRINT_SYMBOL(DkStreamAllocate);
+    PRINT_SYMBOL(DkStreamAdvise);
     PRINT_SYMBOL(DkStreamFlush);
     PRINT_SYMBOL(DkSendHandle);
     PRINT_SYMBOL(DkReceiveHandle);
+    PRINT_SYMBOL(DkSendHandles);
+    PRINT_SYMBOL(DkReceiveHandles);
     PRINT_SYMBOL(DkStreamAttributesQuery);
     PRINT_SYMBOL(DkStreamAttributesQueryByHandle);
     PRINT_SYMBOL(DkStreamAttributesSetByHandle);
     PRINT_SYMBOL(DkStreamGetName);
     PRINT_SYMBOL(DkStreamChangeName);
     PRINT_SYMBOL(DkStreamsWaitEvents);
+    PRINT_SYMBOL(DkPollerCreate);
+    PRINT_SYMBOL(DkPollerCtl);
+    PRINT_SYMBOL(DkPollerWait);
 
     PRINT_SYMBOL(DkThreadCreate);
     PRINT_SYMBOL(DkThreadYieldExecution);
@@ -49,6 +64,7 @@ int main(int argc, char** argv, char** envp) {
     PRINT_SYMBOL(DkEventWait);
 
     PRINT_SYMBOL(DkObjectClose);
+    PRINT_SYMBOL(DkObjectsClose);
 
     PRINT_SYMBOL(DkSystemTimeQuery);
     PRINT_SYMBOL(DkRandomBitsRead);
@@ -57,6 +73,7 @@ int main(int argc, char** argv, char** envp) {
     PRINT_SYMBOL(DkSegmentRegisterSet);
 #endif
     PRINT_SYMBOL(DkMemoryAvailableQuota);
+    PRINT_SYMBOL(DkMemoryResidentSize);
 
     return 0;
 }
@@ -46,6 +46,7 @@ struct A {
     struct avl_tree_node node;
     int64_t key;
     bool freed;
+    size_t subtree_size; /* augmented data, maintained via `tree.update` */
 };
 
 static struct A* node2struct(struct avl_tree_node* node) {
@@ -60,9 +61,20 @@ static bool cmp_gen(void* x, struct avl_tree_node* y) {
     return *(int64_t*)x <= node2struct(y)->key;
 }
 
+static void update(struct avl_tree_node* node) {
+    size_t size = 1;
+    if (node->left) {
+        size += node2struct(node->left)->subtree_size;
+    }
+    if (node->right) {
+        size += node2struct(node->right)->subtree_size;
+    }
+    node2struct(node)->subtree_size = size;
+}
+
 #define ELEMENTS_COUNT 0x1000
 #define RAND_DEL_COUNT 0x100
-static struct avl_tree tree = {.root = NULL, .cmp = cmp};
+static struct avl_tree tree = {.root = NULL, .cmp = cmp, .update = update};
 static struct A t[ELEMENTS_COUNT];
 
 __attribute__((unused)) static void debug_print(struct avl_tree_node* node) {
@@ -85,12 +97,34 @@ static size_t get_tree_size(struct avl_tree_node* node) {
     return get_tree_size(node->left) + 1 + get_tree_size(node->right);
 }
 
+/* Checks that augmented data of each node matches the actual size of its subtree, which is returned
+ * in `*size`. */
+static bool subtree_sizes_valid(struct avl_tree_node* node, size_t* size) {
+    if (!node) {
+        *size = 0;
+        return true;
+    }
+
+    size_t left_size;
+    size_t right_size;
+    bool ret = subtree_sizes_valid(node->left, &left_size);
+    ret &= subtree_sizes_valid(node->right, &right_size);
+
+    *size = left_size + 1 + right_size;
+    return ret && node2struct(node)->subtree_size == *size;
+}
+
+static bool tree_is_valid(void) {
+    size_t size;
+    return debug_avl_tree_is_balanced(&tree) && subtree_sizes_valid(tree.root, &size);
+}
+
 static void try_node_swap(struct avl_tree_node* node, struct avl_tree_node* swap_node) {
     avl_tree_swap_node(&tree, node, swap_node);
     node->left   = (void*)1;
     node->right  = (void*)2;
     node->parent = (void*)3;
-    if (!debug_avl_tree_is_balanced(&tree)) {
+    if (!tree_is_valid()) {
         EXIT_UNBALANCED();
     }
     size_t size = get_tree_size(tree.root);
@@ -103,7 +137,7 @@ static void try_node_swap(struct avl_tree_node* node, struct avl_tree_node* swap
     swap_node->left   = (void*)1;
     swap_node->right  = (void*)2;
     swap_node->parent = (void*)3;
-    if (!debug_avl_tree_is_balanced(&tree)) {
+    if (!tree_is_valid()) {
         EXIT_UNBALANCED();
     }
     size = get_tree_size(tree.root);
@@ -120,7 +154,7 @@ static void do_test(int32_t (*get_num)(void)) {
         t[i].key   = get_num();
         t[i].freed = false;
         avl_tree_insert(&tree, &t[i].node);
-        if (!debug_avl_tree_is_balanced(&tree)) {
+        if (!tree_is_valid()) {
             EXIT_UNBALANCED();
         }
     }
@@ -198,7 +232,7 @@ static void do_test(int32_t (*get_num)(void)) {
     /* get_num returns int32_t, but tmp.key is a int64_t, so this cannot overflow. */
     struct A tmp = {.key = val + 100};
     avl_tree_insert(&tree, &tmp.node);
-    if (!debug_avl_tree_is_balanced(&tree)) {
+    if (!tree_is_valid()) {
         EXIT_UNBALANCED();
     }
 
@@ -223,7 +257,7 @@ static void do_test(int32_t (*get_num)(void)) {
     }
 
     avl_tree_delete(&tree, &tmp.node);
-    if (!debug_avl_tree_is_balanced(&tree)) {
+    if (!tree_is_valid()) {
         EXIT_UNBALANCED();
     }
 
@@ -234,7 +268,7 @@ static void do_test(int32_t (*get_num)(void)) {
             t[r].freed = true;
             avl_tree_delete(&tree, &t[r].node);
             i--;
-            if (!debug_avl_tree_is_balanced(&tree)) {
+            if (!tree_is_valid()) {
                 EXIT_UNBALANCED();
             }
         }
@@ -243,7 +277,7 @@ static void do_test(int32_t (*get_num)(void)) {
         if (!t[i].freed) {
             avl_tree_delete(&tree, &t[i].node);
             t[i].freed = true;
-            if (!debug_avl_tree_is_balanced(&tree)) {
+            if (!tree_is_valid()) {
                 EXIT_UNBALANCED();
             }
         }
@@ -261,7 +295,7 @@ static void test_ordering(void) {
     for (i = ELEMENTS_COUNT - 1; i >= 0; i--) {
         t[i].key = i / (ELEMENTS_COUNT / DIFF_ELEMENTS);
         avl_tree_insert(&tree, &t[i].node);
-        if (!debug_avl_tree_is_balanced(&tree)) {
+        if (!tree_is_valid()) {
             EXIT_UNBALANCED();
         }
     }
@@ -281,7 +315,7 @@ static void test_ordering(void) {
 
     for (i = 0; i < ELEMENTS_COUNT; i++) {
         avl_tree_delete(&tree, &t[i].node);
-        if (!debug_avl_tree_is_balanced(&tree)) {
+        if (!tree_is_valid()) {
             EXIT_UNBALANCED();
         }
     }
@@ -0,0 +1,214 @@
+#include "btree.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "api.h"
+#include "pal.h"
+#include "pal_error.h"
+#include "pal_regression.h"
+
+#define CHECK(cond)                                                  \
+    do {                                                             \
+        if (!(cond)) {                                               \
+            pal_printf("Check failed at %u: %s\n", __LINE__, #cond); \
+            DkProcessExit(1);                                        \
+        }                                                            \
+    } while (0)
+
+#define KEYS_COUNT 0x1000
+#define OPS_COUNT  0x10000
+#define POOL_NODES 0x400
+
+/* PAL regression tests have no malloc(): tree nodes come from a pool of node-sized slots, the
+ * arrays of btree_bulk_load() from an arena which is never reused */
+union pool_slot {
+    union pool_slot* next_free;
+    char data[BTREE_NODE_SIZE];
+};
+static union pool_slot g_pool[POOL_NODES];
+static union pool_slot* g_pool_free;
+static size_t g_pool_used;
+static size_t g_pool_allocated;
+
+static char g_arena[0x80000] __attribute__((aligned(16)));
+static size_t g_arena_used;
+
+void* malloc(size_t size) {
+    if (size > sizeof(union pool_slot)) {
+        size = ALIGN_UP(size, 16);
+        CHECK(size <= sizeof(g_arena) - g_arena_used);
+        g_arena_used += size;
+        return &g_arena[g_arena_used - size];
+    }
+
+    union pool_slot* slot = g_pool_free;
+    if (slot) {
+        g_pool_free = slot->next_free;
+    } else {
+        CHECK(g_pool_used < POOL_NODES);
+        slot = &g_pool[g_pool_used++];
+    }
+    g_pool_allocated++;
+    return slot;
+}
+
+void free(void* ptr) {
+    if (!ptr || ((char*)ptr >= g_arena && (char*)ptr < g_arena + sizeof(g_arena)))
+        return;
+    union pool_slot* slot = ptr;
+    slot->next_free = g_pool_free;
+    g_pool_free = slot;
+    g_pool_allocated--;
+}
+
+static uint32_t _seed;
+
+static void srand(uint32_t seed) {
+    _seed = seed;
+}
+
+/* source: https://elixir.bootlin.com/glibc/glibc-2.31/source/stdlib/rand_r.c */
+static int32_t rand(void) {
+    int32_t result;
+
+    _seed *= 1103515245;
+    _seed += 12345;
+    result = (uint32_t)(_seed / 65536) % 2048;
+
+    _seed *= 1103515245;
+    _seed += 12345;
+    result <<= 10;
+    result ^= (uint32_t)(_seed / 65536) % 1024;
+
+    _seed *= 1103515245;
+    _seed += 12345;
+    result <<= 10;
+    result ^= (uint32_t)(_seed / 65536) % 1024;
+
+    return result;
+}
+
+static struct btree tree;
+static bool present[KEYS_COUNT];
+static size_t present_count;
+
+static void* value_of(uint64_t key) {
+    return (void*)(uintptr_t)(key * 3 + 1);
+}
+
+static void check_iteration(void) {
+    struct btree_iter iter;
+    size_t count = 0;
+    uint64_t prev = 0;
+    for (bool found = btree_first(&tree, &iter); found; found = btree_iter_next(&iter)) {
+        uint64_t key = btree_iter_key(&iter);
+        CHECK(key < KEYS_COUNT && present[key]);
+        CHECK(count == 0 || prev < key);
+        CHECK(btree_iter_value(&iter) == value_of(key));
+        prev = key;
+        count++;
+    }
+    CHECK(count == present_count);
+}
+
+static void do_test(void) {
+    for (size_t i = 0; i < OPS_COUNT; i++) {
+        uint64_t key = rand() % KEYS_COUNT;
+        int op = rand() % 3;
+        /* grow the tree in the first half, then keep its size */
+        if (op == 0 || (op == 1 && i < OPS_COUNT / 2)) {
+            int ret = btree_insert(&tree, key, value_of(key));
+            CHECK(present[key] ? ret == -PAL_ERROR_STREAMEXIST : ret == 0);
+            if (!present[key]) {
+                present[key] = true;
+                present_count++;
+            }
+        } else if (op == 1) {
+            CHECK(btree_delete(&tree, key) == present[key]);
+            if (present[key]) {
+                present[key] = false;
+                present_count--;
+            }
+        } else {
+            void* value;
+            CHECK(btree_find(&tree, key, &value) == present[key]);
+            CHECK(!present[key] || value == value_of(key));
+
+            uint64_t next = key;
+            while (next < KEYS_COUNT && !present[next])
+                next++;
+            struct btree_iter iter;
+            bool found = btree_lower_bound(&tree, key, &iter);
+            CHECK(found == (next < KEYS_COUNT));
+            CHECK(!found || btree_iter_key(&iter) == next);
+        }
+        CHECK(tree.count == present_count);
+        if (i % 0x400 == 0) {
+            CHECK(debug_btree_is_valid(&tree));
+            check_iteration();
+        }
+    }
+    CHECK(debug_btree_is_valid(&tree));
+    check_iteration();
+
+    for (uint64_t key = 0; key < KEYS_COUNT; key++) {
+        if (present[key]) {
+            CHECK(btree_delete(&tree, key));
+            present[key] = false;
+            present_count--;
+        }
+    }
+    CHECK(!tree.root && debug_btree_is_valid(&tree));
+    CHECK(g_pool_allocated == 0);
+}
+
+static void test_bulk_load(void) {
+    static uint64_t keys[KEYS_COUNT];
+    static void* values[KEYS_COUNT];
+
+    for (size_t count = 0; count <= KEYS_COUNT; count += count < 0x100 ? 1 : 0x3d) {
+        for (size_t i = 0; i < count; i++) {
+            keys[i] = 2 * i + 1;
+            values[i] = value_of(keys[i]);
+        }
+        CHECK(btree_bulk_load(&tree, keys, values, count) == 0);
+        CHECK(tree.count == count && debug_btree_is_valid(&tree));
+
+        for (size_t i = 0; i < count; i++) {
+            void* value;
+            CHECK(btree_find(&tree, keys[i], &value) && value == values[i]);
+            CHECK(!btree_find(&tree, keys[i] + 1, NULL));
+        }
+        for (size_t i = 0; i < count; i += 2)
+            CHECK(btree_delete(&tree, keys[i]));
+        CHECK(debug_btree_is_valid(&tree));
+
+        btree_destroy(&tree);
+        CHECK(!tree.root && g_pool_allocated == 0);
+    }
+
+    keys[0] = 1;
+    keys[1] = 1;
+    CHECK(btree_bulk_load(&tree, keys, values, 2) == -PAL_ERROR_INVAL && !tree.root);
+}
+
+int main(void) {
+    pal_printf("Running static tests: ");
+    test_bulk_load();
+    srand(1337);
+    do_test();
+    pal_printf("Done!\n");
+
+    uint32_t seed = 0;
+    if (DkRandomBitsRead(&seed, sizeof(seed)) < 0) {
+        pal_printf("Getting a seed failed\n");
+        return 1;
+    }
+    pal_printf("Running dynamic tests (with seed: %u): ", seed);
+    srand(seed);
+    do_test();
+    pal_printf("Done!\n");
+
+    return 0;
+}
@@ -33,6 +33,23 @@ class TC_00_Basic(RegressionTestCase):
     def test_002_avl_tree(self):
         _, _ = self.run_binary(['avl_tree_test'])
 
+    def test_003_sha256(self):
+        _, stderr = self.run_binary(['Sha256'])
+        self.assertIn('SHA256 test vectors OK', stderr)
+
+    def test_004_string_ops(self):
+        _, stderr = self.run_binary(['StringOps'])
+        self.assertIn('baseline string ops OK', stderr)
+        self.assertIn('String ops test OK', stderr)
+
+    def test_005_aes_gcm(self):
+        _, stderr = self.run_binary(['AesGcm'])
+        self.assertIn('AES-GCM test vectors OK', stderr)
+        self.assertIn('AES-GCM round trips OK', stderr)
+
+    def test_006_btree(self):
+        _, _ = self.run_binary(['btree_test'])
+
 
 @unittest.skipIf(HAS_SGX, "Not yet tested on SGX")
 class TC_00_BasicSet2(RegressionTestCase):
@@ -70,6 +87,12 @@ class TC_00_BasicSet2(RegressionTestCase):
         _, stderr = self.run_binary(['Segment'])
         self.assertIn('Test OK', stderr)
 
+    def test_Poller(self):
+        _, stderr = self.run_binary(['Poller'])
+        self.assertIn('Poller: no events OK', stderr)
+        self.assertIn('Poller: read event OK', stderr)
+        self.assertIn('Poller: removed handle OK', stderr)
+
     def test_Select(self):
         _, stderr = self.run_binary(['Select'])
         self.assertIn('Enter main thread', stderr)
@@ -178,24 +201,37 @@ class TC_02_Symbols(RegressionTestCase):
         'DkVirtualMemoryAlloc',
         'DkVirtualMemoryFree',
         'DkVirtualMemoryProtect',
+        'DkVirtualMemoryMove',
+        'DkVirtualMemoryDiscard',
         'DkProcessCreate',
         'DkProcessExit',
         'DkStreamOpen',
         'DkStreamWaitForClient',
         'DkStreamRead',
         'DkStreamWrite',
+        'DkStreamReadMsgs',
+        'DkStreamWriteMsgs',
+        'DkStreamReadv',
+        'DkStreamWritev',
+        'DkStreamSendFile',
+        'DkStreamCopyFile',
         'DkStreamDelete',
         'DkStreamMap',
         'DkStreamUnmap',
         'DkStreamSetLength',
+        'DkStreamAllocate',
+        'DkStreamAdvise',
         'DkStreamFlush',
         'DkSendHandle',
         'DkReceiveHandle',
+        'DkSendHandles',
+        'DkReceiveHandles',
         'DkStreamAttributesQuery',
         'DkStreamAttributesQueryByHandle',
         'DkStreamAttributesSetByHandle',
         'DkStreamGetName',
         'DkStreamChangeName',
+        'DkStreamsGetIoStats',
         'DkThreadCreate',
         'DkThreadYieldExecution',
         'DkThreadExit',
@@ -206,10 +242,15 @@ class TC_02_Symbols(RegressionTestCase):
         'DkEventClear',
         'DkEventWait',
         'DkStreamsWaitEvents',
+        'DkPollerCreate',
+        'DkPollerCtl',
+        'DkPollerWait',
         'DkObjectClose',
+        'DkObjectsClose',
         'DkSystemTimeQuery',
         'DkRandomBitsRead',
         'DkMemoryAvailableQuota',
+        'DkMemoryResidentSize',
     ]
     if ON_X86:
         ALL_SYMBOLS.append('DkSegmentRegisterGet')
@@ -406,6 +447,13 @@ class TC_20_SingleProcess(RegressionTestCase):
         # Memory Deallocation
         self.assertIn('Memory Deallocation OK', stderr)
 
+    @unittest.skipUnless(HAS_SGX, 'This test is only meaningful on SGX PAL')
+    def test_302_memory_stress(self):
+        # host kernels limit the number of mappings (vm.max_map_count), so this test runs only on
+        # SGX, where enclave memory is a single host mapping
+        _, stderr = self.run_binary(['MemoryStress'], timeout=60)
+        self.assertIn('Memory stress test OK', stderr)
+
     def test_400_pipe(self):
         _, stderr = self.run_binary(['Pipe'])
 
@@ -423,6 +471,7 @@ class TC_20_SingleProcess(RegressionTestCase):
         self.assertIn('Pipe Read 1: Hello World 1', stderr)
         self.assertIn('Pipe Write 2 OK', stderr)
         self.assertIn('Pipe Read 2: Hello World 2', stderr)
+        self.assertIn('Pipe Transmission 2 OK', stderr)
 
     def test_410_socket(self):
         _, stderr = self.run_binary(['Socket'])
@@ -27,6 +27,17 @@ const PAL_CONTROL* DkGetPalControl(void) {
     return &g_pal_control;
 }
 
+void add_startup_phase(const char* name, uint64_t time) {
+    if (g_pal_control.startup_phases_cnt == ARRAY_SIZE(g_pal_control.startup_phases))
+        return;
+    if (!time && _DkSystemTimeQuery(&time) < 0)
+        return;
+
+    g_pal_control.startup_phases[g_pal_control.startup_phases_cnt].name = name;
+    g_pal_control.startup_phases[g_pal_control.startup_phases_cnt].time = time;
+    g_pal_control.startup_phases_cnt++;
+}
+
 struct pal_internal_state g_pal_state;
 
 static void load_libraries(void) {
@@ -273,9 +284,6 @@ noreturn void pal_main(PAL_NUM instance_id,        /* current instance id */
                        PAL_HANDLE first_thread,    /* first thread handle */
                        PAL_STR* arguments,         /* application arguments */
                        PAL_STR* environments       /* environment variables */) {
-    g_pal_state.instance_id = instance_id;
-    g_pal_state.parent_process = parent_process;
-
     ssize_t ret;
 
     assert(g_pal_state.manifest_root);
@@ -283,6 +291,14 @@ noreturn void pal_main(PAL_NUM instance_id,        /* current instance id */
 
     configure_logging();
 
+    static const char* string_ops_names[] = {
+        [STRING_OPS_BASELINE] = "baseline",
+        [STRING_OPS_AVX2]     = "AVX2",
+        [STRING_OPS_AVX512]   = "AVX-512",
+    };
+    enum string_ops_level string_ops = init_string_ops(_DkCpuIdRetrieve, STRING_OPS_AVX512);
+    log_debug("Using %s string operations\n", string_ops_names[string_ops]);
+
     char* dummy_exec_str = NULL;
     ret = toml_string_in(g_pal_state.manifest_root, "loader.exec", &dummy_exec_str);
     if (ret < 0 || dummy_exec_str)
@@ -290,6 +306,21 @@ noreturn void pal_main(PAL_NUM instance_id,        /* current instance id */
                                    "manifest according to the current documentation.");
     free(dummy_exec_str);
 
+    load_libraries();
+
+    /* a zygote doesn't return from this, but in each child forked off it */
+    _DkProcessZygote(&instance_id, &parent_process);
+
+    g_pal_state.instance_id = instance_id;
+    g_pal_state.parent_process = parent_process;
+
+    ret = toml_bool_in(g_pal_state.manifest_root, "loader.io_time_stats", /*defaultval=*/false,
+                       &g_pal_state.io_time_stats);
+    if (ret < 0) {
+        INIT_FAIL_MANIFEST(PAL_ERROR_DENIED, "Cannot parse 'loader.io_time_stats' "
+                                             "(the value must be `true` or `false`)\n");
+    }
+
     bool disable_aslr;
     ret = toml_bool_in(g_pal_state.manifest_root, "loader.insecure__disable_aslr",
                        /*defaultval=*/false, &disable_aslr);
@@ -407,8 +438,6 @@ noreturn void pal_main(PAL_NUM instance_id,        /* current instance id */
     if (ret < 0)
         INIT_FAIL(-ret, "Inserting environment variables from the manifest failed");
 
-    load_libraries();
-
     // TODO: This is just an ugly, temporary hack for PAL regression tests and should only be used
     // there until we clean up the way LibOS is loaded.
     char* entrypoint;
@@ -448,6 +477,8 @@ noreturn void pal_main(PAL_NUM instance_id,        /* current instance id */
             INIT_FAIL(-ret, "Unable to load pal.entrypoint");
     }
 
+    add_startup_phase("PAL initialization", /*time=*/0);
+
     /* Now we will start the execution */
     start_execution(arguments, environments);
 
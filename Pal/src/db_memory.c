@@ -58,6 +58,45 @@ int DkVirtualMemoryProtect(PAL_PTR addr, PAL_NUM size, PAL_FLG prot) {
     return _DkVirtualMemoryProtect((void*)addr, size, prot);
 }
 
+int DkVirtualMemoryMove(PAL_PTR old_addr, PAL_PTR new_addr, PAL_NUM size) {
+    if (!old_addr || !new_addr || !size) {
+        return -PAL_ERROR_INVAL;
+    }
+
+    if (!IS_ALLOC_ALIGNED_PTR(old_addr) || !IS_ALLOC_ALIGNED_PTR(new_addr)
+            || !IS_ALLOC_ALIGNED(size)) {
+        return -PAL_ERROR_INVAL;
+    }
+
+    if ((uintptr_t)old_addr < (uintptr_t)new_addr + size
+            && (uintptr_t)new_addr < (uintptr_t)old_addr + size) {
+        return -PAL_ERROR_INVAL;
+    }
+
+    if (_DkCheckMemoryMappable((void*)old_addr, size)
+            || _DkCheckMemoryMappable((void*)new_addr, size)) {
+        return -PAL_ERROR_DENIED;
+    }
+
+    return _DkVirtualMemoryMove((void*)old_addr, (void*)new_addr, size);
+}
+
+int DkVirtualMemoryDiscard(PAL_PTR addr, PAL_NUM size, PAL_BOL lazy) {
+    if (!addr || !size) {
+        return -PAL_ERROR_INVAL;
+    }
+
+    if (!IS_ALLOC_ALIGNED_PTR(addr) || !IS_ALLOC_ALIGNED(size)) {
+        return -PAL_ERROR_INVAL;
+    }
+
+    if (_DkCheckMemoryMappable((void*)addr, size)) {
+        return -PAL_ERROR_DENIED;
+    }
+
+    return _DkVirtualMemoryDiscard((void*)addr, size, lazy);
+}
+
 int add_preloaded_range(uintptr_t start, uintptr_t end, const char* comment) {
     size_t new_cnt = g_pal_control.preloaded_ranges_cnt + 1;
     void* new_ranges = malloc(new_cnt * sizeof(*g_pal_control.preloaded_ranges));
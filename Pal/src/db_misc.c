@@ -37,6 +37,10 @@ PAL_NUM DkMemoryAvailableQuota(void) {
     return (PAL_NUM)quota;
 }
 
+PAL_NUM DkMemoryResidentSize(void) {
+    return _DkMemoryResidentSize();
+}
+
 int DkCpuIdRetrieve(PAL_IDX leaf, PAL_IDX subleaf, PAL_IDX values[4]) {
     unsigned int vals[4];
     int ret = _DkCpuIdRetrieve(leaf, subleaf, vals);
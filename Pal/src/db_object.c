@@ -47,6 +47,14 @@ void DkObjectClose(PAL_HANDLE objectHandle) {
     _DkObjectClose(objectHandle);
 }
 
+/* PAL call DkObjectsClose: Close the given object handles, possibly in batches. */
+void DkObjectsClose(PAL_HANDLE* handles, PAL_NUM count) {
+    for (PAL_NUM i = 0; i < count; i++)
+        assert(handles[i]);
+
+    _DkObjectsClose(handles, count);
+}
+
 /* Wait for user-specified events of handles in the handle array. The wait can be timed out, unless
  * NO_TIMEOUT is given in the timeout_us argument. Returns `0` if waiting was successful, negative
  * error code otherwise. */
@@ -58,5 +66,38 @@ int DkStreamsWaitEvents(PAL_NUM count, PAL_HANDLE* handle_array, PAL_FLG* events
         }
     }
 
-    return _DkStreamsWaitEvents(count, handle_array, events, ret_events, timeout_us);
+    uint64_t start = io_stats_start();
+    int ret = _DkStreamsWaitEvents(count, handle_array, events, ret_events, timeout_us);
+    io_stats_add_wait(count, handle_array, start);
+    return ret;
+}
+
+int DkPollerCreate(PAL_HANDLE* handle) {
+    *handle = NULL;
+    return _DkPollerCreate(handle);
+}
+
+int DkPollerCtl(PAL_HANDLE poller, enum PAL_POLLER_OP op, PAL_HANDLE handle, PAL_FLG events,
+                PAL_NUM data) {
+    if (!poller || !IS_HANDLE_TYPE(poller, poller) || !handle || UNKNOWN_HANDLE(handle))
+        return -PAL_ERROR_INVAL;
+    if (op != PAL_POLLER_ADD && op != PAL_POLLER_MODIFY && op != PAL_POLLER_REMOVE)
+        return -PAL_ERROR_INVAL;
+    if (events & ~(PAL_WAIT_READ | PAL_WAIT_WRITE | PAL_WAIT_EXCLUSIVE))
+        return -PAL_ERROR_INVAL;
+
+    return _DkPollerCtl(poller, op, handle, events, data);
+}
+
+int DkPollerWait(PAL_HANDLE poller, PAL_POLLER_EVENT* events, PAL_NUM max_events,
+                 PAL_NUM* ret_count, PAL_NUM timeout_us) {
+    if (!poller || !IS_HANDLE_TYPE(poller, poller) || !max_events)
+        return -PAL_ERROR_INVAL;
+
+    size_t count = 0;
+    uint64_t start = io_stats_start();
+    int ret = _DkPollerWait(poller, events, max_events, &count, timeout_us);
+    io_stats_add_wait(/*count=*/1, &poller, start);
+    *ret_count = count;
+    return ret;
 }
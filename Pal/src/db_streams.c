@@ -25,6 +25,7 @@ extern struct handle_ops g_thread_ops;
 extern struct handle_ops g_proc_ops;
 extern struct handle_ops g_event_ops;
 extern struct handle_ops g_eventfd_ops;
+extern struct handle_ops g_poller_ops;
 
 const struct handle_ops* g_pal_handle_ops[PAL_HANDLE_TYPE_BOUND] = {
     [pal_type_file]    = &g_file_ops,
@@ -42,8 +43,147 @@ const struct handle_ops* g_pal_handle_ops[PAL_HANDLE_TYPE_BOUND] = {
     [pal_type_thread]  = &g_thread_ops,
     [pal_type_event]   = &g_event_ops,
     [pal_type_eventfd] = &g_eventfd_ops,
+    [pal_type_poller]  = &g_poller_ops,
 };
 
+/* Updated with relaxed atomics: the counters are independent, readers see each of them (but not
+ * all of them together) consistent. */
+static PAL_IO_STATS g_io_stats[PAL_IO_CLASS_BOUND];
+
+static const char* const g_io_class_names[PAL_IO_CLASS_BOUND] = {
+    [PAL_IO_CLASS_FILE]           = "file",
+    [PAL_IO_CLASS_PROTECTED_FILE] = "protected_file",
+    [PAL_IO_CLASS_DIR]            = "dir",
+    [PAL_IO_CLASS_PIPE]           = "pipe",
+    [PAL_IO_CLASS_DEV]            = "dev",
+    [PAL_IO_CLASS_TCP]            = "tcp",
+    [PAL_IO_CLASS_UDP]            = "udp",
+    [PAL_IO_CLASS_PROCESS]        = "process",
+    [PAL_IO_CLASS_EVENTFD]        = "eventfd",
+    [PAL_IO_CLASS_POLLER]         = "poller",
+    [PAL_IO_CLASS_OTHER]          = "other",
+};
+
+static enum PAL_IO_CLASS io_stats_class(PAL_HANDLE handle) {
+    switch (PAL_GET_TYPE(handle)) {
+        case pal_type_file:
+#ifdef HANDLE_IS_PROTECTED_FILE
+            if (HANDLE_IS_PROTECTED_FILE(handle))
+                return PAL_IO_CLASS_PROTECTED_FILE;
+#endif
+            return PAL_IO_CLASS_FILE;
+        case pal_type_dir:
+            return PAL_IO_CLASS_DIR;
+        case pal_type_pipe:
+        case pal_type_pipesrv:
+        case pal_type_pipecli:
+        case pal_type_pipeprv:
+            return PAL_IO_CLASS_PIPE;
+        case pal_type_dev:
+            return PAL_IO_CLASS_DEV;
+        case pal_type_tcp:
+        case pal_type_tcpsrv:
+            return PAL_IO_CLASS_TCP;
+        case pal_type_udp:
+        case pal_type_udpsrv:
+            return PAL_IO_CLASS_UDP;
+        case pal_type_process:
+            return PAL_IO_CLASS_PROCESS;
+        case pal_type_eventfd:
+            return PAL_IO_CLASS_EVENTFD;
+        case pal_type_poller:
+            return PAL_IO_CLASS_POLLER;
+        default:
+            return PAL_IO_CLASS_OTHER;
+    }
+}
+
+/* 0 if times are not measured (a host time of 0 is never returned) */
+uint64_t io_stats_start(void) {
+    if (!g_pal_state.io_time_stats)
+        return 0;
+    uint64_t time = 0;
+    (void)_DkSystemTimeQuery(&time);
+    return time;
+}
+
+static uint64_t io_stats_elapsed(uint64_t start) {
+    if (!start)
+        return 0;
+    uint64_t now = 0;
+    (void)_DkSystemTimeQuery(&now);
+    return now > start ? now - start : 0;
+}
+
+static void io_stats_add(PAL_NUM* ops, PAL_NUM* bytes, PAL_NUM* time_us, int64_t ret,
+                         uint64_t start) {
+    __atomic_add_fetch(ops, 1, __ATOMIC_RELAXED);
+    if (bytes && ret > 0)
+        __atomic_add_fetch(bytes, ret, __ATOMIC_RELAXED);
+    if (start)
+        __atomic_add_fetch(time_us, io_stats_elapsed(start), __ATOMIC_RELAXED);
+}
+
+void io_stats_add_read(PAL_HANDLE handle, int64_t ret, uint64_t start) {
+    PAL_IO_STATS* stats = &g_io_stats[io_stats_class(handle)];
+    io_stats_add(&stats->reads, &stats->read_bytes, &stats->read_us, ret, start);
+}
+
+void io_stats_add_write(PAL_HANDLE handle, int64_t ret, uint64_t start) {
+    PAL_IO_STATS* stats = &g_io_stats[io_stats_class(handle)];
+    io_stats_add(&stats->writes, &stats->write_bytes, &stats->write_us, ret, start);
+}
+
+/* one wait of each class of `handles` */
+void io_stats_add_wait(size_t count, PAL_HANDLE* handles, uint64_t start) {
+    static_assert(PAL_IO_CLASS_BOUND <= 32, "too many I/O classes for the mask");
+    uint32_t classes = 0;
+    for (size_t i = 0; i < count; i++)
+        if (handles[i])
+            classes |= 1U << io_stats_class(handles[i]);
+
+    uint64_t elapsed = io_stats_elapsed(start);
+    for (size_t i = 0; i < PAL_IO_CLASS_BOUND; i++) {
+        if (!(classes & (1U << i)))
+            continue;
+        __atomic_add_fetch(&g_io_stats[i].waits, 1, __ATOMIC_RELAXED);
+        if (elapsed)
+            __atomic_add_fetch(&g_io_stats[i].wait_us, elapsed, __ATOMIC_RELAXED);
+    }
+}
+
+void DkStreamsGetIoStats(PAL_IO_STATS* stats) {
+    for (size_t i = 0; i < PAL_IO_CLASS_BOUND; i++) {
+        stats[i].reads       = __atomic_load_n(&g_io_stats[i].reads, __ATOMIC_RELAXED);
+        stats[i].read_bytes  = __atomic_load_n(&g_io_stats[i].read_bytes, __ATOMIC_RELAXED);
+        stats[i].read_us     = __atomic_load_n(&g_io_stats[i].read_us, __ATOMIC_RELAXED);
+        stats[i].writes      = __atomic_load_n(&g_io_stats[i].writes, __ATOMIC_RELAXED);
+        stats[i].write_bytes = __atomic_load_n(&g_io_stats[i].write_bytes, __ATOMIC_RELAXED);
+        stats[i].write_us    = __atomic_load_n(&g_io_stats[i].write_us, __ATOMIC_RELAXED);
+        stats[i].waits       = __atomic_load_n(&g_io_stats[i].waits, __ATOMIC_RELAXED);
+        stats[i].wait_us     = __atomic_load_n(&g_io_stats[i].wait_us, __ATOMIC_RELAXED);
+    }
+}
+
+void print_io_stats(void) {
+    PAL_IO_STATS stats[PAL_IO_CLASS_BOUND];
+    DkStreamsGetIoStats(stats);
+
+    bool header = false;
+    for (size_t i = 0; i < PAL_IO_CLASS_BOUND; i++) {
+        if (!stats[i].reads && !stats[i].writes && !stats[i].waits)
+            continue;
+        if (!header) {
+            log_always("----- Stream I/O stats (ops, bytes, us) -----\n");
+            header = true;
+        }
+        log_always("  %-15s reads: %lu %lu %lu, writes: %lu %lu %lu, waits: %lu %lu\n",
+                   g_io_class_names[i], stats[i].reads, stats[i].read_bytes, stats[i].read_us,
+                   stats[i].writes, stats[i].write_bytes, stats[i].write_us, stats[i].waits,
+                   stats[i].wait_us);
+    }
+}
+
 /* parse_stream_uri scan the uri, seperate prefix and search for
    stream handler which will open or access the stream */
 static int parse_stream_uri(const char** uri, char** prefix, struct handle_ops** ops) {
@@ -241,8 +381,10 @@ int DkStreamRead(PAL_HANDLE handle, PAL_NUM offset, PAL_NUM* count, PAL_PTR buff
         return -PAL_ERROR_INVAL;
     }
 
+    uint64_t start = io_stats_start();
     int64_t ret = _DkStreamRead(handle, offset, *count, (void*)buffer, size ? (char*)source : NULL,
                                 source ? size : 0);
+    io_stats_add_read(handle, ret, start);
 
     if (ret < 0) {
         return ret;
@@ -283,8 +425,10 @@ int DkStreamWrite(PAL_HANDLE handle, PAL_NUM offset, PAL_NUM* count, PAL_PTR buf
         return -PAL_ERROR_INVAL;
     }
 
+    uint64_t start = io_stats_start();
     int64_t ret = _DkStreamWrite(handle, offset, *count, (void*)buffer, dest,
                                  dest ? strlen(dest) : 0);
+    io_stats_add_write(handle, ret, start);
 
     if (ret < 0) {
         return ret;
@@ -294,6 +438,194 @@ int DkStreamWrite(PAL_HANDLE handle, PAL_NUM offset, PAL_NUM* count, PAL_PTR buf
     return 0;
 }
 
+/* Transfers the segments one by one and stops at the first short transfer; only file offsets
+ * advance, other streams take offset 0 for every segment */
+static int64_t stream_rw_segments(PAL_HANDLE handle, uint64_t offset, const PAL_IOVEC* iov,
+                                  size_t iov_count, bool is_write) {
+    bool seekable = IS_HANDLE_TYPE(handle, file);
+    uint64_t done = 0;
+    int64_t ret = 0;
+
+    for (size_t i = 0; i < iov_count; i++) {
+        if (!iov[i].size)
+            continue;
+
+        uint64_t seg_offset = seekable ? offset + done : 0;
+        ret = is_write ? _DkStreamWrite(handle, seg_offset, iov[i].size, iov[i].buffer, NULL, 0)
+                       : _DkStreamRead(handle, seg_offset, iov[i].size, iov[i].buffer, NULL, 0);
+        if (ret < 0)
+            break;
+
+        done += ret;
+        if ((uint64_t)ret < iov[i].size)
+            break;
+    }
+
+    return done ? (int64_t)done : ret;
+}
+
+int64_t _DkStreamReadvFallback(PAL_HANDLE handle, uint64_t offset, const PAL_IOVEC* iov,
+                               size_t iov_count) {
+    return stream_rw_segments(handle, offset, iov, iov_count, /*is_write=*/false);
+}
+
+int64_t _DkStreamWritevFallback(PAL_HANDLE handle, uint64_t offset, const PAL_IOVEC* iov,
+                                size_t iov_count) {
+    return stream_rw_segments(handle, offset, iov, iov_count, /*is_write=*/true);
+}
+
+int DkStreamReadv(PAL_HANDLE handle, PAL_NUM offset, const PAL_IOVEC* iov, PAL_NUM iov_count,
+                  PAL_NUM* ret_size) {
+    if (!handle || (!iov && iov_count))
+        return -PAL_ERROR_INVAL;
+
+    const struct handle_ops* ops = HANDLE_OPS(handle);
+    if (!ops)
+        return -PAL_ERROR_BADHANDLE;
+
+    uint64_t start = io_stats_start();
+    int64_t ret = ops->readv ? ops->readv(handle, offset, iov, iov_count)
+                             : _DkStreamReadvFallback(handle, offset, iov, iov_count);
+    io_stats_add_read(handle, ret, start);
+    if (ret < 0)
+        return ret;
+
+    *ret_size = ret;
+    return 0;
+}
+
+int DkStreamWritev(PAL_HANDLE handle, PAL_NUM offset, const PAL_IOVEC* iov, PAL_NUM iov_count,
+                   PAL_NUM* ret_size) {
+    if (!handle || (!iov && iov_count))
+        return -PAL_ERROR_INVAL;
+
+    const struct handle_ops* ops = HANDLE_OPS(handle);
+    if (!ops)
+        return -PAL_ERROR_BADHANDLE;
+
+    uint64_t start = io_stats_start();
+    int64_t ret = ops->writev ? ops->writev(handle, offset, iov, iov_count)
+                              : _DkStreamWritevFallback(handle, offset, iov, iov_count);
+    io_stats_add_write(handle, ret, start);
+    if (ret < 0)
+        return ret;
+
+    *ret_size = ret;
+    return 0;
+}
+
+/* bytes transferred by the first `count` messages, for the I/O counters */
+static int64_t msgs_bytes(const PAL_STREAM_MSG* msgs, int64_t count) {
+    int64_t bytes = 0;
+    for (int64_t i = 0; i < count; i++)
+        bytes += msgs[i].size;
+    return bytes;
+}
+
+int DkStreamReadMsgs(PAL_HANDLE handle, PAL_STREAM_MSG* msgs, PAL_NUM count, PAL_NUM* ret_count) {
+    if (!handle || !msgs || !count)
+        return -PAL_ERROR_INVAL;
+
+    const struct handle_ops* ops = HANDLE_OPS(handle);
+    if (!ops)
+        return -PAL_ERROR_BADHANDLE;
+
+    uint64_t start = io_stats_start();
+    int64_t ret;
+    if (ops->readmsgs) {
+        ret = ops->readmsgs(handle, msgs, count);
+    } else {
+        /* a second read could block, so read only one message */
+        ret = _DkStreamRead(handle, /*offset=*/0, msgs[0].size, msgs[0].buffer,
+                            msgs[0].addr_size ? msgs[0].addr : NULL, msgs[0].addr_size);
+        if (ret >= 0) {
+            msgs[0].size = ret;
+            ret = 1;
+        }
+    }
+
+    io_stats_add_read(handle, ret < 0 ? ret : msgs_bytes(msgs, ret), start);
+    if (ret < 0)
+        return ret;
+
+    *ret_count = ret;
+    return 0;
+}
+
+int DkStreamWriteMsgs(PAL_HANDLE handle, PAL_STREAM_MSG* msgs, PAL_NUM count, PAL_NUM* ret_count) {
+    if (!handle || !msgs || !count)
+        return -PAL_ERROR_INVAL;
+
+    const struct handle_ops* ops = HANDLE_OPS(handle);
+    if (!ops)
+        return -PAL_ERROR_BADHANDLE;
+
+    uint64_t start = io_stats_start();
+    int64_t ret;
+    if (ops->writemsgs) {
+        ret = ops->writemsgs(handle, msgs, count);
+    } else {
+        size_t i;
+        for (i = 0; i < count; i++) {
+            const char* dest = msgs[i].addr;
+            ret = _DkStreamWrite(handle, /*offset=*/0, msgs[i].size, msgs[i].buffer, dest,
+                                 dest ? strlen(dest) : 0);
+            if (ret < 0)
+                break;
+            msgs[i].size = ret;
+        }
+        if (i)
+            ret = i;
+    }
+
+    io_stats_add_write(handle, ret < 0 ? ret : msgs_bytes(msgs, ret), start);
+    if (ret < 0)
+        return ret;
+
+    *ret_count = ret;
+    return 0;
+}
+
+int DkStreamSendFile(PAL_HANDLE handle, PAL_HANDLE file, PAL_NUM offset, PAL_NUM count,
+                     PAL_NUM* ret_count) {
+    if (!handle || !file)
+        return -PAL_ERROR_INVAL;
+
+    const struct handle_ops* ops = HANDLE_OPS(handle);
+    if (!ops)
+        return -PAL_ERROR_BADHANDLE;
+
+    if (!ops->sendfile)
+        return -PAL_ERROR_NOTSUPPORT;
+
+    int64_t ret = ops->sendfile(handle, file, offset, count);
+    if (ret < 0)
+        return ret;
+
+    *ret_count = ret;
+    return 0;
+}
+
+int DkStreamCopyFile(PAL_HANDLE handle, PAL_NUM offset, PAL_HANDLE file, PAL_NUM file_offset,
+                     PAL_NUM count, PAL_NUM* ret_count) {
+    if (!handle || !file)
+        return -PAL_ERROR_INVAL;
+
+    const struct handle_ops* ops = HANDLE_OPS(handle);
+    if (!ops)
+        return -PAL_ERROR_BADHANDLE;
+
+    if (!ops->copyfile)
+        return -PAL_ERROR_NOTSUPPORT;
+
+    int64_t ret = ops->copyfile(handle, offset, file, file_offset, count);
+    if (ret < 0)
+        return ret;
+
+    *ret_count = ret;
+    return 0;
+}
+
 /* _DkStreamAttributesQuery of internal use. The function query attribute
    of streams by their URI */
 int _DkStreamAttributesQuery(const char* uri, PAL_STREAM_ATTR* attr) {
@@ -482,6 +814,34 @@ int DkStreamSetLength(PAL_HANDLE handle, PAL_NUM length) {
     return 0;
 }
 
+int DkStreamAllocate(PAL_HANDLE handle, PAL_NUM offset, PAL_NUM length, PAL_BOL keep_size) {
+    if (!handle || !length || offset + length < offset)
+        return -PAL_ERROR_INVAL;
+
+    const struct handle_ops* ops = HANDLE_OPS(handle);
+    if (!ops)
+        return -PAL_ERROR_BADHANDLE;
+
+    if (!ops->allocate)
+        return -PAL_ERROR_NOTSUPPORT;
+
+    return ops->allocate(handle, offset, length, keep_size);
+}
+
+int DkStreamAdvise(PAL_HANDLE handle, PAL_NUM offset, PAL_NUM length, enum PAL_ADVICE advice) {
+    if (!handle || offset + length < offset || advice > PAL_ADVICE_DONTNEED)
+        return -PAL_ERROR_INVAL;
+
+    const struct handle_ops* ops = HANDLE_OPS(handle);
+    if (!ops)
+        return -PAL_ERROR_BADHANDLE;
+
+    if (!ops->advise)
+        return -PAL_ERROR_NOTSUPPORT;
+
+    return ops->advise(handle, offset, length, advice);
+}
+
 /* _DkStreamFlush for internal use. This function sync up the handle with
    devices. Some streams may not support this operations. */
 int _DkStreamFlush(PAL_HANDLE handle) {
@@ -513,7 +873,7 @@ int DkSendHandle(PAL_HANDLE handle, PAL_HANDLE cargo) {
         return -PAL_ERROR_INVAL;
     }
 
-    return _DkSendHandle(handle, cargo);
+    return _DkSendHandles(handle, &cargo, 1);
 }
 
 int DkReceiveHandle(PAL_HANDLE handle, PAL_HANDLE* cargo) {
@@ -523,7 +883,29 @@ int DkReceiveHandle(PAL_HANDLE handle, PAL_HANDLE* cargo) {
     }
 
     *cargo = NULL;
-    return _DkReceiveHandle(handle, cargo);
+    return _DkReceiveHandles(handle, cargo, 1);
+}
+
+int DkSendHandles(PAL_HANDLE handle, PAL_HANDLE* cargos, PAL_NUM count) {
+    if (!handle || (count && !cargos)) {
+        return -PAL_ERROR_INVAL;
+    }
+    for (PAL_NUM i = 0; i < count; i++) {
+        if (!cargos[i]) {
+            return -PAL_ERROR_INVAL;
+        }
+    }
+
+    return _DkSendHandles(handle, cargos, count);
+}
+
+int DkReceiveHandles(PAL_HANDLE handle, PAL_HANDLE* cargos, PAL_NUM count) {
+    if (!handle || (count && !cargos)) {
+        return -PAL_ERROR_INVAL;
+    }
+
+    memset(cargos, 0, count * sizeof(*cargos));
+    return _DkReceiveHandles(handle, cargos, count);
 }
 
 int DkStreamChangeName(PAL_HANDLE hdl, PAL_STR uri) {
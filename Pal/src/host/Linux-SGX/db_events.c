@@ -10,12 +10,26 @@
 
 #include "api.h"
 #include "assert.h"
+#include "cpu.h"
 #include "enclave_ocalls.h"
 #include "pal.h"
 #include "pal_internal.h"
+#include "pal_linux.h"
 #include "pal_linux_error.h"
 #include "spinlock.h"
 
+/*
+ * Before sleeping on the host futex (which is an OCALL both for the waiter and for the waker), a
+ * waiter spins for a while, checking the event with exponential backoff between the checks. Spinning
+ * waiters are not counted in `waiters_cnt`, so a wakeup which comes during the spin is a plain
+ * enclave memory write. Each event adapts its spin budget: it doubles when the event was signaled
+ * while spinning and halves when the waiter had to sleep anyway, within [EVENT_SPIN_MIN,
+ * g_event_spin_max].
+ */
+#define EVENT_BACKOFF_MAX  64
+
+uint32_t g_event_spin_max = EVENT_SPIN_MAX_DEFAULT;
+
 int _DkEventCreate(PAL_HANDLE* handle_ptr, bool init_signaled, bool auto_clear) {
     PAL_HANDLE handle = malloc(HANDLE_SIZE(event));
     if (!handle) {
@@ -30,6 +44,7 @@ int _DkEventCreate(PAL_HANDLE* handle_ptr, bool init_signaled, bool auto_clear)
     }
     spinlock_init(&handle->event.lock);
     handle->event.waiters_cnt = 0;
+    handle->event.spin_budget = g_event_spin_max;
     handle->event.signaled = init_signaled;
     handle->event.auto_clear = auto_clear;
     __atomic_store_n(handle->event.signaled_untrusted, init_signaled ? 1 : 0, __ATOMIC_RELEASE);
@@ -65,10 +80,43 @@ void _DkEventClear(PAL_HANDLE handle) {
     spinlock_unlock(&handle->event.lock);
 }
 
+/* Spins for at most `budget` pause instructions, waiting for the event to become signaled. Returns
+ * whether it did (it may still be consumed by another waiter before we take the lock). */
+static bool event_spin_wait(PAL_HANDLE handle, uint32_t budget) {
+    uint32_t backoff = 1;
+    uint32_t spun = 0;
+    while (spun < budget) {
+        if (__atomic_load_n(&handle->event.signaled, __ATOMIC_RELAXED)) {
+            return true;
+        }
+        for (uint32_t i = 0; i < backoff; i++) {
+            CPU_RELAX();
+        }
+        spun += backoff;
+        if (backoff < EVENT_BACKOFF_MAX) {
+            backoff *= 2;
+        }
+    }
+    return __atomic_load_n(&handle->event.signaled, __ATOMIC_RELAXED);
+}
+
+static void event_spin(PAL_HANDLE handle) {
+    uint32_t budget = __atomic_load_n(&handle->event.spin_budget, __ATOMIC_RELAXED);
+    if (event_spin_wait(handle, budget)) {
+        budget = budget < g_event_spin_max / 2 ? budget * 2 : g_event_spin_max;
+    } else {
+        budget = MIN(g_event_spin_max, MAX(budget / 2, EVENT_SPIN_MIN));
+    }
+    /* racy updates by concurrent waiters are fine, this is just a heuristic */
+    __atomic_store_n(&handle->event.spin_budget, budget, __ATOMIC_RELAXED);
+}
+
 /* We use `handle->event.signaled` as the source of truth whether the event was signaled.
  * `handle->event.signaled_untrusted` acts only as a futex sleeping word. */
 int _DkEventWait(PAL_HANDLE handle, uint64_t* timeout_us) {
     bool added_to_count = false;
+    /* polling (zero timeout) makes no sense to spin */
+    bool spun = !g_event_spin_max || (timeout_us && *timeout_us == 0);
     while (1) {
         spinlock_lock(&handle->event.lock);
         if (handle->event.signaled) {
@@ -83,6 +131,13 @@ int _DkEventWait(PAL_HANDLE handle, uint64_t* timeout_us) {
             return 0;
         }
 
+        if (!spun) {
+            spinlock_unlock(&handle->event.lock);
+            event_spin(handle);
+            spun = true;
+            continue;
+        }
+
         if (!added_to_count) {
             handle->event.waiters_cnt++;
             added_to_count = true;
@@ -13,6 +13,7 @@
 #include "api.h"
 #include "cpu.h"
 #include "ecall_types.h"
+#include "enclave_pages.h"
 #include "pal.h"
 #include "pal_defs.h"
 #include "pal_error.h"
@@ -172,7 +173,7 @@ static bool handle_ud(sgx_cpu_context_t* uc) {
 
 /* perform exception handling inside the enclave */
 void _DkExceptionHandler(unsigned int exit_info, sgx_cpu_context_t* uc,
-                         PAL_XREGS_STATE* xregs_state) {
+                         PAL_XREGS_STATE* xregs_state, uint64_t fault_addr) {
     assert(IS_ALIGNED_PTR(xregs_state, PAL_XSTATE_ALIGN));
 
     union {
@@ -181,6 +182,7 @@ void _DkExceptionHandler(unsigned int exit_info, sgx_cpu_context_t* uc,
     } ei = {.intval = exit_info};
 
     int event_num;
+    bool has_fault_addr = false;
 
     if (!ei.info.valid) {
         event_num = exit_info;
@@ -206,6 +208,17 @@ void _DkExceptionHandler(unsigned int exit_info, sgx_cpu_context_t* uc,
             case SGX_EXCEPTION_VECTOR_XM:
                 event_num = PAL_EVENT_ARITHMETIC_ERROR;
                 break;
+            case SGX_EXCEPTION_VECTOR_PF:
+                /* first access to a lazily populated enclave page (see enclave_pages.c) */
+                if ((g_pal_sec.enclave_misc_select & SGX_MISCSELECT_EXINFO)
+                        && handle_lazy_enclave_page_fault((void*)fault_addr)) {
+                    restore_sgx_context(uc, xregs_state);
+                    /* NOTREACHED */
+                }
+                has_fault_addr = !!(g_pal_sec.enclave_misc_select & SGX_MISCSELECT_EXINFO);
+                event_num = PAL_EVENT_MEMFAULT;
+                break;
+            case SGX_EXCEPTION_VECTOR_GP:
             case SGX_EXCEPTION_VECTOR_AC:
                 event_num = PAL_EVENT_MEMFAULT;
                 break;
@@ -261,7 +274,9 @@ void _DkExceptionHandler(unsigned int exit_info, sgx_cpu_context_t* uc,
             addr = uc->rip;
             break;
         case PAL_EVENT_MEMFAULT:
-            /* TODO: SGX1 doesn't provide fault address but SGX2 does (with lower bits masked) */
+            /* SGX1 doesn't provide fault address but SGX2 does (with lower bits masked) */
+            if (has_fault_addr)
+                addr = fault_addr;
             break;
         default:
             break;
@@ -7,6 +7,7 @@
 
 #include <asm/fcntl.h>
 #include <asm/stat.h>
+#include <linux/falloc.h>
 #include <linux/fs.h>
 #include <linux/types.h>
 
@@ -28,6 +29,66 @@
  * GBs in size, and a pread OCALL could fail with -ENOMEM, so we cap to reasonably small size) */
 #define MAX_READ_SIZE (PRESET_PAGESIZE * 1024 * 32)
 
+/* serializes the host opens of trusted files deferred by file_open() */
+static spinlock_t g_pending_open_lock = INIT_SPINLOCK_UNLOCKED;
+
+/* Sets up the (already opened on the host) trusted or allowed file of `hdl` for reads and maps. */
+static int file_load_trusted(PAL_HANDLE hdl, int create) {
+    sgx_chunk_hash_t* chunk_hashes;
+    size_t chunk_size;
+    uint64_t total;
+    void* umem;
+    int ret = load_trusted_file(hdl, &chunk_hashes, &chunk_size, &total, create, &umem);
+    if (ret < 0) {
+        log_error("Accessing file:%s is denied (%s). This file is not trusted or allowed."
+                  " Trusted files should be regular files (seekable).\n", hdl->file.realpath,
+                  pal_strerror(ret));
+        return ret;
+    }
+
+    if (chunk_hashes && total) {
+        assert(umem);
+    }
+
+    hdl->file.chunk_hashes = (PAL_PTR)chunk_hashes;
+    hdl->file.chunk_size = chunk_size;
+    hdl->file.total = total;
+    hdl->file.umem  = umem;
+    return 0;
+}
+
+/* Opens the trusted file of `handle` on the host, if file_open() deferred it; done before any
+ * operation which needs the contents of the file or its host FD. */
+static int file_open_pending(PAL_HANDLE handle) {
+    if (!__atomic_load_n(&handle->file.pending_open, __ATOMIC_ACQUIRE))
+        return 0;
+
+    int ret = 0;
+    spinlock_lock(&g_pending_open_lock);
+    if (!handle->file.pending_open)
+        goto out;
+
+    int fd = ocall_open(handle->file.realpath, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        ret = unix_to_pal_error(fd);
+        goto out;
+    }
+
+    handle->file.fd = fd;
+    HANDLE_HDR(handle)->flags |= RFD(0) | WFD(0);
+    ret = file_load_trusted(handle, /*create=*/0);
+    if (ret < 0) {
+        HANDLE_HDR(handle)->flags &= ~(RFD(0) | WFD(0));
+        handle->file.fd = PAL_IDX_POISON;
+        ocall_close(fd);
+        goto out;
+    }
+    __atomic_store_n(&handle->file.pending_open, PAL_FALSE, __ATOMIC_RELEASE);
+out:
+    spinlock_unlock(&g_pending_open_lock);
+    return ret;
+}
+
 /* 'open' operation for file streams */
 static int file_open(PAL_HANDLE* handle, const char* type, const char* uri, int access, int share,
                      int create, int options) {
@@ -41,7 +102,6 @@ static int file_open(PAL_HANDLE* handle, const char* type, const char* uri, int
         return -PAL_ERROR_NOMEM;
 
     SET_HANDLE_TYPE(hdl, file);
-    HANDLE_HDR(hdl)->flags |= RFD(0) | WFD(0);
     char* path = (void*)hdl + HANDLE_SIZE(file);
     int ret;
     if ((ret = get_norm_path(uri, path, &len)) < 0) {
@@ -52,6 +112,23 @@ static int file_open(PAL_HANDLE* handle, const char* type, const char* uri, int
     hdl->file.realpath = (PAL_STR)path;
 
     struct protected_file* pf = get_protected_file(path);
+
+    /* A read-only trusted file is opened on the host only on the first operation which needs it
+     * (see file_open_pending()): opening a file just to query its attributes, as e.g. module
+     * imports of language runtimes do for many files, then never leaves the enclave. The FD is
+     * not valid before (and not sent to a child process, which opens the file on its own). */
+    PAL_STREAM_ATTR tf_attr;
+    if (!pf && !create && (access & PAL_ACCESS_MASK) == PAL_ACCESS_RDONLY
+            && get_trusted_file_attr(path, &tf_attr)) {
+        hdl->file.fd = PAL_IDX_POISON;
+        hdl->file.total = tf_attr.pending_size;
+        hdl->file.seekable = PAL_TRUE;
+        hdl->file.pending_open = PAL_TRUE;
+        *handle = hdl;
+        return 0;
+    }
+
+    HANDLE_HDR(hdl)->flags |= RFD(0) | WFD(0);
     struct stat st;
     /* whether to re-initialize the PF */
     bool pf_create = (create & PAL_CREATE_ALWAYS) || (create & PAL_CREATE_TRY);
@@ -87,10 +164,13 @@ static int file_open(PAL_HANDLE* handle, const char* type, const char* uri, int
         else
             pf_mode = PF_FILE_MODE_READ;
 
+        spinlock_lock(&pf->lock);
+
         /* disallow opening more than one writable handle to a PF */
         if (pf_mode & PF_FILE_MODE_WRITE) {
             if (pf->writable_fd >= 0) {
                 log_error("file_open(%s): disallowing concurrent writable handle\n", path);
+                spinlock_unlock(&pf->lock);
                 ret = -PAL_ERROR_DENIED;
                 goto out;
             }
@@ -101,38 +181,29 @@ static int file_open(PAL_HANDLE* handle, const char* type, const char* uri, int
         /* the protected files should be regular files (seekable) */
         if (!hdl->file.seekable) {
             log_error("file_open(%s): disallowing non-seekable file handle\n", path);
+            spinlock_unlock(&pf->lock);
             goto out;
         }
 
-        pf = load_protected_file(path, (int*)&hdl->file.fd, st.st_size, pf_mode, pf_create, pf);
-        if (pf) {
+        struct protected_file* loaded_pf = load_protected_file(path, (int*)&hdl->file.fd,
+                                                               st.st_size, pf_mode, pf_create, pf);
+        if (loaded_pf) {
+            HANDLE_HDR(hdl)->flags |= PROTECTED_FILE;
             pf->refcount++;
             if (pf_mode & PF_FILE_MODE_WRITE) {
                 pf->writable_fd = fd;
             }
+            spinlock_unlock(&pf->lock);
         } else {
             log_error("load_protected_file(%s, %d) failed\n", path, hdl->file.fd);
+            spinlock_unlock(&pf->lock);
+            pf = NULL;
             goto out;
         }
     } else {
-        sgx_chunk_hash_t* chunk_hashes;
-        uint64_t total;
-        void* umem;
-        ret = load_trusted_file(hdl, &chunk_hashes, &total, create, &umem);
-        if (ret < 0) {
-            log_error("Accessing file:%s is denied (%s). This file is not trusted or allowed."
-                      " Trusted files should be regular files (seekable).\n", hdl->file.realpath,
-                      pal_strerror(ret));
+        ret = file_load_trusted(hdl, create);
+        if (ret < 0)
             goto out;
-        }
-
-        if (chunk_hashes && total) {
-            assert(umem);
-        }
-
-        hdl->file.chunk_hashes = (PAL_PTR)chunk_hashes;
-        hdl->file.total = total;
-        hdl->file.umem  = umem;
     }
 
     *handle = hdl;
@@ -140,8 +211,12 @@ static int file_open(PAL_HANDLE* handle, const char* type, const char* uri, int
 
 out:
     if (ret != 0) {
-        if (pf && pf->context && pf->refcount == 0)
-            unload_protected_file(pf);
+        if (pf) {
+            spinlock_lock(&pf->lock);
+            if (pf->context && pf->refcount == 0)
+                unload_protected_file(pf);
+            spinlock_unlock(&pf->lock);
+        }
 
         free(hdl);
         if (fd >= 0)
@@ -154,13 +229,16 @@ static int64_t pf_file_read(struct protected_file* pf, PAL_HANDLE handle, uint64
                             uint64_t count, void* buffer) {
     int fd = handle->file.fd;
 
+    spinlock_lock(&pf->lock);
     if (!pf->context) {
+        spinlock_unlock(&pf->lock);
         log_error("pf_file_read(PF fd %d): PF not initialized\n", fd);
         return -PAL_ERROR_BADHANDLE;
     }
 
     size_t bytes_read = 0;
     pf_status_t pfs = pf_read(pf->context, offset, count, buffer, &bytes_read);
+    spinlock_unlock(&pf->lock);
 
     if (PF_FAILURE(pfs)) {
         log_error("pf_file_read(PF fd %d): pf_read failed: %s\n", fd, pf_strerror(pfs));
@@ -177,7 +255,10 @@ static int64_t file_read(PAL_HANDLE handle, uint64_t offset, uint64_t count, voi
     if (pf)
         return pf_file_read(pf, handle, offset, count, buffer);
 
-    int64_t ret;
+    int64_t ret = file_open_pending(handle);
+    if (ret < 0)
+        return ret;
+
     sgx_chunk_hash_t* chunk_hashes = (sgx_chunk_hash_t*)handle->file.chunk_hashes;
 
     if (!chunk_hashes) {
@@ -199,12 +280,12 @@ static int64_t file_read(PAL_HANDLE handle, uint64_t offset, uint64_t count, voi
         return 0;
 
     off_t end = MIN(offset + count, total);
-    off_t aligned_offset = ALIGN_DOWN(offset, TRUSTED_CHUNK_SIZE);
-    off_t aligned_end    = ALIGN_UP(end, TRUSTED_CHUNK_SIZE);
+    off_t aligned_offset = ALIGN_DOWN(offset, handle->file.chunk_size);
+    off_t aligned_end    = ALIGN_UP(end, handle->file.chunk_size);
 
     ret = copy_and_verify_trusted_file(handle->file.realpath, buffer, handle->file.umem,
                                        aligned_offset, aligned_end, offset, end, chunk_hashes,
-                                       total);
+                                       handle->file.chunk_size, total);
     if (ret < 0)
         return ret;
 
@@ -215,12 +296,16 @@ static int64_t pf_file_write(struct protected_file* pf, PAL_HANDLE handle, uint6
                              uint64_t count, const void* buffer) {
     int fd = handle->file.fd;
 
+    spinlock_lock(&pf->lock);
     if (!pf->context) {
+        spinlock_unlock(&pf->lock);
         log_error("pf_file_write(PF fd %d): PF not initialized\n", fd);
         return -PAL_ERROR_BADHANDLE;
     }
 
     pf_status_t pf_ret = pf_write(pf->context, offset, count, buffer);
+    pf->attr_cached = false;
+    spinlock_unlock(&pf->lock);
 
     if (PF_FAILURE(pf_ret)) {
         log_error("pf_file_write(PF fd %d): pf_write failed: %s\n", fd, pf_strerror(pf_ret));
@@ -237,7 +322,10 @@ static int64_t file_write(PAL_HANDLE handle, uint64_t offset, uint64_t count, co
     if (pf)
         return pf_file_write(pf, handle, offset, count, buffer);
 
-    int64_t ret;
+    int64_t ret = file_open_pending(handle);
+    if (ret < 0)
+        return ret;
+
     sgx_chunk_hash_t* chunk_hashes = (sgx_chunk_hash_t*)handle->file.chunk_hashes;
 
     if (!chunk_hashes) {
@@ -258,23 +346,128 @@ static int64_t file_write(PAL_HANDLE handle, uint64_t offset, uint64_t count, co
     return -PAL_ERROR_DENIED;
 }
 
+/* 'readv' and 'writev' operations for file streams. Only plain (allowed) files go to the host
+ * directly; protected and trusted files are transferred segment by segment through their own
+ * 'read' and 'write'. */
+static int64_t file_readv(PAL_HANDLE handle, uint64_t offset, const PAL_IOVEC* iov,
+                          size_t iov_count) {
+    if (handle->file.pending_open || handle->file.chunk_hashes
+            || find_protected_file_handle(handle))
+        return _DkStreamReadvFallback(handle, offset, iov, iov_count);
+
+    ssize_t ret = ocall_readv(handle->file.fd, iov, iov_count,
+                              handle->file.seekable ? (off_t)offset : -1);
+    if (ret < 0)
+        return unix_to_pal_error(ret);
+
+    return ret;
+}
+
+static int64_t file_writev(PAL_HANDLE handle, uint64_t offset, const PAL_IOVEC* iov,
+                           size_t iov_count) {
+    if (handle->file.pending_open || handle->file.chunk_hashes
+            || find_protected_file_handle(handle))
+        return _DkStreamWritevFallback(handle, offset, iov, iov_count);
+
+    ssize_t ret = ocall_writev(handle->file.fd, iov, iov_count,
+                               handle->file.seekable ? (off_t)offset : -1);
+    if (ret < 0)
+        return unix_to_pal_error(ret);
+
+    return ret;
+}
+
+/* Verifies the chunks of the trusted file of `handle` which overlap [offset, end), one at a time (the
+ * contents are copied into a scratch buffer and dropped). */
+static int verify_trusted_file_range(PAL_HANDLE handle, uint64_t offset, uint64_t end) {
+    size_t chunk_size = handle->file.chunk_size;
+    uint8_t* chunk = malloc(chunk_size);
+    if (!chunk)
+        return -PAL_ERROR_NOMEM;
+
+    int ret = 0;
+    uint64_t total = handle->file.total;
+    for (uint64_t chunk_offset = ALIGN_DOWN(offset, chunk_size); chunk_offset < end;
+            chunk_offset += chunk_size) {
+        uint64_t chunk_end = MIN(chunk_offset + chunk_size, total);
+        ret = copy_and_verify_trusted_file(handle->file.realpath, chunk, handle->file.umem,
+                                           chunk_offset, chunk_offset + chunk_size, chunk_offset,
+                                           chunk_end, (sgx_chunk_hash_t*)handle->file.chunk_hashes,
+                                           chunk_size, total);
+        if (ret < 0)
+            break;
+    }
+
+    free(chunk);
+    return ret;
+}
+
+/* 'copyfile' operation for file streams. The host copies from a plain (allowed) or trusted file to a
+ * plain file; protected files are copied by the caller through 'read' and 'write'. */
+static int64_t file_copyfile(PAL_HANDLE handle, uint64_t offset, PAL_HANDLE file,
+                             uint64_t file_offset, uint64_t count) {
+    if (!IS_HANDLE_TYPE(file, file) || !handle->file.seekable || !file->file.seekable)
+        return -PAL_ERROR_NOTSUPPORT;
+
+    /* writing to a trusted file fails in 'write' anyway, let the caller report it */
+    if (handle->file.pending_open || handle->file.chunk_hashes
+            || find_protected_file_handle(handle) || find_protected_file_handle(file))
+        return -PAL_ERROR_NOTSUPPORT;
+
+    if (offset > INT64_MAX || file_offset > INT64_MAX)
+        return -PAL_ERROR_INVAL;
+
+    int64_t ret = file_open_pending(file);
+    if (ret < 0)
+        return ret;
+
+    if (file->file.chunk_hashes) {
+        /* The copied range of a trusted source is verified first, so that the copy fails like a
+         * read would on a modified file. The host may still change the contents between the check
+         * and the copy, but it controls the (allowed) destination anyway. */
+        uint64_t total = file->file.total;
+        if (file_offset >= total)
+            return 0;
+        count = MIN(count, MIN(total - file_offset, MAX_READ_SIZE));
+
+        ret = verify_trusted_file_range(file, file_offset, file_offset + count);
+        if (ret < 0)
+            return ret;
+    }
+
+    ssize_t bytes = ocall_copy_file_range(file->file.fd, (off_t)file_offset, handle->file.fd,
+                                          (off_t)offset, count);
+    if (bytes < 0)
+        return unix_to_pal_error(bytes);
+
+    return bytes;
+}
+
 static int pf_file_close(struct protected_file* pf, PAL_HANDLE handle) {
     int fd = handle->file.fd;
+    int ret = 0;
 
+    spinlock_lock(&pf->lock);
     if (pf->refcount == 0) {
         log_error("pf_file_close(PF fd %d): refcount == 0\n", fd);
-        return -PAL_ERROR_INVAL;
+        ret = -PAL_ERROR_INVAL;
+        goto out;
     }
 
     pf->refcount--;
 
-    if (pf->writable_fd == fd)
+    if (pf->writable_fd == fd) {
         pf->writable_fd = -1;
+        /* remaining data is flushed to the host file below */
+        pf->attr_cached = false;
+    }
 
     if (pf->refcount == 0)
-        return unload_protected_file(pf);
+        ret = unload_protected_file(pf);
 
-    return 0;
+out:
+    spinlock_unlock(&pf->lock);
+    return ret;
 }
 
 /* 'close' operation for file streams. In this case, it will only
@@ -289,12 +482,14 @@ static int file_close(PAL_HANDLE handle) {
             return ret;
     }
 
-    if (handle->file.chunk_hashes && handle->file.total) {
-        /* case of trusted file: the whole file was mmapped in untrusted memory */
-        ocall_munmap_untrusted(handle->file.umem, handle->file.total);
-    }
+    if (!handle->file.pending_open) {
+        if (handle->file.chunk_hashes && handle->file.total) {
+            /* case of trusted file: the whole file was mmapped in untrusted memory */
+            ocall_munmap_untrusted(handle->file.umem, handle->file.total);
+        }
 
-    ocall_close(fd);
+        ocall_close(fd);
+    }
 
     /* initial realpath is part of handle object and will be freed with it */
     if (handle->file.realpath && handle->file.realpath != (void*)handle + HANDLE_SIZE(file))
@@ -310,7 +505,16 @@ static int file_delete(PAL_HANDLE handle, int access) {
         return -PAL_ERROR_INVAL;
 
     int ret = ocall_delete(handle->file.realpath);
-    return ret < 0 ? unix_to_pal_error(ret) : ret;
+    if (ret < 0)
+        return unix_to_pal_error(ret);
+
+    struct protected_file* pf = find_protected_file_handle(handle);
+    if (pf) {
+        spinlock_lock(&pf->lock);
+        pf->attr_cached = false;
+        spinlock_unlock(&pf->lock);
+    }
+    return ret;
 }
 
 static int pf_file_map(struct protected_file* pf, PAL_HANDLE handle, void** addr, int prot,
@@ -323,14 +527,12 @@ static int pf_file_map(struct protected_file* pf, PAL_HANDLE handle, void** addr
         return -PAL_ERROR_INVAL;
 
     assert(WITHIN_MASK(prot, PAL_PROT_MASK));
-    if ((prot & PAL_PROT_READ) && (prot & PAL_PROT_WRITE)) {
-        log_error("pf_file_map(PF fd %d): trying to map with R+W access\n", fd);
-        return -PAL_ERROR_NOTSUPPORT;
-    }
 
+    spinlock_lock(&pf->lock);
     if (!pf->context) {
         log_error("pf_file_map(PF fd %d): PF not initialized\n", fd);
-        return -PAL_ERROR_BADHANDLE;
+        ret = -PAL_ERROR_BADHANDLE;
+        goto out;
     }
 
     uint64_t pf_size;
@@ -341,16 +543,45 @@ static int pf_file_map(struct protected_file* pf, PAL_HANDLE handle, void** addr
     log_debug("pf_file_map(PF fd %d): pf %p, addr %p, prot %d, offset %lu, size %lu\n", fd, pf,
               *addr, prot, offset, size);
 
+    /* shared writable mappings are written back to the PF, private ones are only populated */
+    bool write_back = (prot & PAL_PROT_WRITE) && !(prot & PAL_PROT_WRITECOPY);
+
+    /* we don't check this on shared writes since file size may be extended then */
+    if (offset >= pf_size && !write_back) {
+        log_error("pf_file_map(PF fd %d): offset (%lu) >= file size (%lu)\n", fd, offset,
+                  pf_size);
+        ret = -PAL_ERROR_INVAL;
+        goto out;
+    }
+
     if (*addr == NULL) {
         /* LibOS didn't provide address at which to map, can happen on sendfile() */
         allocated_enclave_pages = get_enclave_pages(/*addr=*/NULL, size, /*is_pal_internal=*/false);
-        if (!allocated_enclave_pages)
-            return -PAL_ERROR_NOMEM;
+        if (!allocated_enclave_pages) {
+            ret = -PAL_ERROR_NOMEM;
+            goto out;
+        }
 
         *addr = allocated_enclave_pages;
     }
 
-    if (prot & PAL_PROT_WRITE) {
+    uint64_t copy_size = offset < pf_size ? MIN(size, pf_size - offset) : 0;
+    if (copy_size) {
+        size_t bytes_read = 0;
+        pf_status_t pf_ret = pf_read(pf->context, offset, copy_size, *addr, &bytes_read);
+        if (bytes_read != copy_size) {
+            /* mapped region must be read completely from file, otherwise it's an error */
+            pf_ret = PF_STATUS_CORRUPTED;
+        }
+        if (PF_FAILURE(pf_ret)) {
+            log_error("pf_file_map(PF fd %d): pf_read failed: %s\n", fd, pf_strerror(pf_ret));
+            ret = -PAL_ERROR_DENIED;
+            goto out;
+        }
+    }
+    memset(*addr + copy_size, 0, size - copy_size);
+
+    if (write_back) {
         struct pf_map* map = calloc(1, sizeof(*map));
         if (!map) {
             ret = -PAL_ERROR_NOMEM;
@@ -362,39 +593,22 @@ static int pf_file_map(struct protected_file* pf, PAL_HANDLE handle, void** addr
         map->offset = offset;
         map->buffer = *addr;
 
-        pf_lock();
-        LISTP_ADD_TAIL(map, &g_pf_map_list, list);
-        pf_unlock();
-    }
-
-    if (prot & PAL_PROT_READ) {
-        /* we don't check this on writes since file size may be extended then */
-        if (offset >= pf_size) {
-            log_error("pf_file_map(PF fd %d): offset (%lu) >= file size (%lu)\n", fd, offset,
-                      pf_size);
-            ret = -PAL_ERROR_INVAL;
+        /* only pages modified since they were read are written back */
+        ret = pf_map_init_page_hashes(map);
+        if (ret < 0) {
+            free(map);
             goto out;
         }
 
-        uint64_t copy_size = MIN(size, pf_size - offset);
-
-        size_t bytes_read = 0;
-        pf_status_t pf_ret = pf_read(pf->context, offset, copy_size, *addr, &bytes_read);
-        if (bytes_read != copy_size) {
-            /* mapped region must be read completely from file, otherwise it's an error */
-            pf_ret = PF_STATUS_CORRUPTED;
-        }
-        if (PF_FAILURE(pf_ret)) {
-            log_error("pf_file_map(PF fd %d): pf_read failed: %s\n", fd, pf_strerror(pf_ret));
-            ret = -PAL_ERROR_DENIED;
-            goto out;
-        }
-        memset(*addr + copy_size, 0, size - copy_size);
+        spinlock_lock(&g_pf_map_list_lock);
+        LISTP_ADD_TAIL(map, &g_pf_map_list, list);
+        spinlock_unlock(&g_pf_map_list_lock);
     }
 
-    /* Writes will be flushed to the PF on close. */
+    /* Writes will be flushed to the PF on msync, munmap and close. */
     ret = 0;
 out:
+    spinlock_unlock(&pf->lock);
     if (ret < 0 && allocated_enclave_pages) {
         free_enclave_pages(allocated_enclave_pages, size);
         *addr = NULL;
@@ -402,6 +616,154 @@ out:
     return ret;
 }
 
+/* state of a lazily populated mapping of a trusted file (`sgx.trusted_files_lazy_mmap`); it uses its
+ * own untrusted mapping of the file since the mapping may outlive the handle */
+struct trusted_file_lazy_map {
+    void* umem;
+    uint64_t total;
+    uint64_t offset;
+    sgx_chunk_hash_t* chunk_hashes; /* owned by the trusted file (never freed) */
+    size_t chunk_size;
+    char* path;
+    uint8_t tmp_chunk[]; /* of `chunk_size` bytes */
+};
+
+static int trusted_file_lazy_populate(void* arg, size_t range_offset, void* addr, size_t size) {
+    struct trusted_file_lazy_map* map = arg;
+
+    /* pages are committed by EACCEPT right before, so they are zeroed already (also after the end
+     * of file); the unit being populated is covered by exactly one chunk */
+    uint64_t offset = map->offset + range_offset;
+    if (offset >= map->total)
+        return 0;
+    uint64_t end = MIN(offset + size, map->total);
+
+    int ret = copy_and_verify_trusted_file_nomalloc(map->path, addr, map->umem,
+                                                    ALIGN_DOWN(offset, map->chunk_size),
+                                                    ALIGN_UP(end, map->chunk_size), offset, end,
+                                                    map->chunk_hashes, map->chunk_size, map->total,
+                                                    map->tmp_chunk);
+    if (ret < 0)
+        log_error("file_map - lazy copy & verify on trusted file returned %d\n", ret);
+    return ret;
+}
+
+static void trusted_file_lazy_release(void* arg) {
+    struct trusted_file_lazy_map* map = arg;
+    ocall_munmap_untrusted(map->umem, map->total);
+    free(map->path);
+    free(map);
+}
+
+/* returns NULL if the file cannot be mapped lazily, in which case the caller maps it eagerly */
+static void* trusted_file_map_lazy(PAL_HANDLE handle, void* addr, uint64_t offset, uint64_t size) {
+    struct trusted_file_lazy_map* map = malloc(sizeof(*map) + handle->file.chunk_size);
+    if (!map)
+        return NULL;
+
+    map->umem         = NULL;
+    map->total        = handle->file.total;
+    map->offset       = offset;
+    map->chunk_hashes = (sgx_chunk_hash_t*)handle->file.chunk_hashes;
+    map->chunk_size   = handle->file.chunk_size;
+    map->path         = strdup(handle->file.realpath);
+    if (!map->path)
+        goto fail;
+
+    int ret = ocall_mmap_untrusted(&map->umem, map->total, PROT_READ, MAP_SHARED, handle->file.fd,
+                                   /*offset=*/0);
+    if (ret < 0) {
+        map->umem = NULL;
+        goto fail;
+    }
+
+    void* mem = get_enclave_pages_lazy(addr, size, map->chunk_size, offset % map->chunk_size,
+                                       /*max_readaround=*/0, trusted_file_lazy_populate,
+                                       trusted_file_lazy_release, map);
+    if (!mem)
+        goto fail;
+    return mem;
+
+fail:
+    if (map->umem)
+        ocall_munmap_untrusted(map->umem, map->total);
+    free(map->path);
+    free(map);
+    return NULL;
+}
+
+/* state of a lazily populated mapping of an allowed file (`sgx.allowed_files_lazy_mmap`); it uses
+ * its own host FD since the mapping may outlive the handle */
+struct allowed_file_lazy_map {
+    int fd;
+    uint64_t offset;
+};
+
+/* populated in clusters of ALLOWED_FILE_LAZY_UNIT_SIZE bytes, sequential faults read ahead up to
+ * ALLOWED_FILE_LAZY_READAROUND clusters more */
+#define ALLOWED_FILE_LAZY_UNIT_SIZE  (64 * 1024)
+#define ALLOWED_FILE_LAZY_READAROUND 16
+
+static int allowed_file_lazy_populate(void* arg, size_t range_offset, void* addr, size_t size) {
+    struct allowed_file_lazy_map* map = arg;
+
+    /* pages are committed by EACCEPT right before, so they are zeroed already (also after the end
+     * of file) */
+    size_t bytes_read = 0;
+    while (bytes_read < size) {
+        ssize_t bytes = ocall_pread(map->fd, addr + bytes_read, size - bytes_read,
+                                    map->offset + range_offset + bytes_read);
+        if (bytes > 0) {
+            bytes_read += bytes;
+        } else if (bytes == 0) {
+            break; /* EOF */
+        } else if (bytes == -EINTR || bytes == -EAGAIN) {
+            continue;
+        } else {
+            log_error("file_map - lazy ocall_pread on allowed file returned %ld\n", bytes);
+            return unix_to_pal_error(bytes);
+        }
+    }
+    return 0;
+}
+
+static void allowed_file_lazy_release(void* arg) {
+    struct allowed_file_lazy_map* map = arg;
+    ocall_close(map->fd);
+    free(map);
+}
+
+/* returns NULL if the file cannot be mapped lazily, in which case the caller maps it eagerly */
+static void* allowed_file_map_lazy(PAL_HANDLE handle, void* addr, uint64_t offset, uint64_t size) {
+    struct allowed_file_lazy_map* map = malloc(sizeof(*map));
+    if (!map)
+        return NULL;
+
+    /* reopen the host FD rather than the path, in case the file was renamed or unlinked */
+    char fd_path[32];
+    snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", handle->file.fd);
+
+    map->offset = offset;
+    map->fd = ocall_open(fd_path, O_RDONLY | O_CLOEXEC, 0);
+    if (map->fd < 0) {
+        free(map);
+        return NULL;
+    }
+
+    /* units are aligned to file offsets, so that read-around sees the same clusters in every
+     * mapping of the file */
+    void* mem = get_enclave_pages_lazy(addr, size, ALLOWED_FILE_LAZY_UNIT_SIZE,
+                                       offset % ALLOWED_FILE_LAZY_UNIT_SIZE,
+                                       ALLOWED_FILE_LAZY_READAROUND, allowed_file_lazy_populate,
+                                       allowed_file_lazy_release, map);
+    if (!mem) {
+        ocall_close(map->fd);
+        free(map);
+        return NULL;
+    }
+    return mem;
+}
+
 /* 'map' operation for file stream. */
 static int file_map(PAL_HANDLE handle, void** addr, int prot, uint64_t offset, uint64_t size) {
     assert(IS_ALLOC_ALIGNED(offset) && IS_ALLOC_ALIGNED(size));
@@ -421,6 +783,10 @@ static int file_map(PAL_HANDLE handle, void** addr, int prot, uint64_t offset, u
     if (pf)
         return pf_file_map(pf, handle, addr, prot, offset, size);
 
+    ret = file_open_pending(handle);
+    if (ret < 0)
+        return ret;
+
     sgx_chunk_hash_t* chunk_hashes = (sgx_chunk_hash_t*)handle->file.chunk_hashes;
     void* mem = *addr;
 
@@ -435,14 +801,29 @@ static int file_map(PAL_HANDLE handle, void** addr, int prot, uint64_t offset, u
     }
 
     if (!(prot & PAL_PROT_WRITECOPY) && (prot & PAL_PROT_WRITE)) {
-        log_error(
-            "file_map does not currently support writable pass-through mappings on SGX.  You "
-            "may add the PAL_PROT_WRITECOPY (MAP_PRIVATE) flag to your file mapping to keep "
-            "the writes inside the enclave but they won't be reflected outside of the "
-            "enclave.\n");
+        /* LibOS emulates such mappings with a copy in enclave memory, written back on msync() */
+        log_debug("file_map: writable shared mappings are not supported on SGX\n");
         return -PAL_ERROR_DENIED;
     }
 
+    if (chunk_hashes && g_trusted_files_lazy_mmap && offset < handle->file.total) {
+        /* chunks of the file are copied and verified on first access to them */
+        void* lazy_mem = trusted_file_map_lazy(handle, mem, offset, size);
+        if (lazy_mem) {
+            *addr = lazy_mem;
+            return 0;
+        }
+    }
+
+    if (!chunk_hashes && g_allowed_files_lazy_mmap) {
+        /* clusters of the file are read into the enclave on first access to them */
+        void* lazy_mem = allowed_file_map_lazy(handle, mem, offset, size);
+        if (lazy_mem) {
+            *addr = lazy_mem;
+            return 0;
+        }
+    }
+
     mem = get_enclave_pages(mem, size, /*is_pal_internal=*/false);
     if (!mem)
         return -PAL_ERROR_NOMEM;
@@ -451,8 +832,8 @@ static int file_map(PAL_HANDLE handle, void** addr, int prot, uint64_t offset, u
         /* case of trusted file: already mmaped in umem, copy from there into enclave memory and
          * verify hashes along the way */
         off_t end = MIN(offset + size, handle->file.total);
-        off_t aligned_offset = ALIGN_DOWN(offset, TRUSTED_CHUNK_SIZE);
-        off_t aligned_end    = ALIGN_UP(end, TRUSTED_CHUNK_SIZE);
+        off_t aligned_offset = ALIGN_DOWN(offset, handle->file.chunk_size);
+        off_t aligned_end    = ALIGN_UP(end, handle->file.chunk_size);
         off_t total_size     = aligned_end - aligned_offset;
 
         if ((uint64_t)total_size > SIZE_MAX) {
@@ -463,7 +844,7 @@ static int file_map(PAL_HANDLE handle, void** addr, int prot, uint64_t offset, u
 
         ret = copy_and_verify_trusted_file(handle->file.realpath, mem, handle->file.umem,
                                            aligned_offset, aligned_end, offset, end, chunk_hashes,
-                                           handle->file.total);
+                                           handle->file.chunk_size, handle->file.total);
         if (ret < 0) {
             log_error("file_map - copy & verify on trusted file returned %d\n", ret);
             goto out;
@@ -508,7 +889,16 @@ out:
 static int64_t pf_file_setlength(struct protected_file* pf, PAL_HANDLE handle, uint64_t length) {
     int fd = handle->file.fd;
 
+    spinlock_lock(&pf->lock);
+    if (!pf->context) {
+        spinlock_unlock(&pf->lock);
+        log_error("pf_file_setlength(PF fd %d): PF not initialized\n", fd);
+        return -PAL_ERROR_BADHANDLE;
+    }
+
     pf_status_t pfs = pf_set_size(pf->context, length);
+    pf->attr_cached = false;
+    spinlock_unlock(&pf->lock);
     if (PF_FAILURE(pfs)) {
         log_error("pf_file_setlength(PF fd %d, %lu): pf_set_size returned %s\n", fd, length,
                   pf_strerror(pfs));
@@ -523,7 +913,11 @@ static int64_t file_setlength(PAL_HANDLE handle, uint64_t length) {
     if (pf)
         return pf_file_setlength(pf, handle, length);
 
-    int ret = ocall_ftruncate(handle->file.fd, length);
+    int ret = file_open_pending(handle);
+    if (ret < 0)
+        return ret;
+
+    ret = ocall_ftruncate(handle->file.fd, length);
     if (ret < 0)
         return unix_to_pal_error(ret);
 
@@ -531,17 +925,128 @@ static int64_t file_setlength(PAL_HANDLE handle, uint64_t length) {
     return (int64_t)length;
 }
 
+/* Protected files can't be preallocated on the host (their contents are encrypted), but extending
+ * them here at least avoids getting every zero from LibOS. */
+static int pf_file_allocate(struct protected_file* pf, PAL_HANDLE handle, uint64_t end,
+                            bool keep_size) {
+    int fd = handle->file.fd;
+
+    if (keep_size)
+        return 0;
+
+    spinlock_lock(&pf->lock);
+    if (!pf->context) {
+        spinlock_unlock(&pf->lock);
+        log_error("pf_file_allocate(PF fd %d): PF not initialized\n", fd);
+        return -PAL_ERROR_BADHANDLE;
+    }
+
+    uint64_t size;
+    pf_status_t pfs = pf_get_size(pf->context, &size);
+    if (PF_SUCCESS(pfs) && end > size) {
+        pfs = pf_set_size(pf->context, end);
+        pf->attr_cached = false;
+    }
+    spinlock_unlock(&pf->lock);
+    if (PF_FAILURE(pfs)) {
+        log_error("pf_file_allocate(PF fd %d, %lu): %s\n", fd, end, pf_strerror(pfs));
+        return -PAL_ERROR_DENIED;
+    }
+    return 0;
+}
+
+/* 'allocate' operation for file stream. */
+static int file_allocate(PAL_HANDLE handle, uint64_t offset, uint64_t length, bool keep_size) {
+    struct protected_file* pf = find_protected_file_handle(handle);
+    if (pf)
+        return pf_file_allocate(pf, handle, offset + length, keep_size);
+
+    if (handle->file.pending_open || handle->file.chunk_hashes)
+        return -PAL_ERROR_DENIED;
+
+    int ret = ocall_fallocate(handle->file.fd, keep_size ? FALLOC_FL_KEEP_SIZE : 0, offset,
+                              length);
+    if (ret < 0) {
+        if (ret == -EOPNOTSUPP)
+            return -PAL_ERROR_NOTSUPPORT;
+        if (ret == -ENOSPC)
+            return -PAL_ERROR_NOMEM;
+        return unix_to_pal_error(ret);
+    }
+
+    if (!keep_size && offset + length > handle->file.total)
+        handle->file.total = offset + length;
+    return 0;
+}
+
+/* Protected files take the advice in their read-ahead of encrypted nodes (the host only ever sees
+ * node-sized reads of them). */
+static int pf_file_advise(struct protected_file* pf, PAL_HANDLE handle, uint64_t offset,
+                          uint64_t length, enum PAL_ADVICE advice) {
+    static const pf_advice_t pf_advice[] = {
+        [PAL_ADVICE_NORMAL]     = PF_ADVICE_NORMAL,
+        [PAL_ADVICE_SEQUENTIAL] = PF_ADVICE_SEQUENTIAL,
+        [PAL_ADVICE_RANDOM]     = PF_ADVICE_RANDOM,
+        [PAL_ADVICE_WILLNEED]   = PF_ADVICE_WILLNEED,
+        [PAL_ADVICE_DONTNEED]   = PF_ADVICE_DONTNEED,
+    };
+    int fd = handle->file.fd;
+
+    spinlock_lock(&pf->lock);
+    if (!pf->context) {
+        spinlock_unlock(&pf->lock);
+        log_error("pf_file_advise(PF fd %d): PF not initialized\n", fd);
+        return -PAL_ERROR_BADHANDLE;
+    }
+
+    pf_status_t pfs = pf_advise(pf->context, offset, length, pf_advice[advice]);
+    spinlock_unlock(&pf->lock);
+    if (PF_FAILURE(pfs)) {
+        log_error("pf_file_advise(PF fd %d, %lu, %lu): %s\n", fd, offset, length,
+                  pf_strerror(pfs));
+        return -PAL_ERROR_DENIED;
+    }
+    return 0;
+}
+
+/* 'advise' operation for file stream. */
+static int file_advise(PAL_HANDLE handle, uint64_t offset, uint64_t length,
+                       enum PAL_ADVICE advice) {
+    struct protected_file* pf = find_protected_file_handle(handle);
+    if (pf)
+        return pf_file_advise(pf, handle, offset, length, advice);
+
+    /* a trusted file which wasn't opened on the host yet has nothing cached */
+    if (handle->file.pending_open)
+        return 0;
+
+    /* the host page cache of trusted files helps too, their contents are verified on reads */
+    int ret = ocall_fadvise(handle->file.fd, offset, length, PAL_ADVICE_TO_LINUX(advice));
+    if (ret < 0)
+        return ret == -ESPIPE ? -PAL_ERROR_NOTSUPPORT : unix_to_pal_error(ret);
+
+    return 0;
+}
+
 /* 'flush' operation for file stream. */
 static int file_flush(PAL_HANDLE handle) {
+    /* nothing to flush in a trusted file */
+    if (handle->file.pending_open)
+        return 0;
+
     int fd = handle->file.fd;
     struct protected_file* pf = find_protected_file_handle(handle);
     if (pf) {
+        spinlock_lock(&pf->lock);
         int ret = flush_pf_maps(pf, /*buffer=*/NULL, /*remove=*/false);
         if (ret < 0) {
+            spinlock_unlock(&pf->lock);
             log_error("file_flush(PF fd %d): flush_pf_maps returned %s\n", fd, pal_strerror(ret));
             return ret;
         }
-        pf_status_t pfs = pf_flush(pf->context);
+        pf_status_t pfs = flush_protected_file(pf);
+        pf->attr_cached = false;
+        spinlock_unlock(&pf->lock);
         if (PF_FAILURE(pfs)) {
             log_error("file_flush(PF fd %d): pf_flush returned %s\n", fd, pf_strerror(pfs));
             return -PAL_ERROR_DENIED;
@@ -579,11 +1084,49 @@ static inline void file_attrcopy(PAL_STREAM_ATTR* attr, struct stat* stat) {
     attr->pending_size = stat->st_size;
 }
 
+static void pf_cache_attr(struct protected_file* pf, const PAL_STREAM_ATTR* attr,
+                          const struct stat* stat) {
+    assert(spinlock_is_locked(&pf->lock));
+    pf->cached_attr          = *attr;
+    pf->cached_host_size     = stat->st_size;
+    pf->cached_host_mtime_ns = stat->st_mtime * TIME_NS_IN_S + stat->st_mtime_nsec;
+    pf->attr_cached          = true;
+}
+
+/* Fill `attr` from the cache if possible; with the PF opened, this needs no host access at all */
+static bool pf_get_cached_attr(struct protected_file* pf, PAL_STREAM_ATTR* attr) {
+    bool found = false;
+
+    spinlock_lock(&pf->lock);
+    if (pf->attr_cached && pf->context) {
+        *attr = pf->cached_attr;
+
+        uint64_t size;
+        pf_status_t pfs = pf_get_size(pf->context, &size);
+        __UNUSED(pfs);
+        assert(PF_SUCCESS(pfs));
+        attr->pending_size = size;
+        found = true;
+    }
+    spinlock_unlock(&pf->lock);
+    return found;
+}
+
 static int pf_file_attrquery(struct protected_file* pf, int fd_from_attrquery, const char* path,
-                             uint64_t real_size, PAL_STREAM_ATTR* attr) {
-    pf = load_protected_file(path, &fd_from_attrquery, real_size, PF_FILE_MODE_READ,
-                             /*create=*/false, pf);
-    if (!pf) {
+                             struct stat* stat, PAL_STREAM_ATTR* attr) {
+    spinlock_lock(&pf->lock);
+    if (pf->attr_cached && !pf->context && pf->cached_host_size == (uint64_t)stat->st_size
+            && pf->cached_host_mtime_ns == stat->st_mtime * TIME_NS_IN_S + stat->st_mtime_nsec) {
+        /* the host file didn't change since we last looked into it, skip reading its metadata */
+        attr->pending_size = pf->cached_attr.pending_size;
+        pf_cache_attr(pf, attr, stat);
+        spinlock_unlock(&pf->lock);
+        return 0;
+    }
+
+    if (!load_protected_file(path, &fd_from_attrquery, stat->st_size, PF_FILE_MODE_READ,
+                             /*create=*/false, pf)) {
+        spinlock_unlock(&pf->lock);
         log_error("pf_file_attrquery: load_protected_file(%s, %d) failed\n", path,
                   fd_from_attrquery);
         /* The call above will fail for PFs that were tampered with or have a wrong path.
@@ -598,16 +1141,17 @@ static int pf_file_attrquery(struct protected_file* pf, int fd_from_attrquery, c
     __UNUSED(pfs);
     assert(PF_SUCCESS(pfs));
     attr->pending_size = size;
+    pf_cache_attr(pf, attr, stat);
 
     pf_handle_t pf_handle;
     pfs = pf_get_handle(pf->context, &pf_handle);
     assert(PF_SUCCESS(pfs));
 
     if (fd_from_attrquery == *(int*)pf_handle) { /* this is a PF opened just for us, close it */
-        pfs = pf_close(pf->context);
-        pf->context = NULL;
+        pfs = close_protected_file(pf);
         assert(PF_SUCCESS(pfs));
     }
+    spinlock_unlock(&pf->lock);
 
     return 0;
 }
@@ -617,15 +1161,41 @@ static int file_attrquery(const char* type, const char* uri, PAL_STREAM_ATTR* at
     if (strcmp(type, URI_TYPE_FILE) && strcmp(type, URI_TYPE_DIR))
         return -PAL_ERROR_INVAL;
 
+    size_t len = URI_MAX;
+    char* path = malloc(len);
+    if (!path)
+        return -PAL_ERROR_NOMEM;
+
+    int ret = get_norm_path(uri, path, &len);
+    if (ret < 0) {
+        log_error("Could not normalize path (%s): %s\n", uri, pal_strerror(ret));
+        free(path);
+        return ret;
+    }
+
+    /* For protected files return the data size, not real FS size */
+    struct protected_file* pf = get_protected_file(path);
+    if (pf && pf_get_cached_attr(pf, attr)) {
+        free(path);
+        return 0;
+    }
+
+    /* trusted files are answered from their verified state, the host is not asked at all */
+    if (!pf && get_trusted_file_attr(path, attr)) {
+        free(path);
+        return 0;
+    }
+
     /* open the file with O_NONBLOCK to avoid blocking the current thread if it is actually a FIFO
      * pipe; O_NONBLOCK will be reset below if it is a regular file */
     int fd = ocall_open(uri, O_NONBLOCK, 0);
-    if (fd < 0)
+    if (fd < 0) {
+        free(path);
         return unix_to_pal_error(fd);
+    }
 
-    char* path = NULL;
     struct stat stat_buf;
-    int ret = ocall_fstat(fd, &stat_buf);
+    ret = ocall_fstat(fd, &stat_buf);
 
     /* if it failed, return the right error code */
     if (ret < 0) {
@@ -635,16 +1205,6 @@ static int file_attrquery(const char* type, const char* uri, PAL_STREAM_ATTR* at
 
     file_attrcopy(attr, &stat_buf);
 
-    size_t len = URI_MAX;
-    path = malloc(len);
-    ret = get_norm_path(uri, path, &len);
-    if (ret < 0) {
-        log_error("Could not normalize path (%s): %s\n", uri, pal_strerror(ret));
-        goto out;
-    }
-
-    /* For protected files return the data size, not real FS size */
-    struct protected_file* pf = get_protected_file(path);
     if (pf && attr->handle_type != pal_type_dir) {
         /* protected files should be regular files */
         if (S_ISFIFO(stat_buf.st_mode)) {
@@ -660,7 +1220,7 @@ static int file_attrquery(const char* type, const char* uri, PAL_STREAM_ATTR* at
             goto out;
         }
 
-        ret = pf_file_attrquery(pf, fd, path, stat_buf.st_size, attr);
+        ret = pf_file_attrquery(pf, fd, path, &stat_buf, attr);
     } else {
         ret = 0;
     }
@@ -674,8 +1234,15 @@ out:
 /* 'attrquerybyhdl' operation for file streams */
 static int file_attrquerybyhdl(PAL_HANDLE handle, PAL_STREAM_ATTR* attr) {
     int fd = handle->file.fd;
-    struct stat stat_buf;
+    struct protected_file* pf = find_protected_file_handle(handle);
+    if (pf && pf_get_cached_attr(pf, attr))
+        return 0;
 
+    if ((handle->file.pending_open || handle->file.chunk_hashes)
+            && get_trusted_file_attr(handle->file.realpath, attr))
+        return 0;
+
+    struct stat stat_buf;
     int ret = ocall_fstat(fd, &stat_buf);
     if (ret < 0)
         return unix_to_pal_error(ret);
@@ -684,28 +1251,41 @@ static int file_attrquerybyhdl(PAL_HANDLE handle, PAL_STREAM_ATTR* attr) {
 
     if (attr->handle_type != pal_type_dir) {
         /* For protected files return the data size, not real FS size */
-        struct protected_file* pf = find_protected_file_handle(handle);
         if (pf) {
             /* protected files should be regular files (seekable) */
             if (!handle->file.seekable)
                 return -PAL_ERROR_DENIED;
 
             uint64_t size;
+            spinlock_lock(&pf->lock);
             pf_status_t pfs = pf_get_size(pf->context, &size);
             __UNUSED(pfs);
             assert(PF_SUCCESS(pfs));
             attr->pending_size = size;
+            pf_cache_attr(pf, attr, &stat_buf);
+            spinlock_unlock(&pf->lock);
         }
     }
     return 0;
 }
 
 static int file_attrsetbyhdl(PAL_HANDLE handle, PAL_STREAM_ATTR* attr) {
-    int fd  = handle->file.fd;
-    int ret = ocall_fchmod(fd, attr->share_flags | PERM_rw_______);
+    int ret = file_open_pending(handle);
+    if (ret < 0)
+        return ret;
+
+    int fd = handle->file.fd;
+    ret = ocall_fchmod(fd, attr->share_flags | PERM_rw_______);
     if (ret < 0)
         return unix_to_pal_error(ret);
 
+    struct protected_file* pf = find_protected_file_handle(handle);
+    if (pf) {
+        spinlock_lock(&pf->lock);
+        pf->attr_cached = false;
+        spinlock_unlock(&pf->lock);
+    }
+
     return 0;
 }
 
@@ -723,6 +1303,14 @@ static int file_rename(PAL_HANDLE handle, const char* type, const char* uri) {
         return unix_to_pal_error(ret);
     }
 
+    /* the cached attributes belong to the old path now */
+    struct protected_file* pf = find_protected_file_handle(handle);
+    if (pf) {
+        spinlock_lock(&pf->lock);
+        pf->attr_cached = false;
+        spinlock_unlock(&pf->lock);
+    }
+
     /* initial realpath is part of handle object and will be freed with it */
     if (handle->file.realpath && handle->file.realpath != (void*)handle + HANDLE_SIZE(file)) {
         free((void*)handle->file.realpath);
@@ -756,10 +1344,15 @@ struct handle_ops g_file_ops = {
     .open           = &file_open,
     .read           = &file_read,
     .write          = &file_write,
+    .readv          = &file_readv,
+    .writev         = &file_writev,
+    .copyfile       = &file_copyfile,
     .close          = &file_close,
     .delete         = &file_delete,
     .map            = &file_map,
     .setlength      = &file_setlength,
+    .allocate       = &file_allocate,
+    .advise         = &file_advise,
     .flush          = &file_flush,
     .attrquery      = &file_attrquery,
     .attrquerybyhdl = &file_attrquerybyhdl,
@@ -804,6 +1397,7 @@ static int dir_open(PAL_HANDLE* handle, const char* type, const char* uri, int a
     memcpy(path, uri, len + 1);
     hdl->dir.realpath    = (PAL_STR)path;
     hdl->dir.buf         = (PAL_PTR)NULL;
+    hdl->dir.buf_size    = 0;
     hdl->dir.ptr         = (PAL_PTR)NULL;
     hdl->dir.end         = (PAL_PTR)NULL;
     hdl->dir.endofstream = PAL_FALSE;
@@ -811,7 +1405,11 @@ static int dir_open(PAL_HANDLE* handle, const char* type, const char* uri, int a
     return 0;
 }
 
-#define DIRBUF_SIZE 1024
+/* Every refill of the buffer is an ocall, so the buffer starts small and grows while the directory
+ * keeps filling it (i.e. is large). */
+#define DIRBUF_SIZE     1024
+#define DIRBUF_MAX_SIZE (64 * 1024)
+
 static inline bool is_dot_or_dotdot(const char* name) {
     return (name[0] == '.' && !name[1]) || (name[0] == '.' && name[1] == '.' && !name[2]);
 }
@@ -868,9 +1466,21 @@ static int64_t dir_read(PAL_HANDLE handle, uint64_t offset, size_t count, void*
             if (!handle->dir.buf) {
                 return -PAL_ERROR_NOMEM;
             }
+            handle->dir.buf_size = DIRBUF_SIZE;
+        } else if (handle->dir.buf_size < DIRBUF_MAX_SIZE
+                       && (size_t)((char*)handle->dir.end - (char*)handle->dir.buf)
+                              > handle->dir.buf_size / 2) {
+            /* the previous batch filled most of the buffer, more entries are likely to follow;
+             * all entries of the old buffer were consumed at this point */
+            void* new_buf = malloc(handle->dir.buf_size * 2);
+            if (new_buf) {
+                free((void*)handle->dir.buf);
+                handle->dir.buf = handle->dir.ptr = handle->dir.end = (PAL_PTR)new_buf;
+                handle->dir.buf_size *= 2;
+            }
         }
 
-        int size = ocall_getdents(handle->dir.fd, handle->dir.buf, DIRBUF_SIZE);
+        int size = ocall_getdents(handle->dir.fd, handle->dir.buf, handle->dir.buf_size);
         if (size < 0) {
             /*
              * If something was written just return that and pretend no error
@@ -904,6 +1514,7 @@ static int dir_close(PAL_HANDLE handle) {
     if (handle->dir.buf) {
         free((void*)handle->dir.buf);
         handle->dir.buf = handle->dir.ptr = handle->dir.end = (PAL_PTR)NULL;
+        handle->dir.buf_size = 0;
     }
 
     /* initial realpath is part of handle object and will be freed with it */
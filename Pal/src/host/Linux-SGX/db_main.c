@@ -19,6 +19,7 @@
 #include "ecall_types.h"
 #include "elf/elf.h"
 #include "enclave_pages.h"
+#include "ocall_types.h"
 #include "pal.h"
 #include "pal_defs.h"
 #include "pal_error.h"
@@ -27,6 +28,7 @@
 #include "pal_linux_defs.h"
 #include "pal_security.h"
 #include "protected_files.h"
+#include "rpc_queue.h"
 #include "sysdeps/generic/ldsodefs.h"
 #include "toml.h"
 
@@ -43,6 +45,9 @@ PAL_SESSION_KEY g_master_key = {0};
  * limited by the variable below */
 size_t g_pal_internal_mem_size = 0;
 
+/* enclave-side copy of `sgx.enable_stats`, controls printing of enclave-side stats on exit */
+bool g_sgx_enable_stats = false;
+
 size_t g_page_size = PRESET_PAGESIZE;
 
 unsigned long _DkGetAllocationAlignment(void) {
@@ -520,6 +525,67 @@ extern void* g_enclave_top;
 
 /* Graphene uses GCC's stack protector that looks for a canary at gs:[0x8], but this function starts
  * with a default canary and then updates it to a random one, so we disable stack protector here */
+/*
+ * Pre-faulting of all heap pages (`sgx.preheat_enclave`). The heap is split into chunks which
+ * threads claim from the top of the heap downwards, i.e., in the same order in which the enclave
+ * page allocator hands out memory. The main thread either takes part and waits until all chunks
+ * are done, or (in background mode) leaves the work to helper threads and starts the application
+ * right away, so that pages are faulted in ahead of the allocations.
+ */
+#define PREHEAT_CHUNK_SIZE (2UL * 1024 * 1024)
+
+static size_t g_preheat_next_chunk = 0;
+static size_t g_preheat_helpers_running = 0;
+
+static void preheat_heap_chunks(void) {
+    uint8_t* heap_min = g_pal_sec.heap_min;
+    uint8_t* heap_max = g_pal_sec.heap_max;
+    size_t chunks_num = ((size_t)(heap_max - heap_min) + PREHEAT_CHUNK_SIZE - 1) / PREHEAT_CHUNK_SIZE;
+
+    while (true) {
+        size_t chunk = __atomic_fetch_add(&g_preheat_next_chunk, 1, __ATOMIC_RELAXED);
+        if (chunk >= chunks_num)
+            break;
+
+        uint8_t* top    = heap_max - chunk * PREHEAT_CHUNK_SIZE;
+        uint8_t* bottom = top - MIN((size_t)PREHEAT_CHUNK_SIZE, (size_t)(top - heap_min));
+        for (uint8_t* i = bottom; i < top; i += g_page_size)
+            READ_ONCE(*(size_t*)i);
+    }
+}
+
+static int preheat_helper_thread(void* arg) {
+    __UNUSED(arg);
+    preheat_heap_chunks();
+    __atomic_sub_fetch(&g_preheat_helpers_running, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static void preheat_heap(size_t threads_num, bool background) {
+    size_t helpers_num = background ? threads_num : threads_num - 1;
+
+    for (size_t i = 0; i < helpers_num; i++) {
+        PAL_HANDLE thread;
+        __atomic_add_fetch(&g_preheat_helpers_running, 1, __ATOMIC_RELAXED);
+        int ret = _DkThreadCreate(&thread, preheat_helper_thread, /*param=*/NULL);
+        if (ret < 0) {
+            __atomic_sub_fetch(&g_preheat_helpers_running, 1, __ATOMIC_RELAXED);
+            log_warning("Cannot create enclave preheating thread (%d), preheating with %lu "
+                        "threads\n", ret, background ? i : i + 1);
+            break;
+        }
+    }
+
+    bool helpers_started = __atomic_load_n(&g_preheat_helpers_running, __ATOMIC_RELAXED) > 0;
+    if (background && helpers_started)
+        return;
+
+    /* synchronous mode (or no helper could be started in background mode) */
+    preheat_heap_chunks();
+    while (__atomic_load_n(&g_preheat_helpers_running, __ATOMIC_ACQUIRE))
+        CPU_RELAX();
+}
+
 __attribute__((__optimize__("-fno-stack-protector")))
 noreturn void pal_linux_main(char* uptr_libpal_uri, size_t libpal_uri_len, char* uptr_args,
                              size_t args_size, char* uptr_env, size_t env_size,
@@ -618,6 +684,7 @@ noreturn void pal_linux_main(char* uptr_libpal_uri, size_t libpal_uri_len, char*
     init_untrusted_slab_mgr();
     init_enclave_pages();
     init_cpuid();
+    init_xsave_xinuse();
 
     /* now we can add a link map for PAL itself */
     setup_pal_map(&g_pal_map);
@@ -704,6 +771,20 @@ noreturn void pal_linux_main(char* uptr_libpal_uri, size_t libpal_uri_len, char*
     g_pal_state.raw_manifest_data = manifest_addr;
     g_pal_state.manifest_root = manifest_root;
 
+    /* times of the untrusted loader are only used for the statistics, so they aren't checked */
+    static const char* host_startup_phases[SGX_STARTUP_PHASES_NUM] = {
+        [SGX_STARTUP_LOADER_START]     = "start",
+        [SGX_STARTUP_ENCLAVE_CREATION] = "enclave creation",
+        [SGX_STARTUP_PAGES_ADDING]     = "enclave pages adding",
+        [SGX_STARTUP_ENCLAVE_INIT]     = "enclave initialization",
+        [SGX_STARTUP_UNTRUSTED_PAL]    = "untrusted PAL initialization",
+    };
+    for (size_t i = 0; i < SGX_STARTUP_PHASES_NUM; i++)
+        if (sec_info.startup_times[i])
+            add_startup_phase(host_startup_phases[i], sec_info.startup_times[i]);
+    add_startup_phase("enclave entry", start_time);
+    add_startup_phase("manifest parsing", /*time=*/0);
+
     bool preheat_enclave;
     ret = toml_bool_in(g_pal_state.manifest_root, "sgx.preheat_enclave", /*defaultval=*/false,
                        &preheat_enclave);
@@ -711,11 +792,79 @@ noreturn void pal_linux_main(char* uptr_libpal_uri, size_t libpal_uri_len, char*
         log_error("Cannot parse \'sgx.preheat_enclave\' (the value must be `true` or `false`)\n");
         ocall_exit(1, true);
     }
-    if (preheat_enclave) {
-        for (uint8_t* i = g_pal_sec.heap_min; i < (uint8_t*)g_pal_sec.heap_max; i += g_page_size)
-            READ_ONCE(*(size_t*)i);
+    if (preheat_enclave && GET_ENCLAVE_TLS(edmm_enabled)) {
+        log_error("'sgx.preheat_enclave' cannot be used together with 'sgx.edmm_enable'\n");
+        ocall_exit(1, true);
+    }
+
+    int64_t preheat_enclave_threads;
+    ret = toml_int_in(g_pal_state.manifest_root, "sgx.preheat_enclave_threads", /*defaultval=*/1,
+                      &preheat_enclave_threads);
+    if (ret < 0 || preheat_enclave_threads < 1) {
+        log_error("Cannot parse \'sgx.preheat_enclave_threads\' "
+                  "(the value must be a positive integer)\n");
+        ocall_exit(1, true);
     }
 
+    bool preheat_enclave_background;
+    ret = toml_bool_in(g_pal_state.manifest_root, "sgx.preheat_enclave_background",
+                       /*defaultval=*/false, &preheat_enclave_background);
+    if (ret < 0) {
+        log_error("Cannot parse \'sgx.preheat_enclave_background\' "
+                  "(the value must be `true` or `false`)\n");
+        ocall_exit(1, true);
+    }
+
+    ret = toml_bool_in(g_pal_state.manifest_root, "sgx.enable_stats", /*defaultval=*/false,
+                       &g_sgx_enable_stats);
+    if (ret < 0) {
+        log_error("Cannot parse \'sgx.enable_stats\' (the value must be `true` or `false`)\n");
+        ocall_exit(1, true);
+    }
+
+    int64_t rpc_enclave_spin_max;
+    ret = toml_int_in(g_pal_state.manifest_root, "sgx.rpc_enclave_spin_max",
+                      /*defaultval=*/RPC_SPINLOCK_TIMEOUT, &rpc_enclave_spin_max);
+    if (ret < 0 || rpc_enclave_spin_max < 0) {
+        log_error("Cannot parse \'sgx.rpc_enclave_spin_max\' "
+                  "(the value must be a non-negative integer)\n");
+        ocall_exit(1, true);
+    }
+    g_rpc_enclave_spin_max = rpc_enclave_spin_max;
+
+    int64_t accept_batch_size;
+    ret = toml_int_in(g_pal_state.manifest_root, "sgx.accept_batch_size", /*defaultval=*/1,
+                      &accept_batch_size);
+    if (ret < 0 || accept_batch_size < 1 || accept_batch_size > OCALL_ACCEPT_MAX) {
+        log_error("Cannot parse \'sgx.accept_batch_size\' "
+                  "(the value must be an integer from 1 to %d)\n", OCALL_ACCEPT_MAX);
+        ocall_exit(1, true);
+    }
+    g_accept_batch_size = accept_batch_size;
+
+    int64_t event_spin_max;
+    ret = toml_int_in(g_pal_state.manifest_root, "sgx.event_spin_max",
+                      /*defaultval=*/EVENT_SPIN_MAX_DEFAULT, &event_spin_max);
+    if (ret < 0 || event_spin_max < 0 || (event_spin_max > 0 && event_spin_max < EVENT_SPIN_MIN)
+            || event_spin_max > INT32_MAX) {
+        log_error("Cannot parse \'sgx.event_spin_max\' "
+                  "(the value must be 0 or an integer from %u to %d)\n", EVENT_SPIN_MIN, INT32_MAX);
+        ocall_exit(1, true);
+    }
+    g_event_spin_max = event_spin_max;
+
+    uint64_t io_buffer_size;
+    ret = toml_sizestring_in(g_pal_state.manifest_root, "sgx.io_buffer_size",
+                             /*defaultval=*/DEFAULT_IO_BUFFER_SIZE, &io_buffer_size);
+    if (ret < 0) {
+        log_error("Cannot parse \'sgx.io_buffer_size\' "
+                  "(the value must be put in double quotes!)\n");
+        ocall_exit(1, true);
+    }
+    g_io_buffer_size = ALLOC_ALIGN_UP(io_buffer_size);
+    if ((ret = init_io_buffers()) < 0)
+        log_warning("Failed to map untrusted I/O buffers: %d\n", ret);
+
     ret = toml_sizestring_in(g_pal_state.manifest_root, "loader.pal_internal_mem_size",
                              /*defaultval=*/0, &g_pal_internal_mem_size);
     if (ret < 0) {
@@ -724,6 +873,17 @@ noreturn void pal_linux_main(char* uptr_libpal_uri, size_t libpal_uri_len, char*
         ocall_exit(1, true);
     }
 
+    uint64_t enclave_page_cache_size;
+    ret = toml_sizestring_in(g_pal_state.manifest_root, "sgx.enclave_page_cache_size",
+                             /*defaultval=*/DEFAULT_ENCLAVE_PAGE_CACHE_SIZE,
+                             &enclave_page_cache_size);
+    if (ret < 0) {
+        log_error("Cannot parse \'sgx.enclave_page_cache_size\' "
+                  "(the value must be put in double quotes!)\n");
+        ocall_exit(1, true);
+    }
+    g_enclave_page_cache_size = ALLOC_ALIGN_UP(enclave_page_cache_size);
+
     if ((ret = init_trusted_files()) < 0) {
         log_error("Failed to load the checksums of trusted files: %d\n", ret);
         ocall_exit(1, true);
@@ -738,6 +898,7 @@ noreturn void pal_linux_main(char* uptr_libpal_uri, size_t libpal_uri_len, char*
         log_error("Failed to initialize protected files: %d\n", ret);
         ocall_exit(1, true);
     }
+    add_startup_phase("trusted and protected files setup", /*time=*/0);
 
     /* set up thread handle */
     PAL_HANDLE first_thread = malloc(HANDLE_SIZE(thread));
@@ -758,6 +919,10 @@ noreturn void pal_linux_main(char* uptr_libpal_uri, size_t libpal_uri_len, char*
 
     g_pal_enclave_state.enclave_flags |= PAL_ENCLAVE_INITIALIZED;
 
+    /* helper threads can be started only after the enclave is marked as initialized */
+    if (preheat_enclave)
+        preheat_heap(preheat_enclave_threads, preheat_enclave_background);
+
     /* call main function */
     pal_main(g_pal_sec.instance_id, parent, first_thread, arguments, environments);
 }
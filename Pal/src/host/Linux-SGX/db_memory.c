@@ -31,6 +31,15 @@ bool _DkCheckMemoryMappable(const void* addr, size_t size) {
     return false;
 }
 
+/* EAUGed pages are already zeroed */
+static int lazy_zero_populate(void* arg, size_t offset, void* addr, size_t size) {
+    __UNUSED(arg);
+    __UNUSED(offset);
+    __UNUSED(addr);
+    __UNUSED(size);
+    return 0;
+}
+
 int _DkVirtualMemoryAlloc(void** paddr, uint64_t size, int alloc_type, int prot) {
     __UNUSED(prot);
 
@@ -47,6 +56,17 @@ int _DkVirtualMemoryAlloc(void** paddr, uint64_t size, int alloc_type, int prot)
         return -PAL_ERROR_INVAL;
     }
 
+    if ((alloc_type & PAL_ALLOC_LAZY) && !(alloc_type & PAL_ALLOC_INTERNAL)) {
+        /* falls back to committing all pages below if EDMM is not available */
+        void* mem = get_enclave_pages_lazy(addr, size, g_page_size, /*unit_offset=*/0,
+                                           /*max_readaround=*/0, lazy_zero_populate,
+                                           /*release=*/NULL, /*arg=*/NULL);
+        if (mem) {
+            *paddr = mem;
+            return 0;
+        }
+    }
+
     void* mem = get_enclave_pages(addr, size, alloc_type & PAL_ALLOC_INTERNAL);
     if (!mem)
         return addr ? -PAL_ERROR_DENIED : -PAL_ERROR_NOMEM;
@@ -86,6 +106,22 @@ int _DkVirtualMemoryProtect(void* addr, uint64_t size, int prot) {
     return 0;
 }
 
+int _DkVirtualMemoryMove(void* old_addr, void* new_addr, uint64_t size) {
+    if (!sgx_is_completely_within_enclave(old_addr, size)
+            || !sgx_is_completely_within_enclave(new_addr, size)) {
+        /* untrusted memory is only mapped by PAL internals, which never move it */
+        return -PAL_ERROR_NOTIMPLEMENTED;
+    }
+    return move_enclave_pages(old_addr, new_addr, size);
+}
+
+int _DkVirtualMemoryDiscard(void* addr, uint64_t size, bool lazy) {
+    if (!sgx_is_completely_within_enclave(addr, size)) {
+        return -PAL_ERROR_INVAL;
+    }
+    return discard_enclave_pages(addr, size, lazy);
+}
+
 uint64_t _DkMemoryQuota(void) {
     return g_pal_sec.heap_max - g_pal_sec.heap_min;
 }
@@ -94,3 +130,7 @@ uint64_t _DkMemoryAvailableQuota(void) {
     return (g_pal_sec.heap_max - g_pal_sec.heap_min) -
            __atomic_load_n(&g_allocated_pages.counter, __ATOMIC_SEQ_CST) * g_page_size;
 }
+
+uint64_t _DkMemoryResidentSize(void) {
+    return get_enclave_resident_size();
+}
@@ -11,6 +11,7 @@
 
 #include "api.h"
 #include "cpu.h"
+#include "crypto.h"
 #include "gsgx.h"
 #include "linux_utils.h"
 #include "pal.h"
@@ -109,59 +110,6 @@ int _DkSystemTimeQuery(uint64_t* out_usec) {
     return 0;
 }
 
-#define CPUID_CACHE_SIZE 64 /* cache only 64 distinct CPUID entries; sufficient for most apps */
-static struct pal_cpuid {
-    unsigned int leaf, subleaf;
-    unsigned int values[4];
-} g_pal_cpuid_cache[CPUID_CACHE_SIZE];
-
-static int g_pal_cpuid_cache_top   = 0;
-static spinlock_t g_cpuid_cache_lock = INIT_SPINLOCK_UNLOCKED;
-
-static int get_cpuid_from_cache(unsigned int leaf, unsigned int subleaf, unsigned int values[4]) {
-    int ret = -PAL_ERROR_DENIED;
-
-    spinlock_lock(&g_cpuid_cache_lock);
-    for (int i = 0; i < g_pal_cpuid_cache_top; i++) {
-        if (g_pal_cpuid_cache[i].leaf == leaf && g_pal_cpuid_cache[i].subleaf == subleaf) {
-            values[0] = g_pal_cpuid_cache[i].values[0];
-            values[1] = g_pal_cpuid_cache[i].values[1];
-            values[2] = g_pal_cpuid_cache[i].values[2];
-            values[3] = g_pal_cpuid_cache[i].values[3];
-            ret = 0;
-            break;
-        }
-    }
-    spinlock_unlock(&g_cpuid_cache_lock);
-    return ret;
-}
-
-static void add_cpuid_to_cache(unsigned int leaf, unsigned int subleaf, unsigned int values[4]) {
-    spinlock_lock(&g_cpuid_cache_lock);
-
-    struct pal_cpuid* chosen = NULL;
-    if (g_pal_cpuid_cache_top < CPUID_CACHE_SIZE) {
-        for (int i = 0; i < g_pal_cpuid_cache_top; i++) {
-            if (g_pal_cpuid_cache[i].leaf == leaf && g_pal_cpuid_cache[i].subleaf == subleaf) {
-                /* this CPUID entry is already present in the cache, no need to add */
-                break;
-            }
-        }
-        chosen = &g_pal_cpuid_cache[g_pal_cpuid_cache_top++];
-    }
-
-    if (chosen) {
-        chosen->leaf      = leaf;
-        chosen->subleaf   = subleaf;
-        chosen->values[0] = values[0];
-        chosen->values[1] = values[1];
-        chosen->values[2] = values[2];
-        chosen->values[3] = values[3];
-    }
-
-    spinlock_unlock(&g_cpuid_cache_lock);
-}
-
 static inline uint32_t extension_enabled(uint32_t xfrm, uint32_t bit_idx) {
     uint32_t feature_bit = 1U << bit_idx;
     return xfrm & feature_bit;
@@ -171,14 +119,6 @@ static __sgx_mem_aligned sgx_report_t report;
 static __sgx_mem_aligned sgx_target_info_t target_info;
 static __sgx_mem_aligned sgx_report_data_t report_data;
 
-/* Initialize the data structures used for CPUID emulation. */
-void init_cpuid(void) {
-    memset(&report, 0, sizeof(report));
-    memset(&target_info, 0, sizeof(target_info));
-    memset(&report_data, 0, sizeof(report_data));
-    sgx_report(&target_info, &report_data, &report);
-}
-
 /**
  * Sanity check untrusted CPUID inputs.
  *
@@ -336,6 +276,102 @@ static const struct cpuid_leaf cpuid_known_leaves[] = {
     {.leaf = 0x80000008, .zero_subleaf = true, .cache = true}, /* Virtual/Physical Address Sizes */
 };
 
+/* CPUID values of the `.cache = true` leaves, directly indexed by leaf and subleaf. The subleaves
+ * which exist on this CPU are filled in by init_cpuid() before any other thread starts, after that
+ * the table is read-only and needs no locking. Leaves and subleaves outside of it or not filled in
+ * (rarely used ones) are retrieved from the host on each use. */
+#define CPUID_BASIC_LEAVES    0x20
+#define CPUID_EXTENDED_BASE   0x80000000
+#define CPUID_EXTENDED_LEAVES 0x09
+#define CPUID_TABLE_SUBLEAVES 32
+
+static struct cpuid_entry {
+    bool valid;
+    unsigned int values[4];
+} g_cpuid_table[CPUID_BASIC_LEAVES + CPUID_EXTENDED_LEAVES][CPUID_TABLE_SUBLEAVES];
+
+static struct cpuid_entry* cpuid_table_entry(unsigned int leaf, unsigned int subleaf) {
+    if (subleaf >= CPUID_TABLE_SUBLEAVES)
+        return NULL;
+    if (leaf < CPUID_BASIC_LEAVES)
+        return &g_cpuid_table[leaf][subleaf];
+    if (leaf >= CPUID_EXTENDED_BASE && leaf < CPUID_EXTENDED_BASE + CPUID_EXTENDED_LEAVES)
+        return &g_cpuid_table[CPUID_BASIC_LEAVES + leaf - CPUID_EXTENDED_BASE][subleaf];
+    return NULL;
+}
+
+static void fill_cpuid_entry(unsigned int leaf, unsigned int subleaf) {
+    struct cpuid_entry* entry = cpuid_table_entry(leaf, subleaf);
+    assert(entry);
+    if (ocall_cpuid(leaf, subleaf, entry->values) < 0)
+        return;
+    sanity_check_cpuid(leaf, subleaf, entry->values);
+    entry->valid = true;
+}
+
+/* Initialize the data structures used for CPUID emulation. */
+void init_cpuid(void) {
+    memset(&report, 0, sizeof(report));
+    memset(&target_info, 0, sizeof(target_info));
+    memset(&report_data, 0, sizeof(report_data));
+    sgx_report(&target_info, &report_data, &report);
+
+    fill_cpuid_entry(0x00, 0);
+    fill_cpuid_entry(CPUID_EXTENDED_BASE, 0);
+    struct cpuid_entry* basic = cpuid_table_entry(0x00, 0);
+    struct cpuid_entry* extended = cpuid_table_entry(CPUID_EXTENDED_BASE, 0);
+    unsigned int max_basic = basic->valid ? basic->values[CPUID_WORD_EAX] : 0;
+    unsigned int max_extended = extended->valid ? extended->values[CPUID_WORD_EAX] : 0;
+
+    for (size_t i = 0; i < ARRAY_SIZE(cpuid_known_leaves); i++) {
+        unsigned int leaf = cpuid_known_leaves[i].leaf;
+        if (!cpuid_known_leaves[i].cache || leaf == 0x00 || leaf == CPUID_EXTENDED_BASE)
+            continue;
+        if (leaf < CPUID_EXTENDED_BASE ? leaf > max_basic : leaf > max_extended)
+            continue;
+
+        fill_cpuid_entry(leaf, 0);
+        struct cpuid_entry* first = cpuid_table_entry(leaf, 0);
+        if (cpuid_known_leaves[i].zero_subleaf || !first->valid)
+            continue;
+
+        /* the subleaves (besides 0) this leaf has on this CPU, as far as the table reaches */
+        unsigned int subleaves = 0;
+        switch (leaf) {
+            case 0x07:
+            case 0x0F:
+            case 0x14:
+                subleaves = 2;
+                break;
+            case 0x10:
+                subleaves = 3;
+                break;
+            case 0x12:
+                /* SGX capabilities, attributes and the first EPC section */
+                subleaves = 3;
+                break;
+            case 0x17:
+            case 0x18:
+                /* EAX of subleaf 0 is the highest subleaf */
+                subleaves = first->values[CPUID_WORD_EAX] + 1;
+                break;
+            case 0x0D: {
+                /* subleaf 1 and the subleaves of the XSAVE state components supported */
+                uint64_t components = first->values[CPUID_WORD_EAX]
+                                      | (uint64_t)first->values[CPUID_WORD_EDX] << 32;
+                fill_cpuid_entry(leaf, 1);
+                for (unsigned int subleaf = 2; subleaf < CPUID_TABLE_SUBLEAVES; subleaf++)
+                    if (components & (1UL << subleaf))
+                        fill_cpuid_entry(leaf, subleaf);
+                continue;
+            }
+        }
+        for (unsigned int subleaf = 1; subleaf < subleaves && subleaf < CPUID_TABLE_SUBLEAVES;
+             subleaf++)
+            fill_cpuid_entry(leaf, subleaf);
+    }
+}
+
 int _DkCpuIdRetrieve(unsigned int leaf, unsigned int subleaf, unsigned int values[4]) {
     /* leaves 0x40000000 to 0x4FFFFFFF are used by virtualization software (KVM, Hyper-V, etc.),
      * they return all zeros on bare metal; runtimes like JVM query these leaves to learn about
@@ -371,17 +407,18 @@ int _DkCpuIdRetrieve(unsigned int leaf, unsigned int subleaf, unsigned int value
     if (known_leaf->zero_subleaf)
         subleaf = 0;
 
-    if (known_leaf->cache && !get_cpuid_from_cache(leaf, subleaf, values))
-        return 0;
+    if (known_leaf->cache) {
+        struct cpuid_entry* entry = cpuid_table_entry(leaf, subleaf);
+        if (entry && entry->valid) {
+            memcpy(values, entry->values, sizeof(entry->values));
+            return 0;
+        }
+    }
 
     if (ocall_cpuid(leaf, subleaf, values) < 0)
         return -PAL_ERROR_DENIED;
 
     sanity_check_cpuid(leaf, subleaf, values);
-
-    if (known_leaf->cache)
-        add_cpuid_to_cache(leaf, subleaf, values);
-
     return 0;
 fail:
     log_error("Unrecognized leaf/subleaf in CPUID (EAX=%u, ECX=%u). Exiting...\n", leaf,
@@ -745,6 +782,8 @@ int _DkGetCPUInfo(PAL_CPU_INFO* ci) {
         log_warning("bogomips could not be retrieved, passing 0.0 to the application\n");
     }
 
+    ci->tsc_hz = g_tsc_hz;
+
     return rv;
 out_flags:
     free(flags);
@@ -767,15 +806,70 @@ int _DkGetTopologyInfo(PAL_TOPO_INFO* topo_info) {
     return 0;
 }
 
-int _DkRandomBitsRead(void* buffer, size_t size) {
+/*
+ * Random bits come from a per-thread DRBG (AES-256 CTR_DRBG), seeded from RDRAND and reseeded after
+ * every DRBG_RESEED_INTERVAL requests (of at most 1KB each). RDRAND alone costs hundreds of cycles
+ * per 4 bytes and gets slower when many cores use it at once, which hurts applications pulling lots
+ * of randomness through getrandom() and /dev/urandom. The DRBG of a thread stays with its TCS and
+ * serves the next thread running on it. An in-enclave signal handler which interrupted the DRBG of
+ * its thread doesn't reenter it, but reads RDRAND directly.
+ */
+#define DRBG_RESEED_INTERVAL 1024
+
+struct enclave_drbg {
+    LIB_DRBG_CONTEXT ctx;
+    bool in_use;
+};
+
+static void rdrand_read(void* buffer, size_t size) {
     uint32_t rand;
     for (size_t i = 0; i < size; i += sizeof(rand)) {
         rand = rdrand();
         memcpy(buffer + i, &rand, MIN(sizeof(rand), size - i));
     }
+}
+
+static int rdrand_entropy(void* arg, uint8_t* buf, size_t size) {
+    __UNUSED(arg);
+    rdrand_read(buf, size);
     return 0;
 }
 
+static struct enclave_drbg* get_drbg(void) {
+    struct enclave_tls* tcb = get_tcb_trts();
+    if (tcb->drbg)
+        return tcb->drbg;
+
+    struct enclave_drbg* drbg = malloc(sizeof(*drbg));
+    if (!drbg)
+        return NULL;
+    /* in use until seeded, in case a signal handler wants random bits meanwhile */
+    drbg->in_use = true;
+    tcb->drbg = drbg;
+
+    int ret = lib_DRBGInit(&drbg->ctx, rdrand_entropy, /*arg=*/NULL, DRBG_RESEED_INTERVAL);
+    if (ret < 0) {
+        log_error("Cannot seed the DRBG: %d\n", ret);
+        tcb->drbg = NULL;
+        free(drbg);
+        return NULL;
+    }
+    __atomic_store_n(&drbg->in_use, false, __ATOMIC_RELEASE);
+    return drbg;
+}
+
+int _DkRandomBitsRead(void* buffer, size_t size) {
+    struct enclave_drbg* drbg = get_drbg();
+    if (!drbg || __atomic_exchange_n(&drbg->in_use, true, __ATOMIC_ACQUIRE)) {
+        rdrand_read(buffer, size);
+        return 0;
+    }
+
+    int ret = lib_DRBGRandom(&drbg->ctx, buffer, size);
+    __atomic_store_n(&drbg->in_use, false, __ATOMIC_RELEASE);
+    return ret;
+}
+
 int _DkSegmentRegisterGet(int reg, void** addr) {
     switch (reg) {
         case PAL_SEGMENT_FS:
@@ -13,6 +13,7 @@
 #include "api.h"
 #include "cpu.h"
 #include "crypto.h"
+#include "hex.h"
 #include "pal.h"
 #include "pal_defs.h"
 #include "pal_error.h"
@@ -63,6 +64,423 @@ fail:
     return ret;
 }
 
+/*
+ * Shared-memory transport of pipes.
+ *
+ * A `pipe:` connection opened with PAL_OPTION_PIPE_SHM (LibOS uses it for IPC) moves its data from
+ * the TLS session to two rings (one per direction) in untrusted memory shared by both processes,
+ * so that sending and receiving a message normally needs no OCALL at all. The connecting end
+ * creates the backing file and random AES-GCM keys and passes both to the other end over the
+ * freshly established TLS session, so the host learns nothing but the file. Each write is split
+ * into records: `uint32_t len`, `len` bytes of ciphertext and a GCM tag; the length is
+ * authenticated as AAD and the nonce is the record number, which both ends count on their own, so
+ * records cannot be modified, replayed, reordered or dropped without the reader noticing.
+ *
+ * The only shared variable is `fill`, the number of record bytes in the ring. Both ends update it
+ * with atomic RMW operations, which gives a single order of "ring became non-empty" (seen by the
+ * writer bringing `fill` from 0) and "ring became empty" events (seen by the reader bringing it to
+ * 0). The writer sends one doorbell byte over the host socket on every such "non-empty" event and
+ * the reader consumes one on every "empty" event (once it has also drained its decrypted
+ * leftovers). Hence the socket is readable exactly when there is something to read or the other
+ * end is gone, and poll() on the host FD (DkStreamsWaitEvents() etc.) keeps working unchanged.
+ * A writer that finds the ring full waits for space by polling the socket for hang-up.
+ *
+ * Everything read from untrusted memory (`fill`, record lengths) is validated and the ciphertext is
+ * copied into the enclave before decryption; read and write positions are kept in the enclave.
+ * Like the TLS session, a ring end must not be used by several threads at once.
+ */
+
+#define PIPE_RING_DATA_SIZE  (64 * 1024)
+#define PIPE_RING_RECORD_MAX 4096 /* max payload of one record */
+#define PIPE_RING_KEY_SIZE   16
+#define PIPE_RING_TAG_SIZE   16
+#define PIPE_RING_RECORD_OVERHEAD (sizeof(uint32_t) + PIPE_RING_TAG_SIZE)
+#define PIPE_RING_WAIT_US    1000 /* how long a writer sleeps waiting for space in a full ring */
+
+#define PIPE_RING_PATH_PREFIX "/dev/shm/graphene-pipe-"
+
+/* one direction of the transport, in untrusted memory */
+struct pipe_ring_shared {
+    uint64_t fill;
+    uint8_t pad[56];
+    uint8_t data[PIPE_RING_DATA_SIZE];
+};
+
+/* enclave state of one direction */
+struct pipe_ring_end {
+    struct pipe_ring_shared* shared;
+    uint64_t pos; /* offset of the next record to write (or read) in `shared->data` */
+    uint64_t seq; /* number of the next record, used as GCM nonce */
+    uint8_t key[PIPE_RING_KEY_SIZE];
+    /* encrypted (send end) or not yet authenticated (receive end) record */
+    uint8_t record[PIPE_RING_RECORD_OVERHEAD + PIPE_RING_RECORD_MAX];
+};
+
+struct pipe_ring {
+    void* mem; /* both `pipe_ring_shared`, in untrusted memory */
+    struct pipe_ring_end send;
+    struct pipe_ring_end recv;
+    /* ring drained to empty, but a doorbell byte is still to be consumed from the socket */
+    bool doorbell_owed;
+    /* decrypted payload of the last received record not yet returned to the reader */
+    size_t plain_off;
+    size_t plain_len;
+    uint8_t plain[PIPE_RING_RECORD_MAX];
+};
+
+#define PIPE_RING_MEM_SIZE ALIGN_UP(2 * sizeof(struct pipe_ring_shared), PRESET_PAGESIZE)
+
+/* sent by the connecting end over TLS right after the handshake */
+struct pipe_ring_setup {
+    uint32_t use_ring;
+    char path[sizeof(PIPE_RING_PATH_PREFIX) + 16];
+    /* key of the ring from the connecting end (first) and to it (second) */
+    uint8_t keys[2][PIPE_RING_KEY_SIZE];
+};
+
+static int secure_read_exact(PAL_HANDLE handle, void* buf, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        int ret = _DkStreamSecureRead(handle->pipe.ssl_ctx, (uint8_t*)buf + done, size - done,
+                                      /*is_blocking=*/true);
+        if (ret < 0)
+            return ret;
+        if (ret == 0)
+            return -PAL_ERROR_CONNFAILED_PIPE;
+        done += ret;
+    }
+    return 0;
+}
+
+static int secure_write_exact(PAL_HANDLE handle, const void* buf, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        int ret = _DkStreamSecureWrite(handle->pipe.ssl_ctx, (const uint8_t*)buf + done,
+                                       size - done, /*is_blocking=*/true);
+        if (ret < 0)
+            return ret;
+        done += ret;
+    }
+    return 0;
+}
+
+static void ring_copy_in(struct pipe_ring_shared* shared, uint64_t pos, const void* buf,
+                         size_t size) {
+    size_t first = MIN(size, PIPE_RING_DATA_SIZE - pos);
+    memcpy(&shared->data[pos], buf, first);
+    memcpy(&shared->data[0], (const uint8_t*)buf + first, size - first);
+}
+
+static void ring_copy_out(struct pipe_ring_shared* shared, uint64_t pos, void* buf, size_t size) {
+    size_t first = MIN(size, PIPE_RING_DATA_SIZE - pos);
+    memcpy(buf, &shared->data[pos], first);
+    memcpy((uint8_t*)buf + first, &shared->data[0], size - first);
+}
+
+static void ring_nonce(uint64_t seq, uint8_t nonce[12]) {
+    memset(nonce, 0, 12);
+    memcpy(nonce, &seq, sizeof(seq));
+}
+
+static struct pipe_ring* pipe_ring_create(void* mem, const uint8_t keys[2][PIPE_RING_KEY_SIZE],
+                                          bool is_initiator) {
+    struct pipe_ring* ring = calloc(1, sizeof(*ring));
+    if (!ring)
+        return NULL;
+
+    struct pipe_ring_shared* shared = mem;
+    ring->mem = mem;
+    ring->send.shared = &shared[is_initiator ? 0 : 1];
+    ring->recv.shared = &shared[is_initiator ? 1 : 0];
+    memcpy(ring->send.key, keys[is_initiator ? 0 : 1], PIPE_RING_KEY_SIZE);
+    memcpy(ring->recv.key, keys[is_initiator ? 1 : 0], PIPE_RING_KEY_SIZE);
+    return ring;
+}
+
+static void pipe_ring_destroy(struct pipe_ring* ring) {
+    ocall_munmap_untrusted(ring->mem, PIPE_RING_MEM_SIZE);
+    /* don't leave the keys behind in freed memory */
+    memset(ring, 0, sizeof(*ring));
+    free(ring);
+}
+
+static int map_ring_file(const char* path, bool create, void** out_mem) {
+    int fd = ocall_open(path, O_RDWR | (create ? O_CREAT | O_EXCL : 0), create ? 0600 : 0);
+    if (fd < 0)
+        return unix_to_pal_error(fd);
+
+    int ret;
+    if (create) {
+        ret = ocall_ftruncate(fd, PIPE_RING_MEM_SIZE);
+        if (ret < 0) {
+            ret = unix_to_pal_error(ret);
+            goto out;
+        }
+    }
+
+    void* mem = NULL;
+    ret = ocall_mmap_untrusted(&mem, PIPE_RING_MEM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                               /*offset=*/0);
+    if (ret < 0) {
+        ret = unix_to_pal_error(ret);
+        goto out;
+    }
+    *out_mem = mem;
+    ret = 0;
+out:
+    ocall_close(fd);
+    return ret;
+}
+
+/*
+ * Called by the connecting end after the TLS handshake: set up the rings if requested (and
+ * possible), and tell the other end. Failures to set up the rings are not fatal, the pipe then just
+ * keeps using the TLS session.
+ */
+static int pipe_ring_initiate(PAL_HANDLE handle) {
+    struct pipe_ring_setup setup = { .use_ring = 0 };
+    void* mem = NULL;
+    int ret;
+
+    if (handle->pipe.want_ring) {
+        uint8_t rand[8];
+        ret = _DkRandomBitsRead(rand, sizeof(rand));
+        if (ret < 0)
+            return ret;
+        memcpy(setup.path, PIPE_RING_PATH_PREFIX, static_strlen(PIPE_RING_PATH_PREFIX));
+        BYTES2HEXSTR(rand, setup.path + static_strlen(PIPE_RING_PATH_PREFIX),
+                     sizeof(setup.path) - static_strlen(PIPE_RING_PATH_PREFIX));
+
+        ret = _DkRandomBitsRead(setup.keys, sizeof(setup.keys));
+        if (ret < 0)
+            return ret;
+
+        ret = map_ring_file(setup.path, /*create=*/true, &mem);
+        if (ret < 0) {
+            log_warning("Cannot create shared memory for pipe %s (%d), using the socket\n",
+                        handle->pipe.name.str, ret);
+        } else {
+            setup.use_ring = 1;
+        }
+    }
+
+    ret = secure_write_exact(handle, &setup, sizeof(setup));
+    if (ret < 0 || !setup.use_ring)
+        goto out;
+
+    uint32_t accepted;
+    ret = secure_read_exact(handle, &accepted, sizeof(accepted));
+    if (ret < 0 || !accepted)
+        goto out;
+
+    handle->pipe.ring = pipe_ring_create(mem, setup.keys, /*is_initiator=*/true);
+    if (!handle->pipe.ring) {
+        /* the other end already switched to the rings, so there is no way back */
+        ret = -PAL_ERROR_NOMEM;
+        goto out;
+    }
+    mem = NULL;
+    ret = 0;
+
+out:
+    if (setup.use_ring)
+        ocall_delete(setup.path);
+    if (mem)
+        ocall_munmap_untrusted(mem, PIPE_RING_MEM_SIZE);
+    memset(&setup.keys, 0, sizeof(setup.keys));
+    return ret;
+}
+
+/* Counterpart of pipe_ring_initiate(), called by the accepting end after the TLS handshake. */
+static int pipe_ring_accept(PAL_HANDLE handle) {
+    struct pipe_ring_setup setup;
+    int ret = secure_read_exact(handle, &setup, sizeof(setup));
+    if (ret < 0)
+        return ret;
+
+    if (!setup.use_ring)
+        return 0;
+
+    void* mem = NULL;
+    uint32_t accepted = 0;
+    setup.path[sizeof(setup.path) - 1] = '\0';
+    ret = map_ring_file(setup.path, /*create=*/false, &mem);
+    if (ret == 0) {
+        handle->pipe.ring = pipe_ring_create(mem, setup.keys, /*is_initiator=*/false);
+        if (handle->pipe.ring) {
+            accepted = 1;
+        } else {
+            ocall_munmap_untrusted(mem, PIPE_RING_MEM_SIZE);
+        }
+    }
+    memset(&setup.keys, 0, sizeof(setup.keys));
+
+    ret = secure_write_exact(handle, &accepted, sizeof(accepted));
+    if (ret < 0 && handle->pipe.ring) {
+        pipe_ring_destroy(handle->pipe.ring);
+        handle->pipe.ring = NULL;
+    }
+    return ret;
+}
+
+/* Consume the doorbell byte that announced the records just drained from the receive ring. */
+static int ring_consume_doorbell(PAL_HANDLE handle) {
+    while (true) {
+        char byte;
+        ssize_t ret = ocall_recv(handle->pipe.fd, &byte, 1, NULL, NULL, NULL, NULL);
+        if (ret >= 0) {
+            /* 0 means the other end is gone, which the next read will report */
+            return 0;
+        }
+        if (ret != -EAGAIN && ret != -EINTR)
+            return unix_to_pal_error(ret);
+        /* the writer has announced the records but the byte is not there yet */
+        struct pollfd pfd = {.fd = handle->pipe.fd, .events = POLLIN, .revents = 0};
+        ret = ocall_poll(&pfd, 1, PIPE_RING_WAIT_US);
+        if (ret < 0 && ret != -EINTR)
+            return unix_to_pal_error(ret);
+    }
+}
+
+static int64_t pipe_ring_read(PAL_HANDLE handle, uint64_t len, void* buffer) {
+    struct pipe_ring* ring = handle->pipe.ring;
+    struct pipe_ring_end* end = &ring->recv;
+    int ret;
+
+    while (ring->plain_off == ring->plain_len) {
+        uint64_t fill = __atomic_load_n(&end->shared->fill, __ATOMIC_ACQUIRE);
+        if (fill == 0) {
+            if (handle->pipe.nonblocking)
+                return -PAL_ERROR_TRYAGAIN;
+
+            struct pollfd pfd = {.fd = handle->pipe.fd, .events = POLLIN, .revents = 0};
+            ret = ocall_poll(&pfd, 1, /*timeout_us=*/-1);
+            if (ret < 0)
+                return unix_to_pal_error(ret);
+
+            if (__atomic_load_n(&end->shared->fill, __ATOMIC_ACQUIRE))
+                continue;
+
+            /* The ring is empty, so there is no doorbell in the socket: it's readable because the
+             * other end is gone. */
+            char byte;
+            ret = ocall_recv(handle->pipe.fd, &byte, 1, NULL, NULL, NULL, NULL);
+            if (ret < 0)
+                return unix_to_pal_error(ret);
+            if (ret == 0)
+                return 0;
+            /* stray byte, can only come from the host */
+            continue;
+        }
+
+        uint32_t rec_len;
+        if (fill < PIPE_RING_RECORD_OVERHEAD || fill > PIPE_RING_DATA_SIZE)
+            goto corrupted;
+        ring_copy_out(end->shared, end->pos, &rec_len, sizeof(rec_len));
+        if (rec_len > PIPE_RING_RECORD_MAX || rec_len + PIPE_RING_RECORD_OVERHEAD > fill)
+            goto corrupted;
+
+        size_t rec_size = rec_len + PIPE_RING_RECORD_OVERHEAD;
+        ring_copy_out(end->shared, end->pos, end->record, rec_size);
+        memcpy(&rec_len, end->record, sizeof(rec_len));
+        if (rec_len + PIPE_RING_RECORD_OVERHEAD != rec_size)
+            goto corrupted;
+
+        uint8_t nonce[12];
+        ring_nonce(end->seq, nonce);
+        ret = lib_AESGCMDecrypt(end->key, sizeof(end->key), nonce, end->record + sizeof(rec_len),
+                                rec_len, end->record, sizeof(rec_len), ring->plain,
+                                end->record + sizeof(rec_len) + rec_len, PIPE_RING_TAG_SIZE);
+        if (ret < 0)
+            goto corrupted;
+
+        end->pos = (end->pos + rec_size) % PIPE_RING_DATA_SIZE;
+        end->seq++;
+        ring->plain_off = 0;
+        ring->plain_len = rec_len;
+
+        uint64_t old_fill = __atomic_fetch_sub(&end->shared->fill, rec_size, __ATOMIC_SEQ_CST);
+        if (old_fill < rec_size)
+            goto corrupted;
+        if (old_fill == rec_size)
+            ring->doorbell_owed = true;
+    }
+
+    size_t size = MIN(len, ring->plain_len - ring->plain_off);
+    memcpy(buffer, ring->plain + ring->plain_off, size);
+    ring->plain_off += size;
+
+    if (ring->doorbell_owed && ring->plain_off == ring->plain_len) {
+        ring->doorbell_owed = false;
+        ret = ring_consume_doorbell(handle);
+        if (ret < 0)
+            return ret;
+    }
+    return size;
+
+corrupted:
+    log_error("Shared memory of pipe %s was corrupted\n", handle->pipe.name.str);
+    return -PAL_ERROR_DENIED;
+}
+
+static int64_t pipe_ring_write(PAL_HANDLE handle, uint64_t len, const void* buffer) {
+    struct pipe_ring_end* end = &handle->pipe.ring->send;
+    uint64_t done = 0;
+    int ret;
+
+    while (done < len) {
+        uint32_t rec_len = MIN(len - done, (uint64_t)PIPE_RING_RECORD_MAX);
+        size_t rec_size = rec_len + PIPE_RING_RECORD_OVERHEAD;
+
+        uint64_t fill;
+        while (true) {
+            fill = __atomic_load_n(&end->shared->fill, __ATOMIC_ACQUIRE);
+            if (fill > PIPE_RING_DATA_SIZE) {
+                log_error("Shared memory of pipe %s was corrupted\n", handle->pipe.name.str);
+                return -PAL_ERROR_DENIED;
+            }
+            if (PIPE_RING_DATA_SIZE - fill >= rec_size)
+                break;
+            if (done)
+                return done;
+            if (handle->pipe.nonblocking)
+                return -PAL_ERROR_TRYAGAIN;
+
+            /* ring is full: wait for the reader, but notice if it is gone */
+            struct pollfd pfd = {.fd = handle->pipe.fd, .events = 0, .revents = 0};
+            ret = ocall_poll(&pfd, 1, PIPE_RING_WAIT_US);
+            if (ret < 0 && ret != -EINTR)
+                return unix_to_pal_error(ret);
+            if (ret > 0 && (pfd.revents & (POLLERR | POLLHUP)))
+                return -PAL_ERROR_CONNFAILED_PIPE;
+        }
+
+        memcpy(end->record, &rec_len, sizeof(rec_len));
+        uint8_t nonce[12];
+        ring_nonce(end->seq, nonce);
+        ret = lib_AESGCMEncrypt(end->key, sizeof(end->key), nonce, (const uint8_t*)buffer + done,
+                                rec_len, end->record, sizeof(rec_len),
+                                end->record + sizeof(rec_len),
+                                end->record + sizeof(rec_len) + rec_len, PIPE_RING_TAG_SIZE);
+        if (ret < 0)
+            return ret;
+
+        ring_copy_in(end->shared, end->pos, end->record, rec_size);
+        end->pos = (end->pos + rec_size) % PIPE_RING_DATA_SIZE;
+        end->seq++;
+        done += rec_len;
+
+        if (__atomic_fetch_add(&end->shared->fill, rec_size, __ATOMIC_SEQ_CST) == 0) {
+            char byte = 0;
+            ret = ocall_send(handle->pipe.fd, &byte, 1, NULL, 0, NULL, 0);
+            if (ret < 0)
+                return unix_to_pal_error(ret);
+        }
+    }
+
+    return done;
+}
+
 static int thread_handshake_func(void* param) {
     PAL_HANDLE handle = (PAL_HANDLE)param;
 
@@ -78,6 +496,12 @@ static int thread_handshake_func(void* param) {
         _DkProcessExit(1);
     }
 
+    ret = pipe_ring_initiate(handle);
+    if (ret < 0) {
+        log_error("Failed to set up pipe %s: %d\n", handle->pipe.name.str, ret);
+        _DkProcessExit(1);
+    }
+
     __atomic_store_n(&handle->pipe.handshake_done, 1, __ATOMIC_RELEASE);
     return 0;
 }
@@ -108,7 +532,7 @@ static int pipe_listen(PAL_HANDLE* handle, const char* name, int options) {
     size_t addrlen = sizeof(struct sockaddr_un);
     int nonblock = options & PAL_OPTION_NONBLOCK ? SOCK_NONBLOCK : 0;
 
-    ret = ocall_listen(AF_UNIX, SOCK_STREAM | nonblock, 0, /*ipv6_v6only=*/0,
+    ret = ocall_listen(AF_UNIX, SOCK_STREAM | nonblock, 0, /*ipv6_v6only=*/0, /*reuseport=*/0,
                        (struct sockaddr*)&addr, &addrlen, &sock_options);
     if (ret < 0)
         return unix_to_pal_error(ret);
@@ -132,6 +556,8 @@ static int pipe_listen(PAL_HANDLE* handle, const char* name, int options) {
     hdl->pipe.ssl_ctx        = NULL;
     hdl->pipe.is_server      = false;
     hdl->pipe.handshake_done = 1; /* pipesrv doesn't do any handshake so consider it done */
+    hdl->pipe.want_ring      = PAL_FALSE;
+    hdl->pipe.ring           = NULL;
     memset(hdl->pipe.session_key, 0, sizeof(hdl->pipe.session_key));
 
     *handle = hdl;
@@ -180,6 +606,8 @@ static int pipe_waitforclient(PAL_HANDLE handle, PAL_HANDLE* client) {
     clnt->pipe.ssl_ctx        = NULL;
     clnt->pipe.is_server      = false;
     clnt->pipe.handshake_done = 0;
+    clnt->pipe.want_ring      = PAL_FALSE; /* decided by the connecting end */
+    clnt->pipe.ring           = NULL;
 
     ret = pipe_session_key(&clnt->pipe.name, &clnt->pipe.session_key);
     if (ret < 0) {
@@ -195,6 +623,14 @@ static int pipe_waitforclient(PAL_HANDLE handle, PAL_HANDLE* client) {
         free(clnt);
         return ret;
     }
+
+    ret = pipe_ring_accept(clnt);
+    if (ret < 0) {
+        _DkStreamSecureFree((LIB_SSL_CONTEXT*)clnt->pipe.ssl_ctx);
+        ocall_close(clnt->pipe.fd);
+        free(clnt);
+        return ret;
+    }
     __atomic_store_n(&clnt->pipe.handshake_done, 1, __ATOMIC_RELEASE);
 
     *client = clnt;
@@ -211,7 +647,7 @@ static int pipe_waitforclient(PAL_HANDLE handle, PAL_HANDLE* client) {
  *
  * \param[out] handle  PAL handle of type `pipe` with abstract UNIX socket connected to another end.
  * \param[in]  name    String uniquely identifying the pipe.
- * \param[in]  options May contain PAL_OPTION_NONBLOCK.
+ * \param[in]  options May contain PAL_OPTION_NONBLOCK and PAL_OPTION_PIPE_SHM.
  * \return             0 on success, negative PAL error code otherwise.
  */
 static int pipe_connect(PAL_HANDLE* handle, const char* name, int options) {
@@ -257,6 +693,8 @@ static int pipe_connect(PAL_HANDLE* handle, const char* name, int options) {
     hdl->pipe.ssl_ctx        = NULL;
     hdl->pipe.is_server      = true;
     hdl->pipe.handshake_done = 0;
+    hdl->pipe.want_ring      = (options & PAL_OPTION_PIPE_SHM) ? PAL_TRUE : PAL_FALSE;
+    hdl->pipe.ring           = NULL;
 
     /* create a helper thread to initialize the SSL context (by performing SSL handshake);
      * we need a separate thread because the underlying handshake implementation is blocking
@@ -295,8 +733,7 @@ static int pipe_private(PAL_HANDLE* handle, int options) {
 
     PAL_HANDLE hdl = malloc(HANDLE_SIZE(pipeprv));
     if (!hdl) {
-        ocall_close(fds[0]);
-        ocall_close(fds[1]);
+        ocall_close_batch(fds, ARRAY_SIZE(fds));
         return -PAL_ERROR_NOMEM;
     }
 
@@ -386,6 +823,9 @@ static int64_t pipe_read(PAL_HANDLE handle, uint64_t offset, uint64_t len, void*
         while (!__atomic_load_n(&handle->pipe.handshake_done, __ATOMIC_ACQUIRE))
             CPU_RELAX();
 
+        if (handle->pipe.ring)
+            return pipe_ring_read(handle, len, buffer);
+
         if (!handle->pipe.ssl_ctx)
             return -PAL_ERROR_NOTCONNECTION;
 
@@ -424,6 +864,9 @@ static int64_t pipe_write(PAL_HANDLE handle, uint64_t offset, uint64_t len, cons
         while (!__atomic_load_n(&handle->pipe.handshake_done, __ATOMIC_ACQUIRE))
             CPU_RELAX();
 
+        if (handle->pipe.ring)
+            return pipe_ring_write(handle, len, buffer);
+
         if (!handle->pipe.ssl_ctx)
             return -PAL_ERROR_NOTCONNECTION;
 
@@ -434,6 +877,43 @@ static int64_t pipe_write(PAL_HANDLE handle, uint64_t offset, uint64_t len, cons
     return bytes;
 }
 
+/*!
+ * \brief Read from `pipeprv` into several buffers with one OCALL (pipeprv are not encrypted, so
+ *        there is no need to go through pipe_read() for each buffer).
+ */
+static int64_t pipeprv_readv(PAL_HANDLE handle, uint64_t offset, const PAL_IOVEC* iov,
+                             size_t iov_count) {
+    if (offset)
+        return -PAL_ERROR_INVAL;
+
+    if (!IS_HANDLE_TYPE(handle, pipeprv))
+        return -PAL_ERROR_NOTCONNECTION;
+
+    ssize_t bytes = ocall_readv(handle->pipeprv.fds[0], iov, iov_count, /*offset=*/-1);
+    if (bytes < 0)
+        return unix_to_pal_error(bytes);
+
+    return bytes;
+}
+
+/*!
+ * \brief Write to `pipeprv` from several buffers with one OCALL.
+ */
+static int64_t pipeprv_writev(PAL_HANDLE handle, uint64_t offset, const PAL_IOVEC* iov,
+                              size_t iov_count) {
+    if (offset)
+        return -PAL_ERROR_INVAL;
+
+    if (!IS_HANDLE_TYPE(handle, pipeprv))
+        return -PAL_ERROR_NOTCONNECTION;
+
+    ssize_t bytes = ocall_writev(handle->pipeprv.fds[1], iov, iov_count, /*offset=*/-1);
+    if (bytes < 0)
+        return unix_to_pal_error(bytes);
+
+    return bytes;
+}
+
 /*!
  * \brief Close pipe (both ends in case of `pipeprv`).
  *
@@ -442,14 +922,17 @@ static int64_t pipe_write(PAL_HANDLE handle, uint64_t offset, uint64_t len, cons
  */
 static int pipe_close(PAL_HANDLE handle) {
     if (IS_HANDLE_TYPE(handle, pipeprv)) {
-        if (handle->pipeprv.fds[0] != PAL_IDX_POISON) {
-            ocall_close(handle->pipeprv.fds[0]);
-            handle->pipeprv.fds[0] = PAL_IDX_POISON;
-        }
-        if (handle->pipeprv.fds[1] != PAL_IDX_POISON) {
-            ocall_close(handle->pipeprv.fds[1]);
-            handle->pipeprv.fds[1] = PAL_IDX_POISON;
+        /* close both ends in one batched OCALL */
+        int fds[2];
+        size_t fds_cnt = 0;
+        for (size_t i = 0; i < ARRAY_SIZE(handle->pipeprv.fds); i++) {
+            if (handle->pipeprv.fds[i] != PAL_IDX_POISON) {
+                fds[fds_cnt++] = handle->pipeprv.fds[i];
+                handle->pipeprv.fds[i] = PAL_IDX_POISON;
+            }
         }
+        if (fds_cnt)
+            ocall_close_batch(fds, fds_cnt);
     } else if (handle->pipe.fd != PAL_IDX_POISON) {
         while (!__atomic_load_n(&handle->pipe.handshake_done, __ATOMIC_ACQUIRE))
             CPU_RELAX();
@@ -458,6 +941,10 @@ static int pipe_close(PAL_HANDLE handle) {
             _DkStreamSecureFree((LIB_SSL_CONTEXT*)handle->pipe.ssl_ctx);
             handle->pipe.ssl_ctx = NULL;
         }
+        if (handle->pipe.ring) {
+            pipe_ring_destroy(handle->pipe.ring);
+            handle->pipe.ring = NULL;
+        }
         ocall_close(handle->pipe.fd);
         handle->pipe.fd = PAL_IDX_POISON;
     }
@@ -542,6 +1029,14 @@ static int pipe_attrquerybyhdl(PAL_HANDLE handle, PAL_STREAM_ATTR* attr) {
         attr->pending_size = ret;
     }
 
+    if (!IS_HANDLE_TYPE(handle, pipeprv) && handle->pipe.ring) {
+        /* the socket only holds doorbells; count the decrypted leftovers and what's in the ring
+         * (including record headers and tags, so this is an upper bound) */
+        struct pipe_ring* ring = handle->pipe.ring;
+        attr->pending_size = ring->plain_len - ring->plain_off +
+                             __atomic_load_n(&ring->recv.shared->fill, __ATOMIC_ACQUIRE);
+    }
+
     /* query if there is data available for reading/writing */
     if (IS_HANDLE_TYPE(handle, pipeprv)) {
         /* for private pipe, readable and writable are queried on different fds */
@@ -573,6 +1068,8 @@ static int pipe_attrquerybyhdl(PAL_HANDLE handle, PAL_STREAM_ATTR* attr) {
 
         attr->readable = ret == 1 && (pfd.revents & (POLLIN | POLLERR | POLLHUP)) == POLLIN;
         attr->writable = ret == 1 && (pfd.revents & (POLLOUT | POLLERR | POLLHUP)) == POLLOUT;
+        if (handle->pipe.ring && handle->pipe.ring->plain_off < handle->pipe.ring->plain_len)
+            attr->readable = true;
     }
 
     return 0;
@@ -682,6 +1179,8 @@ struct handle_ops g_pipeprv_ops = {
     .open           = &pipe_open,
     .read           = &pipe_read,
     .write          = &pipe_write,
+    .readv          = &pipeprv_readv,
+    .writev         = &pipeprv_writev,
     .close          = &pipe_close,
     .attrquerybyhdl = &pipe_attrquerybyhdl,
     .attrsetbyhdl   = &pipe_attrsetbyhdl,
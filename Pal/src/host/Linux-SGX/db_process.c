@@ -16,6 +16,7 @@
 
 #include "api.h"
 #include "crypto.h"
+#include "enclave_pages.h"
 #include "pal.h"
 #include "pal_defs.h"
 #include "pal_error.h"
@@ -208,6 +209,11 @@ int _DkProcessCreate(PAL_HANDLE* handle, const char** args) {
             goto failed;
     }
 
+    /* let the child skip re-hashing of trusted files already verified by this enclave */
+    ret = send_trusted_file_hashes(child->process.ssl_ctx);
+    if (ret < 0)
+        goto failed;
+
     *handle = child;
     return 0;
 
@@ -272,13 +278,32 @@ int init_child_process(PAL_HANDLE* parent_handle) {
         g_pf_wrap_key_set = true;
     }
 
+    ret = receive_trusted_file_hashes(parent->process.ssl_ctx);
+    if (ret < 0)
+        return ret;
+
     *parent_handle = parent;
     return 0;
 }
 
+void _DkProcessZygote(PAL_NUM* instance_id, PAL_HANDLE* parent_process) {
+    /* every enclave is created and initialized from scratch, there is no zygote */
+    __UNUSED(instance_id);
+    __UNUSED(parent_process);
+}
+
 noreturn void _DkProcessExit(int exitcode) {
     if (exitcode)
         log_debug("DkProcessExit: Returning exit code %d\n", exitcode);
+    save_trusted_file_hash_cache();
+    if (g_sgx_enable_stats) {
+        print_untrusted_cache_stats();
+        print_untrusted_alloc_stats();
+        print_enclave_page_cache_stats();
+        print_enclave_heap_stats();
+        print_ssl_stats();
+        print_io_stats();
+    }
     ocall_exit(exitcode, /*is_exitgroup=*/true);
     /* Unreachable. */
 }
@@ -12,8 +12,10 @@
 #include <linux/in6.h>
 #include <linux/poll.h>
 #include <linux/types.h>
+#include <sys/eventfd.h>
 
 #include "api.h"
+#include "ocall_types.h"
 #include "pal.h"
 #include "pal_defs.h"
 #include "pal_error.h"
@@ -230,6 +232,7 @@ static inline PAL_HANDLE socket_create_handle(int type, int fd, int options,
     init_handle_hdr(HANDLE_HDR(hdl), type);
     HANDLE_HDR(hdl)->flags |= RFD(0) | (type != pal_type_tcpsrv ? WFD(0) : 0);
     hdl->sock.fd = fd;
+    hdl->sock.accept_efd = PAL_IDX_POISON;
     void* addr   = (void*)hdl + HANDLE_SIZE(sock);
     if (bind_addr) {
         hdl->sock.bind = (PAL_PTR)addr;
@@ -265,6 +268,70 @@ static inline int sock_type(int type, int options) {
     return type;
 }
 
+size_t g_accept_batch_size = 1;
+
+/*
+ * Connections accepted ahead by one OCALL_ACCEPT_MULTI (up to `sgx.accept_batch_size` at a time)
+ * and not yet returned by tcp_accept(). This is done only on non-blocking listening sockets, so
+ * that draining the host backlog never blocks. The queue is hidden from the host, so the listening
+ * socket would not appear readable while connections wait in it; that's why the handle also has an
+ * event FD (polled as its fds[1]), which the host signals when it returns extra connections and
+ * clears on the next OCALL_ACCEPT_MULTI, i.e., when the queue is empty again. Until then the
+ * listening socket may appear readable with nothing to accept, which non-blocking applications
+ * must handle anyway.
+ */
+struct accept_queue {
+    spinlock_t lock; /* also held during OCALL_ACCEPT_MULTI, which doesn't block */
+    size_t start;
+    size_t count;
+    struct ocall_accepted conns[];
+};
+
+int sock_init_accept_queue(PAL_HANDLE handle) {
+    assert(IS_HANDLE_TYPE(handle, tcpsrv));
+    handle->sock.accept_efd = PAL_IDX_POISON;
+    handle->sock.accept_queue = (PAL_PTR)NULL;
+    HANDLE_HDR(handle)->flags &= ~RFD(1);
+
+    if (g_accept_batch_size <= 1)
+        return 0;
+
+    struct accept_queue* queue = malloc(sizeof(*queue)
+                                        + g_accept_batch_size * sizeof(queue->conns[0]));
+    if (!queue)
+        return -PAL_ERROR_NOMEM;
+
+    int ret = ocall_eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ret < 0) {
+        free(queue);
+        return unix_to_pal_error(ret);
+    }
+
+    spinlock_init(&queue->lock);
+    queue->start = 0;
+    queue->count = 0;
+
+    handle->sock.accept_efd = ret;
+    handle->sock.accept_queue = (PAL_PTR)queue;
+    HANDLE_HDR(handle)->flags |= RFD(1);
+    return 0;
+}
+
+static void free_accept_queue(PAL_HANDLE handle) {
+    struct accept_queue* queue = (struct accept_queue*)handle->sock.accept_queue;
+    if (!queue)
+        return;
+
+    for (size_t i = 0; i < queue->count; i++)
+        ocall_close(queue->conns[queue->start + i].fd);
+    free(queue);
+    handle->sock.accept_queue = (PAL_PTR)NULL;
+
+    ocall_close(handle->sock.accept_efd);
+    handle->sock.accept_efd = PAL_IDX_POISON;
+    HANDLE_HDR(handle)->flags &= ~RFD(1);
+}
+
 /* listen on a tcp socket */
 static int tcp_listen(PAL_HANDLE* handle, char* uri, int create, int options) {
     struct sockaddr_storage buffer;
@@ -281,8 +348,9 @@ static int tcp_listen(PAL_HANDLE* handle, char* uri, int create, int options) {
     sock_options.reuseaddr = 1; /* sockets are always set as reusable in Graphene */
 
     int ipv6_v6only = create & PAL_CREATE_DUALSTACK ? 0 : 1;
+    int reuseport = create & PAL_CREATE_REUSEPORT ? 1 : 0;
     ret = ocall_listen(bind_addr->sa_family, sock_type(SOCK_STREAM, options), 0, ipv6_v6only,
-                       bind_addr, &bind_addrlen, &sock_options);
+                       reuseport, bind_addr, &bind_addrlen, &sock_options);
     if (ret < 0)
         return unix_to_pal_error(ret);
 
@@ -293,6 +361,14 @@ static int tcp_listen(PAL_HANDLE* handle, char* uri, int create, int options) {
         return -PAL_ERROR_NOMEM;
     }
 
+    ret = sock_init_accept_queue(*handle);
+    if (ret < 0) {
+        ocall_close((*handle)->sock.fd);
+        free(*handle);
+        *handle = NULL;
+        return ret;
+    }
+
     return 0;
 }
 
@@ -306,24 +382,51 @@ static int tcp_accept(PAL_HANDLE handle, PAL_HANDLE* client) {
 
     struct sockaddr* bind_addr = (struct sockaddr*)handle->sock.bind;
     size_t bind_addrlen = addr_size(bind_addr);
-    struct sockaddr_storage dest_addr;
-    size_t dest_addrlen = sizeof(dest_addr);
+    struct ocall_accepted conn;
+    bool queued = false;
     int ret = 0;
 
-    struct sockopt sock_options;
+    struct accept_queue* queue = (struct accept_queue*)handle->sock.accept_queue;
+    if (queue) {
+        spinlock_lock(&queue->lock);
+        if (!queue->count && handle->sock.nonblocking) {
+            ret = ocall_accept_multi(handle->sock.fd, handle->sock.accept_efd, queue->conns,
+                                     g_accept_batch_size);
+            if (ret < 0) {
+                spinlock_unlock(&queue->lock);
+                return unix_to_pal_error(ret);
+            }
+            queue->start = 0;
+            queue->count = ret;
+        }
+        if (queue->count) {
+            conn = queue->conns[queue->start++];
+            queue->count--;
+            queued = true;
+        }
+        spinlock_unlock(&queue->lock);
+    }
 
-    memset(&sock_options, 0, sizeof(sock_options));
-    sock_options.reuseaddr = 1; /* sockets are always set as reusable in Graphene */
+    if (!queued) {
+        size_t dest_addrlen = sizeof(conn.addr);
 
-    ret = ocall_accept(handle->sock.fd, (struct sockaddr*)&dest_addr, &dest_addrlen, &sock_options);
-    if (ret < 0)
-        return unix_to_pal_error(ret);
+        memset(&conn.sockopt, 0, sizeof(conn.sockopt));
+        conn.sockopt.reuseaddr = 1; /* sockets are always set as reusable in Graphene */
+
+        ret = ocall_accept(handle->sock.fd, (struct sockaddr*)&conn.addr, &dest_addrlen,
+                           &conn.sockopt);
+        if (ret < 0)
+            return unix_to_pal_error(ret);
+
+        conn.fd = ret;
+        conn.addrlen = dest_addrlen;
+    }
 
-    *client = socket_create_handle(pal_type_tcp, ret, 0, bind_addr, bind_addrlen,
-                                   (struct sockaddr*)&dest_addr, dest_addrlen, &sock_options);
+    *client = socket_create_handle(pal_type_tcp, conn.fd, 0, bind_addr, bind_addrlen,
+                                   (struct sockaddr*)&conn.addr, conn.addrlen, &conn.sockopt);
 
     if (!(*client)) {
-        ocall_close(ret);
+        ocall_close(conn.fd);
         return -PAL_ERROR_NOMEM;
     }
 
@@ -436,6 +539,67 @@ static int64_t tcp_write(PAL_HANDLE handle, uint64_t offset, uint64_t len, const
     return bytes;
 }
 
+/* 'readv' operation of tcp stream */
+static int64_t tcp_readv(PAL_HANDLE handle, uint64_t offset, const PAL_IOVEC* iov,
+                         size_t iov_count) {
+    if (offset)
+        return -PAL_ERROR_INVAL;
+
+    if (!IS_HANDLE_TYPE(handle, tcp) || !handle->sock.conn)
+        return -PAL_ERROR_NOTCONNECTION;
+
+    if (handle->sock.fd == PAL_IDX_POISON)
+        return 0;
+
+    ssize_t bytes = ocall_readv(handle->sock.fd, iov, iov_count, /*offset=*/-1);
+    if (bytes < 0)
+        return unix_to_pal_error(bytes);
+
+    return bytes;
+}
+
+/* 'writev' operation of tcp stream */
+static int64_t tcp_writev(PAL_HANDLE handle, uint64_t offset, const PAL_IOVEC* iov,
+                          size_t iov_count) {
+    if (offset)
+        return -PAL_ERROR_INVAL;
+
+    if (!IS_HANDLE_TYPE(handle, tcp) || !handle->sock.conn)
+        return -PAL_ERROR_NOTCONNECTION;
+
+    if (handle->sock.fd == PAL_IDX_POISON)
+        return -PAL_ERROR_CONNFAILED;
+
+    ssize_t bytes = ocall_writev(handle->sock.fd, iov, iov_count, /*offset=*/-1);
+    if (bytes < 0)
+        return unix_to_pal_error(bytes);
+
+    return bytes;
+}
+
+/* 'sendfile' operation of tcp stream */
+static int64_t tcp_sendfile(PAL_HANDLE handle, PAL_HANDLE file, uint64_t offset, uint64_t count) {
+    if (!IS_HANDLE_TYPE(handle, tcp) || !handle->sock.conn)
+        return -PAL_ERROR_NOTCONNECTION;
+
+    if (handle->sock.fd == PAL_IDX_POISON)
+        return -PAL_ERROR_CONNFAILED;
+
+    /* the host may only serve files whose contents the enclave doesn't have to check */
+    if (!IS_HANDLE_TYPE(file, file) || !file->file.seekable || file->file.pending_open
+            || file->file.chunk_hashes || find_protected_file_handle(file))
+        return -PAL_ERROR_NOTSUPPORT;
+
+    if (offset > INT64_MAX)
+        return -PAL_ERROR_INVAL;
+
+    ssize_t bytes = ocall_sendfile(handle->sock.fd, file->file.fd, (off_t)offset, count);
+    if (bytes < 0)
+        return unix_to_pal_error(bytes);
+
+    return bytes;
+}
+
 /* used by 'open' operation of tcp stream for bound socket */
 static int udp_bind(PAL_HANDLE* handle, char* uri, int create, int options) {
     struct sockaddr_storage buffer;
@@ -455,8 +619,9 @@ static int udp_bind(PAL_HANDLE* handle, char* uri, int create, int options) {
     sock_options.reuseaddr = 1; /* sockets are always set as reusable in Graphene */
 
     int ipv6_v6only = create & PAL_CREATE_DUALSTACK ? 0 : 1;
+    int reuseport = create & PAL_CREATE_REUSEPORT ? 1 : 0;
     ret = ocall_listen(bind_addr->sa_family, sock_type(SOCK_DGRAM, options), 0, ipv6_v6only,
-                       bind_addr, &bind_addrlen, &sock_options);
+                       reuseport, bind_addr, &bind_addrlen, &sock_options);
     if (ret < 0)
         return unix_to_pal_error(ret);
 
@@ -632,6 +797,105 @@ static int64_t udp_sendbyaddr(PAL_HANDLE handle, uint64_t offset, uint64_t len,
     return bytes;
 }
 
+/* max messages passed to the host in one udp_readmsgs()/udp_writemsgs() */
+#define UDP_MSGS_BATCH 16
+
+static int64_t udp_readmsgs(PAL_HANDLE handle, PAL_STREAM_MSG* msgs, size_t count) {
+    if (!IS_HANDLE_TYPE(handle, udp) && !IS_HANDLE_TYPE(handle, udpsrv))
+        return -PAL_ERROR_NOTCONNECTION;
+
+    if (handle->sock.fd == PAL_IDX_POISON)
+        return -PAL_ERROR_BADHANDLE;
+
+    bool with_addr = IS_HANDLE_TYPE(handle, udpsrv);
+    if (count > UDP_MSGS_BATCH)
+        count = UDP_MSGS_BATCH;
+
+    struct sgx_mmsg host_msgs[UDP_MSGS_BATCH];
+    struct sockaddr_storage conn_addrs[UDP_MSGS_BATCH];
+    for (size_t i = 0; i < count; i++) {
+        host_msgs[i].buf     = msgs[i].buffer;
+        host_msgs[i].len     = msgs[i].size;
+        host_msgs[i].addr    = with_addr ? (struct sockaddr*)&conn_addrs[i] : NULL;
+        host_msgs[i].addrlen = with_addr ? sizeof(conn_addrs[i]) : 0;
+    }
+
+    ssize_t ret = ocall_recvmmsg(handle->sock.fd, host_msgs, count);
+    if (ret < 0)
+        return unix_to_pal_error(ret);
+
+    for (ssize_t i = 0; i < ret; i++) {
+        msgs[i].size = host_msgs[i].len;
+        if (!with_addr || !msgs[i].addr)
+            continue;
+
+        char* addr = msgs[i].addr;
+        char* addr_uri = strcpy_static(addr, URI_PREFIX_UDP, msgs[i].addr_size);
+        if (!addr_uri)
+            return -PAL_ERROR_OVERFLOW;
+
+        int uri_ret = inet_create_uri(addr_uri, addr + msgs[i].addr_size - addr_uri,
+                                      host_msgs[i].addr, host_msgs[i].addrlen, NULL);
+        if (uri_ret < 0)
+            return uri_ret;
+    }
+
+    return ret;
+}
+
+static int64_t udp_writemsgs(PAL_HANDLE handle, PAL_STREAM_MSG* msgs, size_t count) {
+    if (!IS_HANDLE_TYPE(handle, udp) && !IS_HANDLE_TYPE(handle, udpsrv))
+        return -PAL_ERROR_NOTCONNECTION;
+
+    if (handle->sock.fd == PAL_IDX_POISON)
+        return -PAL_ERROR_BADHANDLE;
+
+    bool with_addr = IS_HANDLE_TYPE(handle, udpsrv);
+    if (count > UDP_MSGS_BATCH)
+        count = UDP_MSGS_BATCH;
+
+    struct sgx_mmsg host_msgs[UDP_MSGS_BATCH];
+    struct sockaddr_storage conn_addrs[UDP_MSGS_BATCH];
+    for (size_t i = 0; i < count; i++) {
+        host_msgs[i].buf     = msgs[i].buffer;
+        host_msgs[i].len     = msgs[i].size;
+        host_msgs[i].addr    = NULL;
+        host_msgs[i].addrlen = 0;
+
+        /* connected sockets take no address, server sockets need one for every message */
+        if (!with_addr != !msgs[i].addr)
+            return -PAL_ERROR_INVAL;
+        if (!with_addr)
+            continue;
+
+        const char* addr = msgs[i].addr;
+        if (!strstartswith(addr, URI_PREFIX_UDP))
+            return -PAL_ERROR_INVAL;
+        addr += static_strlen(URI_PREFIX_UDP);
+
+        size_t addrlen = strlen(addr) + 1;
+        char* addrbuf = __alloca(addrlen);
+        memcpy(addrbuf, addr, addrlen);
+
+        size_t conn_addrlen = sizeof(conn_addrs[i]);
+        int ret = inet_parse_uri(&addrbuf, (struct sockaddr*)&conn_addrs[i], &conn_addrlen);
+        if (ret < 0)
+            return ret;
+
+        host_msgs[i].addr    = (struct sockaddr*)&conn_addrs[i];
+        host_msgs[i].addrlen = conn_addrlen;
+    }
+
+    ssize_t ret = ocall_sendmmsg(handle->sock.fd, host_msgs, count);
+    if (ret < 0)
+        return unix_to_pal_error(ret);
+
+    for (ssize_t i = 0; i < ret; i++)
+        msgs[i].size = host_msgs[i].len;
+
+    return ret;
+}
+
 static int socket_delete(PAL_HANDLE handle, int access) {
     if (handle->sock.fd == PAL_IDX_POISON)
         return 0;
@@ -662,6 +926,9 @@ static int socket_delete(PAL_HANDLE handle, int access) {
 }
 
 static int socket_close(PAL_HANDLE handle) {
+    if (IS_HANDLE_TYPE(handle, tcpsrv))
+        free_accept_queue(handle);
+
     if (handle->sock.fd != PAL_IDX_POISON) {
         ocall_close(handle->sock.fd);
         handle->sock.fd = PAL_IDX_POISON;
@@ -713,6 +980,10 @@ static int socket_attrquerybyhdl(PAL_HANDLE handle, PAL_STREAM_ATTR* attr) {
 
     attr->readable = ret == 1 && (pfd.revents & (POLLIN | POLLERR | POLLHUP)) == POLLIN;
     attr->writable = ret == 1 && (pfd.revents & (POLLOUT | POLLERR | POLLHUP)) == POLLOUT;
+
+    struct accept_queue* queue = (struct accept_queue*)handle->sock.accept_queue;
+    if (queue && __atomic_load_n(&queue->count, __ATOMIC_RELAXED))
+        attr->readable = PAL_TRUE;
     return 0;
 }
 
@@ -902,6 +1173,9 @@ struct handle_ops g_tcp_ops = {
     .waitforclient  = &tcp_accept,
     .read           = &tcp_read,
     .write          = &tcp_write,
+    .readv          = &tcp_readv,
+    .writev         = &tcp_writev,
+    .sendfile       = &tcp_sendfile,
     .delete         = &socket_delete,
     .close          = &socket_close,
     .attrquerybyhdl = &socket_attrquerybyhdl,
@@ -913,6 +1187,8 @@ struct handle_ops g_udp_ops = {
     .open           = &udp_open,
     .read           = &udp_receive,
     .write          = &udp_send,
+    .readmsgs       = &udp_readmsgs,
+    .writemsgs      = &udp_writemsgs,
     .delete         = &socket_delete,
     .close          = &socket_close,
     .attrquerybyhdl = &socket_attrquerybyhdl,
@@ -924,6 +1200,8 @@ struct handle_ops g_udpsrv_ops = {
     .open           = &udp_open,
     .readbyaddr     = &udp_receivebyaddr,
     .writebyaddr    = &udp_sendbyaddr,
+    .readmsgs       = &udp_readmsgs,
+    .writemsgs      = &udp_writemsgs,
     .delete         = &socket_delete,
     .close          = &socket_close,
     .attrquerybyhdl = &socket_attrquerybyhdl,
@@ -29,9 +29,6 @@
 #include "perm.h"
 #include "stat.h"
 
-#define DUMMYPAYLOAD     "dummypayload"
-#define DUMMYPAYLOADSIZE (sizeof(DUMMYPAYLOAD))
-
 static int g_log_fd = PAL_LOG_DEFAULT_FD;
 
 struct hdl_header {
@@ -40,6 +37,17 @@ struct hdl_header {
 };
 static_assert((sizeof(((struct hdl_header*)0)->fds) * 8) >= MAX_FDS, "insufficient fds size");
 
+/* Handles are sent in batches, so that FDs of the whole batch fit into one SCM_RIGHTS message
+ * (Linux allows at most 253 FDs per message). */
+#define HANDLES_BATCH_SIZE 64UL
+static_assert(HANDLES_BATCH_SIZE * MAX_FDS <= 253, "too many FDs in one batch");
+
+struct hdls_header {
+    uint32_t cnt;
+    size_t data_size; /* total size of serialized PAL handles of the batch */
+    struct hdl_header hdls[HANDLES_BATCH_SIZE];
+};
+
 static size_t addr_size(const struct sockaddr* addr) {
     switch (addr->sa_family) {
         case AF_INET:
@@ -74,6 +82,12 @@ out:
 /* _DkStreamUnmap for internal use. Unmap stream at certain memory address.
    The memory is unmapped as a whole.*/
 int _DkStreamUnmap(void* addr, uint64_t size) {
+    /* allowed files mapped without an address are mapped in untrusted memory */
+    if (sgx_is_completely_outside_enclave(addr, size)) {
+        int ret = ocall_munmap_untrusted(addr, size);
+        return ret < 0 ? unix_to_pal_error(ret) : 0;
+    }
+
     int ret = flush_pf_maps(/*pf=*/NULL, addr, /*remove=*/true);
     if (ret < 0)
         return ret;
@@ -99,6 +113,9 @@ static ssize_t handle_serialize(PAL_HANDLE handle, void** data) {
             break;
         case pal_type_pipe:
         case pal_type_pipecli:
+            /* the shared-memory transport cannot be handed over */
+            if (handle->pipe.ring)
+                return -PAL_ERROR_NOTSUPPORT;
             /* session key is part of handle but need to serialize SSL context */
             if (handle->pipe.ssl_ctx) {
                 free_d1 = true;
@@ -188,6 +205,7 @@ static int handle_deserialize(PAL_HANDLE* handle, const void* data, size_t size,
         case pal_type_pipecli:
             /* session key is part of handle but need to deserialize SSL context */
             hdl->pipe.fd = fds[0]; /* correct host FD must be passed to SSL context */
+            hdl->pipe.ring = NULL;
             ret = _DkStreamSecureInit(hdl, hdl->pipe.is_server, &hdl->pipe.session_key,
                                       (LIB_SSL_CONTEXT**)&hdl->pipe.ssl_ctx,
                                       (const uint8_t*)hdl + hdlsz, size - hdlsz);
@@ -214,6 +232,13 @@ static int handle_deserialize(PAL_HANDLE* handle, const void* data, size_t size,
                 hdl->sock.bind = (PAL_PTR)hdl + hdlsz;
             if (s2)
                 hdl->sock.conn = (PAL_PTR)hdl + hdlsz + s2;
+            if (PAL_GET_TYPE(hdl) == pal_type_tcpsrv) {
+                ret = sock_init_accept_queue(hdl);
+                if (ret < 0) {
+                    free(hdl);
+                    return ret;
+                }
+            }
             break;
         }
         case pal_type_process:
@@ -238,48 +263,99 @@ static int handle_deserialize(PAL_HANDLE* handle, const void* data, size_t size,
     return 0;
 }
 
-/*!
- * \brief Send `cargo` handle to a process identified via `hdl` handle.
- *
- * If `hdl` has an SSL context (i.e., its stream is encrypted), then `cargo` is sent encrypted.
- *
- * \param[in] hdl    Process stream on which to send `cargo`.
- * \param[in] cargo  Arbitrary handle to serialize and send on `hdl`.
- * \return           0 on success, negative PAL error code otherwise.
- */
-int _DkSendHandle(PAL_HANDLE hdl, PAL_HANDLE cargo) {
-    if (!IS_HANDLE_TYPE(hdl, process))
-        return -PAL_ERROR_BADHANDLE;
+/* Both sides are in PAL, so the payload can be read in chunks of any size: loop until complete.
+ * Only payload is encrypted (if `hdl` has an SSL context), headers with FDs are not. */
+static int process_write_exact(PAL_HANDLE hdl, const void* buf, size_t size, bool secure) {
+    while (size) {
+        ssize_t ret;
+        if (secure && hdl->process.ssl_ctx) {
+            ret = _DkStreamSecureWrite(hdl->process.ssl_ctx, buf, size,
+                                       /*is_blocking=*/!hdl->process.nonblocking);
+        } else {
+            ret = ocall_write(hdl->process.stream, buf, size);
+            ret = ret < 0 ? unix_to_pal_error(ret) : ret;
+        }
+        if (ret == -PAL_ERROR_INTERRUPTED)
+            continue;
+        if (ret < 0)
+            return ret;
+        buf = (const char*)buf + ret;
+        size -= ret;
+    }
+    return 0;
+}
+
+static int process_read_exact(PAL_HANDLE hdl, void* buf, size_t size, bool secure) {
+    while (size) {
+        ssize_t ret;
+        if (secure && hdl->process.ssl_ctx) {
+            ret = _DkStreamSecureRead(hdl->process.ssl_ctx, buf, size,
+                                      /*is_blocking=*/!hdl->process.nonblocking);
+        } else {
+            ret = ocall_read(hdl->process.stream, buf, size);
+            ret = ret < 0 ? unix_to_pal_error(ret) : ret;
+        }
+        if (ret == -PAL_ERROR_INTERRUPTED)
+            continue;
+        if (ret < 0)
+            return ret;
+        if (ret == 0 || (size_t)ret > size)
+            return -PAL_ERROR_DENIED;
+        buf = (char*)buf + ret;
+        size -= ret;
+    }
+    return 0;
+}
 
-    /* serialize cargo handle into a blob hdl_data */
-    void* hdl_data = NULL;
-    ssize_t hdl_data_size = handle_serialize(cargo, &hdl_data);
-    if (hdl_data_size < 0)
-        return hdl_data_size;
+static int send_handles_batch(PAL_HANDLE hdl, PAL_HANDLE* cargos, size_t cnt) {
+    assert(cnt <= HANDLES_BATCH_SIZE);
 
-    ssize_t ret;
-    struct hdl_header hdl_hdr = {.fds = 0, .data_size = hdl_data_size};
-    int fd = hdl->process.stream;
+    struct hdls_header hdls_hdr = {.cnt = cnt};
+    void* hdl_data[HANDLES_BATCH_SIZE];
+    size_t data_size = 0;
+    int ret;
 
-    /* apply bitmask of FDs-to-transfer to hdl_hdr.fds and populate `fds` with these FDs */
-    int fds[MAX_FDS];
+    /* serialize cargo handles into blobs and populate `fds` with their FDs-to-transfer */
+    int fds[HANDLES_BATCH_SIZE * MAX_FDS];
     int nfds = 0;
-    for (int i = 0; i < MAX_FDS; i++)
-        if (HANDLE_HDR(cargo)->flags & (RFD(i) | WFD(i))) {
-            hdl_hdr.fds |= 1U << i;
-            fds[nfds++] = cargo->generic.fds[i];
+    size_t serialized = 0;
+    for (; serialized < cnt; serialized++) {
+        PAL_HANDLE cargo = cargos[serialized];
+        ssize_t size = handle_serialize(cargo, &hdl_data[serialized]);
+        if (size < 0) {
+            ret = size;
+            goto out;
         }
 
-    /* first send hdl_hdr so the recipient knows how many FDs were transferred + how large is cargo */
-    ret = ocall_send(fd, &hdl_hdr, sizeof(struct hdl_header), NULL, 0, NULL, 0);
-    if (ret < 0) {
-        free(hdl_data);
-        return unix_to_pal_error(ret);
+        struct hdl_header* hdl_hdr = &hdls_hdr.hdls[serialized];
+        hdl_hdr->data_size = size;
+        data_size += size;
+        for (int i = 0; i < MAX_FDS; i++)
+            if (HANDLE_HDR(cargo)->flags & (RFD(i) | WFD(i))) {
+                if (IS_HANDLE_TYPE(cargo, tcpsrv) && i == 1) {
+                    /* event FD of the accept queue, which stays with the sender, see db_sockets.c */
+                    continue;
+                }
+                hdl_hdr->fds |= 1U << i;
+                fds[nfds++] = cargo->generic.fds[i];
+            }
+    }
+    hdls_hdr.data_size = data_size;
+
+    char* data = malloc(data_size);
+    if (!data) {
+        ret = -PAL_ERROR_NOMEM;
+        goto out;
+    }
+    char* pos = data;
+    for (size_t i = 0; i < cnt; i++) {
+        memcpy(pos, hdl_data[i], hdls_hdr.hdls[i].data_size);
+        pos += hdls_hdr.hdls[i].data_size;
     }
 
-    /* construct ancillary data of FDs-to-transfer in a control message */
+    /* construct ancillary data of FDs-to-transfer of all handles in a control message */
     size_t fds_size = nfds * sizeof(int);
-    char control_buf[sizeof(struct cmsghdr) + fds_size];
+    char control_buf[CMSG_SPACE(sizeof(fds))];
 
     struct cmsghdr* control_hdr = (struct cmsghdr*)control_buf;
     control_hdr->cmsg_level     = SOL_SOCKET;
@@ -287,113 +363,177 @@ int _DkSendHandle(PAL_HANDLE hdl, PAL_HANDLE cargo) {
     control_hdr->cmsg_len       = CMSG_LEN(fds_size);
     memcpy(CMSG_DATA(control_hdr), fds, fds_size);
 
-    /* next send FDs-to-transfer as ancillary data */
-    ret = ocall_send(fd, DUMMYPAYLOAD, DUMMYPAYLOADSIZE, NULL, 0, control_hdr,
-                     control_hdr->cmsg_len);
-    if (ret < 0) {
-        free(hdl_data);
-        return unix_to_pal_error(ret);
+    /* first send hdls_hdr, carrying FDs-to-transfer as ancillary data */
+    ssize_t bytes = ocall_send(hdl->process.stream, &hdls_hdr, sizeof(hdls_hdr), NULL, 0,
+                               nfds ? control_hdr : NULL, nfds ? control_hdr->cmsg_len : 0);
+    if (bytes < 0 || (size_t)bytes > sizeof(hdls_hdr)) {
+        free(data);
+        ret = bytes < 0 ? unix_to_pal_error(bytes) : -PAL_ERROR_DENIED;
+        goto out;
     }
 
-    /* finally send the serialized cargo as payload (possibly encrypted) */
-    if (hdl->process.ssl_ctx) {
-        ret = _DkStreamSecureWrite(hdl->process.ssl_ctx, (uint8_t*)hdl_data, hdl_hdr.data_size,
-                                   /*is_blocking=*/!hdl->process.nonblocking);
-    } else {
-        ret = ocall_write(fd, hdl_data, hdl_hdr.data_size);
-        ret = ret < 0 ? unix_to_pal_error(ret) : ret;
+    /* a partial send is possible only for the payload, the FDs went with its first part */
+    ret = process_write_exact(hdl, (char*)&hdls_hdr + bytes, sizeof(hdls_hdr) - bytes,
+                              /*secure=*/false);
+    if (ret == 0) {
+        /* finally send the serialized cargos as payload (possibly encrypted), all at once */
+        ret = process_write_exact(hdl, data, data_size, /*secure=*/true);
     }
+    free(data);
 
-    free(hdl_data);
-    return ret < 0 ? ret : 0;
+out:
+    for (size_t i = 0; i < serialized; i++)
+        free(hdl_data[i]);
+    return ret;
 }
 
-/*!
- * \brief Receive `cargo` handle from a process identified via `hdl` handle.
- *
- * If `hdl` has an SSL context (i.e., its stream is encrypted), then `cargo` is sent encrypted.
- *
- * \param[in] hdl    Process stream on which to receive `cargo`.
- * \param[in] cargo  Arbitrary handle to receive on `hdl` and deserialize.
- * \return           0 on success, negative PAL error code otherwise.
- */
-int _DkReceiveHandle(PAL_HANDLE hdl, PAL_HANDLE* cargo) {
-    if (!IS_HANDLE_TYPE(hdl, process))
-        return -PAL_ERROR_BADHANDLE;
+static int receive_handles_batch(PAL_HANDLE hdl, PAL_HANDLE* cargos, size_t cnt) {
+    assert(cnt <= HANDLES_BATCH_SIZE);
 
+    struct hdls_header hdls_hdr;
     ssize_t ret;
-    struct hdl_header hdl_hdr;
-    int fd = hdl->process.stream;
-
-    /* first receive hdl_hdr so that we know how many FDs were transferred + how large is cargo */
-    ret = ocall_recv(fd, &hdl_hdr, sizeof(hdl_hdr), NULL, NULL, NULL, NULL);
-    if (ret < 0)
-        return unix_to_pal_error(ret);
-
-    if ((size_t)ret != sizeof(hdl_hdr)) {
-        /* This check is to shield from a Iago attack. We know that ocall_send() in _DkSendHandle()
-         * transfers the message atomically, and that our ocall_recv() receives it atomically. So
-         * the only valid values for ret must be zero or the size of the header. */
-        if (!ret)
-            return -PAL_ERROR_TRYAGAIN;
-        return -PAL_ERROR_DENIED;
-    }
 
-    /* prepare control-message buffer to receive ancillary data of FDs-to-transfer */
-    int nfds = 0;
-    for (int i = 0; i < MAX_FDS; i++)
-        if (hdl_hdr.fds & (1U << i))
-            nfds++;
+    /* first receive hdls_hdr, so that we know how many FDs were transferred + how large cargos
+     * are; the control buffer is sized for the maximum number of FDs in a batch */
+    char control_buf[CMSG_SPACE(HANDLES_BATCH_SIZE * MAX_FDS * sizeof(int))];
+    size_t control_buf_size = sizeof(control_buf);
 
-    size_t control_buf_size = sizeof(struct cmsghdr) + nfds * sizeof(int);
-    char control_buf[control_buf_size];
-
-    /* next receive FDs-to-transfer as ancillary data */
-    char dummypayload[DUMMYPAYLOADSIZE];
-    ret = ocall_recv(fd, dummypayload, DUMMYPAYLOADSIZE, NULL, NULL, control_buf,
+    ret = ocall_recv(hdl->process.stream, &hdls_hdr, sizeof(hdls_hdr), NULL, NULL, control_buf,
                      &control_buf_size);
     if (ret < 0)
         return unix_to_pal_error(ret);
+    if (ret == 0)
+        return -PAL_ERROR_TRYAGAIN;
+    if ((size_t)ret > sizeof(hdls_hdr) || control_buf_size > sizeof(control_buf))
+        return -PAL_ERROR_DENIED;
 
-    /* finally receive the serialized cargo as payload (possibly encrypted) */
-    char hdl_data[hdl_hdr.data_size];
-
-    if (hdl->process.ssl_ctx) {
-        ret = _DkStreamSecureRead(hdl->process.ssl_ctx, (uint8_t*)hdl_data, hdl_hdr.data_size,
-                                  /*is_blocking=*/!hdl->process.nonblocking);
-    } else {
-        ret = ocall_read(fd, hdl_data, hdl_hdr.data_size);
-        ret = ret < 0 ? unix_to_pal_error(ret) : ret;
+    /* the host controls everything received here, hence the checks below to shield from Iago
+     * attacks */
+    int* fds = NULL;
+    size_t fds_cnt = 0;
+    if (control_buf_size) {
+        struct cmsghdr* control_hdr = (struct cmsghdr*)control_buf;
+        if (control_buf_size < sizeof(*control_hdr) || control_hdr->cmsg_len < CMSG_LEN(0)
+                || control_hdr->cmsg_len > control_buf_size
+                || control_hdr->cmsg_level != SOL_SOCKET || control_hdr->cmsg_type != SCM_RIGHTS)
+            return -PAL_ERROR_DENIED;
+        fds = (int*)CMSG_DATA(control_hdr);
+        fds_cnt = (control_hdr->cmsg_len - CMSG_LEN(0)) / sizeof(int);
     }
+
+    ret = process_read_exact(hdl, (char*)&hdls_hdr + ret, sizeof(hdls_hdr) - ret,
+                             /*secure=*/false);
     if (ret < 0)
         return ret;
 
-    /* prepare array of FDs from the received FDs-to-transfer */
-    struct cmsghdr* control_hdr = (struct cmsghdr*)control_buf;
-    if (!control_hdr || control_hdr->cmsg_type != SCM_RIGHTS)
+    /* sanity checks: both sides agree on the number of handles and sizes add up */
+    if (hdls_hdr.cnt != cnt)
+        return -PAL_ERROR_DENIED;
+    size_t data_size = 0;
+    for (size_t i = 0; i < cnt; i++) {
+        if (hdls_hdr.hdls[i].data_size > hdls_hdr.data_size - data_size)
+            return -PAL_ERROR_DENIED;
+        data_size += hdls_hdr.hdls[i].data_size;
+    }
+    if (data_size != hdls_hdr.data_size)
         return -PAL_ERROR_DENIED;
 
-    int* fds = (int*)CMSG_DATA(control_hdr);
+    /* finally receive the serialized cargos as payload (possibly encrypted) */
+    char* data = malloc(data_size);
+    if (!data)
+        return -PAL_ERROR_NOMEM;
 
-    /* deserialize cargo handle from a blob hdl_data */
-    PAL_HANDLE handle = NULL;
-    ret = handle_deserialize(&handle, hdl_data, hdl_hdr.data_size, fds);
+    ret = process_read_exact(hdl, data, data_size, /*secure=*/true);
     if (ret < 0)
-        return ret;
+        goto out;
 
-    /* restore cargo handle's FDs from the received FDs-to-transfer */
-    int fds_idx = 0;
-    for (int i = 0; i < MAX_FDS; i++) {
-        if (hdl_hdr.fds & (1U << i)) {
-            if (fds_idx < nfds) {
-                handle->generic.fds[i] = fds[fds_idx++];
-            } else {
-                HANDLE_HDR(handle)->flags &= ~(RFD(i) | WFD(i));
+    /* FDs of handles are consumed in order; missing ones are replaced by -1 */
+    int hdl_fds[MAX_FDS];
+    size_t off = 0;
+    size_t fds_idx = 0;
+    size_t received = 0;
+    for (; received < cnt; received++) {
+        struct hdl_header* hdl_hdr = &hdls_hdr.hdls[received];
+
+        size_t hdl_fds_idx = fds_idx;
+        for (int i = 0, j = 0; i < MAX_FDS; i++)
+            if (hdl_hdr->fds & (1U << i))
+                hdl_fds[j++] = hdl_fds_idx < fds_cnt ? fds[hdl_fds_idx++] : -1;
+
+        /* deserialize cargo handle from a blob */
+        PAL_HANDLE handle = NULL;
+        ret = handle_deserialize(&handle, data + off, hdl_hdr->data_size, hdl_fds);
+        if (ret < 0)
+            goto out;
+        off += hdl_hdr->data_size;
+
+        /* restore cargo handle's FDs from the received FDs-to-transfer */
+        for (int i = 0; i < MAX_FDS; i++) {
+            if (hdl_hdr->fds & (1U << i)) {
+                if (fds_idx < fds_cnt) {
+                    handle->generic.fds[i] = fds[fds_idx++];
+                } else {
+                    HANDLE_HDR(handle)->flags &= ~(RFD(i) | WFD(i));
+                }
             }
         }
+
+        cargos[received] = handle;
+    }
+
+    ret = 0;
+out:
+    if (ret < 0) {
+        for (size_t i = 0; i < received; i++) {
+            free(cargos[i]);
+            cargos[i] = NULL;
+        }
+    }
+    free(data);
+    return ret;
+}
+
+/*!
+ * \brief Send `cargos` handles to a process identified via `hdl` handle.
+ *
+ * Handles are sent in batches, each with one message carrying host FDs of all its handles. If
+ * `hdl` has an SSL context (i.e., its stream is encrypted), then `cargos` are sent encrypted.
+ *
+ * \param[in] hdl     Process stream on which to send `cargos`.
+ * \param[in] cargos  Array of arbitrary handles to serialize and send on `hdl`.
+ * \param[in] count   Number of handles in `cargos`.
+ * \return            0 on success, negative PAL error code otherwise.
+ */
+int _DkSendHandles(PAL_HANDLE hdl, PAL_HANDLE* cargos, size_t count) {
+    if (!IS_HANDLE_TYPE(hdl, process))
+        return -PAL_ERROR_BADHANDLE;
+
+    for (size_t done = 0; done < count; done += HANDLES_BATCH_SIZE) {
+        int ret = send_handles_batch(hdl, cargos + done, MIN(count - done, HANDLES_BATCH_SIZE));
+        if (ret < 0)
+            return ret;
     }
+    return 0;
+}
 
-    *cargo = handle;
+/*!
+ * \brief Receive `cargos` handles from a process identified via `hdl` handle.
+ *
+ * \param[in]  hdl     Process stream on which to receive `cargos`.
+ * \param[out] cargos  Array to be filled with handles received on `hdl` and deserialized.
+ * \param[in]  count   Number of handles to receive, must match the number sent.
+ * \return             0 on success, negative PAL error code otherwise.
+ */
+int _DkReceiveHandles(PAL_HANDLE hdl, PAL_HANDLE* cargos, size_t count) {
+    if (!IS_HANDLE_TYPE(hdl, process))
+        return -PAL_ERROR_BADHANDLE;
+
+    for (size_t done = 0; done < count; done += HANDLES_BATCH_SIZE) {
+        int ret = receive_handles_batch(hdl, cargos + done,
+                                        MIN(count - done, HANDLES_BATCH_SIZE));
+        if (ret < 0)
+            return ret;
+    }
     return 0;
 }
 
@@ -5,6 +5,7 @@
  * This file contains APIs to create, exit and yield a thread.
  */
 
+#include <stdalign.h>
 #include <stddef.h> /* needed by <linux/signal.h> for size_t */
 #include <linux/mman.h>
 #include <linux/sched.h>
@@ -14,6 +15,7 @@
 
 #include "api.h"
 #include "ecall_types.h"
+#include "enclave_pages.h"
 #include "list.h"
 #include "pal.h"
 #include "pal_defs.h"
@@ -34,6 +36,7 @@ struct thread_param {
 };
 
 extern void* g_enclave_base;
+extern char enclave_entry[];
 
 /*
  * We do not currently handle tid counter wrap-around, and could, in
@@ -85,6 +88,11 @@ __attribute__((__optimize__("-fno-stack-protector"))) void pal_start_thread(void
         _DkProcessExit(1);
     }
     pal_set_tcb_stack_canary(stack_protector_canary);
+
+    ret = init_io_buffers();
+    if (ret < 0)
+        log_warning("Failed to map untrusted I/O buffers: %d\n", ret);
+
     PAL_TCB* pal_tcb = pal_get_tcb();
     memset(&pal_tcb->libos_tcb, 0, sizeof(pal_tcb->libos_tcb));
     callback((void*)param);
@@ -92,6 +100,74 @@ __attribute__((__optimize__("-fno-stack-protector"))) void pal_start_thread(void
     /* UNREACHABLE */
 }
 
+/*
+ * With EDMM, a new TCS (together with its SSA frames, TLS page and stacks) is created at runtime
+ * when all TCSs are in use. The memory is PAL-internal and is never freed: the host keeps the TCS
+ * in its pool and reuses it for later threads, exactly like TCSs created at enclave build time.
+ *
+ * Layout of the allocated area (from lower to higher addresses):
+ *   [ signal stack | stack | SSA frames | TLS page | TCS page ]
+ */
+static int create_dynamic_tcs(void** out_tcs) {
+    size_t ssa_size = SSA_FRAME_NUM * SSA_FRAME_SIZE;
+    size_t size = ENCLAVE_SIG_STACK_SIZE + ENCLAVE_STACK_SIZE + ssa_size + 2 * PRESET_PAGESIZE;
+
+    void* sig_stack = get_enclave_pages(/*addr=*/NULL, size, /*is_pal_internal=*/true);
+    if (!sig_stack)
+        return -ENOMEM;
+
+    void* stack = sig_stack + ENCLAVE_SIG_STACK_SIZE;
+    void* ssa   = stack + ENCLAVE_STACK_SIZE;
+    struct enclave_tls* tls = ssa + ssa_size;
+    sgx_arch_tcs_t* tcs = (void*)tls + PRESET_PAGESIZE;
+
+    /* per-enclave fields are the same as in the TLS of the current thread, see sgx_main.c */
+    memset(tls, 0, PRESET_PAGESIZE);
+    tls->common.self = (PAL_TCB*)tls;
+    tls->common.stack_protector_canary = STACK_PROTECTOR_CANARY_DEFAULT;
+    tls->enclave_size       = GET_ENCLAVE_TLS(enclave_size);
+    tls->tcs_offset         = (void*)tcs - g_enclave_base;
+    tls->initial_stack_addr = (uint64_t)stack + ENCLAVE_STACK_SIZE;
+    tls->sig_stack_low      = (uint64_t)sig_stack;
+    tls->sig_stack_high     = (uint64_t)sig_stack + ENCLAVE_SIG_STACK_SIZE;
+    tls->ssa                = ssa;
+    tls->gpr                = ssa + SSA_FRAME_SIZE - sizeof(sgx_pal_gpr_t);
+    tls->manifest_size      = GET_ENCLAVE_TLS(manifest_size);
+    tls->heap_min           = GET_ENCLAVE_TLS(heap_min);
+    tls->heap_max           = GET_ENCLAVE_TLS(heap_max);
+    tls->edmm_enabled       = GET_ENCLAVE_TLS(edmm_enabled);
+
+    memset(tcs, 0, PRESET_PAGESIZE);
+    tcs->flags     = g_sgx_enable_stats ? TCS_FLAGS_DBGOPTIN : 0;
+    tcs->ossa      = ssa - g_enclave_base;
+    tcs->nssa      = SSA_FRAME_NUM;
+    tcs->oentry    = (void*)enclave_entry - g_enclave_base;
+    tcs->ofs_base  = 0;
+    tcs->ogs_base  = (void*)tls - g_enclave_base;
+    tcs->ofs_limit = 0xfff;
+    tcs->ogs_limit = 0xfff;
+
+    int ret = ocall_edmm_convert_tcs(tcs);
+    if (ret < 0)
+        goto fail;
+
+    alignas(64) sgx_arch_sec_info_t secinfo = {
+        .flags = SGX_SECINFO_FLAGS_TCS | SGX_SECINFO_FLAGS_MODIFIED,
+    };
+    if (sgx_accept(&secinfo, tcs)) {
+        /* the page may have been converted, we cannot safely reuse it, so leak the area */
+        log_error("EDMM: accepting new TCS page %p failed\n", tcs);
+        return -EPERM;
+    }
+
+    *out_tcs = tcs;
+    return 0;
+
+fail:
+    free_enclave_pages(sig_stack, size);
+    return ret;
+}
+
 /* _DkThreadCreate for internal use. Create an internal thread
    inside the current process. The arguments callback and param
    specify the starting function and parameters */
@@ -114,9 +190,28 @@ int _DkThreadCreate(PAL_HANDLE* handle, int (*callback)(void*), const void* para
     LISTP_ADD_TAIL(&new_thread->thread, &g_thread_list, list);
     spinlock_unlock(&g_thread_list_lock);
 
-    int ret = ocall_clone_thread();
-    if (ret < 0)
+    int ret = ocall_clone_thread(/*dynamic_tcs=*/NULL);
+    if (ret == -EAGAIN && GET_ENCLAVE_TLS(edmm_enabled)) {
+        /* all TCSs are in use, create one more */
+        void* tcs;
+        ret = create_dynamic_tcs(&tcs);
+        if (ret < 0)
+            log_error("Cannot create a new TCS for a new thread: %d\n", ret);
+        else
+            ret = ocall_clone_thread(tcs);
+    }
+    if (ret < 0) {
+        if (ret == -EAGAIN) {
+            log_error("There are no available TCS pages left for a new thread!\n"
+                      "Please try to increase sgx.thread_num in the manifest.\n");
+        }
+        spinlock_lock(&g_thread_list_lock);
+        LISTP_DEL(&new_thread->thread, &g_thread_list, list);
+        spinlock_unlock(&g_thread_list_lock);
+        free(thread_param);
+        free(new_thread);
         return unix_to_pal_error(ret);
+    }
 
     /* There can be subtle race between the parent and child so hold the parent until child updates
        its tcs. */
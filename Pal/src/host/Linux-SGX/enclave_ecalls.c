@@ -19,7 +19,9 @@ static struct atomic_int g_enclave_start_called = ATOMIC_INIT(0);
 
 /* returns 0 if rpc_queue is valid/not requested, otherwise -1 */
 static int verify_and_init_rpc_queue(rpc_queue_t* untrusted_rpc_queue) {
-    g_rpc_queue = NULL;
+    g_rpc_queue        = NULL;
+    g_rpc_channels     = NULL;
+    g_rpc_channels_cnt = 0;
 
     if (!untrusted_rpc_queue) {
         /* user app didn't request RPC queue (i.e., the app didn't request exitless syscalls) */
@@ -31,6 +33,21 @@ static int verify_and_init_rpc_queue(rpc_queue_t* untrusted_rpc_queue) {
         return -1;
     }
 
+    /* channels are optional; copy the array pointer and size into trusted memory so that they
+     * cannot be changed after verification */
+    rpc_channel_t* channels = READ_ONCE(untrusted_rpc_queue->channels);
+    size_t channels_cnt     = READ_ONCE(untrusted_rpc_queue->channels_cnt);
+    if (channels) {
+        size_t channels_size;
+        if (!channels_cnt || __builtin_mul_overflow(channels_cnt, sizeof(*channels), &channels_size)
+                || !sgx_is_completely_outside_enclave(channels, channels_size)) {
+            /* malicious RPC channels, return error */
+            return -1;
+        }
+        g_rpc_channels     = channels;
+        g_rpc_channels_cnt = channels_cnt;
+    }
+
     g_rpc_queue = untrusted_rpc_queue;
     return 0;
 }
@@ -77,6 +94,8 @@ void handle_ecall(long ecall_index, void* ecall_args, void* exit_target, void* e
     SET_ENCLAVE_TLS(ustack_top,      ursp);
     SET_ENCLAVE_TLS(clear_child_tid, NULL);
     SET_ENCLAVE_TLS(untrusted_area_cache.in_use, 0UL);
+    for (size_t i = 0; i < IO_BUFFERS_PER_THREAD; i++)
+        __atomic_store_n(&get_tcb_trts()->io_buffers[i].in_use, 0, __ATOMIC_RELAXED);
 
     int64_t t = 0;
     if (__atomic_compare_exchange_n(&g_enclave_start_called.counter, &t, 1, /*weak=*/false,
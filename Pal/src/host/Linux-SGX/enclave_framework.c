@@ -1,17 +1,21 @@
 #include <stdbool.h>
 
 #include "api.h"
+#include "cpu.h"
 #include "crypto.h"
 #include "enclave_pages.h"
 #include "hex.h"
 #include "list.h"
+#include "lru_cache.h"
 #include "pal_error.h"
 #include "pal_internal.h"
 #include "pal_linux.h"
 #include "pal_linux_error.h"
 #include "pal_security.h"
+#include "perm.h"
 #include "sgx_arch.h"
 #include "spinlock.h"
+#include "stat.h"
 #include "toml.h"
 
 __sgx_mem_aligned struct pal_enclave_state g_pal_enclave_state;
@@ -19,7 +23,9 @@ __sgx_mem_aligned struct pal_enclave_state g_pal_enclave_state;
 void* g_enclave_base;
 void* g_enclave_top;
 
-static int register_trusted_file(const char* uri, const char* checksum_str, bool check_duplicates);
+static int register_trusted_file(const char* uri, const sgx_file_hash_t* file_hash,
+                                 size_t chunk_size, const char* chunks_uri,
+                                 const sgx_file_hash_t* chunks_hash);
 
 bool sgx_is_completely_within_enclave(const void* addr, size_t size) {
     if ((uintptr_t)addr > UINTPTR_MAX - size) {
@@ -85,13 +91,55 @@ void* sgx_alloc_on_ustack(size_t size) {
     return sgx_alloc_on_ustack_aligned(size, 1);
 }
 
+/* Checks that [ptr, ptr + size) is inside of the enclave and [uptr, uptr + size) is outside of it,
+ * with one overflow check for both. */
+static inline bool is_valid_boundary_copy(const void* ptr, const void* uptr, size_t size) {
+    if ((uintptr_t)ptr > UINTPTR_MAX - size || (uintptr_t)uptr > UINTPTR_MAX - size)
+        return false;
+    return g_enclave_base <= ptr && ptr + size <= g_enclave_top
+           && (uptr + size <= g_enclave_base || g_enclave_top <= uptr);
+}
+
+/* Copies with non-temporal stores, see SGX_COPY_NT_THRESHOLD. Only SSE2 is used, so this doesn't
+ * depend on the XFRM of the enclave. */
+static void copy_nt(void* dest, const void* src, size_t size) {
+    size_t head = ALIGN_UP_PTR_POW2(dest, 16) - dest;
+    memcpy(dest, src, head);
+    char* d = dest + head;
+    const char* s = src + head;
+    size -= head;
+
+    for (; size >= 64; size -= 64, d += 64, s += 64) {
+        __asm__ volatile(
+            "movdqu 0(%1), %%xmm0\n"
+            "movdqu 16(%1), %%xmm1\n"
+            "movdqu 32(%1), %%xmm2\n"
+            "movdqu 48(%1), %%xmm3\n"
+            "movntdq %%xmm0, 0(%0)\n"
+            "movntdq %%xmm1, 16(%0)\n"
+            "movntdq %%xmm2, 32(%0)\n"
+            "movntdq %%xmm3, 48(%0)\n"
+            :: "r"(d), "r"(s) : "xmm0", "xmm1", "xmm2", "xmm3", "memory");
+    }
+    __asm__ volatile("sfence" ::: "memory");
+    memcpy(d, s, size);
+}
+
+bool sgx_copy_from_enclave(void* uptr, const void* ptr, size_t size) {
+    if (!is_valid_boundary_copy(ptr, uptr, size))
+        return false;
+    if (size >= SGX_COPY_NT_THRESHOLD)
+        copy_nt(uptr, ptr, size);
+    else
+        memcpy(uptr, ptr, size);
+    return true;
+}
+
 void* sgx_copy_to_ustack(const void* ptr, size_t size) {
-    if (!sgx_is_completely_within_enclave(ptr, size)) {
-        return NULL;
-    }
+    /* on failure, the space is released by the caller's sgx_reset_ustack() */
     void* uptr = sgx_alloc_on_ustack(size);
-    if (uptr) {
-        memcpy(uptr, ptr, size);
+    if (!uptr || !sgx_copy_from_enclave(uptr, ptr, size)) {
+        return NULL;
     }
     return uptr;
 }
@@ -112,9 +160,7 @@ bool sgx_copy_ptr_to_enclave(void** ptr, void* uptr, size_t size) {
 }
 
 bool sgx_copy_to_enclave(void* ptr, size_t maxsize, const void* uptr, size_t usize) {
-    if (usize > maxsize ||
-        !sgx_is_completely_outside_enclave(uptr, usize) ||
-        !sgx_is_completely_within_enclave(ptr, usize)) {
+    if (usize > maxsize || !is_valid_boundary_copy(ptr, uptr, usize)) {
         return false;
     }
     memcpy(ptr, uptr, usize);
@@ -209,58 +255,376 @@ int sgx_verify_report(sgx_report_t* report) {
  * match, the file access will be rejected.
  *
  * During the generation of the SHA256 hash, a 128-bit hash (truncated SHA256) is also generated for
- * each chunk (of size TRUSTED_CHUNK_SIZE) in the file. The per-chunk hashes are used for partial
- * verification in future reads, to avoid re-verifying the whole file again or the need of caching
- * file contents. */
+ * each chunk (of TRUSTED_CHUNK_SIZE by default) in the file. The per-chunk hashes are used for
+ * partial verification in future reads, to avoid re-verifying the whole file again or the need of
+ * caching file contents.
+ *
+ * The chunk size may be set per file in the manifest ("sgx.trusted_chunk_size", a power of two
+ * between the page size and TRUSTED_CHUNK_SIZE_MAX): big chunks keep the hash arrays small and
+ * make per-read verification cheaper for big files which are read sequentially, small chunks make
+ * random accesses to big libraries cheaper. Like the hashes, it is covered by the signature of the
+ * manifest.
+ *
+ * Hashing the whole file on first open is expensive for big files of which only small parts are
+ * ever read. Therefore the manifest may also specify, for each trusted file, a chunk table
+ * generated by graphene-sgx-sign ("sgx.trusted_chunks") together with its SHA256 hash
+ * ("sgx.trusted_chunks_hash"). The table contains the file size (8 bytes, little-endian) followed
+ * by the 128-bit hashes of all chunks. On first open, Graphene then loads and verifies only this
+ * table; file chunks are verified lazily on reads, as usual.
+ *
+ * Manifests of big runtimes list tens of thousands of trusted files, so besides the list (in
+ * registration order) all files are kept in a hash table keyed by the normalized URI. Trusted files
+ * are looked up by exact URI; allowed files may also be directories, so a path is looked up
+ * together with all its parent directories (see lookup_trusted_file()), which costs a few hash
+ * lookups per path component instead of a scan over all registered files. A URI is registered
+ * only once, the first registration wins. */
 DEFINE_LIST(trusted_file);
 struct trusted_file {
     LIST_TYPE(trusted_file) list;
+    UT_hash_handle hh;
     uint64_t size;
     bool allowed;
     sgx_file_hash_t file_hash;      /* hash over the whole file, must be the same as in manifest */
+    size_t chunk_size;              /* size of the chunks of `chunk_hashes` */
     sgx_chunk_hash_t* chunk_hashes; /* array of hashes over separate file chunks */
+    char* chunks_uri;               /* pre-generated table of chunk hashes (optional) */
+    sgx_file_hash_t chunks_hash;    /* hash over the chunk table, must be the same as in manifest */
+    /* `sgx.trusted_files_hash_cache` state: host inode and mtime of the file when `chunk_hashes`
+     * were verified (if `host_meta_valid`), and hashes loaded from the cache which are not yet
+     * checked against the current host metadata (they become `chunk_hashes` on first open) */
+    bool host_meta_valid;
+    uint64_t host_ino;
+    uint64_t host_mtime_ns;
+    sgx_chunk_hash_t* cached_chunk_hashes;
+    bool runnable; /* execute permission of the host file at registration, see
+                    * get_trusted_file_attr() */
     size_t uri_len;
     char uri[]; /* must be NULL-terminated */
 };
 
 DEFINE_LISTP(trusted_file);
 static LISTP_TYPE(trusted_file) g_trusted_file_list = LISTP_INIT;
+static struct trusted_file* g_trusted_file_map = NULL; /* all files of the list, keyed by `uri` */
 static spinlock_t g_trusted_file_lock = INIT_SPINLOCK_UNLOCKED;
 static int g_file_check_policy = FILE_CHECK_POLICY_STRICT;
 
-/* Assumes `path` is normalized */
-static bool path_is_equal_or_subpath(const struct trusted_file* tf, const char* path,
-                                     size_t path_len) {
-    if (tf->uri_len > path_len || memcmp(tf->uri, path, tf->uri_len)) {
-        /* tf->uri is not prefix of `path` */
+/* `sgx.trusted_files_hash_cache` (NULL if disabled), see save_trusted_file_hash_cache() */
+static char* g_trusted_files_hash_cache_uri = NULL;
+static bool g_trusted_files_hash_cache_dirty = false; /* protected by `g_trusted_file_lock` */
+
+static struct trusted_file* find_trusted_file(const char* uri, size_t uri_len) {
+    assert(spinlock_is_locked(&g_trusted_file_lock));
+    struct trusted_file* tf = NULL;
+    HASH_FIND(hh, g_trusted_file_map, uri, uri_len, tf);
+    return tf;
+}
+
+/* Finds the entry for normalized `path`: either a trusted or allowed file with exactly this URI,
+ * or an allowed entry which is a parent directory of `path`. The latter are `path` cut right
+ * before or after each '/' (as the allowed URI may end with a slash), the nearest first, and the
+ * empty path "file:", which is a prefix of everything. */
+static struct trusted_file* lookup_trusted_file(const char* path, size_t path_len) {
+    assert(spinlock_is_locked(&g_trusted_file_lock));
+    struct trusted_file* tf = find_trusted_file(path, path_len);
+    if (tf)
+        return tf;
+
+    for (size_t i = path_len; i > URI_PREFIX_FILE_LEN; i--) {
+        if (path[i - 1] != '/')
+            continue;
+        if (i < path_len) {
+            tf = find_trusted_file(path, i);
+            if (tf && tf->allowed)
+                return tf;
+        }
+        tf = find_trusted_file(path, i - 1);
+        if (tf && tf->allowed)
+            return tf;
+    }
+
+    tf = find_trusted_file(URI_PREFIX_FILE, URI_PREFIX_FILE_LEN);
+    return tf && tf->allowed ? tf : NULL;
+}
+
+bool get_trusted_file_attr(const char* path, PAL_STREAM_ATTR* attr) {
+    size_t path_len = strlen(path);
+    char* uri = malloc(URI_PREFIX_FILE_LEN + path_len + 1);
+    if (!uri)
         return false;
+    memcpy(uri, URI_PREFIX_FILE, URI_PREFIX_FILE_LEN);
+    memcpy(uri + URI_PREFIX_FILE_LEN, path, path_len + 1);
+
+    spinlock_lock(&g_trusted_file_lock);
+    /* trusted files must have exactly the same URI */
+    struct trusted_file* tf = find_trusted_file(uri, URI_PREFIX_FILE_LEN + path_len);
+    bool found = tf && !tf->allowed;
+    if (found) {
+        /* the contents of the file are checked against its size and hashes at registration, so
+         * these are the only attributes the enclave can vouch for */
+        memset(attr, 0, sizeof(*attr));
+        attr->handle_type  = pal_type_file;
+        attr->readable     = PAL_TRUE;
+        attr->writable     = PAL_FALSE;
+        attr->runnable     = tf->runnable;
+        attr->share_flags  = S_IFREG | (tf->runnable ? PERM_r_xr_xr_x : PERM_r__r__r__);
+        attr->pending_size = tf->size;
+    }
+    spinlock_unlock(&g_trusted_file_lock);
+
+    free(uri);
+    return found;
+}
+
+/* Reads `size` bytes from host file `fd` into enclave buffer `buf`; a short file is an error. */
+static int read_all(int fd, uint8_t* buf, size_t size) {
+    size_t bytes = 0;
+    while (bytes < size) {
+        ssize_t n = ocall_read(fd, buf + bytes, size - bytes);
+        if (n == -EINTR)
+            continue;
+        if (n <= 0)
+            return n < 0 ? unix_to_pal_error(n) : -PAL_ERROR_DENIED;
+        bytes += n;
+    }
+    return 0;
+}
+
+/* Reads `size` bytes from host file `fd` into enclave buffer `buf` and calculates their hash; the
+ * copy is hashed, to prevent TOCTOU attacks. */
+static int read_and_hash(int fd, uint8_t* buf, size_t size, sgx_file_hash_t* hash) {
+    int ret = read_all(fd, buf, size);
+    if (ret < 0)
+        return ret;
+
+    LIB_SHA256_CONTEXT sha;
+    ret = lib_SHA256Init(&sha);
+    if (ret < 0)
+        return ret;
+    ret = lib_SHA256Update(&sha, buf, size);
+    if (ret < 0)
+        return ret;
+    return lib_SHA256Final(&sha, hash->bytes);
+}
+
+/* Reads the pre-generated chunk table of `tf` into the enclave and checks it against the hash from
+ * the manifest and against the file size. */
+static int load_trusted_chunk_table(struct trusted_file* tf, sgx_chunk_hash_t** chunk_hashes_ptr) {
+    int ret;
+    int fd = -1;
+    uint8_t* table = NULL;
+
+    size_t chunks_cnt = DIV_ROUND_UP(tf->size, tf->chunk_size);
+    size_t table_size = sizeof(uint64_t) + chunks_cnt * sizeof(sgx_chunk_hash_t);
+
+    table = malloc(table_size);
+    if (!table) {
+        ret = -PAL_ERROR_NOMEM;
+        goto out;
+    }
+
+    fd = ocall_open(tf->chunks_uri + URI_PREFIX_FILE_LEN, O_RDONLY, 0);
+    if (fd < 0) {
+        log_error("Cannot open chunk table %s of trusted file %s\n", tf->chunks_uri, tf->uri);
+        ret = unix_to_pal_error(fd);
+        goto out;
+    }
+
+    struct stat st;
+    ret = ocall_fstat(fd, &st);
+    if (ret < 0) {
+        ret = unix_to_pal_error(ret);
+        goto out;
+    }
+    if ((uint64_t)st.st_size != table_size) {
+        log_error("Chunk table %s does not match the size of trusted file %s\n", tf->chunks_uri,
+                  tf->uri);
+        ret = -PAL_ERROR_DENIED;
+        goto out;
+    }
+
+    sgx_file_hash_t table_hash;
+    ret = read_and_hash(fd, table, table_size, &table_hash);
+    if (ret < 0)
+        goto out;
+
+    /* check the hash of the table against the reference hash in the manifest; the file size stored
+     * in the table must match the size reported by the host (as the whole-file hash would) */
+    uint64_t file_size;
+    memcpy(&file_size, table, sizeof(file_size));
+    if (memcmp(&table_hash, &tf->chunks_hash, sizeof(table_hash)) || file_size != tf->size) {
+        log_error("Accessing file '%s' is denied: incorrect hash of its chunk table %s.\n",
+                  tf->uri, tf->chunks_uri);
+        ret = -PAL_ERROR_DENIED;
+        goto out;
+    }
+
+    /* drop the file size, the rest of the table is exactly the array of chunk hashes */
+    memmove(table, table + sizeof(uint64_t), table_size - sizeof(uint64_t));
+    *chunk_hashes_ptr = (sgx_chunk_hash_t*)table;
+    table = NULL;
+    ret = 0;
+out:
+    if (fd >= 0)
+        ocall_close(fd);
+    free(table);
+    return ret;
+}
+
+/*
+ * Parallel hashing of big trusted files on first open (`sgx.trusted_files_hash_threads`). SHA256
+ * over the whole file is inherently sequential, so only the per-chunk hashes are distributed: the
+ * file is copied into the enclave window by window, the opening thread feeds each window into the
+ * whole-file hash and then joins the worker threads in hashing the chunks of this window. Both kinds
+ * of hashes are calculated over the same in-enclave copy, so the host cannot present different
+ * contents to them. Files with chunks bigger than the window are hashed one chunk per window.
+ */
+#define TRUSTED_HASH_WINDOW_CHUNKS 64
+#define TRUSTED_HASH_WINDOW_SIZE   (TRUSTED_HASH_WINDOW_CHUNKS * TRUSTED_CHUNK_SIZE)
+
+static size_t g_trusted_files_hash_threads = 1;
+
+bool g_trusted_files_lazy_mmap = false;
+bool g_allowed_files_lazy_mmap = false;
+
+struct trusted_hash_job {
+    uint8_t* window;                /* in-enclave copy of the current window of the file */
+    size_t window_size;
+    size_t chunk_size;
+    sgx_chunk_hash_t* chunk_hashes; /* hashes of the chunks of the current window */
+    size_t next_chunk;              /* next chunk of the current window to be hashed */
+    size_t workers_finished;        /* number of workers done with the current window */
+    size_t workers_running;
+    uint64_t generation;            /* incremented on each new window (and on exit) */
+    bool exit;
+    int error;
+};
+
+static void hash_window_chunks(struct trusted_hash_job* job) {
+    size_t chunks_cnt = DIV_ROUND_UP(job->window_size, job->chunk_size);
+
+    while (true) {
+        size_t i = __atomic_fetch_add(&job->next_chunk, 1, __ATOMIC_RELAXED);
+        if (i >= chunks_cnt)
+            break;
+
+        size_t chunk_offset = i * job->chunk_size;
+        size_t chunk_size = MIN(job->window_size - chunk_offset, job->chunk_size);
+
+        sgx_chunk_hash_t chunk_hash[2]; /* each chunk_hash is 128 bits in size but we need 256 */
+        LIB_SHA256_CONTEXT chunk_sha;
+        int ret = lib_SHA256Init(&chunk_sha);
+        if (ret >= 0)
+            ret = lib_SHA256Update(&chunk_sha, job->window + chunk_offset, chunk_size);
+        if (ret >= 0)
+            ret = lib_SHA256Final(&chunk_sha, (uint8_t*)&chunk_hash[0]);
+        if (ret < 0) {
+            __atomic_store_n(&job->error, ret, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        /* note that we truncate SHA256 to 128 bits */
+        memcpy(&job->chunk_hashes[i], &chunk_hash[0], sizeof(job->chunk_hashes[i]));
+    }
+}
+
+static int trusted_hash_worker(void* arg) {
+    struct trusted_hash_job* job = arg;
+    uint64_t seen_generation = 0;
+
+    while (true) {
+        uint64_t generation;
+        while ((generation = __atomic_load_n(&job->generation, __ATOMIC_ACQUIRE))
+                == seen_generation)
+            CPU_RELAX();
+        seen_generation = generation;
+
+        if (__atomic_load_n(&job->exit, __ATOMIC_RELAXED))
+            break;
+
+        hash_window_chunks(job);
+        __atomic_add_fetch(&job->workers_finished, 1, __ATOMIC_RELEASE);
     }
-    if (tf->uri_len == path_len) {
-        /* Both are equal */
-        return true;
+
+    /* `job` may be freed as soon as the counter drops to zero, so this must be the last access */
+    __atomic_sub_fetch(&job->workers_running, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static int hash_trusted_file_parallel(const void* umem, uint64_t size, size_t chunk_size,
+                                      sgx_chunk_hash_t* chunk_hashes, sgx_file_hash_t* file_hash) {
+    int ret;
+
+    struct trusted_hash_job* job = calloc(1, sizeof(*job));
+    if (!job)
+        return -PAL_ERROR_NOMEM;
+
+    /* both are powers of two, so the window is a multiple of the chunk size */
+    size_t window_size = MAX(TRUSTED_HASH_WINDOW_SIZE, chunk_size);
+    job->chunk_size = chunk_size;
+    job->window = malloc(window_size);
+    if (!job->window) {
+        free(job);
+        return -PAL_ERROR_NOMEM;
     }
-    if (tf->uri[tf->uri_len - 1] == '/' || path[tf->uri_len] == '/') {
-        /* tf->uri is a subpath of `path` */
-        return true;
+
+    for (size_t i = 0; i < g_trusted_files_hash_threads - 1; i++) {
+        PAL_HANDLE thread;
+        __atomic_add_fetch(&job->workers_running, 1, __ATOMIC_RELAXED);
+        ret = _DkThreadCreate(&thread, trusted_hash_worker, job);
+        if (ret < 0) {
+            /* not fatal, hash with the threads we already have */
+            __atomic_sub_fetch(&job->workers_running, 1, __ATOMIC_RELAXED);
+            break;
+        }
     }
-    if (tf->uri_len == URI_PREFIX_FILE_LEN &&
-            !memcmp(tf->uri, URI_PREFIX_FILE, URI_PREFIX_FILE_LEN)) {
-        /* Empty path is a prefix of everything */
-        return true;
+    size_t workers_cnt = __atomic_load_n(&job->workers_running, __ATOMIC_RELAXED);
+
+    LIB_SHA256_CONTEXT file_sha;
+    ret = lib_SHA256Init(&file_sha);
+
+    for (uint64_t offset = 0; ret >= 0 && offset < size; offset += window_size) {
+        /* to prevent TOCTOU attacks, copy file contents into the enclave before hashing */
+        job->window_size = MIN(size - offset, window_size);
+        memcpy(job->window, umem + offset, job->window_size);
+
+        job->chunk_hashes = chunk_hashes + offset / chunk_size;
+        job->next_chunk = 0;
+        job->workers_finished = 0;
+        __atomic_add_fetch(&job->generation, 1, __ATOMIC_RELEASE);
+
+        ret = lib_SHA256Update(&file_sha, job->window, job->window_size);
+        hash_window_chunks(job);
+
+        /* the window buffer is reused for the next window, so wait for all workers */
+        while (__atomic_load_n(&job->workers_finished, __ATOMIC_ACQUIRE) < workers_cnt)
+            CPU_RELAX();
     }
-    return false;
+
+    __atomic_store_n(&job->exit, true, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&job->generation, 1, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&job->workers_running, __ATOMIC_ACQUIRE))
+        CPU_RELAX();
+
+    if (ret >= 0)
+        ret = job->error;
+    if (ret >= 0)
+        ret = lib_SHA256Final(&file_sha, file_hash->bytes);
+
+    free(job->window);
+    free(job);
+    return ret;
 }
 
-int load_trusted_file(PAL_HANDLE file, sgx_chunk_hash_t** chunk_hashes_ptr, uint64_t* size_ptr,
-                      int create, void** umem) {
+int load_trusted_file(PAL_HANDLE file, sgx_chunk_hash_t** chunk_hashes_ptr,
+                      size_t* chunk_size_ptr, uint64_t* size_ptr, int create, void** umem) {
     *chunk_hashes_ptr = NULL;
+    *chunk_size_ptr = TRUSTED_CHUNK_SIZE;
     *size_ptr = 0;
     *umem = NULL;
 
     uint8_t* tmp_chunk = NULL; /* scratch buf to calculate whole-file and chunk-of-file hashes */
 
     struct trusted_file* tf = NULL;
-    struct trusted_file* tmp;
     int ret, fd = file->file.fd;
     char* uri = malloc(URI_MAX);
     const size_t normpath_size = URI_MAX;
@@ -282,7 +646,7 @@ int load_trusted_file(PAL_HANDLE file, sgx_chunk_hash_t** chunk_hashes_ptr, uint
 
     /* always allow creating files */
     if (create) {
-        register_trusted_file(uri, NULL, /*check_duplicates=*/true);
+        register_trusted_file(uri, NULL, /*chunk_size=*/0, NULL, NULL);
         ret = 0;
         goto out_free;
     }
@@ -305,23 +669,8 @@ int load_trusted_file(PAL_HANDLE file, sgx_chunk_hash_t** chunk_hashes_ptr, uint
     len += URI_PREFIX_FILE_LEN;
 
     spinlock_lock(&g_trusted_file_lock);
-
-    LISTP_FOR_EACH_ENTRY(tmp, &g_trusted_file_list, list) {
-        if (tmp->chunk_hashes) {
-            /* trusted files: must be exactly the same URI */
-            if (tmp->uri_len == len && !memcmp(tmp->uri, normpath, len + 1)) {
-                tf = tmp;
-                break;
-            }
-        } else {
-            /* allowed files: must be a subfolder or file */
-            if (path_is_equal_or_subpath(tmp, normpath, len)) {
-                tf = tmp;
-                break;
-            }
-        }
-    }
-
+    /* trusted files must have exactly the same URI, allowed ones may also be parent directories */
+    tf = lookup_trusted_file(normpath, len);
     spinlock_unlock(&g_trusted_file_lock);
 
     if (!tf || tf->allowed) {
@@ -357,6 +706,8 @@ int load_trusted_file(PAL_HANDLE file, sgx_chunk_hash_t** chunk_hashes_ptr, uint
         return -PAL_ERROR_DENIED;
 
     sgx_chunk_hash_t* chunk_hashes = NULL;
+    size_t chunk_size = tf->chunk_size;
+    *chunk_size_ptr = chunk_size;
     /* mmap the whole trusted file in untrusted memory for future reads/writes; it is
      * caller's responsibility to unmap those areas after use */
     *size_ptr = tf->size;
@@ -377,13 +728,65 @@ int load_trusted_file(PAL_HANDLE file, sgx_chunk_hash_t** chunk_hashes_ptr, uint
     }
     spinlock_unlock(&g_trusted_file_lock);
 
-    chunk_hashes = malloc(sizeof(sgx_chunk_hash_t) * DIV_ROUND_UP(tf->size, TRUSTED_CHUNK_SIZE));
+    /* with the hash cache, hashes loaded from it are used only if the host file didn't change since
+     * they were verified; newly verified hashes are stored together with the current metadata */
+    bool host_meta_valid = false;
+    uint64_t host_ino = 0;
+    uint64_t host_mtime_ns = 0;
+    if (g_trusted_files_hash_cache_uri) {
+        struct stat st;
+        if (ocall_fstat(fd, &st) == 0) {
+            host_meta_valid = true;
+            host_ino = st.st_ino;
+            host_mtime_ns = st.st_mtime * TIME_NS_IN_S + st.st_mtime_nsec;
+        }
+
+        sgx_chunk_hash_t* stale_hashes = NULL;
+        spinlock_lock(&g_trusted_file_lock);
+        if (!tf->chunk_hashes && tf->cached_chunk_hashes) {
+            if (host_meta_valid && tf->host_ino == host_ino && tf->host_mtime_ns == host_mtime_ns)
+                tf->chunk_hashes = tf->cached_chunk_hashes;
+            else
+                stale_hashes = tf->cached_chunk_hashes;
+            tf->cached_chunk_hashes = NULL;
+        }
+        sgx_chunk_hash_t* verified_hashes = tf->chunk_hashes;
+        spinlock_unlock(&g_trusted_file_lock);
+
+        free(stale_hashes);
+        if (verified_hashes) {
+            *chunk_hashes_ptr = verified_hashes;
+            return 0;
+        }
+    }
+
+    if (tf->chunks_uri) {
+        ret = load_trusted_chunk_table(tf, &chunk_hashes);
+        if (ret < 0) {
+            chunk_hashes = NULL;
+            goto failed;
+        }
+        goto done;
+    }
+
+    chunk_hashes = malloc(sizeof(sgx_chunk_hash_t) * DIV_ROUND_UP(tf->size, chunk_size));
     if (!chunk_hashes) {
         ret = -PAL_ERROR_NOMEM;
         goto failed;
     }
 
-    tmp_chunk = malloc(TRUSTED_CHUNK_SIZE);
+    sgx_file_hash_t file_hash;
+
+    /* worker threads can be started only after the enclave is marked as initialized */
+    if (g_trusted_files_hash_threads > 1 && tf->size > TRUSTED_HASH_WINDOW_SIZE
+            && (g_pal_enclave_state.enclave_flags & PAL_ENCLAVE_INITIALIZED)) {
+        ret = hash_trusted_file_parallel(*umem, tf->size, chunk_size, chunk_hashes, &file_hash);
+        if (ret < 0)
+            goto failed;
+        goto check_file_hash;
+    }
+
+    tmp_chunk = malloc(chunk_size);
     if (!tmp_chunk) {
         ret = -PAL_ERROR_NOMEM;
         goto failed;
@@ -397,25 +800,25 @@ int load_trusted_file(PAL_HANDLE file, sgx_chunk_hash_t** chunk_hashes_ptr, uint
     if (ret < 0)
         goto failed;
 
-    for (; offset < tf->size; offset += TRUSTED_CHUNK_SIZE, chunk_hashes_item++) {
-        /* For each file chunk of size TRUSTED_CHUNK_SIZE, generate 128-bit hash from SHA-256 hash
-         * over contents of this file chunk (we simply truncate SHA-256 hash to first 128 bits; this
-         * is fine for integrity purposes). Also, generate a SHA-256 hash for the whole file
-         * contents to compare with the manifest "reference" hash value. */
-        uint64_t chunk_size = MIN(tf->size - offset, TRUSTED_CHUNK_SIZE);
+    for (; offset < tf->size; offset += chunk_size, chunk_hashes_item++) {
+        /* For each file chunk of size `chunk_size`, generate 128-bit hash from SHA-256 hash over
+         * contents of this file chunk (we simply truncate SHA-256 hash to first 128 bits; this is
+         * fine for integrity purposes). Also, generate a SHA-256 hash for the whole file contents
+         * to compare with the manifest "reference" hash value. */
+        uint64_t this_chunk_size = MIN(tf->size - offset, chunk_size);
         LIB_SHA256_CONTEXT chunk_sha;
         ret = lib_SHA256Init(&chunk_sha);
         if (ret < 0)
             goto failed;
 
         /* to prevent TOCTOU attacks, copy file contents into the enclave before hashing */
-        memcpy(tmp_chunk, *umem + offset, chunk_size);
+        memcpy(tmp_chunk, *umem + offset, this_chunk_size);
 
-        ret = lib_SHA256Update(&file_sha, tmp_chunk, chunk_size);
+        ret = lib_SHA256Update(&file_sha, tmp_chunk, this_chunk_size);
         if (ret < 0)
             goto failed;
 
-        ret = lib_SHA256Update(&chunk_sha, tmp_chunk, chunk_size);
+        ret = lib_SHA256Update(&chunk_sha, tmp_chunk, this_chunk_size);
         if (ret < 0)
             goto failed;
 
@@ -428,17 +831,18 @@ int load_trusted_file(PAL_HANDLE file, sgx_chunk_hash_t** chunk_hashes_ptr, uint
         memcpy(chunk_hashes_item, &chunk_hash[0], sizeof(*chunk_hashes_item));
     }
 
-    sgx_file_hash_t file_hash;
     ret = lib_SHA256Final(&file_sha, file_hash.bytes);
     if (ret < 0)
         goto failed;
 
+check_file_hash:
     /* check the generated hash-over-whole-file against the reference hash in the manifest */
     if (memcmp(&file_hash, &tf->file_hash, sizeof(file_hash))) {
         ret = -PAL_ERROR_DENIED;
         goto failed;
     }
 
+done:
     spinlock_lock(&g_trusted_file_lock);
     if (tf->chunk_hashes) {
         *chunk_hashes_ptr = tf->chunk_hashes;
@@ -448,6 +852,12 @@ int load_trusted_file(PAL_HANDLE file, sgx_chunk_hash_t** chunk_hashes_ptr, uint
         return 0;
     }
     tf->chunk_hashes = chunk_hashes;
+    if (host_meta_valid) {
+        tf->host_meta_valid = true;
+        tf->host_ino = host_ino;
+        tf->host_mtime_ns = host_mtime_ns;
+        g_trusted_files_hash_cache_dirty = true;
+    }
     *chunk_hashes_ptr = chunk_hashes;
     spinlock_unlock(&g_trusted_file_lock);
 
@@ -469,6 +879,480 @@ out_free:
     return ret;
 }
 
+/*
+ * Children inherit hashes of trusted file chunks from the parent (over the TLS-protected process
+ * stream, right after the master key), so that files already verified by the parent are not hashed
+ * again in each child, which is expensive for fork-heavy workloads. The parent is attested (it must
+ * have the same MRENCLAVE or be listed in the child's manifest), but its manifest may differ from
+ * the child's, so inherited hashes are used only for files with the same whole-file hash, size and
+ * chunk size in the child's manifest. Hashes are received before the child's manifest is parsed,
+ * see init_child_process(), and are adopted at the end of init_trusted_files().
+ *
+ * Stream format: for each file, `struct trusted_file_hashes_hdr` followed by URI (without the
+ * terminating zero) and hashes of all chunks; the end is marked by a header with zero `uri_len`.
+ */
+struct trusted_file_hashes_hdr {
+    uint64_t size;
+    sgx_file_hash_t file_hash;
+    uint64_t chunk_size;
+    uint64_t uri_len;
+};
+
+static bool is_valid_trusted_chunk_size(uint64_t chunk_size) {
+    return chunk_size >= PRESET_PAGESIZE && chunk_size <= TRUSTED_CHUNK_SIZE_MAX
+           && IS_POWER_OF_2(chunk_size);
+}
+
+struct inherited_trusted_file {
+    struct inherited_trusted_file* next;
+    struct trusted_file_hashes_hdr hdr;
+    sgx_chunk_hash_t* chunk_hashes;
+    char uri[]; /* NULL-terminated */
+};
+
+static struct inherited_trusted_file* g_inherited_trusted_files = NULL;
+
+static int secure_write_all(LIB_SSL_CONTEXT* ssl_ctx, const void* buf, size_t size) {
+    while (size) {
+        int ret = _DkStreamSecureWrite(ssl_ctx, buf, size, /*is_blocking=*/true);
+        if (ret == -PAL_ERROR_INTERRUPTED)
+            continue;
+        if (ret <= 0)
+            return ret < 0 ? ret : -PAL_ERROR_DENIED;
+        buf  += ret;
+        size -= ret;
+    }
+    return 0;
+}
+
+static int secure_read_all(LIB_SSL_CONTEXT* ssl_ctx, void* buf, size_t size) {
+    while (size) {
+        int ret = _DkStreamSecureRead(ssl_ctx, buf, size, /*is_blocking=*/true);
+        if (ret == -PAL_ERROR_INTERRUPTED)
+            continue;
+        if (ret <= 0)
+            return ret < 0 ? ret : -PAL_ERROR_DENIED;
+        buf  += ret;
+        size -= ret;
+    }
+    return 0;
+}
+
+int send_trusted_file_hashes(LIB_SSL_CONTEXT* ssl_ctx) {
+    int ret;
+    struct trusted_file* tf;
+
+    /* trusted files are never removed from the list and their hashes are never freed once set, but
+     * the list itself may grow concurrently, so take a snapshot first (without allocating memory
+     * under the lock) */
+    size_t cnt = 0;
+    spinlock_lock(&g_trusted_file_lock);
+    LISTP_FOR_EACH_ENTRY(tf, &g_trusted_file_list, list) {
+        if (!tf->allowed && tf->chunk_hashes && tf->size)
+            cnt++;
+    }
+    spinlock_unlock(&g_trusted_file_lock);
+
+    struct trusted_file** tfs = NULL;
+    if (cnt) {
+        tfs = malloc(cnt * sizeof(*tfs));
+        if (!tfs)
+            return -PAL_ERROR_NOMEM;
+    }
+
+    size_t filled = 0;
+    spinlock_lock(&g_trusted_file_lock);
+    LISTP_FOR_EACH_ENTRY(tf, &g_trusted_file_list, list) {
+        if (filled == cnt)
+            break;
+        if (!tf->allowed && tf->chunk_hashes && tf->size)
+            tfs[filled++] = tf;
+    }
+    spinlock_unlock(&g_trusted_file_lock);
+
+    for (size_t i = 0; i < filled; i++) {
+        struct trusted_file_hashes_hdr hdr = {
+            .size       = tfs[i]->size,
+            .file_hash  = tfs[i]->file_hash,
+            .chunk_size = tfs[i]->chunk_size,
+            .uri_len    = tfs[i]->uri_len,
+        };
+        ret = secure_write_all(ssl_ctx, &hdr, sizeof(hdr));
+        if (ret < 0)
+            goto out;
+        ret = secure_write_all(ssl_ctx, tfs[i]->uri, tfs[i]->uri_len);
+        if (ret < 0)
+            goto out;
+        ret = secure_write_all(ssl_ctx, tfs[i]->chunk_hashes,
+                               DIV_ROUND_UP(hdr.size, hdr.chunk_size) * sizeof(sgx_chunk_hash_t));
+        if (ret < 0)
+            goto out;
+    }
+
+    struct trusted_file_hashes_hdr end_hdr = {0};
+    ret = secure_write_all(ssl_ctx, &end_hdr, sizeof(end_hdr));
+out:
+    free(tfs);
+    return ret;
+}
+
+int receive_trusted_file_hashes(LIB_SSL_CONTEXT* ssl_ctx) {
+    while (true) {
+        struct trusted_file_hashes_hdr hdr;
+        int ret = secure_read_all(ssl_ctx, &hdr, sizeof(hdr));
+        if (ret < 0)
+            return ret;
+        if (!hdr.uri_len)
+            return 0;
+
+        if (hdr.uri_len >= URI_MAX || !hdr.size || !is_valid_trusted_chunk_size(hdr.chunk_size)
+                || hdr.size > SIZE_MAX - hdr.chunk_size) {
+            log_error("Invalid trusted file hashes received from parent\n");
+            return -PAL_ERROR_DENIED;
+        }
+        size_t hashes_size = DIV_ROUND_UP(hdr.size, hdr.chunk_size) * sizeof(sgx_chunk_hash_t);
+
+        struct inherited_trusted_file* itf = malloc(sizeof(*itf) + hdr.uri_len + 1);
+        if (!itf)
+            return -PAL_ERROR_NOMEM;
+        itf->hdr = hdr;
+        itf->chunk_hashes = malloc(hashes_size);
+        if (!itf->chunk_hashes) {
+            free(itf);
+            return -PAL_ERROR_NOMEM;
+        }
+
+        ret = secure_read_all(ssl_ctx, itf->uri, hdr.uri_len);
+        if (ret == 0)
+            ret = secure_read_all(ssl_ctx, itf->chunk_hashes, hashes_size);
+        if (ret < 0) {
+            free(itf->chunk_hashes);
+            free(itf);
+            return ret;
+        }
+        itf->uri[hdr.uri_len] = '\0';
+
+        itf->next = g_inherited_trusted_files;
+        g_inherited_trusted_files = itf;
+    }
+}
+
+static void adopt_inherited_trusted_file_hashes(void) {
+    while (g_inherited_trusted_files) {
+        struct inherited_trusted_file* itf = g_inherited_trusted_files;
+        g_inherited_trusted_files = itf->next;
+
+        spinlock_lock(&g_trusted_file_lock);
+        struct trusted_file* tf = find_trusted_file(itf->uri, itf->hdr.uri_len);
+        if (tf && !tf->allowed && !tf->chunk_hashes && tf->size == itf->hdr.size
+                && tf->chunk_size == itf->hdr.chunk_size
+                && !memcmp(&tf->file_hash, &itf->hdr.file_hash, sizeof(tf->file_hash))) {
+            tf->chunk_hashes = itf->chunk_hashes;
+            itf->chunk_hashes = NULL;
+        }
+        spinlock_unlock(&g_trusted_file_lock);
+
+        free(itf->chunk_hashes);
+        free(itf);
+    }
+}
+
+/*
+ * Hashing big trusted files on first open dominates the start-up of many workloads, and it is
+ * repeated on every run. With `sgx.trusted_files_hash_cache`, the chunk hashes of the files
+ * verified in a run are written at process exit to a host file, MAC-protected with a seal key bound
+ * to MRENCLAVE. MRENCLAVE covers the manifest (with the hashes of all trusted files), so the cache
+ * is accepted only by the very same enclave and is invalidated by any change of the manifest. On
+ * start-up, the entries whose size, chunk size and whole-file hash match the manifest are loaded;
+ * on first open, their hashes are used only if the inode and mtime of the host file didn't change
+ * since they were verified, otherwise the file is hashed again. The host metadata is not relied
+ * upon for security (reads are still verified chunk by chunk against the MAC-protected hashes), it
+ * only makes sure that a file modified on the host is rejected on open, as without the cache.
+ *
+ * File format: `struct trusted_file_hash_cache_hdr`, then for each file
+ * `struct trusted_file_hash_cache_entry` followed by URI (without the terminating zero) and hashes
+ * of all chunks. The MAC in the header covers everything after the header.
+ */
+#define TRUSTED_FILE_HASH_CACHE_MAGIC "GSGXHC02"
+
+struct trusted_file_hash_cache_hdr {
+    char magic[8];
+    sgx_key_id_t key_id;   /* random, for a fresh seal key on each write */
+    sgx_cpu_svn_t cpu_svn; /* SVNs of the writer, the seal key is derived for them */
+    sgx_isv_svn_t isv_svn;
+    uint16_t reserved[3];
+    sgx_mac_t mac;
+};
+
+struct trusted_file_hash_cache_entry {
+    uint64_t size;
+    sgx_file_hash_t file_hash;
+    uint64_t chunk_size;
+    uint64_t host_ino;
+    uint64_t host_mtime_ns;
+    uint64_t uri_len;
+};
+
+static int hash_cache_mac(const struct trusted_file_hash_cache_hdr* hdr, const uint8_t* data,
+                          size_t size, sgx_mac_t* mac) {
+    __sgx_mem_aligned sgx_key_request_t keyrequest;
+    memset(&keyrequest, 0, sizeof(keyrequest));
+    keyrequest.key_name   = SEAL_KEY;
+    keyrequest.key_policy = KEYPOLICY_MRENCLAVE;
+    keyrequest.isv_svn    = hdr->isv_svn;
+    memcpy(&keyrequest.cpu_svn, &hdr->cpu_svn, sizeof(keyrequest.cpu_svn));
+    memcpy(&keyrequest.key_id, &hdr->key_id, sizeof(keyrequest.key_id));
+    keyrequest.attribute_mask.flags = SGX_FLAGS_INITIALIZED | SGX_FLAGS_DEBUG | SGX_FLAGS_MODE64BIT;
+
+    sgx_key_128bit_t seal_key __attribute__((aligned(sizeof(sgx_key_128bit_t))));
+    if (sgx_getkey(&keyrequest, &seal_key)) {
+        /* e.g. written with a newer CPU SVN than the current one */
+        return -PAL_ERROR_DENIED;
+    }
+
+    int ret = lib_AESCMAC((uint8_t*)&seal_key, sizeof(seal_key), data, size, (uint8_t*)mac,
+                          sizeof(*mac));
+    memset(&seal_key, 0, sizeof(seal_key));
+    return ret;
+}
+
+/* Returns the hashes of `tf` to be written to the cache, if any. */
+static const sgx_chunk_hash_t* hash_cache_hashes(struct trusted_file* tf) {
+    assert(spinlock_is_locked(&g_trusted_file_lock));
+    if (tf->allowed || !tf->size || !tf->host_meta_valid)
+        return NULL;
+    return tf->chunk_hashes ?: tf->cached_chunk_hashes;
+}
+
+static int load_trusted_file_hash_cache(void) {
+    int ret;
+    uint8_t* data = NULL;
+
+    int fd = ocall_open(g_trusted_files_hash_cache_uri + URI_PREFIX_FILE_LEN, O_RDONLY, 0);
+    if (fd == -ENOENT)
+        return 0; /* not written yet */
+    if (fd < 0)
+        return unix_to_pal_error(fd);
+
+    struct stat st;
+    ret = ocall_fstat(fd, &st);
+    if (ret < 0) {
+        ret = unix_to_pal_error(ret);
+        goto out;
+    }
+    struct trusted_file_hash_cache_hdr hdr;
+    if ((uint64_t)st.st_size <= sizeof(hdr)) {
+        ret = -PAL_ERROR_DENIED;
+        goto out;
+    }
+    size_t size = st.st_size - sizeof(hdr);
+    data = malloc(size);
+    if (!data) {
+        ret = -PAL_ERROR_NOMEM;
+        goto out;
+    }
+
+    ret = read_all(fd, (uint8_t*)&hdr, sizeof(hdr));
+    if (ret == 0)
+        ret = read_all(fd, data, size);
+    if (ret < 0)
+        goto out;
+
+    sgx_mac_t mac;
+    if (memcmp(hdr.magic, TRUSTED_FILE_HASH_CACHE_MAGIC, sizeof(hdr.magic))
+            || hash_cache_mac(&hdr, data, size, &mac) < 0
+            || memcmp(&mac, &hdr.mac, sizeof(mac))) {
+        ret = -PAL_ERROR_DENIED;
+        goto out;
+    }
+
+    size_t off = 0;
+    while (off < size) {
+        struct trusted_file_hash_cache_entry entry;
+        if (size - off < sizeof(entry)) {
+            ret = -PAL_ERROR_DENIED;
+            goto out;
+        }
+        memcpy(&entry, data + off, sizeof(entry));
+        off += sizeof(entry);
+
+        if (!entry.size || !is_valid_trusted_chunk_size(entry.chunk_size)
+                || entry.size > SIZE_MAX - entry.chunk_size || entry.uri_len >= URI_MAX
+                || size - off < entry.uri_len) {
+            ret = -PAL_ERROR_DENIED;
+            goto out;
+        }
+        const char* uri = (const char*)data + off;
+        off += entry.uri_len;
+        size_t hashes_size = DIV_ROUND_UP(entry.size, entry.chunk_size)
+                             * sizeof(sgx_chunk_hash_t);
+        if (size - off < hashes_size) {
+            ret = -PAL_ERROR_DENIED;
+            goto out;
+        }
+        const uint8_t* hashes = data + off;
+        off += hashes_size;
+
+        spinlock_lock(&g_trusted_file_lock);
+        struct trusted_file* tf = find_trusted_file(uri, entry.uri_len);
+        bool matches = tf && !tf->allowed && !tf->chunk_hashes && !tf->cached_chunk_hashes
+                       && tf->size == entry.size && tf->chunk_size == entry.chunk_size
+                       && !memcmp(&tf->file_hash, &entry.file_hash, sizeof(tf->file_hash));
+        spinlock_unlock(&g_trusted_file_lock);
+        if (!matches)
+            continue;
+
+        sgx_chunk_hash_t* chunk_hashes = malloc(hashes_size);
+        if (!chunk_hashes) {
+            ret = -PAL_ERROR_NOMEM;
+            goto out;
+        }
+        memcpy(chunk_hashes, hashes, hashes_size);
+
+        spinlock_lock(&g_trusted_file_lock);
+        if (!tf->chunk_hashes && !tf->cached_chunk_hashes) {
+            tf->cached_chunk_hashes = chunk_hashes;
+            tf->host_meta_valid = true;
+            tf->host_ino = entry.host_ino;
+            tf->host_mtime_ns = entry.host_mtime_ns;
+            chunk_hashes = NULL;
+        }
+        spinlock_unlock(&g_trusted_file_lock);
+        free(chunk_hashes);
+    }
+    ret = 0;
+out:
+    ocall_close(fd);
+    free(data);
+    return ret;
+}
+
+static int write_all(int fd, const void* buf, size_t size) {
+    while (size) {
+        ssize_t n = ocall_write(fd, buf, size);
+        if (n == -EINTR)
+            continue;
+        if (n <= 0)
+            return n < 0 ? unix_to_pal_error(n) : -PAL_ERROR_DENIED;
+        buf  += n;
+        size -= n;
+    }
+    return 0;
+}
+
+void save_trusted_file_hash_cache(void) {
+    int ret;
+    struct trusted_file* tf;
+    const sgx_chunk_hash_t* hashes;
+    uint8_t* data = NULL;
+    char* tmp_path = NULL;
+    int fd = -1;
+
+    if (!g_trusted_files_hash_cache_uri)
+        return;
+
+    /* the list may grow and files may get their hashes concurrently (hashes are never freed once
+     * set), so only the entries which fit into the buffer sized in the first pass are written */
+    size_t size = 0;
+    spinlock_lock(&g_trusted_file_lock);
+    bool dirty = g_trusted_files_hash_cache_dirty;
+    LISTP_FOR_EACH_ENTRY(tf, &g_trusted_file_list, list) {
+        if (hash_cache_hashes(tf))
+            size += sizeof(struct trusted_file_hash_cache_entry) + tf->uri_len
+                    + DIV_ROUND_UP(tf->size, tf->chunk_size) * sizeof(sgx_chunk_hash_t);
+    }
+    spinlock_unlock(&g_trusted_file_lock);
+    if (!dirty || !size)
+        return;
+
+    data = malloc(size);
+    if (!data) {
+        ret = -PAL_ERROR_NOMEM;
+        goto out;
+    }
+
+    size_t filled = 0;
+    spinlock_lock(&g_trusted_file_lock);
+    LISTP_FOR_EACH_ENTRY(tf, &g_trusted_file_list, list) {
+        hashes = hash_cache_hashes(tf);
+        if (!hashes)
+            continue;
+        struct trusted_file_hash_cache_entry entry = {
+            .size          = tf->size,
+            .file_hash     = tf->file_hash,
+            .chunk_size    = tf->chunk_size,
+            .host_ino      = tf->host_ino,
+            .host_mtime_ns = tf->host_mtime_ns,
+            .uri_len       = tf->uri_len,
+        };
+        size_t hashes_size = DIV_ROUND_UP(tf->size, tf->chunk_size) * sizeof(*hashes);
+        if (size - filled < sizeof(entry) + entry.uri_len + hashes_size)
+            continue;
+        memcpy(data + filled, &entry, sizeof(entry));
+        filled += sizeof(entry);
+        memcpy(data + filled, tf->uri, entry.uri_len);
+        filled += entry.uri_len;
+        memcpy(data + filled, hashes, hashes_size);
+        filled += hashes_size;
+    }
+    g_trusted_files_hash_cache_dirty = false;
+    spinlock_unlock(&g_trusted_file_lock);
+
+    __sgx_mem_aligned sgx_target_info_t targetinfo = {0};
+    __sgx_mem_aligned sgx_report_data_t reportdata = {0};
+    __sgx_mem_aligned sgx_report_t report;
+    if (sgx_report(&targetinfo, &reportdata, &report)) {
+        ret = -PAL_ERROR_DENIED;
+        goto out;
+    }
+
+    struct trusted_file_hash_cache_hdr hdr = {0};
+    memcpy(hdr.magic, TRUSTED_FILE_HASH_CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.cpu_svn = report.body.cpu_svn;
+    hdr.isv_svn = report.body.isv_svn;
+    uint64_t suffix;
+    ret = _DkRandomBitsRead(&hdr.key_id, sizeof(hdr.key_id));
+    if (ret == 0)
+        ret = _DkRandomBitsRead(&suffix, sizeof(suffix));
+    if (ret == 0)
+        ret = hash_cache_mac(&hdr, data, filled, &hdr.mac);
+    if (ret < 0)
+        goto out;
+
+    /* processes of the same application may exit at the same time, so each one writes a new file
+     * and atomically replaces the old cache with it */
+    const char* path = g_trusted_files_hash_cache_uri + URI_PREFIX_FILE_LEN;
+    size_t tmp_path_size = strlen(path) + 1 + 16 + 1;
+    tmp_path = malloc(tmp_path_size);
+    if (!tmp_path) {
+        ret = -PAL_ERROR_NOMEM;
+        goto out;
+    }
+    snprintf(tmp_path, tmp_path_size, "%s.%016lx", path, suffix);
+
+    fd = ocall_open(tmp_path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        ret = unix_to_pal_error(fd);
+        goto out;
+    }
+    ret = write_all(fd, &hdr, sizeof(hdr));
+    if (ret == 0)
+        ret = write_all(fd, data, filled);
+    ocall_close(fd);
+    if (ret == 0) {
+        ret = ocall_rename(tmp_path, path);
+        ret = ret < 0 ? unix_to_pal_error(ret) : 0;
+    }
+    if (ret < 0)
+        ocall_delete(tmp_path);
+out:
+    if (ret < 0)
+        log_warning("Cannot write trusted file hash cache %s: %s\n",
+                    g_trusted_files_hash_cache_uri, pal_strerror(ret));
+    free(data);
+    free(tmp_path);
+}
+
 int get_file_check_policy(void) {
     return g_file_check_policy;
 }
@@ -477,27 +1361,125 @@ static void set_file_check_policy(int policy) {
     g_file_check_policy = policy;
 }
 
-int copy_and_verify_trusted_file(const char* path, uint8_t* buf, const void* umem,
-                                 off_t aligned_offset, off_t aligned_end, off_t offset, off_t end,
-                                 sgx_chunk_hash_t* chunk_hashes, size_t file_size) {
+/*
+ * Enclave-wide LRU cache of verified trusted-file chunks (`sgx.trusted_files_cache_size`), shared
+ * by all handles, so that repeated reads of hot files (e.g. shared libraries) skip copying from
+ * untrusted memory and hashing. Note that only the contents can be cached: remembering that a chunk
+ * was verified would be useless because the host may modify the untrusted copy at any time.
+ *
+ * A chunk is identified by the address of its hash in the `chunk_hashes` array of its file: these
+ * arrays are shared by all handles of a trusted file and are never freed.
+ */
+struct trusted_chunk {
+    size_t size;
+    uint8_t data[];
+};
+
+static size_t g_trusted_chunk_cache_max_size = 0;
+static size_t g_trusted_chunk_cache_size = 0;
+static lruc_context_t* g_trusted_chunk_cache = NULL;
+static spinlock_t g_trusted_chunk_cache_lock = INIT_SPINLOCK_UNLOCKED;
+
+/* Copies [copy_start, copy_end) of the cached chunk (within the chunk) into `buf`, if there is such
+ * a cached chunk */
+static bool trusted_chunk_cache_get(const sgx_chunk_hash_t* chunk_hash, uint8_t* buf,
+                                    size_t copy_start, size_t copy_end) {
+    bool found = false;
+
+    spinlock_lock(&g_trusted_chunk_cache_lock);
+    struct trusted_chunk* chunk = lruc_get(g_trusted_chunk_cache, (uint64_t)chunk_hash);
+    if (chunk) {
+        assert(copy_end <= chunk->size);
+        memcpy(buf, chunk->data + copy_start, copy_end - copy_start);
+        found = true;
+    }
+    spinlock_unlock(&g_trusted_chunk_cache_lock);
+    return found;
+}
+
+static void trusted_chunk_cache_add(const sgx_chunk_hash_t* chunk_hash, const uint8_t* data,
+                                    size_t size) {
+    struct trusted_chunk* chunk = malloc(sizeof(*chunk) + size);
+    if (!chunk)
+        return;
+    chunk->size = size;
+    memcpy(chunk->data, data, size);
+
+    spinlock_lock(&g_trusted_chunk_cache_lock);
+    /* another thread may have added the same chunk in the meantime */
+    if (lruc_find(g_trusted_chunk_cache, (uint64_t)chunk_hash)
+            || !lruc_add(g_trusted_chunk_cache, (uint64_t)chunk_hash, chunk)) {
+        spinlock_unlock(&g_trusted_chunk_cache_lock);
+        free(chunk);
+        return;
+    }
+    g_trusted_chunk_cache_size += size;
+
+    while (g_trusted_chunk_cache_size > g_trusted_chunk_cache_max_size) {
+        struct trusted_chunk* last = lruc_get_last(g_trusted_chunk_cache);
+        assert(last);
+        g_trusted_chunk_cache_size -= last->size;
+        lruc_remove_last(g_trusted_chunk_cache);
+        free(last);
+    }
+    spinlock_unlock(&g_trusted_chunk_cache_lock);
+}
+
+/* Copies `size` bytes from untrusted `src` into the enclave buffer `dst` and feeds them to `sha` in
+ * the same pass: each block is hashed right after being copied, while it is still in the cache. The
+ * hash is always calculated over the in-enclave copy, to prevent TOCTOU attacks. */
+#define TRUSTED_COPY_BLOCK_SIZE 1024UL
+
+static int copy_and_hash(LIB_SHA256_CONTEXT* sha, uint8_t* dst, const uint8_t* src, size_t size) {
+    while (size) {
+        size_t block_size = MIN(size, TRUSTED_COPY_BLOCK_SIZE);
+        memcpy(dst, src, block_size);
+
+        int ret = lib_SHA256Update(sha, dst, block_size);
+        if (ret < 0)
+            return ret;
+
+        dst  += block_size;
+        src  += block_size;
+        size -= block_size;
+    }
+    return 0;
+}
+
+/* `tmp_chunk` is a scratch buffer of `chunk_size` bytes; if NULL, it is allocated only if some
+ * chunk is not completely requested */
+static int __copy_and_verify_trusted_file(const char* path, uint8_t* buf, const void* umem,
+                                          off_t aligned_offset, off_t aligned_end, off_t offset,
+                                          off_t end, sgx_chunk_hash_t* chunk_hashes,
+                                          size_t chunk_size, size_t file_size, uint8_t* tmp_chunk,
+                                          bool use_cache) {
     int ret = 0;
 
-    assert(IS_ALIGNED(aligned_offset, TRUSTED_CHUNK_SIZE));
+    assert(IS_ALIGNED(aligned_offset, chunk_size));
     assert(offset >= aligned_offset && end <= aligned_end);
 
-    uint8_t* tmp_chunk = malloc(TRUSTED_CHUNK_SIZE);
-    if (!tmp_chunk) {
-        ret = -PAL_ERROR_NOMEM;
-        goto failed;
-    }
+    uint8_t* allocated_tmp_chunk = NULL;
+    use_cache = use_cache && g_trusted_chunk_cache;
 
-    sgx_chunk_hash_t* chunk_hashes_item = chunk_hashes + aligned_offset / TRUSTED_CHUNK_SIZE;
+    sgx_chunk_hash_t* chunk_hashes_item = chunk_hashes + aligned_offset / chunk_size;
 
     uint8_t* buf_pos = buf;
     off_t chunk_offset = aligned_offset;
-    for (; chunk_offset < aligned_end; chunk_offset += TRUSTED_CHUNK_SIZE, chunk_hashes_item++) {
-        size_t chunk_size = MIN(file_size - chunk_offset, TRUSTED_CHUNK_SIZE);
-        off_t chunk_end   = chunk_offset + chunk_size;
+    for (; chunk_offset < aligned_end; chunk_offset += chunk_size, chunk_hashes_item++) {
+        size_t this_chunk_size = MIN(file_size - chunk_offset, chunk_size);
+        off_t chunk_end        = chunk_offset + this_chunk_size;
+
+        /* determine which part of the chunk is needed by the caller */
+        off_t copy_start = MAX(chunk_offset, offset);
+        off_t copy_end   = MIN(chunk_end, end);
+        assert(copy_end > copy_start);
+
+        if (use_cache
+                && trusted_chunk_cache_get(chunk_hashes_item, buf_pos, copy_start - chunk_offset,
+                                           copy_end - chunk_offset)) {
+            buf_pos += copy_end - copy_start;
+            continue;
+        }
 
         sgx_chunk_hash_t chunk_hash[2]; /* each chunk_hash is 128 bits in size but we need 256 */
 
@@ -506,32 +1488,50 @@ int copy_and_verify_trusted_file(const char* path, uint8_t* buf, const void* ume
         if (ret < 0)
             goto failed;
 
+        /* verified contents of the whole chunk, for the cache */
+        const uint8_t* chunk_data;
+
         if (chunk_offset >= offset && chunk_end <= end) {
             /* if current chunk-to-copy completely resides in the requested region-to-copy,
              * directly copy into buf (without a scratch buffer) and hash in-place */
-            memcpy(buf_pos, umem + chunk_offset, chunk_size);
-
-            ret = lib_SHA256Update(&chunk_sha, buf_pos, chunk_size);
+            ret = copy_and_hash(&chunk_sha, buf_pos, umem + chunk_offset, this_chunk_size);
             if (ret < 0)
                 goto failed;
 
-            buf_pos += chunk_size;
+            chunk_data = buf_pos;
+            buf_pos += this_chunk_size;
         } else {
             /* if current chunk-to-copy only partially overlaps with the requested region-to-copy,
-             * read the file contents into a scratch buffer, verify hash and then copy only the part
-             * needed by the caller */
-            memcpy(tmp_chunk, umem + chunk_offset, chunk_size);
+             * copy the part needed by the caller directly into buf and the rest of the chunk into
+             * a scratch buffer; all parts are hashed in order, so the hash covers the whole chunk
+             * exactly as it was copied into the enclave */
+            if (!tmp_chunk) {
+                tmp_chunk = allocated_tmp_chunk = malloc(chunk_size);
+                if (!tmp_chunk) {
+                    ret = -PAL_ERROR_NOMEM;
+                    goto failed;
+                }
+            }
+
+            ret = copy_and_hash(&chunk_sha, tmp_chunk, umem + chunk_offset,
+                                copy_start - chunk_offset);
+            if (ret < 0)
+                goto failed;
 
-            ret = lib_SHA256Update(&chunk_sha, tmp_chunk, chunk_size);
+            ret = copy_and_hash(&chunk_sha, buf_pos, umem + copy_start, copy_end - copy_start);
             if (ret < 0)
                 goto failed;
 
-            /* determine which part of the chunk is needed by the caller */
-            off_t copy_start = MAX(chunk_offset, offset);
-            off_t copy_end   = MIN(chunk_offset + (off_t)chunk_size, end);
-            assert(copy_end > copy_start);
+            ret = copy_and_hash(&chunk_sha, tmp_chunk + (copy_end - chunk_offset),
+                                umem + copy_end, chunk_end - copy_end);
+            if (ret < 0)
+                goto failed;
 
-            memcpy(buf_pos, tmp_chunk + copy_start - chunk_offset, copy_end - copy_start);
+            if (use_cache) {
+                /* complete the chunk in the scratch buffer (out of already copied data) */
+                memcpy(tmp_chunk + (copy_start - chunk_offset), buf_pos, copy_end - copy_start);
+            }
+            chunk_data = tmp_chunk;
             buf_pos += copy_end - copy_start;
         }
 
@@ -545,18 +1545,59 @@ int copy_and_verify_trusted_file(const char* path, uint8_t* buf, const void* ume
             ret = -PAL_ERROR_DENIED;
             goto failed;
         }
+
+        if (use_cache)
+            trusted_chunk_cache_add(chunk_hashes_item, chunk_data, this_chunk_size);
     }
 
-    free(tmp_chunk);
+    free(allocated_tmp_chunk);
     return 0;
 
 failed:
-    free(tmp_chunk);
+    free(allocated_tmp_chunk);
     memset(buf, 0, end - offset);
     return ret;
 }
 
-static int register_trusted_file(const char* uri, const char* checksum_str, bool check_duplicates) {
+int copy_and_verify_trusted_file(const char* path, uint8_t* buf, const void* umem,
+                                 off_t aligned_offset, off_t aligned_end, off_t offset, off_t end,
+                                 sgx_chunk_hash_t* chunk_hashes, size_t chunk_size,
+                                 size_t file_size) {
+    return __copy_and_verify_trusted_file(path, buf, umem, aligned_offset, aligned_end, offset, end,
+                                          chunk_hashes, chunk_size, file_size, /*tmp_chunk=*/NULL,
+                                          /*use_cache=*/true);
+}
+
+int copy_and_verify_trusted_file_nomalloc(const char* path, uint8_t* buf, const void* umem,
+                                          off_t aligned_offset, off_t aligned_end, off_t offset,
+                                          off_t end, sgx_chunk_hash_t* chunk_hashes,
+                                          size_t chunk_size, size_t file_size, uint8_t* tmp_chunk) {
+    return __copy_and_verify_trusted_file(path, buf, umem, aligned_offset, aligned_end, offset, end,
+                                          chunk_hashes, chunk_size, file_size, tmp_chunk,
+                                          /*use_cache=*/false);
+}
+
+static int parse_file_hash(const char* hash_str, sgx_file_hash_t* hash) {
+    if (strlen(hash_str) < sizeof(*hash) * 2)
+        return -PAL_ERROR_INVAL;
+
+    for (size_t i = 0; i < sizeof(*hash); i++) {
+        int8_t byte1 = hex2dec(hash_str[i * 2]);
+        int8_t byte2 = hex2dec(hash_str[i * 2 + 1]);
+
+        if (byte1 < 0 || byte2 < 0)
+            return -PAL_ERROR_INVAL;
+
+        hash->bytes[i] = byte1 * 16 + byte2;
+    }
+    return 0;
+}
+
+/* Registers `uri` as a trusted file with `file_hash` and chunks of `chunk_size` (and optionally the
+ * chunk table `chunks_uri` with `chunks_hash`), or as an allowed file if `file_hash` is NULL. */
+static int register_trusted_file(const char* uri, const sgx_file_hash_t* file_hash,
+                                 size_t chunk_size, const char* chunks_uri,
+                                 const sgx_file_hash_t* chunks_hash) {
     int ret;
 
     size_t uri_len = strlen(uri);
@@ -565,20 +1606,11 @@ static int register_trusted_file(const char* uri, const char* checksum_str, bool
         return -PAL_ERROR_INVAL;
     }
 
-    if (check_duplicates) {
-        /* this check is only done during runtime (when creating a new file) and not needed during
-         * initialization (because manifest is assumed to have no duplicates); skipping this check
-         * significantly improves startup time */
-        spinlock_lock(&g_trusted_file_lock);
-        struct trusted_file* tf;
-        LISTP_FOR_EACH_ENTRY(tf, &g_trusted_file_list, list) {
-            if (tf->uri_len == uri_len && !memcmp(tf->uri, uri, uri_len)) {
-                spinlock_unlock(&g_trusted_file_lock);
-                return 0;
-            }
-        }
-        spinlock_unlock(&g_trusted_file_lock);
-    }
+    spinlock_lock(&g_trusted_file_lock);
+    bool registered = find_trusted_file(uri, uri_len);
+    spinlock_unlock(&g_trusted_file_lock);
+    if (registered)
+        return 0;
 
     struct trusted_file* new = malloc(sizeof(*new) + uri_len + 1);
     if (!new)
@@ -586,12 +1618,26 @@ static int register_trusted_file(const char* uri, const char* checksum_str, bool
 
     INIT_LIST_HEAD(new, list);
     new->size = 0;
+    new->chunk_size = TRUSTED_CHUNK_SIZE;
     new->chunk_hashes = NULL;
+    new->chunks_uri = NULL;
+    new->host_meta_valid = false;
+    new->host_ino = 0;
+    new->host_mtime_ns = 0;
+    new->cached_chunk_hashes = NULL;
+    new->runnable = false;
     new->allowed = false;
     new->uri_len = uri_len;
     memcpy(new->uri, uri, uri_len + 1);
 
-    if (checksum_str) {
+    if (file_hash) {
+        if (!is_valid_trusted_chunk_size(chunk_size)) {
+            log_error("Invalid chunk size %lu of file: %s\n", chunk_size, uri);
+            free(new);
+            return -PAL_ERROR_INVAL;
+        }
+        new->chunk_size = chunk_size;
+
         PAL_STREAM_ATTR attr;
         ret = _DkStreamAttributesQuery(uri, &attr);
         if (ret < 0) {
@@ -600,19 +1646,21 @@ static int register_trusted_file(const char* uri, const char* checksum_str, bool
             return ret;
         }
         new->size = attr.pending_size;
+        new->runnable = attr.runnable;
+        new->file_hash = *file_hash;
 
-        assert(strlen(checksum_str) >= sizeof(sgx_file_hash_t) * 2);
-        for (size_t i = 0; i < sizeof(sgx_file_hash_t); i++) {
-            int8_t byte1 = hex2dec(checksum_str[i * 2]);
-            int8_t byte2 = hex2dec(checksum_str[i * 2 + 1]);
-
-            if (byte1 < 0 || byte2 < 0) {
-                log_error("Could not parse checksum of file: %s\n", uri);
+        if (chunks_uri) {
+            if (!strstartswith(chunks_uri, URI_PREFIX_FILE)) {
+                log_error("Invalid chunk table of file: %s\n", uri);
                 free(new);
                 return -PAL_ERROR_INVAL;
             }
-
-            new->file_hash.bytes[i] = byte1 * 16 + byte2;
+            new->chunks_hash = *chunks_hash;
+            new->chunks_uri = strdup(chunks_uri);
+            if (!new->chunks_uri) {
+                free(new);
+                return -PAL_ERROR_NOMEM;
+            }
         }
     } else {
         memset(&new->file_hash, 0, sizeof(new->file_hash));
@@ -620,29 +1668,43 @@ static int register_trusted_file(const char* uri, const char* checksum_str, bool
     }
 
     spinlock_lock(&g_trusted_file_lock);
-
-    if (check_duplicates) {
-        /* this check is only done during runtime and not needed during initialization (see above);
-         * we check again because same file could have been added by another thread in meantime */
-        struct trusted_file* tf;
-        LISTP_FOR_EACH_ENTRY(tf, &g_trusted_file_list, list) {
-            if (tf->uri_len == uri_len && !memcmp(tf->uri, uri, uri_len)) {
-                spinlock_unlock(&g_trusted_file_lock);
-                free(new);
-                return 0;
-            }
-        }
+    /* check again, the same file could have been registered by another thread in the meantime */
+    if (find_trusted_file(uri, uri_len)) {
+        spinlock_unlock(&g_trusted_file_lock);
+        free(new->chunks_uri);
+        free(new);
+        return 0;
     }
-
     LISTP_ADD_TAIL(new, &g_trusted_file_list, list);
+    HASH_ADD_KEYPTR(hh, g_trusted_file_map, new->uri, new->uri_len, new);
     spinlock_unlock(&g_trusted_file_lock);
 
     return 0;
 }
 
+/* Normalizes trusted file `uri` into `normpath` (of URI_MAX bytes). */
+static int normalize_trusted_uri(const char* uri, char* normpath) {
+    if (!strstartswith(uri, URI_PREFIX_FILE)) {
+        log_error("Invalid URI [%s]: Trusted files must start with 'file:'\n", uri);
+        return -PAL_ERROR_INVAL;
+    }
+    memcpy(normpath, URI_PREFIX_FILE, URI_PREFIX_FILE_LEN);
+    size_t len = URI_MAX - URI_PREFIX_FILE_LEN;
+    int ret = get_norm_path(uri + URI_PREFIX_FILE_LEN, normpath + URI_PREFIX_FILE_LEN, &len);
+    if (ret < 0) {
+        log_error("Path (%s) normalization failed: %s\n", uri + URI_PREFIX_FILE_LEN,
+                  pal_strerror(ret));
+        return ret;
+    }
+    return 0;
+}
+
 static int init_trusted_file(const char* key, const char* uri) {
     int ret;
     char* normpath = NULL;
+    char* chunks_uri = NULL;
+    char* chunks_hash_str = NULL;
+    sgx_file_hash_t chunks_hash;
 
     /* read sgx.trusted_checksum.<key> entry from manifest */
     char* fullkey = alloc_concat3("sgx.trusted_checksum.\"", -1, key, -1, "\"", -1);
@@ -664,39 +1726,317 @@ static int init_trusted_file(const char* key, const char* uri) {
         goto out;
     }
 
-    /* Normalize the uri */
-    const size_t normpath_size = URI_MAX;
-    normpath = malloc(normpath_size);
+    sgx_file_hash_t file_hash;
+    if (parse_file_hash(trusted_checksum_str, &file_hash) < 0) {
+        log_error("Could not parse checksum of file: %s\n", uri);
+        ret = -PAL_ERROR_INVAL;
+        goto out;
+    }
+
+    normpath = malloc(URI_MAX);
     if (!normpath) {
         ret = -PAL_ERROR_NOMEM;
         goto out;
     }
-    (void)strcpy_static(normpath, URI_PREFIX_FILE, normpath_size);
+    ret = normalize_trusted_uri(uri, normpath);
+    if (ret < 0)
+        goto out;
 
-    if (!strstartswith(uri, URI_PREFIX_FILE)) {
-        log_error("Invalid URI [%s]: Trusted files must start with 'file:'\n", uri);
+    /* read optional sgx.trusted_chunk_size.<key> entry (checked in register_trusted_file()) */
+    free(fullkey);
+    fullkey = alloc_concat3("sgx.trusted_chunk_size.\"", -1, key, -1, "\"", -1);
+    if (!fullkey) {
+        ret = -PAL_ERROR_NOMEM;
+        goto out;
+    }
+    uint64_t chunk_size;
+    ret = toml_sizestring_in(g_pal_state.manifest_root, fullkey, TRUSTED_CHUNK_SIZE, &chunk_size);
+    if (ret < 0) {
+        log_error("Cannot parse '%s' (the value must be put in double quotes!)\n", fullkey);
         ret = -PAL_ERROR_INVAL;
         goto out;
     }
-    size_t len = normpath_size - strlen(normpath);
-    ret = get_norm_path(uri + URI_PREFIX_FILE_LEN, normpath + URI_PREFIX_FILE_LEN, &len);
+
+    /* read optional sgx.trusted_chunks.<key> and sgx.trusted_chunks_hash.<key> entries (chunk table
+     * generated by graphene-sgx-sign, see above) */
+    free(fullkey);
+    fullkey = alloc_concat3("sgx.trusted_chunks.\"", -1, key, -1, "\"", -1);
+    if (!fullkey) {
+        ret = -PAL_ERROR_NOMEM;
+        goto out;
+    }
+    ret = toml_string_in(g_pal_state.manifest_root, fullkey, &chunks_uri);
     if (ret < 0) {
-        log_error("Path (%s) normalization failed: %s\n", uri + URI_PREFIX_FILE_LEN,
-                  pal_strerror(ret));
+        log_error("Cannot parse '%s'\n", fullkey);
+        ret = -PAL_ERROR_INVAL;
         goto out;
     }
 
-    ret = register_trusted_file(normpath, trusted_checksum_str, /*check_duplicates=*/false);
+    if (chunks_uri) {
+        free(fullkey);
+        fullkey = alloc_concat3("sgx.trusted_chunks_hash.\"", -1, key, -1, "\"", -1);
+        if (!fullkey) {
+            ret = -PAL_ERROR_NOMEM;
+            goto out;
+        }
+        ret = toml_string_in(g_pal_state.manifest_root, fullkey, &chunks_hash_str);
+        if (ret < 0 || !chunks_hash_str || parse_file_hash(chunks_hash_str, &chunks_hash) < 0) {
+            log_error("Cannot parse '%s'\n", fullkey);
+            ret = -PAL_ERROR_INVAL;
+            goto out;
+        }
+    }
+
+    ret = register_trusted_file(normpath, &file_hash, chunk_size, chunks_uri, &chunks_hash);
 out:
     free(normpath);
     free(trusted_checksum_str);
+    free(chunks_uri);
+    free(chunks_hash_str);
     free(fullkey);
     return ret;
 }
 
+/*
+ * Manifests of big runtimes list tens of thousands of trusted files, and parsing and querying such
+ * TOML tables takes a big part of the start-up time of each enclave. With
+ * `sgx.trusted_files_image`, graphene-sgx-sign moves all trusted files (including `loader.preload`)
+ * from the manifest into a binary image, bound to the manifest by its hash
+ * (`sgx.trusted_files_image_uri` and `sgx.trusted_files_image_hash`). The image is read into the
+ * enclave with one OCALL, and its entries are registered without parsing. Child processes load the
+ * same image.
+ *
+ * Format (little-endian): `struct trusted_files_image_hdr`, then for each file
+ * `struct trusted_files_image_entry` followed by the file URI and the chunk table URI (both without
+ * the terminating zero, the latter is empty if there is no chunk table).
+ */
+#define TRUSTED_FILES_IMAGE_MAGIC "GSGXTFI2"
+
+struct trusted_files_image_hdr {
+    char magic[8];
+    uint64_t count;
+};
+
+struct trusted_files_image_entry {
+    uint32_t uri_len;
+    uint32_t chunks_uri_len;
+    sgx_file_hash_t file_hash;
+    sgx_file_hash_t chunks_hash;
+    uint64_t chunk_size;
+};
+
+static_assert(sizeof(struct trusted_files_image_hdr) == 16, "incompatible image format");
+static_assert(sizeof(struct trusted_files_image_entry) == 80, "incompatible image format");
+
+static int register_trusted_files_image(const uint8_t* image, size_t size) {
+    struct trusted_files_image_hdr hdr;
+    assert(size >= sizeof(hdr));
+    memcpy(&hdr, image, sizeof(hdr));
+    if (memcmp(hdr.magic, TRUSTED_FILES_IMAGE_MAGIC, sizeof(hdr.magic)))
+        return -PAL_ERROR_DENIED;
+
+    char* uri = malloc(URI_MAX);
+    char* chunks_uri = malloc(URI_MAX);
+    char* normpath = malloc(URI_MAX);
+    int ret = -PAL_ERROR_NOMEM;
+    if (!uri || !chunks_uri || !normpath)
+        goto out;
+
+    size_t off = sizeof(hdr);
+    for (uint64_t i = 0; i < hdr.count; i++) {
+        struct trusted_files_image_entry entry;
+        if (size - off < sizeof(entry)) {
+            ret = -PAL_ERROR_DENIED;
+            goto out;
+        }
+        memcpy(&entry, image + off, sizeof(entry));
+        off += sizeof(entry);
+        if (entry.uri_len >= URI_MAX || entry.chunks_uri_len >= URI_MAX
+                || size - off < (size_t)entry.uri_len + entry.chunks_uri_len) {
+            ret = -PAL_ERROR_DENIED;
+            goto out;
+        }
+        memcpy(uri, image + off, entry.uri_len);
+        uri[entry.uri_len] = '\0';
+        off += entry.uri_len;
+        memcpy(chunks_uri, image + off, entry.chunks_uri_len);
+        chunks_uri[entry.chunks_uri_len] = '\0';
+        off += entry.chunks_uri_len;
+
+        ret = normalize_trusted_uri(uri, normpath);
+        if (ret < 0)
+            goto out;
+        ret = register_trusted_file(normpath, &entry.file_hash, entry.chunk_size,
+                                    entry.chunks_uri_len ? chunks_uri : NULL, &entry.chunks_hash);
+        if (ret < 0)
+            goto out;
+    }
+    ret = off == size ? 0 : -PAL_ERROR_DENIED;
+out:
+    free(uri);
+    free(chunks_uri);
+    free(normpath);
+    return ret;
+}
+
+/* Registers the trusted files from the image named in the manifest, if any; sets `*loaded` to
+ * whether there is one. */
+static int load_trusted_files_image(bool* loaded) {
+    int ret;
+    int fd = -1;
+    uint8_t* image = NULL;
+    char* image_uri = NULL;
+    char* image_hash_str = NULL;
+
+    *loaded = false;
+    ret = toml_string_in(g_pal_state.manifest_root, "sgx.trusted_files_image_uri", &image_uri);
+    if (ret < 0 || (image_uri && !strstartswith(image_uri, URI_PREFIX_FILE))) {
+        log_error("Cannot parse \'sgx.trusted_files_image_uri\'\n");
+        ret = -PAL_ERROR_INVAL;
+        goto out;
+    }
+    if (!image_uri)
+        goto out;
+
+    sgx_file_hash_t image_hash;
+    ret = toml_string_in(g_pal_state.manifest_root, "sgx.trusted_files_image_hash",
+                         &image_hash_str);
+    if (ret < 0 || !image_hash_str || parse_file_hash(image_hash_str, &image_hash) < 0) {
+        log_error("Cannot parse \'sgx.trusted_files_image_hash\'\n");
+        ret = -PAL_ERROR_INVAL;
+        goto out;
+    }
+
+    fd = ocall_open(image_uri + URI_PREFIX_FILE_LEN, O_RDONLY, 0);
+    if (fd < 0) {
+        log_error("Cannot open trusted files image %s\n", image_uri);
+        ret = unix_to_pal_error(fd);
+        goto out;
+    }
+
+    struct stat st;
+    ret = ocall_fstat(fd, &st);
+    if (ret < 0) {
+        ret = unix_to_pal_error(ret);
+        goto out;
+    }
+    size_t size = st.st_size;
+    if (size < sizeof(struct trusted_files_image_hdr)) {
+        log_error("Trusted files image %s is truncated\n", image_uri);
+        ret = -PAL_ERROR_DENIED;
+        goto out;
+    }
+    image = malloc(size);
+    if (!image) {
+        ret = -PAL_ERROR_NOMEM;
+        goto out;
+    }
+
+    sgx_file_hash_t hash;
+    ret = read_and_hash(fd, image, size, &hash);
+    if (ret < 0)
+        goto out;
+    if (memcmp(&hash, &image_hash, sizeof(hash))) {
+        log_error("Trusted files image %s doesn't match the manifest\n", image_uri);
+        ret = -PAL_ERROR_DENIED;
+        goto out;
+    }
+
+    ret = register_trusted_files_image(image, size);
+    if (ret < 0) {
+        log_error("Cannot register trusted files from image %s: %s\n", image_uri,
+                  pal_strerror(ret));
+        goto out;
+    }
+    *loaded = true;
+out:
+    if (fd >= 0)
+        ocall_close(fd);
+    free(image);
+    free(image_uri);
+    free(image_hash_str);
+    return ret;
+}
+
 int init_trusted_files(void) {
     int ret;
 
+    int64_t hash_threads;
+    ret = toml_int_in(g_pal_state.manifest_root, "sgx.trusted_files_hash_threads",
+                      /*defaultval=*/1, &hash_threads);
+    if (ret < 0 || hash_threads < 1) {
+        log_error("Cannot parse \'sgx.trusted_files_hash_threads\' "
+                  "(the value must be a positive integer)\n");
+        return -PAL_ERROR_INVAL;
+    }
+    g_trusted_files_hash_threads = hash_threads;
+
+    uint64_t cache_size;
+    ret = toml_sizestring_in(g_pal_state.manifest_root, "sgx.trusted_files_cache_size",
+                             /*defaultval=*/0, &cache_size);
+    if (ret < 0) {
+        log_error("Cannot parse \'sgx.trusted_files_cache_size\' "
+                  "(the value must be put in double quotes!)\n");
+        return -PAL_ERROR_INVAL;
+    }
+    if (cache_size) {
+        g_trusted_chunk_cache = lruc_create();
+        if (!g_trusted_chunk_cache)
+            return -PAL_ERROR_NOMEM;
+        g_trusted_chunk_cache_max_size = cache_size;
+    }
+
+    bool lazy_mmap;
+    ret = toml_bool_in(g_pal_state.manifest_root, "sgx.trusted_files_lazy_mmap",
+                       /*defaultval=*/false, &lazy_mmap);
+    if (ret < 0) {
+        log_error("Cannot parse \'sgx.trusted_files_lazy_mmap\' (the value must be `true` or "
+                  "`false`)\n");
+        return -PAL_ERROR_INVAL;
+    }
+    if (lazy_mmap && (!GET_ENCLAVE_TLS(edmm_enabled)
+                          || !(g_pal_sec.enclave_misc_select & SGX_MISCSELECT_EXINFO))) {
+        log_warning("\'sgx.trusted_files_lazy_mmap\' requires EDMM and \'sgx.support_exinfo\', "
+                    "trusted files will be mapped eagerly\n");
+        lazy_mmap = false;
+    }
+    g_trusted_files_lazy_mmap = lazy_mmap;
+
+    ret = toml_bool_in(g_pal_state.manifest_root, "sgx.allowed_files_lazy_mmap",
+                       /*defaultval=*/false, &lazy_mmap);
+    if (ret < 0) {
+        log_error("Cannot parse \'sgx.allowed_files_lazy_mmap\' (the value must be `true` or "
+                  "`false`)\n");
+        return -PAL_ERROR_INVAL;
+    }
+    if (lazy_mmap && (!GET_ENCLAVE_TLS(edmm_enabled)
+                          || !(g_pal_sec.enclave_misc_select & SGX_MISCSELECT_EXINFO))) {
+        log_warning("\'sgx.allowed_files_lazy_mmap\' requires EDMM and \'sgx.support_exinfo\', "
+                    "allowed files will be mapped eagerly\n");
+        lazy_mmap = false;
+    }
+    g_allowed_files_lazy_mmap = lazy_mmap;
+
+    ret = toml_string_in(g_pal_state.manifest_root, "sgx.trusted_files_hash_cache",
+                         &g_trusted_files_hash_cache_uri);
+    if (ret < 0 || (g_trusted_files_hash_cache_uri
+                       && !strstartswith(g_trusted_files_hash_cache_uri, URI_PREFIX_FILE))) {
+        log_error("Cannot parse \'sgx.trusted_files_hash_cache\' (the value must be a URI "
+                  "starting with \"file:\")\n");
+        return -PAL_ERROR_INVAL;
+    }
+
+    bool image_loaded;
+    ret = load_trusted_files_image(&image_loaded);
+    if (ret < 0)
+        return ret;
+
+    /* with an image, the manifest has no trusted files, but `sgx` is still needed for allowed
+     * files */
+    toml_table_t* manifest_sgx = toml_table_in(g_pal_state.manifest_root, "sgx");
+    if (image_loaded)
+        goto no_trusted;
+
     /* read loader.preload string from manifest and register its files as trusted */
     char* preload_str = NULL;
     ret = toml_string_in(g_pal_state.manifest_root, "loader.preload", &preload_str);
@@ -734,7 +2074,6 @@ int init_trusted_files(void) {
     }
 
     /* read sgx.trusted_files entries from manifest and register them */
-    toml_table_t* manifest_sgx = toml_table_in(g_pal_state.manifest_root, "sgx");
     if (!manifest_sgx)
         goto no_trusted;
 
@@ -826,13 +2165,23 @@ no_trusted:
             goto no_allowed;
         }
 
-        register_trusted_file(norm_path, NULL, /*check_duplicates=*/false);
+        register_trusted_file(norm_path, NULL, /*chunk_size=*/0, NULL, NULL);
     }
 
     ret = 0;
 
 no_allowed:
     free(norm_path);
+    if (ret == 0) {
+        adopt_inherited_trusted_file_hashes();
+        if (g_trusted_files_hash_cache_uri) {
+            /* the cache is only an optimization, a missing or broken one is just not used */
+            int cache_ret = load_trusted_file_hash_cache();
+            if (cache_ret < 0)
+                log_warning("Ignoring trusted file hash cache %s: %s\n",
+                            g_trusted_files_hash_cache_uri, pal_strerror(cache_ret));
+        }
+    }
     return ret;
 }
 
@@ -888,6 +2237,7 @@ int init_enclave(void) {
     memcpy(&g_pal_sec.mr_enclave, &report.body.mr_enclave, sizeof(g_pal_sec.mr_enclave));
     memcpy(&g_pal_sec.mr_signer, &report.body.mr_signer, sizeof(g_pal_sec.mr_signer));
     g_pal_sec.enclave_attributes = report.body.attributes;
+    g_pal_sec.enclave_misc_select = report.body.misc_select;
 
     /*
      * The enclave id is uniquely created for each enclave as a token
@@ -1179,30 +2529,91 @@ out:
     return ret;
 }
 
+/*
+ * Pipes between enclaves of one application resume TLS sessions instead of doing a full handshake
+ * every time: servers issue session tickets encrypted with a key derived from `g_master_key`, which
+ * all these enclaves share, and clients (in any of the enclaves) offer the last session they got.
+ * An abbreviated handshake saves a round trip, i.e. several OCALLs on each side. Process handles are
+ * set up before the child knows `g_master_key` and stay with full handshakes.
+ */
+#define SSL_SESSION_CACHE_SIZE 512
+
+static uint8_t g_ssl_session[SSL_SESSION_CACHE_SIZE];
+static size_t g_ssl_session_size = 0;
+static spinlock_t g_ssl_session_lock = INIT_SPINLOCK_UNLOCKED;
+
+/* stats of pipe handshakes, reported with `sgx.enable_stats` */
+static uint64_t g_ssl_handshakes = 0;
+static uint64_t g_ssl_resumed_handshakes = 0;
+static uint64_t g_ssl_handshake_us = 0;
+
+static int ssl_ticket_key(uint8_t key[static SHA256_DIGEST_LEN]) {
+    static const char label[] = "pipe session tickets";
+    LIB_SHA256_CONTEXT sha;
+
+    int ret = lib_SHA256Init(&sha);
+    if (ret == 0)
+        ret = lib_SHA256Update(&sha, (uint8_t*)&g_master_key, sizeof(g_master_key));
+    if (ret == 0)
+        ret = lib_SHA256Update(&sha, (const uint8_t*)label, sizeof(label));
+    if (ret == 0)
+        ret = lib_SHA256Final(&sha, key);
+    return ret;
+}
+
+void print_ssl_stats(void) {
+    uint64_t handshakes = __atomic_load_n(&g_ssl_handshakes, __ATOMIC_RELAXED);
+    if (!handshakes)
+        return;
+
+    log_always("----- Pipe TLS handshake stats -----\n"
+               "  # of handshakes:     %lu\n"
+               "  # of resumptions:    %lu\n"
+               "  avg time (us):       %lu\n",
+               handshakes, __atomic_load_n(&g_ssl_resumed_handshakes, __ATOMIC_RELAXED),
+               __atomic_load_n(&g_ssl_handshake_us, __ATOMIC_RELAXED) / handshakes);
+}
+
 int _DkStreamSecureInit(PAL_HANDLE stream, bool is_server, PAL_SESSION_KEY* session_key,
                         LIB_SSL_CONTEXT** out_ssl_ctx, const uint8_t* buf_load_ssl_ctx,
                         size_t buf_size) {
     int stream_fd;
+    bool is_pipe = false;
 
-    if (IS_HANDLE_TYPE(stream, process))
+    if (IS_HANDLE_TYPE(stream, process)) {
         stream_fd = stream->process.stream;
-    else if (IS_HANDLE_TYPE(stream, pipe) || IS_HANDLE_TYPE(stream, pipecli))
+    } else if (IS_HANDLE_TYPE(stream, pipe) || IS_HANDLE_TYPE(stream, pipecli)) {
         stream_fd = stream->pipe.fd;
-    else
+        is_pipe = true;
+    } else {
         return -PAL_ERROR_BADHANDLE;
+    }
+
+    uint8_t ticket_key[SHA256_DIGEST_LEN];
+    if (is_pipe) {
+        int ret = ssl_ticket_key(ticket_key);
+        if (ret < 0)
+            return ret;
+    }
 
     LIB_SSL_CONTEXT* ssl_ctx = malloc(sizeof(*ssl_ctx));
     if (!ssl_ctx)
         return -PAL_ERROR_NOMEM;
 
+    uint64_t start_us = 0;
+    if (g_sgx_enable_stats && is_pipe && !buf_load_ssl_ctx)
+        _DkSystemTimeQuery(&start_us);
+
     /* mbedTLS init routines are not thread safe, so we use a spinlock to protect them */
     static spinlock_t ssl_init_lock = INIT_SPINLOCK_UNLOCKED;
 
     spinlock_lock(&ssl_init_lock);
     int ret = lib_SSLInit(ssl_ctx, stream_fd, is_server,
                           (const uint8_t*)session_key, sizeof(*session_key),
-                          ocall_read, ocall_write, buf_load_ssl_ctx, buf_size);
+                          is_pipe ? ticket_key : NULL, ocall_read, ocall_write, buf_load_ssl_ctx,
+                          buf_size);
     spinlock_unlock(&ssl_init_lock);
+    memset(ticket_key, 0, sizeof(ticket_key));
 
     if (ret != 0) {
         free(ssl_ctx);
@@ -1210,12 +2621,39 @@ int _DkStreamSecureInit(PAL_HANDLE stream, bool is_server, PAL_SESSION_KEY* sess
     }
 
     if (!buf_load_ssl_ctx) {
+        if (is_pipe && !is_server) {
+            spinlock_lock(&g_ssl_session_lock);
+            if (g_ssl_session_size) {
+                /* failure only means a full handshake */
+                lib_SSLSetSession(ssl_ctx, g_ssl_session, g_ssl_session_size);
+            }
+            spinlock_unlock(&g_ssl_session_lock);
+        }
+
         /* TLS context was not restored from the buffer, need to perform handshake */
         ret = lib_SSLHandshake(ssl_ctx);
         if (ret != 0) {
             free(ssl_ctx);
             return ret;
         }
+
+        if (is_pipe && !is_server) {
+            /* keep the newest session (and ticket) for the next pipe */
+            spinlock_lock(&g_ssl_session_lock);
+            if (lib_SSLSaveSession(ssl_ctx, g_ssl_session, sizeof(g_ssl_session),
+                                   &g_ssl_session_size) < 0)
+                g_ssl_session_size = 0;
+            spinlock_unlock(&g_ssl_session_lock);
+        }
+
+        if (g_sgx_enable_stats && is_pipe) {
+            uint64_t end_us = 0;
+            _DkSystemTimeQuery(&end_us);
+            __atomic_add_fetch(&g_ssl_handshakes, 1, __ATOMIC_RELAXED);
+            if (ssl_ctx->resumed)
+                __atomic_add_fetch(&g_ssl_resumed_handshakes, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&g_ssl_handshake_us, end_us - start_us, __ATOMIC_RELAXED);
+        }
     }
 
     *out_ssl_ctx = ssl_ctx;
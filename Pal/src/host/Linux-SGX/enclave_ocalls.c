@@ -43,25 +43,42 @@
  * size of 8MB. Thus, 512KB limit also works well for the main thread. */
 #define MAX_UNTRUSTED_STACK_BUF (THREAD_STACK_SIZE / 4)
 
-/* global pointer to a single untrusted queue, all accesses must be protected by g_rpc_queue->lock
- */
+/* global pointer to a single untrusted queue, all accesses must go through the lock-free
+ * rpc_enqueue() */
 rpc_queue_t* g_rpc_queue;
 
-static long sgx_exitless_ocall(uint64_t code, void* ms) {
-    /* perform OCALL with enclave exit if no RPC queue (i.e., no exitless); no need for atomics
-     * because this pointer is set only once at enclave initialization */
-    if (!g_rpc_queue)
-        return sgx_ocall(code, ms);
-
-    /* allocate request in a new stack frame on OCALL stack; note that request's lock is used in
-     * futex() and must be aligned to at least 4B */
-    void* old_ustack = sgx_prepare_ustack();
-    rpc_request_t* req = sgx_alloc_on_ustack_aligned(sizeof(*req), alignof(*req));
-    if (!req) {
-        sgx_reset_ustack(old_ustack);
-        return -ENOMEM;
+/* trusted copies of `g_rpc_queue->channels` and `g_rpc_queue->channels_cnt`, set only once at
+ * enclave initialization; NULL with "shared" RPC affinity */
+rpc_channel_t* g_rpc_channels;
+size_t g_rpc_channels_cnt;
+
+/* upper bound on the adaptive spin budget of enclave threads, set from the manifest at enclave
+ * initialization (the default is used for OCALLs issued before the manifest is parsed) */
+uint64_t g_rpc_enclave_spin_max = RPC_SPINLOCK_TIMEOUT;
+
+/* Spin until the RPC thread releases the request's lock, but no more than `budget` iterations.
+ * Returns 0 if the lock was acquired (OCALL is done) and 1 if timed out; the number of spent
+ * iterations is returned in `*out_spins`. */
+static int rpc_request_spin_wait(rpc_request_t* req, uint64_t budget, uint64_t* out_spins) {
+    uint64_t spins = 0;
+    while (1) {
+        if (__atomic_load_n(&req->lock.lock, __ATOMIC_RELAXED) == SPINLOCK_UNLOCKED
+                && !spinlock_trylock(&req->lock)) {
+            *out_spins = spins;
+            return 0;
+        }
+        if (spins == budget) {
+            *out_spins = spins;
+            return 1;
+        }
+        spins++;
+        CPU_RELAX();
     }
+}
 
+/* Initialize OCALL request `req` (in untrusted memory) and submit it to RPC threads. Returns false
+ * if the request cannot be submitted; then the caller must perform the OCALL with enclave exit. */
+static bool rpc_submit(rpc_request_t* req, uint64_t code, void* ms) {
     WRITE_ONCE(req->ocall_index, code);
     WRITE_ONCE(req->buffer, ms);
     spinlock_init(&req->lock);
@@ -71,18 +88,31 @@ static long sgx_exitless_ocall(uint64_t code, void* ms) {
      * of the lock */
     spinlock_lock(&req->lock);
 
-    /* enqueue OCALL request into RPC queue; some RPC thread will dequeue it, issue a syscall
-     * and, after syscall is finished, release the request's spinlock */
-    bool enqueued = rpc_enqueue(g_rpc_queue, req);
-    if (!enqueued) {
-        /* no space in queue: all RPC threads are busy with outstanding ocalls; fallback to normal
-         * syscall path with enclave exit */
-        sgx_reset_ustack(old_ustack);
-        return sgx_ocall(code, ms);
-    }
+    /* enqueue OCALL request into this thread's channel (if not "shared" mode) or into RPC queue;
+     * some RPC thread will dequeue it, issue a syscall and, after syscall is finished, release the
+     * request's spinlock */
+    bool enqueued = false;
+    if (g_rpc_channels) {
+        size_t idx = rpc_channel_index(GET_ENCLAVE_TLS(tcs_offset), g_rpc_channels_cnt);
+        enqueued = rpc_channel_push(&g_rpc_channels[idx], req);
+    }
+    if (!enqueued)
+        enqueued = rpc_enqueue(g_rpc_queue, req);
+    return enqueued;
+}
 
-    /* wait till request processing is finished; try spinlock first */
-    int timedout = spinlock_lock_timeout(&req->lock, RPC_SPINLOCK_TIMEOUT);
+/* Wait until RPC thread finishes the submitted request `req` and store the OCALL result in
+ * `*out_result`. Returns negative error code if waiting failed (then the request may be still in
+ * flight and its memory must not be reused). */
+static int rpc_wait(rpc_request_t* req, long* out_result) {
+    /* wait till request processing is finished; try spinning first, for as long as the recent
+     * OCALLs of this thread suggest (if they had to wait on futex, the estimate grows towards the
+     * manifest-provided bound) */
+    uint64_t estimate = GET_ENCLAVE_TLS(rpc_spin_estimate);
+    uint64_t budget   = rpc_spin_budget(estimate, g_rpc_enclave_spin_max);
+    uint64_t spins;
+    int timedout = rpc_request_spin_wait(req, budget, &spins);
+    SET_ENCLAVE_TLS(rpc_spin_estimate, rpc_spin_estimate_update(estimate, spins));
 
     /* at this point:
      * - either RPC thread is done with OCALL and released the request's spinlock,
@@ -101,6 +131,7 @@ static long sgx_exitless_ocall(uint64_t code, void* ms) {
          * wait on futex (note that enclave thread grabbed lock but it doesn't matter) */
         if (!spinlock_cmpxchg(&req->lock, &c, SPINLOCK_LOCKED_NO_WAITERS)) {
             /* allocate futex args on OCALL stack */
+            void* old_ustack = sgx_prepare_ustack();
             ms_ocall_futex_t* ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
             if (!ms) {
                 sgx_reset_ustack(old_ustack);
@@ -132,11 +163,40 @@ static long sgx_exitless_ocall(uint64_t code, void* ms) {
             /* while-loop is required for spurious futex wake-ups: our enclave thread must wait
              * until lock moves to UNLOCKED (note that enclave thread grabs lock but it doesn't
              * matter at this point) */
+            sgx_reset_ustack(old_ustack);
         }
     }
 
+    *out_result = READ_ONCE(req->result);
+    return 0;
+}
+
+long sgx_exitless_ocall(uint64_t code, void* ms) {
+    /* perform OCALL with enclave exit if no RPC queue (i.e., no exitless); no need for atomics
+     * because this pointer is set only once at enclave initialization */
+    if (!g_rpc_queue)
+        return sgx_ocall(code, ms);
+
+    /* allocate request in a new stack frame on OCALL stack; note that request's lock is used in
+     * futex() and must be aligned to at least 4B */
+    void* old_ustack = sgx_prepare_ustack();
+    rpc_request_t* req = sgx_alloc_on_ustack_aligned(sizeof(*req), alignof(*req));
+    if (!req) {
+        sgx_reset_ustack(old_ustack);
+        return -ENOMEM;
+    }
+
+    if (!rpc_submit(req, code, ms)) {
+        /* no space in queue: all RPC threads are busy with outstanding ocalls; fallback to normal
+         * syscall path with enclave exit */
+        sgx_reset_ustack(old_ustack);
+        return sgx_ocall(code, ms);
+    }
+
+    long result;
+    int ret = rpc_wait(req, &result);
     sgx_reset_ustack(old_ustack);
-    return READ_ONCE(req->result);
+    return ret < 0 ? ret : result;
 }
 
 noreturn void ocall_exit(int exitcode, int is_exitgroup) {
@@ -249,7 +309,10 @@ int ocall_munmap_untrusted(const void* addr, size_t size) {
 }
 
 /*
- * Memorize untrusted memory area to avoid mmap/munmap per each read/write IO. Because this cache
+ * Memorize untrusted memory areas to avoid mmap/munmap per each read/write IO. Each thread caches
+ * up to UNTRUSTED_AREA_CACHE_SLOTS areas; sizes are rounded up to powers of two, so that a request
+ * reuses the smallest cached area that fits it. When the cache is full or would exceed
+ * UNTRUSTED_AREA_CACHE_MAX_SIZE, least recently used areas are unmapped. Because this cache
  * is per-thread, we don't worry about concurrency. The cache will be carried over thread
  * exit/creation. On fork/exec emulation, untrusted code does vfork/exec, so the mmapped cache
  * will be released by exec host syscall.
@@ -260,52 +323,99 @@ int ocall_munmap_untrusted(const void* addr, size_t size) {
  * handling do not use the cache and always explicitly mmap/munmap untrusted memory; 'need_munmap'
  * indicates whether explicit munmap is needed at the end of such OCALL.
  */
+static uint64_t g_untrusted_cache_hits      = 0;
+static uint64_t g_untrusted_cache_misses    = 0;
+static uint64_t g_untrusted_cache_evictions = 0;
+
+static int ocall_mmap_untrusted_nocache(size_t size, void** addrptr, bool* need_munmap) {
+    int ret = ocall_mmap_untrusted(addrptr, size, PROT_READ | PROT_WRITE,
+                                   MAP_ANONYMOUS | MAP_PRIVATE, /*fd=*/-1, /*offset=*/0);
+    if (ret < 0)
+        return ret;
+    *need_munmap = true;
+    return 0;
+}
+
 static int ocall_mmap_untrusted_cache(size_t size, void** addrptr, bool* need_munmap) {
     int ret;
 
     *addrptr = NULL;
     *need_munmap = false;
 
-    struct untrusted_area* cache = &get_tcb_trts()->untrusted_area_cache;
+    struct untrusted_area_cache* cache = &get_tcb_trts()->untrusted_area_cache;
 
     uint64_t in_use = 0;
     if (!__atomic_compare_exchange_n(&cache->in_use, &in_use, 1, /*weak=*/false, __ATOMIC_RELAXED,
                                      __ATOMIC_RELAXED)) {
         /* AEX signal handling case: cache is in use, so make explicit mmap/munmap */
-        ret = ocall_mmap_untrusted(addrptr, size, PROT_READ | PROT_WRITE,
-                                   MAP_ANONYMOUS | MAP_PRIVATE, /*fd=*/-1, /*offset=*/0);
-        if (ret < 0) {
-            return ret;
-        }
-        *need_munmap = true;
-        return 0;
+        return ocall_mmap_untrusted_nocache(size, addrptr, need_munmap);
     }
 
     /* normal execution case: cache was not in use, so use it/allocate new one for reuse */
-    if (cache->valid) {
-        if (cache->size >= size) {
-            *addrptr = cache->addr;
-            return 0;
-        }
-        ret = ocall_munmap_untrusted(cache->addr, cache->size);
-        if (ret < 0) {
-            cache->valid = false;
-            __atomic_store_n(&cache->in_use, 0, __ATOMIC_RELAXED);
-            return ret;
+    cache->clock++;
+
+    struct untrusted_area* best = NULL;
+    size_t total_size = 0;
+    for (size_t i = 0; i < UNTRUSTED_AREA_CACHE_SLOTS; i++) {
+        struct untrusted_area* area = &cache->areas[i];
+        if (!area->valid)
+            continue;
+        total_size += area->size;
+        if (area->size >= size && (!best || area->size < best->size))
+            best = area;
+    }
+
+    if (best) {
+        __atomic_add_fetch(&g_untrusted_cache_hits, 1, __ATOMIC_RELAXED);
+        best->last_used = cache->clock;
+        *addrptr = best->addr;
+        return 0;
+    }
+    __atomic_add_fetch(&g_untrusted_cache_misses, 1, __ATOMIC_RELAXED);
+
+    size_t class_size = 1UL << (64 - __builtin_clzl(size - 1));
+    if (class_size > UNTRUSTED_AREA_CACHE_MAX_SIZE) {
+        /* too large to be cached */
+        __atomic_store_n(&cache->in_use, 0, __ATOMIC_RELAXED);
+        return ocall_mmap_untrusted_nocache(size, addrptr, need_munmap);
+    }
+
+    /* evict least recently used areas until there is a free slot and the new area fits */
+    struct untrusted_area* free_area;
+    while (true) {
+        struct untrusted_area* lru = NULL;
+        free_area = NULL;
+        for (size_t i = 0; i < UNTRUSTED_AREA_CACHE_SLOTS; i++) {
+            struct untrusted_area* area = &cache->areas[i];
+            if (!area->valid) {
+                if (!free_area)
+                    free_area = area;
+            } else if (!lru || area->last_used < lru->last_used) {
+                lru = area;
+            }
         }
+        if (free_area && total_size + class_size <= UNTRUSTED_AREA_CACHE_MAX_SIZE)
+            break;
+
+        /* there is not much we can do in case of munmap error, the area is forgotten anyway */
+        ocall_munmap_untrusted(lru->addr, lru->size);
+        lru->valid = false;
+        total_size -= lru->size;
+        __atomic_add_fetch(&g_untrusted_cache_evictions, 1, __ATOMIC_RELAXED);
     }
 
-    ret = ocall_mmap_untrusted(addrptr, size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE,
-                               /*fd=*/-1, /*offset=*/0);
+    ret = ocall_mmap_untrusted(addrptr, class_size, PROT_READ | PROT_WRITE,
+                               MAP_ANONYMOUS | MAP_PRIVATE, /*fd=*/-1, /*offset=*/0);
     if (ret < 0) {
-        cache->valid = false;
         __atomic_store_n(&cache->in_use, 0, __ATOMIC_RELAXED);
-    } else {
-        cache->valid = true;
-        cache->addr  = *addrptr;
-        cache->size  = size;
+        return ret;
     }
-    return ret;
+
+    free_area->valid     = true;
+    free_area->addr      = *addrptr;
+    free_area->size      = class_size;
+    free_area->last_used = cache->clock;
+    return 0;
 }
 
 static void ocall_munmap_untrusted_cache(void* addr, size_t size, bool need_munmap) {
@@ -313,11 +423,86 @@ static void ocall_munmap_untrusted_cache(void* addr, size_t size, bool need_munm
         ocall_munmap_untrusted(addr, size);
         /* there is not much we can do in case of error */
     } else {
-        struct untrusted_area* cache = &get_tcb_trts()->untrusted_area_cache;
+        struct untrusted_area_cache* cache = &get_tcb_trts()->untrusted_area_cache;
         __atomic_store_n(&cache->in_use, 0, __ATOMIC_RELAXED);
     }
 }
 
+void print_untrusted_cache_stats(void) {
+    log_always("----- Untrusted area cache stats -----\n"
+               "  # of hits:           %lu\n"
+               "  # of misses:         %lu\n"
+               "  # of evictions:      %lu\n",
+               __atomic_load_n(&g_untrusted_cache_hits, __ATOMIC_RELAXED),
+               __atomic_load_n(&g_untrusted_cache_misses, __ATOMIC_RELAXED),
+               __atomic_load_n(&g_untrusted_cache_evictions, __ATOMIC_RELAXED));
+}
+
+/*
+ * Pre-registered untrusted I/O buffers: each enclave thread (more precisely, each TCS) maps
+ * IO_BUFFERS_PER_THREAD untrusted buffers of `sgx.io_buffer_size` bytes once, when the first thread
+ * on this TCS starts, and keeps them for the lifetime of the enclave. Medium and large I/O OCALLs
+ * (read, write, pread, pwrite, recv, send) stage their data in a free buffer of the pool instead of
+ * growing the untrusted stack or calling ocall_mmap_untrusted_cache(), so such transfers need only
+ * a single copy across the enclave boundary and no mmap/munmap OCALLs.
+ *
+ * Similarly to the untrusted area cache above, 'in_use' atomics protect the buffers from OCALLs
+ * issued by in-enclave signal handlers; such OCALLs take the next free buffer or fall back to the
+ * usual paths.
+ */
+size_t g_io_buffer_size = 0;
+
+int init_io_buffers(void) {
+    if (!g_io_buffer_size)
+        return 0;
+
+    struct enclave_tls* tls = get_tcb_trts();
+    for (size_t i = 0; i < IO_BUFFERS_PER_THREAD; i++) {
+        struct untrusted_area* io_buffer = &tls->io_buffers[i];
+        if (io_buffer->valid)
+            continue; /* mapped by previous thread on this TCS */
+
+        void* addr;
+        int ret = ocall_mmap_untrusted(&addr, g_io_buffer_size, PROT_READ | PROT_WRITE,
+                                       MAP_ANONYMOUS | MAP_PRIVATE, /*fd=*/-1, /*offset=*/0);
+        if (ret < 0)
+            return ret;
+
+        io_buffer->addr  = addr;
+        io_buffer->size  = g_io_buffer_size;
+        io_buffer->valid = true;
+    }
+    return 0;
+}
+
+static void* io_buffer_get(size_t size) {
+    if (size < IO_BUFFER_MIN_SIZE)
+        return NULL; /* small buffers are cheaper to allocate on untrusted stack */
+
+    struct enclave_tls* tls = get_tcb_trts();
+    for (size_t i = 0; i < IO_BUFFERS_PER_THREAD; i++) {
+        struct untrusted_area* io_buffer = &tls->io_buffers[i];
+        if (!io_buffer->valid || io_buffer->size < size)
+            continue;
+
+        uint64_t in_use = 0;
+        if (__atomic_compare_exchange_n(&io_buffer->in_use, &in_use, 1, /*weak=*/false,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return io_buffer->addr;
+    }
+    return NULL;
+}
+
+static void io_buffer_put(const void* addr) {
+    struct enclave_tls* tls = get_tcb_trts();
+    for (size_t i = 0; i < IO_BUFFERS_PER_THREAD; i++) {
+        if (tls->io_buffers[i].addr == addr) {
+            __atomic_store_n(&tls->io_buffers[i].in_use, 0, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+}
+
 int ocall_cpuid(unsigned int leaf, unsigned int subleaf, unsigned int values[4]) {
     int retval = 0;
     ms_ocall_cpuid_t* ms;
@@ -348,10 +533,21 @@ int ocall_cpuid(unsigned int leaf, unsigned int subleaf, unsigned int values[4])
     return retval;
 }
 
-int ocall_open(const char* pathname, int flags, unsigned short mode) {
+int ocall_close(int fd) {
     int retval = 0;
-    size_t len = pathname ? strlen(pathname) + 1 : 0;
-    ms_ocall_open_t* ms;
+    ms_ocall_close_t* ms;
+
+    struct ocall_close_deferred* deferred = get_tcb_trts()->close_deferred;
+    if (deferred) {
+        if (deferred->count == ARRAY_SIZE(deferred->fds)) {
+            retval = ocall_close_batch(deferred->fds, deferred->count);
+            deferred->count = 0;
+            if (retval < 0)
+                return retval;
+        }
+        deferred->fds[deferred->count++] = fd;
+        return 0;
+    }
 
     void* old_ustack = sgx_prepare_ustack();
     ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
@@ -360,56 +556,119 @@ int ocall_open(const char* pathname, int flags, unsigned short mode) {
         return -EPERM;
     }
 
-    WRITE_ONCE(ms->ms_flags, flags);
-    WRITE_ONCE(ms->ms_mode, mode);
-    void* untrusted_pathname = sgx_copy_to_ustack(pathname, len);
-    if (!untrusted_pathname) {
-        sgx_reset_ustack(old_ustack);
-        return -EPERM;
-    }
-    WRITE_ONCE(ms->ms_pathname, untrusted_pathname);
+    WRITE_ONCE(ms->ms_fd, fd);
 
+    /* We should never restart host-level `close` syscall on errors (including `EINTR`), but
+     * `sgx_ocall_close` does not forward any errors (always returns `0`), so this can only be
+     * an injected `EINTR`. */
     do {
-        retval = sgx_exitless_ocall(OCALL_OPEN, ms);
+        retval = sgx_exitless_ocall(OCALL_CLOSE, ms);
     } while (retval == -EINTR);
 
     sgx_reset_ustack(old_ustack);
     return retval;
 }
 
-int ocall_close(int fd) {
-    int retval = 0;
-    ms_ocall_close_t* ms;
+static void set_batch_entry(struct ocall_batch_entry* entry, uint64_t ocall_index, void* ms) {
+    WRITE_ONCE(entry->ocall_index, ocall_index);
+    WRITE_ONCE(entry->ms, ms);
+    WRITE_ONCE(entry->result, -EINTR);
+}
 
-    void* old_ustack = sgx_prepare_ustack();
-    ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
-    if (!ms) {
-        sgx_reset_ustack(old_ustack);
+/* Submits `count` batch entries (allocated on the untrusted stack) in one OCALL. Results of entries
+ * are filled in by the untrusted side; -EINTR of the whole batch means it was interrupted by a
+ * signal and results of the not yet executed entries are still -EINTR. */
+static long submit_batch(struct ocall_batch_entry* entries, size_t count) {
+    ms_ocall_batch_t* ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
+    if (!ms)
         return -EPERM;
+
+    WRITE_ONCE(ms->ms_count, count);
+    WRITE_ONCE(ms->ms_entries, entries);
+
+    long ret = sgx_exitless_ocall(OCALL_BATCH, ms);
+    return ret == -EINTR ? 0 : ret;
+}
+
+/* Submits `count` OCALLs `ocall_index` whose argument structures (each of `ms_size` bytes) are
+ * stored consecutively at `ms_array` on the untrusted stack. OCALLs that returned -EINTR are
+ * resubmitted, same as non-batched OCALLs do. Per-OCALL results are stored in `results`. Must be
+ * called within the untrusted stack frame of the caller. */
+static long submit_batch_restartable(uint64_t ocall_index, void* ms_array, size_t ms_size,
+                                     size_t count, long* results) {
+    assert(count && count <= OCALL_BATCH_MAX);
+
+    struct ocall_batch_entry* entries = sgx_alloc_on_ustack_aligned(sizeof(*entries) * count,
+                                                                    alignof(*entries));
+    if (!entries)
+        return -EPERM;
+
+    size_t pending[OCALL_BATCH_MAX];
+    size_t pending_cnt = count;
+    for (size_t i = 0; i < count; i++)
+        pending[i] = i;
+
+    while (pending_cnt) {
+        for (size_t j = 0; j < pending_cnt; j++)
+            set_batch_entry(&entries[j], ocall_index, (char*)ms_array + pending[j] * ms_size);
+
+        long ret = submit_batch(entries, pending_cnt);
+        if (ret < 0)
+            return ret;
+
+        size_t still_pending_cnt = 0;
+        for (size_t j = 0; j < pending_cnt; j++) {
+            long result = READ_ONCE(entries[j].result);
+            results[pending[j]] = result;
+            if (result == -EINTR)
+                pending[still_pending_cnt++] = pending[j];
+        }
+        pending_cnt = still_pending_cnt;
     }
+    return 0;
+}
 
-    WRITE_ONCE(ms->ms_fd, fd);
+int ocall_close_batch(const int* fds, size_t count) {
+    long results[OCALL_BATCH_MAX];
 
-    /* We should never restart host-level `close` syscall on errors (including `EINTR`), but
-     * `sgx_ocall_close` does not forward any errors (always returns `0`), so this can only be
-     * an injected `EINTR`. */
-    do {
-        retval = sgx_exitless_ocall(OCALL_CLOSE, ms);
-    } while (retval == -EINTR);
+    while (count) {
+        size_t n = MIN(count, (size_t)OCALL_BATCH_MAX);
 
-    sgx_reset_ustack(old_ustack);
-    return retval;
+        void* old_ustack = sgx_prepare_ustack();
+        ms_ocall_close_t* ms = sgx_alloc_on_ustack_aligned(sizeof(*ms) * n, alignof(*ms));
+        if (!ms) {
+            sgx_reset_ustack(old_ustack);
+            return -EPERM;
+        }
+
+        for (size_t i = 0; i < n; i++)
+            WRITE_ONCE(ms[i].ms_fd, fds[i]);
+
+        /* same as in ocall_close(): `sgx_ocall_close` always returns 0, so -EINTR can only mean
+         * that the close was not executed and it is safe to resubmit */
+        long ret = submit_batch_restartable(OCALL_CLOSE, ms, sizeof(*ms), n, results);
+        sgx_reset_ustack(old_ustack);
+        if (ret < 0)
+            return ret;
+
+        fds   += n;
+        count -= n;
+    }
+    return 0;
 }
 
 ssize_t ocall_read(int fd, void* buf, size_t count) {
     ssize_t retval = 0;
     void* obuf = NULL;
+    void* iobuf = NULL;
     ms_ocall_read_t* ms;
     void* ms_buf;
     bool need_munmap = false;
 
     void* old_ustack = sgx_prepare_ustack();
-    if (count > MAX_UNTRUSTED_STACK_BUF) {
+    if ((iobuf = io_buffer_get(count))) {
+        ms_buf = iobuf;
+    } else if (count > MAX_UNTRUSTED_STACK_BUF) {
         retval = ocall_mmap_untrusted_cache(ALLOC_ALIGN_UP(count), &obuf, &need_munmap);
         if (retval < 0) {
             sgx_reset_ustack(old_ustack);
@@ -449,6 +708,8 @@ ssize_t ocall_read(int fd, void* buf, size_t count) {
 
 out:
     sgx_reset_ustack(old_ustack);
+    if (iobuf)
+        io_buffer_put(iobuf);
     if (obuf)
         ocall_munmap_untrusted_cache(obuf, ALLOC_ALIGN_UP(count), need_munmap);
     return retval;
@@ -457,6 +718,7 @@ out:
 ssize_t ocall_write(int fd, const void* buf, size_t count) {
     ssize_t retval = 0;
     void* obuf = NULL;
+    void* iobuf = NULL;
     ms_ocall_write_t* ms;
     const void* ms_buf;
     bool need_munmap = false;
@@ -466,25 +728,21 @@ ssize_t ocall_write(int fd, const void* buf, size_t count) {
     if (sgx_is_completely_outside_enclave(buf, count)) {
         /* buf is in untrusted memory (e.g., allowed file mmaped in untrusted memory) */
         ms_buf = buf;
-    } else if (sgx_is_completely_within_enclave(buf, count)) {
-        /* typical case of buf inside of enclave memory */
-        if (count > MAX_UNTRUSTED_STACK_BUF) {
-            /* buf is too big and may overflow untrusted stack, so use untrusted heap */
-            retval = ocall_mmap_untrusted_cache(ALLOC_ALIGN_UP(count), &obuf, &need_munmap);
-            if (retval < 0) {
-                sgx_reset_ustack(old_ustack);
-                return retval;
-            }
-            memcpy(obuf, buf, count);
-            ms_buf = obuf;
-        } else {
-            ms_buf = sgx_copy_to_ustack(buf, count);
+    } else if ((iobuf = io_buffer_get(count))) {
+        ms_buf = sgx_copy_from_enclave(iobuf, buf, count) ? iobuf : NULL;
+    } else if (count > MAX_UNTRUSTED_STACK_BUF) {
+        /* buf is too big and may overflow untrusted stack, so use untrusted heap */
+        retval = ocall_mmap_untrusted_cache(ALLOC_ALIGN_UP(count), &obuf, &need_munmap);
+        if (retval < 0) {
+            sgx_reset_ustack(old_ustack);
+            return retval;
         }
+        ms_buf = sgx_copy_from_enclave(obuf, buf, count) ? obuf : NULL;
     } else {
-        /* buf is partially in/out of enclave memory */
-        ms_buf = NULL;
+        ms_buf = sgx_copy_to_ustack(buf, count);
     }
     if (!ms_buf) {
+        /* buf is partially in/out of enclave memory */
         retval = -EPERM;
         goto out;
     }
@@ -508,6 +766,8 @@ ssize_t ocall_write(int fd, const void* buf, size_t count) {
 
 out:
     sgx_reset_ustack(old_ustack);
+    if (iobuf)
+        io_buffer_put(iobuf);
     if (obuf)
         ocall_munmap_untrusted_cache(obuf, ALLOC_ALIGN_UP(count), need_munmap);
     return retval;
@@ -516,12 +776,15 @@ out:
 ssize_t ocall_pread(int fd, void* buf, size_t count, off_t offset) {
     long retval = 0;
     void* obuf = NULL;
+    void* iobuf = NULL;
     ms_ocall_pread_t* ms;
     void* ms_buf;
     bool need_munmap = false;
 
     void* old_ustack = sgx_prepare_ustack();
-    if (count > MAX_UNTRUSTED_STACK_BUF) {
+    if ((iobuf = io_buffer_get(count))) {
+        ms_buf = iobuf;
+    } else if (count > MAX_UNTRUSTED_STACK_BUF) {
         retval = ocall_mmap_untrusted_cache(ALLOC_ALIGN_UP(count), &obuf, &need_munmap);
         if (retval < 0) {
             sgx_reset_ustack(old_ustack);
@@ -560,6 +823,8 @@ ssize_t ocall_pread(int fd, void* buf, size_t count, off_t offset) {
 
 out:
     sgx_reset_ustack(old_ustack);
+    if (iobuf)
+        io_buffer_put(iobuf);
     if (obuf)
         ocall_munmap_untrusted_cache(obuf, ALLOC_ALIGN_UP(count), need_munmap);
     return retval;
@@ -568,6 +833,7 @@ out:
 ssize_t ocall_pwrite(int fd, const void* buf, size_t count, off_t offset) {
     long retval = 0;
     void* obuf = NULL;
+    void* iobuf = NULL;
     ms_ocall_pwrite_t* ms;
     const void* ms_buf;
     bool need_munmap = false;
@@ -577,25 +843,21 @@ ssize_t ocall_pwrite(int fd, const void* buf, size_t count, off_t offset) {
     if (sgx_is_completely_outside_enclave(buf, count)) {
         /* buf is in untrusted memory (e.g., allowed file mmaped in untrusted memory) */
         ms_buf = buf;
-    } else if (sgx_is_completely_within_enclave(buf, count)) {
-        /* typical case of buf inside of enclave memory */
-        if (count > MAX_UNTRUSTED_STACK_BUF) {
-            /* buf is too big and may overflow untrusted stack, so use untrusted heap */
-            retval = ocall_mmap_untrusted_cache(ALLOC_ALIGN_UP(count), &obuf, &need_munmap);
-            if (retval < 0) {
-                sgx_reset_ustack(old_ustack);
-                return retval;
-            }
-            memcpy(obuf, buf, count);
-            ms_buf = obuf;
-        } else {
-            ms_buf = sgx_copy_to_ustack(buf, count);
+    } else if ((iobuf = io_buffer_get(count))) {
+        ms_buf = sgx_copy_from_enclave(iobuf, buf, count) ? iobuf : NULL;
+    } else if (count > MAX_UNTRUSTED_STACK_BUF) {
+        /* buf is too big and may overflow untrusted stack, so use untrusted heap */
+        retval = ocall_mmap_untrusted_cache(ALLOC_ALIGN_UP(count), &obuf, &need_munmap);
+        if (retval < 0) {
+            sgx_reset_ustack(old_ustack);
+            return retval;
         }
+        ms_buf = sgx_copy_from_enclave(obuf, buf, count) ? obuf : NULL;
     } else {
-        /* buf is partially in/out of enclave memory */
-        ms_buf = NULL;
+        ms_buf = sgx_copy_to_ustack(buf, count);
     }
     if (!ms_buf) {
+        /* buf is partially in/out of enclave memory */
         retval = -EPERM;
         goto out;
     }
@@ -619,104 +881,195 @@ ssize_t ocall_pwrite(int fd, const void* buf, size_t count, off_t offset) {
 
 out:
     sgx_reset_ustack(old_ustack);
+    if (iobuf)
+        io_buffer_put(iobuf);
     if (obuf)
         ocall_munmap_untrusted_cache(obuf, ALLOC_ALIGN_UP(count), need_munmap);
     return retval;
 }
 
-int ocall_fstat(int fd, struct stat* buf) {
-    int retval = 0;
-    ms_ocall_fstat_t* ms;
+ssize_t ocall_pwritev(int fd, const struct ocall_pwritev_seg* segs, size_t count) {
+    long retval = 0;
+    void* obuf = NULL;
+    bool need_munmap = false;
+    size_t total = 0;
 
-    void* old_ustack = sgx_prepare_ustack();
-    ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
-    if (!ms) {
-        sgx_reset_ustack(old_ustack);
-        return -EPERM;
-    }
+    if (!count || count > OCALL_PWRITEV_MAX)
+        return -EINVAL;
 
-    WRITE_ONCE(ms->ms_fd, fd);
+    for (size_t i = 0; i < count; i++)
+        if (__builtin_add_overflow(total, segs[i].count, &total))
+            return -EINVAL;
 
-    do {
-        retval = sgx_exitless_ocall(OCALL_FSTAT, ms);
-    } while (retval == -EINTR);
+    void* old_ustack = sgx_prepare_ustack();
 
-    if (!retval) {
-        memcpy(buf, &ms->ms_stat, sizeof(struct stat));
+    /* data of all segments is copied to one untrusted buffer */
+    uint8_t* ms_data;
+    if (total > MAX_UNTRUSTED_STACK_BUF) {
+        retval = ocall_mmap_untrusted_cache(ALLOC_ALIGN_UP(total), &obuf, &need_munmap);
+        if (retval < 0) {
+            sgx_reset_ustack(old_ustack);
+            return retval;
+        }
+        ms_data = obuf;
+    } else {
+        ms_data = sgx_alloc_on_ustack(total);
     }
 
-    sgx_reset_ustack(old_ustack);
-    return retval;
-}
-
-int ocall_fionread(int fd) {
-    int retval = 0;
-    ms_ocall_fionread_t* ms;
+    struct ocall_pwritev_seg* ms_segs = sgx_alloc_on_ustack_aligned(sizeof(*ms_segs) * count,
+                                                                    alignof(*ms_segs));
+    ms_ocall_pwritev_t* ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
+    if (!ms_data || !ms_segs || !ms) {
+        retval = -EPERM;
+        goto out;
+    }
 
-    void* old_ustack = sgx_prepare_ustack();
-    ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
-    if (!ms) {
-        sgx_reset_ustack(old_ustack);
-        return -EPERM;
+    size_t data_offset = 0;
+    for (size_t i = 0; i < count; i++) {
+        /* also checks that the segment is inside of the enclave */
+        if (!sgx_copy_from_enclave(ms_data + data_offset, segs[i].buf, segs[i].count)) {
+            retval = -EPERM;
+            goto out;
+        }
+        WRITE_ONCE(ms_segs[i].buf, ms_data + data_offset);
+        WRITE_ONCE(ms_segs[i].count, segs[i].count);
+        WRITE_ONCE(ms_segs[i].offset, segs[i].offset);
+        data_offset += segs[i].count;
     }
 
     WRITE_ONCE(ms->ms_fd, fd);
+    WRITE_ONCE(ms->ms_count, count);
+    WRITE_ONCE(ms->ms_segs, ms_segs);
 
-    do {
-        retval = sgx_exitless_ocall(OCALL_FIONREAD, ms);
-    } while (retval == -EINTR);
+    retval = sgx_exitless_ocall(OCALL_PWRITEV, ms);
+    if (retval > 0 && (size_t)retval > total) {
+        retval = -EPERM;
+        goto out;
+    }
 
+out:
     sgx_reset_ustack(old_ustack);
+    if (obuf)
+        ocall_munmap_untrusted_cache(obuf, ALLOC_ALIGN_UP(total), need_munmap);
     return retval;
 }
 
-int ocall_fsetnonblock(int fd, int nonblocking) {
-    int retval = 0;
-    ms_ocall_fsetnonblock_t* ms;
+static ssize_t ocall_rwv(int fd, const PAL_IOVEC* iov, size_t iov_count, off_t offset,
+                         bool is_write) {
+    ssize_t retval = 0;
+    void* obuf = NULL;
+    void* iobuf = NULL;
+    bool is_obuf_mapped = false;
+    bool need_munmap = false;
+    size_t total = 0;
+    size_t staged = 0;
 
-    void* old_ustack = sgx_prepare_ustack();
-    ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
-    if (!ms) {
-        sgx_reset_ustack(old_ustack);
-        return -EPERM;
-    }
+    if (iov_count > OCALL_IOV_MAX)
+        iov_count = OCALL_IOV_MAX;
 
-    WRITE_ONCE(ms->ms_fd, fd);
-    WRITE_ONCE(ms->ms_nonblocking, nonblocking);
+    /* segments of writes that are already in untrusted memory are passed to the host as they are,
+     * all others are staged in one untrusted buffer */
+    for (size_t i = 0; i < iov_count; i++) {
+        if (__builtin_add_overflow(total, iov[i].size, &total))
+            return -EINVAL;
+        if (is_write && sgx_is_completely_outside_enclave(iov[i].buffer, iov[i].size))
+            continue;
+        if (!sgx_is_completely_within_enclave(iov[i].buffer, iov[i].size))
+            return -EPERM;
+        staged += iov[i].size;
+    }
+    if (!total)
+        return 0;
 
-    do {
-        retval = sgx_exitless_ocall(OCALL_FSETNONBLOCK, ms);
-    } while (retval == -EINTR);
+    void* old_ustack = sgx_prepare_ustack();
 
-    sgx_reset_ustack(old_ustack);
-    return retval;
-}
+    if ((iobuf = io_buffer_get(staged))) {
+        obuf = iobuf;
+    } else if (staged > MAX_UNTRUSTED_STACK_BUF) {
+        retval = ocall_mmap_untrusted_cache(ALLOC_ALIGN_UP(staged), &obuf, &need_munmap);
+        if (retval < 0)
+            goto out;
+        is_obuf_mapped = true;
+    } else {
+        obuf = sgx_alloc_on_ustack(staged);
+        if (!obuf && staged) {
+            retval = -EPERM;
+            goto out;
+        }
+    }
 
-int ocall_fchmod(int fd, unsigned short mode) {
-    int retval = 0;
-    ms_ocall_fchmod_t* ms;
+    struct iovec* ms_iov = sgx_alloc_on_ustack_aligned(sizeof(*ms_iov) * iov_count,
+                                                       alignof(*ms_iov));
+    ms_ocall_readv_t* ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
+    if (!ms_iov || !ms) {
+        retval = -EPERM;
+        goto out;
+    }
 
-    void* old_ustack = sgx_prepare_ustack();
-    ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
-    if (!ms) {
-        sgx_reset_ustack(old_ustack);
-        return -EPERM;
+    size_t data_offset = 0;
+    for (size_t i = 0; i < iov_count; i++) {
+        void* buf = iov[i].buffer;
+        if (!is_write || !sgx_is_completely_outside_enclave(buf, iov[i].size)) {
+            buf = (char*)obuf + data_offset;
+            if (is_write && !sgx_copy_from_enclave(buf, iov[i].buffer, iov[i].size)) {
+                retval = -EPERM;
+                goto out;
+            }
+            data_offset += iov[i].size;
+        }
+        WRITE_ONCE(ms_iov[i].iov_base, buf);
+        WRITE_ONCE(ms_iov[i].iov_len, iov[i].size);
     }
 
     WRITE_ONCE(ms->ms_fd, fd);
-    WRITE_ONCE(ms->ms_mode, mode);
+    WRITE_ONCE(ms->ms_offset, offset < 0 ? -1 : offset);
+    WRITE_ONCE(ms->ms_iov, ms_iov);
+    WRITE_ONCE(ms->ms_iovcnt, iov_count);
 
-    do {
-        retval = sgx_exitless_ocall(OCALL_FCHMOD, ms);
-    } while (retval == -EINTR);
+    retval = sgx_exitless_ocall(is_write ? OCALL_WRITEV : OCALL_READV, ms);
+    if (retval <= 0)
+        goto out;
+    if ((size_t)retval > total) {
+        retval = -EPERM;
+        goto out;
+    }
 
+    if (!is_write) {
+        /* reads are always staged, so segments follow each other in `obuf` */
+        size_t left = retval;
+        data_offset = 0;
+        for (size_t i = 0; i < iov_count && left; i++) {
+            size_t size = MIN(left, iov[i].size);
+            if (!sgx_copy_to_enclave(iov[i].buffer, iov[i].size, (char*)obuf + data_offset,
+                                     size)) {
+                retval = -EPERM;
+                goto out;
+            }
+            data_offset += size;
+            left -= size;
+        }
+    }
+
+out:
     sgx_reset_ustack(old_ustack);
+    if (iobuf)
+        io_buffer_put(iobuf);
+    if (is_obuf_mapped)
+        ocall_munmap_untrusted_cache(obuf, ALLOC_ALIGN_UP(staged), need_munmap);
     return retval;
 }
 
-int ocall_fsync(int fd) {
-    int retval = 0;
-    ms_ocall_fsync_t* ms;
+ssize_t ocall_readv(int fd, const PAL_IOVEC* iov, size_t iov_count, off_t offset) {
+    return ocall_rwv(fd, iov, iov_count, offset, /*is_write=*/false);
+}
+
+ssize_t ocall_writev(int fd, const PAL_IOVEC* iov, size_t iov_count, off_t offset) {
+    return ocall_rwv(fd, iov, iov_count, offset, /*is_write=*/true);
+}
+
+ssize_t ocall_sendfile(int out_fd, int in_fd, off_t offset, size_t count) {
+    ssize_t retval = 0;
+    ms_ocall_sendfile_t* ms;
 
     void* old_ustack = sgx_prepare_ustack();
     ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
@@ -725,19 +1078,24 @@ int ocall_fsync(int fd) {
         return -EPERM;
     }
 
-    WRITE_ONCE(ms->ms_fd, fd);
+    WRITE_ONCE(ms->ms_out_fd, out_fd);
+    WRITE_ONCE(ms->ms_in_fd, in_fd);
+    WRITE_ONCE(ms->ms_offset, offset);
+    WRITE_ONCE(ms->ms_count, count);
 
-    do {
-        retval = sgx_exitless_ocall(OCALL_FSYNC, ms);
-    } while (retval == -EINTR);
+    retval = sgx_exitless_ocall(OCALL_SENDFILE, ms);
+
+    if (retval > 0 && (size_t)retval > count) {
+        retval = -EPERM;
+    }
 
     sgx_reset_ustack(old_ustack);
     return retval;
 }
 
-int ocall_ftruncate(int fd, uint64_t length) {
-    int retval = 0;
-    ms_ocall_ftruncate_t* ms;
+ssize_t ocall_copy_file_range(int fd_in, off_t off_in, int fd_out, off_t off_out, size_t count) {
+    ssize_t retval = 0;
+    ms_ocall_copy_file_range_t* ms;
 
     void* old_ustack = sgx_prepare_ustack();
     ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
@@ -746,43 +1104,178 @@ int ocall_ftruncate(int fd, uint64_t length) {
         return -EPERM;
     }
 
-    WRITE_ONCE(ms->ms_fd, fd);
-    WRITE_ONCE(ms->ms_length, length);
+    WRITE_ONCE(ms->ms_fd_in, fd_in);
+    WRITE_ONCE(ms->ms_off_in, off_in);
+    WRITE_ONCE(ms->ms_fd_out, fd_out);
+    WRITE_ONCE(ms->ms_off_out, off_out);
+    WRITE_ONCE(ms->ms_count, count);
 
-    do {
-        retval = sgx_exitless_ocall(OCALL_FTRUNCATE, ms);
-    } while (retval == -EINTR);
+    retval = sgx_exitless_ocall(OCALL_COPY_FILE_RANGE, ms);
+
+    if (retval > 0 && (size_t)retval > count) {
+        retval = -EPERM;
+    }
 
     sgx_reset_ustack(old_ustack);
     return retval;
 }
 
-int ocall_mkdir(const char* pathname, unsigned short mode) {
-    int retval = 0;
-    size_t len = pathname ? strlen(pathname) + 1 : 0;
-    ms_ocall_mkdir_t* ms;
+/*
+ * Asynchronous OCALLs. The request, OCALL arguments and data of an asynchronous OCALL must outlive
+ * the stack frame of the submitting function, so instead of the untrusted stack they live in one of
+ * OCALL_ASYNC_MAX slots of an untrusted area that is mapped on first use. Slots are allocated with
+ * a lock-free bitmap; completion is signaled by RPC threads through the request's lock, exactly as
+ * for synchronous exitless OCALLs.
+ */
+struct ocall_async_slot {
+    rpc_request_t req;
+    union {
+        ms_ocall_write_t write;
+        ms_ocall_pwrite_t pwrite;
+    } ms;
+    uint8_t buf[OCALL_ASYNC_BUF_SIZE];
+};
+
+static_assert(OCALL_ASYNC_MAX == 64, "slot bitmap must fit in uint64_t");
+
+static struct ocall_async_slot* g_async_slots = NULL;
+static uint64_t g_async_slots_used = 0;
+static spinlock_t g_async_slots_lock = INIT_SPINLOCK_UNLOCKED;
+
+static struct ocall_async_slot* get_async_slots(void) {
+    struct ocall_async_slot* slots = __atomic_load_n(&g_async_slots, __ATOMIC_ACQUIRE);
+    if (slots)
+        return slots;
+
+    spinlock_lock(&g_async_slots_lock);
+    if (!g_async_slots) {
+        void* addr;
+        int ret = ocall_mmap_untrusted(&addr, ALLOC_ALIGN_UP(sizeof(*slots) * OCALL_ASYNC_MAX),
+                                       PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE,
+                                       /*fd=*/-1, /*offset=*/0);
+        if (ret == 0)
+            __atomic_store_n(&g_async_slots, addr, __ATOMIC_RELEASE);
+    }
+    slots = g_async_slots;
+    spinlock_unlock(&g_async_slots_lock);
+    return slots;
+}
 
-    void* old_ustack = sgx_prepare_ustack();
-    ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
-    if (!ms) {
-        sgx_reset_ustack(old_ustack);
-        return -EPERM;
+static size_t alloc_async_slot(void) {
+    uint64_t used = __atomic_load_n(&g_async_slots_used, __ATOMIC_RELAXED);
+    while (~used) {
+        size_t slot = __builtin_ctzl(~used);
+        if (__atomic_compare_exchange_n(&g_async_slots_used, &used, used | (1UL << slot),
+                                        /*weak=*/true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return slot;
     }
+    return OCALL_ASYNC_MAX;
+}
 
-    WRITE_ONCE(ms->ms_mode, mode);
-    void* untrusted_pathname = sgx_copy_to_ustack(pathname, len);
-    if (!untrusted_pathname) {
-        sgx_reset_ustack(old_ustack);
-        return -EPERM;
+static void free_async_slot(size_t slot) {
+    __atomic_fetch_and(&g_async_slots_used, ~(1UL << slot), __ATOMIC_RELEASE);
+}
+
+/* finish a write of which `done` bytes were already written, retrying on -EINTR */
+static ssize_t write_rest(int fd, const void* buf, size_t count, off_t offset, size_t done) {
+    while (done < count) {
+        ssize_t ret = offset < 0 ? ocall_write(fd, buf + done, count - done)
+                                 : ocall_pwrite(fd, buf + done, count - done, offset + done);
+        if (ret == -EINTR)
+            continue;
+        if (ret < 0)
+            return ret;
+        if (ret == 0)
+            return -EIO;
+        done += ret;
     }
-    WRITE_ONCE(ms->ms_pathname, untrusted_pathname);
+    return done;
+}
 
-    do {
-        retval = sgx_exitless_ocall(OCALL_MKDIR, ms);
-    } while (retval == -EINTR);
+void ocall_write_async(int fd, const void* buf, size_t count, off_t offset,
+                       struct ocall_async* async) {
+    async->slot   = OCALL_ASYNC_MAX;
+    async->fd     = fd;
+    async->offset = offset;
+    async->count  = count;
+
+    struct ocall_async_slot* slots = NULL;
+    if (g_rpc_queue && count <= OCALL_ASYNC_BUF_SIZE && sgx_is_completely_within_enclave(buf, count))
+        slots = get_async_slots();
+
+    size_t slot = slots ? alloc_async_slot() : OCALL_ASYNC_MAX;
+    if (slot == OCALL_ASYNC_MAX) {
+        /* no Exitless or no free slot, perform the write synchronously */
+        async->result = write_rest(fd, buf, count, offset, /*done=*/0);
+        return;
+    }
+
+    struct ocall_async_slot* s = &slots[slot];
+    memcpy(s->buf, buf, count);
+
+    uint64_t code;
+    if (offset < 0) {
+        code = OCALL_WRITE;
+        WRITE_ONCE(s->ms.write.ms_fd, fd);
+        WRITE_ONCE(s->ms.write.ms_count, count);
+        WRITE_ONCE(s->ms.write.ms_buf, s->buf);
+    } else {
+        code = OCALL_PWRITE;
+        WRITE_ONCE(s->ms.pwrite.ms_fd, fd);
+        WRITE_ONCE(s->ms.pwrite.ms_count, count);
+        WRITE_ONCE(s->ms.pwrite.ms_offset, offset);
+        WRITE_ONCE(s->ms.pwrite.ms_buf, s->buf);
+    }
+
+    if (!rpc_submit(&s->req, code, &s->ms)) {
+        /* no space in queue, perform the write synchronously with enclave exit */
+        ssize_t ret = sgx_ocall(code, &s->ms);
+        if (ret == -EINTR)
+            ret = 0;
+        if (ret > (ssize_t)count)
+            ret = -EPERM;
+        else if (ret >= 0)
+            ret = write_rest(fd, s->buf, count, offset, ret);
+        free_async_slot(slot);
+        async->result = ret;
+        return;
+    }
+
+    async->slot = slot;
+}
 
-    sgx_reset_ustack(old_ustack);
-    return retval;
+bool ocall_async_done(struct ocall_async* async) {
+    if (async->slot == OCALL_ASYNC_MAX)
+        return true;
+    rpc_request_t* req = &g_async_slots[async->slot].req;
+    return __atomic_load_n(&req->lock.lock, __ATOMIC_ACQUIRE) == SPINLOCK_UNLOCKED;
+}
+
+ssize_t ocall_async_wait(struct ocall_async* async) {
+    if (async->slot == OCALL_ASYNC_MAX)
+        return async->result;
+
+    struct ocall_async_slot* s = &g_async_slots[async->slot];
+    long result;
+    int ret = rpc_wait(&s->req, &result);
+    if (ret < 0) {
+        /* the write may be still in flight, so the slot is leaked */
+        async->slot   = OCALL_ASYNC_MAX;
+        async->result = ret;
+        return ret;
+    }
+
+    if (result == -EINTR)
+        result = 0;
+    if (result > (long)async->count)
+        result = -EPERM;
+    else if (result >= 0)
+        result = write_rest(async->fd, s->buf, async->count, async->offset, result);
+
+    free_async_slot(async->slot);
+    async->slot   = OCALL_ASYNC_MAX;
+    async->result = result;
+    return result;
 }
 
 int ocall_getdents(int fd, struct linux_dirent64* dirp, size_t dirp_size) {
@@ -850,15 +1343,14 @@ int ocall_resume_thread(void* tcs) {
     return retval;
 }
 
-int ocall_clone_thread(void) {
+int ocall_clone_thread(void* dynamic_tcs) {
     int retval = 0;
-    void* dummy = NULL;
     /* FIXME: if there was an EINTR, there may be an untrusted thread left over */
     do {
         /* clone must happen in the context of current (enclave) thread, cannot use exitless;
          * in particular, the new (enclave) thread must have the same signal mask as the current
          * enclave thread (and NOT signal mask of the RPC thread) */
-        retval = sgx_ocall(OCALL_CLONE_THREAD, dummy);
+        retval = sgx_ocall(OCALL_CLONE_THREAD, dynamic_tcs);
     } while (retval == -EINTR);
     return retval;
 }
@@ -980,8 +1472,8 @@ int ocall_socketpair(int domain, int type, int protocol, int sockfds[2]) {
     return retval;
 }
 
-int ocall_listen(int domain, int type, int protocol, int ipv6_v6only, struct sockaddr* addr,
-                 size_t* addrlen, struct sockopt* sockopt) {
+int ocall_listen(int domain, int type, int protocol, int ipv6_v6only, int reuseport,
+                 struct sockaddr* addr, size_t* addrlen, struct sockopt* sockopt) {
     int retval = 0;
     size_t len = addrlen ? *addrlen : 0;
     ms_ocall_listen_t* ms;
@@ -997,6 +1489,7 @@ int ocall_listen(int domain, int type, int protocol, int ipv6_v6only, struct soc
     WRITE_ONCE(ms->ms_type, type);
     WRITE_ONCE(ms->ms_protocol, protocol);
     WRITE_ONCE(ms->ms_ipv6_v6only, ipv6_v6only);
+    WRITE_ONCE(ms->ms_reuseport, reuseport);
     WRITE_ONCE(ms->ms_addrlen, len);
     void* untrusted_addr = (addr && len) ? sgx_copy_to_ustack(addr, len) : NULL;
     if (addr && len && !untrusted_addr) {
@@ -1070,6 +1563,56 @@ int ocall_accept(int sockfd, struct sockaddr* addr, size_t* addrlen, struct sock
     return retval;
 }
 
+ssize_t ocall_accept_multi(int sockfd, int efd, struct ocall_accepted* conns, size_t count) {
+    ssize_t retval = 0;
+    ms_ocall_accept_multi_t* ms;
+
+    if (!count)
+        return 0;
+    if (count > OCALL_ACCEPT_MAX)
+        count = OCALL_ACCEPT_MAX;
+
+    void* old_ustack = sgx_prepare_ustack();
+    struct ocall_accepted* untrusted_conns =
+        sgx_alloc_on_ustack_aligned(count * sizeof(*untrusted_conns), alignof(*untrusted_conns));
+    ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
+    if (!untrusted_conns || !ms) {
+        retval = -EPERM;
+        goto out;
+    }
+
+    WRITE_ONCE(ms->ms_sockfd, sockfd);
+    WRITE_ONCE(ms->ms_efd, efd);
+    WRITE_ONCE(ms->ms_conns, untrusted_conns);
+    WRITE_ONCE(ms->ms_count, count);
+
+    retval = sgx_exitless_ocall(OCALL_ACCEPT_MULTI, ms);
+    if (retval < 0)
+        goto out;
+    if ((size_t)retval > count) {
+        retval = -EPERM;
+        goto out;
+    }
+
+    if (!sgx_copy_to_enclave(conns, retval * sizeof(*conns), untrusted_conns,
+                             retval * sizeof(*untrusted_conns))) {
+        retval = -EPERM;
+        goto out;
+    }
+
+    for (size_t i = 0; i < (size_t)retval; i++) {
+        if (conns[i].fd < 0 || conns[i].addrlen > sizeof(conns[i].addr)) {
+            /* the FDs can't be trusted either, so they are leaked instead of closed here */
+            retval = -EPERM;
+            goto out;
+        }
+    }
+
+out:
+    sgx_reset_ustack(old_ustack);
+    return retval;
+}
+
 int ocall_connect(int domain, int type, int protocol, int ipv6_v6only, const struct sockaddr* addr,
                   size_t addrlen, struct sockaddr* bind_addr, size_t* bind_addrlen,
                   struct sockopt* sockopt) {
@@ -1126,6 +1669,7 @@ ssize_t ocall_recv(int sockfd, void* buf, size_t count, struct sockaddr* addr, s
                    void* control, size_t* controllenptr) {
     ssize_t retval = 0;
     void* obuf = NULL;
+    void* iobuf = NULL;
     bool is_obuf_mapped = false;
     size_t addrlen = addrlenptr ? *addrlenptr : 0;
     size_t controllen = controllenptr ? *controllenptr : 0;
@@ -1134,7 +1678,9 @@ ssize_t ocall_recv(int sockfd, void* buf, size_t count, struct sockaddr* addr, s
 
     void* old_ustack = sgx_prepare_ustack();
 
-    if ((count + addrlen + controllen) > MAX_UNTRUSTED_STACK_BUF) {
+    if ((iobuf = io_buffer_get(count))) {
+        obuf = iobuf;
+    } else if ((count + addrlen + controllen) > MAX_UNTRUSTED_STACK_BUF) {
         retval = ocall_mmap_untrusted_cache(ALLOC_ALIGN_UP(count), &obuf, &need_munmap);
         if (retval < 0) {
             goto out;
@@ -1203,6 +1749,8 @@ ssize_t ocall_recv(int sockfd, void* buf, size_t count, struct sockaddr* addr, s
 
 out:
     sgx_reset_ustack(old_ustack);
+    if (iobuf)
+        io_buffer_put(iobuf);
     if (is_obuf_mapped)
         ocall_munmap_untrusted_cache(obuf, ALLOC_ALIGN_UP(count), need_munmap);
     return retval;
@@ -1212,32 +1760,31 @@ ssize_t ocall_send(int sockfd, const void* buf, size_t count, const struct socka
                    size_t addrlen, void* control, size_t controllen) {
     ssize_t retval = 0;
     void* obuf = NULL;
+    void* iobuf = NULL;
     bool is_obuf_mapped = false;
     ms_ocall_send_t* ms;
+    const void* ms_buf;
     bool need_munmap;
 
     void* old_ustack = sgx_prepare_ustack();
 
     if (sgx_is_completely_outside_enclave(buf, count)) {
         /* buf is in untrusted memory (e.g., allowed file mmaped in untrusted memory) */
-        obuf = (void*)buf;
-    } else if (sgx_is_completely_within_enclave(buf, count)) {
-        /* typical case of buf inside of enclave memory */
-        if ((count + addrlen + controllen) > MAX_UNTRUSTED_STACK_BUF) {
-            /* buf is too big and may overflow untrusted stack, so use untrusted heap */
-            retval = ocall_mmap_untrusted_cache(ALLOC_ALIGN_UP(count), &obuf, &need_munmap);
-            if (retval < 0)
-                goto out;
-            is_obuf_mapped = true;
-            memcpy(obuf, buf, count);
-        } else {
-            obuf = sgx_copy_to_ustack(buf, count);
-        }
+        ms_buf = buf;
+    } else if ((iobuf = io_buffer_get(count))) {
+        ms_buf = sgx_copy_from_enclave(iobuf, buf, count) ? iobuf : NULL;
+    } else if ((count + addrlen + controllen) > MAX_UNTRUSTED_STACK_BUF) {
+        /* buf is too big and may overflow untrusted stack, so use untrusted heap */
+        retval = ocall_mmap_untrusted_cache(ALLOC_ALIGN_UP(count), &obuf, &need_munmap);
+        if (retval < 0)
+            goto out;
+        is_obuf_mapped = true;
+        ms_buf = sgx_copy_from_enclave(obuf, buf, count) ? obuf : NULL;
     } else {
-        /* buf is partially in/out of enclave memory */
-        obuf = NULL;
+        ms_buf = sgx_copy_to_ustack(buf, count);
     }
-    if (!obuf) {
+    if (!ms_buf) {
+        /* buf is partially in/out of enclave memory */
         retval = -EPERM;
         goto out;
     }
@@ -1257,7 +1804,7 @@ ssize_t ocall_send(int sockfd, const void* buf, size_t count, const struct socka
         retval = -EPERM;
         goto out;
     }
-    WRITE_ONCE(ms->ms_buf, obuf);
+    WRITE_ONCE(ms->ms_buf, ms_buf);
     WRITE_ONCE(ms->ms_addr, untrusted_addr);
     WRITE_ONCE(ms->ms_control, untrusted_control);
     WRITE_ONCE(ms->ms_controllen, controllen);
@@ -1270,11 +1817,146 @@ ssize_t ocall_send(int sockfd, const void* buf, size_t count, const struct socka
 
 out:
     sgx_reset_ustack(old_ustack);
+    if (iobuf)
+        io_buffer_put(iobuf);
     if (is_obuf_mapped)
         ocall_munmap_untrusted_cache(obuf, ALLOC_ALIGN_UP(count), need_munmap);
     return retval;
 }
 
+static ssize_t ocall_mmsg(int sockfd, struct sgx_mmsg* msgs, size_t count, bool is_send) {
+    ssize_t retval = 0;
+    void* obuf = NULL;
+    void* iobuf = NULL;
+    bool is_obuf_mapped = false;
+    bool need_munmap = false;
+    size_t total = 0;
+    size_t addrs_total = 0;
+    ms_ocall_mmsg_t* ms;
+
+    if (!count)
+        return 0;
+    if (count > OCALL_MMSG_MAX)
+        count = OCALL_MMSG_MAX;
+
+    for (size_t i = 0; i < count; i++) {
+        if (__builtin_add_overflow(total, msgs[i].len, &total))
+            return -EINVAL;
+        if (msgs[i].addr) {
+            if (msgs[i].addrlen > UINT32_MAX)
+                return -EINVAL;
+            addrs_total += msgs[i].addrlen;
+        }
+        if (is_send && !sgx_is_completely_within_enclave(msgs[i].buf, msgs[i].len)
+                && !sgx_is_completely_outside_enclave(msgs[i].buf, msgs[i].len))
+            return -EPERM;
+    }
+
+    void* old_ustack = sgx_prepare_ustack();
+
+    /* all payloads are packed into one untrusted buffer, like in ocall_recv()/ocall_send() */
+    if ((iobuf = io_buffer_get(total))) {
+        obuf = iobuf;
+    } else if (total + addrs_total + count * sizeof(struct ocall_mmsg) > MAX_UNTRUSTED_STACK_BUF) {
+        retval = ocall_mmap_untrusted_cache(ALLOC_ALIGN_UP(total), &obuf, &need_munmap);
+        if (retval < 0)
+            goto out;
+        is_obuf_mapped = true;
+    } else {
+        obuf = sgx_alloc_on_ustack(total);
+        if (!obuf && total) {
+            retval = -EPERM;
+            goto out;
+        }
+    }
+
+    struct ocall_mmsg* untrusted_msgs = sgx_alloc_on_ustack_aligned(count * sizeof(*untrusted_msgs),
+                                                                    alignof(*untrusted_msgs));
+    ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
+    if (!untrusted_msgs || !ms) {
+        retval = -EPERM;
+        goto out;
+    }
+
+    size_t off = 0;
+    for (size_t i = 0; i < count; i++) {
+        void* untrusted_addr = NULL;
+        if (msgs[i].addr) {
+            untrusted_addr = is_send ? sgx_copy_to_ustack(msgs[i].addr, msgs[i].addrlen)
+                                     : sgx_alloc_on_ustack_aligned(msgs[i].addrlen,
+                                                                   alignof(*msgs[i].addr));
+            if (!untrusted_addr) {
+                retval = -EPERM;
+                goto out;
+            }
+        }
+        if (is_send)
+            memcpy(obuf + off, msgs[i].buf, msgs[i].len);
+
+        WRITE_ONCE(untrusted_msgs[i].buf, obuf + off);
+        WRITE_ONCE(untrusted_msgs[i].len, msgs[i].len);
+        WRITE_ONCE(untrusted_msgs[i].addr, untrusted_addr);
+        WRITE_ONCE(untrusted_msgs[i].addrlen, untrusted_addr ? msgs[i].addrlen : 0);
+        WRITE_ONCE(untrusted_msgs[i].msg_len, 0);
+        off += msgs[i].len;
+    }
+
+    WRITE_ONCE(ms->ms_sockfd, sockfd);
+    WRITE_ONCE(ms->ms_msgs, untrusted_msgs);
+    WRITE_ONCE(ms->ms_vlen, count);
+
+    retval = sgx_exitless_ocall(is_send ? OCALL_SENDMMSG : OCALL_RECVMMSG, ms);
+    if (retval < 0)
+        goto out;
+    if ((size_t)retval > count) {
+        retval = -EPERM;
+        goto out;
+    }
+
+    off = 0;
+    for (size_t i = 0; i < (size_t)retval; i++) {
+        size_t size = msgs[i].len;
+        size_t msg_len = READ_ONCE(untrusted_msgs[i].msg_len);
+        if (msg_len > size) {
+            retval = -EPERM;
+            goto out;
+        }
+        if (!is_send) {
+            if (msg_len && !sgx_copy_to_enclave(msgs[i].buf, size, obuf + off, msg_len)) {
+                retval = -EPERM;
+                goto out;
+            }
+            if (msgs[i].addr && msgs[i].addrlen) {
+                size_t untrusted_addrlen = READ_ONCE(untrusted_msgs[i].addrlen);
+                if (!sgx_copy_to_enclave(msgs[i].addr, msgs[i].addrlen,
+                                         READ_ONCE(untrusted_msgs[i].addr), untrusted_addrlen)) {
+                    retval = -EPERM;
+                    goto out;
+                }
+                msgs[i].addrlen = untrusted_addrlen;
+            }
+        }
+        msgs[i].len = msg_len;
+        off += size;
+    }
+
+out:
+    sgx_reset_ustack(old_ustack);
+    if (iobuf)
+        io_buffer_put(iobuf);
+    if (is_obuf_mapped)
+        ocall_munmap_untrusted_cache(obuf, ALLOC_ALIGN_UP(total), need_munmap);
+    return retval;
+}
+
+ssize_t ocall_recvmmsg(int sockfd, struct sgx_mmsg* msgs, size_t count) {
+    return ocall_mmsg(sockfd, msgs, count, /*is_send=*/false);
+}
+
+ssize_t ocall_sendmmsg(int sockfd, struct sgx_mmsg* msgs, size_t count) {
+    return ocall_mmsg(sockfd, msgs, count, /*is_send=*/true);
+}
+
 int ocall_setsockopt(int sockfd, int level, int optname, const void* optval, size_t optlen) {
     int retval = 0;
     ms_ocall_setsockopt_t* ms;
@@ -1310,49 +1992,6 @@ int ocall_setsockopt(int sockfd, int level, int optname, const void* optval, siz
     return retval;
 }
 
-int ocall_shutdown(int sockfd, int how) {
-    int retval = 0;
-    ms_ocall_shutdown_t* ms;
-
-    void* old_ustack = sgx_prepare_ustack();
-    ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
-    if (!ms) {
-        sgx_reset_ustack(old_ustack);
-        return -EPERM;
-    }
-
-    WRITE_ONCE(ms->ms_sockfd, sockfd);
-    WRITE_ONCE(ms->ms_how, how);
-
-    do {
-        retval = sgx_exitless_ocall(OCALL_SHUTDOWN, ms);
-    } while (retval == -EINTR);
-
-    sgx_reset_ustack(old_ustack);
-    return retval;
-}
-
-int ocall_gettime(uint64_t* microsec) {
-    int retval = 0;
-    ms_ocall_gettime_t* ms;
-
-    void* old_ustack = sgx_prepare_ustack();
-    ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
-    if (!ms) {
-        sgx_reset_ustack(old_ustack);
-        return -EPERM;
-    }
-
-    do {
-        retval = sgx_exitless_ocall(OCALL_GETTIME, ms);
-    } while (retval == -EINTR);
-    if (!retval)
-        *microsec = READ_ONCE(ms->ms_microsec);
-
-    sgx_reset_ustack(old_ustack);
-    return retval;
-}
-
 void ocall_sched_yield(void) {
     void* old_ustack = sgx_prepare_ustack();
 
@@ -1400,11 +2039,17 @@ out:
     return retval;
 }
 
-int ocall_rename(const char* oldpath, const char* newpath) {
-    int retval = 0;
-    int oldlen = oldpath ? strlen(oldpath) + 1 : 0;
-    int newlen = newpath ? strlen(newpath) + 1 : 0;
-    ms_ocall_rename_t* ms;
+int ocall_epoll_create(void) {
+    int retval;
+    do {
+        retval = sgx_exitless_ocall(OCALL_EPOLL_CREATE, NULL);
+    } while (retval == -EINTR);
+    return retval;
+}
+
+int ocall_epoll_ctl(int epfd, int op, int fd, uint32_t events, uint64_t data) {
+    int retval;
+    ms_ocall_epoll_ctl_t* ms;
 
     void* old_ustack = sgx_prepare_ustack();
     ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
@@ -1413,46 +2058,59 @@ int ocall_rename(const char* oldpath, const char* newpath) {
         return -EPERM;
     }
 
-    void* untrusted_oldpath = sgx_copy_to_ustack(oldpath, oldlen);
-    void* untrusted_newpath = sgx_copy_to_ustack(newpath, newlen);
-    if (!untrusted_oldpath || !untrusted_newpath) {
-        sgx_reset_ustack(old_ustack);
-        return -EPERM;
-    }
-    WRITE_ONCE(ms->ms_oldpath, untrusted_oldpath);
-    WRITE_ONCE(ms->ms_newpath, untrusted_newpath);
+    WRITE_ONCE(ms->ms_epfd, epfd);
+    WRITE_ONCE(ms->ms_op, op);
+    WRITE_ONCE(ms->ms_fd, fd);
+    WRITE_ONCE(ms->ms_event.events, events);
+    WRITE_ONCE(ms->ms_event.data, data);
 
     do {
-        retval = sgx_exitless_ocall(OCALL_RENAME, ms);
+        retval = sgx_exitless_ocall(OCALL_EPOLL_CTL, ms);
     } while (retval == -EINTR);
 
     sgx_reset_ustack(old_ustack);
     return retval;
 }
 
-int ocall_delete(const char* pathname) {
-    int retval = 0;
-    size_t len = pathname ? strlen(pathname) + 1 : 0;
-    ms_ocall_delete_t* ms;
+int ocall_epoll_wait(int epfd, struct ocall_epoll_event* events, int maxevents,
+                     int64_t timeout_us) {
+    int retval;
+    size_t events_size = maxevents * sizeof(*events);
+    ms_ocall_epoll_wait_t* ms;
 
     void* old_ustack = sgx_prepare_ustack();
     ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
     if (!ms) {
-        sgx_reset_ustack(old_ustack);
-        return -EPERM;
+        retval = -EPERM;
+        goto out;
     }
 
-    void* untrusted_pathname = sgx_copy_to_ustack(pathname, len);
-    if (!untrusted_pathname) {
-        sgx_reset_ustack(old_ustack);
-        return -EPERM;
+    void* untrusted_events = sgx_alloc_on_ustack_aligned(events_size, alignof(*events));
+    if (!untrusted_events) {
+        retval = -EPERM;
+        goto out;
     }
-    WRITE_ONCE(ms->ms_pathname, untrusted_pathname);
 
-    do {
-        retval = sgx_exitless_ocall(OCALL_DELETE, ms);
-    } while (retval == -EINTR);
+    WRITE_ONCE(ms->ms_epfd, epfd);
+    WRITE_ONCE(ms->ms_events, untrusted_events);
+    WRITE_ONCE(ms->ms_maxevents, maxevents);
+    WRITE_ONCE(ms->ms_timeout_us, timeout_us);
+
+    /* EINTR is returned to the caller, same as for ocall_poll() */
+    retval = sgx_exitless_ocall(OCALL_EPOLL_WAIT, ms);
+    if (retval > 0) {
+        if (retval > maxevents) {
+            retval = -EPERM;
+            goto out;
+        }
+        size_t ret_size = retval * sizeof(*events);
+        if (!sgx_copy_to_enclave(events, ret_size, untrusted_events, ret_size)) {
+            retval = -EPERM;
+            goto out;
+        }
+    }
 
+out:
     sgx_reset_ustack(old_ustack);
     return retval;
 }
@@ -1520,28 +2178,6 @@ int ocall_debug_map_remove(void* addr) {
     return retval;
 }
 
-int ocall_eventfd(unsigned int initval, int flags) {
-    int retval = 0;
-    ms_ocall_eventfd_t* ms;
-
-    void* old_ustack = sgx_prepare_ustack();
-    ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
-    if (!ms) {
-        sgx_reset_ustack(old_ustack);
-        return -EPERM;
-    }
-
-    WRITE_ONCE(ms->ms_initval, initval);
-    WRITE_ONCE(ms->ms_flags, flags);
-
-    do {
-        retval = sgx_exitless_ocall(OCALL_EVENTFD, ms);
-    } while (retval == -EINTR);
-
-    sgx_reset_ustack(old_ustack);
-    return retval;
-}
-
 int ocall_get_quote(const sgx_spid_t* spid, bool linkable, const sgx_report_t* report,
                     const sgx_quote_nonce_t* nonce, char** quote, size_t* quote_len) {
     int retval;
@@ -1699,3 +2335,43 @@ int ocall_sched_getaffinity(void* tcs, size_t cpumask_size, void* cpu_mask) {
     sgx_reset_ustack(old_ustack);
     return retval;
 }
+
+static int ocall_edmm_pages(uint64_t code, void* addr, size_t size) {
+    int retval = 0;
+    ms_ocall_edmm_pages_t* ms;
+
+    if (!sgx_is_completely_within_enclave(addr, size))
+        return -EINVAL;
+
+    void* old_ustack = sgx_prepare_ustack();
+    ms = sgx_alloc_on_ustack_aligned(sizeof(*ms), alignof(*ms));
+    if (!ms) {
+        sgx_reset_ustack(old_ustack);
+        return -EPERM;
+    }
+
+    WRITE_ONCE(ms->ms_addr, addr);
+    WRITE_ONCE(ms->ms_size, size);
+
+    do {
+        retval = sgx_exitless_ocall(code, ms);
+    } while (retval == -EINTR);
+
+    if (retval < 0 && !IS_UNIX_ERR(retval))
+        retval = -EPERM;
+
+    sgx_reset_ustack(old_ustack);
+    return retval;
+}
+
+int ocall_edmm_trim_pages(void* addr, size_t size) {
+    return ocall_edmm_pages(OCALL_EDMM_TRIM_PAGES, addr, size);
+}
+
+int ocall_edmm_remove_pages(void* addr, size_t size) {
+    return ocall_edmm_pages(OCALL_EDMM_REMOVE_PAGES, addr, size);
+}
+
+int ocall_edmm_convert_tcs(void* addr) {
+    return ocall_edmm_pages(OCALL_EDMM_CONVERT_TCS, addr, PRESET_PAGESIZE);
+}
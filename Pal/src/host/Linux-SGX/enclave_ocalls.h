@@ -2,6 +2,9 @@
  * This is for enclave to make ocalls to untrusted runtime.
  */
 
+#ifndef ENCLAVE_OCALLS_H
+#define ENCLAVE_OCALLS_H
+
 #include <asm/stat.h>
 #include <linux/poll.h>
 #include <linux/socket.h>
@@ -13,16 +16,66 @@
 
 noreturn void ocall_exit(int exitcode, int is_exitgroup);
 
+/*!
+ * \brief Issue OCALL `code` with argument structure `ms` (already on the untrusted stack).
+ *
+ * The OCALL is submitted to an RPC thread if exitless OCALLs are enabled and one is free, otherwise
+ * it is done with an enclave exit. Used by the stubs generated from ocalls.spec.
+ *
+ * \return  result of the OCALL, or negative error code.
+ */
+long sgx_exitless_ocall(uint64_t code, void* ms);
+
 int ocall_mmap_untrusted(void** addrptr, size_t size, int prot, int flags, int fd, off_t offset);
 
 int ocall_munmap_untrusted(const void* addr, size_t size);
 
+/* I/O OCALLs with at least this many bytes of data use pre-registered untrusted I/O buffers */
+#define IO_BUFFER_MIN_SIZE (64 * 1024)
+
+/* default size of each pre-registered untrusted I/O buffer */
+#define DEFAULT_IO_BUFFER_SIZE (1024 * 1024)
+
+extern size_t g_io_buffer_size; /* from `sgx.io_buffer_size`, 0 if I/O buffers are disabled */
+
+/*!
+ * \brief Map untrusted I/O buffers of the current thread (if not yet mapped for its TCS).
+ *
+ * \return  0 on success, negative error code otherwise.
+ */
+int init_io_buffers(void);
+
+/*!
+ * \brief Print hit/miss/eviction counters of the per-thread untrusted area caches.
+ */
+void print_untrusted_cache_stats(void);
+
 int ocall_cpuid(unsigned int leaf, unsigned int subleaf, unsigned int values[4]);
 
 int ocall_open(const char* pathname, int flags, unsigned short mode);
 
 int ocall_close(int fd);
 
+/* max number of OCALLs submitted in one batch (i.e., in one enclave exit or one RPC round-trip) */
+#define OCALL_BATCH_MAX 64
+
+/*!
+ * \brief Close several host FDs in one batched OCALL.
+ *
+ * \param fds    Array of host FDs to close.
+ * \param count  Number of FDs in `fds`.
+ * \return       0 on success, negative error code otherwise.
+ */
+int ocall_close_batch(const int* fds, size_t count);
+
+/* Host FDs whose close is deferred: while `close_deferred` of the enclave TLS points to this,
+ * ocall_close() only records FDs here (and closes them with ocall_close_batch() when full). Used by
+ * _DkObjectsClose(), which closes the remaining FDs at the end. */
+struct ocall_close_deferred {
+    int fds[OCALL_BATCH_MAX];
+    size_t count;
+};
+
 ssize_t ocall_read(int fd, void* buf, size_t count);
 
 ssize_t ocall_write(int fd, const void* buf, size_t count);
@@ -31,6 +84,97 @@ ssize_t ocall_pread(int fd, void* buf, size_t count, off_t offset);
 
 ssize_t ocall_pwrite(int fd, const void* buf, size_t count, off_t offset);
 
+/*!
+ * \brief Write several segments of data at (possibly non-adjacent) file offsets with one OCALL.
+ *
+ * Segments whose file ranges follow each other are written by the host with a single pwritev.
+ * Returns the number of bytes written counting from the first segment; a return value smaller than
+ * the total size of all segments means that the segments after that point were not (completely)
+ * written.
+ *
+ * \param fd     Host FD to write to.
+ * \param segs   Array of segments, each in enclave memory.
+ * \param count  Number of segments, at most OCALL_PWRITEV_MAX.
+ */
+struct ocall_pwritev_seg;
+ssize_t ocall_pwritev(int fd, const struct ocall_pwritev_seg* segs, size_t count);
+
+/*!
+ * \brief Read into / write from several buffers with one host readv/preadv or writev/pwritev.
+ *
+ * The data of all segments goes through one untrusted buffer. Segments after the first
+ * OCALL_IOV_MAX (see ocall_types.h) are ignored, i.e. the transfer is then partial.
+ *
+ * \param fd         Host FD.
+ * \param iov        Array of segments, each in enclave memory (or, for writes, in untrusted memory).
+ * \param iov_count  Number of segments.
+ * \param offset     File offset, or a negative value to use the host file position.
+ */
+typedef struct PAL_IOVEC_ PAL_IOVEC;
+ssize_t ocall_readv(int fd, const PAL_IOVEC* iov, size_t iov_count, off_t offset);
+ssize_t ocall_writev(int fd, const PAL_IOVEC* iov, size_t iov_count, off_t offset);
+
+/*!
+ * \brief Send up to `count` bytes of host file `in_fd`, starting at `offset`, to `out_fd` with host
+ *        sendfile. The data never enters the enclave, so this is only for files whose contents
+ *        don't have to be verified or decrypted.
+ */
+ssize_t ocall_sendfile(int out_fd, int in_fd, off_t offset, size_t count);
+
+/*!
+ * \brief Copy up to `count` bytes of host file `fd_in`, starting at `off_in`, to host file `fd_out`
+ *        at `off_out` with host copy_file_range. As with ocall_sendfile(), the data never enters
+ *        the enclave.
+ */
+ssize_t ocall_copy_file_range(int fd_in, off_t off_in, int fd_out, off_t off_out, size_t count);
+
+/* max number of asynchronous OCALLs in flight (in the whole enclave) */
+#define OCALL_ASYNC_MAX 64
+/* max size of data for one asynchronous OCALL */
+#define OCALL_ASYNC_BUF_SIZE (64 * 1024)
+
+/* handle of an asynchronous OCALL, owned by the caller */
+struct ocall_async {
+    size_t slot;    /* index of untrusted slot, OCALL_ASYNC_MAX if completed synchronously */
+    int fd;
+    off_t offset;
+    size_t count;
+    ssize_t result; /* valid only if `slot == OCALL_ASYNC_MAX` */
+};
+
+/*!
+ * \brief Submit a write (or a pwrite if `offset >= 0`) without waiting for its completion.
+ *
+ * The data is copied to untrusted memory before this function returns, so `buf` may be reused
+ * right away. The write is served by RPC threads while the caller continues; if Exitless is
+ * disabled, `count` exceeds OCALL_ASYNC_BUF_SIZE or all OCALL_ASYNC_MAX slots are in flight, the
+ * write is performed synchronously. Each submitted write must be finished with ocall_async_wait().
+ * Writes in flight may complete in any order.
+ *
+ * \param fd              Host FD to write to.
+ * \param buf             Data to write.
+ * \param count           Size of `buf`.
+ * \param offset          File offset for pwrite, or -1 for write.
+ * \param[out] async      Handle to be passed to ocall_async_done() and ocall_async_wait().
+ */
+void ocall_write_async(int fd, const void* buf, size_t count, off_t offset,
+                       struct ocall_async* async);
+
+/*!
+ * \brief Check (without blocking) whether an asynchronous OCALL has completed.
+ */
+bool ocall_async_done(struct ocall_async* async);
+
+/*!
+ * \brief Wait for an asynchronous OCALL to complete and release its untrusted slot.
+ *
+ * Writes interrupted by a signal or written only partially are completed synchronously, so the
+ * result is either `count` or a negative error code.
+ *
+ * \return  Number of bytes written or negative error code.
+ */
+ssize_t ocall_async_wait(struct ocall_async* async);
+
 int ocall_fstat(int fd, struct stat* buf);
 
 int ocall_fionread(int fd);
@@ -43,15 +187,25 @@ int ocall_fsync(int fd);
 
 int ocall_ftruncate(int fd, uint64_t length);
 
+int ocall_fallocate(int fd, int mode, uint64_t offset, uint64_t length);
+
+int ocall_fadvise(int fd, uint64_t offset, uint64_t length, int advice);
+
 int ocall_mkdir(const char* pathname, unsigned short mode);
 
 int ocall_getdents(int fd, struct linux_dirent64* dirp, size_t size);
 
-int ocall_listen(int domain, int type, int protocol, int ipv6_v6only, struct sockaddr* addr,
-                 size_t* addrlen, struct sockopt* sockopt);
+int ocall_listen(int domain, int type, int protocol, int ipv6_v6only, int reuseport,
+                 struct sockaddr* addr, size_t* addrlen, struct sockopt* sockopt);
 
 int ocall_accept(int sockfd, struct sockaddr* addr, size_t* addrlen, struct sockopt* opt);
 
+struct ocall_accepted;
+
+/* return the number of accepted connections (at most OCALL_ACCEPT_MAX from ocall_types.h); waits
+ * only for the first connection, see sgx_ocall_accept_multi() for the use of `efd` */
+ssize_t ocall_accept_multi(int sockfd, int efd, struct ocall_accepted* conns, size_t count);
+
 int ocall_connect(int domain, int type, int protocol, int ipv6_v6only, const struct sockaddr* addr,
                   size_t addrlen, struct sockaddr* bind_addr, size_t* bind_addrlen,
                   struct sockopt* sockopt);
@@ -62,6 +216,19 @@ ssize_t ocall_recv(int sockfd, void* buf, size_t count, struct sockaddr* addr, s
 ssize_t ocall_send(int sockfd, const void* buf, size_t count, const struct sockaddr* addr,
                    size_t addrlen, void* control, size_t controllen);
 
+/* one message of ocall_recvmmsg()/ocall_sendmmsg(), in enclave memory */
+struct sgx_mmsg {
+    void* buf;
+    size_t len;            /* size of `buf`; on return, number of bytes transferred */
+    struct sockaddr* addr; /* destination/source address, may be NULL */
+    size_t addrlen;        /* size of `addr`; on return from ocall_recvmmsg(), size of source */
+};
+
+/* return the number of messages transferred (at most OCALL_MMSG_MAX from ocall_types.h, the rest is
+ * ignored); the receive variant waits only for the first message */
+ssize_t ocall_recvmmsg(int sockfd, struct sgx_mmsg* msgs, size_t count);
+ssize_t ocall_sendmmsg(int sockfd, struct sgx_mmsg* msgs, size_t count);
+
 int ocall_setsockopt(int sockfd, int level, int optname, const void* optval, size_t optlen);
 
 int ocall_shutdown(int sockfd, int how);
@@ -72,7 +239,16 @@ int ocall_sched_setaffinity(void* tcs, size_t cpumask_size, void* cpu_mask);
 
 int ocall_sched_getaffinity(void* tcs, size_t cpumask_size, void* cpu_mask);
 
-int ocall_clone_thread(void);
+/*!
+ * \brief Create a new untrusted thread which enters the enclave via ECALL_THREAD_START.
+ *
+ * \param dynamic_tcs  TCS to be used by the new thread, added by the enclave at runtime with EDMM
+ *                     (see ocall_edmm_convert_tcs()); NULL to use any free TCS.
+ *
+ * \return  0 on success, -EAGAIN if there is no free TCS, other negative Linux error code on
+ *          failure.
+ */
+int ocall_clone_thread(void* dynamic_tcs);
 
 int ocall_create_process(size_t nargs, const char** args, int* stream_fd, unsigned int* pid);
 
@@ -86,6 +262,16 @@ int ocall_socketpair(int domain, int type, int protocol, int sockfds[2]);
 
 int ocall_poll(struct pollfd* fds, size_t nfds, int64_t timeout_us);
 
+int ocall_epoll_create(void);
+
+int ocall_epoll_ctl(int epfd, int op, int fd, uint32_t events, uint64_t data);
+
+/* Returns the number of events stored in `events` (at most `maxevents`); `data` of each of them
+ * is untrusted and must be validated by the caller */
+struct ocall_epoll_event;
+int ocall_epoll_wait(int epfd, struct ocall_epoll_event* events, int maxevents,
+                     int64_t timeout_us);
+
 int ocall_rename(const char* oldpath, const char* newpath);
 
 int ocall_delete(const char* pathname);
@@ -114,3 +300,31 @@ int ocall_eventfd(unsigned int initval, int flags);
  */
 int ocall_get_quote(const sgx_spid_t* spid, bool linkable, const sgx_report_t* report,
                     const sgx_quote_nonce_t* nonce, char** quote, size_t* quote_len);
+
+/*!
+ * \brief Ask the host to change the type of enclave pages to TRIM (SGX2 EDMM).
+ *
+ * The enclave must EACCEPT the change for each page before removing the pages with
+ * ocall_edmm_remove_pages().
+ *
+ * \return  0 on success, negative Linux error code otherwise.
+ */
+int ocall_edmm_trim_pages(void* addr, size_t size);
+
+/*!
+ * \brief Ask the host to remove trimmed (and accepted) enclave pages from the enclave (SGX2 EDMM).
+ *
+ * \return  0 on success, negative Linux error code otherwise.
+ */
+int ocall_edmm_remove_pages(void* addr, size_t size);
+
+/*!
+ * \brief Ask the host to change the type of an enclave page to TCS (SGX2 EDMM).
+ *
+ * The enclave must fill the page with TCS contents before and EACCEPT the change after this call.
+ *
+ * \return  0 on success, negative Linux error code otherwise.
+ */
+int ocall_edmm_convert_tcs(void* addr);
+
+#endif /* ENCLAVE_OCALLS_H */
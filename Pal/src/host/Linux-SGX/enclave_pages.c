@@ -1,7 +1,9 @@
 #include "enclave_pages.h"
 
+#include <stdalign.h>
+
 #include "api.h"
-#include "list.h"
+#include "avl_tree.h"
 #include "pal_error.h"
 #include "pal_internal.h"
 #include "pal_linux.h"
@@ -9,6 +11,8 @@
 #include "spinlock.h"
 
 struct atomic_int g_allocated_pages;
+/* high-water mark of `g_allocated_pages`, updated under `g_heap_vma_lock` */
+static size_t g_peak_allocated_pages = 0;
 
 static size_t g_page_size = PRESET_PAGESIZE;
 static void* g_heap_bottom;
@@ -16,24 +20,45 @@ static void* g_heap_top;
 
 static size_t g_pal_internal_mem_used = 0;
 
-/* list of VMAs of used memory areas kept in DESCENDING order; note that preallocated PAL internal
- * memory relies on this descending order of allocations (from high addresses to low), see
+/* with SGX2 EDMM, heap pages are committed (EACCEPTed) when they are allocated and removed from the
+ * enclave when they are freed; otherwise the whole heap is EADDed at enclave creation */
+static bool g_edmm_enabled = false;
+/* with EDMM, number of heap pages currently committed to the enclave */
+static size_t g_edmm_committed_pages = 0;
+
+/* tree of VMAs of used memory areas sorted by address; each node is augmented with the bounds of
+ * its subtree and the largest free gap inside the subtree, so that finding the highest-address free
+ * area of a given size, as well as inserting, removing and merging VMAs, is O(log n); note that
+ * preallocated PAL internal memory relies on allocations going from high addresses to low, see
  * _DkGetAvailableUserAddressRange() for more details */
-DEFINE_LIST(heap_vma);
 struct heap_vma {
-    LIST_TYPE(heap_vma) list;
+    union {
+        struct avl_tree_node node;
+        struct heap_vma* next_free; /* used only while the object is in the pool's free list */
+    };
     void* bottom;
     void* top;
+    void* subtree_bottom;
+    void* subtree_top;
+    size_t subtree_max_gap;
     bool is_pal_internal;
 };
-DEFINE_LISTP(heap_vma);
 
-static LISTP_TYPE(heap_vma) g_heap_vma_list = LISTP_INIT;
+static bool heap_vma_cmp(struct avl_tree_node* a, struct avl_tree_node* b) {
+    return container_of(a, struct heap_vma, node)->bottom
+           <= container_of(b, struct heap_vma, node)->bottom;
+}
+
+static void heap_vma_update(struct avl_tree_node* node);
+
+static struct avl_tree g_heap_vma_tree = {.root = NULL, .cmp = heap_vma_cmp,
+                                          .update = heap_vma_update};
 static spinlock_t g_heap_vma_lock = INIT_SPINLOCK_UNLOCKED;
 
 /* heap_vma objects are taken from pre-allocated pool to avoid recursive mallocs */
-#define MAX_HEAP_VMAS 100000
+#define MAX_HEAP_VMAS (128 * 1024)
 static struct heap_vma g_heap_vma_pool[MAX_HEAP_VMAS];
+static size_t g_heap_vma_pool_used = 0; /* objects after this index were never used */
 static size_t g_heap_vma_num = 0;
 static struct heap_vma* g_free_vma = NULL;
 
@@ -42,24 +67,18 @@ static struct heap_vma* __alloc_vma(void) {
     assert(spinlock_is_locked(&g_heap_vma_lock));
 
     if (g_free_vma) {
-        /* simple optimization: if there is a cached free vma object, use it */
         assert((uintptr_t)g_free_vma >= (uintptr_t)&g_heap_vma_pool[0]);
         assert((uintptr_t)g_free_vma <= (uintptr_t)&g_heap_vma_pool[MAX_HEAP_VMAS - 1]);
 
         struct heap_vma* ret = g_free_vma;
-        g_free_vma = NULL;
+        g_free_vma = ret->next_free;
         g_heap_vma_num++;
         return ret;
     }
 
-    /* FIXME: this loop may become perf bottleneck on large number of vma objects; however,
-     * experiments show that this number typically does not exceed 20 (thanks to VMA merging) */
-    for (size_t i = 0; i < MAX_HEAP_VMAS; i++) {
-        if (!g_heap_vma_pool[i].bottom && !g_heap_vma_pool[i].top) {
-            /* found empty slot in the pool, use it */
-            g_heap_vma_num++;
-            return &g_heap_vma_pool[i];
-        }
+    if (g_heap_vma_pool_used < MAX_HEAP_VMAS) {
+        g_heap_vma_num++;
+        return &g_heap_vma_pool[g_heap_vma_pool_used++];
     }
 
     return NULL;
@@ -70,19 +89,180 @@ static void __free_vma(struct heap_vma* vma) {
     assert((uintptr_t)vma >= (uintptr_t)&g_heap_vma_pool[0]);
     assert((uintptr_t)vma <= (uintptr_t)&g_heap_vma_pool[MAX_HEAP_VMAS - 1]);
 
-    g_free_vma  = vma;
-    vma->top    = 0;
-    vma->bottom = 0;
+    vma->top       = 0;
+    vma->bottom    = 0;
+    vma->next_free = g_free_vma;
+    g_free_vma     = vma;
     g_heap_vma_num--;
 }
 
+static struct heap_vma* node2vma(struct avl_tree_node* node) {
+    return node ? container_of(node, struct heap_vma, node) : NULL;
+}
+
+static void heap_vma_update(struct avl_tree_node* node) {
+    struct heap_vma* vma   = node2vma(node);
+    struct heap_vma* left  = node2vma(node->left);
+    struct heap_vma* right = node2vma(node->right);
+
+    vma->subtree_bottom  = left ? left->subtree_bottom : vma->bottom;
+    vma->subtree_top     = right ? right->subtree_top : vma->top;
+    vma->subtree_max_gap = 0;
+    if (left) {
+        vma->subtree_max_gap = MAX(left->subtree_max_gap, (size_t)(vma->bottom - left->subtree_top));
+    }
+    if (right) {
+        size_t right_gap = MAX(right->subtree_max_gap, (size_t)(right->subtree_bottom - vma->top));
+        vma->subtree_max_gap = MAX(vma->subtree_max_gap, right_gap);
+    }
+}
+
+/* neighbouring VMAs with lower (prev) and higher (next) addresses */
+static struct heap_vma* heap_vma_prev(struct heap_vma* vma) {
+    return node2vma(avl_tree_prev(&vma->node));
+}
+
+static struct heap_vma* heap_vma_next(struct heap_vma* vma) {
+    return node2vma(avl_tree_next(&vma->node));
+}
+
+static bool addr_le_vma_bottom(void* addr, struct avl_tree_node* node) {
+    return (uintptr_t)addr <= (uintptr_t)node2vma(node)->bottom;
+}
+
+/* returns the lowest-address VMA starting at or above `addr`, or NULL if there is none */
+static struct heap_vma* find_vma_above(void* addr) {
+    return node2vma(avl_tree_lower_bound_fn(&g_heap_vma_tree, addr, addr_le_vma_bottom));
+}
+
+/* returns the highest-address VMA starting below the VMA `vma_above` (as returned by
+ * find_vma_above()), or the highest-address VMA overall if `vma_above` is NULL */
+static struct heap_vma* vma_below_of(struct heap_vma* vma_above) {
+    if (vma_above)
+        return heap_vma_prev(vma_above);
+    return node2vma(avl_tree_last(&g_heap_vma_tree));
+}
+
+/* returns the top of the highest-address free gap of at least `size` bytes between VMAs of the
+ * subtree rooted at `vma`; the subtree must contain such a gap */
+static void* find_highest_gap_in_subtree(struct heap_vma* vma, size_t size) {
+    assert(vma->subtree_max_gap >= size);
+
+    while (true) {
+        struct heap_vma* left  = node2vma(vma->node.left);
+        struct heap_vma* right = node2vma(vma->node.right);
+
+        if (right && right->subtree_max_gap >= size) {
+            vma = right;
+        } else if (right && (size_t)(right->subtree_bottom - vma->top) >= size) {
+            return right->subtree_bottom;
+        } else if (left && (size_t)(vma->bottom - left->subtree_top) >= size) {
+            return vma->bottom;
+        } else {
+            assert(left && left->subtree_max_gap >= size);
+            vma = left;
+        }
+    }
+}
+
+/* returns the top of the highest-address free area of at least `size` bytes on the heap, or NULL
+ * if there is no such area */
+static void* find_highest_free_area(size_t size) {
+    struct heap_vma* root = node2vma(g_heap_vma_tree.root);
+
+    if (!root)
+        return (size_t)(g_heap_top - g_heap_bottom) >= size ? g_heap_top : NULL;
+
+    if ((size_t)(g_heap_top - root->subtree_top) >= size)
+        return g_heap_top;
+    if (root->subtree_max_gap >= size)
+        return find_highest_gap_in_subtree(root, size);
+    if ((size_t)(root->subtree_bottom - g_heap_bottom) >= size)
+        return root->subtree_bottom;
+    return NULL;
+}
+
 int init_enclave_pages(void) {
-    g_heap_bottom = g_pal_sec.heap_min;
-    g_heap_top    = g_pal_sec.heap_max;
+    g_heap_bottom  = g_pal_sec.heap_min;
+    g_heap_top     = g_pal_sec.heap_max;
+    g_edmm_enabled = !!GET_ENCLAVE_TLS(edmm_enabled);
     return 0;
 }
 
-static void* __create_vma_and_merge(void* addr, size_t size, bool is_pal_internal,
+/* EACCEPT pages EAUGed by the in-kernel SGX driver (it adds them on first access, i.e., on page
+ * fault in EACCEPT itself); failures mean that the host refused to give us memory, so they are
+ * fatal, similarly to running out of VMA bookkeeping objects */
+static void edmm_commit_pages(void* addr, size_t size) {
+    alignas(64) sgx_arch_sec_info_t secinfo_accept = {
+        .flags = SGX_SECINFO_FLAGS_R | SGX_SECINFO_FLAGS_W | SGX_SECINFO_FLAGS_REG
+                 | SGX_SECINFO_FLAGS_PENDING,
+    };
+    /* EAUGed pages are RW, but heap pages are RWX without EDMM, so keep the same semantics */
+    alignas(64) sgx_arch_sec_info_t secinfo_extend = {
+        .flags = SGX_SECINFO_FLAGS_R | SGX_SECINFO_FLAGS_W | SGX_SECINFO_FLAGS_X,
+    };
+
+    for (void* page = addr; page < addr + size; page += g_page_size) {
+        int64_t ret = sgx_accept(&secinfo_accept, page);
+        if (ret) {
+            log_error("EDMM: accepting enclave page %p failed (SGX error %ld)\n", page, ret);
+            ocall_exit(/*exitcode=*/1, /*is_exitgroup=*/true);
+        }
+        sgx_modpe(&secinfo_extend, page);
+    }
+    __atomic_add_fetch(&g_edmm_committed_pages, size / g_page_size, __ATOMIC_RELAXED);
+}
+
+/* trim and remove pages from the enclave; the trimmed state is verified via EACCEPT, so that the
+ * host cannot trick us into reusing pages it still controls the contents of */
+static void edmm_uncommit_pages(void* addr, size_t size) {
+    alignas(64) sgx_arch_sec_info_t secinfo_trim = {
+        .flags = SGX_SECINFO_FLAGS_TRIM | SGX_SECINFO_FLAGS_MODIFIED,
+    };
+
+    int ret = ocall_edmm_trim_pages(addr, size);
+    if (ret < 0) {
+        log_error("EDMM: trimming enclave pages %p-%p failed: %d\n", addr, addr + size, ret);
+        ocall_exit(/*exitcode=*/1, /*is_exitgroup=*/true);
+    }
+
+    for (void* page = addr; page < addr + size; page += g_page_size) {
+        int64_t sgx_ret = sgx_accept(&secinfo_trim, page);
+        if (sgx_ret) {
+            log_error("EDMM: accepting trimmed page %p failed (SGX error %ld)\n", page, sgx_ret);
+            ocall_exit(/*exitcode=*/1, /*is_exitgroup=*/true);
+        }
+    }
+
+    ret = ocall_edmm_remove_pages(addr, size);
+    if (ret < 0) {
+        log_error("EDMM: removing enclave pages %p-%p failed: %d\n", addr, addr + size, ret);
+        ocall_exit(/*exitcode=*/1, /*is_exitgroup=*/true);
+    }
+    __atomic_sub_fetch(&g_edmm_committed_pages, size / g_page_size, __ATOMIC_RELAXED);
+}
+
+/* commit all pages in [addr, addr + size) that are not yet covered by VMAs; `vma_below` is the
+ * highest-address VMA starting below `addr` (or NULL) */
+static void edmm_commit_unallocated_pages(void* addr, size_t size, struct heap_vma* vma_below) {
+    assert(spinlock_is_locked(&g_heap_vma_lock));
+
+    void* cursor = addr; /* everything in [addr, cursor) is already handled */
+
+    struct heap_vma* vma = vma_below ?: node2vma(avl_tree_first(&g_heap_vma_tree));
+    for (; vma && vma->bottom < addr + size; vma = heap_vma_next(vma)) {
+        if (vma->top <= cursor)
+            continue;
+        if (vma->bottom > cursor)
+            edmm_commit_pages(cursor, vma->bottom - cursor);
+        cursor = vma->top;
+    }
+
+    if (cursor < addr + size)
+        edmm_commit_pages(cursor, addr + size - cursor);
+}
+
+static void* __create_vma_and_merge(void* addr, size_t size, bool is_pal_internal, bool commit,
                                     struct heap_vma* vma_above) {
     assert(spinlock_is_locked(&g_heap_vma_lock));
     assert(addr && size);
@@ -91,13 +271,7 @@ static void* __create_vma_and_merge(void* addr, size_t size, bool is_pal_interna
         return NULL;
 
     /* find enclosing VMAs and check that pal-internal VMAs do not overlap with normal VMAs */
-    struct heap_vma* vma_below;
-    if (vma_above) {
-        vma_below = LISTP_NEXT_ENTRY(vma_above, &g_heap_vma_list, list);
-    } else {
-        /* no VMA above `addr`; VMA right below `addr` must be the first (highest-address) in list */
-        vma_below = LISTP_FIRST_ENTRY(&g_heap_vma_list, struct heap_vma, list);
-    }
+    struct heap_vma* vma_below = vma_below_of(vma_above);
 
     /* check whether [addr, addr + size) overlaps with above VMAs of different type */
     struct heap_vma* check_vma_above = vma_above;
@@ -105,7 +279,7 @@ static void* __create_vma_and_merge(void* addr, size_t size, bool is_pal_interna
         if (check_vma_above->is_pal_internal != is_pal_internal) {
             return NULL;
         }
-        check_vma_above = LISTP_PREV_ENTRY(check_vma_above, &g_heap_vma_list, list);
+        check_vma_above = heap_vma_next(check_vma_above);
     }
 
     /* check whether [addr, addr + size) overlaps with below VMAs of different type */
@@ -114,7 +288,7 @@ static void* __create_vma_and_merge(void* addr, size_t size, bool is_pal_interna
         if (check_vma_below->is_pal_internal != is_pal_internal) {
             return NULL;
         }
-        check_vma_below = LISTP_NEXT_ENTRY(check_vma_below, &g_heap_vma_list, list);
+        check_vma_below = heap_vma_prev(check_vma_below);
     }
 
     /* create VMA with [addr, addr+size); in case of existing overlapping VMAs, the created VMA is
@@ -126,6 +300,11 @@ static void* __create_vma_and_merge(void* addr, size_t size, bool is_pal_interna
     vma->top             = addr + size;
     vma->is_pal_internal = is_pal_internal;
 
+    /* requested area may partially overlap with existing VMAs whose pages are already committed;
+     * lazily populated areas are committed on first access instead */
+    if (g_edmm_enabled && commit)
+        edmm_commit_unallocated_pages(addr, size, vma_below);
+
     /* how much memory was freed because [addr, addr + size) overlapped with VMAs */
     size_t freed = 0;
 
@@ -137,11 +316,11 @@ static void* __create_vma_and_merge(void* addr, size_t size, bool is_pal_interna
            vma_above->is_pal_internal == vma->is_pal_internal) {
         /* newly created VMA grows into above VMA; expand newly created VMA and free above-VMA */
         freed += vma_above->top - vma_above->bottom;
-        struct heap_vma* vma_above_above = LISTP_PREV_ENTRY(vma_above, &g_heap_vma_list, list);
+        struct heap_vma* vma_above_above = heap_vma_next(vma_above);
 
         vma->bottom = MIN(vma_above->bottom, vma->bottom);
         vma->top    = MAX(vma_above->top, vma->top);
-        LISTP_DEL(vma_above, &g_heap_vma_list, list);
+        avl_tree_delete(&g_heap_vma_tree, &vma_above->node);
 
         __free_vma(vma_above);
         vma_above = vma_above_above;
@@ -151,27 +330,29 @@ static void* __create_vma_and_merge(void* addr, size_t size, bool is_pal_interna
            vma_below->is_pal_internal == vma->is_pal_internal) {
         /* newly created VMA grows into below VMA; expand newly create VMA and free below-VMA */
         freed += vma_below->top - vma_below->bottom;
-        struct heap_vma* vma_below_below = LISTP_NEXT_ENTRY(vma_below, &g_heap_vma_list, list);
+        struct heap_vma* vma_below_below = heap_vma_prev(vma_below);
 
         vma->bottom = MIN(vma_below->bottom, vma->bottom);
         vma->top    = MAX(vma_below->top, vma->top);
-        LISTP_DEL(vma_below, &g_heap_vma_list, list);
+        avl_tree_delete(&g_heap_vma_tree, &vma_below->node);
 
         __free_vma(vma_below);
         vma_below = vma_below_below;
     }
 
-    INIT_LIST_HEAD(vma, list);
-    LISTP_ADD_AFTER(vma, vma_above, &g_heap_vma_list, list);
-
     if (vma->bottom >= vma->top) {
         log_error("Bad memory bookkeeping: %p - %p\n", vma->bottom, vma->top);
         ocall_exit(/*exitcode=*/1, /*is_exitgroup=*/true);
     }
 
+    avl_tree_insert(&g_heap_vma_tree, &vma->node);
+
     assert(vma->top - vma->bottom >= (ptrdiff_t)freed);
     size_t allocated = vma->top - vma->bottom - freed;
-    __atomic_add_fetch(&g_allocated_pages.counter, allocated / g_page_size, __ATOMIC_SEQ_CST);
+    size_t allocated_pages = __atomic_add_fetch(&g_allocated_pages.counter,
+                                                allocated / g_page_size, __ATOMIC_SEQ_CST);
+    if (allocated_pages > g_peak_allocated_pages)
+        __atomic_store_n(&g_peak_allocated_pages, allocated_pages, __ATOMIC_RELAXED);
 
     if (is_pal_internal) {
         assert(allocated <= g_pal_internal_mem_size - g_pal_internal_mem_used);
@@ -181,80 +362,33 @@ static void* __create_vma_and_merge(void* addr, size_t size, bool is_pal_interna
     return addr;
 }
 
-void* get_enclave_pages(void* addr, size_t size, bool is_pal_internal) {
-    void* ret = NULL;
-
-    if (!size)
-        return NULL;
-
-    size = ALIGN_UP(size, g_page_size);
-    addr = ALIGN_DOWN_PTR(addr, g_page_size);
-
-    assert(access_ok(addr, size));
-
-    struct heap_vma* vma_above = NULL;
-    struct heap_vma* vma;
-
-    spinlock_lock(&g_heap_vma_lock);
+static void* __get_enclave_pages(void* addr, size_t size, bool is_pal_internal, bool commit) {
+    assert(spinlock_is_locked(&g_heap_vma_lock));
 
     if (is_pal_internal && size > g_pal_internal_mem_size - g_pal_internal_mem_used) {
         /* requested PAL-internal allocation would exceed the limit, fail */
-        goto out;
+        return NULL;
     }
 
     if (addr) {
-        /* caller specified concrete address; find VMA right-above this address */
+        /* caller specified concrete address; check it is inside the heap */
         if (addr < g_heap_bottom || addr + size > g_heap_top)
-            goto out;
-
-        LISTP_FOR_EACH_ENTRY(vma, &g_heap_vma_list, list) {
-            if (vma->bottom < addr) {
-                /* current VMA is not above `addr`, thus vma_above is VMA right-above `addr` */
-                break;
-            }
-            vma_above = vma;
-        }
-        ret = __create_vma_and_merge(addr, size, is_pal_internal, vma_above);
+            return NULL;
     } else {
         /* caller did not specify address; find first (highest-address) empty slot that fits */
-        void* vma_above_bottom = g_heap_top;
-
-        LISTP_FOR_EACH_ENTRY(vma, &g_heap_vma_list, list) {
-            if (vma->top < vma_above_bottom - size) {
-                ret = __create_vma_and_merge(vma_above_bottom - size, size, is_pal_internal,
-                                             vma_above);
-                goto out;
-            }
-            vma_above = vma;
-            vma_above_bottom = vma_above->bottom;
-        }
-
-        /* corner case: there may be enough space between heap bottom and the lowest-address VMA */
-        if (g_heap_bottom < vma_above_bottom - size)
-            ret = __create_vma_and_merge(vma_above_bottom - size, size, is_pal_internal, vma_above);
+        void* free_area_top = find_highest_free_area(size);
+        if (!free_area_top)
+            return NULL;
+        addr = free_area_top - size;
     }
 
-out:
-    spinlock_unlock(&g_heap_vma_lock);
-    return ret;
+    return __create_vma_and_merge(addr, size, is_pal_internal, commit, find_vma_above(addr));
 }
 
-int free_enclave_pages(void* addr, size_t size) {
-    int ret = 0;
-
-    if (!size)
-        return -PAL_ERROR_NOMEM;
-
-    size = ALIGN_UP(size, g_page_size);
-
-    if (!access_ok(addr, size) || !IS_ALIGNED_PTR(addr, g_page_size) || addr < g_heap_bottom ||
-            addr + size > g_heap_top) {
-        return -PAL_ERROR_INVAL;
-    }
-
-    spinlock_lock(&g_heap_vma_lock);
+static int __free_enclave_pages(void* addr, size_t size) {
+    assert(spinlock_is_locked(&g_heap_vma_lock));
 
-    /* VMA list contains both normal and pal-internal VMAs; it is impossible to free an area
+    /* VMA tree contains both normal and pal-internal VMAs; it is impossible to free an area
      * that overlaps with VMAs of two types at the same time, so we fail in such cases */
     bool is_pal_internal_set = false;
     bool is_pal_internal = false;
@@ -262,13 +396,14 @@ int free_enclave_pages(void* addr, size_t size) {
     /* how much memory was actually freed, since [addr, addr + size) can overlap with VMAs */
     size_t freed = 0;
 
-    struct heap_vma* vma;
-    struct heap_vma* p;
-    LISTP_FOR_EACH_ENTRY_SAFE(vma, p, &g_heap_vma_list, list) {
-        if (vma->bottom >= addr + size)
-            continue;
-        if (vma->top <= addr)
-            break;
+    /* start from the VMA right below `addr` if it extends into the area to free */
+    struct heap_vma* vma = find_vma_above(addr);
+    struct heap_vma* vma_below = vma_below_of(vma);
+    if (vma_below && vma_below->top > addr)
+        vma = vma_below;
+
+    while (vma && vma->bottom < addr + size) {
+        struct heap_vma* next = heap_vma_next(vma);
 
         /* found VMA overlapping with area to free; check it is either normal or pal-internal */
         if (!is_pal_internal_set) {
@@ -280,34 +415,48 @@ int free_enclave_pages(void* addr, size_t size) {
             log_error("Area to free (address %p, size %lu) overlaps with both normal and "
                       "pal-internal VMAs\n",
                       addr, size);
-            ret = -PAL_ERROR_INVAL;
-            goto out;
+            return -PAL_ERROR_INVAL;
         }
 
         freed += MIN(vma->top, addr + size) - MAX(vma->bottom, addr);
 
-        if (vma->bottom < addr) {
-            /* create VMA [vma->bottom, addr); this may leave VMA [addr + size, vma->top), see below */
-            struct heap_vma* new = __alloc_vma();
+        struct heap_vma* new = NULL;
+        if (vma->bottom < addr && vma->top > addr + size) {
+            /* area to free is strictly inside the VMA; create VMA [addr + size, vma->top) and
+             * leave VMA [vma->bottom, addr), see below */
+            new = __alloc_vma();
             if (!new) {
                 log_error("Cannot create split VMA during freeing of address %p\n", addr);
-                ret = -PAL_ERROR_NOMEM;
-                goto out;
+                return -PAL_ERROR_NOMEM;
             }
-            new->top             = addr;
-            new->bottom          = vma->bottom;
+            new->bottom          = addr + size;
+            new->top             = vma->top;
             new->is_pal_internal = vma->is_pal_internal;
-            INIT_LIST_HEAD(new, list);
-            LIST_ADD(new, vma, list);
         }
 
-        /* compress overlapping VMA to [addr + size, vma->top) */
-        vma->bottom = addr + size;
-        if (vma->top <= addr + size) {
-            /* memory area to free completely covers/extends above the rest of the VMA */
-            LISTP_DEL(vma, &g_heap_vma_list, list);
+        if (g_edmm_enabled) {
+            void* free_bottom = MAX(vma->bottom, addr);
+            edmm_uncommit_pages(free_bottom, MIN(vma->top, addr + size) - free_bottom);
+        }
+
+        if (vma->bottom < addr) {
+            /* compress overlapping VMA to [vma->bottom, addr); this does not change its position */
+            vma->top = addr;
+            avl_tree_update_path(&g_heap_vma_tree, &vma->node);
+            if (new)
+                avl_tree_insert(&g_heap_vma_tree, &new->node);
+        } else if (vma->top > addr + size) {
+            /* compress overlapping VMA to [addr + size, vma->top); this does not change its
+             * position since it does not overlap with the next VMA */
+            vma->bottom = addr + size;
+            avl_tree_update_path(&g_heap_vma_tree, &vma->node);
+        } else {
+            /* memory area to free completely covers the VMA */
+            avl_tree_delete(&g_heap_vma_tree, &vma->node);
             __free_vma(vma);
         }
+
+        vma = next;
     }
 
     __atomic_sub_fetch(&g_allocated_pages.counter, freed / g_page_size, __ATOMIC_SEQ_CST);
@@ -317,25 +466,642 @@ int free_enclave_pages(void* addr, size_t size) {
         g_pal_internal_mem_used -= freed;
     }
 
+    return 0;
+}
+
+/*
+ * Per-thread caches (magazines) of recently freed page runs, in front of the global VMA tree. Each
+ * enclave thread (more precisely, each TCS) keeps up to ENCLAVE_PAGE_CACHE_SLOTS runs of at most
+ * `sgx.enclave_page_cache_size` bytes in total. A cached run stays allocated in the VMA tree and
+ * is owned by the cache; an allocation of the same size (or, for fixed-address allocations, of the
+ * same range) by the same thread takes it back without touching the global lock and, with EDMM,
+ * without re-committing the pages.
+ *
+ * Frees still take the global lock, but only to check that the run is really allocated and to put
+ * it into the cache, which is much cheaper than splitting VMAs and (with EDMM) removing the pages.
+ * Fixed-address allocations and frees overlapping cached runs of any thread evict these runs first,
+ * so that a cached run is never handed out while someone else owns its memory. When the global
+ * heap cannot satisfy an allocation, all caches are drained and the allocation is retried.
+ *
+ * Lock ordering: g_heap_vma_lock is taken before cache locks; list of caches is protected by
+ * g_heap_vma_lock. Note that cached pages are still accounted as allocated.
+ */
+size_t g_enclave_page_cache_size = 0;
+
+static struct enclave_page_cache* g_page_caches = NULL;
+static uint64_t g_page_cache_runs = 0; /* total number of runs in all caches */
+
+static uint64_t g_page_cache_hits = 0;
+static uint64_t g_page_cache_puts = 0;
+static uint64_t g_page_cache_drains = 0;
+
+static void page_cache_remove_run(struct enclave_page_cache* cache, size_t i) {
+    assert(spinlock_is_locked(&cache->lock));
+    assert(i < cache->cnt);
+
+    cache->size -= cache->runs[i].size;
+    cache->cnt--;
+    memmove(&cache->runs[i], &cache->runs[i + 1], (cache->cnt - i) * sizeof(cache->runs[0]));
+    __atomic_sub_fetch(&g_page_cache_runs, 1, __ATOMIC_RELAXED);
+}
+
+/* takes a run from the cache of the current thread; `addr` may be NULL for any address */
+static void* page_cache_get(void* addr, size_t size, bool is_pal_internal) {
+    if (!g_enclave_page_cache_size || size > g_enclave_page_cache_size)
+        return NULL;
+
+    struct enclave_page_cache* cache = &get_tcb_trts()->page_cache;
+    void* ret = NULL;
+
+    spinlock_lock(&cache->lock);
+    /* prefer the most recently freed run, its pages are most likely still in CPU caches */
+    for (size_t i = cache->cnt; i > 0; i--) {
+        struct enclave_page_run* run = &cache->runs[i - 1];
+        if (run->size == size && run->is_pal_internal == is_pal_internal &&
+                (!addr || run->addr == addr)) {
+            ret = run->addr;
+            page_cache_remove_run(cache, i - 1);
+            break;
+        }
+    }
+    spinlock_unlock(&cache->lock);
+
+    if (ret)
+        __atomic_add_fetch(&g_page_cache_hits, 1, __ATOMIC_RELAXED);
+    return ret;
+}
+
+/* puts a run into the cache of the current thread, if the whole run is allocated memory of a single
+ * type; least recently freed runs are evicted (really freed) to make room */
+static bool page_cache_put(void* addr, size_t size) {
+    assert(spinlock_is_locked(&g_heap_vma_lock));
+
+    if (!g_enclave_page_cache_size || size > g_enclave_page_cache_size)
+        return false;
+
+    struct heap_vma* vma = find_vma_above(addr);
+    if (!vma || vma->bottom != addr)
+        vma = vma_below_of(vma);
+    if (!vma || vma->bottom > addr || vma->top < addr + size)
+        return false;
+
+    struct enclave_page_cache* cache = &get_tcb_trts()->page_cache;
+    struct enclave_page_run evicted[ENCLAVE_PAGE_CACHE_SLOTS];
+    size_t evicted_cnt = 0;
+
+    spinlock_lock(&cache->lock);
+    if (!cache->registered) {
+        cache->next = g_page_caches;
+        g_page_caches = cache;
+        cache->registered = true;
+    }
+
+    while (cache->cnt == ENCLAVE_PAGE_CACHE_SLOTS || cache->size + size > g_enclave_page_cache_size) {
+        evicted[evicted_cnt++] = cache->runs[0];
+        page_cache_remove_run(cache, 0);
+    }
+
+    cache->runs[cache->cnt++] = (struct enclave_page_run){
+        .addr = addr,
+        .size = size,
+        .is_pal_internal = vma->is_pal_internal,
+    };
+    cache->size += size;
+    __atomic_add_fetch(&g_page_cache_runs, 1, __ATOMIC_RELAXED);
+    spinlock_unlock(&cache->lock);
+
+    for (size_t i = 0; i < evicted_cnt; i++) {
+        int ret = __free_enclave_pages(evicted[i].addr, evicted[i].size);
+        if (ret < 0) {
+            log_error("Bad memory bookkeeping: cannot free cached pages %p - %p: %d\n",
+                      evicted[i].addr, evicted[i].addr + evicted[i].size, ret);
+            ocall_exit(/*exitcode=*/1, /*is_exitgroup=*/true);
+        }
+    }
+
+    __atomic_add_fetch(&g_page_cache_puts, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+/* really frees all cached runs overlapping [addr, addr + size) (or all cached runs if `addr` is
+ * NULL) in caches of all threads; returns whether anything was freed */
+static bool page_cache_evict(void* addr, size_t size) {
+    assert(spinlock_is_locked(&g_heap_vma_lock));
+
+    if (!__atomic_load_n(&g_page_cache_runs, __ATOMIC_RELAXED))
+        return false;
+
+    bool evicted_any = false;
+    for (struct enclave_page_cache* cache = g_page_caches; cache; cache = cache->next) {
+        struct enclave_page_run evicted[ENCLAVE_PAGE_CACHE_SLOTS];
+        size_t evicted_cnt = 0;
+
+        spinlock_lock(&cache->lock);
+        for (size_t i = cache->cnt; i > 0; i--) {
+            struct enclave_page_run* run = &cache->runs[i - 1];
+            if (!addr || (run->addr < addr + size && addr < run->addr + run->size)) {
+                evicted[evicted_cnt++] = *run;
+                page_cache_remove_run(cache, i - 1);
+            }
+        }
+        spinlock_unlock(&cache->lock);
+
+        for (size_t i = 0; i < evicted_cnt; i++) {
+            int ret = __free_enclave_pages(evicted[i].addr, evicted[i].size);
+            if (ret < 0) {
+                log_error("Bad memory bookkeeping: cannot free cached pages %p - %p: %d\n",
+                          evicted[i].addr, evicted[i].addr + evicted[i].size, ret);
+                ocall_exit(/*exitcode=*/1, /*is_exitgroup=*/true);
+            }
+        }
+        evicted_any |= evicted_cnt > 0;
+    }
+
+    if (!addr && evicted_any)
+        __atomic_add_fetch(&g_page_cache_drains, 1, __ATOMIC_RELAXED);
+    return evicted_any;
+}
+
+void print_enclave_page_cache_stats(void) {
+    if (!g_enclave_page_cache_size)
+        return;
+
+    log_always("----- Enclave page cache stats -----\n"
+               "  # of hits:           %lu\n"
+               "  # of cached frees:   %lu\n"
+               "  # of drains:         %lu\n",
+               __atomic_load_n(&g_page_cache_hits, __ATOMIC_RELAXED),
+               __atomic_load_n(&g_page_cache_puts, __ATOMIC_RELAXED),
+               __atomic_load_n(&g_page_cache_drains, __ATOMIC_RELAXED));
+}
+
+void print_enclave_heap_stats(void) {
+    size_t heap_size = g_heap_top - g_heap_bottom;
+    size_t peak = __atomic_load_n(&g_peak_allocated_pages, __ATOMIC_RELAXED) * g_page_size;
+    size_t current = __atomic_load_n(&g_allocated_pages.counter, __ATOMIC_RELAXED) * g_page_size;
+
+    /* the peak is what `sgx.enclave_size` must accommodate (besides binaries, stacks etc.) */
+    log_always("----- Enclave heap stats -----\n"
+               "  heap size:           %lu KB\n"
+               "  peak allocated:      %lu KB (%lu%% of heap)\n"
+               "  allocated at exit:   %lu KB\n",
+               heap_size / 1024, peak / 1024, heap_size ? peak * 100 / heap_size : 0,
+               current / 1024);
+    if (g_edmm_enabled)
+        log_always("  committed at exit:   %lu KB\n",
+                   __atomic_load_n(&g_edmm_committed_pages, __ATOMIC_RELAXED) * g_page_size / 1024);
+}
+
+/*
+ * Lazily populated areas (only with EDMM and MISCSELECT.EXINFO, since without EDMM all heap pages
+ * are committed and thus accessible from the start). The VMA of such an area is created as usual,
+ * but its pages are not committed: the first access to each unit of `unit_size` bytes raises #PF,
+ * and handle_lazy_enclave_page_fault() commits the pages of this unit and fills them in with the
+ * `populate` callback. Units are aligned relative to `bottom - unit_offset`, so that they can match
+ * e.g. chunks of a file mapped at a non-chunk-aligned offset.
+ *
+ * When (part of) an area is freed or overwritten by a fixed-address allocation, its unpopulated
+ * pages in the affected range are committed, so that the rest of heap code can treat them as
+ * normal pages; units crossing the boundaries of the affected range are populated, because their
+ * parts outside of the range stay mapped. At this point, a record whose units are all populated is
+ * dropped and its `release` callback is invoked (without any locks held, since it may free memory).
+ *
+ * With `max_readaround` > 0, a fault on the unit right after the units populated by the previous
+ * fault of this area is taken as sequential access and also populates the following units (at most
+ * `max_readaround` of them, the window doubles on each sequential fault), with a single `populate`
+ * call; any other fault resets the window. This saves a #PF and a `populate` round trip (e.g. an
+ * OCALL) per unit for sequential readers of big mappings.
+ *
+ * The `populate` callback is called with g_lazy_ranges_lock held (and possibly g_heap_vma_lock
+ * held), so it must not allocate or free memory. Lock ordering: g_heap_vma_lock is taken before
+ * g_lazy_ranges_lock.
+ */
+struct lazy_range {
+    struct lazy_range* next;
+    void* bottom;
+    void* top;
+    size_t unit_size;
+    size_t unit_offset;
+    size_t units_left; /* number of not yet populated units */
+    size_t max_readaround;
+    size_t ra_window; /* current read-around window, in units */
+    size_t ra_next;   /* unit following the ones populated by the last fault */
+    lazy_populate_fn_t populate;
+    lazy_release_fn_t release;
+    void* arg;
+    uint64_t populated[]; /* bitmap of populated units */
+};
+
+static struct lazy_range* g_lazy_ranges = NULL;
+static spinlock_t g_lazy_ranges_lock = INIT_SPINLOCK_UNLOCKED;
+
+static void* lazy_unit_bottom(struct lazy_range* range, size_t unit) {
+    return MAX(range->bottom, range->bottom - range->unit_offset + unit * range->unit_size);
+}
+
+static void* lazy_unit_top(struct lazy_range* range, size_t unit) {
+    return MIN(range->top, range->bottom - range->unit_offset + (unit + 1) * range->unit_size);
+}
+
+static size_t lazy_unit_of(struct lazy_range* range, void* addr) {
+    return (addr - range->bottom + range->unit_offset) / range->unit_size;
+}
+
+static bool lazy_unit_populated(struct lazy_range* range, size_t unit) {
+    return range->populated[unit / 64] & (1UL << (unit % 64));
+}
+
+static void lazy_unit_set_populated(struct lazy_range* range, size_t unit) {
+    range->populated[unit / 64] |= 1UL << (unit % 64);
+    range->units_left--;
+}
+
+/* commits pages of `count` consecutive unpopulated units and fills them in; on failure, the units
+ * are left zeroed (they are still marked populated, so that subsequent accesses do not fault
+ * infinitely) */
+static int lazy_populate_units(struct lazy_range* range, size_t first, size_t count) {
+    assert(spinlock_is_locked(&g_lazy_ranges_lock));
+    assert(count);
+
+    void* bottom = lazy_unit_bottom(range, first);
+    void* top    = lazy_unit_top(range, first + count - 1);
+
+    edmm_commit_pages(bottom, top - bottom);
+    int ret = range->populate(range->arg, bottom - range->bottom, bottom, top - bottom);
+    if (ret < 0)
+        memset(bottom, 0, top - bottom);
+
+    for (size_t unit = first; unit < first + count; unit++) {
+        assert(!lazy_unit_populated(range, unit));
+        lazy_unit_set_populated(range, unit);
+    }
+    return ret;
+}
+
+static int lazy_populate_unit(struct lazy_range* range, size_t unit) {
+    return lazy_populate_units(range, unit, /*count=*/1);
+}
+
+/* populates the faulting unit and, on sequential faults, the read-around window after it */
+static int lazy_populate_on_fault(struct lazy_range* range, size_t unit) {
+    if (!range->max_readaround)
+        return lazy_populate_unit(range, unit);
+
+    if (unit == range->ra_next) {
+        range->ra_window = range->ra_window ? MIN(range->ra_window * 2, range->max_readaround) : 1;
+    } else {
+        range->ra_window = 0;
+    }
+
+    void* unit_top = lazy_unit_top(range, unit);
+    size_t count = 1;
+    while (count <= range->ra_window && unit_top < range->top
+            && !lazy_unit_populated(range, unit + count)) {
+        unit_top = lazy_unit_top(range, unit + count);
+        count++;
+    }
+
+    range->ra_next = unit + count;
+    return lazy_populate_units(range, unit, count);
+}
+
+/* unlinks ranges without unpopulated units and prepends them to `*released` */
+static void lazy_ranges_collect(struct lazy_range** released) {
+    assert(spinlock_is_locked(&g_lazy_ranges_lock));
+
+    struct lazy_range** pos = &g_lazy_ranges;
+    while (*pos) {
+        struct lazy_range* range = *pos;
+        if (range->units_left) {
+            pos = &range->next;
+            continue;
+        }
+        *pos = range->next;
+        range->next = *released;
+        *released = range;
+    }
+}
+
+/* see the comment above; released records are returned in `*released` for lazy_ranges_free() */
+static void lazy_ranges_release(void* addr, size_t size, struct lazy_range** released) {
+    assert(spinlock_is_locked(&g_heap_vma_lock));
+
+    if (!__atomic_load_n(&g_lazy_ranges, __ATOMIC_RELAXED))
+        return;
+
+    spinlock_lock(&g_lazy_ranges_lock);
+    for (struct lazy_range* range = g_lazy_ranges; range; range = range->next) {
+        void* bottom = MAX(range->bottom, addr);
+        void* top    = MIN(range->top, addr + size);
+        if (bottom >= top)
+            continue;
+
+        size_t first = lazy_unit_of(range, bottom);
+        size_t last  = lazy_unit_of(range, top - 1);
+        for (size_t unit = first; unit <= last; unit++) {
+            if (lazy_unit_populated(range, unit))
+                continue;
+
+            void* unit_bottom = lazy_unit_bottom(range, unit);
+            void* unit_top    = lazy_unit_top(range, unit);
+            if (unit_bottom >= bottom && unit_top <= top) {
+                /* contents of this unit are discarded, only make it a normal committed unit */
+                edmm_commit_pages(unit_bottom, unit_top - unit_bottom);
+                lazy_unit_set_populated(range, unit);
+            } else {
+                /* this unit is only partially affected, its other part must stay intact */
+                (void)lazy_populate_unit(range, unit);
+            }
+        }
+    }
+    lazy_ranges_collect(released);
+    spinlock_unlock(&g_lazy_ranges_lock);
+}
+
+static void lazy_ranges_free(struct lazy_range* released) {
+    assert(!spinlock_is_locked(&g_heap_vma_lock));
+
+    while (released) {
+        struct lazy_range* next = released->next;
+        if (released->release)
+            released->release(released->arg);
+        free(released);
+        released = next;
+    }
+}
+
+void* get_enclave_pages_lazy(void* addr, size_t size, size_t unit_size, size_t unit_offset,
+                             size_t max_readaround, lazy_populate_fn_t populate,
+                             lazy_release_fn_t release, void* arg) {
+    if (!g_edmm_enabled || !(g_pal_sec.enclave_misc_select & SGX_MISCSELECT_EXINFO) || !size)
+        return NULL;
+
+    size = ALIGN_UP(size, g_page_size);
+    addr = ALIGN_DOWN_PTR(addr, g_page_size);
+
+    assert(access_ok(addr, size));
+    assert(IS_ALIGNED(unit_size, g_page_size) && IS_ALIGNED(unit_offset, g_page_size));
+    assert(unit_size && unit_offset < unit_size);
+
+    size_t units = (unit_offset + size + unit_size - 1) / unit_size;
+    size_t bitmap_size = (units + 63) / 64 * sizeof(uint64_t);
+
+    /* allocated before taking g_heap_vma_lock since malloc() may need new enclave pages */
+    struct lazy_range* range = calloc(1, sizeof(*range) + bitmap_size);
+    if (!range)
+        return NULL;
+
+    spinlock_lock(&g_heap_vma_lock);
+
+    void* ret = NULL;
+    if (addr) {
+        if (addr < g_heap_bottom || addr + size > g_heap_top)
+            goto out;
+
+        page_cache_evict(addr, size);
+
+        /* areas overlapping with existing VMAs are not supported (their pages are committed), the
+         * caller falls back to normal allocation */
+        struct heap_vma* vma_above = find_vma_above(addr);
+        struct heap_vma* vma_below = vma_below_of(vma_above);
+        if ((vma_above && vma_above->bottom < addr + size) || (vma_below && vma_below->top > addr))
+            goto out;
+    }
+
+    ret = __get_enclave_pages(addr, size, /*is_pal_internal=*/false, /*commit=*/false);
+    if (!ret)
+        goto out;
+
+    range->bottom         = ret;
+    range->top            = ret + size;
+    range->unit_size      = unit_size;
+    range->unit_offset    = unit_offset;
+    range->units_left     = units;
+    range->populate       = populate;
+    range->release        = release;
+    range->arg            = arg;
+    range->max_readaround = max_readaround;
+    range->ra_next        = (size_t)-1;
+
+    spinlock_lock(&g_lazy_ranges_lock);
+    range->next = g_lazy_ranges;
+    __atomic_store_n(&g_lazy_ranges, range, __ATOMIC_RELAXED);
+    spinlock_unlock(&g_lazy_ranges_lock);
+    range = NULL;
+
+out:
+    spinlock_unlock(&g_heap_vma_lock);
+    free(range);
+    return ret;
+}
+
+bool handle_lazy_enclave_page_fault(void* addr) {
+    if (!__atomic_load_n(&g_lazy_ranges, __ATOMIC_RELAXED))
+        return false;
+
+    bool handled = false;
+
+    spinlock_lock(&g_lazy_ranges_lock);
+    for (struct lazy_range* range = g_lazy_ranges; range; range = range->next) {
+        if (addr < range->bottom || addr >= range->top)
+            continue;
+
+        size_t unit = lazy_unit_of(range, addr);
+        /* the unit may have been populated by another thread in the meantime, just retry access */
+        handled = lazy_unit_populated(range, unit) || lazy_populate_on_fault(range, unit) >= 0;
+        break;
+    }
+    spinlock_unlock(&g_lazy_ranges_lock);
+
+    /* completely populated ranges are not released here but only on free: the interrupted context
+     * might hold locks of the memory allocator */
+    return handled;
+}
+
+void* get_enclave_pages(void* addr, size_t size, bool is_pal_internal) {
+    if (!size)
+        return NULL;
+
+    size = ALIGN_UP(size, g_page_size);
+    addr = ALIGN_DOWN_PTR(addr, g_page_size);
+
+    assert(access_ok(addr, size));
+
+    void* ret = page_cache_get(addr, size, is_pal_internal);
+    if (ret)
+        return ret;
+
+    spinlock_lock(&g_heap_vma_lock);
+
+    /* cached runs overlapping with the requested fixed range must not be handed out later */
+    struct lazy_range* released = NULL;
+    if (addr) {
+        page_cache_evict(addr, size);
+        lazy_ranges_release(addr, size, &released);
+    }
+
+    ret = __get_enclave_pages(addr, size, is_pal_internal, /*commit=*/true);
+    if (!ret && !addr && page_cache_evict(/*addr=*/NULL, /*size=*/0)) {
+        /* memory pressure: cached runs of all threads were freed, try again (fixed-address
+         * allocations fail only because of the requested range itself, so they are not retried) */
+        ret = __get_enclave_pages(addr, size, is_pal_internal, /*commit=*/true);
+    }
+
+    spinlock_unlock(&g_heap_vma_lock);
+    lazy_ranges_free(released);
+    return ret;
+}
+
+int free_enclave_pages(void* addr, size_t size) {
+    int ret = 0;
+
+    if (!size)
+        return -PAL_ERROR_NOMEM;
+
+    size = ALIGN_UP(size, g_page_size);
+
+    if (!access_ok(addr, size) || !IS_ALIGNED_PTR(addr, g_page_size) || addr < g_heap_bottom ||
+            addr + size > g_heap_top) {
+        return -PAL_ERROR_INVAL;
+    }
+
+    spinlock_lock(&g_heap_vma_lock);
+
+    /* the area may overlap with cached runs (e.g. on double free), which must be freed first */
+    page_cache_evict(addr, size);
+
+    struct lazy_range* released = NULL;
+    lazy_ranges_release(addr, size, &released);
+
+    if (!page_cache_put(addr, size))
+        ret = __free_enclave_pages(addr, size);
+
+    spinlock_unlock(&g_heap_vma_lock);
+    lazy_ranges_free(released);
+    return ret;
+}
+
+/* Enclave pages cannot be remapped to other addresses (not even with EDMM), so their contents are
+ * copied. Lazily populated parts of the old range are populated by the copy itself. */
+int move_enclave_pages(void* old_addr, void* new_addr, size_t size) {
+    if (!size)
+        return -PAL_ERROR_INVAL;
+
+    size = ALIGN_UP(size, g_page_size);
+
+    if (!access_ok(old_addr, size) || !IS_ALIGNED_PTR(old_addr, g_page_size) ||
+            old_addr < g_heap_bottom || old_addr + size > g_heap_top ||
+            !IS_ALIGNED_PTR(new_addr, g_page_size)) {
+        return -PAL_ERROR_INVAL;
+    }
+    assert(old_addr + size <= new_addr || new_addr + size <= old_addr);
+
+    if (!get_enclave_pages(new_addr, size, /*is_pal_internal=*/false))
+        return -PAL_ERROR_NOMEM;
+
+    memcpy(new_addr, old_addr, size);
+    return free_enclave_pages(old_addr, size);
+}
+
+static int zero_populate(void* arg, size_t offset, void* addr, size_t size) {
+    __UNUSED(arg);
+    __UNUSED(offset);
+    __UNUSED(addr);
+    __UNUSED(size);
+    /* freshly committed (EAUGed) pages are already zeroed */
+    return 0;
+}
+
+/* With EDMM, the pages are removed from the enclave and the range becomes a lazily populated area
+ * (see above) which is filled with zeroes on first access. Without EDMM, EPC pages cannot be given
+ * back to the host, so the range is only zeroed (and left intact if `lazy`, which is allowed by
+ * MADV_FREE semantics: the memory was just not needed yet). */
+int discard_enclave_pages(void* addr, size_t size, bool lazy) {
+    if (!size)
+        return -PAL_ERROR_INVAL;
+
+    size = ALIGN_UP(size, g_page_size);
+
+    if (!access_ok(addr, size) || !IS_ALIGNED_PTR(addr, g_page_size) || addr < g_heap_bottom ||
+            addr + size > g_heap_top) {
+        return -PAL_ERROR_INVAL;
+    }
+
+    if (!g_edmm_enabled || !(g_pal_sec.enclave_misc_select & SGX_MISCSELECT_EXINFO)) {
+        if (!lazy)
+            memset(addr, 0, size);
+        return 0;
+    }
+
+    size_t units = size / g_page_size;
+    size_t bitmap_size = (units + 63) / 64 * sizeof(uint64_t);
+
+    /* allocated before taking g_heap_vma_lock since malloc() may need new enclave pages */
+    struct lazy_range* range = calloc(1, sizeof(*range) + bitmap_size);
+    if (!range)
+        return -PAL_ERROR_NOMEM;
+
+    int ret = 0;
+    struct lazy_range* released = NULL;
+
+    spinlock_lock(&g_heap_vma_lock);
+
+    page_cache_evict(addr, size);
+
+    /* only memory allocated as a whole by a single normal VMA can be discarded */
+    struct heap_vma* vma = find_vma_above(addr);
+    if (!vma || vma->bottom != addr)
+        vma = vma_below_of(vma);
+    if (!vma || vma->bottom > addr || vma->top < addr + size || vma->is_pal_internal) {
+        ret = -PAL_ERROR_INVAL;
+        goto out;
+    }
+
+    /* parts of the range which are still lazily populated are committed first, so that the whole
+     * range can be uncommitted below */
+    lazy_ranges_release(addr, size, &released);
+    edmm_uncommit_pages(addr, size);
+
+    range->bottom      = addr;
+    range->top         = addr + size;
+    range->unit_size   = g_page_size;
+    range->unit_offset = 0;
+    range->units_left  = units;
+    range->populate    = zero_populate;
+    range->release     = NULL;
+    range->arg         = NULL;
+
+    spinlock_lock(&g_lazy_ranges_lock);
+    range->next = g_lazy_ranges;
+    __atomic_store_n(&g_lazy_ranges, range, __ATOMIC_RELAXED);
+    spinlock_unlock(&g_lazy_ranges_lock);
+    range = NULL;
+
 out:
     spinlock_unlock(&g_heap_vma_lock);
+    lazy_ranges_free(released);
+    free(range);
     return ret;
 }
 
+size_t get_enclave_resident_size(void) {
+    if (g_edmm_enabled)
+        return __atomic_load_n(&g_edmm_committed_pages, __ATOMIC_RELAXED) * g_page_size;
+    /* without EDMM the whole heap is in the enclave, count only the allocated part */
+    return __atomic_load_n(&g_allocated_pages.counter, __ATOMIC_RELAXED) * g_page_size;
+}
+
 /* returns current highest available address on the enclave heap */
 void* get_enclave_heap_top(void) {
     spinlock_lock(&g_heap_vma_lock);
 
     void* addr = g_heap_top;
-    struct heap_vma* vma;
-    LISTP_FOR_EACH_ENTRY(vma, &g_heap_vma_list, list) {
-        if (vma->top < addr) {
-            goto out;
-        }
+    struct heap_vma* vma = node2vma(avl_tree_last(&g_heap_vma_tree));
+    while (vma && vma->top >= addr) {
         addr = vma->bottom;
+        vma = heap_vma_prev(vma);
     }
 
-out:
     spinlock_unlock(&g_heap_vma_lock);
     return addr;
 }
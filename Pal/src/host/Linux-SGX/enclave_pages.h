@@ -1,7 +1,37 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+#define DEFAULT_ENCLAVE_PAGE_CACHE_SIZE (1024 * 1024)
+
+/* per-thread cap on cached freed pages, `sgx.enclave_page_cache_size` (0 disables the caches) */
+extern size_t g_enclave_page_cache_size;
+
 int init_enclave_pages(void);
 void* get_enclave_heap_top(void);
 void* get_enclave_pages(void* addr, size_t size, bool is_pal_internal);
 int free_enclave_pages(void* addr, size_t size);
+/* moves [old_addr, old_addr + size) to the non-overlapping range at `new_addr`, freeing the old
+ * range; any memory previously allocated in the new range is discarded */
+int move_enclave_pages(void* old_addr, void* new_addr, size_t size);
+/* releases the pages of the allocated range [addr, addr + size), its next access reads zeroes; with
+ * `lazy`, the old contents may stay */
+int discard_enclave_pages(void* addr, size_t size, bool lazy);
+/* returns the size of heap memory currently backed by EPC pages */
+size_t get_enclave_resident_size(void);
+
+/* fills in [addr, addr + size) at `offset` from the start of a lazily populated area; must not
+ * allocate or free memory */
+typedef int (*lazy_populate_fn_t)(void* arg, size_t offset, void* addr, size_t size);
+typedef void (*lazy_release_fn_t)(void* arg);
+
+/* allocates an area whose pages are committed and populated on first access, in units of
+ * `unit_size` bytes starting at `unit_offset` bytes before the area; sequential faults populate up
+ * to `max_readaround` following units at once; `release(arg)` is called once the whole area was
+ * populated, freed or overwritten; returns NULL if not supported (requires EDMM and
+ * MISCSELECT.EXINFO), if there is no memory or if a fixed area overlaps existing allocations */
+void* get_enclave_pages_lazy(void* addr, size_t size, size_t unit_size, size_t unit_offset,
+                             size_t max_readaround, lazy_populate_fn_t populate,
+                             lazy_release_fn_t release, void* arg);
+bool handle_lazy_enclave_page_fault(void* addr);
+void print_enclave_page_cache_stats(void);
+void print_enclave_heap_stats(void);
@@ -5,7 +5,9 @@
 
 #include <linux/fs.h>
 
+#include "cpu.h"
 #include "crypto.h"
+#include "ocall_types.h"
 #include "pal_internal.h"
 #include "pal_linux.h"
 #include "pal_linux_error.h"
@@ -27,12 +29,190 @@ bool g_pf_wrap_key_set = false;
  * infinite recursion in FS handlers) we don't use PAL file APIs here, but raw OCALLs.
  */
 
+/* Defaults for per-PF cache parameters (sgx.protected_files_cache_size.<key> and
+ * sgx.protected_files_readahead.<key>): size of the cache of decrypted nodes, and max size of
+ * encrypted nodes read from the host at once when a PF is read sequentially */
+#define PF_DEFAULT_CACHE_SIZE     (48 * PF_NODE_SIZE)
+#define PF_DEFAULT_READAHEAD_SIZE (64 * PF_NODE_SIZE)
+
 /* List of map buffers */
 LISTP_TYPE(pf_map) g_pf_map_list = LISTP_INIT;
+spinlock_t g_pf_map_list_lock = INIT_SPINLOCK_UNLOCKED;
+
+/*
+ * On flush, dirty data and MHT nodes of protected files are written in batches with OCALL_PWRITEV
+ * (see cb_write_vec()). Other writes of data and MHT nodes through cb_write() use asynchronous
+ * OCALLs, so that host writes overlap with the work of the enclave thread. The metadata
+ * node (at offset 0) is the commit point of a flush: it is written synchronously and only after all
+ * pending writes to the same host FD have completed successfully, which keeps the ordering of the
+ * synchronous implementation. Reads and truncations wait for pending writes to the same FD, and so
+ * does a write that overlaps with a pending one. A failed flush and closing the PF also wait for
+ * all pending writes to the FD, so that no entries are left behind for a later file which reuses
+ * the FD number.
+ */
+#define PF_ASYNC_WRITES_MAX 16
+
+enum {
+    PF_ASYNC_WRITE_FREE = 0,
+    PF_ASYNC_WRITE_SUBMITTING,
+    PF_ASYNC_WRITE_PENDING,
+};
+
+struct pf_async_write {
+    int state;
+    int fd;
+    uint64_t offset;
+    size_t size;
+    struct ocall_async async;
+};
+
+static struct pf_async_write g_pf_async_writes[PF_ASYNC_WRITES_MAX];
+static spinlock_t g_pf_async_writes_lock = INIT_SPINLOCK_UNLOCKED;
+
+/* Wait for pending writes to `fd` that overlap with [offset, offset + size); returns false if any
+ * of them failed */
+static bool pf_wait_writes(int fd, uint64_t offset, size_t size) {
+    bool success = true;
+    while (true) {
+        struct ocall_async async;
+        size_t write_size = 0;
+
+        spinlock_lock(&g_pf_async_writes_lock);
+        for (size_t i = 0; i < PF_ASYNC_WRITES_MAX; i++) {
+            struct pf_async_write* w = &g_pf_async_writes[i];
+            if (w->state == PF_ASYNC_WRITE_PENDING && w->fd == fd
+                    && w->offset < offset + size && offset < w->offset + w->size) {
+                async      = w->async;
+                write_size = w->size;
+                w->state   = PF_ASYNC_WRITE_FREE;
+                break;
+            }
+        }
+        spinlock_unlock(&g_pf_async_writes_lock);
+
+        if (!write_size)
+            return success;
+
+        ssize_t written = ocall_async_wait(&async);
+        if (written < 0 || (size_t)written != write_size) {
+            log_error("pf_wait_writes(%d): write of %lu bytes at %lu failed: %ld\n", fd,
+                      write_size, async.offset, written);
+            success = false;
+        }
+    }
+}
+
+static bool pf_wait_all_writes(int fd) {
+    return pf_wait_writes(fd, /*offset=*/0, /*size=*/UINT64_MAX);
+}
+
+/*
+ * Protected files of at least `sgx.protected_files_mmap_min_size` bytes are mapped into untrusted
+ * memory (MAP_SHARED) when they are opened. Node reads and writes that fall within the mapping are
+ * then plain copies between the enclave and the mapping instead of OCALLs. The PF library only
+ * authenticates data once it has been copied into the enclave, so this is as safe as pread. Stores
+ * to a shared mapping go directly to the host page cache, the same as pwrite, so no msync is
+ * needed for them to become visible to host reads and to be written back by the host kernel.
+ * Writes that extend the file beyond the mapping still use OCALLs.
+ */
+#define PF_MMAPS_MAX 16
+
+struct pf_mmap {
+    int fd;
+    bool writable;
+    void* umem;       /* NULL if the slot is free */
+    size_t umem_size;
+    uint64_t size;    /* accessible part of the mapping, shrinks if the file is truncated */
+};
+
+static struct pf_mmap g_pf_mmaps[PF_MMAPS_MAX];
+static spinlock_t g_pf_mmaps_lock = INIT_SPINLOCK_UNLOCKED;
+static uint64_t g_pf_mmap_min_size = 0; /* 0 means that PFs are never mapped */
+
+/* Slots are added and removed only when the PF is opened/closed, i.e., with the PF's lock held,
+ * same as all node I/O of the PF, so the mapping cannot go away while it's being accessed */
+static struct pf_mmap* pf_find_mmap(int fd) {
+    struct pf_mmap* found = NULL;
+    spinlock_lock(&g_pf_mmaps_lock);
+    for (size_t i = 0; i < PF_MMAPS_MAX; i++) {
+        if (g_pf_mmaps[i].umem && g_pf_mmaps[i].fd == fd) {
+            found = &g_pf_mmaps[i];
+            break;
+        }
+    }
+    spinlock_unlock(&g_pf_mmaps_lock);
+    return found;
+}
+
+static void pf_mmap_host_file(int fd, uint64_t size, bool writable) {
+    if (!g_pf_mmap_min_size || size < g_pf_mmap_min_size)
+        return;
+
+    void* umem = NULL;
+    int ret = ocall_mmap_untrusted(&umem, size, PROT_READ | (writable ? PROT_WRITE : 0),
+                                   MAP_SHARED, fd, /*offset=*/0);
+    if (ret < 0) {
+        log_debug("pf_mmap_host_file(%d, %lu): mmap failed (%d), using read/write OCALLs\n", fd,
+                  size, ret);
+        return;
+    }
+
+    spinlock_lock(&g_pf_mmaps_lock);
+    for (size_t i = 0; i < PF_MMAPS_MAX; i++) {
+        struct pf_mmap* m = &g_pf_mmaps[i];
+        if (!m->umem) {
+            m->fd        = fd;
+            m->writable  = writable;
+            m->umem_size = size;
+            m->size      = size;
+            m->umem      = umem;
+            umem = NULL;
+            break;
+        }
+    }
+    spinlock_unlock(&g_pf_mmaps_lock);
+
+    if (umem) {
+        /* all slots are taken */
+        ocall_munmap_untrusted(umem, size);
+    }
+}
+
+static void pf_munmap_host_file(int fd) {
+    struct pf_mmap* m = pf_find_mmap(fd);
+    if (!m)
+        return;
+
+    ocall_munmap_untrusted(m->umem, m->umem_size);
+    spinlock_lock(&g_pf_mmaps_lock);
+    m->umem = NULL;
+    spinlock_unlock(&g_pf_mmaps_lock);
+}
+
+/* Returns false if [offset, offset + size) is not (completely) mapped, in which case the caller
+ * uses OCALLs */
+static bool pf_mmap_copy(int fd, void* buffer, uint64_t offset, size_t size, bool write) {
+    struct pf_mmap* m = pf_find_mmap(fd);
+    if (!m || (write && !m->writable) || offset > m->size || size > m->size - offset)
+        return false;
+
+    if (write) {
+        memcpy(m->umem + offset, buffer, size);
+    } else {
+        memcpy(buffer, m->umem + offset, size);
+    }
+    return true;
+}
 
 /* Callbacks for protected files handling */
 static pf_status_t cb_read(pf_handle_t handle, void* buffer, uint64_t offset, size_t size) {
     int fd = *(int*)handle;
+    if (!pf_wait_writes(fd, offset, size))
+        return PF_STATUS_CALLBACK_FAILED;
+
+    if (pf_mmap_copy(fd, buffer, offset, size, /*write=*/false))
+        return PF_STATUS_SUCCESS;
+
     size_t buffer_offset = 0;
     size_t to_read = size;
     while (to_read > 0) {
@@ -58,8 +238,7 @@ static pf_status_t cb_read(pf_handle_t handle, void* buffer, uint64_t offset, si
     return PF_STATUS_SUCCESS;
 }
 
-static pf_status_t cb_write(pf_handle_t handle, const void* buffer, uint64_t offset, size_t size) {
-    int fd = *(int*)handle;
+static pf_status_t write_sync(int fd, const void* buffer, uint64_t offset, size_t size) {
     size_t buffer_offset = 0;
     size_t to_write = size;
     while (to_write > 0) {
@@ -86,8 +265,130 @@ static pf_status_t cb_write(pf_handle_t handle, const void* buffer, uint64_t off
     return PF_STATUS_SUCCESS;
 }
 
+static struct pf_async_write* reserve_async_write(int fd, uint64_t offset, size_t size) {
+    struct pf_async_write* reserved = NULL;
+
+    spinlock_lock(&g_pf_async_writes_lock);
+    for (size_t i = 0; i < PF_ASYNC_WRITES_MAX; i++) {
+        struct pf_async_write* w = &g_pf_async_writes[i];
+        if (w->state == PF_ASYNC_WRITE_FREE) {
+            w->state  = PF_ASYNC_WRITE_SUBMITTING;
+            w->fd     = fd;
+            w->offset = offset;
+            w->size   = size;
+            reserved  = w;
+            break;
+        }
+    }
+    spinlock_unlock(&g_pf_async_writes_lock);
+    return reserved;
+}
+
+static pf_status_t cb_write(pf_handle_t handle, const void* buffer, uint64_t offset, size_t size) {
+    int fd = *(int*)handle;
+
+    if (pf_find_mmap(fd)) {
+        /* the metadata node must hit the file after all other nodes, so wait for pending writes
+         * (done by OCALLs past the mapping) before copying anything */
+        if (!pf_wait_all_writes(fd))
+            return PF_STATUS_CALLBACK_FAILED;
+        if (pf_mmap_copy(fd, (void*)buffer, offset, size, /*write=*/true))
+            return PF_STATUS_SUCCESS;
+        return write_sync(fd, buffer, offset, size);
+    }
+
+    if (offset == 0 || size > OCALL_ASYNC_BUF_SIZE) {
+        /* metadata node (commit point) or unexpectedly large write */
+        if (!pf_wait_all_writes(fd))
+            return PF_STATUS_CALLBACK_FAILED;
+        return write_sync(fd, buffer, offset, size);
+    }
+
+    if (!pf_wait_writes(fd, offset, size)) {
+        pf_wait_all_writes(fd);
+        return PF_STATUS_CALLBACK_FAILED;
+    }
+
+    struct pf_async_write* w = reserve_async_write(fd, offset, size);
+    if (!w) {
+        /* all slots are taken, complete own pending writes and retry */
+        if (!pf_wait_all_writes(fd))
+            return PF_STATUS_CALLBACK_FAILED;
+        w = reserve_async_write(fd, offset, size);
+    }
+    if (!w) {
+        /* slots are taken by other files */
+        pf_status_t status = write_sync(fd, buffer, offset, size);
+        if (PF_FAILURE(status))
+            pf_wait_all_writes(fd);
+        return status;
+    }
+
+    ocall_write_async(fd, buffer, size, offset, &w->async);
+    __atomic_store_n(&w->state, PF_ASYNC_WRITE_PENDING, __ATOMIC_RELEASE);
+    return PF_STATUS_SUCCESS;
+}
+
+/* Dirty nodes of a flush are written with OCALL_PWRITEV, i.e., with only a few host syscalls
+ * instead of one per node; falls back to writing the segments one by one if the host did not write
+ * all data */
+static pf_status_t cb_write_vec(pf_handle_t handle, const pf_write_seg_t* segs, size_t count) {
+    static_assert(PF_WRITE_VEC_MAX <= OCALL_PWRITEV_MAX, "too many segments for OCALL_PWRITEV");
+    int fd = *(int*)handle;
+
+    if (!pf_wait_all_writes(fd))
+        return PF_STATUS_CALLBACK_FAILED;
+
+    if (pf_find_mmap(fd)) {
+        for (size_t i = 0; i < count; i++) {
+            if (pf_mmap_copy(fd, (void*)segs[i].buffer, segs[i].offset, segs[i].size,
+                             /*write=*/true))
+                continue;
+            pf_status_t status = write_sync(fd, segs[i].buffer, segs[i].offset, segs[i].size);
+            if (PF_FAILURE(status))
+                return status;
+        }
+        return PF_STATUS_SUCCESS;
+    }
+
+    struct ocall_pwritev_seg ocall_segs[PF_WRITE_VEC_MAX];
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        ocall_segs[i].buf    = segs[i].buffer;
+        ocall_segs[i].count  = segs[i].size;
+        ocall_segs[i].offset = segs[i].offset;
+        total += segs[i].size;
+    }
+
+    ssize_t written;
+    do {
+        written = ocall_pwritev(fd, ocall_segs, count);
+    } while (written == -EINTR);
+
+    if (written < 0) {
+        log_error("cb_write_vec(%d, %lu segments): write failed: %ld\n", fd, count, written);
+        return PF_STATUS_CALLBACK_FAILED;
+    }
+    if ((size_t)written == total)
+        return PF_STATUS_SUCCESS;
+
+    for (size_t i = 0; i < count; i++) {
+        pf_status_t status = write_sync(fd, segs[i].buffer, segs[i].offset, segs[i].size);
+        if (PF_FAILURE(status))
+            return status;
+    }
+    return PF_STATUS_SUCCESS;
+}
+
 static pf_status_t cb_truncate(pf_handle_t handle, uint64_t size) {
     int fd = *(int*)handle;
+    if (!pf_wait_all_writes(fd))
+        return PF_STATUS_CALLBACK_FAILED;
+    /* pages of the mapping past the end of file must not be accessed anymore (SIGBUS) */
+    struct pf_mmap* m = pf_find_mmap(fd);
+    if (m)
+        m->size = MIN(m->size, size);
+
     int ret = ocall_ftruncate(fd, size);
     if (ret < 0) {
         log_error("cb_truncate(%d, %lu): ocall failed: %d\n", fd, size, ret);
@@ -102,12 +403,52 @@ static void cb_debug(const char* msg) {
 }
 #endif
 
+/* The only CMAC key of protected files is their KDK (the wrap key, the same for all of them), which
+ * derives the metadata key on every flush and open: its AES-CMAC context is kept set up between
+ * these calls, and wiped whenever a PF is closed. (The GCM keys of nodes are random and used for
+ * a single encryption, so there is nothing to keep for them.) */
+static LIB_AESCMAC_CONTEXT g_pf_cmac_ctx;
+static pf_key_t g_pf_cmac_key;
+static bool g_pf_cmac_ctx_valid = false;
+static spinlock_t g_pf_cmac_lock = INIT_SPINLOCK_UNLOCKED;
+
+static void pf_cmac_ctx_wipe_locked(void) {
+    if (g_pf_cmac_ctx_valid) {
+        lib_AESCMACFree(&g_pf_cmac_ctx);
+        memset(&g_pf_cmac_key, 0, sizeof(g_pf_cmac_key));
+        g_pf_cmac_ctx_valid = false;
+    }
+}
+
+static bool pf_cmac_key_equal(const pf_key_t* key) {
+    /* constant-time: this compares secret keys */
+    uint8_t diff = 0;
+    for (size_t i = 0; i < sizeof(*key); i++)
+        diff |= (*key)[i] ^ g_pf_cmac_key[i];
+    return diff == 0;
+}
+
 static pf_status_t cb_aes_cmac(const pf_key_t* key, const void* input, size_t input_size,
                                pf_mac_t* mac) {
-    int ret = lib_AESCMAC((const uint8_t*)key, sizeof(*key), input, input_size, (uint8_t*)mac,
-                          sizeof(*mac));
+    int ret = 0;
+    spinlock_lock(&g_pf_cmac_lock);
+    if (!g_pf_cmac_ctx_valid || !pf_cmac_key_equal(key)) {
+        pf_cmac_ctx_wipe_locked();
+        /* a context which failed to be set up is freed below */
+        g_pf_cmac_ctx_valid = true;
+        COPY_ARRAY(g_pf_cmac_key, *key);
+        ret = lib_AESCMACInit(&g_pf_cmac_ctx, (const uint8_t*)key, sizeof(*key));
+    }
+    if (ret == 0)
+        ret = lib_AESCMACUpdate(&g_pf_cmac_ctx, input, input_size);
+    if (ret == 0)
+        ret = lib_AESCMACFinishAndReset(&g_pf_cmac_ctx, (uint8_t*)mac, sizeof(*mac));
+    if (ret != 0)
+        pf_cmac_ctx_wipe_locked();
+    spinlock_unlock(&g_pf_cmac_lock);
+
     if (ret != 0) {
-        log_error("lib_AESCMAC failed: %d\n", ret);
+        log_error("AES-CMAC failed: %d\n", ret);
         return PF_STATUS_CALLBACK_FAILED;
     }
     return PF_STATUS_SUCCESS;
@@ -147,32 +488,116 @@ static pf_status_t cb_random(uint8_t* buffer, size_t size) {
     return PF_STATUS_SUCCESS;
 }
 
+/*
+ * Pool of helper threads which encrypt dirty PF data nodes in parallel on flush
+ * (`sgx.protected_files_flush_threads`). Workers are created on first use, since helper threads can
+ * be created only after the enclave is initialized, and sleep on their own events between jobs; the
+ * flushing thread takes part in the job too. Only one job runs at a time: concurrent flushes of
+ * other PFs do not wait for it but encrypt on their own thread.
+ */
+struct pf_parallel_job {
+    void (*fn)(void* arg, size_t i);
+    void* arg;
+    size_t count;
+    size_t next;             /* next item to be processed */
+    size_t workers_finished; /* number of workers done with the job */
+};
+
+static size_t g_pf_flush_threads = 1;
+static PAL_HANDLE* g_pf_worker_events = NULL; /* one auto-clear event per worker */
+static size_t g_pf_workers_cnt = 0;
+static bool g_pf_workers_created = false;
+static struct pf_parallel_job g_pf_job;
+static spinlock_t g_pf_job_lock = INIT_SPINLOCK_UNLOCKED;
+
+static void pf_run_job_items(struct pf_parallel_job* job) {
+    while (true) {
+        size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->count)
+            break;
+        job->fn(job->arg, i);
+    }
+}
+
+static int pf_flush_worker(void* arg) {
+    PAL_HANDLE event = arg;
+    while (true) {
+        if (_DkEventWait(event, /*timeout_us=*/NULL) < 0)
+            continue;
+        pf_run_job_items(&g_pf_job);
+        __atomic_add_fetch(&g_pf_job.workers_finished, 1, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+/* called with g_pf_job_lock held; workers are created only once, failures are not retried */
+static void pf_create_flush_workers(void) {
+    if (g_pf_workers_created || !(g_pal_enclave_state.enclave_flags & PAL_ENCLAVE_INITIALIZED))
+        return;
+    g_pf_workers_created = true;
+
+    for (size_t i = 0; i < g_pf_flush_threads - 1; i++) {
+        PAL_HANDLE event;
+        int ret = _DkEventCreate(&event, /*init_signaled=*/false, /*auto_clear=*/true);
+        if (ret < 0)
+            break;
+
+        PAL_HANDLE thread;
+        ret = _DkThreadCreate(&thread, pf_flush_worker, event);
+        if (ret < 0) {
+            log_warning("Cannot create PF flush thread (%d), using %lu threads\n", ret,
+                        g_pf_workers_cnt + 1);
+            _DkObjectClose(event);
+            break;
+        }
+        g_pf_worker_events[g_pf_workers_cnt++] = event;
+    }
+}
+
+static void cb_parallel(void (*fn)(void* arg, size_t i), void* arg, size_t count) {
+    if (spinlock_trylock(&g_pf_job_lock) == 0) {
+        pf_create_flush_workers();
+        size_t workers_cnt = g_pf_workers_cnt;
+        if (workers_cnt) {
+            g_pf_job.fn               = fn;
+            g_pf_job.arg              = arg;
+            g_pf_job.count            = count;
+            g_pf_job.next             = 0;
+            g_pf_job.workers_finished = 0;
+            for (size_t i = 0; i < workers_cnt; i++)
+                _DkEventSet(g_pf_worker_events[i]);
+
+            pf_run_job_items(&g_pf_job);
+
+            while (__atomic_load_n(&g_pf_job.workers_finished, __ATOMIC_ACQUIRE) < workers_cnt)
+                CPU_RELAX();
+            spinlock_unlock(&g_pf_job_lock);
+            return;
+        }
+        spinlock_unlock(&g_pf_job_lock);
+    }
+
+    for (size_t i = 0; i < count; i++)
+        fn(arg, i);
+}
+
 /* Collection of registered protected files */
 static struct protected_file* g_protected_files = NULL;
 
 /* Collection of registered protected directories */
 static struct protected_file* g_protected_dirs = NULL;
 
-/* Lock for operations on global PF structures */
+/* Lock for the collections of registered PFs and for the wrap key; it is held only for lookups and
+ * registration, I/O on a PF is protected by the PF's own lock (see `struct protected_file`) */
 static spinlock_t g_protected_file_lock = INIT_SPINLOCK_UNLOCKED;
 
-/* Take ownership of the global PF lock */
-void pf_lock(void) {
-    spinlock_lock(&g_protected_file_lock);
-}
-
-/* Release ownership of the global PF lock */
-void pf_unlock(void) {
-    spinlock_unlock(&g_protected_file_lock);
-}
-
 /* Exact match of path in g_protected_files */
 struct protected_file* find_protected_file(const char* path) {
     struct protected_file* pf = NULL;
 
-    pf_lock();
+    spinlock_lock(&g_protected_file_lock);
     HASH_FIND_STR(g_protected_files, path, pf);
-    pf_unlock();
+    spinlock_unlock(&g_protected_file_lock);
     return pf;
 }
 
@@ -182,7 +607,7 @@ static struct protected_file* find_protected_dir(const char* path) {
     struct protected_file* tmp = NULL;
     size_t len = strlen(path);
 
-    pf_lock();
+    spinlock_lock(&g_protected_file_lock);
     // TODO: avoid linear lookup
     for (tmp = g_protected_dirs; tmp != NULL; tmp = tmp->hh.next) {
         if (tmp->path_len < len && !memcmp(tmp->path, path, tmp->path_len) &&
@@ -192,7 +617,7 @@ static struct protected_file* find_protected_dir(const char* path) {
         }
     }
 
-    pf_unlock();
+    spinlock_unlock(&g_protected_file_lock);
     return pf;
 }
 
@@ -220,7 +645,8 @@ out:
     return ret;
 }
 
-static int register_protected_path(const char* path, struct protected_file** new_pf);
+static int register_protected_path(const char* path, struct protected_file** new_pf,
+                                   size_t cache_size, size_t readahead_size);
 
 /* Return a registered PF that matches specified path
    (or the path that is contained in a registered PF directory) */
@@ -233,7 +659,7 @@ struct protected_file* get_protected_file(const char* path) {
     if (pf) {
         /* path not registered but matches registered dir */
         log_debug("get_pf: registering new PF '%s' in dir '%s'\n", path, pf->path);
-        int ret = register_protected_path(path, &pf);
+        int ret = register_protected_path(path, &pf, pf->cache_size, pf->readahead_size);
         __UNUSED(ret);
         assert(ret == 0);
         /* return newly registered PF */
@@ -279,7 +705,7 @@ out:
 }
 
 /* Register all files from the given directory recursively */
-static int register_protected_dir(const char* path) {
+static int register_protected_dir(const char* path, size_t cache_size, size_t readahead_size) {
     int fd = -1;
     int ret = -PAL_ERROR_NOMEM;
     size_t bufsize = 1024;
@@ -323,7 +749,7 @@ static int register_protected_dir(const char* path) {
                 goto out;
 
             snprintf(sub_path, sub_path_size, URI_PREFIX_FILE "%s/%s", path, dir->d_name);
-            ret = register_protected_path(sub_path, NULL);
+            ret = register_protected_path(sub_path, NULL, cache_size, readahead_size);
             if (ret != 0) {
                 free(sub_path);
                 goto out;
@@ -343,7 +769,8 @@ out:
 }
 
 /* Register a single PF (if it's a directory, recursively) */
-static int register_protected_path(const char* path, struct protected_file** new_pf) {
+static int register_protected_path(const char* path, struct protected_file** new_pf,
+                                   size_t cache_size, size_t readahead_size) {
     int ret = -PAL_ERROR_NOMEM;
     struct protected_file* new = NULL;
 
@@ -364,7 +791,10 @@ static int register_protected_path(const char* path, struct protected_file** new
     else
         path = normpath;
 
-    if (find_protected_file(path)) {
+    struct protected_file* registered = find_protected_file(path);
+    if (registered) {
+        if (new_pf)
+            *new_pf = registered;
         ret = 0;
         log_debug("register_protected_path: file %s already registered\n", path);
         goto out;
@@ -386,8 +816,11 @@ static int register_protected_path(const char* path, struct protected_file** new
     }
 
     memcpy(new->path, path, new->path_len + 1);
+    spinlock_init(&new->lock);
     new->refcount = 0;
     new->writable_fd = -1;
+    new->cache_size = cache_size;
+    new->readahead_size = readahead_size;
 
     bool is_dir;
     ret = is_directory(path, &is_dir);
@@ -397,17 +830,27 @@ static int register_protected_path(const char* path, struct protected_file** new
     log_debug("register_protected_path: [%s] %s = %p\n", is_dir ? "dir" : "file", path, new);
 
     if (is_dir)
-        register_protected_dir(path);
+        register_protected_dir(path, cache_size, readahead_size);
 
-    pf_lock();
+    spinlock_lock(&g_protected_file_lock);
 
     if (is_dir) {
         HASH_ADD_STR(g_protected_dirs, path, new);
     } else {
-        HASH_ADD_STR(g_protected_files, path, new);
+        /* another thread may have registered the same file in the meantime (files in registered
+         * directories are registered on first access) */
+        HASH_FIND_STR(g_protected_files, new->path, registered);
+        if (!registered)
+            HASH_ADD_STR(g_protected_files, path, new);
     }
 
-    pf_unlock();
+    spinlock_unlock(&g_protected_file_lock);
+
+    if (registered) {
+        free(new->path);
+        free(new);
+        new = registered;
+    }
 
     if (new_pf)
         *new_pf = new;
@@ -423,6 +866,22 @@ out:
     return ret;
 }
 
+/* Read optional size of a PF cache parameter `sgx.<option>.<key>` */
+static int read_pf_size_option(const char* option, const char* key, uint64_t defaultval,
+                               uint64_t* size) {
+    char* fullkey = alloc_concat3(option, -1, key, -1, "\"", -1);
+    if (!fullkey)
+        return -PAL_ERROR_NOMEM;
+
+    int ret = toml_sizestring_in(g_pal_state.manifest_root, fullkey, defaultval, size);
+    if (ret < 0) {
+        log_error("Cannot parse \'%s\' (the value must be put in double quotes!)\n", fullkey);
+        ret = -PAL_ERROR_INVAL;
+    }
+    free(fullkey);
+    return ret;
+}
+
 /* Read PF paths from manifest and register them */
 static int register_protected_files(void) {
     int ret;
@@ -453,19 +912,37 @@ static int register_protected_files(void) {
             continue;
         }
 
+        uint64_t cache_size;
+        uint64_t readahead_size;
+        ret = read_pf_size_option("sgx.protected_files_cache_size.\"", toml_pf_key,
+                                  PF_DEFAULT_CACHE_SIZE, &cache_size);
+        if (ret == 0)
+            ret = read_pf_size_option("sgx.protected_files_readahead.\"", toml_pf_key,
+                                      PF_DEFAULT_READAHEAD_SIZE, &readahead_size);
+        if (ret < 0) {
+            free(toml_pf_value);
+            return ret;
+        }
+        if (cache_size < PF_NODE_SIZE) {
+            log_error("\'sgx.protected_files_cache_size.%s\' must be at least %u bytes\n",
+                      toml_pf_key, PF_NODE_SIZE);
+            free(toml_pf_value);
+            return -PAL_ERROR_INVAL;
+        }
+
         if (!strstartswith(toml_pf_value, URI_PREFIX_FILE)) {
             log_error("Invalid URI [%s]: URIs of protected files must start with \'"
                       URI_PREFIX_FILE "\'\n", toml_pf_value);
         } else {
-            register_protected_path(toml_pf_value, NULL);
+            register_protected_path(toml_pf_value, NULL, cache_size, readahead_size);
         }
         free(toml_pf_value);
     }
 
-    pf_lock();
+    spinlock_lock(&g_protected_file_lock);
     log_debug("Registered %u protected directories and %u protected files\n",
               HASH_COUNT(g_protected_dirs), HASH_COUNT(g_protected_files));
-    pf_unlock();
+    spinlock_unlock(&g_protected_file_lock);
     return 0;
 }
 
@@ -480,6 +957,31 @@ int init_protected_files(void) {
 
     pf_set_callbacks(cb_read, cb_write, cb_truncate, cb_aes_cmac, cb_aes_gcm_encrypt,
                      cb_aes_gcm_decrypt, cb_random, debug_callback);
+    pf_set_write_vec_callback(cb_write_vec);
+
+    int64_t flush_threads;
+    ret = toml_int_in(g_pal_state.manifest_root, "sgx.protected_files_flush_threads",
+                      /*defaultval=*/1, &flush_threads);
+    if (ret < 0 || flush_threads < 1) {
+        log_error("Cannot parse \'sgx.protected_files_flush_threads\' "
+                  "(the value must be a positive integer)\n");
+        return -PAL_ERROR_INVAL;
+    }
+    if (flush_threads > 1) {
+        g_pf_worker_events = malloc((flush_threads - 1) * sizeof(*g_pf_worker_events));
+        if (!g_pf_worker_events)
+            return -PAL_ERROR_NOMEM;
+        g_pf_flush_threads = flush_threads;
+        pf_set_parallel_callback(cb_parallel);
+    }
+
+    ret = toml_sizestring_in(g_pal_state.manifest_root, "sgx.protected_files_mmap_min_size",
+                             /*defaultval=*/0, &g_pf_mmap_min_size);
+    if (ret < 0) {
+        log_error("Cannot parse \'sgx.protected_files_mmap_min_size\' "
+                  "(the value must be put in double quotes!)\n");
+        return -PAL_ERROR_INVAL;
+    }
 
     /* if wrap key is not hard-coded in the manifest, assume that it was received from parent or
      * it will be provisioned after local/remote attestation; otherwise read it from manifest */
@@ -521,6 +1023,41 @@ int init_protected_files(void) {
     return 0;
 }
 
+static int pf_context_fd(struct protected_file* pf) {
+    pf_handle_t handle;
+    pf_status_t pfs = pf_get_handle(pf->context, &handle);
+    __UNUSED(pfs);
+    assert(PF_SUCCESS(pfs));
+    return *(int*)handle;
+}
+
+/* Flush the PF context of `pf`; the caller must hold `pf->lock` */
+pf_status_t flush_protected_file(struct protected_file* pf) {
+    pf_status_t pfs = pf_flush(pf->context);
+    if (PF_FAILURE(pfs)) {
+        /* the flush stopped before its commit point, don't keep its remaining writes pending */
+        pf_wait_all_writes(pf_context_fd(pf));
+    }
+    return pfs;
+}
+
+/* Close the PF context of `pf` and unmap its host file; the caller must hold `pf->lock` */
+pf_status_t close_protected_file(struct protected_file* pf) {
+    int fd = pf_context_fd(pf);
+
+    pf_status_t pfs = pf_close(pf->context);
+    pf->context = NULL;
+    /* also if pf_close() failed, the host FD is closed after this and its number may be reused */
+    if (!pf_wait_all_writes(fd) && PF_SUCCESS(pfs))
+        pfs = PF_STATUS_CALLBACK_FAILED;
+    pf_munmap_host_file(fd);
+
+    spinlock_lock(&g_pf_cmac_lock);
+    pf_cmac_ctx_wipe_locked();
+    spinlock_unlock(&g_pf_cmac_lock);
+    return pfs;
+}
+
 /* Open/create a PF */
 static int open_protected_file(const char* path, struct protected_file* pf, pf_handle_t handle,
                                uint64_t size, pf_file_mode_t mode, bool create) {
@@ -529,10 +1066,24 @@ static int open_protected_file(const char* path, struct protected_file* pf, pf_h
         return -PAL_ERROR_DENIED;
     }
 
+    /* a newly created file is empty and written through OCALLs until the next open */
+    if (!create)
+        pf_mmap_host_file(*(int*)handle, size, mode & PF_FILE_MODE_WRITE);
+
     pf_status_t pfs;
     pfs = pf_open(handle, path, size, mode, create, &g_pf_wrap_key, &pf->context);
     if (PF_FAILURE(pfs)) {
         log_error("pf_open(%d, %s) failed: %s\n", *(int*)handle, path, pf_strerror(pfs));
+        pf_munmap_host_file(*(int*)handle);
+        return -PAL_ERROR_DENIED;
+    }
+
+    pfs = pf_set_cache_params(pf->context, pf->cache_size / PF_NODE_SIZE,
+                              pf->readahead_size / PF_NODE_SIZE);
+    if (PF_FAILURE(pfs)) {
+        log_error("pf_set_cache_params(%d, %s) failed: %s\n", *(int*)handle, path,
+                  pf_strerror(pfs));
+        close_protected_file(pf);
         return -PAL_ERROR_DENIED;
     }
     return 0;
@@ -564,66 +1115,156 @@ struct protected_file* load_protected_file(const char* path, int* fd, uint64_t s
     return pf;
 }
 
-/* Flush PF map buffers and optionally remove and free them.
- * If pf is NULL, process all maps containing given buffer.
- * If buffer is NULL, process all maps for given pf.
- * If both pf and buffer are NULL, process all maps for all PFs.
- */
-int flush_pf_maps(struct protected_file* pf, void* buffer, bool remove) {
-    struct pf_map* map;
-    struct pf_map* tmp;
+/* granularity of dirty tracking in PF maps */
+static const size_t g_page_size = PRESET_PAGESIZE;
+
+static int pf_map_page_hash(struct pf_map* map, size_t page, sgx_file_hash_t* hash) {
+    size_t offset = page * g_page_size;
+    size_t size = MIN(g_page_size, map->size - offset);
+
+    LIB_SHA256_CONTEXT sha;
+    int ret = lib_SHA256Init(&sha);
+    if (ret < 0)
+        return ret;
+    ret = lib_SHA256Update(&sha, (uint8_t*)map->buffer + offset, size);
+    if (ret < 0)
+        return ret;
+    return lib_SHA256Final(&sha, hash->bytes);
+}
+
+int pf_map_init_page_hashes(struct pf_map* map) {
+    size_t pages = ALIGN_UP(map->size, g_page_size) / g_page_size;
+    map->page_hashes = malloc(pages * sizeof(*map->page_hashes));
+    if (!map->page_hashes)
+        return -PAL_ERROR_NOMEM;
+
+    for (size_t page = 0; page < pages; page++) {
+        int ret = pf_map_page_hash(map, page, &map->page_hashes[page]);
+        if (ret < 0) {
+            free(map->page_hashes);
+            map->page_hashes = NULL;
+            return ret;
+        }
+    }
+    return 0;
+}
+
+static void free_pf_map(struct pf_map* map) {
+    free(map->page_hashes);
+    free(map);
+}
+
+/* Write back the pages of `map` that changed since they were last read or written */
+static int write_pf_map(struct protected_file* pf, struct pf_map* map) {
     uint64_t pf_size;
-    pf_status_t pfs;
+    pf_status_t pfs = pf_get_size(pf->context, &pf_size);
+    assert(PF_SUCCESS(pfs));
 
-    pf_lock();
-    LISTP_FOR_EACH_ENTRY_SAFE(map, tmp, &g_pf_map_list, list) {
-        if (pf && map->pf != pf)
-            continue;
+    if (map->offset >= pf_size)
+        return 0;
 
-        if (buffer && map->buffer != buffer)
+    size_t map_size = MIN(map->size, pf_size - map->offset);
+    for (size_t pos = 0; pos < map_size; pos += g_page_size) {
+        size_t page = pos / g_page_size;
+        sgx_file_hash_t hash;
+        int ret = pf_map_page_hash(map, page, &hash);
+        if (ret < 0)
+            return ret;
+        if (!memcmp(&hash, &map->page_hashes[page], sizeof(hash)))
             continue;
 
-        size_t map_size = map->size;
-        struct protected_file* map_pf = pf ? pf : map->pf;
+        pfs = pf_write(pf->context, map->offset + pos, MIN(g_page_size, map_size - pos),
+                       (uint8_t*)map->buffer + pos);
+        if (PF_FAILURE(pfs)) {
+            log_error("flush_pf_maps: pf_write failed: %s\n", pf_strerror(pfs));
+            return -PAL_ERROR_INVAL;
+        }
+        map->page_hashes[page] = hash;
+    }
+    return 0;
+}
 
-        pfs = pf_get_size(map_pf->context, &pf_size);
-        assert(PF_SUCCESS(pfs));
+/* Flush map buffers of `pf` (all of them if `buffer` is NULL) and optionally remove and free them;
+ * the caller must hold `pf->lock`. Maps of a PF are added and removed only with its lock held, so
+ * they are detached from the global list for the duration of the writes, which are done without
+ * holding `g_pf_map_list_lock`. */
+static int flush_pf_maps_locked(struct protected_file* pf, void* buffer, bool remove) {
+    assert(spinlock_is_locked(&pf->lock));
 
-        assert(pf_size >= map->offset);
-        if (map->offset + map_size > pf_size)
-            map_size = pf_size - map->offset;
+    LISTP_TYPE(pf_map) maps = LISTP_INIT;
+    struct pf_map* map;
+    struct pf_map* tmp;
+    int ret = 0;
 
-        if (map_size > 0) {
-            pfs = pf_write(map_pf->context, map->offset, map_size, map->buffer);
-            if (PF_FAILURE(pfs)) {
-                log_error("flush_pf_maps: pf_write failed: %s\n", pf_strerror(pfs));
-                pf_unlock();
-                return -PAL_ERROR_INVAL;
-            }
+    spinlock_lock(&g_pf_map_list_lock);
+    LISTP_FOR_EACH_ENTRY_SAFE(map, tmp, &g_pf_map_list, list) {
+        if (map->pf != pf || (buffer && map->buffer != buffer))
+            continue;
+        LISTP_DEL(map, &g_pf_map_list, list);
+        LISTP_ADD_TAIL(map, &maps, list);
+    }
+    spinlock_unlock(&g_pf_map_list_lock);
+
+    LISTP_FOR_EACH_ENTRY(map, &maps, list) {
+        ret = write_pf_map(pf, map);
+        if (ret < 0)
+            break;
+    }
+
+    if (remove && ret == 0) {
+        LISTP_FOR_EACH_ENTRY_SAFE(map, tmp, &maps, list) {
+            LISTP_DEL(map, &maps, list);
+            free_pf_map(map);
         }
+    } else {
+        spinlock_lock(&g_pf_map_list_lock);
+        LISTP_SPLICE_TAIL(&maps, &g_pf_map_list, list, pf_map);
+        spinlock_unlock(&g_pf_map_list_lock);
+    }
+    return ret;
+}
 
-        if (remove) {
-            LISTP_DEL(map, &g_pf_map_list, list);
-            free(map);
+/* Flush PF map buffers and optionally remove and free them.
+ * If pf is NULL, process the map with given buffer (the PF's lock is taken here).
+ * If buffer is NULL, process all maps for given pf (the caller must hold `pf->lock`).
+ */
+int flush_pf_maps(struct protected_file* pf, void* buffer, bool remove) {
+    if (pf)
+        return flush_pf_maps_locked(pf, buffer, remove);
+
+    assert(buffer);
+    struct protected_file* map_pf = NULL;
+    struct pf_map* map;
+
+    spinlock_lock(&g_pf_map_list_lock);
+    LISTP_FOR_EACH_ENTRY(map, &g_pf_map_list, list) {
+        if (map->buffer == buffer) {
+            /* PFs are never freed, so `map_pf` can be used after dropping the lock */
+            map_pf = map->pf;
+            break;
         }
     }
+    spinlock_unlock(&g_pf_map_list_lock);
 
-    pf_unlock();
-    return 0;
+    if (!map_pf)
+        return 0;
+
+    spinlock_lock(&map_pf->lock);
+    int ret = flush_pf_maps_locked(map_pf, buffer, remove);
+    spinlock_unlock(&map_pf->lock);
+    return ret;
 }
 
-/* Flush map buffers and unload/close the PF */
+/* Flush map buffers and unload/close the PF; the caller must hold `pf->lock` */
 int unload_protected_file(struct protected_file* pf) {
     /* flush all pf's maps and delete them */
     int ret = flush_pf_maps(pf, NULL, true);
     if (ret < 0)
         return ret;
-    pf_status_t pfs = pf_close(pf->context);
+    pf_status_t pfs = close_protected_file(pf);
     if (PF_FAILURE(pfs)) {
         log_error("unload_protected_file(%p) failed: %s\n", pf, pf_strerror(pfs));
     }
-
-    pf->context = NULL;
     return 0;
 }
 
@@ -633,19 +1274,19 @@ int set_protected_files_key(const char* pf_key_hex) {
         return -PAL_ERROR_INVAL;
     }
 
-    pf_lock();
+    spinlock_lock(&g_protected_file_lock);
     memset(g_pf_wrap_key, 0, sizeof(g_pf_wrap_key));
     for (size_t i = 0; i < pf_key_hex_len; i++) {
         int8_t val = hex2dec(pf_key_hex[i]);
         if (val < 0) {
             memset(g_pf_wrap_key, 0, sizeof(g_pf_wrap_key));
-            pf_unlock();
+            spinlock_unlock(&g_protected_file_lock);
             return -PAL_ERROR_INVAL;
         }
         g_pf_wrap_key[i / 2] = g_pf_wrap_key[i / 2] * 16 + (uint8_t)val;
     }
     g_pf_wrap_key_set = true;
-    pf_unlock();
+    spinlock_unlock(&g_protected_file_lock);
 
     return 0;
 }
@@ -1,13 +1,36 @@
 /* SPDX-License-Identifier: LGPL-3.0-or-later */
 /* Copyright (C) 2014 Stony Brook University */
 
+/*
+ * Allocator of untrusted memory, used for objects shared with the untrusted runtime.
+ *
+ * The slab manager gets its memory from a pool of 2MB chunks of untrusted memory. The chunks are
+ * mapped with MAP_HUGETLB if the host has huge pages reserved, and otherwise are at least 2MB
+ * aligned, so that the host kernel can back them with transparent huge pages. This keeps the
+ * untrusted objects touched on each boundary crossing in few dTLB entries. Chunk pages are handed
+ * out with a per-chunk bitmap; allocations bigger than UNTRUSTED_POOL_MAX_ALLOC bypass the pool.
+ *
+ * Small allocations are served from per-thread magazines of free slab objects kept in the enclave
+ * TLS, so that they usually don't take `g_malloc_lock`. The magazines work (and are sized) as those
+ * of the LibOS slab allocator, see LibOS/shim/src/shim_malloc.c. They differ in ownership: like the
+ * untrusted area cache in enclave_ocalls.c, the magazines belong to a TCS and are carried over
+ * thread exit/creation, and an `in_use` atomic makes allocations of in-enclave signal handlers
+ * (which may interrupt an allocation on the same thread) go directly to the slab manager.
+ */
+
 #include "api.h"
 #include "enclave_ocalls.h"
 #include "pal_error.h"
 #include "pal_internal.h"
+#include "pal_linux.h"
 #include "pal_security.h"
+#include "sgx_tls.h"
 #include "spinlock.h"
 
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB 0x40000
+#endif
+
 static spinlock_t g_malloc_lock = INIT_SPINLOCK_UNLOCKED;
 static size_t g_page_size = PRESET_PAGESIZE;
 
@@ -17,16 +40,169 @@ static size_t g_page_size = PRESET_PAGESIZE;
 
 #define ALLOC_ALIGNMENT g_page_size
 
-static inline void* __malloc(size_t size) {
+#define UNTRUSTED_POOL_CHUNK_SIZE  (2 * 1024 * 1024)
+#define UNTRUSTED_POOL_CHUNK_PAGES (UNTRUSTED_POOL_CHUNK_SIZE / PRESET_PAGESIZE)
+#define UNTRUSTED_POOL_MAX_CHUNKS  64
+#define UNTRUSTED_POOL_MAX_ALLOC   (UNTRUSTED_POOL_CHUNK_SIZE / 4)
+
+struct untrusted_pool_chunk {
+    char* addr;
+    size_t free_pages;
+    uint64_t used[UNTRUSTED_POOL_CHUNK_PAGES / 64]; /* bitmap of allocated pages */
+};
+
+static spinlock_t g_pool_lock = INIT_SPINLOCK_UNLOCKED;
+static struct untrusted_pool_chunk g_pool_chunks[UNTRUSTED_POOL_MAX_CHUNKS];
+static size_t g_pool_chunks_cnt = 0;
+static bool g_pool_no_hugetlb = false; /* set after the first failed MAP_HUGETLB mapping */
+
+static uint64_t g_pool_hugetlb_chunks = 0;
+static uint64_t g_slab_cache_refills = 0;
+static uint64_t g_slab_cache_flushes = 0;
+
+static int mmap_untrusted_anon(void** addr, size_t size, int flags) {
+    *addr = NULL;
+    return ocall_mmap_untrusted(addr, size, PROT_READ | PROT_WRITE,
+                                MAP_ANONYMOUS | MAP_PRIVATE | flags, /*fd=*/-1, /*offset=*/0);
+}
+
+/* Maps a new, 2MB-aligned pool chunk. */
+static void* map_pool_chunk(void) {
+    void* addr;
+    if (!__atomic_load_n(&g_pool_no_hugetlb, __ATOMIC_RELAXED)) {
+        if (mmap_untrusted_anon(&addr, UNTRUSTED_POOL_CHUNK_SIZE, MAP_HUGETLB) == 0) {
+            __atomic_add_fetch(&g_pool_hugetlb_chunks, 1, __ATOMIC_RELAXED);
+            return addr;
+        }
+        /* no huge pages reserved on the host (or not supported), don't try again */
+        __atomic_store_n(&g_pool_no_hugetlb, true, __ATOMIC_RELAXED);
+    }
+
+    /* map twice the size and trim it to an aligned chunk, eligible for transparent huge pages */
+    if (mmap_untrusted_anon(&addr, 2 * UNTRUSTED_POOL_CHUNK_SIZE, /*flags=*/0) < 0)
+        return NULL;
+
+    char* start = (char*)addr;
+    char* chunk = (char*)ALIGN_UP_PTR_POW2(start, UNTRUSTED_POOL_CHUNK_SIZE);
+    char* end   = start + 2 * UNTRUSTED_POOL_CHUNK_SIZE;
+    if (chunk > start)
+        ocall_munmap_untrusted(start, chunk - start);
+    if (end > chunk + UNTRUSTED_POOL_CHUNK_SIZE)
+        ocall_munmap_untrusted(chunk + UNTRUSTED_POOL_CHUNK_SIZE,
+                               end - (chunk + UNTRUSTED_POOL_CHUNK_SIZE));
+    return chunk;
+}
+
+static bool pool_page_used(struct untrusted_pool_chunk* chunk, size_t page) {
+    return chunk->used[page / 64] & (1UL << (page % 64));
+}
+
+static void pool_mark_pages(struct untrusted_pool_chunk* chunk, size_t first, size_t pages,
+                            bool used) {
+    for (size_t i = first; i < first + pages; i++) {
+        if (used)
+            chunk->used[i / 64] |= 1UL << (i % 64);
+        else
+            chunk->used[i / 64] &= ~(1UL << (i % 64));
+    }
+    if (used)
+        chunk->free_pages -= pages;
+    else
+        chunk->free_pages += pages;
+}
+
+// g_pool_lock needs to be held by the caller.
+static void* pool_chunk_alloc(struct untrusted_pool_chunk* chunk, size_t pages) {
+    if (chunk->free_pages < pages)
+        return NULL;
+
+    size_t run = 0;
+    for (size_t i = 0; i < UNTRUSTED_POOL_CHUNK_PAGES; i++) {
+        if (pool_page_used(chunk, i)) {
+            run = 0;
+            continue;
+        }
+        if (++run == pages) {
+            size_t first = i + 1 - pages;
+            pool_mark_pages(chunk, first, pages, /*used=*/true);
+            return chunk->addr + first * PRESET_PAGESIZE;
+        }
+    }
+    return NULL;
+}
+
+static void* pool_alloc(size_t size) {
+    size_t pages = ALIGN_UP(size, PRESET_PAGESIZE) / PRESET_PAGESIZE;
+
+    spinlock_lock(&g_pool_lock);
+    for (size_t i = 0; i < g_pool_chunks_cnt; i++) {
+        void* addr = pool_chunk_alloc(&g_pool_chunks[i], pages);
+        if (addr) {
+            spinlock_unlock(&g_pool_lock);
+            return addr;
+        }
+    }
+    spinlock_unlock(&g_pool_lock);
+
+    /* mapping is an OCALL, so don't hold the lock (another thread may add a chunk meanwhile) */
+    char* chunk_addr = map_pool_chunk();
+    if (!chunk_addr)
+        return NULL;
+
     void* addr = NULL;
-    int ret = ocall_mmap_untrusted(&addr, size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE,
-                                   /*fd=*/-1, /*offset=*/0);
+    spinlock_lock(&g_pool_lock);
+    if (g_pool_chunks_cnt < UNTRUSTED_POOL_MAX_CHUNKS) {
+        struct untrusted_pool_chunk* chunk = &g_pool_chunks[g_pool_chunks_cnt++];
+        chunk->addr = chunk_addr;
+        chunk->free_pages = UNTRUSTED_POOL_CHUNK_PAGES;
+        memset(chunk->used, 0, sizeof(chunk->used));
+        addr = pool_chunk_alloc(chunk, pages);
+        chunk_addr = NULL;
+    }
+    spinlock_unlock(&g_pool_lock);
+
+    if (chunk_addr) {
+        /* the pool is full, fall back to a separate mapping */
+        ocall_munmap_untrusted(chunk_addr, UNTRUSTED_POOL_CHUNK_SIZE);
+        if (mmap_untrusted_anon(&addr, size, /*flags=*/0) < 0)
+            return NULL;
+    }
+    return addr;
+}
+
+/* Returns false if `addr` is not in the pool. */
+static bool pool_free(void* addr, size_t size) {
+    size_t pages = ALIGN_UP(size, PRESET_PAGESIZE) / PRESET_PAGESIZE;
+
+    spinlock_lock(&g_pool_lock);
+    for (size_t i = 0; i < g_pool_chunks_cnt; i++) {
+        struct untrusted_pool_chunk* chunk = &g_pool_chunks[i];
+        if ((char*)addr >= chunk->addr && (char*)addr < chunk->addr + UNTRUSTED_POOL_CHUNK_SIZE) {
+            size_t first = ((char*)addr - chunk->addr) / PRESET_PAGESIZE;
+            assert(first + pages <= UNTRUSTED_POOL_CHUNK_PAGES);
+            pool_mark_pages(chunk, first, pages, /*used=*/false);
+            spinlock_unlock(&g_pool_lock);
+            return true;
+        }
+    }
+    spinlock_unlock(&g_pool_lock);
+    return false;
+}
+
+static inline void* __malloc(size_t size) {
+    if (size <= UNTRUSTED_POOL_MAX_ALLOC)
+        return pool_alloc(size);
+
+    void* addr;
+    int ret = mmap_untrusted_anon(&addr, size, /*flags=*/0);
     return ret < 0 ? NULL : addr;
 }
 
 #define system_malloc(size) __malloc(size)
 
 static inline void __free(void* addr, size_t size) {
+    if (size <= UNTRUSTED_POOL_MAX_ALLOC && pool_free(addr, size))
+        return;
     ocall_munmap_untrusted(addr, size);
 }
 
@@ -34,8 +210,17 @@ static inline void __free(void* addr, size_t size) {
 
 #include "slabmgr.h"
 
+static_assert(UNTRUSTED_SLAB_CACHE_LEVELS == SLAB_LEVEL,
+              "UNTRUSTED_SLAB_CACHE_LEVELS must match the slab levels");
+
 static SLAB_MGR untrusted_slabmgr = NULL;
 
+/* magazine sizes, same as in LibOS/shim/src/shim_malloc.c */
+#define SLAB_CACHE_MAX_OBJS   32UL
+#define SLAB_CACHE_LEVEL_SIZE 8192UL
+
+static size_t g_slab_cache_cap[SLAB_LEVEL];
+
 void init_untrusted_slab_mgr(void) {
     if (untrusted_slabmgr)
         return;
@@ -43,12 +228,97 @@ void init_untrusted_slab_mgr(void) {
     untrusted_slabmgr = create_slab_mgr();
     if (!untrusted_slabmgr)
         INIT_FAIL(PAL_ERROR_NOMEM, "cannot initialize slab manager");
+
+    for (size_t i = 0; i < SLAB_LEVEL; i++) {
+        size_t cap = MIN(SLAB_CACHE_MAX_OBJS, SLAB_CACHE_LEVEL_SIZE / slab_levels[i]);
+        g_slab_cache_cap[i] = MAX(cap, 2UL);
+    }
+}
+
+/* Returns the slab cache of the current thread, or NULL if it is in use by the interrupted normal
+ * execution; a non-NULL cache must be released with put_thread_slab_cache(). */
+static struct untrusted_slab_cache* get_thread_slab_cache(void) {
+    struct untrusted_slab_cache* cache = &get_tcb_trts()->untrusted_slab_cache;
+    uint64_t in_use = 0;
+    if (!__atomic_compare_exchange_n(&cache->in_use, &in_use, 1, /*weak=*/false, __ATOMIC_RELAXED,
+                                     __ATOMIC_RELAXED))
+        return NULL;
+    return cache;
+}
+
+static void put_thread_slab_cache(struct untrusted_slab_cache* cache) {
+    __atomic_store_n(&cache->in_use, 0, __ATOMIC_RELAXED);
 }
 
 void* malloc_untrusted(size_t size) {
-    return slab_alloc(untrusted_slabmgr, size);
+    size_t level = slab_size_to_level(size);
+    struct untrusted_slab_cache* cache = level < SLAB_LEVEL ? get_thread_slab_cache() : NULL;
+    if (!cache)
+        return slab_alloc(untrusted_slabmgr, size);
+
+    if (!cache->cnts[level]) {
+        cache->cnts[level] = slab_alloc_batch(untrusted_slabmgr, level,
+                                              g_slab_cache_cap[level] / 2, &cache->heads[level]);
+        __atomic_add_fetch(&g_slab_cache_refills, 1, __ATOMIC_RELAXED);
+        if (!cache->cnts[level]) {
+            put_thread_slab_cache(cache);
+            return NULL;
+        }
+    }
+
+    void* obj = cache->heads[level];
+    /* the links of the free list are stored in the (untrusted) objects themselves */
+    assert(sgx_is_completely_outside_enclave(obj, slab_levels[level]));
+    cache->heads[level] = *(void**)obj;
+    cache->cnts[level]--;
+    put_thread_slab_cache(cache);
+    return obj;
 }
 
 void free_untrusted(void* ptr) {
-    slab_free(untrusted_slabmgr, ptr);
+    if (!ptr)
+        return;
+
+    unsigned char level = slab_obj_level(ptr);
+    struct untrusted_slab_cache* cache = level < SLAB_LEVEL ? get_thread_slab_cache() : NULL;
+    if (!cache) {
+        slab_free(untrusted_slabmgr, ptr);
+        return;
+    }
+
+    if (cache->cnts[level] == g_slab_cache_cap[level]) {
+        size_t keep = cache->cnts[level] / 2;
+        void* last = cache->heads[level];
+        for (size_t i = 1; i < keep; i++)
+            last = *(void**)last;
+
+        void* rest = *(void**)last;
+        *(void**)last = NULL;
+        slab_free_batch(untrusted_slabmgr, level, rest);
+        cache->cnts[level] = keep;
+        __atomic_add_fetch(&g_slab_cache_flushes, 1, __ATOMIC_RELAXED);
+    }
+
+    *(void**)ptr = cache->heads[level];
+    cache->heads[level] = ptr;
+    cache->cnts[level]++;
+    put_thread_slab_cache(cache);
+}
+
+void print_untrusted_alloc_stats(void) {
+    spinlock_lock(&g_pool_lock);
+    size_t chunks = g_pool_chunks_cnt;
+    size_t free_pages = 0;
+    for (size_t i = 0; i < chunks; i++)
+        free_pages += g_pool_chunks[i].free_pages;
+    spinlock_unlock(&g_pool_lock);
+
+    log_always("----- Untrusted allocator stats -----\n"
+               "  # of pool chunks:    %lu (%lu with MAP_HUGETLB)\n"
+               "  # of free pages:     %lu\n"
+               "  # of cache refills:  %lu\n"
+               "  # of cache flushes:  %lu\n",
+               chunks, __atomic_load_n(&g_pool_hugetlb_chunks, __ATOMIC_RELAXED), free_pages,
+               __atomic_load_n(&g_slab_cache_refills, __ATOMIC_RELAXED),
+               __atomic_load_n(&g_slab_cache_flushes, __ATOMIC_RELAXED));
 }
@@ -38,6 +38,7 @@
 #include <stdbool.h>
 
 #include "api.h"
+#include "cpu.h"
 #include "crypto.h"
 #include "enclave_pages.h"
 #include "list.h"
@@ -51,6 +52,9 @@
 int g_xsave_enabled = 0;
 uint64_t g_xsave_features = 0;
 uint32_t g_xsave_size = 0;
+/* XGETBV with ECX = 1 (XINUSE) is supported; enclave_entry.S then saves and scrubs only the state
+ * components that are not in their initial configuration */
+int g_xsave_xinuse = 0;
 // FXRSTOR only cares about the first 512 bytes, while XRSTOR in compacted mode will ignore
 // the first 512 bytes.
 const uint32_t g_xsave_reset_state[XSAVE_RESET_STATE_SIZE / sizeof(uint32_t)] __attribute__((
@@ -97,3 +101,17 @@ void init_xsave_size(uint64_t xfrm) {
     }
     log_debug("xsave is enabled with g_xsave_size: %u\n", g_xsave_size);
 }
+
+/* Must be called after init_cpuid(). The host can only lie XINUSE support into existence, which
+ * makes XGETBV fault (#UD) inside the enclave, i.e. this is no worse than a denial of service. */
+void init_xsave_xinuse(void) {
+    if (!g_xsave_enabled)
+        return;
+
+    unsigned int values[4];
+    if (_DkCpuIdRetrieve(0xd, 1, values) < 0)
+        return;
+
+    g_xsave_xinuse = !!(values[CPUID_WORD_EAX] & (1U << 2));
+    log_debug("xsave uses XINUSE: %d\n", g_xsave_xinuse);
+}
@@ -0,0 +1,222 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: LGPL-3.0-or-later
+# Copyright (C) 2021 Intel Corporation
+
+'''
+Generate enclave-side OCALL stubs and their argument structures from ocalls.spec (see the
+description of the format there).
+'''
+
+import argparse
+import re
+import sys
+
+MAX_LINE = 100
+
+HEADER = '/* Generated by gen-ocalls.py from {spec}, do not edit. */\n'
+
+line_re = re.compile(r'^(?P<name>\w+)\s*\((?P<args>[^)]*)\)\s*(?P<flags>[\w\s]*)$')
+arg_re = re.compile(r'^(?:(?P<kind>in_str|out)\s+)?(?P<type>.*?)\s*\b(?P<name>\w+)$')
+
+class SpecError(Exception):
+    pass
+
+class Arg:
+    def __init__(self, text):
+        match = arg_re.match(text.strip())
+        if not match:
+            raise SpecError('invalid argument {!r}'.format(text))
+        self.kind = match.group('kind') or 'value'
+        self.type = match.group('type')
+        self.name = match.group('name')
+        if self.kind == 'in_str':
+            if self.type:
+                raise SpecError('in_str argument {!r} cannot have a type'.format(self.name))
+            self.type = 'const char*'
+        elif not self.type:
+            raise SpecError('argument {!r} has no type'.format(self.name))
+
+    @property
+    def param(self):
+        if self.kind == 'out':
+            return '{}* {}'.format(self.type, self.name)
+        return '{} {}'.format(self.type, self.name)
+
+    @property
+    def field(self):
+        return '{} ms_{};'.format(self.type, self.name)
+
+class Ocall:
+    def __init__(self, line):
+        match = line_re.match(line)
+        if not match:
+            raise SpecError('invalid OCALL {!r}'.format(line))
+        self.name = match.group('name')
+        args = match.group('args').strip()
+        self.args = [Arg(arg) for arg in args.split(',')] if args else []
+        flags = match.group('flags').split()
+        for flag in flags:
+            if flag != 'retry':
+                raise SpecError('unknown flag {!r}'.format(flag))
+        self.retry = 'retry' in flags
+
+        names = [arg.name for arg in self.args]
+        if len(set(names)) != len(names):
+            raise SpecError('duplicate argument of {!r}'.format(self.name))
+
+    @property
+    def ms_type(self):
+        return 'ms_ocall_{}_t'.format(self.name)
+
+    def gen_type(self):
+        lines = ['typedef struct {']
+        lines += ['    ' + arg.field for arg in self.args]
+        if not self.args:
+            # empty structures are a GNU extension
+            lines.append('    char ms_unused;')
+        lines.append('}} {};'.format(self.ms_type))
+        return '\n'.join(lines) + '\n'
+
+    def gen_stub(self):
+        strs = [arg for arg in self.args if arg.kind == 'in_str']
+        outs = [arg for arg in self.args if arg.kind == 'out']
+        params = ', '.join(arg.param for arg in self.args) or 'void'
+
+        out = ['int ocall_{}({}) {{'.format(self.name, params)]
+        size = 'sizeof(*ms)'
+        for arg in strs:
+            out.append('    size_t {0}_size = {0} ? strlen({0}) + 1 : 0;'.format(arg.name))
+            size += ' + {}_size'.format(arg.name)
+        if strs:
+            out.append('')
+
+        alloc = '    {}* ms = sgx_alloc_on_ustack_aligned({}, alignof(*ms));'.format(self.ms_type,
+                                                                               size)
+        if len(alloc) > MAX_LINE:
+            alloc = '    {}* ms = sgx_alloc_on_ustack_aligned(\n        {}, alignof(*ms));'.format(
+                self.ms_type, size)
+        out += [
+            '    void* old_ustack = sgx_prepare_ustack();',
+            alloc,
+            '    if (!ms) {',
+            '        sgx_reset_ustack(old_ustack);',
+            '        return -EPERM;',
+            '    }',
+            '',
+        ]
+
+        for arg in self.args:
+            if arg.kind == 'value':
+                out.append('    WRITE_ONCE(ms->ms_{0}, {0});'.format(arg.name))
+
+        if strs:
+            out.append('    char* ubuf = (char*)(ms + 1);')
+            for arg in strs:
+                out += [
+                    '    char* u{} = ubuf;'.format(arg.name),
+                    '    WRITE_ONCE(ms->ms_{0}, u{0});'.format(arg.name),
+                    '    ubuf += {}_size;'.format(arg.name),
+                ]
+            # a NULL string is rejected here, as sgx_copy_from_enclave() fails on it
+            copies = ['!sgx_copy_from_enclave(u{0}, {0}, {0}_size)'.format(arg.name)
+                      for arg in strs]
+            out.append('    if ({}) {{'.format(('\n        || ').join(copies)))
+            out += [
+                '        sgx_reset_ustack(old_ustack);',
+                '        return -EPERM;',
+                '    }',
+            ]
+        out.append('')
+
+        call = 'retval = sgx_exitless_ocall(OCALL_{}, ms);'.format(self.name.upper())
+        out.append('    int retval;')
+        if self.retry:
+            out += [
+                '    do {',
+                '        ' + call,
+                '    } while (retval == -EINTR);',
+            ]
+        else:
+            out.append('    ' + call)
+
+        if outs:
+            out.append('')
+            out.append('    if (retval >= 0) {')
+            for arg in outs:
+                out.append('        memcpy({0}, &ms->ms_{0}, sizeof(*{0}));'.format(arg.name))
+            out.append('    }')
+
+        out += [
+            '',
+            '    sgx_reset_ustack(old_ustack);',
+            '    return retval;',
+            '}',
+        ]
+        return '\n'.join(out) + '\n'
+
+def parse_spec(spec):
+    ocalls = []
+    for lineno, line in enumerate(spec, 1):
+        line = line.split('#', 1)[0].strip()
+        if not line:
+            continue
+        try:
+            ocalls.append(Ocall(line))
+        except SpecError as e:
+            raise SpecError('{}:{}: {}'.format(spec.name, lineno, e)) from None
+
+    names = [ocall.name for ocall in ocalls]
+    for name in names:
+        if names.count(name) > 1:
+            raise SpecError('{}: OCALL {!r} defined more than once'.format(spec.name, name))
+    return ocalls
+
+def write_types(f, spec_name, ocalls):
+    f.write(HEADER.format(spec=spec_name))
+    f.write('''
+/* Argument structures of the generated OCALLs, included by ocall_types.h (and packed there). */
+
+#ifndef OCALL_TYPES_GEN_H
+#define OCALL_TYPES_GEN_H
+''')
+    for ocall in ocalls:
+        f.write('\n' + ocall.gen_type())
+    f.write('\n#endif /* OCALL_TYPES_GEN_H */\n')
+
+def write_stubs(f, spec_name, ocalls):
+    f.write(HEADER.format(spec=spec_name))
+    f.write('''
+#include <asm/errno.h>
+#include <stdalign.h>
+
+#include "api.h"
+#include "enclave_ocalls.h"
+#include "ocall_types.h"
+#include "pal_linux.h"
+''')
+    for ocall in ocalls:
+        f.write('\n' + ocall.gen_stub())
+
+argparser = argparse.ArgumentParser()
+argparser.add_argument('--spec', metavar='SPEC', type=argparse.FileType('r'), required=True,
+                       help='OCALL description (ocalls.spec)')
+argparser.add_argument('--types', metavar='HEADER', type=str, required=True,
+                       help='Output .h file with the argument structures')
+argparser.add_argument('--stubs', metavar='SOURCE', type=str, required=True,
+                       help='Output .c file with the enclave-side stubs')
+
+def main(args=None):
+    args = argparser.parse_args(args)
+    try:
+        ocalls = parse_spec(args.spec)
+    except SpecError as e:
+        print(e, file=sys.stderr)
+        sys.exit(1)
+
+    with open(args.types, 'w') as f:
+        write_types(f, args.spec.name, ocalls)
+    with open(args.stubs, 'w') as f:
+        write_stubs(f, args.spec.name, ocalls)
+
+if __name__ == '__main__':
+    main()
@@ -53,6 +53,10 @@ __attribute__((__used__)) static void dummy(void) {
     OFFSET_T(SGX_GPR_EXITINFO, sgx_pal_gpr_t, exitinfo);
     DEFINE(SGX_GPR_SIZE, sizeof(sgx_pal_gpr_t));
 
+    /* sgx_arch_exinfo_t */
+    OFFSET_T(SGX_EXINFO_MADDR, sgx_arch_exinfo_t, maddr);
+    DEFINE(SGX_EXINFO_SIZE, sizeof(sgx_arch_exinfo_t));
+
     /* sgx_cpu_context_t */
     OFFSET_T(SGX_CPU_CONTEXT_RAX, sgx_cpu_context_t, rax);
     OFFSET_T(SGX_CPU_CONTEXT_RCX, sgx_cpu_context_t, rcx);
@@ -99,6 +103,7 @@ __attribute__((__used__)) static void dummy(void) {
     OFFSET(SGX_MANIFEST_SIZE, enclave_tls, manifest_size);
     OFFSET(SGX_HEAP_MIN, enclave_tls, heap_min);
     OFFSET(SGX_HEAP_MAX, enclave_tls, heap_max);
+    OFFSET(SGX_EDMM_ENABLED, enclave_tls, edmm_enabled);
     OFFSET(SGX_CLEAR_CHILD_TID, enclave_tls, clear_child_tid);
 
     /* struct pal_tcb_urts aka PAL_TCB_URTS */
@@ -156,6 +161,8 @@ __attribute__((__used__)) static void dummy(void) {
     DEFINE(ENCLAVE_SIG_STACK_SIZE, ENCLAVE_SIG_STACK_SIZE);
     DEFINE(DEFAULT_ENCLAVE_BASE, DEFAULT_ENCLAVE_BASE);
     DEFINE(MMAP_MIN_ADDR, MMAP_MIN_ADDR);
+    DEFINE(TRUSTED_CHUNK_SIZE, TRUSTED_CHUNK_SIZE);
+    DEFINE(TRUSTED_CHUNK_SIZE_MAX, TRUSTED_CHUNK_SIZE_MAX);
 
     /* pal_linux.h */
     DEFINE(PAGESIZE, PRESET_PAGESIZE);
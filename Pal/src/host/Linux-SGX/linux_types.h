@@ -76,6 +76,10 @@ struct sockaddr {
 #define MSG_NOSIGNAL 0x4000
 #endif
 
+#ifndef MSG_WAITFORONE
+#define MSG_WAITFORONE 0x10000
+#endif
+
 #ifndef SHUT_RD
 #define SHUT_RD 0
 #endif
@@ -98,6 +102,11 @@ struct msghdr {
     int msg_flags;
 };
 
+struct mmsghdr {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+};
+
 struct cmsghdr {
     size_t cmsg_len;
     int cmsg_level;
@@ -21,6 +21,9 @@
 
 typedef long (*sgx_ocall_fn_t)(void*);
 
+/* argument structures of the OCALLs described in ocalls.spec */
+#include "ocall_types_gen.h"
+
 enum {
     OCALL_EXIT = 0,
     OCALL_MMAP_UNTRUSTED,
@@ -32,12 +35,19 @@ enum {
     OCALL_WRITE,
     OCALL_PREAD,
     OCALL_PWRITE,
+    OCALL_PWRITEV,
+    OCALL_READV,
+    OCALL_WRITEV,
+    OCALL_SENDFILE,
+    OCALL_COPY_FILE_RANGE,
     OCALL_FSTAT,
     OCALL_FIONREAD,
     OCALL_FSETNONBLOCK,
     OCALL_FCHMOD,
     OCALL_FSYNC,
     OCALL_FTRUNCATE,
+    OCALL_FALLOCATE,
+    OCALL_FADVISE,
     OCALL_MKDIR,
     OCALL_GETDENTS,
     OCALL_RESUME_THREAD,
@@ -49,20 +59,30 @@ enum {
     OCALL_SOCKETPAIR,
     OCALL_LISTEN,
     OCALL_ACCEPT,
+    OCALL_ACCEPT_MULTI,
     OCALL_CONNECT,
     OCALL_RECV,
     OCALL_SEND,
+    OCALL_RECVMMSG,
+    OCALL_SENDMMSG,
     OCALL_SETSOCKOPT,
     OCALL_SHUTDOWN,
     OCALL_GETTIME,
     OCALL_SCHED_YIELD,
     OCALL_POLL,
+    OCALL_EPOLL_CREATE,
+    OCALL_EPOLL_CTL,
+    OCALL_EPOLL_WAIT,
     OCALL_RENAME,
     OCALL_DELETE,
     OCALL_DEBUG_MAP_ADD,
     OCALL_DEBUG_MAP_REMOVE,
     OCALL_EVENTFD,
     OCALL_GET_QUOTE,
+    OCALL_BATCH,
+    OCALL_EDMM_TRIM_PAGES,
+    OCALL_EDMM_REMOVE_PAGES,
+    OCALL_EDMM_CONVERT_TCS,
     OCALL_NR,
 };
 
@@ -91,12 +111,6 @@ typedef struct {
     unsigned int ms_values[4];
 } ms_ocall_cpuid_t;
 
-typedef struct {
-    const char* ms_pathname;
-    int ms_flags;
-    unsigned short ms_mode;
-} ms_ocall_open_t;
-
 typedef struct {
     int ms_fd;
 } ms_ocall_close_t;
@@ -127,38 +141,48 @@ typedef struct {
     off_t ms_offset;
 } ms_ocall_pwrite_t;
 
-typedef struct {
-    int ms_fd;
-    struct stat ms_stat;
-} ms_ocall_fstat_t;
+/* max number of segments in one OCALL_PWRITEV */
+#define OCALL_PWRITEV_MAX 64
 
-typedef struct {
-    int ms_fd;
-} ms_ocall_fionread_t;
+/* one segment of OCALL_PWRITEV; segments with adjacent file ranges are written with one pwritev */
+struct ocall_pwritev_seg {
+    const void* buf;
+    size_t count;
+    off_t offset;
+};
 
 typedef struct {
     int ms_fd;
-    int ms_nonblocking;
-} ms_ocall_fsetnonblock_t;
+    size_t ms_count;
+    struct ocall_pwritev_seg* ms_segs;
+} ms_ocall_pwritev_t;
 
-typedef struct {
-    int ms_fd;
-    unsigned short ms_mode;
-} ms_ocall_fchmod_t;
+/* max number of segments in one OCALL_READV/OCALL_WRITEV */
+#define OCALL_IOV_MAX 64
 
 typedef struct {
     int ms_fd;
-} ms_ocall_fsync_t;
+    off_t ms_offset; /* negative: at (and advancing) the file position, as readv/writev */
+    struct iovec* ms_iov;
+    unsigned int ms_iovcnt;
+} ms_ocall_readv_t;
+
+typedef ms_ocall_readv_t ms_ocall_writev_t;
 
 typedef struct {
-    int ms_fd;
-    uint64_t ms_length;
-} ms_ocall_ftruncate_t;
+    int ms_out_fd;
+    int ms_in_fd;
+    off_t ms_offset;
+    size_t ms_count;
+} ms_ocall_sendfile_t;
 
 typedef struct {
-    const char* ms_pathname;
-    unsigned short ms_mode;
-} ms_ocall_mkdir_t;
+    int ms_fd_in;
+    off_t ms_off_in;
+    int ms_fd_out;
+    off_t ms_off_out;
+    size_t ms_count;
+} ms_ocall_copy_file_range_t;
 
 typedef struct {
     int ms_fd;
@@ -201,6 +225,7 @@ typedef struct {
     int ms_type;
     int ms_protocol;
     int ms_ipv6_v6only;
+    int ms_reuseport;
     const struct sockaddr* ms_addr;
     size_t ms_addrlen;
     struct sockopt ms_sockopt;
@@ -213,6 +238,24 @@ typedef struct {
     struct sockopt ms_sockopt;
 } ms_ocall_accept_t;
 
+/* max connections in one OCALL_ACCEPT_MULTI */
+#define OCALL_ACCEPT_MAX 32
+
+/* one connection of OCALL_ACCEPT_MULTI, filled by the host */
+struct ocall_accepted {
+    int fd;
+    uint32_t addrlen;
+    struct sockaddr_storage addr;
+    struct sockopt sockopt;
+};
+
+typedef struct {
+    int ms_sockfd;
+    int ms_efd; /* event FD: cleared first, signaled if more than one connection was accepted */
+    struct ocall_accepted* ms_conns;
+    unsigned int ms_count;
+} ms_ocall_accept_multi_t;
+
 typedef struct {
     int ms_domain;
     int ms_type;
@@ -245,6 +288,24 @@ typedef struct {
     size_t ms_controllen;
 } ms_ocall_send_t;
 
+/* max messages in one OCALL_RECVMMSG/OCALL_SENDMMSG */
+#define OCALL_MMSG_MAX 64
+
+/* one message of OCALL_RECVMMSG/OCALL_SENDMMSG, in untrusted memory */
+struct ocall_mmsg {
+    void* buf;
+    size_t len;
+    struct sockaddr* addr;
+    uint32_t addrlen;  /* size of `addr`; on return from OCALL_RECVMMSG, size of source address */
+    uint32_t msg_len;  /* set by the host: number of bytes transferred */
+};
+
+typedef struct {
+    PAL_IDX ms_sockfd;
+    struct ocall_mmsg* ms_msgs;
+    unsigned int ms_vlen;
+} ms_ocall_mmsg_t;
+
 typedef struct {
     int ms_sockfd;
     int ms_level;
@@ -253,29 +314,31 @@ typedef struct {
     size_t ms_optlen;
 } ms_ocall_setsockopt_t;
 
-typedef struct {
-    int ms_sockfd;
-    int ms_how;
-} ms_ocall_shutdown_t;
-
-typedef struct {
-    uint64_t ms_microsec;
-} ms_ocall_gettime_t;
-
 typedef struct {
     struct pollfd* ms_fds;
     size_t ms_nfds;
     int64_t ms_timeout_us;
 } ms_ocall_poll_t;
 
+/* layout of the host's `struct epoll_event` (packed on x86-64) */
+struct ocall_epoll_event {
+    uint32_t events;
+    uint64_t data;
+};
+
 typedef struct {
-    const char* ms_oldpath;
-    const char* ms_newpath;
-} ms_ocall_rename_t;
+    int ms_epfd;
+    int ms_op;
+    int ms_fd;
+    struct ocall_epoll_event ms_event;
+} ms_ocall_epoll_ctl_t;
 
 typedef struct {
-    const char* ms_pathname;
-} ms_ocall_delete_t;
+    int ms_epfd;
+    struct ocall_epoll_event* ms_events;
+    int ms_maxevents;
+    int64_t ms_timeout_us;
+} ms_ocall_epoll_wait_t;
 
 typedef struct {
     struct debug_map* _Atomic* ms_debug_map;
@@ -290,11 +353,6 @@ typedef struct {
     void* ms_addr;
 } ms_ocall_debug_map_remove_t;
 
-typedef struct {
-    unsigned int ms_initval;
-    int          ms_flags;
-} ms_ocall_eventfd_t;
-
 typedef struct {
     bool              ms_is_epid;
     sgx_spid_t        ms_spid;
@@ -305,4 +363,21 @@ typedef struct {
     size_t            ms_quote_len;
 } ms_ocall_get_quote_t;
 
+typedef struct {
+    void*  ms_addr;
+    size_t ms_size;
+} ms_ocall_edmm_pages_t;
+
+/* one OCALL of a batch; `ms` is the regular argument structure of `ocall_index` */
+struct ocall_batch_entry {
+    uint64_t ocall_index;
+    void*    ms;
+    long     result;
+};
+
+typedef struct {
+    size_t                    ms_count;
+    struct ocall_batch_entry* ms_entries;
+} ms_ocall_batch_t;
+
 #pragma pack(pop)
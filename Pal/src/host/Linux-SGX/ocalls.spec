@@ -0,0 +1,35 @@
+# Declarative description of the OCALLs whose enclave-side stubs and argument structures are
+# generated by gen-ocalls.py (into enclave_ocalls_gen.c and ocall_types_gen.h). OCALLs which need
+# more than this (untrusted I/O buffers, variable-sized output, batching, async completion, ...)
+# are written by hand in enclave_ocalls.c.
+#
+# One OCALL per line:
+#
+#     <name>(<argument>, ...) [retry]
+#
+# generates `int ocall_<name>(...)`, which issues OCALL_<NAME> (exitless if enabled) with the
+# argument structure `ms_ocall_<name>_t`. An argument is one of:
+#
+#     <C type> <name>       value, stored in the `ms_<name>` field
+#     in_str <name>         `const char*` string, copied with its NUL behind the structure
+#     out <C type> <name>   `<C type>*` result, stored in `ms_<name>` and copied back if the
+#                           OCALL returned a non-negative value
+#
+# The structure and all strings are one contiguous block on the untrusted stack. With `retry`, the
+# OCALL is restarted on -EINTR (see the comment at the top of enclave_ocalls.c).
+
+open(in_str pathname, int flags, unsigned short mode) retry
+fstat(int fd, out struct stat stat) retry
+fionread(int fd) retry
+fsetnonblock(int fd, int nonblocking) retry
+fchmod(int fd, unsigned short mode) retry
+fsync(int fd) retry
+ftruncate(int fd, uint64_t length) retry
+fallocate(int fd, int mode, uint64_t offset, uint64_t length) retry
+fadvise(int fd, uint64_t offset, uint64_t length, int advice) retry
+mkdir(in_str pathname, unsigned short mode) retry
+shutdown(int sockfd, int how) retry
+gettime(out uint64_t microsec) retry
+rename(in_str oldpath, in_str newpath) retry
+delete(in_str pathname) retry
+eventfd(unsigned int initval, int flags) retry
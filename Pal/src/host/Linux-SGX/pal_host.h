@@ -23,6 +23,9 @@
 void* malloc_untrusted(size_t size);
 void free_untrusted(void* mem);
 
+/* shared-memory transport of pipes, see db_pipes.c */
+struct pipe_ring;
+
 DEFINE_LIST(pal_handle_thread);
 struct pal_handle_thread {
     PAL_HDR reserved;
@@ -57,8 +60,10 @@ typedef struct pal_handle {
             PAL_NUM total;
             /* below fields are used only for trusted files */
             PAL_PTR chunk_hashes; /* array of hashes of file chunks */
+            PAL_NUM chunk_size;   /* size of file chunks, valid only when chunk_hashes != NULL */
             PAL_PTR umem;         /* valid only when chunk_hashes != NULL */
             PAL_BOL seekable;     /* regular files are seekable, FIFO pipes are not */
+            PAL_BOL pending_open; /* trusted file not opened on the host yet, see file_open() */
         } file;
 
         struct {
@@ -69,6 +74,8 @@ typedef struct pal_handle {
             PAL_SESSION_KEY session_key;
             PAL_NUM handshake_done;
             void* ssl_ctx;
+            PAL_BOL want_ring;       /* PAL_OPTION_PIPE_SHM given on connect */
+            struct pipe_ring* ring;  /* shared-memory transport, NULL if data go over `ssl_ctx` */
         } pipe;
 
         struct {
@@ -87,10 +94,17 @@ typedef struct pal_handle {
             PAL_BOL nonblocking;
         } dev;
 
+        struct {
+            PAL_IDX fd;      /* host epoll FD */
+            spinlock_t lock; /* protects `items` */
+            PAL_PTR items;   /* registered host FDs, see db_object.c */
+        } poller;
+
         struct {
             PAL_IDX fd;
             PAL_STR realpath;
             PAL_PTR buf;
+            PAL_NUM buf_size;
             PAL_PTR ptr;
             PAL_PTR end;
             PAL_BOL endofstream;
@@ -98,6 +112,7 @@ typedef struct pal_handle {
 
         struct {
             PAL_IDX fd;
+            PAL_IDX accept_efd; /* fds[1] of tcpsrv, readable while `accept_queue` is not empty */
             PAL_PTR bind;
             PAL_PTR conn;
             PAL_BOL nonblocking;
@@ -109,6 +124,7 @@ typedef struct pal_handle {
             PAL_BOL tcp_cork;
             PAL_BOL tcp_keepalive;
             PAL_BOL tcp_nodelay;
+            PAL_PTR accept_queue; /* connections accepted ahead, see db_sockets.c */
         } sock;
 
         struct {
@@ -129,9 +145,13 @@ typedef struct pal_handle {
              * separate copies, because we need to guard against malicious host modifications yet
              * still be able to call futex on it. */
             spinlock_t lock;
-            /* Current number of waiters - used solely as an optimization. `uint32_t` because futex
-             * syscall does not allow for more than `INT_MAX` waiters anyway. */
+            /* Current number of waiters which (are about to) sleep on the host futex - used solely
+             * as an optimization. Waiters which only spin are not counted, so that waking them
+             * doesn't need an OCALL. `uint32_t` because futex syscall does not allow for more than
+             * `INT_MAX` waiters anyway. */
             uint32_t waiters_cnt;
+            /* Current spin budget (in pause instructions) of waiters, adapted after each spin. */
+            uint32_t spin_budget;
             bool signaled;
             bool auto_clear;
             /* Access to the *content* of this field should be atomic, because it's used as futex
@@ -144,6 +164,10 @@ typedef struct pal_handle {
 #define RFD(n)   (1 << (MAX_FDS * 0 + (n)))
 #define WFD(n)   (1 << (MAX_FDS * 1 + (n)))
 #define ERROR(n) (1 << (MAX_FDS * 2 + (n)))
+/* file handle of a protected file, for the I/O counters (see db_streams.c) */
+#define PROTECTED_FILE (1 << (MAX_FDS * 3))
+
+#define HANDLE_IS_PROTECTED_FILE(handle) (HANDLE_HDR(handle)->flags & PROTECTED_FILE)
 
 #define HANDLE_TYPE(handle) ((handle)->hdr.type)
 
@@ -22,6 +22,7 @@
 #include "sgx_arch.h"
 #include "sgx_attest.h"
 #include "sgx_tls.h"
+#include "spinlock.h"
 #include "sysdep-arch.h"
 
 #define IS_ERR_P    INTERNAL_SYSCALL_ERROR_P
@@ -58,6 +59,15 @@ int init_child_process(PAL_HANDLE* parent);
 
 #ifdef IN_ENCLAVE
 extern size_t g_pal_internal_mem_size;
+extern bool g_sgx_enable_stats;
+extern size_t g_accept_batch_size;
+extern uint32_t g_event_spin_max;
+
+/* default and lower bound (unless 0) of `sgx.event_spin_max` (in pause instructions) */
+#define EVENT_SPIN_MAX_DEFAULT 4096
+#define EVENT_SPIN_MIN         64U
+
+int sock_init_accept_queue(PAL_HANDLE handle);
 
 struct pal_sec;
 noreturn void pal_linux_main(char* uptr_libpal_uri, size_t libpal_uri_len, char* uptr_args,
@@ -84,16 +94,18 @@ typedef struct {
 extern int g_xsave_enabled;
 extern uint64_t g_xsave_features;
 extern uint32_t g_xsave_size;
+extern int g_xsave_xinuse;
 #define XSAVE_RESET_STATE_SIZE (512 + 64)  // 512 for legacy regs, 64 for xsave header
 extern const uint32_t g_xsave_reset_state[];
 
 void init_xsave_size(uint64_t xfrm);
+void init_xsave_xinuse(void);
 void save_xregs(PAL_XREGS_STATE* xsave_area);
 void restore_xregs(const PAL_XREGS_STATE* xsave_area);
 noreturn void _restore_sgx_context(sgx_cpu_context_t* uc, PAL_XREGS_STATE* xsave_area);
 
 void _DkExceptionHandler(unsigned int exit_info, sgx_cpu_context_t* uc,
-                         PAL_XREGS_STATE* xregs_state);
+                         PAL_XREGS_STATE* xregs_state, uint64_t fault_addr);
 void _DkHandleExternalEvent(PAL_NUM event, sgx_cpu_context_t* uc, PAL_XREGS_STATE* xregs_state);
 
 int init_trusted_files(void);
@@ -108,14 +120,28 @@ void init_tsc(void);
  *
  * \param file              file handle to be opened
  * \param chunk_hashes_ptr  array of hashes over file chunks
+ * \param chunk_size_ptr    returns size of file chunks (of the trusted file)
  * \param size_ptr          returns size of opened file
  * \param create            whether this file is newly created
  * \param umem              untrusted memory address at which the file is loaded
  *
  * \return 0 on success, negative error code on failure
  */
-int load_trusted_file(PAL_HANDLE file, sgx_chunk_hash_t** chunk_hashes_ptr, uint64_t* size_ptr,
-                      int create, void** umem);
+int load_trusted_file(PAL_HANDLE file, sgx_chunk_hash_t** chunk_hashes_ptr,
+                      size_t* chunk_size_ptr, uint64_t* size_ptr, int create, void** umem);
+
+/* Fills `attr` of trusted file `path` (normalized, without the URI prefix) from its registration,
+ * without asking the host; returns false if `path` is not a trusted file. Trusted files are
+ * read-only regular files with a stable mode, and their size is the one they were verified with. */
+bool get_trusted_file_attr(const char* path, PAL_STREAM_ATTR* attr);
+
+/* send hashes of already verified trusted files to a child enclave, and receive them in the child
+ * (they are used after the child's trusted files are registered in init_trusted_files()) */
+int send_trusted_file_hashes(LIB_SSL_CONTEXT* ssl_ctx);
+int receive_trusted_file_hashes(LIB_SSL_CONTEXT* ssl_ctx);
+
+/* write hashes of verified trusted files to `sgx.trusted_files_hash_cache` (on process exit) */
+void save_trusted_file_hash_cache(void);
 
 enum {
     FILE_CHECK_POLICY_STRICT = 0,
@@ -132,11 +158,12 @@ int get_file_check_policy(void);
  * \param path            file path (currently only for a log message)
  * \param buf             in-enclave buffer where contents of the file are copied
  * \param umem            start of untrusted file memory mapped outside the enclave
- * \param aligned_offset  offset into file contents to copy, aligned to TRUSTED_CHUNK_SIZE
- * \param aligned_end     end of file contents to copy, aligned to TRUSTED_CHUNK_SIZE
+ * \param aligned_offset  offset into file contents to copy, aligned to `chunk_size`
+ * \param aligned_end     end of file contents to copy, aligned to `chunk_size`
  * \param offset          unaligned offset into file contents to copy
  * \param end             unaligned end of file contents to copy
  * \param chunk_hashes    array of hashes of all file chunks
+ * \param chunk_size      size of file chunks (as returned by load_trusted_file())
  * \param file_size       total size of the file
  *
  * \return 0 on success, negative error code on failure
@@ -151,12 +178,30 @@ int get_file_check_policy(void);
  */
 int copy_and_verify_trusted_file(const char* path, uint8_t* buf, const void* umem,
                                  off_t aligned_offset, off_t aligned_end, off_t offset, off_t end,
-                                 sgx_chunk_hash_t* chunk_hashes, size_t file_size);
+                                 sgx_chunk_hash_t* chunk_hashes, size_t chunk_size,
+                                 size_t file_size);
+
+/* map trusted files on demand, chunk by chunk (`sgx.trusted_files_lazy_mmap`) */
+extern bool g_trusted_files_lazy_mmap;
+/* map allowed files on demand, cluster by cluster (`sgx.allowed_files_lazy_mmap`) */
+extern bool g_allowed_files_lazy_mmap;
+
+/*!
+ * \brief Same as copy_and_verify_trusted_file(), but never allocates memory and bypasses the cache of
+ * verified chunks, so that it can be used while handling lazy enclave page faults
+ *
+ * \param tmp_chunk  scratch buffer of `chunk_size` bytes
+ */
+int copy_and_verify_trusted_file_nomalloc(const char* path, uint8_t* buf, const void* umem,
+                                          off_t aligned_offset, off_t aligned_end, off_t offset,
+                                          off_t end, sgx_chunk_hash_t* chunk_hashes,
+                                          size_t chunk_size, size_t file_size, uint8_t* tmp_chunk);
 
 int register_trusted_child(const char* uri, const char* mr_enclave_str);
 
 int init_enclave(void);
 void init_untrusted_slab_mgr(void);
+void print_untrusted_alloc_stats(void);
 
 /* Used to track map buffers for protected files */
 DEFINE_LIST(pf_map);
@@ -166,31 +211,37 @@ struct pf_map {
     void* buffer;
     uint64_t size;
     uint64_t offset; /* offset in PF, needed for write buffers when flushing to the PF */
+    sgx_file_hash_t* page_hashes; /* SHA-256 of each page as last read from or written to the PF */
 };
 DEFINE_LISTP(pf_map);
 
-/* List of PF map buffers; this list is traversed on PF flush (on file close) */
+/* List of PF map buffers; this list is traversed on PF flush (on file close). Entries of a PF are
+ * added and removed only with both the PF's lock and `g_pf_map_list_lock` held. */
 extern LISTP_TYPE(pf_map) g_pf_map_list;
+extern spinlock_t g_pf_map_list_lock;
 
 /* Data of a protected file */
 struct protected_file {
     UT_hash_handle hh;
     size_t path_len;
     char* path;
+    spinlock_t lock; /* protects the fields below and all operations on `context` */
     pf_context_t* context; /* NULL until PF is opened */
     int64_t refcount; /* used for deciding when to call unload_protected_file() */
     int writable_fd; /* fd of underlying file for writable PF, -1 if no writable handles are open */
+    size_t cache_size;     /* `sgx.protected_files_cache_size.<key>`, inherited from dirs */
+    size_t readahead_size; /* `sgx.protected_files_readahead.<key>`, inherited from dirs */
+    /* Attributes cached by stat/fstat so that repeated queries skip the host and the metadata
+       decryption; invalidated by the enclave's own writes, truncates, chmods and renames */
+    bool attr_cached;
+    PAL_STREAM_ATTR cached_attr;   /* host attributes, `pending_size` is the plaintext size */
+    uint64_t cached_host_size;     /* size and mtime of the underlying file when cached, used to */
+    uint64_t cached_host_mtime_ns; /* detect host-side changes while the PF is not opened */
 };
 
 /* Initialize the PF library, register PFs from the manifest */
 int init_protected_files(void);
 
-/* Take ownership of the global PF lock */
-void pf_lock(void);
-
-/* Release ownership of the global PF lock */
-void pf_unlock(void);
-
 /* Set new wrap key for protected files (e.g., provisioned by remote user) */
 int set_protected_files_key(const char* pf_key_hex);
 
@@ -206,7 +257,7 @@ struct protected_file* get_protected_file(const char* path);
  * size:   underlying file size (in bytes)
  * mode:   access mode
  * create: if true, the PF is being created/truncated
- * pf:     (optional) PF pointer if already known
+ * pf:     (optional) PF pointer if already known; if given, the caller must hold `pf->lock`
  */
 struct protected_file* load_protected_file(const char* path, int* fd, size_t size,
                                            pf_file_mode_t mode, bool create,
@@ -214,12 +265,22 @@ struct protected_file* load_protected_file(const char* path, int* fd, size_t siz
 
 /* Flush PF map buffers and optionally remove and free them.
    If pf is NULL, process all maps containing given buffer.
-   If buffer is NULL, process all maps for given pf. */
+   If buffer is NULL, process all maps for given pf; the caller must hold `pf->lock`. */
 int flush_pf_maps(struct protected_file* pf, void* buffer, bool remove);
 
-/* Flush map buffers and unload/close the PF */
+/* Record the current contents of a map buffer (just read from the PF), so that flush_pf_maps()
+   writes back only the pages modified afterwards */
+int pf_map_init_page_hashes(struct pf_map* map);
+
+/* Flush map buffers and unload/close the PF; the caller must hold `pf->lock` */
 int unload_protected_file(struct protected_file* pf);
 
+/* Flush the PF context without flushing map buffers; the caller must hold `pf->lock` */
+pf_status_t flush_protected_file(struct protected_file* pf);
+
+/* Close the PF context without flushing map buffers; the caller must hold `pf->lock` */
+pf_status_t close_protected_file(struct protected_file* pf);
+
 /* Find registered PF by path (exact match) */
 struct protected_file* find_protected_file(const char* path);
 
@@ -286,6 +347,7 @@ int _DkStreamSecureRead(LIB_SSL_CONTEXT* ssl_ctx, uint8_t* buf, size_t len, bool
 int _DkStreamSecureWrite(LIB_SSL_CONTEXT* ssl_ctx, const uint8_t* buf, size_t len,
                          bool is_blocking);
 int _DkStreamSecureSave(LIB_SSL_CONTEXT* ssl_ctx, const uint8_t** obuf, size_t* olen);
+void print_ssl_stats(void);
 
 #include "sgx_arch.h"
 
@@ -296,6 +358,7 @@ int _DkStreamSecureSave(LIB_SSL_CONTEXT* ssl_ctx, const uint8_t** obuf, size_t*
 #else
 
 int sgx_create_process(size_t nargs, const char** args, int* stream_fd, const char* manifest);
+void sgx_fill_process_pool(void);
 
 #ifdef DEBUG
 #ifndef SIGCHLD
@@ -25,7 +25,10 @@
 #define DEBUG_ECALL 0
 #define DEBUG_OCALL 0
 
-#define TRUSTED_CHUNK_SIZE (PRESET_PAGESIZE * 4UL)
+/* default granularity of trusted file verification; `sgx.trusted_chunk_size` may set a different
+ * one per file, a power of two between the page size and TRUSTED_CHUNK_SIZE_MAX */
+#define TRUSTED_CHUNK_SIZE     (PRESET_PAGESIZE * 4UL)
+#define TRUSTED_CHUNK_SIZE_MAX (PRESET_PAGESIZE * 4096UL)
 
 #define MAX_ARGS_SIZE 10000000
 #define MAX_ENV_SIZE  10000000
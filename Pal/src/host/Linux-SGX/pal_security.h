@@ -9,6 +9,17 @@
 
 typedef char PAL_SEC_STR[255];
 
+/* start-up phases of the untrusted loader (host wall-clock time in microseconds at their ends),
+ * reported by the enclave PAL in `g_pal_control.startup_phases` */
+enum {
+    SGX_STARTUP_LOADER_START = 0,
+    SGX_STARTUP_ENCLAVE_CREATION,   /* manifest parsing, driver setup and ECREATE */
+    SGX_STARTUP_PAGES_ADDING,       /* EADD and EEXTEND of all initial enclave pages */
+    SGX_STARTUP_ENCLAVE_INIT,       /* EINIT */
+    SGX_STARTUP_UNTRUSTED_PAL,      /* the rest of the untrusted PAL initialization */
+    SGX_STARTUP_PHASES_NUM,
+};
+
 struct pal_sec {
     /* host credentials */
     PAL_NUM instance_id;
@@ -19,6 +30,7 @@ struct pal_sec {
     sgx_measurement_t mr_enclave;
     sgx_measurement_t mr_signer;
     sgx_attributes_t  enclave_attributes;
+    sgx_misc_select_t enclave_misc_select;
 
     /* remaining heap usable by application */
     PAL_PTR heap_min, heap_max;
@@ -35,6 +47,8 @@ struct pal_sec {
     int* cpu_socket;
     PAL_TOPO_INFO topo_info;
 
+    PAL_NUM startup_times[SGX_STARTUP_PHASES_NUM];
+
 #ifdef DEBUG
     PAL_BOL in_gdb;
 #endif
@@ -40,6 +40,8 @@ static pf_aes_cmac_f        g_cb_aes_cmac        = NULL;
 static pf_aes_gcm_encrypt_f g_cb_aes_gcm_encrypt = NULL;
 static pf_aes_gcm_decrypt_f g_cb_aes_gcm_decrypt = NULL;
 static pf_random_f          g_cb_random          = NULL;
+static pf_parallel_f        g_cb_parallel        = NULL;
+static pf_write_vec_f       g_cb_write_vec       = NULL;
 
 #ifdef DEBUG
 #define PF_DEBUG_PRINT_SIZE_MAX 4096
@@ -193,6 +195,15 @@ static bool ipf_init_fields(pf_context_t* pf) {
     pf->last_error     = PF_STATUS_SUCCESS;
     pf->real_file_size = 0;
 
+    pf->max_cache_nodes      = MAX_PAGES_IN_CACHE;
+    pf->max_readahead_nodes  = 0;
+    pf->readahead_window     = 0;
+    pf->readahead_random     = false;
+    pf->next_seq_node_number = 0;
+    pf->readahead_buffer     = NULL;
+    pf->readahead_first      = 0;
+    pf->readahead_count      = 0;
+
     pf->cache = lruc_create();
     return true;
 }
@@ -272,10 +283,86 @@ out:
     return pf;
 }
 
+// Sequential reads are detected by physical node numbers: MHT nodes are interleaved with data nodes
+// in the file, so reading data nodes in order may skip one (already cached) node. On a sequential
+// read, the read-ahead window is doubled (up to max_readahead_nodes) and that many consecutive
+// nodes, i.e., the next data nodes together with their MHT nodes, are fetched with one read
+// callback. The nodes are kept encrypted in readahead_buffer until requested, and are decrypted and
+// authenticated as usual when copied out of it.
+// fetch `count` (at most max_readahead_nodes) physical nodes starting at `node_number` into the
+// (allocated) readahead_buffer
+static bool ipf_fill_readahead(pf_context_t* pf, pf_handle_t handle, uint64_t node_number,
+                               size_t count) {
+    assert(pf->readahead_buffer && count <= pf->max_readahead_nodes);
+
+    pf->readahead_count = 0;
+    pf_status_t status = g_cb_read(handle, pf->readahead_buffer, node_number * PF_NODE_SIZE,
+                                   count * PF_NODE_SIZE);
+    if (PF_FAILURE(status)) {
+        pf->last_error = status;
+        return false;
+    }
+    pf->readahead_first = node_number;
+    pf->readahead_count = count;
+    return true;
+}
+
+static bool ipf_read_node_readahead(pf_context_t* pf, pf_handle_t handle, uint64_t node_number,
+                                    void* buffer, bool* done) {
+    *done = false;
+
+    if (node_number >= pf->readahead_first
+            && node_number < pf->readahead_first + pf->readahead_count) {
+        memcpy(buffer, pf->readahead_buffer + (node_number - pf->readahead_first) * PF_NODE_SIZE,
+               PF_NODE_SIZE);
+        pf->next_seq_node_number = node_number + 1;
+        *done = true;
+        return true;
+    }
+
+    bool sequential = node_number == pf->next_seq_node_number
+                      || node_number == pf->next_seq_node_number + 1;
+    pf->next_seq_node_number = node_number + 1;
+    if (!sequential || pf->readahead_random) {
+        pf->readahead_window = 1;
+        return true;
+    }
+
+    pf->readahead_window = MIN(MAX(pf->readahead_window * 2, 2UL), pf->max_readahead_nodes);
+
+    uint64_t file_nodes = pf->real_file_size / PF_NODE_SIZE;
+    if (node_number >= file_nodes)
+        return true;
+    size_t count = MIN(pf->readahead_window, file_nodes - node_number);
+    if (count < 2)
+        return true;
+
+    if (!pf->readahead_buffer) {
+        pf->readahead_buffer = malloc(pf->max_readahead_nodes * PF_NODE_SIZE);
+        if (!pf->readahead_buffer)
+            return true; // not fatal, read only the requested node
+    }
+
+    if (!ipf_fill_readahead(pf, handle, node_number, count))
+        return false;
+
+    memcpy(buffer, pf->readahead_buffer, PF_NODE_SIZE);
+    *done = true;
+    return true;
+}
+
 static bool ipf_read_node(pf_context_t* pf, pf_handle_t handle, uint64_t node_number, void* buffer,
                           uint32_t node_size) {
     uint64_t offset = node_number * node_size;
 
+    if (pf->max_readahead_nodes > 1 && node_size == PF_NODE_SIZE) {
+        bool done;
+        if (!ipf_read_node_readahead(pf, handle, node_number, buffer, &done))
+            return false;
+        if (done)
+            return true;
+    }
+
     pf_status_t status = g_cb_read(handle, buffer, offset, node_size);
     if (PF_FAILURE(status)) {
         pf->last_error = status;
@@ -285,8 +372,17 @@ static bool ipf_read_node(pf_context_t* pf, pf_handle_t handle, uint64_t node_nu
     return true;
 }
 
+// drop read-ahead nodes if they are overwritten
+static void ipf_invalidate_readahead(pf_context_t* pf, uint64_t offset, uint64_t size) {
+    if (pf->readahead_count && offset < (pf->readahead_first + pf->readahead_count) * PF_NODE_SIZE
+            && pf->readahead_first * PF_NODE_SIZE < offset + size)
+        pf->readahead_count = 0;
+}
+
 static bool ipf_write_file(pf_context_t* pf, pf_handle_t handle, uint64_t offset, void* buffer,
                            uint32_t size) {
+    ipf_invalidate_readahead(pf, offset, size);
+
     pf_status_t status = g_cb_write(handle, buffer, offset, size);
     if (PF_FAILURE(status)) {
         pf->last_error = status;
@@ -384,6 +480,45 @@ static bool ipf_init_new_file(pf_context_t* pf, const char* path) {
     return true;
 }
 
+// Nodes are allocated and freed all the time on reads of files bigger than the cache, so buffers of
+// evicted nodes are reused. The decrypted part of a pooled buffer is always scrubbed, the encrypted
+// part is overwritten before use.
+static file_node_t* ipf_alloc_node(pf_context_t* pf) {
+    file_node_t* file_node = pf->free_nodes;
+    if (file_node) {
+        pf->free_nodes = file_node->parent;
+        pf->free_nodes_count--;
+        memset(file_node, 0, offsetof(file_node_t, encrypted));
+        return file_node;
+    }
+
+    file_node = calloc(1, sizeof(*file_node));
+    if (!file_node) {
+        pf->last_error = PF_STATUS_NO_MEMORY;
+        return NULL;
+    }
+
+    pf->nodes_count++;
+    if (pf->nodes_count > pf->peak_nodes_count)
+        pf->peak_nodes_count = pf->nodes_count;
+    return file_node;
+}
+
+static void ipf_free_node(pf_context_t* pf, file_node_t* file_node) {
+    // scrub the plaintext data
+    erase_memory(&file_node->decrypted, sizeof(file_node->decrypted));
+
+    if (pf->free_nodes_count < MAX_FREE_NODES) {
+        file_node->parent = pf->free_nodes;
+        pf->free_nodes = file_node;
+        pf->free_nodes_count++;
+        return;
+    }
+
+    free(file_node);
+    pf->nodes_count--;
+}
+
 static bool ipf_close(pf_context_t* pf) {
     void* data;
     bool retval = true;
@@ -408,10 +543,20 @@ static bool ipf_close(pf_context_t* pf) {
         lruc_remove_last(pf->cache);
     }
 
+    while (pf->free_nodes) {
+        file_node_t* file_node = pf->free_nodes;
+        pf->free_nodes = file_node->parent;
+        free(file_node);
+    }
+
+    DEBUG_PF("peak node memory: %lu bytes (%lu nodes)\n",
+             pf->peak_nodes_count * sizeof(file_node_t), pf->peak_nodes_count);
+
     // scrub first MD_USER_DATA_SIZE of file data and the gmac_key
     erase_memory(&pf->encrypted_part_plain, sizeof(pf->encrypted_part_plain));
 
     lruc_destroy(pf->cache);
+    free(pf->readahead_buffer);
 
 #ifdef DEBUG
     free(pf->debug_buffer);
@@ -498,37 +643,71 @@ static void sort_nodes(file_node_t** data, size_t low, size_t high) {
     }
 }
 
+static gcm_crypto_data_t* ipf_data_node_crypto(file_node_t* data_node) {
+    return &data_node->parent->decrypted.mht
+                .data_nodes_crypto[data_node->node_number % ATTACHED_DATA_NODES_COUNT];
+}
+
+struct ipf_encrypt_job {
+    file_node_t** nodes;
+    pf_status_t status; // first failure, if any
+};
+
+// encrypt the data, this also saves the gmac of the operation in the mht crypto node; different
+// data nodes use different keys and write to different parts of their parents, so this is safe to
+// run concurrently for all dirty data nodes
+static void ipf_encrypt_data_node(void* arg, size_t i) {
+    struct ipf_encrypt_job* job = arg;
+    file_node_t* data_node = job->nodes[i];
+    gcm_crypto_data_t* gcm_crypto_data = ipf_data_node_crypto(data_node);
+
+    pf_status_t status = g_cb_aes_gcm_encrypt(&gcm_crypto_data->key, &g_empty_iv, NULL, 0,  // aad
+                                              data_node->decrypted.data.data, PF_NODE_SIZE,
+                                              data_node->encrypted.cipher, &gcm_crypto_data->gmac);
+    if (PF_FAILURE(status)) {
+        pf_status_t expected = PF_STATUS_SUCCESS;
+        __atomic_compare_exchange_n(&job->status, &expected, status, /*weak=*/false,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+}
+
 static bool ipf_update_all_data_and_mht_nodes(pf_context_t* pf) {
     bool ret = false;
+    file_node_t** data_array = NULL;
     file_node_t** mht_array = NULL;
     file_node_t* file_mht_node;
     pf_status_t status;
-    void* data = lruc_get_first(pf->cache);
+    void* data;
 
     // 1. encrypt the changed data
     // 2. set the IV+GMAC in the parent MHT
     // [3. set the need_writing flag for all the parents]
+    size_t dirty_data_count = 0;
+    data = lruc_get_first(pf->cache);
+    while (data != NULL) {
+        if (((file_node_t*)data)->type == FILE_DATA_NODE_TYPE
+                && ((file_node_t*)data)->need_writing)
+            dirty_data_count++;
+        data = lruc_get_next(pf->cache);
+    }
+
+    data_array = malloc(dirty_data_count * sizeof(*data_array));
+    if (dirty_data_count && !data_array) {
+        pf->last_error = PF_STATUS_NO_MEMORY;
+        goto out;
+    }
+
+    // keys are generated on this thread, only encryption itself is done in parallel
+    size_t data_idx = 0;
+    data = lruc_get_first(pf->cache);
     while (data != NULL) {
         if (((file_node_t*)data)->type == FILE_DATA_NODE_TYPE) {
             file_node_t* data_node = (file_node_t*)data;
 
             if (data_node->need_writing) {
-                gcm_crypto_data_t* gcm_crypto_data =
-                    &data_node->parent->decrypted.mht
-                         .data_nodes_crypto[data_node->node_number % ATTACHED_DATA_NODES_COUNT];
-
-                if (!ipf_generate_random_key(pf, &gcm_crypto_data->key))
+                if (!ipf_generate_random_key(pf, &ipf_data_node_crypto(data_node)->key))
                     goto out;
-
-                // encrypt the data, this also saves the gmac of the operation in the mht crypto
-                // node
-                status = g_cb_aes_gcm_encrypt(&gcm_crypto_data->key, &g_empty_iv, NULL, 0,  // aad
-                                              data_node->decrypted.data.data, PF_NODE_SIZE,
-                                              data_node->encrypted.cipher, &gcm_crypto_data->gmac);
-                if (PF_FAILURE(status)) {
-                    pf->last_error = status;
-                    goto out;
-                }
+                data_array[data_idx++] = data_node;
 
                 file_mht_node = data_node->parent;
 #ifdef DEBUG
@@ -543,6 +722,19 @@ static bool ipf_update_all_data_and_mht_nodes(pf_context_t* pf) {
         data = lruc_get_next(pf->cache);
     }
 
+    struct ipf_encrypt_job job = {.nodes = data_array, .status = PF_STATUS_SUCCESS};
+    if (g_cb_parallel && dirty_data_count > 1) {
+        g_cb_parallel(ipf_encrypt_data_node, &job, dirty_data_count);
+    } else {
+        for (data_idx = 0; data_idx < dirty_data_count && PF_SUCCESS(job.status); data_idx++)
+            ipf_encrypt_data_node(&job, data_idx);
+    }
+    if (PF_FAILURE(job.status)) {
+        pf->last_error = job.status;
+        goto out;
+    }
+
+    // the MHT nodes are updated in order, after all the data nodes they cover
     size_t dirty_count = 0;
 
     // count dirty mht nodes
@@ -616,6 +808,7 @@ static bool ipf_update_all_data_and_mht_nodes(pf_context_t* pf) {
     ret = true;
 
 out:
+    free(data_array);
     free(mht_array);
     return ret;
 }
@@ -642,8 +835,81 @@ static bool ipf_update_metadata_node(pf_context_t* pf) {
     return true;
 }
 
+static bool ipf_write_segs(pf_context_t* pf, pf_write_seg_t* segs, size_t count) {
+    // insertion sort by offset, so that adjacent nodes can be merged into one host write
+    for (size_t i = 1; i < count; i++) {
+        pf_write_seg_t seg = segs[i];
+        size_t j = i;
+        for (; j > 0 && segs[j - 1].offset > seg.offset; j--)
+            segs[j] = segs[j - 1];
+        segs[j] = seg;
+    }
+
+    for (size_t i = 0; i < count; i++)
+        ipf_invalidate_readahead(pf, segs[i].offset, segs[i].size);
+
+    pf_status_t status = g_cb_write_vec(pf->file, segs, count);
+    if (PF_FAILURE(status)) {
+        pf->last_error = status;
+        return false;
+    }
+
+    return true;
+}
+
+// writes dirty data and MHT nodes (including the root MHT node) with the vectored callback
+static bool ipf_write_nodes_vec(pf_context_t* pf) {
+    pf_write_seg_t segs[PF_WRITE_VEC_MAX];
+    file_node_t* batch[PF_WRITE_VEC_MAX];
+    size_t count = 0;
+
+    for (void* data = lruc_get_first(pf->cache); data != NULL; data = lruc_get_next(pf->cache)) {
+        file_node_t* file_node = (file_node_t*)data;
+        if (!file_node->need_writing)
+            continue;
+
+        segs[count].buffer = &file_node->encrypted;
+        segs[count].offset = file_node->physical_node_number * PF_NODE_SIZE;
+        segs[count].size   = PF_NODE_SIZE;
+        batch[count] = file_node;
+        count++;
+
+        if (count == PF_WRITE_VEC_MAX) {
+            if (!ipf_write_segs(pf, segs, count))
+                return false;
+
+            for (size_t i = 0; i < count; i++) {
+                batch[i]->need_writing = false;
+                batch[i]->new_node = false;
+            }
+            count = 0;
+        }
+    }
+
+    // root MHT node goes with the last batch
+    segs[count].buffer = &pf->root_mht.encrypted;
+    segs[count].offset = 1 * PF_NODE_SIZE;
+    segs[count].size   = PF_NODE_SIZE;
+
+    if (!ipf_write_segs(pf, segs, count + 1))
+        return false;
+
+    for (size_t i = 0; i < count; i++) {
+        batch[i]->need_writing = false;
+        batch[i]->new_node = false;
+    }
+    return true;
+}
+
 static bool ipf_write_all_changes_to_disk(pf_context_t* pf) {
-    if (pf->encrypted_part_plain.size > MD_USER_DATA_SIZE && pf->root_mht.need_writing) {
+    if (pf->encrypted_part_plain.size > MD_USER_DATA_SIZE && pf->root_mht.need_writing
+            && g_cb_write_vec) {
+        if (!ipf_write_nodes_vec(pf))
+            return false;
+
+        pf->root_mht.need_writing = false;
+        pf->root_mht.new_node = false;
+    } else if (pf->encrypted_part_plain.size > MD_USER_DATA_SIZE && pf->root_mht.need_writing) {
         void* data = NULL;
         uint8_t* data_to_write;
         uint64_t node_number;
@@ -964,7 +1230,7 @@ static file_node_t* ipf_get_data_node(pf_context_t* pf) {
     }
 
     // even if we didn't get the required data_node, we might have read other nodes in the process
-    while (lruc_size(pf->cache) > MAX_PAGES_IN_CACHE) {
+    while (lruc_size(pf->cache) > pf->max_cache_nodes) {
         void* data = lruc_get_last(pf->cache);
         assert(data != NULL);
         // for production -
@@ -976,10 +1242,7 @@ static file_node_t* ipf_get_data_node(pf_context_t* pf) {
         if (!((file_node_t*)data)->need_writing) {
             lruc_remove_last(pf->cache);
 
-            // before deleting the memory, need to scrub the plain secrets
-            file_node_t* file_node = (file_node_t*)data;
-            erase_memory(&file_node->decrypted, sizeof(file_node->decrypted));
-            free(file_node);
+            ipf_free_node(pf, (file_node_t*)data);
         } else {
             if (!ipf_internal_flush(pf)) {
                 // error, can't flush cache, file status changed to error
@@ -1001,11 +1264,9 @@ static file_node_t* ipf_append_data_node(pf_context_t* pf) {
 
     file_node_t* new_file_data_node = NULL;
 
-    new_file_data_node = calloc(1, sizeof(*new_file_data_node));
-    if (!new_file_data_node) {
-        pf->last_error = PF_STATUS_NO_MEMORY;
+    new_file_data_node = ipf_alloc_node(pf);
+    if (!new_file_data_node)
         return NULL;
-    }
 
     new_file_data_node->type = FILE_DATA_NODE_TYPE;
     new_file_data_node->new_node = true;
@@ -1014,7 +1275,7 @@ static file_node_t* ipf_append_data_node(pf_context_t* pf) {
                      &new_file_data_node->physical_node_number);
 
     if (!lruc_add(pf->cache, new_file_data_node->physical_node_number, new_file_data_node)) {
-        free(new_file_data_node);
+        ipf_free_node(pf, new_file_data_node);
         pf->last_error = PF_STATUS_NO_MEMORY;
         return NULL;
     }
@@ -1040,11 +1301,9 @@ static file_node_t* ipf_read_data_node(pf_context_t* pf) {
     if (file_mht_node == NULL) // some error happened
         return NULL;
 
-    file_data_node = calloc(1, sizeof(*file_data_node));
-    if (!file_data_node) {
-        pf->last_error = PF_STATUS_NO_MEMORY;
+    file_data_node = ipf_alloc_node(pf);
+    if (!file_data_node)
         return NULL;
-    }
 
     file_data_node->type = FILE_DATA_NODE_TYPE;
     file_data_node->node_number = data_node_number;
@@ -1053,7 +1312,7 @@ static file_node_t* ipf_read_data_node(pf_context_t* pf) {
 
     if (!ipf_read_node(pf, pf->file, file_data_node->physical_node_number,
                        file_data_node->encrypted.cipher, PF_NODE_SIZE)) {
-        free(file_data_node);
+        ipf_free_node(pf, file_data_node);
         return NULL;
     }
 
@@ -1067,7 +1326,7 @@ static file_node_t* ipf_read_data_node(pf_context_t* pf) {
                                   file_data_node->decrypted.data.data, &gcm_crypto_data->gmac);
 
     if (PF_FAILURE(status)) {
-        free(file_data_node);
+        ipf_free_node(pf, file_data_node);
         pf->last_error = status;
         if (status == PF_STATUS_MAC_MISMATCH)
             pf->file_status = PF_STATUS_CORRUPTED;
@@ -1075,9 +1334,7 @@ static file_node_t* ipf_read_data_node(pf_context_t* pf) {
     }
 
     if (!lruc_add(pf->cache, file_data_node->physical_node_number, file_data_node)) {
-        // scrub the plaintext data
-        erase_memory(&file_data_node->decrypted, sizeof(file_data_node->decrypted));
-        free(file_data_node);
+        ipf_free_node(pf, file_data_node);
         pf->last_error = PF_STATUS_NO_MEMORY;
         return NULL;
     }
@@ -1125,11 +1382,9 @@ static file_node_t* ipf_append_mht_node(pf_context_t* pf, uint64_t mht_node_numb
                                     mht_node_number * (1 + ATTACHED_DATA_NODES_COUNT);
 
     file_node_t* new_file_mht_node = NULL;
-    new_file_mht_node = calloc(1, sizeof(*new_file_mht_node));
-    if (!new_file_mht_node) {
-        pf->last_error = PF_STATUS_NO_MEMORY;
+    new_file_mht_node = ipf_alloc_node(pf);
+    if (!new_file_mht_node)
         return NULL;
-    }
 
     new_file_mht_node->type = FILE_MHT_NODE_TYPE;
     new_file_mht_node->new_node = true;
@@ -1138,7 +1393,7 @@ static file_node_t* ipf_append_mht_node(pf_context_t* pf, uint64_t mht_node_numb
     new_file_mht_node->physical_node_number = physical_node_number;
 
     if (!lruc_add(pf->cache, new_file_mht_node->physical_node_number, new_file_mht_node)) {
-        free(new_file_mht_node);
+        ipf_free_node(pf, new_file_mht_node);
         pf->last_error = PF_STATUS_NO_MEMORY;
         return NULL;
     }
@@ -1166,11 +1421,9 @@ static file_node_t* ipf_read_mht_node(pf_context_t* pf, uint64_t mht_node_number
     if (parent_file_mht_node == NULL) // some error happened
         return NULL;
 
-    file_mht_node = calloc(1, sizeof(*file_mht_node));
-    if (!file_mht_node) {
-        pf->last_error = PF_STATUS_NO_MEMORY;
+    file_mht_node = ipf_alloc_node(pf);
+    if (!file_mht_node)
         return NULL;
-    }
 
     file_mht_node->type                 = FILE_MHT_NODE_TYPE;
     file_mht_node->node_number          = mht_node_number;
@@ -1179,7 +1432,7 @@ static file_node_t* ipf_read_mht_node(pf_context_t* pf, uint64_t mht_node_number
 
     if (!ipf_read_node(pf, pf->file, file_mht_node->physical_node_number,
                        file_mht_node->encrypted.cipher, PF_NODE_SIZE)) {
-        free(file_mht_node);
+        ipf_free_node(pf, file_mht_node);
         return NULL;
     }
 
@@ -1192,7 +1445,7 @@ static file_node_t* ipf_read_mht_node(pf_context_t* pf, uint64_t mht_node_number
                                   file_mht_node->encrypted.cipher, PF_NODE_SIZE,
                                   &file_mht_node->decrypted.mht, &gcm_crypto_data->gmac);
     if (PF_FAILURE(status)) {
-        free(file_mht_node);
+        ipf_free_node(pf, file_mht_node);
         pf->last_error = status;
         if (status == PF_STATUS_MAC_MISMATCH)
             pf->file_status = PF_STATUS_CORRUPTED;
@@ -1200,8 +1453,7 @@ static file_node_t* ipf_read_mht_node(pf_context_t* pf, uint64_t mht_node_number
     }
 
     if (!lruc_add(pf->cache, file_mht_node->physical_node_number, file_mht_node)) {
-        erase_memory(&file_mht_node->decrypted, sizeof(file_mht_node->decrypted));
-        free(file_mht_node);
+        ipf_free_node(pf, file_mht_node);
         pf->last_error = PF_STATUS_NO_MEMORY;
         return NULL;
     }
@@ -1226,6 +1478,14 @@ void pf_set_callbacks(pf_read_f read_f, pf_write_f write_f, pf_truncate_f trunca
     g_initialized = true;
 }
 
+void pf_set_parallel_callback(pf_parallel_f parallel_f) {
+    g_cb_parallel = parallel_f;
+}
+
+void pf_set_write_vec_callback(pf_write_vec_f write_vec_f) {
+    g_cb_write_vec = write_vec_f;
+}
+
 pf_status_t pf_open(pf_handle_t handle, const char* path, uint64_t underlying_size,
                     pf_file_mode_t mode, bool create, const pf_key_t* key, pf_context_t** context) {
     if (!g_initialized)
@@ -1325,6 +1585,86 @@ pf_status_t pf_flush(pf_context_t* pf) {
     return PF_STATUS_SUCCESS;
 }
 
+pf_status_t pf_set_cache_params(pf_context_t* pf, size_t cache_nodes, size_t readahead_nodes) {
+    if (!g_initialized)
+        return PF_STATUS_UNINITIALIZED;
+
+    if (!cache_nodes)
+        return PF_STATUS_INVALID_PARAMETER;
+
+    if (readahead_nodes != pf->max_readahead_nodes) {
+        free(pf->readahead_buffer);
+        pf->readahead_buffer = NULL;
+        pf->readahead_count  = 0;
+        pf->readahead_window = 0;
+    }
+
+    pf->max_cache_nodes     = cache_nodes;
+    pf->max_readahead_nodes = readahead_nodes;
+    return PF_STATUS_SUCCESS;
+}
+
+pf_status_t pf_advise(pf_context_t* pf, uint64_t offset, uint64_t size, pf_advice_t advice) {
+    if (!g_initialized)
+        return PF_STATUS_UNINITIALIZED;
+
+    if (pf->max_readahead_nodes <= 1)
+        return PF_STATUS_SUCCESS; // read-ahead is disabled, nothing to drive
+
+    switch (advice) {
+        case PF_ADVICE_NORMAL:
+            pf->readahead_random = false;
+            pf->readahead_window = 0;
+            return PF_STATUS_SUCCESS;
+        case PF_ADVICE_SEQUENTIAL:
+            pf->readahead_random = false;
+            pf->readahead_window = pf->max_readahead_nodes;
+            return PF_STATUS_SUCCESS;
+        case PF_ADVICE_RANDOM:
+            pf->readahead_random = true;
+            pf->readahead_window = 1;
+            return PF_STATUS_SUCCESS;
+        case PF_ADVICE_WILLNEED:
+        case PF_ADVICE_DONTNEED:
+            break;
+        default:
+            return PF_STATUS_INVALID_PARAMETER;
+    }
+
+    // user data in the metadata node is always at hand, only the following nodes are read ahead
+    uint64_t data_size = pf->encrypted_part_plain.size;
+    uint64_t start = MAX(offset, (uint64_t)MD_USER_DATA_SIZE);
+    uint64_t end = size && size < data_size - MIN(offset, data_size) ? offset + size : data_size;
+    if (start >= end)
+        return PF_STATUS_SUCCESS;
+
+    uint64_t first;
+    uint64_t last;
+    get_node_numbers(start, NULL, NULL, NULL, &first);
+    get_node_numbers(end - 1, NULL, NULL, NULL, &last);
+
+    if (advice == PF_ADVICE_DONTNEED) {
+        ipf_invalidate_readahead(pf, first * PF_NODE_SIZE, (last + 1 - first) * PF_NODE_SIZE);
+        return PF_STATUS_SUCCESS;
+    }
+
+    // nodes not written to the file yet are in the cache anyway
+    uint64_t file_nodes = pf->real_file_size / PF_NODE_SIZE;
+    if (first >= file_nodes)
+        return PF_STATUS_SUCCESS;
+    size_t count = MIN(MIN(last + 1, file_nodes) - first, pf->max_readahead_nodes);
+
+    if (!pf->readahead_buffer) {
+        pf->readahead_buffer = malloc(pf->max_readahead_nodes * PF_NODE_SIZE);
+        if (!pf->readahead_buffer)
+            return PF_STATUS_SUCCESS; // advice may be ignored
+    }
+
+    if (!ipf_fill_readahead(pf, pf->file, first, count))
+        return pf->last_error;
+    return PF_STATUS_SUCCESS;
+}
+
 pf_status_t pf_get_handle(pf_context_t* pf, pf_handle_t* handle) {
     if (!g_initialized)
         return PF_STATUS_UNINITIALIZED;
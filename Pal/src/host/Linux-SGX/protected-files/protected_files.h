@@ -62,6 +62,15 @@ typedef enum _pf_file_mode_t {
     PF_FILE_MODE_WRITE = 2,
 } pf_file_mode_t;
 
+/*! Access advice, see pf_advise() */
+typedef enum _pf_advice_t {
+    PF_ADVICE_NORMAL,
+    PF_ADVICE_SEQUENTIAL,
+    PF_ADVICE_RANDOM,
+    PF_ADVICE_WILLNEED,
+    PF_ADVICE_DONTNEED,
+} pf_advice_t;
+
 /*! Opaque file handle type, interpreted by callbacks as necessary */
 typedef void* pf_handle_t;
 
@@ -178,6 +187,58 @@ void pf_set_callbacks(pf_read_f read_f, pf_write_f write_f, pf_truncate_f trunca
                       pf_aes_gcm_decrypt_f aes_gcm_decrypt_f, pf_random_f random_f,
                       pf_debug_f debug_f);
 
+/*!
+ * \brief Parallel execution callback type
+ *
+ * \param [in] fn Function to run for each item
+ * \param [in] arg Argument passed to \a fn
+ * \param [in] count Number of items
+ *
+ * \details Must call `fn(arg, i)` exactly once for each `i` in [0, count), possibly concurrently
+ *          from several threads, and return only after all of the calls have finished.
+ */
+typedef void (*pf_parallel_f)(void (*fn)(void* arg, size_t i), void* arg, size_t count);
+
+/*!
+ * \brief Set (optional) callback used to encrypt independent nodes in parallel on flush
+ *
+ * \param [in] parallel_f Parallel execution callback, or NULL to encrypt on the calling thread
+ */
+void pf_set_parallel_callback(pf_parallel_f parallel_f);
+
+/*! One segment of a vectored write */
+typedef struct pf_write_seg {
+    const void* buffer;
+    uint64_t offset;
+    size_t size;
+} pf_write_seg_t;
+
+/*!
+ * \brief Vectored file write callback
+ *
+ * \param [in] handle File handle
+ * \param [in] segs Segments to write, sorted by offset and not overlapping
+ * \param [in] count Number of segments, at most PF_WRITE_VEC_MAX
+ * \return PF status
+ *
+ * \details Must write all of the segments; the order in which they reach the file is not defined.
+ */
+typedef pf_status_t (*pf_write_vec_f)(pf_handle_t handle, const pf_write_seg_t* segs,
+                                      size_t count);
+
+/*! Max number of segments passed to pf_write_vec_f at once */
+#define PF_WRITE_VEC_MAX 64
+
+/*!
+ * \brief Set (optional) callback used to write dirty data and MHT nodes on flush
+ *
+ * \param [in] write_vec_f Vectored write callback, or NULL to write each node with pf_write_f
+ *
+ * \details The metadata node, which commits the flush, is always written with pf_write_f after
+ *          all other nodes.
+ */
+void pf_set_write_vec_callback(pf_write_vec_f write_vec_f);
+
 /*! Context representing an open protected file */
 typedef struct pf_context pf_context_t;
 
@@ -258,6 +319,33 @@ pf_status_t pf_get_size(pf_context_t* pf, uint64_t* size);
  */
 pf_status_t pf_set_size(pf_context_t* pf, uint64_t size);
 
+/*!
+ * \brief Set cache parameters of a PF
+ *
+ * \param [in] pf PF context
+ * \param [in] cache_nodes Max number of decrypted nodes kept in cache (at least 1)
+ * \param [in] readahead_nodes Max number of nodes fetched with one read callback when the file
+ *            is read sequentially (0 or 1 disables read-ahead)
+ * \return PF status
+ */
+pf_status_t pf_set_cache_params(pf_context_t* pf, size_t cache_nodes, size_t readahead_nodes);
+
+/*!
+ * \brief Apply access advice to a range of a PF
+ *
+ * \param [in] pf PF context
+ * \param [in] offset Start of the range (user data offset)
+ * \param [in] size Size of the range, 0 means up to the end of file
+ * \param [in] advice Access advice
+ * \return PF status
+ * \details Drives read-ahead of the file (if enabled with pf_set_cache_params()):
+ *          PF_ADVICE_RANDOM stops it, PF_ADVICE_SEQUENTIAL starts it with the full window and
+ *          PF_ADVICE_NORMAL returns to detecting sequential reads. PF_ADVICE_WILLNEED fetches the
+ *          (beginning of the) range with one read callback, PF_ADVICE_DONTNEED drops the fetched
+ *          nodes of the range.
+ */
+pf_status_t pf_advise(pf_context_t* pf, uint64_t offset, uint64_t size, pf_advice_t advice);
+
 /*!
  * \brief Get underlying handle of a PF
  *
@@ -101,7 +101,7 @@ typedef struct _encrypted_node {
 
 static_assert(sizeof(encrypted_node_t) == PF_NODE_SIZE, "sizeof(encrypted_node_t)");
 
-#define MAX_PAGES_IN_CACHE 48
+#define MAX_PAGES_IN_CACHE 48 // default, see pf_set_cache_params()
 
 typedef enum {
     FILE_MHT_NODE_TYPE  = 1,
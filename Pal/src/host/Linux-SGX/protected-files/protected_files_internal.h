@@ -29,11 +29,28 @@ struct pf_context {
     pf_key_t user_kdk_key;
     pf_key_t cur_key;
     lruc_context_t* cache;
+    size_t max_cache_nodes; // max number of decrypted nodes in cache
+    // read-ahead of encrypted nodes on sequential reads, see ipf_read_node()
+    size_t max_readahead_nodes; // 0 if read-ahead is disabled
+    size_t readahead_window; // number of nodes to read ahead at next sequential read
+    bool readahead_random; // PF_ADVICE_RANDOM: no read-ahead on sequential reads
+    uint64_t next_seq_node_number; // physical node number following the last read one
+    uint8_t* readahead_buffer; // nodes [readahead_first, readahead_first + readahead_count)
+    uint64_t readahead_first;
+    size_t readahead_count;
+    // buffers of evicted nodes kept for reuse, linked through `parent`, see ipf_alloc_node()
+    file_node_t* free_nodes;
+    size_t free_nodes_count;
+    size_t nodes_count; // allocated node buffers (cached or in `free_nodes`)
+    size_t peak_nodes_count;
 #ifdef DEBUG
     char* debug_buffer; // buffer for debug output
 #endif
 };
 
+// max number of node buffers kept in the pool of one context
+#define MAX_FREE_NODES 16
+
 /* ipf prefix means "Intel protected files", these are functions from the SGX SDK implementation */
 static bool ipf_init_fields(pf_context_t* pf);
 static bool ipf_init_existing_file(pf_context_t* pf, const char* path);
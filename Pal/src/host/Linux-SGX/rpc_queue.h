@@ -14,7 +14,11 @@
  * To issue a syscall, enclave thread enqueues syscall request in the queue and spins waiting for
  * result. RPC threads spin waiting for syscall requests; when request comes, first lucky RPC
  * thread grabs request, issues syscall to OS, and notifies enclave thread by releasing the request
- * lock. RPC queue is implemented as a FIFO ring buffer with one global lock.
+ * lock. RPC queue is implemented as a lock-free bounded MPMC (multi-producer multi-consumer) FIFO
+ * ring buffer: each slot carries a sequence number that tells producers and consumers whether the
+ * slot is free for the current lap of the ring, so that enqueue and dequeue only need a single
+ * compare-and-swap on the (cache-line-separated) rear/front indexes. This design is due to Dmitry
+ * Vyukov ("Bounded MPMC queue", 1024cores.net).
  *
  * The RPC queue with its ring buffer resides in *untrusted memory*. The enclave code accessing the
  * RPC queue must be carefully written to withstand attacks tampering with the queue.
@@ -25,6 +29,23 @@
  * for some time in hope the system call returns immediately (fast path), then sleeps waiting on
  * futex (slow path, useful for blocking syscalls).
  *
+ * With "sgx.rpc_affinity = \"paired\"" in the manifest, each enclave thread additionally gets its
+ * own single-producer single-consumer channel (see `rpc_channel_t`), served by a fixed RPC thread
+ * that is pinned to a hyperthread sibling of the CPU the enclave thread is pinned to. This keeps
+ * the request's cache lines within one physical core. The shared queue is still used when the
+ * channel is busy and for stealing work from RPC threads blocked in a long syscall.
+ *
+ * With "sgx.rpc_affinity = \"numa\"", the channels are grouped by NUMA node instead: enclave and
+ * RPC threads are split round-robin into one group per NUMA node (limited to the CPUs the process
+ * may run on), all threads of a group are pinned to the CPUs of its node, and each channel is served
+ * by any RPC thread of its group before RPC threads of other nodes steal from it. Enclave threads
+ * thus use RPC threads (and untrusted request memory) on their own node.
+ *
+ * With "sgx.rpc_io_uring = true", an RPC thread does not execute file and socket OCALLs as
+ * synchronous syscalls but submits them to its own host io_uring and goes on serving requests (see
+ * sgx_rpc_uring.c). Blocking OCALLs then do not occupy an RPC thread each, so fewer RPC threads
+ * can serve more enclave threads.
+ *
  * NOTE: number of created RPC threads must match max number of simultaneous enclave threads. If
  * there are more RPC threads, CPU time is wasted. If there are less, some enclave threads may
  * starve, especially if there are many blocking syscalls by other enclave threads.
@@ -44,18 +65,54 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "api.h"
 #include "spinlock.h"
 
-/* Number of iterations to spin before sleeping. We choose 1M as follows: we want to sleep on
- * blocking syscalls but we want to allow ample time for fast syscalls to complete. We choose
+/* Default upper bound on the number of iterations the enclave thread spins before sleeping on a
+ * futex (can be changed via `sgx.rpc_enclave_spin_max`). We choose 1M as follows: we want to sleep
+ * on blocking syscalls but we want to allow ample time for fast syscalls to complete. We choose
  * 1 millisecond -- more than enough time to complete any non-blocking syscall. Assuming a 1GHz
  * CPU and no pipelining (and ignoring the pause instruction), 1 millisecond is 1M cycles. This
  * works well in practice. */
 #define RPC_SPINLOCK_TIMEOUT 1000000
 
-#define RPC_QUEUE_SIZE  1024 /* max # of requests in RPC queue */
+/* Spin budgets of both the enclave thread (waiting for the OCALL result) and the RPC thread
+ * (waiting for the next request) adapt to the recently observed waits: each thread keeps an
+ * exponentially weighted moving average (EWMA) of the number of iterations it had to spin and
+ * spins for at most `RPC_SPIN_MIN + 2 * average`, capped by the manifest-provided maximum. The
+ * average gives weight 1/2^RPC_SPIN_EWMA_SHIFT to each new sample. */
+#define RPC_SPIN_MIN        1000
+#define RPC_SPIN_EWMA_SHIFT 3
+
+/* Default bounds for RPC threads (can be changed via `sgx.rpc_thread_spin_max` and
+ * `sgx.rpc_thread_sleep_max`): max number of idle spins before going to sleep and max sleep time
+ * in microseconds (sleep time grows in RPC_SLEEP_STEPS steps up to the max) */
+#define RPC_THREAD_SPIN_MAX  10000
+#define RPC_THREAD_SLEEP_MAX 100000
+#define RPC_SLEEP_STEPS      100
+
+static inline uint64_t rpc_spin_budget(uint64_t estimate, uint64_t spin_max) {
+    uint64_t budget = RPC_SPIN_MIN + 2 * estimate;
+    return budget < spin_max ? budget : spin_max;
+}
+
+static inline uint64_t rpc_spin_estimate_update(uint64_t estimate, uint64_t sample) {
+    /* written to avoid unsigned underflow when the sample is less than the estimate */
+    return estimate - (estimate >> RPC_SPIN_EWMA_SHIFT) + (sample >> RPC_SPIN_EWMA_SHIFT);
+}
+
+#define RPC_QUEUE_SIZE  1024 /* max # of requests in RPC queue, must be a power of two */
 #define MAX_RPC_THREADS 256  /* max number of RPC threads */
 
+/* Max number of attempts of the enclave thread to claim a slot in rpc_enqueue(). The queue lives in
+ * untrusted memory, so the host may tamper with the sequence numbers to make the enclave spin
+ * forever; after this many failed attempts the enclave thread gives up and the OCALL falls back to
+ * the normal enclave-exit path. */
+#define RPC_ENQUEUE_ATTEMPTS_MAX 1024
+
+static_assert(RPC_QUEUE_SIZE && (RPC_QUEUE_SIZE & (RPC_QUEUE_SIZE - 1)) == 0,
+              "RPC_QUEUE_SIZE must be a power of two");
+
 typedef struct {
     spinlock_t lock; /* can be UNLOCKED / LOCKED_NO_WAITERS / LOCKED_WITH_WAITERS */
     long result;
@@ -63,22 +120,91 @@ typedef struct {
     void* buffer;
 } rpc_request_t;
 
+typedef struct {
+    uint64_t sequence;  /* lap counter of this slot, see rpc_enqueue()/rpc_dequeue() */
+    rpc_request_t* req; /* syscall request stored in this slot */
+} rpc_slot_t;
+
+/* Per-enclave-thread channel of "paired" and "numa" modes. Enclave threads issue at most one
+ * synchronous OCALL at a time, so the channel holds a single request (or NULL if empty). */
+typedef struct {
+    __attribute__((aligned(CACHE_LINE_SIZE))) rpc_request_t* req;
+} rpc_channel_t;
+
 typedef struct rpc_queue {
-    spinlock_t lock;                  /* global lock for enclave and RPC threads */
-    uint64_t front, rear;             /* indexes into front and rear ends of q */
-    rpc_request_t* q[RPC_QUEUE_SIZE]; /* queue of syscall requests */
+    /* indexes into rear and front ends of q; each one is on its own cache line so that producers
+     * (enclave threads) and consumers (RPC threads) do not bounce the same line */
+    __attribute__((aligned(CACHE_LINE_SIZE))) uint64_t rear;
+    __attribute__((aligned(CACHE_LINE_SIZE))) uint64_t front;
+    __attribute__((aligned(CACHE_LINE_SIZE))) rpc_slot_t q[RPC_QUEUE_SIZE]; /* queue of requests */
     int rpc_threads[MAX_RPC_THREADS]; /* RPC threads (thread IDs) */
     size_t rpc_threads_cnt;           /* number of RPC threads */
+    rpc_channel_t* channels;          /* per-enclave-thread channels, NULL in "shared" mode */
+    size_t channels_cnt;              /* number of channels (equal to number of enclave threads) */
 } rpc_queue_t;
 
 extern rpc_queue_t* g_rpc_queue;  /* global RPC queue */
 
+#ifdef IN_ENCLAVE
+extern rpc_channel_t* g_rpc_channels; /* per-thread channels (verified copy) */
+extern size_t g_rpc_channels_cnt;
+extern uint64_t g_rpc_enclave_spin_max; /* from `sgx.rpc_enclave_spin_max` */
+#else
+/* host io_uring of an RPC thread, see `sgx.rpc_io_uring` (sgx_rpc_uring.c) */
+struct rpc_uring;
+struct rpc_uring* rpc_uring_create(void);
+/* Queues OCALL `req` (received at TSC `tsc`); returns false if it must be executed synchronously */
+bool rpc_uring_queue(struct rpc_uring* ring, rpc_request_t* req, uint64_t tsc);
+/* Submits the queued OCALLs (and cancellations of the ones interrupted by signals) to the host */
+int rpc_uring_flush(struct rpc_uring* ring);
+/* Returns the next completed OCALL with its result set, or NULL if none */
+rpc_request_t* rpc_uring_reap(struct rpc_uring* ring, uint64_t* out_ocall_index,
+                              uint64_t* out_submit_tsc);
+uint32_t rpc_uring_inflight(struct rpc_uring* ring);
+/* Waits for a completion for at most `timeout_ns` nanoseconds (or until a signal arrives) */
+void rpc_uring_wait(struct rpc_uring* ring, uint64_t timeout_ns);
+#endif
+
 static inline void rpc_queue_init(rpc_queue_t* q) {
-    spinlock_init(&q->lock);
     q->front = 0;
     q->rear  = 0;
-    for (size_t i = 0; i < RPC_QUEUE_SIZE; i++)
-        q->q[i] = NULL;
+    for (size_t i = 0; i < RPC_QUEUE_SIZE; i++) {
+        q->q[i].sequence = i;
+        q->q[i].req      = NULL;
+    }
+    q->channels     = NULL;
+    q->channels_cnt = 0;
+}
+
+/* Channel of the enclave thread bound to the TCS at `tcs_offset` (relative to enclave base). TCS
+ * pages are contiguous, so this is a one-to-one mapping as long as `channels_cnt` is not less than
+ * the number of TCSs. Used by both enclave and untrusted code so that they agree on the pairing. */
+static inline size_t rpc_channel_index(uint64_t tcs_offset, size_t channels_cnt) {
+    return (tcs_offset / PAGE_SIZE) % channels_cnt;
+}
+
+/*!
+ * \brief Put OCALL request `req` in the per-thread channel `ch`.
+ *
+ * Called from the enclave code; `ch` is in untrusted memory, but a tampered channel can only make
+ * this function fail, in which case the caller falls back to the shared queue.
+ */
+static inline bool rpc_channel_push(rpc_channel_t* ch, rpc_request_t* req) {
+    rpc_request_t* expected = NULL;
+    return __atomic_compare_exchange_n(&ch->req, &expected, req, /*weak=*/false, __ATOMIC_RELEASE,
+                                       __ATOMIC_RELAXED);
+}
+
+/*!
+ * \brief Take OCALL request from the per-thread channel `ch`, or return NULL if it is empty.
+ *
+ * Called only from the untrusted code. Several RPC threads may race on the same channel (the
+ * owner and the ones stealing work), so the request is taken with an exchange.
+ */
+static inline rpc_request_t* rpc_channel_pop(rpc_channel_t* ch) {
+    if (!__atomic_load_n(&ch->req, __ATOMIC_RELAXED))
+        return NULL;
+    return __atomic_exchange_n(&ch->req, NULL, __ATOMIC_ACQUIRE);
 }
 
 /*!
@@ -88,65 +214,76 @@ static inline void rpc_queue_init(rpc_queue_t* q) {
  * attacks tampering with untrusted `req` and untrusted `q`. In particular, `req` and `q` must not
  * have arbitrary pointers (or alternatively the code below must sanitize possible pointer values)
  * to prevent arbitrary writes to/reads from the enclave memory. Similarly, `q->q[idx]` code must
- * ensure that `idx` points inside the `q->q` array to prevent buffer overflows.
+ * ensure that `idx` points inside the `q->q` array to prevent buffer overflows. Finally, tampered
+ * sequence numbers must not make the enclave thread loop forever, so the number of attempts is
+ * bounded by RPC_ENQUEUE_ATTEMPTS_MAX.
+ *
+ * Slot `rear % RPC_QUEUE_SIZE` is free for the producer at position `rear` iff its sequence number
+ * equals `rear`. After storing the request, the producer publishes it by setting the sequence
+ * number to `rear + 1`.
  */
 static inline bool rpc_enqueue(rpc_queue_t* q, rpc_request_t* req) {
-    bool ret = false;
-    spinlock_lock(&q->lock);
+    uint64_t pos = __atomic_load_n(&q->rear, __ATOMIC_RELAXED);
 
-    if (q->rear - q->front >= RPC_QUEUE_SIZE) {
-        /* queue is full, cannot enqueue */
-        goto out;
-    }
+    for (size_t attempt = 0; attempt < RPC_ENQUEUE_ATTEMPTS_MAX; attempt++) {
+        rpc_slot_t* slot = &q->q[pos % RPC_QUEUE_SIZE];
+        uint64_t seq = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t)(seq - pos);
 
-    if (q->q[q->rear % RPC_QUEUE_SIZE]) {
-        /* current slot is occupied, cannot enqueue but the caller can try again */
-        q->rear++;
-        goto out;
+        if (diff == 0) {
+            /* slot is free for this lap, try to claim it; on failure `pos` is reloaded */
+            if (__atomic_compare_exchange_n(&q->rear, &pos, pos + 1, /*weak=*/true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                __atomic_store_n(&slot->req, req, __ATOMIC_RELAXED);
+                __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+        } else if (diff < 0) {
+            /* slot still holds a request from the previous lap: queue is full, cannot enqueue */
+            return false;
+        } else {
+            /* another producer claimed this slot, retry with the new rear */
+            pos = __atomic_load_n(&q->rear, __ATOMIC_RELAXED);
+        }
+        CPU_RELAX();
     }
 
-    q->q[q->rear % RPC_QUEUE_SIZE] = req;
-    q->rear++;
-    ret = true;
-out:
-    spinlock_unlock(&q->lock);
-    return ret;
+    return false;
 }
 
 /*!
  * \brief Dequeue OCALL request `req` from the shared RPC queue `q`.
  *
  * This function is called only from the untrusted code and thus has no security implications.
+ *
+ * Slot `front % RPC_QUEUE_SIZE` holds a request for the consumer at position `front` iff its
+ * sequence number equals `front + 1`. After taking the request, the consumer frees the slot for the
+ * next lap by setting the sequence number to `front + RPC_QUEUE_SIZE`.
  */
 static inline rpc_request_t* rpc_dequeue(rpc_queue_t* q) {
-    if (__atomic_load_n(&q->front, __ATOMIC_RELAXED) ==
-            __atomic_load_n(&q->rear,  __ATOMIC_RELAXED)) {
-        /* quick check that queue is empty; this doesn't acquire a spinlock and thus lowers latency
-         * on rpc_enqueue() performed by enclave threads (they don't have to wait for spinlock
-         * release); note that untrusted RPC threads will simply retry again if this check fails */
-        return NULL;
-    }
-
-    rpc_request_t* ret = NULL;
-    spinlock_lock(&q->lock);
+    uint64_t pos = __atomic_load_n(&q->front, __ATOMIC_RELAXED);
 
-    if (q->front == q->rear) {
-        /* queue is empty, nothing to dequeue */
-        goto out;
-    }
+    while (true) {
+        rpc_slot_t* slot = &q->q[pos % RPC_QUEUE_SIZE];
+        uint64_t seq = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t)(seq - (pos + 1));
 
-    if (!q->q[q->front % RPC_QUEUE_SIZE]) {
-        /* current slot is empty, cannot dequeue but the caller can try next one */
-        q->front++;
-        goto out;
+        if (diff == 0) {
+            /* slot is published for this lap, try to claim it; on failure `pos` is reloaded */
+            if (__atomic_compare_exchange_n(&q->front, &pos, pos + 1, /*weak=*/true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                rpc_request_t* req = __atomic_load_n(&slot->req, __ATOMIC_RELAXED);
+                __atomic_store_n(&slot->sequence, pos + RPC_QUEUE_SIZE, __ATOMIC_RELEASE);
+                return req;
+            }
+        } else if (diff < 0) {
+            /* queue is empty, nothing to dequeue */
+            return NULL;
+        } else {
+            /* another consumer took this slot, retry with the new front */
+            pos = __atomic_load_n(&q->front, __ATOMIC_RELAXED);
+        }
     }
-
-    ret = q->q[q->front % RPC_QUEUE_SIZE];
-    q->q[q->front % RPC_QUEUE_SIZE] = NULL;
-    q->front++;
-out:
-    spinlock_unlock(&q->lock);
-    return ret;
 }
 
 #endif /* QUEUE_H_ */
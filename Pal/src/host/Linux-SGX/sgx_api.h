@@ -20,6 +20,18 @@ void sgx_reset_ustack(const void* old_ustack);
 bool sgx_copy_ptr_to_enclave(void** ptr, void* uptr, size_t size);
 bool sgx_copy_to_enclave(void* ptr, size_t maxsize, const void* uptr, size_t usize);
 
+/* Copies of at least this size out of the enclave use non-temporal stores, so that data which the
+ * enclave doesn't read again doesn't evict its working set from the cache. */
+#define SGX_COPY_NT_THRESHOLD (256 * 1024)
+
+/*!
+ * \brief Copy `size` bytes from `ptr` inside of the enclave to `uptr` outside of it.
+ *
+ * Returns false (and copies nothing) if any of the buffers is not completely inside/outside of the
+ * enclave, so callers don't need to check them separately.
+ */
+bool sgx_copy_from_enclave(void* uptr, const void* ptr, size_t size);
+
 /*!
  * \brief Low-level wrapper around EREPORT instruction leaf.
  *
@@ -50,4 +62,32 @@ static inline int64_t sgx_getkey(sgx_key_request_t* keyrequest, sgx_key_128bit_t
     return rax;
 }
 
+/*!
+ * \brief Low-level wrapper around EACCEPT instruction leaf (SGX2).
+ *
+ * Caller is responsible for parameter alignment: 64B for `secinfo` and page size for `addr`.
+ * Returns 0 on success and SGX error code on failure.
+ */
+static inline int64_t sgx_accept(sgx_arch_sec_info_t* secinfo, const void* addr) {
+    int64_t rax = EACCEPT;
+    __asm__ volatile(
+        ENCLU "\n"
+        : "+a"(rax)
+        : "b"(secinfo), "c"(addr)
+        : "memory");
+    return rax;
+}
+
+/*!
+ * \brief Low-level wrapper around EMODPE instruction leaf (SGX2).
+ *
+ * Caller is responsible for parameter alignment: 64B for `secinfo` and page size for `addr`.
+ */
+static inline void sgx_modpe(sgx_arch_sec_info_t* secinfo, const void* addr) {
+    __asm__ volatile(
+        ENCLU "\n"
+        :: "a"(EMODPE), "b"(secinfo), "c"(addr)
+        : "memory");
+}
+
 #endif /* SGX_API_H */
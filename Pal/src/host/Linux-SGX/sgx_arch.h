@@ -176,6 +176,13 @@ typedef struct {
     uint32_t valid : 1;
 } sgx_arch_exit_info_t;
 
+/* EXINFO part of the SSA MISC region, located right below GPRSGX (with MISCSELECT.EXINFO) */
+typedef struct {
+    uint64_t maddr; /* faulting address of #PF (lower 12 bits cleared) */
+    uint32_t errcd; /* #PF/#GP error code */
+    uint32_t reserved;
+} sgx_arch_exinfo_t;
+
 #define SGX_EXCEPTION_HARDWARE 3UL
 #define SGX_EXCEPTION_SOFTWARE 6UL
 
@@ -184,6 +191,8 @@ typedef struct {
 #define SGX_EXCEPTION_VECTOR_BP 3UL  /* INT 3 instruction */
 #define SGX_EXCEPTION_VECTOR_BR 5UL  /* BOUND instruction */
 #define SGX_EXCEPTION_VECTOR_UD 6UL  /* UD2 instruction or reserved opcodes */
+#define SGX_EXCEPTION_VECTOR_GP 13UL /* General protection (reported only with EXINFO) */
+#define SGX_EXCEPTION_VECTOR_PF 14UL /* Page fault (reported only with EXINFO) */
 #define SGX_EXCEPTION_VECTOR_MF 16UL /* x87 FPU floating-point or WAIT/FWAIT instruction */
 #define SGX_EXCEPTION_VECTOR_AC 17UL /* Any data reference in memory */
 #define SGX_EXCEPTION_VECTOR_XM 19UL /* Any SIMD floating-point exceptions */
@@ -200,12 +209,19 @@ typedef struct {
     uint64_t reserved[7];
 } sgx_arch_sec_info_t;
 
-#define SGX_SECINFO_FLAGS_R    0x001
-#define SGX_SECINFO_FLAGS_W    0x002
-#define SGX_SECINFO_FLAGS_X    0x004
-#define SGX_SECINFO_FLAGS_SECS 0x000
-#define SGX_SECINFO_FLAGS_TCS  0x100
-#define SGX_SECINFO_FLAGS_REG  0x200
+#define SGX_SECINFO_FLAGS_R        0x001
+#define SGX_SECINFO_FLAGS_W        0x002
+#define SGX_SECINFO_FLAGS_X        0x004
+#define SGX_SECINFO_FLAGS_PENDING  0x008
+#define SGX_SECINFO_FLAGS_MODIFIED 0x010
+#define SGX_SECINFO_FLAGS_SECS     0x000
+#define SGX_SECINFO_FLAGS_TCS      0x100
+#define SGX_SECINFO_FLAGS_REG      0x200
+#define SGX_SECINFO_FLAGS_TRIM     0x400
+
+/* page types for SGX_IOC_ENCLAVE_MODIFY_TYPES ioctl, i.e., SGX_SECINFO_FLAGS_* >> 8 */
+#define SGX_PAGE_TYPE_TCS  1
+#define SGX_PAGE_TYPE_TRIM 4
 
 typedef struct _css_header_t {
     uint8_t  header[12];
@@ -365,6 +381,8 @@ typedef uint8_t sgx_key_128bit_t[16];
 #define EREPORT 0
 #define EGETKEY 1
 #define EEXIT   4
+#define EACCEPT 5
+#define EMODPE  6
 
 #define LAUNCH_KEY         0
 #define PROVISION_KEY      1
@@ -7,6 +7,7 @@
 #include <asm/ioctls.h>
 #include <asm/mman.h>
 #include <asm/socket.h>
+#include <linux/eventpoll.h>
 #include <linux/fs.h>
 #include <linux/futex.h>
 #include <linux/in.h>
@@ -18,6 +19,7 @@
 #include "cpu.h"
 #include "debug_map.h"
 #include "ecall_types.h"
+#include "hex.h"
 #include "linux_utils.h"
 #include "ocall_types.h"
 #include "pal_linux_error.h"
@@ -27,6 +29,7 @@
 #include "sgx_log.h"
 #include "sgx_tls.h"
 #include "sigset.h"
+#include "topo_info.h"
 
 #define ODEBUG(code, ms) \
     do {                 \
@@ -56,6 +59,9 @@ static long sgx_ocall_exit(void* pms) {
     block_async_signals(true);
     ecall_thread_reset();
 
+    /* keep the host thread and its TCS for a later thread if possible (doesn't return then) */
+    thread_pool_park();
+
     unmap_tcs();
 
     if (!current_enclave_thread_cnt()) {
@@ -155,6 +161,84 @@ static long sgx_ocall_pwrite(void* pms) {
     return ret;
 }
 
+static long sgx_ocall_pwritev(void* pms) {
+    ms_ocall_pwritev_t* ms = (ms_ocall_pwritev_t*)pms;
+    ODEBUG(OCALL_PWRITEV, ms);
+
+    if (ms->ms_count > OCALL_PWRITEV_MAX)
+        return -EINVAL;
+
+    /* returns the number of bytes written from the beginning of the segment list, or an error if
+     * nothing was written */
+    struct iovec iov[OCALL_PWRITEV_MAX];
+    long total = 0;
+    size_t i = 0;
+    while (i < ms->ms_count) {
+        struct ocall_pwritev_seg* first = &ms->ms_segs[i];
+        off_t end = first->offset;
+        size_t run_size = 0;
+        int iovcnt = 0;
+        while (i < ms->ms_count && ms->ms_segs[i].offset == end) {
+            iov[iovcnt].iov_base = (void*)ms->ms_segs[i].buf;
+            iov[iovcnt].iov_len  = ms->ms_segs[i].count;
+            end += ms->ms_segs[i].count;
+            run_size += ms->ms_segs[i].count;
+            iovcnt++;
+            i++;
+        }
+
+        long ret = INLINE_SYSCALL(pwritev, 5, ms->ms_fd, iov, iovcnt, first->offset, 0);
+        if (ret < 0)
+            return total ?: ret;
+        total += ret;
+        if ((size_t)ret != run_size)
+            break;
+    }
+    return total;
+}
+
+static long sgx_ocall_readv(void* pms) {
+    ms_ocall_readv_t* ms = (ms_ocall_readv_t*)pms;
+    ODEBUG(OCALL_READV, ms);
+
+    if (ms->ms_iovcnt > OCALL_IOV_MAX)
+        return -EINVAL;
+
+    if (ms->ms_offset < 0)
+        return INLINE_SYSCALL(readv, 3, ms->ms_fd, ms->ms_iov, ms->ms_iovcnt);
+    return INLINE_SYSCALL(preadv, 5, ms->ms_fd, ms->ms_iov, ms->ms_iovcnt, ms->ms_offset, 0);
+}
+
+static long sgx_ocall_writev(void* pms) {
+    ms_ocall_writev_t* ms = (ms_ocall_writev_t*)pms;
+    ODEBUG(OCALL_WRITEV, ms);
+
+    if (ms->ms_iovcnt > OCALL_IOV_MAX)
+        return -EINVAL;
+
+    if (ms->ms_offset < 0)
+        return INLINE_SYSCALL(writev, 3, ms->ms_fd, ms->ms_iov, ms->ms_iovcnt);
+    return INLINE_SYSCALL(pwritev, 5, ms->ms_fd, ms->ms_iov, ms->ms_iovcnt, ms->ms_offset, 0);
+}
+
+static long sgx_ocall_sendfile(void* pms) {
+    ms_ocall_sendfile_t* ms = (ms_ocall_sendfile_t*)pms;
+    ODEBUG(OCALL_SENDFILE, ms);
+
+    off_t offset = ms->ms_offset;
+    return INLINE_SYSCALL(sendfile, 4, ms->ms_out_fd, ms->ms_in_fd, &offset, ms->ms_count);
+}
+
+static long sgx_ocall_copy_file_range(void* pms) {
+    ms_ocall_copy_file_range_t* ms = (ms_ocall_copy_file_range_t*)pms;
+    ODEBUG(OCALL_COPY_FILE_RANGE, ms);
+
+    off_t off_in  = ms->ms_off_in;
+    off_t off_out = ms->ms_off_out;
+    return INLINE_SYSCALL(copy_file_range, 6, ms->ms_fd_in, &off_in, ms->ms_fd_out, &off_out,
+                          ms->ms_count, 0);
+}
+
 static long sgx_ocall_fstat(void* pms) {
     ms_ocall_fstat_t* ms = (ms_ocall_fstat_t*)pms;
     long ret;
@@ -217,6 +301,18 @@ static long sgx_ocall_ftruncate(void* pms) {
     return ret;
 }
 
+static long sgx_ocall_fallocate(void* pms) {
+    ms_ocall_fallocate_t* ms = (ms_ocall_fallocate_t*)pms;
+    ODEBUG(OCALL_FALLOCATE, ms);
+    return INLINE_SYSCALL(fallocate, 4, ms->ms_fd, ms->ms_mode, ms->ms_offset, ms->ms_length);
+}
+
+static long sgx_ocall_fadvise(void* pms) {
+    ms_ocall_fadvise_t* ms = (ms_ocall_fadvise_t*)pms;
+    ODEBUG(OCALL_FADVISE, ms);
+    return INLINE_SYSCALL(fadvise64, 4, ms->ms_fd, ms->ms_offset, ms->ms_length, ms->ms_advice);
+}
+
 static long sgx_ocall_mkdir(void* pms) {
     ms_ocall_mkdir_t* ms = (ms_ocall_mkdir_t*)pms;
     long ret;
@@ -267,9 +363,13 @@ static long sgx_ocall_sched_getaffinity(void* pms) {
 }
 
 static long sgx_ocall_clone_thread(void* pms) {
-    __UNUSED(pms);
     ODEBUG(OCALL_CLONE_THREAD, pms);
-    return clone_thread();
+    /* `pms` is NULL or a TCS dynamically added by the enclave (with EDMM) for the new thread */
+    if (pms && ((uintptr_t)pms < g_pal_enclave.baseaddr
+                || (uintptr_t)pms >= g_pal_enclave.baseaddr + g_pal_enclave.size
+                || !IS_ALIGNED_PTR(pms, g_page_size)))
+        return -EINVAL;
+    return clone_thread(pms);
 }
 
 static long sgx_ocall_create_process(void* pms) {
@@ -371,6 +471,15 @@ static long sgx_ocall_listen(void* pms) {
     if (ret < 0)
         goto err_fd;
 
+    if (ms->ms_reuseport) {
+        /* like IPV6_V6ONLY, SO_REUSEPORT can only be set before first bind */
+        int reuseport = 1;
+        ret = INLINE_SYSCALL(setsockopt, 5, fd, SOL_SOCKET, SO_REUSEPORT, &reuseport,
+                             sizeof(reuseport));
+        if (ret < 0)
+            goto err_fd;
+    }
+
     if (ms->ms_domain == AF_INET6) {
         /* IPV6_V6ONLY socket option can only be set before first bind */
         ret = INLINE_SYSCALL(setsockopt, 5, fd, IPPROTO_IPV6, IPV6_V6ONLY, &ms->ms_ipv6_v6only,
@@ -439,6 +548,54 @@ err:
     return ret;
 }
 
+/* Accepts up to `ms_count` connections waiting in the backlog (blocks only for the first one if the
+ * listening socket is blocking, but the enclave uses this OCALL only for non-blocking ones). The
+ * enclave queues the extra connections; `ms_efd` is an event FD which the enclave polls together
+ * with the listening socket, so it is signaled here when extra connections were accepted and
+ * cleared when the enclave asks for more (i.e., when its queue is empty). */
+static long sgx_ocall_accept_multi(void* pms) {
+    ms_ocall_accept_multi_t* ms = (ms_ocall_accept_multi_t*)pms;
+    long ret = 0;
+    ODEBUG(OCALL_ACCEPT_MULTI, ms);
+
+    if (ms->ms_count > OCALL_ACCEPT_MAX)
+        return -EINVAL;
+
+    if (ms->ms_efd >= 0) {
+        uint64_t val;
+        INLINE_SYSCALL(read, 3, ms->ms_efd, &val, sizeof(val));
+    }
+
+    unsigned int count = 0;
+    while (count < ms->ms_count) {
+        struct ocall_accepted* conn = &ms->ms_conns[count];
+        int addrlen = sizeof(conn->addr);
+        ret = INLINE_SYSCALL(accept4, 4, ms->ms_sockfd, &conn->addr, &addrlen, O_CLOEXEC);
+        if (ret < 0)
+            break;
+
+        int fd = ret;
+        ret = sock_getopt(fd, &conn->sockopt);
+        if (ret < 0) {
+            INLINE_SYSCALL(close, 1, fd);
+            break;
+        }
+
+        conn->fd = fd;
+        conn->addrlen = addrlen;
+        count++;
+    }
+
+    if (!count)
+        return ret;
+
+    if (count > 1 && ms->ms_efd >= 0) {
+        uint64_t val = 1;
+        INLINE_SYSCALL(write, 3, ms->ms_efd, &val, sizeof(val));
+    }
+    return count;
+}
+
 static long sgx_ocall_connect(void* pms) {
     ms_ocall_connect_t* ms = (ms_ocall_connect_t*)pms;
     long ret;
@@ -575,6 +732,58 @@ static long sgx_ocall_send(void* pms) {
     return ret;
 }
 
+static long sgx_ocall_mmsg(ms_ocall_mmsg_t* ms, bool is_send) {
+    unsigned int vlen = ms->ms_vlen;
+    if (!vlen || vlen > OCALL_MMSG_MAX)
+        return -EINVAL;
+
+    struct mmsghdr hdrs[OCALL_MMSG_MAX];
+    struct iovec iovs[OCALL_MMSG_MAX];
+    for (unsigned int i = 0; i < vlen; i++) {
+        struct ocall_mmsg* msg = &ms->ms_msgs[i];
+        if (msg->addr && msg->addrlen > INT_MAX)
+            return -EINVAL;
+
+        iovs[i].iov_base = msg->buf;
+        iovs[i].iov_len  = msg->len;
+        hdrs[i].msg_hdr.msg_name       = msg->addr;
+        hdrs[i].msg_hdr.msg_namelen    = msg->addr ? msg->addrlen : 0;
+        hdrs[i].msg_hdr.msg_iov        = &iovs[i];
+        hdrs[i].msg_hdr.msg_iovlen     = 1;
+        hdrs[i].msg_hdr.msg_control    = NULL;
+        hdrs[i].msg_hdr.msg_controllen = 0;
+        hdrs[i].msg_hdr.msg_flags      = 0;
+        hdrs[i].msg_len = 0;
+    }
+
+    long ret;
+    if (is_send) {
+        ret = INLINE_SYSCALL(sendmmsg, 4, ms->ms_sockfd, hdrs, vlen, MSG_NOSIGNAL);
+    } else {
+        /* same as a single recv, block only until the first message */
+        ret = INLINE_SYSCALL(recvmmsg, 5, ms->ms_sockfd, hdrs, vlen, MSG_WAITFORONE, NULL);
+    }
+
+    for (long i = 0; i < ret; i++) {
+        ms->ms_msgs[i].msg_len = hdrs[i].msg_len;
+        if (!is_send)
+            ms->ms_msgs[i].addrlen = hdrs[i].msg_hdr.msg_namelen;
+    }
+    return ret;
+}
+
+static long sgx_ocall_recvmmsg(void* pms) {
+    ms_ocall_mmsg_t* ms = (ms_ocall_mmsg_t*)pms;
+    ODEBUG(OCALL_RECVMMSG, ms);
+    return sgx_ocall_mmsg(ms, /*is_send=*/false);
+}
+
+static long sgx_ocall_sendmmsg(void* pms) {
+    ms_ocall_mmsg_t* ms = (ms_ocall_mmsg_t*)pms;
+    ODEBUG(OCALL_SENDMMSG, ms);
+    return sgx_ocall_mmsg(ms, /*is_send=*/true);
+}
+
 static long sgx_ocall_setsockopt(void* pms) {
     ms_ocall_setsockopt_t* ms = (ms_ocall_setsockopt_t*)pms;
     long ret;
@@ -624,6 +833,27 @@ static long sgx_ocall_poll(void* pms) {
     return ret;
 }
 
+static long sgx_ocall_epoll_create(void* pms) {
+    __UNUSED(pms);
+    ODEBUG(OCALL_EPOLL_CREATE, NULL);
+    return INLINE_SYSCALL(epoll_create1, 1, EPOLL_CLOEXEC);
+}
+
+static long sgx_ocall_epoll_ctl(void* pms) {
+    ms_ocall_epoll_ctl_t* ms = (ms_ocall_epoll_ctl_t*)pms;
+    ODEBUG(OCALL_EPOLL_CTL, ms);
+    return INLINE_SYSCALL(epoll_ctl, 4, ms->ms_epfd, ms->ms_op, ms->ms_fd, &ms->ms_event);
+}
+
+static long sgx_ocall_epoll_wait(void* pms) {
+    ms_ocall_epoll_wait_t* ms = (ms_ocall_epoll_wait_t*)pms;
+    ODEBUG(OCALL_EPOLL_WAIT, ms);
+    /* epoll_wait() has only millisecond granularity, round up so that we never wake up early */
+    int timeout_ms = ms->ms_timeout_us < 0 ? -1 : (int)((ms->ms_timeout_us + 999) / 1000);
+    return INLINE_SYSCALL(epoll_wait, 4, ms->ms_epfd, ms->ms_events, ms->ms_maxevents,
+                          timeout_ms);
+}
+
 static long sgx_ocall_rename(void* pms) {
     ms_ocall_rename_t* ms = (ms_ocall_rename_t*)pms;
     long ret;
@@ -690,6 +920,54 @@ static long sgx_ocall_get_quote(void* pms) {
                           &ms->ms_nonce, &ms->ms_quote, &ms->ms_quote_len);
 }
 
+static long sgx_ocall_edmm_trim_pages(void* pms) {
+    ms_ocall_edmm_pages_t* ms = (ms_ocall_edmm_pages_t*)pms;
+    ODEBUG(OCALL_EDMM_TRIM_PAGES, ms);
+    return trim_enclave_pages(ms->ms_addr, ms->ms_size);
+}
+
+static long sgx_ocall_edmm_remove_pages(void* pms) {
+    ms_ocall_edmm_pages_t* ms = (ms_ocall_edmm_pages_t*)pms;
+    ODEBUG(OCALL_EDMM_REMOVE_PAGES, ms);
+    return remove_enclave_pages(ms->ms_addr, ms->ms_size);
+}
+
+static long sgx_ocall_edmm_convert_tcs(void* pms) {
+    ms_ocall_edmm_pages_t* ms = (ms_ocall_edmm_pages_t*)pms;
+    ODEBUG(OCALL_EDMM_CONVERT_TCS, ms);
+    return convert_enclave_pages_to_tcs(ms->ms_addr, ms->ms_size);
+}
+
+/* only OCALLs that neither change the control flow of the enclave thread nor block for long can be
+ * part of a batch; the enclave batches only closes (see ocall_close_batch()) */
+static bool is_batchable_ocall(uint64_t ocall_index) {
+    switch (ocall_index) {
+        case OCALL_CLOSE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+extern sgx_ocall_fn_t ocall_table[OCALL_NR];
+
+static long sgx_ocall_batch(void* pms) {
+    ms_ocall_batch_t* ms = (ms_ocall_batch_t*)pms;
+    ODEBUG(OCALL_BATCH, ms);
+
+    /* entries are executed in order; the enclave initializes all results to -EINTR, so if a signal
+     * interrupts the batch, the not yet executed entries are reported as interrupted */
+    for (size_t i = 0; i < ms->ms_count; i++) {
+        struct ocall_batch_entry* entry = &ms->ms_entries[i];
+        if (!is_batchable_ocall(entry->ocall_index)) {
+            entry->result = -EINVAL;
+            continue;
+        }
+        entry->result = ocall_table[entry->ocall_index](entry->ms);
+    }
+    return 0;
+}
+
 sgx_ocall_fn_t ocall_table[OCALL_NR] = {
     [OCALL_EXIT]             = sgx_ocall_exit,
     [OCALL_MMAP_UNTRUSTED]   = sgx_ocall_mmap_untrusted,
@@ -701,12 +979,19 @@ sgx_ocall_fn_t ocall_table[OCALL_NR] = {
     [OCALL_WRITE]            = sgx_ocall_write,
     [OCALL_PREAD]            = sgx_ocall_pread,
     [OCALL_PWRITE]           = sgx_ocall_pwrite,
+    [OCALL_PWRITEV]          = sgx_ocall_pwritev,
+    [OCALL_READV]            = sgx_ocall_readv,
+    [OCALL_WRITEV]           = sgx_ocall_writev,
+    [OCALL_SENDFILE]         = sgx_ocall_sendfile,
+    [OCALL_COPY_FILE_RANGE]  = sgx_ocall_copy_file_range,
     [OCALL_FSTAT]            = sgx_ocall_fstat,
     [OCALL_FIONREAD]         = sgx_ocall_fionread,
     [OCALL_FSETNONBLOCK]     = sgx_ocall_fsetnonblock,
     [OCALL_FCHMOD]           = sgx_ocall_fchmod,
     [OCALL_FSYNC]            = sgx_ocall_fsync,
     [OCALL_FTRUNCATE]        = sgx_ocall_ftruncate,
+    [OCALL_FALLOCATE]        = sgx_ocall_fallocate,
+    [OCALL_FADVISE]          = sgx_ocall_fadvise,
     [OCALL_MKDIR]            = sgx_ocall_mkdir,
     [OCALL_GETDENTS]         = sgx_ocall_getdents,
     [OCALL_RESUME_THREAD]    = sgx_ocall_resume_thread,
@@ -718,20 +1003,30 @@ sgx_ocall_fn_t ocall_table[OCALL_NR] = {
     [OCALL_SOCKETPAIR]       = sgx_ocall_socketpair,
     [OCALL_LISTEN]           = sgx_ocall_listen,
     [OCALL_ACCEPT]           = sgx_ocall_accept,
+    [OCALL_ACCEPT_MULTI]     = sgx_ocall_accept_multi,
     [OCALL_CONNECT]          = sgx_ocall_connect,
     [OCALL_RECV]             = sgx_ocall_recv,
     [OCALL_SEND]             = sgx_ocall_send,
+    [OCALL_RECVMMSG]         = sgx_ocall_recvmmsg,
+    [OCALL_SENDMMSG]         = sgx_ocall_sendmmsg,
     [OCALL_SETSOCKOPT]       = sgx_ocall_setsockopt,
     [OCALL_SHUTDOWN]         = sgx_ocall_shutdown,
     [OCALL_GETTIME]          = sgx_ocall_gettime,
     [OCALL_SCHED_YIELD]      = sgx_ocall_sched_yield,
     [OCALL_POLL]             = sgx_ocall_poll,
+    [OCALL_EPOLL_CREATE]     = sgx_ocall_epoll_create,
+    [OCALL_EPOLL_CTL]        = sgx_ocall_epoll_ctl,
+    [OCALL_EPOLL_WAIT]       = sgx_ocall_epoll_wait,
     [OCALL_RENAME]           = sgx_ocall_rename,
     [OCALL_DELETE]           = sgx_ocall_delete,
     [OCALL_DEBUG_MAP_ADD]    = sgx_ocall_debug_map_add,
     [OCALL_DEBUG_MAP_REMOVE] = sgx_ocall_debug_map_remove,
     [OCALL_EVENTFD]          = sgx_ocall_eventfd,
     [OCALL_GET_QUOTE]        = sgx_ocall_get_quote,
+    [OCALL_BATCH]            = sgx_ocall_batch,
+    [OCALL_EDMM_TRIM_PAGES]  = sgx_ocall_edmm_trim_pages,
+    [OCALL_EDMM_REMOVE_PAGES]= sgx_ocall_edmm_remove_pages,
+    [OCALL_EDMM_CONVERT_TCS] = sgx_ocall_edmm_convert_tcs,
 };
 
 #define EDEBUG(code, ms) \
@@ -740,8 +1035,248 @@ sgx_ocall_fn_t ocall_table[OCALL_NR] = {
 
 rpc_queue_t* g_rpc_queue = NULL; /* pointer to untrusted queue */
 
+/* In "paired" mode, RPC thread `i` is pinned to `rpc_cpu` of pair `i % g_rpc_cpu_pairs_cnt` and
+ * the enclave threads it serves are pinned to `enclave_cpu` of the same pair; the two CPUs are
+ * hyperthread siblings of one physical core. */
+struct rpc_cpu_pair {
+    int enclave_cpu;
+    int rpc_cpu;
+};
+static struct rpc_cpu_pair g_rpc_cpu_pairs[MAX_RPC_THREADS];
+static size_t g_rpc_cpu_pairs_cnt = 0;
+
+/* How often (in idle spins) an RPC thread in "paired" or "numa" mode scans channels of other RPC
+ * threads, to serve enclave threads whose RPC threads are stuck in blocking syscalls */
+#define RPC_STEAL_INTERVAL 64
+
+/* Max number of requests an RPC thread with `sgx.rpc_io_uring` queues before it submits them and
+ * delivers completions, even if more requests are waiting */
+#define RPC_URING_BATCH 16
+
+/* size of CPU mask used for pinning, same as the default `cpu_set_t` of glibc */
+#define RPC_CPU_MASK_BITS  1024
+#define RPC_CPU_MASK_WORD  (8 * sizeof(unsigned long))
+#define RPC_CPU_MASK_WORDS (RPC_CPU_MASK_BITS / RPC_CPU_MASK_WORD)
+
+/* In "numa" mode, RPC thread `i` belongs to node group `i % g_rpc_nodes_cnt`, and so do the enclave
+ * threads of channels `i % g_rpc_nodes_cnt`; all threads of a group are pinned to the CPUs of one
+ * NUMA node (that the process is allowed to run on), so that requests stay within the node. */
+struct rpc_node {
+    unsigned long cpus[RPC_CPU_MASK_WORDS];
+};
+static struct rpc_node g_rpc_nodes[MAX_RPC_THREADS];
+static size_t g_rpc_nodes_cnt = 0;
+
+static int pin_current_thread_to_cpus(const unsigned long* mask) {
+    return INLINE_SYSCALL(sched_setaffinity, 3, 0, RPC_CPU_MASK_WORDS * sizeof(*mask), mask);
+}
+
+static int pin_current_thread_to_cpu(int cpu) {
+    unsigned long mask[RPC_CPU_MASK_WORDS] = {0};
+    if (cpu < 0 || cpu >= RPC_CPU_MASK_BITS)
+        return -EINVAL;
+    mask[cpu / RPC_CPU_MASK_WORD] |= 1UL << (cpu % RPC_CPU_MASK_WORD);
+    return pin_current_thread_to_cpus(mask);
+}
+
+/* parses the first two CPU indices of a "thread_siblings_list" sysfs file (e.g. "0,36" or "0-1") */
+static int read_thread_siblings(int cpu, int* first, int* second) {
+    char filename[128];
+    char buf[64];
+    snprintf(filename, sizeof(filename),
+             "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+    int ret = read_file_buffer(filename, buf, sizeof(buf) - 1);
+    if (ret < 0)
+        return ret;
+    buf[ret] = '\0';
+
+    char* end;
+    long a = strtol(buf, &end, 10);
+    if (end == buf || (*end != ',' && *end != '-'))
+        return -ENOENT; /* no SMT sibling */
+    char separator = *end;
+    char* ptr = end + 1;
+    long b = strtol(ptr, &end, 10);
+    if (end == ptr || a < 0 || b < 0 || a > INT_MAX || b > INT_MAX)
+        return -ENOENT;
+    if (separator == '-')
+        b = a + 1; /* range "a-c": the sibling of `a` is `a + 1` */
+
+    *first  = (int)a;
+    *second = (int)b;
+    return 0;
+}
+
+static void init_rpc_cpu_pairs(void) {
+    int online_cpus = get_hw_resource("/sys/devices/system/cpu/online", /*count=*/true);
+    for (int cpu = 0; cpu < online_cpus && g_rpc_cpu_pairs_cnt < MAX_RPC_THREADS; cpu++) {
+        int first, second;
+        if (read_thread_siblings(cpu, &first, &second) < 0 || first != cpu)
+            continue;
+        g_rpc_cpu_pairs[g_rpc_cpu_pairs_cnt].enclave_cpu = first;
+        g_rpc_cpu_pairs[g_rpc_cpu_pairs_cnt].rpc_cpu     = second;
+        g_rpc_cpu_pairs_cnt++;
+    }
+
+    if (!g_rpc_cpu_pairs_cnt)
+        log_warning("sgx.rpc_affinity = \"paired\" requested but no hyperthread siblings found; "
+                    "RPC and enclave threads will not be pinned\n");
+}
+
+/* parses a "cpumap" sysfs string (comma-separated 32-bit hex words, most significant first, e.g.
+ * "00000000,00ff00ff") into `mask`; CPUs beyond RPC_CPU_MASK_BITS are ignored */
+static void parse_cpumap(const char* cpumap, unsigned long* mask) {
+    memset(mask, 0, RPC_CPU_MASK_WORDS * sizeof(*mask));
+    size_t bit = 0;
+    for (size_t i = strnlen(cpumap, PAL_SYSFS_MAP_FILESZ); i > 0 && bit < RPC_CPU_MASK_BITS; i--) {
+        int8_t digit = hex2dec(cpumap[i - 1]);
+        if (digit < 0)
+            continue; /* comma or newline */
+        mask[bit / RPC_CPU_MASK_WORD] |= (unsigned long)digit << (bit % RPC_CPU_MASK_WORD);
+        bit += 4;
+    }
+}
+
+static void init_rpc_numa_nodes(void) {
+    unsigned long allowed[RPC_CPU_MASK_WORDS] = {0};
+    int ret = INLINE_SYSCALL(sched_getaffinity, 3, 0, sizeof(allowed), allowed);
+    if (ret < 0) {
+        log_warning("sgx.rpc_affinity = \"numa\" requested but the CPU affinity of the process is "
+                    "unknown (%d); RPC and enclave threads will not be pinned\n", ret);
+        return;
+    }
+
+    /* use at most one node per RPC thread, so that every node group has an RPC thread */
+    PAL_TOPO_INFO* topo_info = &g_pal_enclave.pal_sec.topo_info;
+    for (size_t node = 0; node < topo_info->num_online_nodes
+                          && g_rpc_nodes_cnt < g_pal_enclave.rpc_thread_num; node++) {
+        unsigned long* cpus = g_rpc_nodes[g_rpc_nodes_cnt].cpus;
+        parse_cpumap(topo_info->numa_topology[node].cpumap, cpus);
+
+        bool empty = true;
+        for (size_t i = 0; i < RPC_CPU_MASK_WORDS; i++) {
+            cpus[i] &= allowed[i];
+            if (cpus[i])
+                empty = false;
+        }
+        if (!empty)
+            g_rpc_nodes_cnt++;
+    }
+
+    if (!g_rpc_nodes_cnt)
+        log_warning("sgx.rpc_affinity = \"numa\" requested but no NUMA node with allowed CPUs "
+                    "found; RPC and enclave threads will not be pinned\n");
+}
+
+void rpc_pin_enclave_thread(void* tcs) {
+    if (!g_rpc_queue || !g_rpc_queue->channels)
+        return;
+
+    size_t idx = rpc_channel_index((uintptr_t)tcs - g_pal_enclave.baseaddr,
+                                   g_rpc_queue->channels_cnt);
+    int ret;
+    if (g_rpc_nodes_cnt) {
+        ret = pin_current_thread_to_cpus(g_rpc_nodes[idx % g_rpc_nodes_cnt].cpus);
+    } else if (g_rpc_cpu_pairs_cnt) {
+        size_t rpc_thread_idx = idx % g_pal_enclave.rpc_thread_num;
+        ret = pin_current_thread_to_cpu(
+                  g_rpc_cpu_pairs[rpc_thread_idx % g_rpc_cpu_pairs_cnt].enclave_cpu);
+    } else {
+        return;
+    }
+    if (ret < 0)
+        log_warning("Failed to pin enclave thread next to its RPC thread: %d\n", ret);
+}
+
+/* per-RPC-thread statistics reported with `sgx.enable_stats`; each entry is written only by its
+ * RPC thread (and read when printing stats), so cache-line alignment prevents false sharing */
+struct rpc_thread_stats {
+    uint64_t requests;     /* # of served OCALL requests */
+    uint64_t wakeups;      /* # of requests whose enclave thread stopped spinning and slept */
+    uint64_t uring;        /* # of requests executed through the host io_uring */
+    uint64_t busy_cycles;  /* TSC cycles spent executing OCALLs */
+    uint64_t idle_cycles;  /* TSC cycles spent waiting for requests (spinning and sleeping) */
+    uint64_t sleep_cycles; /* TSC cycles spent sleeping (part of `idle_cycles`) */
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static struct rpc_thread_stats g_rpc_thread_stats[MAX_RPC_THREADS];
+
+static unsigned long percentage(uint64_t part, uint64_t total) {
+    return total ? (unsigned long)(part * 100 / total) : 0;
+}
+
+void print_rpc_stats(void) {
+    if (!g_sgx_enable_stats || !g_rpc_queue)
+        return;
+
+    uint64_t requests = 0, wakeups = 0, uring = 0, busy_cycles = 0, idle_cycles = 0;
+    uint64_t sleep_cycles = 0;
+    for (size_t i = 0; i < g_pal_enclave.rpc_thread_num; i++) {
+        struct rpc_thread_stats* stats = &g_rpc_thread_stats[i];
+        requests     += __atomic_load_n(&stats->requests, __ATOMIC_RELAXED);
+        wakeups      += __atomic_load_n(&stats->wakeups, __ATOMIC_RELAXED);
+        uring        += __atomic_load_n(&stats->uring, __ATOMIC_RELAXED);
+        busy_cycles  += __atomic_load_n(&stats->busy_cycles, __ATOMIC_RELAXED);
+        idle_cycles  += __atomic_load_n(&stats->idle_cycles, __ATOMIC_RELAXED);
+        sleep_cycles += __atomic_load_n(&stats->sleep_cycles, __ATOMIC_RELAXED);
+    }
+    uint64_t spin_cycles  = idle_cycles > sleep_cycles ? idle_cycles - sleep_cycles : 0;
+    uint64_t total_cycles = busy_cycles + idle_cycles;
+
+    log_always("----- Exitless stats (%lu RPC threads) -----\n"
+               "  # of exitless OCALLs:        %lu\n"
+               "    completed while spinning:  %lu\n"
+               "    enclave thread slept:      %lu\n"
+               "    through host io_uring:     %lu\n"
+               "  RPC threads busy time:       %lu%%\n"
+               "  RPC threads spin time:       %lu%%\n"
+               "  RPC threads sleep time:      %lu%%\n",
+               g_pal_enclave.rpc_thread_num, requests, requests - wakeups, wakeups, uring,
+               percentage(busy_cycles, total_cycles), percentage(spin_cycles, total_cycles),
+               percentage(sleep_cycles, total_cycles));
+}
+
+/* notifies the enclave thread awaiting `req` that its result is ready */
+static void finish_request(rpc_request_t* req, struct rpc_thread_stats* stats, bool collect_stats) {
+    /* this code is based on Mutex 2 from Futexes are Tricky */
+    int old_lock_state = __atomic_fetch_sub(&req->lock.lock, 1, __ATOMIC_ACQ_REL);
+    if (old_lock_state == SPINLOCK_LOCKED_WITH_WAITERS) {
+        /* must unlock and wake waiters */
+        spinlock_unlock(&req->lock);
+        int ret = INLINE_SYSCALL(futex, 6, &req->lock.lock, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+        if (ret == -1)
+            log_error("RPC thread failed to wake up enclave thread\n");
+        if (collect_stats)
+            stats->wakeups++;
+    }
+}
+
+/* submits the OCALLs queued in `uring` and finishes the completed ones; returns whether any
+ * OCALL completed */
+static bool serve_uring(struct rpc_uring* uring, struct rpc_thread_stats* stats,
+                        bool collect_stats) {
+    (void)rpc_uring_flush(uring);
+
+    bool completed = false;
+    rpc_request_t* req;
+    uint64_t ocall_index;
+    uint64_t submit_tsc;
+    while ((req = rpc_uring_reap(uring, &ocall_index, &submit_tsc))) {
+        if (collect_stats) {
+            /* latency of the host operation, as for synchronous OCALLs */
+            sgx_ocall_stats_record(ocall_index, OCALL_STATS_PATH_EXITLESS,
+                                   get_tsc() - submit_tsc);
+            stats->requests++;
+            stats->uring++;
+        }
+        finish_request(req, stats, collect_stats);
+        completed = true;
+    }
+    return completed;
+}
+
 static int rpc_thread_loop(void* arg) {
-    __UNUSED(arg);
+    size_t my_idx = (size_t)arg;
     long mytid = INLINE_SYSCALL(gettid, 0);
 
     /* block all signals except SIGUSR2 for RPC thread */
@@ -750,52 +1285,149 @@ static int rpc_thread_loop(void* arg) {
     __sigdelset(&mask, SIGUSR2);
     INLINE_SYSCALL(rt_sigprocmask, 4, SIG_SETMASK, &mask, NULL, sizeof(mask));
 
-    spinlock_lock(&g_rpc_queue->lock);
-    g_rpc_queue->rpc_threads[g_rpc_queue->rpc_threads_cnt] = mytid;
-    g_rpc_queue->rpc_threads_cnt++;
-    spinlock_unlock(&g_rpc_queue->lock);
+    size_t idx = __atomic_fetch_add(&g_rpc_queue->rpc_threads_cnt, 1, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&g_rpc_queue->rpc_threads[idx], mytid, __ATOMIC_RELEASE);
+
+    rpc_channel_t* channels = g_rpc_queue->channels;
+    size_t channels_cnt     = g_rpc_queue->channels_cnt;
+    size_t rpc_threads_num  = g_pal_enclave.rpc_thread_num;
+
+    /* own channels of this RPC thread, served before the shared queue: in "paired" mode, channel
+     * `i` belongs to RPC thread `i % rpc_threads_num`; in "numa" mode, it belongs to all RPC
+     * threads of node group `i % g_rpc_nodes_cnt` */
+    size_t own_first = my_idx;
+    size_t own_step  = rpc_threads_num;
+    if (channels && g_rpc_nodes_cnt) {
+        own_first = my_idx % g_rpc_nodes_cnt;
+        own_step  = g_rpc_nodes_cnt;
+        int ret = pin_current_thread_to_cpus(g_rpc_nodes[own_first].cpus);
+        if (ret < 0)
+            log_warning("Failed to pin RPC thread to its NUMA node: %d\n", ret);
+    } else if (channels && g_rpc_cpu_pairs_cnt) {
+        int ret = pin_current_thread_to_cpu(g_rpc_cpu_pairs[my_idx % g_rpc_cpu_pairs_cnt].rpc_cpu);
+        if (ret < 0)
+            log_warning("Failed to pin RPC thread to its pair CPU: %d\n", ret);
+    }
+
+    uint64_t spin_max   = g_pal_enclave.rpc_thread_spin_max;
+    uint64_t sleep_max  = g_pal_enclave.rpc_thread_sleep_max * 1000; /* nanoseconds */
+    uint64_t sleep_step = sleep_max / RPC_SLEEP_STEPS ?: sleep_max;
 
-    static const uint64_t SPIN_ATTEMPTS_MAX = 10000;     /* rather arbitrary */
-    static const uint64_t SLEEP_TIME_MAX    = 100000000; /* nanoseconds (0.1 seconds) */
-    static const uint64_t SLEEP_TIME_STEP   = 1000000;   /* 100 steps before capped */
+    struct rpc_thread_stats* stats = &g_rpc_thread_stats[my_idx];
+    bool collect_stats = g_sgx_enable_stats;
+
+    struct rpc_uring* uring = g_pal_enclave.rpc_io_uring ? rpc_uring_create() : NULL;
+    size_t uring_batch = 0;
 
     /* no races possible since vars are thread-local and RPC threads don't receive signals */
+    uint64_t spin_estimate = 0; /* EWMA of idle spins before the next request arrived */
+    uint64_t spin_budget   = rpc_spin_budget(spin_estimate, spin_max);
     uint64_t spin_attempts = 0;
     uint64_t sleep_time    = 0;
+    uint64_t sleeps_cnt    = 0;
+    uint64_t sleep_cycles  = 0;
+    uint64_t idle_start    = collect_stats ? get_tsc() : 0;
 
     while (1) {
-        rpc_request_t* req = rpc_dequeue(g_rpc_queue);
-        if (!req) {
-            if (spin_attempts == SPIN_ATTEMPTS_MAX) {
-                if (sleep_time < SLEEP_TIME_MAX)
-                    sleep_time += SLEEP_TIME_STEP;
+        rpc_request_t* req = NULL;
 
-                struct timespec tv = {.tv_sec = 0, .tv_nsec = sleep_time};
-                (void)INLINE_SYSCALL(nanosleep, 2, &tv, /*rem=*/NULL);
+        if (collect_stats)
+            sgx_stats_dump_if_requested();
+
+        for (size_t i = own_first; channels && !req && i < channels_cnt; i += own_step)
+            req = rpc_channel_pop(&channels[i]);
+
+        if (!req)
+            req = rpc_dequeue(g_rpc_queue);
+
+        if (!req && channels && spin_attempts % RPC_STEAL_INTERVAL == 0) {
+            for (size_t i = 0; !req && i < channels_cnt; i++)
+                req = rpc_channel_pop(&channels[i]);
+        }
+
+        if (!req) {
+            /* no more requests for now: submit the batch queued so far (if any) and deliver the
+             * completed requests */
+            uring_batch = 0;
+            if (uring && rpc_uring_inflight(uring) && serve_uring(uring, stats, collect_stats))
+                continue;
+
+            if (spin_attempts == spin_budget && sleep_max) {
+                sleep_time = MIN(sleep_time + sleep_step, sleep_max);
+
+                uint64_t sleep_start = collect_stats ? get_tsc() : 0;
+                if (uring && rpc_uring_inflight(uring)) {
+                    /* also woken up by completions of the requests in flight */
+                    rpc_uring_wait(uring, sleep_time);
+                } else {
+                    struct timespec tv = {.tv_sec = 0, .tv_nsec = sleep_time};
+                    (void)INLINE_SYSCALL(nanosleep, 2, &tv, /*rem=*/NULL);
+                }
+                if (collect_stats)
+                    sleep_cycles += get_tsc() - sleep_start;
+                sleeps_cnt++;
             } else {
-                spin_attempts++;
+                if (spin_attempts < spin_budget)
+                    spin_attempts++;
                 CPU_RELAX();
             }
             continue;
         }
 
-        /* new request came, reset spin/sleep heuristics */
+        /* new request came, learn from the idle gap and reset spin/sleep heuristics: if the request
+         * arrived while spinning, the gap is known exactly; if it arrived right after the first
+         * nap, spinning gave up too early; otherwise the thread is mostly idle and spinning is a
+         * waste of CPU time */
+        uint64_t sample = 0;
+        if (!sleeps_cnt)
+            sample = spin_attempts;
+        else if (sleeps_cnt == 1)
+            sample = 2 * spin_budget;
+        spin_estimate = rpc_spin_estimate_update(spin_estimate, sample);
+        spin_budget   = rpc_spin_budget(spin_estimate, spin_max);
+
         spin_attempts = 0;
         sleep_time    = 0;
+        sleeps_cnt    = 0;
+
+        uint64_t busy_start = 0;
+        if (collect_stats) {
+            busy_start = get_tsc();
+            stats->idle_cycles  += busy_start - idle_start;
+            stats->sleep_cycles += sleep_cycles;
+            sleep_cycles = 0;
+        }
+
+        if (uring && rpc_uring_queue(uring, req, collect_stats ? busy_start : 0)) {
+            /* the enclave thread is notified when the request completes, see serve_uring() */
+            if (++uring_batch == RPC_URING_BATCH) {
+                uring_batch = 0;
+                (void)serve_uring(uring, stats, collect_stats);
+            }
+            if (collect_stats) {
+                idle_start = get_tsc();
+                stats->busy_cycles += idle_start - busy_start;
+            }
+            continue;
+        }
+
+        /* requests queued so far must not wait for this (possibly blocking) one */
+        if (uring)
+            (void)rpc_uring_flush(uring);
 
         /* call actual function and notify awaiting enclave thread when done */
-        sgx_ocall_fn_t f = ocall_table[req->ocall_index];
+        uint64_t ocall_index = req->ocall_index;
+        sgx_ocall_fn_t f = ocall_table[ocall_index];
         req->result = f(req->buffer);
+        if (collect_stats)
+            sgx_ocall_stats_record(ocall_index, OCALL_STATS_PATH_EXITLESS, get_tsc() - busy_start);
+
+        finish_request(req, stats, collect_stats);
 
-        /* this code is based on Mutex 2 from Futexes are Tricky */
-        int old_lock_state = __atomic_fetch_sub(&req->lock.lock, 1, __ATOMIC_ACQ_REL);
-        if (old_lock_state == SPINLOCK_LOCKED_WITH_WAITERS) {
-            /* must unlock and wake waiters */
-            spinlock_unlock(&req->lock);
-            int ret = INLINE_SYSCALL(futex, 6, &req->lock.lock, FUTEX_WAKE_PRIVATE,
-                                     1, NULL, NULL, 0);
-            if (ret == -1)
-                log_error("RPC thread failed to wake up enclave thread\n");
+        if (collect_stats) {
+            idle_start = get_tsc();
+            stats->busy_cycles += idle_start - busy_start;
+            stats->requests++;
         }
     }
 
@@ -814,6 +1446,24 @@ static int start_rpc(size_t num_of_threads) {
     /* initialize g_rpc_queue just for sanity, it will be overwritten by in-enclave code */
     rpc_queue_init(g_rpc_queue);
 
+    if (g_pal_enclave.rpc_affinity != RPC_AFFINITY_SHARED) {
+        size_t channels_size = ALIGN_UP(sizeof(rpc_channel_t) * g_pal_enclave.thread_num,
+                                        PRESET_PAGESIZE);
+        rpc_channel_t* channels = (rpc_channel_t*)INLINE_SYSCALL(mmap, 6, NULL, channels_size,
+                                                                 PROT_READ | PROT_WRITE,
+                                                                 MAP_ANONYMOUS | MAP_PRIVATE,
+                                                                 -1, 0);
+        if (IS_ERR_P(channels))
+            return -ENOMEM;
+
+        g_rpc_queue->channels     = channels;
+        g_rpc_queue->channels_cnt = g_pal_enclave.thread_num;
+        if (g_pal_enclave.rpc_affinity == RPC_AFFINITY_NUMA)
+            init_rpc_numa_nodes();
+        else
+            init_rpc_cpu_pairs();
+    }
+
     for (size_t i = 0; i < num_of_threads; i++) {
         void* stack = (void*)INLINE_SYSCALL(mmap, 6, NULL, RPC_STACK_SIZE, PROT_READ | PROT_WRITE,
                                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
@@ -827,7 +1477,7 @@ static int start_rpc(size_t num_of_threads) {
         int ret = clone(rpc_thread_loop, child_stack_top,
                         CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SYSVSEM |
                         CLONE_THREAD | CLONE_SIGHAND | CLONE_PTRACE | CLONE_PARENT_SETTID,
-                        NULL, &dummy_parent_tid_field, NULL);
+                        (void*)i, &dummy_parent_tid_field, NULL);
 
         if (ret < 0) {
             INLINE_SYSCALL(munmap, 2, stack, RPC_STACK_SIZE);
@@ -837,9 +1487,7 @@ static int start_rpc(size_t num_of_threads) {
 
     /* wait until all RPC threads are initialized in rpc_thread_loop */
     while (1) {
-        spinlock_lock(&g_rpc_queue->lock);
-        size_t n = g_rpc_queue->rpc_threads_cnt;
-        spinlock_unlock(&g_rpc_queue->lock);
+        size_t n = __atomic_load_n(&g_rpc_queue->rpc_threads_cnt, __ATOMIC_ACQUIRE);
         if (n == g_pal_enclave.rpc_thread_num)
             break;
         INLINE_SYSCALL(sched_yield, 0);
@@ -859,6 +1507,9 @@ int ecall_enclave_start(char* libpal_uri, char* args, size_t args_size, char* en
             return ret;
         }
         /* after this point, g_rpc_queue != NULL */
+
+        /* the first thread was mapped to its TCS before RPC threads were started */
+        rpc_pin_enclave_thread(get_tcb_urts()->tcs);
     }
 
     ms_ecall_enclave_start_t ms;
@@ -120,16 +120,23 @@ static bool interrupted_in_aex_profiling(void) {
     return get_tcb_urts()->is_in_aex_profiling != 0;
 }
 
+/* send dummy signal to RPC threads so they interrupt blocked syscalls (and cancel the OCALLs in
+ * flight in their io_urings) */
+static void interrupt_rpc_threads(void) {
+    if (!g_rpc_queue)
+        return;
+    __atomic_add_fetch(&g_rpc_signal_cnt, 1, __ATOMIC_RELEASE);
+    for (size_t i = 0; i < g_rpc_queue->rpc_threads_cnt; i++)
+        INLINE_SYSCALL(tkill, 2, g_rpc_queue->rpc_threads[i], SIGUSR2);
+}
+
 static void handle_sync_signal(int signum, siginfo_t* info, struct ucontext* uc) {
     int event = get_pal_event(signum);
     assert(event > 0);
 
     __UNUSED(info);
 
-    /* send dummy signal to RPC threads so they interrupt blocked syscalls */
-    if (g_rpc_queue)
-        for (size_t i = 0; i < g_rpc_queue->rpc_threads_cnt; i++)
-            INLINE_SYSCALL(tkill, 2, g_rpc_queue->rpc_threads[i], SIGUSR2);
+    interrupt_rpc_threads();
 
     if (interrupted_in_enclave(uc)) {
         /* exception happened in app/LibOS/trusted PAL code, handle signal inside enclave */
@@ -164,10 +171,7 @@ static void handle_async_signal(int signum, siginfo_t* info, struct ucontext* uc
 
     __UNUSED(info);
 
-    /* send dummy signal to RPC threads so they interrupt blocked syscalls */
-    if (g_rpc_queue)
-        for (size_t i = 0; i < g_rpc_queue->rpc_threads_cnt; i++)
-            INLINE_SYSCALL(tkill, 2, g_rpc_queue->rpc_threads[i], SIGUSR2);
+    interrupt_rpc_threads();
 
     if (interrupted_in_enclave(uc) || interrupted_in_aex_profiling()) {
         /* signal arrived while in app/LibOS/trusted PAL code or when handling another AEX, handle
@@ -191,6 +195,25 @@ static void handle_dummy_signal(int signum, siginfo_t* info, struct ucontext* uc
     /* we need this handler to interrupt blocking syscalls in RPC threads */
 }
 
+#ifdef DEBUG
+static void handle_profile_signal(int signum, siginfo_t* info, struct ucontext* uc) {
+    __UNUSED(signum);
+    __UNUSED(info);
+    /* overflow of the perf event of this thread; only samples of enclave code are recorded (on the
+     * AEX path, after this handler returns) */
+    sgx_profile_event_signal(interrupted_in_enclave(uc));
+}
+#endif
+
+static void handle_stats_signal(int signum, siginfo_t* info, struct ucontext* uc) {
+    __UNUSED(signum);
+    __UNUSED(info);
+    __UNUSED(uc);
+    /* SGX stats of the whole process are dumped without stopping it, but not here: printing is not
+     * async-signal-safe */
+    sgx_stats_request_dump();
+}
+
 int sgx_signal_setup(void) {
     int ret;
 
@@ -243,6 +266,22 @@ int sgx_signal_setup(void) {
     if (ret < 0)
         goto err;
 
+    /* with SGX stats enabled, SIGUSR1 from the host dumps them (SIGUSR1 is not forwarded to the
+     * enclave anyway) */
+    if (g_sgx_enable_stats) {
+        ret = set_signal_handler(SIGUSR1, handle_stats_signal);
+        if (ret < 0)
+            goto err;
+    }
+
+#ifdef DEBUG
+    if (g_pal_enclave.profile_enable && g_pal_enclave.profile_mode == SGX_PROFILE_MODE_PERF_EVENT) {
+        ret = set_signal_handler(SGX_PROFILE_SIGNAL, handle_profile_signal);
+        if (ret < 0)
+            goto err;
+    }
+#endif
+
     ret = 0;
 err:
     return ret;
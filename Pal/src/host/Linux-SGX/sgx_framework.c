@@ -15,6 +15,8 @@ static int g_isgx_device = -1;
 
 static void* g_zero_pages       = NULL;
 static size_t g_zero_pages_size = 0;
+/* zero ranges bigger than this are added with several ADD_PAGES ioctls from the same zero pages */
+#define ZERO_PAGES_MAX_SIZE (64 * 1024 * 1024)
 
 int open_sgx_driver(bool need_gsgx) {
     if (need_gsgx) {
@@ -247,29 +249,31 @@ int add_pages_to_enclave(sgx_arch_secs_t* secs, void* addr, void* user_addr, uns
                   comment, m);
 
 #ifdef SGX_DCAP
-    if (!user_addr && g_zero_pages_size < size) {
-        /* not enough contigious zero pages to back up enclave pages, allocate more */
-        /* TODO: this logic can be removed if we introduce a size cap in ENCLAVE_ADD_PAGES ioctl */
+    size_t zero_size = MIN(size, (unsigned long)ZERO_PAGES_MAX_SIZE);
+    if (!user_addr && g_zero_pages_size < zero_size) {
+        /* not enough contiguous zero pages to back up enclave pages, allocate more; they are
+         * prefaulted (all map the same physical zero page), so that the driver doesn't take a page
+         * fault for each of them, in each ioctl */
         ret = INLINE_SYSCALL(munmap, 2, g_zero_pages, g_zero_pages_size);
         if (ret < 0) {
             log_error("Cannot unmap zero pages %d\n", ret);
             return ret;
         }
 
-        g_zero_pages = (void*)INLINE_SYSCALL(mmap, 6, NULL, size, PROT_READ,
-                                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        g_zero_pages = (void*)INLINE_SYSCALL(mmap, 6, NULL, zero_size, PROT_READ,
+                                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
         if (IS_ERR_P(g_zero_pages)) {
             log_error("Cannot map zero pages %ld\n", ERRNO_P(g_zero_pages));
             return -ENOMEM;
         }
-        g_zero_pages_size = size;
+        g_zero_pages_size = zero_size;
     }
 
     /* newer DCAP driver (version 1.6+) allows adding a range of pages for performance, use it */
     struct sgx_enclave_add_pages param = {
         .offset  = (uint64_t)addr - secs->base,
         .src     = (uint64_t)(user_addr ?: g_zero_pages),
-        .length  = size,
+        .length  = 0, /* set below for each ioctl */
         .secinfo = (uint64_t)&secinfo,
         .flags   = skip_eextend ? 0 : SGX_PAGE_MEASURE,
         .count   = 0, /* output parameter, will be checked after IOCTL */
@@ -286,7 +290,10 @@ int add_pages_to_enclave(sgx_arch_secs_t* secs, void* addr, void* user_addr, uns
      * field of struct and thus may stay redundant (and unused by driver v39). We hope that this
      * contrived logic won't be needed when the SGX driver stabilizes its ioctl interface.
      * (https://git.kernel.org/pub/scm/linux/kernel/git/jarkko/linux-sgx.git/tag/?h=v39) */
-    while (param.length > 0) {
+    uint64_t remaining = size;
+    while (remaining > 0) {
+        /* data is added in one go (up to the driver's cap), zeros in batches of the zero pages */
+        param.length = user_addr ? remaining : MIN(remaining, (uint64_t)g_zero_pages_size);
         ret = INLINE_SYSCALL(ioctl, 3, g_isgx_device, SGX_IOC_ENCLAVE_ADD_PAGES, &param);
         if (ret < 0) {
             if (ret == -EINTR)
@@ -303,9 +310,9 @@ int add_pages_to_enclave(sgx_arch_secs_t* secs, void* addr, void* user_addr, uns
         }
 
         param.offset += added_size;
-        if (param.src != (uint64_t)g_zero_pages)
+        if (user_addr)
             param.src += added_size;
-        param.length -= added_size;
+        remaining -= added_size;
     }
 
     /* ask Intel SGX driver to actually mmap the added enclave pages */
@@ -417,6 +424,114 @@ int init_enclave(sgx_arch_secs_t* secs, sgx_arch_enclave_css_t* sigstruct,
     return 0;
 }
 
+#ifdef SGX_IOC_ENCLAVE_REMOVE_PAGES
+int check_edmm_support(void) {
+    /* zero-length request is always rejected by SGX2-capable drivers with -EINVAL, whereas drivers
+     * (or CPUs) without SGX2 support fail with -ENOTTY (or -ENODEV) */
+    struct sgx_enclave_remove_pages param = {0};
+    int ret = INLINE_SYSCALL(ioctl, 3, g_isgx_device, SGX_IOC_ENCLAVE_REMOVE_PAGES, &param);
+    if (ret == -ENOTTY || ret == -ENODEV) {
+        log_error("'sgx.edmm_enable' requires SGX2-capable CPU and Intel SGX driver (in-kernel "
+                  "driver from Linux 6.0+)\n");
+        return -ENOSYS;
+    }
+    return 0;
+}
+
+int map_dynamic_enclave_pages(void* addr, size_t size) {
+    log_debug("mapping dynamic pages of enclave: %p-%p [REG:RWX] (free)\n", addr, addr + size);
+
+    uint64_t mapped = INLINE_SYSCALL(mmap, 6, addr, size, PROT_READ | PROT_WRITE | PROT_EXEC,
+                                     MAP_FIXED | MAP_SHARED, g_isgx_device, 0);
+    if (IS_ERR_P(mapped)) {
+        log_error("Cannot map dynamic enclave pages %ld\n", ERRNO_P(mapped));
+        return -EACCES;
+    }
+    return 0;
+}
+
+static int modify_enclave_pages_type(void* addr, size_t size, uint64_t page_type) {
+    struct sgx_enclave_modify_types param = {
+        .offset    = (uint64_t)addr - g_pal_enclave.baseaddr,
+        .length    = size,
+        .page_type = page_type,
+    };
+
+    /* the driver may process only part of the range, so loop until all pages are trimmed */
+    while (param.length > 0) {
+        param.result = 0;
+        param.count  = 0;
+        int ret = INLINE_SYSCALL(ioctl, 3, g_isgx_device, SGX_IOC_ENCLAVE_MODIFY_TYPES, &param);
+        if (ret < 0 && ret != -EINTR && ret != -EAGAIN) {
+            log_error("Enclave EMODT returned %d (SGX result %lu)\n", ret,
+                      (unsigned long)param.result);
+            return ret;
+        }
+        param.offset += param.count;
+        param.length -= param.count;
+    }
+    return 0;
+}
+
+int trim_enclave_pages(void* addr, size_t size) {
+    return modify_enclave_pages_type(addr, size, SGX_PAGE_TYPE_TRIM);
+}
+
+int convert_enclave_pages_to_tcs(void* addr, size_t size) {
+    return modify_enclave_pages_type(addr, size, SGX_PAGE_TYPE_TCS);
+}
+
+int remove_enclave_pages(void* addr, size_t size) {
+    struct sgx_enclave_remove_pages param = {
+        .offset = (uint64_t)addr - g_pal_enclave.baseaddr,
+        .length = size,
+    };
+
+    while (param.length > 0) {
+        param.count = 0;
+        int ret = INLINE_SYSCALL(ioctl, 3, g_isgx_device, SGX_IOC_ENCLAVE_REMOVE_PAGES, &param);
+        if (ret < 0 && ret != -EINTR && ret != -EAGAIN) {
+            log_error("Removing trimmed enclave pages returned %d\n", ret);
+            return ret;
+        }
+        param.offset += param.count;
+        param.length -= param.count;
+    }
+    return 0;
+}
+#else
+/* only the upstream in-kernel SGX driver supports EDMM */
+int check_edmm_support(void) {
+    log_error("'sgx.edmm_enable' requires the in-kernel Intel SGX driver (Linux 6.0+), but "
+              "Graphene was built against a different SGX driver\n");
+    return -ENOSYS;
+}
+
+int map_dynamic_enclave_pages(void* addr, size_t size) {
+    __UNUSED(addr);
+    __UNUSED(size);
+    return -ENOSYS;
+}
+
+int trim_enclave_pages(void* addr, size_t size) {
+    __UNUSED(addr);
+    __UNUSED(size);
+    return -ENOSYS;
+}
+
+int convert_enclave_pages_to_tcs(void* addr, size_t size) {
+    __UNUSED(addr);
+    __UNUSED(size);
+    return -ENOSYS;
+}
+
+int remove_enclave_pages(void* addr, size_t size) {
+    __UNUSED(addr);
+    __UNUSED(size);
+    return -ENOSYS;
+}
+#endif /* SGX_IOC_ENCLAVE_REMOVE_PAGES */
+
 int destroy_enclave(void* base_addr, size_t length) {
     log_debug("destroying enclave...\n");
 
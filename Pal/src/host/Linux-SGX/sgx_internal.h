@@ -42,6 +42,19 @@ uint16_t htons(uint16_t shortval);
 uint32_t ntohl(uint32_t longval);
 uint16_t ntohs(uint16_t shortval);
 
+/* max number of children spawned ahead of time, see `sgx.process_pool_size` */
+#define MAX_PROCESS_POOL_SIZE 64
+
+/* max number of parked host threads, see `sgx.thread_pool_size` */
+#define MAX_THREAD_POOL_SIZE 256
+
+/* placement of RPC threads relative to enclave threads, see `sgx.rpc_affinity` */
+enum rpc_affinity {
+    RPC_AFFINITY_SHARED = 0,
+    RPC_AFFINITY_PAIRED,
+    RPC_AFFINITY_NUMA,
+};
+
 struct pal_enclave {
     /* attributes */
     bool is_first_process; // Initial process in Graphene namespace is special.
@@ -52,11 +65,19 @@ struct pal_enclave {
     unsigned long size;
     unsigned long thread_num;
     unsigned long rpc_thread_num;
+    enum rpc_affinity rpc_affinity;
+    bool edmm_enabled;
+    unsigned long rpc_thread_spin_max;
+    unsigned long rpc_thread_sleep_max; /* in microseconds */
+    bool rpc_io_uring;
     unsigned long ssa_frame_size;
     bool nonpie_binary;
     bool remote_attestation_enabled;
     bool use_epid_attestation; /* Valid only if `remote_attestation_enabled` is true, selects
                                 * EPID/DCAP attestation scheme. */
+    unsigned long process_pool_size;
+    unsigned long thread_pool_size;
+    unsigned long thread_pool_idle_timeout; /* in milliseconds, 0 means no timeout */
 
     /* files */
     int sigfile;
@@ -71,6 +92,9 @@ struct pal_enclave {
     char profile_filename[64];
     bool profile_with_stack;
     int profile_frequency;
+    bool profile_ocall_duration;
+    int profile_event;
+    uint64_t profile_event_period;
 #endif
 
     /* security information */
@@ -119,6 +143,21 @@ int retrieve_quote(const sgx_spid_t* spid, bool linkable, const sgx_report_t* re
 int init_enclave(sgx_arch_secs_t* secs, sgx_arch_enclave_css_t* sigstruct, sgx_arch_token_t* token);
 
 int destroy_enclave(void* base_addr, size_t length);
+
+/*
+ * SGX2 Enclave Dynamic Memory Management (EDMM), see `sgx.edmm_enable`. Heap pages are not EADDed
+ * but mapped with `map_dynamic_enclave_pages()`; the in-kernel SGX driver EAUGs them on first
+ * access (by enclave's EACCEPT). To free pages, the enclave asks to change their type to TRIM via
+ * `trim_enclave_pages()`, EACCEPTs the change and finally asks to remove them from the enclave via
+ * `remove_enclave_pages()`. To create new threads at runtime, the enclave fills a regular page with
+ * TCS contents, asks to change its type via `convert_enclave_pages_to_tcs()` and EACCEPTs it. All
+ * functions return 0 on success and negative Linux error code otherwise.
+ */
+int check_edmm_support(void);
+int map_dynamic_enclave_pages(void* addr, size_t size);
+int trim_enclave_pages(void* addr, size_t size);
+int convert_enclave_pages_to_tcs(void* addr, size_t size);
+int remove_enclave_pages(void* addr, size_t size);
 void exit_process(int status, uint64_t start_exiting);
 
 int sgx_ecall(long ecall_no, void* ms);
@@ -129,13 +168,20 @@ void eresume_pointer(void);
 void async_exit_pointer_end(void);
 
 int get_tid_from_tcs(void* tcs);
-int clone_thread(void);
+int clone_thread(void* dynamic_tcs);
 
-void create_tcs_mapper(void* tcs_base, unsigned int thread_num);
+int create_tcs_mapper(void* tcs_base, unsigned int thread_num);
 int pal_thread_init(void* tcbptr);
 void map_tcs(unsigned int tid);
 void unmap_tcs(void);
 int current_enclave_thread_cnt(void);
+bool thread_pool_park(void);
+void rpc_pin_enclave_thread(void* tcs);
+void print_rpc_stats(void);
+
+/* Number of signals that arrived at the process; incremented before interrupting RPC threads, so
+ * that OCALLs in flight in their io_urings are cancelled (see sgx_rpc_uring.c). */
+extern uint64_t g_rpc_signal_cnt;
 void thread_exit(int status);
 
 uint64_t sgx_edbgrd(void* addr);
@@ -149,6 +195,31 @@ int block_async_signals(bool block);
 
 void update_debugger(void);
 
+/* per-OCALL stats (sgx_ocall_stats.c) */
+enum {
+    OCALL_STATS_PATH_DIRECT = 0, /* OCALL with enclave exit */
+    OCALL_STATS_PATH_EXITLESS,   /* OCALL served by RPC thread */
+    OCALL_STATS_PATHS,
+};
+
+/* Record one OCALL with index `code` that took `cycles` TSC cycles on the host */
+void sgx_ocall_stats_record(uint64_t code, int path, uint64_t cycles);
+
+/* Call direct-OCALL handler and record its stats (called from sgx_entry.S if stats are enabled) */
+long sgx_ocall_with_stats(void* ms, long (*handler)(void*), uint64_t code);
+
+/* Print per-OCALL stats of the whole process (called on exit and on SIGUSR1) */
+void sgx_ocall_stats_print(void);
+
+/* Print EPC usage and page faults of the process (called on exit and on SIGUSR1) */
+void print_epc_stats(void);
+
+/* Request a dump of the stats above (async-signal-safe, called from the SIGUSR1 handler) */
+void sgx_stats_request_dump(void);
+
+/* Dump the stats if requested since the last dump (called by threads on the host side) */
+void sgx_stats_dump_if_requested(void);
+
 #ifdef DEBUG
 /* SGX profiling (sgx_profile.c) */
 
@@ -163,6 +234,15 @@ enum {
     SGX_PROFILE_MODE_AEX = 1,
     SGX_PROFILE_MODE_OCALL_INNER = 2,
     SGX_PROFILE_MODE_OCALL_OUTER = 3,
+    SGX_PROFILE_MODE_PERF_EVENT = 4,
+};
+
+/* Hardware (or software) events sampled in SGX_PROFILE_MODE_PERF_EVENT mode */
+enum {
+    SGX_PROFILE_EVENT_CYCLES = 1,
+    SGX_PROFILE_EVENT_CACHE_MISSES = 2,
+    SGX_PROFILE_EVENT_DTLB_MISSES = 3,
+    SGX_PROFILE_EVENT_PAGE_FAULTS = 4,
 };
 
 /* Filenames for saved data */
@@ -175,6 +255,18 @@ int sgx_profile_init(void);
 /* Finalize and close file */
 void sgx_profile_finish(void);
 
+/* Set up profiling of the current thread (opens its perf event in SGX_PROFILE_MODE_PERF_EVENT) */
+void sgx_profile_thread_init(void);
+
+/* Write out the samples of the exiting thread and release its sample buffer */
+void sgx_profile_thread_exit(void);
+
+/* Handle the overflow signal of the thread's perf event (SGX_PROFILE_SIGNAL) */
+void sgx_profile_event_signal(bool in_enclave);
+
+/* Signal sent on overflow of a perf event in SGX_PROFILE_MODE_PERF_EVENT */
+#define SGX_PROFILE_SIGNAL SIGPROF
+
 /* Record a sample during AEX */
 void sgx_profile_sample_aex(void* tcs);
 
@@ -184,6 +276,9 @@ void sgx_profile_sample_ocall_inner(void* enclave_gpr);
 /* Record a sample during OCALL (function to be executed) */
 void sgx_profile_sample_ocall_outer(void* ocall_func);
 
+/* Record a sample of the finished OCALL, weighted by its duration (`sgx.profile.ocall_duration`) */
+void sgx_profile_sample_ocall_done(void);
+
 /* Record a new mapped ELF */
 void sgx_profile_report_elf(const char* filename, void* addr);
 
@@ -196,9 +291,16 @@ void sgx_profile_report_urts_elfs(void);
 #define PD_STACK_SIZE 8192
 
 struct perf_data;
+struct pd_samples;
 
 struct perf_data* pd_open(const char* file_name, bool with_stack);
 
+/* Allocate a (per-thread) buffer for samples to be written to `pd` */
+struct pd_samples* pd_samples_alloc(struct perf_data* pd);
+
+/* Write out (and empty) the sample buffer; `pd` must not be used concurrently */
+int pd_flush_samples(struct perf_data* pd, struct pd_samples* samples);
+
 /* Finalize and close; returns resulting file size */
 ssize_t pd_close(struct perf_data* pd);
 
@@ -209,12 +311,13 @@ int pd_event_command(struct perf_data* pd, const char* command, uint32_t pid, ui
 int pd_event_mmap(struct perf_data* pd, const char* filename, uint32_t pid, uint64_t addr,
                   uint64_t len, uint64_t pgoff);
 
-/* Write PERF_RECORD_SAMPLE (simple version) */
-int pd_event_sample_simple(struct perf_data* pd, uint64_t ip, uint32_t pid, uint32_t tid,
+/* Add PERF_RECORD_SAMPLE to the buffer (simple version); returns -ENOSPC if the buffer is full */
+int pd_event_sample_simple(struct pd_samples* samples, uint64_t ip, uint32_t pid, uint32_t tid,
                            uint64_t period);
 
-/* Write PERF_RECORD_SAMPLE (with stack sample, at most PD_STACK_SIZE bytes) */
-int pd_event_sample_stack(struct perf_data* pd,  uint64_t ip, uint32_t pid, uint32_t tid,
+/* Add PERF_RECORD_SAMPLE to the buffer (with stack sample, at most PD_STACK_SIZE bytes); returns
+ * -ENOSPC if the buffer is full */
+int pd_event_sample_stack(struct pd_samples* samples, uint64_t ip, uint32_t pid, uint32_t tid,
                           uint64_t period, sgx_pal_gpr_t* gpr, void* stack, size_t stack_size);
 
 #endif
@@ -47,6 +47,13 @@ char* g_libpal_path = NULL;
 
 struct pal_enclave g_pal_enclave;
 
+/* host wall-clock time in microseconds, the same clock as of _DkSystemTimeQuery() in the enclave */
+static uint64_t get_time_us(void) {
+    struct timeval tv;
+    INLINE_SYSCALL(gettimeofday, 2, &tv, NULL);
+    return tv.tv_sec * 1000000UL + tv.tv_usec;
+}
+
 /*
  * FIXME: the ELF-parsing functions in this file (scan_enclave_binary, load_enclave_binary) assume
  * that all the program headers will be found within first FILEBUF_SIZE bytes. This will be true for
@@ -122,6 +129,7 @@ static int load_enclave_binary(sgx_arch_secs_t* secs, int fd, unsigned long base
         ElfW(Addr) mapstart, mapend, datastart, dataend, allocend;
         unsigned int mapoff;
         int prot;
+        void* data; /* host mapping of the file contents */
     } loadcmds[16], *c;
     int nloadcmds = 0;
 
@@ -137,10 +145,28 @@ static int load_enclave_binary(sgx_arch_secs_t* secs, int fd, unsigned long base
             c->dataend   = ph->p_vaddr + ph->p_filesz;
             c->allocend  = ph->p_vaddr + ph->p_memsz;
             c->mapoff    = ALLOC_ALIGN_DOWN(ph->p_offset);
+            c->data      = NULL;
             c->prot = (ph->p_flags & PF_R ? PROT_READ : 0) | (ph->p_flags & PF_W ? PROT_WRITE : 0) |
                       (ph->p_flags & PF_X ? PROT_EXEC : 0) | prot;
         }
 
+    /* map all segments first and start reading them ahead, so that reading of the file overlaps
+     * with adding the previous segments to the enclave */
+    for (c = loadcmds; c < &loadcmds[nloadcmds]; c++) {
+        if (c->mapend <= c->mapstart)
+            continue;
+
+        void* addr = (void*)INLINE_SYSCALL(mmap, 6, NULL, c->mapend - c->mapstart,
+                                           PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FILE, fd,
+                                           c->mapoff);
+        if (IS_ERR_P(addr)) {
+            ret = -ERRNO_P(addr);
+            goto out;
+        }
+        c->data = addr;
+        INLINE_SYSCALL(madvise, 3, addr, c->mapend - c->mapstart, MADV_WILLNEED);
+    }
+
     base -= loadcmds[0].mapstart;
     for (c = loadcmds; c < &loadcmds[nloadcmds]; c++) {
         ElfW(Addr) zero     = c->dataend;
@@ -150,13 +176,8 @@ static int load_enclave_binary(sgx_arch_secs_t* secs, int fd, unsigned long base
         if (zeroend < zeropage)
             zeropage = zeroend;
 
-        if (c->mapend > c->mapstart) {
-            void* addr = (void*)INLINE_SYSCALL(mmap, 6, NULL, c->mapend - c->mapstart,
-                                               PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FILE, fd,
-                                               c->mapoff);
-
-            if (IS_ERR_P(addr))
-                return -ERRNO_P(addr);
+        if (c->data) {
+            void* addr = c->data;
 
             if (c->datastart > c->mapstart)
                 memset(addr, 0, c->datastart - c->mapstart);
@@ -170,20 +191,26 @@ static int load_enclave_binary(sgx_arch_secs_t* secs, int fd, unsigned long base
                                        (c->prot & PROT_EXEC) ? "code" : "data");
 
             INLINE_SYSCALL(munmap, 2, addr, c->mapend - c->mapstart);
+            c->data = NULL;
 
             if (ret < 0)
-                return ret;
+                goto out;
         }
 
         if (zeroend > zeropage) {
             ret = add_pages_to_enclave(secs, (void*)base + zeropage, NULL, zeroend - zeropage,
                                        SGX_PAGE_REG, c->prot, false, "bss");
             if (ret < 0)
-                return ret;
+                goto out;
         }
     }
 
-    return 0;
+    ret = 0;
+out:
+    for (c = loadcmds; c < &loadcmds[nloadcmds]; c++)
+        if (c->data)
+            INLINE_SYSCALL(munmap, 2, c->data, c->mapend - c->mapstart);
+    return ret;
 }
 
 static int initialize_enclave(struct pal_enclave* enclave, const char* manifest_to_measure) {
@@ -255,6 +282,13 @@ static int initialize_enclave(struct pal_enclave* enclave, const char* manifest_
         log_error("Creating enclave failed: %d\n", ret);
         goto out;
     }
+    enclave->pal_sec.startup_times[SGX_STARTUP_ENCLAVE_CREATION] = get_time_us();
+
+    if (enclave->edmm_enabled) {
+        ret = check_edmm_support();
+        if (ret < 0)
+            goto out;
+    }
 
     /* SECS contains SSA frame size in pages, convert to size in bytes */
     enclave->ssa_frame_size = enclave_secs.ssa_frame_size * g_page_size;
@@ -385,7 +419,8 @@ static int initialize_enclave(struct pal_enclave* enclave, const char* manifest_
 
     enclave_entry_addr += pal_area->addr;
 
-    if (last_populated_addr > enclave_heap_min) {
+    /* with EDMM, heap pages are not EADDed but added on demand after enclave initialization */
+    if (last_populated_addr > enclave_heap_min && !enclave->edmm_enabled) {
         areas[area_num] = (struct mem_area){.desc         = "free",
                                             .skip_eextend = true,
                                             .data_src     = ZERO,
@@ -435,6 +470,7 @@ static int initialize_enclave(struct pal_enclave* enclave, const char* manifest_
                 gs->manifest_size = manifest_size;
                 gs->heap_min = (void*)enclave_heap_min;
                 gs->heap_max = (void*)pal_area->addr;
+                gs->edmm_enabled = enclave->edmm_enabled;
                 gs->thread = NULL;
             }
         } else if (areas[i].data_src == TCS) {
@@ -471,13 +507,27 @@ static int initialize_enclave(struct pal_enclave* enclave, const char* manifest_
         }
     }
 
+    enclave->pal_sec.startup_times[SGX_STARTUP_PAGES_ADDING] = get_time_us();
+
     ret = init_enclave(&enclave_secs, &enclave_sigstruct, &enclave_token);
     if (ret < 0) {
         log_error("Initializing enclave failed: %d\n", ret);
         goto out;
     }
+    enclave->pal_sec.startup_times[SGX_STARTUP_ENCLAVE_INIT] = get_time_us();
+
+    if (enclave->edmm_enabled && last_populated_addr > enclave_heap_min) {
+        ret = map_dynamic_enclave_pages((void*)enclave_heap_min,
+                                        last_populated_addr - enclave_heap_min);
+        if (ret < 0)
+            goto out;
+    }
 
-    create_tcs_mapper((void*)tcs_area->addr, enclave->thread_num);
+    ret = create_tcs_mapper((void*)tcs_area->addr, enclave->thread_num);
+    if (ret < 0) {
+        log_error("Creating TCS mapper failed: %d\n", ret);
+        goto out;
+    }
 
     struct enclave_dbginfo* dbg = (void*)INLINE_SYSCALL(
         mmap, 6, DBGINFO_ADDR, sizeof(struct enclave_dbginfo), PROT_READ | PROT_WRITE,
@@ -496,7 +546,12 @@ static int initialize_enclave(struct pal_enclave* enclave, const char* manifest_
             dbg->tcs_addrs[i] = tcs_addrs[i];
     }
 
-    if (g_sgx_enable_stats) {
+    bool dbgoptin = g_sgx_enable_stats;
+#ifdef DEBUG
+    /* hardware perf events don't count inside the enclave otherwise */
+    dbgoptin |= enclave->profile_enable && enclave->profile_mode == SGX_PROFILE_MODE_PERF_EVENT;
+#endif
+    if (dbgoptin) {
         /* set TCS.FLAGS.DBGOPTIN in all enclave threads to enable perf counters, Intel PT, etc */
         ret = INLINE_SYSCALL(open, 3, "/proc/self/mem", O_RDWR | O_LARGEFILE, 0);
         if (ret < 0) {
@@ -647,6 +702,94 @@ static int parse_loader_config(char* manifest, struct pal_enclave* enclave_info)
         goto out;
     }
 
+    char* rpc_affinity_str = NULL;
+    ret = toml_string_in(manifest_root, "sgx.rpc_affinity", &rpc_affinity_str);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.rpc_affinity' "
+                  "(the value must be \"shared\", \"paired\" or \"numa\")\n");
+        ret = -EINVAL;
+        goto out;
+    }
+    if (!rpc_affinity_str || !strcmp(rpc_affinity_str, "shared")) {
+        enclave_info->rpc_affinity = RPC_AFFINITY_SHARED;
+    } else if (!strcmp(rpc_affinity_str, "paired")) {
+        enclave_info->rpc_affinity = RPC_AFFINITY_PAIRED;
+    } else if (!strcmp(rpc_affinity_str, "numa")) {
+        enclave_info->rpc_affinity = RPC_AFFINITY_NUMA;
+    } else {
+        log_error("Invalid 'sgx.rpc_affinity' (the value must be \"shared\", \"paired\" or "
+                  "\"numa\")\n");
+        free(rpc_affinity_str);
+        ret = -EINVAL;
+        goto out;
+    }
+    free(rpc_affinity_str);
+
+    int64_t rpc_thread_spin_max_int64;
+    ret = toml_int_in(manifest_root, "sgx.rpc_thread_spin_max", /*defaultval=*/RPC_THREAD_SPIN_MAX,
+                      &rpc_thread_spin_max_int64);
+    if (ret < 0 || rpc_thread_spin_max_int64 < 0) {
+        log_error("Cannot parse 'sgx.rpc_thread_spin_max' "
+                  "(the value must be a non-negative integer)\n");
+        ret = -EINVAL;
+        goto out;
+    }
+    enclave_info->rpc_thread_spin_max = rpc_thread_spin_max_int64;
+
+    int64_t rpc_thread_sleep_max_int64;
+    ret = toml_int_in(manifest_root, "sgx.rpc_thread_sleep_max",
+                      /*defaultval=*/RPC_THREAD_SLEEP_MAX, &rpc_thread_sleep_max_int64);
+    if (ret < 0 || rpc_thread_sleep_max_int64 < 0 || rpc_thread_sleep_max_int64 >= 1000000) {
+        log_error("Cannot parse 'sgx.rpc_thread_sleep_max' "
+                  "(the value must be a number of microseconds less than 1000000)\n");
+        ret = -EINVAL;
+        goto out;
+    }
+    enclave_info->rpc_thread_sleep_max = rpc_thread_sleep_max_int64;
+
+    ret = toml_bool_in(manifest_root, "sgx.rpc_io_uring", /*defaultval=*/false,
+                       &enclave_info->rpc_io_uring);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.rpc_io_uring' (the value must be `true` or `false`)\n");
+        ret = -EINVAL;
+        goto out;
+    }
+
+    int64_t process_pool_size_int64;
+    ret = toml_int_in(manifest_root, "sgx.process_pool_size", /*defaultval=*/0,
+                      &process_pool_size_int64);
+    if (ret < 0 || process_pool_size_int64 < 0
+            || process_pool_size_int64 > MAX_PROCESS_POOL_SIZE) {
+        log_error("Cannot parse 'sgx.process_pool_size' (the value must be a number between 0 and "
+                  "%d)\n", MAX_PROCESS_POOL_SIZE);
+        ret = -EINVAL;
+        goto out;
+    }
+    enclave_info->process_pool_size = process_pool_size_int64;
+
+    int64_t thread_pool_size_int64;
+    ret = toml_int_in(manifest_root, "sgx.thread_pool_size", /*defaultval=*/0,
+                      &thread_pool_size_int64);
+    if (ret < 0 || thread_pool_size_int64 < 0
+            || thread_pool_size_int64 > MAX_THREAD_POOL_SIZE) {
+        log_error("Cannot parse 'sgx.thread_pool_size' (the value must be a number between 0 and "
+                  "%d)\n", MAX_THREAD_POOL_SIZE);
+        ret = -EINVAL;
+        goto out;
+    }
+    enclave_info->thread_pool_size = thread_pool_size_int64;
+
+    int64_t thread_pool_idle_timeout_int64;
+    ret = toml_int_in(manifest_root, "sgx.thread_pool_idle_timeout", /*defaultval=*/1000,
+                      &thread_pool_idle_timeout_int64);
+    if (ret < 0 || thread_pool_idle_timeout_int64 < 0) {
+        log_error("Cannot parse 'sgx.thread_pool_idle_timeout' "
+                  "(the value must be a non-negative number of milliseconds)\n");
+        ret = -EINVAL;
+        goto out;
+    }
+    enclave_info->thread_pool_idle_timeout = thread_pool_idle_timeout_int64;
+
     bool nonpie_binary;
     ret = toml_bool_in(manifest_root, "sgx.nonpie_binary", /*defaultval=*/false, &nonpie_binary);
     if (ret < 0) {
@@ -656,6 +799,15 @@ static int parse_loader_config(char* manifest, struct pal_enclave* enclave_info)
     }
     enclave_info->nonpie_binary = nonpie_binary;
 
+    bool edmm_enabled;
+    ret = toml_bool_in(manifest_root, "sgx.edmm_enable", /*defaultval=*/false, &edmm_enabled);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.edmm_enable' (the value must be `true` or `false`)\n");
+        ret = -EINVAL;
+        goto out;
+    }
+    enclave_info->edmm_enabled = edmm_enabled;
+
     ret = toml_bool_in(manifest_root, "sgx.enable_stats", /*defaultval=*/false,
                        &g_sgx_enable_stats);
     if (ret < 0) {
@@ -743,7 +895,8 @@ static int parse_loader_config(char* manifest, struct pal_enclave* enclave_info)
     ret = toml_string_in(manifest_root, "sgx.profile.mode", &profile_mode_str);
     if (ret < 0) {
         log_error("Cannot parse 'sgx.profile.mode' "
-                  "(the value must be \"aex\", \"ocall_inner\" or \"ocall_outer\")\n");
+                  "(the value must be \"aex\", \"ocall_inner\", \"ocall_outer\" or "
+                  "\"perf_event\")\n");
         ret = -EINVAL;
         goto out;
     }
@@ -755,9 +908,12 @@ static int parse_loader_config(char* manifest, struct pal_enclave* enclave_info)
         enclave_info->profile_mode = SGX_PROFILE_MODE_OCALL_INNER;
     } else if (!strcmp(profile_mode_str, "ocall_outer")) {
         enclave_info->profile_mode = SGX_PROFILE_MODE_OCALL_OUTER;
+    } else if (!strcmp(profile_mode_str, "perf_event")) {
+        enclave_info->profile_mode = SGX_PROFILE_MODE_PERF_EVENT;
     } else {
         log_error("Invalid 'sgx.profile.mode' "
-                  "(the value must be \"aex\", \"ocall_inner\" or \"ocall_outer\")\n");
+                  "(the value must be \"aex\", \"ocall_inner\", \"ocall_outer\" or "
+                  "\"perf_event\")\n");
         ret = -EINVAL;
         goto out;
     }
@@ -791,6 +947,59 @@ static int parse_loader_config(char* manifest, struct pal_enclave* enclave_info)
         goto out;
     }
     enclave_info->profile_frequency = profile_frequency;
+
+    bool profile_ocall_duration;
+    ret = toml_bool_in(manifest_root, "sgx.profile.ocall_duration", /*defaultval=*/false,
+                       &profile_ocall_duration);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.profile.ocall_duration' (the value must be `true` or "
+                  "`false`)\n");
+        ret = -EINVAL;
+        goto out;
+    }
+    enclave_info->profile_ocall_duration = profile_ocall_duration;
+
+    char* profile_event_str = NULL;
+    ret = toml_string_in(manifest_root, "sgx.profile.event", &profile_event_str);
+    if (ret < 0) {
+        log_error("Cannot parse 'sgx.profile.event' (the value must be \"cycles\", "
+                  "\"cache_misses\", \"dtlb_misses\" or \"page_faults\")\n");
+        ret = -EINVAL;
+        goto out;
+    }
+    /* default periods give a few hundred samples per second of a busy thread */
+    uint64_t default_event_period;
+    if (!profile_event_str || !strcmp(profile_event_str, "cycles")) {
+        enclave_info->profile_event = SGX_PROFILE_EVENT_CYCLES;
+        default_event_period = 10000000;
+    } else if (!strcmp(profile_event_str, "cache_misses")) {
+        enclave_info->profile_event = SGX_PROFILE_EVENT_CACHE_MISSES;
+        default_event_period = 100000;
+    } else if (!strcmp(profile_event_str, "dtlb_misses")) {
+        enclave_info->profile_event = SGX_PROFILE_EVENT_DTLB_MISSES;
+        default_event_period = 100000;
+    } else if (!strcmp(profile_event_str, "page_faults")) {
+        enclave_info->profile_event = SGX_PROFILE_EVENT_PAGE_FAULTS;
+        default_event_period = 100;
+    } else {
+        log_error("Invalid 'sgx.profile.event' (the value must be \"cycles\", "
+                  "\"cache_misses\", \"dtlb_misses\" or \"page_faults\")\n");
+        free(profile_event_str);
+        ret = -EINVAL;
+        goto out;
+    }
+    free(profile_event_str);
+
+    int64_t profile_event_period;
+    ret = toml_int_in(manifest_root, "sgx.profile.event_period", default_event_period,
+                      &profile_event_period);
+    if (ret < 0 || profile_event_period <= 0) {
+        log_error("Cannot parse 'sgx.profile.event_period' (the value must be a positive "
+                  "number)\n");
+        ret = -EINVAL;
+        goto out;
+    }
+    enclave_info->profile_event_period = profile_event_period;
 #else
     if (profile_str && strcmp(profile_str, "none")) {
         log_error("Invalid 'sgx.profile.enable' "
@@ -861,12 +1070,9 @@ out:
 static int load_enclave(struct pal_enclave* enclave, char* args, size_t args_size, char* env,
                         size_t env_size, bool need_gsgx) {
     int ret;
-    struct timeval tv;
     struct pal_sec* pal_sec = &enclave->pal_sec;
 
-    uint64_t start_time;
-    INLINE_SYSCALL(gettimeofday, 2, &tv, NULL);
-    start_time = tv.tv_sec * 1000000UL + tv.tv_usec;
+    uint64_t start_time = get_time_us();
 
     ret = parse_loader_config(enclave->raw_manifest_data, enclave);
     if (ret < 0) {
@@ -1001,6 +1207,11 @@ static int load_enclave(struct pal_enclave* enclave, char* args, size_t args_siz
     if (ret < 0)
         return ret;
 
+    /* Children fill their pools only once they create a process themselves, otherwise each pooled
+     * child would spawn a pool of its own. */
+    if (enclave->is_first_process)
+        sgx_fill_process_pool();
+
     if (enclave->remote_attestation_enabled) {
         /* initialize communication with Quoting Enclave only if app requests attestation */
         bool is_epid = enclave->use_epid_attestation;
@@ -1023,9 +1234,8 @@ static int load_enclave(struct pal_enclave* enclave, char* args, size_t args_siz
     if (ret < 0)
         return ret;
 
-    uint64_t end_time;
-    INLINE_SYSCALL(gettimeofday, 2, &tv, NULL);
-    end_time = tv.tv_sec * 1000000UL + tv.tv_usec;
+    uint64_t end_time = get_time_us();
+    pal_sec->startup_times[SGX_STARTUP_UNTRUSTED_PAL] = end_time;
 
     if (g_sgx_enable_stats) {
         /* This shows the time for Graphene + the Intel SGX driver to initialize the untrusted
@@ -1070,6 +1280,8 @@ int main(int argc, char* argv[], char* envp[]) {
     bool need_gsgx = true;
     char* manifest = NULL;
 
+    g_pal_enclave.pal_sec.startup_times[SGX_STARTUP_LOADER_START] = get_time_us();
+
     force_linux_to_grow_stack();
 
     if (argc < 4)
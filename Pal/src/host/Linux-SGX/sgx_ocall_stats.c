@@ -0,0 +1,178 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+
+/*
+ * Per-OCALL statistics (enabled with `sgx.enable_stats`). For every OCALL index and for each of
+ * the two paths (direct OCALL with enclave exit, exitless OCALL served by an RPC thread), we count
+ * the number of calls and keep a histogram of host-side latencies, measured in TSC cycles and
+ * bucketed by log2. Note that the latency covers only the untrusted handler of the OCALL, i.e., it
+ * does not include enclave exit/entry or the RPC queue round-trip.
+ *
+ * Counters are updated with relaxed atomics by all threads and are never reset, so the stats can be
+ * dumped at any time: they are printed on process exit and on SIGUSR1 sent to the Graphene process.
+ * The SIGUSR1 handler only requests the dump, which is done by the next thread returning from a
+ * direct OCALL or by an RPC thread (printing is not async-signal-safe).
+ */
+
+#include "cpu.h"
+#include "ocall_types.h"
+#include "sgx_internal.h"
+#include "sgx_log.h"
+#include "sgx_tls.h"
+
+#define OCALL_STATS_BUCKETS 32 /* bucket `i` counts latencies in [2^i, 2^(i+1)) cycles */
+
+struct ocall_path_stats {
+    uint64_t cycles;
+    uint64_t hist[OCALL_STATS_BUCKETS];
+};
+
+struct ocall_stats {
+    struct ocall_path_stats path[OCALL_STATS_PATHS];
+};
+
+static struct ocall_stats g_ocall_stats[OCALL_NR];
+
+static bool g_stats_dump_requested = false;
+
+static const char* const g_ocall_names[OCALL_NR] = {
+    [OCALL_EXIT]              = "exit",
+    [OCALL_MMAP_UNTRUSTED]    = "mmap_untrusted",
+    [OCALL_MUNMAP_UNTRUSTED]  = "munmap_untrusted",
+    [OCALL_CPUID]             = "cpuid",
+    [OCALL_OPEN]              = "open",
+    [OCALL_CLOSE]             = "close",
+    [OCALL_READ]              = "read",
+    [OCALL_WRITE]             = "write",
+    [OCALL_PREAD]             = "pread",
+    [OCALL_PWRITE]            = "pwrite",
+    [OCALL_PWRITEV]           = "pwritev",
+    [OCALL_READV]             = "readv",
+    [OCALL_WRITEV]            = "writev",
+    [OCALL_SENDFILE]          = "sendfile",
+    [OCALL_COPY_FILE_RANGE]   = "copy_file_range",
+    [OCALL_FSTAT]             = "fstat",
+    [OCALL_FIONREAD]          = "fionread",
+    [OCALL_FSETNONBLOCK]      = "fsetnonblock",
+    [OCALL_FCHMOD]            = "fchmod",
+    [OCALL_FSYNC]             = "fsync",
+    [OCALL_FTRUNCATE]         = "ftruncate",
+    [OCALL_FALLOCATE]         = "fallocate",
+    [OCALL_FADVISE]           = "fadvise",
+    [OCALL_MKDIR]             = "mkdir",
+    [OCALL_GETDENTS]          = "getdents",
+    [OCALL_RESUME_THREAD]     = "resume_thread",
+    [OCALL_SCHED_SETAFFINITY] = "sched_setaffinity",
+    [OCALL_SCHED_GETAFFINITY] = "sched_getaffinity",
+    [OCALL_CLONE_THREAD]      = "clone_thread",
+    [OCALL_CREATE_PROCESS]    = "create_process",
+    [OCALL_FUTEX]             = "futex",
+    [OCALL_SOCKETPAIR]        = "socketpair",
+    [OCALL_LISTEN]            = "listen",
+    [OCALL_ACCEPT]            = "accept",
+    [OCALL_ACCEPT_MULTI]      = "accept_multi",
+    [OCALL_CONNECT]           = "connect",
+    [OCALL_RECV]              = "recv",
+    [OCALL_SEND]              = "send",
+    [OCALL_RECVMMSG]          = "recvmmsg",
+    [OCALL_SENDMMSG]          = "sendmmsg",
+    [OCALL_SETSOCKOPT]        = "setsockopt",
+    [OCALL_SHUTDOWN]          = "shutdown",
+    [OCALL_GETTIME]           = "gettime",
+    [OCALL_SCHED_YIELD]       = "sched_yield",
+    [OCALL_POLL]              = "poll",
+    [OCALL_EPOLL_CREATE]      = "epoll_create",
+    [OCALL_EPOLL_CTL]         = "epoll_ctl",
+    [OCALL_EPOLL_WAIT]        = "epoll_wait",
+    [OCALL_RENAME]            = "rename",
+    [OCALL_DELETE]            = "delete",
+    [OCALL_DEBUG_MAP_ADD]     = "debug_map_add",
+    [OCALL_DEBUG_MAP_REMOVE]  = "debug_map_remove",
+    [OCALL_EVENTFD]           = "eventfd",
+    [OCALL_GET_QUOTE]         = "get_quote",
+    [OCALL_BATCH]             = "batch",
+    [OCALL_EDMM_TRIM_PAGES]   = "edmm_trim_pages",
+    [OCALL_EDMM_REMOVE_PAGES] = "edmm_remove_pages",
+    [OCALL_EDMM_CONVERT_TCS]  = "edmm_convert_tcs",
+};
+
+void sgx_ocall_stats_record(uint64_t code, int path, uint64_t cycles) {
+    if (code >= OCALL_NR || path < 0 || path >= OCALL_STATS_PATHS)
+        return;
+
+    size_t bucket = cycles ? 63 - __builtin_clzl(cycles) : 0;
+    if (bucket >= OCALL_STATS_BUCKETS)
+        bucket = OCALL_STATS_BUCKETS - 1;
+
+    struct ocall_path_stats* stats = &g_ocall_stats[code].path[path];
+    __atomic_add_fetch(&stats->cycles, cycles, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats->hist[bucket], 1, __ATOMIC_RELAXED);
+}
+
+long sgx_ocall_with_stats(void* ms, sgx_ocall_fn_t handler, uint64_t code) {
+    uint64_t start = get_tsc();
+    long ret = handler(ms);
+    sgx_ocall_stats_record(code, OCALL_STATS_PATH_DIRECT, get_tsc() - start);
+    sgx_stats_dump_if_requested();
+    return ret;
+}
+
+static void print_ocall_path_stats(const char* name, const char* path_name,
+                                   struct ocall_path_stats* stats) {
+    uint64_t hist[OCALL_STATS_BUCKETS];
+    uint64_t count = 0;
+    for (size_t i = 0; i < OCALL_STATS_BUCKETS; i++) {
+        hist[i] = __atomic_load_n(&stats->hist[i], __ATOMIC_RELAXED);
+        count += hist[i];
+    }
+    if (!count)
+        return;
+
+    uint64_t cycles = __atomic_load_n(&stats->cycles, __ATOMIC_RELAXED);
+
+    /* print only the non-empty range of the histogram */
+    size_t first = 0;
+    while (!hist[first])
+        first++;
+    size_t last = OCALL_STATS_BUCKETS - 1;
+    while (!hist[last])
+        last--;
+
+    char buf[OCALL_STATS_BUCKETS * 24];
+    size_t off = 0;
+    for (size_t i = first; i <= last && off < sizeof(buf); i++)
+        off += snprintf(buf + off, sizeof(buf) - off, " %lu", hist[i]);
+
+    log_always("  %s (%s): %lu calls, avg %lu cycles, log2 histogram from 2^%lu:%s\n",
+               name, path_name, count, cycles / count, first, buf);
+}
+
+void sgx_ocall_stats_print(void) {
+    if (!g_sgx_enable_stats)
+        return;
+
+    int pid = INLINE_SYSCALL(getpid, 0);
+    log_always("----- OCALL stats for process %d (host-side latency in TSC cycles) -----\n", pid);
+    for (size_t code = 0; code < OCALL_NR; code++) {
+        const char* name = g_ocall_names[code] ?: "unknown";
+        print_ocall_path_stats(name, "direct",
+                               &g_ocall_stats[code].path[OCALL_STATS_PATH_DIRECT]);
+        print_ocall_path_stats(name, "exitless",
+                               &g_ocall_stats[code].path[OCALL_STATS_PATH_EXITLESS]);
+    }
+}
+
+void sgx_stats_request_dump(void) {
+    __atomic_store_n(&g_stats_dump_requested, true, __ATOMIC_RELAXED);
+}
+
+void sgx_stats_dump_if_requested(void) {
+    if (!__atomic_load_n(&g_stats_dump_requested, __ATOMIC_RELAXED))
+        return;
+    /* only one thread dumps the stats for each request */
+    if (!__atomic_exchange_n(&g_stats_dump_requested, false, __ATOMIC_RELAXED))
+        return;
+
+    sgx_ocall_stats_print();
+    print_rpc_stats();
+    print_epc_stats();
+}
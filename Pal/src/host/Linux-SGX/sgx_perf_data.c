@@ -19,6 +19,10 @@
  * convenient to use because perf userspace tools recognize it only when reading from stdin. This
  * has been fixed in Linux 5.8: https://lkml.org/lkml/2020/5/7/294)
  *
+ * Samples are not written to `struct perf_data` directly, but to per-thread buffers
+ * (`struct pd_samples`), which the caller merges into the file with pd_flush_samples(). This way,
+ * threads recording samples don't need to synchronize on every sample.
+ *
  * To view the report, use 'perf report -i <filename>'.
  *
  * For debugging the output, you can use:
@@ -46,6 +50,9 @@
  * flush to a file too often. */
 #define BUF_SIZE (32 * 1024 * 1024)
 
+/* Buffer size for samples of one thread (1 MB, i.e. about 120 samples with stack). */
+#define SAMPLES_BUF_SIZE (1024 * 1024)
+
 /* Registers to sample - see arch/x86/include/uapi/asm/perf_regs.h */
 #define NUM_SAMPLE_REGS 18
 #define SAMPLE_REGS ((1 << PERF_REG_X86_AX)    | \
@@ -101,6 +108,12 @@ struct perf_data {
     bool with_stack;
 };
 
+struct pd_samples {
+    bool with_stack;
+    size_t buf_count;
+    uint8_t buf[SAMPLES_BUF_SIZE];
+};
+
 static ssize_t write_all(int fd, const void* buf, size_t count) {
     while (count > 0) {
         ssize_t ret = INLINE_SYSCALL(write, 3, fd, buf, count);
@@ -139,6 +152,13 @@ static int pd_write(struct perf_data* pd, const void* data, size_t size) {
     return 0;
 }
 
+// Add data to a sample buffer; the caller checks that there is enough space
+static void samples_write(struct pd_samples* samples, const void* data, size_t size) {
+    assert(samples->buf_count + size <= sizeof(samples->buf));
+    memcpy(samples->buf + samples->buf_count, data, size);
+    samples->buf_count += size;
+}
+
 struct perf_data* pd_open(const char* file_name, bool with_stack) {
     int ret;
 
@@ -347,8 +367,29 @@ int pd_event_mmap(struct perf_data* pd, const char* filename, uint32_t pid, uint
     return 0;
 }
 
-static int pd_event_sample(struct perf_data* pd, uint64_t ip, uint32_t pid, uint32_t tid,
-                         uint64_t period, size_t extra_size) {
+struct pd_samples* pd_samples_alloc(struct perf_data* pd) {
+    struct pd_samples* samples = malloc(sizeof(*samples));
+    if (!samples) {
+        log_error("pd_samples_alloc: out of memory\n");
+        return NULL;
+    }
+
+    samples->with_stack = pd->with_stack;
+    samples->buf_count = 0;
+    return samples;
+}
+
+int pd_flush_samples(struct perf_data* pd, struct pd_samples* samples) {
+    assert(samples->with_stack == pd->with_stack);
+    int ret = pd_write(pd, samples->buf, samples->buf_count);
+    if (ret < 0)
+        return ret;
+    samples->buf_count = 0;
+    return 0;
+}
+
+static int pd_event_sample(struct pd_samples* samples, uint64_t ip, uint32_t pid, uint32_t tid,
+                           uint64_t period, size_t extra_size) {
     struct {
         struct perf_event_header header;
 
@@ -368,18 +409,23 @@ static int pd_event_sample(struct perf_data* pd, uint64_t ip, uint32_t pid, uint
         .period = period,
     };
 
-    return pd_write(pd, &event, sizeof(event));
+    // All or nothing: the extra data is written by the caller
+    if (samples->buf_count + sizeof(event) + extra_size > sizeof(samples->buf))
+        return -ENOSPC;
+
+    samples_write(samples, &event, sizeof(event));
+    return 0;
 }
 
-int pd_event_sample_simple(struct perf_data* pd, uint64_t ip, uint32_t pid, uint32_t tid,
+int pd_event_sample_simple(struct pd_samples* samples, uint64_t ip, uint32_t pid, uint32_t tid,
                            uint64_t period) {
-    assert(!pd->with_stack);
-    return pd_event_sample(pd, ip, pid, tid, period, /*extra_size=*/0);
+    assert(!samples->with_stack);
+    return pd_event_sample(samples, ip, pid, tid, period, /*extra_size=*/0);
 }
 
-int pd_event_sample_stack(struct perf_data* pd, uint64_t ip, uint32_t pid, uint32_t tid,
+int pd_event_sample_stack(struct pd_samples* samples, uint64_t ip, uint32_t pid, uint32_t tid,
                           uint64_t period, sgx_pal_gpr_t* gpr, void* stack, size_t stack_size) {
-    assert(pd->with_stack);
+    assert(samples->with_stack);
     struct {
         // Empty callchain section - needed so that perf will attempt to recover call chain
         struct {
@@ -423,26 +469,18 @@ int pd_event_sample_stack(struct perf_data* pd, uint64_t ip, uint32_t pid, uint3
     int ret;
 
     // Common section
-    ret = pd_event_sample(pd, ip, pid, tid, period, extra_size);
+    ret = pd_event_sample(samples, ip, pid, tid, period, extra_size);
     if (ret < 0)
         return ret;
 
     // Callchain and regs sections
-    ret = pd_write(pd, &extra, sizeof(extra));
-    if (ret < 0)
-        return ret;
+    samples_write(samples, &extra, sizeof(extra));
 
     // Stack section (variable length)
     uint64_t size_field = stack_size;
-    ret = pd_write(pd, &size_field, sizeof(size_field));  // uint64_t size
-    if (ret < 0)
-        return ret;
-    ret = pd_write(pd, stack, stack_size);
-    if (ret < 0)
-        return ret;
-    ret = pd_write(pd, &size_field, sizeof(size_field));  // uint64_t dyn_size = size
-    if (ret < 0)
-        return ret;
+    samples_write(samples, &size_field, sizeof(size_field));  // uint64_t size
+    samples_write(samples, stack, stack_size);
+    samples_write(samples, &size_field, sizeof(size_field));  // uint64_t dyn_size = size
 
     return 0;
 }
@@ -20,6 +20,7 @@
 #include "sgx_internal.h"
 #include "sgx_log.h"
 #include "sgx_tls.h"
+#include "spinlock.h"
 
 extern char* g_pal_loader_path;
 extern char* g_libpal_path;
@@ -61,7 +62,7 @@ static int __attribute_noinline vfork_exec(int parent_stream, const char** argv)
     return 0;
 }
 
-int sgx_create_process(size_t nargs, const char** args, int* stream_fd, const char* manifest) {
+static int spawn_process(size_t nargs, const char** args, int* stream_fd, const char* manifest) {
     int ret, rete, child;
     int fds[2] = {-1, -1};
 
@@ -154,6 +155,85 @@ out:
     return ret;
 }
 
+/*
+ * Children spawned ahead of time, sized by `sgx.process_pool_size` in the manifest. Everything
+ * a child needs (the manifest and the parent's instance) is known upfront, so a pooled child builds
+ * its enclave (ECREATE, EADD, EEXTEND, EINIT) right away and then waits inside the enclave until
+ * the parent connects over the stream. Creating a process only hands out one of them (and spawns
+ * a replacement), instead of waiting for a new enclave to be built from scratch.
+ */
+static struct {
+    int pid;
+    int stream_fd;
+} g_process_pool[MAX_PROCESS_POOL_SIZE];
+static size_t g_process_pool_cnt = 0;
+/* number of children being spawned into the pool */
+static size_t g_process_pool_pending = 0;
+static spinlock_t g_process_pool_lock = INIT_SPINLOCK_UNLOCKED;
+
+void sgx_fill_process_pool(void) {
+    while (true) {
+        spinlock_lock(&g_process_pool_lock);
+        bool full = g_process_pool_cnt + g_process_pool_pending >= g_pal_enclave.process_pool_size;
+        if (!full)
+            g_process_pool_pending++;
+        spinlock_unlock(&g_process_pool_lock);
+
+        if (full)
+            return;
+
+        /* spawning takes a while, don't hold the lock meanwhile */
+        int stream_fd;
+        int pid = spawn_process(/*nargs=*/0, /*args=*/NULL, &stream_fd,
+                                g_pal_enclave.raw_manifest_data);
+
+        spinlock_lock(&g_process_pool_lock);
+        g_process_pool_pending--;
+        if (pid >= 0) {
+            g_process_pool[g_process_pool_cnt].pid = pid;
+            g_process_pool[g_process_pool_cnt].stream_fd = stream_fd;
+            g_process_pool_cnt++;
+        }
+        spinlock_unlock(&g_process_pool_lock);
+
+        if (pid < 0) {
+            log_warning("failed to spawn a child for the process pool: %d\n", pid);
+            return;
+        }
+    }
+}
+
+int sgx_create_process(size_t nargs, const char** args, int* stream_fd, const char* manifest) {
+    /* pooled children are spawned without arguments, like LibOS always creates processes */
+    bool use_pool = g_pal_enclave.process_pool_size && !nargs && stream_fd
+                    && manifest == g_pal_enclave.raw_manifest_data;
+
+    int pid = -1;
+    if (use_pool) {
+        spinlock_lock(&g_process_pool_lock);
+        if (g_process_pool_cnt) {
+            /* the oldest child is the most likely to have finished building its enclave */
+            pid = g_process_pool[0].pid;
+            *stream_fd = g_process_pool[0].stream_fd;
+            g_process_pool_cnt--;
+            memmove(&g_process_pool[0], &g_process_pool[1],
+                    g_process_pool_cnt * sizeof(g_process_pool[0]));
+        }
+        spinlock_unlock(&g_process_pool_lock);
+    }
+
+    if (pid < 0) {
+        pid = spawn_process(nargs, args, stream_fd, manifest);
+        if (pid < 0)
+            return pid;
+    }
+
+    if (use_pool)
+        sgx_fill_process_pool();
+
+    return pid;
+}
+
 int sgx_init_child_process(int parent_pipe_fd, struct pal_sec* pal_sec, char** application_path_out,
                            char** manifest_out) {
     int ret;
@@ -6,13 +6,28 @@
 /*
  * SGX profiling. This code takes samples of running code and writes them out to a perf.data file
  * (see also sgx_perf_data.c).
+ *
+ * Each thread records its samples into its own buffer (`struct profile_buf`), so that threads don't
+ * contend on `g_perf_data_lock` for every sample. The buffer is merged into the perf.data file when
+ * it's full, when the thread exits and when the profiling finishes. The buffers of exited threads
+ * are reused by new threads.
+ *
+ * In the `perf_event` mode, each thread opens a perf event counting in user space (e.g. CPU cycles
+ * or cache misses; the enclave TCSs are opted in to debug, so that the counters also count inside
+ * the enclave). Every `sgx.profile.event_period` events, the counter overflows and the kernel sends
+ * SGX_PROFILE_SIGNAL to the thread, which causes an AEX if the thread is in the enclave. The sample
+ * is then taken on the AEX path as in the `aex` mode, and attributed to the interrupted enclave
+ * code. Overflows in untrusted code are ignored.
  */
 
 #ifdef DEBUG
 
+#include <asm/fcntl.h>
 #include <assert.h>
 #include <errno.h>
 #include <linux/limits.h>
+#include <linux/perf_event.h>
+#include <linux/signal.h>
 #include <stddef.h>
 
 #include "cpu.h"
@@ -30,8 +45,17 @@ char* realpath(const char* path, char* resolved_path);
 
 #define NSEC_IN_SEC 1000000000
 
+struct profile_buf {
+    struct profile_buf* next;   /* in `g_profile_bufs`, protected by `g_perf_data_lock` */
+    bool in_use;                /* owned by a thread, protected by `g_perf_data_lock` */
+    spinlock_t lock;            /* taken by the owning thread and by sgx_profile_finish() */
+    struct pd_samples* samples;
+};
+
+/* protects `g_perf_data` and `g_profile_bufs`; nests inside `profile_buf::lock` */
 static spinlock_t g_perf_data_lock = INIT_SPINLOCK_UNLOCKED;
 static struct perf_data* g_perf_data = NULL;
+static struct profile_buf* g_profile_bufs = NULL;
 
 static bool g_profile_enabled = false;
 static int g_profile_mode;
@@ -147,6 +171,164 @@ out:
     return ret;
 }
 
+/* Merge the samples of `buf` into the perf.data file. If the profiling already finished, the
+ * samples are dropped. */
+static int flush_profile_buf(struct profile_buf* buf) {
+    assert(spinlock_is_locked(&buf->lock));
+
+    int ret = 0;
+    spinlock_lock(&g_perf_data_lock);
+    if (g_perf_data)
+        ret = pd_flush_samples(g_perf_data, buf->samples);
+    spinlock_unlock(&g_perf_data_lock);
+    return ret;
+}
+
+static struct profile_buf* get_profile_buf(void) {
+    PAL_TCB_URTS* tcb = get_tcb_urts();
+    if (tcb->profile_buf)
+        return tcb->profile_buf;
+
+    spinlock_lock(&g_perf_data_lock);
+    struct profile_buf* buf = g_profile_bufs;
+    while (buf && buf->in_use)
+        buf = buf->next;
+
+    if (!buf && g_perf_data) {
+        buf = malloc(sizeof(*buf));
+        if (buf) {
+            buf->samples = pd_samples_alloc(g_perf_data);
+            if (!buf->samples) {
+                free(buf);
+                buf = NULL;
+            }
+        }
+        if (buf) {
+            spinlock_init(&buf->lock);
+            buf->next = g_profile_bufs;
+            g_profile_bufs = buf;
+        }
+    }
+    if (buf)
+        buf->in_use = true;
+    spinlock_unlock(&g_perf_data_lock);
+
+    if (!buf) {
+        log_error("error allocating sample buffer\n");
+        return NULL;
+    }
+    tcb->profile_buf = buf;
+    return buf;
+}
+
+static int open_perf_event(void) {
+    struct perf_event_attr attr = {
+        .size = sizeof(attr),
+        .sample_period = g_pal_enclave.profile_event_period,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+        .disabled = 1,
+    };
+    switch (g_pal_enclave.profile_event) {
+        case SGX_PROFILE_EVENT_CYCLES:
+            attr.type   = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case SGX_PROFILE_EVENT_CACHE_MISSES:
+            attr.type   = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            break;
+        case SGX_PROFILE_EVENT_DTLB_MISSES:
+            attr.type   = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                          | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        case SGX_PROFILE_EVENT_PAGE_FAULTS:
+            /* includes EPC page faults, as the AEX makes them visible to the kernel */
+            attr.type   = PERF_TYPE_SOFTWARE;
+            attr.config = PERF_COUNT_SW_PAGE_FAULTS;
+            break;
+        default:
+            return -EINVAL;
+    }
+
+    int fd = INLINE_SYSCALL(perf_event_open, 5, &attr, /*pid=*/0, /*cpu=*/-1, /*group_fd=*/-1,
+                            /*flags=*/0);
+    if (fd < 0)
+        return fd;
+
+    /* deliver the overflow signal to this thread */
+    struct f_owner_ex owner = {
+        .type = F_OWNER_TID,
+        .pid  = INLINE_SYSCALL(gettid, 0),
+    };
+    int ret = INLINE_SYSCALL(fcntl, 3, fd, F_SETOWN_EX, &owner);
+    if (ret < 0)
+        goto fail;
+    ret = INLINE_SYSCALL(fcntl, 3, fd, F_SETSIG, SGX_PROFILE_SIGNAL);
+    if (ret < 0)
+        goto fail;
+    ret = INLINE_SYSCALL(fcntl, 3, fd, F_SETFL, FASYNC);
+    if (ret < 0)
+        goto fail;
+
+    /* enable until the next overflow, re-armed in sgx_profile_event_signal() */
+    ret = INLINE_SYSCALL(ioctl, 3, fd, PERF_EVENT_IOC_REFRESH, 1);
+    if (ret < 0)
+        goto fail;
+    return fd;
+
+fail:
+    INLINE_SYSCALL(close, 1, fd);
+    return ret;
+}
+
+void sgx_profile_thread_init(void) {
+    if (!(g_profile_enabled && g_profile_mode == SGX_PROFILE_MODE_PERF_EVENT))
+        return;
+
+    PAL_TCB_URTS* tcb = get_tcb_urts();
+    int ret = open_perf_event();
+    if (ret < 0) {
+        log_error("sgx_profile_thread_init: opening perf event failed: %d (check "
+                  "/proc/sys/kernel/perf_event_paranoid)\n", ret);
+        return;
+    }
+    tcb->profile_event_fd = ret;
+}
+
+void sgx_profile_event_signal(bool in_enclave) {
+    PAL_TCB_URTS* tcb = get_tcb_urts();
+    if (tcb->profile_event_fd < 0)
+        return;
+
+    tcb->profile_event_pending = in_enclave;
+    INLINE_SYSCALL(ioctl, 3, tcb->profile_event_fd, PERF_EVENT_IOC_REFRESH, 1);
+}
+
+void sgx_profile_thread_exit(void) {
+    PAL_TCB_URTS* tcb = get_tcb_urts();
+    if (tcb->profile_event_fd >= 0) {
+        INLINE_SYSCALL(close, 1, tcb->profile_event_fd);
+        tcb->profile_event_fd = -1;
+    }
+
+    struct profile_buf* buf = tcb->profile_buf;
+    if (!buf)
+        return;
+
+    spinlock_lock(&buf->lock);
+    int ret = flush_profile_buf(buf);
+    spinlock_unlock(&buf->lock);
+    if (ret < 0)
+        log_error("sgx_profile_thread_exit: pd_flush_samples failed: %d\n", ret);
+
+    tcb->profile_buf = NULL;
+    spinlock_lock(&g_perf_data_lock);
+    buf->in_use = false;
+    spinlock_unlock(&g_perf_data_lock);
+}
+
 void sgx_profile_finish(void) {
     int ret;
     ssize_t size;
@@ -154,6 +336,20 @@ void sgx_profile_finish(void) {
     if (!g_profile_enabled)
         return;
 
+    /* Buffers are never removed from the list, so it can be walked without `g_perf_data_lock`
+     * (which must not be held while taking the lock of a buffer). Samples recorded by other
+     * threads after this are dropped. */
+    spinlock_lock(&g_perf_data_lock);
+    struct profile_buf* bufs = g_profile_bufs;
+    spinlock_unlock(&g_perf_data_lock);
+    for (struct profile_buf* buf = bufs; buf; buf = buf->next) {
+        spinlock_lock(&buf->lock);
+        ret = flush_profile_buf(buf);
+        spinlock_unlock(&buf->lock);
+        if (ret < 0)
+            log_error("sgx_profile_finish: pd_flush_samples failed: %d\n", ret);
+    }
+
     spinlock_lock(&g_perf_data_lock);
 
     size = pd_close(g_perf_data);
@@ -173,23 +369,32 @@ void sgx_profile_finish(void) {
     g_profile_enabled = false;
 }
 
-static void sample_simple(uint64_t rip) {
+static void sample_simple(uint64_t rip, uint64_t period) {
     int ret;
 
     // Report all events as the same PID so that they are grouped in report.
     pid_t pid = g_pal_enclave.pal_sec.pid;
     pid_t tid = pid;
 
-    spinlock_lock(&g_perf_data_lock);
-    ret = pd_event_sample_simple(g_perf_data, rip, pid, tid, g_profile_period);
-    spinlock_unlock(&g_perf_data_lock);
+    struct profile_buf* buf = get_profile_buf();
+    if (!buf)
+        return;
+
+    spinlock_lock(&buf->lock);
+    ret = pd_event_sample_simple(buf->samples, rip, pid, tid, period);
+    if (ret == -ENOSPC) {
+        ret = flush_profile_buf(buf);
+        if (ret == 0)
+            ret = pd_event_sample_simple(buf->samples, rip, pid, tid, period);
+    }
+    spinlock_unlock(&buf->lock);
 
     if (ret < 0) {
         log_error("error recording sample: %d\n", ret);
     }
 }
 
-static void sample_stack(sgx_pal_gpr_t* gpr) {
+static void sample_stack(sgx_pal_gpr_t* gpr, uint64_t period) {
     int ret;
 
     // Report all events as the same PID so that they are grouped in report.
@@ -205,10 +410,19 @@ static void sample_stack(sgx_pal_gpr_t* gpr) {
     }
     stack_size = ret;
 
-    spinlock_lock(&g_perf_data_lock);
-    ret = pd_event_sample_stack(g_perf_data, gpr->rip, pid, tid, g_profile_period,
-                                gpr, stack, stack_size);
-    spinlock_unlock(&g_perf_data_lock);
+    struct profile_buf* buf = get_profile_buf();
+    if (!buf)
+        return;
+
+    spinlock_lock(&buf->lock);
+    ret = pd_event_sample_stack(buf->samples, gpr->rip, pid, tid, period, gpr, stack, stack_size);
+    if (ret == -ENOSPC) {
+        ret = flush_profile_buf(buf);
+        if (ret == 0)
+            ret = pd_event_sample_stack(buf->samples, gpr->rip, pid, tid, period, gpr, stack,
+                                        stack_size);
+    }
+    spinlock_unlock(&buf->lock);
 
     if (ret < 0) {
         log_error("error recording sample: %d\n", ret);
@@ -251,11 +465,24 @@ static bool update_time(void) {
 void sgx_profile_sample_aex(void* tcs) {
     int ret;
 
-    if (!(g_profile_enabled && g_profile_mode == SGX_PROFILE_MODE_AEX))
+    if (!g_profile_enabled)
         return;
 
-    if (!update_time())
+    uint64_t period;
+    if (g_profile_mode == SGX_PROFILE_MODE_AEX) {
+        if (!update_time())
+            return;
+        period = g_profile_period;
+    } else if (g_profile_mode == SGX_PROFILE_MODE_PERF_EVENT) {
+        /* only AEXs caused by the overflow signal */
+        PAL_TCB_URTS* tcb = get_tcb_urts();
+        if (!tcb->profile_event_pending)
+            return;
+        tcb->profile_event_pending = false;
+        period = g_pal_enclave.profile_event_period;
+    } else {
         return;
+    }
 
     sgx_pal_gpr_t gpr;
     ret = get_sgx_gpr(&gpr, tcs);
@@ -265,42 +492,102 @@ void sgx_profile_sample_aex(void* tcs) {
     }
 
     if (g_pal_enclave.profile_with_stack) {
-        sample_stack(&gpr);
+        sample_stack(&gpr, period);
     } else {
-        sample_simple(gpr.rip);
+        sample_simple(gpr.rip, period);
     }
 }
 
-void sgx_profile_sample_ocall_inner(void* enclave_gpr) {
-    int ret;
-
-    if (!(g_profile_enabled && g_profile_mode == SGX_PROFILE_MODE_OCALL_INNER))
-        return;
-
-    if (!enclave_gpr)
-        return;
+static uint64_t ocall_time(void) {
+    struct timespec ts;
+    int ret = INLINE_SYSCALL(clock_gettime, 2, CLOCK_MONOTONIC, &ts);
+    if (ret < 0) {
+        log_error("sgx_profile_sample_ocall: clock_gettime failed: %d\n", ret);
+        return 0;
+    }
+    return ts.tv_sec * NSEC_IN_SEC + ts.tv_nsec;
+}
 
+static void sample_ocall_inner(void* enclave_gpr, uint64_t period) {
     sgx_pal_gpr_t gpr;
-    ret = debug_read_all(&gpr, enclave_gpr, sizeof(gpr));
+    int ret = debug_read_all(&gpr, enclave_gpr, sizeof(gpr));
     if (ret < 0) {
         log_error("sgx_profile_sample_ocall_inner: error reading GPR: %d\n", ret);
         return;
     }
 
     if (g_pal_enclave.profile_with_stack) {
-        sample_stack(&gpr);
+        sample_stack(&gpr, period);
     } else {
-        sample_simple(gpr.rip);
+        sample_simple(gpr.rip, period);
     }
 }
 
+/*
+ * With `sgx.profile.ocall_duration`, the OCALL hooks below only remember the OCALL site and the
+ * start time, and the sample is recorded when the OCALL returns, with the time spent outside the
+ * enclave (in nanoseconds) as its period. 'perf report' weights samples by their periods, so the
+ * report shows where the enclave waits for the host. The enclave state doesn't change during the
+ * OCALL, so reading it at the end gives the same sample. (An OCALL made by a signal handler during
+ * another OCALL overwrites the state of the outer one, which is then not recorded.)
+ */
+static void start_ocall(void* site) {
+    PAL_TCB_URTS* tcb = get_tcb_urts();
+    tcb->profile_ocall_site  = site;
+    tcb->profile_ocall_start = ocall_time();
+}
+
+void sgx_profile_sample_ocall_inner(void* enclave_gpr) {
+    if (!(g_profile_enabled && g_profile_mode == SGX_PROFILE_MODE_OCALL_INNER))
+        return;
+
+    if (!enclave_gpr)
+        return;
+
+    if (g_pal_enclave.profile_ocall_duration) {
+        start_ocall(enclave_gpr);
+        return;
+    }
+
+    sample_ocall_inner(enclave_gpr, g_profile_period);
+}
+
 void sgx_profile_sample_ocall_outer(void* ocall_func) {
     if (!(g_profile_enabled && g_profile_mode == SGX_PROFILE_MODE_OCALL_OUTER))
         return;
 
     assert(ocall_func);
     assert(!g_pal_enclave.profile_with_stack);
-    sample_simple((uint64_t)ocall_func);
+
+    if (g_pal_enclave.profile_ocall_duration) {
+        start_ocall(ocall_func);
+        return;
+    }
+
+    sample_simple((uint64_t)ocall_func, g_profile_period);
+}
+
+void sgx_profile_sample_ocall_done(void) {
+    if (!(g_profile_enabled && g_pal_enclave.profile_ocall_duration))
+        return;
+
+    PAL_TCB_URTS* tcb = get_tcb_urts();
+    uint64_t start = tcb->profile_ocall_start;
+    void* site = tcb->profile_ocall_site;
+    tcb->profile_ocall_start = 0;
+    tcb->profile_ocall_site  = NULL;
+    if (!start || !site)
+        return;
+
+    uint64_t end = ocall_time();
+    if (end <= start)
+        return;
+
+    if (g_profile_mode == SGX_PROFILE_MODE_OCALL_INNER) {
+        sample_ocall_inner(site, end - start);
+    } else if (g_profile_mode == SGX_PROFILE_MODE_OCALL_OUTER) {
+        sample_simple((uint64_t)site, end - start);
+    }
 }
 
 void sgx_profile_report_elf(const char* filename, void* addr) {
@@ -0,0 +1,410 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * Host io_uring backend of RPC threads (enabled with `sgx.rpc_io_uring`). Instead of executing
+ * file and socket OCALLs as synchronous syscalls, an RPC thread puts them into its own io_uring and
+ * goes on serving other requests; results are delivered to enclave threads when the completions
+ * arrive. A single RPC thread can thus keep many (possibly blocking) OCALLs of different enclave
+ * threads in flight, and submits all requests that arrived together with one io_uring_enter().
+ *
+ * Signals interrupt OCALLs blocked in RPC threads (see `g_rpc_signal_cnt`): requests in flight when
+ * a signal arrives are cancelled and complete with -EINTR, as the synchronous syscalls would.
+ *
+ * Requires Linux 5.11 (IORING_ENTER_EXT_ARG); on older kernels, RPC threads fall back to
+ * synchronous syscalls.
+ */
+
+#include <asm/errno.h>
+#include <asm/mman.h>
+#include <limits.h>
+
+#include "ocall_types.h"
+#include "rpc_queue.h"
+#include "sgx_internal.h"
+#include "sgx_log.h"
+
+uint64_t g_rpc_signal_cnt = 0;
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+#ifdef IORING_FEAT_EXT_ARG
+
+#define RPC_URING_ENTRIES 256 /* max # of OCALLs in flight per RPC thread, must be a power of two */
+
+/* user_data of the cancellation requests, whose completions are ignored */
+#define RPC_URING_CANCEL_TAG UINT64_MAX
+
+/* an OCALL in flight; `hdr` and `iov` are the arguments of socket OCALLs */
+struct rpc_uring_op {
+    rpc_request_t* req;
+    uint64_t submit_tsc;
+    uint64_t signal_cnt; /* value of `g_rpc_signal_cnt` when submitted */
+    bool cancelled;
+    struct msghdr hdr;
+    struct iovec iov;
+};
+
+struct rpc_uring {
+    int fd;
+    void* ring_mem;
+    size_t ring_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+
+    uint32_t* sq_head;
+    uint32_t* sq_tail;
+    uint32_t* sq_array;
+    uint32_t sq_mask;
+    uint32_t* cq_head;
+    uint32_t* cq_tail;
+    struct io_uring_cqe* cqes;
+    uint32_t cq_mask;
+
+    uint32_t sq_queued;    /* SQEs not yet submitted to the kernel */
+    uint32_t inflight_cnt; /* OCALLs queued or in flight */
+    uint64_t signal_cnt;   /* last value of `g_rpc_signal_cnt` handled by this RPC thread */
+
+    struct rpc_uring_op ops[RPC_URING_ENTRIES];
+    uint32_t free_ops[RPC_URING_ENTRIES]; /* stack of indexes of free `ops` */
+    uint32_t free_ops_cnt;
+};
+
+struct rpc_uring* rpc_uring_create(void) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = INLINE_SYSCALL(io_uring_setup, 2, RPC_URING_ENTRIES, &params);
+    if (fd < 0) {
+        log_warning("sgx.rpc_io_uring requested but io_uring_setup() failed (%d); RPC threads will "
+                    "use synchronous syscalls\n", fd);
+        return NULL;
+    }
+
+    struct rpc_uring* ring = NULL;
+    uint32_t needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_EXT_ARG | IORING_FEAT_RW_CUR_POS;
+    if ((params.features & needed) != needed || params.sq_entries != RPC_URING_ENTRIES
+            || params.cq_entries < 2 * RPC_URING_ENTRIES) {
+        log_warning("sgx.rpc_io_uring requested but the host io_uring lacks required features "
+                    "(Linux 5.11 is needed); RPC threads will use synchronous syscalls\n");
+        goto err;
+    }
+
+    size_t ring_struct_size = ALIGN_UP(sizeof(*ring), PRESET_PAGESIZE);
+    ring = (struct rpc_uring*)INLINE_SYSCALL(mmap, 6, NULL, ring_struct_size,
+                                             PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE,
+                                             -1, 0);
+    if (IS_ERR_P(ring)) {
+        ring = NULL;
+        goto err;
+    }
+    ring->fd = fd;
+
+    /* with IORING_FEAT_SINGLE_MMAP, the SQ and CQ rings share one mapping */
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->ring_size = MAX(sq_size, cq_size);
+    ring->ring_mem  = (void*)INLINE_SYSCALL(mmap, 6, NULL, ring->ring_size, PROT_READ | PROT_WRITE,
+                                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (IS_ERR_P(ring->ring_mem))
+        goto err_ring;
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe*)INLINE_SYSCALL(mmap, 6, NULL, ring->sqes_size,
+                                                      PROT_READ | PROT_WRITE,
+                                                      MAP_SHARED | MAP_POPULATE, fd,
+                                                      IORING_OFF_SQES);
+    if (IS_ERR_P(ring->sqes)) {
+        INLINE_SYSCALL(munmap, 2, ring->ring_mem, ring->ring_size);
+        goto err_ring;
+    }
+
+    char* mem = ring->ring_mem;
+    ring->sq_head  = (uint32_t*)(mem + params.sq_off.head);
+    ring->sq_tail  = (uint32_t*)(mem + params.sq_off.tail);
+    ring->sq_array = (uint32_t*)(mem + params.sq_off.array);
+    ring->sq_mask  = *(uint32_t*)(mem + params.sq_off.ring_mask);
+    ring->cq_head  = (uint32_t*)(mem + params.cq_off.head);
+    ring->cq_tail  = (uint32_t*)(mem + params.cq_off.tail);
+    ring->cqes     = (struct io_uring_cqe*)(mem + params.cq_off.cqes);
+    ring->cq_mask  = *(uint32_t*)(mem + params.cq_off.ring_mask);
+
+    ring->signal_cnt = __atomic_load_n(&g_rpc_signal_cnt, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < RPC_URING_ENTRIES; i++)
+        ring->free_ops[i] = RPC_URING_ENTRIES - 1 - i;
+    ring->free_ops_cnt = RPC_URING_ENTRIES;
+    return ring;
+
+err_ring:
+    INLINE_SYSCALL(munmap, 2, ring, ring_struct_size);
+    ring = NULL;
+    log_warning("sgx.rpc_io_uring requested but the io_uring rings cannot be mapped; RPC threads "
+                "will use synchronous syscalls\n");
+err:
+    INLINE_SYSCALL(close, 1, fd);
+    return ring;
+}
+
+uint32_t rpc_uring_inflight(struct rpc_uring* ring) {
+    return ring->inflight_cnt;
+}
+
+/* Returns a zeroed SQE at the SQ tail, or NULL if the SQ is full. The application is the only
+ * producer, so the tail is published only in `rpc_uring_flush()`. */
+static struct io_uring_sqe* get_sqe(struct rpc_uring* ring) {
+    uint32_t head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    uint32_t tail = *ring->sq_tail + ring->sq_queued;
+    if (tail - head >= RPC_URING_ENTRIES)
+        return NULL;
+
+    uint32_t idx = tail & ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[idx] = idx;
+    ring->sq_queued++;
+    return sqe;
+}
+
+/* Fills `sqe` with the host operation of OCALL `req`; returns false if the OCALL is not handled
+ * by io_uring (and must be executed synchronously). */
+static bool prep_sqe(struct io_uring_sqe* sqe, struct rpc_uring_op* op, rpc_request_t* req) {
+    switch (req->ocall_index) {
+        case OCALL_READ:
+        case OCALL_WRITE: {
+            /* ms_ocall_read_t and ms_ocall_write_t have the same layout */
+            ms_ocall_read_t* ms = req->buffer;
+            sqe->opcode = req->ocall_index == OCALL_READ ? IORING_OP_READ : IORING_OP_WRITE;
+            sqe->fd     = ms->ms_fd;
+            sqe->addr   = (uintptr_t)ms->ms_buf;
+            sqe->len    = ms->ms_count;
+            sqe->off    = (uint64_t)-1;
+            return true;
+        }
+        case OCALL_PREAD:
+        case OCALL_PWRITE: {
+            ms_ocall_pread_t* ms = req->buffer;
+            if (ms->ms_count > UINT32_MAX || ms->ms_offset < 0)
+                return false;
+            sqe->opcode = req->ocall_index == OCALL_PREAD ? IORING_OP_READ : IORING_OP_WRITE;
+            sqe->fd     = ms->ms_fd;
+            sqe->addr   = (uintptr_t)ms->ms_buf;
+            sqe->len    = ms->ms_count;
+            sqe->off    = ms->ms_offset;
+            return true;
+        }
+        case OCALL_READV:
+        case OCALL_WRITEV: {
+            ms_ocall_readv_t* ms = req->buffer;
+            if (ms->ms_iovcnt > OCALL_IOV_MAX)
+                return false;
+            sqe->opcode = req->ocall_index == OCALL_READV ? IORING_OP_READV : IORING_OP_WRITEV;
+            sqe->fd     = ms->ms_fd;
+            sqe->addr   = (uintptr_t)ms->ms_iov;
+            sqe->len    = ms->ms_iovcnt;
+            sqe->off    = ms->ms_offset < 0 ? (uint64_t)-1 : (uint64_t)ms->ms_offset;
+            return true;
+        }
+        case OCALL_FSYNC: {
+            ms_ocall_fsync_t* ms = req->buffer;
+            sqe->opcode = IORING_OP_FSYNC;
+            sqe->fd     = ms->ms_fd;
+            return true;
+        }
+        case OCALL_RECV:
+        case OCALL_SEND: {
+            /* ms_ocall_recv_t and ms_ocall_send_t have the same layout */
+            ms_ocall_recv_t* ms = req->buffer;
+            if (ms->ms_addr && ms->ms_addrlen > INT_MAX)
+                return false;
+            op->iov.iov_base        = ms->ms_buf;
+            op->iov.iov_len         = ms->ms_count;
+            op->hdr.msg_name        = ms->ms_addr;
+            op->hdr.msg_namelen     = ms->ms_addr ? ms->ms_addrlen : 0;
+            op->hdr.msg_iov         = &op->iov;
+            op->hdr.msg_iovlen      = 1;
+            op->hdr.msg_control     = ms->ms_control;
+            op->hdr.msg_controllen  = ms->ms_controllen;
+            op->hdr.msg_flags       = 0;
+            bool is_recv = req->ocall_index == OCALL_RECV;
+            sqe->opcode    = is_recv ? IORING_OP_RECVMSG : IORING_OP_SENDMSG;
+            sqe->fd        = ms->ms_sockfd;
+            sqe->addr      = (uintptr_t)&op->hdr;
+            sqe->len       = 1;
+            sqe->msg_flags = is_recv ? 0 : MSG_NOSIGNAL;
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+bool rpc_uring_queue(struct rpc_uring* ring, rpc_request_t* req, uint64_t tsc) {
+    if (!ring->free_ops_cnt)
+        return false;
+
+    struct io_uring_sqe* sqe = get_sqe(ring);
+    if (!sqe && rpc_uring_flush(ring) >= 0)
+        sqe = get_sqe(ring);
+    if (!sqe)
+        return false;
+
+    uint32_t op_idx = ring->free_ops[ring->free_ops_cnt - 1];
+    struct rpc_uring_op* op = &ring->ops[op_idx];
+    if (!prep_sqe(sqe, op, req)) {
+        ring->sq_queued--;
+        return false;
+    }
+    ring->free_ops_cnt--;
+
+    op->req        = req;
+    op->submit_tsc = tsc;
+    op->signal_cnt = ring->signal_cnt;
+    op->cancelled  = false;
+    sqe->user_data = op_idx;
+    ring->inflight_cnt++;
+    return true;
+}
+
+/* Cancels the OCALLs that were in flight when a signal arrived, see `g_rpc_signal_cnt`. */
+static void cancel_interrupted(struct rpc_uring* ring, uint64_t signal_cnt) {
+    for (uint32_t i = 0; i < RPC_URING_ENTRIES; i++) {
+        struct rpc_uring_op* op = &ring->ops[i];
+        if (!op->req || op->cancelled || op->signal_cnt == signal_cnt)
+            continue;
+        struct io_uring_sqe* sqe = get_sqe(ring);
+        if (!sqe)
+            return; /* retried on the next flush, `ring->signal_cnt` is not updated */
+        sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+        sqe->fd        = -1;
+        sqe->addr      = i;
+        sqe->user_data = RPC_URING_CANCEL_TAG;
+        op->cancelled  = true;
+    }
+    ring->signal_cnt = signal_cnt;
+}
+
+int rpc_uring_flush(struct rpc_uring* ring) {
+    uint64_t signal_cnt = __atomic_load_n(&g_rpc_signal_cnt, __ATOMIC_ACQUIRE);
+    if (signal_cnt != ring->signal_cnt)
+        cancel_interrupted(ring, signal_cnt);
+
+    if (!ring->sq_queued)
+        return 0;
+
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + ring->sq_queued, __ATOMIC_RELEASE);
+    uint32_t to_submit = ring->sq_queued;
+    ring->sq_queued = 0;
+
+    int ret = INLINE_SYSCALL(io_uring_enter, 6, ring->fd, to_submit, 0, 0, NULL, 0);
+    if (ret < 0 && ret != -EINTR && ret != -EAGAIN && ret != -EBUSY) {
+        log_error("RPC thread failed to submit to its io_uring: %d\n", ret);
+        return ret;
+    }
+    /* SQEs not consumed now (on -EAGAIN/-EBUSY) stay in the SQ and are submitted next time */
+    return 0;
+}
+
+rpc_request_t* rpc_uring_reap(struct rpc_uring* ring, uint64_t* out_ocall_index,
+                              uint64_t* out_submit_tsc) {
+    while (1) {
+        uint32_t head = *ring->cq_head;
+        if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+            return NULL;
+
+        struct io_uring_cqe* cqe = &ring->cqes[head & ring->cq_mask];
+        uint64_t user_data = cqe->user_data;
+        long res = cqe->res;
+        __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+        if (user_data >= RPC_URING_ENTRIES)
+            continue; /* completion of a cancellation request */
+
+        struct rpc_uring_op* op = &ring->ops[user_data];
+        rpc_request_t* req = op->req;
+        if (op->cancelled && (res == -ECANCELED || res == -EINTR))
+            res = -EINTR;
+
+        switch (req->ocall_index) {
+            case OCALL_FSYNC:
+                /* like sgx_ocall_fsync() */
+                res = 0;
+                break;
+            case OCALL_RECV:
+                if (res >= 0) {
+                    ms_ocall_recv_t* ms = req->buffer;
+                    if (op->hdr.msg_name)
+                        ms->ms_addrlen = op->hdr.msg_namelen;
+                    if (op->hdr.msg_control)
+                        ms->ms_controllen = op->hdr.msg_controllen;
+                }
+                break;
+            default:
+                break;
+        }
+
+        req->result      = res;
+        *out_ocall_index = req->ocall_index;
+        *out_submit_tsc  = op->submit_tsc;
+
+        op->req = NULL;
+        ring->free_ops[ring->free_ops_cnt++] = user_data;
+        ring->inflight_cnt--;
+        return req;
+    }
+}
+
+void rpc_uring_wait(struct rpc_uring* ring, uint64_t timeout_ns) {
+    struct __kernel_timespec ts = {
+        .tv_sec  = timeout_ns / 1000000000,
+        .tv_nsec = timeout_ns % 1000000000,
+    };
+    struct io_uring_getevents_arg arg = {
+        .sigmask    = 0,
+        .sigmask_sz = 0,
+        .ts         = (uintptr_t)&ts,
+    };
+    /* returns on a completion, on the timeout or on a signal (SIGUSR2 interrupts RPC threads) */
+    (void)INLINE_SYSCALL(io_uring_enter, 6, ring->fd, 0, 1,
+                         IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+#else /* IORING_FEAT_EXT_ARG */
+
+struct rpc_uring* rpc_uring_create(void) {
+    log_warning("sgx.rpc_io_uring requested but Graphene was built without io_uring support; RPC "
+                "threads will use synchronous syscalls\n");
+    return NULL;
+}
+
+uint32_t rpc_uring_inflight(struct rpc_uring* ring) {
+    __UNUSED(ring);
+    return 0;
+}
+
+bool rpc_uring_queue(struct rpc_uring* ring, rpc_request_t* req, uint64_t tsc) {
+    __UNUSED(ring);
+    __UNUSED(req);
+    __UNUSED(tsc);
+    return false;
+}
+
+int rpc_uring_flush(struct rpc_uring* ring) {
+    __UNUSED(ring);
+    return 0;
+}
+
+rpc_request_t* rpc_uring_reap(struct rpc_uring* ring, uint64_t* out_ocall_index,
+                              uint64_t* out_submit_tsc) {
+    __UNUSED(ring);
+    __UNUSED(out_ocall_index);
+    __UNUSED(out_submit_tsc);
+    return NULL;
+}
+
+void rpc_uring_wait(struct rpc_uring* ring, uint64_t timeout_ns) {
+    __UNUSED(ring);
+    __UNUSED(timeout_ns);
+}
+
+#endif /* IORING_FEAT_EXT_ARG */
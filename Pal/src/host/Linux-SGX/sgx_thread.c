@@ -5,6 +5,7 @@
 #include <asm/prctl.h>
 #include <asm/signal.h>
 #include <linux/futex.h>
+#include <linux/resource.h>
 #include <linux/signal.h>
 
 #include "assert.h"
@@ -16,17 +17,95 @@
 #include "sgx_log.h"
 #include "spinlock.h"
 
+/* TCS of a thread map entry was handed to a thread being created (the thread sets its real TID) */
+#define THREAD_MAP_TID_RESERVED ((unsigned int)-1)
+
+#define THREAD_MAP_CHUNK_ENTRIES 64 /* for chunks of TCSs added at runtime */
+
 struct thread_map {
     unsigned int    tid;
     sgx_arch_tcs_t* tcs;
 };
 
-static sgx_arch_tcs_t* g_enclave_tcs;
-static int g_enclave_thread_num;
-static struct thread_map* g_enclave_thread_map;
+/* TCS mapper is a list of chunks: the first chunk holds TCSs created at enclave build time, the
+ * next ones hold TCSs dynamically added by the enclave (with EDMM). Chunks and entries are never
+ * removed, so entries can be looked up without taking `tcs_lock`. */
+struct thread_map_chunk {
+    struct thread_map_chunk* next;
+    size_t cnt; /* number of used entries; updated under `tcs_lock` and read atomically */
+    size_t capacity;
+    struct thread_map entries[];
+};
+
+static struct thread_map_chunk* g_enclave_thread_map;
+static struct thread_map_chunk* g_enclave_thread_map_tail;
+static int g_enclave_thread_num; /* total number of TCSs in the mapper */
 
 bool g_sgx_enable_stats = false;
 
+/* Page faults of the calling thread (RUSAGE_THREAD) or of the whole process (RUSAGE_SELF). An
+ * access to an enclave page evicted from the EPC is an AEX followed by a page fault handled by the
+ * SGX driver, so with EPC paging, these show up among the AEXs. */
+static unsigned long get_page_faults(int who) {
+    struct rusage ru;
+    int ret = INLINE_SYSCALL(getrusage, 2, who, &ru);
+    if (ret < 0)
+        return 0;
+    return ru.ru_minflt + ru.ru_majflt;
+}
+
+/* Reads a number from a sysfs file; returns false if the file doesn't exist (e.g. other driver) */
+static bool read_sysfs_ulong(const char* path, unsigned long* out_value) {
+    int fd = INLINE_SYSCALL(open, 3, path, O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+
+    char buf[32];
+    int ret = INLINE_SYSCALL(read, 3, fd, buf, sizeof(buf) - 1);
+    INLINE_SYSCALL(close, 1, fd);
+    if (ret <= 0)
+        return false;
+    buf[ret] = '\0';
+    return str_to_ulong(buf, 10, out_value, /*out_endptr=*/NULL);
+}
+
+/* Prints the EPC usage on this machine (as far as the SGX driver exposes it) and page faults of
+ * this process; safe to call from a signal handler */
+void print_epc_stats(void) {
+    if (!g_sgx_enable_stats)
+        return;
+
+    int pid = INLINE_SYSCALL(getpid, 0);
+    log_always("----- EPC stats for process %d -----\n"
+               "  enclave size:        %lu KB\n"
+               "  # of page faults:    %lu\n",
+               pid, g_pal_enclave.size / 1024, get_page_faults(RUSAGE_SELF));
+
+    /* out-of-tree (isgx) driver */
+    unsigned long total_pages;
+    unsigned long free_pages;
+    if (read_sysfs_ulong("/sys/module/isgx/parameters/sgx_nr_total_epc_pages", &total_pages)
+            && read_sysfs_ulong("/sys/module/isgx/parameters/sgx_nr_free_pages", &free_pages)) {
+        log_always("  EPC size:            %lu KB\n"
+                   "  EPC free:            %lu KB\n",
+                   total_pages * PRESET_PAGESIZE / 1024, free_pages * PRESET_PAGESIZE / 1024);
+        return;
+    }
+
+    /* in-kernel driver (Linux 6.0+) exposes only the EPC size of each NUMA node */
+    unsigned long total_bytes = 0;
+    for (int node = 0; ; node++) {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/x86/sgx_total_bytes", node);
+        unsigned long node_bytes;
+        if (!read_sysfs_ulong(path, &node_bytes))
+            break;
+        total_bytes += node_bytes;
+    }
+    if (total_bytes)
+        log_always("  EPC size:            %lu KB\n", total_bytes / 1024);
+}
+
 /* this function is called only on thread/process exit (never in the middle of thread exec) */
 void update_and_print_stats(bool process_wide) {
     static atomic_ulong g_eenter_cnt       = 0;
@@ -47,9 +126,10 @@ void update_and_print_stats(bool process_wide) {
                "  # of EEXITs:         %lu\n"
                "  # of AEXs:           %lu\n"
                "  # of sync signals:   %lu\n"
-               "  # of async signals:  %lu\n",
+               "  # of async signals:  %lu\n"
+               "  # of page faults:    %lu\n",
                tid, tcb->eenter_cnt, tcb->eexit_cnt, tcb->aex_cnt,
-               tcb->sync_signal_cnt, tcb->async_signal_cnt);
+               tcb->sync_signal_cnt, tcb->async_signal_cnt, get_page_faults(RUSAGE_THREAD));
 
     g_eenter_cnt       += tcb->eenter_cnt;
     g_eexit_cnt        += tcb->eexit_cnt;
@@ -68,6 +148,9 @@ void update_and_print_stats(bool process_wide) {
                    "  # of async signals:  %lu\n",
                    pid, g_eenter_cnt, g_eexit_cnt, g_aex_cnt,
                    g_sync_signal_cnt, g_async_signal_cnt);
+        print_rpc_stats();
+        sgx_ocall_stats_print();
+        print_epc_stats();
     }
 }
 
@@ -84,59 +167,191 @@ void pal_tcb_urts_init(PAL_TCB_URTS* tcb, void* stack, void* alt_stack) {
     tcb->async_signal_cnt = 0;
 
     tcb->profile_sample_time = 0;
+    tcb->profile_ocall_start = 0;
+    tcb->profile_ocall_site = NULL;
+    tcb->profile_buf = NULL;
+    tcb->profile_event_fd = -1;
+    tcb->profile_event_pending = false;
 }
 
 static spinlock_t tcs_lock = INIT_SPINLOCK_UNLOCKED;
 
-void create_tcs_mapper(void* tcs_base, unsigned int thread_num) {
-    size_t thread_map_size = ALIGN_UP_POW2(sizeof(struct thread_map) * thread_num, PRESET_PAGESIZE);
+static struct thread_map_chunk* alloc_thread_map_chunk(size_t capacity) {
+    size_t size = ALIGN_UP_POW2(sizeof(struct thread_map_chunk)
+                                + sizeof(struct thread_map) * capacity, PRESET_PAGESIZE);
+    struct thread_map_chunk* chunk = (struct thread_map_chunk*)INLINE_SYSCALL(
+        mmap, 6, NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (IS_ERR_P(chunk))
+        return NULL;
 
-    g_enclave_tcs = tcs_base;
-    g_enclave_thread_num = thread_num;
-    g_enclave_thread_map = (struct thread_map*)INLINE_SYSCALL(mmap, 6, NULL, thread_map_size,
-                                                              PROT_READ | PROT_WRITE,
-                                                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    chunk->capacity = capacity; /* other fields are zeroed out by mmap() */
+    return chunk;
+}
+
+/* returns the entry of `tcs` (and its index in the whole mapper) or NULL */
+static struct thread_map* find_tcs_entry(sgx_arch_tcs_t* tcs, size_t* out_index) {
+    size_t index = 0;
+    for (struct thread_map_chunk* chunk = g_enclave_thread_map; chunk;
+            chunk = __atomic_load_n(&chunk->next, __ATOMIC_ACQUIRE)) {
+        size_t cnt = __atomic_load_n(&chunk->cnt, __ATOMIC_ACQUIRE);
+        for (size_t i = 0; i < cnt; i++, index++) {
+            if (chunk->entries[i].tcs == tcs) {
+                if (out_index)
+                    *out_index = index;
+                return &chunk->entries[i];
+            }
+        }
+    }
+    return NULL;
+}
 
+static void update_dbginfo_thread(size_t index, unsigned int tid) {
+    if (index < MAX_DBG_THREADS)
+        ((struct enclave_dbginfo*)DBGINFO_ADDR)->thread_tids[index] = tid;
+}
+
+/* must be called with `tcs_lock` held */
+static struct thread_map* add_tcs_entry(sgx_arch_tcs_t* tcs) {
+    assert(spinlock_is_locked(&tcs_lock));
+
+    struct thread_map_chunk* chunk = g_enclave_thread_map_tail;
+    if (chunk->cnt == chunk->capacity) {
+        chunk = alloc_thread_map_chunk(THREAD_MAP_CHUNK_ENTRIES);
+        if (!chunk)
+            return NULL;
+        __atomic_store_n(&g_enclave_thread_map_tail->next, chunk, __ATOMIC_RELEASE);
+        g_enclave_thread_map_tail = chunk;
+    }
+
+    struct thread_map* entry = &chunk->entries[chunk->cnt];
+    entry->tid = 0;
+    entry->tcs = tcs;
+    __atomic_store_n(&chunk->cnt, chunk->cnt + 1, __ATOMIC_RELEASE);
+
+    size_t index = g_enclave_thread_num++;
+    if (index < MAX_DBG_THREADS)
+        ((struct enclave_dbginfo*)DBGINFO_ADDR)->tcs_addrs[index] = tcs;
+    return entry;
+}
+
+int create_tcs_mapper(void* tcs_base, unsigned int thread_num) {
+    g_enclave_thread_map = alloc_thread_map_chunk(thread_num);
+    if (!g_enclave_thread_map)
+        return -ENOMEM;
+    g_enclave_thread_map_tail = g_enclave_thread_map;
+
+    sgx_arch_tcs_t* enclave_tcs = tcs_base;
     for (uint32_t i = 0; i < thread_num; i++) {
-        g_enclave_thread_map[i].tid = 0;
-        g_enclave_thread_map[i].tcs = &g_enclave_tcs[i];
+        g_enclave_thread_map->entries[i].tid = 0;
+        g_enclave_thread_map->entries[i].tcs = &enclave_tcs[i];
+    }
+    g_enclave_thread_map->cnt = thread_num;
+    g_enclave_thread_num = thread_num;
+    return 0;
+}
+
+/* Reserve a free TCS for a new thread; if `dynamic_tcs` is not NULL, it is a TCS just added by the
+ * enclave and it is reserved instead. Returns the reserved TCS or NULL if there is no free TCS. */
+static sgx_arch_tcs_t* reserve_tcs(sgx_arch_tcs_t* dynamic_tcs) {
+    struct thread_map* entry = NULL;
+
+    spinlock_lock(&tcs_lock);
+    if (dynamic_tcs) {
+        entry = find_tcs_entry(dynamic_tcs, /*out_index=*/NULL);
+        if (!entry)
+            entry = add_tcs_entry(dynamic_tcs);
+        if (entry && entry->tid)
+            entry = NULL;
+    } else {
+        for (struct thread_map_chunk* chunk = g_enclave_thread_map; chunk && !entry;
+                chunk = chunk->next) {
+            for (size_t i = 0; i < chunk->cnt; i++) {
+                if (!chunk->entries[i].tid) {
+                    entry = &chunk->entries[i];
+                    break;
+                }
+            }
+        }
     }
+    if (entry)
+        entry->tid = THREAD_MAP_TID_RESERVED;
+    spinlock_unlock(&tcs_lock);
+
+    return entry ? entry->tcs : NULL;
+}
+
+static void unreserve_tcs(sgx_arch_tcs_t* tcs) {
+    spinlock_lock(&tcs_lock);
+    struct thread_map* entry = find_tcs_entry(tcs, /*out_index=*/NULL);
+    assert(entry && entry->tid == THREAD_MAP_TID_RESERVED);
+    entry->tid = 0;
+    spinlock_unlock(&tcs_lock);
 }
 
 void map_tcs(unsigned int tid) {
+    PAL_TCB_URTS* tcb = get_tcb_urts();
+    size_t index;
+
     spinlock_lock(&tcs_lock);
-    for (int i = 0; i < g_enclave_thread_num; i++)
-        if (!g_enclave_thread_map[i].tid) {
-            g_enclave_thread_map[i].tid = tid;
-            get_tcb_urts()->tcs = g_enclave_thread_map[i].tcs;
-            ((struct enclave_dbginfo*)DBGINFO_ADDR)->thread_tids[i] = tid;
-            break;
+    if (tcb->tcs) {
+        /* child thread: its TCS was reserved by the parent in clone_thread() */
+        struct thread_map* entry = find_tcs_entry(tcb->tcs, &index);
+        assert(entry && entry->tid == THREAD_MAP_TID_RESERVED);
+        entry->tid = tid;
+        update_dbginfo_thread(index, tid);
+        goto out;
+    }
+
+    index = 0;
+    for (struct thread_map_chunk* chunk = g_enclave_thread_map; chunk; chunk = chunk->next) {
+        for (size_t i = 0; i < chunk->cnt; i++, index++) {
+            if (!chunk->entries[i].tid) {
+                chunk->entries[i].tid = tid;
+                tcb->tcs = chunk->entries[i].tcs;
+                update_dbginfo_thread(index, tid);
+                goto out;
+            }
         }
+    }
+out:
     spinlock_unlock(&tcs_lock);
 }
 
 void unmap_tcs(void) {
     spinlock_lock(&tcs_lock);
 
-    int index = get_tcb_urts()->tcs - g_enclave_tcs;
-    struct thread_map* map = &g_enclave_thread_map[index];
-
-    assert(index < g_enclave_thread_num);
+    size_t index;
+    struct thread_map* entry = find_tcs_entry(get_tcb_urts()->tcs, &index);
+    assert(entry);
 
     get_tcb_urts()->tcs = NULL;
-    ((struct enclave_dbginfo*)DBGINFO_ADDR)->thread_tids[index] = 0;
-    map->tid = 0;
+    update_dbginfo_thread(index, 0);
+    entry->tid = 0;
     spinlock_unlock(&tcs_lock);
 }
 
+/*
+ * Pool of parked host threads (`sgx.thread_pool_size`). Instead of exiting, a child thread whose
+ * enclave thread exited keeps its host stacks and its TCS, and waits (at most
+ * `sgx.thread_pool_idle_timeout` milliseconds) until clone_thread() hands it the next new thread.
+ * This saves clone() of a host thread, mmap() of its stacks and setup of its TCB; the parked thread
+ * simply enters its (reset) TCS again with ecall_thread_start(), so the enclave code is unaware of
+ * the pool. Parked threads keep their TCSs mapped but are not counted as enclave threads.
+ */
+static spinlock_t g_thread_pool_lock = INIT_SPINLOCK_UNLOCKED;
+static PAL_TCB_URTS* g_thread_pool[MAX_THREAD_POOL_SIZE];
+static size_t g_thread_pool_cnt = 0; /* updated under `g_thread_pool_lock` and read atomically */
+
+/* returns the number of enclave threads, not counting parked host threads */
 int current_enclave_thread_cnt(void) {
     int ret = 0;
     spinlock_lock(&tcs_lock);
-    for (int i = 0; i < g_enclave_thread_num; i++)
-        if (g_enclave_thread_map[i].tid)
-            ret++;
+    for (struct thread_map_chunk* chunk = g_enclave_thread_map; chunk; chunk = chunk->next)
+        for (size_t i = 0; i < chunk->cnt; i++)
+            if (chunk->entries[i].tid)
+                ret++;
     spinlock_unlock(&tcs_lock);
-    return ret;
+    return ret - (int)__atomic_load_n(&g_thread_pool_cnt, __ATOMIC_ACQUIRE);
 }
 
 /*
@@ -183,6 +398,10 @@ int pal_thread_init(void* tcbptr) {
         goto out;
     }
 
+#ifdef DEBUG
+    sgx_profile_thread_init();
+#endif
+
     if (!tcb->stack) {
         /* only first thread doesn't have a stack (it uses the one provided by Linux); first
          * thread calls ecall_enclave_start() instead of ecall_thread_start() so just exit */
@@ -190,11 +409,15 @@ int pal_thread_init(void* tcbptr) {
     }
 
     /* not-first (child) thread, start it */
+    rpc_pin_enclave_thread(tcb->tcs);
     ecall_thread_start();
 
     unmap_tcs();
     ret = 0;
 out:
+#ifdef DEBUG
+    sgx_profile_thread_exit();
+#endif
     INLINE_SYSCALL(munmap, 2, tcb->stack, THREAD_STACK_SIZE + ALT_STACK_SIZE);
     return ret;
 }
@@ -207,6 +430,9 @@ noreturn void thread_exit(int status) {
     block_async_signals(true);
 
     update_and_print_stats(/*process_wide=*/false);
+#ifdef DEBUG
+    sgx_profile_thread_exit();
+#endif
 
     if (tcb->alt_stack) {
         stack_t ss;
@@ -238,13 +464,139 @@ noreturn void thread_exit(int status) {
     __builtin_unreachable();
 }
 
-int clone_thread(void) {
+/* removes `tcb` from the pool; returns false if it was already taken by clone_thread() */
+static bool thread_pool_remove(PAL_TCB_URTS* tcb) {
+    bool found = false;
+    spinlock_lock(&g_thread_pool_lock);
+    for (size_t i = 0; i < g_thread_pool_cnt; i++) {
+        if (g_thread_pool[i] == tcb) {
+            g_thread_pool[i] = g_thread_pool[g_thread_pool_cnt - 1];
+            __atomic_store_n(&g_thread_pool_cnt, g_thread_pool_cnt - 1, __ATOMIC_RELEASE);
+            found = true;
+            break;
+        }
+    }
+    spinlock_unlock(&g_thread_pool_lock);
+    return found;
+}
+
+static PAL_TCB_URTS* thread_pool_take(void) {
+    PAL_TCB_URTS* tcb = NULL;
+    spinlock_lock(&g_thread_pool_lock);
+    if (g_thread_pool_cnt) {
+        tcb = g_thread_pool[g_thread_pool_cnt - 1];
+        __atomic_store_n(&g_thread_pool_cnt, g_thread_pool_cnt - 1, __ATOMIC_RELEASE);
+    }
+    spinlock_unlock(&g_thread_pool_lock);
+    return tcb;
+}
+
+/* Runs on top of the host stack of a parked thread; waits until the thread is handed a new enclave
+ * thread and starts it, or exits the thread after the idle timeout. Called only from the inline
+ * assembly in thread_pool_park(). */
+__attribute__((__used__)) static noreturn void thread_pool_loop(void) {
+    PAL_TCB_URTS* tcb = get_tcb_urts();
+    unsigned long timeout_ms = g_pal_enclave.thread_pool_idle_timeout;
+
+    while (true) {
+        struct timespec timeout = {
+            .tv_sec  = timeout_ms / 1000,
+            .tv_nsec = (timeout_ms % 1000) * 1000000,
+        };
+        int ret = INLINE_SYSCALL(futex, 6, &tcb->pool_wakeup, FUTEX_WAIT_PRIVATE, 0,
+                                 timeout_ms ? &timeout : NULL, NULL, 0);
+
+        if (__atomic_load_n(&tcb->pool_wakeup, __ATOMIC_ACQUIRE)) {
+            /* the new thread is started just like by pal_thread_init() */
+            block_async_signals(false);
+            rpc_pin_enclave_thread(tcb->tcs);
+            ecall_thread_start();
+            /* returns only if the enclave refused to start the thread; gets here also when a later
+             * exit of the thread could not park it again */
+            break;
+        }
+
+        /* on timeout, exit unless clone_thread() took this thread meanwhile (then it wakes us up
+         * right away) */
+        if (ret == -ETIMEDOUT && thread_pool_remove(tcb))
+            break;
+    }
+
+    unmap_tcs();
+    thread_exit(0);
+}
+
+/*
+ * Called by a thread whose enclave thread exited (its TCS is already reset). Parks the thread in
+ * the pool and never returns, or returns false if the pool is full, this is the first thread (it
+ * runs on the stack provided by Linux) or no other enclave threads are left.
+ */
+bool thread_pool_park(void) {
+    PAL_TCB_URTS* tcb = get_tcb_urts();
+    if (!tcb->stack)
+        return false;
+
+    spinlock_lock(&g_thread_pool_lock);
+    bool park = g_thread_pool_cnt < g_pal_enclave.thread_pool_size
+                && current_enclave_thread_cnt() > 1;
+    if (park) {
+        tcb->pool_wakeup = 0;
+        tcb->pool_tid    = INLINE_SYSCALL(gettid, 0);
+        g_thread_pool[g_thread_pool_cnt] = tcb;
+        __atomic_store_n(&g_thread_pool_cnt, g_thread_pool_cnt + 1, __ATOMIC_RELEASE);
+    }
+    spinlock_unlock(&g_thread_pool_lock);
+    if (!park)
+        return false;
+
+    /* the host stack still holds the frames of the exited thread (which never return), so start
+     * over at the top of the stack */
+    __asm__ volatile("movq %0, %%rsp \n"
+                     "xorq %%rbp, %%rbp \n"
+                     "callq thread_pool_loop \n"
+                     "ud2 \n"
+                     :
+                     : "r"(ALIGN_DOWN_PTR(tcb->stack + THREAD_STACK_SIZE, 16))
+                     : "memory");
+    __builtin_unreachable();
+}
+
+/* hands the next new thread to a parked host thread; returns false if there is none */
+static bool thread_pool_unpark(void) {
+    PAL_TCB_URTS* tcb = thread_pool_take();
+    if (!tcb)
+        return false;
+
+    /* like a newly cloned thread, the new thread inherits the CPU affinity of its creator */
+    unsigned long mask[1024 / (8 * sizeof(unsigned long))];
+    int ret = INLINE_SYSCALL(sched_getaffinity, 3, 0, sizeof(mask), mask);
+    if (ret > 0)
+        INLINE_SYSCALL(sched_setaffinity, 3, tcb->pool_tid, ret, mask);
+
+    __atomic_store_n(&tcb->pool_wakeup, 1, __ATOMIC_RELEASE);
+    INLINE_SYSCALL(futex, 6, &tcb->pool_wakeup, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    return true;
+}
+
+int clone_thread(void* dynamic_tcs) {
     int ret = 0;
 
+    /* a thread parked in the pool already owns its TCS and host stacks */
+    if (!dynamic_tcs && thread_pool_unpark())
+        return 0;
+
+    /* reserve TCS for the new thread now, so that TCS exhaustion is reported to the enclave (which
+     * may add a new TCS with EDMM) instead of failing asynchronously in the new thread */
+    sgx_arch_tcs_t* tcs = reserve_tcs(dynamic_tcs);
+    if (!tcs)
+        return -EAGAIN;
+
     void* stack = (void*)INLINE_SYSCALL(mmap, 6, NULL, THREAD_STACK_SIZE + ALT_STACK_SIZE,
                                         PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (IS_ERR_P(stack))
+    if (IS_ERR_P(stack)) {
+        unreserve_tcs(tcs);
         return -ENOMEM;
+    }
 
     /* Stack layout for the new thread looks like this (recall that stacks grow towards lower
      * addresses on Linux on x86-64):
@@ -264,13 +616,14 @@ int clone_thread(void) {
     /* initialize TCB at the top of the alternative stack */
     PAL_TCB_URTS* tcb = child_stack_top + ALT_STACK_SIZE - sizeof(PAL_TCB_URTS);
     pal_tcb_urts_init(tcb, stack, child_stack_top);
+    tcb->tcs = tcs; /* child thread marks it as used in map_tcs() */
 
     /* align child_stack to 16 */
     child_stack_top = ALIGN_DOWN_PTR(child_stack_top, 16);
 
     int dummy_parent_tid_field = 0;
-    // TODO: pal_thread_init() may fail during initialization (e.g. on TCS exhaustion), we should
-    // check its result (but this happens asynchronously, so it's not trivial to do).
+    // TODO: pal_thread_init() may fail during initialization, we should check its result (but this
+    // happens asynchronously, so it's not trivial to do).
     ret = clone(pal_thread_init, child_stack_top,
                 CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SYSVSEM | CLONE_THREAD | CLONE_SIGHAND |
                     CLONE_PARENT_SETTID,
@@ -278,18 +631,20 @@ int clone_thread(void) {
 
     if (ret < 0) {
         INLINE_SYSCALL(munmap, 2, stack, THREAD_STACK_SIZE + ALT_STACK_SIZE);
+        unreserve_tcs(tcs);
         return ret;
     }
     return 0;
 }
 
 int get_tid_from_tcs(void* tcs) {
-    int index = (sgx_arch_tcs_t*)tcs - g_enclave_tcs;
-    struct thread_map* map = &g_enclave_thread_map[index];
-    if (index >= g_enclave_thread_num)
+    struct thread_map* map = find_tcs_entry(tcs, /*out_index=*/NULL);
+    if (!map)
         return -EINVAL;
-    if (!map->tid)
+
+    unsigned int tid = __atomic_load_n(&map->tid, __ATOMIC_RELAXED);
+    if (!tid || tid == THREAD_MAP_TID_RESERVED)
         return -EINVAL;
 
-    return map->tid;
+    return tid;
 }
@@ -6,6 +6,7 @@
 #include <stdint.h>
 
 #include "pal.h"
+#include "spinlock.h"
 
 struct untrusted_area {
     void* addr;
@@ -13,8 +14,53 @@ struct untrusted_area {
     uint64_t in_use; /* must be uint64_t, because SET_ENCLAVE_TLS() currently supports only 8-byte
                       * types. TODO: fix this. */
     bool valid;
+    uint64_t last_used; /* LRU timestamp, used only by untrusted area cache */
 };
 
+/* Per-thread cache of untrusted memory areas for large I/O OCALLs (see enclave_ocalls.c): at most
+ * UNTRUSTED_AREA_CACHE_SLOTS areas of power-of-two sizes, UNTRUSTED_AREA_CACHE_MAX_SIZE in total */
+#define UNTRUSTED_AREA_CACHE_SLOTS    8
+#define UNTRUSTED_AREA_CACHE_MAX_SIZE (64 * 1024 * 1024)
+
+struct untrusted_area_cache {
+    uint64_t in_use; /* must be uint64_t, because SET_ENCLAVE_TLS() currently supports only 8-byte
+                      * types */
+    uint64_t clock;  /* incremented on each lookup, source of `last_used` timestamps */
+    struct untrusted_area areas[UNTRUSTED_AREA_CACHE_SLOTS];
+};
+
+/* Per-thread cache of recently freed enclave page runs (see enclave_pages.c) */
+#define ENCLAVE_PAGE_CACHE_SLOTS 16
+
+struct enclave_page_run {
+    void* addr;
+    size_t size;
+    bool is_pal_internal;
+};
+
+struct enclave_page_cache {
+    spinlock_t lock; /* taken by the owner thread and by threads evicting runs from this cache */
+    size_t cnt;
+    size_t size;     /* total size of cached runs */
+    struct enclave_page_cache* next; /* list of caches of all threads, see enclave_pages.c */
+    bool registered;
+    struct enclave_page_run runs[ENCLAVE_PAGE_CACHE_SLOTS]; /* from least to most recently freed */
+};
+
+/* Per-thread magazines of free objects of the untrusted slab allocator (see enclave_untrusted.c),
+ * one LIFO list per slab level */
+#define UNTRUSTED_SLAB_CACHE_LEVELS 8
+
+struct untrusted_slab_cache {
+    uint64_t in_use; /* taken by normal execution, OCALL-issuing signal handlers bypass the cache */
+    void* heads[UNTRUSTED_SLAB_CACHE_LEVELS];
+    size_t cnts[UNTRUSTED_SLAB_CACHE_LEVELS];
+};
+
+/* Number of pre-registered untrusted I/O buffers per enclave thread: one for normal execution and
+ * one for OCALLs issued by an in-enclave signal handler that interrupted the normal execution. */
+#define IO_BUFFERS_PER_THREAD 2
+
 /*
  * Beside the classic thread local storage (like ustack, thread, etc.) the TLS
  * area is also used to pass parameters needed during enclave or thread
@@ -46,8 +92,15 @@ struct enclave_tls {
     uint64_t manifest_size;
     void*    heap_min;
     void*    heap_max;
+    uint64_t edmm_enabled; /* heap pages are not EADDed but committed on demand via EACCEPT */
     int*     clear_child_tid;
-    struct untrusted_area untrusted_area_cache;
+    struct untrusted_area_cache untrusted_area_cache;
+    struct untrusted_area io_buffers[IO_BUFFERS_PER_THREAD];
+    uint64_t rpc_spin_estimate; /* EWMA of spins waiting for exitless OCALLs, see rpc_queue.h */
+    struct enclave_page_cache page_cache;
+    struct untrusted_slab_cache untrusted_slab_cache;
+    struct enclave_drbg* drbg; /* for _DkRandomBitsRead(), see db_misc.c */
+    struct ocall_close_deferred* close_deferred; /* see _DkObjectsClose() */
 };
 
 #ifndef DEBUG
@@ -104,6 +157,13 @@ typedef struct pal_tcb_urts {
     atomic_ulong sync_signal_cnt;  /* # of sync signals, corresponds to # of SIGSEGV/SIGILL/.. */
     atomic_ulong async_signal_cnt; /* # of async signals, corresponds to # of SIGINT/SIGCONT/.. */
     uint64_t profile_sample_time;  /* last time sgx_profile_sample() recorded a sample */
+    uint64_t profile_ocall_start;  /* start of the current OCALL (`sgx.profile.ocall_duration`) */
+    void* profile_ocall_site;      /* in-enclave GPR or outer OCALL function of the current OCALL */
+    struct profile_buf* profile_buf; /* sample buffer of this thread (see sgx_profile.c) */
+    int profile_event_fd;          /* perf event of this thread (`perf_event` profiling mode) */
+    bool profile_event_pending;    /* the perf event overflowed in the enclave, record AEX sample */
+    int pool_wakeup;               /* futex of a parked thread, set to 1 to hand it a new thread */
+    int pool_tid;                  /* host TID of a parked thread */
 } PAL_TCB_URTS;
 
 extern void pal_tcb_urts_init(PAL_TCB_URTS* tcb, void* stack, void* alt_stack);
@@ -11,10 +11,12 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <mbedtls/cmac.h>
@@ -184,9 +186,14 @@ out:
 
 static mbedtls_entropy_context g_entropy;
 static mbedtls_ctr_drbg_context g_prng;
+/* mbedTLS DRBG is not thread-safe, and files may be converted concurrently */
+static pthread_mutex_t g_prng_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static pf_status_t mbedtls_random(uint8_t* buffer, size_t size) {
-    if (mbedtls_ctr_drbg_random(&g_prng, buffer, size) != 0) {
+    pthread_mutex_lock(&g_prng_lock);
+    int ret = mbedtls_ctr_drbg_random(&g_prng, buffer, size);
+    pthread_mutex_unlock(&g_prng_lock);
+    if (ret != 0) {
         ERROR("Failed to get random bytes\n");
         return PF_STATUS_CALLBACK_FAILED;
     }
@@ -264,8 +271,11 @@ out:
     return ret;
 }
 
-/* Convert a single file to the protected format */
-int pf_encrypt_file(const char* input_path, const char* output_path, const pf_key_t* wrap_key) {
+/* Encrypt `input_path` into `output_path`; the PF is bound to `pf_path` (it may be different from
+ * `output_path` if the output is renamed afterwards). `cache_nodes` of 0 keeps the default PF cache
+ * size. */
+static int encrypt_file(const char* input_path, const char* output_path, const char* pf_path,
+                        const pf_key_t* wrap_key, size_t cache_nodes) {
     int ret = -1;
     int input = -1;
     int output = -1;
@@ -288,18 +298,26 @@ int pf_encrypt_file(const char* input_path, const char* output_path, const pf_ke
         goto out;
     }
 
-    INFO("Encrypting: %s -> %s\n", input_path, output_path);
+    INFO("Encrypting: %s -> %s\n", input_path, pf_path);
     INFO("            (Graphene's sgx.protected_files must contain this exact path: \"%s\")\n",
-                      output_path);
+                      pf_path);
 
     pf_handle_t handle = (pf_handle_t)&output;
-    pf_status_t pfs = pf_open(handle, output_path, /*size=*/0, PF_FILE_MODE_WRITE, /*create=*/true,
+    pf_status_t pfs = pf_open(handle, pf_path, /*size=*/0, PF_FILE_MODE_WRITE, /*create=*/true,
                               wrap_key, &pf);
     if (PF_FAILURE(pfs)) {
         ERROR("Failed to open output PF: %s\n", pf_strerror(pfs));
         goto out;
     }
 
+    if (cache_nodes) {
+        pfs = pf_set_cache_params(pf, cache_nodes, /*readahead_nodes=*/0);
+        if (PF_FAILURE(pfs)) {
+            ERROR("Failed to set cache size of output PF: %s\n", pf_strerror(pfs));
+            goto out;
+        }
+    }
+
     /* Process file contents */
     uint64_t input_size = get_file_size(input);
     if (input_size == (uint64_t)-1) {
@@ -349,6 +367,11 @@ out:
     return ret;
 }
 
+/* Convert a single file to the protected format */
+int pf_encrypt_file(const char* input_path, const char* output_path, const pf_key_t* wrap_key) {
+    return encrypt_file(input_path, output_path, output_path, wrap_key, /*cache_nodes=*/0);
+}
+
 /* Convert a single file from the protected format */
 int pf_decrypt_file(const char* input_path, const char* output_path, bool verify_path,
                     const pf_key_t* wrap_key) {
@@ -454,79 +477,208 @@ enum processing_mode_t {
     MODE_DECRYPT = 2,
 };
 
-static int process_files(const char* input_dir, const char* output_dir, const char* wrap_key_path,
-                         enum processing_mode_t mode, bool verify_path) {
-    int ret = -1;
-    pf_key_t wrap_key;
-    struct stat st;
-    char* input_path  = NULL;
-    char* output_path = NULL;
+/* Suffix of output files that are being written; an output file gets its final name only after it
+ * was converted completely, so that an interrupted batch can be resumed */
+#define PARTIAL_SUFFIX ".pf_crypt_partial"
 
-    if (mode != MODE_ENCRYPT && mode != MODE_DECRYPT) {
-        ERROR("Invalid mode: %d\n", mode);
-        goto out;
+/* PF cache size (in nodes) per encryption thread of a file: all dirty nodes in the cache are encrypted
+ * in parallel on flush, so a bigger cache gives the threads more work per flush */
+#define CACHE_NODES_PER_THREAD 64
+
+/*
+ * Pool of threads that encrypt independent nodes of one file on flush (see pf_parallel_f). Only one
+ * file at a time uses the pool; flushes of other files that are converted concurrently are done by
+ * their own threads.
+ */
+struct parallel_job {
+    void (*fn)(void* arg, size_t i);
+    void* arg;
+    size_t count;
+    size_t next;    /* next item to process, taken atomically */
+    size_t running; /* helpers that have not finished with this job yet */
+};
+
+static pthread_mutex_t g_pool_busy_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t g_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_pool_job_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t g_pool_done_cond = PTHREAD_COND_INITIALIZER;
+static struct parallel_job* g_pool_job = NULL;
+static uint64_t g_pool_job_seq = 0;
+static size_t g_pool_size = 0;
+
+static void run_parallel_job(struct parallel_job* job) {
+    size_t i;
+    while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count)
+        job->fn(job->arg, i);
+}
+
+static void* pool_thread(void* arg) {
+    (void)arg;
+    uint64_t seen_seq = 0;
+
+    pthread_mutex_lock(&g_pool_lock);
+    while (true) {
+        while (g_pool_job_seq == seen_seq)
+            pthread_cond_wait(&g_pool_job_cond, &g_pool_lock);
+        seen_seq = g_pool_job_seq;
+        struct parallel_job* job = g_pool_job;
+        pthread_mutex_unlock(&g_pool_lock);
+
+        run_parallel_job(job);
+
+        pthread_mutex_lock(&g_pool_lock);
+        if (--job->running == 0)
+            pthread_cond_signal(&g_pool_done_cond);
     }
+    return NULL;
+}
 
-    if (mode == MODE_ENCRYPT && verify_path) {
-        ERROR("Path verification can't be on in MODE_ENCRYPT\n");
-        goto out;
+static void cb_parallel(void (*fn)(void* arg, size_t i), void* arg, size_t count) {
+    struct parallel_job job = {
+        .fn      = fn,
+        .arg     = arg,
+        .count   = count,
+        .next    = 0,
+        .running = g_pool_size,
+    };
+
+    if (count < 2 || pthread_mutex_trylock(&g_pool_busy_lock) != 0) {
+        run_parallel_job(&job);
+        return;
     }
 
-    ret = load_wrap_key(wrap_key_path, &wrap_key);
-    if (ret != 0)
-        goto out;
+    pthread_mutex_lock(&g_pool_lock);
+    g_pool_job = &job;
+    g_pool_job_seq++;
+    pthread_cond_broadcast(&g_pool_job_cond);
+    pthread_mutex_unlock(&g_pool_lock);
 
-    if (stat(input_dir, &st) != 0) {
-        ERROR("Failed to stat input path %s: %s\n", input_dir, strerror(errno));
-        goto out;
+    run_parallel_job(&job);
+
+    pthread_mutex_lock(&g_pool_lock);
+    while (job.running)
+        pthread_cond_wait(&g_pool_done_cond, &g_pool_lock);
+    pthread_mutex_unlock(&g_pool_lock);
+
+    pthread_mutex_unlock(&g_pool_busy_lock);
+}
+
+/* Start `threads - 1` pool threads (the flushing thread itself is the last one); the pool lives
+ * until the process exits */
+static int start_thread_pool(size_t threads) {
+    if (threads < 2 || g_pool_size)
+        return 0;
+
+    for (size_t i = 0; i < threads - 1; i++) {
+        pthread_t thread;
+        int ret = pthread_create(&thread, NULL, pool_thread, NULL);
+        if (ret != 0) {
+            ERROR("Failed to create thread: %s\n", strerror(ret));
+            break;
+        }
+        pthread_detach(thread);
+        g_pool_size++;
     }
 
-    /* single file? */
-    if (S_ISREG(st.st_mode)) {
-        if (mode == MODE_ENCRYPT)
-            return pf_encrypt_file(input_dir, output_dir, &wrap_key);
-        else
-            return pf_decrypt_file(input_dir, output_dir, verify_path, &wrap_key);
+    if (g_pool_size)
+        pf_set_parallel_callback(cb_parallel);
+    return 0;
+}
+
+/* One file to convert */
+struct batch_file {
+    char* input_path;
+    char* output_path;
+    uint64_t size;
+};
+
+struct batch {
+    enum processing_mode_t mode;
+    bool verify_path;
+    const pf_key_t* wrap_key;
+    const struct pf_batch_options* options;
+
+    struct batch_file* files;
+    size_t files_count;
+    size_t files_size;
+
+    size_t next_file;  /* taken atomically by workers */
+    size_t done_files; /* counters below are updated atomically */
+    size_t skipped_files;
+    uint64_t done_bytes;
+    bool failed;
+};
+
+static char* join_path(const char* dir, const char* name) {
+    size_t size = strlen(dir) + 1 + strlen(name) + 1;
+    char* path = malloc(size);
+    if (!path) {
+        ERROR("No memory\n");
+        return NULL;
+    }
+    snprintf(path, size, "%s/%s", dir, name);
+    return path;
+}
+
+static int add_batch_file(struct batch* batch, const char* input_path, const char* output_path,
+                          uint64_t size) {
+    if (batch->files_count == batch->files_size) {
+        size_t new_size = batch->files_size ? batch->files_size * 2 : 64;
+        struct batch_file* files = realloc(batch->files, new_size * sizeof(*files));
+        if (!files) {
+            ERROR("No memory\n");
+            return -1;
+        }
+        batch->files = files;
+        batch->files_size = new_size;
+    }
+
+    struct batch_file* file = &batch->files[batch->files_count];
+    file->input_path  = strdup(input_path);
+    file->output_path = strdup(output_path);
+    file->size        = size;
+    if (!file->input_path || !file->output_path) {
+        ERROR("No memory\n");
+        free(file->input_path);
+        free(file->output_path);
+        return -1;
     }
 
+    batch->files_count++;
+    return 0;
+}
+
+/* Walk the input directory recursively, create output directories and collect the files */
+static int collect_files(struct batch* batch, const char* input_dir, const char* output_dir) {
+    int ret = -1;
+    char* input_path  = NULL;
+    char* output_path = NULL;
+    struct stat st;
+
     ret = mkdir(output_dir, PERM_rwxrwxr_x);
     if (ret != 0 && errno != EEXIST) {
         ERROR("Failed to create directory %s: %s\n", output_dir, strerror(errno));
-        goto out;
+        return -1;
     }
 
-    /* Process input directory */
-    struct dirent* dir;
     DIR* dfd = opendir(input_dir);
     if (!dfd) {
         ERROR("Failed to open input directory: %s\n", strerror(errno));
-        goto out;
+        return -1;
     }
 
-    size_t input_path_size, output_path_size;
+    struct dirent* dir;
     while ((dir = readdir(dfd)) != NULL) {
+        ret = -1;
         if (!strcmp(dir->d_name, "."))
             continue;
         if (!strcmp(dir->d_name, ".."))
             continue;
 
-        input_path_size = strlen(input_dir) + 1 + strlen(dir->d_name) + 1;
-        output_path_size = strlen(output_dir) + 1 + strlen(dir->d_name) + 1;
-
-        input_path = malloc(input_path_size);
-        if (!input_path) {
-            ERROR("No memory\n");
-            goto out;
-        }
-
-        output_path = malloc(output_path_size);
-        if (!output_path) {
-            ERROR("No memory\n");
+        input_path  = join_path(input_dir, dir->d_name);
+        output_path = join_path(output_dir, dir->d_name);
+        if (!input_path || !output_path)
             goto out;
-        }
-
-        snprintf(input_path, input_path_size, "%s/%s", input_dir, dir->d_name);
-        snprintf(output_path, output_path_size, "%s/%s", output_dir, dir->d_name);
 
         if (stat(input_path, &st) != 0) {
             ERROR("Failed to stat input file %s: %s\n", input_path, strerror(errno));
@@ -534,17 +686,11 @@ static int process_files(const char* input_dir, const char* output_dir, const ch
         }
 
         if (S_ISREG(st.st_mode)) {
-            if (mode == MODE_ENCRYPT)
-                ret = pf_encrypt_file(input_path, output_path, &wrap_key);
-            else
-                ret = pf_decrypt_file(input_path, output_path, verify_path, &wrap_key);
-
-            if (ret != 0)
+            if (add_batch_file(batch, input_path, output_path, st.st_size) != 0)
                 goto out;
         } else if (S_ISDIR(st.st_mode)) {
             /* process directory recursively */
-            ret = process_files(input_path, output_path, wrap_key_path, mode, verify_path);
-            if (ret != 0)
+            if (collect_files(batch, input_path, output_path) != 0)
                 goto out;
         } else {
             INFO("Skipping non-regular file %s\n", input_path);
@@ -558,18 +704,191 @@ static int process_files(const char* input_dir, const char* output_dir, const ch
     ret = 0;
 
 out:
+    closedir(dfd);
     free(input_path);
     free(output_path);
     return ret;
 }
 
+static int convert_batch_file(struct batch* batch, struct batch_file* file) {
+    if (batch->options->resume && access(file->output_path, F_OK) == 0) {
+        DBG("Skipping already converted file %s\n", file->output_path);
+        __atomic_add_fetch(&batch->skipped_files, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    char* partial_path = malloc(strlen(file->output_path) + sizeof(PARTIAL_SUFFIX));
+    if (!partial_path) {
+        ERROR("No memory\n");
+        return -1;
+    }
+    sprintf(partial_path, "%s%s", file->output_path, PARTIAL_SUFFIX);
+
+    /* leftover of an interrupted run */
+    if (unlink(partial_path) != 0 && errno != ENOENT) {
+        ERROR("Failed to remove %s: %s\n", partial_path, strerror(errno));
+        free(partial_path);
+        return -1;
+    }
+
+    int ret;
+    if (batch->mode == MODE_ENCRYPT) {
+        size_t threads = batch->options->threads_per_file;
+        ret = encrypt_file(file->input_path, partial_path, file->output_path, batch->wrap_key,
+                           threads > 1 ? threads * CACHE_NODES_PER_THREAD : 0);
+    } else {
+        ret = pf_decrypt_file(file->input_path, partial_path, batch->verify_path,
+                              batch->wrap_key);
+    }
+
+    if (ret == 0 && rename(partial_path, file->output_path) != 0) {
+        ERROR("Failed to rename %s to %s: %s\n", partial_path, file->output_path,
+              strerror(errno));
+        ret = -1;
+    }
+
+    free(partial_path);
+    if (ret == 0) {
+        __atomic_add_fetch(&batch->done_files, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&batch->done_bytes, file->size, __ATOMIC_RELAXED);
+    }
+    return ret;
+}
+
+static void* batch_worker(void* arg) {
+    struct batch* batch = arg;
+    size_t i;
+    while ((i = __atomic_fetch_add(&batch->next_file, 1, __ATOMIC_RELAXED)) < batch->files_count) {
+        if (__atomic_load_n(&batch->failed, __ATOMIC_RELAXED))
+            break;
+        if (convert_batch_file(batch, &batch->files[i]) != 0)
+            __atomic_store_n(&batch->failed, true, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static double get_time_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int process_files(const char* input_dir, const char* output_dir, const char* wrap_key_path,
+                         enum processing_mode_t mode, bool verify_path,
+                         const struct pf_batch_options* options) {
+    int ret = -1;
+    pf_key_t wrap_key;
+    struct stat st;
+    pthread_t* workers = NULL;
+    size_t workers_count = 0;
+    struct batch batch = {
+        .mode        = mode,
+        .verify_path = verify_path,
+        .wrap_key    = &wrap_key,
+        .options     = options,
+    };
+
+    if (mode != MODE_ENCRYPT && mode != MODE_DECRYPT) {
+        ERROR("Invalid mode: %d\n", mode);
+        goto out;
+    }
+
+    if (mode == MODE_ENCRYPT && verify_path) {
+        ERROR("Path verification can't be on in MODE_ENCRYPT\n");
+        goto out;
+    }
+
+    if (!options->jobs || !options->threads_per_file) {
+        ERROR("Number of jobs and threads must be positive\n");
+        goto out;
+    }
+
+    ret = load_wrap_key(wrap_key_path, &wrap_key);
+    if (ret != 0)
+        goto out;
+    ret = -1;
+
+    if (stat(input_dir, &st) != 0) {
+        ERROR("Failed to stat input path %s: %s\n", input_dir, strerror(errno));
+        goto out;
+    }
+
+    if (S_ISREG(st.st_mode)) {
+        /* single file */
+        if (add_batch_file(&batch, input_dir, output_dir, st.st_size) != 0)
+            goto out;
+    } else if (collect_files(&batch, input_dir, output_dir) != 0) {
+        goto out;
+    }
+
+    if (mode == MODE_ENCRYPT && start_thread_pool(options->threads_per_file) != 0)
+        goto out;
+
+    double start_time = get_time_sec();
+
+    size_t jobs = MIN(options->jobs, batch.files_count);
+    if (jobs > 1) {
+        workers = calloc(jobs - 1, sizeof(*workers));
+        if (!workers) {
+            ERROR("No memory\n");
+            goto out;
+        }
+        for (; workers_count < jobs - 1; workers_count++) {
+            int err = pthread_create(&workers[workers_count], NULL, batch_worker, &batch);
+            if (err != 0) {
+                ERROR("Failed to create thread: %s\n", strerror(err));
+                break;
+            }
+        }
+    }
+
+    batch_worker(&batch);
+    for (size_t i = 0; i < workers_count; i++)
+        pthread_join(workers[i], NULL);
+
+    double elapsed = get_time_sec() - start_time;
+    double mib = batch.done_bytes / (1024.0 * 1024.0);
+    INFO("Converted %zu files (%zu skipped as already converted): %.1f MiB in %.1f s (%.1f MiB/s)\n",
+         batch.done_files, batch.skipped_files, mib, elapsed, elapsed > 0 ? mib / elapsed : 0.0);
+
+    ret = batch.failed ? -1 : 0;
+
+out:
+    free(workers);
+    for (size_t i = 0; i < batch.files_count; i++) {
+        free(batch.files[i].input_path);
+        free(batch.files[i].output_path);
+    }
+    free(batch.files);
+    return ret;
+}
+
+static const struct pf_batch_options g_default_batch_options = {
+    .jobs             = 1,
+    .threads_per_file = 1,
+    .resume           = false,
+};
+
 /* Convert a file or directory (recursively) to the protected format */
 int pf_encrypt_files(const char* input_dir, const char* output_dir, const char* wrap_key_path) {
-    return process_files(input_dir, output_dir, wrap_key_path, MODE_ENCRYPT, false);
+    return process_files(input_dir, output_dir, wrap_key_path, MODE_ENCRYPT, false,
+                         &g_default_batch_options);
 }
 
 /* Convert a file or directory (recursively) from the protected format */
 int pf_decrypt_files(const char* input_dir, const char* output_dir, bool verify_path,
                      const char* wrap_key_path) {
-    return process_files(input_dir, output_dir, wrap_key_path, MODE_DECRYPT, verify_path);
+    return process_files(input_dir, output_dir, wrap_key_path, MODE_DECRYPT, verify_path,
+                         &g_default_batch_options);
+}
+
+int pf_encrypt_files_batch(const char* input_dir, const char* output_dir,
+                           const char* wrap_key_path, const struct pf_batch_options* options) {
+    return process_files(input_dir, output_dir, wrap_key_path, MODE_ENCRYPT, false, options);
+}
+
+int pf_decrypt_files_batch(const char* input_dir, const char* output_dir, bool verify_path,
+                           const char* wrap_key_path, const struct pf_batch_options* options) {
+    return process_files(input_dir, output_dir, wrap_key_path, MODE_DECRYPT, verify_path,
+                         options);
 }
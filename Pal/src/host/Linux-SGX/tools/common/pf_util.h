@@ -6,6 +6,8 @@
 #ifndef PF_UTIL_H
 #define PF_UTIL_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "protected_files.h"
@@ -32,6 +34,26 @@ int pf_encrypt_files(const char* input_dir, const char* output_dir, const char*
 int pf_decrypt_files(const char* input_dir, const char* output_dir, bool verify_path,
                      const char* wrap_key_path);
 
+/*! Options of batch conversion of files */
+struct pf_batch_options {
+    size_t jobs;             /*!< number of files converted concurrently */
+    size_t threads_per_file; /*!< number of threads encrypting nodes of one file (encryption only) */
+    bool resume;             /*!< skip files whose output already exists (from an earlier run) */
+};
+
+/*!
+ * \brief Convert a file or directory (recursively) to the protected format, in parallel
+ *
+ * Output files are written under a temporary name and renamed when complete, so a batch that was
+ * interrupted can be resumed with `options->resume`. Prints throughput when done.
+ */
+int pf_encrypt_files_batch(const char* input_dir, const char* output_dir,
+                           const char* wrap_key_path, const struct pf_batch_options* options);
+
+/*! Convert a file or directory (recursively) from the protected format, in parallel (see above) */
+int pf_decrypt_files_batch(const char* input_dir, const char* output_dir, bool verify_path,
+                           const char* wrap_key_path, const struct pf_batch_options* options);
+
 /*! AES-CMAC */
 pf_status_t mbedtls_aes_cmac(const pf_key_t* key, const void* input, size_t input_size,
                              pf_mac_t* mac);
@@ -15,6 +15,9 @@ struct option g_options[] = {
     { "output", required_argument, 0, 'o' },
     { "wrap-key", required_argument, 0, 'w' },
     { "verify", no_argument, 0, 'V' },
+    { "jobs", required_argument, 0, 'j' },
+    { "threads", required_argument, 0, 't' },
+    { "resume", no_argument, 0, 'r' },
     { "verbose", no_argument, 0, 'v' },
     { "help", no_argument, 0, 'h' },
     { 0, 0, 0, 0 }
@@ -29,6 +32,11 @@ static void usage(void) {
     INFO("\nAvailable general options:\n");
     INFO("  --help, -h              Display this help\n");
     INFO("  --verbose, -v           Verbose output\n");
+    INFO("\nAvailable encrypt/decrypt batch options:\n");
+    INFO("  --jobs, -j N            (optional) Number of files to convert in parallel (default 1)\n");
+    INFO("  --threads, -t N         (optional) Number of threads encrypting one file (default 1),\n");
+    INFO("                          useful for a few big files; encryption only\n");
+    INFO("  --resume, -r            (optional) Skip files converted by an interrupted earlier run\n");
     INFO("\nAvailable gen-key options:\n");
     INFO("  --wrap-key, -w PATH     Path to wrap key file\n");
     INFO("\nAvailable encrypt options:\n");
@@ -54,9 +62,14 @@ int main(int argc, char* argv[]) {
     char* wrap_key_path = NULL;
     char* mode = NULL;
     bool verify = false;
+    struct pf_batch_options batch_options = {
+        .jobs             = 1,
+        .threads_per_file = 1,
+        .resume           = false,
+    };
 
     while (true) {
-        this_option = getopt_long(argc, argv, "i:o:p:w:Vvh", g_options, NULL);
+        this_option = getopt_long(argc, argv, "i:o:p:w:j:t:rVvh", g_options, NULL);
         if (this_option == -1)
             break;
 
@@ -76,6 +89,15 @@ int main(int argc, char* argv[]) {
             case 'V':
                 verify = true;
                 break;
+            case 'j':
+                batch_options.jobs = strtoul(optarg, NULL, 10);
+                break;
+            case 't':
+                batch_options.threads_per_file = strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                batch_options.resume = true;
+                break;
             case 'h':
                 usage();
                 exit(0);
@@ -114,7 +136,7 @@ int main(int argc, char* argv[]) {
                 usage();
                 goto out;
             }
-            ret = pf_encrypt_files(input_path, output_path, wrap_key_path);
+            ret = pf_encrypt_files_batch(input_path, output_path, wrap_key_path, &batch_options);
             break;
 
         case 'd': /* decrypt */
@@ -123,7 +145,8 @@ int main(int argc, char* argv[]) {
                 usage();
                 goto out;
             }
-            ret = pf_decrypt_files(input_path, output_path, verify, wrap_key_path);
+            ret = pf_decrypt_files_batch(input_path, output_path, verify, wrap_key_path,
+                                         &batch_options);
             break;
 
         default:
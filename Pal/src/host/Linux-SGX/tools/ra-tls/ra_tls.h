@@ -2,6 +2,7 @@
 /* Copyright (C) 2018-2020 Intel Labs */
 
 #include <mbedtls/x509_crt.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "sgx_arch.h"
@@ -23,6 +24,12 @@
 #define RA_TLS_CERT_TIMESTAMP_NOT_BEFORE "RA_TLS_CERT_TIMESTAMP_NOT_BEFORE"
 #define RA_TLS_CERT_TIMESTAMP_NOT_AFTER  "RA_TLS_CERT_TIMESTAMP_NOT_AFTER"
 
+/* reuse the RA-TLS key and certificate, refreshed (in the background) after this many seconds */
+#define RA_TLS_CERT_REFRESH_INTERVAL "RA_TLS_CERT_REFRESH_INTERVAL"
+
+/* remember quotes verified by IAS/DCAP for this many seconds */
+#define RA_TLS_QUOTE_CACHE_TTL "RA_TLS_QUOTE_CACHE_TTL"
+
 #define SHA256_DIGEST_SIZE       32
 #define RSA_PUB_3072_KEY_LEN     3072
 #define RSA_PUB_3072_KEY_DER_LEN 422
@@ -53,6 +60,13 @@ int cmp_crt_pk_against_quote_report_data(mbedtls_x509_crt* crt, sgx_quote_t* quo
 __attribute__ ((visibility("hidden")))
 int verify_quote_against_envvar_measurements(const void* quote, size_t quote_size);
 
+/* cache of quotes which passed the IAS/DCAP verification, enabled with `RA_TLS_QUOTE_CACHE_TTL` */
+__attribute__ ((visibility("hidden")))
+bool verified_quote_cache_lookup(const void* quote, size_t quote_size, bool allow_outdated_tcb);
+
+__attribute__ ((visibility("hidden")))
+void verified_quote_cache_add(const void* quote, size_t quote_size, bool allow_outdated_tcb);
+
 /*!
  * \brief Callback for user-specific verification of measurements in SGX quote.
  *
@@ -113,6 +127,11 @@ int ra_tls_verify_callback_der(uint8_t* der_crt, size_t der_crt_size);
  * to the calculated hash (this ties the generated certificate key to the SGX quote). Finally, it
  * generates the X.509 self-signed certificate with this key and the SGX quote embedded.
  *
+ * If `RA_TLS_CERT_REFRESH_INTERVAL` is set, the key and certificate are generated only on the first
+ * call and returned again by later calls. Once they are older than the interval, new ones are
+ * generated in the background (the old ones are returned until then). This function is
+ * thread-safe in this case.
+ *
  * \param[out] key   Populated with a generated RSA keypair.
  * \param[out] crt   Populated with a self-signed RA-TLS certificate with SGX quote embedded.
  *
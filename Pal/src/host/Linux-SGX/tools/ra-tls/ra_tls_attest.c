@@ -10,23 +10,27 @@
  * agnostic to the format of the SGX quote).
  *
  * This file is part of the RA-TLS attestation library which is typically linked into server
- * applications. This library is *not* thread-safe.
+ * applications. This library is *not* thread-safe (except for the reused RA-TLS certificate, see
+ * `g_cert`).
  */
 
 #define _GNU_SOURCE
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <mbedtls/ctr_drbg.h>
 #include <mbedtls/entropy.h>
 #include <mbedtls/pk.h>
+#include <mbedtls/platform_util.h>
 #include <mbedtls/rsa.h>
 #include <mbedtls/sha256.h>
 #include <mbedtls/x509_crt.h>
@@ -38,6 +42,25 @@
 #define CERT_TIMESTAMP_NOT_BEFORE_DEFAULT "20010101000000"
 #define CERT_TIMESTAMP_NOT_AFTER_DEFAULT  "20301231235959"
 
+#define DER_BUF_SIZE (16 * 1024) /* enough for any X.509 certificate and RSA key */
+
+/* Generating an RA-TLS certificate takes a new RSA key pair and a new SGX quote, which is far too
+ * slow to do per TLS connection. With `RA_TLS_CERT_REFRESH_INTERVAL` set, the key and certificate
+ * are generated once and returned by all ra_tls_create_key_and_crt*() calls. Once they are older
+ * than the interval, a background thread generates new ones while the old ones are still returned,
+ * so that no caller waits for the refresh. */
+struct ra_tls_cert {
+    uint8_t* key_der; /* NULL if there is no certificate yet */
+    size_t key_der_size;
+    uint8_t* crt_der;
+    size_t crt_der_size;
+    time_t created;
+};
+
+static pthread_mutex_t g_cert_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct ra_tls_cert g_cert = {0};
+static bool g_cert_refreshing = false;
+
 static ssize_t rw_file(const char* path, uint8_t* buf, size_t len, bool do_write) {
     ssize_t bytes = 0;
     ssize_t ret = 0;
@@ -192,27 +215,26 @@ static int create_x509(mbedtls_pk_context* pk, mbedtls_x509write_cert* writecrt)
     return ret;
 }
 
-static int create_key_and_crt(mbedtls_pk_context* key, mbedtls_x509_crt* crt, uint8_t** crt_der,
-                              size_t* crt_der_size) {
+/*! generates a new RSA key pair and an RA-TLS certificate for it, both in DER format */
+static int generate_key_and_crt_der(struct ra_tls_cert* cert) {
     int ret;
 
-    if (!key || !crt)
-        return MBEDTLS_ERR_X509_FATAL_ERROR;
-
     mbedtls_ctr_drbg_context ctr_drbg;
     mbedtls_ctr_drbg_init(&ctr_drbg);
 
     mbedtls_entropy_context entropy;
     mbedtls_entropy_init(&entropy);
 
+    mbedtls_pk_context key;
+    mbedtls_pk_init(&key);
+
     mbedtls_x509write_cert writecrt;
     mbedtls_x509write_crt_init(&writecrt);
 
-    uint8_t* crt_der_buf = NULL;
-    uint8_t* output_buf = NULL;
-    size_t output_buf_size = 16 * 1024; /* enough for any X.509 certificate */
+    uint8_t* key_der = NULL;
+    uint8_t* crt_der = NULL;
 
-    output_buf = malloc(output_buf_size);
+    uint8_t* output_buf = malloc(DER_BUF_SIZE);
     if (!output_buf) {
         ret = MBEDTLS_ERR_X509_ALLOC_FAILED;
         goto out;
@@ -223,112 +245,209 @@ static int create_key_and_crt(mbedtls_pk_context* key, mbedtls_x509_crt* crt, ui
     if (ret < 0)
         goto out;
 
-    ret = mbedtls_pk_setup(key, mbedtls_pk_info_from_type(MBEDTLS_PK_RSA));
+    ret = mbedtls_pk_setup(&key, mbedtls_pk_info_from_type(MBEDTLS_PK_RSA));
     if (ret < 0)
         goto out;
 
-    mbedtls_rsa_init((mbedtls_rsa_context*)key->pk_ctx, MBEDTLS_RSA_PKCS_V15, /*hash_id=*/0);
+    mbedtls_rsa_init((mbedtls_rsa_context*)key.pk_ctx, MBEDTLS_RSA_PKCS_V15, /*hash_id=*/0);
 
-    ret = mbedtls_rsa_gen_key((mbedtls_rsa_context*)key->pk_ctx, mbedtls_ctr_drbg_random, &ctr_drbg,
+    ret = mbedtls_rsa_gen_key((mbedtls_rsa_context*)key.pk_ctx, mbedtls_ctr_drbg_random, &ctr_drbg,
                               RSA_PUB_3072_KEY_LEN, RSA_PUB_EXPONENT);
     if (ret < 0)
         goto out;
 
-    ret = create_x509(key, &writecrt);
+    ret = create_x509(&key, &writecrt);
     if (ret < 0)
         goto out;
 
-    int size = mbedtls_x509write_crt_der(&writecrt, output_buf, output_buf_size,
-                                         mbedtls_ctr_drbg_random, &ctr_drbg);
-    if (size < 0) {
-        ret = size;
+    /* note that mbedtls_x509write_crt_der() and mbedtls_pk_write_key_der() write data at the end of
+     * the output_buf */
+    int crt_size = mbedtls_x509write_crt_der(&writecrt, output_buf, DER_BUF_SIZE,
+                                             mbedtls_ctr_drbg_random, &ctr_drbg);
+    if (crt_size < 0) {
+        ret = crt_size;
         goto out;
     }
 
-    if (crt_der && crt_der_size) {
-        crt_der_buf = malloc(size);
-        if (!crt_der_buf) {
-            ret = MBEDTLS_ERR_X509_ALLOC_FAILED;
-            goto out;
-        }
+    crt_der = malloc(crt_size);
+    if (!crt_der) {
+        ret = MBEDTLS_ERR_X509_ALLOC_FAILED;
+        goto out;
+    }
+    memcpy(crt_der, output_buf + DER_BUF_SIZE - crt_size, crt_size);
 
-        /* note that mbedtls_x509write_crt_der() wrote data at the end of the output_buf */
-        memcpy(crt_der_buf, output_buf + output_buf_size - size, size);
-        *crt_der      = crt_der_buf;
-        *crt_der_size = size;
+    int key_size = mbedtls_pk_write_key_der(&key, output_buf, DER_BUF_SIZE);
+    if (key_size < 0) {
+        ret = key_size;
+        goto out;
     }
 
-    if (crt) {
-        ret = mbedtls_x509_crt_parse_der(crt, output_buf + output_buf_size - size, size);
-        if (ret < 0)
-            goto out;
+    key_der = malloc(key_size);
+    if (!key_der) {
+        ret = MBEDTLS_ERR_X509_ALLOC_FAILED;
+        goto out;
     }
+    memcpy(key_der, output_buf + DER_BUF_SIZE - key_size, key_size);
 
+    cert->key_der      = key_der;
+    cert->key_der_size = key_size;
+    cert->crt_der      = crt_der;
+    cert->crt_der_size = crt_size;
+    cert->created      = time(NULL);
     ret = 0;
 out:
     if (ret < 0) {
-        free(crt_der_buf);
+        free(key_der);
+        free(crt_der);
+    }
+    if (output_buf) {
+        mbedtls_platform_zeroize(output_buf, DER_BUF_SIZE);
+        free(output_buf);
     }
     mbedtls_x509write_crt_free(&writecrt);
+    mbedtls_pk_free(&key);
     mbedtls_entropy_free(&entropy);
     mbedtls_ctr_drbg_free(&ctr_drbg);
-    free(output_buf);
     return ret;
 }
 
-int ra_tls_create_key_and_crt(mbedtls_pk_context* key, mbedtls_x509_crt* crt) {
-    return create_key_and_crt(key, crt, NULL, NULL);
+static void free_cert(struct ra_tls_cert* cert) {
+    if (cert->key_der) {
+        mbedtls_platform_zeroize(cert->key_der, cert->key_der_size);
+        free(cert->key_der);
+    }
+    free(cert->crt_der);
+    memset(cert, 0, sizeof(*cert));
 }
 
-int ra_tls_create_key_and_crt_der(uint8_t** der_key, size_t* der_key_size, uint8_t** der_crt,
-                                  size_t* der_crt_size) {
-    int ret;
+static int copy_cert(const struct ra_tls_cert* src, struct ra_tls_cert* dst) {
+    dst->key_der = malloc(src->key_der_size);
+    dst->crt_der = malloc(src->crt_der_size);
+    if (!dst->key_der || !dst->crt_der) {
+        free(dst->key_der);
+        free(dst->crt_der);
+        dst->key_der = NULL;
+        dst->crt_der = NULL;
+        return MBEDTLS_ERR_X509_ALLOC_FAILED;
+    }
 
-    if (!der_key || !der_key_size || !der_crt || !der_crt_size)
-        return -EINVAL;
+    memcpy(dst->key_der, src->key_der, src->key_der_size);
+    dst->key_der_size = src->key_der_size;
+    memcpy(dst->crt_der, src->crt_der, src->crt_der_size);
+    dst->crt_der_size = src->crt_der_size;
+    dst->created      = src->created;
+    return 0;
+}
 
-    mbedtls_pk_context key;
-    mbedtls_pk_init(&key);
+/*! reads the refresh interval in \p interval, 0 (no reuse) if the envvar is not set */
+static int getenv_cert_refresh_interval(time_t* interval) {
+    *interval = 0;
 
-    uint8_t* der_key_buf   = NULL;
-    uint8_t* output_buf    = NULL;
-    size_t output_buf_size = 1024; /* enough for any public key */
+    char* str = getenv(RA_TLS_CERT_REFRESH_INTERVAL);
+    if (!str)
+        return 0;
 
-    output_buf = malloc(output_buf_size);
-    if (!output_buf) {
-        ret = MBEDTLS_ERR_X509_ALLOC_FAILED;
-        goto out;
-    }
+    errno = 0;
+    char* end;
+    long val = strtol(str, &end, 10);
+    if (errno || end == str || *end || val < 0)
+        return MBEDTLS_ERR_X509_BAD_INPUT_DATA;
 
-    ret = create_key_and_crt(&key, NULL, der_crt, der_crt_size);
-    if (ret < 0) {
-        goto out;
-    }
+    *interval = val;
+    return 0;
+}
 
-    /* populate der_key; note that der_crt was already populated */
-    int size = mbedtls_pk_write_key_der(&key, output_buf, sizeof(output_buf));
-    if (size < 0) {
-        ret = size;
-        goto out;
+static void* refresh_cert_thread(void* arg) {
+    (void)arg;
+
+    struct ra_tls_cert new_cert = {0};
+    int ret = generate_key_and_crt_der(&new_cert);
+
+    pthread_mutex_lock(&g_cert_lock);
+    struct ra_tls_cert old_cert = g_cert;
+    if (ret == 0)
+        g_cert = new_cert;
+    g_cert_refreshing = false;
+    pthread_mutex_unlock(&g_cert_lock);
+
+    /* on failure, the old certificate is kept and the next call retries the refresh */
+    if (ret == 0)
+        free_cert(&old_cert);
+    return NULL;
+}
+
+/*! returns a (possibly reused, see `g_cert`) RA-TLS key and certificate, owned by the caller */
+static int get_key_and_crt_der(struct ra_tls_cert* cert) {
+    time_t refresh_interval;
+    int ret = getenv_cert_refresh_interval(&refresh_interval);
+    if (ret < 0)
+        return ret;
+
+    if (!refresh_interval)
+        return generate_key_and_crt_der(cert);
+
+    pthread_mutex_lock(&g_cert_lock);
+    if (!g_cert.key_der) {
+        /* the first certificate is generated synchronously, all other callers wait for it */
+        ret = generate_key_and_crt_der(&g_cert);
+        if (ret < 0)
+            goto out;
+    } else if (!g_cert_refreshing && time(NULL) - g_cert.created >= refresh_interval) {
+        pthread_t tid;
+        pthread_attr_t tattr;
+        if (pthread_attr_init(&tattr) == 0) {
+            if (pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED) == 0
+                    && pthread_create(&tid, &tattr, refresh_cert_thread, NULL) == 0)
+                g_cert_refreshing = true;
+            pthread_attr_destroy(&tattr);
+        }
+        /* if the thread cannot be created, the old certificate is returned and the refresh is
+         * retried on the next call */
     }
 
-    der_key_buf = malloc(size);
-    if (!der_key_buf) {
-        ret = MBEDTLS_ERR_X509_ALLOC_FAILED;
+    ret = copy_cert(&g_cert, cert);
+out:
+    pthread_mutex_unlock(&g_cert_lock);
+    return ret;
+}
+
+int ra_tls_create_key_and_crt(mbedtls_pk_context* key, mbedtls_x509_crt* crt) {
+    if (!key || !crt)
+        return MBEDTLS_ERR_X509_FATAL_ERROR;
+
+    struct ra_tls_cert cert = {0};
+    int ret = get_key_and_crt_der(&cert);
+    if (ret < 0)
+        return ret;
+
+    ret = mbedtls_pk_parse_key(key, cert.key_der, cert.key_der_size, /*pwd=*/NULL,
+                               /*pwdlen=*/0);
+    if (ret < 0)
         goto out;
-    }
 
-    /* note that mbedtls_pk_write_key_der() wrote data at the end of the output_buf */
-    memcpy(der_key_buf, output_buf + sizeof(output_buf) - size, size);
-    *der_key      = der_key_buf;
-    *der_key_size = size;
+    ret = mbedtls_x509_crt_parse_der(crt, cert.crt_der, cert.crt_der_size);
+    if (ret < 0)
+        goto out;
 
     ret = 0;
 out:
-    if (ret < 0) {
-        free(der_key_buf);
-    }
-    mbedtls_pk_free(&key);
-    free(output_buf);
+    free_cert(&cert);
     return ret;
 }
+
+int ra_tls_create_key_and_crt_der(uint8_t** der_key, size_t* der_key_size, uint8_t** der_crt,
+                                  size_t* der_crt_size) {
+    if (!der_key || !der_key_size || !der_crt || !der_crt_size)
+        return -EINVAL;
+
+    struct ra_tls_cert cert = {0};
+    int ret = get_key_and_crt_der(&cert);
+    if (ret < 0)
+        return ret;
+
+    *der_key      = cert.key_der;
+    *der_key_size = cert.key_der_size;
+    *der_crt      = cert.crt_der;
+    *der_crt_size = cert.crt_der_size;
+    return 0;
+}
@@ -9,9 +9,12 @@
  */
 
 #define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <mbedtls/pk.h>
@@ -24,6 +27,25 @@
 
 verify_measurements_cb_t g_verify_measurements_cb = NULL;
 
+/* Quotes which passed verification by IAS/DCAP, so that clients connecting repeatedly with the same
+ * RA-TLS certificate don't need a round trip to IAS or a DCAP quote verification per handshake.
+ * Entries are keyed by the SHA256 hash of the whole quote (including its signature), expire after
+ * `RA_TLS_QUOTE_CACHE_TTL` seconds, and the least recently used one is evicted when the cache is
+ * full. Only the result of the IAS/DCAP verification is cached, the measurements are checked on
+ * each handshake. */
+#define VERIFIED_QUOTES_MAX 64
+
+struct verified_quote {
+    uint8_t hash[SHA256_DIGEST_SIZE];
+    bool allow_outdated_tcb; /* whether an outdated TCB was allowed when the quote was verified */
+    time_t expire_time;
+    uint64_t last_used; /* 0 if the entry is unused */
+};
+
+static pthread_mutex_t g_verified_quotes_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct verified_quote g_verified_quotes[VERIFIED_QUOTES_MAX];
+static uint64_t g_verified_quotes_clock = 0;
+
 static int getenv_enclave_measurements(sgx_measurement_t* mrsigner, bool* validate_mrsigner,
                                        sgx_measurement_t* mrenclave, bool* validate_mrenclave,
                                        sgx_prod_id_t* isv_prod_id, bool* validate_isv_prod_id,
@@ -87,6 +109,85 @@ int getenv_allow_outdated_tcb(bool* allow_outdated_tcb) {
     return 0;
 }
 
+/*! reads the TTL of verified quotes in \p ttl, 0 (caching disabled) if the envvar is not set */
+static int getenv_quote_cache_ttl(time_t* ttl) {
+    *ttl = 0;
+
+    char* str = getenv(RA_TLS_QUOTE_CACHE_TTL);
+    if (!str)
+        return 0;
+
+    errno = 0;
+    char* end;
+    long val = strtol(str, &end, 10);
+    if (errno || end == str || *end || val < 0)
+        return MBEDTLS_ERR_X509_BAD_INPUT_DATA;
+
+    *ttl = val;
+    return 0;
+}
+
+bool verified_quote_cache_lookup(const void* quote, size_t quote_size, bool allow_outdated_tcb) {
+    time_t ttl;
+    if (getenv_quote_cache_ttl(&ttl) < 0 || !ttl)
+        return false;
+
+    uint8_t hash[SHA256_DIGEST_SIZE];
+    if (mbedtls_sha256_ret(quote, quote_size, hash, /*is224=*/0) < 0)
+        return false;
+
+    time_t now = time(NULL);
+    if (now == (time_t)-1)
+        return false;
+
+    bool found = false;
+    pthread_mutex_lock(&g_verified_quotes_lock);
+    for (size_t i = 0; i < VERIFIED_QUOTES_MAX; i++) {
+        struct verified_quote* entry = &g_verified_quotes[i];
+        if (entry->last_used && now < entry->expire_time
+                && (allow_outdated_tcb || !entry->allow_outdated_tcb)
+                && !memcmp(entry->hash, hash, sizeof(hash))) {
+            entry->last_used = ++g_verified_quotes_clock;
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_verified_quotes_lock);
+    return found;
+}
+
+void verified_quote_cache_add(const void* quote, size_t quote_size, bool allow_outdated_tcb) {
+    time_t ttl;
+    if (getenv_quote_cache_ttl(&ttl) < 0 || !ttl)
+        return;
+
+    uint8_t hash[SHA256_DIGEST_SIZE];
+    if (mbedtls_sha256_ret(quote, quote_size, hash, /*is224=*/0) < 0)
+        return;
+
+    time_t now = time(NULL);
+    if (now == (time_t)-1)
+        return;
+
+    pthread_mutex_lock(&g_verified_quotes_lock);
+    /* replace the entry of the same quote, an unused one or the least recently used one */
+    struct verified_quote* victim = &g_verified_quotes[0];
+    for (size_t i = 0; i < VERIFIED_QUOTES_MAX; i++) {
+        struct verified_quote* entry = &g_verified_quotes[i];
+        if (entry->last_used && !memcmp(entry->hash, hash, sizeof(hash))) {
+            victim = entry;
+            break;
+        }
+        if (entry->last_used < victim->last_used)
+            victim = entry;
+    }
+    memcpy(victim->hash, hash, sizeof(hash));
+    victim->allow_outdated_tcb = allow_outdated_tcb;
+    victim->expire_time        = now + ttl;
+    victim->last_used          = ++g_verified_quotes_clock;
+    pthread_mutex_unlock(&g_verified_quotes_lock);
+}
+
 /*! searches for specific \p oid among \p exts and returns pointer to its value in \p val */
 int find_oid(const uint8_t* exts, size_t exts_len, const uint8_t* oid, size_t oid_len,
              uint8_t** val, size_t* len) {
@@ -71,53 +71,13 @@ int sgx_qv_verify_quote(const uint8_t* p_quote, uint32_t quote_size, void* p_quo
                         sgx_ql_qv_result_t* p_quote_verification_result, void* p_qve_report_info,
                         uint32_t supplemental_data_size, uint8_t* p_supplemental_data);
 
-int ra_tls_verify_callback(void* data, mbedtls_x509_crt* crt, int depth, uint32_t* flags) {
-    (void)data;
-
+/*! verifies \p quote with libsgx_dcap_quoteverify */
+static int dcap_verify_quote(const sgx_quote_t* quote, size_t quote_size, bool allow_outdated_tcb) {
     int ret;
 
     uint8_t* supplemental_data      = NULL;
     uint32_t supplemental_data_size = 0;
 
-    if (depth != 0) {
-        /* the cert chain in RA-TLS consists of single self-signed cert, so we expect depth 0 */
-        return MBEDTLS_ERR_X509_INVALID_FORMAT;
-    }
-
-    if (flags) {
-        /* mbedTLS sets flags to signal that the cert is not to be trusted (e.g., it is not
-         * correctly signed by a trusted CA; since RA-TLS uses self-signed certs, we don't care
-         * what mbedTLS thinks and ignore internal cert verification logic of mbedTLS */
-        *flags = 0;
-    }
-
-    /* extract SGX quote from "quote" OID extension from crt */
-    sgx_quote_t* quote;
-    size_t quote_size;
-    ret = find_oid(crt->v3_ext.p, crt->v3_ext.len, quote_oid, quote_oid_len, (uint8_t**)&quote,
-                   &quote_size);
-    if (ret < 0)
-        goto out;
-
-    if (quote_size < sizeof(*quote)) {
-        ret = MBEDTLS_ERR_X509_INVALID_EXTENSIONS;
-        goto out;
-    }
-
-    /* compare public key's hash from cert against quote's report_data */
-    ret = cmp_crt_pk_against_quote_report_data(crt, quote);
-    if (ret < 0)
-        goto out;
-
-    /* prepare user-supplied verification parameter "allow outdated TCB" */
-    bool allow_outdated_tcb;
-    ret = getenv_allow_outdated_tcb(&allow_outdated_tcb);
-    if (ret < 0) {
-        ret = MBEDTLS_ERR_X509_BAD_INPUT_DATA;
-        goto out;
-    }
-
-    /* call into libsgx_dcap_quoteverify to verify ECDSA/based SGX quote */
     ret = sgx_qv_get_quote_supplemental_data_size(&supplemental_data_size);
     if (ret) {
         ret = MBEDTLS_ERR_X509_FATAL_ERROR;
@@ -167,6 +127,59 @@ int ra_tls_verify_callback(void* data, mbedtls_x509_crt* crt, int depth, uint32_
             break;
     }
 
+out:
+    free(supplemental_data);
+    return ret;
+}
+
+int ra_tls_verify_callback(void* data, mbedtls_x509_crt* crt, int depth, uint32_t* flags) {
+    (void)data;
+
+    int ret;
+
+    if (depth != 0) {
+        /* the cert chain in RA-TLS consists of single self-signed cert, so we expect depth 0 */
+        return MBEDTLS_ERR_X509_INVALID_FORMAT;
+    }
+
+    if (flags) {
+        /* mbedTLS sets flags to signal that the cert is not to be trusted (e.g., it is not
+         * correctly signed by a trusted CA; since RA-TLS uses self-signed certs, we don't care
+         * what mbedTLS thinks and ignore internal cert verification logic of mbedTLS */
+        *flags = 0;
+    }
+
+    /* extract SGX quote from "quote" OID extension from crt */
+    sgx_quote_t* quote;
+    size_t quote_size;
+    ret = find_oid(crt->v3_ext.p, crt->v3_ext.len, quote_oid, quote_oid_len, (uint8_t**)&quote,
+                   &quote_size);
+    if (ret < 0)
+        return ret;
+
+    if (quote_size < sizeof(*quote))
+        return MBEDTLS_ERR_X509_INVALID_EXTENSIONS;
+
+    /* compare public key's hash from cert against quote's report_data */
+    ret = cmp_crt_pk_against_quote_report_data(crt, quote);
+    if (ret < 0)
+        return ret;
+
+    /* prepare user-supplied verification parameter "allow outdated TCB" */
+    bool allow_outdated_tcb;
+    ret = getenv_allow_outdated_tcb(&allow_outdated_tcb);
+    if (ret < 0)
+        return MBEDTLS_ERR_X509_BAD_INPUT_DATA;
+
+    /* call into libsgx_dcap_quoteverify to verify ECDSA/based SGX quote, unless it was verified
+     * recently */
+    if (!verified_quote_cache_lookup(quote, quote_size, allow_outdated_tcb)) {
+        ret = dcap_verify_quote(quote, quote_size, allow_outdated_tcb);
+        if (ret < 0)
+            return ret;
+        verified_quote_cache_add(quote, quote_size, allow_outdated_tcb);
+    }
+
     /* verify all measurements from the SGX quote */
     if (g_verify_measurements_cb) {
         /* use user-supplied callback to verify measurements */
@@ -178,13 +191,8 @@ int ra_tls_verify_callback(void* data, mbedtls_x509_crt* crt, int depth, uint32_
         /* use default logic to verify measurements */
         ret = verify_quote_against_envvar_measurements(quote, quote_size);
     }
-    if (ret < 0) {
-        ret = MBEDTLS_ERR_X509_CERT_VERIFY_FAILED;
-        goto out;
-    }
+    if (ret < 0)
+        return MBEDTLS_ERR_X509_CERT_VERIFY_FAILED;
 
-    ret = 0;
-out:
-    free(supplemental_data);
-    return ret;
+    return 0;
 }
@@ -115,9 +115,11 @@ static int getenv_ias_pub_key_pem(char** ias_pub_key_pem) {
     return 0;
 }
 
-int ra_tls_verify_callback(void* data, mbedtls_x509_crt* crt, int depth, uint32_t* flags) {
-    (void)data;
-
+/*! sends \p quote to IAS and verifies the received IAS attestation report; the quote body from
+ *  the report is returned in \p out_quote_from_ias */
+static int verify_quote_with_ias(const sgx_quote_t* quote, size_t quote_size,
+                                 bool allow_outdated_tcb, uint8_t** out_quote_from_ias,
+                                 size_t* out_quote_from_ias_size) {
     int ret;
     struct ias_context_t* ias = NULL;
     char* ias_pub_key_pem     = NULL;
@@ -132,21 +134,6 @@ int ra_tls_verify_callback(void* data, mbedtls_x509_crt* crt, int depth, uint32_
     size_t cert_data_size     = 0;
     size_t advisory_data_size = 0;
 
-    uint8_t* quote_from_ias    = NULL;
-    size_t quote_from_ias_size = 0;
-
-    if (depth != 0) {
-        /* the cert chain in RA-TLS consists of single self-signed cert, so we expect depth 0 */
-        return MBEDTLS_ERR_X509_INVALID_FORMAT;
-    }
-
-    if (flags) {
-        /* mbedTLS sets flags to signal that the cert is not to be trusted (e.g., it is not
-         * correctly signed by a trusted CA; since RA-TLS uses self-signed certs, we don't care
-         * what mbedTLS thinks and ignore internal cert verification logic of mbedTLS */
-        *flags = 0;
-    }
-
     ret = init_from_env(&g_api_key, RA_TLS_EPID_API_KEY, /*default_val=*/NULL);
     if (ret < 0)
         goto out;
@@ -159,24 +146,6 @@ int ra_tls_verify_callback(void* data, mbedtls_x509_crt* crt, int depth, uint32_
     if (ret < 0)
         goto out;
 
-    /* extract SGX quote from "quote" OID extension from crt */
-    sgx_quote_t* quote;
-    size_t quote_size;
-    ret = find_oid(crt->v3_ext.p, crt->v3_ext.len, quote_oid, quote_oid_len, (uint8_t**)&quote,
-                   &quote_size);
-    if (ret < 0)
-        goto out;
-
-    if (quote_size < sizeof(*quote)) {
-        ret = MBEDTLS_ERR_X509_INVALID_EXTENSIONS;
-        goto out;
-    }
-
-    /* compare public key's hash from cert against quote's report_data */
-    ret = cmp_crt_pk_against_quote_report_data(crt, quote);
-    if (ret < 0)
-        goto out;
-
     /* initialize the IAS context, send the quote to the IAS and receive IAS attestation report */
     ias = ias_init(g_api_key, g_report_url, g_sigrl_url);
     if (!ias) {
@@ -213,13 +182,6 @@ int ra_tls_verify_callback(void* data, mbedtls_x509_crt* crt, int depth, uint32_
      *       IAS attestation report verification, so we don't obtain them */
 
     /* verify the received IAS attestation report */
-    bool allow_outdated_tcb;
-    ret = getenv_allow_outdated_tcb(&allow_outdated_tcb);
-    if (ret < 0) {
-        ret = MBEDTLS_ERR_X509_BAD_INPUT_DATA;
-        goto out;
-    }
-
     ret = getenv_ias_pub_key_pem(&ias_pub_key_pem);
     if (ret < 0)
         goto out;
@@ -227,29 +189,104 @@ int ra_tls_verify_callback(void* data, mbedtls_x509_crt* crt, int depth, uint32_
     ret = verify_ias_report_extract_quote((uint8_t*)report_data, report_data_size,
                                           (uint8_t*)sig_data, sig_data_size,
                                           allow_outdated_tcb, nonce,
-                                          ias_pub_key_pem, &quote_from_ias, &quote_from_ias_size);
+                                          ias_pub_key_pem, out_quote_from_ias,
+                                          out_quote_from_ias_size);
     if (ret < 0) {
         ret = MBEDTLS_ERR_X509_CERT_VERIFY_FAILED;
         goto out;
     }
 
+    ret = 0;
+out:
+    if (ias)
+        ias_cleanup(ias);
+
+    free(ias_pub_key_pem);
+    free(report_data);
+    free(sig_data);
+    free(cert_data);
+    free(advisory_data);
+
+    return ret;
+}
+
+int ra_tls_verify_callback(void* data, mbedtls_x509_crt* crt, int depth, uint32_t* flags) {
+    (void)data;
+
+    int ret;
+
+    uint8_t* quote_from_ias    = NULL;
+    size_t quote_from_ias_size = 0;
+
+    if (depth != 0) {
+        /* the cert chain in RA-TLS consists of single self-signed cert, so we expect depth 0 */
+        return MBEDTLS_ERR_X509_INVALID_FORMAT;
+    }
+
+    if (flags) {
+        /* mbedTLS sets flags to signal that the cert is not to be trusted (e.g., it is not
+         * correctly signed by a trusted CA; since RA-TLS uses self-signed certs, we don't care
+         * what mbedTLS thinks and ignore internal cert verification logic of mbedTLS */
+        *flags = 0;
+    }
+
+    /* extract SGX quote from "quote" OID extension from crt */
+    sgx_quote_t* quote;
+    size_t quote_size;
+    ret = find_oid(crt->v3_ext.p, crt->v3_ext.len, quote_oid, quote_oid_len, (uint8_t**)&quote,
+                   &quote_size);
+    if (ret < 0)
+        goto out;
+
+    if (quote_size < sizeof(*quote)) {
+        ret = MBEDTLS_ERR_X509_INVALID_EXTENSIONS;
+        goto out;
+    }
+
+    /* compare public key's hash from cert against quote's report_data */
+    ret = cmp_crt_pk_against_quote_report_data(crt, quote);
+    if (ret < 0)
+        goto out;
+
+    bool allow_outdated_tcb;
+    ret = getenv_allow_outdated_tcb(&allow_outdated_tcb);
+    if (ret < 0) {
+        ret = MBEDTLS_ERR_X509_BAD_INPUT_DATA;
+        goto out;
+    }
+
+    /* verify the quote with IAS, unless it was verified recently; the quote body in the IAS
+     * attestation report is the same as in the quote itself */
+    const uint8_t* verified_quote = (const uint8_t*)quote;
+    size_t verified_quote_size    = quote_size;
+    if (!verified_quote_cache_lookup(quote, quote_size, allow_outdated_tcb)) {
+        ret = verify_quote_with_ias(quote, quote_size, allow_outdated_tcb, &quote_from_ias,
+                                    &quote_from_ias_size);
+        if (ret < 0)
+            goto out;
+
+        verified_quote_cache_add(quote, quote_size, allow_outdated_tcb);
+        verified_quote      = quote_from_ias;
+        verified_quote_size = quote_from_ias_size;
+    }
+
     /* verify all measurements from the SGX quote (extracted from IAS report) */
     if (g_verify_measurements_cb) {
         /* use user-supplied callback to verify measurements */
         size_t min_quote_size = offsetof(sgx_quote_t, signature_len);
-        if (quote_from_ias_size < min_quote_size || quote_from_ias_size > QUOTE_MAX_SIZE) {
+        if (verified_quote_size < min_quote_size || verified_quote_size > QUOTE_MAX_SIZE) {
             ret = MBEDTLS_ERR_X509_CERT_VERIFY_FAILED;
             goto out;
         }
 
-        sgx_quote_t* q = (sgx_quote_t*)quote_from_ias;
+        const sgx_quote_t* q = (const sgx_quote_t*)verified_quote;
         ret = g_verify_measurements_cb((const char*)&q->report_body.mr_enclave,
                                        (const char*)&q->report_body.mr_signer,
                                        (const char*)&q->report_body.isv_prod_id,
                                        (const char*)&q->report_body.isv_svn);
     } else {
         /* use default logic to verify measurements */
-        ret = verify_quote_against_envvar_measurements(quote_from_ias, quote_from_ias_size);
+        ret = verify_quote_against_envvar_measurements(verified_quote, verified_quote_size);
     }
     if (ret < 0) {
         ret = MBEDTLS_ERR_X509_CERT_VERIFY_FAILED;
@@ -258,15 +295,6 @@ int ra_tls_verify_callback(void* data, mbedtls_x509_crt* crt, int depth, uint32_
 
     ret = 0;
 out:
-    if (ias)
-        ias_cleanup(ias);
-
-    free(ias_pub_key_pem);
     free(quote_from_ias);
-    free(report_data);
-    free(sig_data);
-    free(cert_data);
-    free(advisory_data);
-
     return ret;
 }
@@ -19,10 +19,15 @@
 
 /* envvars for server (verifier) */
 #define SECRET_PROVISION_LISTENING_PORT "SECRET_PROVISION_LISTENING_PORT"
+#define SECRET_PROVISION_TICKET_LIFETIME "SECRET_PROVISION_TICKET_LIFETIME"
 
 /* internal secret-provisioning protocol message format */
 #define SECRET_PROVISION_REQUEST  "SECRET_PROVISION_RA_TLS_REQUEST_V1"
 #define SECRET_PROVISION_RESPONSE "SECRET_PROVISION_RA_TLS_RESPONSE_V1:" // 8B secret size follows
+/* 4B name size and the name (without null byte) follow; answered with SECRET_PROVISION_RESPONSE,
+ * secret size 0 means that the server has no secret with this name */
+#define SECRET_PROVISION_NAMED_REQUEST "SECRET_PROVISION_RA_TLS_NAMED_REQUEST_V1:"
+#define SECRET_PROVISION_NAME_MAX_SIZE 256
 
 #define DEFAULT_SERVERS "localhost:4433"
 
@@ -35,6 +40,11 @@ typedef int (*verify_measurements_cb_t)(const char* mrenclave, const char* mrsig
 
 typedef int (*secret_provision_cb_t)(struct ra_tls_ctx* ctx);
 
+/* returns 0 and the secret named \p name (owned by the caller of secret_provision_serve(), must
+ * stay valid until the secret is sent), or a negative error code if there is no such secret */
+typedef int (*secret_provision_lookup_cb_t)(const char* name, const uint8_t** out_secret,
+                                            size_t* out_secret_size);
+
 /*!
  * \brief Write arbitrary data in an established RA-TLS session.
  *
@@ -101,7 +111,9 @@ int secret_provision_get(uint8_t** out_secret, size_t* out_secret_size);
 /*!
  * \brief Destroy a provisioned secret.
  *
- * This function zeroes out the memory where provisioned secret is stored and frees it.
+ * This function zeroes out the memory where provisioned secret is stored and frees it. The copy
+ * that Graphene keeps for child processes (see secret_provision_start()) is not affected; to remove
+ * it, open `/dev/attestation/provisioned_secret` for writing and close it without writing.
  */
 __attribute__ ((visibility("default")))
 void secret_provision_destroy(void);
@@ -113,9 +125,16 @@ void secret_provision_destroy(void);
  * with the first available server from the \a in_servers list and retrieves the first secret.
  * If \a out_ssl pointer is supplied by the user, the session is not closed and the user can
  * continue this secure session with the server via secret_provision_read(),
- * secret_provision_write(), and the final secret_provision_close(). The first secret can be
- * retrieved via secret_provision_get() and later destroyed via secret_provision_destroy().
- * Not thread-safe.
+ * secret_provision_write(), and the final secret_provision_close(), or fetch more secrets over the
+ * same session with secret_provision_request(). The first secret can be retrieved via
+ * secret_provision_get() and later destroyed via secret_provision_destroy(). Not thread-safe.
+ *
+ * Under Graphene, the first secret (if at most 4KB) is also saved in
+ * `/dev/attestation/provisioned_secret`, which Graphene passes to child processes. If \a out_ctx
+ * is NULL and a secret was already provisioned to this process or to one of its ancestors, this
+ * function returns immediately and secret_provision_get() returns that secret; no connection to
+ * the server is made. In particular, children of an application that provisions the secret in the
+ * library constructor (`SECRET_PROVISION_CONSTRUCTOR`) don't attest to the server again.
  *
  * \param[in] in_servers        List of servers (in format "server1:port1;server2:port2;..."). If
  *                              not specified, environment variable `SECRET_PROVISION_SERVERS` is
@@ -135,6 +154,44 @@ __attribute__ ((visibility("default")))
 int secret_provision_start(const char* in_servers, const char* in_ca_chain_path,
                            struct ra_tls_ctx* out_ctx);
 
+/*!
+ * \brief Fetch a secret by name over an established RA-TLS session (client-side).
+ *
+ * This function can be called any number of times after an RA-TLS session is established via
+ * secret_provision_start() with a non-NULL \a out_ctx, so that many secrets are fetched after a
+ * single remote attestation. The server must answer these requests with secret_provision_serve()
+ * in its secret_provision_cb_t() callback.
+ *
+ * \param[in]  ctx              Established RA-TLS session, obtained from secret_provision_start().
+ * \param[in]  name             Name of the secret (null-terminated string of at most
+ *                              SECRET_PROVISION_NAME_MAX_SIZE characters).
+ * \param[out] out_secret       Pointer to buffer with secret (allocated by the library, must be
+ *                              zeroed out and freed by the caller).
+ * \param[out] out_secret_size  Size of allocated buffer.
+ *
+ * \return                      0 on success, -ENOENT if the server has no secret with this name,
+ *                              specific error code (negative int) otherwise.
+ */
+__attribute__ ((visibility("default")))
+int secret_provision_request(struct ra_tls_ctx* ctx, const char* name, uint8_t** out_secret,
+                             size_t* out_secret_size);
+
+/*!
+ * \brief Serve named secrets over an established RA-TLS session (server-side).
+ *
+ * This function is typically called in the secret_provision_cb_t() callback. It answers the
+ * client's secret_provision_request() calls with the secrets found by \a lookup_cb until the
+ * client closes the session, and then closes the session.
+ *
+ * \param[in] ctx        Established RA-TLS session, obtained in secret_provision_cb_t() callback.
+ * \param[in] lookup_cb  Callback that finds the secret with a given name.
+ *
+ * \return               0 when the client closed the session, specific error code (negative int)
+ *                       otherwise.
+ */
+__attribute__ ((visibility("default")))
+int secret_provision_serve(struct ra_tls_ctx* ctx, secret_provision_lookup_cb_t lookup_cb);
+
 /*!
  * \brief Start a secret provisioning service (server-side).
  *
@@ -9,6 +9,10 @@
  * with an SGX quote embedded in it (using ra_tls_create_key_and_crt()), send it to one of
  * the verifier/secret provisioning servers, and receive secrets in response.
  *
+ * Under Graphene, the first secret is also kept in `/dev/attestation/provisioned_secret`, which is
+ * passed to child processes (on fork and execve) together with the rest of the process state, so
+ * that children reuse it instead of attesting and provisioning again.
+ *
  * This file is part of the secret-provisioning client-side library which is typically linked
  * into the SGX application that needs to receive secrets. This library is *not* thread-safe.
  */
@@ -49,9 +53,100 @@ static mbedtls_ssl_context g_ssl;
 static mbedtls_pk_context g_my_ratls_key;
 static mbedtls_x509_crt g_my_ratls_cert;
 
+/* TLS session of the last successful secret_provision_start(), resumed by the next one with the
+ * same server (if the server issued a session ticket), which skips the RA-TLS verification */
+static mbedtls_ssl_session g_saved_session;
+static char* g_saved_session_server = NULL; /* "addr:port", NULL if there is no saved session */
+
 static uint8_t* provisioned_secret = NULL;
 static size_t provisioned_secret_size = 0;
 
+#define PROVISIONED_SECRET_PATH     "/dev/attestation/provisioned_secret"
+#define PROVISIONED_SECRET_MAX_SIZE 4096 /* limit of the pseudo-file */
+
+static void erase_secret(uint8_t* secret, size_t secret_size) {
+#ifdef __STDC_LIB_EXT1__
+    memset_s(secret, 0, secret_size);
+#else
+    memset(secret, 0, secret_size);
+#endif
+}
+
+static int write_file(const char* path, const uint8_t* buf, size_t size) {
+    int fd = open(path, O_WRONLY);
+    if (fd < 0)
+        return -errno;
+
+    size_t total_written = 0;
+    while (total_written < size) {
+        ssize_t written = write(fd, buf + total_written, size - total_written);
+        if (written > 0) {
+            total_written += written;
+        } else if (written == 0) {
+            /* end of file */
+            break;
+        } else if (errno == EAGAIN || errno == EINTR) {
+            continue;
+        } else {
+            int ret = -errno;
+            close(fd);
+            return ret;
+        }
+    }
+
+    /* pseudo-files under /dev/attestation apply the written data on close */
+    if (close(fd) < 0)
+        return -errno;
+    return total_written == size ? 0 : -EIO;
+}
+
+/* Takes the secret inherited from the parent process (or saved earlier by this process) from
+ * Graphene; fails outside of Graphene or if there is no such secret. */
+static int load_saved_secret(void) {
+    int fd = open(PROVISIONED_SECRET_PATH, O_RDONLY);
+    if (fd < 0)
+        return -errno;
+
+    uint8_t* secret = malloc(PROVISIONED_SECRET_MAX_SIZE);
+    if (!secret) {
+        close(fd);
+        return -ENOMEM;
+    }
+
+    int ret;
+    size_t total_read = 0;
+    while (total_read < PROVISIONED_SECRET_MAX_SIZE) {
+        ssize_t bytes = read(fd, secret + total_read, PROVISIONED_SECRET_MAX_SIZE - total_read);
+        if (bytes > 0) {
+            total_read += bytes;
+        } else if (bytes == 0) {
+            break;
+        } else if (errno == EAGAIN || errno == EINTR) {
+            continue;
+        } else {
+            ret = -errno;
+            goto out;
+        }
+    }
+
+    if (!total_read) {
+        ret = -ENOENT;
+        goto out;
+    }
+
+    provisioned_secret      = secret;
+    provisioned_secret_size = total_read;
+    secret = NULL;
+    ret = 0;
+out:
+    if (secret) {
+        erase_secret(secret, PROVISIONED_SECRET_MAX_SIZE);
+        free(secret);
+    }
+    close(fd);
+    return ret;
+}
+
 int secret_provision_get(uint8_t** out_secret, size_t* out_secret_size) {
     if (!out_secret || !out_secret_size)
         return -EINVAL;
@@ -63,16 +158,44 @@ int secret_provision_get(uint8_t** out_secret, size_t* out_secret_size) {
 
 void secret_provision_destroy(void) {
     if (provisioned_secret && provisioned_secret_size)
-#ifdef __STDC_LIB_EXT1__
-        memset_s(provisioned_secret, 0, provisioned_secret_size);
-#else
-        memset(provisioned_secret, 0, provisioned_secret_size);
-#endif
+        erase_secret(provisioned_secret, provisioned_secret_size);
     free(provisioned_secret);
     provisioned_secret      = NULL;
     provisioned_secret_size = 0;
 }
 
+static bool is_saved_session_server(const char* addr, const char* port) {
+    if (!g_saved_session_server)
+        return false;
+
+    size_t addr_len = strlen(addr);
+    return !strncmp(g_saved_session_server, addr, addr_len)
+           && g_saved_session_server[addr_len] == ':'
+           && !strcmp(g_saved_session_server + addr_len + 1, port);
+}
+
+static void save_session(mbedtls_ssl_context* ssl, const char* addr, const char* port) {
+    if (g_saved_session_server) {
+        mbedtls_ssl_session_free(&g_saved_session);
+        free(g_saved_session_server);
+        g_saved_session_server = NULL;
+    }
+
+    size_t server_size = strlen(addr) + 1 + strlen(port) + 1;
+    char* server = malloc(server_size);
+    if (!server)
+        return;
+    snprintf(server, server_size, "%s:%s", addr, port);
+
+    mbedtls_ssl_session_init(&g_saved_session);
+    if (mbedtls_ssl_get_session(ssl, &g_saved_session) < 0) {
+        mbedtls_ssl_session_free(&g_saved_session);
+        free(server);
+        return;
+    }
+    g_saved_session_server = server;
+}
+
 int secret_provision_start(const char* in_servers, const char* in_ca_chain_path,
                            struct ra_tls_ctx* out_ctx) {
     int ret;
@@ -83,6 +206,14 @@ int secret_provision_start(const char* in_servers, const char* in_ca_chain_path,
     char* connected_addr = NULL;
     char* connected_port = NULL;
 
+    if (!out_ctx) {
+        if (provisioned_secret)
+            return 0;
+        /* no session is requested, so a secret provisioned to the parent process will do */
+        if (load_saved_secret() == 0)
+            return 0;
+    }
+
     mbedtls_ctr_drbg_init(&g_ctr_drbg);
     mbedtls_entropy_init(&g_entropy);
     mbedtls_x509_crt_init(&g_verifier_ca_chain);
@@ -198,6 +329,11 @@ int secret_provision_start(const char* in_servers, const char* in_ca_chain_path,
 
     mbedtls_ssl_set_bio(&g_ssl, &g_verifier_fd, mbedtls_net_send, mbedtls_net_recv, NULL);
 
+    if (is_saved_session_server(connected_addr, connected_port)) {
+        /* failing to resume is not an error, the handshake is then simply a full one */
+        mbedtls_ssl_set_session(&g_ssl, &g_saved_session);
+    }
+
     ret = -1;
     while (ret < 0) {
         ret = mbedtls_ssl_handshake(&g_ssl);
@@ -215,6 +351,8 @@ int secret_provision_start(const char* in_servers, const char* in_ca_chain_path,
         goto out;
     }
 
+    save_session(&g_ssl, connected_addr, connected_port);
+
     struct ra_tls_ctx ctx = {.ssl = &g_ssl};
     uint8_t buf[128] = {0};
     size_t size;
@@ -267,6 +405,11 @@ int secret_provision_start(const char* in_servers, const char* in_ca_chain_path,
         goto out;
     }
 
+    if (provisioned_secret_size <= PROVISIONED_SECRET_MAX_SIZE) {
+        /* let Graphene pass the secret to child processes; not an error outside of Graphene */
+        (void)write_file(PROVISIONED_SECRET_PATH, provisioned_secret, provisioned_secret_size);
+    }
+
     if (out_ctx) {
         out_ctx->ssl = ctx.ssl;
     } else {
@@ -296,6 +439,65 @@ out:
     return ret;
 }
 
+int secret_provision_request(struct ra_tls_ctx* ctx, const char* name, uint8_t** out_secret,
+                             size_t* out_secret_size) {
+    int ret;
+
+    if (!ctx || !ctx->ssl || !name || !out_secret || !out_secret_size)
+        return -EINVAL;
+
+    size_t name_size = strlen(name);
+    if (!name_size || name_size > SECRET_PROVISION_NAME_MAX_SIZE)
+        return -EINVAL;
+
+    /* remote verifier receives 32-bit integer over network; we need to hton it */
+    uint8_t buf[sizeof(SECRET_PROVISION_NAMED_REQUEST) + sizeof(uint32_t)
+                + SECRET_PROVISION_NAME_MAX_SIZE];
+    uint32_t send_name_size = htonl((uint32_t)name_size);
+    memcpy(buf, SECRET_PROVISION_NAMED_REQUEST, sizeof(SECRET_PROVISION_NAMED_REQUEST));
+    memcpy(buf + sizeof(SECRET_PROVISION_NAMED_REQUEST), &send_name_size, sizeof(send_name_size));
+    memcpy(buf + sizeof(SECRET_PROVISION_NAMED_REQUEST) + sizeof(send_name_size), name, name_size);
+
+    ret = secret_provision_write(ctx, buf, sizeof(SECRET_PROVISION_NAMED_REQUEST)
+                                           + sizeof(send_name_size) + name_size);
+    if (ret < 0)
+        return ret;
+
+    uint32_t received_secret_size;
+    ret = secret_provision_read(ctx, buf,
+                                sizeof(SECRET_PROVISION_RESPONSE) + sizeof(received_secret_size));
+    if (ret < 0)
+        return ret;
+
+    if (memcmp(buf, SECRET_PROVISION_RESPONSE, sizeof(SECRET_PROVISION_RESPONSE)))
+        return -EINVAL;
+
+    memcpy(&received_secret_size, buf + sizeof(SECRET_PROVISION_RESPONSE),
+           sizeof(received_secret_size));
+
+    received_secret_size = ntohl(received_secret_size);
+    if (!received_secret_size) {
+        /* server doesn't know this secret */
+        return -ENOENT;
+    }
+    if (received_secret_size > INT_MAX)
+        return -EINVAL;
+
+    uint8_t* secret = malloc(received_secret_size);
+    if (!secret)
+        return -ENOMEM;
+
+    ret = secret_provision_read(ctx, secret, received_secret_size);
+    if (ret < 0) {
+        free(secret);
+        return ret;
+    }
+
+    *out_secret      = secret;
+    *out_secret_size = received_secret_size;
+    return 0;
+}
+
 __attribute__((constructor)) static void secret_provision_constructor(void) {
     char* e = getenv(SECRET_PROVISION_CONSTRUCTOR);
     if (!e)
@@ -323,27 +525,9 @@ __attribute__((constructor)) static void secret_provision_constructor(void) {
         /* successfully retrieved the secret: is it a protected files key? */
         e = getenv(SECRET_PROVISION_SET_PF_KEY);
         if (e && (!strcmp(e, "1") || !strcmp(e, "true") || !strcmp(e, "TRUE"))) {
-            /* the secret is a PF key, apply it to Graphene via pseudo-FS */
-            int fd = open("/dev/attestation/protected_files_key", O_WRONLY);
-            if (fd < 0)
+            /* the secret is a PF key, apply it to Graphene via pseudo-FS (on file close) */
+            if (write_file("/dev/attestation/protected_files_key", secret, secret_size) < 0)
                 return;
-
-            ssize_t total_written = 0;
-            while (total_written < secret_size) {
-                ssize_t written = write(fd, secret + total_written, secret_size - total_written);
-                if (written > 0) {
-                    total_written += written;
-                } else if (written == 0) {
-                    /* end of file */
-                    break;
-                } else if (errno == EAGAIN || errno == EINTR) {
-                    continue;
-                } else {
-                    return;
-                }
-            }
-
-            close(fd);  /* applies retrieved PF key */
         }
 
         /* put the secret into an environment variable */
@@ -29,6 +29,7 @@
 #include "mbedtls/error.h"
 #include "mbedtls/net_sockets.h"
 #include "mbedtls/ssl.h"
+#include "mbedtls/ssl_ticket.h"
 
 #include "ra_tls.h"
 #include "secret_prov.h"
@@ -44,6 +45,24 @@ struct thread_info {
 /* SSL/TLS + RA-TLS handshake is not thread-safe, use coarse-grained lock */
 static pthread_mutex_t g_handshake_lock;
 
+/*! reads the session ticket lifetime in \p lifetime, 0 (no tickets) if the envvar is not set */
+static int getenv_ticket_lifetime(uint32_t* lifetime) {
+    *lifetime = 0;
+
+    char* str = getenv(SECRET_PROVISION_TICKET_LIFETIME);
+    if (!str)
+        return 0;
+
+    errno = 0;
+    char* end;
+    unsigned long val = strtoul(str, &end, 10);
+    if (errno || end == str || *end || val > UINT32_MAX)
+        return -EINVAL;
+
+    *lifetime = val;
+    return 0;
+}
+
 static void* client_connection(void* data) {
     int ret;
     struct thread_info* ti = (struct thread_info*)data;
@@ -133,6 +152,76 @@ out:
     return NULL;
 }
 
+int secret_provision_serve(struct ra_tls_ctx* ctx, secret_provision_lookup_cb_t lookup_cb) {
+    int ret;
+
+    if (!ctx || !ctx->ssl || !lookup_cb)
+        return -EINVAL;
+
+    while (true) {
+        /* remote attester sends 32-bit integer over network; we need to ntoh it */
+        uint8_t buf[sizeof(SECRET_PROVISION_NAMED_REQUEST) + sizeof(uint32_t)];
+        ret = secret_provision_read(ctx, buf, sizeof(buf));
+        if (ret == -ECONNRESET) {
+            /* client is done */
+            ret = 0;
+            break;
+        }
+        if (ret < 0)
+            break;
+
+        if (memcmp(buf, SECRET_PROVISION_NAMED_REQUEST, sizeof(SECRET_PROVISION_NAMED_REQUEST))) {
+            ret = -EINVAL;
+            break;
+        }
+
+        uint32_t name_size;
+        memcpy(&name_size, buf + sizeof(SECRET_PROVISION_NAMED_REQUEST), sizeof(name_size));
+        name_size = ntohl(name_size);
+        if (!name_size || name_size > SECRET_PROVISION_NAME_MAX_SIZE) {
+            ret = -EINVAL;
+            break;
+        }
+
+        char name[SECRET_PROVISION_NAME_MAX_SIZE + 1];
+        ret = secret_provision_read(ctx, (uint8_t*)name, name_size);
+        if (ret < 0)
+            break;
+        name[name_size] = '\0';
+
+        const uint8_t* secret = NULL;
+        size_t secret_size = 0;
+        if (lookup_cb(name, &secret, &secret_size) < 0 || !secret) {
+            /* size 0 tells the client that there is no such secret */
+            secret_size = 0;
+        }
+        if (secret_size > INT_MAX) {
+            ret = -EINVAL;
+            break;
+        }
+
+        /* remote attester receives 32-bit integer over network; we need to hton it */
+        uint32_t send_secret_size = htonl((uint32_t)secret_size);
+        uint8_t response[sizeof(SECRET_PROVISION_RESPONSE) + sizeof(send_secret_size)];
+        memcpy(response, SECRET_PROVISION_RESPONSE, sizeof(SECRET_PROVISION_RESPONSE));
+        memcpy(response + sizeof(SECRET_PROVISION_RESPONSE), &send_secret_size,
+               sizeof(send_secret_size));
+
+        ret = secret_provision_write(ctx, response, sizeof(response));
+        if (ret < 0)
+            break;
+
+        if (secret_size) {
+            ret = secret_provision_write(ctx, secret, secret_size);
+            if (ret < 0)
+                break;
+        }
+    }
+
+    secret_provision_close(ctx);
+    return ret;
+}
+
 int secret_provision_start_server(uint8_t* secret, size_t secret_size, const char* port,
                                   const char* cert_path, const char* key_path,
                                   verify_measurements_cb_t m_cb, secret_provision_cb_t f_cb) {
@@ -152,6 +241,7 @@ int secret_provision_start_server(uint8_t* secret, size_t secret_size, const cha
     mbedtls_x509_crt srvcert;
     mbedtls_net_context client_fd;
     mbedtls_net_context listen_fd;
+    mbedtls_ssl_ticket_context ticket_ctx;
 
     mbedtls_ssl_config_init(&conf);
     mbedtls_ctr_drbg_init(&ctr_drbg);
@@ -160,6 +250,7 @@ int secret_provision_start_server(uint8_t* secret, size_t secret_size, const cha
     mbedtls_x509_crt_init(&srvcert);
     mbedtls_net_init(&client_fd);
     mbedtls_net_init(&listen_fd);
+    mbedtls_ssl_ticket_init(&ticket_ctx);
 
     const char* pers = "secret-provisioning-server";
     ret = mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy,
@@ -212,6 +303,23 @@ int secret_provision_start_server(uint8_t* secret, size_t secret_size, const cha
         goto out;
     }
 
+    /* with session tickets, clients reconnecting within the ticket lifetime resume their session
+     * and skip the RA-TLS verification (which was done when the ticket was issued) */
+    uint32_t ticket_lifetime;
+    ret = getenv_ticket_lifetime(&ticket_lifetime);
+    if (ret < 0) {
+        goto out;
+    }
+    if (ticket_lifetime) {
+        ret = mbedtls_ssl_ticket_setup(&ticket_ctx, mbedtls_ctr_drbg_random, &ctr_drbg,
+                                       MBEDTLS_CIPHER_AES_256_GCM, ticket_lifetime);
+        if (ret < 0) {
+            goto out;
+        }
+        mbedtls_ssl_conf_session_tickets_cb(&conf, mbedtls_ssl_ticket_write,
+                                            mbedtls_ssl_ticket_parse, &ticket_ctx);
+    }
+
     /* wait for new clients */
     while (true) {
         ret = mbedtls_net_accept(&listen_fd, &client_fd, NULL, 0, NULL);
@@ -260,6 +368,7 @@ int secret_provision_start_server(uint8_t* secret, size_t secret_size, const cha
     }
 
 out:
+    mbedtls_ssl_ticket_free(&ticket_ctx);
     mbedtls_x509_crt_free(&srvcert);
     mbedtls_pk_free(&srvkey);
     mbedtls_net_free(&listen_fd);
@@ -5,7 +5,9 @@
  * This file contains operands to handle streams with URIs that start with "file:" or "dir:".
  */
 
+#include <linux/falloc.h>
 #include <linux/types.h>
+#include <sys/uio.h>
 
 #include "api.h"
 #include "pal.h"
@@ -112,6 +114,68 @@ static int64_t file_write(PAL_HANDLE handle, uint64_t offset, uint64_t count, co
     return ret;
 }
 
+/* PAL_IOVEC arrays are passed to host readv/writev (here, in db_pipes.c and db_sockets.c) as they
+ * are */
+static_assert(sizeof(PAL_IOVEC) == sizeof(struct iovec)
+                  && offsetof(PAL_IOVEC, buffer) == offsetof(struct iovec, iov_base)
+                  && offsetof(PAL_IOVEC, size) == offsetof(struct iovec, iov_len),
+              "PAL_IOVEC must have the layout of struct iovec");
+
+/* 'readv' operation for file streams. */
+static int64_t file_readv(PAL_HANDLE handle, uint64_t offset, const PAL_IOVEC* iov,
+                          size_t iov_count) {
+    int fd = handle->file.fd;
+    int64_t ret;
+
+    if (handle->file.seekable) {
+        ret = INLINE_SYSCALL(preadv, 5, fd, iov, iov_count, offset, 0);
+    } else {
+        ret = INLINE_SYSCALL(readv, 3, fd, iov, iov_count);
+    }
+
+    if (ret < 0)
+        return unix_to_pal_error(ret);
+
+    return ret;
+}
+
+/* 'writev' operation for file streams. */
+static int64_t file_writev(PAL_HANDLE handle, uint64_t offset, const PAL_IOVEC* iov,
+                           size_t iov_count) {
+    int fd = handle->file.fd;
+    int64_t ret;
+
+    if (handle->file.seekable) {
+        ret = INLINE_SYSCALL(pwritev, 5, fd, iov, iov_count, offset, 0);
+    } else {
+        ret = INLINE_SYSCALL(writev, 3, fd, iov, iov_count);
+    }
+
+    if (ret < 0)
+        return unix_to_pal_error(ret);
+
+    return ret;
+}
+
+/* 'copyfile' operation for file streams */
+static int64_t file_copyfile(PAL_HANDLE handle, uint64_t offset, PAL_HANDLE file,
+                             uint64_t file_offset, uint64_t count) {
+    if (!IS_HANDLE_TYPE(file, file) || !handle->file.seekable || !file->file.seekable)
+        return -PAL_ERROR_NOTSUPPORT;
+
+    if (offset > INT64_MAX || file_offset > INT64_MAX)
+        return -PAL_ERROR_INVAL;
+
+    off_t off_in  = file_offset;
+    off_t off_out = offset;
+    int64_t ret = INLINE_SYSCALL(copy_file_range, 6, file->file.fd, &off_in, handle->file.fd,
+                                 &off_out, count, 0);
+    if (ret < 0)
+        return unix_to_pal_error(ret);
+
+    return ret;
+}
+
 /* 'close' operation for file streams. In this case, it will only
    close the file withou deleting it. */
 static int file_close(PAL_HANDLE handle) {
@@ -175,6 +239,32 @@ static int64_t file_setlength(PAL_HANDLE handle, uint64_t length) {
     return (int64_t)length;
 }
 
+/* 'advise' operation for file stream. */
+static int file_advise(PAL_HANDLE handle, uint64_t offset, uint64_t length,
+                       enum PAL_ADVICE advice) {
+    int ret = INLINE_SYSCALL(fadvise64, 4, handle->file.fd, offset, length,
+                             PAL_ADVICE_TO_LINUX(advice));
+    if (ret < 0)
+        return ret == -ESPIPE ? -PAL_ERROR_NOTSUPPORT : unix_to_pal_error(ret);
+
+    return 0;
+}
+
+/* 'allocate' operation for file stream. */
+static int file_allocate(PAL_HANDLE handle, uint64_t offset, uint64_t length, bool keep_size) {
+    int ret = INLINE_SYSCALL(fallocate, 4, handle->file.fd, keep_size ? FALLOC_FL_KEEP_SIZE : 0,
+                             offset, length);
+    if (ret < 0) {
+        if (ret == -EOPNOTSUPP)
+            return -PAL_ERROR_NOTSUPPORT;
+        if (ret == -ENOSPC)
+            return -PAL_ERROR_NOMEM;
+        return unix_to_pal_error(ret);
+    }
+
+    return 0;
+}
+
 /* 'flush' operation for file stream. */
 static int file_flush(PAL_HANDLE handle) {
     int ret = INLINE_SYSCALL(fsync, 1, handle->file.fd);
@@ -301,10 +391,15 @@ struct handle_ops g_file_ops = {
     .open           = &file_open,
     .read           = &file_read,
     .write          = &file_write,
+    .readv          = &file_readv,
+    .writev         = &file_writev,
+    .copyfile       = &file_copyfile,
     .close          = &file_close,
     .delete         = &file_delete,
     .map            = &file_map,
     .setlength      = &file_setlength,
+    .allocate       = &file_allocate,
+    .advise         = &file_advise,
     .flush          = &file_flush,
     .attrquery      = &file_attrquery,
     .attrquerybyhdl = &file_attrquerybyhdl,
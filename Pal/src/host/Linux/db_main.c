@@ -135,8 +135,9 @@ noreturn static void print_usage_and_exit(const char* argv_0) {
     const char* self = argv_0 ?: "<this program>";
     log_always("USAGE:\n"
                "\tFirst process: %s <path to libpal.so> init <application> args...\n"
-               "\tChildren:      %s <path to libpal.so> child <parent_pipe_fd> args...\n",
-               self, self);
+               "\tChildren:      %s <path to libpal.so> child <parent_pipe_fd> args...\n"
+               "\tZygote:        %s <path to libpal.so> zygote <parent_pipe_fd>\n",
+               self, self, self);
     log_always("This is an internal interface. Use pal_loader to launch applications in "
                "Graphene.\n");
     _DkProcessExit(1);
@@ -177,7 +178,9 @@ noreturn void pal_linux_main(void* initial_rsp, void* fini_callback) {
 
     // Are we the first in this Graphene's namespace?
     bool first_process = !strcmp(argv[2], "init");
-    if (!first_process && strcmp(argv[2], "child")) {
+    // A zygote forks children off itself in pal_main() (see _DkProcessZygote()).
+    bool zygote = !strcmp(argv[2], "zygote");
+    if (!first_process && !zygote && strcmp(argv[2], "child")) {
         print_usage_and_exit(argv[0]);
     }
 
@@ -279,7 +282,7 @@ noreturn void pal_linux_main(void* initial_rsp, void* fini_callback) {
     } else {
         // Children receive their argv and config via IPC.
         int parent_pipe_fd = atoi(argv[3]);
-        init_child_process(parent_pipe_fd, &parent, &manifest);
+        init_child_process(parent_pipe_fd, zygote, &parent, &manifest);
     }
     assert(manifest);
 
@@ -292,6 +295,9 @@ noreturn void pal_linux_main(void* initial_rsp, void* fini_callback) {
     if (!g_pal_state.manifest_root)
         INIT_FAIL_MANIFEST(PAL_ERROR_DENIED, errbuf);
 
+    add_startup_phase("start", start_time);
+    add_startup_phase("manifest parsing", /*time=*/0);
+
     /* call to main function */
     pal_main((PAL_NUM)g_linux_state.parent_process_id, parent, first_thread,
              first_process ? argv + 3 : argv + 4, envp);
@@ -53,6 +53,26 @@ int _DkVirtualMemoryProtect(void* addr, size_t size, int prot) {
     return ret < 0 ? unix_to_pal_error(ret) : 0;
 }
 
+int _DkVirtualMemoryMove(void* old_addr, void* new_addr, size_t size) {
+    /* the host moves the page table entries, no contents are copied */
+    void* ret = (void*)INLINE_SYSCALL(mremap, 5, old_addr, size, size,
+                                      MREMAP_MAYMOVE | MREMAP_FIXED, new_addr);
+    if (IS_ERR_P(ret))
+        return unix_to_pal_error(-ERRNO_P(ret));
+
+    assert(ret == new_addr);
+    return 0;
+}
+
+int _DkVirtualMemoryDiscard(void* addr, size_t size, bool lazy) {
+    int ret = INLINE_SYSCALL(madvise, 3, addr, size, lazy ? MADV_FREE : MADV_DONTNEED);
+    if (ret == -EINVAL && lazy) {
+        /* MADV_FREE is not supported by hosts older than Linux 4.5 */
+        ret = INLINE_SYSCALL(madvise, 3, addr, size, MADV_DONTNEED);
+    }
+    return ret < 0 ? unix_to_pal_error(ret) : 0;
+}
+
 static int read_proc_meminfo(const char* key, unsigned long* val) {
     int fd = INLINE_SYSCALL(open, 3, "/proc/meminfo", O_RDONLY, 0);
 
@@ -124,6 +144,25 @@ unsigned long _DkMemoryAvailableQuota(void) {
     return quota * 1024;
 }
 
+unsigned long _DkMemoryResidentSize(void) {
+    int fd = INLINE_SYSCALL(open, 3, "/proc/self/statm", O_RDONLY, 0);
+    if (fd < 0)
+        return 0;
+
+    /* "size resident shared text lib data dt", all in pages */
+    char buffer[128];
+    int ret = INLINE_SYSCALL(read, 3, fd, buffer, sizeof(buffer) - 1);
+    INLINE_SYSCALL(close, 1, fd);
+    if (ret <= 0)
+        return 0;
+    buffer[ret] = '\0';
+
+    char* resident = strchr(buffer, ' ');
+    if (!resident)
+        return 0;
+    return (unsigned long)atol(resident + 1) * _DkGetAllocationAlignment();
+}
+
 /* Expects `line` to be in the same format as "/proc/self/maps" entries, i.e. starting with
  * "hexadecimalnumber-hexadecimalnumber", e.g. "1fe3-87cc ...". */
 static void parse_line(const char* line, uintptr_t* start_ptr, uintptr_t* end_ptr) {
@@ -2,10 +2,12 @@
 /* Copyright (C) 2014 Stony Brook University */
 
 /*
- * This file contains APIs for waiting on PAL handles (polling).
+ * This file contains APIs for waiting on PAL handles (polling) and for pollers.
  */
 
 #include <asm/errno.h>
+#include <limits.h>
+#include <linux/eventpoll.h>
 #include <linux/poll.h>
 #include <linux/time.h>
 #include <linux/wait.h>
@@ -18,6 +20,12 @@
 #include "pal_linux.h"
 #include "pal_linux_defs.h"
 
+/* host FDs are closed with plain syscalls, there is nothing to gain from batching them */
+void _DkObjectsClose(PAL_HANDLE* handles, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        _DkObjectClose(handles[i]);
+}
+
 /* Wait for specific events on all handles in the handle array and return multiple events
  * (including errors) reported by the host. Return 0 on success, PAL error on failure. */
 int _DkStreamsWaitEvents(size_t count, PAL_HANDLE* handle_array, PAL_FLG* events,
@@ -130,3 +138,245 @@ out:
     free(offsets);
     return ret;
 }
+
+/* Registration of one internal-handle FD in a poller (`handle->poller.items`, hashed by the FD).
+ * The host epoll instance reports ready FDs with the FD itself as the epoll data. */
+struct poller_item {
+    UT_hash_handle hh;
+    int fd;
+    PAL_FLG events;
+    PAL_NUM data; /* reported to the caller for events on this FD */
+};
+
+#ifndef EPOLLEXCLUSIVE
+/* Linux 4.5, not present in older kernel headers */
+#define EPOLLEXCLUSIVE (1U << 28)
+#endif
+
+/* max host events fetched by one wait; the remaining ones are returned by subsequent waits */
+#define POLLER_WAIT_MAX_EVENTS 128
+
+static uint32_t pal_to_epoll_events(PAL_FLG events) {
+    uint32_t epoll_events = 0;
+    if (events & PAL_WAIT_READ)
+        epoll_events |= EPOLLIN;
+    if (events & PAL_WAIT_WRITE)
+        epoll_events |= EPOLLOUT;
+    if (events & PAL_WAIT_EXCLUSIVE)
+        epoll_events |= EPOLLEXCLUSIVE;
+    return epoll_events;
+}
+
+static PAL_FLG epoll_to_pal_events(uint32_t epoll_events) {
+    PAL_FLG events = 0;
+    if (epoll_events & EPOLLIN)
+        events |= PAL_WAIT_READ;
+    if (epoll_events & EPOLLOUT)
+        events |= PAL_WAIT_WRITE;
+    if (epoll_events & (EPOLLERR | EPOLLHUP))
+        events |= PAL_WAIT_ERROR;
+    return events;
+}
+
+static int epoll_ctl_fd(int epfd, int op, int fd, uint32_t events, uint64_t data) {
+    struct epoll_event event = {.events = events, .data = data};
+    return INLINE_SYSCALL(epoll_ctl, 4, epfd, op, fd, &event);
+}
+
+static int epoll_wait_us(int epfd, struct epoll_event* events, int maxevents, int64_t timeout_us) {
+    /* round up, so that we don't return before the timeout expired */
+    int timeout_ms = timeout_us < 0 ? -1 : (int)MIN((timeout_us + 999) / 1000, INT_MAX);
+    return INLINE_SYSCALL(epoll_wait, 4, epfd, events, maxevents, timeout_ms);
+}
+
+int _DkPollerCreate(PAL_HANDLE* handle) {
+    int fd = INLINE_SYSCALL(epoll_create1, 1, EPOLL_CLOEXEC);
+    if (fd < 0)
+        return unix_to_pal_error(fd);
+
+    PAL_HANDLE hdl = calloc(1, HANDLE_SIZE(poller));
+    if (!hdl) {
+        INLINE_SYSCALL(close, 1, fd);
+        return -PAL_ERROR_NOMEM;
+    }
+
+    SET_HANDLE_TYPE(hdl, poller);
+    hdl->poller.fd = fd;
+    spinlock_init(&hdl->poller.lock);
+    hdl->poller.items = NULL;
+
+    *handle = hdl;
+    return 0;
+}
+
+/* Changes the host registration of `fd` from `old_events` to `events`. The host rejects
+ * EPOLL_CTL_MOD of exclusive registrations (and turning one into exclusive), so these are replaced
+ * instead; this also re-adds an FD the host dropped. */
+static int epoll_mod_fd(int epfd, int fd, PAL_FLG old_events, PAL_FLG events) {
+    uint32_t epoll_events = pal_to_epoll_events(events);
+    if (!((old_events | events) & PAL_WAIT_EXCLUSIVE))
+        return epoll_ctl_fd(epfd, EPOLL_CTL_MOD, fd, epoll_events, fd);
+
+    (void)epoll_ctl_fd(epfd, EPOLL_CTL_DEL, fd, /*events=*/0, /*data=*/0);
+    return epoll_ctl_fd(epfd, EPOLL_CTL_ADD, fd, epoll_events, fd);
+}
+
+/* called with `poller->poller.lock` held */
+static int poller_ctl_fd(PAL_HANDLE poller, struct poller_item** items, enum PAL_POLLER_OP op,
+                         int fd, PAL_FLG events, PAL_NUM data) {
+    int epfd = poller->poller.fd;
+    uint32_t epoll_events = pal_to_epoll_events(events);
+    struct poller_item* item;
+    int ret;
+
+    HASH_FIND_INT(*items, &fd, item);
+
+    switch (op) {
+        case PAL_POLLER_ADD:
+            if (item) {
+                /* re-registration, or a stale item of a handle closed without being removed (the
+                 * host drops closed FDs from the epoll set) whose FD number got reused */
+                ret = epoll_mod_fd(epfd, fd, item->events, events);
+                if (ret == -ENOENT)
+                    ret = epoll_ctl_fd(epfd, EPOLL_CTL_ADD, fd, epoll_events, fd);
+                if (ret < 0)
+                    return unix_to_pal_error(ret);
+            } else {
+                item = malloc(sizeof(*item));
+                if (!item)
+                    return -PAL_ERROR_NOMEM;
+
+                ret = epoll_ctl_fd(epfd, EPOLL_CTL_ADD, fd, epoll_events, fd);
+                if (ret == -EEXIST) {
+                    /* a host registration we don't track, which may be exclusive: replace it */
+                    ret = epoll_mod_fd(epfd, fd, PAL_WAIT_EXCLUSIVE, events);
+                }
+                if (ret < 0) {
+                    free(item);
+                    return unix_to_pal_error(ret);
+                }
+
+                item->fd = fd;
+                HASH_ADD_INT(*items, fd, item);
+            }
+            item->events = events;
+            item->data   = data;
+            return 0;
+
+        case PAL_POLLER_MODIFY:
+            if (!item)
+                return -PAL_ERROR_STREAMNOTEXIST;
+            ret = epoll_mod_fd(epfd, fd, item->events, events);
+            if (ret < 0)
+                return unix_to_pal_error(ret);
+            item->events = events;
+            item->data   = data;
+            return 0;
+
+        case PAL_POLLER_REMOVE:
+            if (!item)
+                return -PAL_ERROR_STREAMNOTEXIST;
+            /* errors are ignored: the FD may be already closed and thus dropped by the host */
+            (void)epoll_ctl_fd(epfd, EPOLL_CTL_DEL, fd, /*events=*/0, /*data=*/0);
+            HASH_DEL(*items, item);
+            free(item);
+            return 0;
+    }
+
+    return -PAL_ERROR_INVAL;
+}
+
+int _DkPollerCtl(PAL_HANDLE poller, enum PAL_POLLER_OP op, PAL_HANDLE handle, PAL_FLG events,
+                 PAL_NUM data) {
+    PAL_FLG flags = HANDLE_HDR(handle)->flags;
+    bool found = false;
+    int ret = 0;
+
+    spinlock_lock(&poller->poller.lock);
+    struct poller_item* items = poller->poller.items;
+
+    /* (un)register all internal-handle FDs which are readable/writable, same as the ones
+     * _DkStreamsWaitEvents() waits on */
+    for (size_t j = 0; j < MAX_FDS; j++) {
+        if (handle->generic.fds[j] == PAL_IDX_POISON || !(flags & (RFD(j) | WFD(j))))
+            continue;
+        found = true;
+
+        PAL_FLG fd_events = 0;
+        fd_events |= (flags & RFD(j)) ? (events & PAL_WAIT_READ) : 0;
+        fd_events |= (flags & WFD(j)) ? (events & PAL_WAIT_WRITE) : 0;
+        fd_events |= events & PAL_WAIT_EXCLUSIVE;
+
+        ret = poller_ctl_fd(poller, &items, op, handle->generic.fds[j], fd_events, data);
+        if (ret < 0)
+            break;
+    }
+
+    poller->poller.items = items;
+    spinlock_unlock(&poller->poller.lock);
+
+    if (!found) {
+        /* handle is an event/non-pollable object or is already closed */
+        return -PAL_ERROR_INVAL;
+    }
+    return ret;
+}
+
+int _DkPollerWait(PAL_HANDLE poller, PAL_POLLER_EVENT* events, size_t max_events,
+                  size_t* ret_count, int64_t timeout_us) {
+    struct epoll_event host_events[POLLER_WAIT_MAX_EVENTS];
+
+    /* no lock is held while blocked, so that other threads can (un)register handles */
+    int max_host_events = (int)MIN(max_events, (size_t)POLLER_WAIT_MAX_EVENTS);
+    int ret = epoll_wait_us(poller->poller.fd, host_events, max_host_events, timeout_us);
+    if (ret < 0)
+        return unix_to_pal_error(ret);
+
+    if (!ret) {
+        /* timed out */
+        return -PAL_ERROR_TRYAGAIN;
+    }
+
+    size_t count = 0;
+    spinlock_lock(&poller->poller.lock);
+    struct poller_item* items = poller->poller.items;
+    for (int i = 0; i < ret; i++) {
+        int fd = (int)host_events[i].data;
+        struct poller_item* item;
+        HASH_FIND_INT(items, &fd, item);
+        /* unknown FD: removed concurrently with this wait */
+        if (!item)
+            continue;
+
+        PAL_FLG ready = epoll_to_pal_events(host_events[i].events);
+        ready &= item->events | PAL_WAIT_ERROR;
+        if (!ready)
+            continue;
+
+        events[count].data   = item->data;
+        events[count].events = ready;
+        count++;
+    }
+    spinlock_unlock(&poller->poller.lock);
+
+    *ret_count = count;
+    return 0;
+}
+
+static int poller_close(PAL_HANDLE handle) {
+    struct poller_item* items = handle->poller.items;
+    struct poller_item* item;
+    struct poller_item* tmp;
+    HASH_ITER(hh, items, item, tmp) {
+        HASH_DEL(items, item);
+        free(item);
+    }
+    handle->poller.items = NULL;
+
+    INLINE_SYSCALL(close, 1, handle->poller.fd);
+    return 0;
+}
+
+struct handle_ops g_poller_ops = {
+    .close = &poller_close,
+};
@@ -322,6 +322,48 @@ static int64_t pipe_write(PAL_HANDLE handle, uint64_t offset, size_t len, const
     return bytes;
 }
 
+/*!
+ * \brief Read from pipe into several buffers, see pipe_read().
+ */
+static int64_t pipe_readv(PAL_HANDLE handle, uint64_t offset, const PAL_IOVEC* iov,
+                          size_t iov_count) {
+    if (offset)
+        return -PAL_ERROR_INVAL;
+
+    if (!IS_HANDLE_TYPE(handle, pipecli) && !IS_HANDLE_TYPE(handle, pipeprv) &&
+        !IS_HANDLE_TYPE(handle, pipe))
+        return -PAL_ERROR_NOTCONNECTION;
+
+    int fd = IS_HANDLE_TYPE(handle, pipeprv) ? handle->pipeprv.fds[0] : handle->pipe.fd;
+
+    ssize_t bytes = INLINE_SYSCALL(readv, 3, fd, iov, iov_count);
+    if (bytes < 0)
+        return unix_to_pal_error(bytes);
+
+    return bytes;
+}
+
+/*!
+ * \brief Write to pipe from several buffers, see pipe_write().
+ */
+static int64_t pipe_writev(PAL_HANDLE handle, uint64_t offset, const PAL_IOVEC* iov,
+                           size_t iov_count) {
+    if (offset)
+        return -PAL_ERROR_INVAL;
+
+    if (!IS_HANDLE_TYPE(handle, pipecli) && !IS_HANDLE_TYPE(handle, pipeprv) &&
+        !IS_HANDLE_TYPE(handle, pipe))
+        return -PAL_ERROR_NOTCONNECTION;
+
+    int fd = IS_HANDLE_TYPE(handle, pipeprv) ? handle->pipeprv.fds[1] : handle->pipe.fd;
+
+    ssize_t bytes = INLINE_SYSCALL(writev, 3, fd, iov, iov_count);
+    if (bytes < 0)
+        return unix_to_pal_error(bytes);
+
+    return bytes;
+}
+
 /*!
  * \brief Close pipe (both ends in case of `pipeprv`).
  *
@@ -540,6 +582,8 @@ struct handle_ops g_pipe_ops = {
     .waitforclient  = &pipe_waitforclient,
     .read           = &pipe_read,
     .write          = &pipe_write,
+    .readv          = &pipe_readv,
+    .writev         = &pipe_writev,
     .close          = &pipe_close,
     .delete         = &pipe_delete,
     .attrquerybyhdl = &pipe_attrquerybyhdl,
@@ -550,6 +594,8 @@ struct handle_ops g_pipeprv_ops = {
     .open           = &pipe_open,
     .read           = &pipe_read,
     .write          = &pipe_write,
+    .readv          = &pipe_readv,
+    .writev         = &pipe_writev,
     .close          = &pipe_close,
     .attrquerybyhdl = &pipe_attrquerybyhdl,
     .attrsetbyhdl   = &pipe_attrsetbyhdl,
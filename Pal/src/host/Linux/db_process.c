@@ -105,6 +105,25 @@ struct proc_args {
     size_t manifest_data_size;
 };
 
+/* Request of a new child sent to the zygote, the FD of the child's end of the process stream goes
+ * with it and the serialized parent handle follows it; the zygote replies with the PID of the
+ * child (or a negative error code). */
+struct zygote_request {
+    PAL_NUM         parent_process_id;
+    unsigned long   memory_quota;
+    size_t          parent_data_size;
+};
+
+/* In the creating process: process stream of our zygote, spawned by the first _DkProcessCreate()
+ * if the manifest asks for it. The lock serializes requests, as each of them waits for the reply
+ * of the zygote (which only forks). */
+static spinlock_t g_zygote_lock = INIT_SPINLOCK_UNLOCKED;
+static bool g_zygote_spawned = false;
+static PAL_HANDLE g_zygote = NULL;
+
+/* In the zygote itself: stream of requests from the creating process, -1 everywhere else. */
+static int g_zygote_requests_fd = -1;
+
 /*
  * vfork() shares stack between child and parent. Any stack modifications in
  * child are reflected in parent's stack. Compiler may unwittingly modify
@@ -132,41 +151,19 @@ static int __attribute_noinline child_process(struct proc_param* proc_param) {
     die_or_inf_loop();
 }
 
-int _DkProcessCreate(PAL_HANDLE* handle, const char** args) {
-    PAL_HANDLE parent_handle = NULL;
-    PAL_HANDLE child_handle = NULL;
-    struct proc_args* proc_args = NULL;
-    void* parent_data = NULL;
-    void* exec_data = NULL;
+/* Starts a new loader in `mode` ("child" or "zygote") which gets `parent_handle` as the stream to
+ * its parent, and sends it the process parameters followed by `parent_data` and the manifest.
+ * Returns the PID of the new process or a negative PAL error code. */
+static int spawn_loader(const char* mode, PAL_HANDLE parent_handle, PAL_HANDLE child_handle,
+                        const void* parent_data, size_t parent_data_size, const char** args) {
     int ret;
 
-    /* step 1: create parent and child process handle */
-
-    struct proc_param param;
-    ret = create_process_handle(&parent_handle, &child_handle);
-    if (ret < 0)
-        goto out;
-
-    param.parent   = parent_handle;
-
-    /* step 2: compose process parameters */
-
-    size_t parent_data_size = 0;
-    size_t manifest_data_size = 0;
-
-    ret = handle_serialize(parent_handle, &parent_data);
-    if (ret < 0)
-        goto out;
-    parent_data_size = (size_t)ret;
-
-    manifest_data_size = strlen(g_pal_state.raw_manifest_data);
+    size_t manifest_data_size = strlen(g_pal_state.raw_manifest_data);
 
     size_t data_size = parent_data_size + manifest_data_size;
-    proc_args = malloc(sizeof(struct proc_args) + data_size);
-    if (!proc_args) {
-        ret = -ENOMEM;
-        goto out;
-    }
+    struct proc_args* proc_args = malloc(sizeof(struct proc_args) + data_size);
+    if (!proc_args)
+        return -PAL_ERROR_NOMEM;
 
     proc_args->parent_process_id = g_linux_state.parent_process_id;
     memcpy(&proc_args->pal_sec, &g_pal_sec, sizeof(struct pal_sec));
@@ -182,7 +179,10 @@ int _DkProcessCreate(PAL_HANDLE* handle, const char** args) {
     proc_args->manifest_data_size = manifest_data_size;
     data += manifest_data_size;
 
-    /* step 3: create a child thread which will execve in the future */
+    /* create a child thread which will execve in the future */
+
+    struct proc_param param;
+    param.parent = parent_handle;
 
     /* the first argument must be the PAL */
     int argc = 0;
@@ -192,7 +192,7 @@ int _DkProcessCreate(PAL_HANDLE* handle, const char** args) {
     param.argv = __alloca(sizeof(const char*) * (argc + 5));
     param.argv[0] = g_pal_loader_path;
     param.argv[1] = g_libpal_path;
-    param.argv[2] = "child";
+    param.argv[2] = mode;
     char parent_fd_str[16];
     snprintf(parent_fd_str, sizeof(parent_fd_str), "%u", parent_handle->process.stream);
     param.argv[3] = parent_fd_str;
@@ -207,21 +207,20 @@ int _DkProcessCreate(PAL_HANDLE* handle, const char** args) {
     if (ret < 0)
         goto out;
 
-    ret = child_process(&param);
-    if (ret < 0) {
+    int pid = child_process(&param);
+    if (pid < 0) {
         ret = -PAL_ERROR_DENIED;
         goto out;
     }
 
-    proc_args->pal_sec.process_id = ret;
-    child_handle->process.pid = ret;
+    proc_args->pal_sec.process_id = pid;
 
     /* children unblock async signals by signal_setup() */
     ret = block_async_signals(false);
     if (ret < 0)
         goto out;
 
-    /* step 4: send parameters over the process handle */
+    /* send parameters over the process handle */
 
     ret = write_all(child_handle->process.stream, proc_args, sizeof(struct proc_args) + data_size);
     if (ret < 0) {
@@ -229,12 +228,176 @@ int _DkProcessCreate(PAL_HANDLE* handle, const char** args) {
         goto out;
     }
 
+    ret = pid;
+out:
+    free(proc_args);
+    return ret;
+}
+
+/* Called with `g_zygote_lock` held. Failure is not fatal, processes are then created without the
+ * zygote. */
+static void spawn_zygote(void) {
+    PAL_HANDLE zygote_end = NULL;
+    PAL_HANDLE our_end = NULL;
+
+    g_zygote_spawned = true;
+
+    bool use_zygote;
+    int ret = toml_bool_in(g_pal_state.manifest_root, "loader.zygote", /*defaultval=*/false,
+                           &use_zygote);
+    if (ret < 0) {
+        log_error("Cannot parse 'loader.zygote' (the value must be `true` or `false`)\n");
+        return;
+    }
+    if (!use_zygote)
+        return;
+
+    ret = create_process_handle(&zygote_end, &our_end);
+    if (ret < 0)
+        goto out;
+
+    ret = spawn_loader("zygote", zygote_end, our_end, /*parent_data=*/NULL,
+                       /*parent_data_size=*/0, /*args=*/NULL);
+    if (ret < 0)
+        goto out;
+
+    our_end->process.pid = ret;
+    g_zygote = our_end;
+    ret = 0;
+out:
+    if (zygote_end)
+        _DkObjectClose(zygote_end);
+    if (ret < 0) {
+        log_warning("Starting the zygote failed (%d), creating processes without it\n", ret);
+        if (our_end)
+            _DkObjectClose(our_end);
+    }
+}
+
+/* Called with `g_zygote_lock` held. Returns the PID of the new child or a negative PAL error
+ * code. */
+static int request_zygote_child(PAL_HANDLE parent_handle, const void* parent_data,
+                                size_t parent_data_size) {
+    int fd = g_zygote->process.stream;
+
+    struct zygote_request request = {
+        .parent_process_id = g_linux_state.parent_process_id,
+        .memory_quota      = g_linux_state.memory_quota,
+        .parent_data_size  = parent_data_size,
+    };
+
+    struct msghdr message_hdr = {0};
+    struct iovec iov[1];
+    char control_buf[CMSG_SPACE(sizeof(int))] = {0};
+
+    iov[0].iov_base = &request;
+    iov[0].iov_len  = sizeof(request);
+    message_hdr.msg_iov        = iov;
+    message_hdr.msg_iovlen     = 1;
+    message_hdr.msg_control    = control_buf;
+    message_hdr.msg_controllen = sizeof(control_buf);
+
+    struct cmsghdr* control_hdr = CMSG_FIRSTHDR(&message_hdr);
+    control_hdr->cmsg_level = SOL_SOCKET;
+    control_hdr->cmsg_type  = SCM_RIGHTS;
+    control_hdr->cmsg_len   = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(control_hdr), &parent_handle->process.stream, sizeof(int));
+
+    ssize_t bytes = INLINE_SYSCALL(sendmsg, 3, fd, &message_hdr, MSG_NOSIGNAL);
+    if (bytes < 0)
+        return unix_to_pal_error(bytes);
+
+    /* a partial send is possible only for the payload, the FD went with its first part */
+    int ret = write_all(fd, (char*)&request + bytes, sizeof(request) - bytes);
+    if (ret < 0)
+        return unix_to_pal_error(ret);
+
+    ret = write_all(fd, parent_data, parent_data_size);
+    if (ret < 0)
+        return unix_to_pal_error(ret);
+
+    int pid;
+    ret = read_all(fd, &pid, sizeof(pid));
+    if (ret < 0)
+        return unix_to_pal_error(ret);
+    if (pid <= 0)
+        return pid < 0 ? unix_to_pal_error(pid) : -PAL_ERROR_DENIED;
+
+    return pid;
+}
+
+/* Tries to create the child by the zygote (spawning it first if this is the first process creation
+ * at all). Returns the PID of the child or a negative PAL error code. */
+static int create_process_from_zygote(PAL_HANDLE parent_handle, const void* parent_data,
+                                      size_t parent_data_size) {
+    int ret;
+
+    spinlock_lock(&g_zygote_lock);
+    if (!g_zygote_spawned)
+        spawn_zygote();
+
+    if (!g_zygote) {
+        ret = -PAL_ERROR_DENIED;
+        goto out;
+    }
+
+    ret = request_zygote_child(parent_handle, parent_data, parent_data_size);
+    if (ret < 0) {
+        /* the zygote is gone or out of sync, don't use it anymore */
+        log_warning("Creating a process by the zygote failed (%d), creating processes without "
+                    "it from now on\n", ret);
+        _DkObjectClose(g_zygote);
+        g_zygote = NULL;
+    }
+out:
+    spinlock_unlock(&g_zygote_lock);
+    return ret;
+}
+
+int _DkProcessCreate(PAL_HANDLE* handle, const char** args) {
+    PAL_HANDLE parent_handle = NULL;
+    PAL_HANDLE child_handle = NULL;
+    void* parent_data = NULL;
+    int ret;
+
+    /* step 1: create parent and child process handle */
+
+    ret = create_process_handle(&parent_handle, &child_handle);
+    if (ret < 0)
+        goto out;
+
+    /* step 2: compose process parameters */
+
+    ret = handle_serialize(parent_handle, &parent_data);
+    if (ret < 0)
+        goto out;
+    size_t parent_data_size = (size_t)ret;
+
+    /* step 3: fork the child off the zygote, which already loaded everything; it can't change
+     * arguments of the loader, so that is done only for the usual process creation (with no
+     * arguments) */
+
+    if (!args) {
+        ret = create_process_from_zygote(parent_handle, parent_data, parent_data_size);
+        if (ret > 0) {
+            child_handle->process.pid = ret;
+            *handle = child_handle;
+            ret = 0;
+            goto out;
+        }
+    }
+
+    /* step 4: otherwise start a new loader and send it the parameters */
+
+    ret = spawn_loader("child", parent_handle, child_handle, parent_data, parent_data_size, args);
+    if (ret < 0)
+        goto out;
+    child_handle->process.pid = ret;
+
     *handle = child_handle;
     ret = 0;
 out:
     free(parent_data);
-    free(exec_data);
-    free(proc_args);
     if (parent_handle)
         _DkObjectClose(parent_handle);
     if (ret < 0) {
@@ -244,7 +407,8 @@ out:
     return ret;
 }
 
-void init_child_process(int parent_pipe_fd, PAL_HANDLE* parent_handle, char** manifest_out) {
+void init_child_process(int parent_pipe_fd, bool zygote, PAL_HANDLE* parent_handle,
+                        char** manifest_out) {
     int ret = 0;
 
     struct proc_args proc_args;
@@ -255,8 +419,9 @@ void init_child_process(int parent_pipe_fd, PAL_HANDLE* parent_handle, char** ma
         INIT_FAIL(-ret, "communication with parent failed");
     }
 
-    /* a child must have parent handle and an executable */
-    if (!proc_args.parent_data_size)
+    /* a child must have parent handle and an executable, a zygote gets its parent handles with
+     * the requests of new children */
+    if (zygote ? proc_args.parent_data_size != 0 : proc_args.parent_data_size == 0)
         INIT_FAIL(PAL_ERROR_INVAL, "invalid process created");
 
     size_t data_size = proc_args.parent_data_size + proc_args.manifest_data_size;
@@ -273,10 +438,14 @@ void init_child_process(int parent_pipe_fd, PAL_HANDLE* parent_handle, char** ma
     /* now deserialize the parent_handle */
     PAL_HANDLE parent = NULL;
     char* data_iter = data;
-    ret = handle_deserialize(&parent, data_iter, proc_args.parent_data_size);
-    if (ret < 0)
-        INIT_FAIL(-ret, "cannot deserialize parent process handle");
-    data_iter += proc_args.parent_data_size;
+    if (!zygote) {
+        ret = handle_deserialize(&parent, data_iter, proc_args.parent_data_size);
+        if (ret < 0)
+            INIT_FAIL(-ret, "cannot deserialize parent process handle");
+        data_iter += proc_args.parent_data_size;
+    } else {
+        g_zygote_requests_fd = parent_pipe_fd;
+    }
     *parent_handle = parent;
 
     char* manifest = malloc(proc_args.manifest_data_size + 1);
@@ -294,6 +463,123 @@ void init_child_process(int parent_pipe_fd, PAL_HANDLE* parent_handle, char** ma
     free(data);
 }
 
+/* Receives a request of a new child (see request_zygote_child()). Returns 0 on EOF, i.e. when the
+ * creating process is gone, 1 on success and a negative PAL error code on failure. */
+static int receive_zygote_request(struct zygote_request* request, int* out_fd, void** out_data) {
+    int fd = g_zygote_requests_fd;
+
+    struct msghdr message_hdr = {0};
+    struct iovec iov[1];
+    char control_buf[CMSG_SPACE(sizeof(int))];
+
+    iov[0].iov_base = request;
+    iov[0].iov_len  = sizeof(*request);
+    message_hdr.msg_iov        = iov;
+    message_hdr.msg_iovlen     = 1;
+    message_hdr.msg_control    = control_buf;
+    message_hdr.msg_controllen = sizeof(control_buf);
+
+    ssize_t bytes;
+    do {
+        bytes = INLINE_SYSCALL(recvmsg, 3, fd, &message_hdr, MSG_CMSG_CLOEXEC);
+    } while (bytes == -EINTR);
+    if (bytes < 0)
+        return unix_to_pal_error(bytes);
+    if (bytes == 0)
+        return 0;
+
+    struct cmsghdr* control_hdr = CMSG_FIRSTHDR(&message_hdr);
+    if (!control_hdr || control_hdr->cmsg_level != SOL_SOCKET
+            || control_hdr->cmsg_type != SCM_RIGHTS
+            || control_hdr->cmsg_len != CMSG_LEN(sizeof(int)))
+        return -PAL_ERROR_DENIED;
+    memcpy(out_fd, CMSG_DATA(control_hdr), sizeof(int));
+
+    int ret = read_all(fd, (char*)request + bytes, sizeof(*request) - bytes);
+    if (ret < 0)
+        goto fail;
+
+    void* data = malloc(request->parent_data_size);
+    if (!data) {
+        ret = -ENOMEM;
+        goto fail;
+    }
+    ret = read_all(fd, data, request->parent_data_size);
+    if (ret < 0) {
+        free(data);
+        goto fail;
+    }
+
+    *out_data = data;
+    return 1;
+fail:
+    INLINE_SYSCALL(close, 1, *out_fd);
+    return unix_to_pal_error(ret);
+}
+
+/* Sets up the current process (just forked off the zygote) as the requested child. */
+static void init_zygote_child(struct zygote_request* request, int parent_fd, void* parent_data,
+                              PAL_NUM* instance_id, PAL_HANDLE* parent_process) {
+    INLINE_SYSCALL(close, 1, g_zygote_requests_fd);
+    g_zygote_requests_fd = -1;
+
+    get_tcb_linux()->handle->thread.tid = INLINE_SYSCALL(gettid, 0);
+
+    g_pal_sec.process_id = INLINE_SYSCALL(getpid, 0);
+    g_linux_state.pid = g_pal_sec.process_id;
+    g_linux_state.process_id = g_linux_state.pid;
+    g_linux_state.parent_process_id = request->parent_process_id;
+    g_linux_state.memory_quota = request->memory_quota;
+
+    PAL_HANDLE parent = NULL;
+    int ret = handle_deserialize(&parent, parent_data, request->parent_data_size);
+    if (ret < 0)
+        INIT_FAIL(-ret, "cannot deserialize parent process handle");
+    if (PAL_GET_TYPE(parent) != pal_type_process)
+        INIT_FAIL(PAL_ERROR_DENIED, "invalid parent process handle");
+    /* the serialized handle has the FD number of the creating process */
+    parent->process.stream = parent_fd;
+    free(parent_data);
+
+    *instance_id = g_linux_state.parent_process_id;
+    *parent_process = parent;
+}
+
+void _DkProcessZygote(PAL_NUM* instance_id, PAL_HANDLE* parent_process) {
+    if (g_zygote_requests_fd < 0)
+        return;
+
+    while (true) {
+        struct zygote_request request;
+        int parent_fd = -1;
+        void* parent_data = NULL;
+
+        int ret = receive_zygote_request(&request, &parent_fd, &parent_data);
+        if (ret == 0)
+            _DkProcessExit(0);
+        if (ret < 0) {
+            log_error("Zygote: receiving a request failed (%d), exiting\n", ret);
+            _DkProcessExit(1);
+        }
+
+        /* plain fork(), we have only one thread; no exit signal, as for usual children */
+        int pid = INLINE_SYSCALL(clone, 4, 0, 0, NULL, NULL);
+        if (pid == 0) {
+            init_zygote_child(&request, parent_fd, parent_data, instance_id, parent_process);
+            return;
+        }
+
+        INLINE_SYSCALL(close, 1, parent_fd);
+        free(parent_data);
+
+        ret = write_all(g_zygote_requests_fd, &pid, sizeof(pid));
+        if (ret < 0) {
+            log_error("Zygote: replying to a request failed (%d), exiting\n", ret);
+            _DkProcessExit(1);
+        }
+    }
+}
+
 noreturn void _DkProcessExit(int exitcode) {
     INLINE_SYSCALL(exit_group, 1, exitcode);
     die_or_inf_loop();
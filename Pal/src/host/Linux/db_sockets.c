@@ -9,6 +9,7 @@
 #include <asm/errno.h>
 #include <asm/fcntl.h>
 #include <asm/ioctls.h>
+#include <asm/socket.h>
 #include <linux/in.h>
 #include <linux/in6.h>
 #include <linux/poll.h>
@@ -273,6 +274,17 @@ static inline PAL_HANDLE socket_create_handle(int type, int fd, int options,
     return hdl;
 }
 
+/* SO_REUSEPORT (like IPV6_V6ONLY) can only be set before the bind */
+static int socket_set_reuseport(int fd, int create) {
+    if (!(create & PAL_CREATE_REUSEPORT))
+        return 0;
+
+    int reuseport = 1;
+    int ret = INLINE_SYSCALL(setsockopt, 5, fd, SOL_SOCKET, SO_REUSEPORT, &reuseport,
+                             sizeof(reuseport));
+    return ret < 0 ? unix_to_pal_error(ret) : 0;
+}
+
 /* listen on a tcp socket */
 static int tcp_listen(PAL_HANDLE* handle, char* uri, int create, int options) {
     struct sockaddr_storage buffer;
@@ -302,6 +314,9 @@ static int tcp_listen(PAL_HANDLE* handle, char* uri, int create, int options) {
     if (ret < 0)
         return -PAL_ERROR_INVAL;
 
+    if ((ret = socket_set_reuseport(fd, create)) < 0)
+        goto failed;
+
     if (bind_addr->sa_family == AF_INET6) {
         /* IPV6_V6ONLY socket option can only be set before first bind */
         int ipv6_v6only = create & PAL_CREATE_DUALSTACK ? 0 : 1;
@@ -566,6 +581,86 @@ static int64_t tcp_write(PAL_HANDLE handle, uint64_t offset, size_t len, const v
     return bytes;
 }
 
+/* 'readv' operation of tcp stream */
+static int64_t tcp_readv(PAL_HANDLE handle, uint64_t offset, const PAL_IOVEC* iov,
+                         size_t iov_count) {
+    if (offset)
+        return -PAL_ERROR_INVAL;
+
+    if (!IS_HANDLE_TYPE(handle, tcp) || !handle->sock.conn)
+        return -PAL_ERROR_NOTCONNECTION;
+
+    if (handle->sock.fd == PAL_IDX_POISON)
+        return 0;
+
+    struct msghdr hdr;
+    hdr.msg_name       = NULL;
+    hdr.msg_namelen    = 0;
+    hdr.msg_iov        = (struct iovec*)iov;
+    hdr.msg_iovlen     = iov_count;
+    hdr.msg_control    = NULL;
+    hdr.msg_controllen = 0;
+    hdr.msg_flags      = 0;
+
+    int64_t bytes = INLINE_SYSCALL(recvmsg, 3, handle->sock.fd, &hdr, 0);
+
+    if (bytes < 0)
+        return unix_to_pal_error(bytes);
+
+    return bytes;
+}
+
+/* 'writev' operation of tcp stream */
+static int64_t tcp_writev(PAL_HANDLE handle, uint64_t offset, const PAL_IOVEC* iov,
+                          size_t iov_count) {
+    if (offset)
+        return -PAL_ERROR_INVAL;
+
+    if (!IS_HANDLE_TYPE(handle, tcp) || !handle->sock.conn)
+        return -PAL_ERROR_NOTCONNECTION;
+
+    if (handle->sock.fd == PAL_IDX_POISON)
+        return -PAL_ERROR_CONNFAILED;
+
+    struct msghdr hdr;
+    hdr.msg_name       = NULL;
+    hdr.msg_namelen    = 0;
+    hdr.msg_iov        = (struct iovec*)iov;
+    hdr.msg_iovlen     = iov_count;
+    hdr.msg_control    = NULL;
+    hdr.msg_controllen = 0;
+    hdr.msg_flags      = 0;
+
+    int64_t bytes = INLINE_SYSCALL(sendmsg, 3, handle->sock.fd, &hdr, MSG_NOSIGNAL);
+    if (bytes < 0)
+        bytes = unix_to_pal_error(bytes);
+
+    return bytes;
+}
+
+/* 'sendfile' operation of tcp stream */
+static int64_t tcp_sendfile(PAL_HANDLE handle, PAL_HANDLE file, uint64_t offset, uint64_t count) {
+    if (!IS_HANDLE_TYPE(handle, tcp) || !handle->sock.conn)
+        return -PAL_ERROR_NOTCONNECTION;
+
+    if (handle->sock.fd == PAL_IDX_POISON)
+        return -PAL_ERROR_CONNFAILED;
+
+    if (!IS_HANDLE_TYPE(file, file) || !file->file.seekable)
+        return -PAL_ERROR_NOTSUPPORT;
+
+    if (offset > INT64_MAX)
+        return -PAL_ERROR_INVAL;
+
+    /* host SIGPIPE is ignored, so a closed connection just fails with EPIPE */
+    off_t off = offset;
+    int64_t bytes = INLINE_SYSCALL(sendfile, 4, handle->sock.fd, file->file.fd, &off, count);
+    if (bytes < 0)
+        bytes = unix_to_pal_error(bytes);
+
+    return bytes;
+}
+
 /* used by 'open' operation of tcp stream for bound socket */
 static int udp_bind(PAL_HANDLE* handle, char* uri, int create, int options) {
     struct sockaddr_storage buffer;
@@ -588,6 +683,9 @@ static int udp_bind(PAL_HANDLE* handle, char* uri, int create, int options) {
     if (fd < 0)
         return -PAL_ERROR_DENIED;
 
+    if ((ret = socket_set_reuseport(fd, create)) < 0)
+        goto failed;
+
     /* IPV6_V6ONLY socket option can only be set before first bind */
     if (bind_addr->sa_family == AF_INET6) {
         int ipv6_v6only = create & PAL_CREATE_DUALSTACK ? 0 : 1;
@@ -862,6 +960,121 @@ static int64_t udp_sendbyaddr(PAL_HANDLE handle, uint64_t offset, size_t len, co
     return bytes;
 }
 
+/* struct mmsghdr of recvmmsg()/sendmmsg(), glibc declares it only with _GNU_SOURCE */
+struct linux_mmsghdr {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+};
+
+/* max messages passed to the host in one udp_readmsgs()/udp_writemsgs() */
+#define UDP_MSGS_BATCH 16
+
+static void init_mmsghdr(struct linux_mmsghdr* hdr, struct iovec* iov, PAL_STREAM_MSG* msg,
+                         struct sockaddr_storage* addr, size_t addrlen) {
+    iov->iov_base = msg->buffer;
+    iov->iov_len  = msg->size;
+    hdr->msg_hdr.msg_name       = addr;
+    hdr->msg_hdr.msg_namelen    = addr ? addrlen : 0;
+    hdr->msg_hdr.msg_iov        = iov;
+    hdr->msg_hdr.msg_iovlen     = 1;
+    hdr->msg_hdr.msg_control    = NULL;
+    hdr->msg_hdr.msg_controllen = 0;
+    hdr->msg_hdr.msg_flags      = 0;
+    hdr->msg_len = 0;
+}
+
+static int64_t udp_readmsgs(PAL_HANDLE handle, PAL_STREAM_MSG* msgs, size_t count) {
+    if (!IS_HANDLE_TYPE(handle, udp) && !IS_HANDLE_TYPE(handle, udpsrv))
+        return -PAL_ERROR_NOTCONNECTION;
+
+    if (handle->sock.fd == PAL_IDX_POISON)
+        return -PAL_ERROR_BADHANDLE;
+
+    bool with_addr = IS_HANDLE_TYPE(handle, udpsrv);
+    if (count > UDP_MSGS_BATCH)
+        count = UDP_MSGS_BATCH;
+
+    struct linux_mmsghdr hdrs[UDP_MSGS_BATCH];
+    struct iovec iovs[UDP_MSGS_BATCH];
+    struct sockaddr_storage conn_addrs[UDP_MSGS_BATCH];
+    for (size_t i = 0; i < count; i++)
+        init_mmsghdr(&hdrs[i], &iovs[i], &msgs[i], with_addr ? &conn_addrs[i] : NULL,
+                     sizeof(conn_addrs[i]));
+
+    /* same as a single read, block only until the first message */
+    int64_t ret = INLINE_SYSCALL(recvmmsg, 5, handle->sock.fd, hdrs, count, MSG_WAITFORONE, NULL);
+    if (ret < 0)
+        return unix_to_pal_error(ret);
+
+    for (int64_t i = 0; i < ret; i++) {
+        msgs[i].size = hdrs[i].msg_len;
+        if (!with_addr || !msgs[i].addr)
+            continue;
+
+        char* addr = msgs[i].addr;
+        char* addr_uri = strcpy_static(addr, URI_PREFIX_UDP, msgs[i].addr_size);
+        if (!addr_uri)
+            return -PAL_ERROR_OVERFLOW;
+
+        int uri_ret = inet_create_uri(addr_uri, addr + msgs[i].addr_size - addr_uri,
+                                      (struct sockaddr*)&conn_addrs[i],
+                                      hdrs[i].msg_hdr.msg_namelen, NULL);
+        if (uri_ret < 0)
+            return uri_ret;
+    }
+
+    return ret;
+}
+
+static int64_t udp_writemsgs(PAL_HANDLE handle, PAL_STREAM_MSG* msgs, size_t count) {
+    if (!IS_HANDLE_TYPE(handle, udp) && !IS_HANDLE_TYPE(handle, udpsrv))
+        return -PAL_ERROR_NOTCONNECTION;
+
+    if (handle->sock.fd == PAL_IDX_POISON)
+        return -PAL_ERROR_BADHANDLE;
+
+    bool with_addr = IS_HANDLE_TYPE(handle, udpsrv);
+    if (count > UDP_MSGS_BATCH)
+        count = UDP_MSGS_BATCH;
+
+    struct linux_mmsghdr hdrs[UDP_MSGS_BATCH];
+    struct iovec iovs[UDP_MSGS_BATCH];
+    struct sockaddr_storage conn_addrs[UDP_MSGS_BATCH];
+    for (size_t i = 0; i < count; i++) {
+        /* connected sockets take no address, server sockets need one for every message */
+        if (!with_addr != !msgs[i].addr)
+            return -PAL_ERROR_INVAL;
+
+        size_t conn_addrlen = sizeof(conn_addrs[i]);
+        if (with_addr) {
+            const char* addr = msgs[i].addr;
+            if (!strstartswith(addr, URI_PREFIX_UDP))
+                return -PAL_ERROR_INVAL;
+            addr += static_strlen(URI_PREFIX_UDP);
+
+            size_t addrlen = strlen(addr) + 1;
+            char* addrbuf = __alloca(addrlen);
+            memcpy(addrbuf, addr, addrlen);
+
+            int ret = inet_parse_uri(&addrbuf, (struct sockaddr*)&conn_addrs[i], &conn_addrlen);
+            if (ret < 0)
+                return ret;
+        }
+
+        init_mmsghdr(&hdrs[i], &iovs[i], &msgs[i], with_addr ? &conn_addrs[i] : NULL,
+                     conn_addrlen);
+    }
+
+    int64_t ret = INLINE_SYSCALL(sendmmsg, 4, handle->sock.fd, hdrs, count, MSG_NOSIGNAL);
+    if (ret < 0)
+        return unix_to_pal_error(ret);
+
+    for (int64_t i = 0; i < ret; i++)
+        msgs[i].size = hdrs[i].msg_len;
+
+    return ret;
+}
+
 static int socket_delete(PAL_HANDLE handle, int access) {
     if (handle->sock.fd == PAL_IDX_POISON)
         return 0;
@@ -1143,6 +1356,9 @@ struct handle_ops g_tcp_ops = {
     .waitforclient  = &tcp_accept,
     .read           = &tcp_read,
     .write          = &tcp_write,
+    .readv          = &tcp_readv,
+    .writev         = &tcp_writev,
+    .sendfile       = &tcp_sendfile,
     .delete         = &socket_delete,
     .close          = &socket_close,
     .attrquerybyhdl = &socket_attrquerybyhdl,
@@ -1154,6 +1370,8 @@ struct handle_ops g_udp_ops = {
     .open           = &udp_open,
     .read           = &udp_receive,
     .write          = &udp_send,
+    .readmsgs       = &udp_readmsgs,
+    .writemsgs      = &udp_writemsgs,
     .delete         = &socket_delete,
     .close          = &socket_close,
     .attrquerybyhdl = &socket_attrquerybyhdl,
@@ -1165,6 +1383,8 @@ struct handle_ops g_udpsrv_ops = {
     .open           = &udp_open,
     .readbyaddr     = &udp_receivebyaddr,
     .writebyaddr    = &udp_sendbyaddr,
+    .readmsgs       = &udp_readmsgs,
+    .writemsgs      = &udp_writemsgs,
     .delete         = &socket_delete,
     .close          = &socket_close,
     .attrquerybyhdl = &socket_attrquerybyhdl,
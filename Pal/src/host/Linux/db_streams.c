@@ -36,6 +36,17 @@ struct hdl_header {
 };
 static_assert((sizeof(((struct hdl_header*)0)->fds) * 8) >= MAX_FDS, "insufficient fds size");
 
+/* Handles are sent in batches, so that FDs of the whole batch fit into one SCM_RIGHTS message
+ * (Linux allows at most 253 FDs per message). */
+#define HANDLES_BATCH_SIZE 64UL
+static_assert(HANDLES_BATCH_SIZE * MAX_FDS <= 253, "too many FDs in one batch");
+
+struct hdls_header {
+    uint32_t cnt;
+    size_t data_size; /* total size of serialized PAL handles of the batch */
+    struct hdl_header hdls[HANDLES_BATCH_SIZE];
+};
+
 static size_t addr_size(const struct sockaddr* addr) {
     switch (addr->sa_family) {
         case AF_INET:
@@ -201,164 +212,261 @@ int handle_deserialize(PAL_HANDLE* handle, const void* data, size_t size) {
     return 0;
 }
 
-/*!
- * \brief Send `cargo` handle to a process identified via `hdl` handle.
- *
- * \param[in] hdl    Process stream on which to send `cargo`.
- * \param[in] cargo  Arbitrary handle to serialize and send on `hdl`.
- * \return           0 on success, negative PAL error code otherwise.
- */
-int _DkSendHandle(PAL_HANDLE hdl, PAL_HANDLE cargo) {
-    if (!IS_HANDLE_TYPE(hdl, process))
-        return -PAL_ERROR_BADHANDLE;
+/* Both sides are in PAL, so the payload can be read in chunks of any size: loop until complete. */
+static int process_write_exact(int fd, const void* buf, size_t size) {
+    while (size) {
+        ssize_t ret = INLINE_SYSCALL(write, 3, fd, buf, size);
+        if (ret == -EINTR)
+            continue;
+        if (ret < 0)
+            return unix_to_pal_error(ret);
+        buf = (const char*)buf + ret;
+        size -= ret;
+    }
+    return 0;
+}
+
+static int process_read_exact(int fd, void* buf, size_t size) {
+    while (size) {
+        ssize_t ret = INLINE_SYSCALL(read, 3, fd, buf, size);
+        if (ret == -EINTR)
+            continue;
+        if (ret < 0)
+            return unix_to_pal_error(ret);
+        if (ret == 0)
+            return -PAL_ERROR_DENIED;
+        buf = (char*)buf + ret;
+        size -= ret;
+    }
+    return 0;
+}
 
-    /* serialize cargo handle into a blob hdl_data */
-    void* hdl_data = NULL;
-    ssize_t hdl_data_size = handle_serialize(cargo, &hdl_data);
-    if (hdl_data_size < 0)
-        return hdl_data_size;
+static int send_handles_batch(int fd, PAL_HANDLE* cargos, size_t cnt) {
+    assert(cnt <= HANDLES_BATCH_SIZE);
 
-    ssize_t ret;
-    struct hdl_header hdl_hdr = {.fds = 0, .data_size = hdl_data_size};
-    int fd = hdl->process.stream;
+    struct hdls_header hdls_hdr = {.cnt = cnt};
+    void* hdl_data[HANDLES_BATCH_SIZE];
+    size_t data_size = 0;
+    int ret;
 
-    /* apply bitmask of FDs-to-transfer to hdl_hdr.fds and populate `fds` with these FDs */
-    int fds[MAX_FDS];
+    /* serialize cargo handles into blobs and populate `fds` with their FDs-to-transfer */
+    int fds[HANDLES_BATCH_SIZE * MAX_FDS];
     int nfds = 0;
-    for (int i = 0; i < MAX_FDS; i++)
-        if (HANDLE_HDR(cargo)->flags & (RFD(i) | WFD(i))) {
-            hdl_hdr.fds |= 1U << i;
-            fds[nfds++] = cargo->generic.fds[i];
+    size_t serialized = 0;
+    for (; serialized < cnt; serialized++) {
+        PAL_HANDLE cargo = cargos[serialized];
+        ssize_t size = handle_serialize(cargo, &hdl_data[serialized]);
+        if (size < 0) {
+            ret = size;
+            goto out;
         }
 
-    /* first send hdl_hdr so the recipient knows how many FDs were transferred + how large is cargo */
+        struct hdl_header* hdl_hdr = &hdls_hdr.hdls[serialized];
+        hdl_hdr->data_size = size;
+        data_size += size;
+        for (int i = 0; i < MAX_FDS; i++)
+            if (HANDLE_HDR(cargo)->flags & (RFD(i) | WFD(i))) {
+                hdl_hdr->fds |= 1U << i;
+                fds[nfds++] = cargo->generic.fds[i];
+            }
+    }
+    hdls_hdr.data_size = data_size;
+
+    char* data = malloc(data_size);
+    if (!data) {
+        ret = -PAL_ERROR_NOMEM;
+        goto out;
+    }
+    char* pos = data;
+    for (size_t i = 0; i < cnt; i++) {
+        memcpy(pos, hdl_data[i], hdls_hdr.hdls[i].data_size);
+        pos += hdls_hdr.hdls[i].data_size;
+    }
+
+    /* first send hdls_hdr, carrying FDs-to-transfer of all handles as ancillary data */
     struct msghdr message_hdr = {0};
     struct iovec iov[1];
 
-    iov[0].iov_base    = &hdl_hdr;
-    iov[0].iov_len     = sizeof(hdl_hdr);
+    iov[0].iov_base    = &hdls_hdr;
+    iov[0].iov_len     = sizeof(hdls_hdr);
     message_hdr.msg_iov    = iov;
     message_hdr.msg_iovlen = 1;
 
-    ret = INLINE_SYSCALL(sendmsg, 3, fd, &message_hdr, MSG_NOSIGNAL);
-    if (ret < 0) {
-        free(hdl_data);
-        return unix_to_pal_error(ret);
-    }
+    char control_buf[CMSG_SPACE(sizeof(fds))];
+    if (nfds) {
+        message_hdr.msg_control    = control_buf;
+        message_hdr.msg_controllen = sizeof(control_buf);
 
-    /* construct ancillary data of FDs-to-transfer in a control message */
-    char control_buf[sizeof(struct cmsghdr) + MAX_FDS * sizeof(int)];
-    message_hdr.msg_control    = control_buf;
-    message_hdr.msg_controllen = sizeof(control_buf);
+        struct cmsghdr* control_hdr = CMSG_FIRSTHDR(&message_hdr);
+        control_hdr->cmsg_level = SOL_SOCKET;
+        control_hdr->cmsg_type  = SCM_RIGHTS;
+        control_hdr->cmsg_len   = CMSG_LEN(sizeof(int) * nfds);
+        memcpy(CMSG_DATA(control_hdr), fds, sizeof(int) * nfds);
 
-    struct cmsghdr* control_hdr = CMSG_FIRSTHDR(&message_hdr);
-    control_hdr->cmsg_level = SOL_SOCKET;
-    control_hdr->cmsg_type  = SCM_RIGHTS;
-    control_hdr->cmsg_len   = CMSG_LEN(sizeof(int) * nfds);
-    memcpy(CMSG_DATA(control_hdr), fds, sizeof(int) * nfds);
-
-    message_hdr.msg_controllen = control_hdr->cmsg_len;
+        message_hdr.msg_controllen = control_hdr->cmsg_len;
+    }
 
-    /* finally send the serialized cargo as payload and FDs-to-transfer as ancillary data */
-    iov[0].iov_base = hdl_data;
-    iov[0].iov_len  = hdl_data_size;
-    message_hdr.msg_iov    = iov;
-    message_hdr.msg_iovlen = 1;
+    ssize_t bytes = INLINE_SYSCALL(sendmsg, 3, fd, &message_hdr, MSG_NOSIGNAL);
+    if (bytes < 0) {
+        free(data);
+        ret = unix_to_pal_error(bytes);
+        goto out;
+    }
 
-    ret = INLINE_SYSCALL(sendmsg, 3, fd, &message_hdr, 0);
-    if (ret < 0) {
-        free(hdl_data);
-        return unix_to_pal_error(ret);
+    /* a partial send is possible only for the payload, the FDs went with its first part */
+    ret = process_write_exact(fd, (char*)&hdls_hdr + bytes, sizeof(hdls_hdr) - bytes);
+    if (ret == 0) {
+        /* finally send the serialized cargos as payload, all at once */
+        ret = process_write_exact(fd, data, data_size);
     }
+    free(data);
 
-    free(hdl_data);
-    return ret < 0 ? unix_to_pal_error(ret) : 0;
+out:
+    for (size_t i = 0; i < serialized; i++)
+        free(hdl_data[i]);
+    return ret;
 }
 
-/*!
- * \brief Receive `cargo` handle from a process identified via `hdl` handle.
- *
- * \param[in] hdl    Process stream on which to receive `cargo`.
- * \param[in] cargo  Arbitrary handle to receive on `hdl` and deserialize.
- * \return           0 on success, negative PAL error code otherwise.
- */
-int _DkReceiveHandle(PAL_HANDLE hdl, PAL_HANDLE* cargo) {
-    if (!IS_HANDLE_TYPE(hdl, process))
-        return -PAL_ERROR_BADHANDLE;
+static int receive_handles_batch(int fd, PAL_HANDLE* cargos, size_t cnt) {
+    assert(cnt <= HANDLES_BATCH_SIZE);
 
+    struct hdls_header hdls_hdr;
     ssize_t ret;
-    struct hdl_header hdl_hdr;
-    int fd = hdl->process.stream;
 
-    /* first receive hdl_hdr so that we know how many FDs were transferred + how large is cargo */
+    /* first receive hdls_hdr, so that we know how many FDs were transferred + how large cargos
+     * are; the control buffer is sized for the maximum number of FDs in a batch */
     struct msghdr message_hdr = {0};
     struct iovec iov[1];
+    char control_buf[CMSG_SPACE(HANDLES_BATCH_SIZE * MAX_FDS * sizeof(int))];
 
-    iov[0].iov_base = &hdl_hdr;
-    iov[0].iov_len  = sizeof(hdl_hdr);
-    message_hdr.msg_iov    = iov;
-    message_hdr.msg_iovlen = 1;
+    iov[0].iov_base = &hdls_hdr;
+    iov[0].iov_len  = sizeof(hdls_hdr);
+    message_hdr.msg_iov        = iov;
+    message_hdr.msg_iovlen     = 1;
+    message_hdr.msg_control    = control_buf;
+    message_hdr.msg_controllen = sizeof(control_buf);
 
     ret = INLINE_SYSCALL(recvmsg, 3, fd, &message_hdr, 0);
     if (ret < 0)
         return unix_to_pal_error(ret);
+    if (ret == 0)
+        return -PAL_ERROR_TRYAGAIN;
 
-    if ((size_t)ret != sizeof(hdl_hdr)) {
-        /* This check is to shield from a Iago attack. We know that sendmsg() in _DkSendHandle()
-         * transfers the message atomically, and that our recvmsg() receives it atomically. So
-         * the only valid values for ret must be zero or the size of the header. */
-        if (!ret)
-            return -PAL_ERROR_TRYAGAIN;
-        return -PAL_ERROR_DENIED;
+    int* fds = NULL;
+    size_t fds_cnt = 0;
+    struct cmsghdr* control_hdr = CMSG_FIRSTHDR(&message_hdr);
+    if (control_hdr) {
+        if (control_hdr->cmsg_level != SOL_SOCKET || control_hdr->cmsg_type != SCM_RIGHTS)
+            return -PAL_ERROR_DENIED;
+        fds = (int*)CMSG_DATA(control_hdr);
+        fds_cnt = (control_hdr->cmsg_len - CMSG_LEN(0)) / sizeof(int);
     }
 
-    /* prepare control-message buffer to receive ancillary data of FDs-to-transfer */
-    int nfds = 0;
-    for (int i = 0; i < MAX_FDS; i++)
-        if (hdl_hdr.fds & (1U << i))
-            nfds++;
-
-    char control_buf[sizeof(struct cmsghdr) + nfds * sizeof(int)];
-    message_hdr.msg_control    = control_buf;
-    message_hdr.msg_controllen = sizeof(control_buf);
+    ret = process_read_exact(fd, (char*)&hdls_hdr + ret, sizeof(hdls_hdr) - ret);
+    if (ret < 0)
+        return ret;
 
-    /* finally receive the serialized cargo as payload and FDs-to-transfer as ancillary data */
-    char hdl_data[hdl_hdr.data_size];
+    /* sanity checks: both sides agree on the number of handles and sizes add up */
+    if (hdls_hdr.cnt != cnt)
+        return -PAL_ERROR_DENIED;
+    size_t data_size = 0;
+    for (size_t i = 0; i < cnt; i++) {
+        if (hdls_hdr.hdls[i].data_size > hdls_hdr.data_size - data_size)
+            return -PAL_ERROR_DENIED;
+        data_size += hdls_hdr.hdls[i].data_size;
+    }
+    if (data_size != hdls_hdr.data_size)
+        return -PAL_ERROR_DENIED;
 
-    iov[0].iov_base = hdl_data;
-    iov[0].iov_len  = hdl_hdr.data_size;
-    message_hdr.msg_iov    = iov;
-    message_hdr.msg_iovlen = 1;
+    /* finally receive the serialized cargos as payload */
+    char* data = malloc(data_size);
+    if (!data)
+        return -PAL_ERROR_NOMEM;
 
-    ret = INLINE_SYSCALL(recvmsg, 3, fd, &message_hdr, 0);
+    ret = process_read_exact(fd, data, data_size);
     if (ret < 0)
-        return unix_to_pal_error(ret);
+        goto out;
 
-    /* deserialize cargo handle from a blob hdl_data */
-    PAL_HANDLE handle = NULL;
-    ret = handle_deserialize(&handle, hdl_data, hdl_hdr.data_size);
-    if (ret < 0)
-        return ret;
+    size_t off = 0;
+    size_t fds_idx = 0;
+    size_t received = 0;
+    for (; received < cnt; received++) {
+        struct hdl_header* hdl_hdr = &hdls_hdr.hdls[received];
 
-    /* restore cargo handle's FDs from the received FDs-to-transfer */
-    struct cmsghdr* control_hdr = CMSG_FIRSTHDR(&message_hdr);
-    if (!control_hdr || control_hdr->cmsg_type != SCM_RIGHTS)
-        return -PAL_ERROR_DENIED;
+        /* deserialize cargo handle from a blob */
+        PAL_HANDLE handle = NULL;
+        ret = handle_deserialize(&handle, data + off, hdl_hdr->data_size);
+        if (ret < 0)
+            goto out;
+        off += hdl_hdr->data_size;
+
+        /* restore cargo handle's FDs from the received FDs-to-transfer */
+        for (int i = 0; i < MAX_FDS; i++) {
+            if (hdl_hdr->fds & (1U << i)) {
+                if (fds_idx < fds_cnt) {
+                    handle->generic.fds[i] = fds[fds_idx++];
+                } else {
+                    HANDLE_HDR(handle)->flags &= ~(RFD(i) | WFD(i));
+                }
+            }
+        }
 
-    int fds_idx = 0;
-    int* fds = (int*)CMSG_DATA(control_hdr);
+        cargos[received] = handle;
+    }
 
-    for (int i = 0; i < MAX_FDS; i++) {
-        if (hdl_hdr.fds & (1U << i)) {
-            if (fds_idx < nfds) {
-                handle->generic.fds[i] = fds[fds_idx++];
-            } else {
-                HANDLE_HDR(handle)->flags &= ~(RFD(i) | WFD(i));
-            }
+    ret = 0;
+out:
+    if (ret < 0) {
+        for (size_t i = 0; i < received; i++) {
+            free(cargos[i]);
+            cargos[i] = NULL;
         }
     }
+    free(data);
+    return ret;
+}
 
-    *cargo = handle;
+/*!
+ * \brief Send `cargos` handles to a process identified via `hdl` handle.
+ *
+ * Handles are sent in batches, each with one message carrying host FDs of all its handles.
+ *
+ * \param[in] hdl     Process stream on which to send `cargos`.
+ * \param[in] cargos  Array of arbitrary handles to serialize and send on `hdl`.
+ * \param[in] count   Number of handles in `cargos`.
+ * \return            0 on success, negative PAL error code otherwise.
+ */
+int _DkSendHandles(PAL_HANDLE hdl, PAL_HANDLE* cargos, size_t count) {
+    if (!IS_HANDLE_TYPE(hdl, process))
+        return -PAL_ERROR_BADHANDLE;
+
+    for (size_t done = 0; done < count; done += HANDLES_BATCH_SIZE) {
+        int ret = send_handles_batch(hdl->process.stream, cargos + done,
+                                     MIN(count - done, HANDLES_BATCH_SIZE));
+        if (ret < 0)
+            return ret;
+    }
+    return 0;
+}
+
+/*!
+ * \brief Receive `cargos` handles from a process identified via `hdl` handle.
+ *
+ * \param[in]  hdl     Process stream on which to receive `cargos`.
+ * \param[out] cargos  Array to be filled with handles received on `hdl` and deserialized.
+ * \param[in]  count   Number of handles to receive, must match the number sent.
+ * \return             0 on success, negative PAL error code otherwise.
+ */
+int _DkReceiveHandles(PAL_HANDLE hdl, PAL_HANDLE* cargos, size_t count) {
+    if (!IS_HANDLE_TYPE(hdl, process))
+        return -PAL_ERROR_BADHANDLE;
+
+    for (size_t done = 0; done < count; done += HANDLES_BATCH_SIZE) {
+        int ret = receive_handles_batch(hdl->process.stream, cargos + done,
+                                        MIN(count - done, HANDLES_BATCH_SIZE));
+        if (ret < 0)
+            return ret;
+    }
     return 0;
 }
 
@@ -16,6 +16,7 @@
 #include <stdint.h>
 
 #include "atomic.h"
+#include "spinlock.h"
 
 typedef struct {
     PAL_HDR hdr;
@@ -72,6 +73,12 @@ typedef struct pal_handle {
             PAL_BOL nonblocking;
         } dev;
 
+        struct {
+            PAL_IDX fd;      /* host epoll FD */
+            spinlock_t lock; /* protects `items` */
+            PAL_PTR items;   /* registered host FDs, see db_object.c */
+        } poller;
+
         struct {
             PAL_IDX fd;
             PAL_STR realpath;
@@ -27,6 +27,14 @@ int _DkVirtualMemoryProtect(void* addr, uint64_t size, int prot) {
     return -PAL_ERROR_NOTIMPLEMENTED;
 }
 
+int _DkVirtualMemoryMove(void* old_addr, void* new_addr, uint64_t size) {
+    return -PAL_ERROR_NOTIMPLEMENTED;
+}
+
+int _DkVirtualMemoryDiscard(void* addr, uint64_t size, bool lazy) {
+    return -PAL_ERROR_NOTIMPLEMENTED;
+}
+
 unsigned long _DkMemoryQuota(void) {
     return 0;
 }
@@ -34,3 +42,7 @@ unsigned long _DkMemoryQuota(void) {
 unsigned long _DkMemoryAvailableQuota(void) {
     return 0;
 }
+
+unsigned long _DkMemoryResidentSize(void) {
+    return 0;
+}
@@ -17,3 +17,24 @@ int _DkStreamsWaitEvents(size_t count, PAL_HANDLE* handle_array, PAL_FLG* events
                          PAL_FLG* ret_events, int64_t timeout_us) {
     return -PAL_ERROR_NOTIMPLEMENTED;
 }
+
+void _DkObjectsClose(PAL_HANDLE* handles, size_t count) {
+    for (size_t i = 0; i < count; i++)
+        _DkObjectClose(handles[i]);
+}
+
+int _DkPollerCreate(PAL_HANDLE* handle) {
+    return -PAL_ERROR_NOTIMPLEMENTED;
+}
+
+int _DkPollerCtl(PAL_HANDLE poller, enum PAL_POLLER_OP op, PAL_HANDLE handle, PAL_FLG events,
+                 PAL_NUM data) {
+    return -PAL_ERROR_NOTIMPLEMENTED;
+}
+
+int _DkPollerWait(PAL_HANDLE poller, PAL_POLLER_EVENT* events, size_t max_events,
+                  size_t* ret_count, int64_t timeout_us) {
+    return -PAL_ERROR_NOTIMPLEMENTED;
+}
+
+struct handle_ops g_poller_ops = {};
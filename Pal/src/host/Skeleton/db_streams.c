@@ -17,15 +17,15 @@ int _DkStreamUnmap(void* addr, uint64_t size) {
     return -PAL_ERROR_NOTIMPLEMENTED;
 }
 
-/* _DkSendHandle for internal use. Send a PAL_HANDLE over the given
+/* _DkSendHandles for internal use. Send an array of PAL_HANDLEs over the given
    process handle. */
-int _DkSendHandle(PAL_HANDLE hdl, PAL_HANDLE cargo) {
+int _DkSendHandles(PAL_HANDLE hdl, PAL_HANDLE* cargos, size_t count) {
     return -PAL_ERROR_NOTIMPLEMENTED;
 }
 
-/* _DkReceiveHandle for internal use. Receive and return a PAL_HANDLE over the
-   given PAL_HANDLE else return negative value. */
-int _DkReceiveHandle(PAL_HANDLE hdl, PAL_HANDLE* cargo) {
+/* _DkReceiveHandles for internal use. Receive and return an array of PAL_HANDLEs
+   over the given PAL_HANDLE else return negative value. */
+int _DkReceiveHandles(PAL_HANDLE hdl, PAL_HANDLE* cargos, size_t count) {
     return -PAL_ERROR_NOTIMPLEMENTED;
 }
 
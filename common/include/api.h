@@ -172,6 +172,20 @@ void* memmove(void* dest, const void* src, size_t count);
 void* memset(void* dest, int ch, size_t count);
 int memcmp(const void* lhs, const void* rhs, size_t count);
 
+enum string_ops_level {
+    STRING_OPS_BASELINE, /* REP MOVSB/STOSB and plain C loops */
+    STRING_OPS_AVX2,
+    STRING_OPS_AVX512,   /* AVX-512F for memcpy() and memset(), AVX2 for the rest */
+};
+
+/* Selects the implementations of memcpy(), memset(), memcmp() and strnlen() (and the functions
+ * built on them) for this CPU, at most `max_level`, and returns the level selected. `cpuid` must
+ * return the values of the given CPUID leaf and subleaf. Until this is called, the baseline ones
+ * are used. */
+enum string_ops_level init_string_ops(int (*cpuid)(unsigned int leaf, unsigned int subleaf,
+                                                   unsigned int values[4]),
+                                      enum string_ops_level max_level);
+
 /* Used by _FORTIFY_SOURCE */
 void* __memcpy_chk(void* restrict dest, const void* restrict src, size_t count, size_t dest_count);
 void* __memmove_chk(void* dest, const void* src, size_t count, size_t dest_count);
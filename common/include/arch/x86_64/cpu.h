@@ -9,6 +9,8 @@
 #define PAGE_SIZE       (1ul << 12)
 #define PRESET_PAGESIZE PAGE_SIZE
 
+#define CACHE_LINE_SIZE 64
+
 enum CPUID_WORD {
     CPUID_WORD_EAX = 0,
     CPUID_WORD_EBX = 1,
@@ -51,6 +51,10 @@ struct avl_tree {
     /* This should be a total order (<=) on tree nodes. If two elements compare equal, the newer
      * will be on the left (side of smaller elements) from the older one. */
     bool (*cmp)(struct avl_tree_node*, struct avl_tree_node*);
+    /* Optional (can be NULL). Called on a node whenever its subtree might have changed, always for
+     * children before their parents. This allows augmenting nodes with data computed from a node
+     * and its children only (e.g. subtree size), which then stays valid for every node. */
+    void (*update)(struct avl_tree_node*);
 };
 
 void avl_tree_insert(struct avl_tree* tree, struct avl_tree_node* node);
@@ -65,6 +69,13 @@ void avl_tree_delete(struct avl_tree* tree, struct avl_tree_node* node);
 void avl_tree_swap_node(struct avl_tree* tree, struct avl_tree_node* old_node,
                         struct avl_tree_node* new_node);
 
+/*
+ * Recomputes augmented data (see `tree.update`) of `node` and all its ancestors. Must be called
+ * after the data `tree.update` depends on was changed in place for a node already in the tree,
+ * e.g. when the node was shrunk without changing its position with respect to `tree.cmp`.
+ */
+void avl_tree_update_path(struct avl_tree* tree, struct avl_tree_node* node);
+
 /* These functions return respectively previous and next node or NULL if such does not exist.
  * O(log(n)) in worst case, but amortized O(1). */
 struct avl_tree_node* avl_tree_prev(struct avl_tree_node* node);
@@ -0,0 +1,83 @@
+#ifndef BTREE_H
+#define BTREE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Ordered map from unique `uint64_t` keys to pointers, implemented as a B+-tree.
+ *
+ * Unlike `struct avl_tree`, which chases one pointer per element on every lookup, nodes of this
+ * tree hold up to BTREE_MAX_KEYS keys in a few cache lines, so a lookup in a tree of thousands of
+ * elements touches only 3-4 nodes. All elements are stored in leaves, which are linked in key
+ * order for cheap range iteration. The price is that the tree is not intrusive: nodes are
+ * allocated with malloc() (so insertions may fail) and there is no augmented data.
+ *
+ * Example usage:
+ *
+ * struct btree tree = { 0 };
+ * int ret = btree_insert(&tree, 42, element);
+ *
+ * struct btree_iter iter;
+ * for (bool found = btree_lower_bound(&tree, 13, &iter); found; found = btree_iter_next(&iter))
+ *     use(btree_iter_key(&iter), btree_iter_value(&iter));
+ *
+ * The tree does no locking; an iterator is invalidated by any insertion or deletion.
+ */
+
+/* one node occupies BTREE_NODE_SIZE bytes (4 cache lines of 64 bytes) */
+#define BTREE_NODE_SIZE 256
+#define BTREE_MAX_KEYS  15
+
+struct btree_node;
+
+struct btree {
+    /* NULL for an empty tree */
+    struct btree_node* root;
+    /* number of levels below the root, i.e. 0 if the root is a leaf */
+    size_t height;
+    size_t count;
+};
+
+struct btree_iter {
+    struct btree_node* leaf;
+    size_t index;
+};
+
+/* Inserts `value` under `key`. Returns 0, -PAL_ERROR_STREAMEXIST if `key` is already in `tree`
+ * (which is left intact) or -PAL_ERROR_NOMEM. */
+int btree_insert(struct btree* tree, uint64_t key, void* value);
+
+/* Removes `key` from `tree`; returns false if it is not there. Never fails. */
+bool btree_delete(struct btree* tree, uint64_t key);
+
+/* Returns whether `key` is in `tree`, and if so its value in `*value` (if not NULL). */
+bool btree_find(struct btree* tree, uint64_t key, void** value);
+
+/*
+ * Builds `tree`, which must be empty, from `count` elements with strictly increasing `keys`. This
+ * is O(count) and leaves all nodes (almost) full, so it is the fastest way to create a tree from
+ * sorted data. Returns 0, -PAL_ERROR_INVAL if `keys` are not strictly increasing or
+ * -PAL_ERROR_NOMEM; on failure `tree` stays empty.
+ */
+int btree_bulk_load(struct btree* tree, const uint64_t* keys, void* const* values, size_t count);
+
+/* Frees all nodes of `tree` and leaves it empty; the values are not touched. */
+void btree_destroy(struct btree* tree);
+
+/* Point `iter` at the first element of `tree`, or the first one with a key greater or equal to
+ * `key`. Return false (and `iter` is not valid) if there is no such element. */
+bool btree_first(struct btree* tree, struct btree_iter* iter);
+bool btree_lower_bound(struct btree* tree, uint64_t key, struct btree_iter* iter);
+
+/* Advances `iter` to the next element in key order; returns false if there is none. */
+bool btree_iter_next(struct btree_iter* iter);
+
+uint64_t btree_iter_key(struct btree_iter* iter);
+void* btree_iter_value(struct btree_iter* iter);
+
+/* Checks all invariants of `tree` (ordering, occupancy of nodes, depth, leaf links, count). */
+bool debug_btree_is_valid(struct btree* tree);
+
+#endif // BTREE_H
@@ -33,6 +33,8 @@ typedef struct AES LIB_AES_CONTEXT;
 
 typedef mbedtls_sha256_context LIB_SHA256_CONTEXT;
 
+typedef mbedtls_ctr_drbg_context LIB_DRBG_CONTEXT;
+
 typedef mbedtls_dhm_context LIB_DH_CONTEXT;
 typedef struct {
     mbedtls_cipher_type_t cipher;
@@ -48,6 +50,9 @@ typedef struct {
     ssize_t (*pal_recv_cb)(int fd, void* buf, size_t buf_size);
     ssize_t (*pal_send_cb)(int fd, const void* buf, size_t buf_size);
     int stream_fd;
+    uint8_t ticket_key[32]; /* server side: key of session tickets, valid if `use_tickets` */
+    bool use_tickets;
+    bool resumed; /* set by lib_SSLHandshake() if an earlier session was resumed */
 } LIB_SSL_CONTEXT;
 
 #endif /* CRYPTO_USE_MBEDTLS */
@@ -91,14 +96,32 @@ int lib_AESGCMDecrypt(const uint8_t* key, size_t key_size, const uint8_t* iv, co
 int lib_AESCMACInit(LIB_AESCMAC_CONTEXT* context, const uint8_t* key, size_t key_size);
 int lib_AESCMACUpdate(LIB_AESCMAC_CONTEXT* context, const uint8_t* input, size_t input_size);
 int lib_AESCMACFinish(LIB_AESCMAC_CONTEXT* context, uint8_t* mac, size_t mac_size);
+/* Same as lib_AESCMACFinish(), but keeps `context` for the next message with the same key, so that
+ * the key schedule is not set up again; such a context is wiped and freed by lib_AESCMACFree(). */
+int lib_AESCMACFinishAndReset(LIB_AESCMAC_CONTEXT* context, uint8_t* mac, size_t mac_size);
+void lib_AESCMACFree(LIB_AESCMAC_CONTEXT* context);
+
+/* DRBG (AES-256 CTR_DRBG), seeded with `entropy_cb` (which must fill `buf` with `size` bytes of
+ * entropy and return 0) and reseeded after every `reseed_interval` calls of lib_DRBGRandom() */
+int lib_DRBGInit(LIB_DRBG_CONTEXT* context, int (*entropy_cb)(void* arg, uint8_t* buf, size_t size),
+                 void* arg, int reseed_interval);
+int lib_DRBGRandom(LIB_DRBG_CONTEXT* context, uint8_t* output, size_t output_size);
+void lib_DRBGFree(LIB_DRBG_CONTEXT* context);
 
 /* SSL/TLS */
+/* `ticket_key` (32 bytes, may be NULL) enables session resumption: a server issues session tickets
+ * encrypted with it, and accepts those issued by any server with the same key. */
 int lib_SSLInit(LIB_SSL_CONTEXT* ssl_ctx, int stream_fd, bool is_server, const uint8_t* psk,
-                size_t psk_size, ssize_t (*pal_recv_cb)(int fd, void* buf, size_t buf_size),
+                size_t psk_size, const uint8_t* ticket_key,
+                ssize_t (*pal_recv_cb)(int fd, void* buf, size_t buf_size),
                 ssize_t (*pal_send_cb)(int fd, const void* buf, size_t buf_size),
                 const uint8_t* buf_load_ssl_ctx, size_t buf_size);
 int lib_SSLFree(LIB_SSL_CONTEXT* ssl_ctx);
 int lib_SSLHandshake(LIB_SSL_CONTEXT* ssl_ctx);
+/* client side: offer to resume a session saved with lib_SSLSaveSession(), before the handshake */
+int lib_SSLSetSession(LIB_SSL_CONTEXT* ssl_ctx, const uint8_t* buf, size_t buf_size);
+/* client side: serialize the session (with its ticket) after the handshake */
+int lib_SSLSaveSession(LIB_SSL_CONTEXT* ssl_ctx, uint8_t* buf, size_t buf_size, size_t* out_size);
 int lib_SSLRead(LIB_SSL_CONTEXT* ssl_ctx, uint8_t* buf, size_t buf_size);
 int lib_SSLWrite(LIB_SSL_CONTEXT* ssl_ctx, const uint8_t* buf, size_t buf_size);
 int lib_SSLSave(LIB_SSL_CONTEXT* ssl_ctx, uint8_t* buf, size_t buf_size, size_t* out_size);
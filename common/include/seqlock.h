@@ -86,4 +86,22 @@ static inline void write_seqend(seqlock_t* sl) {
     spinlock_unlock(&sl->lock);
 }
 
+/*!
+ * \brief Start a locked reader-side critical section (acquires spinlock).
+ *
+ * Excludes writers (and other locked readers) like write_seqbegin(), but doesn't force lock-free
+ * readers to retry. Useful for readers which cannot be speculative, e.g. because they follow or
+ * take references to pointers.
+ */
+static inline void read_seqlock_excl(seqlock_t* sl) {
+    spinlock_lock(&sl->lock);
+}
+
+/*!
+ * \brief End a locked reader-side critical section (releases spinlock).
+ */
+static inline void read_sequnlock_excl(seqlock_t* sl) {
+    spinlock_unlock(&sl->lock);
+}
+
 #endif // _SEQLOCK_H
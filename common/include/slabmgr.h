@@ -107,6 +107,36 @@ static_assert(IS_ALIGNED(offsetof(struct slab_area, raw), 16),
 // (SLAB_HDR_SIZE)).
 static const size_t slab_levels[SLAB_LEVEL] = {SLAB_LEVEL_SIZES};
 
+/*
+ * Objects bigger than the last level ("large objects") are allocated directly by system_malloc().
+ * Their total size (including the header) is rounded up to a size class: a whole number of
+ * LARGE_OBJ_GRANULE units up to LARGE_OBJ_EXACT_GRANULES units, then four classes per power of two.
+ *
+ * If LARGE_OBJ_CACHE_SIZE is defined, freed large objects of at most LARGE_OBJ_CACHE_MAX bytes are
+ * kept in the slab manager (at most LARGE_OBJ_CACHE_SLOTS of them and LARGE_OBJ_CACHE_SIZE bytes in
+ * total) and reused by allocations of the same size class, instead of calling system_free() and
+ * system_malloc() again. The least recently freed objects are evicted first.
+ */
+#ifndef LARGE_OBJ_GRANULE
+#define LARGE_OBJ_GRANULE 4096
+#endif
+
+#ifndef LARGE_OBJ_EXACT_GRANULES
+#define LARGE_OBJ_EXACT_GRANULES 16
+#endif
+static_assert(LARGE_OBJ_EXACT_GRANULES >= 4, "LARGE_OBJ_EXACT_GRANULES is too small");
+
+#ifdef LARGE_OBJ_CACHE_SIZE
+#ifndef LARGE_OBJ_CACHE_MAX
+#define LARGE_OBJ_CACHE_MAX (256 * 1024)
+#endif
+#ifndef LARGE_OBJ_CACHE_SLOTS
+#define LARGE_OBJ_CACHE_SLOTS 32
+#endif
+static_assert(LARGE_OBJ_CACHE_MAX <= LARGE_OBJ_CACHE_SIZE,
+              "LARGE_OBJ_CACHE_MAX must not exceed LARGE_OBJ_CACHE_SIZE");
+#endif
+
 DEFINE_LISTP(slab_obj);
 DEFINE_LISTP(slab_area);
 typedef struct slab_mgr {
@@ -116,6 +146,11 @@ typedef struct slab_mgr {
     void* addr[SLAB_LEVEL];
     void* addr_top[SLAB_LEVEL];
     SLAB_AREA active_area[SLAB_LEVEL];
+#ifdef LARGE_OBJ_CACHE_SIZE
+    struct large_mem_obj* large_cache[LARGE_OBJ_CACHE_SLOTS]; /* from least recently freed */
+    size_t large_cache_cnt;
+    size_t large_cache_size; /* in bytes, including headers */
+#endif
 } SLAB_MGR_TYPE, *SLAB_MGR;
 
 typedef struct __attribute__((packed)) large_mem_obj {
@@ -229,6 +264,11 @@ static inline SLAB_MGR create_slab_mgr(void) {
         addr += __MAX_MEM_SIZE(slab_levels[i], size);
     }
 
+#ifdef LARGE_OBJ_CACHE_SIZE
+    mgr->large_cache_cnt  = 0;
+    mgr->large_cache_size = 0;
+#endif
+
     return mgr;
 }
 
@@ -248,6 +288,13 @@ static inline void destroy_slab_mgr(SLAB_MGR mgr) {
         addr += __MAX_MEM_SIZE(slab_levels[i], area->size);
     }
 
+#ifdef LARGE_OBJ_CACHE_SIZE
+    for (size_t i = 0; i < mgr->large_cache_cnt; i++) {
+        struct large_mem_obj* mem = mgr->large_cache[i];
+        system_free(mem, mem->size + sizeof(*mem));
+    }
+#endif
+
     system_free(mgr, addr - (void*)mgr);
 }
 
@@ -291,55 +338,177 @@ static inline int maybe_enlarge_slab_mgr(SLAB_MGR mgr, int level) {
     return 0;
 }
 
-static inline void* slab_alloc(SLAB_MGR mgr, size_t size) {
+/* Returns the level serving allocations of `size` bytes, or SLAB_LEVEL if such allocations are
+ * served directly by system_malloc(). */
+static inline size_t slab_size_to_level(size_t size) {
+    for (size_t i = 0; i < SLAB_LEVEL; i++)
+        if (size <= slab_levels[i])
+            return i;
+    return SLAB_LEVEL;
+}
+
+// SYSTEM_LOCK needs to be held by the caller and maybe_enlarge_slab_mgr() must have succeeded.
+static inline void* __slab_take_obj(SLAB_MGR mgr, size_t level) {
     SLAB_OBJ mobj;
-    size_t level = -1;
 
-    for (size_t i = 0; i < SLAB_LEVEL; i++)
-        if (size <= slab_levels[i]) {
-            level = i;
+    assert(mgr->addr[level] <= mgr->addr_top[level]);
+    if (!LISTP_EMPTY(&mgr->free_list[level])) {
+        mobj = LISTP_FIRST_ENTRY(&mgr->free_list[level], SLAB_OBJ_TYPE, __list);
+        LISTP_DEL(mobj, &mgr->free_list[level], __list);
+    } else {
+        mobj = (void*)mgr->addr[level];
+        mgr->addr[level] += slab_levels[level] + SLAB_HDR_SIZE;
+    }
+    assert(mgr->addr[level] <= mgr->addr_top[level]);
+    OBJ_LEVEL(mobj) = level;
+
+#ifdef SLAB_CANARY
+    unsigned long* m = (unsigned long*)((void*)OBJ_RAW(mobj) + slab_levels[level]);
+    *m = SLAB_CANARY_STRING;
+#endif
+
+    return OBJ_RAW(mobj);
+}
+
+/* Rounds the total size of a large object (including its header) up to its size class. */
+static inline size_t large_obj_class_size(size_t size) {
+    size_t granules = ALIGN_UP(size, LARGE_OBJ_GRANULE) / LARGE_OBJ_GRANULE;
+    if (granules > LARGE_OBJ_EXACT_GRANULES) {
+        /* four classes per power of two, i.e. at most 25% of waste */
+        size_t shift = 63 - __builtin_clzl(granules - 1) - 2;
+        granules = ALIGN_UP_POW2(granules, 1UL << shift);
+    }
+    return granules * LARGE_OBJ_GRANULE;
+}
+
+#ifdef LARGE_OBJ_CACHE_SIZE
+// SYSTEM_LOCK needs to be held by the caller.
+static inline void __large_cache_remove(SLAB_MGR mgr, size_t i) {
+    assert(i < mgr->large_cache_cnt);
+
+    LARGE_MEM_OBJ mem = mgr->large_cache[i];
+    mgr->large_cache_size -= mem->size + sizeof(LARGE_MEM_OBJ_TYPE);
+    mgr->large_cache_cnt--;
+    memmove(&mgr->large_cache[i], &mgr->large_cache[i + 1],
+            (mgr->large_cache_cnt - i) * sizeof(mgr->large_cache[0]));
+}
+#endif
+
+/* Takes a cached large object of total size `total` (a size class), if there is one. */
+static inline LARGE_MEM_OBJ large_cache_get(SLAB_MGR mgr, size_t total) {
+#ifdef LARGE_OBJ_CACHE_SIZE
+    if (total > LARGE_OBJ_CACHE_MAX)
+        return NULL;
+
+    LARGE_MEM_OBJ mem = NULL;
+    SYSTEM_LOCK();
+    /* prefer the most recently freed object, its memory is most likely still in CPU caches */
+    for (size_t i = mgr->large_cache_cnt; i > 0; i--) {
+        LARGE_MEM_OBJ cached = mgr->large_cache[i - 1];
+        if (cached->size + sizeof(LARGE_MEM_OBJ_TYPE) == total) {
+            mem = cached;
+            __large_cache_remove(mgr, i - 1);
             break;
         }
+    }
+    SYSTEM_UNLOCK();
+    return mem;
+#else
+    __UNUSED(mgr);
+    __UNUSED(total);
+    return NULL;
+#endif
+}
+
+/* Puts a freed large object into the cache, evicting (really freeing) the least recently freed
+ * ones to make room. Returns false if the object is not cacheable. */
+static inline bool large_cache_put(SLAB_MGR mgr, LARGE_MEM_OBJ mem) {
+#ifdef LARGE_OBJ_CACHE_SIZE
+    size_t total = mem->size + sizeof(LARGE_MEM_OBJ_TYPE);
+    if (total > LARGE_OBJ_CACHE_MAX)
+        return false;
+
+    LARGE_MEM_OBJ evicted[LARGE_OBJ_CACHE_SLOTS];
+    size_t evicted_cnt = 0;
+
+    SYSTEM_LOCK();
+    while (mgr->large_cache_cnt == LARGE_OBJ_CACHE_SLOTS ||
+            mgr->large_cache_size + total > LARGE_OBJ_CACHE_SIZE) {
+        evicted[evicted_cnt++] = mgr->large_cache[0];
+        __large_cache_remove(mgr, 0);
+    }
+    mgr->large_cache[mgr->large_cache_cnt++] = mem;
+    mgr->large_cache_size += total;
+    SYSTEM_UNLOCK();
+
+    for (size_t i = 0; i < evicted_cnt; i++)
+        system_free(evicted[i], evicted[i]->size + sizeof(LARGE_MEM_OBJ_TYPE));
+    return true;
+#else
+    __UNUSED(mgr);
+    __UNUSED(mem);
+    return false;
+#endif
+}
 
-    if (level == (size_t)-1) {
-        size = ALIGN_UP_POW2(size, MIN_MALLOC_ALIGNMENT);
+static inline void* slab_alloc(SLAB_MGR mgr, size_t size) {
+    size_t level = slab_size_to_level(size);
 
-        LARGE_MEM_OBJ mem = (LARGE_MEM_OBJ)system_malloc(sizeof(LARGE_MEM_OBJ_TYPE) + size);
-        if (!mem)
+    if (level == SLAB_LEVEL) {
+        if (size > SIZE_MAX / 2)
             return NULL;
+        size_t total = large_obj_class_size(sizeof(LARGE_MEM_OBJ_TYPE) + size);
 
-        mem->size = size;
+        LARGE_MEM_OBJ mem = large_cache_get(mgr, total);
+        if (!mem) {
+            mem = (LARGE_MEM_OBJ)system_malloc(total);
+            if (!mem)
+                return NULL;
+        }
+
+        mem->size = total - sizeof(LARGE_MEM_OBJ_TYPE);
         OBJ_LEVEL(mem) = (unsigned char)-1;
 
         return OBJ_RAW(mem);
     }
 
     SYSTEM_LOCK();
-    assert(mgr->addr[level] <= mgr->addr_top[level]);
-
     int ret = maybe_enlarge_slab_mgr(mgr, level);
     if (ret < 0) {
         SYSTEM_UNLOCK();
         return NULL;
     }
 
-    if (!LISTP_EMPTY(&mgr->free_list[level])) {
-        mobj = LISTP_FIRST_ENTRY(&mgr->free_list[level], SLAB_OBJ_TYPE, __list);
-        LISTP_DEL(mobj, &mgr->free_list[level], __list);
-    } else {
-        mobj = (void*)mgr->addr[level];
-        mgr->addr[level] += slab_levels[level] + SLAB_HDR_SIZE;
-    }
-    assert(mgr->addr[level] <= mgr->addr_top[level]);
-    OBJ_LEVEL(mobj) = level;
+    void* obj = __slab_take_obj(mgr, level);
     SYSTEM_UNLOCK();
+    return obj;
+}
 
-#ifdef SLAB_CANARY
-    unsigned long* m = (unsigned long*)((void*)OBJ_RAW(mobj) + slab_levels[level]);
-    *m = SLAB_CANARY_STRING;
-#endif
+/*
+ * Allocates up to `count` objects of level `level` while taking SYSTEM_LOCK only once. The objects
+ * are returned in `*head`, chained through the first word of their user buffers (which is why
+ * this is only useful for caches of free objects, e.g. per-thread ones). Returns the number of
+ * allocated objects, which is less than `count` only if the slab manager could not be enlarged.
+ */
+static inline size_t slab_alloc_batch(SLAB_MGR mgr, size_t level, size_t count, void** head) {
+    assert(level < SLAB_LEVEL);
 
-    return OBJ_RAW(mobj);
+    void* chain = NULL;
+    size_t allocated = 0;
+
+    SYSTEM_LOCK();
+    while (allocated < count) {
+        if (maybe_enlarge_slab_mgr(mgr, level) < 0)
+            break;
+        void* obj = __slab_take_obj(mgr, level);
+        *(void**)obj = chain;
+        chain = obj;
+        allocated++;
+    }
+    SYSTEM_UNLOCK();
+
+    *head = chain;
+    return allocated;
 }
 
 // Returns user buffer size (i.e. excluding size of control structures).
@@ -367,20 +536,13 @@ static inline size_t slab_get_buf_size(const void* ptr) {
     return slab_levels[level];
 }
 
-static inline void slab_free(SLAB_MGR mgr, void* obj) {
-    /* In a general purpose allocator, free of NULL is allowed (and is a
-     * nop). We might want to enforce stricter rules for our allocator if
-     * we're sure that no clients rely on being able to free NULL. */
-    if (!obj)
-        return;
-
+/* Returns the level of a slab object (or (unsigned char)-1 for objects allocated directly by
+ * system_malloc()), panicking on detected heap corruption. */
+static inline unsigned char slab_obj_level(const void* obj) {
     unsigned char level = RAW_TO_LEVEL(obj);
 
-    if (level == (unsigned char)-1) {
-        LARGE_MEM_OBJ mem = RAW_TO_OBJ(obj, LARGE_MEM_OBJ_TYPE);
-        system_free(mem, mem->size + sizeof(LARGE_MEM_OBJ_TYPE));
-        return;
-    }
+    if (level == (unsigned char)-1)
+        return level;
 
     /* If this happens, either the heap is already corrupted, or someone's
      * freeing something that's wrong, which will most likely lead to heap
@@ -395,16 +557,53 @@ static inline void slab_free(SLAB_MGR mgr, void* obj) {
     }
 
 #ifdef SLAB_CANARY
-    unsigned long* m = (unsigned long*)(obj + slab_levels[level]);
+    const unsigned long* m = (const unsigned long*)(obj + slab_levels[level]);
     __UNUSED(m);
     assert(*m == SLAB_CANARY_STRING);
 #endif
 
-    SLAB_OBJ mobj = RAW_TO_OBJ(obj, SLAB_OBJ_TYPE);
+    return level;
+}
 
-    SYSTEM_LOCK();
+// SYSTEM_LOCK needs to be held by the caller.
+static inline void __slab_put_obj(SLAB_MGR mgr, size_t level, void* obj) {
+    SLAB_OBJ mobj = RAW_TO_OBJ(obj, SLAB_OBJ_TYPE);
     INIT_LIST_HEAD(mobj, __list);
     LISTP_ADD_TAIL(mobj, &mgr->free_list[level], __list);
+}
+
+static inline void slab_free(SLAB_MGR mgr, void* obj) {
+    /* In a general purpose allocator, free of NULL is allowed (and is a
+     * nop). We might want to enforce stricter rules for our allocator if
+     * we're sure that no clients rely on being able to free NULL. */
+    if (!obj)
+        return;
+
+    unsigned char level = slab_obj_level(obj);
+
+    if (level == (unsigned char)-1) {
+        LARGE_MEM_OBJ mem = RAW_TO_OBJ(obj, LARGE_MEM_OBJ_TYPE);
+        if (!large_cache_put(mgr, mem))
+            system_free(mem, mem->size + sizeof(LARGE_MEM_OBJ_TYPE));
+        return;
+    }
+
+    SYSTEM_LOCK();
+    __slab_put_obj(mgr, level, obj);
+    SYSTEM_UNLOCK();
+}
+
+/* Frees a chain of objects of level `level` (as returned by slab_alloc_batch()) while taking
+ * SYSTEM_LOCK only once. The objects must have been checked by slab_obj_level() already. */
+static inline void slab_free_batch(SLAB_MGR mgr, size_t level, void* head) {
+    assert(level < SLAB_LEVEL);
+
+    SYSTEM_LOCK();
+    while (head) {
+        void* next = *(void**)head;
+        __slab_put_obj(mgr, level, head);
+        head = next;
+    }
     SYSTEM_UNLOCK();
 }
 
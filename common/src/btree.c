@@ -0,0 +1,507 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * B+-tree, see btree.h. Inner nodes with `count` keys have `count + 1` children; all keys in
+ * `children[i]` are smaller than `keys[i]`, and all keys in `children[i + 1]` are greater or equal.
+ * Every node but the root has at least BTREE_MIN_KEYS keys.
+ *
+ * Both insertion and deletion go down from the root in a single pass: a full child is split before
+ * descending into it, and a child with the minimum number of keys gets one from its sibling (or is
+ * merged with it). So there is never anything to fix on the way back up, and an allocation failure
+ * during insertion leaves a valid tree.
+ */
+
+#include "btree.h"
+
+#include "api.h"
+#include "assert.h"
+#include "pal_error.h"
+
+#define BTREE_MIN_KEYS (BTREE_MAX_KEYS / 2)
+
+struct btree_node {
+    uint32_t count;
+    bool leaf;
+    uint64_t keys[BTREE_MAX_KEYS];
+    union {
+        struct btree_node* children[BTREE_MAX_KEYS + 1];
+        struct {
+            void* values[BTREE_MAX_KEYS];
+            struct btree_node* next; /* next leaf in key order */
+        };
+    };
+};
+
+static_assert(sizeof(struct btree_node) == BTREE_NODE_SIZE, "unexpected size of B-tree nodes");
+
+static struct btree_node* node_alloc(bool leaf) {
+    struct btree_node* node = malloc(sizeof(*node));
+    if (!node)
+        return NULL;
+    node->count = 0;
+    node->leaf = leaf;
+    if (leaf)
+        node->next = NULL;
+    return node;
+}
+
+/* Index of the child of inner `node` which holds `key`. Nodes span just a few cache lines, so a
+ * linear scan is as fast as a binary search. */
+static size_t child_index(struct btree_node* node, uint64_t key) {
+    size_t i = 0;
+    while (i < node->count && node->keys[i] <= key)
+        i++;
+    return i;
+}
+
+/* Index of the first key in leaf `node` greater or equal to `key` (`node->count` if none). */
+static size_t leaf_index(struct btree_node* node, uint64_t key) {
+    size_t i = 0;
+    while (i < node->count && node->keys[i] < key)
+        i++;
+    return i;
+}
+
+/* Splits the full child `i` of `parent`, which must not be full itself. */
+static int split_child(struct btree_node* parent, size_t i) {
+    struct btree_node* child = parent->children[i];
+    assert(child->count == BTREE_MAX_KEYS && parent->count < BTREE_MAX_KEYS);
+
+    struct btree_node* sibling = node_alloc(child->leaf);
+    if (!sibling)
+        return -PAL_ERROR_NOMEM;
+
+    uint64_t separator;
+    if (child->leaf) {
+        size_t left = (BTREE_MAX_KEYS + 1) / 2;
+        sibling->count = BTREE_MAX_KEYS - left;
+        memcpy(sibling->keys, &child->keys[left], sibling->count * sizeof(child->keys[0]));
+        memcpy(sibling->values, &child->values[left], sibling->count * sizeof(child->values[0]));
+        sibling->next = child->next;
+        child->next = sibling;
+        child->count = left;
+        separator = sibling->keys[0];
+    } else {
+        /* the middle key moves up to `parent` */
+        size_t mid = BTREE_MAX_KEYS / 2;
+        sibling->count = BTREE_MAX_KEYS - mid - 1;
+        memcpy(sibling->keys, &child->keys[mid + 1], sibling->count * sizeof(child->keys[0]));
+        memcpy(sibling->children, &child->children[mid + 1],
+               (sibling->count + 1) * sizeof(child->children[0]));
+        child->count = mid;
+        separator = child->keys[mid];
+    }
+
+    memmove(&parent->keys[i + 1], &parent->keys[i], (parent->count - i) * sizeof(parent->keys[0]));
+    memmove(&parent->children[i + 2], &parent->children[i + 1],
+            (parent->count - i) * sizeof(parent->children[0]));
+    parent->keys[i] = separator;
+    parent->children[i + 1] = sibling;
+    parent->count++;
+    return 0;
+}
+
+int btree_insert(struct btree* tree, uint64_t key, void* value) {
+    if (!tree->root) {
+        tree->root = node_alloc(/*leaf=*/true);
+        if (!tree->root)
+            return -PAL_ERROR_NOMEM;
+        tree->height = 0;
+    }
+
+    if (tree->root->count == BTREE_MAX_KEYS) {
+        struct btree_node* root = node_alloc(/*leaf=*/false);
+        if (!root)
+            return -PAL_ERROR_NOMEM;
+        root->children[0] = tree->root;
+        int ret = split_child(root, 0);
+        if (ret < 0) {
+            free(root);
+            return ret;
+        }
+        tree->root = root;
+        tree->height++;
+    }
+
+    struct btree_node* node = tree->root;
+    while (!node->leaf) {
+        size_t i = child_index(node, key);
+        if (node->children[i]->count == BTREE_MAX_KEYS) {
+            int ret = split_child(node, i);
+            if (ret < 0)
+                return ret;
+            if (key >= node->keys[i])
+                i++;
+        }
+        node = node->children[i];
+    }
+
+    size_t i = leaf_index(node, key);
+    if (i < node->count && node->keys[i] == key)
+        return -PAL_ERROR_STREAMEXIST;
+
+    memmove(&node->keys[i + 1], &node->keys[i], (node->count - i) * sizeof(node->keys[0]));
+    memmove(&node->values[i + 1], &node->values[i], (node->count - i) * sizeof(node->values[0]));
+    node->keys[i] = key;
+    node->values[i] = value;
+    node->count++;
+    tree->count++;
+    return 0;
+}
+
+/* Moves the last element of child `i - 1` of `parent` to the front of child `i`. */
+static void borrow_from_left(struct btree_node* parent, size_t i) {
+    struct btree_node* left = parent->children[i - 1];
+    struct btree_node* child = parent->children[i];
+
+    memmove(&child->keys[1], &child->keys[0], child->count * sizeof(child->keys[0]));
+    if (child->leaf) {
+        memmove(&child->values[1], &child->values[0], child->count * sizeof(child->values[0]));
+        child->keys[0] = left->keys[left->count - 1];
+        child->values[0] = left->values[left->count - 1];
+        parent->keys[i - 1] = child->keys[0];
+    } else {
+        memmove(&child->children[1], &child->children[0],
+                (child->count + 1) * sizeof(child->children[0]));
+        child->keys[0] = parent->keys[i - 1];
+        child->children[0] = left->children[left->count];
+        parent->keys[i - 1] = left->keys[left->count - 1];
+    }
+    left->count--;
+    child->count++;
+}
+
+/* Moves the first element of child `i + 1` of `parent` to the end of child `i`. */
+static void borrow_from_right(struct btree_node* parent, size_t i) {
+    struct btree_node* child = parent->children[i];
+    struct btree_node* right = parent->children[i + 1];
+
+    if (child->leaf) {
+        child->keys[child->count] = right->keys[0];
+        child->values[child->count] = right->values[0];
+        memmove(&right->values[0], &right->values[1], (right->count - 1) * sizeof(right->values[0]));
+        memmove(&right->keys[0], &right->keys[1], (right->count - 1) * sizeof(right->keys[0]));
+        parent->keys[i] = right->keys[0];
+    } else {
+        child->keys[child->count] = parent->keys[i];
+        child->children[child->count + 1] = right->children[0];
+        parent->keys[i] = right->keys[0];
+        memmove(&right->keys[0], &right->keys[1], (right->count - 1) * sizeof(right->keys[0]));
+        memmove(&right->children[0], &right->children[1],
+                right->count * sizeof(right->children[0]));
+    }
+    child->count++;
+    right->count--;
+}
+
+/* Merges child `i + 1` of `parent` into child `i`; both must have the minimum number of keys. */
+static void merge_children(struct btree_node* parent, size_t i) {
+    struct btree_node* left = parent->children[i];
+    struct btree_node* right = parent->children[i + 1];
+
+    if (left->leaf) {
+        memcpy(&left->keys[left->count], right->keys, right->count * sizeof(right->keys[0]));
+        memcpy(&left->values[left->count], right->values, right->count * sizeof(right->values[0]));
+        left->count += right->count;
+        left->next = right->next;
+    } else {
+        left->keys[left->count] = parent->keys[i];
+        memcpy(&left->keys[left->count + 1], right->keys, right->count * sizeof(right->keys[0]));
+        memcpy(&left->children[left->count + 1], right->children,
+               (right->count + 1) * sizeof(right->children[0]));
+        left->count += right->count + 1;
+    }
+    assert(left->count <= BTREE_MAX_KEYS);
+
+    memmove(&parent->keys[i], &parent->keys[i + 1],
+            (parent->count - i - 1) * sizeof(parent->keys[0]));
+    memmove(&parent->children[i + 1], &parent->children[i + 2],
+            (parent->count - i - 1) * sizeof(parent->children[0]));
+    parent->count--;
+    free(right);
+}
+
+/* Makes child `i` of `parent` (which has the minimum number of keys) bigger, so that one key can
+ * be removed from it. Returns the index of the child which now covers the keys of child `i`. */
+static size_t fill_child(struct btree_node* parent, size_t i) {
+    if (i > 0 && parent->children[i - 1]->count > BTREE_MIN_KEYS) {
+        borrow_from_left(parent, i);
+        return i;
+    }
+    if (i < parent->count && parent->children[i + 1]->count > BTREE_MIN_KEYS) {
+        borrow_from_right(parent, i);
+        return i;
+    }
+    if (i > 0) {
+        merge_children(parent, i - 1);
+        return i - 1;
+    }
+    merge_children(parent, i);
+    return i;
+}
+
+bool btree_delete(struct btree* tree, uint64_t key) {
+    struct btree_node* node = tree->root;
+    if (!node)
+        return false;
+
+    while (!node->leaf) {
+        size_t i = child_index(node, key);
+        if (node->children[i]->count <= BTREE_MIN_KEYS) {
+            i = fill_child(node, i);
+            if (node->count == 0) {
+                /* the last two children of the root were merged */
+                assert(node == tree->root);
+                tree->root = node->children[0];
+                tree->height--;
+                free(node);
+                node = tree->root;
+                continue;
+            }
+        }
+        node = node->children[i];
+    }
+
+    size_t i = leaf_index(node, key);
+    if (i == node->count || node->keys[i] != key)
+        return false;
+
+    memmove(&node->keys[i], &node->keys[i + 1], (node->count - i - 1) * sizeof(node->keys[0]));
+    memmove(&node->values[i], &node->values[i + 1],
+            (node->count - i - 1) * sizeof(node->values[0]));
+    node->count--;
+    tree->count--;
+
+    if (!tree->count) {
+        assert(node == tree->root);
+        free(node);
+        tree->root = NULL;
+        tree->height = 0;
+    }
+    return true;
+}
+
+static struct btree_node* find_leaf(struct btree* tree, uint64_t key) {
+    struct btree_node* node = tree->root;
+    if (!node)
+        return NULL;
+    while (!node->leaf)
+        node = node->children[child_index(node, key)];
+    return node;
+}
+
+bool btree_find(struct btree* tree, uint64_t key, void** value) {
+    struct btree_node* leaf = find_leaf(tree, key);
+    if (!leaf)
+        return false;
+
+    size_t i = leaf_index(leaf, key);
+    if (i == leaf->count || leaf->keys[i] != key)
+        return false;
+    if (value)
+        *value = leaf->values[i];
+    return true;
+}
+
+int btree_bulk_load(struct btree* tree, const uint64_t* keys, void* const* values, size_t count) {
+    assert(!tree->root);
+
+    for (size_t i = 1; i < count; i++)
+        if (keys[i - 1] >= keys[i])
+            return -PAL_ERROR_INVAL;
+    if (!count)
+        return 0;
+
+    /* Elements (and then children) are spread evenly over the nodes of each level, so every node
+     * but the root is at least half full. All nodes are allocated upfront, level by level, so that
+     * building the tree cannot fail. */
+    size_t leaves_cnt = DIV_ROUND_UP(count, BTREE_MAX_KEYS);
+    size_t nodes_cnt = 0;
+    for (size_t level_cnt = leaves_cnt; ; level_cnt = DIV_ROUND_UP(level_cnt, BTREE_MAX_KEYS + 1)) {
+        nodes_cnt += level_cnt;
+        if (level_cnt == 1)
+            break;
+    }
+
+    int ret = -PAL_ERROR_NOMEM;
+    size_t allocated = 0;
+    struct btree_node** nodes = malloc(nodes_cnt * sizeof(*nodes));
+    /* smallest key under each node of the level being built */
+    uint64_t* min_keys = malloc(leaves_cnt * sizeof(*min_keys));
+    if (!nodes || !min_keys)
+        goto out;
+    for (; allocated < nodes_cnt; allocated++) {
+        nodes[allocated] = malloc(sizeof(*nodes[allocated]));
+        if (!nodes[allocated])
+            goto out;
+    }
+
+    size_t done = 0;
+    for (size_t i = 0; i < leaves_cnt; i++) {
+        struct btree_node* leaf = nodes[i];
+        leaf->leaf = true;
+        leaf->count = count / leaves_cnt + (i < count % leaves_cnt);
+        memcpy(leaf->keys, keys + done, leaf->count * sizeof(*keys));
+        memcpy(leaf->values, values + done, leaf->count * sizeof(*values));
+        leaf->next = i + 1 < leaves_cnt ? nodes[i + 1] : NULL;
+        min_keys[i] = keys[done];
+        done += leaf->count;
+    }
+
+    size_t height = 0;
+    size_t level = 0;
+    size_t level_cnt = leaves_cnt;
+    while (level_cnt > 1) {
+        size_t parents = level + level_cnt;
+        size_t parents_cnt = DIV_ROUND_UP(level_cnt, BTREE_MAX_KEYS + 1);
+        done = 0;
+        for (size_t i = 0; i < parents_cnt; i++) {
+            struct btree_node* parent = nodes[parents + i];
+            size_t children_cnt = level_cnt / parents_cnt + (i < level_cnt % parents_cnt);
+            parent->leaf = false;
+            parent->count = children_cnt - 1;
+            for (size_t j = 0; j < children_cnt; j++) {
+                parent->children[j] = nodes[level + done + j];
+                if (j > 0)
+                    parent->keys[j - 1] = min_keys[done + j];
+            }
+            /* `i <= done`, so this never overwrites keys of children not visited yet */
+            min_keys[i] = min_keys[done];
+            done += children_cnt;
+        }
+        level = parents;
+        level_cnt = parents_cnt;
+        height++;
+    }
+    assert(level + 1 == nodes_cnt);
+
+    tree->root = nodes[nodes_cnt - 1];
+    tree->height = height;
+    tree->count = count;
+    allocated = 0;
+    ret = 0;
+out:
+    for (size_t i = 0; i < allocated; i++)
+        free(nodes[i]);
+    free(nodes);
+    free(min_keys);
+    return ret;
+}
+
+static void destroy_node(struct btree_node* node) {
+    if (!node->leaf)
+        for (size_t i = 0; i <= node->count; i++)
+            destroy_node(node->children[i]);
+    free(node);
+}
+
+void btree_destroy(struct btree* tree) {
+    if (tree->root)
+        destroy_node(tree->root);
+    tree->root = NULL;
+    tree->height = 0;
+    tree->count = 0;
+}
+
+bool btree_first(struct btree* tree, struct btree_iter* iter) {
+    struct btree_node* node = tree->root;
+    if (!node)
+        return false;
+    while (!node->leaf)
+        node = node->children[0];
+    iter->leaf = node;
+    iter->index = 0;
+    return true;
+}
+
+bool btree_lower_bound(struct btree* tree, uint64_t key, struct btree_iter* iter) {
+    struct btree_node* leaf = find_leaf(tree, key);
+    if (!leaf)
+        return false;
+
+    size_t i = leaf_index(leaf, key);
+    if (i == leaf->count) {
+        /* all keys of the leaf are smaller, the next leaf starts with a greater one */
+        leaf = leaf->next;
+        i = 0;
+        if (!leaf)
+            return false;
+    }
+    iter->leaf = leaf;
+    iter->index = i;
+    return true;
+}
+
+bool btree_iter_next(struct btree_iter* iter) {
+    assert(iter->index < iter->leaf->count);
+    iter->index++;
+    if (iter->index == iter->leaf->count) {
+        iter->leaf = iter->leaf->next;
+        iter->index = 0;
+    }
+    return iter->leaf;
+}
+
+uint64_t btree_iter_key(struct btree_iter* iter) {
+    assert(iter->index < iter->leaf->count);
+    return iter->leaf->keys[iter->index];
+}
+
+void* btree_iter_value(struct btree_iter* iter) {
+    assert(iter->index < iter->leaf->count);
+    return iter->leaf->values[iter->index];
+}
+
+struct btree_check {
+    struct btree* tree;
+    struct btree_node* prev_leaf;
+    size_t count;
+};
+
+/* Checks the subtree of `node` at `depth`, whose keys must be in [`lo`, `hi`) (without the bounds
+ * for which `has_lo` or `has_hi` are false). */
+static bool check_node(struct btree_check* check, struct btree_node* node, size_t depth,
+                       bool has_lo, uint64_t lo, bool has_hi, uint64_t hi) {
+    size_t min_keys = node == check->tree->root ? 1 : BTREE_MIN_KEYS;
+    if (node->count < min_keys || node->count > BTREE_MAX_KEYS)
+        return false;
+    if (node->leaf != (depth == check->tree->height))
+        return false;
+
+    for (size_t i = 0; i < node->count; i++) {
+        if (i > 0 && node->keys[i - 1] >= node->keys[i])
+            return false;
+        if ((has_lo && node->keys[i] < lo) || (has_hi && node->keys[i] >= hi))
+            return false;
+    }
+
+    if (node->leaf) {
+        if (check->prev_leaf ? check->prev_leaf->next != node : node != find_leaf(check->tree, 0))
+            return false;
+        check->prev_leaf = node;
+        check->count += node->count;
+        return true;
+    }
+
+    for (size_t i = 0; i <= node->count; i++) {
+        bool child_has_lo = i > 0 || has_lo;
+        uint64_t child_lo = i > 0 ? node->keys[i - 1] : lo;
+        bool child_has_hi = i < node->count || has_hi;
+        uint64_t child_hi = i < node->count ? node->keys[i] : hi;
+        if (!check_node(check, node->children[i], depth + 1, child_has_lo, child_lo, child_has_hi,
+                        child_hi))
+            return false;
+    }
+    return true;
+}
+
+bool debug_btree_is_valid(struct btree* tree) {
+    if (!tree->root)
+        return tree->count == 0 && tree->height == 0;
+
+    struct btree_check check = {.tree = tree};
+    if (!check_node(&check, tree->root, 0, false, 0, false, 0))
+        return false;
+    return !check.prev_leaf->next && check.count == tree->count;
+}
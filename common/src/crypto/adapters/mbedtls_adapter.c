@@ -15,8 +15,11 @@
 #include "mbedtls/error.h"
 #include "mbedtls/gcm.h"
 #include "mbedtls/net_sockets.h"
+#include "mbedtls/platform_util.h"
 #include "mbedtls/rsa.h"
 #include "mbedtls/sha256.h"
+#include "mbedtls/ssl_internal.h"
+#include "mbedtls_gcm_aesni.h"
 #include "pal_error.h"
 
 /* This is declared in pal_internal.h, but that can't be included here. */
@@ -91,6 +94,7 @@ static int mbedtls_to_pal_error(int error) {
             return -PAL_ERROR_CRYPTO_VERIFY_FAILED;
 
         case MBEDTLS_ERR_RSA_RNG_FAILED:
+        case MBEDTLS_ERR_CTR_DRBG_ENTROPY_SOURCE_FAILED:
             return -PAL_ERROR_CRYPTO_RNG_FAILED;
 
         case MBEDTLS_ERR_SSL_WANT_READ:
@@ -132,17 +136,49 @@ int lib_SHA256Final(LIB_SHA256_CONTEXT* context, uint8_t* output) {
     return 0;
 }
 
+/* The limits of mbedtls_gcm_starts() and mbedtls_gcm_finish(), other arguments are passed to
+ * mbedTLS to fail there */
+static bool use_gcm_aesni(size_t input_size, size_t aad_size, size_t tag_size) {
+    return input_size <= 0xFFFFFFFE0ULL && aad_size < (1ULL << 61) && tag_size >= 4
+           && tag_size <= GCM_AESNI_TAG_SIZE && gcm_aesni_supported();
+}
+
+static int aes_gcm_aesni(const uint8_t* key, size_t key_size, bool encrypt, const uint8_t* iv,
+                         const uint8_t* input, size_t input_size, const uint8_t* aad,
+                         size_t aad_size, uint8_t* output, uint8_t tag[GCM_AESNI_TAG_SIZE]) {
+    mbedtls_aes_context aes;
+    mbedtls_aes_init(&aes);
+
+    int ret = mbedtls_aes_setkey_enc(&aes, key, key_size * BITS_IN_BYTE);
+    ret = mbedtls_to_pal_error(ret);
+    if (ret == 0)
+        gcm_aesni_crypt(&aes, encrypt, iv, input, input_size, aad, aad_size, output, tag);
+
+    mbedtls_aes_free(&aes);
+    return ret;
+}
+
 int lib_AESGCMEncrypt(const uint8_t* key, size_t key_size, const uint8_t* iv, const uint8_t* input,
                       size_t input_size, const uint8_t* aad, size_t aad_size, uint8_t* output,
                       uint8_t* tag, size_t tag_size) {
     int ret = -PAL_ERROR_INVAL;
 
+    if (key_size != 16 && key_size != 24 && key_size != 32)
+        return ret;
+
+    if (use_gcm_aesni(input_size, aad_size, tag_size)) {
+        uint8_t full_tag[GCM_AESNI_TAG_SIZE];
+        ret = aes_gcm_aesni(key, key_size, /*encrypt=*/true, iv, input, input_size, aad, aad_size,
+                            output, full_tag);
+        if (ret == 0)
+            memcpy(tag, full_tag, tag_size);
+        mbedtls_platform_zeroize(full_tag, sizeof(full_tag));
+        return ret;
+    }
+
     mbedtls_gcm_context gcm;
     mbedtls_gcm_init(&gcm);
 
-    if (key_size != 16 && key_size != 24 && key_size != 32)
-        goto out;
-
     ret = mbedtls_gcm_setkey(&gcm, MBEDTLS_CIPHER_ID_AES, key, key_size * BITS_IN_BYTE);
     ret = mbedtls_to_pal_error(ret);
     if (ret != 0)
@@ -165,12 +201,30 @@ int lib_AESGCMDecrypt(const uint8_t* key, size_t key_size, const uint8_t* iv, co
                       const uint8_t* tag, size_t tag_size) {
     int ret = -PAL_ERROR_INVAL;
 
+    if (key_size != 16 && key_size != 24 && key_size != 32)
+        return ret;
+
+    if (use_gcm_aesni(input_size, aad_size, tag_size)) {
+        uint8_t full_tag[GCM_AESNI_TAG_SIZE];
+        ret = aes_gcm_aesni(key, key_size, /*encrypt=*/false, iv, input, input_size, aad,
+                            aad_size, output, full_tag);
+        if (ret == 0) {
+            /* constant-time comparison, like in mbedtls_gcm_auth_decrypt() */
+            uint8_t diff = 0;
+            for (size_t i = 0; i < tag_size; i++)
+                diff |= tag[i] ^ full_tag[i];
+            if (diff) {
+                mbedtls_platform_zeroize(output, input_size);
+                ret = mbedtls_to_pal_error(MBEDTLS_ERR_GCM_AUTH_FAILED);
+            }
+        }
+        mbedtls_platform_zeroize(full_tag, sizeof(full_tag));
+        return ret;
+    }
+
     mbedtls_gcm_context gcm;
     mbedtls_gcm_init(&gcm);
 
-    if (key_size != 16 && key_size != 24 && key_size != 32)
-        goto out;
-
     ret = mbedtls_gcm_setkey(&gcm, MBEDTLS_CIPHER_ID_AES, key, key_size * BITS_IN_BYTE);
     ret = mbedtls_to_pal_error(ret);
     if (ret != 0)
@@ -262,6 +316,51 @@ exit:
     return ret;
 }
 
+int lib_AESCMACFinishAndReset(LIB_AESCMAC_CONTEXT* context, uint8_t* mac, size_t mac_size) {
+    const mbedtls_cipher_info_t* cipher_info = mbedtls_cipher_info_from_type(context->cipher);
+    if (mac_size < cipher_info->block_size)
+        return -PAL_ERROR_INVAL;
+
+    int ret = mbedtls_cipher_cmac_finish(&context->ctx, mac);
+    if (ret == 0)
+        ret = mbedtls_cipher_cmac_reset(&context->ctx);
+    return mbedtls_to_pal_error(ret);
+}
+
+void lib_AESCMACFree(LIB_AESCMAC_CONTEXT* context) {
+    /* zeroizes the key schedule and the CMAC state */
+    mbedtls_cipher_free(&context->ctx);
+}
+
+int lib_DRBGInit(LIB_DRBG_CONTEXT* context, int (*entropy_cb)(void* arg, uint8_t* buf, size_t size),
+                 void* arg, int reseed_interval) {
+    mbedtls_ctr_drbg_init(context);
+    int ret = mbedtls_ctr_drbg_seed(context, entropy_cb, arg, /*custom=*/NULL, /*len=*/0);
+    if (ret != 0) {
+        mbedtls_ctr_drbg_free(context);
+        return mbedtls_to_pal_error(ret);
+    }
+    mbedtls_ctr_drbg_set_reseed_interval(context, reseed_interval);
+    return 0;
+}
+
+int lib_DRBGRandom(LIB_DRBG_CONTEXT* context, uint8_t* output, size_t output_size) {
+    while (output_size) {
+        size_t size = MIN(output_size, (size_t)MBEDTLS_CTR_DRBG_MAX_REQUEST);
+        int ret = mbedtls_ctr_drbg_random(context, output, size);
+        if (ret != 0)
+            return mbedtls_to_pal_error(ret);
+        output += size;
+        output_size -= size;
+    }
+    return 0;
+}
+
+void lib_DRBGFree(LIB_DRBG_CONTEXT* context) {
+    /* This call zeros out context for us. */
+    mbedtls_ctr_drbg_free(context);
+}
+
 int mbedtls_hardware_poll(void* data, unsigned char* output, size_t len, size_t* olen) {
     __UNUSED(data);
     assert(output && olen);
@@ -320,9 +419,62 @@ static int send_cb(void* ctx, uint8_t const* buf, size_t buf_size) {
     return ret;
 }
 
+#define TICKET_IV_SIZE  12
+#define TICKET_TAG_SIZE 16
+
+/* Session ticket: random IV, serialized session encrypted with `ticket_key`, GCM tag. */
+static int ticket_write_cb(void* p_ticket, const mbedtls_ssl_session* session, unsigned char* start,
+                           const unsigned char* end, size_t* tlen, uint32_t* lifetime) {
+    LIB_SSL_CONTEXT* ssl_ctx = p_ticket;
+
+    if ((size_t)(end - start) < TICKET_IV_SIZE + TICKET_TAG_SIZE)
+        return MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL;
+
+    uint8_t* iv = start;
+    uint8_t* data = start + TICKET_IV_SIZE;
+    size_t data_size;
+    int ret = mbedtls_ssl_session_save(session, data,
+                                       end - data - TICKET_TAG_SIZE, &data_size);
+    if (ret != 0)
+        return ret;
+
+    if (_DkRandomBitsRead(iv, TICKET_IV_SIZE) < 0)
+        return MBEDTLS_ERR_ENTROPY_SOURCE_FAILED;
+
+    ret = lib_AESGCMEncrypt(ssl_ctx->ticket_key, sizeof(ssl_ctx->ticket_key), iv, data, data_size,
+                            /*aad=*/NULL, 0, data, data + data_size, TICKET_TAG_SIZE);
+    if (ret < 0)
+        return MBEDTLS_ERR_SSL_INTERNAL_ERROR;
+
+    *tlen = TICKET_IV_SIZE + data_size + TICKET_TAG_SIZE;
+    /* tickets never expire: they are bound to the key, which lives as long as the application */
+    *lifetime = 0;
+    return 0;
+}
+
+static int ticket_parse_cb(void* p_ticket, mbedtls_ssl_session* session, unsigned char* buf,
+                           size_t len) {
+    LIB_SSL_CONTEXT* ssl_ctx = p_ticket;
+
+    if (len < TICKET_IV_SIZE + TICKET_TAG_SIZE)
+        return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+
+    uint8_t* iv = buf;
+    uint8_t* data = buf + TICKET_IV_SIZE;
+    size_t data_size = len - TICKET_IV_SIZE - TICKET_TAG_SIZE;
+    int ret = lib_AESGCMDecrypt(ssl_ctx->ticket_key, sizeof(ssl_ctx->ticket_key), iv, data,
+                                data_size, /*aad=*/NULL, 0, data, data + data_size,
+                                TICKET_TAG_SIZE);
+    if (ret < 0)
+        return MBEDTLS_ERR_SSL_INVALID_MAC;
+
+    return mbedtls_ssl_session_load(session, data, data_size);
+}
+
 /*! This function is not thread-safe; caller is responsible for proper synchronization. */
 int lib_SSLInit(LIB_SSL_CONTEXT* ssl_ctx, int stream_fd, bool is_server, const uint8_t* psk,
-                size_t psk_size, ssize_t (*pal_recv_cb)(int fd, void* buf, size_t buf_size),
+                size_t psk_size, const uint8_t* ticket_key,
+                ssize_t (*pal_recv_cb)(int fd, void* buf, size_t buf_size),
                 ssize_t (*pal_send_cb)(int fd, const void* buf, size_t buf_size),
                 const uint8_t* buf_load_ssl_ctx, size_t buf_size) {
     int ret;
@@ -361,6 +513,18 @@ int lib_SSLInit(LIB_SSL_CONTEXT* ssl_ctx, int stream_fd, bool is_server, const u
     if (ret != 0)
         return mbedtls_to_pal_error(ret);
 
+    if (ticket_key) {
+        ssl_ctx->use_tickets = true;
+        memcpy(ssl_ctx->ticket_key, ticket_key, sizeof(ssl_ctx->ticket_key));
+        if (is_server) {
+            mbedtls_ssl_conf_session_tickets_cb(&ssl_ctx->conf, ticket_write_cb, ticket_parse_cb,
+                                                ssl_ctx);
+        }
+    }
+    mbedtls_ssl_conf_session_tickets(&ssl_ctx->conf, ticket_key
+                                                         ? MBEDTLS_SSL_SESSION_TICKETS_ENABLED
+                                                         : MBEDTLS_SSL_SESSION_TICKETS_DISABLED);
+
     ret = mbedtls_ssl_setup(&ssl_ctx->ssl, &ssl_ctx->conf);
     if (ret != 0)
         return mbedtls_to_pal_error(ret);
@@ -382,14 +546,23 @@ int lib_SSLFree(LIB_SSL_CONTEXT* ssl_ctx) {
     mbedtls_ssl_config_free(&ssl_ctx->conf);
     mbedtls_ctr_drbg_free(&ssl_ctx->ctr_drbg);
     mbedtls_entropy_free(&ssl_ctx->entropy);
+    mbedtls_platform_zeroize(ssl_ctx->ticket_key, sizeof(ssl_ctx->ticket_key));
     return 0;
 }
 
 int lib_SSLHandshake(LIB_SSL_CONTEXT* ssl_ctx) {
-    int ret;
-    while ((ret = mbedtls_ssl_handshake(&ssl_ctx->ssl)) != 0) {
-        if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE)
+    /* same as mbedtls_ssl_handshake(), but notes whether the session was resumed (the handshake
+     * parameters are gone once it is over) */
+    mbedtls_ssl_context* ssl = &ssl_ctx->ssl;
+    int ret = 0;
+    ssl_ctx->resumed = false;
+    while (ssl->state != MBEDTLS_SSL_HANDSHAKE_OVER) {
+        if (ssl->handshake)
+            ssl_ctx->resumed = ssl->handshake->resume;
+        ret = mbedtls_ssl_handshake_step(ssl);
+        if (ret != 0 && ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE)
             break;
+        ret = 0;
     }
     if (ret != 0)
         return mbedtls_to_pal_error(ret);
@@ -397,6 +570,32 @@ int lib_SSLHandshake(LIB_SSL_CONTEXT* ssl_ctx) {
     return 0;
 }
 
+int lib_SSLSetSession(LIB_SSL_CONTEXT* ssl_ctx, const uint8_t* buf, size_t buf_size) {
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+
+    int ret = mbedtls_ssl_session_load(&session, buf, buf_size);
+    if (ret == 0)
+        ret = mbedtls_ssl_set_session(&ssl_ctx->ssl, &session);
+
+    mbedtls_ssl_session_free(&session);
+    return mbedtls_to_pal_error(ret);
+}
+
+int lib_SSLSaveSession(LIB_SSL_CONTEXT* ssl_ctx, uint8_t* buf, size_t buf_size, size_t* out_size) {
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+
+    int ret = mbedtls_ssl_get_session(&ssl_ctx->ssl, &session);
+    if (ret == 0)
+        ret = mbedtls_ssl_session_save(&session, buf, buf_size, out_size);
+
+    mbedtls_ssl_session_free(&session);
+    if (ret == MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL)
+        return -PAL_ERROR_NOMEM;
+    return mbedtls_to_pal_error(ret);
+}
+
 int lib_SSLRead(LIB_SSL_CONTEXT* ssl_ctx, uint8_t* buf, size_t buf_size) {
     int ret = mbedtls_ssl_read(&ssl_ctx->ssl, buf, buf_size);
     if (ret < 0)
@@ -0,0 +1,417 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * AES-GCM based on AES-NI and PCLMULQDQ. mbedTLS's GCM (even with MBEDTLS_AESNI_C) encrypts and
+ * hashes one block at a time; here eight counter blocks are encrypted at once, interleaved with
+ * GHASH of eight ciphertext blocks, which are multiplied by precomputed powers of H and reduced
+ * only once. On CPUs with VAES and VPCLMULQDQ (e.g. Ice Lake), their 256-bit forms process two
+ * blocks per instruction. As in mbedtls_sha256_process.c, CPUID is executed only once, on first use.
+ *
+ * GHASH works on byte-reflected blocks; the multiplication and reduction follow "Intel
+ * Carry-Less Multiplication Instruction and its Usage for Computing the GCM Mode" (algorithms 1
+ * and 5, with the reduction deferred for aggregated products).
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <immintrin.h>
+
+#include "api.h"
+#include "assert.h"
+#include "cpu.h"
+#include "mbedtls/platform_util.h"
+#include "mbedtls_gcm_aesni.h"
+
+#define CPUID_FEATURE_PCLMULQDQ (1u << 1)  /* ECX of leaf 1 */
+#define CPUID_FEATURE_SSSE3     (1u << 9)  /* ECX of leaf 1 */
+#define CPUID_FEATURE_AESNI     (1u << 25) /* ECX of leaf 1 */
+#define CPUID_FEATURE_OSXSAVE   (1u << 27) /* ECX of leaf 1 */
+#define CPUID_FEATURE_AVX       (1u << 28) /* ECX of leaf 1 */
+
+#define CPUID_LEAF_EXT_FEATURES      7
+#define CPUID_EXT_FEATURE_AVX2       (1u << 5)  /* EBX */
+#define CPUID_EXT_FEATURE_VAES       (1u << 9)  /* ECX */
+#define CPUID_EXT_FEATURE_VPCLMULQDQ (1u << 10) /* ECX */
+
+#define XCR0_AVX_STATE 0x06 /* SSE and AVX */
+
+#define TARGET_AESNI "aes,pclmul,ssse3"
+#define TARGET_VAES  "aes,pclmul,ssse3,avx2,vaes,vpclmulqdq"
+
+#define GCM_BLOCK_SIZE 16
+#define GCM_STRIDE     8 /* blocks encrypted and hashed at once */
+#define AES_MAX_ROUNDS 14
+
+struct gcm_key {
+    __m128i rk[AES_MAX_ROUNDS + 1];
+    int nr;
+    __m128i h[GCM_STRIDE]; /* h[i] is H^(i+1), byte-reflected */
+};
+
+__attribute__((target(TARGET_AESNI)))
+static inline __m128i bswap128(__m128i x) {
+    return _mm_shuffle_epi8(x, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+}
+
+__attribute__((target(TARGET_AESNI)))
+static inline __m128i load_block(const uint8_t* data) {
+    return bswap128(_mm_loadu_si128((const __m128i*)data));
+}
+
+/* `ctr` is the byte-reflected counter block, so the 32-bit counter is its lowest dword */
+__attribute__((target(TARGET_AESNI)))
+static inline __m128i counter_block(__m128i ctr, int i) {
+    return bswap128(_mm_add_epi32(ctr, _mm_set_epi32(0, 0, 0, i)));
+}
+
+__attribute__((target(TARGET_AESNI)))
+static inline __m128i aes_encrypt(const struct gcm_key* key, __m128i block) {
+    block = _mm_xor_si128(block, key->rk[0]);
+    for (int r = 1; r < key->nr; r++)
+        block = _mm_aesenc_si128(block, key->rk[r]);
+    return _mm_aesenclast_si128(block, key->rk[key->nr]);
+}
+
+/* Accumulates the 256-bit carry-less product of `a` and `b` into `lo`, `mid` and `hi` */
+__attribute__((target(TARGET_AESNI)))
+static inline void clmul_acc(__m128i a, __m128i b, __m128i* lo, __m128i* mid, __m128i* hi) {
+    *lo  = _mm_xor_si128(*lo, _mm_clmulepi64_si128(a, b, 0x00));
+    *hi  = _mm_xor_si128(*hi, _mm_clmulepi64_si128(a, b, 0x11));
+    *mid = _mm_xor_si128(*mid, _mm_clmulepi64_si128(a, b, 0x01));
+    *mid = _mm_xor_si128(*mid, _mm_clmulepi64_si128(a, b, 0x10));
+}
+
+/* Reduces the (sum of) products accumulated by clmul_acc() modulo the GCM polynomial */
+__attribute__((target(TARGET_AESNI)))
+static inline __m128i ghash_reduce(__m128i lo, __m128i mid, __m128i hi) {
+    lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+    hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+    /* shift the 256-bit product left by one bit, as the operands are bit-reflected */
+    __m128i lo_carry = _mm_srli_epi32(lo, 31);
+    __m128i hi_carry = _mm_srli_epi32(hi, 31);
+    lo = _mm_slli_epi32(lo, 1);
+    hi = _mm_slli_epi32(hi, 1);
+    hi = _mm_or_si128(hi, _mm_srli_si128(lo_carry, 12));
+    hi = _mm_or_si128(hi, _mm_slli_si128(hi_carry, 4));
+    lo = _mm_or_si128(lo, _mm_slli_si128(lo_carry, 4));
+
+    /* reduce modulo x^128 + x^7 + x^2 + x + 1 */
+    __m128i t = _mm_xor_si128(_mm_slli_epi32(lo, 31), _mm_slli_epi32(lo, 30));
+    t = _mm_xor_si128(t, _mm_slli_epi32(lo, 25));
+    __m128i t_hi = _mm_srli_si128(t, 4);
+    lo = _mm_xor_si128(lo, _mm_slli_si128(t, 12));
+
+    __m128i u = _mm_xor_si128(_mm_srli_epi32(lo, 1), _mm_srli_epi32(lo, 2));
+    u = _mm_xor_si128(u, _mm_srli_epi32(lo, 7));
+    u = _mm_xor_si128(u, t_hi);
+    lo = _mm_xor_si128(lo, u);
+    return _mm_xor_si128(hi, lo);
+}
+
+__attribute__((target(TARGET_AESNI)))
+static inline __m128i gfmul(__m128i a, __m128i b) {
+    __m128i lo = _mm_setzero_si128();
+    __m128i mid = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+    clmul_acc(a, b, &lo, &mid, &hi);
+    return ghash_reduce(lo, mid, hi);
+}
+
+/* GHASH of GCM_STRIDE blocks at `data` into `x` */
+__attribute__((target(TARGET_AESNI)))
+static inline __m128i ghash_stride(const struct gcm_key* key, __m128i x, const uint8_t* data) {
+    __m128i lo = _mm_setzero_si128();
+    __m128i mid = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+    clmul_acc(_mm_xor_si128(x, load_block(data)), key->h[GCM_STRIDE - 1], &lo, &mid, &hi);
+    for (int i = 1; i < GCM_STRIDE; i++)
+        clmul_acc(load_block(data + i * GCM_BLOCK_SIZE), key->h[GCM_STRIDE - 1 - i], &lo, &mid,
+                  &hi);
+    return ghash_reduce(lo, mid, hi);
+}
+
+/* GHASH of `size` bytes at `data` into `x`, with the last block padded by zeros */
+__attribute__((target(TARGET_AESNI)))
+static __m128i ghash(const struct gcm_key* key, __m128i x, const uint8_t* data, size_t size) {
+    for (; size >= GCM_STRIDE * GCM_BLOCK_SIZE; size -= GCM_STRIDE * GCM_BLOCK_SIZE) {
+        x = ghash_stride(key, x, data);
+        data += GCM_STRIDE * GCM_BLOCK_SIZE;
+    }
+    for (; size >= GCM_BLOCK_SIZE; size -= GCM_BLOCK_SIZE) {
+        x = gfmul(_mm_xor_si128(x, load_block(data)), key->h[0]);
+        data += GCM_BLOCK_SIZE;
+    }
+    if (size) {
+        uint8_t block[GCM_BLOCK_SIZE] = {0};
+        memcpy(block, data, size);
+        x = gfmul(_mm_xor_si128(x, load_block(block)), key->h[0]);
+    }
+    return x;
+}
+
+/* CTR encryption and GHASH of the ciphertext, one block at a time, for the data after the last
+ * full stride */
+__attribute__((target(TARGET_AESNI)))
+static __m128i gcm_crypt_tail(const struct gcm_key* key, bool encrypt, __m128i* ctr, __m128i x,
+                              const uint8_t* input, size_t size, uint8_t* output) {
+    for (; size >= GCM_BLOCK_SIZE; size -= GCM_BLOCK_SIZE) {
+        __m128i in = _mm_loadu_si128((const __m128i*)input);
+        __m128i out = _mm_xor_si128(in, aes_encrypt(key, counter_block(*ctr, 0)));
+        *ctr = _mm_add_epi32(*ctr, _mm_set_epi32(0, 0, 0, 1));
+        _mm_storeu_si128((__m128i*)output, out);
+        x = gfmul(_mm_xor_si128(x, bswap128(encrypt ? out : in)), key->h[0]);
+        input += GCM_BLOCK_SIZE;
+        output += GCM_BLOCK_SIZE;
+    }
+    if (size) {
+        uint8_t block[GCM_BLOCK_SIZE] = {0};
+        memcpy(block, input, size);
+        __m128i in = _mm_loadu_si128((const __m128i*)block);
+        __m128i out = _mm_xor_si128(in, aes_encrypt(key, counter_block(*ctr, 0)));
+        _mm_storeu_si128((__m128i*)block, out);
+        memcpy(output, block, size);
+        if (encrypt) {
+            /* the ciphertext is hashed padded by zeros, not by the rest of the keystream */
+            memset(block + size, 0, sizeof(block) - size);
+            in = _mm_loadu_si128((const __m128i*)block);
+        }
+        x = gfmul(_mm_xor_si128(x, bswap128(in)), key->h[0]);
+        mbedtls_platform_zeroize(block, sizeof(block));
+    }
+    return x;
+}
+
+/*
+ * Encrypts the full strides of `input` and hashes the ciphertext. The AES rounds of one stride are
+ * interleaved with GHASH of a stride of ciphertext: of the same one when decrypting (the input) and
+ * of the previous one when encrypting (the output of the previous iteration). Returns the number of
+ * bytes processed.
+ */
+__attribute__((target(TARGET_AESNI)))
+static size_t gcm_crypt_strides_aesni(const struct gcm_key* key, bool encrypt, __m128i* ctr,
+                                      __m128i* x, const uint8_t* input, size_t size,
+                                      uint8_t* output) {
+    const size_t stride_size = GCM_STRIDE * GCM_BLOCK_SIZE;
+    const uint8_t* hashed = NULL;
+    size_t done = 0;
+
+    for (; size - done >= stride_size; done += stride_size) {
+        if (!encrypt)
+            hashed = input + done;
+
+        __m128i b[GCM_STRIDE];
+        for (int i = 0; i < GCM_STRIDE; i++)
+            b[i] = _mm_xor_si128(counter_block(*ctr, i), key->rk[0]);
+        *ctr = _mm_add_epi32(*ctr, _mm_set_epi32(0, 0, 0, GCM_STRIDE));
+
+        __m128i lo = _mm_setzero_si128();
+        __m128i mid = _mm_setzero_si128();
+        __m128i hi = _mm_setzero_si128();
+        /* AES-128 has ten rounds, the first GCM_STRIDE of them are stitched with GHASH */
+        for (int r = 1; r <= GCM_STRIDE; r++) {
+            for (int i = 0; i < GCM_STRIDE; i++)
+                b[i] = _mm_aesenc_si128(b[i], key->rk[r]);
+            if (hashed) {
+                __m128i c = load_block(hashed + (r - 1) * GCM_BLOCK_SIZE);
+                if (r == 1)
+                    c = _mm_xor_si128(c, *x);
+                clmul_acc(c, key->h[GCM_STRIDE - r], &lo, &mid, &hi);
+            }
+        }
+        for (int r = GCM_STRIDE + 1; r < key->nr; r++)
+            for (int i = 0; i < GCM_STRIDE; i++)
+                b[i] = _mm_aesenc_si128(b[i], key->rk[r]);
+        if (hashed)
+            *x = ghash_reduce(lo, mid, hi);
+
+        for (int i = 0; i < GCM_STRIDE; i++) {
+            __m128i in = _mm_loadu_si128((const __m128i*)(input + done) + i);
+            __m128i ks = _mm_aesenclast_si128(b[i], key->rk[key->nr]);
+            _mm_storeu_si128((__m128i*)(output + done) + i, _mm_xor_si128(in, ks));
+        }
+
+        if (encrypt)
+            hashed = output + done;
+    }
+
+    if (encrypt && hashed)
+        *x = ghash_stride(key, *x, hashed);
+    return done;
+}
+
+__attribute__((target(TARGET_VAES)))
+static inline __m256i bswap256(__m256i x) {
+    const __m256i mask = _mm256_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                                         0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    return _mm256_shuffle_epi8(x, mask);
+}
+
+__attribute__((target(TARGET_VAES)))
+static inline void clmul_acc256(__m256i a, __m256i b, __m256i* lo, __m256i* mid, __m256i* hi) {
+    *lo  = _mm256_xor_si256(*lo, _mm256_clmulepi64_epi128(a, b, 0x00));
+    *hi  = _mm256_xor_si256(*hi, _mm256_clmulepi64_epi128(a, b, 0x11));
+    *mid = _mm256_xor_si256(*mid, _mm256_clmulepi64_epi128(a, b, 0x01));
+    *mid = _mm256_xor_si256(*mid, _mm256_clmulepi64_epi128(a, b, 0x10));
+}
+
+__attribute__((target(TARGET_VAES)))
+static inline __m128i fold256(__m256i x) {
+    return _mm_xor_si128(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+}
+
+/* The same as gcm_crypt_strides_aesni(), with two blocks in each register */
+__attribute__((target(TARGET_VAES)))
+static size_t gcm_crypt_strides_vaes(const struct gcm_key* key, bool encrypt, __m128i* ctr,
+                                     __m128i* x, const uint8_t* input, size_t size,
+                                     uint8_t* output) {
+    const size_t stride_size = GCM_STRIDE * GCM_BLOCK_SIZE;
+    const int regs = GCM_STRIDE / 2;
+    const uint8_t* hashed = NULL;
+    size_t done = 0;
+
+    __m256i rk[AES_MAX_ROUNDS + 1];
+    for (int r = 0; r <= key->nr; r++)
+        rk[r] = _mm256_broadcastsi128_si256(key->rk[r]);
+    /* register i holds blocks 2i and 2i+1, which are multiplied by H^(8-2i) and H^(7-2i) */
+    __m256i h[GCM_STRIDE / 2];
+    for (int i = 0; i < regs; i++)
+        h[i] = _mm256_set_m128i(key->h[GCM_STRIDE - 2 - 2 * i], key->h[GCM_STRIDE - 1 - 2 * i]);
+    __m256i ctr_pair = _mm256_add_epi32(_mm256_broadcastsi128_si256(*ctr),
+                                        _mm256_set_epi32(0, 0, 0, 1, 0, 0, 0, 0));
+
+    for (; size - done >= stride_size; done += stride_size) {
+        if (!encrypt)
+            hashed = input + done;
+
+        __m256i b[GCM_STRIDE / 2];
+        for (int i = 0; i < regs; i++) {
+            __m256i c = _mm256_add_epi32(ctr_pair,
+                                         _mm256_set_epi32(0, 0, 0, 2 * i, 0, 0, 0, 2 * i));
+            b[i] = _mm256_xor_si256(bswap256(c), rk[0]);
+        }
+        ctr_pair = _mm256_add_epi32(ctr_pair, _mm256_set_epi32(0, 0, 0, GCM_STRIDE,
+                                                               0, 0, 0, GCM_STRIDE));
+
+        __m256i lo = _mm256_setzero_si256();
+        __m256i mid = _mm256_setzero_si256();
+        __m256i hi = _mm256_setzero_si256();
+        for (int r = 1; r <= regs; r++) {
+            for (int i = 0; i < regs; i++)
+                b[i] = _mm256_aesenc_epi128(b[i], rk[r]);
+            if (hashed) {
+                __m256i c = bswap256(_mm256_loadu_si256((const __m256i*)hashed + r - 1));
+                if (r == 1)
+                    c = _mm256_xor_si256(c, _mm256_set_m128i(_mm_setzero_si128(), *x));
+                clmul_acc256(c, h[r - 1], &lo, &mid, &hi);
+            }
+        }
+        for (int r = regs + 1; r < key->nr; r++)
+            for (int i = 0; i < regs; i++)
+                b[i] = _mm256_aesenc_epi128(b[i], rk[r]);
+        if (hashed)
+            *x = ghash_reduce(fold256(lo), fold256(mid), fold256(hi));
+
+        for (int i = 0; i < regs; i++) {
+            __m256i in = _mm256_loadu_si256((const __m256i*)(input + done) + i);
+            __m256i ks = _mm256_aesenclast_epi128(b[i], rk[key->nr]);
+            _mm256_storeu_si256((__m256i*)(output + done) + i, _mm256_xor_si256(in, ks));
+        }
+
+        if (encrypt)
+            hashed = output + done;
+    }
+
+    if (encrypt && hashed)
+        *x = ghash_stride(key, *x, hashed);
+    *ctr = _mm256_castsi256_si128(ctr_pair);
+
+    mbedtls_platform_zeroize(rk, sizeof(rk));
+    return done;
+}
+
+/* 0 = not checked yet, 1 = not supported, 2 = AES-NI and PCLMULQDQ, 3 = also VAES and VPCLMULQDQ */
+static int g_gcm_aesni_support = 0;
+
+static int gcm_aesni_support(void) {
+    int support = __atomic_load_n(&g_gcm_aesni_support, __ATOMIC_RELAXED);
+    if (!support) {
+        unsigned int words[4];
+        cpuid(/*leaf=*/1, /*subleaf=*/0, words);
+        unsigned int ecx = words[2];
+        bool has_aesni = (ecx & CPUID_FEATURE_AESNI) && (ecx & CPUID_FEATURE_PCLMULQDQ)
+                         && (ecx & CPUID_FEATURE_SSSE3);
+        bool has_avx = false;
+        if ((ecx & CPUID_FEATURE_OSXSAVE) && (ecx & CPUID_FEATURE_AVX)) {
+            uint32_t xcr0_lo, xcr0_hi;
+            __asm__ volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+            has_avx = (xcr0_lo & XCR0_AVX_STATE) == XCR0_AVX_STATE;
+        }
+
+        cpuid(CPUID_LEAF_EXT_FEATURES, /*subleaf=*/0, words);
+        bool has_vaes = has_avx && (words[1] & CPUID_EXT_FEATURE_AVX2)
+                        && (words[2] & CPUID_EXT_FEATURE_VAES)
+                        && (words[2] & CPUID_EXT_FEATURE_VPCLMULQDQ);
+
+        support = !has_aesni ? 1 : has_vaes ? 3 : 2;
+        __atomic_store_n(&g_gcm_aesni_support, support, __ATOMIC_RELAXED);
+    }
+    return support;
+}
+
+bool gcm_aesni_supported(void) {
+    return gcm_aesni_support() >= 2;
+}
+
+__attribute__((target(TARGET_AESNI)))
+static void gcm_key_init(struct gcm_key* key, const mbedtls_aes_context* aes) {
+    /* mbedTLS keeps the round keys in the byte order which AESENC expects */
+    key->nr = aes->nr;
+    for (int r = 0; r <= AES_MAX_ROUNDS; r++)
+        key->rk[r] = r <= aes->nr ? _mm_loadu_si128((const __m128i*)aes->rk + r)
+                                  : _mm_setzero_si128();
+
+    __m128i h = bswap128(aes_encrypt(key, _mm_setzero_si128()));
+    key->h[0] = h;
+    for (int i = 1; i < GCM_STRIDE; i++)
+        key->h[i] = gfmul(key->h[i - 1], h);
+}
+
+__attribute__((target(TARGET_AESNI)))
+void gcm_aesni_crypt(const mbedtls_aes_context* aes, bool encrypt,
+                     const uint8_t iv[GCM_AESNI_IV_SIZE], const uint8_t* input, size_t input_size,
+                     const uint8_t* aad, size_t aad_size, uint8_t* output,
+                     uint8_t tag[GCM_AESNI_TAG_SIZE]) {
+    assert(gcm_aesni_supported());
+    assert(aes->nr >= 10 && aes->nr <= AES_MAX_ROUNDS);
+
+    struct gcm_key key;
+    gcm_key_init(&key, aes);
+
+    /* J0 = IV || 0^31 || 1, the data is encrypted starting with inc32(J0) */
+    uint8_t j0_bytes[GCM_BLOCK_SIZE] = {0};
+    memcpy(j0_bytes, iv, GCM_AESNI_IV_SIZE);
+    j0_bytes[GCM_BLOCK_SIZE - 1] = 1;
+    __m128i j0 = _mm_loadu_si128((const __m128i*)j0_bytes);
+    __m128i ctr = _mm_add_epi32(bswap128(j0), _mm_set_epi32(0, 0, 0, 1));
+
+    __m128i x = ghash(&key, _mm_setzero_si128(), aad, aad_size);
+
+    size_t done;
+    if (gcm_aesni_support() == 3) {
+        done = gcm_crypt_strides_vaes(&key, encrypt, &ctr, &x, input, input_size, output);
+    } else {
+        done = gcm_crypt_strides_aesni(&key, encrypt, &ctr, &x, input, input_size, output);
+    }
+    x = gcm_crypt_tail(&key, encrypt, &ctr, x, input + done, input_size - done, output + done);
+
+    /* the lengths block, byte-reflected: len(A) || len(C) in bits */
+    __m128i lengths = _mm_set_epi64x((uint64_t)aad_size * BITS_IN_BYTE,
+                                     (uint64_t)input_size * BITS_IN_BYTE);
+    x = gfmul(_mm_xor_si128(x, lengths), key.h[0]);
+    _mm_storeu_si128((__m128i*)tag, _mm_xor_si128(bswap128(x), aes_encrypt(&key, j0)));
+
+    mbedtls_platform_zeroize(&key, sizeof(key));
+}
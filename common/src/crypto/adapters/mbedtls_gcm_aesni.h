@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * AES-GCM with 96-bit IVs based on AES-NI and PCLMULQDQ, used by lib_AESGCMEncrypt() and
+ * lib_AESGCMDecrypt() instead of mbedTLS's GCM when the CPU supports them.
+ */
+
+#ifndef MBEDTLS_GCM_AESNI_H
+#define MBEDTLS_GCM_AESNI_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mbedtls/aes.h"
+
+#define GCM_AESNI_IV_SIZE  12
+#define GCM_AESNI_TAG_SIZE 16
+
+bool gcm_aesni_supported(void);
+
+/* `aes` must be set up by mbedtls_aes_setkey_enc(). Computes the full tag, which the caller
+ * truncates (or compares with the expected one). `output` may be the same as `input`. */
+void gcm_aesni_crypt(const mbedtls_aes_context* aes, bool encrypt,
+                     const uint8_t iv[GCM_AESNI_IV_SIZE], const uint8_t* input, size_t input_size,
+                     const uint8_t* aad, size_t aad_size, uint8_t* output,
+                     uint8_t tag[GCM_AESNI_TAG_SIZE]);
+
+#endif /* MBEDTLS_GCM_AESNI_H */
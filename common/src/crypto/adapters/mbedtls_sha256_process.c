@@ -0,0 +1,163 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * SHA-256 compression function for mbedTLS (MBEDTLS_SHA256_PROCESS_ALT). mbedTLS calls it for every
+ * 64-byte block; we dispatch at runtime to an implementation based on the Intel SHA extensions
+ * (SHA-NI) if the CPU supports them and fall back to portable C code otherwise. Note that CPUID is
+ * executed only once, on first use (inside SGX enclaves, it is emulated by the PAL).
+ */
+
+#include <stdint.h>
+
+#include <immintrin.h>
+
+#include "api.h"
+#include "cpu.h"
+#include "mbedtls/sha256.h"
+
+#define CPUID_LEAF_EXT_FEATURES 7
+#define CPUID_EXT_FEATURE_SHA   (1u << 29) /* EBX */
+#define CPUID_FEATURE_SSE4_1    (1u << 19) /* ECX of leaf 1 */
+
+static const uint32_t g_sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_process_generic(uint32_t state[8], const unsigned char data[64]) {
+    uint32_t w[64];
+    for (size_t i = 0; i < 16; i++) {
+        w[i] = (uint32_t)data[i * 4] << 24 | (uint32_t)data[i * 4 + 1] << 16
+               | (uint32_t)data[i * 4 + 2] << 8 | (uint32_t)data[i * 4 + 3];
+    }
+    for (size_t i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (size_t i = 0; i < 64; i++) {
+        uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g))
+                      + g_sha256_k[i] + w[i];
+        uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+/* Four rounds on message words `msg` (already with the round constants `k` added to them) */
+#define SHA_NI_ROUNDS4(msg, k)                                      \
+    do {                                                            \
+        __m128i _wk = _mm_add_epi32(msg, _mm_loadu_si128(k));       \
+        state1 = _mm_sha256rnds2_epu32(state1, state0, _wk);        \
+        _wk = _mm_shuffle_epi32(_wk, 0x0E);                         \
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _wk);        \
+    } while (0)
+
+/* Computes the next four message words from the previous sixteen (in `m0`..`m3`) into `m0` */
+#define SHA_NI_SCHEDULE(m0, m1, m2, m3)                             \
+    do {                                                            \
+        m0 = _mm_sha256msg1_epu32(m0, m1);                          \
+        m0 = _mm_add_epi32(m0, _mm_alignr_epi8(m3, m2, 4));         \
+        m0 = _mm_sha256msg2_epu32(m0, m3);                          \
+    } while (0)
+
+__attribute__((target("sha,sse4.1")))
+static void sha256_process_sha_ni(uint32_t state[8], const unsigned char data[64]) {
+    const __m128i byteswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    const __m128i* k = (const __m128i*)g_sha256_k;
+
+    /* SHA-NI instructions expect the state as ABEF and CDGH */
+    __m128i tmp    = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xB1); /* CDAB */
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1B); /* EFGH */
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);    /* ABEF */
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);         /* CDGH */
+
+    __m128i abef_save = state0;
+    __m128i cdgh_save = state1;
+
+    __m128i m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 0)), byteswap);
+    __m128i m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), byteswap);
+    __m128i m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), byteswap);
+    __m128i m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), byteswap);
+
+    SHA_NI_ROUNDS4(m0, &k[0]);
+    SHA_NI_ROUNDS4(m1, &k[1]);
+    SHA_NI_ROUNDS4(m2, &k[2]);
+    SHA_NI_ROUNDS4(m3, &k[3]);
+    for (size_t i = 4; i < 16; i += 4) {
+        SHA_NI_SCHEDULE(m0, m1, m2, m3);
+        SHA_NI_ROUNDS4(m0, &k[i]);
+        SHA_NI_SCHEDULE(m1, m2, m3, m0);
+        SHA_NI_ROUNDS4(m1, &k[i + 1]);
+        SHA_NI_SCHEDULE(m2, m3, m0, m1);
+        SHA_NI_ROUNDS4(m2, &k[i + 2]);
+        SHA_NI_SCHEDULE(m3, m0, m1, m2);
+        SHA_NI_ROUNDS4(m3, &k[i + 3]);
+    }
+
+    state0 = _mm_add_epi32(state0, abef_save);
+    state1 = _mm_add_epi32(state1, cdgh_save);
+
+    /* convert back from ABEF and CDGH to ABCD and EFGH */
+    tmp    = _mm_shuffle_epi32(state0, 0x1B);            /* FEBA */
+    state1 = _mm_shuffle_epi32(state1, 0xB1);            /* DCHG */
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);         /* DCBA */
+    state1 = _mm_alignr_epi8(state1, tmp, 8);            /* ABEF -> HGFE */
+
+    _mm_storeu_si128((__m128i*)&state[0], state0);
+    _mm_storeu_si128((__m128i*)&state[4], state1);
+}
+
+/* 0 = not checked yet, 1 = SHA-NI is not supported, 2 = SHA-NI is supported */
+static int g_sha_ni_support = 0;
+
+static bool sha_ni_supported(void) {
+    int support = __atomic_load_n(&g_sha_ni_support, __ATOMIC_RELAXED);
+    if (!support) {
+        unsigned int words[4];
+        cpuid(/*leaf=*/1, /*subleaf=*/0, words);
+        bool has_sse4_1 = words[2] & CPUID_FEATURE_SSE4_1;
+        cpuid(CPUID_LEAF_EXT_FEATURES, /*subleaf=*/0, words);
+        bool has_sha = words[1] & CPUID_EXT_FEATURE_SHA;
+
+        support = has_sse4_1 && has_sha ? 2 : 1;
+        __atomic_store_n(&g_sha_ni_support, support, __ATOMIC_RELAXED);
+    }
+    return support == 2;
+}
+
+int mbedtls_internal_sha256_process(mbedtls_sha256_context* ctx, const unsigned char data[64]) {
+    if (sha_ni_supported()) {
+        sha256_process_sha_ni(ctx->state, data);
+    } else {
+        sha256_process_generic(ctx->state, data);
+    }
+    return 0;
+}
@@ -35,10 +35,14 @@
 #define MBEDTLS_PLATFORM_C
 #define MBEDTLS_RSA_C
 #define MBEDTLS_SHA256_C
+/* SHA-NI with runtime dispatch, see adapters/mbedtls_sha256_process.c */
+#define MBEDTLS_SHA256_PROCESS_ALT
 #define MBEDTLS_SSL_CIPHERSUITES MBEDTLS_TLS_PSK_WITH_AES_128_GCM_SHA256
 #define MBEDTLS_SSL_CLI_C
 #define MBEDTLS_SSL_CONTEXT_SERIALIZATION
 #define MBEDTLS_SSL_PROTO_TLS1_2
+/* session resumption with tickets, encrypted by lib_SSLInit() callbacks (no MBEDTLS_SSL_TICKET_C) */
+#define MBEDTLS_SSL_SESSION_TICKETS
 #define MBEDTLS_SSL_SRV_C
 #define MBEDTLS_SSL_TLS_C
 
@@ -3,8 +3,9 @@
 #include <stdint.h>
 
 #include "api.h"
+#include "string_ops.h"
 
-int memcmp(const void* lhs, const void* rhs, size_t count) {
+int memcmp_baseline(const void* lhs, const void* rhs, size_t count) {
     const unsigned char* l = lhs;
     const unsigned char* r = rhs;
     while (count && *l == *r) {
@@ -14,3 +15,7 @@ int memcmp(const void* lhs, const void* rhs, size_t count) {
     }
     return count ? *l - *r : 0;
 }
+
+int memcmp(const void* lhs, const void* rhs, size_t count) {
+    return g_string_ops.memcmp(lhs, rhs, count);
+}
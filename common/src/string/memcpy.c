@@ -5,11 +5,12 @@
 #include "api.h"
 #include "assert.h"
 #include "log.h"
+#include "string_ops.h"
 
 #undef memcpy
 #undef memmove
 
-void* memcpy(void* restrict dest, const void* restrict src, size_t count) {
+void* memcpy_baseline(void* restrict dest, const void* restrict src, size_t count) {
     char* d = dest;
 #if defined(__x86_64__)
     /* "Beginning with processors based on Intel microarchitecture code name Ivy Bridge, REP string
@@ -29,6 +30,10 @@ void* memcpy(void* restrict dest, const void* restrict src, size_t count) {
     return dest;
 }
 
+void* memcpy(void* restrict dest, const void* restrict src, size_t count) {
+    return g_string_ops.memcpy(dest, src, count);
+}
+
 void* __memcpy_chk(void* restrict dest, const void* restrict src, size_t count, size_t dest_count) {
     if (count > dest_count) {
         log_always("memcpy() check failed\n");
@@ -8,10 +8,11 @@
 #include "api.h"
 #include "assert.h"
 #include "log.h"
+#include "string_ops.h"
 
 #undef memset
 
-void* memset(void* dest, int ch, size_t count) {
+void* memset_baseline(void* dest, int ch, size_t count) {
     char* d = dest;
 #if defined(__x86_64__)
     /* "Beginning with processors based on Intel microarchitecture code name Ivy Bridge, REP string
@@ -27,6 +28,10 @@ void* memset(void* dest, int ch, size_t count) {
     return dest;
 }
 
+void* memset(void* dest, int ch, size_t count) {
+    return g_string_ops.memset(dest, ch, count);
+}
+
 void* __memset_chk(void* dest, int ch, size_t count, size_t dest_count) {
     if (count > dest_count) {
         log_always("memset() check failed\n");
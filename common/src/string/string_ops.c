@@ -0,0 +1,339 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * AVX2 and AVX-512 implementations of memcpy(), memset(), memcmp() and strnlen(), and the selection
+ * of implementations. The baseline ones (REP MOVSB/STOSB and C loops) are in memcpy.c etc.
+ *
+ * Sizes up to two vectors are handled with (possibly overlapping) unaligned accesses to the first
+ * and last bytes, larger ones with a loop over aligned destination vectors. Copies of at least
+ * MEMCPY_NT_THRESHOLD bytes (e.g. of large I/O buffers into and out of the SGX enclave) use
+ * non-temporal stores, so that they don't evict the whole cache. strnlen() reads only aligned
+ * vectors, which never cross a page boundary, so it doesn't touch pages the string doesn't reach
+ * into.
+ *
+ * The vector code uses GCC vector extensions and builtins in functions compiled for the given ISA,
+ * but not <immintrin.h>, which pulls in libc headers. LibOS and PAL may clobber the extended state
+ * of the application (see syscallas.S).
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "api.h"
+#include "string_ops.h"
+
+#if defined(__x86_64__)
+#include "cpu.h"
+#endif
+
+struct string_ops g_string_ops = {
+    .memcpy  = memcpy_baseline,
+    .memset  = memset_baseline,
+    .memcmp  = memcmp_baseline,
+    .strnlen = strnlen_baseline,
+};
+
+#if defined(__x86_64__)
+
+#define MEMCPY_NT_THRESHOLD (4 * 1024 * 1024)
+
+#define CPUID_1_ECX_OSXSAVE (1U << 27)
+#define CPUID_1_ECX_AVX     (1U << 28)
+#define CPUID_7_EBX_AVX2    (1U << 5)
+#define CPUID_7_EBX_AVX512F (1U << 16)
+
+#define XCR0_AVX_STATE    0x06 /* SSE and AVX */
+#define XCR0_AVX512_STATE 0xe6 /* SSE, AVX, opmask and ZMM */
+
+typedef char v16qi __attribute__((vector_size(16)));
+typedef char v32qi __attribute__((vector_size(32)));
+typedef char v64qi __attribute__((vector_size(64)));
+
+/* for unaligned and aligned accesses */
+typedef v16qi v16qi_u __attribute__((aligned(1), may_alias));
+typedef v32qi v32qi_u __attribute__((aligned(1), may_alias));
+typedef v32qi v32qi_a __attribute__((aligned(32), may_alias));
+typedef v64qi v64qi_u __attribute__((aligned(1), may_alias));
+typedef v64qi v64qi_a __attribute__((aligned(64), may_alias));
+typedef uint64_t u64_u __attribute__((aligned(1), may_alias));
+typedef uint32_t u32_u __attribute__((aligned(1), may_alias));
+
+static inline void copy_small(char* d, const char* s, size_t count) {
+    assert(count <= 32);
+    if (count >= 16) {
+        v16qi head = *(const v16qi_u*)s;
+        v16qi tail = *(const v16qi_u*)(s + count - 16);
+        *(v16qi_u*)d = head;
+        *(v16qi_u*)(d + count - 16) = tail;
+    } else if (count >= 8) {
+        uint64_t head = *(const u64_u*)s;
+        uint64_t tail = *(const u64_u*)(s + count - 8);
+        *(u64_u*)d = head;
+        *(u64_u*)(d + count - 8) = tail;
+    } else if (count >= 4) {
+        uint32_t head = *(const u32_u*)s;
+        uint32_t tail = *(const u32_u*)(s + count - 4);
+        *(u32_u*)d = head;
+        *(u32_u*)(d + count - 4) = tail;
+    } else if (count) {
+        char a = s[0], b = s[count / 2], c = s[count - 1];
+        d[0] = a;
+        d[count / 2] = b;
+        d[count - 1] = c;
+    }
+}
+
+static inline void set_small(char* d, char ch, size_t count) {
+    assert(count <= 32);
+    if (count >= 16) {
+        v16qi v = {0};
+        v += ch;
+        *(v16qi_u*)d = v;
+        *(v16qi_u*)(d + count - 16) = v;
+    } else if (count >= 8) {
+        uint64_t v = 0x0101010101010101UL * (uint8_t)ch;
+        *(u64_u*)d = v;
+        *(u64_u*)(d + count - 8) = v;
+    } else if (count >= 4) {
+        uint32_t v = 0x01010101U * (uint8_t)ch;
+        *(u32_u*)d = v;
+        *(u32_u*)(d + count - 4) = v;
+    } else if (count) {
+        d[0] = ch;
+        d[count / 2] = ch;
+        d[count - 1] = ch;
+    }
+}
+
+__attribute__((target("avx2")))
+static void* memcpy_avx2(void* restrict dest, const void* restrict src, size_t count) {
+    char* d = dest;
+    const char* s = src;
+    if (count <= 32) {
+        copy_small(d, s, count);
+        return dest;
+    }
+
+    v32qi head = *(const v32qi_u*)s;
+    v32qi tail = *(const v32qi_u*)(s + count - 32);
+    char* end = d + count - 32;
+    if (count > 64) {
+        /* aligned stores between the head and the tail */
+        size_t skew = 32 - ((uintptr_t)d & 31);
+        char* p = d + skew;
+        const char* q = s + skew;
+        if (count >= MEMCPY_NT_THRESHOLD) {
+            for (; p < end; p += 32, q += 32)
+                __asm__ volatile("vmovntdq %1, %0" : "=m"(*(v32qi_a*)p) : "x"(*(const v32qi_u*)q));
+            __asm__ volatile("sfence" ::: "memory");
+        } else {
+            for (; end - p > 128; p += 128, q += 128) {
+                v32qi a = *(const v32qi_u*)q;
+                v32qi b = *(const v32qi_u*)(q + 32);
+                v32qi c = *(const v32qi_u*)(q + 64);
+                v32qi e = *(const v32qi_u*)(q + 96);
+                *(v32qi_a*)p = a;
+                *(v32qi_a*)(p + 32) = b;
+                *(v32qi_a*)(p + 64) = c;
+                *(v32qi_a*)(p + 96) = e;
+            }
+            for (; p < end; p += 32, q += 32)
+                *(v32qi_a*)p = *(const v32qi_u*)q;
+        }
+    }
+    *(v32qi_u*)d = head;
+    *(v32qi_u*)end = tail;
+    return dest;
+}
+
+__attribute__((target("avx2")))
+static void* memset_avx2(void* dest, int ch, size_t count) {
+    char* d = dest;
+    if (count <= 32) {
+        set_small(d, ch, count);
+        return dest;
+    }
+
+    v32qi v = {0};
+    v += (char)ch;
+    char* end = d + count - 32;
+    for (char* p = d + 32 - ((uintptr_t)d & 31); p < end; p += 32)
+        *(v32qi_a*)p = v;
+    *(v32qi_u*)d = v;
+    *(v32qi_u*)end = v;
+    return dest;
+}
+
+__attribute__((target("avx2")))
+static int memcmp_avx2(const void* lhs, const void* rhs, size_t count) {
+    const unsigned char* l = lhs;
+    const unsigned char* r = rhs;
+    if (count < 32) {
+        for (; count >= 8; count -= 8, l += 8, r += 8) {
+            uint64_t a = *(const u64_u*)l;
+            uint64_t b = *(const u64_u*)r;
+            if (a != b) {
+                /* the first differing byte decides, so compare them as big-endian */
+                return __builtin_bswap64(a) < __builtin_bswap64(b) ? -1 : 1;
+            }
+        }
+        for (; count; count--, l++, r++)
+            if (*l != *r)
+                return *l - *r;
+        return 0;
+    }
+
+    for (size_t off = 0;; off += 32) {
+        /* the last vector overlaps the previous one */
+        if (off + 32 > count)
+            off = count - 32;
+        v32qi a = *(const v32qi_u*)(l + off);
+        v32qi b = *(const v32qi_u*)(r + off);
+        unsigned int equal = __builtin_ia32_pmovmskb256((v32qi)(a == b));
+        if (equal != 0xffffffff) {
+            size_t i = off + __builtin_ctz(~equal);
+            return l[i] - r[i];
+        }
+        if (off + 32 == count)
+            return 0;
+    }
+}
+
+__attribute__((target("avx2")))
+static size_t strnlen_avx2(const char* str, size_t maxlen) {
+    if (!maxlen)
+        return 0;
+
+    v32qi zero = {0};
+    const char* p = (const char*)((uintptr_t)str & ~31UL);
+    unsigned int nul = __builtin_ia32_pmovmskb256((v32qi)(*(const v32qi_a*)p == zero));
+    nul >>= str - p;
+    if (nul)
+        return MIN((size_t)__builtin_ctz(nul), maxlen);
+
+    /* `str + len` is aligned from now on */
+    for (size_t len = 32 - (str - p); len < maxlen; len += 32) {
+        nul = __builtin_ia32_pmovmskb256((v32qi)(*(const v32qi_a*)(str + len) == zero));
+        if (nul)
+            return MIN(len + __builtin_ctz(nul), maxlen);
+    }
+    return maxlen;
+}
+
+__attribute__((target("avx512f")))
+static void* memcpy_avx512(void* restrict dest, const void* restrict src, size_t count) {
+    if (count <= 128)
+        return memcpy_avx2(dest, src, count);
+
+    char* d = dest;
+    const char* s = src;
+    v64qi head = *(const v64qi_u*)s;
+    v64qi tail = *(const v64qi_u*)(s + count - 64);
+    char* end = d + count - 64;
+    size_t skew = 64 - ((uintptr_t)d & 63);
+    char* p = d + skew;
+    const char* q = s + skew;
+    if (count >= MEMCPY_NT_THRESHOLD) {
+        for (; p < end; p += 64, q += 64)
+            __asm__ volatile("vmovntdq %1, %0" : "=m"(*(v64qi_a*)p) : "v"(*(const v64qi_u*)q));
+        __asm__ volatile("sfence" ::: "memory");
+    } else {
+        for (; end - p > 256; p += 256, q += 256) {
+            v64qi a = *(const v64qi_u*)q;
+            v64qi b = *(const v64qi_u*)(q + 64);
+            v64qi c = *(const v64qi_u*)(q + 128);
+            v64qi e = *(const v64qi_u*)(q + 192);
+            *(v64qi_a*)p = a;
+            *(v64qi_a*)(p + 64) = b;
+            *(v64qi_a*)(p + 128) = c;
+            *(v64qi_a*)(p + 192) = e;
+        }
+        for (; p < end; p += 64, q += 64)
+            *(v64qi_a*)p = *(const v64qi_u*)q;
+    }
+    *(v64qi_u*)d = head;
+    *(v64qi_u*)end = tail;
+    return dest;
+}
+
+__attribute__((target("avx512f")))
+static void* memset_avx512(void* dest, int ch, size_t count) {
+    if (count <= 128)
+        return memset_avx2(dest, ch, count);
+
+    char* d = dest;
+    v64qi v = {0};
+    v += (char)ch;
+    char* end = d + count - 64;
+    for (char* p = d + 64 - ((uintptr_t)d & 63); p < end; p += 64)
+        *(v64qi_a*)p = v;
+    *(v64qi_u*)d = v;
+    *(v64qi_u*)end = v;
+    return dest;
+}
+
+static uint64_t xgetbv(uint32_t index) {
+    uint32_t eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(index));
+    return eax | (uint64_t)edx << 32;
+}
+
+static enum string_ops_level cpu_string_ops_level(int (*cpuid)(unsigned int leaf,
+                                                                unsigned int subleaf,
+                                                                unsigned int values[4])) {
+    unsigned int leaf0[CPUID_WORD_NUM];
+    unsigned int leaf1[CPUID_WORD_NUM];
+    unsigned int leaf7[CPUID_WORD_NUM];
+    if (cpuid(0x0, 0, leaf0) < 0 || leaf0[CPUID_WORD_EAX] < 0x7 || cpuid(0x1, 0, leaf1) < 0
+            || cpuid(0x7, 0, leaf7) < 0)
+        return STRING_OPS_BASELINE;
+
+    /* the OS (or the SGX enclave, through XFRM) must have enabled the extended state */
+    if (!(leaf1[CPUID_WORD_ECX] & CPUID_1_ECX_OSXSAVE) || !(leaf1[CPUID_WORD_ECX] & CPUID_1_ECX_AVX)
+            || !(leaf7[CPUID_WORD_EBX] & CPUID_7_EBX_AVX2))
+        return STRING_OPS_BASELINE;
+    uint64_t xcr0 = xgetbv(0);
+    if ((xcr0 & XCR0_AVX_STATE) != XCR0_AVX_STATE)
+        return STRING_OPS_BASELINE;
+
+    if (!(leaf7[CPUID_WORD_EBX] & CPUID_7_EBX_AVX512F)
+            || (xcr0 & XCR0_AVX512_STATE) != XCR0_AVX512_STATE)
+        return STRING_OPS_AVX2;
+    return STRING_OPS_AVX512;
+}
+
+#endif /* __x86_64__ */
+
+enum string_ops_level init_string_ops(int (*cpuid)(unsigned int leaf, unsigned int subleaf,
+                                                   unsigned int values[4]),
+                                      enum string_ops_level max_level) {
+    enum string_ops_level level = STRING_OPS_BASELINE;
+#if defined(__x86_64__)
+    level = MIN(cpu_string_ops_level(cpuid), max_level);
+#else
+    __UNUSED(cpuid);
+    __UNUSED(max_level);
+#endif
+
+    switch (level) {
+        case STRING_OPS_BASELINE:
+            g_string_ops.memcpy  = memcpy_baseline;
+            g_string_ops.memset  = memset_baseline;
+            g_string_ops.memcmp  = memcmp_baseline;
+            g_string_ops.strnlen = strnlen_baseline;
+            break;
+#if defined(__x86_64__)
+        case STRING_OPS_AVX2:
+        case STRING_OPS_AVX512:
+            g_string_ops.memcpy  = level == STRING_OPS_AVX512 ? memcpy_avx512 : memcpy_avx2;
+            g_string_ops.memset  = level == STRING_OPS_AVX512 ? memset_avx512 : memset_avx2;
+            g_string_ops.memcmp  = memcmp_avx2;
+            g_string_ops.strnlen = strnlen_avx2;
+            break;
+#endif
+        default:
+            break;
+    }
+    return level;
+}
@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * Implementations of memcpy(), memset(), memcmp() and strnlen() (which the rest of string functions
+ * build on), selected by init_string_ops(). Private to common/src/string.
+ */
+
+#ifndef STRING_OPS_H
+#define STRING_OPS_H
+
+#include <stddef.h>
+
+struct string_ops {
+    void* (*memcpy)(void* restrict dest, const void* restrict src, size_t count);
+    void* (*memset)(void* dest, int ch, size_t count);
+    int (*memcmp)(const void* lhs, const void* rhs, size_t count);
+    size_t (*strnlen)(const char* str, size_t maxlen);
+};
+
+extern struct string_ops g_string_ops;
+
+void* memcpy_baseline(void* restrict dest, const void* restrict src, size_t count);
+void* memset_baseline(void* dest, int ch, size_t count);
+int memcmp_baseline(const void* lhs, const void* rhs, size_t count);
+size_t strnlen_baseline(const char* str, size_t maxlen);
+
+#endif /* STRING_OPS_H */
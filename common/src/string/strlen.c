@@ -22,10 +22,11 @@
    Boston, MA 02111-1307, USA.  */
 
 #include "api.h"
+#include "string_ops.h"
 
 /* Find the length of S, but scan at most MAXLEN characters.  If no
    '\0' terminator is found in that many characters, return MAXLEN.  */
-size_t strnlen(const char* str, size_t maxlen) {
+size_t strnlen_baseline(const char* str, size_t maxlen) {
     const char *char_ptr, *end_ptr = str + maxlen;
     const unsigned long int* longword_ptr;
     unsigned long int longword, himagic, lomagic;
@@ -147,6 +148,10 @@ size_t strnlen(const char* str, size_t maxlen) {
     return char_ptr - str;
 }
 
+size_t strnlen(const char* str, size_t maxlen) {
+    return g_string_ops.strnlen(str, maxlen);
+}
+
 size_t strlen(const char* str) {
     return strnlen(str, -1);
 }
@@ -5,8 +5,11 @@
 #                    Michał Kowalczyk <mkow@invisiblethingslab.com>
 
 import argparse
+from concurrent.futures import ThreadPoolExecutor
 import datetime
+import fnmatch
 import hashlib
+import json
 import os
 from pathlib import Path
 import struct
@@ -33,7 +36,9 @@ DEFAULT_THREAD_NUM = 4
 
 # Utilities
 
-ZERO_PAGE = bytes(offs.PAGESIZE)
+HASH_READ_SIZE = 1024 * 1024
+
+TRUSTED_FILES_IMAGE_MAGIC = b'GSGXTFI2'
 
 
 def roundup(addr):
@@ -156,8 +161,153 @@ def sha256(data):
 
 
 def get_hash(filename):
+    # hashlib releases the GIL while hashing large buffers, so this runs in parallel in threads
+    sha = hashlib.sha256()
     with open(filename, 'rb') as file:
-        return sha256(file.read())
+        while True:
+            data = file.read(HASH_READ_SIZE)
+            if not data:
+                break
+            sha.update(data)
+    return sha.digest()
+
+
+class HashCache:
+    # Hashes of trusted files from previous runs, stored as JSON. An entry is only used if the
+    # file still has the same size, mtime and inode, so a file replaced or modified in the meantime
+    # (by anything that updates the mtime) is hashed again. `get_hash()` is called from the hashing
+    # threads, which only ever add distinct entries.
+    def __init__(self, path):
+        self.path = path
+        self.entries = {}
+        self.dirty = False
+        try:
+            with open(path, 'r', encoding='UTF-8') as file:
+                self.entries = json.load(file)
+        except (FileNotFoundError, json.JSONDecodeError):
+            pass
+
+    @staticmethod
+    def _stat_key(stat):
+        return [stat.st_size, stat.st_mtime_ns, stat.st_ino]
+
+    def get_hash(self, filename):
+        path = os.path.abspath(filename)
+        stat = os.stat(path)
+        entry = self.entries.get(path)
+        if entry is not None and entry[:3] == self._stat_key(stat):
+            return bytes.fromhex(entry[3])
+
+        hash_ = get_hash(path)
+        self.entries[path] = self._stat_key(stat) + [hash_.hex()]
+        self.dirty = True
+        return hash_
+
+    def save(self):
+        if not self.dirty:
+            return
+        tmp_path = f'{self.path}.tmp'
+        with open(tmp_path, 'w', encoding='UTF-8') as file:
+            json.dump(self.entries, file)
+        os.replace(tmp_path, self.path)
+        self.dirty = False
+
+
+def parse_chunk_size(value):
+    chunk_size = parse_size(value) if isinstance(value, str) else value
+    if (not isinstance(chunk_size, int) or chunk_size < offs.PAGESIZE
+            or chunk_size > offs.TRUSTED_CHUNK_SIZE_MAX or chunk_size & (chunk_size - 1)):
+        raise ManifestError(f'Invalid trusted chunk size {value!r} (must be a power of two between '
+                            f'{offs.PAGESIZE} and {offs.TRUSTED_CHUNK_SIZE_MAX})')
+    return chunk_size
+
+
+def get_chunk_sizes(manifest, trusted_files):
+    # Chunk size of each trusted file: `sgx.trusted_chunk_size` of its key (directories pass theirs
+    # to the files in them, see get_trusted_files()), else the first of
+    # `sgx.trusted_chunk_size_patterns` matching its URI, else the default. The PAL reads only the
+    # per-file entries, so the patterns are dropped and only non-default sizes are written back.
+    manifest_sgx = manifest['sgx']
+    per_file = manifest_sgx['trusted_chunk_size']
+    patterns = [(pattern, parse_chunk_size(value))
+                for pattern, value in manifest_sgx.pop('trusted_chunk_size_patterns').items()]
+
+    chunk_sizes = {}
+    for key, (uri, _, _) in trusted_files:
+        if key in per_file:
+            chunk_sizes[key] = parse_chunk_size(per_file[key])
+            continue
+        chunk_sizes[key] = next((size for pattern, size in patterns
+                                 if fnmatch.fnmatchcase(uri, pattern)), offs.TRUSTED_CHUNK_SIZE)
+
+    manifest_sgx['trusted_chunk_size'] = {key: str(size) for key, size in chunk_sizes.items()
+                                          if size != offs.TRUSTED_CHUNK_SIZE}
+    return chunk_sizes
+
+
+def get_chunk_table(filename, chunk_size):
+    # Chunk table for lazy verification of trusted files: file size (8 bytes, little-endian)
+    # followed by the SHA256 hashes of all chunks of the file, truncated to 128 bits.
+    table = [struct.pack('<Q', os.stat(filename).st_size)]
+    with open(filename, 'rb') as file:
+        while True:
+            chunk = file.read(chunk_size)
+            if not chunk:
+                break
+            table.append(sha256(chunk)[:16])
+    return b''.join(table)
+
+
+def output_chunk_tables(manifest, trusted_files, chunk_sizes, output, jobs=None):
+    # Each table is bound to the manifest by its hash, so only the tables need to be verified on
+    # first open, and not the whole files.
+    manifest_sgx = manifest['sgx']
+    manifest_sgx['trusted_chunks'] = {}
+    manifest_sgx['trusted_chunks_hash'] = {}
+
+    chunks_dir = Path(f'{output}.chunks')
+    chunks_dir.mkdir(exist_ok=True)
+    with ThreadPoolExecutor(max_workers=jobs) as executor:
+        tables = executor.map(get_chunk_table, [target for _, (_, target, _) in trusted_files],
+                              [chunk_sizes[key] for key, _ in trusted_files])
+    for (key, (uri, _, _)), table in zip(trusted_files, tables):
+        # keys are not guaranteed to be valid file names, so name the tables after the URIs
+        table_path = chunks_dir / path_to_key(uri)
+        with open(table_path, 'wb') as file:
+            file.write(table)
+        manifest_sgx['trusted_chunks'][key] = f'file:{table_path}'
+        manifest_sgx['trusted_chunks_hash'][key] = sha256(table).hex()
+
+
+def output_trusted_files_image(manifest, chunk_sizes, output):
+    # Binary image of all trusted files, bound to the manifest by its hash: huge TOML tables are
+    # slow to parse and query in each enclave, while the image is loaded with one read. Format
+    # (little-endian, see `struct trusted_files_image_entry` in enclave_framework.c): magic and
+    # number of entries, then for each file the lengths of its URI and chunk table URI, its hash,
+    # the hash of its chunk table (zeros if none), its chunk size, and the two URIs (without
+    # terminating zeros).
+    manifest_sgx = manifest['sgx']
+    trusted_files = manifest_sgx.pop('trusted_files')
+    checksums = manifest_sgx.pop('trusted_checksum')
+    chunks = manifest_sgx.pop('trusted_chunks', {})
+    chunks_hashes = manifest_sgx.pop('trusted_chunks_hash', {})
+    manifest_sgx.pop('trusted_chunk_size')
+
+    image = [struct.pack('<8sQ', TRUSTED_FILES_IMAGE_MAGIC, len(trusted_files))]
+    for key, uri in trusted_files.items():
+        uri = uri.encode()
+        chunks_uri = chunks.get(key, '').encode()
+        chunks_hash = bytes.fromhex(chunks_hashes[key]) if key in chunks_hashes else bytes(32)
+        image.append(struct.pack('<II32s32sQ', len(uri), len(chunks_uri),
+                                 bytes.fromhex(checksums[key]), chunks_hash, chunk_sizes[key]))
+        image += [uri, chunks_uri]
+    image = b''.join(image)
+
+    image_path = f'{output}.trusted'
+    with open(image_path, 'wb') as file:
+        file.write(image)
+    manifest_sgx['trusted_files_image_uri'] = f'file:{image_path}'
+    manifest_sgx['trusted_files_image_hash'] = sha256(image).hex()
 
 
 # TODO: this function should be deleted after we start using TOML lists instead of key-values for
@@ -171,7 +321,7 @@ def walk_dir(path):
     return sorted(filter(Path.is_file, path.rglob('*')))
 
 
-def get_trusted_files(manifest, check_exist=True, do_hash=True):
+def get_trusted_files(manifest, check_exist=True, do_hash=True, jobs=None, hash_cache=None):
     targets = {}
 
     preload_str = manifest['loader']['preload']
@@ -179,6 +329,7 @@ def get_trusted_files(manifest, check_exist=True, do_hash=True):
     for i, uri in enumerate(filter(None, preload_str.split(','))):
         targets[f'preload{i}'] = uri, resolve_uri(uri, check_exist)
 
+    chunk_sizes = manifest['sgx']['trusted_chunk_size']
     for key, val in manifest['sgx']['trusted_files'].items():
         path = Path(resolve_uri(val, check_exist))
         if path.is_dir():
@@ -186,14 +337,20 @@ def get_trusted_files(manifest, check_exist=True, do_hash=True):
                 sub_key = path_to_key(str(sub_path))
                 uri = f'file:{sub_path}'
                 targets[sub_key] = uri, sub_path
+                if key in chunk_sizes:
+                    chunk_sizes.setdefault(sub_key, chunk_sizes[key])
+            chunk_sizes.pop(key, None)
         else:
             targets[key] = val, path
 
     if do_hash:
-        for key, val in targets.items():
-            uri, target = val
-            hash_ = get_hash(target).hex()
-            targets[key] = uri, target, hash_
+        hash_func = hash_cache.get_hash if hash_cache is not None else get_hash
+        with ThreadPoolExecutor(max_workers=jobs) as executor:
+            hashes = executor.map(hash_func, [target for _, target in targets.values()])
+        for (key, (uri, target)), hash_ in zip(list(targets.items()), hashes):
+            targets[key] = uri, target, hash_.hex()
+        if hash_cache is not None:
+            hash_cache.save()
 
     return targets
 
@@ -383,6 +540,7 @@ def gen_area_content(attr, areas, enclave_base, enclave_heap_min):
         set_tls_field(t, offs.SGX_MANIFEST_SIZE, len(manifest_area.content))
         set_tls_field(t, offs.SGX_HEAP_MIN, enclave_heap_min)
         set_tls_field(t, offs.SGX_HEAP_MAX, enclave_heap_max)
+        set_tls_field(t, offs.SGX_EDMM_ENABLED, int(attr['edmm_enable']))
 
     tcs_area.content = tcs_data
     tls_area.content = tls_data
@@ -400,6 +558,12 @@ def populate_memory_areas(attr, areas, enclave_base, enclave_heap_min):
             raise Exception('Enclave size is not large enough')
         last_populated_addr = area.addr
 
+    gen_area_content(attr, areas, enclave_base, enclave_heap_min)
+
+    if attr['edmm_enable']:
+        # with EDMM, heap pages are added at runtime and are not part of the measurement
+        return areas
+
     free_areas = []
     for area in areas:
         addr = area.addr + area.size
@@ -417,8 +581,6 @@ def populate_memory_areas(attr, areas, enclave_base, enclave_heap_min):
                        size=last_populated_addr - enclave_heap_min, flags=flags,
                        measure=False))
 
-    gen_area_content(attr, areas, enclave_base, enclave_heap_min)
-
     return areas + free_areas
 
 def generate_measurement(enclave_base, attr, areas):
@@ -428,29 +590,32 @@ def generate_measurement(enclave_base, attr, areas):
         data = struct.pack('<8sLQ44s', b'ECREATE', offs.SSA_FRAME_SIZE // offs.PAGESIZE, size, b'')
         digest.update(data)
 
-    def do_eadd(digest, offset, flags):
-        assert offset < attr['enclave_size']
-        data = struct.pack('<8sQQ40s', b'EADD', offset, flags, b'')
-        digest.update(data)
-
-    def do_eextend(digest, offset, content):
-        assert offset < attr['enclave_size']
-
-        if len(content) != 256:
-            raise ValueError('Exactly 256 bytes expected')
-
-        data = struct.pack('<8sQ48s', b'EEXTEND', offset, b'')
-        digest.update(data)
-        digest.update(content)
-
-    def include_page(digest, addr, flags, content, measure):
-        if len(content) != offs.PAGESIZE:
-            raise ValueError('Exactly one page expected')
-
-        do_eadd(digest, addr - enclave_base, flags)
-        if measure:
-            for i in range(0, offs.PAGESIZE, 256):
-                do_eextend(digest, addr - enclave_base + i, content[i:i + 256])
+    eadd = struct.Struct('<8sQQ40s')
+    eextend = struct.Struct('<8sQ48s')
+
+    def include_pages(digest, addr, size, flags, content):
+        # Simulates EADD of all pages in [addr, addr + size), and EEXTEND of each 256-byte block of
+        # `content` if it's not None (i.e. the pages are measured). The records of many pages are
+        # hashed with one `update()`, which is much faster than hashing them one by one in the case
+        # of multi-GB enclaves.
+        if size % offs.PAGESIZE or (content is not None and len(content) != size):
+            raise ValueError('Whole pages expected')
+        assert addr - enclave_base + size <= attr['enclave_size']
+
+        if content is not None:
+            content = memoryview(content)
+        records = []
+        for page_offset in range(0, size, offs.PAGESIZE):
+            offset = addr - enclave_base + page_offset
+            records.append(eadd.pack(b'EADD', offset, flags, b''))
+            if content is not None:
+                for i in range(0, offs.PAGESIZE, 256):
+                    records.append(eextend.pack(b'EEXTEND', offset + i, b''))
+                    records.append(content[page_offset + i:page_offset + i + 256])
+            if len(records) >= 4096:
+                digest.update(b''.join(records))
+                records = []
+        digest.update(b''.join(records))
 
     mrenclave = hashlib.sha256()
     do_ecreate(mrenclave, attr['enclave_size'])
@@ -483,32 +648,16 @@ def generate_measurement(enclave_base, attr, areas):
 
         print_area(m_addr, m_size, flags, desc, True)
 
-        for page in range(m_addr, m_addr + m_size, offs.PAGESIZE):
-            start = page - m_addr + f_addr
-            end = start + offs.PAGESIZE
-            start_zero = b''
-            if start < offset:
-                if offset - start >= offs.PAGESIZE:
-                    start_zero = ZERO_PAGE
-                else:
-                    start_zero = bytes(offset - start)
-            end_zero = b''
-            if end > offset + filesize:
-                if end - offset - filesize >= offs.PAGESIZE:
-                    end_zero = ZERO_PAGE
-                else:
-                    end_zero = bytes(end - offset - filesize)
-            start += len(start_zero)
-            end -= len(end_zero)
-            if start < end:
-                file.seek(start)
-                data = file.read(end - start)
-            else:
-                data = b''
-            if len(start_zero + data + end_zero) != offs.PAGESIZE:
-                raise Exception('wrong calculation')
-
-            include_page(digest, page, flags, start_zero + data + end_zero, True)
+        # the segment is the file contents at [offset, offset + filesize), padded with zeros to
+        # whole pages (the file contents sharing the first page before `offset` are zeroed too)
+        file.seek(offset)
+        data = file.read(filesize)
+        if len(data) != filesize:
+            raise Exception('wrong calculation')
+        start_zero = bytes(offset - f_addr)
+        end_zero = bytes(m_size - len(start_zero) - filesize)
+
+        include_pages(digest, m_addr, m_size, flags, start_zero + data + end_zero)
 
     for area in areas:
         if area.elf_filename is not None:
@@ -537,14 +686,12 @@ def generate_measurement(enclave_base, attr, areas):
                     load_file(mrenclave, file, offset, baseaddr_ + addr, filesize, memsize,
                               desc, flags)
         else:
-            for addr in range(area.addr, area.addr + area.size, offs.PAGESIZE):
-                data = ZERO_PAGE
-                if area.content is not None:
-                    start = addr - area.addr
-                    end = start + offs.PAGESIZE
-                    data = area.content[start:end]
-                    data += b'\0' * (offs.PAGESIZE - len(data)) # pad last page
-                include_page(mrenclave, addr, area.flags, data, area.measure)
+            size = roundup(area.size)
+            data = None
+            if area.measure:
+                data = area.content[:size] if area.content is not None else b''
+                data += bytes(size - len(data)) # pad last page
+            include_pages(mrenclave, area.addr, size, area.flags, data)
 
             print_area(area.addr, area.size, area.flags, area.desc,
                        area.measure)
@@ -647,6 +794,14 @@ argparser.add_argument('--manifest', '-manifest', metavar='MANIFEST',
 argparser.add_argument('--depend', '-depend',
                        action='store_true', required=False,
                        help='Generate dependency for Makefile')
+argparser.add_argument('--jobs', '-j', metavar='JOBS',
+                       type=int, required=False,
+                       help='Number of trusted files hashed in parallel '
+                            '(by default based on the number of CPUs)')
+argparser.add_argument('--hash-cache', metavar='CACHE',
+                       type=str, required=False,
+                       help='File to keep hashes of trusted files in between runs; files whose '
+                            'size, mtime and inode did not change are not hashed again')
 
 argparser.set_defaults(libpal=os.path.join(_CONFIG_PKGLIBDIR, 'sgx/libpal.so'))
 
@@ -657,6 +812,8 @@ def parse_args(args):
         'libpal': args.libpal,
         'key': args.key,
         'manifest': args.manifest,
+        'jobs': args.jobs,
+        'hash_cache': args.hash_cache,
     }
     if args.depend:
         args_dict['depend'] = True
@@ -677,6 +834,8 @@ def read_manifest(path):
     sgx = manifest.setdefault('sgx', {})
     sgx.setdefault('trusted_files', {})
     sgx.setdefault('trusted_checksum', {})
+    sgx.setdefault('trusted_chunk_size', {})
+    sgx.setdefault('trusted_chunk_size_patterns', {})
     sgx.setdefault('enclave_size', DEFAULT_ENCLAVE_SIZE)
     sgx.setdefault('thread_num', DEFAULT_THREAD_NUM)
     sgx.setdefault('isvprodid', 0)
@@ -690,6 +849,9 @@ def read_manifest(path):
     sgx.setdefault('support_exinfo', False)
     sgx.setdefault('nonpie_binary', False)
     sgx.setdefault('enable_stats', False)
+    sgx.setdefault('edmm_enable', False)
+    sgx.setdefault('lazy_trusted_files', False)
+    sgx.setdefault('trusted_files_image', False)
 
     loader = manifest.setdefault('loader', {})
     loader.setdefault('preload', '')
@@ -711,6 +873,7 @@ def main_sign(manifest, args):
     attr['thread_num'] = manifest_sgx['thread_num']
     attr['isv_prod_id'] = manifest_sgx['isvprodid']
     attr['isv_svn'] = manifest_sgx['isvsvn']
+    attr['edmm_enable'] = manifest_sgx['edmm_enable']
     attr['flags'], attr['xfrms'], attr['misc_select'] = get_enclave_attributes(manifest)
     today = datetime.date.today()
     attr['year'] = today.year
@@ -722,6 +885,7 @@ def main_sign(manifest, args):
     print(f'    thread_num:  {attr["thread_num"]}')
     print(f'    isv_prod_id: {attr["isv_prod_id"]}')
     print(f'    isv_svn:     {attr["isv_svn"]}')
+    print(f'    edmm:        {attr["edmm_enable"]}')
     print(f'    attr.flags:  {attr["flags"].hex()}')
     print(f'    attr.xfrm:   {attr["xfrms"].hex()}')
     print(f'    misc_select: {attr["misc_select"].hex()}')
@@ -740,13 +904,23 @@ def main_sign(manifest, args):
 
     # Use `list()` to ensure non-laziness (`manifest_sgx` is a part of `manifest`, and we'll be
     # changing it while iterating).
-    expanded_trusted_files = list(get_trusted_files(manifest).items())
+    hash_cache = HashCache(args['hash_cache']) if args.get('hash_cache') else None
+    expanded_trusted_files = list(get_trusted_files(manifest, jobs=args.get('jobs'),
+                                                    hash_cache=hash_cache).items())
     manifest_sgx['trusted_files'] = {} # generate the list from scratch, dropping directory entries
     for key, val in expanded_trusted_files:
         uri, _, hash_ = val
         manifest_sgx['trusted_files'][key] = uri
         manifest_sgx['trusted_checksum'][key] = hash_
 
+    chunk_sizes = get_chunk_sizes(manifest, expanded_trusted_files)
+
+    if manifest_sgx['lazy_trusted_files']:
+        output_chunk_tables(manifest, expanded_trusted_files, chunk_sizes, args['output'],
+                            args.get('jobs'))
+    if manifest_sgx['trusted_files_image']:
+        output_trusted_files_image(manifest, chunk_sizes, args['output'])
+
     # Populate memory areas
     memory_areas = get_memory_areas(attr, args)
 
@@ -0,0 +1,98 @@
+# SPDX-License-Identifier: LGPL-3.0-or-later
+# Copyright (c) 2021 Intel Corporation
+
+'''
+Decoder of binary syscall traces written by Graphene (see ``libos.syscall_trace_file``)
+'''
+
+import errno
+import struct
+
+import click
+
+MAGIC = b'GSCTRC01'
+HEADER = struct.Struct('<8sIIII')
+RECORD = struct.Struct('<QQII6qq')
+
+class TraceFormatError(Exception):
+    pass
+
+def read_trace(f):
+    '''
+    Args:
+        f: binary file object with a trace.
+
+    Returns:
+        the PID of the traced process, the list of syscall names (indexed by syscall number, empty
+        for unknown numbers) and a generator of records `(time_us, duration_us, tid, sysnr, args,
+        ret)`.
+    '''
+    header = f.read(HEADER.size)
+    if len(header) < HEADER.size:
+        raise TraceFormatError('truncated header')
+    magic, record_size, names_count, names_size, pid = HEADER.unpack(header)
+    if magic != MAGIC:
+        raise TraceFormatError('not a Graphene syscall trace')
+    if record_size != RECORD.size:
+        raise TraceFormatError(f'unsupported record size {record_size}')
+
+    names = f.read(names_size).decode('ascii').split('\0')[:names_count]
+    if len(names) != names_count:
+        raise TraceFormatError('truncated syscall names')
+
+    def records():
+        while True:
+            data = f.read(RECORD.size)
+            if len(data) < RECORD.size:
+                # the last record may be incomplete if the process was killed
+                return
+            time_us, duration_us, tid, sysnr, *rest = RECORD.unpack(data)
+            yield time_us, duration_us, tid, sysnr, tuple(rest[:6]), rest[6]
+
+    return pid, names, records()
+
+def format_ret(ret):
+    if -4096 < ret < 0 and -ret in errno.errorcode:
+        return f'-{errno.errorcode[-ret]}'
+    if ret < 0 or ret > 0xffff:
+        return hex(ret & 0xffffffffffffffff)
+    return str(ret)
+
+def format_record(pid, names, record, start_us, nargs):
+    time_us, duration_us, tid, sysnr, args, ret = record
+    name = names[sysnr] if sysnr < len(names) and names[sysnr] else f'syscall{sysnr}'
+    args_str = ', '.join(hex(arg & 0xffffffffffffffff) for arg in args[:nargs])
+    return (f'{(time_us - start_us) / 1e6:.6f} [P{pid}:T{tid}] {name}({args_str}) = '
+            f'{format_ret(ret)} <{duration_us}us>')
+
+@click.command()
+@click.option('--args', '-a', 'nargs', type=click.IntRange(0, 6), default=6,
+    help='Number of (raw) arguments to print.')
+@click.option('--summary', '-s', is_flag=True,
+    help='Print the number of calls and total time per syscall instead of the records.')
+@click.argument('infile', type=click.File('rb'))
+def main(nargs, summary, infile):
+    '''Decode a binary syscall trace of one Graphene process.'''
+    try:
+        pid, names, records = read_trace(infile)
+    except TraceFormatError as e:
+        raise click.ClickException(f'{infile.name}: {e}')
+
+    stats = {}
+    start_us = None
+    for record in records:
+        if start_us is None:
+            start_us = record[0]
+        if summary:
+            count, total_us = stats.get(record[3], (0, 0))
+            stats[record[3]] = (count + 1, total_us + record[1])
+        else:
+            click.echo(format_record(pid, names, record, start_us, nargs))
+
+    if summary:
+        for sysnr, (count, total_us) in sorted(stats.items(), key=lambda x: -x[1][1]):
+            name = names[sysnr] if sysnr < len(names) and names[sysnr] else f'syscall{sysnr}'
+            click.echo(f'{name:24} {count:10} {total_us:12}us')
+
+if __name__ == '__main__':
+    main() # pylint: disable=no-value-for-parameter
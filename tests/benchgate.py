@@ -0,0 +1,443 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: LGPL-3.0-or-later
+# Copyright (c) 2021 Intel Corporation
+
+'''
+Benchmark regression gate
+-------------------------
+
+Runs a selected set of the asv benchmarks in ``benchmarks/`` against an already built Graphene tree
+(without asv, so that each benchmark can be repeated and all samples are kept), stores the results
+as the baseline of a hardware profile, and compares later results with that baseline.
+
+A benchmark is reported as a regression if the change of its mean is worse than the threshold
+(5% by default) and the bootstrap confidence interval of the change (95% by default) lies entirely
+on the worse side, i.e. the regression is statistically significant. The comparison is written as a
+JSON report (see ``compare()``); the exit status is 1 if there are regressions or failed
+benchmarks.
+
+Typical use::
+
+    make -C benchmarks
+    ./benchgate.py run -o results.json
+    ./benchgate.py save results.json            # on the old version, once per machine
+    ./benchgate.py check --report report.json   # on the new version: run and compare
+'''
+
+import argparse
+import datetime
+import importlib
+import itertools
+import json
+import os
+import pathlib
+import random
+import re
+import statistics
+import subprocess
+import sys
+
+TESTS_DIR = pathlib.Path(__file__).resolve().parent
+DEFAULT_BASELINE_DIR = TESTS_DIR / '.benchgate'
+
+RESULTS_VERSION = 1
+BOOTSTRAP_ROUNDS = 2000
+
+# units (see the `unit` attributes of the benchmarks) for which a lower value is better, otherwise
+# higher is better
+LOWER_IS_BETTER_UNITS = {'s', 'ms', 'us', 'ns'}
+
+# Benchmark sets: `benchmarks.<module>.<class>`, optionally only some of its `track_*` methods and
+# only some values of its parameters (the others are not run). `lower` lists the parameter values
+# for which a lower result is better, for benchmarks which report both latency and throughput.
+SETS = {
+    'syscalls': [
+        {'module': 'microbench', 'class': 'Syscalls',
+         'params': {'operation': ['empty', 'getpid', 'clock_gettime', 'futex', 'pipe',
+                                  'read_small', 'write_small', 'open', 'mmap'],
+                    'env': ['nosgx', 'sgx-direct', 'sgx-exitless']}},
+    ],
+    'startup': [
+        {'module': 'startup', 'class': 'Startup',
+         'params': {'phase': ['wall', 'total']}},
+    ],
+    'startup-apps': [
+        {'module': 'startup_apps', 'class': 'AppStartup',
+         'params': {'phase': ['wall', 'total', 'enclave creation', 'manifest parsing',
+                              'trusted and protected files setup', 'executable loading',
+                              'interpreter loading']}},
+    ],
+    'nginx': [
+        {'module': 'nginx', 'class': 'Nginx',
+         'methods': ['track_graphene_nosgx', 'track_graphene_sgx'],
+         'params': {'concurrency': [1, 32]},
+         'lower': {'metric': ['latency']}},
+    ],
+    'redis': [
+        {'module': 'redis', 'class': 'Redis',
+         'methods': ['track_graphene_nosgx', 'track_graphene_sgx'],
+         'params': {'test': ['PING_INLINE', 'SET', 'GET']}},
+    ],
+    'protected-files': [
+        {'module': 'file_io', 'class': cls,
+         'params': {'kind': ['protected'], 'filesize': [16 << 20], 'threadcount': [1]}}
+        for cls in ('FileReads', 'FileWrites')
+    ],
+}
+
+class GateError(Exception):
+    pass
+
+
+def hardware_profile():
+    '''A description of this machine; results are comparable only within the same profile.'''
+    cpu = 'unknown'
+    try:
+        with open('/proc/cpuinfo') as file:
+            for line in file:
+                if line.startswith('model name'):
+                    cpu = line.split(':', 1)[1].strip()
+                    break
+    except OSError:
+        pass
+
+    sgx = any(os.path.exists(path) for path in ('/dev/sgx_enclave', '/dev/sgx/enclave',
+                                                '/dev/isgx'))
+    machine = {
+        'cpu': cpu,
+        'cpus': os.cpu_count(),
+        'kernel': os.uname().release,
+        'sgx': sgx,
+    }
+    name = '{}-{}cpu-{}'.format(re.sub(r'[^A-Za-z0-9]+', '-', cpu).strip('-').lower(),
+                                machine['cpus'], 'sgx' if sgx else 'nosgx')
+    return name, machine
+
+def git_commit(path):
+    try:
+        return subprocess.run(['git', '-C', os.fspath(path), 'rev-parse', 'HEAD'], check=True,
+            stdout=subprocess.PIPE, stderr=subprocess.DEVNULL).stdout.decode().strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def _param_lists(bench_class):
+    # like asv, a flat list is the values of the only parameter
+    params = getattr(bench_class, 'params', [])
+    if not params:
+        return [], []
+    if not all(isinstance(values, (list, tuple)) for values in params):
+        params = [params]
+    names = list(getattr(bench_class, 'param_names', []))
+    if len(names) != len(params):
+        names = ['param{}'.format(i) for i in range(len(params))]
+    return names, [list(values) for values in params]
+
+def _bench_name(module, cls, method, names, values):
+    name = '{}.{}.{}'.format(module, cls, method)
+    if names:
+        name += '({})'.format(', '.join('{}={}'.format(n, v) for n, v in zip(names, values)))
+    return name
+
+def collect(set_names, bench_re):
+    '''Yields (name, entry, class, method, parameters) of the benchmarks to run.'''
+    for set_name in set_names:
+        for entry in SETS[set_name]:
+            try:
+                module = importlib.import_module('benchmarks.' + entry['module'])
+            except Exception as e: # pylint: disable=broad-except
+                # e.g. nginx or redis not installed
+                raise GateError('cannot load the benchmarks of set {!r} ({!r}), select the sets '
+                                'to run with --set'.format(set_name, e)) from e
+            bench_class = getattr(module, entry['class'])
+            methods = entry.get('methods') or sorted(m for m in dir(bench_class)
+                                                       if m.startswith('track_'))
+            names, params = _param_lists(bench_class)
+            filters = entry.get('params', {})
+            params = [[v for v in values if name not in filters or v in filters[name]]
+                      for name, values in zip(names, params)]
+
+            for method in methods:
+                for values in itertools.product(*params):
+                    name = _bench_name(entry['module'], entry['class'], method, names, values)
+                    if bench_re and not bench_re.search(name):
+                        continue
+                    yield name, entry, bench_class, method, dict(zip(names, values))
+
+def _lower_is_better(entry, unit, params):
+    if unit in LOWER_IS_BETTER_UNITS:
+        return True
+    return any(params.get(name) in values for name, values in entry.get('lower', {}).items())
+
+def run_one(entry, bench_class, method_name, params, repeat):
+    instance = bench_class()
+    method = getattr(instance, method_name)
+    unit = getattr(method, 'unit', getattr(bench_class, 'unit', None))
+    result = {
+        'params': params,
+        'unit': unit,
+        'lower_is_better': _lower_is_better(entry, unit, params),
+        'samples': [],
+    }
+
+    args = list(params.values())
+    try:
+        if hasattr(instance, 'setup'):
+            instance.setup(*args)
+    except NotImplementedError:
+        # asv convention for parameter combinations which are not run
+        result['skipped'] = True
+        return result
+
+    try:
+        for _ in range(repeat):
+            result['samples'].append(float(method(*args)))
+    finally:
+        if hasattr(instance, 'teardown'):
+            instance.teardown(*args)
+    return result
+
+def run(args):
+    build_dir = pathlib.Path(args.build_dir).resolve()
+    # what asv would set, the benchmarks find Graphene and their own files through these
+    os.environ['ASV_BUILD_DIR'] = os.fspath(build_dir)
+    os.environ['ASV_CONF_DIR'] = os.fspath(TESTS_DIR)
+    sys.path.insert(0, os.fspath(TESTS_DIR))
+
+    profile, machine = hardware_profile()
+    results = {
+        'version': RESULTS_VERSION,
+        'profile': args.profile or profile,
+        'machine': machine,
+        'commit': git_commit(build_dir),
+        'date': datetime.datetime.now(datetime.timezone.utc).isoformat(timespec='seconds'),
+        'repeat': args.repeat,
+        'benchmarks': {},
+    }
+
+    bench_re = re.compile(args.bench) if args.bench else None
+    for name, entry, bench_class, method, params in collect(args.set or list(SETS), bench_re):
+        print('running {}'.format(name), file=sys.stderr)
+        try:
+            results['benchmarks'][name] = run_one(entry, bench_class, method, params, args.repeat)
+        except Exception as e: # pylint: disable=broad-except
+            results['benchmarks'][name] = {'params': params, 'samples': [], 'error': repr(e)}
+            print('  failed: {!r}'.format(e), file=sys.stderr)
+    return results
+
+
+def _mean_change(baseline, current):
+    return statistics.mean(current) / statistics.mean(baseline) - 1
+
+def change_ci(baseline, current, confidence, rng):
+    '''Bootstrap (percentile) confidence interval of the relative change of the mean.'''
+    changes = sorted(_mean_change(rng.choices(baseline, k=len(baseline)),
+                                  rng.choices(current, k=len(current)))
+                     for _ in range(BOOTSTRAP_ROUNDS))
+    alpha = (1 - confidence) / 2
+    low = changes[int(alpha * (BOOTSTRAP_ROUNDS - 1))]
+    high = changes[int(round((1 - alpha) * (BOOTSTRAP_ROUNDS - 1)))]
+    return low, high
+
+def compare_one(base, cur, threshold, confidence, rng):
+    entry = {
+        'params': cur['params'] if cur else base['params'],
+        'unit': (cur or base).get('unit'),
+    }
+    if cur is None:
+        entry['status'] = 'missing'
+        return entry
+    if cur.get('error'):
+        entry['status'] = 'error'
+        entry['error'] = cur['error']
+        return entry
+    if cur.get('skipped'):
+        entry['status'] = 'skipped'
+        return entry
+    if base is None or not base.get('samples'):
+        entry['status'] = 'new'
+        return entry
+
+    baseline, current = base['samples'], cur['samples']
+    entry['baseline'] = {'mean': statistics.mean(baseline), 'samples': len(baseline)}
+    entry['current'] = {'mean': statistics.mean(current), 'samples': len(current)}
+    if len(baseline) < 2 or len(current) < 2 or statistics.mean(baseline) == 0:
+        entry['status'] = 'insufficient'
+        return entry
+
+    change = _mean_change(baseline, current)
+    low, high = change_ci(baseline, current, confidence, rng)
+    entry['change'] = change
+    entry['ci'] = [low, high]
+
+    # "worse" is a negative change of a higher-is-better result, and vice versa
+    sign = 1 if cur.get('lower_is_better') else -1
+    worse = sign * change
+    worse_low, worse_high = sorted((sign * low, sign * high))
+    if worse > threshold and worse_low > 0:
+        entry['status'] = 'regression'
+    elif worse < -threshold and worse_high < 0:
+        entry['status'] = 'improvement'
+    else:
+        entry['status'] = 'unchanged'
+    return entry
+
+def compare(baseline, results, threshold, confidence):
+    '''The report: all benchmarks of `results` and `baseline` with their status (`regression`,
+    `improvement`, `unchanged`, `insufficient` samples, `new`, `missing`, `skipped` or `error`),
+    means, relative change and its confidence interval.'''
+    if baseline['profile'] != results['profile']:
+        raise GateError('baseline is of profile {!r}, results are of {!r}'.format(
+            baseline['profile'], results['profile']))
+
+    # a fixed seed, so that a report can be reproduced from the same results
+    rng = random.Random(0)
+    names = sorted(set(baseline['benchmarks']) | set(results['benchmarks']))
+    benchmarks = {
+        name: compare_one(baseline['benchmarks'].get(name), results['benchmarks'].get(name),
+                          threshold, confidence, rng)
+        for name in names
+    }
+
+    summary = {}
+    for entry in benchmarks.values():
+        summary[entry['status']] = summary.get(entry['status'], 0) + 1
+
+    return {
+        'version': RESULTS_VERSION,
+        'profile': results['profile'],
+        'baseline_commit': baseline.get('commit'),
+        'commit': results.get('commit'),
+        'threshold': threshold,
+        'confidence': confidence,
+        'summary': summary,
+        'passed': not summary.get('regression') and not summary.get('error'),
+        'benchmarks': benchmarks,
+    }
+
+def print_report(report, file=sys.stdout):
+    for name, entry in report['benchmarks'].items():
+        if 'change' in entry:
+            detail = '{:+.1%} [{:+.1%}, {:+.1%}]'.format(entry['change'], *entry['ci'])
+        else:
+            detail = entry.get('error', '')
+        print('{:<12} {:<28} {}'.format(entry['status'], detail, name), file=file)
+    print('{}: {}'.format('PASSED' if report['passed'] else 'FAILED',
+                          ', '.join('{} {}'.format(count, status)
+                                    for status, count in sorted(report['summary'].items()))),
+          file=file)
+
+
+def load_json(path):
+    with open(path) as file:
+        data = json.load(file)
+    if data.get('version') != RESULTS_VERSION:
+        raise GateError('{}: unsupported version {!r}'.format(path, data.get('version')))
+    return data
+
+def write_json(path, data):
+    if path == '-':
+        json.dump(data, sys.stdout, indent=4)
+        sys.stdout.write('\n')
+        return
+    with open(path, 'w') as file:
+        json.dump(data, file, indent=4)
+        file.write('\n')
+
+def baseline_path(args, profile):
+    return pathlib.Path(args.baseline_dir) / '{}.json'.format(profile)
+
+def do_compare(args, results):
+    baseline = load_json(args.baseline or baseline_path(args, results['profile']))
+    report = compare(baseline, results, args.threshold, args.confidence)
+    print_report(report)
+    if args.report:
+        write_json(args.report, report)
+    return 0 if report['passed'] else 1
+
+def cmd_run(args):
+    write_json(args.output, run(args))
+    return 0
+
+def cmd_save(args):
+    results = load_json(args.results)
+    if args.profile:
+        results['profile'] = args.profile
+    path = baseline_path(args, results['profile'])
+    path.parent.mkdir(parents=True, exist_ok=True)
+    write_json(path, results)
+    print('saved baseline of profile {!r} to {}'.format(results['profile'], path))
+    return 0
+
+def cmd_compare(args):
+    results = load_json(args.results)
+    if args.profile:
+        results['profile'] = args.profile
+    return do_compare(args, results)
+
+def cmd_check(args):
+    results = run(args)
+    if args.output:
+        write_json(args.output, results)
+    return do_compare(args, results)
+
+
+def _add_run_args(parser):
+    parser.add_argument('--set', action='append', choices=sorted(SETS),
+        help='Benchmark set to run (can be repeated; default: all)')
+    parser.add_argument('-b', '--bench', metavar='REGEX',
+        help='Run only the benchmarks whose name matches REGEX')
+    parser.add_argument('--repeat', type=int, default=5,
+        help='Number of samples of each benchmark (default: %(default)s)')
+    parser.add_argument('--build-dir', default=os.fspath(TESTS_DIR.parent),
+        help='Graphene tree to benchmark (default: %(default)s)')
+
+def _add_compare_args(parser):
+    parser.add_argument('--baseline', metavar='FILE',
+        help='Baseline results (default: the one of the profile in the baseline directory)')
+    parser.add_argument('--threshold', type=float, default=0.05,
+        help='Smallest relative change considered a regression (default: %(default)s)')
+    parser.add_argument('--confidence', type=float, default=0.95,
+        help='Confidence level of the change (default: %(default)s)')
+    parser.add_argument('--report', metavar='FILE',
+        help='Write the machine-readable report (JSON) to FILE ("-" for stdout)')
+
+argparser = argparse.ArgumentParser(description=__doc__.split('\n\n')[1])
+argparser.add_argument('--profile',
+    help='Hardware profile (default: derived from the CPU model, CPU count and SGX availability)')
+argparser.add_argument('--baseline-dir', default=os.fspath(DEFAULT_BASELINE_DIR),
+    help='Directory with the baselines of the profiles (default: %(default)s)')
+subparsers = argparser.add_subparsers(dest='command', required=True)
+
+parser_run = subparsers.add_parser('run', help='Run benchmarks and write their results')
+_add_run_args(parser_run)
+parser_run.add_argument('-o', '--output', default='-', help='Results file (default: stdout)')
+parser_run.set_defaults(func=cmd_run)
+
+parser_save = subparsers.add_parser('save', help='Store results as the baseline of their profile')
+parser_save.add_argument('results')
+parser_save.set_defaults(func=cmd_save)
+
+parser_compare = subparsers.add_parser('compare', help='Compare results with the baseline')
+parser_compare.add_argument('results')
+_add_compare_args(parser_compare)
+parser_compare.set_defaults(func=cmd_compare)
+
+parser_check = subparsers.add_parser('check', help='Run benchmarks and compare with the baseline')
+_add_run_args(parser_check)
+_add_compare_args(parser_check)
+parser_check.add_argument('-o', '--output', help='Also write the results to this file')
+parser_check.set_defaults(func=cmd_check)
+
+def main(args=None):
+    args = argparser.parse_args(args)
+    if hasattr(args, 'confidence') and not 0 < args.confidence < 1:
+        argparser.error('--confidence must be between 0 and 1')
+    try:
+        return args.func(args)
+    except (GateError, OSError, json.JSONDecodeError) as e:
+        print(e, file=sys.stderr)
+        return 2
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -59,11 +59,13 @@ class Exec:
 
     def setup(self, *_args):
         self.benchmarks_path.mkdir(parents=True, exist_ok=True)
-        try:
-            self.executable_path.unlink()
-        except FileNotFoundError:
-            pass
-        self.executable_path.symlink_to(self.conf_path / self.executable)
+        # not when run in the source tree itself (see benchgate.py)
+        if self.executable_path != self.conf_path / self.executable:
+            try:
+                self.executable_path.unlink()
+            except FileNotFoundError:
+                pass
+            self.executable_path.symlink_to(self.conf_path / self.executable)
 
         with open(self.conf_path / self.manifest_template) as file:
             template = MesonTemplate(file.read())
@@ -104,10 +106,14 @@ class Exec:
         return os.fspath(self.graphene_path / 'Runtime/pal_loader')
 
 
-    def run_in_graphene(self, *args, sgx=True):
+    def run_native(self, *args, **kwds):
+        return subprocess.run([os.fspath(self.executable_path), *args],
+            check=True, cwd=self.benchmarks_path, **kwds)
+
+    def run_in_graphene(self, *args, sgx=True, **kwds):
         self._set_sgx(sgx)
         return subprocess.run([self.pal_loader, os.fspath(self.manifest_sgx_path), *args],
-            check=True, cwd=self.benchmarks_path)
+            check=True, cwd=self.benchmarks_path, **kwds)
 
     @contextlib.contextmanager
     def graphene_server(self, *args, sgx=True, sleep=30):
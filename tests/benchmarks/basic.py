@@ -3,6 +3,8 @@
 #                    Wojtek Porczyk <woju@invisiblethingslab.com>
 #
 
+import subprocess
+
 from . import Exec
 
 # pylint: disable=invalid-name
@@ -32,3 +34,40 @@ class WritePages:
 
     def time_graphene_sgx(self, pagecount):
         self.write_pages.run_in_graphene(str(pagecount), sgx=True)
+
+class ExitlessOcalls:
+    # pylint: disable=no-self-use
+
+    exitless_ocalls = Exec('exitless_ocalls', manifest_template='exitless.manifest.template',
+        RPC_THREADS=8)
+    params = [1, 2, 4, 8, 16, 32, 64]
+    param_names = ['threadcount']
+    setup = exitless_ocalls.setup
+    iterations = 100000
+
+    def track_ocalls_per_sec(self, threadcount):
+        proc = self.exitless_ocalls.run_in_graphene(str(threadcount), str(self.iterations),
+            sgx=True, stdout=subprocess.PIPE)
+        return float(proc.stdout.decode().split()[-1])
+    track_ocalls_per_sec.unit = 'ocalls/s'
+
+class IdSyscalls:
+    # pylint: disable=no-self-use
+
+    id_syscalls = Exec('id_syscalls', manifest_template='basic.manifest.template')
+    params = [['getpid', 'gettid', 'getuid']]
+    param_names = ['syscall']
+    setup = id_syscalls.setup
+    iterations = 1000000
+
+    def track_syscalls_per_sec_nosgx(self, syscall):
+        proc = self.id_syscalls.run_in_graphene(syscall, str(self.iterations), sgx=False,
+            stdout=subprocess.PIPE)
+        return float(proc.stdout.decode().split()[-1])
+    track_syscalls_per_sec_nosgx.unit = 'syscalls/s'
+
+    def track_syscalls_per_sec_sgx(self, syscall):
+        proc = self.id_syscalls.run_in_graphene(syscall, str(self.iterations), sgx=True,
+            stdout=subprocess.PIPE)
+        return float(proc.stdout.decode().split()[-1])
+    track_syscalls_per_sec_sgx.unit = 'syscalls/s'
@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * Issue a number of tiny pread() syscalls on an allowed host file from THREADCOUNT threads in
+ * parallel and report the achieved syscall rate. Under Graphene-SGX every such pread() is one
+ * OCALL, so with exitless enabled this measures the throughput of the RPC queue.
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DATA_FILE "exitless_ocalls.dat"
+
+static int g_fd;
+static long g_iterations;
+static pthread_barrier_t g_barrier;
+
+static void usage(char* argv0) {
+    fprintf(stderr, "usage: %s THREADCOUNT ITERATIONS\n", argv0);
+}
+
+static void* thread_func(void* arg) {
+    (void)arg;
+    char c;
+
+    pthread_barrier_wait(&g_barrier);
+    for (long i = 0; i < g_iterations; i++) {
+        if (pread(g_fd, &c, 1, 0) != 1)
+            err(1, "pread");
+    }
+    return NULL;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    errno = 0;
+    long threadcount = strtol(argv[1], NULL, 0);
+    g_iterations = strtol(argv[2], NULL, 0);
+    if (errno != 0 || threadcount <= 0 || g_iterations <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    g_fd = open(DATA_FILE, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (g_fd < 0)
+        err(1, "open");
+    if (write(g_fd, "x", 1) != 1)
+        err(1, "write");
+
+    pthread_t* threads = calloc(threadcount, sizeof(*threads));
+    if (!threads)
+        err(1, "calloc");
+
+    if (pthread_barrier_init(&g_barrier, NULL, threadcount + 1))
+        errx(1, "pthread_barrier_init");
+
+    for (long i = 0; i < threadcount; i++)
+        if (pthread_create(&threads[i], NULL, thread_func, NULL))
+            errx(1, "pthread_create");
+
+    struct timespec start, end;
+    pthread_barrier_wait(&g_barrier);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (long i = 0; i < threadcount; i++)
+        pthread_join(threads[i], NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%.0f\n", threadcount * g_iterations / elapsed);
+
+    free(threads);
+    close(g_fd);
+    unlink(DATA_FILE);
+    return 0;
+}
@@ -0,0 +1,301 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * Run OPERATION on files of FILESIZE bytes in `file_io_data/KIND/` (KIND is "protected", "trusted"
+ * or "allowed", matching the manifest) from THREADCOUNT threads in parallel and report the
+ * aggregate rate: MiB/s for sequential reads and writes, operations per second otherwise.
+ *
+ * Read operations share one file, `file_<FILESIZE>`, which is created by the benchmark unless KIND
+ * is "trusted" (trusted files must exist when the enclave is signed). Write operations use one file
+ * per thread, because a protected file can't have more than one writable handle. Preparing the
+ * files is not timed; for writes, the final close() is, since protected files are flushed then.
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DATA_DIR "file_io_data"
+
+#define CHUNK_SIZE (64 * 1024) /* sequential reads and writes */
+#define BLOCK_SIZE 4096        /* random reads and writes, appends */
+
+#define FSYNC_ITERATIONS    200
+#define OPENSTAT_ITERATIONS 10000
+
+struct thread_ctx {
+    pthread_t thread;
+    unsigned int seed;
+    char path[256];
+    uint64_t done; /* bytes or operations */
+};
+
+struct operation {
+    const char* name;
+    const char* unit;
+    bool shared_file; /* reads the shared file, otherwise each thread writes its own */
+    void (*prepare)(struct thread_ctx* ctx);
+    uint64_t (*run)(struct thread_ctx* ctx);
+};
+
+static const char* g_kind;
+static size_t g_file_size;
+static const struct operation* g_op;
+static pthread_barrier_t g_barrier;
+static char g_buf_pattern[CHUNK_SIZE];
+
+static void pread_all(int fd, void* buf, size_t size, off_t offset) {
+    while (size > 0) {
+        ssize_t ret = pread(fd, buf, size, offset);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            err(1, "pread");
+        buf += ret;
+        size -= ret;
+        offset += ret;
+    }
+}
+
+static void pwrite_all(int fd, const void* buf, size_t size, off_t offset) {
+    while (size > 0) {
+        ssize_t ret = pwrite(fd, buf, size, offset);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            err(1, "pwrite");
+        buf += ret;
+        size -= ret;
+        offset += ret;
+    }
+}
+
+static void fill_file(const char* path, size_t size) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+        err(1, "open %s", path);
+    for (size_t off = 0; off < size; off += CHUNK_SIZE) {
+        size_t chunk = size - off < CHUNK_SIZE ? size - off : CHUNK_SIZE;
+        pwrite_all(fd, g_buf_pattern, chunk, off);
+    }
+    if (close(fd) < 0)
+        err(1, "close %s", path);
+}
+
+static size_t blocks_count(void) {
+    size_t blocks = g_file_size / BLOCK_SIZE;
+    return blocks ?: 1;
+}
+
+static void prepare_full_file(struct thread_ctx* ctx) {
+    fill_file(ctx->path, g_file_size);
+}
+
+static void prepare_empty_file(struct thread_ctx* ctx) {
+    fill_file(ctx->path, 0);
+}
+
+static uint64_t run_seqread(struct thread_ctx* ctx) {
+    char buf[CHUNK_SIZE];
+    int fd = open(ctx->path, O_RDONLY);
+    if (fd < 0)
+        err(1, "open %s", ctx->path);
+    for (size_t off = 0; off < g_file_size; off += CHUNK_SIZE) {
+        size_t chunk = g_file_size - off < CHUNK_SIZE ? g_file_size - off : CHUNK_SIZE;
+        pread_all(fd, buf, chunk, off);
+    }
+    close(fd);
+    return g_file_size;
+}
+
+static uint64_t run_randread(struct thread_ctx* ctx) {
+    char buf[BLOCK_SIZE];
+    size_t blocks = blocks_count();
+    int fd = open(ctx->path, O_RDONLY);
+    if (fd < 0)
+        err(1, "open %s", ctx->path);
+    for (size_t i = 0; i < blocks; i++) {
+        off_t off = (off_t)(rand_r(&ctx->seed) % blocks) * BLOCK_SIZE;
+        pread_all(fd, buf, BLOCK_SIZE, off);
+    }
+    close(fd);
+    return blocks;
+}
+
+static uint64_t run_openstat(struct thread_ctx* ctx) {
+    struct stat st;
+    for (size_t i = 0; i < OPENSTAT_ITERATIONS; i++) {
+        int fd = open(ctx->path, O_RDONLY);
+        if (fd < 0)
+            err(1, "open %s", ctx->path);
+        if (fstat(fd, &st) < 0)
+            err(1, "fstat %s", ctx->path);
+        close(fd);
+        if (stat(ctx->path, &st) < 0)
+            err(1, "stat %s", ctx->path);
+    }
+    return OPENSTAT_ITERATIONS;
+}
+
+static uint64_t run_seqwrite(struct thread_ctx* ctx) {
+    fill_file(ctx->path, g_file_size);
+    return g_file_size;
+}
+
+static uint64_t run_randwrite(struct thread_ctx* ctx) {
+    size_t blocks = blocks_count();
+    int fd = open(ctx->path, O_RDWR);
+    if (fd < 0)
+        err(1, "open %s", ctx->path);
+    for (size_t i = 0; i < blocks; i++) {
+        off_t off = (off_t)(rand_r(&ctx->seed) % blocks) * BLOCK_SIZE;
+        pwrite_all(fd, g_buf_pattern, BLOCK_SIZE, off);
+    }
+    if (close(fd) < 0)
+        err(1, "close %s", ctx->path);
+    return blocks;
+}
+
+static uint64_t run_append(struct thread_ctx* ctx) {
+    size_t blocks = blocks_count();
+    int fd = open(ctx->path, O_WRONLY | O_APPEND);
+    if (fd < 0)
+        err(1, "open %s", ctx->path);
+    for (size_t i = 0; i < blocks; i++) {
+        if (write(fd, g_buf_pattern, BLOCK_SIZE) != BLOCK_SIZE)
+            err(1, "write");
+    }
+    if (close(fd) < 0)
+        err(1, "close %s", ctx->path);
+    return blocks;
+}
+
+static uint64_t run_fsync(struct thread_ctx* ctx) {
+    size_t blocks = blocks_count();
+    int fd = open(ctx->path, O_RDWR);
+    if (fd < 0)
+        err(1, "open %s", ctx->path);
+    for (size_t i = 0; i < FSYNC_ITERATIONS; i++) {
+        off_t off = (off_t)(rand_r(&ctx->seed) % blocks) * BLOCK_SIZE;
+        pwrite_all(fd, g_buf_pattern, BLOCK_SIZE, off);
+        if (fsync(fd) < 0)
+            err(1, "fsync");
+    }
+    if (close(fd) < 0)
+        err(1, "close %s", ctx->path);
+    return FSYNC_ITERATIONS;
+}
+
+static const struct operation g_operations[] = {
+    { "seqread",   "MiB/s", true,  NULL,               run_seqread   },
+    { "randread",  "ops/s", true,  NULL,               run_randread  },
+    { "openstat",  "ops/s", true,  NULL,               run_openstat  },
+    { "seqwrite",  "MiB/s", false, NULL,               run_seqwrite  },
+    { "randwrite", "ops/s", false, prepare_full_file,  run_randwrite },
+    { "append",    "ops/s", false, prepare_empty_file, run_append    },
+    { "fsync",     "ops/s", false, prepare_full_file,  run_fsync     },
+};
+
+static void* thread_func(void* arg) {
+    struct thread_ctx* ctx = arg;
+
+    if (g_op->prepare)
+        g_op->prepare(ctx);
+
+    pthread_barrier_wait(&g_barrier);
+    ctx->done = g_op->run(ctx);
+    return NULL;
+}
+
+static void usage(char* argv0) {
+    fprintf(stderr, "usage: %s KIND OPERATION FILESIZE THREADCOUNT\n", argv0);
+    fprintf(stderr, "operations:");
+    for (size_t i = 0; i < sizeof(g_operations) / sizeof(g_operations[0]); i++)
+        fprintf(stderr, " %s", g_operations[i].name);
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 5) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    g_kind = argv[1];
+    for (size_t i = 0; i < sizeof(g_operations) / sizeof(g_operations[0]); i++)
+        if (!strcmp(argv[2], g_operations[i].name))
+            g_op = &g_operations[i];
+
+    errno = 0;
+    g_file_size = strtoul(argv[3], NULL, 0);
+    long threadcount = strtol(argv[4], NULL, 0);
+    if (!g_op || errno != 0 || threadcount <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    bool trusted = !strcmp(g_kind, "trusted");
+    if (trusted && !g_op->shared_file)
+        errx(2, "trusted files can't be written");
+
+    memset(g_buf_pattern, 0xa5, sizeof(g_buf_pattern));
+
+    char shared_path[256];
+    snprintf(shared_path, sizeof(shared_path), "%s/%s/file_%zu", DATA_DIR, g_kind, g_file_size);
+    if (g_op->shared_file && !trusted)
+        fill_file(shared_path, g_file_size);
+
+    struct thread_ctx* threads = calloc(threadcount, sizeof(*threads));
+    if (!threads)
+        err(1, "calloc");
+
+    if (pthread_barrier_init(&g_barrier, NULL, threadcount + 1))
+        errx(1, "pthread_barrier_init");
+
+    for (long i = 0; i < threadcount; i++) {
+        threads[i].seed = i + 1;
+        if (g_op->shared_file) {
+            memcpy(threads[i].path, shared_path, sizeof(shared_path));
+        } else {
+            snprintf(threads[i].path, sizeof(threads[i].path), "%s/%s/thread%ld_%zu", DATA_DIR,
+                     g_kind, i, g_file_size);
+        }
+        if (pthread_create(&threads[i].thread, NULL, thread_func, &threads[i]))
+            errx(1, "pthread_create");
+    }
+
+    struct timespec start, end;
+    pthread_barrier_wait(&g_barrier);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    uint64_t done = 0;
+    for (long i = 0; i < threadcount; i++) {
+        pthread_join(threads[i].thread, NULL);
+        done += threads[i].done;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    double rate = done / elapsed;
+    if (!strcmp(g_op->unit, "MiB/s"))
+        rate /= 1024 * 1024;
+    printf("%s %s %s: %.2f\n", g_kind, g_op->name, g_op->unit, rate);
+
+    for (long i = 0; i < threadcount; i++)
+        if (!g_op->shared_file)
+            unlink(threads[i].path);
+    free(threads);
+    return 0;
+}
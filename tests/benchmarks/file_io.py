@@ -0,0 +1,80 @@
+# SPDX-License-Identifier: LGPL-3.0-or-later
+# Copyright (c) 2021 Intel Corporation
+
+import os
+import subprocess
+
+from . import Exec
+
+# pylint: disable=invalid-name,too-many-arguments
+
+class _FileIO:
+    # pylint: disable=no-self-use
+
+    file_io = {
+        'direct': Exec('file_io', manifest_template='file_io.manifest.template', RPC_THREADS=0),
+        'exitless': Exec('file_io', manifest_template='file_io.manifest.template', RPC_THREADS=8),
+    }
+    filesizes = [1 << 20, 16 << 20, 128 << 20]
+    threadcounts = [1, 4]
+    modes = ['direct', 'exitless']
+
+    def setup(self, kind, filesize, threadcount, mode):
+        # pylint: disable=unused-argument
+        file_io = self.file_io[mode]
+        data_path = file_io.benchmarks_path / 'file_io_data'
+        for file_kind in ('protected', 'trusted', 'allowed'):
+            (data_path / file_kind).mkdir(parents=True, exist_ok=True)
+
+        # trusted files are hashed when the manifest is signed, so they can't be created by the
+        # benchmark itself
+        for size in self.filesizes:
+            path = data_path / 'trusted' / 'file_{}'.format(size)
+            if not path.exists() or path.stat().st_size != size:
+                with open(path, 'wb') as file:
+                    file.write(os.urandom(size))
+
+        file_io.setup()
+
+    def run(self, kind, operation, filesize, threadcount, mode):
+        proc = self.file_io[mode].run_in_graphene(kind, operation, str(filesize),
+            str(threadcount), sgx=True, stdout=subprocess.PIPE)
+        return float(proc.stdout.decode().split()[-1])
+
+class FileReads(_FileIO):
+    params = [['protected', 'trusted', 'allowed'], _FileIO.filesizes, _FileIO.threadcounts,
+        _FileIO.modes]
+    param_names = ['kind', 'filesize', 'threadcount', 'mode']
+
+    def track_seqread(self, kind, filesize, threadcount, mode):
+        return self.run(kind, 'seqread', filesize, threadcount, mode)
+    track_seqread.unit = 'MiB/s'
+
+    def track_randread(self, kind, filesize, threadcount, mode):
+        return self.run(kind, 'randread', filesize, threadcount, mode)
+    track_randread.unit = 'ops/s'
+
+    def track_openstat(self, kind, filesize, threadcount, mode):
+        return self.run(kind, 'openstat', filesize, threadcount, mode)
+    track_openstat.unit = 'ops/s'
+
+class FileWrites(_FileIO):
+    # trusted files are read-only
+    params = [['protected', 'allowed'], _FileIO.filesizes, _FileIO.threadcounts, _FileIO.modes]
+    param_names = ['kind', 'filesize', 'threadcount', 'mode']
+
+    def track_seqwrite(self, kind, filesize, threadcount, mode):
+        return self.run(kind, 'seqwrite', filesize, threadcount, mode)
+    track_seqwrite.unit = 'MiB/s'
+
+    def track_randwrite(self, kind, filesize, threadcount, mode):
+        return self.run(kind, 'randwrite', filesize, threadcount, mode)
+    track_randwrite.unit = 'ops/s'
+
+    def track_append(self, kind, filesize, threadcount, mode):
+        return self.run(kind, 'append', filesize, threadcount, mode)
+    track_append.unit = 'ops/s'
+
+    def track_fsync(self, kind, filesize, threadcount, mode):
+        return self.run(kind, 'fsync', filesize, threadcount, mode)
+    track_fsync.unit = 'ops/s'
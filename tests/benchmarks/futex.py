@@ -0,0 +1,23 @@
+# SPDX-License-Identifier: LGPL-3.0-or-later
+# Copyright (c) 2021 Intel Corporation
+
+import subprocess
+
+from . import Exec
+
+# pylint: disable=invalid-name
+
+class FutexContention:
+    # pylint: disable=no-self-use
+
+    futex_contention = Exec('futex_contention', manifest_template='futex.manifest.template')
+    params = [['private', 'shared'], [1, 4, 16, 64]]
+    param_names = ['mode', 'threadcount']
+    setup = futex_contention.setup
+    iterations = 100000
+
+    def track_futex_calls_per_sec(self, mode, threadcount):
+        proc = self.futex_contention.run_in_graphene(mode, str(threadcount), str(self.iterations),
+            sgx=True, stdout=subprocess.PIPE)
+        return float(proc.stdout.decode().split()[-1])
+    track_futex_calls_per_sec.unit = 'syscalls/s'
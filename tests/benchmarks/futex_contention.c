@@ -0,0 +1,111 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * Issue FUTEX_WAKE and FUTEX_WAIT (with a mismatching value, so that it returns EAGAIN right away)
+ * syscalls from THREADCOUNT threads in parallel and report the achieved syscall rate. In "private"
+ * mode every thread uses its own futex word, in "shared" mode all threads use the same one. Nothing
+ * ever sleeps, so this measures the cost of futex lookup and locking: with private words, threads
+ * should not contend with each other at all.
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/* one futex word per cache line, so that private words don't share cache lines */
+struct futex_word {
+    uint32_t val;
+} __attribute__((aligned(64)));
+
+static struct futex_word* g_words;
+static long g_iterations;
+static pthread_barrier_t g_barrier;
+
+static long futex(uint32_t* uaddr, int op, uint32_t val) {
+    return syscall(SYS_futex, uaddr, op, val, NULL, NULL, 0);
+}
+
+static void* thread_func(void* arg) {
+    uint32_t* uaddr = arg;
+
+    pthread_barrier_wait(&g_barrier);
+    for (long i = 0; i < g_iterations; i++) {
+        if (futex(uaddr, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, 1) < 0)
+            err(1, "futex wake");
+        if (futex(uaddr, FUTEX_WAIT | FUTEX_PRIVATE_FLAG, 1) != -1 || errno != EAGAIN)
+            errx(1, "futex wait didn't fail with EAGAIN");
+    }
+    return NULL;
+}
+
+static void usage(char* argv0) {
+    fprintf(stderr, "usage: %s private|shared THREADCOUNT ITERATIONS\n", argv0);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 4) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    bool shared;
+    if (!strcmp(argv[1], "private")) {
+        shared = false;
+    } else if (!strcmp(argv[1], "shared")) {
+        shared = true;
+    } else {
+        usage(argv[0]);
+        return 2;
+    }
+
+    errno = 0;
+    long threadcount = strtol(argv[2], NULL, 0);
+    g_iterations = strtol(argv[3], NULL, 0);
+    if (errno != 0 || threadcount <= 0 || g_iterations <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    /* futex words are 0, every FUTEX_WAIT expects 1 */
+    g_words = aligned_alloc(sizeof(*g_words), threadcount * sizeof(*g_words));
+    pthread_t* threads = calloc(threadcount, sizeof(*threads));
+    if (!g_words || !threads)
+        err(1, "alloc");
+    memset(g_words, 0, threadcount * sizeof(*g_words));
+
+    if (pthread_barrier_init(&g_barrier, NULL, threadcount + 1))
+        errx(1, "pthread_barrier_init");
+
+    for (long i = 0; i < threadcount; i++) {
+        uint32_t* uaddr = &g_words[shared ? 0 : i].val;
+        if (pthread_create(&threads[i], NULL, thread_func, uaddr))
+            errx(1, "pthread_create");
+    }
+
+    struct timespec start, end;
+    pthread_barrier_wait(&g_barrier);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (long i = 0; i < threadcount; i++)
+        pthread_join(threads[i], NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%.0f\n", 2 * threadcount * g_iterations / elapsed);
+
+    free(threads);
+    free(g_words);
+    return 0;
+}
@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * Issue ITERATIONS raw getpid/gettid/getuid syscalls (bypassing any caching in libc) and report the
+ * achieved syscall rate. The LibOS answers these from its own state, so this measures the bare
+ * syscall entry/exit cost.
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+static void usage(char* argv0) {
+    fprintf(stderr, "usage: %s getpid|gettid|getuid ITERATIONS\n", argv0);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    long nr;
+    if (!strcmp(argv[1], "getpid")) {
+        nr = SYS_getpid;
+    } else if (!strcmp(argv[1], "gettid")) {
+        nr = SYS_gettid;
+    } else if (!strcmp(argv[1], "getuid")) {
+        nr = SYS_getuid;
+    } else {
+        usage(argv[0]);
+        return 2;
+    }
+
+    errno = 0;
+    long iterations = strtol(argv[2], NULL, 0);
+    if (errno != 0 || iterations <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (long i = 0; i < iterations; i++)
+        if (syscall(nr) < 0)
+            err(1, "%s", argv[1]);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%.0f\n", iterations / elapsed);
+    return 0;
+}
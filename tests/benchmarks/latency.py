@@ -0,0 +1,121 @@
+# SPDX-License-Identifier: LGPL-3.0-or-later
+# Copyright (c) 2021 Intel Corporation
+
+'''
+Tail-latency benchmarks
+-----------------------
+
+Latency percentiles (p50, p99, p99.9) and throughput of network servers under an open-loop load
+(see ``loadgen.c``), across a matrix of ``sgx.thread_num``, ``sgx.rpc_thread_num``, connection
+counts and payload sizes. The SGX manifest options matter only for ``sgx``, so ``native`` and
+``nosgx`` are run only with the first values of them. Each metric is a separate run of the server.
+
+Workloads:
+
+- ``NginxLatency``: HTTP/1.1 keep-alive GETs of static files, one request at a time per connection,
+- ``NginxMultiplexed``: the same, but with many requests in flight on each connection, the way
+  HTTP/2 clients multiplex streams (HTTP/1.1 pipelining is used, as ``loadgen`` doesn't speak
+  HTTP/2),
+- ``RedisLatency``: Redis GETs,
+- ``MemcachedLatency``: memcached GETs.
+
+This benchmark can be configured with the following environment variables (and the ``NGINX`` and
+``REDIS_SERVER`` variables of the nginx and Redis benchmarks, the servers must listen on the default
+ports):
+
+.. envvar:: MEMCACHED
+    Command executed as memcached server. Default is ``memcached -u nobody -U 0 -t 2``.
+
+.. envvar:: LOADGEN_RATE
+    Requests per second sent by ``loadgen``. Default is 10000.
+
+.. envvar:: LOADGEN_DURATION
+    Duration of the load in seconds. Default is 10.
+'''
+
+import os
+import shlex
+import subprocess
+
+from . import Exec, which
+from .nginx import CONF_DIR, NGINX
+from .redis import REDIS_SERVER
+
+MEMCACHED = shlex.split(os.getenv('MEMCACHED', 'memcached -u nobody -U 0 -t 2'))
+LOADGEN_RATE = os.getenv('LOADGEN_RATE', '10000')
+LOADGEN_DURATION = os.getenv('LOADGEN_DURATION', '10')
+
+class _Latency:
+    # pylint: disable=no-self-use,attribute-defined-outside-init
+
+    params = [[8, 16], [0, 4], [1, 16, 64], [64, 4096, 65536], ['native', 'nosgx', 'sgx']]
+    param_names = ['thread_num', 'rpc_thread_num', 'connections', 'payload', 'env']
+    timeout = 600
+
+    # set by subclasses
+    command = None
+    manifest_template = None
+    protocol = None
+    port = None
+    depth = 1
+
+    def setup(self, thread_num, rpc_thread_num, _connections, _payload, env):
+        if env != 'sgx' and (thread_num, rpc_thread_num) != (self.params[0][0], self.params[1][0]):
+            # the same configuration as with the first values
+            raise NotImplementedError()
+
+        self.server = Exec(which(self.command[0]), manifest_template=self.manifest_template,
+            THREADS=thread_num, RPC_THREADS=rpc_thread_num, CONFDIR=CONF_DIR)
+        if env != 'native':
+            self.server.setup()
+
+    def _run(self, connections, payload, env):
+        if env == 'native':
+            server = self.server.native_server(*self.command[1:])
+        else:
+            server = self.server.graphene_server(*self.command[1:], sgx=(env == 'sgx'))
+
+        with server:
+            proc = subprocess.run([os.fspath(self.server.conf_path / 'loadgen'), self.protocol,
+                '127.0.0.1', str(self.port), str(connections), str(self.depth), LOADGEN_RATE,
+                LOADGEN_DURATION, str(payload)], check=True, stdout=subprocess.PIPE)
+        # p50, p99, p99.9, throughput
+        return [float(value) for value in proc.stdout.decode().split()[-4:]]
+
+    def track_p50(self, _thread_num, _rpc_thread_num, connections, payload, env):
+        return self._run(connections, payload, env)[0]
+    track_p50.unit = 'us'
+
+    def track_p99(self, _thread_num, _rpc_thread_num, connections, payload, env):
+        return self._run(connections, payload, env)[1]
+    track_p99.unit = 'us'
+
+    def track_p999(self, _thread_num, _rpc_thread_num, connections, payload, env):
+        return self._run(connections, payload, env)[2]
+    track_p999.unit = 'us'
+
+    def track_throughput(self, _thread_num, _rpc_thread_num, connections, payload, env):
+        return self._run(connections, payload, env)[3]
+    track_throughput.unit = 'requests/s'
+
+class NginxLatency(_Latency):
+    command = NGINX
+    manifest_template = 'nginx.manifest.template'
+    protocol = 'http'
+    port = 8002
+
+class NginxMultiplexed(NginxLatency):
+    params = [*_Latency.params[:2], [1, 4], *_Latency.params[3:]]
+    depth = 16
+
+class RedisLatency(_Latency):
+    command = REDIS_SERVER
+    manifest_template = 'redis-server.manifest.template'
+    protocol = 'redis'
+    port = 6379
+
+class MemcachedLatency(_Latency):
+    command = MEMCACHED
+    manifest_template = 'memcached.manifest.template'
+    protocol = 'memcached'
+    port = 11211
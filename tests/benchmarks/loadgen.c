@@ -0,0 +1,447 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * Open-loop load generator for request-response servers:
+ *
+ *   loadgen PROTOCOL HOST PORT CONNECTIONS DEPTH RATE DURATION PAYLOAD
+ *
+ * Sends RATE requests per second for DURATION seconds, spread round-robin over CONNECTIONS
+ * connections, with at most DEPTH requests in flight on each connection (requests are pipelined if
+ * DEPTH is more than 1). The requests are scheduled on a fixed timetable, which doesn't slow down
+ * when the server does, and the latency of each request is taken from its scheduled time, so stalls
+ * of the server show up in the tail instead of being hidden (no coordinated omission). Reports the
+ * 50th, 99th and 99.9th percentile of latency in microseconds and the achieved throughput in
+ * requests per second (the last four numbers printed).
+ *
+ * Protocols:
+ *
+ *   http       HTTP/1.1 keep-alive GET of "/PAYLOAD.html" (a file of PAYLOAD bytes)
+ *   memcached  memcached text protocol GET of a key set to PAYLOAD bytes beforehand
+ *   redis      Redis RESP GET of a key set to PAYLOAD bytes beforehand
+ */
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define KEY "loadgen"
+
+#define RECV_BUF_SIZE     (64 * 1024)
+#define CONNECT_RETRIES   30
+#define DRAIN_TIMEOUT_SEC 10
+#define MAX_EVENTS        64
+
+struct conn {
+    int fd;
+    long scheduled;     /* requests of this connection whose time has come */
+    long sent;          /* requests fully written */
+    long completed;     /* responses received */
+    size_t write_off;   /* of the request being written */
+    bool want_out;
+    char* buf;          /* received data not parsed yet, NUL-terminated */
+    size_t buf_len;
+    size_t buf_size;
+};
+
+/* returns the length of the complete response at the start of `buf`, 0 if incomplete and -1 if
+ * invalid; `buf` is NUL-terminated */
+typedef ssize_t (*response_len_t)(const char* buf, size_t len);
+
+static response_len_t g_response_len;
+static char* g_request;
+static size_t g_request_len;
+
+static struct conn* g_conns;
+static long g_conns_count;
+static long g_depth;
+static double g_rate;
+
+static uint64_t g_start_ns;
+static uint64_t g_last_ns;
+static uint64_t* g_latencies;
+static long g_total;
+static long g_issued;
+static long g_completed;
+
+static void usage(const char* argv0) {
+    fprintf(stderr, "usage: %s http|memcached|redis HOST PORT CONNECTIONS DEPTH RATE DURATION "
+                    "PAYLOAD\n", argv0);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* scheduled time of the `i`-th request of all */
+static uint64_t request_time_ns(long i) {
+    return g_start_ns + (uint64_t)(i * 1e9 / g_rate);
+}
+
+static ssize_t http_response_len(const char* buf, size_t len) {
+    const char* end = memmem(buf, len, "\r\n\r\n", 4);
+    if (!end)
+        return 0;
+    if (strncmp(buf, "HTTP/1.1 200 ", strlen("HTTP/1.1 200 ")))
+        return -1;
+
+    size_t header_len = end + 4 - buf;
+    const char* field = strcasestr(buf, "\r\nContent-Length:");
+    if (!field || field > end)
+        return -1;
+    size_t total = header_len + strtoul(field + strlen("\r\nContent-Length:"), NULL, 10);
+    return len < total ? 0 : (ssize_t)total;
+}
+
+static ssize_t memcached_response_len(const char* buf, size_t len) {
+    const char* eol = memmem(buf, len, "\r\n", 2);
+    if (!eol)
+        return 0;
+
+    size_t value_len;
+    if (sscanf(buf, "VALUE " KEY " %*u %zu\r\n", &value_len) != 1)
+        return -1;
+    size_t total = eol + 2 - buf + value_len + strlen("\r\nEND\r\n");
+    if (len < total)
+        return 0;
+    return memcmp(buf + total - strlen("END\r\n"), "END\r\n", strlen("END\r\n")) ? -1
+                                                                                  : (ssize_t)total;
+}
+
+static ssize_t redis_response_len(const char* buf, size_t len) {
+    const char* eol = memmem(buf, len, "\r\n", 2);
+    if (!eol)
+        return 0;
+
+    long value_len;
+    if (buf[0] != '$' || (value_len = strtol(buf + 1, NULL, 10)) < 0)
+        return -1;
+    size_t total = eol + 2 - buf + value_len + 2;
+    return len < total ? 0 : (ssize_t)total;
+}
+
+static void write_all(int fd, const char* buf, size_t len) {
+    while (len) {
+        ssize_t ret = write(fd, buf, len);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            err(1, "write");
+        }
+        buf += ret;
+        len -= ret;
+    }
+}
+
+/* sends `request` on a blocking `fd` and checks that the response is exactly `response` */
+static void transact(int fd, const char* request, size_t request_len, const char* response) {
+    char buf[64];
+    size_t len = 0;
+    size_t response_len = strlen(response);
+    assert(response_len <= sizeof(buf));
+
+    write_all(fd, request, request_len);
+    while (len < response_len) {
+        ssize_t ret = read(fd, buf + len, response_len - len);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            err(1, "read");
+        }
+        if (ret == 0)
+            errx(1, "connection closed by the server");
+        len += ret;
+    }
+    if (memcmp(buf, response, response_len))
+        errx(1, "unexpected response of the server");
+}
+
+/* prepares the requests and sets the key for memcached and Redis */
+static void prepare(const char* protocol, const char* host, int fd, long payload) {
+    char* value = malloc(payload);
+    if (!value)
+        err(1, "malloc");
+    memset(value, 'x', payload);
+
+    char* set_request = NULL;
+    int set_len = 0;
+    int ret;
+    if (!strcmp(protocol, "http")) {
+        g_response_len = http_response_len;
+        ret = asprintf(&g_request, "GET /%ld.html HTTP/1.1\r\nHost: %s\r\n\r\n", payload, host);
+    } else if (!strcmp(protocol, "memcached")) {
+        g_response_len = memcached_response_len;
+        ret = asprintf(&g_request, "get " KEY "\r\n");
+        set_len = asprintf(&set_request, "set " KEY " 0 0 %ld\r\n%.*s\r\n", payload, (int)payload,
+                           value);
+    } else if (!strcmp(protocol, "redis")) {
+        g_response_len = redis_response_len;
+        ret = asprintf(&g_request, "*2\r\n$3\r\nGET\r\n$%zu\r\n" KEY "\r\n", strlen(KEY));
+        set_len = asprintf(&set_request, "*3\r\n$3\r\nSET\r\n$%zu\r\n" KEY "\r\n$%ld\r\n%.*s\r\n",
+                           strlen(KEY), payload, (int)payload, value);
+    } else {
+        errx(2, "unknown protocol: %s", protocol);
+    }
+    if (ret < 0 || set_len < 0)
+        err(1, "asprintf");
+    g_request_len = ret;
+
+    if (set_request) {
+        transact(fd, set_request, set_len,
+                 !strcmp(protocol, "memcached") ? "STORED\r\n" : "+OK\r\n");
+        free(set_request);
+    }
+    free(value);
+}
+
+static int connect_to(const char* host, const char* port) {
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo* addrs;
+    int ret = getaddrinfo(host, port, &hints, &addrs);
+    if (ret)
+        errx(1, "getaddrinfo: %s", gai_strerror(ret));
+
+    /* the server may be still starting */
+    for (int retries = 0; retries < CONNECT_RETRIES; retries++) {
+        for (struct addrinfo* addr = addrs; addr; addr = addr->ai_next) {
+            int fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+            if (fd < 0)
+                err(1, "socket");
+            if (connect(fd, addr->ai_addr, addr->ai_addrlen) == 0) {
+                int one = 1;
+                if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0)
+                    err(1, "setsockopt");
+                freeaddrinfo(addrs);
+                return fd;
+            }
+            if (errno != ECONNREFUSED)
+                err(1, "connect");
+            close(fd);
+        }
+        sleep(1);
+    }
+    errx(1, "cannot connect to %s:%s", host, port);
+}
+
+static void set_events(struct conn* conn, int epfd, bool want_out) {
+    struct epoll_event event = {
+        .events = EPOLLIN | (want_out ? EPOLLOUT : 0),
+        .data.ptr = conn,
+    };
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &event) < 0)
+        err(1, "epoll_ctl");
+    conn->want_out = want_out;
+}
+
+static void try_send(struct conn* conn, int epfd) {
+    while (conn->sent < conn->scheduled && conn->sent - conn->completed < g_depth) {
+        ssize_t ret = write(conn->fd, g_request + conn->write_off,
+                            g_request_len - conn->write_off);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN)
+                err(1, "write");
+            if (!conn->want_out)
+                set_events(conn, epfd, /*want_out=*/true);
+            return;
+        }
+        conn->write_off += ret;
+        if (conn->write_off == g_request_len) {
+            conn->write_off = 0;
+            conn->sent++;
+        }
+    }
+    if (conn->want_out)
+        set_events(conn, epfd, /*want_out=*/false);
+}
+
+static void receive(struct conn* conn, int epfd) {
+    while (1) {
+        if (conn->buf_len == conn->buf_size) {
+            conn->buf_size *= 2;
+            conn->buf = realloc(conn->buf, conn->buf_size + 1);
+            if (!conn->buf)
+                err(1, "realloc");
+        }
+        size_t space = conn->buf_size - conn->buf_len;
+        ssize_t ret = read(conn->fd, conn->buf + conn->buf_len, space);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                break;
+            err(1, "read");
+        }
+        if (ret == 0)
+            errx(1, "connection closed by the server");
+        conn->buf_len += ret;
+        conn->buf[conn->buf_len] = '\0';
+        if ((size_t)ret < space)
+            break; /* no more data for now */
+    }
+
+    uint64_t now = now_ns();
+    size_t off = 0;
+    ssize_t len;
+    while ((len = g_response_len(conn->buf + off, conn->buf_len - off)) > 0) {
+        if (conn->completed == conn->sent)
+            errx(1, "response to a request which wasn't sent");
+        long i = conn->completed * g_conns_count + (conn - g_conns);
+        g_latencies[g_completed++] = now - request_time_ns(i);
+        conn->completed++;
+        off += len;
+    }
+    if (len < 0)
+        errx(1, "invalid response of the server");
+    if (off) {
+        g_last_ns = now;
+        conn->buf_len -= off;
+        memmove(conn->buf, conn->buf + off, conn->buf_len + 1);
+    }
+
+    try_send(conn, epfd);
+}
+
+/* issues the requests whose time has come and arms `timerfd` for the next one */
+static void issue(int timerfd, int epfd) {
+    uint64_t now = now_ns();
+    while (g_issued < g_total && request_time_ns(g_issued) <= now) {
+        struct conn* conn = &g_conns[g_issued % g_conns_count];
+        conn->scheduled++;
+        try_send(conn, epfd);
+        g_issued++;
+    }
+    if (g_issued == g_total)
+        return;
+
+    uint64_t next = request_time_ns(g_issued);
+    struct itimerspec spec = {
+        .it_value = {.tv_sec = next / 1000000000UL, .tv_nsec = next % 1000000000UL},
+    };
+    if (timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &spec, NULL) < 0)
+        err(1, "timerfd_settime");
+}
+
+static int cmp_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* nearest-rank percentile of sorted `g_latencies`, in microseconds */
+static double percentile(double p) {
+    long rank = (long)(p * g_total + 0.999999);
+    return g_latencies[rank > 0 ? rank - 1 : 0] / 1000.0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 9) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    errno = 0;
+    g_conns_count = strtol(argv[4], NULL, 0);
+    g_depth = strtol(argv[5], NULL, 0);
+    g_rate = strtod(argv[6], NULL);
+    double duration = strtod(argv[7], NULL);
+    long payload = strtol(argv[8], NULL, 0);
+    if (errno != 0 || g_conns_count <= 0 || g_depth <= 0 || g_rate <= 0 || duration <= 0
+            || payload <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    g_total = g_rate * duration;
+    if (g_total <= 0)
+        errx(2, "RATE * DURATION must be at least 1");
+    g_latencies = malloc(g_total * sizeof(*g_latencies));
+    g_conns = calloc(g_conns_count, sizeof(*g_conns));
+    if (!g_latencies || !g_conns)
+        err(1, "malloc");
+
+    int epfd = epoll_create1(0);
+    if (epfd < 0)
+        err(1, "epoll_create1");
+
+    for (long i = 0; i < g_conns_count; i++) {
+        struct conn* conn = &g_conns[i];
+        conn->fd = connect_to(argv[2], argv[3]);
+        if (i == 0)
+            prepare(argv[1], argv[2], conn->fd, payload);
+        if (fcntl(conn->fd, F_SETFL, O_NONBLOCK) < 0)
+            err(1, "fcntl");
+
+        conn->buf_size = RECV_BUF_SIZE;
+        conn->buf = malloc(conn->buf_size + 1);
+        if (!conn->buf)
+            err(1, "malloc");
+
+        struct epoll_event event = {.events = EPOLLIN, .data.ptr = conn};
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, conn->fd, &event) < 0)
+            err(1, "epoll_ctl");
+    }
+
+    int timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (timerfd < 0)
+        err(1, "timerfd_create");
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, timerfd, &event) < 0)
+        err(1, "epoll_ctl");
+
+    g_start_ns = now_ns();
+    uint64_t deadline = g_start_ns + (uint64_t)((duration + DRAIN_TIMEOUT_SEC) * 1e9);
+    issue(timerfd, epfd);
+
+    while (g_completed < g_total) {
+        uint64_t now = now_ns();
+        if (now >= deadline)
+            errx(1, "%ld of %ld requests not answered in time", g_total - g_completed, g_total);
+
+        struct epoll_event events[MAX_EVENTS];
+        int count = epoll_wait(epfd, events, MAX_EVENTS, (deadline - now) / 1000000 + 1);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+            err(1, "epoll_wait");
+        }
+        for (int i = 0; i < count; i++) {
+            struct conn* conn = events[i].data.ptr;
+            if (!conn) {
+                uint64_t expirations;
+                if (read(timerfd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+                    err(1, "read timerfd");
+                issue(timerfd, epfd);
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                receive(conn, epfd);
+            if (events[i].events & EPOLLOUT)
+                try_send(conn, epfd);
+        }
+    }
+
+    qsort(g_latencies, g_total, sizeof(*g_latencies), cmp_u64);
+    printf("%.1f %.1f %.1f %.0f\n",
+           percentile(0.5), percentile(0.99), percentile(0.999),
+           g_total / ((g_last_ns - g_start_ns) / 1e9));
+    return 0;
+}
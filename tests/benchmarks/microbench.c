@@ -0,0 +1,388 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * Run OPERATION ITERATIONS times and report the achieved number of operations per second. The
+ * operations are single syscalls or short syscall sequences, so that the same binary measures their
+ * cost natively, in Graphene and in Graphene-SGX (with direct and exitless OCALLs):
+ *
+ *   empty          syscall with an invalid number (returns ENOSYS)
+ *   getpid         raw getpid syscall
+ *   clock_gettime  clock_gettime(CLOCK_MONOTONIC)
+ *   futex          FUTEX_WAKE/FUTEX_WAIT ping-pong between two threads (one round trip)
+ *   pipe           1-byte ping-pong over two pipes between two threads (one round trip)
+ *   read_small     64-byte pread from a file
+ *   read_large     1 MB pread from a file
+ *   write_small    64-byte pwrite to a file
+ *   write_large    1 MB pwrite to a file
+ *   open           open, fstat and close of a file
+ *   mmap           mmap of 64 KB of anonymous memory, touching one page, munmap
+ *   poll           poll on FDCOUNT pipes, none of them ready (zero timeout)
+ *   epoll          epoll_wait on FDCOUNT pipes, none of them ready (zero timeout)
+ *   thread         pthread_create and pthread_join of a thread doing nothing
+ *   fork           fork of a child which exits right away, waitpid
+ *   exec           fork of a child which executes this binary with "noop", waitpid
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DATA_PATH  "microbench_data"
+#define SMALL_SIZE 64
+#define LARGE_SIZE (1024 * 1024)
+#define MMAP_SIZE  (64 * 1024)
+
+static long g_iterations;
+static long g_fdcount = 1;
+static const char* g_argv0;
+
+static char g_buf[LARGE_SIZE];
+
+static struct timespec g_start;
+
+/* called by each benchmark after its setup */
+static void start_clock(void) {
+    clock_gettime(CLOCK_MONOTONIC, &g_start);
+}
+
+static void usage(const char* argv0) {
+    fprintf(stderr, "usage: %s empty|getpid|clock_gettime|futex|pipe|read_small|read_large|"
+                    "write_small|write_large|open|mmap|poll|epoll|thread|fork|exec ITERATIONS "
+                    "[FDCOUNT]\n", argv0);
+}
+
+static void bench_empty(void) {
+    start_clock();
+    for (long i = 0; i < g_iterations; i++)
+        if (syscall(0x1000) != -1 || errno != ENOSYS)
+            errx(1, "invalid syscall didn't fail with ENOSYS");
+}
+
+static void bench_getpid(void) {
+    start_clock();
+    for (long i = 0; i < g_iterations; i++)
+        if (syscall(SYS_getpid) < 0)
+            err(1, "getpid");
+}
+
+static void bench_clock_gettime(void) {
+    struct timespec ts;
+    start_clock();
+    for (long i = 0; i < g_iterations; i++)
+        if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+            err(1, "clock_gettime");
+}
+
+static _Atomic uint32_t g_futex_word = 0;
+
+static long futex(_Atomic uint32_t* uaddr, int op, uint32_t val) {
+    return syscall(SYS_futex, uaddr, op, val, NULL, NULL, 0);
+}
+
+/* waits until `g_futex_word` becomes `val` */
+static void futex_wait_for(uint32_t val) {
+    uint32_t cur;
+    while ((cur = atomic_load(&g_futex_word)) != val)
+        if (futex(&g_futex_word, FUTEX_WAIT_PRIVATE, cur) < 0 && errno != EAGAIN && errno != EINTR)
+            err(1, "futex wait");
+}
+
+static void futex_set(uint32_t val) {
+    atomic_store(&g_futex_word, val);
+    if (futex(&g_futex_word, FUTEX_WAKE_PRIVATE, 1) < 0)
+        err(1, "futex wake");
+}
+
+static void* futex_thread(void* arg) {
+    (void)arg;
+    for (long i = 0; i < g_iterations; i++) {
+        futex_wait_for(1);
+        futex_set(0);
+    }
+    return NULL;
+}
+
+static void bench_futex(void) {
+    pthread_t thread;
+    if ((errno = pthread_create(&thread, NULL, futex_thread, NULL)))
+        err(1, "pthread_create");
+
+    start_clock();
+    for (long i = 0; i < g_iterations; i++) {
+        futex_set(1);
+        futex_wait_for(0);
+    }
+
+    if ((errno = pthread_join(thread, NULL)))
+        err(1, "pthread_join");
+}
+
+static int g_ping[2];
+static int g_pong[2];
+
+static void* pipe_thread(void* arg) {
+    (void)arg;
+    char c;
+    for (long i = 0; i < g_iterations; i++) {
+        if (read(g_ping[0], &c, 1) != 1)
+            err(1, "read");
+        if (write(g_pong[1], &c, 1) != 1)
+            err(1, "write");
+    }
+    return NULL;
+}
+
+static void bench_pipe(void) {
+    if (pipe(g_ping) < 0 || pipe(g_pong) < 0)
+        err(1, "pipe");
+
+    pthread_t thread;
+    if ((errno = pthread_create(&thread, NULL, pipe_thread, NULL)))
+        err(1, "pthread_create");
+
+    char c = 'x';
+    start_clock();
+    for (long i = 0; i < g_iterations; i++) {
+        if (write(g_ping[1], &c, 1) != 1)
+            err(1, "write");
+        if (read(g_pong[0], &c, 1) != 1)
+            err(1, "read");
+    }
+
+    if ((errno = pthread_join(thread, NULL)))
+        err(1, "pthread_join");
+}
+
+static int open_data_file(void) {
+    int fd = open(DATA_PATH, O_RDWR | O_CREAT, 0600);
+    if (fd < 0)
+        err(1, "open %s", DATA_PATH);
+    if (pwrite(fd, g_buf, LARGE_SIZE, 0) != LARGE_SIZE)
+        err(1, "pwrite");
+    return fd;
+}
+
+static void bench_read(size_t size) {
+    int fd = open_data_file();
+    start_clock();
+    for (long i = 0; i < g_iterations; i++)
+        if (pread(fd, g_buf, size, 0) != (ssize_t)size)
+            err(1, "pread");
+    close(fd);
+}
+
+static void bench_write(size_t size) {
+    int fd = open_data_file();
+    start_clock();
+    for (long i = 0; i < g_iterations; i++)
+        if (pwrite(fd, g_buf, size, 0) != (ssize_t)size)
+            err(1, "pwrite");
+    close(fd);
+}
+
+static void bench_open(void) {
+    close(open_data_file());
+
+    struct stat st;
+    start_clock();
+    for (long i = 0; i < g_iterations; i++) {
+        int fd = open(DATA_PATH, O_RDONLY);
+        if (fd < 0)
+            err(1, "open %s", DATA_PATH);
+        if (fstat(fd, &st) < 0)
+            err(1, "fstat");
+        if (close(fd) < 0)
+            err(1, "close");
+    }
+}
+
+static void bench_mmap(void) {
+    start_clock();
+    for (long i = 0; i < g_iterations; i++) {
+        char* addr = mmap(NULL, MMAP_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                          -1, 0);
+        if (addr == MAP_FAILED)
+            err(1, "mmap");
+        addr[0] = 1;
+        if (munmap(addr, MMAP_SIZE) < 0)
+            err(1, "munmap");
+    }
+}
+
+/* read ends of `g_fdcount` pipes, nothing is ever written to them */
+static int* open_pipes(void) {
+    int* fds = malloc(g_fdcount * sizeof(*fds));
+    if (!fds)
+        err(1, "malloc");
+    for (long i = 0; i < g_fdcount; i++) {
+        int p[2];
+        if (pipe(p) < 0)
+            err(1, "pipe");
+        fds[i] = p[0];
+    }
+    return fds;
+}
+
+static void bench_poll(void) {
+    int* fds = open_pipes();
+    struct pollfd* pfds = calloc(g_fdcount, sizeof(*pfds));
+    if (!pfds)
+        err(1, "calloc");
+    for (long i = 0; i < g_fdcount; i++) {
+        pfds[i].fd = fds[i];
+        pfds[i].events = POLLIN;
+    }
+
+    start_clock();
+    for (long i = 0; i < g_iterations; i++)
+        if (poll(pfds, g_fdcount, /*timeout=*/0) != 0)
+            errx(1, "poll didn't time out");
+}
+
+static void bench_epoll(void) {
+    int* fds = open_pipes();
+    int epfd = epoll_create1(0);
+    if (epfd < 0)
+        err(1, "epoll_create1");
+    for (long i = 0; i < g_fdcount; i++) {
+        struct epoll_event event = {.events = EPOLLIN, .data.fd = fds[i]};
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &event) < 0)
+            err(1, "epoll_ctl");
+    }
+
+    struct epoll_event event;
+    start_clock();
+    for (long i = 0; i < g_iterations; i++)
+        if (epoll_wait(epfd, &event, 1, /*timeout=*/0) != 0)
+            errx(1, "epoll_wait didn't time out");
+}
+
+static void* noop_thread(void* arg) {
+    return arg;
+}
+
+static void bench_thread(void) {
+    start_clock();
+    for (long i = 0; i < g_iterations; i++) {
+        pthread_t thread;
+        if ((errno = pthread_create(&thread, NULL, noop_thread, NULL)))
+            err(1, "pthread_create");
+        if ((errno = pthread_join(thread, NULL)))
+            err(1, "pthread_join");
+    }
+}
+
+static void bench_fork(bool exec) {
+    start_clock();
+    for (long i = 0; i < g_iterations; i++) {
+        pid_t pid = fork();
+        if (pid < 0)
+            err(1, "fork");
+        if (pid == 0) {
+            if (exec) {
+                execl(g_argv0, g_argv0, "noop", NULL);
+                err(1, "execl %s", g_argv0);
+            }
+            _exit(0);
+        }
+
+        int status;
+        if (waitpid(pid, &status, 0) < 0)
+            err(1, "waitpid");
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            errx(1, "child failed");
+    }
+}
+
+int main(int argc, char* argv[]) {
+    g_argv0 = argv[0];
+    if (argc == 2 && !strcmp(argv[1], "noop"))
+        return 0;
+
+    if (argc != 3 && argc != 4) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    errno = 0;
+    g_iterations = strtol(argv[2], NULL, 0);
+    if (errno != 0 || g_iterations <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (argc == 4) {
+        g_fdcount = strtol(argv[3], NULL, 0);
+        if (errno != 0 || g_fdcount <= 0) {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    struct {
+        const char* name;
+        void (*func)(void);
+    } simple_benches[] = {
+        {"empty", bench_empty},
+        {"getpid", bench_getpid},
+        {"clock_gettime", bench_clock_gettime},
+        {"futex", bench_futex},
+        {"pipe", bench_pipe},
+        {"open", bench_open},
+        {"mmap", bench_mmap},
+        {"poll", bench_poll},
+        {"epoll", bench_epoll},
+        {"thread", bench_thread},
+    };
+    const char* op = argv[1];
+
+    size_t i;
+    for (i = 0; i < sizeof(simple_benches) / sizeof(simple_benches[0]); i++) {
+        if (!strcmp(op, simple_benches[i].name)) {
+            simple_benches[i].func();
+            break;
+        }
+    }
+    if (i == sizeof(simple_benches) / sizeof(simple_benches[0])) {
+        if (!strcmp(op, "read_small")) {
+            bench_read(SMALL_SIZE);
+        } else if (!strcmp(op, "read_large")) {
+            bench_read(LARGE_SIZE);
+        } else if (!strcmp(op, "write_small")) {
+            bench_write(SMALL_SIZE);
+        } else if (!strcmp(op, "write_large")) {
+            bench_write(LARGE_SIZE);
+        } else if (!strcmp(op, "fork")) {
+            bench_fork(/*exec=*/false);
+        } else if (!strcmp(op, "exec")) {
+            bench_fork(/*exec=*/true);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double elapsed = (end.tv_sec - g_start.tv_sec) + (end.tv_nsec - g_start.tv_nsec) / 1e9;
+    printf("%.0f\n", g_iterations / elapsed);
+    return 0;
+}
@@ -0,0 +1,76 @@
+# SPDX-License-Identifier: LGPL-3.0-or-later
+# Copyright (c) 2021 Intel Corporation
+
+import subprocess
+
+from . import Exec
+
+# pylint: disable=invalid-name
+
+class _Microbench:
+    # pylint: disable=no-self-use
+
+    microbench = {
+        'direct': Exec('microbench', manifest_template='microbench.manifest.template',
+            RPC_THREADS=0),
+        'exitless': Exec('microbench', manifest_template='microbench.manifest.template',
+            RPC_THREADS=8),
+    }
+    envs = ['native', 'nosgx', 'sgx-direct', 'sgx-exitless']
+
+    # number of operations per run, for the slower operations smaller
+    iterations = {
+        'empty': 1000000,
+        'getpid': 1000000,
+        'clock_gettime': 1000000,
+        'futex': 100000,
+        'pipe': 100000,
+        'read_small': 100000,
+        'read_large': 1000,
+        'write_small': 100000,
+        'write_large': 1000,
+        'open': 10000,
+        'mmap': 10000,
+        'poll': 100000,
+        'epoll': 100000,
+        'thread': 1000,
+        'fork': 20,
+        'exec': 20,
+    }
+
+    @staticmethod
+    def _mode(env):
+        return 'exitless' if env == 'sgx-exitless' else 'direct'
+
+    def setup(self, *args):
+        # both modes write the same manifest, so set up the one of this run (`env` is the last
+        # parameter)
+        self.microbench[self._mode(args[-1])].setup()
+
+    def run(self, op, env, *args):
+        microbench = self.microbench[self._mode(env)]
+        args = (op, str(self.iterations[op]), *args)
+        if env == 'native':
+            proc = microbench.run_native(*args, stdout=subprocess.PIPE)
+        else:
+            proc = microbench.run_in_graphene(*args, sgx=(env != 'nosgx'),
+                stdout=subprocess.PIPE)
+        return float(proc.stdout.decode().split()[-1])
+
+class Syscalls(_Microbench):
+    params = [['empty', 'getpid', 'clock_gettime', 'futex', 'pipe', 'read_small', 'read_large',
+               'write_small', 'write_large', 'open', 'mmap', 'thread', 'fork', 'exec'],
+              _Microbench.envs]
+    param_names = ['operation', 'env']
+
+    def track_ops_per_sec(self, op, env):
+        return self.run(op, env)
+    track_ops_per_sec.unit = 'ops/s'
+
+class Polling(_Microbench):
+    params = [['poll', 'epoll'], [1, 16, 256], _Microbench.envs]
+    param_names = ['operation', 'fdcount', 'env']
+
+    def track_ops_per_sec(self, op, fdcount, env):
+        return self.run(op, env, str(fdcount))
+    track_ops_per_sec.unit = 'ops/s'
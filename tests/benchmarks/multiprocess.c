@@ -0,0 +1,263 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* Copyright (C) 2021 Intel Corporation */
+
+/*
+ * Multi-process benchmarks: each one runs ITERATIONS rounds and reports the achieved rate (the last
+ * number printed).
+ *
+ *   fork ITERATIONS HEAP_MB          fork of a process with HEAP_MB MB of touched heap, the child
+ *                                    exits right away; reports forks per second
+ *   fanout ITERATIONS CHILDREN       start CHILDREN children at once, each executing this binary
+ *                                    with "noop" (like `make -j`), and wait for all of them; reports
+ *                                    rounds per second
+ *   kill ITERATIONS CHILDREN         start CHILDREN children sleeping in pause(), kill all of them
+ *                                    with SIGTERM and wait for all of them; reports rounds per second
+ *   sem ITERATIONS                   ping-pong on two SysV semaphores between parent and child;
+ *                                    reports round trips per second
+ *   pipe ITERATIONS SIZE_KB          send SIZE_KB KB through a pipe to a child (in 64 KB writes);
+ *                                    reports MB per second
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/sem.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PIPE_CHUNK_SIZE (64 * 1024)
+
+static const char* g_argv0;
+static long g_iterations;
+static long g_arg;
+
+static struct timespec g_start;
+
+/* called by each benchmark after its setup */
+static void start_clock(void) {
+    clock_gettime(CLOCK_MONOTONIC, &g_start);
+}
+
+static void usage(const char* argv0) {
+    fprintf(stderr, "usage: %s fork ITERATIONS HEAP_MB\n"
+                    "       %s fanout|kill ITERATIONS CHILDREN\n"
+                    "       %s sem ITERATIONS\n"
+                    "       %s pipe ITERATIONS SIZE_KB\n", argv0, argv0, argv0, argv0);
+}
+
+static void wait_child(pid_t pid, int expected_signal) {
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        err(1, "waitpid");
+    if (expected_signal) {
+        if (!WIFSIGNALED(status) || WTERMSIG(status) != expected_signal)
+            errx(1, "child %d wasn't killed by signal %d", pid, expected_signal);
+    } else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        errx(1, "child %d failed", pid);
+    }
+}
+
+static void bench_fork(void) {
+    size_t size = g_arg * 1024 * 1024;
+    char* heap = malloc(size);
+    if (!heap)
+        err(1, "malloc");
+    memset(heap, 1, size);
+
+    start_clock();
+    for (long i = 0; i < g_iterations; i++) {
+        pid_t pid = fork();
+        if (pid < 0)
+            err(1, "fork");
+        if (pid == 0)
+            _exit(heap[size - 1] == 1 ? 0 : 1);
+        wait_child(pid, /*expected_signal=*/0);
+    }
+    free(heap);
+}
+
+static void bench_fanout(void) {
+    pid_t* pids = malloc(g_arg * sizeof(*pids));
+    if (!pids)
+        err(1, "malloc");
+
+    start_clock();
+    for (long i = 0; i < g_iterations; i++) {
+        for (long j = 0; j < g_arg; j++) {
+            pids[j] = fork();
+            if (pids[j] < 0)
+                err(1, "fork");
+            if (pids[j] == 0) {
+                execl(g_argv0, g_argv0, "noop", NULL);
+                err(1, "execl %s", g_argv0);
+            }
+        }
+        for (long j = 0; j < g_arg; j++)
+            wait_child(pids[j], /*expected_signal=*/0);
+    }
+    free(pids);
+}
+
+static void bench_kill(void) {
+    pid_t* pids = malloc(g_arg * sizeof(*pids));
+    if (!pids)
+        err(1, "malloc");
+
+    start_clock();
+    for (long i = 0; i < g_iterations; i++) {
+        for (long j = 0; j < g_arg; j++) {
+            pids[j] = fork();
+            if (pids[j] < 0)
+                err(1, "fork");
+            if (pids[j] == 0) {
+                while (1)
+                    pause();
+            }
+        }
+        for (long j = 0; j < g_arg; j++)
+            if (kill(pids[j], SIGTERM) < 0)
+                err(1, "kill");
+        for (long j = 0; j < g_arg; j++)
+            wait_child(pids[j], /*expected_signal=*/SIGTERM);
+    }
+    free(pids);
+}
+
+static void sem_op(int semid, unsigned short num, short op) {
+    struct sembuf sop = {.sem_num = num, .sem_op = op, .sem_flg = 0};
+    while (semop(semid, &sop, 1) < 0)
+        if (errno != EINTR)
+            err(1, "semop");
+}
+
+static void bench_sem(void) {
+    /* semaphore 0 is "ping" (parent -> child), semaphore 1 is "pong" (child -> parent) */
+    int semid = semget(IPC_PRIVATE, 2, IPC_CREAT | 0600);
+    if (semid < 0)
+        err(1, "semget");
+
+    pid_t pid = fork();
+    if (pid < 0)
+        err(1, "fork");
+    if (pid == 0) {
+        for (long i = 0; i < g_iterations; i++) {
+            sem_op(semid, 0, -1);
+            sem_op(semid, 1, 1);
+        }
+        _exit(0);
+    }
+
+    start_clock();
+    for (long i = 0; i < g_iterations; i++) {
+        sem_op(semid, 0, 1);
+        sem_op(semid, 1, -1);
+    }
+    wait_child(pid, /*expected_signal=*/0);
+
+    if (semctl(semid, 0, IPC_RMID) < 0)
+        err(1, "semctl");
+}
+
+static void bench_pipe(void) {
+    static char buf[PIPE_CHUNK_SIZE];
+    size_t size = g_arg * 1024;
+
+    int fds[2];
+    if (pipe(fds) < 0)
+        err(1, "pipe");
+
+    pid_t pid = fork();
+    if (pid < 0)
+        err(1, "fork");
+    if (pid == 0) {
+        close(fds[1]);
+        size_t total = 0;
+        while (1) {
+            ssize_t ret = read(fds[0], buf, sizeof(buf));
+            if (ret < 0) {
+                if (errno == EINTR)
+                    continue;
+                err(1, "read");
+            }
+            if (ret == 0)
+                break;
+            total += ret;
+        }
+        _exit(total == size * g_iterations ? 0 : 1);
+    }
+    close(fds[0]);
+
+    start_clock();
+    for (long i = 0; i < g_iterations; i++) {
+        size_t done = 0;
+        while (done < size) {
+            size_t count = size - done < sizeof(buf) ? size - done : sizeof(buf);
+            ssize_t ret = write(fds[1], buf, count);
+            if (ret < 0) {
+                if (errno == EINTR)
+                    continue;
+                err(1, "write");
+            }
+            done += ret;
+        }
+    }
+    close(fds[1]);
+    wait_child(pid, /*expected_signal=*/0);
+}
+
+int main(int argc, char* argv[]) {
+    g_argv0 = argv[0];
+    if (argc == 2 && !strcmp(argv[1], "noop"))
+        return 0;
+
+    if (argc < 3) {
+        usage(argv[0]);
+        return 2;
+    }
+    const char* op = argv[1];
+    bool has_arg = strcmp(op, "sem") != 0;
+    if (argc != (has_arg ? 4 : 3)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    errno = 0;
+    g_iterations = strtol(argv[2], NULL, 0);
+    if (has_arg)
+        g_arg = strtol(argv[3], NULL, 0);
+    if (errno != 0 || g_iterations <= 0 || (has_arg && g_arg <= 0)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    double units = g_iterations;
+    if (!strcmp(op, "fork")) {
+        bench_fork();
+    } else if (!strcmp(op, "fanout")) {
+        bench_fanout();
+    } else if (!strcmp(op, "kill")) {
+        bench_kill();
+    } else if (!strcmp(op, "sem")) {
+        bench_sem();
+    } else if (!strcmp(op, "pipe")) {
+        bench_pipe();
+        units = (double)g_iterations * g_arg / 1024;
+    } else {
+        usage(argv[0]);
+        return 2;
+    }
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double elapsed = (end.tv_sec - g_start.tv_sec) + (end.tv_nsec - g_start.tv_nsec) / 1e9;
+    printf("%.0f\n", units / elapsed);
+    return 0;
+}
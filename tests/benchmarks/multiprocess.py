@@ -0,0 +1,68 @@
+# SPDX-License-Identifier: LGPL-3.0-or-later
+# Copyright (c) 2021 Intel Corporation
+
+import subprocess
+
+from . import Exec
+
+# pylint: disable=invalid-name
+
+class _Multiprocess:
+    # pylint: disable=no-self-use
+
+    multiprocess = Exec('multiprocess', manifest_template='multiprocess.manifest.template')
+    envs = ['native', 'nosgx', 'sgx']
+    setup = multiprocess.setup
+
+    def run(self, env, *args):
+        if env == 'native':
+            proc = self.multiprocess.run_native(*args, stdout=subprocess.PIPE)
+        else:
+            proc = self.multiprocess.run_in_graphene(*args, sgx=(env == 'sgx'),
+                stdout=subprocess.PIPE)
+        return float(proc.stdout.decode().split()[-1])
+
+class Fork(_Multiprocess):
+    params = [[1, 16, 128, 512], _Multiprocess.envs]
+    param_names = ['heap_mb', 'env']
+    iterations = 10
+
+    def track_forks_per_sec(self, heap_mb, env):
+        return self.run(env, 'fork', str(self.iterations), str(heap_mb))
+    track_forks_per_sec.unit = 'forks/s'
+
+class Fanout(_Multiprocess):
+    params = [[1, 4, 8], _Multiprocess.envs]
+    param_names = ['children', 'env']
+    iterations = 5
+
+    def track_rounds_per_sec(self, children, env):
+        return self.run(env, 'fanout', str(self.iterations), str(children))
+    track_rounds_per_sec.unit = 'rounds/s'
+
+class KillWait(_Multiprocess):
+    params = [[1, 4, 8], _Multiprocess.envs]
+    param_names = ['children', 'env']
+    iterations = 5
+
+    def track_rounds_per_sec(self, children, env):
+        return self.run(env, 'kill', str(self.iterations), str(children))
+    track_rounds_per_sec.unit = 'rounds/s'
+
+class SemPingPong(_Multiprocess):
+    params = [_Multiprocess.envs]
+    param_names = ['env']
+    iterations = 10000
+
+    def track_round_trips_per_sec(self, env):
+        return self.run(env, 'sem', str(self.iterations))
+    track_round_trips_per_sec.unit = 'round trips/s'
+
+class PipeThroughput(_Multiprocess):
+    params = [[64, 1024, 16384], _Multiprocess.envs]
+    param_names = ['size_kb', 'env']
+    iterations = 16
+
+    def track_throughput(self, size_kb, env):
+        return self.run(env, 'pipe', str(self.iterations), str(size_kb))
+    track_throughput.unit = 'MB/s'
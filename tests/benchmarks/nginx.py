@@ -29,8 +29,8 @@ import subprocess
 
 from . import Exec, which
 
-NGINX = shlex.split(os.getenv('NGINX', 'nginx -p {} -c nginx.conf'.format(
-    shlex.quote(os.fspath(pathlib.Path(os.getenv('ASV_CONF_DIR')) / 'benchmarks')))))
+CONF_DIR = os.fspath(pathlib.Path(os.getenv('ASV_CONF_DIR')) / 'benchmarks')
+NGINX = shlex.split(os.getenv('NGINX', 'nginx -p {} -c nginx.conf'.format(shlex.quote(CONF_DIR))))
 AB = shlex.split(os.getenv('AB', 'ab -dSqk -n 10000 http://127.0.0.1:8002/random/10K.1.html'))
 
 def _parse_line(line):
@@ -54,7 +54,8 @@ def _run_ab(metric, concurrency):
     raise RuntimeError(f'metric not found: {metric!r}')
 
 class Nginx:
-    nginx = Exec(which(NGINX[0]), manifest_template='nginx.manifest.template')
+    nginx = Exec(which(NGINX[0]), manifest_template='nginx.manifest.template',
+        THREADS=8, RPC_THREADS=0, CONFDIR=CONF_DIR)
     _metric = {
         'latency': 'Time per request',
         'throughput': 'Requests per second',
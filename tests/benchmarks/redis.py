@@ -41,7 +41,8 @@ def _run_benchmark(t): # pylint: disable=inconsistent-return-statements
 class Redis:
     # pylint: disable=no-self-use
 
-    redis_server = Exec(which(REDIS_SERVER[0]), manifest_template='redis-server.manifest.template')
+    redis_server = Exec(which(REDIS_SERVER[0]), manifest_template='redis-server.manifest.template',
+        THREADS=8, RPC_THREADS=0)
     params = [
         'PING_INLINE', 'PING_BULK', 'SET', 'GET', 'INCR', 'LPUSH', 'RPUSH', 'LPOP',
         'RPOP', 'SADD', 'HSET', 'SPOP', 'LPUSH', 'LRANGE_100', 'LRANGE_300',
@@ -0,0 +1,51 @@
+# SPDX-License-Identifier: LGPL-3.0-or-later
+# Copyright (c) 2021 Intel Corporation
+
+import json
+import time
+
+from . import Exec
+
+# pylint: disable=invalid-name
+
+# 'wall' is the whole run as seen by the host (including the application and exit), 'total' is the
+# part reported by Graphene, up to the entry to the application; the others are the phases reported
+# by Graphene (see `libos.startup_stats_file`)
+PHASES = ['wall', 'total', 'enclave creation', 'enclave pages adding', 'enclave initialization',
+          'manifest parsing', 'trusted and protected files setup', 'PAL initialization',
+          'LibOS initialization', 'executable loading', 'interpreter loading', 'application entry']
+
+def run_startup(exe, phase, *args, sgx):
+    '''Runs `exe` (an `Exec` with `libos.startup_stats_file` in its manifest) in Graphene, returns
+    the duration of `phase` in ms.'''
+    stats_path = exe.benchmarks_path / 'startup_stats.json'
+    start = time.monotonic()
+    exe.run_in_graphene(*args, sgx=sgx)
+    wall_us = (time.monotonic() - start) * 1000000
+    if phase == 'wall':
+        return wall_us / 1000
+
+    with open(stats_path) as file:
+        stats = json.load(file)
+    if phase == 'total':
+        return stats['total_us'] / 1000
+    for entry in stats['phases']:
+        if entry['name'] == phase:
+            return entry['us'] / 1000
+    return float('nan')
+
+class Startup:
+    # pylint: disable=no-self-use
+
+    startup = Exec('helloworld', manifest_template='startup.manifest.template')
+    setup = startup.setup
+    params = [PHASES]
+    param_names = ['phase']
+
+    def track_startup_ms_nosgx(self, phase):
+        return run_startup(self.startup, phase, sgx=False)
+    track_startup_ms_nosgx.unit = 'ms'
+
+    def track_startup_ms_sgx(self, phase):
+        return run_startup(self.startup, phase, sgx=True)
+    track_startup_ms_sgx.unit = 'ms'
@@ -0,0 +1,171 @@
+# SPDX-License-Identifier: LGPL-3.0-or-later
+# Copyright (c) 2021 Intel Corporation
+
+'''
+Startup of real applications
+----------------------------
+
+Time to ready of applications much bigger than ``helloworld``, split into the startup phases
+reported by Graphene (see ``startup.py``):
+
+- ``python``: ``import numpy, pandas``,
+- ``java``: hello world (``Hello.java``) in the JVM,
+- ``node``: ``console.log()`` in Node.js,
+- ``go``: hello world (``hello_go.go``) built as a static binary.
+
+The applications are used from the host (only ``Hello.java`` and ``hello_go.go`` are built, in
+``setup``). Applications which are not installed are skipped. They can be configured with the
+following environment variables:
+
+.. envvar:: PYTHON
+    Python interpreter, with NumPy and pandas installed. Default is ``python3``.
+
+.. envvar:: JAVA
+    Java launcher; ``javac`` is taken from the same directory. Default is ``java``.
+
+.. envvar:: NODE
+    Node.js. Default is ``node``.
+
+.. envvar:: GO
+    Go toolchain. Default is ``go``.
+'''
+
+import os
+import pathlib
+import shutil
+import subprocess
+
+from . import Exec
+from .startup import PHASES, run_startup
+
+# pylint: disable=invalid-name
+
+def _find(envvar, default):
+    path = shutil.which(os.getenv(envvar, default))
+    if not path:
+        raise NotImplementedError('{} not found'.format(os.getenv(envvar, default)))
+    return pathlib.Path(path).resolve()
+
+def _is_nonpie(path):
+    with open(path, 'rb') as file:
+        header = file.read(18)
+    # e_type of the ELF header
+    return header[:4] == b'\x7fELF' and int.from_bytes(header[16:18], 'little') == 2 # ET_EXEC
+
+USR = pathlib.Path('/usr')
+
+def _top_dirs(dirs):
+    '''The directories of `dirs` which are not inside another one.'''
+    dirs = set(dirs)
+    return sorted(d for d in dirs if not any(p in d.parents for p in dirs))
+
+def _manifest_vars(entrypoint, mounts, trusted, enclave_size, threads, stack_size='2M'):
+    '''Template variables of startup_app.manifest.template: `mounts` are host directories mounted
+    at the same path (with the one of `entrypoint`), `trusted` are host files and directories
+    (relative ones are in the directory where the benchmark runs).'''
+    mount_lines = []
+    for i, path in enumerate(_top_dirs([*mounts, entrypoint.parent])):
+        mount_lines += [
+            'fs.mount.app{}.type = chroot'.format(i),
+            'fs.mount.app{}.path = "{}"'.format(i, path),
+            'fs.mount.app{}.uri = "file:{}"'.format(i, path),
+        ]
+    trusted_lines = ['sgx.trusted_files.app{} = "file:{}{}"'.format(
+                         i, path, '/' if path.is_absolute() and path.is_dir() else '')
+                     for i, path in enumerate(trusted)]
+    return {
+        'ENTRYPOINT': os.fspath(entrypoint),
+        'MOUNTS': '\n'.join(mount_lines),
+        'TRUSTED_FILES': '\n'.join(trusted_lines),
+        'ENCLAVE_SIZE': enclave_size,
+        'THREADS': threads,
+        'STACK_SIZE': stack_size,
+        'NONPIE_BINARY': 'true' if _is_nonpie(entrypoint) else 'false',
+    }
+
+def _python(build_path):
+    # pylint: disable=unused-argument
+    python = _find('PYTHON', 'python3')
+    proc = subprocess.run([os.fspath(python), '-c',
+                           'import sys, numpy, pandas; print("\\n".join(sys.path))'],
+                          stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+    if proc.returncode != 0:
+        raise NotImplementedError('NumPy or pandas not installed for {}'.format(python))
+
+    paths = {pathlib.Path(p).resolve() for p in proc.stdout.decode().split('\n') if p}
+    paths = [p for p in paths if p.is_dir()]
+    return Exec(python, manifest_template='startup_app.manifest.template',
+                **_manifest_vars(python, mounts=[USR, *paths],
+                                 trusted=[python, *_top_dirs(paths)],
+                                 enclave_size='4G', threads=64)), \
+           ['-c', 'import numpy, pandas']
+
+def _java(build_path):
+    java = _find('JAVA', 'java')
+    javac = java.parent / 'javac'
+    if not javac.exists():
+        raise NotImplementedError('{} not found'.format(javac))
+    subprocess.run([os.fspath(javac), '-d', os.fspath(build_path),
+                    os.fspath(pathlib.Path(__file__).parent / 'Hello.java')], check=True)
+
+    java_home = java.parent.parent
+    return Exec(java, manifest_template='startup_app.manifest.template',
+                **_manifest_vars(java, mounts=[USR, java_home],
+                                 trusted=[java_home, pathlib.Path('Hello.class')],
+                                 enclave_size='8G', threads=64)), \
+           ['-Xmx256m', '-XX:+UseSerialGC', '-cp', '.', 'Hello']
+
+def _node(build_path):
+    # pylint: disable=unused-argument
+    node = _find('NODE', 'node')
+    return Exec(node, manifest_template='startup_app.manifest.template',
+                **_manifest_vars(node, mounts=[USR],
+                                 trusted=[node], enclave_size='4G', threads=32)), \
+           ['-e', 'console.log("Hello world")']
+
+def _go(build_path):
+    go = _find('GO', 'go')
+    hello = build_path / 'hello_go'
+    subprocess.run([os.fspath(go), 'build', '-o', os.fspath(hello),
+                    os.fspath(pathlib.Path(__file__).parent / 'hello_go.go')],
+                   check=True, env={**os.environ, 'CGO_ENABLED': '0'})
+    return Exec(hello, manifest_template='startup_app.manifest.template',
+                **_manifest_vars(hello, mounts=[], trusted=[hello], enclave_size='1G',
+                                 threads=16)), \
+           []
+
+APPS = {
+    'python': _python,
+    'java': _java,
+    'node': _node,
+    'go': _go,
+}
+
+# manifests are signed once per process, not for each phase
+_prepared = {}
+
+class AppStartup:
+    # pylint: disable=no-self-use,attribute-defined-outside-init
+
+    params = [list(APPS), PHASES]
+    param_names = ['app', 'phase']
+
+    def setup(self, app, phase):
+        # pylint: disable=unused-argument
+        if app not in _prepared:
+            build_path = pathlib.Path(os.environ['ASV_BUILD_DIR']) / 'tests/benchmarks'
+            build_path.mkdir(parents=True, exist_ok=True)
+            exe, args = APPS[app](build_path)
+            exe.setup()
+            _prepared[app] = exe, args
+        self.exe, self.args = _prepared[app]
+
+    def track_startup_ms_nosgx(self, app, phase):
+        # pylint: disable=unused-argument
+        return run_startup(self.exe, phase, *self.args, sgx=False)
+    track_startup_ms_nosgx.unit = 'ms'
+
+    def track_startup_ms_sgx(self, app, phase):
+        # pylint: disable=unused-argument
+        return run_startup(self.exe, phase, *self.args, sgx=True)
+    track_startup_ms_sgx.unit = 'ms'